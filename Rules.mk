@@ -42,6 +42,16 @@ FLOAT_ABI ?= hard
 # set this to 1 to enable garbage collection on sections, may cause side effects
 GC_SECTIONS ?= 0
 
+# set this to 1 to enable link-time optimization (see doc/build-optimization.txt)
+LTO ?= 0
+
+# set this to "generate" or "use" for profile-guided optimization (requires GCC 12+)
+PGO ?=
+
+# objects, which are compiled with HOTOPTIMIZE instead of OPTIMIZE (e.g. "util_fast.o")
+HOTPATH ?=
+HOTOPTIMIZE ?= -O3
+
 CC	= $(PREFIX)gcc
 CPP	= $(PREFIX)g++
 AS	= $(CC)
@@ -115,6 +125,22 @@ CFLAGS	+= -ffunction-sections -fdata-sections
 LDFLAGS	+= --gc-sections
 endif
 
+ifeq ($(strip $(LTO)),1)
+CFLAGS	+= -flto -fno-fat-lto-objects
+AR	= $(PREFIX)gcc-ar
+endif
+
+ifeq ($(strip $(PGO)),generate)
+CFLAGS	+= -fprofile-arcs -fprofile-info-section
+LIBGCOV	  = "$(shell $(CPP) $(ARCH) -print-file-name=libgcov.a)"
+EXTRALIBS += $(LIBGCOV)
+else ifeq ($(strip $(PGO)),use)
+CFLAGS	+= -fprofile-use -fno-profile-values -fprofile-partial-training \
+	   -Wno-missing-profile
+else ifneq ($(strip $(PGO)),)
+$(error PGO must be set to generate or use)
+endif
+
 OPTIMIZE ?= -O2
 STANDARD ?= -std=c++14 -Wno-aligned-new
 
@@ -132,17 +158,19 @@ ifeq ($(strip $(CHECK_DEPS)),1)
 DEPS	= $(OBJS:.o=.d)
 endif
 
+COMMA	= ,
+
 %.o: %.S
 	@echo "  AS    $@"
 	@$(AS) $(AFLAGS) -c -o $@ $<
 
 %.o: %.c
 	@echo "  CC    $@"
-	@$(CC) $(CFLAGS) -std=gnu99 -c -o $@ $<
+	@$(CC) $(CFLAGS) $(if $(filter $@,$(HOTPATH)),$(HOTOPTIMIZE)) -std=gnu99 -c -o $@ $<
 
 %.o: %.cpp
 	@echo "  CPP   $@"
-	@$(CPP) $(CPPFLAGS) -c -o $@ $<
+	@$(CPP) $(CPPFLAGS) $(if $(filter $@,$(HOTPATH)),$(HOTOPTIMIZE)) -c -o $@ $<
 
 %.d: %.S
 	@$(AS) $(AFLAGS) -M -MG -MT $*.o -MT $@ -MF $@ $<
@@ -155,9 +183,16 @@ endif
 
 $(TARGET).img: $(OBJS) $(LIBS) $(CIRCLEHOME)/circle.ld
 	@echo "  LD    $(TARGET).elf"
+ifeq ($(strip $(LTO)),1)
+	@$(CPP) $(ARCH) $(OPTIMIZE) -flto=auto -nostdlib -nostartfiles \
+		-o $(TARGET).elf -Wl,-Map,$(TARGET).map $(addprefix -Wl$(COMMA),$(LDFLAGS)) \
+		-T $(CIRCLEHOME)/circle.ld $(CRTBEGIN) $(OBJS) \
+		-Wl,--start-group $(LIBS) $(EXTRALIBS) -Wl,--end-group $(CRTEND)
+else
 	@$(LD) -o $(TARGET).elf -Map $(TARGET).map $(LDFLAGS) \
 		-T $(CIRCLEHOME)/circle.ld $(CRTBEGIN) $(OBJS) \
 		--start-group $(LIBS) $(EXTRALIBS) --end-group $(CRTEND)
+endif
 	@echo "  DUMP  $(TARGET).lst"
 	@$(PREFIX)objdump -d $(TARGET).elf | $(PREFIX)c++filt > $(TARGET).lst
 	@echo "  COPY  $(TARGET).img"
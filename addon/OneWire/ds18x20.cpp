@@ -165,25 +165,38 @@ boolean CDS18x20::DoMeasurement (void)
 		return FALSE;
 	}
 	
+	int nCelsius = GetRawTemperature (Data, m_bIs18S20) * 10 / 16;
+	unsigned nFahrenheit = (nCelsius * 18) / 10 + 320;
+
+	m_fCelsius = nCelsius / 10.0;
+	m_fFahrenheit = nFahrenheit / 10.0;
+
+	return TRUE;
+}
+
+short CDS18x20::GetRawTemperature (const u8 *pScratchpad, boolean bIs18S20)
+{
+	assert (pScratchpad != 0);
+
 	// Convert the data to actual temperature
 	// because the result is a 16 bit signed integer, it should
 	// be stored to an "int16_t" type, which is always 16 bits
 	// even when compiled on a 32 bit processor.
-	short nRaw = (Data[1] << 8) | Data[0];
+	short nRaw = (pScratchpad[1] << 8) | pScratchpad[0];
 
-	if (m_bIs18S20)
+	if (bIs18S20)
 	{
 		nRaw = nRaw << 3;		// 9 bit resolution default
 
-		if (Data[7] == 0x10)
+		if (pScratchpad[7] == 0x10)
 		{
 			// "count remain" gives full 12 bit resolution
-			nRaw = (nRaw & 0xFFF0) + 12 - Data[6];
+			nRaw = (nRaw & 0xFFF0) + 12 - pScratchpad[6];
 		}
 	}
 	else
 	{
-		u8 ucConfig = Data[4] & 0x60;
+		u8 ucConfig = pScratchpad[4] & 0x60;
 
 		// at lower res, the low bits are undefined, so let's zero them
 		if (ucConfig == 0x00)
@@ -202,13 +215,7 @@ boolean CDS18x20::DoMeasurement (void)
 		// default is 12 bit resolution, 750 ms conversion time
 	}
 
-	int nCelsius = nRaw * 10 / 16;
-	unsigned nFahrenheit = (nCelsius * 18) / 10 + 320;
-
-	m_fCelsius = nCelsius / 10.0;
-	m_fFahrenheit = nFahrenheit / 10.0;
-
-	return TRUE;
+	return nRaw;
 }
 
 float CDS18x20::GetCelsius (void) const
@@ -25,6 +25,11 @@ public:
 	float GetCelsius (void) const;
 	float GetFahrenheit (void) const;
 
+	/// \param pScratchpad Pointer to the 9 bytes read from the scratchpad
+	/// \param bIs18S20 Is it a DS18S20 (or DS1820)?
+	/// \return Temperature in units of 1/16 degrees Celsius
+	static short GetRawTemperature (const u8 *pScratchpad, boolean bIs18S20);
+
 private:
 	OneWire *m_pOneWire;
 	boolean  m_bSearch;
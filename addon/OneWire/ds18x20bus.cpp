@@ -0,0 +1,257 @@
+//
+// ds18x20bus.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <OneWire/ds18x20bus.h>
+#include <OneWire/ds18x20.h>
+#include <OneWire/OneWire.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define FAMILY_DS18S20		0x10
+#define FAMILY_DS18B20		0x28
+#define FAMILY_DS1822		0x22
+
+#define CONVERT_T		0x44
+#define READ_SCRATCHPAD		0xBE
+
+CDS18x20Bus::CDS18x20Bus (COneWireMaster *pMaster)
+:	m_pMaster (pMaster),
+	m_nSensors (0),
+	m_State (StateIdle)
+{
+	assert (m_pMaster != 0);
+}
+
+CDS18x20Bus::~CDS18x20Bus (void)
+{
+	assert (m_State == StateIdle);
+
+	m_pMaster = 0;
+}
+
+unsigned CDS18x20Bus::Scan (void)
+{
+	assert (m_State == StateIdle);
+
+	unsigned nFound = 0;
+
+	u8 Address[8];
+	for (boolean bFirst = TRUE; m_pMaster->Search (Address, bFirst); bFirst = FALSE)
+	{
+		if (AddSensor (Address))
+		{
+			nFound++;
+		}
+	}
+
+	return nFound;
+}
+
+boolean CDS18x20Bus::AddSensor (const u8 *pAddress)
+{
+	assert (pAddress != 0);
+
+	if (   m_nSensors >= DS18X20_MAX_SENSORS
+	    || OneWire::crc8 (pAddress, 7) != pAddress[7])
+	{
+		return FALSE;
+	}
+
+	TSensor *pSensor = &m_Sensor[m_nSensors];
+
+	switch (pAddress[0])
+	{
+	case FAMILY_DS18S20:
+		pSensor->bIs18S20 = TRUE;
+		break;
+
+	case FAMILY_DS18B20:
+	case FAMILY_DS1822:
+		pSensor->bIs18S20 = FALSE;
+		break;
+
+	default:
+		return FALSE;
+	}
+
+	memcpy (pSensor->Address, pAddress, sizeof pSensor->Address);
+	pSensor->bValid = FALSE;
+	pSensor->nRawTemperature = 0;
+
+	m_nSensors++;
+
+	return TRUE;
+}
+
+unsigned CDS18x20Bus::GetSensorCount (void) const
+{
+	return m_nSensors;
+}
+
+const u8 *CDS18x20Bus::GetAddress (unsigned nIndex) const
+{
+	assert (nIndex < m_nSensors);
+
+	return m_Sensor[nIndex].Address;
+}
+
+boolean CDS18x20Bus::StartMeasurement (void)
+{
+	if (m_State != StateIdle)
+	{
+		return FALSE;
+	}
+
+	// all sensors start the conversion at once
+	m_TxBuffer[0] = ONEWIRE_SKIP_ROM;
+	m_TxBuffer[1] = CONVERT_T;
+
+	memset (&m_Transaction, 0, sizeof m_Transaction);
+	m_Transaction.bReset = TRUE;
+	m_Transaction.pTxData = m_TxBuffer;
+	m_Transaction.nTxBits = 2*8;
+
+	if (!m_pMaster->Submit (&m_Transaction))
+	{
+		return FALSE;
+	}
+
+	m_State = StateConverting;
+
+	return TRUE;
+}
+
+void CDS18x20Bus::Update (void)
+{
+	m_pMaster->Update ();
+
+	switch (m_State)
+	{
+	case StateIdle:
+		break;
+
+	case StateConverting:
+		if (!m_Transaction.bDone)
+		{
+			break;
+		}
+
+		if (!m_Transaction.bStatus)
+		{
+			for (unsigned i = 0; i < m_nSensors; i++)
+			{
+				m_Sensor[i].bValid = FALSE;
+			}
+
+			m_State = StateIdle;
+
+			break;
+		}
+
+		m_nStartTicks = CTimer::GetClockTicks ();
+		m_State = StateWaiting;
+		break;
+
+	case StateWaiting:
+		if (CTimer::GetClockTicks () - m_nStartTicks < DS18X20_CONVERSION_MS * (CLOCKHZ / 1000))
+		{
+			break;
+		}
+
+		m_nReadIndex = 0;
+		m_State = StateReading;
+		ReadNextSensor ();
+		break;
+
+	case StateReading: {
+		if (!m_Transaction.bDone)
+		{
+			break;
+		}
+
+		assert (m_nReadIndex < m_nSensors);
+		TSensor *pSensor = &m_Sensor[m_nReadIndex];
+
+		pSensor->bValid =    m_Transaction.bStatus
+				  && OneWire::crc8 (m_Scratchpad, 8) == m_Scratchpad[8];
+		if (pSensor->bValid)
+		{
+			pSensor->nRawTemperature =
+				CDS18x20::GetRawTemperature (m_Scratchpad, pSensor->bIs18S20);
+		}
+
+		m_nReadIndex++;
+		ReadNextSensor ();
+		} break;
+
+	default:
+		assert (0);
+		break;
+	}
+}
+
+boolean CDS18x20Bus::IsMeasurementDone (void) const
+{
+	return m_State == StateIdle;
+}
+
+boolean CDS18x20Bus::GetCelsius (unsigned nIndex, float *pCelsius) const
+{
+	assert (nIndex < m_nSensors);
+	const TSensor *pSensor = &m_Sensor[nIndex];
+
+	if (!pSensor->bValid)
+	{
+		return FALSE;
+	}
+
+	assert (pCelsius != 0);
+	*pCelsius = pSensor->nRawTemperature / 16.0f;
+
+	return TRUE;
+}
+
+void CDS18x20Bus::ReadNextSensor (void)
+{
+	if (m_nReadIndex >= m_nSensors)
+	{
+		m_State = StateIdle;
+
+		return;
+	}
+
+	m_TxBuffer[0] = ONEWIRE_MATCH_ROM;
+	memcpy (&m_TxBuffer[1], m_Sensor[m_nReadIndex].Address, 8);
+	m_TxBuffer[9] = READ_SCRATCHPAD;
+
+	memset (&m_Transaction, 0, sizeof m_Transaction);
+	m_Transaction.bReset = TRUE;
+	m_Transaction.pTxData = m_TxBuffer;
+	m_Transaction.nTxBits = 10*8;
+	m_Transaction.pRxData = m_Scratchpad;
+	m_Transaction.nRxBits = 9*8;
+
+	// the queue is empty here, because only one transaction is used at a time
+#ifndef NDEBUG
+	boolean bOK =
+#endif
+		m_pMaster->Submit (&m_Transaction);
+	assert (bOK);
+}
@@ -0,0 +1,104 @@
+//
+// ds18x20bus.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _OneWire_ds18x20bus_h
+#define _OneWire_ds18x20bus_h
+
+#include <OneWire/onewiremaster.h>
+#include <circle/types.h>
+
+#define DS18X20_MAX_SENSORS		64
+#define DS18X20_CONVERSION_MS		750	// for 12 bit resolution (default)
+
+/// \note All sensors on the bus convert in parallel, started with a single Skip ROM / Convert T
+///	  command. The results are read one sensor after the other afterwards. Nothing blocks
+///	  besides Scan(), so that the measurement takes about one conversion time in total.
+/// \note The sensors must be externally powered. DS18x20 sensors do not support overdrive
+///	  speed, so the bus has to be at standard speed.
+
+class CDS18x20Bus		/// Non-blocking driver for many DS18x20 temperature sensors on one bus
+{
+public:
+	/// \param pMaster Pointer to the 1-Wire bus master
+	CDS18x20Bus (COneWireMaster *pMaster);
+	~CDS18x20Bus (void);
+
+	/// \brief Search the bus for DS18x20 sensors and add them (blocking)
+	/// \return Number of sensors found
+	unsigned Scan (void);
+
+	/// \param pAddress Pointer to 8-byte address array of a known sensor
+	/// \return FALSE if the address is not valid or too many sensors
+	boolean AddSensor (const u8 *pAddress);
+
+	unsigned GetSensorCount (void) const;
+	const u8 *GetAddress (unsigned nIndex) const;
+
+	/// \brief Start the conversion on all sensors
+	/// \return FALSE if a measurement is already running
+	boolean StartMeasurement (void);
+
+	/// \brief Advance the measurement, never blocks
+	/// \note Has to be called often (calls COneWireMaster::Update() too).
+	void Update (void);
+
+	/// \return Is no measurement running?
+	boolean IsMeasurementDone (void) const;
+
+	/// \param nIndex Index of the sensor (0..GetSensorCount()-1)
+	/// \param pCelsius Receives the result of the last measurement
+	/// \return FALSE if the sensor did not respond or the CRC was invalid
+	boolean GetCelsius (unsigned nIndex, float *pCelsius) const;
+
+private:
+	void ReadNextSensor (void);
+
+private:
+	COneWireMaster *m_pMaster;
+
+	struct TSensor
+	{
+		u8	Address[8];
+		boolean	bIs18S20;
+		boolean	bValid;
+		short	nRawTemperature;		// 1/16 degrees Celsius
+	};
+
+	TSensor m_Sensor[DS18X20_MAX_SENSORS];
+	unsigned m_nSensors;
+
+	enum TState
+	{
+		StateIdle,
+		StateConverting,
+		StateWaiting,
+		StateReading,
+		StateUnknown
+	};
+
+	TState m_State;
+	unsigned m_nStartTicks;
+	unsigned m_nReadIndex;
+
+	TOneWireTransaction m_Transaction;
+	u8 m_TxBuffer[10];
+	u8 m_Scratchpad[9];
+};
+
+#endif
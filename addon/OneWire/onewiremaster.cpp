@@ -0,0 +1,431 @@
+//
+// onewiremaster.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <OneWire/onewiremaster.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#include <assert.h>
+
+// The reset character 0xF0 holds the bus low for 5 bit periods (start bit and 4 data bits)
+#define RESET_BAUD_STANDARD	9600		// 520us low
+#define RESET_BAUD_OVERDRIVE	66667		// 75us low
+
+// The slot character 0x00 holds the bus low for 9 bit periods, 0xFF for one bit period
+#define SLOT_BAUD_STANDARD	115200		// write 0: 78us, write 1 / read: 8.7us
+#define SLOT_BAUD_OVERDRIVE	1000000		// write 0: 9us, write 1 / read: 1us
+
+#define RESET_CHAR		0xF0
+#define SLOT_CHAR_0		0x00
+#define SLOT_CHAR_1		0xFF
+
+#define MAX_SLOTS_PER_UPDATE	64
+
+COneWireMaster::COneWireMaster (CSerialDevice *pSerial)
+:	m_pSerial (pSerial),
+	m_State (StateIdle),
+	m_Speed (SpeedStandard),
+	m_nBaudrate (0),
+	m_pCurrent (0),
+	m_nLastDiscrepancy (0),
+	m_bLastDevice (FALSE)
+{
+	assert (m_pSerial != 0);
+	m_pSerial->SetOptions (0);		// no NL translation
+}
+
+COneWireMaster::~COneWireMaster (void)
+{
+	m_pCurrent = 0;
+	m_pSerial = 0;
+}
+
+boolean COneWireMaster::Submit (TOneWireTransaction *pTransaction)
+{
+	assert (pTransaction != 0);
+	assert (pTransaction->nTxBits == 0 || pTransaction->pTxData != 0);
+	assert (pTransaction->nRxBits == 0 || pTransaction->pRxData != 0);
+
+	pTransaction->bDone = FALSE;
+	pTransaction->bStatus = FALSE;
+
+	return m_Queue.Put (pTransaction);
+}
+
+void COneWireMaster::Update (void)
+{
+	if (m_State == StateIdle)
+	{
+		if (!m_Queue.Get (&m_pCurrent))
+		{
+			return;
+		}
+
+		Start ();
+	}
+
+	assert (m_pCurrent != 0);
+
+	if (CTimer::GetClockTicks () - m_nStartTicks > ONEWIRE_TIMEOUT_MS * (CLOCKHZ / 1000))
+	{
+		Complete (FALSE);
+
+		return;
+	}
+
+	switch (m_State)
+	{
+	case StateReset: {
+		u8 uchEcho;
+		int nResult = m_pSerial->Read (&uchEcho, 1);
+		if (nResult == 0)
+		{
+			break;
+		}
+
+		// a device pulls the bus low during the reset character, if present
+		if (   nResult < 0
+		    || uchEcho == RESET_CHAR)
+		{
+			Complete (FALSE);
+
+			break;
+		}
+
+		if (m_nSlots == 0)
+		{
+			Complete (TRUE);
+
+			break;
+		}
+
+		m_State = StateSlots;
+		SetBaudrate (m_Speed == SpeedStandard ? SLOT_BAUD_STANDARD : SLOT_BAUD_OVERDRIVE);
+		FeedSlots ();
+		} break;
+
+	case StateSlots: {
+		u8 Echo[MAX_SLOTS_PER_UPDATE];
+		unsigned nPending = m_nSlotsSent - m_nSlotsDone;
+		int nResult = m_pSerial->Read (Echo, nPending < sizeof Echo ? nPending : sizeof Echo);
+		if (nResult < 0)
+		{
+			Complete (FALSE);
+
+			break;
+		}
+
+		for (int i = 0; i < nResult; i++, m_nSlotsDone++)
+		{
+			if (m_nSlotsDone < m_pCurrent->nTxBits)
+			{
+				continue;
+			}
+
+			// a device pulls the bus low during the read slot to send a 0
+			if (Echo[i] == SLOT_CHAR_1)
+			{
+				unsigned nBit = m_nSlotsDone - m_pCurrent->nTxBits;
+				m_pCurrent->pRxData[nBit / 8] |= 1 << (nBit % 8);
+			}
+		}
+
+		if (m_nSlotsDone == m_nSlots)
+		{
+			Complete (TRUE);
+		}
+		else
+		{
+			FeedSlots ();
+		}
+		} break;
+
+	default:
+		assert (0);
+		break;
+	}
+}
+
+boolean COneWireMaster::IsIdle (void) const
+{
+	return m_State == StateIdle && m_Queue.IsEmpty ();
+}
+
+boolean COneWireMaster::Transfer (TOneWireTransaction *pTransaction)
+{
+	while (!Submit (pTransaction))
+	{
+		Update ();
+	}
+
+	while (!pTransaction->bDone)
+	{
+		Update ();
+	}
+
+	return pTransaction->bStatus;
+}
+
+boolean COneWireMaster::EnterOverdrive (void)
+{
+	u8 uchCommand = ONEWIRE_OVERDRIVE_SKIP_ROM;
+
+	TOneWireTransaction Transaction;
+	memset (&Transaction, 0, sizeof Transaction);
+	Transaction.bReset = TRUE;
+	Transaction.pTxData = &uchCommand;
+	Transaction.nTxBits = 8;
+
+	m_Speed = SpeedStandard;
+	if (!Transfer (&Transaction))
+	{
+		return FALSE;
+	}
+
+	m_Speed = SpeedOverdrive;
+
+	return TRUE;
+}
+
+boolean COneWireMaster::LeaveOverdrive (void)
+{
+	TOneWireTransaction Transaction;
+	memset (&Transaction, 0, sizeof Transaction);
+	Transaction.bReset = TRUE;
+
+	m_Speed = SpeedStandard;
+
+	return Transfer (&Transaction);
+}
+
+COneWireMaster::TSpeed COneWireMaster::GetSpeed (void) const
+{
+	return m_Speed;
+}
+
+// See: Maxim Application Note 187 "1-Wire Search Algorithm"
+boolean COneWireMaster::Search (u8 *pAddress, boolean bFirst)
+{
+	assert (pAddress != 0);
+
+	if (bFirst)
+	{
+		m_nLastDiscrepancy = 0;
+		m_bLastDevice = FALSE;
+		memset (m_ROM, 0, sizeof m_ROM);
+	}
+
+	if (m_bLastDevice)
+	{
+		return FALSE;
+	}
+
+	u8 uchCommand = ONEWIRE_SEARCH_ROM;
+
+	TOneWireTransaction Transaction;
+	memset (&Transaction, 0, sizeof Transaction);
+	Transaction.bReset = TRUE;
+	Transaction.pTxData = &uchCommand;
+	Transaction.nTxBits = 8;
+	if (!Transfer (&Transaction))
+	{
+		m_nLastDiscrepancy = 0;
+
+		return FALSE;
+	}
+
+	unsigned nLastZero = 0;
+	for (unsigned nBit = 1; nBit <= 64; nBit++)
+	{
+		// read the bit and its complement
+		u8 uchBits = 0;
+		memset (&Transaction, 0, sizeof Transaction);
+		Transaction.pRxData = &uchBits;
+		Transaction.nRxBits = 2;
+		if (!Transfer (&Transaction))
+		{
+			return FALSE;
+		}
+
+		u8 *pROMByte = &m_ROM[(nBit-1) / 8];
+		u8 uchMask = 1 << ((nBit-1) % 8);
+
+		u8 uchDirection;
+		switch (uchBits)
+		{
+		case 0:					// discrepancy
+			if (nBit < m_nLastDiscrepancy)
+			{
+				uchDirection = *pROMByte & uchMask ? 1 : 0;
+			}
+			else
+			{
+				uchDirection = nBit == m_nLastDiscrepancy ? 1 : 0;
+			}
+
+			if (uchDirection == 0)
+			{
+				nLastZero = nBit;
+			}
+			break;
+
+		case 1:
+		case 2:
+			uchDirection = uchBits & 1;
+			break;
+
+		default:				// no device
+			m_nLastDiscrepancy = 0;
+			return FALSE;
+		}
+
+		if (uchDirection)
+		{
+			*pROMByte |= uchMask;
+		}
+		else
+		{
+			*pROMByte &= ~uchMask;
+		}
+
+		memset (&Transaction, 0, sizeof Transaction);
+		Transaction.pTxData = &uchDirection;
+		Transaction.nTxBits = 1;
+		if (!Transfer (&Transaction))
+		{
+			return FALSE;
+		}
+	}
+
+	m_nLastDiscrepancy = nLastZero;
+	if (m_nLastDiscrepancy == 0)
+	{
+		m_bLastDevice = TRUE;
+	}
+
+	memcpy (pAddress, m_ROM, sizeof m_ROM);
+
+	return TRUE;
+}
+
+void COneWireMaster::Start (void)
+{
+	assert (m_pCurrent != 0);
+
+	m_nSlots = m_pCurrent->nTxBits + m_pCurrent->nRxBits;
+	m_nSlotsSent = 0;
+	m_nSlotsDone = 0;
+	m_nStartTicks = CTimer::GetClockTicks ();
+
+	if (m_pCurrent->nRxBits > 0)
+	{
+		memset (m_pCurrent->pRxData, 0, (m_pCurrent->nRxBits + 7) / 8);
+	}
+
+	// discard stale echoes
+	u8 Buffer[16];
+	while (m_pSerial->Read (Buffer, sizeof Buffer) != 0)
+	{
+		// do nothing
+	}
+
+	if (m_pCurrent->bReset)
+	{
+		m_State = StateReset;
+		SetBaudrate (m_Speed == SpeedStandard ? RESET_BAUD_STANDARD : RESET_BAUD_OVERDRIVE);
+
+		u8 uchReset = RESET_CHAR;
+		if (m_pSerial->Write (&uchReset, 1) != 1)
+		{
+			Complete (FALSE);
+		}
+	}
+	else
+	{
+		m_State = StateSlots;
+		SetBaudrate (m_Speed == SpeedStandard ? SLOT_BAUD_STANDARD : SLOT_BAUD_OVERDRIVE);
+		FeedSlots ();
+	}
+}
+
+void COneWireMaster::Complete (boolean bStatus)
+{
+	assert (m_pCurrent != 0);
+	TOneWireTransaction *pTransaction = m_pCurrent;
+
+	m_pCurrent = 0;
+	m_State = StateIdle;
+
+	pTransaction->bStatus = bStatus;
+	pTransaction->bDone = TRUE;
+
+	if (pTransaction->pCompletionRoutine != 0)
+	{
+		(*pTransaction->pCompletionRoutine) (bStatus, pTransaction->pParam);
+	}
+}
+
+void COneWireMaster::FeedSlots (void)
+{
+	assert (m_pCurrent != 0);
+
+	// limit the number of slots on the way, so that the receive buffer cannot overflow
+	u8 Slots[MAX_SLOTS_PER_UPDATE];
+	unsigned nCount = 0;
+	while (   m_nSlotsSent + nCount < m_nSlots
+	       && m_nSlotsSent + nCount - m_nSlotsDone < sizeof Slots)
+	{
+		unsigned nSlot = m_nSlotsSent + nCount;
+
+		u8 uchChar = SLOT_CHAR_1;			// read slot
+		if (nSlot < m_pCurrent->nTxBits)
+		{
+			uchChar =   m_pCurrent->pTxData[nSlot / 8] & (1 << (nSlot % 8))
+				  ? SLOT_CHAR_1 : SLOT_CHAR_0;
+		}
+
+		Slots[nCount++] = uchChar;
+	}
+
+	if (nCount == 0)
+	{
+		return;
+	}
+
+	int nResult = m_pSerial->Write (Slots, nCount);
+	if (nResult < 0)
+	{
+		Complete (FALSE);
+
+		return;
+	}
+
+	m_nSlotsSent += nResult;
+}
+
+boolean COneWireMaster::SetBaudrate (unsigned nBaudrate)
+{
+	if (m_nBaudrate == nBaudrate)
+	{
+		return TRUE;
+	}
+
+	m_nBaudrate = nBaudrate;
+
+	return m_pSerial->SetBaudrate (nBaudrate);
+}
@@ -0,0 +1,136 @@
+//
+// onewiremaster.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _OneWire_onewiremaster_h
+#define _OneWire_onewiremaster_h
+
+#include <circle/serial.h>
+#include <circle/fixedring.h>
+#include <circle/types.h>
+
+#define ONEWIRE_QUEUE_SIZE	8		// max. number of pending transactions (power of 2)
+#define ONEWIRE_TIMEOUT_MS	100		// per transaction
+
+#define ONEWIRE_SKIP_ROM		0xCC
+#define ONEWIRE_MATCH_ROM		0x55
+#define ONEWIRE_SEARCH_ROM		0xF0
+#define ONEWIRE_OVERDRIVE_SKIP_ROM	0x3C
+
+/// \note The 1-Wire time slots are generated by the UART: each slot is one character, which
+///	  is echoed from the bus (TXD and RXD connected via an open-drain buffer with pull-up).
+///	  A character 0xFF writes a 1 or reads a bit, 0x00 writes a 0. The reset pulse is a
+///	  character 0xF0 at a lower baud rate, the presence pulse modifies its echo. This way
+///	  no bit timing is done by the CPU and interrupts remain enabled.
+/// \note The serial device must be interrupt driven and initialized before (8N1).
+/// \note Strong pull-up for parasite powered devices is not supported.
+
+typedef void TOneWireCompletionRoutine (boolean bStatus, void *pParam);
+
+struct TOneWireTransaction		/// Reset (optional), write bits, read bits
+{
+	boolean	 bReset;		///< Issue reset and check presence before
+	const u8 *pTxData;		///< Bits to be written (LSB first)
+	unsigned nTxBits;
+	u8	*pRxData;		///< Buffer for bits to be read (LSB first)
+	unsigned nRxBits;
+
+	TOneWireCompletionRoutine *pCompletionRoutine;	///< Called from Update() (or 0)
+	void	*pParam;
+
+	volatile boolean bDone;		///< Set on completion
+	boolean	 bStatus;		///< FALSE on timeout or missing presence pulse
+};
+
+class COneWireMaster		/// Non-blocking 1-Wire bus master, using a UART as slot engine
+{
+public:
+	enum TSpeed
+	{
+		SpeedStandard,
+		SpeedOverdrive,
+		SpeedUnknown
+	};
+
+public:
+	/// \param pSerial Pointer to interrupt driven serial device, initialized before
+	COneWireMaster (CSerialDevice *pSerial);
+	~COneWireMaster (void);
+
+	/// \brief Queue a transaction, the object must persist until completion
+	/// \return FALSE if the queue is full
+	boolean Submit (TOneWireTransaction *pTransaction);
+
+	/// \brief Process the queued transactions, never blocks
+	/// \note Has to be called often (e.g. from the main loop or a task).
+	void Update (void);
+
+	/// \return Are no transactions queued or active?
+	boolean IsIdle (void) const;
+
+	/// \brief Submit and process a transaction until it is completed (blocking)
+	boolean Transfer (TOneWireTransaction *pTransaction);
+
+	/// \brief Switch all overdrive capable devices to overdrive speed (issues Overdrive Skip ROM)
+	/// \note A reset at standard speed switches back. Blocking.
+	boolean EnterOverdrive (void);
+	/// \brief Issue a reset at standard speed to switch back (blocking)
+	boolean LeaveOverdrive (void);
+	TSpeed GetSpeed (void) const;
+
+	/// \brief Search ROM, returns the address of the next device (blocking)
+	/// \param pAddress Pointer to 8-byte address array
+	/// \param bFirst Restart the search
+	/// \return FALSE if no (further) device has been found
+	boolean Search (u8 *pAddress, boolean bFirst = FALSE);
+
+private:
+	void Start (void);
+	void Complete (boolean bStatus);
+	void FeedSlots (void);
+	boolean SetBaudrate (unsigned nBaudrate);
+
+private:
+	CSerialDevice *m_pSerial;
+
+	CFixedRing<TOneWireTransaction *, ONEWIRE_QUEUE_SIZE> m_Queue;
+
+	enum TState
+	{
+		StateIdle,
+		StateReset,
+		StateSlots,
+		StateUnknown
+	};
+
+	TState m_State;
+	TSpeed m_Speed;
+	unsigned m_nBaudrate;
+
+	TOneWireTransaction *m_pCurrent;
+	unsigned m_nSlots;			// total number of slots of current transaction
+	unsigned m_nSlotsSent;
+	unsigned m_nSlotsDone;
+	unsigned m_nStartTicks;
+
+	u8 m_ROM[8];				// search state
+	unsigned m_nLastDiscrepancy;
+	boolean m_bLastDevice;
+};
+
+#endif
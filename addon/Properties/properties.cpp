@@ -22,20 +22,52 @@
 #include <circle/logger.h>
 #include <assert.h>
 
+#define HASH_SIZE_INITIAL	16
+
+#define SNAPSHOT_MAGIC		0x53505250	// "PRPS"
+#define SNAPSHOT_VERSION	1
+
 struct TPropertyPair
 {
 	char *pName;
 	char *pValue;
+	u32 nHash;
+	boolean bNameStatic;			// strings are located in a snapshot
+	boolean bValueStatic;
+	TPropertyPair *pHashNext;
+};
+
+struct TSnapshotHeader
+{
+	u32 nMagic;
+	u32 nVersion;
+	u32 nCount;
+	u32 nSize;				// total size in bytes
+	// TSnapshotEntry[nCount] follows
+	// null-terminated strings follow
+};
+
+struct TSnapshotEntry
+{
+	u32 nHash;
+	u32 nNameOffset;			// from start of snapshot
+	u32 nValueOffset;
 };
 
 CProperties::CProperties (void)
-:	m_nGetIndex (0)
+:	m_nGetIndex (0),
+	m_ppHashTable (0),
+	m_nHashSize (0),
+	m_pSnapshot (0)
 {
 }
 
 CProperties::~CProperties (void)
 {
 	RemoveAll ();
+
+	delete [] m_ppHashTable;
+	m_ppHashTable = 0;
 }
 
 boolean CProperties::IsSet (const char *pPropertyName) const
@@ -174,8 +206,12 @@ void CProperties::SetString (const char *pPropertyName, const char *pValue)
 	}
 	else
 	{
-		delete pProperty->pValue;
+		if (!pProperty->bValueStatic)
+		{
+			delete [] pProperty->pValue;
+		}
 
+		pProperty->bValueStatic = FALSE;
 		pProperty->pValue = new char[strlen (pValue)+1];
 		assert (pProperty->pValue != 0);
 		strcpy (pProperty->pValue, pValue);
@@ -219,8 +255,16 @@ void CProperties::RemoveAll (void)
 		TPropertyPair *pProperty = (TPropertyPair *) m_PropArray[i];
 		assert (pProperty != 0);
 
-		delete [] (char *) pProperty->pName;
-		delete [] (char *) pProperty->pValue;
+		if (!pProperty->bNameStatic)
+		{
+			delete [] (char *) pProperty->pName;
+		}
+
+		if (!pProperty->bValueStatic)
+		{
+			delete [] (char *) pProperty->pValue;
+		}
+
 		delete pProperty;
 	}
 
@@ -228,6 +272,144 @@ void CProperties::RemoveAll (void)
 	{
 		m_PropArray.RemoveLast ();
 	}
+
+	for (unsigned i = 0; i < m_nHashSize; i++)
+	{
+		m_ppHashTable[i] = 0;
+	}
+
+	delete [] m_pSnapshot;
+	m_pSnapshot = 0;
+}
+
+size_t CProperties::GetSnapshotSize (void) const
+{
+	size_t nSize = sizeof (TSnapshotHeader) + m_PropArray.GetCount () * sizeof (TSnapshotEntry);
+
+	for (unsigned i = 0; i < m_PropArray.GetCount (); i++)
+	{
+		TPropertyPair *pProperty = (TPropertyPair *) m_PropArray[i];
+		assert (pProperty != 0);
+
+		nSize += strlen (pProperty->pName)+1 + strlen (pProperty->pValue)+1;
+	}
+
+	return (nSize + 3) & ~3;
+}
+
+boolean CProperties::WriteSnapshot (void *pBuffer, size_t nSize) const
+{
+	size_t nSnapshotSize = GetSnapshotSize ();
+	if (nSize < nSnapshotSize)
+	{
+		return FALSE;
+	}
+
+	assert (pBuffer != 0);
+	u8 *pSnapshot = (u8 *) pBuffer;
+	memset (pSnapshot, 0, nSnapshotSize);
+
+	TSnapshotHeader *pHeader = (TSnapshotHeader *) pSnapshot;
+	pHeader->nMagic = SNAPSHOT_MAGIC;
+	pHeader->nVersion = SNAPSHOT_VERSION;
+	pHeader->nCount = m_PropArray.GetCount ();
+	pHeader->nSize = nSnapshotSize;
+
+	TSnapshotEntry *pEntry = (TSnapshotEntry *) (pSnapshot + sizeof (TSnapshotHeader));
+	u32 nOffset = sizeof (TSnapshotHeader) + pHeader->nCount * sizeof (TSnapshotEntry);
+
+	for (unsigned i = 0; i < m_PropArray.GetCount (); i++, pEntry++)
+	{
+		TPropertyPair *pProperty = (TPropertyPair *) m_PropArray[i];
+		assert (pProperty != 0);
+
+		pEntry->nHash = pProperty->nHash;
+
+		pEntry->nNameOffset = nOffset;
+		strcpy ((char *) pSnapshot + nOffset, pProperty->pName);
+		nOffset += strlen (pProperty->pName)+1;
+
+		pEntry->nValueOffset = nOffset;
+		strcpy ((char *) pSnapshot + nOffset, pProperty->pValue);
+		nOffset += strlen (pProperty->pValue)+1;
+	}
+
+	assert (nOffset <= nSnapshotSize);
+
+	return TRUE;
+}
+
+boolean CProperties::LoadSnapshot (const void *pSnapshot, size_t nSize, boolean bCopy)
+{
+	RemoveAll ();
+
+	assert (pSnapshot != 0);
+	const TSnapshotHeader *pHeader = (const TSnapshotHeader *) pSnapshot;
+	if (   nSize < sizeof (TSnapshotHeader)
+	    || pHeader->nMagic != SNAPSHOT_MAGIC
+	    || pHeader->nVersion != SNAPSHOT_VERSION
+	    || pHeader->nSize > nSize
+	    || pHeader->nCount > (pHeader->nSize - sizeof (TSnapshotHeader)) / sizeof (TSnapshotEntry))
+	{
+		return FALSE;
+	}
+
+	nSize = pHeader->nSize;
+
+	char *pData = (char *) pSnapshot;
+	if (bCopy)
+	{
+		m_pSnapshot = new u8[nSize];
+		assert (m_pSnapshot != 0);
+		memcpy (m_pSnapshot, pSnapshot, nSize);
+
+		pData = (char *) m_pSnapshot;
+	}
+
+	// the strings have to be null-terminated inside the snapshot
+	u32 nStrings = sizeof (TSnapshotHeader) + pHeader->nCount * sizeof (TSnapshotEntry);
+	if (   nStrings < nSize
+	    && pData[nSize-1] != '\0')
+	{
+		RemoveAll ();
+
+		return FALSE;
+	}
+
+	unsigned nHashSize = HASH_SIZE_INITIAL;
+	while (nHashSize < pHeader->nCount)
+	{
+		nHashSize *= 2;
+	}
+
+	ResizeHash (nHashSize);
+
+	const TSnapshotEntry *pEntry = (const TSnapshotEntry *) (pData + sizeof (TSnapshotHeader));
+	for (unsigned i = 0; i < pHeader->nCount; i++, pEntry++)
+	{
+		if (   pEntry->nNameOffset < nStrings || pEntry->nNameOffset >= nSize
+		    || pEntry->nValueOffset < nStrings || pEntry->nValueOffset >= nSize)
+		{
+			RemoveAll ();
+
+			return FALSE;
+		}
+
+		TPropertyPair *pProperty = new TPropertyPair;
+		assert (pProperty != 0);
+
+		pProperty->pName = pData + pEntry->nNameOffset;
+		pProperty->pValue = pData + pEntry->nValueOffset;
+		pProperty->nHash = pEntry->nHash;
+		pProperty->bNameStatic = TRUE;
+		pProperty->bValueStatic = TRUE;
+
+		InsertHash (pProperty);
+
+		m_PropArray.Append (pProperty);
+	}
+
+	return TRUE;
 }
 
 void CProperties::AddProperty (const char*pPropertyName, const char *pValue)
@@ -252,6 +434,12 @@ void CProperties::AddProperty (const char*pPropertyName, const char *pValue)
 	assert (pProperty->pValue != 0);
 	strcpy (pProperty->pValue, pValue);
 
+	pProperty->nHash = Hash (pPropertyName);
+	pProperty->bNameStatic = FALSE;
+	pProperty->bValueStatic = FALSE;
+
+	InsertHash (pProperty);
+
 	m_PropArray.Append (pProperty);
 }
 
@@ -291,11 +479,21 @@ const char *CProperties::GetValue (void) const
 
 TPropertyPair *CProperties::Lookup (const char*pPropertyName) const
 {
-	for (unsigned i = 0; i < m_PropArray.GetCount (); i++)
+	if (m_nHashSize == 0)
 	{
-		TPropertyPair *pProperty = (TPropertyPair *) m_PropArray[i];
-		assert (pProperty != 0);
-		if (strcmp (pProperty->pName, pPropertyName) == 0)
+		return 0;
+	}
+
+	assert (pPropertyName != 0);
+	u32 nHash = Hash (pPropertyName);
+
+	assert (m_ppHashTable != 0);
+	for (TPropertyPair *pProperty = m_ppHashTable[nHash & (m_nHashSize-1)];
+	     pProperty != 0;
+	     pProperty = pProperty->pHashNext)
+	{
+		if (   pProperty->nHash == nHash
+		    && strcmp (pProperty->pName, pPropertyName) == 0)
 		{
 			return pProperty;
 		}
@@ -304,6 +502,73 @@ TPropertyPair *CProperties::Lookup (const char*pPropertyName) const
 	return 0;
 }
 
+// must be called before the property is appended to m_PropArray
+void CProperties::InsertHash (TPropertyPair *pProperty)
+{
+	// keep the load factor at or below 1
+	if (m_nHashSize < HASH_SIZE_INITIAL)
+	{
+		ResizeHash (HASH_SIZE_INITIAL);
+	}
+	else if (m_PropArray.GetCount () >= m_nHashSize)
+	{
+		ResizeHash (m_nHashSize * 2);
+	}
+
+	assert (pProperty != 0);
+	unsigned nIndex = pProperty->nHash & (m_nHashSize-1);
+
+	pProperty->pHashNext = m_ppHashTable[nIndex];
+	m_ppHashTable[nIndex] = pProperty;
+}
+
+void CProperties::ResizeHash (unsigned nSize)
+{
+	assert (nSize >= HASH_SIZE_INITIAL);
+	assert ((nSize & (nSize-1)) == 0);
+
+	if (nSize == m_nHashSize)
+	{
+		return;
+	}
+
+	delete [] m_ppHashTable;
+
+	m_nHashSize = nSize;
+	m_ppHashTable = new TPropertyPair *[m_nHashSize];
+	assert (m_ppHashTable != 0);
+
+	for (unsigned i = 0; i < m_nHashSize; i++)
+	{
+		m_ppHashTable[i] = 0;
+	}
+
+	// rehash all properties, which are already in the array
+	for (unsigned i = 0; i < m_PropArray.GetCount (); i++)
+	{
+		TPropertyPair *pProperty = (TPropertyPair *) m_PropArray[i];
+		assert (pProperty != 0);
+
+		unsigned nIndex = pProperty->nHash & (m_nHashSize-1);
+
+		pProperty->pHashNext = m_ppHashTable[nIndex];
+		m_ppHashTable[nIndex] = pProperty;
+	}
+}
+
+u32 CProperties::Hash (const char *pString)
+{
+	// FNV-1a
+	u32 nHash = 2166136261U;
+	for (; *pString != '\0'; pString++)
+	{
+		nHash ^= (u8) *pString;
+		nHash *= 16777619U;
+	}
+
+	return nHash;
+}
+
 #ifndef NDEBUG
 
 void CProperties::Dump (const char *pSource) const
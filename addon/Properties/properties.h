@@ -50,6 +50,14 @@ public:
 
 	void RemoveAll (void);
 
+	// binary snapshot of all properties, which can be loaded without parsing
+	size_t GetSnapshotSize (void) const;
+	// returns FALSE if nSize is too small
+	boolean WriteSnapshot (void *pBuffer, size_t nSize) const;
+	// replaces all properties, returns FALSE if the snapshot is invalid
+	// bCopy: if FALSE the snapshot is used in place and must remain valid (e.g. linked in)
+	boolean LoadSnapshot (const void *pSnapshot, size_t nSize, boolean bCopy = TRUE);
+
 #ifndef NDEBUG
 	void Dump (const char *pSource = "properties") const;
 #endif
@@ -69,10 +77,20 @@ protected:
 private:
 	TPropertyPair *Lookup (const char*pPropertyName) const;
 
+	void InsertHash (TPropertyPair *pProperty);
+	void ResizeHash (unsigned nSize);
+
+	static u32 Hash (const char *pString);
+
 private:
 	CPtrArray m_PropArray;
 	unsigned m_nGetIndex;
 
+	TPropertyPair **m_ppHashTable;		// index by name hash, chained
+	unsigned m_nHashSize;			// power of 2
+
+	u8 *m_pSnapshot;			// owned copy of the loaded snapshot
+
 	u8 m_IPAddress[4];
 };
 
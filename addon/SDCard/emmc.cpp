@@ -37,6 +37,7 @@
 #include <circle/devicenameservice.h>
 #include <circle/util.h>
 #include <circle/stdarg.h>
+#include <circle/sched/scheduler.h>
 #include <assert.h>
 #ifndef USE_SDHOST
 	#include <circle/bcm2835.h>
@@ -45,7 +46,7 @@
 	#include <circle/synchronize.h>
 	#include <circle/machineinfo.h>
 	#include <circle/memio.h>
-	#include <circle/sched/scheduler.h>
+	#include <circle/new.h>
 #else
 	#include "mmc.h"
 	#include "mmcerror.h"
@@ -69,6 +70,15 @@
 // Enable 1.8V support
 //#define SD_1_8V_SUPPORT
 
+// Enable UHS-I modes (SDR50, SDR104, DDR50) with 1.8V signaling on the EMMC2
+// (Raspberry Pi 4 only, falls back to High Speed/SDR25 automatically)
+#if RASPPI >= 4 && !defined (USE_SDHOST) && !defined (USE_EMBEDDED_MMC_CM) && !defined (NO_SD_UHS)
+	#define SD_UHS_SUPPORT
+	#ifndef SD_1_8V_SUPPORT
+		#define SD_1_8V_SUPPORT
+	#endif
+#endif
+
 // Enable High Speed/SDR25 mode
 //#define SD_HIGH_SPEED
 
@@ -91,6 +101,10 @@
 // Enable card interrupts
 //#define SD_CARD_INTERRUPTS
 
+// Use ADMA2 descriptor-based data transfers with interrupt completion
+// instead of PIO via the data FIFO (EMMC2 on Raspberry Pi 4 only)
+#define EMMC_USE_ADMA2
+
 // Allow old sdhci versions (may cause errors)
 // Required for QEMU
 #define EMMC_ALLOW_OLD_SDHCI
@@ -127,6 +141,8 @@
 #define EMMC_TUNE_STEP		(EMMC_BASE + 0x88)
 #define EMMC_TUNE_STEPS_STD	(EMMC_BASE + 0x8C)
 #define EMMC_TUNE_STEPS_DDR	(EMMC_BASE + 0x90)
+#define EMMC_ADMA_ERR_STAT	(EMMC_BASE + 0x54)
+#define EMMC_ADMA_SYS_ADDR	(EMMC_BASE + 0x58)
 #define EMMC_SPI_INT_SPT	(EMMC_BASE + 0xF0)
 #define EMMC_SLOTISR_VER	(EMMC_BASE + 0xFC)
 
@@ -472,6 +488,54 @@ const u32 CEMMCDevice::sd_acommands[] =
 
 #define SD_GET_CLOCK_DIVIDER_FAIL	0xffffffff
 
+#define SD_CAPS0_ADMA2		(1 << 19)
+
+#define SD_CAPS1_SDR50		(1 << 0)
+#define SD_CAPS1_SDR104		(1 << 1)
+#define SD_CAPS1_DDR50		(1 << 2)
+#define SD_CAPS1_TUNING_SDR50	(1 << 13)
+
+// Host Control 2 (upper half of CONTROL2)
+#define SD_CTRL2_UHS_MODE_MASK	(7 << 16)
+#define SD_CTRL2_UHS_MODE(func)	((func) << 16)	// same encoding as CMD6 access mode
+#define SD_CTRL2_1_8V		(1 << 19)
+#define SD_CTRL2_EXEC_TUNING	(1 << 22)
+#define SD_CTRL2_SAMPLE_CLOCK	(1 << 23)
+
+// CMD6 function group 1 (access mode)
+#define SD_ACCESS_SDR12		0
+#define SD_ACCESS_SDR25		1		// also High Speed
+#define SD_ACCESS_SDR50		2
+#define SD_ACCESS_SDR104	3
+#define SD_ACCESS_DDR50		4
+
+#define SD_TUNING_BLOCK_SIZE	64
+#define SD_TUNING_LOOPS		40
+
+#define SD_CTRL0_DMA_SEL_MASK	(3 << 3)
+#define SD_CTRL0_DMA_SEL_ADMA2	(2 << 3)	// 32-bit address
+
+#if RASPPI >= 4
+
+struct TADMA2Descriptor		// 32-bit address format
+{
+	u16	Attributes;
+#define ADMA2_ATTR_VALID	(1 << 0)
+#define ADMA2_ATTR_END		(1 << 1)
+#define ADMA2_ATTR_INT		(1 << 2)
+#define ADMA2_ATTR_ACT_TRAN	(2 << 4)
+	u16	Length;			// bytes
+	u32	Address;
+}
+PACKED;
+
+#define ADMA2_MAX_LENGTH	0x8000		// bytes per descriptor
+#define ADMA2_DESCRIPTORS	256		// => 8 MByte per transfer max.
+
+#define ADMA2_MAX_ADDRESS	0x40000000	// buffers must be in the low 1 GB
+
+#endif
+
 #endif
 
 #define SD_BLOCK_SIZE		512
@@ -482,12 +546,19 @@ CEMMCDevice::CEMMCDevice (CInterruptSystem *pInterruptSystem, CTimer *pTimer, CA
 	m_pActLED (pActLED),
 	m_ullOffset (0),
 	m_pPartitionManager (0),
+	m_pRequestQueue (0),
 #ifdef USE_SDHOST
 	m_Host (pInterruptSystem, pTimer),
 #else
 	m_hci_ver (0),
 #endif
 	m_pSCR (0)
+#if !defined (USE_SDHOST) && RASPPI >= 4
+	, m_bADMA2 (FALSE),
+	m_pADMA2Table (0),
+	m_bTransferIRQ (FALSE),
+	m_card_access_modes (0)
+#endif
 {
 	assert (m_pInterruptSystem != 0);
 	assert (m_pTimer != 0);
@@ -519,8 +590,25 @@ CEMMCDevice::CEMMCDevice (CInterruptSystem *pInterruptSystem, CTimer *pTimer, CA
 
 CEMMCDevice::~CEMMCDevice (void)
 {
+	if (m_pRequestQueue != 0)
+	{
+		m_pRequestQueue->Stop ();	// deleted by the scheduler
+		m_pRequestQueue = 0;
+	}
+
 #ifdef USE_SDHOST
 	m_Host.Reset ();
+#elif RASPPI >= 4
+	if (m_bADMA2)
+	{
+		write32 (EMMC_IRPT_EN, 0);
+		m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_ARASANSDIO);
+
+		m_bADMA2 = FALSE;
+	}
+
+	delete [] m_pADMA2Table;
+	m_pADMA2Table = 0;
 #endif
 
 	delete m_pSCR;
@@ -565,6 +653,23 @@ boolean CEMMCDevice::Initialize (void)
 		return FALSE;
 	}
 
+#if !defined (USE_SDHOST) && RASPPI >= 4 && defined (EMMC_USE_ADMA2)
+	if (   m_hci_ver >= 2
+	    && (read32 (EMMC_CAPABILITIES_0) & SD_CAPS0_ADMA2))
+	{
+		m_pADMA2Table = new (HEAP_DMA30) TADMA2Descriptor[ADMA2_DESCRIPTORS];
+		assert (m_pADMA2Table != 0);
+
+		m_pInterruptSystem->ConnectIRQ (ARM_IRQ_ARASANSDIO, InterruptHandler, this);
+
+		m_bADMA2 = TRUE;
+
+#ifdef EMMC_DEBUG
+		LogWrite (LogDebug, "Using ADMA2 transfers");
+#endif
+	}
+#endif
+
 	PeripheralExit ();
 
 	const char DeviceName[] = "emmc1";
@@ -582,6 +687,22 @@ boolean CEMMCDevice::Initialize (void)
 	return TRUE;
 }
 
+boolean CEMMCDevice::SubmitRequest (CBlockRequest *pRequest)
+{
+	if (!CScheduler::IsActive ())
+	{
+		return CDevice::SubmitRequest (pRequest);
+	}
+
+	if (m_pRequestQueue == 0)
+	{
+		m_pRequestQueue = new CBlockRequestQueue (this, "emmc1");
+		assert (m_pRequestQueue != 0);
+	}
+
+	return m_pRequestQueue->Submit (pRequest);
+}
+
 int CEMMCDevice::Read (void *pBuffer, size_t nCount)
 {
 	if (m_ullOffset % SD_BLOCK_SIZE != 0)
@@ -913,6 +1034,17 @@ void CEMMCDevice::IssueCommandInt (u32 cmd_reg, u32 argument, int timeout)
 	u32 blksizecnt = m_block_size | (m_blocks_to_transfer << 16);
 	write32 (EMMC_BLKSIZECNT, blksizecnt);
 
+#if RASPPI >= 4
+	boolean bDMA = FALSE;
+	if (   (cmd_reg & SD_CMD_ISDATA)
+	    && m_bADMA2
+	    && SetupADMA2 (m_buf, m_block_size * m_blocks_to_transfer))
+	{
+		bDMA = TRUE;
+		cmd_reg |= SD_CMD_DMA;
+	}
+#endif
+
 	// Set argument 1 reg
 	write32 (EMMC_ARG1, argument);
 
@@ -937,6 +1069,13 @@ void CEMMCDevice::IssueCommandInt (u32 cmd_reg, u32 argument, int timeout)
 		m_last_error = irpts & 0xffff0000;
 		m_last_interrupt = irpts;
 
+#if RASPPI >= 4
+		if (bDMA)
+		{
+			write32 (EMMC_IRPT_EN, 0);
+		}
+#endif
+
 		return;
 	}
 
@@ -958,6 +1097,14 @@ void CEMMCDevice::IssueCommandInt (u32 cmd_reg, u32 argument, int timeout)
 		break;
 	}
 
+#if RASPPI >= 4
+	if (bDMA)
+	{
+		// the transfer complete or error status is evaluated below
+		WaitADMA2 (timeout);
+	}
+	else
+#endif
 	// If with data, wait for the appropriate interrupt
 	if (cmd_reg & SD_CMD_ISDATA)
 	{
@@ -980,7 +1127,8 @@ void CEMMCDevice::IssueCommandInt (u32 cmd_reg, u32 argument, int timeout)
 		}
 #endif
 
-		assert (((uintptr) m_buf & 3) == 0);
+		// unaligned buffers are accessed bytewise
+		boolean bAligned = ((uintptr) m_buf & 3) == 0;
 		u32 *pData = (u32 *) m_buf;
 
 		for (int nBlock = 0; nBlock < m_blocks_to_transfer; nBlock++)
@@ -1005,7 +1153,24 @@ void CEMMCDevice::IssueCommandInt (u32 cmd_reg, u32 argument, int timeout)
 			size_t length = m_block_size;
 			assert ((length & 3) == 0);
 
-			if (is_write)
+			if (!bAligned)
+			{
+				for (; length > 0; length -= 4)
+				{
+					u32 nData;
+					if (is_write)
+					{
+						memcpy (&nData, pData++, sizeof nData);
+						write32 (EMMC_DATA, nData);
+					}
+					else
+					{
+						nData = read32 (EMMC_DATA);
+						memcpy (pData++, &nData, sizeof nData);
+					}
+				}
+			}
+			else if (is_write)
 			{
 				for (; length > 0; length -= 4)
 				{
@@ -1061,10 +1226,274 @@ void CEMMCDevice::IssueCommandInt (u32 cmd_reg, u32 argument, int timeout)
 		}
 	}
 
+#if RASPPI >= 4
+	if (   bDMA
+	    && (cmd_reg & SD_CMD_DAT_DIR_CH))
+	{
+		InvalidateDataCacheRange ((uintptr) m_buf, m_block_size * m_blocks_to_transfer);
+	}
+#endif
+
 	// Return success
 	m_last_cmd_success = 1;
 }
 
+#if RASPPI >= 4
+
+boolean CEMMCDevice::SetupADMA2 (void *buf, size_t buf_size)
+{
+	// DMA directly from/to buf requires a cache-line aligned buffer in the low memory
+	uintptr nAddress = (uintptr) buf;
+	if (   (nAddress & (DATA_CACHE_LINE_LENGTH_MAX-1))
+	    || (buf_size & (DATA_CACHE_LINE_LENGTH_MAX-1))
+	    || nAddress + buf_size > ADMA2_MAX_ADDRESS
+	    || buf_size > (size_t) ADMA2_MAX_LENGTH * ADMA2_DESCRIPTORS)
+	{
+		return FALSE;
+	}
+
+	assert (m_pADMA2Table != 0);
+	unsigned nDesc = 0;
+	while (buf_size > 0)
+	{
+		size_t nLength = buf_size;
+		if (nLength > ADMA2_MAX_LENGTH)
+		{
+			nLength = ADMA2_MAX_LENGTH;
+		}
+
+		buf_size -= nLength;
+
+		assert (nDesc < ADMA2_DESCRIPTORS);
+		TADMA2Descriptor *pDesc = &m_pADMA2Table[nDesc++];
+		pDesc->Attributes = ADMA2_ATTR_VALID | ADMA2_ATTR_ACT_TRAN;
+		pDesc->Length = (u16) nLength;
+		pDesc->Address = (u32) nAddress;
+
+		if (buf_size == 0)
+		{
+			pDesc->Attributes |= ADMA2_ATTR_END;
+		}
+
+		nAddress += nLength;
+	}
+
+	CleanDataCacheRange ((uintptr) m_pADMA2Table, nDesc * sizeof (TADMA2Descriptor));
+	CleanAndInvalidateDataCacheRange ((uintptr) buf, nAddress - (uintptr) buf);
+
+	u32 control0 = read32 (EMMC_CONTROL0);
+	control0 &= ~SD_CTRL0_DMA_SEL_MASK;
+	control0 |= SD_CTRL0_DMA_SEL_ADMA2;
+	write32 (EMMC_CONTROL0, control0);
+
+	write32 (EMMC_ADMA_SYS_ADDR, (u32) (uintptr) m_pADMA2Table);
+
+	// signal transfer complete and errors (the status bits are evaluated by the caller)
+	m_bTransferIRQ = FALSE;
+	write32 (EMMC_IRPT_EN, 0xffff0000 | SD_TRANSFER_COMPLETE);
+
+	return TRUE;
+}
+
+boolean CEMMCDevice::WaitADMA2 (unsigned usec)
+{
+	assert (m_pTimer != 0);
+	unsigned nStartTicks = m_pTimer->GetClockTicks ();
+	unsigned nTimeoutTicks = usec * (CLOCKHZ / 1000000);
+
+	while (!m_bTransferIRQ)
+	{
+		if (m_pTimer->GetClockTicks () - nStartTicks >= nTimeoutTicks)
+		{
+			write32 (EMMC_IRPT_EN, 0);
+
+#ifdef EMMC_DEBUG
+			LogWrite (LogWarning, "ADMA2 transfer timed out (error status %08x)",
+				  read32 (EMMC_ADMA_ERR_STAT));
+#endif
+
+			return FALSE;
+		}
+
+#ifdef NO_BUSY_WAIT
+		CScheduler::Get ()->Yield ();
+#endif
+	}
+
+	return TRUE;
+}
+
+boolean CEMMCDevice::SetIOVoltage18 (boolean bEnable)
+{
+	CBcmPropertyTags Tags;
+	TPropertyTagGPIOState GPIOState;
+	GPIOState.nGPIO = EXP_GPIO_BASE + 4;
+	GPIOState.nState = bEnable ? 1 : 0;
+
+	return Tags.GetTag (PROPTAG_SET_SET_GPIO_STATE, &GPIOState, sizeof GPIOState, 8);
+}
+
+boolean CEMMCDevice::SetAccessMode (unsigned nFunction)
+{
+	// 512 bit response
+	u8 cmd6_resp[64];
+	m_buf = &cmd6_resp[0];
+	m_block_size = 64;
+
+	// CMD6 Mode 1: Set Function (Group 1, Access Mode)
+	boolean bOK = IssueCommand (SWITCH_FUNC, 0x80fffff0 | nFunction, 100000);
+
+	m_block_size = SD_BLOCK_SIZE;
+
+	// Check the function selected in group 1
+	return bOK && (cmd6_resp[16] & 0x0F) == nFunction;
+}
+
+// Switch to the fastest UHS-I mode supported by card and host,
+// falls back to the next slower mode, if the switch or tuning fails
+int CEMMCDevice::SwitchUHSMode (u32 base_clock)
+{
+	static const struct
+	{
+		unsigned	nFunction;
+		u32		nHostCaps;
+		u32		nClockRate;
+		const char	*pName;
+	}
+	Modes[] =
+	{
+		{SD_ACCESS_SDR104,	SD_CAPS1_SDR104,	SD_CLOCK_208,	"SDR104"},
+		{SD_ACCESS_SDR50,	SD_CAPS1_SDR50,		SD_CLOCK_100,	"SDR50"},
+		{SD_ACCESS_DDR50,	SD_CAPS1_DDR50,		SD_CLOCK_HIGH,	"DDR50"},
+		{SD_ACCESS_SDR25,	0,			SD_CLOCK_HIGH,	"SDR25"}
+	};
+
+	u32 caps1 = read32 (EMMC_CAPABILITIES_1);
+
+	for (unsigned i = 0; i < sizeof Modes / sizeof Modes[0]; i++)
+	{
+		if (   !(m_card_access_modes & (1 << Modes[i].nFunction))
+		    || (caps1 & Modes[i].nHostCaps) != Modes[i].nHostCaps)
+		{
+			continue;
+		}
+
+		// SDR104 does not give more than SDR50 with a base clock below 208 MHz
+		u32 clock_rate = Modes[i].nClockRate;
+		if (clock_rate > base_clock)
+		{
+			if (Modes[i].nFunction == SD_ACCESS_SDR104)
+			{
+				continue;
+			}
+
+			clock_rate = base_clock;
+		}
+
+		if (!SetAccessMode (Modes[i].nFunction))
+		{
+			LogWrite (LogWarning, "Card did not switch to %s mode", Modes[i].pName);
+
+			continue;
+		}
+
+		u32 control2 = read32 (EMMC_CONTROL2);
+		control2 &= ~SD_CTRL2_UHS_MODE_MASK;
+		control2 |= SD_CTRL2_UHS_MODE (Modes[i].nFunction);
+		write32 (EMMC_CONTROL2, control2);
+
+		if (SwitchClockRate (base_clock, clock_rate) != 0)
+		{
+			continue;
+		}
+
+		if (   Modes[i].nFunction == SD_ACCESS_SDR104
+		    || (   Modes[i].nFunction == SD_ACCESS_SDR50
+			&& (caps1 & SD_CAPS1_TUNING_SDR50)))
+		{
+			if (ExecuteTuning () != 0)
+			{
+				LogWrite (LogWarning, "Tuning for %s mode failed", Modes[i].pName);
+
+				continue;
+			}
+		}
+
+		LogWrite (LogNotice, "Using %s mode (%u MHz)", Modes[i].pName, clock_rate / 1000000);
+
+		return 0;
+	}
+
+	// Back to the default mode on the host side, the card may be in another mode now
+	u32 control2 = read32 (EMMC_CONTROL2);
+	control2 &= ~SD_CTRL2_UHS_MODE_MASK;
+	write32 (EMMC_CONTROL2, control2);
+
+	SwitchClockRate (base_clock, SD_CLOCK_NORMAL);
+	SetAccessMode (SD_ACCESS_SDR12);
+
+	return -1;
+}
+
+// As per HCSS 2.2.26 (Execute Tuning), CMD19 is repeated until the controller is done
+int CEMMCDevice::ExecuteTuning (void)
+{
+	u32 control2 = read32 (EMMC_CONTROL2);
+	control2 &= ~SD_CTRL2_SAMPLE_CLOCK;
+	control2 |= SD_CTRL2_EXEC_TUNING;
+	write32 (EMMC_CONTROL2, control2);
+
+	for (unsigned i = 0; i < SD_TUNING_LOOPS; i++)
+	{
+		write32 (EMMC_BLKSIZECNT, SD_TUNING_BLOCK_SIZE | (1 << 16));
+		write32 (EMMC_ARG1, 0);
+		write32 (EMMC_CMDTM, sd_commands[SEND_TUNING_BLOCK]);
+
+		// The tuning block is consumed by the controller, only wait for buffer read ready
+		int nResult = TimeoutWait (EMMC_INTERRUPT, 0x8000 | SD_BUFFER_READ_READY, 1, 10000);
+		u32 irpts = read32 (EMMC_INTERRUPT);
+		write32 (EMMC_INTERRUPT, 0xffff0000 | SD_BUFFER_READ_READY | SD_COMMAND_COMPLETE
+					 | SD_TRANSFER_COMPLETE);
+
+		if (   nResult < 0
+		    || (irpts & 0xffff0000))
+		{
+			ResetCmd ();
+			ResetDat ();
+		}
+
+		if (!(read32 (EMMC_CONTROL2) & SD_CTRL2_EXEC_TUNING))
+		{
+			break;
+		}
+	}
+
+	control2 = read32 (EMMC_CONTROL2);
+	if (   (control2 & SD_CTRL2_EXEC_TUNING)
+	    || !(control2 & SD_CTRL2_SAMPLE_CLOCK))
+	{
+		control2 &= ~(SD_CTRL2_EXEC_TUNING | SD_CTRL2_SAMPLE_CLOCK);
+		write32 (EMMC_CONTROL2, control2);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void CEMMCDevice::InterruptHandler (void *pParam)
+{
+	CEMMCDevice *pThis = (CEMMCDevice *) pParam;
+	assert (pThis != 0);
+
+	// the status remains in the INTERRUPT register for IssueCommandInt()
+	write32 (EMMC_IRPT_EN, 0);
+
+	pThis->m_bTransferIRQ = TRUE;
+}
+
+#endif
+
 void CEMMCDevice::HandleCardInterrupt (void)
 {
 	// Handle a card interrupt
@@ -1773,22 +2202,38 @@ int CEMMCDevice::CardReset (void)
 		}
 
 		// Set 1.8V signal enable to 1
+#if RASPPI >= 4
+		// The EMMC2 has the bit in Host Control 2, the I/O supply is switched externally
+		SetIOVoltage18 (TRUE);
+
+		u32 control2 = read32 (EMMC_CONTROL2);
+		control2 |= SD_CTRL2_1_8V;
+		write32 (EMMC_CONTROL2, control2);
+#else
 		u32 control0 = read32(EMMC_CONTROL0);
 		control0 |= (1 << 8);
 		write32(EMMC_CONTROL0, control0);
+#endif
 
 		// Wait 5 ms
 		usDelay (5000);
 
 		// Check the 1.8V signal enable is set
+#if RASPPI >= 4
+		if (!(read32 (EMMC_CONTROL2) & SD_CTRL2_1_8V))
+#else
 		control0 = read32(EMMC_CONTROL0);
 		if(((control0 >> 8) & 1) == 0)
+#endif
 		{
 #ifdef EMMC_DEBUG
 			LogWrite (LogDebug, "controller did not keep 1.8V signal enable high");
 #endif
 			m_failed_voltage_switch = 1;
 			PowerOff();
+#if RASPPI >= 4
+			SetIOVoltage18 (FALSE);
+#endif
 
 			return CardReset ();
 		}
@@ -1810,6 +2255,9 @@ int CEMMCDevice::CardReset (void)
 #endif
 			m_failed_voltage_switch = 1;
 			PowerOff();
+#if RASPPI >= 4
+			SetIOVoltage18 (FALSE);
+#endif
 
 			return CardReset ();
 		}
@@ -2001,8 +2449,17 @@ int CEMMCDevice::CardReset (void)
 			// Check Group 1, Function 1 (High Speed/SDR25)
 			m_card_supports_hs = (cmd6_resp[13] >> 1) & 0x1;
 
+#ifdef SD_UHS_SUPPORT
+			// UHS-I modes are selected after the switch to 4-bit mode
+			m_card_access_modes = m_card_supports_18v ? cmd6_resp[13] & 0x1F : 0;
+#endif
+
 			// Attempt switch if supported
-			if (m_card_supports_hs)
+			if (   m_card_supports_hs
+#ifdef SD_UHS_SUPPORT
+			    && !(m_card_access_modes & ~0x03)
+#endif
+			   )
 			{
 #ifdef EMMC_DEBUG2
 				LogWrite (LogDebug, "Switching to %s mode", m_card_supports_18v ? "SDR25" : "High Speed");
@@ -2088,6 +2545,14 @@ int CEMMCDevice::CardReset (void)
 #endif
 	}
 
+#ifdef SD_UHS_SUPPORT
+	if (   (m_card_access_modes & ~0x03)
+	    && SwitchUHSMode (base_clock) != 0)
+	{
+		LogWrite (LogWarning, "Cannot switch to UHS-I mode");
+	}
+#endif
+
 	LogWrite (LogNotice, "Found a valid version %s SD card", sd_versions[m_pSCR->sd_version]);
 
 #else	// #ifndef USE_EMBEDDED_MMC_CM
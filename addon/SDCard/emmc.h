@@ -35,6 +35,7 @@
 #include <circle/actled.h>
 #include <circle/gpiopin.h>
 #include <circle/fs/partitionmanager.h>
+#include <circle/sched/blockrequestqueue.h>
 #include <circle/logger.h>
 #include <circle/types.h>
 #include <circle/sysconfig.h>
@@ -64,6 +65,9 @@ public:
 
 	u64 Seek (u64 ullOffset);
 
+	// requests are processed by a queue task, if the scheduler is active (synchronously otherwise)
+	boolean SubmitRequest (CBlockRequest *pRequest);
+
 	const u32 *GetID (void);
 
 private:
@@ -98,6 +102,17 @@ private:
 	int TimeoutWait (unsigned reg, unsigned mask, int value, unsigned usec);
 #endif
 
+#if !defined (USE_SDHOST) && RASPPI >= 4
+	boolean SetupADMA2 (void *buf, size_t buf_size);
+	boolean WaitADMA2 (unsigned usec);
+	static void InterruptHandler (void *pParam);
+
+	boolean SetIOVoltage18 (boolean bEnable);
+	boolean SetAccessMode (unsigned nFunction);
+	int SwitchUHSMode (u32 base_clock);
+	int ExecuteTuning (void);
+#endif
+
 	void usDelay (unsigned usec);
 
 	static void LogWrite (TLogSeverity Severity, const char *pMessage, ...);
@@ -118,6 +133,8 @@ private:
 
 	CPartitionManager *m_pPartitionManager;
 
+	CBlockRequestQueue *m_pRequestQueue;
+
 #ifdef USE_SDHOST
 	CSDHOSTDevice m_Host;
 #else
@@ -158,6 +175,14 @@ private:
 	u32 m_base_clock;
 #endif
 
+#if !defined (USE_SDHOST) && RASPPI >= 4
+	boolean m_bADMA2;			// ADMA2 is supported and enabled
+	struct TADMA2Descriptor *m_pADMA2Table;
+	volatile boolean m_bTransferIRQ;
+
+	u32 m_card_access_modes;		// CMD6 function group 1 support bits
+#endif
+
 	static const char *sd_versions[];
 #ifndef USE_SDHOST
 	static const char *err_irpts[];
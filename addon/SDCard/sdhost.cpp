@@ -482,9 +482,18 @@ void CSDHOSTDevice::read_block_pio(void)
 
 			copy_words -= words;
 
-			while (words) {
-				*(buf++) = read(SDDATA);
-				words--;
+			if ((uintptr) buf & 3) {
+				/* unaligned buffer */
+				while (words) {
+					u32 data = read(SDDATA);
+					memcpy(buf++, &data, sizeof data);
+					words--;
+				}
+			} else {
+				while (words) {
+					*(buf++) = read(SDDATA);
+					words--;
+				}
 			}
 		}
 
@@ -562,9 +571,19 @@ void CSDHOSTDevice::write_block_pio (void)
 
 			copy_words -= words;
 
-			while (words) {
-				write(*(buf++), SDDATA);
-				words--;
+			if ((uintptr) buf & 3) {
+				/* unaligned buffer */
+				while (words) {
+					u32 data;
+					memcpy(&data, buf++, sizeof data);
+					write(data, SDDATA);
+					words--;
+				}
+			} else {
+				while (words) {
+					write(*(buf++), SDDATA);
+					words--;
+				}
 			}
 		}
 
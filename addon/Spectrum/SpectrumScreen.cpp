@@ -20,10 +20,21 @@
 #include <circle/util.h>
 #include <assert.h>
 
+#if defined (__ARM_NEON) && __has_include (<arm_neon.h>)
+	#define SPECTRUM_NEON
+	#include <arm_neon.h>
+#endif
+
+#define BUFFER_ORIGIN		1413	// first word of the screen area in the frame buffer
+#define BUFFER_PITCH		44	// words per line
+#define BUFFER_ROW_PITCH	(8 * BUFFER_PITCH)
+
 CSpectrumScreen::CSpectrumScreen (void)
 :	m_pFrameBuffer (0),
 	m_pBuffer (0),
-	m_pVideoMem (0)
+	m_pVideoMem (0),
+	m_invalid (TRUE),
+	m_updatedCells (0)
 {
 }
 
@@ -104,54 +115,81 @@ void CSpectrumScreen::Update (boolean flash)
 	assert (m_pBuffer != 0);
 	assert (m_pVideoMem != 0);
 
-	int bufIdx = 1413;
-	int attr = 6144;
-	for (int addr = 0; addr < 256; addr += 32) {
-		for (int col = 0; col < 32; col++) {
-			unsigned char color = m_pVideoMem[attr++];
-			if (!flash)
-				color &= 0x7F;
-			m_pBuffer[bufIdx + col] = m_scrTable[color][m_pVideoMem[addr + col]];
-			m_pBuffer[bufIdx + col + 44] = m_scrTable[color][m_pVideoMem[addr + col + 256]];
-			m_pBuffer[bufIdx + col + 88] = m_scrTable[color][m_pVideoMem[addr + col + 512]];
-			m_pBuffer[bufIdx + col + 132] = m_scrTable[color][m_pVideoMem[addr + col + 768]];
-			m_pBuffer[bufIdx + col + 176] = m_scrTable[color][m_pVideoMem[addr + col + 1024]];
-			m_pBuffer[bufIdx + col + 220] = m_scrTable[color][m_pVideoMem[addr + col + 1280]];
-			m_pBuffer[bufIdx + col + 264] = m_scrTable[color][m_pVideoMem[addr + col + 1536]];
-			m_pBuffer[bufIdx + col + 308] = m_scrTable[color][m_pVideoMem[addr + col + 1792]];
+	u8 attrMask = flash ? 0xFF : 0x7F;
+	m_updatedCells = 0;
+
+	for (unsigned row = 0; row < SPECTRUM_ROWS; row++) {
+		// the screen is divided into thirds, the pixel lines of a cell are 256 bytes apart
+		unsigned bitmap = (row / 8) * 2048 + (row % 8) * SPECTRUM_COLUMNS;
+		unsigned attr = SPECTRUM_BITMAP_SIZE + row * SPECTRUM_COLUMNS;
+
+		// collect the changes of all cells in this row, non-zero means changed
+		u8 diff[SPECTRUM_COLUMNS];
+		if (m_invalid) {
+			memset(diff, 0xFF, sizeof diff);
+		} else {
+#ifdef SPECTRUM_NEON
+			uint8x16_t mask = vdupq_n_u8(attrMask);
+			for (unsigned col = 0; col < SPECTRUM_COLUMNS; col += 16) {
+				uint8x16_t d = veorq_u8(vandq_u8(vld1q_u8(&m_pVideoMem[attr + col]), mask),
+							vld1q_u8(&m_shadow[attr + col]));
+				for (unsigned line = 0; line < 8; line++) {
+					unsigned addr = bitmap + line * 256 + col;
+					d = vorrq_u8(d, veorq_u8(vld1q_u8(&m_pVideoMem[addr]),
+								 vld1q_u8(&m_shadow[addr])));
+				}
+				vst1q_u8(&diff[col], d);
+			}
+#else
+			for (unsigned col = 0; col < SPECTRUM_COLUMNS; col++) {
+				u8 d = (m_pVideoMem[attr + col] & attrMask) ^ m_shadow[attr + col];
+				for (unsigned line = 0; line < 8; line++) {
+					unsigned addr = bitmap + line * 256 + col;
+					d |= m_pVideoMem[addr] ^ m_shadow[addr];
+				}
+				diff[col] = d;
+			}
+#endif
 		}
-		bufIdx += 352;
-	}
-	for (int addr = 2048; addr < 2304; addr += 32) {
-		for (int col = 0; col < 32; col++) {
-			unsigned char color = m_pVideoMem[attr++];
-			if (!flash)
-				color &= 0x7F;
-			m_pBuffer[bufIdx + col] = m_scrTable[color][m_pVideoMem[addr + col]];
-			m_pBuffer[bufIdx + col + 44] = m_scrTable[color][m_pVideoMem[addr + col + 256]];
-			m_pBuffer[bufIdx + col + 88] = m_scrTable[color][m_pVideoMem[addr + col + 512]];
-			m_pBuffer[bufIdx + col + 132] = m_scrTable[color][m_pVideoMem[addr + col + 768]];
-			m_pBuffer[bufIdx + col + 176] = m_scrTable[color][m_pVideoMem[addr + col + 1024]];
-			m_pBuffer[bufIdx + col + 220] = m_scrTable[color][m_pVideoMem[addr + col + 1280]];
-			m_pBuffer[bufIdx + col + 264] = m_scrTable[color][m_pVideoMem[addr + col + 1536]];
-			m_pBuffer[bufIdx + col + 308] = m_scrTable[color][m_pVideoMem[addr + col + 1792]];
+
+		for (unsigned col = 0; col < SPECTRUM_COLUMNS; col++) {
+			if (!diff[col])
+				continue;
+
+			u8 color = m_pVideoMem[attr + col] & attrMask;
+			m_shadow[attr + col] = color;
+			for (unsigned line = 0; line < 8; line++) {
+				unsigned addr = bitmap + line * 256 + col;
+				m_shadow[addr] = m_pVideoMem[addr];
+			}
+
+			DrawCell(row, col, color);
 		}
-		bufIdx += 352;
 	}
-	for (int addr = 4096; addr < 4352; addr += 32) {
-		for (int col = 0; col < 32; col++) {
-			unsigned char color = m_pVideoMem[attr++];
-			if (!flash)
-				color &= 0x7F;
-			m_pBuffer[bufIdx + col] = m_scrTable[color][m_pVideoMem[addr + col]];
-			m_pBuffer[bufIdx + col + 44] = m_scrTable[color][m_pVideoMem[addr + col + 256]];
-			m_pBuffer[bufIdx + col + 88] = m_scrTable[color][m_pVideoMem[addr + col + 512]];
-			m_pBuffer[bufIdx + col + 132] = m_scrTable[color][m_pVideoMem[addr + col + 768]];
-			m_pBuffer[bufIdx + col + 176] = m_scrTable[color][m_pVideoMem[addr + col + 1024]];
-			m_pBuffer[bufIdx + col + 220] = m_scrTable[color][m_pVideoMem[addr + col + 1280]];
-			m_pBuffer[bufIdx + col + 264] = m_scrTable[color][m_pVideoMem[addr + col + 1536]];
-			m_pBuffer[bufIdx + col + 308] = m_scrTable[color][m_pVideoMem[addr + col + 1792]];
-		}
-		bufIdx += 352;
+
+	m_invalid = FALSE;
+}
+
+void CSpectrumScreen::Invalidate (void)
+{
+	m_invalid = TRUE;
+}
+
+unsigned CSpectrumScreen::GetUpdatedCells (void) const
+{
+	return m_updatedCells;
+}
+
+void CSpectrumScreen::DrawCell (unsigned row, unsigned col, u8 color)
+{
+	// each bitmap byte is expanded to eight 4-bit pixels (one word) by the lookup table
+	const unsigned *pTable = m_scrTable[color];
+	const u8 *pBitmap = &m_shadow[(row / 8) * 2048 + (row % 8) * SPECTRUM_COLUMNS + col];
+	u32 *pBuffer = &m_pBuffer[BUFFER_ORIGIN + row * BUFFER_ROW_PITCH + col];
+
+	for (unsigned line = 0; line < 8; line++) {
+		pBuffer[line * BUFFER_PITCH] = pTable[pBitmap[line * 256]];
 	}
+
+	m_updatedCells++;
 }
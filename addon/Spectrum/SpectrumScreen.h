@@ -22,6 +22,11 @@
 #include <circle/bcmframebuffer.h>
 #include <circle/types.h>
 
+#define SPECTRUM_BITMAP_SIZE	6144
+#define SPECTRUM_ATTR_SIZE	768
+#define SPECTRUM_ROWS		24		// character rows
+#define SPECTRUM_COLUMNS	32
+
 class CSpectrumScreen
 {
 public:
@@ -30,13 +35,30 @@ public:
 
 	boolean Initialize (u8 *pVideoMem);
 
+	// Only the 8x8 character cells, whose bitmap or attribute has changed since
+	// the last call, are rendered. If the flash state changes, only the cells with
+	// the flash attribute set are affected.
 	void Update (boolean flash);
 
+	// Render the whole screen on the next Update()
+	void Invalidate (void);
+
+	// Number of cells rendered by the last Update()
+	unsigned GetUpdatedCells (void) const;
+
+private:
+	void DrawCell (unsigned row, unsigned col, u8 color);
+
 private:
 	CBcmFrameBuffer	*m_pFrameBuffer;
 	u32		*m_pBuffer;		// Address of frame buffer
 	unsigned	 m_scrTable[256][256];	// lookup table
 	u8		*m_pVideoMem;		// Spectrum video memory
+
+	// Video memory at the last Update(), attributes with the flash bit applied
+	u8		 m_shadow[SPECTRUM_BITMAP_SIZE + SPECTRUM_ATTR_SIZE];
+	boolean		 m_invalid;
+	unsigned	 m_updatedCells;
 };
 
 #endif
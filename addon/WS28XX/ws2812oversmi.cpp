@@ -22,19 +22,36 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include "ws2812oversmi.h"
+#include <circle/timer.h>
 #include <circle/util.h>
+#include <assert.h>
 
 
-CWS2812OverSMI::CWS2812OverSMI(unsigned nSDLinesMask, unsigned nNumberOfLEDsPerStrip) :
-		m_SMIMaster (nSDLinesMask, FALSE),
+CWS2812OverSMI::CWS2812OverSMI(unsigned nSDLinesMask, unsigned nNumberOfLEDsPerStrip, CInterruptSystem *pInterruptSystem) :
+		m_SMIMaster (nSDLinesMask, FALSE, pInterruptSystem),
 		m_nLEDCount (nNumberOfLEDsPerStrip),
 		m_bDirty (TRUE),
-		m_bOnlyOneLine (TRUE)
+		m_bOnlyOneLine (TRUE),
+		m_nFrameInterval (0),
+		m_nLastFrameTicks (0),
+		m_bFirstFrame (TRUE)
 {
 	assert (m_nLEDCount > 0);
 	unsigned len = TX_BUFF_LEN(m_nLEDCount);
+	m_nBufferLength = len;
+	m_nMinInterval = (unsigned) ((u64) len * NEOPIXEL_SMI_CYCLE_NS / 1000) + LED_RESET_US;
 	m_pBuffer = new TXDATA_T[len]; // using new makes the buffer cache-aligned, so suitable for DMA
+	m_pFrontBuffer = new TXDATA_T[len];
 	memset(m_pBuffer, 0, len * sizeof(TXDATA_T));
+	// The 1st (high) and 3rd (low) pulse of each bit do not depend on the data, so set them once here
+	for (unsigned nLEDIndex = 0; nLEDIndex < m_nLEDCount; nLEDIndex++) {
+		TXDATA_T *txd = &m_pBuffer[LED_TX_OSET(nLEDIndex)];
+		for (unsigned nBit = 0; nBit < LED_NBITS; nBit++) {
+			txd[0] = (TXDATA_T) 0xffff;
+			txd[2] = 0;
+			txd += BIT_NPULSES;
+		}
+	}
 	unsigned nLines = 0;
 	for (unsigned nStripIndex = 0; nStripIndex < LED_NCHANS; nStripIndex++) {
 		if (nSDLinesMask & (1 << nStripIndex)) {
@@ -43,11 +60,14 @@ CWS2812OverSMI::CWS2812OverSMI(unsigned nSDLinesMask, unsigned nNumberOfLEDsPerS
 		}
 	}
 	m_SMIMaster.SetupTiming(NEOPIXEL_SMI_WIDTH, NEOPIXEL_SMI_NS, NEOPIXEL_SMI_SETUP, NEOPIXEL_SMI_STROBE, NEOPIXEL_SMI_HOLD, NEOPIXEL_SMI_PACE);
-	m_SMIMaster.SetupDMA(m_pBuffer, len * sizeof(TXDATA_T));
+	memcpy(m_pFrontBuffer, m_pBuffer, len * sizeof(TXDATA_T));
+	m_SMIMaster.SetupDMA(m_pFrontBuffer, len * sizeof(TXDATA_T));
 }
 
 
 CWS2812OverSMI::~CWS2812OverSMI() {
+	m_SMIMaster.WaitForDMA();
+	delete[] m_pFrontBuffer;
 	delete[] m_pBuffer;
 }
 
@@ -60,7 +80,39 @@ unsigned CWS2812OverSMI::GetLEDCount() const {
 void CWS2812OverSMI::Update() {
 	if (!m_bDirty) return;
 	m_bDirty = FALSE;
+
+	// The previous frame must have left the SMI FIFO and been latched by the LEDs, before the buffer is switched
+	unsigned nInterval = m_nFrameInterval > m_nMinInterval ? m_nFrameInterval : m_nMinInterval;
+	if (!m_bFirstFrame) {
+		while (CTimer::GetClockTicks() - m_nLastFrameTicks < nInterval) {}
+	}
+	m_SMIMaster.WaitForDMA();
+	m_nLastFrameTicks = CTimer::GetClockTicks();
+	m_bFirstFrame = FALSE;
+
+	// Swap buffers, the new back buffer starts with the current LED state
+	TXDATA_T *pBuffer = m_pFrontBuffer;
+	m_pFrontBuffer = m_pBuffer;
+	m_pBuffer = pBuffer;
+	m_SMIMaster.SetupDMA(m_pFrontBuffer, m_nBufferLength * sizeof(TXDATA_T));
 	m_SMIMaster.WriteDMA(FALSE);
+	memcpy(m_pBuffer, m_pFrontBuffer, m_nBufferLength * sizeof(TXDATA_T));
+}
+
+void CWS2812OverSMI::SetFrameRate(unsigned nFramesPerSecond) {
+	m_nFrameInterval = nFramesPerSecond > 0 ? 1000000 / nFramesPerSecond : 0;
+}
+
+void CWS2812OverSMI::SetUpdateCompletionRoutine(TSMICompletionRoutine *pRoutine, void *pParam) {
+	m_SMIMaster.SetCompletionRoutine(pRoutine, pParam);
+}
+
+boolean CWS2812OverSMI::IsUpdateActive() const {
+	return m_SMIMaster.IsDMAActive();
+}
+
+void CWS2812OverSMI::WaitForUpdate() {
+	m_SMIMaster.WaitForDMA();
 }
 
 void CWS2812OverSMI::SetLED(unsigned nSDLine, unsigned nLEDIndexInStrip, u8 nRed, u8 nGreen, u8 nBlue) {
@@ -73,9 +125,8 @@ void CWS2812OverSMI::SetLED(unsigned nSDLine, unsigned nLEDIndexInStrip, u8 nRed
 	// Logic 1 is 0.8us high, 0.4 us low, logic 0 is 0.4us high, 0.8us low
 	TXDATA_T nLineMask = 1 << nSDLine;
 	// For each bit of the 24-bit GRB values...
+	// (1st byte or word is a high pulse on all lines, 3rd is a low pulse, both set in the constructor)
 	for (unsigned msk = 1<<(LED_NBITS-1); msk > 0; msk >>= 1) {
-		// 1st byte or word is a high pulse on all lines
-		txd[0] = (TXDATA_T) 0xffff;
 		// 2nd has high or low bits from data
 		if (m_bOnlyOneLine) {
 			if (grb & msk) txd[1] = nLineMask;
@@ -85,8 +136,6 @@ void CWS2812OverSMI::SetLED(unsigned nSDLine, unsigned nLEDIndexInStrip, u8 nRed
 			if (grb & msk) txd[1] |= nLineMask;
 			else txd[1] &= ~nLineMask;
 		}
-		// 3rd is a low pulse on all lines
-		txd[2] = 0;
 		txd += BIT_NPULSES;
 	}
 }
@@ -32,6 +32,7 @@
 #define LED_PREBITS		4   // Number of zero bits before LED data
 #define LED_POSTBITS	4   // Number of zero bits after LED data
 #define BIT_NPULSES		3   // Number of O/P pulses per LED bit
+#define LED_RESET_US	300 // Reset time between two frames in microseconds (> 280 for newer chips)
 
 
 // Length of data for 1 row (1 LED on each channel)
@@ -63,19 +64,33 @@
 #define NEOPIXEL_SMI_STROBE		20
 #define NEOPIXEL_SMI_HOLD		10
 #endif
+#define NEOPIXEL_SMI_CYCLE_NS	(NEOPIXEL_SMI_NS * (NEOPIXEL_SMI_SETUP + NEOPIXEL_SMI_STROBE + NEOPIXEL_SMI_HOLD + NEOPIXEL_SMI_PACE))
 
 
 class CWS2812OverSMI {
 public:
 	// nSDLinesMask may be for example (1 << 0) | (1 << 5) for 2 LED strips on SD0 (GPIO8) and SD5 (GPIO13)
-	CWS2812OverSMI(unsigned nSDLinesMask, unsigned nNumberOfLEDsPerStrip);
+	// pInterruptSystem is only required for SetUpdateCompletionRoutine()
+	CWS2812OverSMI(unsigned nSDLinesMask, unsigned nNumberOfLEDsPerStrip, CInterruptSystem *pInterruptSystem = 0);
 
 	~CWS2812OverSMI();
 
 	unsigned GetLEDCount() const;
 
+	// Starts sending the LED data by DMA and returns immediately (double-buffered).
+	// Waits for the previous frame to be sent and latched before, and for the next frame to be due, if SetFrameRate() has been called.
 	void Update();
 
+	// Limits the number of updates per second (0 for no limit, the default)
+	void SetFrameRate(unsigned nFramesPerSecond);
+
+	// The routine is called from interrupt context, when the data of a frame has been sent
+	void SetUpdateCompletionRoutine(TSMICompletionRoutine *pRoutine, void *pParam);
+
+	boolean IsUpdateActive() const;
+
+	void WaitForUpdate();
+
 	// Accordingly to the constructor, nSDLine may be for example 0 for the first strip on SD0 (GPIO8) or 5 for the second strip on SD5 (GPIO13)
 	void SetLED(unsigned nSDLine, unsigned nLEDIndexInStrip, u8 nRed, u8 nGreen, u8 nBlue);
 
@@ -83,8 +98,14 @@ private:
 	CSMIMaster m_SMIMaster;
 	unsigned m_nLEDCount;
 	boolean m_bDirty;
-	TXDATA_T *m_pBuffer;
+	unsigned m_nBufferLength;
+	TXDATA_T *m_pBuffer;		// written by SetLED()
+	TXDATA_T *m_pFrontBuffer;	// currently sent
 	boolean m_bOnlyOneLine;
+	unsigned m_nFrameInterval;	// requested, in microseconds
+	unsigned m_nMinInterval;	// transfer time and reset time
+	unsigned m_nLastFrameTicks;
+	boolean m_bFirstFrame;
 };
 
 #endif
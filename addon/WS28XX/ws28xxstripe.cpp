@@ -21,25 +21,117 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include "ws28xxstripe.h"
+#include <circle/timer.h>
 #include <circle/util.h>
 #include <assert.h>
 
+#define WS2801_LATCH_TIME	500		// microseconds
+#define WS2812_RESET_TIME	300		// microseconds, newer chips need more than 280
+
 CWS28XXStripe::CWS28XXStripe (TWS28XXType Type, unsigned nLEDCount, unsigned nClockSpeed,
 			      unsigned nSPIDevice)
 :	m_Type (Type),
 	m_nLEDCount (nLEDCount),
-	m_SPIMaster (m_Type == WS2801 ? nClockSpeed : 6400000, 0, 0, nSPIDevice)
+	m_nClockSpeed (m_Type == WS2801 ? nClockSpeed : 6400000),
+	m_pSPIMaster (new CSPIMaster (m_nClockSpeed, 0, 0, nSPIDevice)),
+	m_pSPIMasterDMA (0),
+	m_pFrontBuffer (0),
+	m_pDummyBuffer (0)
+{
+	assert (m_pSPIMaster != 0);
+
+	Setup ();
+}
+
+CWS28XXStripe::CWS28XXStripe (TWS28XXType Type, unsigned nLEDCount,
+			      CInterruptSystem *pInterruptSystem, unsigned nClockSpeed)
+:	m_Type (Type),
+	m_nLEDCount (nLEDCount),
+	m_nClockSpeed (m_Type == WS2801 ? nClockSpeed : 6400000),
+	m_pSPIMaster (0),
+	m_pSPIMasterDMA (new CSPIMasterDMA (pInterruptSystem, m_nClockSpeed)),
+	m_pFrontBuffer (0),
+	m_pDummyBuffer (0)
+{
+	assert (m_pSPIMasterDMA != 0);
+
+	Setup ();
+
+	// new returns cache-line aligned buffers, so these are suitable for DMA
+	m_pFrontBuffer = new u8[m_nBufSize];
+	assert (m_pFrontBuffer != 0);
+	memcpy (m_pFrontBuffer, m_pBuffer, m_nBufSize);
+
+	m_pDummyBuffer = new u8[m_nBufSize < WS28XX_DMA_CHUNK_SIZE ? m_nBufSize
+								   : WS28XX_DMA_CHUNK_SIZE];
+	assert (m_pDummyBuffer != 0);
+}
+
+CWS28XXStripe::~CWS28XXStripe (void)
+{
+	if (m_pSPIMasterDMA != 0)
+	{
+		WaitForUpdate ();
+	}
+
+	delete [] m_pDummyBuffer;
+	m_pDummyBuffer = 0;
+
+	delete [] m_pFrontBuffer;
+	m_pFrontBuffer = 0;
+
+	delete [] m_pBlackoutBuffer;
+	m_pBlackoutBuffer = 0;
+
+	delete [] m_pBuffer;
+	m_pBuffer = 0;
+
+	delete m_pSPIMasterDMA;
+	m_pSPIMasterDMA = 0;
+
+	delete m_pSPIMaster;
+	m_pSPIMaster = 0;
+}
+
+void CWS28XXStripe::Setup (void)
 {
 	assert (m_Type <= WS2812B);
 	assert (m_nLEDCount > 0);
 
+	m_pTxPointer = 0;
+	m_nTxRemaining = 0;
+	m_bTransferActive = FALSE;
+	m_pCompletionRoutine = 0;
+	m_pCompletionParam = 0;
+	m_nFrameInterval = 0;
+	m_nLastFrameTicks = 0;
+	m_bFirstFrame = TRUE;
+
 	m_nBufSize = m_nLEDCount * 3;
 	if (   m_Type == WS2812
 	    || m_Type == WS2812B)
 	{
 		m_nBufSize *= 8;
 	}
-	
+
+	// the next frame must not start before the previous one has been sent and latched
+	assert (m_nClockSpeed > 0);
+	m_nMinInterval =   (unsigned) ((u64) m_nBufSize * 8 * 1000000 / m_nClockSpeed)
+			 + (m_Type == WS2801 ? WS2801_LATCH_TIME : WS2812_RESET_TIME);
+
+	// precompute the SPI code bytes for each possible color value
+	u8 nHighCode = m_Type == WS2812 ? 0xF0 : 0xF8;
+	for (unsigned nValue = 0; nValue < 256; nValue++)
+	{
+		u8 Code[8];
+		for (unsigned i = 0; i < 8; i++)
+		{
+			Code[i] = nValue & (0x80 >> i) ? nHighCode : 0xC0;
+		}
+
+		memcpy (&m_EncodeTable[nValue], Code, sizeof Code);
+	}
+
 	m_pBuffer = new u8[m_nBufSize];
 	assert (m_pBuffer != 0);
 
@@ -53,18 +145,15 @@ CWS28XXStripe::CWS28XXStripe (TWS28XXType Type, unsigned nLEDCount, unsigned nCl
 	memset (m_pBlackoutBuffer, m_Type == WS2801 ? 0 : 0xC0, m_nBufSize);
 }
 
-CWS28XXStripe::~CWS28XXStripe (void)
-{
-	delete [] m_pBlackoutBuffer;
-	m_pBlackoutBuffer = 0;
-
-	delete [] m_pBuffer;
-	m_pBuffer = 0;
-}
-
 boolean CWS28XXStripe::Initialize (void)
 {
-	return m_SPIMaster.Initialize ();
+	if (m_pSPIMasterDMA != 0)
+	{
+		return m_pSPIMasterDMA->Initialize ();
+	}
+
+	assert (m_pSPIMaster != 0);
+	return m_pSPIMaster->Initialize ();
 }
 
 unsigned CWS28XXStripe::GetLEDCount (void) const
@@ -98,33 +187,169 @@ void CWS28XXStripe::SetLED (unsigned nLEDIndex, u8 nRed, u8 nGreen, u8 nBlue)
 boolean CWS28XXStripe::Update (void)
 {
 	assert (m_pBuffer != 0);
-	return m_SPIMaster.Write (0, m_pBuffer, m_nBufSize) == (int) m_nBufSize;
+
+	WaitForNextFrame ();
+
+	if (m_pSPIMasterDMA == 0)
+	{
+		assert (m_pSPIMaster != 0);
+		return m_pSPIMaster->Write (0, m_pBuffer, m_nBufSize) == (int) m_nBufSize;
+	}
+
+	WaitForUpdate ();
+
+	// swap buffers, the new back buffer starts with the current LED state
+	assert (m_pFrontBuffer != 0);
+	u8 *pBuffer = m_pFrontBuffer;
+	m_pFrontBuffer = m_pBuffer;
+	m_pBuffer = pBuffer;
+
+	boolean bOK = StartTransfer (m_pFrontBuffer);
+
+	memcpy (m_pBuffer, m_pFrontBuffer, m_nBufSize);
+
+	return bOK;
 }
 
 boolean CWS28XXStripe::Blackout (void)
 {
 	assert (m_pBlackoutBuffer != 0);
-	return m_SPIMaster.Write (0, m_pBlackoutBuffer, m_nBufSize) == (int) m_nBufSize;
+
+	WaitForNextFrame ();
+
+	if (m_pSPIMasterDMA == 0)
+	{
+		assert (m_pSPIMaster != 0);
+		return m_pSPIMaster->Write (0, m_pBlackoutBuffer, m_nBufSize) == (int) m_nBufSize;
+	}
+
+	WaitForUpdate ();
+
+	return StartTransfer (m_pBlackoutBuffer);
+}
+
+void CWS28XXStripe::SetFrameRate (unsigned nFramesPerSecond)
+{
+	m_nFrameInterval = nFramesPerSecond > 0 ? 1000000 / nFramesPerSecond : 0;
+}
+
+void CWS28XXStripe::SetUpdateCompletionRoutine (TWS28XXCompletionRoutine *pRoutine, void *pParam)
+{
+	assert (m_pSPIMasterDMA != 0);
+
+	WaitForUpdate ();
+
+	m_pCompletionParam = pParam;
+	m_pCompletionRoutine = pRoutine;
+}
+
+boolean CWS28XXStripe::IsUpdateActive (void) const
+{
+	return m_bTransferActive;
+}
+
+void CWS28XXStripe::WaitForUpdate (void)
+{
+	while (m_bTransferActive)
+	{
+		// just wait
+	}
 }
 
 void CWS28XXStripe::SetColorWS2812 (unsigned nOffset, u8 nValue)
 {
 	assert (m_Type != WS2801);
-	u8 nHighCode = m_Type == WS2812 ? 0xF0 : 0xF8;
-
 	assert (nOffset+7 < m_nBufSize);
+	assert (!(nOffset & 7));
+
+	*(u64 *) &m_pBuffer[nOffset] = m_EncodeTable[nValue];
+}
 
-	for (u8 nMask = 0x80; nMask != 0; nMask >>= 1)
+void CWS28XXStripe::WaitForNextFrame (void)
+{
+	unsigned nInterval = m_nFrameInterval;
+	if (   m_pSPIMasterDMA != 0
+	    && nInterval < m_nMinInterval)
 	{
-		if (nValue & nMask)
-		{
-			m_pBuffer[nOffset] = nHighCode;
-		}
-		else
+		nInterval = m_nMinInterval;
+	}
+
+	if (!m_bFirstFrame)
+	{
+		while (CTimer::GetClockTicks () - m_nLastFrameTicks < nInterval)
 		{
-			m_pBuffer[nOffset] = 0xC0;
+			// just wait
 		}
+	}
 
-		nOffset++;
+	m_nLastFrameTicks = CTimer::GetClockTicks ();
+	m_bFirstFrame = FALSE;
+}
+
+boolean CWS28XXStripe::StartTransfer (const u8 *pBuffer)
+{
+	assert (m_pSPIMasterDMA != 0);
+	assert (!m_bTransferActive);
+
+	assert (pBuffer != 0);
+	assert (!((uintptr) pBuffer & 3));
+	m_pTxPointer = pBuffer;
+	m_nTxRemaining = m_nBufSize;
+
+	m_bTransferActive = TRUE;
+
+	StartChunk ();
+
+	return TRUE;
+}
+
+void CWS28XXStripe::StartChunk (void)
+{
+	assert (m_pSPIMasterDMA != 0);
+	assert (m_nTxRemaining > 0);
+
+	unsigned nCount = m_nTxRemaining;
+	if (nCount > WS28XX_DMA_CHUNK_SIZE)
+	{
+		nCount = WS28XX_DMA_CHUNK_SIZE;
+	}
+
+	// the completion routine is reset by CSPIMasterDMA after each transfer
+	m_pSPIMasterDMA->SetCompletionRoutine (ChunkCompletionStub, this);
+
+	assert (m_pTxPointer != 0);
+	assert (m_pDummyBuffer != 0);
+	m_pSPIMasterDMA->StartWriteRead (0, m_pTxPointer, m_pDummyBuffer, nCount);
+
+	m_pTxPointer += nCount;
+	m_nTxRemaining -= nCount;
+}
+
+void CWS28XXStripe::ChunkCompletionRoutine (boolean bStatus)
+{
+	assert (m_bTransferActive);
+
+	if (   bStatus
+	    && m_nTxRemaining > 0)
+	{
+		StartChunk ();
+
+		return;
 	}
+
+	m_nTxRemaining = 0;
+	m_bTransferActive = FALSE;
+
+	if (m_pCompletionRoutine != 0)
+	{
+		(*m_pCompletionRoutine) (bStatus, m_pCompletionParam);
+	}
+}
+
+void CWS28XXStripe::ChunkCompletionStub (boolean bStatus, void *pParam)
+{
+	CWS28XXStripe *pThis = (CWS28XXStripe *) pParam;
+	assert (pThis != 0);
+
+	pThis->ChunkCompletionRoutine (bStatus);
 }
@@ -24,6 +24,8 @@
 #define _ws28xx_ws28xxstripe_h
 
 #include <circle/spimaster.h>
+#include <circle/spimasterdma.h>
+#include <circle/interrupt.h>
 #include <circle/types.h>
 
 enum TWS28XXType
@@ -34,12 +36,20 @@ enum TWS28XXType
 	SK6812 = WS2812B
 };
 
+// called from interrupt context, when an asynchronous update has been completed
+typedef void TWS28XXCompletionRoutine (boolean bStatus, void *pParam);
+
+#define WS28XX_DMA_CHUNK_SIZE	65520	// max. bytes per SPI DMA transfer (multiple of 24 and 4)
+
 class CWS28XXStripe
 {
 public:
 	// nClockSpeed is only variable on WS2801, otherwise ignored
 	CWS28XXStripe (TWS28XXType Type, unsigned nLEDCount, unsigned nClockSpeed = 4000000,
 		       unsigned nSPIDevice = 0);
+	// double-buffered DMA mode on SPI0, Update() returns before the data has been sent
+	CWS28XXStripe (TWS28XXType Type, unsigned nLEDCount, CInterruptSystem *pInterruptSystem,
+		       unsigned nClockSpeed = 4000000);
 	~CWS28XXStripe (void);
 
 	boolean Initialize (void);
@@ -52,16 +62,53 @@ public:
 
 	boolean Blackout (void);		// temporary switch all LEDs off
 
+	// limit the number of updates per second (0 for no limit, the default),
+	// Update() waits until the next frame is due
+	void SetFrameRate (unsigned nFramesPerSecond);
+
+	// DMA mode only
+	void SetUpdateCompletionRoutine (TWS28XXCompletionRoutine *pRoutine, void *pParam);
+	boolean IsUpdateActive (void) const;
+	void WaitForUpdate (void);
+
 private:
+	void Setup (void);
+
 	void SetColorWS2812 (unsigned nOffset, u8 nValue);
 
+	void WaitForNextFrame (void);
+
+	boolean StartTransfer (const u8 *pBuffer);
+	void StartChunk (void);
+	void ChunkCompletionRoutine (boolean bStatus);
+	static void ChunkCompletionStub (boolean bStatus, void *pParam);
+
 private:
 	TWS28XXType	 m_Type;
 	unsigned	 m_nLEDCount;
+	unsigned	 m_nClockSpeed;
 	unsigned	 m_nBufSize;
-	u8		*m_pBuffer;
+	u8		*m_pBuffer;		// written by SetLED()
 	u8		*m_pBlackoutBuffer;
-	CSPIMaster	 m_SPIMaster;
+	CSPIMaster	*m_pSPIMaster;
+	CSPIMasterDMA	*m_pSPIMasterDMA;
+
+	u64		 m_EncodeTable[256];	// WS2812: one code byte per data bit
+
+	// DMA mode
+	u8		*m_pFrontBuffer;	// currently sent
+	u8		*m_pDummyBuffer;	// receives the MISO data
+	const u8	*m_pTxPointer;
+	unsigned	 m_nTxRemaining;
+	volatile boolean m_bTransferActive;
+	TWS28XXCompletionRoutine *m_pCompletionRoutine;
+	void		*m_pCompletionParam;
+
+	// frame rate control
+	unsigned	 m_nFrameInterval;	// requested, in microseconds
+	unsigned	 m_nMinInterval;	// transfer time and reset/latch time
+	unsigned	 m_nLastFrameTicks;
+	boolean	 m_bFirstFrame;
 };
 
 #endif
@@ -25,6 +25,7 @@
 // THE SOFTWARE.
 //
 #include <display/st7789display.h>
+#include <circle/new.h>
 #include <assert.h>
 
 #define ST7789_NOP	0x00
@@ -88,6 +89,7 @@ CST7789Display::CST7789Display (CSPIMaster *pSPIMaster,
 				unsigned CPOL, unsigned CPHA, unsigned nClockSpeed,
 				unsigned nChipSelect)
 :	m_pSPIMaster (pSPIMaster),
+	m_pSPIMasterDMA (0),
 	m_nResetPin (nResetPin),
 	m_nBackLightPin (nBackLightPin),
 	m_nWidth (nWidth),
@@ -97,10 +99,54 @@ CST7789Display::CST7789Display (CSPIMaster *pSPIMaster,
 	m_nClockSpeed (nClockSpeed),
 	m_nChipSelect (nChipSelect),
 	m_DCPin (nDCPin, GPIOModeOutput),
-	m_pTimer (CTimer::Get ())
+	m_pTimer (CTimer::Get ()),
+	m_pChunkBuffer (0),
+	m_pReadBuffer (0),
+	m_bChunkActive (FALSE),
+	m_nDirtyRects (0)
 {
 	assert (nDCPin != None);
 
+	SetupPins ();
+}
+
+CST7789Display::CST7789Display (CSPIMasterDMA *pSPIMasterDMA,
+				unsigned nDCPin, unsigned nResetPin, unsigned nBackLightPin,
+				unsigned nWidth, unsigned nHeight,
+				unsigned CPOL, unsigned CPHA, unsigned nClockSpeed,
+				unsigned nChipSelect)
+:	m_pSPIMaster (0),
+	m_pSPIMasterDMA (pSPIMasterDMA),
+	m_nResetPin (nResetPin),
+	m_nBackLightPin (nBackLightPin),
+	m_nWidth (nWidth),
+	m_nHeight (nHeight),
+	m_CPOL (CPOL),
+	m_CPHA (CPHA),
+	m_nClockSpeed (nClockSpeed),
+	m_nChipSelect (nChipSelect),
+	m_DCPin (nDCPin, GPIOModeOutput),
+	m_pTimer (CTimer::Get ()),
+	m_pChunkBuffer (0),
+	m_pReadBuffer (0),
+	m_bChunkActive (FALSE),
+	m_nDirtyRects (0)
+{
+	assert (nDCPin != None);
+
+	SetupPins ();
+}
+
+CST7789Display::~CST7789Display (void)
+{
+	WaitChunk ();
+
+	delete [] m_pChunkBuffer;
+	m_pChunkBuffer = 0;
+}
+
+void CST7789Display::SetupPins (void)
+{
 	if (m_nBackLightPin != None)
 	{
 		m_BackLightPin.AssignPin (m_nBackLightPin);
@@ -116,9 +162,20 @@ CST7789Display::CST7789Display (CSPIMaster *pSPIMaster,
 
 boolean CST7789Display::Initialize (void)
 {
-	assert (m_pSPIMaster != 0);
+	assert (m_pSPIMaster != 0 || m_pSPIMasterDMA != 0);
 	assert (m_pTimer != 0);
 
+	// two chunks for double buffering and a read buffer for DMA
+	m_pChunkBuffer = new (HEAP_DMA30) u8[3 * ST7789_CHUNK_SIZE];
+	if (m_pChunkBuffer == 0)
+	{
+		return FALSE;
+	}
+
+	m_pChunk[0] = (u16 *) m_pChunkBuffer;
+	m_pChunk[1] = (u16 *) (m_pChunkBuffer + ST7789_CHUNK_SIZE);
+	m_pReadBuffer = m_pChunkBuffer + 2 * ST7789_CHUNK_SIZE;
+
 	if (m_nBackLightPin != None)
 	{
 		m_BackLightPin.Write (LOW);
@@ -289,6 +346,163 @@ void CST7789Display::DrawText (unsigned nPosX, unsigned nPosY, const char *pStri
 	}
 }
 
+void CST7789Display::WriteArea (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight,
+				const u16 *pPixels, unsigned nPitch)
+{
+	assert (nWidth > 0);
+	assert (nHeight > 0);
+	assert (pPixels != 0);
+	assert (m_pChunkBuffer != 0);
+
+	if (nPitch == 0)
+	{
+		nPitch = nWidth;
+	}
+	assert (nPitch >= nWidth);
+
+	SetWindow (nPosX, nPosY, nPosX+nWidth-1, nPosY+nHeight-1);
+
+	const unsigned nChunkPixels = ST7789_CHUNK_SIZE / sizeof (u16);
+	unsigned nPixels = nWidth * nHeight;
+	unsigned nLine = 0;
+	unsigned nColumn = 0;
+	unsigned nChunk = 0;
+
+	while (nPixels > 0)
+	{
+		unsigned nCount = nPixels < nChunkPixels ? nPixels : nChunkPixels;
+
+		// the display expects big endian pixels
+		u16 *pTo = m_pChunk[nChunk];
+		const u16 *pFrom = &pPixels[nLine * nPitch + nColumn];
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			pTo[i] = bswap16 (*pFrom++);
+
+			if (++nColumn == nWidth)
+			{
+				nColumn = 0;
+				pFrom += nPitch - nWidth;
+				nLine++;
+			}
+		}
+
+		SendChunk (pTo, nCount * sizeof (u16));
+
+		nPixels -= nCount;
+		nChunk ^= 1;
+	}
+
+	WaitChunk ();
+}
+
+void CST7789Display::MarkDirty (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight)
+{
+	if (   nPosX >= m_nWidth
+	    || nPosY >= m_nHeight
+	    || nWidth == 0
+	    || nHeight == 0)
+	{
+		return;
+	}
+
+	TRect Rect = {nPosX, nPosY, nPosX + nWidth, nPosY + nHeight};
+	if (Rect.nX2 > m_nWidth)
+	{
+		Rect.nX2 = m_nWidth;
+	}
+	if (Rect.nY2 > m_nHeight)
+	{
+		Rect.nY2 = m_nHeight;
+	}
+
+	// merge with an overlapping or adjacent rectangle
+	for (unsigned i = 0; i < m_nDirtyRects; i++)
+	{
+		TRect *pRect = &m_DirtyRect[i];
+
+		if (   Rect.nX1 <= pRect->nX2 && pRect->nX1 <= Rect.nX2
+		    && Rect.nY1 <= pRect->nY2 && pRect->nY1 <= Rect.nY2)
+		{
+			Unite (pRect, Rect);
+
+			return;
+		}
+	}
+
+	if (m_nDirtyRects < ST7789_DIRTY_RECTS)
+	{
+		m_DirtyRect[m_nDirtyRects++] = Rect;
+
+		return;
+	}
+
+	// list is full, merge with the rectangle, which grows least
+	unsigned nBest = 0;
+	unsigned nBestGrowth = (unsigned) -1;
+	for (unsigned i = 0; i < m_nDirtyRects; i++)
+	{
+		TRect Union = m_DirtyRect[i];
+		Unite (&Union, Rect);
+
+		unsigned nGrowth =   (Union.nX2 - Union.nX1) * (Union.nY2 - Union.nY1)
+				   - (m_DirtyRect[i].nX2 - m_DirtyRect[i].nX1)
+				     * (m_DirtyRect[i].nY2 - m_DirtyRect[i].nY1);
+		if (nGrowth < nBestGrowth)
+		{
+			nBest = i;
+			nBestGrowth = nGrowth;
+		}
+	}
+
+	Unite (&m_DirtyRect[nBest], Rect);
+}
+
+void CST7789Display::Update (const u16 *pFrameBuffer)
+{
+	assert (pFrameBuffer != 0);
+
+	for (unsigned i = 0; i < m_nDirtyRects; i++)
+	{
+		const TRect *pRect = &m_DirtyRect[i];
+
+		WriteArea (pRect->nX1, pRect->nY1,
+			   pRect->nX2 - pRect->nX1, pRect->nY2 - pRect->nY1,
+			   &pFrameBuffer[pRect->nY1 * m_nWidth + pRect->nX1], m_nWidth);
+	}
+
+	m_nDirtyRects = 0;
+}
+
+void CST7789Display::UpdateHandler (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight,
+				    const void *pPixels, void *pParam)
+{
+	CST7789Display *pThis = (CST7789Display *) pParam;
+	assert (pThis != 0);
+
+	pThis->WriteArea (nPosX, nPosY, nWidth, nHeight, (const u16 *) pPixels);
+}
+
+void CST7789Display::Unite (TRect *pRect, const TRect &rOther)
+{
+	if (rOther.nX1 < pRect->nX1)
+	{
+		pRect->nX1 = rOther.nX1;
+	}
+	if (rOther.nY1 < pRect->nY1)
+	{
+		pRect->nY1 = rOther.nY1;
+	}
+	if (rOther.nX2 > pRect->nX2)
+	{
+		pRect->nX2 = rOther.nX2;
+	}
+	if (rOther.nY2 > pRect->nY2)
+	{
+		pRect->nY2 = rOther.nY2;
+	}
+}
+
 void CST7789Display::SetWindow (unsigned x0, unsigned y0, unsigned x1, unsigned y1)
 {
 	assert (x0 <= x1);
@@ -313,6 +527,22 @@ void CST7789Display::SetWindow (unsigned x0, unsigned y0, unsigned x1, unsigned
 
 void CST7789Display::SendByte (u8 uchByte, boolean bIsData)
 {
+	if (m_pSPIMasterDMA != 0)
+	{
+		m_DCPin.Write (bIsData ? HIGH : LOW);
+
+		m_pSPIMasterDMA->SetClock (m_nClockSpeed);
+		m_pSPIMasterDMA->SetMode (m_CPOL, m_CPHA);
+
+#ifndef NDEBUG
+		int nResult =
+#endif
+			m_pSPIMasterDMA->WriteReadSync (m_nChipSelect, &uchByte, 0, sizeof uchByte);
+		assert (nResult == (int) sizeof uchByte);
+
+		return;
+	}
+
 	assert (m_pSPIMaster != 0);
 
 	m_DCPin.Write (bIsData ? HIGH : LOW);
@@ -331,6 +561,23 @@ void CST7789Display::SendData (const void *pData, size_t nLength)
 {
 	assert (pData != 0);
 	assert (nLength > 0);
+
+	if (m_pSPIMasterDMA != 0)
+	{
+		m_DCPin.Write (HIGH);
+
+		m_pSPIMasterDMA->SetClock (m_nClockSpeed);
+		m_pSPIMasterDMA->SetMode (m_CPOL, m_CPHA);
+
+#ifndef NDEBUG
+		int nResult =
+#endif
+			m_pSPIMasterDMA->WriteReadSync (m_nChipSelect, pData, 0, nLength);
+		assert (nResult == (int) nLength);
+
+		return;
+	}
+
 	assert (m_pSPIMaster != 0);
 
 	m_DCPin.Write (HIGH);
@@ -344,3 +591,47 @@ void CST7789Display::SendData (const void *pData, size_t nLength)
 		m_pSPIMaster->Write (m_nChipSelect, pData, nLength);
 	assert (nResult == (int) nLength);
 }
+
+void CST7789Display::SendChunk (const void *pData, size_t nLength)
+{
+	if (m_pSPIMasterDMA == 0)
+	{
+		SendData (pData, nLength);
+
+		return;
+	}
+
+	assert (pData != 0);
+	assert (nLength > 0);
+	assert (nLength <= ST7789_CHUNK_SIZE);
+
+	// the previous chunk has been converted, while this one had been transferred
+	WaitChunk ();
+
+	m_DCPin.Write (HIGH);
+
+	m_pSPIMasterDMA->SetClock (m_nClockSpeed);
+	m_pSPIMasterDMA->SetMode (m_CPOL, m_CPHA);
+
+	m_bChunkActive = TRUE;
+
+	m_pSPIMasterDMA->SetCompletionRoutine (ChunkCompletionRoutine, this);
+	m_pSPIMasterDMA->StartWriteRead (m_nChipSelect, pData, m_pReadBuffer, nLength);
+}
+
+void CST7789Display::WaitChunk (void)
+{
+	while (m_bChunkActive)
+	{
+		// just wait
+	}
+}
+
+void CST7789Display::ChunkCompletionRoutine (boolean bStatus, void *pParam)
+{
+	CST7789Display *pThis = (CST7789Display *) pParam;
+	assert (pThis != 0);
+
+	assert (bStatus);
+	pThis->m_bChunkActive = FALSE;
+}
@@ -21,12 +21,21 @@
 #define _display_st7789display_h
 
 #include <circle/spimaster.h>
+#include <circle/spimasterdma.h>
 #include <circle/gpiopin.h>
 #include <circle/chargenerator.h>
 #include <circle/timer.h>
 #include <circle/util.h>
 #include <circle/types.h>
 
+#ifndef ST7789_DIRTY_RECTS
+#define ST7789_DIRTY_RECTS	8		///< Tracked for Update(), merged if exceeded
+#endif
+
+#ifndef ST7789_CHUNK_SIZE
+#define ST7789_CHUNK_SIZE	4096		///< Bytes per SPI transfer in WriteArea()
+#endif
+
 class CST7789Display	/// Driver for ST7789-based dot-matrix displays
 {
 public:
@@ -62,6 +71,17 @@ public:
 			unsigned CPOL = 0, unsigned CPHA = 0, unsigned nClockSpeed = 15000000,
 			unsigned nChipSelect = 0);
 
+	/// \brief Same as above, but pixel data is sent by DMA (SPI0 only)
+	/// \param pSPIMasterDMA Pointer to SPI master object with DMA support
+	/// \note The other parameters are the same as above.
+	CST7789Display (CSPIMasterDMA *pSPIMasterDMA,
+			unsigned nDCPin, unsigned nResetPin = None, unsigned nBackLightPin = None,
+			unsigned nWidth = 240, unsigned nHeight = 240,
+			unsigned CPOL = 0, unsigned CPHA = 0, unsigned nClockSpeed = 15000000,
+			unsigned nChipSelect = 0);
+
+	~CST7789Display (void);
+
 	/// \return Display width in number of pixels
 	unsigned GetWidth (void) const		{ return m_nWidth; }
 	/// \return Display height in number of pixels
@@ -94,6 +114,35 @@ public:
 	void DrawText (unsigned nPosX, unsigned nPosY, const char *pString,
 		       TST7789Color Color, TST7789Color BgColor = ST7789_BLACK_COLOR);
 
+	/// \brief Write a rectangular area of pixels (partial update)
+	/// \param nPosX X-position of the area (0..width-1)
+	/// \param nPosY Y-position of the area (0..height-1)
+	/// \param nWidth Width of the area in number of pixels
+	/// \param nHeight Height of the area in number of pixels
+	/// \param pPixels RGB565 pixels in native byte order (e.g. from lvgl with LV_COLOR_DEPTH 16)
+	/// \param nPitch Distance between the starts of two lines in pPixels in number of pixels
+	///	   (0 for nWidth)
+	/// \note The pixels are converted in chunks. With DMA the next chunk is converted,
+	///	  while the previous one is transferred.
+	void WriteArea (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight,
+			const u16 *pPixels, unsigned nPitch = 0);
+
+	/// \brief Mark an area of the frame buffer handed over to Update() as modified
+	/// \param nPosX X-position of the area (0..width-1)
+	/// \param nPosY Y-position of the area (0..height-1)
+	/// \param nWidth Width of the area in number of pixels
+	/// \param nHeight Height of the area in number of pixels
+	void MarkDirty (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight);
+
+	/// \brief Write the areas marked with MarkDirty() from a frame buffer to the display
+	/// \param pFrameBuffer RGB565 pixels in native byte order of the whole display
+	void Update (const u16 *pFrameBuffer);
+
+	/// \brief Calls WriteArea() for the display object pParam, e.g. as CLVGL::TDisplayUpdateHandler
+	/// \note Requires LV_COLOR_DEPTH 16 and LV_COLOR_16_SWAP 0 with LVGL.
+	static void UpdateHandler (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight,
+				   const void *pPixels, void *pParam);
+
 private:
 	void SetWindow (unsigned x0, unsigned y0, unsigned x1, unsigned y1);
 
@@ -104,8 +153,23 @@ private:
 
 	void SendData (const void *pData, size_t nLength);
 
+	void SendChunk (const void *pData, size_t nLength);
+	void WaitChunk (void);
+	static void ChunkCompletionRoutine (boolean bStatus, void *pParam);
+
+	void SetupPins (void);
+
+	struct TRect
+	{
+		unsigned nX1, nY1;
+		unsigned nX2, nY2;	// exclusive
+	};
+
+	static void Unite (TRect *pRect, const TRect &rOther);
+
 private:
 	CSPIMaster *m_pSPIMaster;
+	CSPIMasterDMA *m_pSPIMasterDMA;
 	unsigned m_nResetPin;
 	unsigned m_nBackLightPin;
 	unsigned m_nWidth;
@@ -121,6 +185,14 @@ private:
 
 	CCharGenerator m_CharGen;
 	CTimer *m_pTimer;
+
+	u8 *m_pChunkBuffer;
+	u16 *m_pChunk[2];
+	u8 *m_pReadBuffer;			// dummy for CSPIMasterDMA::StartWriteRead()
+	volatile boolean m_bChunkActive;
+
+	TRect m_DirtyRect[ST7789_DIRTY_RECTS];
+	unsigned m_nDirtyRects;
 };
 
 #endif
@@ -0,0 +1,145 @@
+/*-----------------------------------------------------------------------*/
+/* Contiguous file helper for FatFs                                      */
+/* Implementation for Circle by R. Stange <rsta2@o2online.de>            */
+/*-----------------------------------------------------------------------*/
+
+#include "contigfile.h"
+#include "diskio.h"
+#include <assert.h>
+
+#if FF_USE_EXPAND && !FF_FS_READONLY
+
+#define SECTOR_SIZE		FF_MIN_SS
+
+/* The direct writes do not maintain fp->clust, so that f_lseek() has to */
+/* walk the cluster chain from the start of the file.                     */
+static FRESULT seek_contiguous (
+	FIL* fp,			/* Pointer to the file object */
+	FSIZE_t ofs			/* File pointer from top of file */
+)
+{
+	fp->fptr = 0;
+
+	return f_lseek (fp, ofs);
+}
+
+FRESULT f_open_contiguous (
+	FIL* fp,			/* Pointer to the blank file object */
+	const TCHAR* path,	/* Pointer to the file name */
+	FSIZE_t size		/* Number of bytes to be preallocated */
+)
+{
+	assert (fp != 0);
+
+	FRESULT res = f_open (fp, path, FA_WRITE | FA_CREATE_ALWAYS);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	/* Allocate a contiguous cluster block and write the FAT and the directory entry */
+	res = f_expand (fp, size, 1);
+	if (res == FR_OK)
+	{
+		res = f_sync (fp);
+	}
+
+	if (res != FR_OK)
+	{
+		f_close (fp);
+		f_unlink (path);
+	}
+
+	return res;
+}
+
+FRESULT f_write_contiguous (
+	FIL* fp,			/* Pointer to the file object */
+	const void* buff,	/* Pointer to the data to be written */
+	UINT btw,			/* Number of bytes to write */
+	UINT* bw			/* Pointer to number of bytes written */
+)
+{
+	assert (fp != 0);
+	assert (buff != 0);
+	assert (bw != 0);
+
+	*bw = 0;
+
+	FATFS *fs = fp->obj.fs;
+	if (   fs == 0
+	    || fp->obj.sclust == 0
+	    || fp->fptr % SECTOR_SIZE != 0)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	if (btw > fp->obj.objsize - fp->fptr)
+	{
+		return FR_DENIED;
+	}
+
+	/* The cluster block is contiguous, so that the sector follows from the file pointer */
+	UINT count = btw / SECTOR_SIZE;
+	if (count > 0)
+	{
+		LBA_t sector =   fs->database
+			       + (LBA_t) fs->csize * (fp->obj.sclust - 2)
+			       + (LBA_t) (fp->fptr / SECTOR_SIZE);
+
+		if (disk_write (fs->pdrv, (const BYTE *) buff, sector, count) != RES_OK)
+		{
+			return FR_DISK_ERR;
+		}
+
+		fp->fptr += count * SECTOR_SIZE;
+		*bw = count * SECTOR_SIZE;
+	}
+
+	UINT rest = btw % SECTOR_SIZE;
+	if (rest > 0)
+	{
+		FRESULT res = seek_contiguous (fp, fp->fptr);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+
+		UINT written;
+		res = f_write (fp, (const BYTE *) buff + count * SECTOR_SIZE, rest, &written);
+		*bw += written;
+
+		return res;
+	}
+
+	return FR_OK;
+}
+
+FRESULT f_close_contiguous (
+	FIL* fp				/* Pointer to the file object to be closed */
+)
+{
+	assert (fp != 0);
+
+	if (fp->obj.fs == 0)
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	FRESULT res = FR_OK;
+	if (fp->fptr < fp->obj.objsize)
+	{
+		/* Free the clusters, which have not been written */
+		res = seek_contiguous (fp, fp->fptr);
+		if (res == FR_OK)
+		{
+			res = f_truncate (fp);
+		}
+	}
+
+	FRESULT res2 = f_close (fp);
+
+	return res != FR_OK ? res : res2;
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*-----------------------------------------------------------------------/
+/  Contiguous file helper for FatFs                                      /
+/  Implementation for Circle by R. Stange <rsta2@o2online.de>            /
+/-----------------------------------------------------------------------*/
+
+#ifndef _CONTIGFILE_DEFINED
+#define _CONTIGFILE_DEFINED
+
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if FF_USE_EXPAND && !FF_FS_READONLY
+
+/* Create a file and preallocate size bytes in one contiguous cluster     */
+/* block. The allocation is written to the medium at once, so that later  */
+/* writes with f_write_contiguous() do not touch the FAT and the directory */
+/* any more. The file has to be closed with f_close_contiguous().         */
+FRESULT f_open_contiguous (FIL* fp, const TCHAR* path, FSIZE_t size);
+
+/* Write to the preallocated area at the file pointer. Whole sectors are  */
+/* written directly to the medium with one multi-sector request. A final  */
+/* partial sector is written through the file buffer, so that following   */
+/* calls fail with FR_INVALID_PARAMETER, because the file pointer is not  */
+/* sector aligned any more. Writing beyond the preallocated size fails    */
+/* with FR_DENIED.                                                        */
+FRESULT f_write_contiguous (FIL* fp, const void* buff, UINT btw, UINT* bw);
+
+/* Truncate the file to the written size, free the unused clusters and    */
+/* close the file                                                         */
+FRESULT f_close_contiguous (FIL* fp);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
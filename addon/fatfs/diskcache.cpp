@@ -0,0 +1,466 @@
+/*-----------------------------------------------------------------------*/
+/* Write-back sector cache between FatFs and the block devices           */
+/* Implementation for Circle by R. Stange <rsta2@o2online.de>            */
+/*-----------------------------------------------------------------------*/
+
+#include "diskcache.h"
+#include <circle/util.h>
+#include <assert.h>
+
+#if DISK_CACHE_SECTORS > 0
+
+CDiskCache::CDiskCache (void)
+:	m_pHead (0),
+	m_pTail (0)
+{
+	for (unsigned i = 0; i < DISK_CACHE_HASH_SIZE; i++)
+	{
+		m_pHash[i] = 0;
+	}
+
+	for (unsigned i = 0; i < DISK_CACHE_SECTORS; i++)
+	{
+		TEntry *pEntry = &m_Entry[i];
+
+		pEntry->Sector = 0;
+		pEntry->Drive = 0;
+		pEntry->pDevice = 0;
+		pEntry->bValid = FALSE;
+		pEntry->bDirty = FALSE;
+		pEntry->pHashNext = 0;
+		pEntry->pData = m_Data[i];
+
+		/* append to LRU list */
+		pEntry->pPrev = m_pTail;
+		pEntry->pNext = 0;
+		if (m_pTail != 0)
+		{
+			m_pTail->pNext = pEntry;
+		}
+		else
+		{
+			m_pHead = pEntry;
+		}
+		m_pTail = pEntry;
+	}
+}
+
+CDiskCache::~CDiskCache (void)
+{
+	m_pHead = 0;
+	m_pTail = 0;
+}
+
+boolean CDiskCache::Read (BYTE pdrv, CDevice *pDevice, BYTE *buff, LBA_t sector, UINT count)
+{
+	assert (pDevice != 0);
+	assert (buff != 0);
+
+	m_Lock.Acquire ();
+
+	boolean bOK = TRUE;
+
+	if (count > DISK_CACHE_MAX_REQUEST)
+	{
+		/* the cache is write-back, so the device has to be up to date first */
+		bOK =    WriteBack (pdrv, sector, count)
+		      && DeviceRead (pDevice, buff, sector, count);
+
+		m_Lock.Release ();
+
+		return bOK;
+	}
+
+	for (; count > 0; count--, sector++, buff += DISK_CACHE_SECTOR_SIZE)
+	{
+		TEntry *pEntry = Lookup (pdrv, sector);
+		if (pEntry == 0)
+		{
+			pEntry = Allocate (pdrv, pDevice, sector);
+			if (pEntry == 0)
+			{
+				bOK = FALSE;
+
+				break;
+			}
+
+			if (!DeviceRead (pDevice, pEntry->pData, sector, 1))
+			{
+				RemoveHash (pEntry);
+				pEntry->bValid = FALSE;
+
+				bOK = FALSE;
+
+				break;
+			}
+		}
+
+		memcpy (buff, pEntry->pData, DISK_CACHE_SECTOR_SIZE);
+
+		Touch (pEntry);
+	}
+
+	m_Lock.Release ();
+
+	return bOK;
+}
+
+boolean CDiskCache::Write (BYTE pdrv, CDevice *pDevice, const BYTE *buff, LBA_t sector, UINT count)
+{
+	assert (pDevice != 0);
+	assert (buff != 0);
+
+	m_Lock.Acquire ();
+
+	boolean bOK = TRUE;
+
+	if (count > DISK_CACHE_MAX_REQUEST)
+	{
+		bOK = DeviceWrite (pDevice, buff, sector, count);
+		if (bOK)
+		{
+			/* keep cached copies coherent, they are clean now */
+			for (unsigned i = 0; i < DISK_CACHE_SECTORS; i++)
+			{
+				TEntry *pEntry = &m_Entry[i];
+				if (   pEntry->bValid
+				    && pEntry->Drive == pdrv
+				    && pEntry->Sector >= sector
+				    && pEntry->Sector < sector + count)
+				{
+					memcpy (pEntry->pData,
+						buff + (pEntry->Sector - sector) * DISK_CACHE_SECTOR_SIZE,
+						DISK_CACHE_SECTOR_SIZE);
+
+					pEntry->bDirty = FALSE;
+				}
+			}
+		}
+
+		m_Lock.Release ();
+
+		return bOK;
+	}
+
+	for (; count > 0; count--, sector++, buff += DISK_CACHE_SECTOR_SIZE)
+	{
+		TEntry *pEntry = Lookup (pdrv, sector);
+		if (pEntry == 0)
+		{
+			/* the whole sector is overwritten, it need not be read first */
+			pEntry = Allocate (pdrv, pDevice, sector);
+			if (pEntry == 0)
+			{
+				bOK = FALSE;
+
+				break;
+			}
+		}
+
+		memcpy (pEntry->pData, buff, DISK_CACHE_SECTOR_SIZE);
+		pEntry->bDirty = TRUE;
+
+		Touch (pEntry);
+	}
+
+	m_Lock.Release ();
+
+	return bOK;
+}
+
+boolean CDiskCache::Sync (BYTE pdrv)
+{
+	m_Lock.Acquire ();
+
+	boolean bOK = TRUE;
+
+	for (unsigned i = 0; i < DISK_CACHE_SECTORS; i++)
+	{
+		TEntry *pEntry = &m_Entry[i];
+		if (   pEntry->bValid
+		    && pEntry->bDirty
+		    && pEntry->Drive == pdrv)
+		{
+			if (!WriteRun (pEntry))
+			{
+				bOK = FALSE;
+			}
+		}
+	}
+
+	m_Lock.Release ();
+
+	return bOK;
+}
+
+void CDiskCache::Invalidate (BYTE pdrv)
+{
+	m_Lock.Acquire ();
+
+	for (unsigned i = 0; i < DISK_CACHE_SECTORS; i++)
+	{
+		TEntry *pEntry = &m_Entry[i];
+		if (   pEntry->bValid
+		    && pEntry->Drive == pdrv)
+		{
+			RemoveHash (pEntry);
+
+			pEntry->bValid = FALSE;
+			pEntry->bDirty = FALSE;
+		}
+	}
+
+	m_Lock.Release ();
+}
+
+CDiskCache::TEntry *CDiskCache::Lookup (BYTE pdrv, LBA_t sector)
+{
+	for (TEntry *pEntry = m_pHash[Hash (pdrv, sector)]; pEntry != 0; pEntry = pEntry->pHashNext)
+	{
+		if (   pEntry->Sector == sector
+		    && pEntry->Drive == pdrv)
+		{
+			assert (pEntry->bValid);
+
+			return pEntry;
+		}
+	}
+
+	return 0;
+}
+
+CDiskCache::TEntry *CDiskCache::Allocate (BYTE pdrv, CDevice *pDevice, LBA_t sector)
+{
+	/* prefer an invalid entry, otherwise take the least recently used one */
+	TEntry *pEntry = m_pTail;
+	for (TEntry *p = m_pTail; p != 0; p = p->pPrev)
+	{
+		if (!p->bValid)
+		{
+			pEntry = p;
+
+			break;
+		}
+	}
+	assert (pEntry != 0);
+
+	if (pEntry->bValid)
+	{
+		if (   pEntry->bDirty
+		    && !WriteRun (pEntry))
+		{
+			return 0;
+		}
+
+		RemoveHash (pEntry);
+	}
+
+	pEntry->Sector = sector;
+	pEntry->Drive = pdrv;
+	pEntry->pDevice = pDevice;
+	pEntry->bValid = TRUE;
+	pEntry->bDirty = FALSE;
+
+	InsertHash (pEntry);
+
+	return pEntry;
+}
+
+void CDiskCache::Touch (TEntry *pEntry)
+{
+	assert (pEntry != 0);
+
+	if (m_pHead == pEntry)
+	{
+		return;
+	}
+
+	Unlink (pEntry);
+
+	pEntry->pPrev = 0;
+	pEntry->pNext = m_pHead;
+	if (m_pHead != 0)
+	{
+		m_pHead->pPrev = pEntry;
+	}
+	else
+	{
+		m_pTail = pEntry;
+	}
+	m_pHead = pEntry;
+}
+
+void CDiskCache::Unlink (TEntry *pEntry)
+{
+	assert (pEntry != 0);
+
+	if (pEntry->pPrev != 0)
+	{
+		pEntry->pPrev->pNext = pEntry->pNext;
+	}
+	else
+	{
+		assert (m_pHead == pEntry);
+		m_pHead = pEntry->pNext;
+	}
+
+	if (pEntry->pNext != 0)
+	{
+		pEntry->pNext->pPrev = pEntry->pPrev;
+	}
+	else
+	{
+		assert (m_pTail == pEntry);
+		m_pTail = pEntry->pPrev;
+	}
+
+	pEntry->pPrev = 0;
+	pEntry->pNext = 0;
+}
+
+void CDiskCache::InsertHash (TEntry *pEntry)
+{
+	assert (pEntry != 0);
+
+	unsigned nHash = Hash (pEntry->Drive, pEntry->Sector);
+
+	pEntry->pHashNext = m_pHash[nHash];
+	m_pHash[nHash] = pEntry;
+}
+
+void CDiskCache::RemoveHash (TEntry *pEntry)
+{
+	assert (pEntry != 0);
+
+	TEntry **ppEntry = &m_pHash[Hash (pEntry->Drive, pEntry->Sector)];
+	while (*ppEntry != 0)
+	{
+		if (*ppEntry == pEntry)
+		{
+			*ppEntry = pEntry->pHashNext;
+			pEntry->pHashNext = 0;
+
+			return;
+		}
+
+		ppEntry = &(*ppEntry)->pHashNext;
+	}
+
+	assert (0);
+}
+
+boolean CDiskCache::WriteRun (TEntry *pEntry)
+{
+	assert (pEntry != 0);
+	assert (pEntry->bValid);
+	assert (pEntry->bDirty);
+
+	CDevice *pDevice = pEntry->pDevice;
+	assert (pDevice != 0);
+
+	BYTE pdrv = pEntry->Drive;
+
+	/* find the first dirty sector of the run */
+	LBA_t first = pEntry->Sector;
+	for (unsigned i = 1; i < DISK_CACHE_MAX_RUN && first > 0; i++)
+	{
+		TEntry *pPrev = Lookup (pdrv, first-1);
+		if (   pPrev == 0
+		    || !pPrev->bDirty)
+		{
+			break;
+		}
+
+		first--;
+	}
+
+	/* collect the run */
+	TEntry *pRun[DISK_CACHE_MAX_RUN];
+	UINT count;
+	for (count = 0; count < DISK_CACHE_MAX_RUN; count++)
+	{
+		TEntry *p = Lookup (pdrv, first + count);
+		if (   p == 0
+		    || !p->bDirty)
+		{
+			break;
+		}
+
+		pRun[count] = p;
+	}
+	assert (count > 0);
+	assert (first + count > pEntry->Sector);
+
+	if (count == 1)
+	{
+		if (!DeviceWrite (pDevice, pEntry->pData, pEntry->Sector, 1))
+		{
+			return FALSE;
+		}
+	}
+	else
+	{
+		for (UINT i = 0; i < count; i++)
+		{
+			memcpy (m_RunBuffer + i * DISK_CACHE_SECTOR_SIZE, pRun[i]->pData,
+				DISK_CACHE_SECTOR_SIZE);
+		}
+
+		if (!DeviceWrite (pDevice, m_RunBuffer, first, count))
+		{
+			return FALSE;
+		}
+	}
+
+	for (UINT i = 0; i < count; i++)
+	{
+		pRun[i]->bDirty = FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean CDiskCache::WriteBack (BYTE pdrv, LBA_t sector, UINT count)
+{
+	for (unsigned i = 0; i < DISK_CACHE_SECTORS; i++)
+	{
+		TEntry *pEntry = &m_Entry[i];
+		if (   pEntry->bValid
+		    && pEntry->bDirty
+		    && pEntry->Drive == pdrv
+		    && pEntry->Sector >= sector
+		    && pEntry->Sector < sector + count)
+		{
+			if (!WriteRun (pEntry))
+			{
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+boolean CDiskCache::DeviceRead (CDevice *pDevice, BYTE *buff, LBA_t sector, UINT count)
+{
+	assert (pDevice != 0);
+
+	QWORD offset = sector;
+	offset *= DISK_CACHE_SECTOR_SIZE;
+	pDevice->Seek (offset);
+
+	return pDevice->Read (buff, count * DISK_CACHE_SECTOR_SIZE) >= 0;
+}
+
+boolean CDiskCache::DeviceWrite (CDevice *pDevice, const BYTE *buff, LBA_t sector, UINT count)
+{
+	assert (pDevice != 0);
+
+	QWORD offset = sector;
+	offset *= DISK_CACHE_SECTOR_SIZE;
+	pDevice->Seek (offset);
+
+	return pDevice->Write (buff, count * DISK_CACHE_SECTOR_SIZE) >= 0;
+}
+
+#endif
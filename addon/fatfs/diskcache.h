@@ -0,0 +1,105 @@
+/*-----------------------------------------------------------------------*/
+/* Write-back sector cache between FatFs and the block devices           */
+/* Implementation for Circle by R. Stange <rsta2@o2online.de>            */
+/*-----------------------------------------------------------------------*/
+
+#ifndef _DISKCACHE_DEFINED
+#define _DISKCACHE_DEFINED
+
+#include "ff.h"
+#include <circle/device.h>
+#include <circle/genericlock.h>
+#include <circle/macros.h>
+#include <circle/synchronize.h>
+#include <circle/types.h>
+
+#ifndef DISK_CACHE_SECTORS
+#define DISK_CACHE_SECTORS	128		/* 0 disables the cache */
+#endif
+
+#ifndef DISK_CACHE_MAX_RUN
+#define DISK_CACHE_MAX_RUN	32		/* max. sectors per coalesced write */
+#endif
+
+#ifndef DISK_CACHE_MAX_REQUEST
+#define DISK_CACHE_MAX_REQUEST	4	/* larger requests bypass the cache */
+#endif
+
+#define DISK_CACHE_HASH_SIZE	64	/* must be a power of 2 */
+
+#define DISK_CACHE_SECTOR_SIZE	FF_MIN_SS
+
+/* Only small requests (FAT, directory and exFAT allocation bitmap sectors, */
+/* which FatFs transfers through its window), are cached. The cache is      */
+/* shared by all physical drives and is addressed by LBA_t, so that it      */
+/* works with 64-bit LBAs too. Dirty sectors are written back on eviction  */
+/* and on Sync(), adjacent dirty sectors with a single request.             */
+
+class CDiskCache
+{
+public:
+	CDiskCache (void);
+	~CDiskCache (void);
+
+	/* returns FALSE on device error */
+	boolean Read (BYTE pdrv, CDevice *pDevice, BYTE *buff, LBA_t sector, UINT count);
+	boolean Write (BYTE pdrv, CDevice *pDevice, const BYTE *buff, LBA_t sector, UINT count);
+
+	/* write back all dirty sectors of a drive */
+	boolean Sync (BYTE pdrv);
+
+	/* discard all sectors of a drive, without writing them back */
+	void Invalidate (BYTE pdrv);
+
+private:
+	struct TEntry
+	{
+		LBA_t	 Sector;
+		BYTE	 Drive;
+		CDevice	*pDevice;
+		boolean	 bValid;
+		boolean	 bDirty;
+		TEntry	*pPrev;			/* LRU list, head is most recently used */
+		TEntry	*pNext;
+		TEntry	*pHashNext;
+		BYTE	*pData;
+	};
+
+	TEntry *Lookup (BYTE pdrv, LBA_t sector);
+	TEntry *Allocate (BYTE pdrv, CDevice *pDevice, LBA_t sector);
+
+	void Touch (TEntry *pEntry);
+	void Unlink (TEntry *pEntry);
+	void InsertHash (TEntry *pEntry);
+	void RemoveHash (TEntry *pEntry);
+
+	/* writes the run of dirty sectors around pEntry */
+	boolean WriteRun (TEntry *pEntry);
+	/* write back dirty sectors in range, before accessing the device directly */
+	boolean WriteBack (BYTE pdrv, LBA_t sector, UINT count);
+
+	static boolean DeviceRead (CDevice *pDevice, BYTE *buff, LBA_t sector, UINT count);
+	static boolean DeviceWrite (CDevice *pDevice, const BYTE *buff, LBA_t sector, UINT count);
+
+	static unsigned Hash (BYTE pdrv, LBA_t sector)
+	{
+		return ((unsigned) sector ^ pdrv << 5) & (DISK_CACHE_HASH_SIZE-1);
+	}
+
+private:
+	TEntry m_Entry[DISK_CACHE_SECTORS];
+	TEntry *m_pHash[DISK_CACHE_HASH_SIZE];
+
+	TEntry *m_pHead;
+	TEntry *m_pTail;
+
+	BYTE m_Data[DISK_CACHE_SECTORS][DISK_CACHE_SECTOR_SIZE]
+		ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+	BYTE m_RunBuffer[DISK_CACHE_MAX_RUN * DISK_CACHE_SECTOR_SIZE]
+		ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+	CGenericLock m_Lock;
+};
+
+#endif
@@ -10,8 +10,10 @@
 
 #include "ff.h"			/* Obtains integer types */
 #include "diskio.h"		/* Declarations of disk functions */
+#include "diskcache.h"
 #include <circle/device.h>
 #include <circle/devicenameservice.h>
+#include <circle/genericlock.h>
 #include <circle/util.h>
 #include <circle/types.h>
 #include <assert.h>
@@ -31,12 +33,18 @@ static const char *s_pVolumeName[FF_VOLUMES] =
 	"umsd1",
 	"umsd2",
 	"umsd3",
+	"ram1",
+	"nvme1",
 };
 
 static CDevice *s_pVolume[FF_VOLUMES] = {0};
 
-static u8 *s_pBuffer = 0;
-static unsigned s_nBufferSize = 0;
+#if DISK_CACHE_SECTORS > 0
+static CDiskCache s_DiskCache;
+#endif
+
+/* Serializes the disk I/O, because several readers can be active at once */
+static CGenericLock s_IOLock;
 
 
 
@@ -49,7 +57,13 @@ static void disk_removed (
 	void *pContext
 )
 {
-	*((CDevice **) pContext) = 0;
+	CDevice **ppVolume = (CDevice **) pContext;
+	*ppVolume = 0;
+
+#if DISK_CACHE_SECTORS > 0
+	/* dirty sectors are lost, the device is gone */
+	s_DiskCache.Invalidate ((BYTE) (ppVolume - s_pVolume));
+#endif
 }
 
 
@@ -86,6 +100,15 @@ DSTATUS disk_initialize (
 		return STA_NOINIT;
 	}
 
+#if DISK_CACHE_SECTORS > 0
+	if (s_pVolume[pdrv] != 0)
+	{
+		s_DiskCache.Sync (pdrv);
+	}
+
+	s_DiskCache.Invalidate (pdrv);		/* the medium may have been changed */
+#endif
+
 	s_pVolume[pdrv] = CDeviceNameService::Get ()->GetDevice (s_pVolumeName[pdrv], TRUE);
 	if (s_pVolume[pdrv] != 0)
 	{
@@ -121,37 +144,32 @@ DRESULT disk_read (
 		return RES_NOTRDY;
 	}
 
-	/* Ensure that the transfer buffer is word aligned */
-	BYTE *pBuffer = buff;
-	unsigned nSize = count * SECTOR_SIZE;
-	if (((uintptr) pBuffer & 3) != 0)
-	{
-		if (s_nBufferSize < nSize)
-		{
-			delete [] s_pBuffer;
-
-			s_nBufferSize = nSize;
+	s_IOLock.Acquire ();
 
-			s_pBuffer = new u8[s_nBufferSize];
-			assert (s_pBuffer != 0);
-		}
+#if DISK_CACHE_SECTORS > 0
+	if (!s_DiskCache.Read (pdrv, pDevice, buff, sector, count))
+	{
+		s_IOLock.Release ();
 
-		pBuffer = s_pBuffer;
+		return RES_ERROR;
 	}
+#else
+	/* The drivers accept unaligned buffers (and use an aligned buffer for DMA) */
+	unsigned nSize = count * SECTOR_SIZE;
 
 	QWORD offset = sector;
 	offset *= SECTOR_SIZE;
 	pDevice->Seek (offset);
 
-	if (pDevice->Read (pBuffer, nSize) < 0)
+	if (pDevice->Read (buff, nSize) < 0)
 	{
+		s_IOLock.Release ();
+
 		return RES_ERROR;
 	}
+#endif
 
-	if (pBuffer != buff)
-	{
-		memcpy (buff, pBuffer, nSize);
-	}
+	s_IOLock.Release ();
 
 	return RES_OK;
 }
@@ -182,34 +200,32 @@ DRESULT disk_write (
 		return RES_NOTRDY;
 	}
 
-	/* Ensure that the transfer buffer is word aligned */
-	const BYTE *pBuffer = buff;
-	unsigned nSize = count * SECTOR_SIZE;
-	if (((uintptr) pBuffer & 3) != 0)
-	{
-		if (s_nBufferSize < nSize)
-		{
-			delete [] s_pBuffer;
+	s_IOLock.Acquire ();
 
-			s_nBufferSize = nSize;
-
-			s_pBuffer = new u8[s_nBufferSize];
-			assert (s_pBuffer != 0);
-		}
-
-		memcpy (s_pBuffer, buff, nSize);
+#if DISK_CACHE_SECTORS > 0
+	if (!s_DiskCache.Write (pdrv, pDevice, buff, sector, count))
+	{
+		s_IOLock.Release ();
 
-		pBuffer = s_pBuffer;
+		return RES_ERROR;
 	}
+#else
+	/* The drivers accept unaligned buffers (and use an aligned buffer for DMA) */
+	unsigned nSize = count * SECTOR_SIZE;
 
 	QWORD offset = sector;
 	offset *= SECTOR_SIZE;
 	pDevice->Seek (offset);
 
-	if (pDevice->Write (pBuffer, nSize) < 0)
+	if (pDevice->Write (buff, nSize) < 0)
 	{
+		s_IOLock.Release ();
+
 		return RES_ERROR;
 	}
+#endif
+
+	s_IOLock.Release ();
 
 	return RES_OK;
 }
@@ -230,6 +246,23 @@ DRESULT disk_ioctl (
 	switch (cmd)
 	{
 	case CTRL_SYNC:
+#if DISK_CACHE_SECTORS > 0
+		if (pdrv >= FF_VOLUMES)
+		{
+			return RES_PARERR;
+		}
+
+		{
+			s_IOLock.Acquire ();
+			boolean bOK = s_pVolume[pdrv] == 0 || s_DiskCache.Sync (pdrv);
+			s_IOLock.Release ();
+
+			if (!bOK)
+			{
+				return RES_ERROR;
+			}
+		}
+#endif
 		return RES_OK;
 
 	case GET_SECTOR_SIZE:
@@ -237,6 +270,34 @@ DRESULT disk_ioctl (
 		*(WORD *) buff = SECTOR_SIZE;
 		return RES_OK;
 
+	case GET_SECTOR_COUNT:
+		if (pdrv >= FF_VOLUMES)
+		{
+			return RES_PARERR;
+		}
+
+		if (s_pVolume[pdrv] == 0)
+		{
+			return RES_NOTRDY;
+		}
+
+		{
+			u64 ullSize = s_pVolume[pdrv]->GetSize ();
+			if (ullSize == (u64) -1)
+			{
+				return RES_ERROR;
+			}
+
+			assert (buff != 0);
+			*(LBA_t *) buff = (LBA_t) (ullSize / SECTOR_SIZE);
+		}
+		return RES_OK;
+
+	case GET_BLOCK_SIZE:
+		assert (buff != 0);
+		*(DWORD *) buff = 1;		/* erase block size unknown */
+		return RES_OK;
+
 	case CTRL_EJECT:
 		if (pdrv >= FF_VOLUMES)
 		{
@@ -252,6 +313,15 @@ DRESULT disk_ioctl (
 			}
 		}
 
+#if DISK_CACHE_SECTORS > 0
+		if (!s_DiskCache.Sync (pdrv))
+		{
+			return RES_ERROR;
+		}
+
+		s_DiskCache.Invalidate (pdrv);
+#endif
+
 		if (!s_pVolume[pdrv]->RemoveDevice ())
 		{
 			return RES_ERROR;
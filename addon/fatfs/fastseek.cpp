@@ -0,0 +1,99 @@
+/*-----------------------------------------------------------------------*/
+/* Fast seek helper for FatFs                                            */
+/* Implementation for Circle by R. Stange <rsta2@o2online.de>            */
+/*-----------------------------------------------------------------------*/
+
+#include "fastseek.h"
+#include <assert.h>
+
+#if FF_USE_FASTSEEK
+
+/* CLMT size for the first try (2 items per fragment plus 2) */
+#define CLMT_INITIAL_SIZE	64
+
+FRESULT f_open_fastseek (
+	FIL* fp,			/* Pointer to the blank file object */
+	const TCHAR* path,	/* Pointer to the file name */
+	BYTE mode			/* Access mode and open mode flags */
+)
+{
+	FRESULT res = f_open (fp, path, mode);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	if (mode & FA_WRITE)
+	{
+		return FR_OK;	/* Fast seek mode does not allow to expand the file */
+	}
+
+	res = f_enable_fastseek (fp);
+	if (res != FR_OK)
+	{
+		f_close (fp);
+	}
+
+	return res;
+}
+
+FRESULT f_enable_fastseek (
+	FIL* fp				/* Pointer to the file object */
+)
+{
+	assert (fp != 0);
+	assert (fp->cltbl == 0);
+
+	DWORD nSize = CLMT_INITIAL_SIZE;
+	while (1)
+	{
+		DWORD *pTable = new DWORD[nSize];
+		if (pTable == 0)
+		{
+			return FR_NOT_ENOUGH_CORE;
+		}
+
+		pTable[0] = nSize;
+
+		fp->cltbl = pTable;
+		FSIZE_t fptr = fp->fptr;
+
+		FRESULT res = f_lseek (fp, CREATE_LINKMAP);
+		if (res == FR_OK)
+		{
+			/* Restore the file pointer in fast seek mode */
+			return f_lseek (fp, fptr);
+		}
+
+		fp->cltbl = 0;
+
+		if (res != FR_NOT_ENOUGH_CORE)
+		{
+			delete [] pTable;
+
+			return res;
+		}
+
+		/* The required size has been returned in the first item */
+		assert (pTable[0] > nSize);
+		nSize = pTable[0];
+
+		delete [] pTable;
+	}
+}
+
+FRESULT f_close_fastseek (
+	FIL* fp				/* Pointer to the file object to be closed */
+)
+{
+	assert (fp != 0);
+	DWORD *pTable = fp->cltbl;
+
+	FRESULT res = f_close (fp);
+
+	delete [] pTable;
+
+	return res;
+}
+
+#endif
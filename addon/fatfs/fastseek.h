@@ -0,0 +1,36 @@
+/*-----------------------------------------------------------------------/
+/  Fast seek helper for FatFs                                            /
+/  Implementation for Circle by R. Stange <rsta2@o2online.de>            /
+/-----------------------------------------------------------------------*/
+
+#ifndef _FASTSEEK_DEFINED
+#define _FASTSEEK_DEFINED
+
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if FF_USE_FASTSEEK
+
+/* Open a file and enable the fast seek mode for it, if opened read-only.  */
+/* The cluster link map table (CLMT) is built once and allocated from the */
+/* heap, so that f_lseek() does not walk the FAT chain any more. The file */
+/* has to be closed with f_close_fastseek().                              */
+FRESULT f_open_fastseek (FIL* fp, const TCHAR* path, BYTE mode);
+
+/* Build the CLMT for an already opened file (the file size cannot be      */
+/* expanded in fast seek mode)                                            */
+FRESULT f_enable_fastseek (FIL* fp);
+
+/* Close the file and free its CLMT */
+FRESULT f_close_fastseek (FIL* fp);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
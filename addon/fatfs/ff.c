@@ -236,6 +236,7 @@
 
 /* Post process on fatal error in the file operations */
 #define ABORT(fs, res)		{ fp->err = (BYTE)(res); LEAVE_FF(fs, res); }
+#define ABORT_SHARED(fs, res)	{ fp->err = (BYTE)(res); LEAVE_FF_SHARED(fs, res); }
 
 
 /* Re-entrancy related */
@@ -244,8 +245,14 @@
 #error Static LFN work area cannot be used in thread-safe configuration
 #endif
 #define LEAVE_FF(fs, res)	{ unlock_fs(fs, res); return res; }
+#define LEAVE_FF_SHARED(fs, res)	{ unlock_fs_shared(fs, res); return res; }
+#define LOCK_WINDOW(fs)		ff_req_window((fs)->sobj)
+#define UNLOCK_WINDOW(fs)	ff_rel_window((fs)->sobj)
 #else
 #define LEAVE_FF(fs, res)	return res
+#define LEAVE_FF_SHARED(fs, res)	return res
+#define LOCK_WINDOW(fs)
+#define UNLOCK_WINDOW(fs)
 #endif
 
 
@@ -909,6 +916,25 @@ static void unlock_fs (
 	}
 }
 
+
+static int lock_fs_shared (	/* 1:Ok, 0:timeout (Circle) */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	return ff_req_grant_shared(fs->sobj);
+}
+
+
+static void unlock_fs_shared (	/* (Circle) */
+	FATFS* fs,		/* Filesystem object */
+	FRESULT res		/* Result code to be returned */
+)
+{
+	if (fs && res != FR_NOT_ENABLED && res != FR_INVALID_DRIVE && res != FR_TIMEOUT) {
+		ff_rel_grant_shared(fs->sobj);
+	}
+}
+
 #endif
 
 
@@ -3562,9 +3588,10 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 /* Check if the file/directory object is valid or not                    */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
+static FRESULT validate_lock (	/* Returns FR_OK or FR_INVALID_OBJECT */
 	FFOBJID* obj,			/* Pointer to the FFOBJID, the 1st member in the FIL/DIR object, to check validity */
-	FATFS** rfs				/* Pointer to pointer to the owner filesystem object to return */
+	FATFS** rfs,			/* Pointer to pointer to the owner filesystem object to return */
+	int shared				/* 1:Obtain a shared grant for reading (Circle) */
 )
 {
 	FRESULT res = FR_INVALID_OBJECT;
@@ -3572,9 +3599,11 @@ static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 
 	if (obj && obj->fs && obj->fs->fs_type && obj->id == obj->fs->id) {	/* Test if the object is valid */
 #if FF_FS_REENTRANT
-		if (lock_fs(obj->fs)) {	/* Obtain the filesystem object */
+		if (shared ? lock_fs_shared(obj->fs) : lock_fs(obj->fs)) {	/* Obtain the filesystem object */
 			if (!(disk_status(obj->fs->pdrv) & STA_NOINIT)) { /* Test if the phsical drive is kept initialized */
 				res = FR_OK;
+			} else if (shared) {
+				unlock_fs_shared(obj->fs, FR_OK);
 			} else {
 				unlock_fs(obj->fs, FR_OK);
 			}
@@ -3592,6 +3621,15 @@ static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 }
 
 
+static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
+	FFOBJID* obj,			/* Pointer to the FFOBJID, the 1st member in the FIL/DIR object, to check validity */
+	FATFS** rfs				/* Pointer to pointer to the owner filesystem object to return */
+)
+{
+	return validate_lock(obj, rfs, 0);
+}
+
+
 
 
 /*---------------------------------------------------------------------------
@@ -3868,9 +3906,9 @@ FRESULT f_read (
 
 
 	*br = 0;	/* Clear read byte counter */
-	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
-	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
-	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED); /* Check access mode */
+	res = validate_lock(&fp->obj, &fs, 1);		/* Check validity of the file object (shared grant) */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF_SHARED(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_READ)) LEAVE_FF_SHARED(fs, FR_DENIED); /* Check access mode */
 	remain = fp->obj.objsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
 
@@ -3887,27 +3925,31 @@ FRESULT f_read (
 					} else
 #endif
 					{
+						LOCK_WINDOW(fs);		/* The FAT is read through the common sector window */
 						clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
+						UNLOCK_WINDOW(fs);
 					}
 				}
-				if (clst < 2) ABORT(fs, FR_INT_ERR);
-				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+				if (clst < 2) ABORT_SHARED(fs, FR_INT_ERR);
+				if (clst == 0xFFFFFFFF) ABORT_SHARED(fs, FR_DISK_ERR);
 				fp->clust = clst;				/* Update current cluster */
 			}
 			sect = clst2sect(fs, fp->clust);	/* Get current sector */
-			if (sect == 0) ABORT(fs, FR_INT_ERR);
+			if (sect == 0) ABORT_SHARED(fs, FR_INT_ERR);
 			sect += csect;
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
-				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT_SHARED(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
+				LOCK_WINDOW(fs);
 				if (fs->wflag && fs->winsect - sect < cc) {
 					memcpy(rbuff + ((fs->winsect - sect) * SS(fs)), fs->win, SS(fs));
 				}
+				UNLOCK_WINDOW(fs);
 #else
 				if ((fp->flag & FA_DIRTY) && fp->sect - sect < cc) {
 					memcpy(rbuff + ((fp->sect - sect) * SS(fs)), fp->buf, SS(fs));
@@ -3921,11 +3963,11 @@ FRESULT f_read (
 			if (fp->sect != sect) {			/* Load data sector if not in cache */
 #if !FF_FS_READONLY
 				if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT_SHARED(fs, FR_DISK_ERR);
 					fp->flag &= (BYTE)~FA_DIRTY;
 				}
 #endif
-				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK)	ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK)	ABORT_SHARED(fs, FR_DISK_ERR);	/* Fill sector cache */
 			}
 #endif
 			fp->sect = sect;
@@ -3933,14 +3975,19 @@ FRESULT f_read (
 		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
 		if (rcnt > btr) rcnt = btr;					/* Clip it by btr if needed */
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+		LOCK_WINDOW(fs);
+		if (move_window(fs, fp->sect) != FR_OK) {	/* Move sector window */
+			UNLOCK_WINDOW(fs);
+			ABORT_SHARED(fs, FR_DISK_ERR);
+		}
 		memcpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
+		UNLOCK_WINDOW(fs);
 #else
 		memcpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #endif
 	}
 
-	LEAVE_FF(fs, FR_OK);
+	LEAVE_FF_SHARED(fs, FR_OK);
 }
 
 
@@ -372,6 +372,10 @@ void ff_memfree (void* mblock);			/* Free memory block */
 int ff_cre_syncobj (BYTE vol, FF_SYNC_t* sobj);	/* Create a sync object */
 int ff_req_grant (FF_SYNC_t sobj);		/* Lock sync object */
 void ff_rel_grant (FF_SYNC_t sobj);		/* Unlock sync object */
+int ff_req_grant_shared (FF_SYNC_t sobj);	/* Lock sync object for reading (Circle) */
+void ff_rel_grant_shared (FF_SYNC_t sobj);	/* Unlock sync object for reading (Circle) */
+void ff_req_window (FF_SYNC_t sobj);	/* Lock sector window with shared grant (Circle) */
+void ff_rel_window (FF_SYNC_t sobj);	/* Unlock sector window (Circle) */
 int ff_del_syncobj (FF_SYNC_t sobj);	/* Delete a sync object */
 #endif
 
@@ -9,10 +9,121 @@
 #include <circle/genericlock.h>
 #include <circle/alloc.h>
 #include <circle/timer.h>
+#include <circle/sysconfig.h>
 #include <assert.h>
 
+#ifdef NO_BUSY_WAIT
+#include <circle/sched/mutex.h>
+#include <circle/sched/synchronizationevent.h>
+#endif
+
 
 #if FF_FS_REENTRANT
+/*------------------------------------------------------------------------*/
+/* Volume Lock (Circle)                                                   */
+/*------------------------------------------------------------------------*/
+/* With NO_BUSY_WAIT the disk drivers yield while waiting for a transfer,
+/  so that other tasks can run during a file function. In this case the
+/  volume is protected by a reader/writer lock: f_read() takes it shared
+/  and can run concurrently with other f_read() calls on the same volume,
+/  all other functions take it exclusive. Entering the lock is serialized
+/  by a CMutex, which provides priority inheritance. A waiting writer
+/  holds this mutex, so that new readers cannot starve it. Readers access
+/  the common sector window (FAT) only inside the window lock.
+/  Without NO_BUSY_WAIT a file function cannot be interrupted by another
+/  task, so that a simple exclusive lock is sufficient.
+*/
+
+class CVolumeLock
+{
+public:
+	CVolumeLock (void)
+#ifdef NO_BUSY_WAIT
+	:	m_nReaders (0),
+		m_ReadersDone (TRUE)
+#endif
+	{
+	}
+
+	void Acquire (void)
+	{
+#ifdef NO_BUSY_WAIT
+		m_EntryMutex.Acquire ();
+
+		while (m_nReaders > 0)
+		{
+			m_ReadersDone.Wait ();
+		}
+#else
+		m_Lock.Acquire ();
+#endif
+	}
+
+	void Release (void)
+	{
+#ifdef NO_BUSY_WAIT
+		m_EntryMutex.Release ();
+#else
+		m_Lock.Release ();
+#endif
+	}
+
+	void AcquireShared (void)
+	{
+#ifdef NO_BUSY_WAIT
+		m_EntryMutex.Acquire ();
+
+		if (m_nReaders++ == 0)
+		{
+			m_ReadersDone.Clear ();
+		}
+
+		m_EntryMutex.Release ();
+#else
+		m_Lock.Acquire ();
+#endif
+	}
+
+	void ReleaseShared (void)
+	{
+#ifdef NO_BUSY_WAIT
+		assert (m_nReaders > 0);
+		if (--m_nReaders == 0)
+		{
+			m_ReadersDone.Set ();
+		}
+#else
+		m_Lock.Release ();
+#endif
+	}
+
+	void AcquireWindow (void)
+	{
+#ifdef NO_BUSY_WAIT
+		m_WindowMutex.Acquire ();
+#endif
+	}
+
+	void ReleaseWindow (void)
+	{
+#ifdef NO_BUSY_WAIT
+		m_WindowMutex.Release ();
+#endif
+	}
+
+private:
+#ifdef NO_BUSY_WAIT
+	CMutex m_EntryMutex;			/* held by writer or entering reader */
+	volatile unsigned m_nReaders;
+	CSynchronizationEvent m_ReadersDone;	/* set if m_nReaders == 0 */
+	CMutex m_WindowMutex;			/* protects fs->win for readers */
+#else
+	CGenericLock m_Lock;
+#endif
+};
+
+
+
 /*------------------------------------------------------------------------*/
 /* Create a Synchronization Object                                        */
 /*------------------------------------------------------------------------*/
@@ -29,7 +140,7 @@ int ff_cre_syncobj (	/* 1:Function succeeded, 0:Could not create the sync object
 	int ret;
 
 
-	*sobj = new CGenericLock ();		/* Circle */
+	*sobj = new CVolumeLock ();		/* Circle */
 	assert (*sobj != 0);
 	ret = 1;
 
@@ -65,7 +176,7 @@ int ff_del_syncobj (	/* 1:Function succeeded, 0:Could not delete due to any erro
 	int ret;
 
 
-	CGenericLock *pLock = (CGenericLock *) sobj;		/* Circle */
+	CVolumeLock *pLock = (CVolumeLock *) sobj;		/* Circle */
 	delete pLock;
 	ret = 1;
 
@@ -97,7 +208,7 @@ int ff_req_grant (	/* 1:Got a grant to access the volume, 0:Could not get a gran
 {
 	int ret;
 
-	CGenericLock *pLock = (CGenericLock *) sobj;		/* Circle */
+	CVolumeLock *pLock = (CVolumeLock *) sobj;		/* Circle */
 	assert (pLock != 0);
 	pLock->Acquire ();
 	ret = 1;
@@ -126,7 +237,7 @@ void ff_rel_grant (
 	FF_SYNC_t sobj	/* Sync object to be signaled */
 )
 {
-	CGenericLock *pLock = (CGenericLock *) sobj;	/* Circle */
+	CVolumeLock *pLock = (CVolumeLock *) sobj;	/* Circle */
 	assert (pLock != 0);
 	pLock->Release ();
 
@@ -139,6 +250,69 @@ void ff_rel_grant (
 //	xSemaphoreGive(sobj);	/* FreeRTOS */
 }
 
+
+
+/*------------------------------------------------------------------------*/
+/* Request Shared Grant to Access the Volume (Circle)                     */
+/*------------------------------------------------------------------------*/
+/* This function is called on entering f_read() to lock the volume for
+/  reading. Other shared grants may be active at the same time.
+*/
+
+int ff_req_grant_shared (	/* 1:Got a grant to access the volume, 0:Could not get a grant */
+	FF_SYNC_t sobj	/* Sync object to wait */
+)
+{
+	CVolumeLock *pLock = (CVolumeLock *) sobj;
+	assert (pLock != 0);
+	pLock->AcquireShared ();
+
+	return 1;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Release Shared Grant to Access the Volume (Circle)                     */
+/*------------------------------------------------------------------------*/
+
+void ff_rel_grant_shared (
+	FF_SYNC_t sobj	/* Sync object to be signaled */
+)
+{
+	CVolumeLock *pLock = (CVolumeLock *) sobj;
+	assert (pLock != 0);
+	pLock->ReleaseShared ();
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Lock/Unlock the Sector Window (Circle)                                 */
+/*------------------------------------------------------------------------*/
+/* These functions are called with a shared grant around accesses to the
+/  common sector window of the volume (fs->win).
+*/
+
+void ff_req_window (
+	FF_SYNC_t sobj	/* Sync object of the volume */
+)
+{
+	CVolumeLock *pLock = (CVolumeLock *) sobj;
+	assert (pLock != 0);
+	pLock->AcquireWindow ();
+}
+
+
+void ff_rel_window (
+	FF_SYNC_t sobj	/* Sync object of the volume */
+)
+{
+	CVolumeLock *pLock = (CVolumeLock *) sobj;
+	assert (pLock != 0);
+	pLock->ReleaseWindow ();
+}
+
 #endif
 
 
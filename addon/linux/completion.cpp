@@ -1,39 +1,33 @@
 #include <linux/completion.h>
 #include <linux/jiffies.h>
 #include <linux/bug.h>
-#include <circle/sched/scheduler.h>
+#include <circle/synchronize.h>
 #include <circle/multicore.h>
 
 void complete (struct completion *x)
 {
-#ifdef ARM_ALLOW_MULTI_CORE
-	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
-#endif
+	EnterCritical (IRQ_LEVEL);
 
-	x->done++;
+	if (x->done < (int) ((unsigned) -1 / 2))
+	{
+		x->done++;
+	}
+
+	LeaveCritical ();
+
+	wake_up (&x->wait);
 }
 
 void complete_all (struct completion *x)
 {
-#ifdef ARM_ALLOW_MULTI_CORE
-	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
-#endif
-
 	x->done = (unsigned) -1 / 2;
+
+	wake_up_all (&x->wait);
 }
 
 void wait_for_completion (struct completion *x)
 {
-#ifdef ARM_ALLOW_MULTI_CORE
-	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
-#endif
-
-	while (x->done == 0)
-	{
-		CScheduler::Get ()->Yield ();
-	}
-
-	x->done--;
+	wait_event (x->wait, try_wait_for_completion (x));
 }
 
 int try_wait_for_completion (struct completion *x)
@@ -42,36 +36,27 @@ int try_wait_for_completion (struct completion *x)
 	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
 #endif
 
-	if (x->done == 0)
-	{
-		return 0;
-	}
+	int ret = 0;
 
-	x->done--;
+	// complete() may increment done from interrupt context meanwhile
+	EnterCritical (IRQ_LEVEL);
 
-	return 1;
-}
-
-long wait_for_completion_interruptible_timeout (struct completion *x, unsigned long timeout)
-{
-#ifdef ARM_ALLOW_MULTI_CORE
-	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
-#endif
-
-	unsigned long start = jiffies;
-
-	while (x->done == 0)
+	if (x->done != 0)
 	{
-		unsigned long now = jiffies;
-		if (now-start >= timeout)
+		if (x->done < (int) ((unsigned) -1 / 2))
 		{
-			return 0;
+			x->done--;
 		}
 
-		CScheduler::Get ()->Yield ();
+		ret = 1;
 	}
 
-	x->done--;
+	LeaveCritical ();
 
-	return 1;
+	return ret;
+}
+
+long wait_for_completion_interruptible_timeout (struct completion *x, unsigned long timeout)
+{
+	return wait_event_timeout (x->wait, try_wait_for_completion (x), timeout);
 }
@@ -1,6 +1,8 @@
 #ifndef _linux_completion_h
 #define _linux_completion_h
 
+#include <linux/wait.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,11 +10,15 @@ extern "C" {
 struct completion
 {
 	volatile int done;
+	wait_queue_head_t wait;
 };
 
+#define DECLARE_COMPLETION(work)	struct completion work = {0, {{0, 0}}}
+
 static inline void init_completion (struct completion *x)
 {
 	x->done = 0;
+	init_waitqueue_head (&x->wait);
 }
 
 static inline void reinit_completion (struct completion *x)
@@ -20,6 +26,7 @@ static inline void reinit_completion (struct completion *x)
 	x->done = 0;
 }
 
+// can be called from interrupt context
 void complete (struct completion *x);
 void complete_all (struct completion *x);
 
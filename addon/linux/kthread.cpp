@@ -9,7 +9,8 @@ class CKThread : public CTask
 {
 public:
 	CKThread (int (*threadfn) (void *data), void *data, const char *pName)
-	:	m_threadfn (threadfn),
+	:	CTask (TASK_STACK_SIZE, TRUE),		// started by wake_up_process()
+		m_threadfn (threadfn),
 		m_data (data)
 	{
 		SetName (pName);
@@ -56,10 +57,22 @@ void set_user_nice (struct task_struct *task, long nice)
 {
 }
 
-// TODO: task is waken by default
+// returns 1 if the task has been started, 0 if it was already running
 int wake_up_process (struct task_struct *task)
 {
-	return 0;
+	BUG_ON (task == 0);
+
+	CTask *ctask = (CTask *) task->taskobj;
+	if (   ctask == 0
+	    || task->terminated
+	    || !ctask->IsSuspended ())
+	{
+		return 0;
+	}
+
+	ctask->Start ();
+
+	return 1;
 }
 
 void flush_signals (struct task_struct *task)
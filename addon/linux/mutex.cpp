@@ -1,6 +1,5 @@
 #include <linux/mutex.h>
 #include <linux/bug.h>
-#include <circle/sched/scheduler.h>
 #include <circle/multicore.h>
 
 void mutex_lock (struct mutex *lock)
@@ -9,10 +8,7 @@ void mutex_lock (struct mutex *lock)
 	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
 #endif
 
-	while (lock->lock != 0)
-	{
-		CScheduler::Get ()->Yield ();
-	}
+	wait_event (lock->wait, lock->lock == 0);
 
 	lock->lock = 1;
 }
@@ -24,4 +20,6 @@ void mutex_unlock (struct mutex *lock)
 #endif
 
 	lock->lock = 0;
+
+	wake_up (&lock->wait);
 }
@@ -1,6 +1,8 @@
 #ifndef _linux_mutex_h
 #define _linux_mutex_h
 
+#include <linux/wait.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,11 +10,15 @@ extern "C" {
 struct mutex
 {
 	volatile int lock;
+	wait_queue_head_t wait;
 };
 
+#define DEFINE_MUTEX(name)	struct mutex name = {0, {{0, 0}}}
+
 static inline void mutex_init (struct mutex *lock)
 {
 	lock->lock = 0;
+	init_waitqueue_head (&lock->wait);
 }
 
 void mutex_lock (struct mutex *lock);
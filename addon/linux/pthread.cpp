@@ -59,6 +59,8 @@ int pthread_create (pthread_t *thread, const pthread_attr_t *attr,
 
 	p->kthread->userdata = p;
 
+	wake_up_process (p->kthread);
+
 	BUG_ON (thread == 0);
 	*thread = p;
 
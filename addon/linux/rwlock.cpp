@@ -1,6 +1,5 @@
 #include <linux/rwlock.h>
 #include <linux/bug.h>
-#include <circle/sched/scheduler.h>
 #include <circle/multicore.h>
 
 #define WRITE_LOCK	(1U << 31)
@@ -11,12 +10,10 @@ void read_lock_bh (rwlock_t *lock)
 	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
 #endif
 
-	lock->lock++;
+	// a pending writer blocks new readers, otherwise both would wait for each other
+	wait_event (lock->wait, !(lock->lock & WRITE_LOCK));
 
-	while (lock->lock >= WRITE_LOCK)
-	{
-		CScheduler::Get ()->Yield ();
-	}
+	lock->lock++;
 }
 
 void read_unlock_bh (rwlock_t *lock)
@@ -25,7 +22,10 @@ void read_unlock_bh (rwlock_t *lock)
 	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
 #endif
 
-	lock->lock--;
+	if (--lock->lock == WRITE_LOCK)
+	{
+		wake_up (&lock->wait);		// wake waiting writer
+	}
 }
 
 void write_lock_bh (rwlock_t *lock)
@@ -34,12 +34,11 @@ void write_lock_bh (rwlock_t *lock)
 	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
 #endif
 
+	wait_event (lock->wait, !(lock->lock & WRITE_LOCK));
+
 	lock->lock |= WRITE_LOCK;
 
-	while ((lock->lock & ~WRITE_LOCK) != 0)
-	{
-		CScheduler::Get ()->Yield ();
-	}
+	wait_event (lock->wait, (lock->lock & ~WRITE_LOCK) == 0);
 }
 
 void write_unlock_bh (rwlock_t *lock)
@@ -49,4 +48,6 @@ void write_unlock_bh (rwlock_t *lock)
 #endif
 
 	lock->lock &= ~WRITE_LOCK;
+
+	wake_up_all (&lock->wait);
 }
@@ -2,6 +2,7 @@
 #define _linux_rwlock_h
 
 #include <linux/types.h>
+#include <linux/wait.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,12 +14,14 @@ extern "C" {
 typedef struct
 {
 	volatile u32 lock;
+	wait_queue_head_t wait;
 }
 rwlock_t;
 
 static inline void rwlock_init (rwlock_t *lock)
 {
 	lock->lock = 0;
+	init_waitqueue_head (&lock->wait);
 }
 
 void read_lock_bh (rwlock_t *lock);
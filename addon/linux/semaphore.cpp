@@ -1,6 +1,5 @@
 #include <linux/semaphore.h>
 #include <linux/bug.h>
-#include <circle/sched/scheduler.h>
 #include <circle/multicore.h>
 
 void down (struct semaphore *sem)
@@ -9,21 +8,17 @@ void down (struct semaphore *sem)
 	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
 #endif
 
-	while (atomic_read (&sem->count) == 0)
-	{
-		CScheduler::Get ()->Yield ();
-	}
+	// up() can only increment the count meanwhile
+	wait_event (sem->wait, atomic_read (&sem->count) != 0);
 
 	atomic_dec (&sem->count);
 }
 
 void up (struct semaphore *sem)
 {
-#ifdef ARM_ALLOW_MULTI_CORE
-	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
-#endif
-
 	atomic_inc (&sem->count);
+
+	wake_up (&sem->wait);
 }
 
 int down_trylock (struct semaphore *sem)
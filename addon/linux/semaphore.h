@@ -3,6 +3,7 @@
 
 #include <linux/atomic.h>
 #include <linux/compiler.h>
+#include <linux/wait.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,17 +12,19 @@ extern "C" {
 struct semaphore
 {
 	atomic_t count;
+	wait_queue_head_t wait;
 };
 
-#define DEFINE_SEMAPHORE(name)	struct semaphore name = {ATOMIC_INIT (1)}
+#define DEFINE_SEMAPHORE(name)	struct semaphore name = {ATOMIC_INIT (1), {{0, 0}}}
 
 static inline void sema_init (struct semaphore *sem, int val)
 {
 	atomic_set (&sem->count, val);
+	init_waitqueue_head (&sem->wait);
 }
 
 void down (struct semaphore *sem);
-void up (struct semaphore *sem);
+void up (struct semaphore *sem);		// can be called from interrupt context
 
 // returns 0 if semaphore has been locked, 1 otherwise
 int __must_check down_trylock (struct semaphore *sem);
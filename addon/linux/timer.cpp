@@ -28,17 +28,18 @@ void add_timer (struct timer_list *timer)
 
 	unsigned long expires = timer->expires;
 
+	// keep the list sorted by expiry, so that the handler has to check the head only
 	struct list_head *pos;
 	list_for_each (pos, &timer_list)
 	{
 		struct timer_list *t = list_entry (pos, struct timer_list, entry);
-		if ((long) (t->expires-expires) < 0)
+		if ((long) (t->expires-expires) > 0)
 		{
 			break;
 		}
 	}
 
-	list_add (&timer->entry, pos);
+	list_add_tail (&timer->entry, pos);
 
 	spin_unlock (&timer_lock);
 }
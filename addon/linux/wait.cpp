@@ -0,0 +1,49 @@
+#include <linux/wait.h>
+#include <linux/bug.h>
+#include <circle/sched/synchronizationevent.h>
+#include <circle/multicore.h>
+#include <circle/timer.h>
+#include <circle/new.h>
+
+static_assert (sizeof (CSynchronizationEvent) <= sizeof (wait_queue_head_t),
+	       "wait_queue_head_t is too small");
+
+static inline CSynchronizationEvent *get_event (wait_queue_head_t *wq)
+{
+	return (CSynchronizationEvent *) wq->event;
+}
+
+void init_waitqueue_head (wait_queue_head_t *wq)
+{
+	new (wq->event) CSynchronizationEvent;
+}
+
+void wake_up (wait_queue_head_t *wq)
+{
+	get_event (wq)->Set ();
+}
+
+void linuxemu_prepare_wait (wait_queue_head_t *wq)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
+#endif
+
+	get_event (wq)->Clear ();
+}
+
+int linuxemu_wait (wait_queue_head_t *wq, unsigned long timeout)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	BUG_ON (CMultiCoreSupport::ThisCore () != 0);
+#endif
+
+	if (timeout == 0)
+	{
+		get_event (wq)->Wait ();
+
+		return 1;
+	}
+
+	return !get_event (wq)->WaitWithTimeout (timeout * (1000000 / HZ));
+}
@@ -0,0 +1,97 @@
+#ifndef _linux_wait_h
+#define _linux_wait_h
+
+#include <linux/jiffies.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A wait queue blocks the waiting tasks in the scheduler, until it is woken up.
+// It contains the storage for a CSynchronizationEvent, which is initially cleared.
+// A zero-initialized wait queue is in this state too (e.g. static definitions).
+
+typedef struct wait_queue_head
+{
+	void *event[2];
+}
+wait_queue_head_t;
+
+#define DECLARE_WAIT_QUEUE_HEAD(name)	wait_queue_head_t name = {{0, 0}}
+
+void init_waitqueue_head (wait_queue_head_t *wq);
+
+// can be called from interrupt context
+void wake_up (wait_queue_head_t *wq);
+#define wake_up_all(wq)			wake_up (wq)
+#define wake_up_interruptible(wq)	wake_up (wq)
+#define wake_up_interruptible_all(wq)	wake_up (wq)
+
+// internal functions, used by the wait_event*() macros and other primitives
+void linuxemu_prepare_wait (wait_queue_head_t *wq);
+// timeout in jiffies (0 for no timeout), returns 0 if timed out
+int linuxemu_wait (wait_queue_head_t *wq, unsigned long timeout);
+
+// The condition is re-evaluated after the wait queue has been prepared,
+// so that a wake-up between the test and blocking cannot get lost.
+
+#define wait_event(wq, condition)					\
+	do								\
+	{								\
+		while (!(condition))					\
+		{							\
+			linuxemu_prepare_wait (&(wq));			\
+			if (condition)					\
+			{						\
+				break;					\
+			}						\
+			linuxemu_wait (&(wq), 0);			\
+		}							\
+	}								\
+	while (0)
+
+#define wait_event_interruptible(wq, condition)				\
+	({ wait_event (wq, condition); 0; })
+
+#define wait_event_killable(wq, condition)				\
+	wait_event_interruptible (wq, condition)
+
+// timeout in jiffies
+// returns 0 if the condition is still false after the timeout,
+// the remaining jiffies (at least 1) otherwise
+#define wait_event_timeout(wq, condition, timeout)			\
+	({								\
+		unsigned long __start = jiffies;			\
+		unsigned long __timeout = (timeout);			\
+		long __ret = 1;						\
+		while (!(condition))					\
+		{							\
+			unsigned long __elapsed = jiffies - __start;	\
+			linuxemu_prepare_wait (&(wq));			\
+			if (condition)					\
+			{						\
+				break;					\
+			}						\
+			if (   __elapsed >= __timeout			\
+			    || !linuxemu_wait (&(wq), __timeout - __elapsed)) \
+			{						\
+				__ret = (condition) ? 1 : 0;		\
+				break;					\
+			}						\
+		}							\
+		if (__ret)						\
+		{							\
+			unsigned long __elapsed = jiffies - __start;	\
+			__ret = __elapsed < __timeout ? __timeout - __elapsed : 1; \
+		}							\
+		__ret;							\
+	})
+
+#define wait_event_interruptible_timeout(wq, condition, timeout)	\
+	wait_event_timeout (wq, condition, timeout)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
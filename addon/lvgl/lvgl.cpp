@@ -29,15 +29,22 @@
 CLVGL *CLVGL::s_pThis = 0;
 
 CLVGL::CLVGL (CScreenDevice *pScreen, CInterruptSystem *pInterrupt)
-:	m_pBuffer1 (0),
+:	m_RenderMode (LVGLRenderModeUnknown),
+	m_pBuffer1 (0),
 	m_pBuffer2 (0),
 	m_pScreen (pScreen),
 	m_pFrameBuffer (0),
+	m_nWidth (0),
+	m_nHeight (0),
+	m_pUpdateHandler (0),
+	m_pUpdateParam (0),
 	m_DMAChannel (DMA_CHANNEL_NORMAL, pInterrupt),
 	m_nLastUpdate (0),
 	m_pMouseDevice (0),
 	m_pTouchScreen (0),
-	m_nLastTouchUpdate (0)
+	m_nLastTouchUpdate (0),
+	m_nDirtyAreas (0),
+	m_bDirtyOverflow (FALSE)
 {
 	assert (s_pThis == 0);
 	s_pThis = this;
@@ -45,25 +52,68 @@ CLVGL::CLVGL (CScreenDevice *pScreen, CInterruptSystem *pInterrupt)
 	m_PointerData.state = LV_INDEV_STATE_REL;
 	m_PointerData.point.x = 0;
 	m_PointerData.point.y = 0;
+
+	ResetStatistics ();
 }
 
 CLVGL::CLVGL (CBcmFrameBuffer *pFrameBuffer, CInterruptSystem *pInterrupt)
-:	m_pBuffer1 (0),
+:	m_RenderMode (LVGLRenderModeUnknown),
+	m_pBuffer1 (0),
 	m_pBuffer2 (0),
 	m_pScreen (0),
 	m_pFrameBuffer (pFrameBuffer),
+	m_nWidth (0),
+	m_nHeight (0),
+	m_pUpdateHandler (0),
+	m_pUpdateParam (0),
+	m_DMAChannel (DMA_CHANNEL_NORMAL, pInterrupt),
+	m_nLastUpdate (0),
+	m_pMouseDevice (0),
+	m_pTouchScreen (0),
+	m_nLastTouchUpdate (0),
+	m_nDirtyAreas (0),
+	m_bDirtyOverflow (FALSE)
+{
+	assert (s_pThis == 0);
+	s_pThis = this;
+
+	m_PointerData.state = LV_INDEV_STATE_REL;
+	m_PointerData.point.x = 0;
+	m_PointerData.point.y = 0;
+
+	ResetStatistics ();
+}
+
+CLVGL::CLVGL (unsigned nWidth, unsigned nHeight,
+	      TDisplayUpdateHandler *pUpdateHandler, void *pUpdateParam,
+	      CInterruptSystem *pInterrupt)
+:	m_RenderMode (LVGLRenderModeUnknown),
+	m_pBuffer1 (0),
+	m_pBuffer2 (0),
+	m_pScreen (0),
+	m_pFrameBuffer (0),
+	m_nWidth (nWidth),
+	m_nHeight (nHeight),
+	m_pUpdateHandler (pUpdateHandler),
+	m_pUpdateParam (pUpdateParam),
 	m_DMAChannel (DMA_CHANNEL_NORMAL, pInterrupt),
 	m_nLastUpdate (0),
 	m_pMouseDevice (0),
 	m_pTouchScreen (0),
-	m_nLastTouchUpdate (0)
+	m_nLastTouchUpdate (0),
+	m_nDirtyAreas (0),
+	m_bDirtyOverflow (FALSE)
 {
 	assert (s_pThis == 0);
 	s_pThis = this;
 
+	assert (m_pUpdateHandler != 0);
+
 	m_PointerData.state = LV_INDEV_STATE_REL;
 	m_PointerData.point.x = 0;
 	m_PointerData.point.y = 0;
+
+	ResetStatistics ();
 }
 
 CLVGL::~CLVGL (void)
@@ -75,46 +125,99 @@ CLVGL::~CLVGL (void)
 	m_pFrameBuffer = 0;
 	m_pScreen = 0;
 
-	delete [] m_pBuffer1;
-	delete [] m_pBuffer2;
+	if (m_RenderMode != LVGLRenderModeDirect)
+	{
+		delete [] m_pBuffer1;
+		delete [] m_pBuffer2;
+	}
 	m_pBuffer1 = 0;
 	m_pBuffer2 = 0;
 }
 
-boolean CLVGL::Initialize (void)
+boolean CLVGL::Initialize (TLVGLRenderMode Mode)
 {
-	if (m_pFrameBuffer == 0)
+	size_t nWidth = m_nWidth;
+	size_t nHeight = m_nHeight;
+
+	if (m_pUpdateHandler == 0)
 	{
-		assert (m_pScreen != 0);
-		m_pFrameBuffer = m_pScreen->GetFrameBuffer ();
+		if (m_pFrameBuffer == 0)
+		{
+			assert (m_pScreen != 0);
+			m_pFrameBuffer = m_pScreen->GetFrameBuffer ();
+		}
+
+		assert (m_pFrameBuffer != 0);
+		assert (m_pFrameBuffer->GetDepth () == LV_COLOR_DEPTH);
+		nWidth = m_nWidth = m_pFrameBuffer->GetWidth ();
+		nHeight = m_nHeight = m_pFrameBuffer->GetHeight ();
 	}
 
-	assert (m_pFrameBuffer != 0);
-	assert (m_pFrameBuffer->GetDepth () == LV_COLOR_DEPTH);
-	size_t nWidth = m_pFrameBuffer->GetWidth ();
-	size_t nHeight = m_pFrameBuffer->GetHeight ();
+	if (   Mode == LVGLRenderModeDirect
+	    && (   m_pUpdateHandler != 0
+		|| m_pFrameBuffer->GetVirtHeight () < 2*nHeight
+		|| m_pFrameBuffer->GetPitch () != nWidth*LV_COLOR_DEPTH/8))
+	{
+		CLogger::Get ()->Write ("lvgl", LogWarning, "Direct mode is not possible");
+
+		Mode = LVGLRenderModeAutoStrips;
+	}
+
+	m_RenderMode = Mode;
 
 	lv_init ();
 
 	lv_log_register_print_cb (LogPrint);
 
-	m_pBuffer1 = new (HEAP_DMA30) lv_color_t[nWidth*10];
-	m_pBuffer2 = new (HEAP_DMA30) lv_color_t[nWidth*10];
-	if (   m_pBuffer1 == 0
-	    || m_pBuffer2 == 0)
+	size_t nBufferSize;				// in pixels
+	if (m_RenderMode == LVGLRenderModeDirect)
 	{
-		return FALSE;
+		// both halves of the frame buffer are used as draw buffers
+		m_pBuffer1 = (lv_color_t *) (uintptr) m_pFrameBuffer->GetBuffer ();
+		m_pBuffer2 = m_pBuffer1 + nWidth*nHeight;
+		nBufferSize = nWidth*nHeight;
+
+		// display the second buffer, while the first one is rendered
+		m_pFrameBuffer->SetVirtualOffset (0, nHeight);
+	}
+	else
+	{
+		size_t nLines = LVGL_STRIP_LINES;
+		if (m_RenderMode == LVGLRenderModeAutoStrips)
+		{
+			nLines = LVGL_AUTO_STRIP_SIZE / (nWidth * sizeof (lv_color_t));
+			if (nLines < LVGL_STRIP_LINES)
+			{
+				nLines = LVGL_STRIP_LINES;
+			}
+			else if (nLines > nHeight)
+			{
+				nLines = nHeight;
+			}
+		}
+
+		nBufferSize = nWidth*nLines;
+
+		m_pBuffer1 = new (HEAP_DMA30) lv_color_t[nBufferSize];
+		m_pBuffer2 = new (HEAP_DMA30) lv_color_t[nBufferSize];
+		if (   m_pBuffer1 == 0
+		    || m_pBuffer2 == 0)
+		{
+			return FALSE;
+		}
 	}
 
 	static lv_disp_draw_buf_t disp_buf;
-	lv_disp_draw_buf_init (&disp_buf, m_pBuffer1, m_pBuffer2, nWidth*10);
+	lv_disp_draw_buf_init (&disp_buf, m_pBuffer1, m_pBuffer2, nBufferSize);
 
 	static lv_disp_drv_t disp_drv;
 	lv_disp_drv_init (&disp_drv);
 	disp_drv.draw_buf = &disp_buf;
 	disp_drv.flush_cb = DisplayFlush;
+	disp_drv.monitor_cb = DisplayMonitor;
 	disp_drv.hor_res = nWidth;
 	disp_drv.ver_res = nHeight;
+	disp_drv.direct_mode = m_RenderMode == LVGLRenderModeDirect;
 	lv_disp_drv_register (&disp_drv);
 
 	m_pMouseDevice = (CMouseDevice *) CDeviceNameService::Get ()->GetDevice ("mouse1", FALSE);
@@ -167,9 +270,7 @@ void CLVGL::Update (boolean bPlugAndPlayUpdated)
 			(CMouseDevice *) CDeviceNameService::Get ()->GetDevice ("mouse1", FALSE);
 		if (m_pMouseDevice != 0)
 		{
-			assert (m_pFrameBuffer != 0);
-			if (m_pMouseDevice->Setup (m_pFrameBuffer->GetWidth (),
-						   m_pFrameBuffer->GetHeight ()))
+			if (m_pMouseDevice->Setup (m_nWidth, m_nHeight))
 			{
 				m_pMouseDevice->ShowCursor (TRUE);
 
@@ -219,6 +320,26 @@ void CLVGL::DisplayFlush (lv_disp_drv_t *pDriver, const lv_area_t *pArea, lv_col
 	assert (y1 <= y2);
 	assert (pBuffer != 0);
 
+	s_pThis->m_Statistics.nFlushes++;
+
+	if (s_pThis->m_RenderMode == LVGLRenderModeDirect)
+	{
+		s_pThis->DirectModeFlush (pDriver, pArea, pBuffer);
+
+		return;
+	}
+
+	if (s_pThis->m_pUpdateHandler != 0)
+	{
+		(*s_pThis->m_pUpdateHandler) (x1, y1, x2-x1+1, y2-y1+1, pBuffer,
+					      s_pThis->m_pUpdateParam);
+
+		assert (pDriver != 0);
+		lv_disp_flush_ready (pDriver);
+
+		return;
+	}
+
 	assert (s_pThis->m_pFrameBuffer != 0);
 	void *pDestination = (void *) (uintptr) (  s_pThis->m_pFrameBuffer->GetBuffer ()
 						 + y1*s_pThis->m_pFrameBuffer->GetPitch ()
@@ -245,6 +366,94 @@ void CLVGL::DisplayFlushComplete (unsigned nChannel, boolean bStatus, void *pPar
 	lv_disp_flush_ready (pDriver);
 }
 
+void CLVGL::DisplayMonitor (lv_disp_drv_t *pDriver, uint32_t nTime, uint32_t nPixels)
+{
+	assert (s_pThis != 0);
+	TLVGLStatistics *pStat = &s_pThis->m_Statistics;
+
+	pStat->nRefreshes++;
+	pStat->nPixelsRendered += nPixels;
+	pStat->nLastRefreshTime = nTime;
+	if (nTime > pStat->nMaxRefreshTime)
+	{
+		pStat->nMaxRefreshTime = nTime;
+	}
+}
+
+// In direct mode LVGL renders the invalidated areas into the draw buffer at their position on
+// the screen. The other buffer has to be updated with these areas, after the rendered buffer
+// has been displayed, because it is rendered next and contains the previous frame.
+void CLVGL::DirectModeFlush (lv_disp_drv_t *pDriver, const lv_area_t *pArea, lv_color_t *pBuffer)
+{
+	assert (pArea != 0);
+	if (m_nDirtyAreas < LVGL_MAX_DIRTY_AREAS)
+	{
+		m_DirtyArea[m_nDirtyAreas++] = *pArea;
+	}
+	else
+	{
+		m_bDirtyOverflow = TRUE;
+	}
+
+	assert (pDriver != 0);
+	if (!lv_disp_flush_is_last (pDriver))
+	{
+		lv_disp_flush_ready (pDriver);
+
+		return;
+	}
+
+	assert (pBuffer == m_pBuffer1 || pBuffer == m_pBuffer2);
+	lv_color_t *pOther = pBuffer == m_pBuffer1 ? m_pBuffer2 : m_pBuffer1;
+
+	assert (m_pFrameBuffer != 0);
+	m_pFrameBuffer->SetVirtualOffset (0, pBuffer == m_pBuffer1 ? 0 : m_nHeight);
+	m_pFrameBuffer->WaitForVerticalSync ();
+
+	if (!m_bDirtyOverflow)
+	{
+		for (unsigned i = 0; i < m_nDirtyAreas; i++)
+		{
+			CopyArea (pOther, pBuffer, &m_DirtyArea[i]);
+		}
+	}
+	else
+	{
+		memcpy (pOther, pBuffer, m_nWidth * m_nHeight * sizeof (lv_color_t));
+	}
+
+	m_nDirtyAreas = 0;
+	m_bDirtyOverflow = FALSE;
+
+	lv_disp_flush_ready (pDriver);
+}
+
+void CLVGL::CopyArea (lv_color_t *pTo, const lv_color_t *pFrom, const lv_area_t *pArea)
+{
+	assert (pArea != 0);
+	assert (pArea->x1 <= pArea->x2);
+	assert (pArea->y1 <= pArea->y2);
+	size_t nLineLength = (pArea->x2 - pArea->x1 + 1) * sizeof (lv_color_t);
+
+	for (int32_t y = pArea->y1; y <= pArea->y2; y++)
+	{
+		size_t nOffset = y * m_nWidth + pArea->x1;
+
+		memcpy (pTo + nOffset, pFrom + nOffset, nLineLength);
+	}
+}
+
+void CLVGL::GetStatistics (TLVGLStatistics *pStatistics) const
+{
+	assert (pStatistics != 0);
+	*pStatistics = m_Statistics;
+}
+
+void CLVGL::ResetStatistics (void)
+{
+	memset (&m_Statistics, 0, sizeof m_Statistics);
+}
+
 void CLVGL::PointerRead (lv_indev_drv_t *pDriver, lv_indev_data_t *pData)
 {
 	assert (s_pThis != 0);
@@ -32,21 +32,66 @@
 #include <circle/types.h>
 #include <assert.h>
 
+#define LVGL_STRIP_LINES		10		// with LVGLRenderModeStrips
+#define LVGL_AUTO_STRIP_SIZE		(256*1024)	// bytes per buffer with LVGLRenderModeAutoStrips
+#define LVGL_MAX_DIRTY_AREAS		32		// with LVGLRenderModeDirect
+
+enum TLVGLRenderMode
+{
+	LVGLRenderModeStrips,		// two buffers with LVGL_STRIP_LINES lines each (default)
+	LVGLRenderModeAutoStrips,	// two buffers, the number of lines depends on the resolution
+	LVGLRenderModeDirect,		// render into a double-height frame buffer, flip on vsync
+	LVGLRenderModeUnknown
+};
+
+struct TLVGLStatistics
+{
+	unsigned nRefreshes;		// refresh cycles with invalidated areas
+	unsigned nFlushes;		// transfers of rendered areas
+	u64	 nPixelsRendered;	// invalidated pixels, which have been rendered
+	unsigned nLastRefreshTime;	// duration of the last refresh cycle in milliseconds
+	unsigned nMaxRefreshTime;	// longest refresh cycle in milliseconds
+};
+
 class CLVGL
 {
+public:
+	// transfers an area of pixels (format depends on LV_COLOR_DEPTH) to an external display,
+	// nPitch is always nWidth, the buffer can be re-used by LVGL, when the handler returns
+	typedef void TDisplayUpdateHandler (unsigned nPosX, unsigned nPosY,
+					    unsigned nWidth, unsigned nHeight,
+					    const void *pPixels, void *pParam);
+
 public:
 	CLVGL (CScreenDevice *pScreen, CInterruptSystem *pInterrupt);
 	CLVGL (CBcmFrameBuffer *pFrameBuffer, CInterruptSystem *pInterrupt);
+	// for displays without frame buffer (e.g. SPI displays, see CST7789Display::UpdateHandler())
+	CLVGL (unsigned nWidth, unsigned nHeight,
+	       TDisplayUpdateHandler *pUpdateHandler, void *pUpdateParam,
+	       CInterruptSystem *pInterrupt);
 	~CLVGL (void);
 
-	boolean Initialize (void);
+	// LVGLRenderModeDirect requires a frame buffer with double height (bDoubleBuffered set),
+	// which is not the case for the frame buffer of CScreenDevice, and a pitch, which is
+	// equal to the width, LVGLRenderModeAutoStrips is used otherwise
+	boolean Initialize (TLVGLRenderMode Mode = LVGLRenderModeStrips);
 
 	void Update (boolean bPlugAndPlayUpdated = FALSE);
 
+	TLVGLRenderMode GetRenderMode (void) const	{ return m_RenderMode; }
+
+	void GetStatistics (TLVGLStatistics *pStatistics) const;
+	void ResetStatistics (void);
+
 private:
 	static void DisplayFlush (lv_disp_drv_t *pDriver, const lv_area_t *pArea,
 				  lv_color_t *pBuffer);
 	static void DisplayFlushComplete (unsigned nChannel, boolean bStatus, void *pParam);
+	static void DisplayMonitor (lv_disp_drv_t *pDriver, uint32_t nTime, uint32_t nPixels);
+
+	void DirectModeFlush (lv_disp_drv_t *pDriver, const lv_area_t *pArea,
+			      lv_color_t *pBuffer);
+	void CopyArea (lv_color_t *pTo, const lv_color_t *pFrom, const lv_area_t *pArea);
 
 	static void PointerRead (lv_indev_drv_t *pDriver, lv_indev_data_t *pData);
 	static void MouseEventHandler (TMouseEvent Event, unsigned nButtons,
@@ -59,11 +104,16 @@ private:
 	static void MouseRemovedHandler (CDevice *pDevice, void *pContext);
 
 private:
-	lv_color_t *m_pBuffer1;
+	TLVGLRenderMode m_RenderMode;
+	lv_color_t *m_pBuffer1;			// in the frame buffer with LVGLRenderModeDirect
 	lv_color_t *m_pBuffer2;
 
 	CScreenDevice *m_pScreen;
 	CBcmFrameBuffer *m_pFrameBuffer;
+	unsigned m_nWidth;
+	unsigned m_nHeight;
+	TDisplayUpdateHandler *m_pUpdateHandler;
+	void *m_pUpdateParam;
 	CDMAChannel m_DMAChannel;
 	unsigned m_nLastUpdate;
 
@@ -72,6 +122,12 @@ private:
 	unsigned m_nLastTouchUpdate;
 	lv_indev_data_t m_PointerData;
 
+	lv_area_t m_DirtyArea[LVGL_MAX_DIRTY_AREAS];	// rendered in this refresh cycle
+	unsigned m_nDirtyAreas;
+	boolean m_bDirtyOverflow;			// copy the whole buffer
+
+	TLVGLStatistics m_Statistics;
+
 	static CLVGL *s_pThis;
 };
 
@@ -2,7 +2,7 @@
 // microbitclient.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -30,7 +30,10 @@ static const char From[] = "microbit";
 
 CMicrobitClient::CMicrobitClient (const char *pDeviceName)
 :	m_DeviceName (pDeviceName),
-	m_pMicrobit (0)
+	m_pMicrobit (0),
+	m_nReplyLength (0),
+	m_bSyncDone (TRUE),
+	m_bSyncStatus (FALSE)
 {
 }
 
@@ -62,6 +65,56 @@ boolean CMicrobitClient::Initialize (void)
 	return TRUE;
 }
 
+boolean CMicrobitClient::SubmitRequest (const char *pCommand,
+					TMicrobitReplyHandler *pHandler, void *pParam)
+{
+	assert (pCommand != 0);
+	assert (*pCommand == '!');
+
+	TRequest Request;
+	if (strlen (pCommand) >= sizeof Request.Command)
+	{
+		return FALSE;
+	}
+
+	strcpy (Request.Command, pCommand);
+	Request.pHandler = pHandler;
+	Request.pParam = pParam;
+
+	if (!m_Queue.Put (Request))
+	{
+		return FALSE;
+	}
+
+	SendRequests ();
+
+	return TRUE;
+}
+
+void CMicrobitClient::Update (void)
+{
+	ReceiveReplies ();
+	SendRequests ();
+}
+
+void CMicrobitClient::Flush (void)
+{
+	while (GetPendingRequests () > 0)
+	{
+		Update ();
+
+		if (CScheduler::IsActive ())
+		{
+			CScheduler::Get ()->Yield ();
+		}
+	}
+}
+
+unsigned CMicrobitClient::GetPendingRequests (void) const
+{
+	return m_Queue.GetCount () + m_InFlight.GetCount ();
+}
+
 int CMicrobitClient::GetTemperature (void)
 {
 	if (!SendCommand ("!MI:TE\n"))
@@ -431,59 +484,152 @@ int CMicrobitClient::GetFieldStrength (void)
 
 boolean CMicrobitClient::SendCommand (const char *pCommand)
 {
-	assert (m_pMicrobit != 0);
 	assert (pCommand != 0);
-
-	int nResult = m_pMicrobit->Write (pCommand, strlen (pCommand));
-	if (nResult < 0)
+	if (strlen (pCommand) >= MICROBIT_COMMAND_SIZE)
 	{
-		CLogger::Get ()->Write (From, LogError, "Write error");
+		CLogger::Get ()->Write (From, LogError, "Command too long");
 
 		return FALSE;
 	}
 
+	assert (m_bSyncDone);
+	m_bSyncDone = FALSE;
+
+	// wait for a free queue entry
+	while (!SubmitRequest (pCommand, SyncReplyHandler, this))
+	{
+		Update ();
+
+		if (CScheduler::IsActive ())
+		{
+			CScheduler::Get ()->Yield ();
+		}
+	}
+
 	return TRUE;
 }
 
 boolean CMicrobitClient::ReceiveResult (CString *pResult)
 {
 	assert (pResult != 0);
-	*pResult = "";
 
-	boolean bContinue = TRUE;
-	while (bContinue)
+	while (!m_bSyncDone)
 	{
-		char Buffer [20];
-		int nResult = m_pMicrobit->Read (Buffer, sizeof Buffer-1);
-		if (nResult > 0)
+		Update ();
+
+		if (!m_bSyncDone && CScheduler::IsActive ())
 		{
-			assert ((size_t) nResult < sizeof Buffer);
-			Buffer[nResult] = '\0';
+			CScheduler::Get ()->Yield ();
+		}
+	}
 
-			bContinue = Buffer[nResult-1] != '\n';
-			if (!bContinue)
-			{
-				Buffer[nResult-1] = '\0';
-			}
+	*pResult = m_SyncReply;
+
+	return m_bSyncStatus;
+}
+
+void CMicrobitClient::SyncReplyHandler (int nResult, const char *pReply, void *pParam)
+{
+	CMicrobitClient *pThis = (CMicrobitClient *) pParam;
+	assert (pThis != 0);
+
+	pThis->m_bSyncStatus = pReply != 0;
+	pThis->m_SyncReply = pReply != 0 ? pReply : "";
+
+	pThis->m_bSyncDone = TRUE;
+}
 
-			pResult->Append (Buffer);
+void CMicrobitClient::ReceiveReplies (void)
+{
+	assert (m_pMicrobit != 0);
+
+	while (!m_InFlight.IsEmpty ())
+	{
+		char Buffer[64];
+		int nResult = m_pMicrobit->Read (Buffer, sizeof Buffer);
+		if (nResult == 0)
+		{
+			break;
 		}
-		else if (nResult < 0)
+
+		if (nResult < 0)
 		{
 			CLogger::Get ()->Write (From, LogError, "Read error");
 
-			return FALSE;
+			// the assignment of further replies would be uncertain
+			TRequest Request;
+			while (m_InFlight.Get (&Request))
+			{
+				if (Request.pHandler != 0)
+				{
+					(*Request.pHandler) (MICROBIT_ERROR, 0, Request.pParam);
+				}
+			}
+
+			m_nReplyLength = 0;
+
+			break;
 		}
-		else
+
+		for (int i = 0; i < nResult; i++)
 		{
-			if (CScheduler::IsActive ())
+			if (Buffer[i] == '\n')
 			{
-				CScheduler::Get ()->Yield ();
+				m_ReplyBuffer[m_nReplyLength] = '\0';
+				m_nReplyLength = 0;
+
+				Reply (m_ReplyBuffer);
+			}
+			else if (m_nReplyLength < sizeof m_ReplyBuffer-1)
+			{
+				m_ReplyBuffer[m_nReplyLength++] = Buffer[i];
 			}
 		}
 	}
+}
 
-	return TRUE;
+void CMicrobitClient::Reply (const char *pReply)
+{
+	assert (pReply != 0);
+
+	TRequest Request;
+	if (!m_InFlight.Get (&Request))
+	{
+		CLogger::Get ()->Write (From, LogWarning, "Unexpected reply (\"%s\")", pReply);
+
+		return;
+	}
+
+	int nResult = strcmp (pReply, "OK") == 0 ? MICROBIT_OK : ConvertInteger (pReply);
+
+	if (Request.pHandler != 0)
+	{
+		(*Request.pHandler) (nResult, pReply, Request.pParam);
+	}
+}
+
+void CMicrobitClient::SendRequests (void)
+{
+	assert (m_pMicrobit != 0);
+
+	TRequest Request;
+	while (   !m_InFlight.IsFull ()
+	       && m_Queue.Get (&Request))
+	{
+		if (m_pMicrobit->Write (Request.Command, strlen (Request.Command)) < 0)
+		{
+			CLogger::Get ()->Write (From, LogError, "Write error");
+
+			if (Request.pHandler != 0)
+			{
+				(*Request.pHandler) (MICROBIT_ERROR, 0, Request.pParam);
+			}
+
+			continue;
+		}
+
+		m_InFlight.Put (Request);
+	}
 }
 
 int CMicrobitClient::ReceiveInteger (void)
@@ -2,7 +2,7 @@
 // microbitclient.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,6 +21,7 @@
 #define _microbit_microbitclient_h
 
 #include <circle/usb/usbserial.h>
+#include <circle/fixedring.h>
 #include <circle/string.h>
 #include <circle/types.h>
 
@@ -30,6 +31,17 @@
 #define MICROBIT_FALSE		0
 #define MICROBIT_TRUE		1
 
+// The server reads 20 characters at once from a small UART buffer, so only a few
+// requests may be on the way.
+#define MICROBIT_MAX_IN_FLIGHT	4		// sent, but not answered yet (power of 2)
+#define MICROBIT_QUEUE_SIZE	32		// max. waiting requests (power of 2)
+#define MICROBIT_COMMAND_SIZE	48		// max. command length incl. '\0'
+#define MICROBIT_REPLY_SIZE	48		// longer replies are truncated
+
+// nResult is the number returned, MICROBIT_OK or MICROBIT_ERROR,
+// pReply is the reply line without '\n' (0 on I/O error), valid during the call only
+typedef void TMicrobitReplyHandler (int nResult, const char *pReply, void *pParam);
+
 class CMicrobitClient
 {
 public:
@@ -38,6 +50,19 @@ public:
 
 	boolean Initialize (void);
 
+	// Asynchronous interface:
+	// Requests are sent without waiting for the previous reply (up to MICROBIT_MAX_IN_FLIGHT),
+	// the replies are assigned in order. pCommand has the protocol format, e.g. "!PI:RA:0\n"
+	// (see microbit-server.py). The handler is called from Update(), it may submit further
+	// requests, but must not call the synchronous functions below.
+	boolean SubmitRequest (const char *pCommand,		// returns FALSE if queue is full
+			       TMicrobitReplyHandler *pHandler = 0, void *pParam = 0);
+	void Update (void);					// call this often, does not block
+	void Flush (void);					// wait for all replies
+	unsigned GetPendingRequests (void) const;		// waiting and in flight
+
+	// Synchronous interface (requests submitted before are processed first):
+
 	// Microbit
 	int GetTemperature (void);
 
@@ -103,6 +128,12 @@ private:
 	boolean SendCommand (const char *pCommand);
 	boolean ReceiveResult (CString *pResult);
 
+	void ReceiveReplies (void);
+	void Reply (const char *pReply);
+	void SendRequests (void);
+
+	static void SyncReplyHandler (int nResult, const char *pReply, void *pParam);
+
 	int ReceiveInteger (void);
 
 	int CheckStatus (void);
@@ -113,6 +144,23 @@ private:
 	CString m_DeviceName;
 
 	CUSBSerialDevice *m_pMicrobit;
+
+	struct TRequest
+	{
+		char			 Command[MICROBIT_COMMAND_SIZE];
+		TMicrobitReplyHandler	*pHandler;
+		void			*pParam;
+	};
+
+	CFixedRing<TRequest, MICROBIT_QUEUE_SIZE> m_Queue;
+	CFixedRing<TRequest, MICROBIT_MAX_IN_FLIGHT> m_InFlight;
+
+	char m_ReplyBuffer[MICROBIT_REPLY_SIZE];
+	unsigned m_nReplyLength;
+
+	volatile boolean m_bSyncDone;
+	boolean m_bSyncStatus;
+	CString m_SyncReply;
 };
 
 #endif
@@ -2,7 +2,7 @@
 // swdloader.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2021-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -94,6 +94,8 @@
 	#define DCRSR_REGW_N_R			BIT(16)
 #define DCRDR			0xE000EDF8
 
+#define TAR_WRAP_SIZE		1024		// TAR auto-increment is guaranteed within 1K ([1] C2.2.2)
+
 LOGMODULE ("swdloader");
 
 CSWDLoader::CSWDLoader (unsigned nClockPin, unsigned nDataPin, unsigned nResetPin,
@@ -102,6 +104,14 @@ CSWDLoader::CSWDLoader (unsigned nClockPin, unsigned nDataPin, unsigned nResetPi
 	m_nDelayNanos (1000000U / nClockRateKHz / 2),
 	m_ClockPin (nClockPin, GPIOModeOutput),
 	m_DataPin (nDataPin, GPIOModeOutput),
+	m_nClockPin (nClockPin),
+	m_nDataPin (nDataPin),
+	m_bFastIO (nClockPin < 32 && nDataPin < 32),
+	m_nClockMask (m_bFastIO ? BIT (nClockPin) : 0),
+	m_nDataMask (m_bFastIO ? BIT (nDataPin) : 0),
+	m_bDataOutput (TRUE),
+	m_nParallel (0),
+	m_bMismatch (FALSE),
 	m_pTimer (CTimer::Get ())
 {
 	if (m_bResetAvailable)
@@ -199,6 +209,71 @@ boolean CSWDLoader::Load (const void *pProgram, size_t nProgSize, u32 nAddress)
 	return Start (nAddress);
 }
 
+boolean CSWDLoader::LoadParallel (CSWDLoader * const *ppLoader, unsigned nCount,
+				  const void *pProgram, size_t nProgSize, u32 nAddress)
+{
+	assert (ppLoader != 0);
+	assert (1 <= nCount && nCount <= MaxParallelTargets);
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		assert (ppLoader[i] != 0);
+		assert (ppLoader[i]->m_bFastIO);
+
+		if (!ppLoader[i]->Halt ())
+		{
+			return FALSE;
+		}
+	}
+
+	// the first loader drives the clock and data pins of all targets at once
+	CSWDLoader *pLeader = ppLoader[0];
+	for (unsigned i = 1; i < nCount; i++)
+	{
+		assert (!(pLeader->m_nDataMask & ppLoader[i]->m_nDataMask));
+
+		pLeader->m_pParallel[i-1] = ppLoader[i];
+		pLeader->m_nClockMask |= ppLoader[i]->m_nClockMask;
+		pLeader->m_nDataMask |= ppLoader[i]->m_nDataMask;
+	}
+	pLeader->m_nParallel = nCount-1;
+
+	unsigned nStartTicks = pLeader->m_pTimer->GetClockTicks ();
+
+	boolean bOK = pLeader->LoadChunk (pProgram, nProgSize, nAddress);
+
+	unsigned nEndTicks = pLeader->m_pTimer->GetClockTicks ();
+
+	pLeader->m_nParallel = 0;
+	pLeader->m_nClockMask = BIT (pLeader->m_nClockPin);
+	pLeader->m_nDataMask = BIT (pLeader->m_nDataPin);
+
+	for (unsigned i = 1; i < nCount; i++)
+	{
+		ppLoader[i]->m_bDataOutput = pLeader->m_bDataOutput;
+	}
+
+	if (!bOK)
+	{
+		return FALSE;
+	}
+
+	double fDuration = (double) (nEndTicks - nStartTicks) / CLOCKHZ;
+
+	LOGNOTE ("%u bytes loaded to %u targets in %.2f seconds (%.1f KBytes/s)",
+		 nProgSize, nCount, fDuration, nCount * nProgSize / fDuration / 1024.0);
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		if (!ppLoader[i]->Start (nAddress))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 boolean CSWDLoader::Halt (void)
 {
 	BeginTransaction ();
@@ -233,6 +308,13 @@ boolean CSWDLoader::LoadChunk (const void *pChunk, size_t nChunkSize, u32 nAddre
 	assert ((nChunkSize & 3) == 0);
 	while (nChunkSize > 0)
 	{
+		// TAR is written once per block, the following words use the auto-increment
+		size_t nBlockSize = TAR_WRAP_SIZE - (nAddress & (TAR_WRAP_SIZE-1));
+		if (nBlockSize > nChunkSize)
+		{
+			nBlockSize = nChunkSize;
+		}
+
 		BeginTransaction ();
 
 		if (!WriteData (WR_AP_TAR, nAddress))
@@ -242,28 +324,18 @@ boolean CSWDLoader::LoadChunk (const void *pChunk, size_t nChunkSize, u32 nAddre
 			return FALSE;
 		}
 
-		const size_t BlockSize = 1024;
-		for (unsigned i = 0; i < BlockSize; i += 4)
+		for (unsigned i = 0; i < nBlockSize; i += 4)
 		{
 			if (!WriteData (WR_AP_DRW, *pChunk32++))
 			{
-				LOGERR ("Memory write failed (0x%X)", nAddress);
+				LOGERR ("Memory write failed (0x%X)", nAddress + i);
 
 				return FALSE;
 			}
-
-			if (nChunkSize > 4)
-			{
-				nChunkSize -= 4;
-			}
-			else
-			{
-				nChunkSize = 0;
-				break;
-			}
 		}
 
-		nAddress += BlockSize;
+		nAddress += nBlockSize;
+		nChunkSize -= nBlockSize;
 
 		EndTransaction ();
 	}
@@ -274,6 +346,8 @@ boolean CSWDLoader::LoadChunk (const void *pChunk, size_t nChunkSize, u32 nAddre
 	if (!ReadMem (nAddressCopy, &nFirstWordRead))
 	{
 		LOGERR ("Memory read failed (0x%X)", nAddressCopy);
+
+		return FALSE;
 	}
 
 	EndTransaction ();
@@ -372,12 +446,13 @@ boolean CSWDLoader::WriteData (u8 nRequest, u32 nData)
 
 	ReadBits (TURN_CYCLES);
 
-	if (nResponse != DP_OK)
+	if (nResponse != DP_OK || m_bMismatch)
 	{
 		EndTransaction ();
 
-		LOGWARN ("Cannot write (req 0x%02X, data 0x%X, resp %u)",
-			 (unsigned) nRequest, nData, nResponse);
+		LOGWARN ("Cannot write (req 0x%02X, data 0x%X, resp %u%s)",
+			 (unsigned) nRequest, nData, nResponse,
+			 m_bMismatch ? ", targets differ" : "");
 
 		return FALSE;
 	}
@@ -397,13 +472,14 @@ boolean CSWDLoader::ReadData (u8 nRequest, u32 *pData)
 
 	u32 nResponse = ReadBits (3);
 
-	if (nResponse != DP_OK)
+	if (nResponse != DP_OK || m_bMismatch)
 	{
 		ReadBits (TURN_CYCLES);
 
 		EndTransaction ();
 
-		LOGWARN ("Cannot read (req 0x%02X, resp %u)", (unsigned) nRequest, nResponse);
+		LOGWARN ("Cannot read (req 0x%02X, resp %u%s)", (unsigned) nRequest, nResponse,
+			 m_bMismatch ? ", targets differ" : "");
 
 		return FALSE;
 	}
@@ -411,7 +487,8 @@ boolean CSWDLoader::ReadData (u8 nRequest, u32 *pData)
 	u32 nData = ReadBits (32);
 
 	u32 nParity = ReadBits (1);
-	if (nParity != parity32 (nData))
+	if (   nParity != parity32 (nData)
+	    || m_bMismatch)
 	{
 		ReadBits (TURN_CYCLES);
 
@@ -446,6 +523,8 @@ void CSWDLoader::BeginTransaction (void)
 {
 	EnterCritical ();
 
+	m_bMismatch = FALSE;
+
 	WriteIdle ();
 }
 
@@ -481,21 +560,26 @@ void CSWDLoader::WriteIdle (void)
 {
 	WriteBits (0, 8);
 
-	m_ClockPin.Write (LOW);
-
-	m_DataPin.SetMode (GPIOModeOutput, FALSE);
-	m_DataPin.Write (LOW);
+	WriteClockLow (LOW);
 }
 
 void CSWDLoader::WriteBits (u32 nBits, unsigned nBitCount)
 {
-	m_DataPin.SetMode (GPIOModeOutput, FALSE);
+	SetDataDirection (TRUE);
 
 	while (nBitCount--)
 	{
-		m_DataPin.Write (nBits & 1);
+		WriteClockLow (nBits & 1);
+		if (m_nDelayNanos)
+		{
+			m_pTimer->nsDelay (m_nDelayNanos);
+		}
 
-		WriteClock ();
+		WriteClockHigh ();
+		if (m_nDelayNanos)
+		{
+			m_pTimer->nsDelay (m_nDelayNanos);
+		}
 
 		nBits >>= 1;
 	}
@@ -503,15 +587,25 @@ void CSWDLoader::WriteBits (u32 nBits, unsigned nBitCount)
 
 u32 CSWDLoader::ReadBits (unsigned nBitCount)
 {
-	m_DataPin.SetMode (GPIOModeInput, FALSE);
+	SetDataDirection (FALSE);
 
 	u32 nBits = 0;
 	unsigned nRemaining = nBitCount--;
 	while (nRemaining--)
 	{
-		unsigned nLevel = m_DataPin.Read ();
+		unsigned nLevel = ReadDataLevel ();
 
-		WriteClock ();
+		WriteClockLow (LOW);
+		if (m_nDelayNanos)
+		{
+			m_pTimer->nsDelay (m_nDelayNanos);
+		}
+
+		WriteClockHigh ();
+		if (m_nDelayNanos)
+		{
+			m_pTimer->nsDelay (m_nDelayNanos);
+		}
 
 		nBits >>= 1;
 		nBits |= nLevel << nBitCount;
@@ -520,11 +614,78 @@ u32 CSWDLoader::ReadBits (unsigned nBitCount)
 	return nBits;
 }
 
-void CSWDLoader::WriteClock (void)
+// switching the direction needs a read-modify-write of GPFSELn, so do it only on change
+void CSWDLoader::SetDataDirection (boolean bOutput)
+{
+	if (m_bDataOutput == bOutput)
+	{
+		return;
+	}
+
+	TGPIOMode Mode = bOutput ? GPIOModeOutput : GPIOModeInput;
+
+	m_DataPin.SetMode (Mode, FALSE);
+
+	for (unsigned i = 0; i < m_nParallel; i++)
+	{
+		assert (m_pParallel[i] != 0);
+		m_pParallel[i]->m_DataPin.SetMode (Mode, FALSE);
+	}
+
+	m_bDataOutput = bOutput;
+}
+
+void CSWDLoader::WriteClockLow (unsigned nData)
 {
+	if (m_bFastIO)
+	{
+		// SWDIO is changed together with the falling edge of SWCLK
+		u32 nMask = m_nClockMask;
+		if (m_bDataOutput)
+		{
+			nMask |= m_nDataMask;
+		}
+
+		CGPIOPin::WriteAll (nData ? m_nDataMask : 0, nMask);
+
+		return;
+	}
+
+	if (m_bDataOutput)
+	{
+		m_DataPin.Write (nData);
+	}
+
 	m_ClockPin.Write (LOW);
-	m_pTimer->nsDelay (m_nDelayNanos);
+}
+
+void CSWDLoader::WriteClockHigh (void)
+{
+	if (m_bFastIO)
+	{
+		CGPIOPin::WriteAll (m_nClockMask, m_nClockMask);
+	}
+	else
+	{
+		m_ClockPin.Write (HIGH);
+	}
+}
+
+unsigned CSWDLoader::ReadDataLevel (void)
+{
+	if (!m_bFastIO)
+	{
+		return m_DataPin.Read ();
+	}
+
+	u32 nLevels = CGPIOPin::ReadAll () & m_nDataMask;
+
+	// all parallel targets must send the same bits
+	if (   nLevels != 0
+	    && nLevels != m_nDataMask)
+	{
+		m_bMismatch = TRUE;
+	}
 
-	m_ClockPin.Write (HIGH);
-	m_pTimer->nsDelay (m_nDelayNanos);
+	return nLevels & BIT (m_nDataPin) ? HIGH : LOW;
 }
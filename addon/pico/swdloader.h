@@ -2,7 +2,7 @@
 // swdloader.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2021-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -28,6 +28,7 @@ class CSWDLoader	/// Loads a program via the Serial Wire Debug interface to the
 {
 public:
 	const static unsigned DefaultClockRateKHz = 400;	///< Default clock rate in KHz
+	const static unsigned MaxParallelTargets = 8;		///< for LoadParallel()
 
 public:
 	/// \param nClockPin GPIO pin to which SWCLK is connected
@@ -36,6 +37,8 @@ public:
 	/// \param nClockRateKHz Requested interface clock rate in KHz
 	/// \note GPIO pin numbers are SoC number, not header positions.
 	/// \note The actual clock rate may be smaller than the requested.
+	/// \note If SWCLK and SWDIO are GPIO0-31, both pins are accessed together\n
+	///	  with one register access, which allows higher clock rates.
 	CSWDLoader (unsigned nClockPin, unsigned nDataPin, unsigned nResetPin = 0,
 		    unsigned nClockRateKHz = DefaultClockRateKHz);
 
@@ -51,6 +54,19 @@ public:
 	/// \param nAddress Load and start address of the program image
 	boolean Load (const void *pProgram, size_t nProgSize, u32 nAddress);
 
+	/// \brief Halt several RP2040, load the same program image to all and start them
+	/// \param ppLoader List of initialized loaders (on disjoint SWDIO pins)
+	/// \param nCount Number of loaders in the list (1..MaxParallelTargets)
+	/// \param pProgram Pointer to program image in memory
+	/// \param nProgSize Size of the program image (must be a multiple of 4)
+	/// \param nAddress Load and start address of the program image
+	/// \return Operation successful on all targets?
+	/// \note The targets are driven in lockstep with the clock rate of the first loader,\n
+	///	  so that this takes about the time of a single Load(). All SWCLK and SWDIO\n
+	///	  pins must be GPIO0-31.
+	static boolean LoadParallel (CSWDLoader * const *ppLoader, unsigned nCount,
+				     const void *pProgram, size_t nProgSize, u32 nAddress);
+
 public:
 	/// \brief Halt the RP2040
 	/// \return Operation successful?
@@ -88,7 +104,11 @@ private:
 
 	void WriteBits (u32 nBits, unsigned nBitCount);
 	u32 ReadBits (unsigned nBitCount);
-	void WriteClock (void);
+
+	void SetDataDirection (boolean bOutput);
+	void WriteClockLow (unsigned nData);	// sets SWDIO too, if output
+	void WriteClockHigh (void);
+	unsigned ReadDataLevel (void);
 
 private:
 	unsigned m_bResetAvailable;
@@ -98,6 +118,17 @@ private:
 	CGPIOPin m_ClockPin;
 	CGPIOPin m_DataPin;
 
+	unsigned m_nClockPin;
+	unsigned m_nDataPin;
+	boolean m_bFastIO;		// pins can be accessed with CGPIOPin::WriteAll()
+	u32 m_nClockMask;		// including the pins of parallel targets
+	u32 m_nDataMask;
+	boolean m_bDataOutput;		// current direction of SWDIO
+
+	CSWDLoader *m_pParallel[MaxParallelTargets-1];	// driven in lockstep with this
+	unsigned m_nParallel;
+	boolean m_bMismatch;		// parallel targets responded differently
+
 	CTimer *m_pTimer;
 };
 
@@ -0,0 +1,215 @@
+//
+// gcovdump.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <profile/gcovdump.h>
+#include <circle/devicenameservice.h>
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <assert.h>
+
+// see gcc/gcov.h (GCC 12+), which is not available with -nostdinc
+struct gcov_info;
+
+extern "C"
+{
+	void __gcov_info_to_gcda (const struct gcov_info *pInfo,
+				  void (*pFilenameFunc) (const char *, void *),
+				  void (*pDumpFunc) (const void *, unsigned, void *),
+				  void *(*pAllocateFunc) (unsigned, void *),
+				  void *pArg);
+
+	void __gcov_filename_to_gcfn (const char *pFilename,
+				      void (*pDumpFunc) (const void *, unsigned, void *),
+				      void *pArg);
+
+	// defined in circle.ld, filled by -fprofile-info-section
+	extern const struct gcov_info *const __gcov_info_start[];
+	extern const struct gcov_info *const __gcov_info_end[];
+}
+
+static const char From[] = "gcov";
+
+boolean CGCovDump::Write (CDevice *pDevice)
+{
+	assert (pDevice != 0);
+
+	TSink *pSink = new TSink;
+	assert (pSink != 0);
+	memset (pSink, 0, sizeof *pSink);
+	pSink->pDevice = pDevice;
+
+	boolean bOK = Dump (pSink);
+
+	delete pSink;
+
+	return bOK;
+}
+
+boolean CGCovDump::Save (const char *pPartitionName)
+{
+	CDevice *pPartition = CDeviceNameService::Get ()->GetDevice (pPartitionName, TRUE);
+	if (pPartition == 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Partition not found: %s", pPartitionName);
+
+		return FALSE;
+	}
+
+	CFATFileSystem FileSystem;
+	if (!FileSystem.Mount (pPartition))
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot mount partition: %s", pPartitionName);
+
+		return FALSE;
+	}
+
+	boolean bOK = Save (&FileSystem);
+
+	FileSystem.UnMount ();
+
+	return bOK;
+}
+
+boolean CGCovDump::Save (CFATFileSystem *pFileSystem)
+{
+	assert (pFileSystem != 0);
+
+	TSink *pSink = new TSink;
+	assert (pSink != 0);
+	memset (pSink, 0, sizeof *pSink);
+	pSink->pFileSystem = pFileSystem;
+
+	pSink->hFile = pFileSystem->FileCreate (GCOV_DUMP_FILENAME);
+	if (pSink->hFile == 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot create file: %s", GCOV_DUMP_FILENAME);
+
+		delete pSink;
+
+		return FALSE;
+	}
+
+	boolean bOK = Dump (pSink);
+
+	if (!pFileSystem->FileClose (pSink->hFile))
+	{
+		bOK = FALSE;
+	}
+
+	delete pSink;
+
+	return bOK;
+}
+
+boolean CGCovDump::Dump (TSink *pSink)
+{
+	assert (pSink != 0);
+
+	unsigned nObjects = 0;
+	for (const struct gcov_info *const *ppInfo = __gcov_info_start;
+	     ppInfo < __gcov_info_end; ppInfo++)
+	{
+		__gcov_info_to_gcda (*ppInfo, FilenameHandler, DumpHandler, AllocateHandler, pSink);
+
+		nObjects++;
+	}
+
+	Flush (pSink);
+
+	if (pSink->bError)
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot write profile data");
+
+		return FALSE;
+	}
+
+	CLogger::Get ()->Write (From, LogDebug, "Profile data of %u objects saved", nObjects);
+
+	return TRUE;
+}
+
+void CGCovDump::Flush (TSink *pSink)
+{
+	assert (pSink != 0);
+
+	if (   pSink->nInBuffer == 0
+	    || pSink->bError)
+	{
+		pSink->nInBuffer = 0;
+
+		return;
+	}
+
+	if (pSink->pDevice != 0)
+	{
+		if (pSink->pDevice->Write (pSink->Buffer, pSink->nInBuffer) != (int) pSink->nInBuffer)
+		{
+			pSink->bError = TRUE;
+		}
+	}
+	else
+	{
+		assert (pSink->pFileSystem != 0);
+		if (pSink->pFileSystem->FileWrite (pSink->hFile, pSink->Buffer, pSink->nInBuffer)
+		    != pSink->nInBuffer)
+		{
+			pSink->bError = TRUE;
+		}
+	}
+
+	pSink->nInBuffer = 0;
+}
+
+void CGCovDump::FilenameHandler (const char *pFilename, void *pArg)
+{
+	// the file name of the .gcda file is written to the stream
+	__gcov_filename_to_gcfn (pFilename, DumpHandler, pArg);
+}
+
+void CGCovDump::DumpHandler (const void *pData, unsigned nLength, void *pArg)
+{
+	TSink *pSink = (TSink *) pArg;
+	assert (pSink != 0);
+
+	const u8 *pFrom = (const u8 *) pData;
+	while (nLength > 0)
+	{
+		unsigned nCopy = GCOV_DUMP_BUF_SIZE - pSink->nInBuffer;
+		if (nCopy > nLength)
+		{
+			nCopy = nLength;
+		}
+
+		memcpy (pSink->Buffer + pSink->nInBuffer, pFrom, nCopy);
+		pSink->nInBuffer += nCopy;
+		pFrom += nCopy;
+		nLength -= nCopy;
+
+		if (pSink->nInBuffer == GCOV_DUMP_BUF_SIZE)
+		{
+			Flush (pSink);
+		}
+	}
+}
+
+void *CGCovDump::AllocateHandler (unsigned nLength, void *pArg)
+{
+	// only used for value profiles (not generated with PGO = generate), never freed
+	return new u8[nLength];
+}
@@ -0,0 +1,70 @@
+//
+// gcovdump.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _profile_gcovdump_h
+#define _profile_gcovdump_h
+
+#include <circle/fs/fat/fatfs.h>
+#include <circle/device.h>
+#include <circle/types.h>
+
+#define GCOV_DUMP_FILENAME	"GCOV.STM"
+#define GCOV_DUMP_BUF_SIZE	0x1000
+
+/// \note The application and the libraries must be built with "PGO = generate" in Config.mk
+///	  (requires GCC 12 or later). The written stream has to be converted into .gcda files
+///	  on the host with "gcov-tool merge-stream" before rebuilding with "PGO = use".
+///	  See doc/build-optimization.txt for the whole workflow.
+
+class CGCovDump		/// Saves the profile data of an instrumented build as gcov stream
+{
+public:
+	/// \brief Write the profile data to a device (e.g. CQEMUHostFile)
+	/// \return Operation successful?
+	static boolean Write (CDevice *pDevice);
+
+	/// \brief Save the profile data to the file GCOV_DUMP_FILENAME
+	/// \param pPartitionName Name of the partition to be used (default: SD card)
+	/// \note The file system is mounted and unmounted automatically.
+	static boolean Save (const char *pPartitionName = "emmc1-1");
+
+	/// \brief Save the profile data to the file GCOV_DUMP_FILENAME
+	/// \param pFileSystem Pointer to the file system object, which must be mounted before
+	static boolean Save (CFATFileSystem *pFileSystem);
+
+private:
+	struct TSink
+	{
+		CDevice		*pDevice;
+		CFATFileSystem	*pFileSystem;
+		unsigned	 hFile;
+		boolean		 bError;
+		unsigned	 nInBuffer;
+		u8		 Buffer[GCOV_DUMP_BUF_SIZE];
+	};
+
+	static boolean Dump (TSink *pSink);
+	static void Flush (TSink *pSink);
+
+	static void FilenameHandler (const char *pFilename, void *pArg);
+	static void DumpHandler (const void *pData, unsigned nLength, void *pArg);
+	static void *AllocateHandler (unsigned nLength, void *pArg);
+};
+
+#endif
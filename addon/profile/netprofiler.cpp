@@ -0,0 +1,251 @@
+//
+// netprofiler.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <profile/netprofiler.h>
+#include <circle/sched/scheduler.h>
+#include <circle/exceptionstub.h>
+#include <circle/machineinfo.h>
+#include <circle/multicore.h>
+#include <circle/synchronize.h>
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define SAMPLE_CORE_SHIFT	30
+#define SAMPLE_OFFSET_MASK	((1U << SAMPLE_CORE_SHIFT)-1)
+
+static const char From[] = "netprof";
+
+CNetProfiler::CNetProfiler (CNetSubSystem *pNetSubSystem,
+			    const CIPAddress &CollectorIP, u16 usCollectorPort, int nProtocol,
+			    u32 nSamplePeriod, unsigned nSendIntervalMs,
+			    uintptr nTextStart, uintptr nTextEnd)
+:	m_pNetSubSystem (pNetSubSystem),
+	m_CollectorIP (CollectorIP),
+	m_usCollectorPort (usCollectorPort),
+	m_nProtocol (nProtocol),
+	m_nSamplePeriod (nSamplePeriod),
+	m_nSendIntervalMs (nSendIntervalMs),
+	m_nTextStart (nTextStart & ~3),
+	m_nTextEnd (nTextEnd),
+	m_pSocket (0),
+	m_nSequence (0),
+	m_nDropped (0)
+{
+	assert (m_pNetSubSystem != 0);
+	assert (m_nProtocol == IPPROTO_UDP || m_nProtocol == IPPROTO_TCP);
+	assert (m_nSamplePeriod > 0);
+	assert (m_nSendIntervalMs > 0);
+	assert (m_nTextStart < m_nTextEnd);
+	assert (((m_nTextEnd - m_nTextStart) >> 2) <= SAMPLE_OFFSET_MASK);
+
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		m_CoreData[nCore].pCounters = 0;
+		m_CoreData[nCore].nSamples = 0;
+		m_CoreData[nCore].nIn = 0;
+		m_CoreData[nCore].nOut = 0;
+	}
+
+	SetName (From);
+}
+
+CNetProfiler::~CNetProfiler (void)
+{
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		assert (m_CoreData[nCore].pCounters == 0);
+	}
+
+	delete m_pSocket;
+	m_pSocket = 0;
+
+	m_pNetSubSystem = 0;
+}
+
+boolean CNetProfiler::Start (void)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+#else
+	unsigned nCore = 0;
+#endif
+	TCoreData *pData = &m_CoreData[nCore];
+	assert (pData->pCounters == 0);
+
+	pData->pCounters = new CPerfCounters;
+	assert (pData->pCounters != 0);
+
+	if (!pData->pCounters->ConnectOverflowHandler (m_nSamplePeriod, OverflowHandler, this))
+	{
+		delete pData->pCounters;
+		pData->pCounters = 0;
+
+		CLogger::Get ()->Write (From, LogError, "PMU sampling not supported on core %u",
+					nCore);
+
+		return FALSE;
+	}
+
+	pData->pCounters->Start ();
+
+	return TRUE;
+}
+
+void CNetProfiler::Stop (void)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+#else
+	unsigned nCore = 0;
+#endif
+	TCoreData *pData = &m_CoreData[nCore];
+
+	if (pData->pCounters != 0)
+	{
+		pData->pCounters->Stop ();
+
+		delete pData->pCounters;
+		pData->pCounters = 0;
+	}
+}
+
+unsigned CNetProfiler::GetSamples (unsigned nCore) const
+{
+	assert (nCore < CORES);
+	return m_CoreData[nCore].nSamples;
+}
+
+unsigned CNetProfiler::GetDropped (void) const
+{
+	return __atomic_load_n (&m_nDropped, __ATOMIC_RELAXED);
+}
+
+void CNetProfiler::Run (void)
+{
+	assert (m_pSocket == 0);
+	m_pSocket = new CSocket (m_pNetSubSystem, m_nProtocol);
+	assert (m_pSocket != 0);
+
+	if (m_pSocket->Connect (m_CollectorIP, m_usCollectorPort) < 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot connect to collector");
+
+		return;
+	}
+
+	CScheduler *pScheduler = CScheduler::Get ();
+	assert (pScheduler != 0);
+
+	u32 Batch[NET_PROFILER_BATCH_SIZE];
+	while (1)
+	{
+		pScheduler->MsSleep (m_nSendIntervalMs);
+
+		for (unsigned nCore = 0; nCore < CORES; nCore++)
+		{
+			TCoreData *pData = &m_CoreData[nCore];
+
+			unsigned nIn = pData->nIn;
+			DataMemBarrier ();
+
+			while (pData->nOut != nIn)
+			{
+				unsigned nSamples = 0;
+				while (   pData->nOut != nIn
+				       && nSamples < NET_PROFILER_BATCH_SIZE)
+				{
+					Batch[nSamples++] =
+						pData->Ring[pData->nOut & (NET_PROFILER_RING_SIZE-1)];
+
+					pData->nOut++;
+				}
+
+				DataMemBarrier ();
+
+				if (!SendBatch (Batch, nSamples))
+				{
+					CLogger::Get ()->Write (From, LogWarning,
+								"Cannot send batch %u", m_nSequence);
+				}
+			}
+		}
+	}
+}
+
+boolean CNetProfiler::SendBatch (const u32 *pSamples, unsigned nSamples)
+{
+	assert (pSamples != 0);
+	assert (0 < nSamples && nSamples <= NET_PROFILER_BATCH_SIZE);
+
+	u8 Buffer[sizeof (TNetProfilerHeader) + NET_PROFILER_BATCH_SIZE * sizeof (u32)];
+
+	TNetProfilerHeader *pHeader = (TNetProfilerHeader *) Buffer;
+	memcpy (pHeader->Magic, NET_PROFILER_MAGIC, sizeof pHeader->Magic);
+	pHeader->nVersion = NET_PROFILER_VERSION;
+	pHeader->nSamples = (u16) nSamples;
+	pHeader->nSequence = m_nSequence++;
+	pHeader->nDropped = GetDropped ();
+	pHeader->nSamplePeriod = m_nSamplePeriod;
+	pHeader->nClockRate = CMachineInfo::Get ()->GetClockRate (CLOCK_ID_ARM);
+	pHeader->nTextStart = m_nTextStart;
+
+	unsigned nLength = sizeof (TNetProfilerHeader) + nSamples * sizeof (u32);
+	memcpy (Buffer + sizeof (TNetProfilerHeader), pSamples, nSamples * sizeof (u32));
+
+	assert (m_pSocket != 0);
+	return m_pSocket->Send (Buffer, nLength, 0) == (int) nLength;
+}
+
+void CNetProfiler::OverflowHandler (void *pParam)
+{
+	CNetProfiler *pThis = (CNetProfiler *) pParam;
+	assert (pThis != 0);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+#else
+	unsigned nCore = 0;
+#endif
+	TCoreData *pData = &pThis->m_CoreData[nCore];
+
+	pData->nSamples++;
+
+	uintptr nPC = IRQReturnAddressOfCore[nCore];
+	if (   nPC < pThis->m_nTextStart
+	    || nPC >= pThis->m_nTextEnd)
+	{
+		return;
+	}
+
+	unsigned nIn = pData->nIn;
+	if (nIn - pData->nOut >= NET_PROFILER_RING_SIZE)
+	{
+		__atomic_fetch_add (&pThis->m_nDropped, 1, __ATOMIC_RELAXED);
+
+		return;
+	}
+
+	pData->Ring[nIn & (NET_PROFILER_RING_SIZE-1)] =
+		nCore << SAMPLE_CORE_SHIFT | (u32) ((nPC - pThis->m_nTextStart) >> 2);
+
+	DataMemBarrier ();
+
+	pData->nIn = nIn + 1;
+}
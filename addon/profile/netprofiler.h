@@ -0,0 +1,132 @@
+//
+// netprofiler.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _profile_netprofiler_h
+#define _profile_netprofiler_h
+
+#include <circle/sched/task.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/net/ipaddress.h>
+#include <circle/net/socket.h>
+#include <circle/net/in.h>
+#include <circle/perfcounters.h>
+#include <circle/macros.h>
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+
+extern u8 _start, _etext;
+
+#define NET_PROFILER_PORT	5620
+
+/// \note This profiler samples the program counter on each PMU cycle counter overflow\n
+///	  like CPMUProfiler, but does not need a file system. The samples are collected\n
+///	  in a ring buffer per core and are continuously sent to a host collector in\n
+///	  batches (see tools/profcollector.py), which can convert them to the folded\n
+///	  stack format used by flame graph tools.
+/// \note A batch consists of a header (struct TNetProfilerHeader) and nSamples u32\n
+///	  words (little endian). Each word contains the core number in bits 31-30 and\n
+///	  (PC - nTextStart) >> 2 in bits 29-0. With UDP each batch is sent as one\n
+///	  datagram, with TCP the batches are sent back to back.
+/// \note If the ring buffer of a core overflows, the samples are dropped and counted.
+
+struct TNetProfilerHeader
+{
+	char	Magic[4];		// "CPRF"
+#define NET_PROFILER_MAGIC	"CPRF"
+	u16	nVersion;
+#define NET_PROFILER_VERSION	1
+	u16	nSamples;		// following this header
+	u32	nSequence;		// batch number
+	u32	nDropped;		// total number of dropped samples
+	u32	nSamplePeriod;		// in CPU cycles
+	u32	nClockRate;		// of the CPU in Hz
+	u64	nTextStart;		// address of PC offset 0
+}
+PACKED;
+
+class CNetProfiler : public CTask	/// A sampling profiler, which streams over the network
+{
+public:
+	/// \param pNetSubSystem Pointer to the network subsystem
+	/// \param CollectorIP IP address of the host, which runs the collector
+	/// \param usCollectorPort Port number of the collector
+	/// \param nProtocol IPPROTO_UDP or IPPROTO_TCP
+	/// \param nSamplePeriod Sample period in CPU cycles
+	/// \param nSendIntervalMs Interval for sending batches in milliseconds
+	/// \param nTextStart Start address of the code to be profiled
+	/// \param nTextEnd End address of the code to be profiled
+	CNetProfiler (CNetSubSystem *pNetSubSystem,
+		      const CIPAddress &CollectorIP, u16 usCollectorPort = NET_PROFILER_PORT,
+		      int nProtocol = IPPROTO_UDP,
+		      u32 nSamplePeriod = 100000, unsigned nSendIntervalMs = 500,
+		      uintptr nTextStart = (uintptr) &_start,
+		      uintptr nTextEnd = (uintptr) &_etext);
+
+	~CNetProfiler (void);
+
+	/// \brief Start sampling on this core
+	/// \return Operation successful?
+	/// \note Must be called on each core, which should be profiled.
+	boolean Start (void);
+
+	/// \brief Stop sampling on this core
+	/// \note Remaining samples will be sent with the next batch.
+	void Stop (void);
+
+	/// \param nCore Core number
+	/// \return Number of samples taken on this core
+	unsigned GetSamples (unsigned nCore) const;
+	/// \return Total number of samples, which have been dropped
+	unsigned GetDropped (void) const;
+
+	void Run (void);
+
+private:
+	boolean SendBatch (const u32 *pSamples, unsigned nSamples);
+
+	static void OverflowHandler (void *pParam);
+
+private:
+	CNetSubSystem *m_pNetSubSystem;
+	CIPAddress m_CollectorIP;
+	u16 m_usCollectorPort;
+	int m_nProtocol;
+	u32 m_nSamplePeriod;
+	unsigned m_nSendIntervalMs;
+	uintptr m_nTextStart;
+	uintptr m_nTextEnd;
+
+	CSocket *m_pSocket;
+	u32 m_nSequence;
+	unsigned m_nDropped;
+
+#define NET_PROFILER_RING_SIZE	4096		// samples per core, must be a power of 2
+#define NET_PROFILER_BATCH_SIZE	256		// samples per batch
+	struct TCoreData
+	{
+		CPerfCounters	*pCounters;
+		unsigned	 nSamples;
+		volatile unsigned nIn;			// written from IRQ context only
+		volatile unsigned nOut;			// written from Run() only
+		u32		 Ring[NET_PROFILER_RING_SIZE];
+	}
+	m_CoreData[CORES];
+};
+
+#endif
@@ -0,0 +1,283 @@
+//
+// pmuprofiler.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <profile/pmuprofiler.h>
+#include <profile/glibc_compat.h>
+#include <profile/gmon_out.h>
+#include <circle/devicenameservice.h>
+#include <circle/exceptionstub.h>
+#include <circle/machineinfo.h>
+#include <circle/multicore.h>
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define BIN_SHIFT	2		// one histogram bin per instruction
+
+static const char From[] = "pmuprof";
+
+CPMUProfiler::CPMUProfiler (u32 nSamplePeriod, uintptr nTextStart, uintptr nTextEnd)
+:	m_nSamplePeriod (nSamplePeriod),
+	m_nTextStart (nTextStart & ~((1 << BIN_SHIFT)-1)),
+	m_nTextEnd (nTextEnd),
+	m_nBins ((m_nTextEnd - m_nTextStart + (1 << BIN_SHIFT)-1) >> BIN_SHIFT)
+{
+	assert (m_nSamplePeriod > 0);
+	assert (m_nTextStart < m_nTextEnd);
+
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		m_CoreData[nCore].pCounters = 0;
+		m_CoreData[nCore].pHistogram = 0;
+		m_CoreData[nCore].nSamples = 0;
+	}
+}
+
+CPMUProfiler::~CPMUProfiler (void)
+{
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		assert (m_CoreData[nCore].pCounters == 0);
+
+		delete [] m_CoreData[nCore].pHistogram;
+		m_CoreData[nCore].pHistogram = 0;
+	}
+}
+
+boolean CPMUProfiler::Start (void)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+#else
+	unsigned nCore = 0;
+#endif
+	TCoreData *pData = &m_CoreData[nCore];
+	assert (pData->pCounters == 0);
+
+	if (pData->pHistogram == 0)
+	{
+		pData->pHistogram = new u16[m_nBins];
+		if (pData->pHistogram == 0)
+		{
+			CLogger::Get ()->Write (From, LogError, "Not enough memory");
+
+			return FALSE;
+		}
+
+		memset (pData->pHistogram, 0, m_nBins * sizeof (u16));
+	}
+
+	pData->pCounters = new CPerfCounters;
+	assert (pData->pCounters != 0);
+
+	if (!pData->pCounters->ConnectOverflowHandler (m_nSamplePeriod, OverflowHandler, this))
+	{
+		delete pData->pCounters;
+		pData->pCounters = 0;
+
+		CLogger::Get ()->Write (From, LogError, "PMU sampling not supported on core %u",
+					nCore);
+
+		return FALSE;
+	}
+
+	pData->pCounters->Start ();
+
+	return TRUE;
+}
+
+void CPMUProfiler::Stop (void)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+#else
+	unsigned nCore = 0;
+#endif
+	TCoreData *pData = &m_CoreData[nCore];
+
+	if (pData->pCounters != 0)
+	{
+		pData->pCounters->Stop ();
+
+		delete pData->pCounters;
+		pData->pCounters = 0;
+	}
+}
+
+unsigned CPMUProfiler::GetSamples (unsigned nCore) const
+{
+	assert (nCore < CORES);
+	return m_CoreData[nCore].nSamples;
+}
+
+void CPMUProfiler::SaveResults (const char *pPartitionName)
+{
+	CDevice *pPartition = CDeviceNameService::Get ()->GetDevice (pPartitionName, TRUE);
+	if (pPartition == 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Partition not found: %s", pPartitionName);
+
+		return;
+	}
+
+	CFATFileSystem FileSystem;
+	if (!FileSystem.Mount (pPartition))
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot mount partition: %s", pPartitionName);
+
+		return;
+	}
+
+	SaveResults (&FileSystem);
+
+	FileSystem.UnMount ();
+}
+
+void CPMUProfiler::SaveResults (CFATFileSystem *pFileSystem)
+{
+	__set_nocancel_filesystem (pFileSystem);
+
+	WriteResults ();
+}
+
+void CPMUProfiler::SaveResults (FATFS *pFileSystem, const char *pDriveName)
+{
+	__set_nocancel_filesystem (pFileSystem, pDriveName);
+
+	WriteResults ();
+}
+
+void CPMUProfiler::WriteResults (void)
+{
+	// merge the histograms of all cores into the first one available
+	u16 *pHistogram = 0;
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		TCoreData *pData = &m_CoreData[nCore];
+		assert (pData->pCounters == 0);
+
+		if (pData->pHistogram == 0)
+		{
+			continue;
+		}
+
+		if (pHistogram == 0)
+		{
+			pHistogram = pData->pHistogram;
+
+			continue;
+		}
+
+		for (unsigned i = 0; i < m_nBins; i++)
+		{
+			unsigned nSum = pHistogram[i] + pData->pHistogram[i];
+			pHistogram[i] = nSum < 0xFFFF ? nSum : 0xFFFF;
+		}
+
+		delete [] pData->pHistogram;
+		pData->pHistogram = 0;
+	}
+
+	if (pHistogram == 0)
+	{
+		CLogger::Get ()->Write (From, LogWarning, "No samples taken");
+
+		return;
+	}
+
+	int fd = __open_nocancel ("gmon.out", O_CREAT | O_TRUNC | O_WRONLY, 0666);
+	if (fd < 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot create gmon.out");
+
+		return;
+	}
+
+	struct
+	{
+		char cookie[4];
+		s32 version;
+		char spare[3 * 4];
+	}
+	Header;
+
+	memcpy (Header.cookie, GMON_MAGIC, sizeof Header.cookie);
+	Header.version = GMON_VERSION;
+	memset (Header.spare, 0, sizeof Header.spare);
+	__write_nocancel (fd, &Header, sizeof (struct gmon_hdr));
+
+	u8 uchTag = GMON_TAG_TIME_HIST;
+	__write_nocancel (fd, &uchTag, sizeof uchTag);
+
+	struct
+	{
+		uintptr low_pc;
+		uintptr high_pc;
+		s32 hist_size;
+		s32 prof_rate;
+		char dimen[15];
+		char dimen_abbrev;
+	}
+	HistHeader;
+
+	unsigned nClockRate = CMachineInfo::Get ()->GetClockRate (CLOCK_ID_ARM);
+
+	HistHeader.low_pc = m_nTextStart;
+	HistHeader.high_pc = m_nTextStart + (m_nBins << BIN_SHIFT);
+	HistHeader.hist_size = m_nBins;
+	HistHeader.prof_rate = (nClockRate + m_nSamplePeriod/2) / m_nSamplePeriod;
+	strncpy (HistHeader.dimen, "seconds", sizeof HistHeader.dimen);
+	HistHeader.dimen_abbrev = 's';
+	__write_nocancel (fd, &HistHeader, sizeof (struct gmon_hist_hdr));
+
+	__write_nocancel (fd, pHistogram, m_nBins * sizeof (u16));
+
+	__close_nocancel_nostatus (fd);
+
+	CLogger::Get ()->Write (From, LogDebug, "Profiling results saved");
+}
+
+void CPMUProfiler::OverflowHandler (void *pParam)
+{
+	CPMUProfiler *pThis = (CPMUProfiler *) pParam;
+	assert (pThis != 0);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+#else
+	unsigned nCore = 0;
+#endif
+	TCoreData *pData = &pThis->m_CoreData[nCore];
+	assert (pData->pHistogram != 0);
+
+	pData->nSamples++;
+
+	uintptr nPC = IRQReturnAddressOfCore[nCore];
+	if (nPC < pThis->m_nTextStart)
+	{
+		return;
+	}
+
+	unsigned nBin = (nPC - pThis->m_nTextStart) >> BIN_SHIFT;
+	if (   nBin < pThis->m_nBins
+	    && pData->pHistogram[nBin] < 0xFFFF)
+	{
+		pData->pHistogram[nBin]++;
+	}
+}
@@ -0,0 +1,99 @@
+//
+// pmuprofiler.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _profile_pmuprofiler_h
+#define _profile_pmuprofiler_h
+
+#include <circle/perfcounters.h>
+#include <circle/fs/fat/fatfs.h>
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+extern u8 _start, _etext;
+
+/// \note This profiler samples the program counter on each PMU cycle counter overflow\n
+///	  into a histogram per core. It does not need the -pg compiler option and its\n
+///	  overhead is defined by the sample period only. The results are written to a\n
+///	  gmon.out file, which can be evaluated with "gprof -b -p" (flat profile).
+/// \note Code, which runs with IRQs disabled (e.g. IRQ handlers), is accounted to the\n
+///	  location, where IRQs are enabled again.
+/// \note Multi-core programs are supported on the Raspberry Pi 4 only.
+
+class CPMUProfiler		/// A sampling profiler using the ARM PMU
+{
+public:
+	/// \param nSamplePeriod Sample period in CPU cycles
+	/// \param nTextStart Start address of the code to be profiled
+	/// \param nTextEnd End address of the code to be profiled
+	CPMUProfiler (u32 nSamplePeriod = 100000,
+		      uintptr nTextStart = (uintptr) &_start,
+		      uintptr nTextEnd = (uintptr) &_etext);
+
+	~CPMUProfiler (void);
+
+	/// \brief Start sampling on this core
+	/// \return Operation successful?
+	/// \note Must be called on each core, which should be profiled.
+	boolean Start (void);
+
+	/// \brief Stop sampling on this core
+	void Stop (void);
+
+	/// \param nCore Core number
+	/// \return Number of samples taken on this core
+	unsigned GetSamples (unsigned nCore) const;
+
+	/// \brief Save the results of all cores to the file "GMON.OUT"
+	/// \param pPartitionName Name of the partition to be used (default: SD card)
+	/// \note Sampling must have been stopped on all cores before.
+	void SaveResults (const char *pPartitionName = "emmc1-1");
+
+	/// \brief Save the results of all cores to the file "GMON.OUT"
+	/// \param pFileSystem Pointer to the file system object to be used
+	/// \note The file system must already be mounted before.
+	void SaveResults (CFATFileSystem *pFileSystem);
+
+	/// \brief Save the results of all cores to the file "gmon.out"
+	/// \param pFileSystem Pointer to the FatFs file system struct to be used
+	/// \param pDriveName Name of the drive to be used (default: SD card)
+	/// \note The file system must already be mounted before.
+	void SaveResults (FATFS *pFileSystem, const char *pDriveName = "SD:");
+
+private:
+	void WriteResults (void);
+
+	static void OverflowHandler (void *pParam);
+
+private:
+	u32 m_nSamplePeriod;
+	uintptr m_nTextStart;
+	uintptr m_nTextEnd;
+	unsigned m_nBins;
+
+	struct TCoreData
+	{
+		CPerfCounters	*pCounters;
+		u16		*pHistogram;
+		unsigned	 nSamples;
+	}
+	m_CoreData[CORES];
+};
+
+#endif
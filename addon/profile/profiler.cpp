@@ -22,15 +22,16 @@
 #include <circle/devicenameservice.h>
 #include <circle/sysconfig.h>
 #include <circle/logger.h>
-
-#ifdef ARM_ALLOW_MULTI_CORE
-	#error Multi-core programs are not supported by this profile library!
-#endif
+#include <assert.h>
 
 static const char From[] = "prof";
 
 CProfiler::CProfiler (uintptr nTextStart, uintptr nTextEnd)
 {
+#ifdef ARM_ALLOW_MULTI_CORE
+	assert (0);		// not supported with multi-core, use CPMUProfiler instead
+#endif
+
 	__monstartup (nTextStart, nTextEnd);
 }
 
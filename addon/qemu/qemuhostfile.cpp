@@ -2,7 +2,7 @@
 // qemuhostfile.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,22 +19,45 @@
 //
 #include <qemu/qemuhostfile.h>
 #include <circle/util.h>
+#include <assert.h>
 
-CQEMUHostFile::CQEMUHostFile (const char *pFileName, boolean bWrite)
+CQEMUHostFile::CQEMUHostFile (const char *pFileName, boolean bWrite, size_t nBufferSize)
+:	m_bWrite (bWrite),
+	m_pBuffer (0),
+	m_nBufferSize (0),
+	m_nBufferValid (0),
+	m_nBufferOffset (0)
 {
+	assert (pFileName != 0);
 	m_nHandle = CallSemihosting (SEMIHOSTING_SYS_OPEN, (uintptr) pFileName,
 				     bWrite ? SEMIHOSTING_OPEN_WRITE : SEMIHOSTING_OPEN_READ,
 				     strlen (pFileName));
+
+	if (   m_nHandle != SEMIHOSTING_NO_HANDLE
+	    && nBufferSize != 0
+	    && strcmp (pFileName, SEMIHOSTING_STDIO_NAME) != 0)
+	{
+		m_pBuffer = new u8[nBufferSize];
+		if (m_pBuffer != 0)
+		{
+			m_nBufferSize = nBufferSize;
+		}
+	}
 }
 
 CQEMUHostFile::~CQEMUHostFile (void)
 {
 	if (m_nHandle != SEMIHOSTING_NO_HANDLE)
 	{
+		Flush ();
+
 		CallSemihosting (SEMIHOSTING_SYS_CLOSE, m_nHandle);
 
 		m_nHandle = SEMIHOSTING_NO_HANDLE;
 	}
+
+	delete [] m_pBuffer;
+	m_pBuffer = 0;
 }
 
 boolean CQEMUHostFile::IsOpen (void) const
@@ -43,6 +66,165 @@ boolean CQEMUHostFile::IsOpen (void) const
 }
 
 int CQEMUHostFile::Read (void *pBuffer, size_t nCount)
+{
+	if (m_pBuffer == 0)
+	{
+		return ReadDirect (pBuffer, nCount);
+	}
+
+	u8 *pTarget = (u8 *) pBuffer;
+	size_t nResult = 0;
+
+	while (nCount > 0)
+	{
+		if (m_nBufferOffset < m_nBufferValid)
+		{
+			size_t nChunk = m_nBufferValid - m_nBufferOffset;
+			if (nChunk > nCount)
+			{
+				nChunk = nCount;
+			}
+
+			memcpy (pTarget, m_pBuffer + m_nBufferOffset, nChunk);
+
+			m_nBufferOffset += nChunk;
+			pTarget += nChunk;
+			nResult += nChunk;
+			nCount -= nChunk;
+
+			continue;
+		}
+
+		// large requests are read directly into the caller's buffer
+		if (nCount >= m_nBufferSize)
+		{
+			int nRead = ReadDirect (pTarget, nCount);
+			if (nRead < 0)
+			{
+				return nResult > 0 ? (int) nResult : nRead;
+			}
+
+			nResult += nRead;
+
+			break;
+		}
+
+		int nRead = ReadDirect (m_pBuffer, m_nBufferSize);
+		m_nBufferOffset = 0;
+		if (nRead <= 0)
+		{
+			m_nBufferValid = 0;
+
+			if (nRead < 0 && nResult == 0)
+			{
+				return nRead;
+			}
+
+			break;			// EOF
+		}
+
+		m_nBufferValid = nRead;
+	}
+
+	return (int) nResult;
+}
+
+int CQEMUHostFile::Write (const void *pBuffer, size_t nCount)
+{
+	if (m_pBuffer == 0)
+	{
+		return WriteDirect (pBuffer, nCount);
+	}
+
+	if (m_nBufferValid + nCount > m_nBufferSize)
+	{
+		if (!Flush ())
+		{
+			return -1;
+		}
+
+		// large requests are written directly from the caller's buffer
+		if (nCount >= m_nBufferSize)
+		{
+			return WriteDirect (pBuffer, nCount);
+		}
+	}
+
+	memcpy (m_pBuffer + m_nBufferValid, pBuffer, nCount);
+	m_nBufferValid += nCount;
+
+	return (int) nCount;
+}
+
+boolean CQEMUHostFile::Flush (void)
+{
+	if (   m_pBuffer == 0
+	    || !m_bWrite
+	    || m_nBufferValid == 0)
+	{
+		return TRUE;
+	}
+
+	int nResult = WriteDirect (m_pBuffer, m_nBufferValid);
+	m_nBufferValid = 0;
+
+	return nResult >= 0;
+}
+
+u64 CQEMUHostFile::GetSize (void) const
+{
+	if (m_nHandle == SEMIHOSTING_NO_HANDLE)
+	{
+		return (u64) -1;
+	}
+
+	long nSize = (long) CallSemihosting (SEMIHOSTING_SYS_FLEN, m_nHandle);
+	if (nSize < 0)
+	{
+		return (u64) -1;
+	}
+
+	return nSize;
+}
+
+u8 *CQEMUHostFile::LoadFile (const char *pFileName, size_t *pSize)
+{
+	assert (pFileName != 0);
+	TSemihostingValue nHandle = CallSemihosting (SEMIHOSTING_SYS_OPEN, (uintptr) pFileName,
+						     SEMIHOSTING_OPEN_READ_BIN, strlen (pFileName));
+	if (nHandle == SEMIHOSTING_NO_HANDLE)
+	{
+		return 0;
+	}
+
+	u8 *pData = 0;
+
+	long nSize = (long) CallSemihosting (SEMIHOSTING_SYS_FLEN, nHandle);
+	if (nSize >= 0)
+	{
+		pData = new u8[nSize > 0 ? nSize : 1];
+		if (   pData != 0
+		    && nSize > 0
+		    && CallSemihosting (SEMIHOSTING_SYS_READ, nHandle,
+					(uintptr) pData, nSize) != 0)
+		{
+			delete [] pData;
+			pData = 0;
+		}
+	}
+
+	CallSemihosting (SEMIHOSTING_SYS_CLOSE, nHandle);
+
+	if (pData != 0)
+	{
+		assert (pSize != 0);
+		*pSize = (size_t) nSize;
+	}
+
+	return pData;
+}
+
+int CQEMUHostFile::ReadDirect (void *pBuffer, size_t nCount)
 {
 	int nResult = -1;
 
@@ -57,7 +239,7 @@ int CQEMUHostFile::Read (void *pBuffer, size_t nCount)
 	return nResult;
 }
 
-int CQEMUHostFile::Write (const void *pBuffer, size_t nCount)
+int CQEMUHostFile::WriteDirect (const void *pBuffer, size_t nCount)
 {
 	int nResult = -1;
 
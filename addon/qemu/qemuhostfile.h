@@ -2,7 +2,7 @@
 // qemuhostfile.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,14 +24,22 @@
 #include <circle/qemu.h>
 #include <circle/types.h>
 
+#define QEMU_HOST_FILE_BUF_SIZE		0x10000		// default size of the file buffer
+
 /// \note This class requires QEMU started with the -semihosting option to work!
+/// \note Each semihosting call traps out of the emulated CPU. Therefore files (other than the
+///	  console) are accessed in large blocks through a buffer with readahead on read and
+///	  write-back on write.
 
 class CQEMUHostFile : public CDevice	/// Accesses a file using the QEMU semihosting interface
 {
 public:
 	/// \param pFileName File on QEMU host to be opened (default: stdout)
 	/// \param bWrite    TRUE if file is written (default), FALSE if file is read
-	CQEMUHostFile (const char *pFileName = SEMIHOSTING_STDIO_NAME, boolean bWrite = TRUE);
+	/// \param nBufferSize Size of the file buffer (0 for unbuffered access)
+	/// \note The console (SEMIHOSTING_STDIO_NAME) is always accessed unbuffered.
+	CQEMUHostFile (const char *pFileName = SEMIHOSTING_STDIO_NAME, boolean bWrite = TRUE,
+		       size_t nBufferSize = QEMU_HOST_FILE_BUF_SIZE);
 
 	~CQEMUHostFile (void);
 
@@ -48,8 +56,31 @@ public:
 	/// \return Number of bytes successfully written (< 0 on error)
 	int Write (const void *pBuffer, size_t nCount);
 
+	/// \brief Write the buffered data to the host file
+	/// \return Operation successful?
+	boolean Flush (void);
+
+	/// \return Size of the file in bytes ((u64) -1 on error)
+	u64 GetSize (void) const;
+
+	/// \brief Load a whole host file into memory with one semihosting read call
+	/// \param pFileName File on QEMU host to be loaded
+	/// \param pSize Size of the file is returned here
+	/// \return Pointer to the file contents (0 on error), free it with delete [] afterwards
+	static u8 *LoadFile (const char *pFileName, size_t *pSize);
+
+private:
+	int ReadDirect (void *pBuffer, size_t nCount);
+	int WriteDirect (const void *pBuffer, size_t nCount);
+
 private:
 	TSemihostingValue m_nHandle;
+	boolean m_bWrite;
+
+	u8 *m_pBuffer;		// 0 if unbuffered
+	size_t m_nBufferSize;
+	size_t m_nBufferValid;	// number of bytes in buffer (read: read ahead, write: not flushed)
+	size_t m_nBufferOffset;	// read position in buffer
 };
 
 #endif
@@ -2,7 +2,7 @@
 // bmp180.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -59,7 +59,9 @@ CBMP180::CBMP180 (CI2CMaster *pI2CMaster, unsigned nI2CClockHz, u8 ucSlaveAddres
 	m_nI2CClockHz (nI2CClockHz),
 	m_ucSlaveAddress (ucSlaveAddress),
 	m_nTemperature (0),
-	m_nPressure (0)
+	m_nPressure (0),
+	m_B5 (0),
+	m_State (StateIdle)
 {
 }
 
@@ -121,29 +123,119 @@ boolean CBMP180::DoMeasurement (void)
 
 	// Measure temperature
 
-	s32 UT = DoMeasurement (MEASURE_TEMP, 5);
+	if (!StartConversion (MEASURE_TEMP, 5))
+	{
+		return FALSE;
+	}
+
+	CTimer::Get ()->usDelay (m_nDurationUs);
+
+	s32 UT = ReadConversion ();
 	if (UT == BMP180_I2C_ERROR)
 	{
 		return FALSE;
 	}
 
-	s32 X1 = ((UT - m_AC6) * m_AC5) >> 15;
-	s32 X2 = (m_MC << 11) / (X1 + m_MD);
-	s32 B5 = X1 + X2;
-	m_nTemperature = (B5 + 8) >> 4;
+	CalculateTemperature (UT);
 
 	// Measure pressure
 
-	s32 UP = DoMeasurement (MEASURE_PRES | (OVERSAMPLE << 6), 26, OVERSAMPLE);
+	if (!StartConversion (MEASURE_PRES | (OVERSAMPLE << 6), 26))
+	{
+		return FALSE;
+	}
+
+	CTimer::Get ()->usDelay (m_nDurationUs);
+
+	s32 UP = ReadConversion (OVERSAMPLE);
 	if (UP == BMP180_I2C_ERROR)
 	{
 		return FALSE;
 	}
 
-	s32 B6 = B5 - 4000;
+	CalculatePressure (UP);
+
+	return TRUE;
+}
+
+boolean CBMP180::StartMeasurement (void)
+{
+	assert (m_pI2CMaster != 0);
+	m_pI2CMaster->SetClock (m_nI2CClockHz);
+
+	if (!StartConversion (MEASURE_TEMP, 5))
+	{
+		m_State = StateIdle;
+
+		return FALSE;
+	}
+
+	m_State = StateTemperature;
+
+	return TRUE;
+}
+
+TBMP180Status CBMP180::UpdateMeasurement (void)
+{
+	if (m_State == StateIdle)
+	{
+		return BMP180StatusError;
+	}
+
+	if (CTimer::Get ()->GetClockTicks () - m_nStartTicks < m_nDurationUs)
+	{
+		return BMP180StatusBusy;
+	}
+
+	assert (m_pI2CMaster != 0);
+	m_pI2CMaster->SetClock (m_nI2CClockHz);
+
+	if (m_State == StateTemperature)
+	{
+		s32 UT = ReadConversion ();
+		if (   UT == BMP180_I2C_ERROR
+		    || !StartConversion (MEASURE_PRES | (OVERSAMPLE << 6), 26))
+		{
+			m_State = StateIdle;
+
+			return BMP180StatusError;
+		}
+
+		CalculateTemperature (UT);
+
+		m_State = StatePressure;
+
+		return BMP180StatusBusy;
+	}
+
+	assert (m_State == StatePressure);
+	m_State = StateIdle;
+
+	s32 UP = ReadConversion (OVERSAMPLE);
+	if (UP == BMP180_I2C_ERROR)
+	{
+		return BMP180StatusError;
+	}
+
+	CalculatePressure (UP);
+
+	return BMP180StatusDone;
+}
+
+void CBMP180::CalculateTemperature (s32 UT)
+{
+	s32 X1 = ((UT - m_AC6) * m_AC5) >> 15;
+	s32 X2 = (m_MC << 11) / (X1 + m_MD);
+	m_B5 = X1 + X2;
+	m_nTemperature = (m_B5 + 8) >> 4;
+}
+
+void CBMP180::CalculatePressure (s32 UP)
+{
+	s32 B6 = m_B5 - 4000;
 	s32 B62 = B6 * B6 >> 12;
-	X1 = (m_B2 * B62) >> 11;
-	X2 = m_AC2 * B6 >> 11;
+	s32 X1 = (m_B2 * B62) >> 11;
+	s32 X2 = m_AC2 * B6 >> 11;
 	s32 X3 = X1 + X2;
 	s32 B3 = (((m_AC1 * 4 + X3) << OVERSAMPLE) + 2) >> 2;
 	X1 = m_AC3 * B6 >> 13;
@@ -166,8 +258,6 @@ boolean CBMP180::DoMeasurement (void)
 	X1 = (X1 * 3038) >> 16;
 	X2 = (-7357 * P) >> 16;
 	m_nPressure = P + ((X1 + X2 + 3791) >> 4);
-
-	return TRUE;
 }
 
 int CBMP180::GetTemperature (void)
@@ -180,7 +270,7 @@ int CBMP180::GetPressure (void)
 	return m_nPressure;
 }
 
-s32 CBMP180::DoMeasurement (u8 ucCmd, unsigned nDurationMs, unsigned nOversample)
+boolean CBMP180::StartConversion (u8 ucCmd, unsigned nDurationMs)
 {
 	assert (m_pI2CMaster != 0);
 
@@ -191,11 +281,17 @@ s32 CBMP180::DoMeasurement (u8 ucCmd, unsigned nDurationMs, unsigned nOversample
 		CLogger::Get ()->Write (FromBMP180, LogWarning,
 					"I2C write failed (err %d)", nResult);
 
-		return BMP180_I2C_ERROR;
+		return FALSE;
 	}
 
-	CTimer::Get ()->MsDelay (nDurationMs);
+	m_nStartTicks = CTimer::Get ()->GetClockTicks ();
+	m_nDurationUs = nDurationMs * 1000;
 
+	return TRUE;
+}
+
+s32 CBMP180::ReadConversion (unsigned nOversample)
+{
 	u8 ResultBuffer[3];
 	if (!WriteRead (RESULT, ResultBuffer, sizeof ResultBuffer))
 	{
@@ -4,7 +4,7 @@
 // Driver for the BMP180 digital pressure sensor with I2C interface
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -25,6 +25,13 @@
 #include <circle/i2cmaster.h>
 #include <circle/types.h>
 
+enum TBMP180Status
+{
+	BMP180StatusBusy,
+	BMP180StatusDone,
+	BMP180StatusError
+};
+
 class CBMP180
 {
 public:
@@ -33,15 +40,24 @@ public:
 
 	boolean Initialize (void);
 
-	boolean DoMeasurement (void);
+	boolean DoMeasurement (void);		// blocking
+
+	// non-blocking measurement, call UpdateMeasurement() frequently afterwards,
+	// until it returns BMP180StatusDone (or BMP180StatusError)
+	boolean StartMeasurement (void);
+	TBMP180Status UpdateMeasurement (void);
 
 	int GetTemperature (void);	// degrees Celsius * 10
 	int GetPressure (void);		// hPa * 100
 
 private:
-	s32 DoMeasurement (u8 ucCmd, unsigned nDurationMs, unsigned nOversample = 0);
+	boolean StartConversion (u8 ucCmd, unsigned nDurationMs);
+	s32 ReadConversion (unsigned nOversample = 0);
 #define BMP180_I2C_ERROR	-1
 
+	void CalculateTemperature (s32 UT);
+	void CalculatePressure (s32 UP);
+
 	boolean WriteRead (u8 ucRegister, void *pBuffer, unsigned nCount);
 
 private:
@@ -64,6 +80,19 @@ private:
 
 	int m_nTemperature;
 	int m_nPressure;
+
+	s32 m_B5;			// from temperature, needed for pressure calculation
+
+	enum TState
+	{
+		StateIdle,
+		StateTemperature,
+		StatePressure
+	};
+
+	TState m_State;
+	unsigned m_nStartTicks;		// of running conversion
+	unsigned m_nDurationUs;
 };
 
 #endif
@@ -0,0 +1,227 @@
+//
+// gpioedgecapture.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <sensor/gpioedgecapture.h>
+#include <circle/bcm2835.h>
+#include <circle/bcm2835int.h>
+#include <circle/memio.h>
+#include <circle/timer.h>
+#include <circle/synchronize.h>
+#include <assert.h>
+
+// gpio_int[0] signals events of bank 0 only, so that it does not collide with the
+// GPIO3 IRQ used by CGPIOManager
+#if RASPPI <= 3
+	#define GPIO_FIQ	ARM_FIQ_GPIO0
+#else
+	#define GPIO_FIQ	ARM_IRQ_GPIO0		// the GIC can route any IRQ line to the FIQ
+#endif
+
+CGPIOEdgeConsumer::CGPIOEdgeConsumer (u32 nPinMask, unsigned nQueueSize)
+:	m_nPinMask (nPinMask),
+	m_Queue (nQueueSize),
+	m_nLost (0)
+{
+	assert (m_nPinMask != 0);
+	assert (!(m_nPinMask & ~((1U << (GPIO_EDGE_MAX_PIN+1)) - 1)));
+}
+
+CGPIOEdgeConsumer::~CGPIOEdgeConsumer (void)
+{
+}
+
+boolean CGPIOEdgeConsumer::Read (TGPIOEdge *pEdge)
+{
+	return m_Queue.Read (pEdge);
+}
+
+void CGPIOEdgeConsumer::Flush (void)
+{
+	while (m_Queue.BeginRead () != 0)
+	{
+		m_Queue.EndRead ();
+	}
+}
+
+unsigned CGPIOEdgeConsumer::GetLost (void) const
+{
+	return m_nLost;
+}
+
+CGPIOEdgeCapture *CGPIOEdgeCapture::s_pThis = 0;
+
+CGPIOEdgeCapture::CGPIOEdgeCapture (CInterruptSystem *pInterrupt)
+:	m_pInterrupt (pInterrupt),
+	m_bFIQConnected (FALSE),
+	m_nPinMask (0)
+{
+	for (unsigned i = 0; i < GPIO_EDGE_MAX_CONSUMERS; i++)
+	{
+		m_pConsumer[i] = 0;
+	}
+
+	assert (s_pThis == 0);
+	s_pThis = this;
+}
+
+CGPIOEdgeCapture::~CGPIOEdgeCapture (void)
+{
+	u32 nOldPinMask = m_nPinMask;
+	m_nPinMask = 0;
+	UpdateEdgeDetect (nOldPinMask);
+
+	if (m_bFIQConnected)
+	{
+		assert (m_pInterrupt != 0);
+		m_pInterrupt->DisconnectFIQ (GPIO_FIQ);
+
+		m_bFIQConnected = FALSE;
+	}
+
+	m_pInterrupt = 0;
+
+	s_pThis = 0;
+}
+
+boolean CGPIOEdgeCapture::Initialize (void)
+{
+	assert (!m_bFIQConnected);
+	assert (m_pInterrupt != 0);
+	m_pInterrupt->ConnectFIQ (GPIO_FIQ, FIQHandler, this);
+	m_bFIQConnected = TRUE;
+
+	return TRUE;
+}
+
+boolean CGPIOEdgeCapture::AddConsumer (CGPIOEdgeConsumer *pConsumer)
+{
+	assert (m_bFIQConnected);
+	assert (pConsumer != 0);
+	assert (!(m_nPinMask & pConsumer->m_nPinMask));
+
+	EnterCritical (FIQ_LEVEL);
+
+	for (unsigned i = 0; i < GPIO_EDGE_MAX_CONSUMERS; i++)
+	{
+		if (m_pConsumer[i] == 0)
+		{
+			m_pConsumer[i] = pConsumer;
+
+			u32 nOldPinMask = m_nPinMask;
+			m_nPinMask |= pConsumer->m_nPinMask;
+			UpdateEdgeDetect (nOldPinMask);
+
+			LeaveCritical ();
+
+			return TRUE;
+		}
+	}
+
+	LeaveCritical ();
+
+	return FALSE;
+}
+
+void CGPIOEdgeCapture::RemoveConsumer (CGPIOEdgeConsumer *pConsumer)
+{
+	assert (pConsumer != 0);
+
+	EnterCritical (FIQ_LEVEL);
+
+	for (unsigned i = 0; i < GPIO_EDGE_MAX_CONSUMERS; i++)
+	{
+		if (m_pConsumer[i] == pConsumer)
+		{
+			m_pConsumer[i] = 0;
+
+			u32 nOldPinMask = m_nPinMask;
+			m_nPinMask &= ~pConsumer->m_nPinMask;
+			UpdateEdgeDetect (nOldPinMask);
+
+			break;
+		}
+	}
+
+	LeaveCritical ();
+}
+
+CGPIOEdgeCapture *CGPIOEdgeCapture::Get (void)
+{
+	assert (s_pThis != 0);
+	return s_pThis;
+}
+
+// must be called with FIQs disabled, the other pins (e.g. used with CGPIOManager) are kept
+void CGPIOEdgeCapture::UpdateEdgeDetect (u32 nOldPinMask)
+{
+	PeripheralEntry ();
+
+	u32 nRising = read32 (ARM_GPIO_GPREN0) & ~nOldPinMask;
+	u32 nFalling = read32 (ARM_GPIO_GPFEN0) & ~nOldPinMask;
+
+	write32 (ARM_GPIO_GPEDS0, m_nPinMask);		// discard old events
+
+	write32 (ARM_GPIO_GPREN0, nRising | m_nPinMask);
+	write32 (ARM_GPIO_GPFEN0, nFalling | m_nPinMask);
+
+	PeripheralExit ();
+}
+
+void CGPIOEdgeCapture::FIQHandler (void *pParam)
+{
+	CGPIOEdgeCapture *pThis = (CGPIOEdgeCapture *) pParam;
+	assert (pThis != 0);
+
+	PeripheralEntry ();
+
+	unsigned nTimestamp = CTimer::GetClockTicks ();
+
+	u32 nEvents = read32 (ARM_GPIO_GPEDS0) & pThis->m_nPinMask;
+	write32 (ARM_GPIO_GPEDS0, nEvents);
+
+	u32 nLevels = read32 (ARM_GPIO_GPLEV0);
+
+	PeripheralExit ();
+
+	for (unsigned i = 0; nEvents != 0 && i < GPIO_EDGE_MAX_CONSUMERS; i++)
+	{
+		CGPIOEdgeConsumer *pConsumer = pThis->m_pConsumer[i];
+		if (   pConsumer == 0
+		    || !(nEvents & pConsumer->m_nPinMask))
+		{
+			continue;
+		}
+
+		TGPIOEdge *pEdge = pConsumer->m_Queue.BeginWrite ();
+		if (pEdge == 0)
+		{
+			pConsumer->m_nLost++;
+		}
+		else
+		{
+			pEdge->nTimestamp = nTimestamp;
+			pEdge->nLevels = nLevels & pConsumer->m_nPinMask;
+			pEdge->nChanged = nEvents & pConsumer->m_nPinMask;
+
+			pConsumer->m_Queue.EndWrite (pEdge);
+		}
+
+		nEvents &= ~pConsumer->m_nPinMask;
+	}
+}
@@ -0,0 +1,107 @@
+//
+// gpioedgecapture.h
+//
+// Timestamped GPIO edge capture using the FIQ
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _sensor_gpioedgecapture_h
+#define _sensor_gpioedgecapture_h
+
+#include <circle/interrupt.h>
+#include <circle/lockfreering.h>
+#include <circle/types.h>
+
+#define GPIO_EDGE_MAX_PIN		27		// only GPIO0-27 (bank 0) are supported
+#define GPIO_EDGE_MAX_CONSUMERS		8
+
+struct TGPIOEdge	/// Edge event captured by CGPIOEdgeCapture
+{
+	unsigned nTimestamp;		///< CTimer::GetClockTicks() when the FIQ was taken
+	u32	 nLevels;		///< Levels of the consumer's pins after the edge
+	u32	 nChanged;		///< Consumer's pins, which caused this event
+};
+
+class CGPIOEdgeConsumer		/// Queue of edges on a set of GPIO pins, filled by CGPIOEdgeCapture
+{
+public:
+	/// \param nPinMask Bit mask of the GPIO pins (0-27), which are captured on both edges
+	/// \param nQueueSize Capacity of the queue in edges (power of 2)
+	/// \note The pins must be configured as inputs and must not be used with CGPIOManager.
+	CGPIOEdgeConsumer (u32 nPinMask, unsigned nQueueSize = 64);
+	~CGPIOEdgeConsumer (void);
+
+	/// \param pEdge Receives the oldest captured edge
+	/// \return FALSE, if the queue is empty
+	boolean Read (TGPIOEdge *pEdge);
+
+	/// \brief Remove all queued edges
+	void Flush (void);
+
+	/// \return Number of edges, which have been dropped, because the queue was full
+	unsigned GetLost (void) const;
+
+	u32 GetPinMask (void) const		{ return m_nPinMask; }
+
+private:
+	u32 m_nPinMask;
+	CSPSCRing<TGPIOEdge> m_Queue;		// the FIQ handler is the only producer
+	volatile unsigned m_nLost;
+
+	friend class CGPIOEdgeCapture;
+};
+
+/// \note The FIQ handler only reads the event status and the pin levels, takes a timestamp
+///	  and writes it to the queues of the consumers. The edges are processed from the task
+///	  level afterwards, so that no edge gets lost and the timing is independent from the
+///	  IRQ load.
+/// \note The FIQ cannot be used for another purpose, while this class is active.
+
+class CGPIOEdgeCapture		/// Shared FIQ driven edge timestamp service for GPIO0-27
+{
+public:
+	CGPIOEdgeCapture (CInterruptSystem *pInterrupt);
+	~CGPIOEdgeCapture (void);
+
+	/// \return Operation successful?
+	boolean Initialize (void);
+
+	/// \brief Start capturing edges on the pins of a consumer
+	/// \param pConsumer Pointer to the consumer (pins must not overlap with other consumers)
+	/// \return FALSE, if too many consumers are registered
+	boolean AddConsumer (CGPIOEdgeConsumer *pConsumer);
+	/// \brief Stop capturing edges for a consumer
+	void RemoveConsumer (CGPIOEdgeConsumer *pConsumer);
+
+	static CGPIOEdgeCapture *Get (void);
+
+private:
+	void UpdateEdgeDetect (u32 nOldPinMask);
+
+	static void FIQHandler (void *pParam);
+
+private:
+	CInterruptSystem *m_pInterrupt;
+	boolean m_bFIQConnected;
+
+	CGPIOEdgeConsumer *m_pConsumer[GPIO_EDGE_MAX_CONSUMERS];
+	u32 m_nPinMask;				// of all consumers
+
+	static CGPIOEdgeCapture *s_pThis;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // hcsr04.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,16 +20,43 @@
 #include <sensor/hcsr04.h>
 #include <circle/timer.h>
 #include <circle/synchronize.h>
+#include <assert.h>
 
 CHCSR04::CHCSR04 (unsigned nTriggerPin, unsigned nEchoPin)
 :	m_TriggerPin (nTriggerPin, GPIOModeOutput),
 	m_EchoPin (nEchoPin, GPIOModeInput),
+	m_pEdgeCapture (0),
+	m_pEdgeConsumer (0),
+	m_bActive (FALSE),
 	m_nDistance (0)
 {
 }
 
+CHCSR04::CHCSR04 (unsigned nTriggerPin, unsigned nEchoPin, CGPIOEdgeCapture *pEdgeCapture)
+:	m_TriggerPin (nTriggerPin, GPIOModeOutput),
+	m_EchoPin (nEchoPin, GPIOModeInput),
+	m_pEdgeCapture (pEdgeCapture),
+	m_pEdgeConsumer (0),
+	m_bActive (FALSE),
+	m_nDistance (0)
+{
+	assert (m_pEdgeCapture != 0);
+	assert (nEchoPin <= GPIO_EDGE_MAX_PIN);
+
+	m_pEdgeConsumer = new CGPIOEdgeConsumer (1U << nEchoPin, 4);
+	assert (m_pEdgeConsumer != 0);
+}
+
 CHCSR04::~CHCSR04 (void)
 {
+	if (m_pEdgeConsumer != 0)
+	{
+		assert (m_pEdgeCapture != 0);
+		m_pEdgeCapture->RemoveConsumer (m_pEdgeConsumer);
+
+		delete m_pEdgeConsumer;
+		m_pEdgeConsumer = 0;
+	}
 }
 
 boolean CHCSR04::Initialize (void)
@@ -37,11 +64,33 @@ boolean CHCSR04::Initialize (void)
 	m_TriggerPin.Write (LOW);
 	CTimer::Get ()->usDelay (10);
 
+	if (m_pEdgeConsumer != 0)
+	{
+		assert (m_pEdgeCapture != 0);
+		return m_pEdgeCapture->AddConsumer (m_pEdgeConsumer);
+	}
+
 	return TRUE;
 }
 
 boolean CHCSR04::DoMeasurement (unsigned nTimeoutMicros)
 {
+	if (m_pEdgeConsumer != 0)
+	{
+		if (!StartMeasurement (nTimeoutMicros))
+		{
+			return FALSE;
+		}
+
+		THCSR04Status Status;
+		while ((Status = UpdateMeasurement ()) == HCSR04StatusBusy)
+		{
+			// just wait, the echo timing does not depend on this loop
+		}
+
+		return Status == HCSR04StatusDone;
+	}
+
 	if (m_EchoPin.Read () == HIGH)
 	{
 		return FALSE;
@@ -80,6 +129,69 @@ boolean CHCSR04::DoMeasurement (unsigned nTimeoutMicros)
 	return TRUE;
 }
 
+boolean CHCSR04::StartMeasurement (unsigned nTimeoutMicros)
+{
+	assert (m_pEdgeConsumer != 0);
+
+	if (m_EchoPin.Read () == HIGH)
+	{
+		return FALSE;
+	}
+
+	m_pEdgeConsumer->Flush ();
+
+	m_bActive = TRUE;
+	m_bEchoStarted = FALSE;
+	m_nTimeoutMicros = nTimeoutMicros;
+
+	m_TriggerPin.Write (HIGH);
+	CTimer::Get ()->usDelay (10);
+	m_TriggerPin.Write (LOW);
+
+	m_nStartTicks = CTimer::Get ()->GetClockTicks ();
+
+	return TRUE;
+}
+
+THCSR04Status CHCSR04::UpdateMeasurement (void)
+{
+	assert (m_pEdgeConsumer != 0);
+
+	if (!m_bActive)
+	{
+		return HCSR04StatusError;
+	}
+
+	TGPIOEdge Edge;
+	while (m_pEdgeConsumer->Read (&Edge))
+	{
+		if (Edge.nLevels)
+		{
+			m_bEchoStarted = TRUE;
+			m_nEchoStartTicks = Edge.nTimestamp;
+		}
+		else if (m_bEchoStarted)
+		{
+			m_bActive = FALSE;
+
+			unsigned nInterval = Edge.nTimestamp - m_nEchoStartTicks;
+
+			m_nDistance = nInterval * 10 / 58;
+
+			return HCSR04StatusDone;
+		}
+	}
+
+	if (CTimer::Get ()->GetClockTicks () - m_nStartTicks >= m_nTimeoutMicros)
+	{
+		m_bActive = FALSE;
+
+		return HCSR04StatusError;
+	}
+
+	return HCSR04StatusBusy;
+}
+
 unsigned CHCSR04::GetDistance (void) const
 {
 	return m_nDistance;
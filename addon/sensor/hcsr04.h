@@ -4,7 +4,7 @@
 // Driver for HC-SR04 Ultrasonic distance measuring module
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,23 +24,47 @@
 
 #include <circle/gpiopin.h>
 #include <circle/types.h>
+#include <sensor/gpioedgecapture.h>
+
+enum THCSR04Status
+{
+	HCSR04StatusBusy,
+	HCSR04StatusDone,
+	HCSR04StatusError
+};
 
 class CHCSR04
 {
 public:
 	CHCSR04 (unsigned nTriggerPin, unsigned nEchoPin);
+	// capture mode: the echo pulse (nEchoPin 0-27) is timestamped by CGPIOEdgeCapture
+	CHCSR04 (unsigned nTriggerPin, unsigned nEchoPin, CGPIOEdgeCapture *pEdgeCapture);
 	~CHCSR04 (void);
 
 	boolean Initialize (void);
 
 	boolean DoMeasurement (unsigned nTimeoutMicros = 30000);
 
+	// non-blocking measurement (capture mode only), call UpdateMeasurement() frequently
+	// afterwards, until it does not return HCSR04StatusBusy any more
+	boolean StartMeasurement (unsigned nTimeoutMicros = 30000);
+	THCSR04Status UpdateMeasurement (void);
+
 	unsigned GetDistance (void) const;		// returns Millimeters
 
 private:
 	CGPIOPin m_TriggerPin;
 	CGPIOPin m_EchoPin;
 
+	CGPIOEdgeCapture *m_pEdgeCapture;
+	CGPIOEdgeConsumer *m_pEdgeConsumer;
+
+	boolean m_bActive;				// measurement is running
+	unsigned m_nStartTicks;
+	unsigned m_nTimeoutMicros;
+	boolean m_bEchoStarted;
+	unsigned m_nEchoStartTicks;
+
 	unsigned m_nDistance;				// Millimeters
 };
 
@@ -93,8 +93,11 @@ CKY040::CKY040 (unsigned nCLKPin, unsigned nDTPin, unsigned nSWPin, CGPIOManager
 	m_SWPin (nSWPin, GPIOModeInputPullUp, pGPIOManager),
 	m_bPollingMode (!pGPIOManager),
 	m_bInterruptConnected (FALSE),
+	m_pEdgeCapture (nullptr),
+	m_pEdgeConsumer (nullptr),
 	m_pEventHandler (nullptr),
 	m_State (StateStart),
+	m_nEventTimestamp (0),
 	m_hDebounceTimer (0),
 	m_hTickTimer (0),
 	m_nLastSWLevel (HIGH),
@@ -104,8 +107,42 @@ CKY040::CKY040 (unsigned nCLKPin, unsigned nDTPin, unsigned nSWPin, CGPIOManager
 {
 }
 
+CKY040::CKY040 (unsigned nCLKPin, unsigned nDTPin, unsigned nSWPin, CGPIOEdgeCapture *pEdgeCapture)
+:	m_CLKPin (nCLKPin, GPIOModeInputPullUp),
+	m_DTPin (nDTPin, GPIOModeInputPullUp),
+	m_SWPin (nSWPin, GPIOModeInputPullUp),
+	m_bPollingMode (TRUE),
+	m_bInterruptConnected (FALSE),
+	m_pEdgeCapture (pEdgeCapture),
+	m_pEdgeConsumer (nullptr),
+	m_nCLKMask (1U << nCLKPin),
+	m_nDTMask (1U << nDTPin),
+	m_pEventHandler (nullptr),
+	m_State (StateStart),
+	m_nEventTimestamp (0),
+	m_hDebounceTimer (0),
+	m_hTickTimer (0),
+	m_nLastSWLevel (HIGH),
+	m_bDebounceActive (FALSE),
+	m_SwitchState (SwitchStateStart),
+	m_nSwitchLastTicks (0)
+{
+	assert (m_pEdgeCapture);
+	assert (nCLKPin <= GPIO_EDGE_MAX_PIN);
+	assert (nDTPin <= GPIO_EDGE_MAX_PIN);
+}
+
 CKY040::~CKY040 (void)
 {
+	if (m_pEdgeConsumer)
+	{
+		assert (m_pEdgeCapture);
+		m_pEdgeCapture->RemoveConsumer (m_pEdgeConsumer);
+
+		delete m_pEdgeConsumer;
+		m_pEdgeConsumer = nullptr;
+	}
+
 	if (m_bInterruptConnected)
 	{
 		m_pEventHandler = nullptr;
@@ -154,6 +191,20 @@ boolean CKY040::Initialize (void)
 		m_SWPin.EnableInterrupt (GPIOInterruptOnFallingEdge);
 		m_SWPin.EnableInterrupt2 (GPIOInterruptOnRisingEdge);
 	}
+	else if (m_pEdgeCapture)
+	{
+		assert (!m_pEdgeConsumer);
+		m_pEdgeConsumer = new CGPIOEdgeConsumer (m_nCLKMask | m_nDTMask);
+		assert (m_pEdgeConsumer);
+
+		if (!m_pEdgeCapture->AddConsumer (m_pEdgeConsumer))
+		{
+			delete m_pEdgeConsumer;
+			m_pEdgeConsumer = nullptr;
+
+			return FALSE;
+		}
+	}
 
 	return TRUE;
 }
@@ -171,11 +222,29 @@ unsigned CKY040::GetHoldSeconds (void) const
 	return m_nHoldCounter / 2;
 }
 
+unsigned CKY040::GetEventTimestamp (void) const
+{
+	return m_nEventTimestamp;
+}
+
 void CKY040::Update (void)
 {
 	assert (m_bPollingMode);
 
-	EncoderInterruptHandler (this);
+	if (m_pEdgeConsumer)
+	{
+		// the levels after each edge are replayed to the state machine
+		TGPIOEdge Edge;
+		while (m_pEdgeConsumer->Read (&Edge))
+		{
+			HandleEncoder (Edge.nLevels & m_nCLKMask ? HIGH : LOW,
+				       Edge.nLevels & m_nDTMask ? HIGH : LOW, Edge.nTimestamp);
+		}
+	}
+	else
+	{
+		EncoderInterruptHandler (this);
+	}
 
 	// handle switch
 	unsigned nTicks = CTimer::GetClockTicks ();
@@ -248,17 +317,27 @@ void CKY040::EncoderInterruptHandler (void *pParam)
 
 	unsigned nCLK = pThis->m_CLKPin.Read ();
 	unsigned nDT = pThis->m_DTPin.Read ();
+
+	pThis->HandleEncoder (nCLK, nDT, CTimer::GetClockTicks ());
+}
+
+void CKY040::HandleEncoder (unsigned nCLK, unsigned nDT, unsigned nTimestamp)
+{
 	assert (nCLK <= 1);
 	assert (nDT <= 1);
 
-	assert (pThis->m_State < StateUnknown);
-	TEvent Event = s_Output[pThis->m_State][nCLK][nDT];
-	pThis->m_State = s_NextState[pThis->m_State][nCLK][nDT];
+	assert (m_State < StateUnknown);
+	TEvent Event = s_Output[m_State][nCLK][nDT];
+	m_State = s_NextState[m_State][nCLK][nDT];
 
-	if (   Event != EventUnknown
-	    && pThis->m_pEventHandler)
+	if (Event != EventUnknown)
 	{
-		(*pThis->m_pEventHandler) (Event, pThis->m_pEventParam);
+		m_nEventTimestamp = nTimestamp;
+
+		if (m_pEventHandler)
+		{
+			(*m_pEventHandler) (Event, m_pEventParam);
+		}
 	}
 }
 
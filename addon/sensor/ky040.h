@@ -24,8 +24,11 @@
 #include <circle/gpiopin.h>
 #include <circle/timer.h>
 #include <circle/types.h>
+#include <sensor/gpioedgecapture.h>
 
-/// \note This driver supports an interrupt mode and a polling mode.
+/// \note This driver supports an interrupt mode, a polling mode and a capture mode. In capture
+///	  mode the encoder edges are timestamped and queued by CGPIOEdgeCapture in the FIQ and
+///	  processed from Update(), so that no steps get lost under load. The switch is polled.
 
 class CKY040	/// Driver for KY-040 rotary encoder module
 {
@@ -54,6 +57,13 @@ public:
 	/// \param pGPIOManager Pointer to GPIO manager object (0 enables polling mode)
 	CKY040 (unsigned nCLKPin, unsigned nDTPin, unsigned nSWPin, CGPIOManager *pGPIOManager = 0);
 
+	/// \brief Constructor for capture mode
+	/// \param nCLKPin GPIO pin number of clock pin (encoder pin A, 0-27)
+	/// \param nDTPin GPIO pin number of data pin (encoder pin B, 0-27)
+	/// \param nSWPin GPIO pin number of switch pin
+	/// \param pEdgeCapture Pointer to the initialized edge capture service
+	CKY040 (unsigned nCLKPin, unsigned nDTPin, unsigned nSWPin, CGPIOEdgeCapture *pEdgeCapture);
+
 	~CKY040 (void);
 
 	/// \brief Operation successful?
@@ -68,7 +78,11 @@ public:
 	/// \note Only valid, when EventSwitchHold has been received.
 	unsigned GetHoldSeconds (void) const;
 
-	/// \brief Has to be called very frequently in polling mode
+	/// \return CTimer::GetClockTicks() of the edge, which completed the last rotation step
+	/// \note Exact in capture mode only, time of processing the edge otherwise
+	unsigned GetEventTimestamp (void) const;
+
+	/// \brief Has to be called very frequently in polling and capture mode
 	void Update (void);
 
 private:
@@ -108,6 +122,7 @@ private:
 	};
 
 private:
+	void HandleEncoder (unsigned nCLK, unsigned nDT, unsigned nTimestamp);
 	void HandleSwitchEvent (TSwitchEvent SwitchEvent);
 
 	static void EncoderInterruptHandler (void *pParam);
@@ -124,11 +139,18 @@ private:
 	boolean m_bPollingMode;
 	boolean m_bInterruptConnected;
 
+	// capture mode
+	CGPIOEdgeCapture *m_pEdgeCapture;
+	CGPIOEdgeConsumer *m_pEdgeConsumer;
+	u32 m_nCLKMask;
+	u32 m_nDTMask;
+
 	TEventHandler *m_pEventHandler;
 	void *m_pEventParam;
 
 	// encoder
 	TState m_State;
+	unsigned m_nEventTimestamp;
 
 	static TState s_NextState[StateUnknown][2][2];
 	static TEvent s_Output[StateUnknown][2][2];
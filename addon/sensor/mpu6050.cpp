@@ -2,7 +2,7 @@
 // mpu6050.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,6 +23,18 @@
 #include <assert.h>
 
 // Registers
+#define SMPLRT_DIV		25
+#define CONFIG			26
+	#define CONFIG_DLPF_184HZ	1		// gyroscope output rate is 1 kHz
+#define FIFO_EN			35
+	#define FIFO_EN_XG		BIT (6)
+	#define FIFO_EN_YG		BIT (5)
+	#define FIFO_EN_ZG		BIT (4)
+	#define FIFO_EN_ACCEL		BIT (3)
+#define INT_ENABLE		56
+	#define INT_ENABLE_DATA_RDY	BIT (0)
+#define INT_STATUS		58
+	#define INT_STATUS_FIFO_OFLOW	BIT (4)
 #define ACCEL_XOUT_H		59
 #define ACCEL_XOUT_L		60
 #define ACCEL_YOUT_H		61
@@ -38,14 +50,24 @@
 #define GYRO_ZOUT_H		71
 #define GYRO_ZOUT_L		72
 
+#define USER_CTRL		106
+	#define USER_CTRL_FIFO_EN	BIT (6)
+	#define USER_CTRL_FIFO_RESET	BIT (2)
 #define PWR_MGMT_1		107
+#define FIFO_COUNTH		114
+#define FIFO_R_W		116
 
 static const char FromMPU6050[] = "mpu6050";
 
 CMPU6050::CMPU6050 (CI2CMaster *pI2CMaster, unsigned nI2CClockHz, u8 ucSlaveAddress)
 :	m_pI2CMaster (pI2CMaster),
 	m_nI2CClockHz (nI2CClockHz),
-	m_ucSlaveAddress (ucSlaveAddress)
+	m_ucSlaveAddress (ucSlaveAddress),
+	m_pIntPin (0),
+	m_pRing (0),
+	m_nBurstSamples (0),
+	m_nPendingSamples (0),
+	m_nSamplesLost (0)
 {
 	m_pRegs = new TMPU6050Regs;
 	assert (m_pRegs != 0);
@@ -53,6 +75,8 @@ CMPU6050::CMPU6050 (CI2CMaster *pI2CMaster, unsigned nI2CClockHz, u8 ucSlaveAddr
 
 CMPU6050::~CMPU6050 (void)
 {
+	StopCapture ();
+
 	delete m_pRegs;
 	m_pRegs = 0;
 
@@ -142,3 +166,241 @@ s16 CMPU6050::GetGyroscopeOutputZ (void) const
 	assert (m_pRegs != 0);
 	return (s16) m_pRegs->GyroZOutH << 8 | m_pRegs->GyroZOutL;
 }
+
+boolean CMPU6050::EnableFIFO (unsigned nSampleRateHz)
+{
+	assert (4 <= nSampleRateHz && nSampleRateHz <= 1000);
+
+	assert (m_pI2CMaster != 0);
+	m_pI2CMaster->SetClock (m_nI2CClockHz);
+
+	if (   !WriteReg (CONFIG, CONFIG_DLPF_184HZ)
+	    || !WriteReg (SMPLRT_DIV, 1000 / nSampleRateHz - 1)
+	    || !WriteReg (FIFO_EN, FIFO_EN_XG | FIFO_EN_YG | FIFO_EN_ZG | FIFO_EN_ACCEL)
+	    || !WriteReg (USER_CTRL, USER_CTRL_FIFO_RESET)
+	    || !WriteReg (USER_CTRL, USER_CTRL_FIFO_EN))
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CMPU6050::DisableFIFO (void)
+{
+	assert (m_pI2CMaster != 0);
+	m_pI2CMaster->SetClock (m_nI2CClockHz);
+
+	WriteReg (USER_CTRL, 0);
+	WriteReg (FIFO_EN, 0);
+}
+
+int CMPU6050::ReadFIFO (TMPU6050Sample *pSamples, unsigned nMaxSamples)
+{
+	assert (m_pI2CMaster != 0);
+	m_pI2CMaster->SetClock (m_nI2CClockHz);
+
+	u8 Count[2];
+	if (!ReadRegs (FIFO_COUNTH, Count, sizeof Count))
+	{
+		return -1;
+	}
+
+	unsigned nBytes = (unsigned) Count[0] << 8 | Count[1];
+
+	// a full FIFO or a partial sample indicate, that samples have been overwritten
+	if (   nBytes >= sizeof m_FIFOBuffer + MPU6050_FIFO_SAMPLE_SIZE
+	    || nBytes % MPU6050_FIFO_SAMPLE_SIZE != 0)
+	{
+		CLogger::Get ()->Write (FromMPU6050, LogWarning, "FIFO overflow");
+
+		ResetFIFO ();
+
+		return -1;
+	}
+
+	unsigned nSamples = nBytes / MPU6050_FIFO_SAMPLE_SIZE;
+	if (nSamples > nMaxSamples)
+	{
+		nSamples = nMaxSamples;
+	}
+
+	if (nSamples == 0)
+	{
+		return 0;
+	}
+
+	// FIFO_R_W is not auto-incremented, so all samples are read in one burst
+	nBytes = nSamples * MPU6050_FIFO_SAMPLE_SIZE;
+	if (!ReadRegs (FIFO_R_W, m_FIFOBuffer, nBytes))
+	{
+		return -1;
+	}
+
+	assert (pSamples != 0);
+	const u8 *pData = m_FIFOBuffer;
+	for (unsigned i = 0; i < nSamples; i++, pData += MPU6050_FIFO_SAMPLE_SIZE)
+	{
+		pSamples[i].AccelX = (s16) (pData[0]  << 8 | pData[1]);
+		pSamples[i].AccelY = (s16) (pData[2]  << 8 | pData[3]);
+		pSamples[i].AccelZ = (s16) (pData[4]  << 8 | pData[5]);
+		pSamples[i].GyroX  = (s16) (pData[6]  << 8 | pData[7]);
+		pSamples[i].GyroY  = (s16) (pData[8]  << 8 | pData[9]);
+		pSamples[i].GyroZ  = (s16) (pData[10] << 8 | pData[11]);
+	}
+
+	return nSamples;
+}
+
+boolean CMPU6050::StartCapture (CGPIOManager *pGPIOManager, unsigned nIntPin,
+				unsigned nBurstSamples, unsigned nRingSize)
+{
+	assert (m_pIntPin == 0);
+	assert (m_pRing == 0);
+	assert (nBurstSamples > 0);
+	assert (nBurstSamples <= sizeof m_FIFOBuffer / MPU6050_FIFO_SAMPLE_SIZE);
+
+	m_nBurstSamples = nBurstSamples;
+	m_nPendingSamples = 0;
+	m_nSamplesLost = 0;
+
+	m_pRing = new CSPSCRing<TMPU6050Sample> (nRingSize);
+	assert (m_pRing != 0);
+
+	assert (pGPIOManager != 0);
+	m_pIntPin = new CGPIOPin (nIntPin, GPIOModeInput, pGPIOManager);
+	assert (m_pIntPin != 0);
+
+	m_pIntPin->ConnectInterrupt (DataReadyHandler, this);
+	m_pIntPin->EnableInterrupt (GPIOInterruptOnRisingEdge);
+
+	assert (m_pI2CMaster != 0);
+	m_pI2CMaster->SetClock (m_nI2CClockHz);
+
+	ResetFIFO ();
+
+	// INT is active high with a 50us pulse by default
+	if (!WriteReg (INT_ENABLE, INT_ENABLE_DATA_RDY))
+	{
+		StopCapture ();
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CMPU6050::StopCapture (void)
+{
+	if (m_pIntPin != 0)
+	{
+		assert (m_pI2CMaster != 0);
+		m_pI2CMaster->SetClock (m_nI2CClockHz);
+
+		WriteReg (INT_ENABLE, 0);
+
+		m_pIntPin->DisableInterrupt ();
+		m_pIntPin->DisconnectInterrupt ();
+
+		delete m_pIntPin;
+		m_pIntPin = 0;
+	}
+
+	delete m_pRing;
+	m_pRing = 0;
+}
+
+boolean CMPU6050::Update (void)
+{
+	assert (m_pRing != 0);
+
+	unsigned nPending = __atomic_load_n (&m_nPendingSamples, __ATOMIC_RELAXED);
+	if (nPending < m_nBurstSamples)
+	{
+		return TRUE;
+	}
+
+	TMPU6050Sample Samples[sizeof m_FIFOBuffer / MPU6050_FIFO_SAMPLE_SIZE];
+	int nResult = ReadFIFO (Samples, sizeof Samples / sizeof Samples[0]);
+	if (nResult < 0)
+	{
+		__atomic_store_n (&m_nPendingSamples, 0, __ATOMIC_RELAXED);
+
+		return FALSE;
+	}
+
+	// the FIFO may hold more samples than interrupts have been counted so far
+	__atomic_sub_fetch (&m_nPendingSamples,
+			    (unsigned) nResult < nPending ? (unsigned) nResult : nPending,
+			    __ATOMIC_RELAXED);
+
+	unsigned nWritten = m_pRing->WriteMultiple (Samples, nResult);
+	m_nSamplesLost += nResult - nWritten;
+
+	return TRUE;
+}
+
+boolean CMPU6050::GetSample (TMPU6050Sample *pSample)
+{
+	assert (m_pRing != 0);
+	return m_pRing->Read (pSample);
+}
+
+unsigned CMPU6050::GetSamplesAvailable (void) const
+{
+	assert (m_pRing != 0);
+	return m_pRing->GetCount ();
+}
+
+unsigned CMPU6050::GetSamplesLost (void) const
+{
+	return m_nSamplesLost;
+}
+
+boolean CMPU6050::WriteReg (u8 ucRegister, u8 ucValue)
+{
+	assert (m_pI2CMaster != 0);
+
+	u8 Data[] = {ucRegister, ucValue};
+	int nResult = m_pI2CMaster->Write (m_ucSlaveAddress, Data, sizeof Data);
+	if (nResult != sizeof Data)
+	{
+		CLogger::Get ()->Write (FromMPU6050, LogError, "I2C write failed (err %d)", nResult);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean CMPU6050::ReadRegs (u8 ucRegister, void *pBuffer, unsigned nCount)
+{
+	assert (m_pI2CMaster != 0);
+
+	int nResult = m_pI2CMaster->WriteRead (m_ucSlaveAddress, &ucRegister, sizeof ucRegister,
+					       pBuffer, nCount);
+	if (nResult != (int) nCount)
+	{
+		CLogger::Get ()->Write (FromMPU6050, LogError, "I2C read failed (err %d)", nResult);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CMPU6050::ResetFIFO (void)
+{
+	WriteReg (USER_CTRL, USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RESET);
+
+	u8 ucStatus;
+	ReadRegs (INT_STATUS, &ucStatus, sizeof ucStatus);	// clears FIFO_OFLOW_INT
+}
+
+void CMPU6050::DataReadyHandler (void *pParam)
+{
+	CMPU6050 *pThis = (CMPU6050 *) pParam;
+	assert (pThis != 0);
+
+	__atomic_add_fetch (&pThis->m_nPendingSamples, 1, __ATOMIC_RELAXED);
+}
@@ -4,7 +4,7 @@
 // Driver for MPU-6050 (and MPU-6500) with I2C interface
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,9 +23,15 @@
 #define _sensor_mpu6050_h
 
 #include <circle/i2cmaster.h>
+#include <circle/gpiomanager.h>
+#include <circle/gpiopin.h>
+#include <circle/lockfreering.h>
 #include <circle/types.h>
 #include <circle/macros.h>
 
+#define MPU6050_FIFO_SIZE		1024
+#define MPU6050_FIFO_SAMPLE_SIZE	12		// accelerometer and gyroscope outputs
+
 struct TMPU6050Regs
 {
 	u8	AccelXOutH;
@@ -45,6 +51,16 @@ struct TMPU6050Regs
 }
 PACKED;
 
+struct TMPU6050Sample
+{
+	s16	AccelX;
+	s16	AccelY;
+	s16	AccelZ;
+	s16	GyroX;
+	s16	GyroY;
+	s16	GyroZ;
+};
+
 class CMPU6050
 {
 public:
@@ -63,12 +79,57 @@ public:
 	s16 GetGyroscopeOutputY (void) const;
 	s16 GetGyroscopeOutputZ (void) const;
 
+	// FIFO burst mode: the device samples accelerometer and gyroscope into its FIFO
+	// nSampleRateHz is 4..1000
+	boolean EnableFIFO (unsigned nSampleRateHz = 1000);
+	void DisableFIFO (void);
+
+	// reads up to nMaxSamples from the FIFO with one I2C transaction
+	// returns the number of samples read or < 0 on error or FIFO overflow (FIFO is reset then)
+	int ReadFIFO (TMPU6050Sample *pSamples, unsigned nMaxSamples);
+
+	// interrupt-driven capture (requires EnableFIFO() before)
+	// nIntPin is the GPIO pin number connected to INT of the device. The FIFO is read,
+	// when nBurstSamples are available. nRingSize is the capacity of the sample ring
+	// (power of 2).
+	boolean StartCapture (CGPIOManager *pGPIOManager, unsigned nIntPin,
+			      unsigned nBurstSamples = 10, unsigned nRingSize = 1024);
+	void StopCapture (void);
+
+	// moves samples from the FIFO to the ring, call this frequently from TASK_LEVEL
+	// does an I2C transaction only, if a burst of samples has been signaled by the INT pin
+	// returns FALSE on I2C error or FIFO overflow
+	boolean Update (void);
+
+	// consumer side of the sample ring (may be called from another core)
+	boolean GetSample (TMPU6050Sample *pSample);
+	unsigned GetSamplesAvailable (void) const;
+
+	// number of samples, which have been dropped, because the ring was full
+	unsigned GetSamplesLost (void) const;
+
+private:
+	boolean WriteReg (u8 ucRegister, u8 ucValue);
+	boolean ReadRegs (u8 ucRegister, void *pBuffer, unsigned nCount);
+
+	void ResetFIFO (void);
+
+	static void DataReadyHandler (void *pParam);
+
 private:
 	CI2CMaster *m_pI2CMaster;
 	unsigned    m_nI2CClockHz;
 	u8	    m_ucSlaveAddress;
 
 	TMPU6050Regs *m_pRegs;
+
+	u8 m_FIFOBuffer[MPU6050_FIFO_SIZE / MPU6050_FIFO_SAMPLE_SIZE * MPU6050_FIFO_SAMPLE_SIZE];
+
+	CGPIOPin *m_pIntPin;
+	CSPSCRing<TMPU6050Sample> *m_pRing;
+	unsigned m_nBurstSamples;
+	volatile unsigned m_nPendingSamples;	// data ready interrupts since last read
+	unsigned m_nSamplesLost;
 };
 
 #endif
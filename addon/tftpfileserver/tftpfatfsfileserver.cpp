@@ -2,7 +2,7 @@
 // tftpfatfsfileserver.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,14 +18,19 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <tftpfileserver/tftpfatfsfileserver.h>
+#include <circle/util.h>
 #include <assert.h>
 
 CTFTPFatFsFileServer::CTFTPFatFsFileServer (CNetSubSystem *pNetSubSystem, FATFS *pFileSystem,
-					    const char *pPath)
+					    const char *pPath, CContentCache *pCache)
 :	CTFTPDaemon (pNetSubSystem),
 	m_pFileSystem (pFileSystem),
 	m_Path (pPath),
-	m_bFileOpen (FALSE)
+	m_pCache (pCache),
+	m_bFileOpen (FALSE),
+	m_bFileWrite (FALSE),
+	m_pCacheEntry (0),
+	m_nCacheOffset (0)
 {
 	assert (m_Path.GetLength () > 0);
 	assert (((const char *) m_Path)[m_Path.GetLength ()-1] == '/');
@@ -50,6 +55,28 @@ boolean CTFTPFatFsFileServer::FileOpen (const char *pFileName)
 	m_Filename = m_Path;
 	m_Filename.Append (pFileName);
 
+	if (m_pCache != 0)
+	{
+		TContentCacheEntry *pEntry = LoadCachedFile ();
+		if (pEntry != 0)
+		{
+			if (pEntry->pData == 0)
+			{
+				m_pCache->Release (pEntry);
+
+				return FALSE;
+			}
+
+			m_pCacheEntry = pEntry;
+			m_nCacheOffset = 0;
+
+			m_bFileOpen = TRUE;
+			m_bFileWrite = FALSE;
+
+			return TRUE;
+		}
+	}
+
 	FRESULT Result = f_open (&m_File, m_Filename, FA_READ | FA_OPEN_EXISTING);
 	if (Result != FR_OK)
 	{
@@ -57,6 +84,7 @@ boolean CTFTPFatFsFileServer::FileOpen (const char *pFileName)
 	}
 
 	m_bFileOpen = TRUE;
+	m_bFileWrite = FALSE;
 
 	return TRUE;
 }
@@ -70,6 +98,11 @@ boolean CTFTPFatFsFileServer::FileCreate (const char *pFileName)
 	m_Filename = m_Path;
 	m_Filename.Append (pFileName);
 
+	if (m_pCache != 0)
+	{
+		m_pCache->Invalidate (m_Filename);
+	}
+
 	FRESULT Result = f_open (&m_File, m_Filename, FA_WRITE | FA_CREATE_ALWAYS);
 	if (Result != FR_OK)
 	{
@@ -77,6 +110,7 @@ boolean CTFTPFatFsFileServer::FileCreate (const char *pFileName)
 	}
 
 	m_bFileOpen = TRUE;
+	m_bFileWrite = TRUE;
 
 	return TRUE;
 }
@@ -86,11 +120,29 @@ boolean CTFTPFatFsFileServer::FileClose (void)
 	assert (m_pFileSystem != 0);
 	assert (m_bFileOpen);
 
+	if (m_pCacheEntry != 0)
+	{
+		assert (m_pCache != 0);
+		m_pCache->Release (m_pCacheEntry);
+		m_pCacheEntry = 0;
+
+		m_bFileOpen = FALSE;
+
+		return TRUE;
+	}
+
 	if (f_close (&m_File) != FR_OK)
 	{
 		return FALSE;
 	}
 
+	// the file may have been looked up in the meantime
+	if (   m_bFileWrite
+	    && m_pCache != 0)
+	{
+		m_pCache->Invalidate (m_Filename);
+	}
+
 	m_bFileOpen = FALSE;
 
 	return TRUE;
@@ -103,6 +155,21 @@ int CTFTPFatFsFileServer::FileRead (void *pBuffer, unsigned nCount)
 	assert (pBuffer != 0);
 	assert (nCount > 0);
 
+	if (m_pCacheEntry != 0)
+	{
+		assert (m_nCacheOffset <= m_pCacheEntry->nLength);
+		size_t nRest = m_pCacheEntry->nLength - m_nCacheOffset;
+		if (nCount > nRest)
+		{
+			nCount = nRest;
+		}
+
+		memcpy (pBuffer, m_pCacheEntry->pData + m_nCacheOffset, nCount);
+		m_nCacheOffset += nCount;
+
+		return nCount;
+	}
+
 	unsigned nBytesRead;
 	FRESULT Result = f_read (&m_File, pBuffer, nCount, &nBytesRead);
 	if (Result != FR_OK)
@@ -129,3 +196,44 @@ int CTFTPFatFsFileServer::FileWrite (const void *pBuffer, unsigned nCount)
 
 	return nBytesWritten;
 }
+
+TContentCacheEntry *CTFTPFatFsFileServer::LoadCachedFile (void)
+{
+	assert (m_pCache != 0);
+	TContentCacheEntry *pEntry = m_pCache->Lookup (m_Filename);
+	if (pEntry != 0)
+	{
+		return pEntry;
+	}
+
+	if (f_open (&m_File, m_Filename, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		return m_pCache->Insert (m_Filename, 0, 0);	// remember, that it does not exist
+	}
+
+	FSIZE_t nSize = f_size (&m_File);
+	if (nSize > m_pCache->GetMaxEntrySize ())
+	{
+		f_close (&m_File);
+
+		return 0;
+	}
+
+	u8 *pData = new u8[nSize > 0 ? nSize : 1];
+	assert (pData != 0);
+
+	unsigned nBytesRead;
+	if (   f_read (&m_File, pData, nSize, &nBytesRead) != FR_OK
+	    || nBytesRead != nSize)
+	{
+		delete [] pData;
+
+		f_close (&m_File);
+
+		return 0;
+	}
+
+	f_close (&m_File);
+
+	return m_pCache->Insert (m_Filename, pData, nSize);
+}
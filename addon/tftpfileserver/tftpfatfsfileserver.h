@@ -2,7 +2,7 @@
 // tftpfatfsfileserver.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,6 +22,7 @@
 
 #include <circle/net/tftpdaemon.h>
 #include <circle/net/netsubsystem.h>
+#include <circle/net/contentcache.h>
 #include <fatfs/ff.h>
 #include <circle/string.h>
 #include <circle/types.h>
@@ -29,8 +30,10 @@
 class CTFTPFatFsFileServer : public CTFTPDaemon
 {
 public:
+	// files read via TFTP are kept in pCache, if it is not 0
 	CTFTPFatFsFileServer (CNetSubSystem *pNetSubSystem, FATFS *pFileSystem,
-			      const char *pPath = "SD:/");	// must have trailing '/'
+			      const char *pPath = "SD:/",	// must have trailing '/'
+			      CContentCache *pCache = 0);
 	~CTFTPFatFsFileServer (void);
 
 	boolean FileOpen (const char *pFileName);
@@ -39,13 +42,22 @@ public:
 	int FileRead (void *pBuffer, unsigned nCount);
 	int FileWrite (const void *pBuffer, unsigned nCount);
 
+private:
+	// returns the referenced entry, 0 if the file cannot be cached
+	TContentCacheEntry *LoadCachedFile (void);
+
 private:
 	FATFS *m_pFileSystem;
 	CString m_Path;
+	CContentCache *m_pCache;
 
 	CString m_Filename;
 	FIL m_File;
 	boolean m_bFileOpen;
+	boolean m_bFileWrite;
+
+	TContentCacheEntry *m_pCacheEntry;		// file is read from here, if not 0
+	size_t m_nCacheOffset;
 };
 
 #endif
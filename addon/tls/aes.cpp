@@ -0,0 +1,564 @@
+//
+// aes.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <tls/aes.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#ifdef AES_CRYPTO_EXTENSIONS
+	#include <arm_neon.h>
+	#define CE_TARGET	__attribute__ ((target ("+crypto")))
+#endif
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline u32 GetBE32 (const u8 *p)
+{
+	return (u32) p[0] << 24 | (u32) p[1] << 16 | (u32) p[2] << 8 | p[3];
+}
+
+static inline void PutBE32 (u8 *p, u32 x)
+{
+	p[0] = (u8) (x >> 24);
+	p[1] = (u8) (x >> 16);
+	p[2] = (u8) (x >> 8);
+	p[3] = (u8) x;
+}
+
+boolean CAES::s_bTablesValid = FALSE;
+u8 CAES::s_SBox[256];
+u32 CAES::s_TE[4][256];
+int CAES::s_nAccelerated = -1;
+
+static inline u8 xtime (u8 x)
+{
+	return (u8) ((x << 1) ^ (x & 0x80 ? 0x1B : 0));
+}
+
+CAES::CAES (void)
+:	m_nRounds (0)
+{
+	if (!s_bTablesValid)
+	{
+		InitTables ();
+	}
+}
+
+CAES::~CAES (void)
+{
+	memset (m_RoundKey, 0, sizeof m_RoundKey);
+	memset (m_RoundKeyBytes, 0, sizeof m_RoundKeyBytes);
+}
+
+boolean CAES::SetKey (const u8 *pKey, unsigned nKeyLength)
+{
+	assert (pKey != 0);
+
+	unsigned nKeyWords;
+	switch (nKeyLength)
+	{
+	case 16:	nKeyWords = 4;	m_nRounds = 10;	break;
+	case 32:	nKeyWords = 8;	m_nRounds = 14;	break;
+
+	default:
+		m_nRounds = 0;
+		return FALSE;
+	}
+
+	for (unsigned i = 0; i < nKeyWords; i++)
+	{
+		m_RoundKey[i] = GetBE32 (pKey + i*4);
+	}
+
+	u8 uchRCon = 0x01;
+	unsigned nWords = 4 * (m_nRounds+1);
+	for (unsigned i = nKeyWords; i < nWords; i++)
+	{
+		u32 nTemp = m_RoundKey[i-1];
+
+		if (i % nKeyWords == 0)
+		{
+			// RotWord, SubWord and Rcon
+			nTemp =   (u32) s_SBox[(nTemp >> 16) & 0xFF] << 24
+				| (u32) s_SBox[(nTemp >> 8) & 0xFF] << 16
+				| (u32) s_SBox[nTemp & 0xFF] << 8
+				| (u32) s_SBox[nTemp >> 24];
+			nTemp ^= (u32) uchRCon << 24;
+			uchRCon = xtime (uchRCon);
+		}
+		else if (   nKeyWords == 8
+			 && i % nKeyWords == 4)
+		{
+			nTemp =   (u32) s_SBox[nTemp >> 24] << 24
+				| (u32) s_SBox[(nTemp >> 16) & 0xFF] << 16
+				| (u32) s_SBox[(nTemp >> 8) & 0xFF] << 8
+				| (u32) s_SBox[nTemp & 0xFF];
+		}
+
+		m_RoundKey[i] = m_RoundKey[i-nKeyWords] ^ nTemp;
+	}
+
+	for (unsigned i = 0; i < nWords; i++)
+	{
+		PutBE32 (m_RoundKeyBytes + i*4, m_RoundKey[i]);
+	}
+
+	return TRUE;
+}
+
+void CAES::EncryptBlock (const u8 *pIn, u8 *pOut) const
+{
+	assert (m_nRounds != 0);
+	assert (pIn != 0);
+	assert (pOut != 0);
+
+#ifdef AES_CRYPTO_EXTENSIONS
+	if (IsAccelerated ())
+	{
+		EncryptBlockCE (pIn, pOut);
+
+		return;
+	}
+#endif
+
+	EncryptBlockTables (pIn, pOut);
+}
+
+void CAES::EncryptCTR (u8 *pCounter, const u8 *pIn, u8 *pOut, size_t nLength) const
+{
+	assert (m_nRounds != 0);
+	assert (pCounter != 0);
+
+#ifdef AES_CRYPTO_EXTENSIONS
+	if (IsAccelerated ())
+	{
+		EncryptCTRCE (pCounter, pIn, pOut, nLength);
+
+		return;
+	}
+#endif
+
+	u32 nCounter = GetBE32 (pCounter + 12);
+	while (nLength > 0)
+	{
+		u8 KeyStream[AES_BLOCK_SIZE];
+		EncryptBlockTables (pCounter, KeyStream);
+
+		PutBE32 (pCounter + 12, ++nCounter);
+
+		size_t nBlockLength = nLength < AES_BLOCK_SIZE ? nLength : AES_BLOCK_SIZE;
+		for (unsigned i = 0; i < nBlockLength; i++)
+		{
+			pOut[i] = pIn[i] ^ KeyStream[i];
+		}
+
+		pIn += nBlockLength;
+		pOut += nBlockLength;
+		nLength -= nBlockLength;
+	}
+}
+
+boolean CAES::IsAccelerated (void)
+{
+#ifdef AES_CRYPTO_EXTENSIONS
+	if (s_nAccelerated < 0)
+	{
+		// ID_AA64ISAR0_EL1.AES (bits 7:4) is non-zero, if AESE/AESMC are implemented
+		u64 nISAR0;
+		asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (nISAR0));
+
+		s_nAccelerated = (nISAR0 >> 4) & 0xF ? 1 : 0;
+	}
+
+	return s_nAccelerated > 0;
+#else
+	return FALSE;
+#endif
+}
+
+void CAES::EncryptBlockTables (const u8 *pIn, u8 *pOut) const
+{
+	const u32 *pRK = m_RoundKey;
+
+	u32 s0 = GetBE32 (pIn)      ^ pRK[0];
+	u32 s1 = GetBE32 (pIn + 4)  ^ pRK[1];
+	u32 s2 = GetBE32 (pIn + 8)  ^ pRK[2];
+	u32 s3 = GetBE32 (pIn + 12) ^ pRK[3];
+
+	// SubBytes, ShiftRows and MixColumns are combined in the tables
+	for (unsigned nRound = 1; nRound < m_nRounds; nRound++)
+	{
+		pRK += 4;
+
+		u32 t0 =   s_TE[0][s0 >> 24] ^ s_TE[1][(s1 >> 16) & 0xFF]
+			 ^ s_TE[2][(s2 >> 8) & 0xFF] ^ s_TE[3][s3 & 0xFF] ^ pRK[0];
+		u32 t1 =   s_TE[0][s1 >> 24] ^ s_TE[1][(s2 >> 16) & 0xFF]
+			 ^ s_TE[2][(s3 >> 8) & 0xFF] ^ s_TE[3][s0 & 0xFF] ^ pRK[1];
+		u32 t2 =   s_TE[0][s2 >> 24] ^ s_TE[1][(s3 >> 16) & 0xFF]
+			 ^ s_TE[2][(s0 >> 8) & 0xFF] ^ s_TE[3][s1 & 0xFF] ^ pRK[2];
+		u32 t3 =   s_TE[0][s3 >> 24] ^ s_TE[1][(s0 >> 16) & 0xFF]
+			 ^ s_TE[2][(s1 >> 8) & 0xFF] ^ s_TE[3][s2 & 0xFF] ^ pRK[3];
+
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+
+	// final round without MixColumns
+	pRK += 4;
+
+#define FINAL(a, b, c, d, k)	(  (u32) s_SBox[(a) >> 24] << 24		\
+				 | (u32) s_SBox[((b) >> 16) & 0xFF] << 16	\
+				 | (u32) s_SBox[((c) >> 8) & 0xFF] << 8		\
+				 | (u32) s_SBox[(d) & 0xFF]) ^ (k)
+
+	u32 t0 = FINAL (s0, s1, s2, s3, pRK[0]);
+	u32 t1 = FINAL (s1, s2, s3, s0, pRK[1]);
+	u32 t2 = FINAL (s2, s3, s0, s1, pRK[2]);
+	u32 t3 = FINAL (s3, s0, s1, s2, pRK[3]);
+
+	PutBE32 (pOut,      t0);
+	PutBE32 (pOut + 4,  t1);
+	PutBE32 (pOut + 8,  t2);
+	PutBE32 (pOut + 12, t3);
+}
+
+#ifdef AES_CRYPTO_EXTENSIONS
+
+CE_TARGET
+void CAES::EncryptBlockCE (const u8 *pIn, u8 *pOut) const
+{
+	const u8 *pRK = m_RoundKeyBytes;
+
+	uint8x16_t State = vld1q_u8 (pIn);
+	for (unsigned nRound = 1; nRound < m_nRounds; nRound++)
+	{
+		State = vaesmcq_u8 (vaeseq_u8 (State, vld1q_u8 (pRK)));
+		pRK += 16;
+	}
+
+	State = vaeseq_u8 (State, vld1q_u8 (pRK));
+	State = veorq_u8 (State, vld1q_u8 (pRK + 16));
+
+	vst1q_u8 (pOut, State);
+}
+
+CE_TARGET
+void CAES::EncryptCTRCE (u8 *pCounter, const u8 *pIn, u8 *pOut, size_t nLength) const
+{
+	// the round keys are kept in registers for the whole message
+	uint8x16_t RK[AES_MAX_ROUNDS+1];
+	for (unsigned i = 0; i <= m_nRounds; i++)
+	{
+		RK[i] = vld1q_u8 (m_RoundKeyBytes + i*16);
+	}
+
+	u32 nCounter = GetBE32 (pCounter + 12);
+	while (nLength > 0)
+	{
+		uint8x16_t State = vld1q_u8 (pCounter);
+		for (unsigned nRound = 0; nRound < m_nRounds-1; nRound++)
+		{
+			State = vaesmcq_u8 (vaeseq_u8 (State, RK[nRound]));
+		}
+		State = veorq_u8 (vaeseq_u8 (State, RK[m_nRounds-1]), RK[m_nRounds]);
+
+		PutBE32 (pCounter + 12, ++nCounter);
+
+		if (nLength >= AES_BLOCK_SIZE)
+		{
+			vst1q_u8 (pOut, veorq_u8 (State, vld1q_u8 (pIn)));
+
+			pIn += AES_BLOCK_SIZE;
+			pOut += AES_BLOCK_SIZE;
+			nLength -= AES_BLOCK_SIZE;
+		}
+		else
+		{
+			u8 KeyStream[AES_BLOCK_SIZE];
+			vst1q_u8 (KeyStream, State);
+
+			for (unsigned i = 0; i < nLength; i++)
+			{
+				pOut[i] = pIn[i] ^ KeyStream[i];
+			}
+
+			nLength = 0;
+		}
+	}
+}
+
+#endif
+
+void CAES::InitTables (void)
+{
+	// generate the S-box from the multiplicative inverse in GF(2^8)
+	u8 p = 1, q = 1;
+	do
+	{
+		// multiply p by 3
+		p = p ^ xtime (p);
+
+		// divide q by 3
+		q ^= q << 1;
+		q ^= q << 2;
+		q ^= q << 4;
+		if (q & 0x80)
+		{
+			q ^= 0x09;
+		}
+
+		// affine transformation
+		u8 x = q ^ (u8) (q << 1 | q >> 7) ^ (u8) (q << 2 | q >> 6)
+			 ^ (u8) (q << 3 | q >> 5) ^ (u8) (q << 4 | q >> 4);
+		s_SBox[p] = x ^ 0x63;
+	}
+	while (p != 1);
+	s_SBox[0] = 0x63;
+
+	for (unsigned i = 0; i < 256; i++)
+	{
+		u8 s = s_SBox[i];
+		u8 s2 = xtime (s);
+		u32 nWord = (u32) s2 << 24 | (u32) s << 16 | (u32) s << 8 | (u8) (s2 ^ s);
+
+		s_TE[0][i] = nWord;
+		s_TE[1][i] = ROR (nWord, 8);
+		s_TE[2][i] = ROR (nWord, 16);
+		s_TE[3][i] = ROR (nWord, 24);
+	}
+
+	s_bTablesValid = TRUE;
+}
+
+// GCM
+
+static const u64 Last4[16] =
+{
+	0x0000, 0x1C20, 0x3840, 0x2460, 0x7080, 0x6CA0, 0x48C0, 0x54E0,
+	0xE100, 0xFD20, 0xD940, 0xC560, 0x9180, 0x8DA0, 0xA9C0, 0xB5E0
+};
+
+CAESGCM::CAESGCM (void)
+{
+}
+
+CAESGCM::~CAESGCM (void)
+{
+	memset (m_HL, 0, sizeof m_HL);
+	memset (m_HH, 0, sizeof m_HH);
+}
+
+boolean CAESGCM::SetKey (const u8 *pKey, unsigned nKeyLength)
+{
+	if (!m_AES.SetKey (pKey, nKeyLength))
+	{
+		return FALSE;
+	}
+
+	// H = E(K, 0^128)
+	u8 H[AES_BLOCK_SIZE];
+	memset (H, 0, sizeof H);
+	m_AES.EncryptBlock (H, H);
+
+	u64 vh = (u64) GetBE32 (H) << 32 | GetBE32 (H + 4);
+	u64 vl = (u64) GetBE32 (H + 8) << 32 | GetBE32 (H + 12);
+
+	// precompute H * i for all 4-bit values i (Shoup's method)
+	m_HL[8] = vl;
+	m_HH[8] = vh;
+	m_HL[0] = 0;
+	m_HH[0] = 0;
+
+	for (unsigned i = 4; i > 0; i >>= 1)
+	{
+		u32 T = (vl & 1) * 0xE1000000U;
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ ((u64) T << 32);
+
+		m_HL[i] = vl;
+		m_HH[i] = vh;
+	}
+
+	for (unsigned i = 2; i <= 8; i *= 2)
+	{
+		vh = m_HH[i];
+		vl = m_HL[i];
+		for (unsigned j = 1; j < i; j++)
+		{
+			m_HH[i+j] = vh ^ m_HH[j];
+			m_HL[i+j] = vl ^ m_HL[j];
+		}
+	}
+
+	return TRUE;
+}
+
+void CAESGCM::Encrypt (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+		       const u8 *pIn, u8 *pOut, size_t nLength, u8 *pTag)
+{
+	assert (pNonce != 0);
+	assert (pTag != 0);
+
+	u8 J0[AES_BLOCK_SIZE];
+	memcpy (J0, pNonce, AES_GCM_NONCE_SIZE);
+	PutBE32 (J0 + 12, 1);
+
+	u8 Counter[AES_BLOCK_SIZE];
+	memcpy (Counter, J0, AES_BLOCK_SIZE);
+	PutBE32 (Counter + 12, 2);
+
+	m_AES.EncryptCTR (Counter, pIn, pOut, nLength);
+
+	GHASHStart ();
+	GHASHUpdate (pAAD, nAADLength);		// is padded to a full block
+	GHASHUpdate (pOut, nLength);
+	GHASHFinal (nAADLength, nLength, J0, pTag);
+}
+
+boolean CAESGCM::Decrypt (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+			  const u8 *pIn, u8 *pOut, size_t nLength, const u8 *pTag)
+{
+	assert (pNonce != 0);
+	assert (pTag != 0);
+
+	u8 J0[AES_BLOCK_SIZE];
+	memcpy (J0, pNonce, AES_GCM_NONCE_SIZE);
+	PutBE32 (J0 + 12, 1);
+
+	// authenticate the ciphertext before it is overwritten
+	u8 Tag[AES_GCM_TAG_SIZE];
+	GHASHStart ();
+	GHASHUpdate (pAAD, nAADLength);
+	GHASHUpdate (pIn, nLength);
+	GHASHFinal (nAADLength, nLength, J0, Tag);
+
+	u8 uchDiff = 0;
+	for (unsigned i = 0; i < AES_GCM_TAG_SIZE; i++)
+	{
+		uchDiff |= Tag[i] ^ pTag[i];
+	}
+
+	if (uchDiff != 0)
+	{
+		memset (pOut, 0, nLength);
+
+		return FALSE;
+	}
+
+	u8 Counter[AES_BLOCK_SIZE];
+	memcpy (Counter, J0, AES_BLOCK_SIZE);
+	PutBE32 (Counter + 12, 2);
+
+	m_AES.EncryptCTR (Counter, pIn, pOut, nLength);
+
+	return TRUE;
+}
+
+void CAESGCM::GHASHStart (void)
+{
+	memset (m_GHASH, 0, sizeof m_GHASH);
+	m_nGHASHFill = 0;
+}
+
+void CAESGCM::GHASHUpdate (const u8 *pData, size_t nLength)
+{
+	while (nLength > 0)
+	{
+		if (m_nGHASHFill == 0)
+		{
+			if (nLength >= AES_BLOCK_SIZE)
+			{
+				for (unsigned i = 0; i < AES_BLOCK_SIZE; i++)
+				{
+					m_GHASH[i] ^= pData[i];
+				}
+
+				GFMult (m_GHASH);
+
+				pData += AES_BLOCK_SIZE;
+				nLength -= AES_BLOCK_SIZE;
+
+				continue;
+			}
+		}
+
+		// partial block, the last one of each call is padded with zeros
+		m_GHASH[m_nGHASHFill++] ^= *pData++;
+		nLength--;
+
+		if (   m_nGHASHFill == AES_BLOCK_SIZE
+		    || nLength == 0)
+		{
+			GFMult (m_GHASH);
+			m_nGHASHFill = 0;
+		}
+	}
+}
+
+void CAESGCM::GHASHFinal (size_t nAADLength, size_t nLength, const u8 *pJ0, u8 *pTag)
+{
+	u8 LengthBlock[AES_BLOCK_SIZE];
+	u64 nAADBits = (u64) nAADLength * 8;
+	u64 nBits = (u64) nLength * 8;
+	PutBE32 (LengthBlock,      (u32) (nAADBits >> 32));
+	PutBE32 (LengthBlock + 4,  (u32) nAADBits);
+	PutBE32 (LengthBlock + 8,  (u32) (nBits >> 32));
+	PutBE32 (LengthBlock + 12, (u32) nBits);
+
+	GHASHUpdate (LengthBlock, sizeof LengthBlock);
+
+	m_AES.EncryptBlock (pJ0, pTag);
+	for (unsigned i = 0; i < AES_GCM_TAG_SIZE; i++)
+	{
+		pTag[i] ^= m_GHASH[i];
+	}
+}
+
+void CAESGCM::GFMult (u8 *pX) const
+{
+	unsigned nLow = pX[15] & 0xF;
+	u64 zh = m_HH[nLow];
+	u64 zl = m_HL[nLow];
+
+	for (int i = 15; i >= 0; i--)
+	{
+		nLow = pX[i] & 0xF;
+		unsigned nHigh = pX[i] >> 4;
+
+		unsigned nRem;
+		if (i != 15)
+		{
+			nRem = zl & 0xF;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ (Last4[nRem] << 48);
+			zh ^= m_HH[nLow];
+			zl ^= m_HL[nLow];
+		}
+
+		nRem = zl & 0xF;
+		zl = (zh << 60) | (zl >> 4);
+		zh = (zh >> 4) ^ (Last4[nRem] << 48);
+		zh ^= m_HH[nHigh];
+		zl ^= m_HL[nHigh];
+	}
+
+	PutBE32 (pX,      (u32) (zh >> 32));
+	PutBE32 (pX + 4,  (u32) zh);
+	PutBE32 (pX + 8,  (u32) (zl >> 32));
+	PutBE32 (pX + 12, (u32) zl);
+}
@@ -0,0 +1,139 @@
+//
+// aes.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _tls_aes_h
+#define _tls_aes_h
+
+#include <circle/types.h>
+
+#define AES_BLOCK_SIZE		16
+#define AES_MAX_ROUNDS		14
+
+#define AES_GCM_NONCE_SIZE	12
+#define AES_GCM_TAG_SIZE	16
+
+#if AARCH == 64 && defined (__aarch64__) && __has_include (<arm_neon.h>)
+	#define AES_CRYPTO_EXTENSIONS
+#endif
+
+/// \note On AArch64 the ARMv8 Cryptography Extensions (AESE/AESMC) are used, if the CPU\n
+///	  implements them (detected at runtime). Otherwise a table based implementation\n
+///	  is used, which is not constant-time with respect to cache timing.
+
+class CAES		/// AES block cipher (FIPS 197), encryption direction only
+{
+public:
+	CAES (void);
+	~CAES (void);
+
+	/// \brief Set the key and expand the round keys
+	/// \param pKey Pointer to the key
+	/// \param nKeyLength Length of the key (16 or 32 bytes)
+	/// \return Operation successful?
+	boolean SetKey (const u8 *pKey, unsigned nKeyLength);
+
+	/// \brief Encrypt one block
+	/// \param pIn Plaintext block (AES_BLOCK_SIZE bytes)
+	/// \param pOut Ciphertext block (AES_BLOCK_SIZE bytes, may be equal to pIn)
+	void EncryptBlock (const u8 *pIn, u8 *pOut) const;
+
+	/// \brief Encrypt a number of blocks in counter mode (32-bit big endian counter)
+	/// \param pCounter Initial counter block (AES_BLOCK_SIZE bytes), updated on return
+	/// \param pIn Input data
+	/// \param pOut Output data (may be equal to pIn)
+	/// \param nLength Length of the data (the last block may be partial)
+	void EncryptCTR (u8 *pCounter, const u8 *pIn, u8 *pOut, size_t nLength) const;
+
+	/// \return Are the Cryptography Extensions of the CPU used?
+	static boolean IsAccelerated (void);
+
+private:
+	void EncryptBlockTables (const u8 *pIn, u8 *pOut) const;
+#ifdef AES_CRYPTO_EXTENSIONS
+	void EncryptBlockCE (const u8 *pIn, u8 *pOut) const;
+	void EncryptCTRCE (u8 *pCounter, const u8 *pIn, u8 *pOut, size_t nLength) const;
+#endif
+
+	static void InitTables (void);
+
+private:
+	unsigned m_nRounds;
+	u32 m_RoundKey[4*(AES_MAX_ROUNDS+1)];		// as big endian words
+	u8 m_RoundKeyBytes[16*(AES_MAX_ROUNDS+1)];	// for the Cryptography Extensions
+
+	static boolean s_bTablesValid;
+	static u8 s_SBox[256];
+	static u32 s_TE[4][256];
+
+	static int s_nAccelerated;			// -1 if not checked yet
+};
+
+class CAESGCM		/// AES in Galois/Counter Mode (NIST SP 800-38D), an AEAD cipher
+{
+public:
+	CAESGCM (void);
+	~CAESGCM (void);
+
+	/// \brief Set the key
+	/// \param pKey Pointer to the key
+	/// \param nKeyLength Length of the key (16 or 32 bytes)
+	/// \return Operation successful?
+	boolean SetKey (const u8 *pKey, unsigned nKeyLength);
+
+	/// \brief Encrypt and authenticate a message
+	/// \param pNonce Nonce (AES_GCM_NONCE_SIZE bytes), must never be reused with a key
+	/// \param pAAD Additional authenticated data (may be 0, if nAADLength is 0)
+	/// \param nAADLength Length of the additional authenticated data
+	/// \param pIn Plaintext
+	/// \param pOut Ciphertext (may be equal to pIn)
+	/// \param nLength Length of the message
+	/// \param pTag Authentication tag is returned here (AES_GCM_TAG_SIZE bytes)
+	void Encrypt (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+		      const u8 *pIn, u8 *pOut, size_t nLength, u8 *pTag);
+
+	/// \brief Decrypt and verify a message
+	/// \param pNonce Nonce (AES_GCM_NONCE_SIZE bytes)
+	/// \param pAAD Additional authenticated data (may be 0, if nAADLength is 0)
+	/// \param nAADLength Length of the additional authenticated data
+	/// \param pIn Ciphertext
+	/// \param pOut Plaintext (may be equal to pIn, is cleared on failure)
+	/// \param nLength Length of the message
+	/// \param pTag Received authentication tag (AES_GCM_TAG_SIZE bytes)
+	/// \return Is the message authentic?
+	boolean Decrypt (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+			 const u8 *pIn, u8 *pOut, size_t nLength, const u8 *pTag);
+
+private:
+	void GHASHStart (void);
+	void GHASHUpdate (const u8 *pData, size_t nLength);
+	void GHASHFinal (size_t nAADLength, size_t nLength, const u8 *pJ0, u8 *pTag);
+
+	void GFMult (u8 *pX) const;			// X = X * H
+
+private:
+	CAES m_AES;
+
+	u64 m_HL[16];					// 4-bit multiplication tables
+	u64 m_HH[16];
+
+	u8 m_GHASH[AES_BLOCK_SIZE];
+	unsigned m_nGHASHFill;
+};
+
+#endif
@@ -0,0 +1,315 @@
+//
+// chachapoly.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <tls/chachapoly.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static inline u32 GetLE32 (const u8 *p)
+{
+	return (u32) p[0] | (u32) p[1] << 8 | (u32) p[2] << 16 | (u32) p[3] << 24;
+}
+
+static inline void PutLE32 (u8 *p, u32 x)
+{
+	p[0] = (u8) x;
+	p[1] = (u8) (x >> 8);
+	p[2] = (u8) (x >> 16);
+	p[3] = (u8) (x >> 24);
+}
+
+#define QUARTERROUND(a, b, c, d)			\
+	a += b; d ^= a; d = ROL (d, 16);		\
+	c += d; b ^= c; b = ROL (b, 12);		\
+	a += b; d ^= a; d = ROL (d, 8);			\
+	c += d; b ^= c; b = ROL (b, 7);
+
+CChaCha20Poly1305::CChaCha20Poly1305 (void)
+{
+	memset (m_Key, 0, sizeof m_Key);
+}
+
+CChaCha20Poly1305::~CChaCha20Poly1305 (void)
+{
+	memset (m_Key, 0, sizeof m_Key);
+	memset (m_R, 0, sizeof m_R);
+	memset (m_Pad, 0, sizeof m_Pad);
+}
+
+void CChaCha20Poly1305::SetKey (const u8 *pKey)
+{
+	assert (pKey != 0);
+
+	for (unsigned i = 0; i < 8; i++)
+	{
+		m_Key[i] = GetLE32 (pKey + i*4);
+	}
+}
+
+void CChaCha20Poly1305::Encrypt (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+				 const u8 *pIn, u8 *pOut, size_t nLength, u8 *pTag)
+{
+	assert (pTag != 0);
+
+	ChaCha20 (pNonce, 1, pIn, pOut, nLength);
+
+	ComputeTag (pNonce, pAAD, nAADLength, pOut, nLength, pTag);
+}
+
+boolean CChaCha20Poly1305::Decrypt (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+				    const u8 *pIn, u8 *pOut, size_t nLength, const u8 *pTag)
+{
+	assert (pTag != 0);
+
+	u8 Tag[CHACHA20_POLY1305_TAG_SIZE];
+	ComputeTag (pNonce, pAAD, nAADLength, pIn, nLength, Tag);
+
+	u8 uchDiff = 0;
+	for (unsigned i = 0; i < CHACHA20_POLY1305_TAG_SIZE; i++)
+	{
+		uchDiff |= Tag[i] ^ pTag[i];
+	}
+
+	if (uchDiff != 0)
+	{
+		memset (pOut, 0, nLength);
+
+		return FALSE;
+	}
+
+	ChaCha20 (pNonce, 1, pIn, pOut, nLength);
+
+	return TRUE;
+}
+
+void CChaCha20Poly1305::ChaCha20 (const u8 *pNonce, u32 nCounter,
+				  const u8 *pIn, u8 *pOut, size_t nLength)
+{
+	assert (pNonce != 0);
+
+	u32 Input[16];
+	Input[0] = 0x61707865;			// "expand 32-byte k"
+	Input[1] = 0x3320646E;
+	Input[2] = 0x79622D32;
+	Input[3] = 0x6B206574;
+	memcpy (Input + 4, m_Key, sizeof m_Key);
+	Input[12] = nCounter;
+	Input[13] = GetLE32 (pNonce);
+	Input[14] = GetLE32 (pNonce + 4);
+	Input[15] = GetLE32 (pNonce + 8);
+
+	while (nLength > 0)
+	{
+		u8 KeyStream[64];
+		ChaCha20Block (Input, KeyStream);
+		Input[12]++;
+
+		size_t nBlockLength = nLength < 64 ? nLength : 64;
+		for (unsigned i = 0; i < nBlockLength; i++)
+		{
+			pOut[i] = pIn[i] ^ KeyStream[i];
+		}
+
+		pIn += nBlockLength;
+		pOut += nBlockLength;
+		nLength -= nBlockLength;
+	}
+}
+
+void CChaCha20Poly1305::ChaCha20Block (const u32 *pInput, u8 *pOutput)
+{
+	u32 x0  = pInput[0],  x1  = pInput[1],  x2  = pInput[2],  x3  = pInput[3];
+	u32 x4  = pInput[4],  x5  = pInput[5],  x6  = pInput[6],  x7  = pInput[7];
+	u32 x8  = pInput[8],  x9  = pInput[9],  x10 = pInput[10], x11 = pInput[11];
+	u32 x12 = pInput[12], x13 = pInput[13], x14 = pInput[14], x15 = pInput[15];
+
+	for (unsigned i = 0; i < 10; i++)
+	{
+		QUARTERROUND (x0, x4, x8,  x12)
+		QUARTERROUND (x1, x5, x9,  x13)
+		QUARTERROUND (x2, x6, x10, x14)
+		QUARTERROUND (x3, x7, x11, x15)
+
+		QUARTERROUND (x0, x5, x10, x15)
+		QUARTERROUND (x1, x6, x11, x12)
+		QUARTERROUND (x2, x7, x8,  x13)
+		QUARTERROUND (x3, x4, x9,  x14)
+	}
+
+	const u32 x[16] = {x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15};
+	for (unsigned i = 0; i < 16; i++)
+	{
+		PutLE32 (pOutput + i*4, x[i] + pInput[i]);
+	}
+}
+
+void CChaCha20Poly1305::ComputeTag (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+				    const u8 *pCipherText, size_t nLength, u8 *pTag)
+{
+	// the one-time Poly1305 key is the first half of ChaCha20 block 0
+	u8 PolyKey[64];
+	memset (PolyKey, 0, sizeof PolyKey);
+	ChaCha20 (pNonce, 0, PolyKey, PolyKey, sizeof PolyKey);
+
+	Poly1305Init (PolyKey);
+	memset (PolyKey, 0, sizeof PolyKey);
+
+	Poly1305Update (pAAD, nAADLength);
+	Poly1305Update (pCipherText, nLength);
+
+	u8 Lengths[16];
+	PutLE32 (Lengths,      (u32) nAADLength);
+	PutLE32 (Lengths + 4,  (u32) ((u64) nAADLength >> 32));
+	PutLE32 (Lengths + 8,  (u32) nLength);
+	PutLE32 (Lengths + 12, (u32) ((u64) nLength >> 32));
+	Poly1305Blocks (Lengths, sizeof Lengths, 1 << 24);
+
+	Poly1305Final (pTag);
+}
+
+void CChaCha20Poly1305::Poly1305Init (const u8 *pKey)
+{
+	// r &= 0xFFFFFFC0FFFFFFC0FFFFFFC0FFFFFFF
+	m_R[0] = (GetLE32 (pKey)      ) & 0x3FFFFFF;
+	m_R[1] = (GetLE32 (pKey +  3) >> 2) & 0x3FFFF03;
+	m_R[2] = (GetLE32 (pKey +  6) >> 4) & 0x3FFC0FF;
+	m_R[3] = (GetLE32 (pKey +  9) >> 6) & 0x3F03FFF;
+	m_R[4] = (GetLE32 (pKey + 12) >> 8) & 0x00FFFFF;
+
+	memset (m_H, 0, sizeof m_H);
+
+	for (unsigned i = 0; i < 4; i++)
+	{
+		m_Pad[i] = GetLE32 (pKey + 16 + i*4);
+	}
+}
+
+void CChaCha20Poly1305::Poly1305Blocks (const u8 *pData, size_t nLength, u32 nHighBit)
+{
+	const u32 r0 = m_R[0], r1 = m_R[1], r2 = m_R[2], r3 = m_R[3], r4 = m_R[4];
+	const u32 s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+
+	u32 h0 = m_H[0], h1 = m_H[1], h2 = m_H[2], h3 = m_H[3], h4 = m_H[4];
+
+	while (nLength >= 16)
+	{
+		// h += m[i]
+		h0 += (GetLE32 (pData)      ) & 0x3FFFFFF;
+		h1 += (GetLE32 (pData +  3) >> 2) & 0x3FFFFFF;
+		h2 += (GetLE32 (pData +  6) >> 4) & 0x3FFFFFF;
+		h3 += (GetLE32 (pData +  9) >> 6) & 0x3FFFFFF;
+		h4 += (GetLE32 (pData + 12) >> 8) | nHighBit;
+
+		// h *= r (mod 2^130 - 5)
+		u64 d0 =   (u64) h0 * r0 + (u64) h1 * s4 + (u64) h2 * s3
+			 + (u64) h3 * s2 + (u64) h4 * s1;
+		u64 d1 =   (u64) h0 * r1 + (u64) h1 * r0 + (u64) h2 * s4
+			 + (u64) h3 * s3 + (u64) h4 * s2;
+		u64 d2 =   (u64) h0 * r2 + (u64) h1 * r1 + (u64) h2 * r0
+			 + (u64) h3 * s4 + (u64) h4 * s3;
+		u64 d3 =   (u64) h0 * r3 + (u64) h1 * r2 + (u64) h2 * r1
+			 + (u64) h3 * r0 + (u64) h4 * s4;
+		u64 d4 =   (u64) h0 * r4 + (u64) h1 * r3 + (u64) h2 * r2
+			 + (u64) h3 * r1 + (u64) h4 * r0;
+
+		// partial reduction
+		u32 c;
+		c = (u32) (d0 >> 26); h0 = (u32) d0 & 0x3FFFFFF;
+		d1 += c; c = (u32) (d1 >> 26); h1 = (u32) d1 & 0x3FFFFFF;
+		d2 += c; c = (u32) (d2 >> 26); h2 = (u32) d2 & 0x3FFFFFF;
+		d3 += c; c = (u32) (d3 >> 26); h3 = (u32) d3 & 0x3FFFFFF;
+		d4 += c; c = (u32) (d4 >> 26); h4 = (u32) d4 & 0x3FFFFFF;
+		h0 += c * 5; c = h0 >> 26; h0 &= 0x3FFFFFF;
+		h1 += c;
+
+		pData += 16;
+		nLength -= 16;
+	}
+
+	m_H[0] = h0; m_H[1] = h1; m_H[2] = h2; m_H[3] = h3; m_H[4] = h4;
+}
+
+void CChaCha20Poly1305::Poly1305Update (const u8 *pData, size_t nLength)
+{
+	size_t nFullLength = nLength & ~(size_t) 15;
+	Poly1305Blocks (pData, nFullLength, 1 << 24);
+
+	if (nLength > nFullLength)
+	{
+		// the AEAD construction pads with zeros to a multiple of 16 bytes
+		u8 Block[16];
+		memset (Block, 0, sizeof Block);
+		memcpy (Block, pData + nFullLength, nLength - nFullLength);
+
+		Poly1305Blocks (Block, sizeof Block, 1 << 24);
+	}
+}
+
+void CChaCha20Poly1305::Poly1305Final (u8 *pTag)
+{
+	u32 h0 = m_H[0], h1 = m_H[1], h2 = m_H[2], h3 = m_H[3], h4 = m_H[4];
+
+	// fully carry h
+	u32 c;
+	c = h1 >> 26; h1 &= 0x3FFFFFF;
+	h2 += c; c = h2 >> 26; h2 &= 0x3FFFFFF;
+	h3 += c; c = h3 >> 26; h3 &= 0x3FFFFFF;
+	h4 += c; c = h4 >> 26; h4 &= 0x3FFFFFF;
+	h0 += c * 5; c = h0 >> 26; h0 &= 0x3FFFFFF;
+	h1 += c;
+
+	// compute h + -p
+	u32 g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3FFFFFF;
+	u32 g1 = h1 + c; c = g1 >> 26; g1 &= 0x3FFFFFF;
+	u32 g2 = h2 + c; c = g2 >> 26; g2 &= 0x3FFFFFF;
+	u32 g3 = h3 + c; c = g3 >> 26; g3 &= 0x3FFFFFF;
+	u32 g4 = h4 + c - (1 << 26);
+
+	// select h if h < p, or h + -p if h >= p (without branches)
+	u32 nMask = (g4 >> 31) - 1;
+	g0 &= nMask; g1 &= nMask; g2 &= nMask; g3 &= nMask; g4 &= nMask;
+	nMask = ~nMask;
+	h0 = (h0 & nMask) | g0;
+	h1 = (h1 & nMask) | g1;
+	h2 = (h2 & nMask) | g2;
+	h3 = (h3 & nMask) | g3;
+	h4 = (h4 & nMask) | g4;
+
+	// h = h % 2^128
+	h0 = (h0      ) | (h1 << 26);
+	h1 = (h1 >>  6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 <<  8);
+
+	// tag = (h + pad) % 2^128
+	u64 f;
+	f = (u64) h0 + m_Pad[0]            ; h0 = (u32) f;
+	f = (u64) h1 + m_Pad[1] + (f >> 32); h1 = (u32) f;
+	f = (u64) h2 + m_Pad[2] + (f >> 32); h2 = (u32) f;
+	f = (u64) h3 + m_Pad[3] + (f >> 32); h3 = (u32) f;
+
+	PutLE32 (pTag,      h0);
+	PutLE32 (pTag + 4,  h1);
+	PutLE32 (pTag + 8,  h2);
+	PutLE32 (pTag + 12, h3);
+
+	memset (m_H, 0, sizeof m_H);
+}
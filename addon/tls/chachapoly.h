@@ -0,0 +1,93 @@
+//
+// chachapoly.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _tls_chachapoly_h
+#define _tls_chachapoly_h
+
+#include <circle/types.h>
+
+#define CHACHA20_KEY_SIZE		32
+#define CHACHA20_POLY1305_NONCE_SIZE	12
+#define CHACHA20_POLY1305_TAG_SIZE	16
+
+/// \note ChaCha20 uses additions, rotations and XORs only, so it runs in constant time\n
+///	  and is faster than table based AES on CPUs without the Cryptography Extensions.
+
+class CChaCha20Poly1305		/// ChaCha20-Poly1305 AEAD cipher (RFC 8439)
+{
+public:
+	CChaCha20Poly1305 (void);
+	~CChaCha20Poly1305 (void);
+
+	/// \brief Set the key
+	/// \param pKey Pointer to the key (CHACHA20_KEY_SIZE bytes)
+	void SetKey (const u8 *pKey);
+
+	/// \brief Encrypt and authenticate a message
+	/// \param pNonce Nonce (CHACHA20_POLY1305_NONCE_SIZE bytes), must never be reused with a key
+	/// \param pAAD Additional authenticated data (may be 0, if nAADLength is 0)
+	/// \param nAADLength Length of the additional authenticated data
+	/// \param pIn Plaintext
+	/// \param pOut Ciphertext (may be equal to pIn)
+	/// \param nLength Length of the message
+	/// \param pTag Authentication tag is returned here (CHACHA20_POLY1305_TAG_SIZE bytes)
+	void Encrypt (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+		      const u8 *pIn, u8 *pOut, size_t nLength, u8 *pTag);
+
+	/// \brief Decrypt and verify a message
+	/// \param pNonce Nonce (CHACHA20_POLY1305_NONCE_SIZE bytes)
+	/// \param pAAD Additional authenticated data (may be 0, if nAADLength is 0)
+	/// \param nAADLength Length of the additional authenticated data
+	/// \param pIn Ciphertext
+	/// \param pOut Plaintext (may be equal to pIn, is cleared on failure)
+	/// \param nLength Length of the message
+	/// \param pTag Received authentication tag (CHACHA20_POLY1305_TAG_SIZE bytes)
+	/// \return Is the message authentic?
+	boolean Decrypt (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+			 const u8 *pIn, u8 *pOut, size_t nLength, const u8 *pTag);
+
+	/// \brief Encrypt or decrypt data with the ChaCha20 stream cipher only
+	/// \param pNonce Nonce (CHACHA20_POLY1305_NONCE_SIZE bytes)
+	/// \param nCounter Initial block counter
+	/// \param pIn Input data
+	/// \param pOut Output data (may be equal to pIn)
+	/// \param nLength Length of the data
+	void ChaCha20 (const u8 *pNonce, u32 nCounter, const u8 *pIn, u8 *pOut, size_t nLength);
+
+private:
+	void ChaCha20Block (const u32 *pInput, u8 *pOutput);
+
+	void ComputeTag (const u8 *pNonce, const u8 *pAAD, size_t nAADLength,
+			 const u8 *pCipherText, size_t nLength, u8 *pTag);
+
+	// Poly1305 with 26-bit limbs
+	void Poly1305Init (const u8 *pKey);
+	void Poly1305Blocks (const u8 *pData, size_t nLength, u32 nHighBit);
+	void Poly1305Update (const u8 *pData, size_t nLength);	// pads to 16 bytes
+	void Poly1305Final (u8 *pTag);
+
+private:
+	u32 m_Key[8];
+
+	u32 m_R[5];
+	u32 m_H[5];
+	u32 m_Pad[4];
+};
+
+#endif
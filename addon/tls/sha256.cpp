@@ -0,0 +1,308 @@
+//
+// sha256.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <tls/sha256.h>
+#include <circle/util.h>
+#include <assert.h>
+
+static const u32 K[64] =
+{
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+CSHA256::CSHA256 (void)
+{
+	Reset ();
+}
+
+CSHA256::~CSHA256 (void)
+{
+}
+
+void CSHA256::Reset (void)
+{
+	m_State[0] = 0x6A09E667;
+	m_State[1] = 0xBB67AE85;
+	m_State[2] = 0x3C6EF372;
+	m_State[3] = 0xA54FF53A;
+	m_State[4] = 0x510E527F;
+	m_State[5] = 0x9B05688C;
+	m_State[6] = 0x1F83D9AB;
+	m_State[7] = 0x5BE0CD19;
+
+	m_nTotalLength = 0;
+	m_nBufferLength = 0;
+}
+
+void CSHA256::Update (const void *pData, size_t nLength)
+{
+	const u8 *pIn = (const u8 *) pData;
+	m_nTotalLength += nLength;
+
+	if (m_nBufferLength > 0)
+	{
+		size_t nFill = SHA256_BLOCK_SIZE - m_nBufferLength;
+		if (nFill > nLength)
+		{
+			nFill = nLength;
+		}
+
+		memcpy (m_Buffer + m_nBufferLength, pIn, nFill);
+		m_nBufferLength += nFill;
+		pIn += nFill;
+		nLength -= nFill;
+
+		if (m_nBufferLength < SHA256_BLOCK_SIZE)
+		{
+			return;
+		}
+
+		ProcessBlock (m_Buffer);
+		m_nBufferLength = 0;
+	}
+
+	// full blocks are processed directly from the caller's buffer
+	while (nLength >= SHA256_BLOCK_SIZE)
+	{
+		ProcessBlock (pIn);
+		pIn += SHA256_BLOCK_SIZE;
+		nLength -= SHA256_BLOCK_SIZE;
+	}
+
+	if (nLength > 0)
+	{
+		memcpy (m_Buffer, pIn, nLength);
+		m_nBufferLength = nLength;
+	}
+}
+
+void CSHA256::Final (u8 *pDigest)
+{
+	assert (pDigest != 0);
+
+	u64 nBits = m_nTotalLength * 8;
+
+	m_Buffer[m_nBufferLength++] = 0x80;
+	if (m_nBufferLength > SHA256_BLOCK_SIZE-8)
+	{
+		memset (m_Buffer + m_nBufferLength, 0, SHA256_BLOCK_SIZE - m_nBufferLength);
+		ProcessBlock (m_Buffer);
+		m_nBufferLength = 0;
+	}
+
+	memset (m_Buffer + m_nBufferLength, 0, SHA256_BLOCK_SIZE-8 - m_nBufferLength);
+	for (unsigned i = 0; i < 8; i++)
+	{
+		m_Buffer[SHA256_BLOCK_SIZE-1 - i] = (u8) (nBits >> (i * 8));
+	}
+	ProcessBlock (m_Buffer);
+
+	for (unsigned i = 0; i < 8; i++)
+	{
+		pDigest[i*4]   = (u8) (m_State[i] >> 24);
+		pDigest[i*4+1] = (u8) (m_State[i] >> 16);
+		pDigest[i*4+2] = (u8) (m_State[i] >> 8);
+		pDigest[i*4+3] = (u8) m_State[i];
+	}
+
+	Reset ();
+}
+
+void CSHA256::Hash (const void *pData, size_t nLength, u8 *pDigest)
+{
+	CSHA256 SHA256;
+	SHA256.Update (pData, nLength);
+	SHA256.Final (pDigest);
+}
+
+void CSHA256::HMAC (const void *pKey, size_t nKeyLength,
+		    const void *pData, size_t nLength, u8 *pMAC)
+{
+	u8 Key[SHA256_BLOCK_SIZE];
+	memset (Key, 0, sizeof Key);
+	if (nKeyLength > SHA256_BLOCK_SIZE)
+	{
+		Hash (pKey, nKeyLength, Key);
+	}
+	else
+	{
+		memcpy (Key, pKey, nKeyLength);
+	}
+
+	u8 Pad[SHA256_BLOCK_SIZE];
+	for (unsigned i = 0; i < SHA256_BLOCK_SIZE; i++)
+	{
+		Pad[i] = Key[i] ^ 0x36;
+	}
+
+	u8 InnerHash[SHA256_DIGEST_SIZE];
+	CSHA256 SHA256;
+	SHA256.Update (Pad, sizeof Pad);
+	SHA256.Update (pData, nLength);
+	SHA256.Final (InnerHash);
+
+	for (unsigned i = 0; i < SHA256_BLOCK_SIZE; i++)
+	{
+		Pad[i] = Key[i] ^ 0x5C;
+	}
+
+	SHA256.Update (Pad, sizeof Pad);
+	SHA256.Update (InnerHash, sizeof InnerHash);
+	SHA256.Final (pMAC);
+}
+
+void CSHA256::HKDFExtract (const void *pSalt, size_t nSaltLength,
+			   const void *pIKM, size_t nIKMLength, u8 *pPRK)
+{
+	static const u8 NoSalt[SHA256_DIGEST_SIZE] = {0};
+	if (pSalt == 0)
+	{
+		pSalt = NoSalt;
+		nSaltLength = sizeof NoSalt;
+	}
+
+	HMAC (pSalt, nSaltLength, pIKM, nIKMLength, pPRK);
+}
+
+void CSHA256::HKDFExpand (const u8 *pPRK, const void *pInfo, size_t nInfoLength,
+			  u8 *pOKM, size_t nOKMLength)
+{
+	assert (pPRK != 0);
+	assert (pOKM != 0);
+	assert (nOKMLength <= 255 * SHA256_DIGEST_SIZE);
+
+	// T(i) = HMAC (PRK, T(i-1) | info | i), the HMAC is calculated in place
+	u8 Key[SHA256_BLOCK_SIZE];
+	memset (Key, 0, sizeof Key);
+	memcpy (Key, pPRK, SHA256_DIGEST_SIZE);
+
+	u8 Pad[SHA256_BLOCK_SIZE];
+	u8 T[SHA256_DIGEST_SIZE];
+	size_t nTLength = 0;
+
+	for (u8 nCounter = 1; nOKMLength > 0; nCounter++)
+	{
+		CSHA256 SHA256;
+
+		for (unsigned i = 0; i < SHA256_BLOCK_SIZE; i++)
+		{
+			Pad[i] = Key[i] ^ 0x36;
+		}
+		SHA256.Update (Pad, sizeof Pad);
+		SHA256.Update (T, nTLength);
+		SHA256.Update (pInfo, nInfoLength);
+		SHA256.Update (&nCounter, 1);
+		SHA256.Final (T);
+
+		for (unsigned i = 0; i < SHA256_BLOCK_SIZE; i++)
+		{
+			Pad[i] = Key[i] ^ 0x5C;
+		}
+		SHA256.Update (Pad, sizeof Pad);
+		SHA256.Update (T, sizeof T);
+		SHA256.Final (T);
+		nTLength = sizeof T;
+
+		size_t nCopy = nOKMLength < sizeof T ? nOKMLength : sizeof T;
+		memcpy (pOKM, T, nCopy);
+		pOKM += nCopy;
+		nOKMLength -= nCopy;
+	}
+}
+
+void CSHA256::HKDFExpandLabel (const u8 *pSecret, const char *pLabel,
+			       const void *pContext, size_t nContextLength,
+			       u8 *pOKM, size_t nOKMLength)
+{
+	assert (pLabel != 0);
+	size_t nLabelLength = strlen (pLabel);
+	assert (6 + nLabelLength <= 255);
+	assert (nContextLength <= 255);
+
+	// struct HkdfLabel { u16 length; opaque label<7..255>; opaque context<0..255>; }
+	u8 Info[2 + 1 + 255 + 1 + 255];
+	unsigned nInfoLength = 0;
+	Info[nInfoLength++] = (u8) (nOKMLength >> 8);
+	Info[nInfoLength++] = (u8) nOKMLength;
+	Info[nInfoLength++] = (u8) (6 + nLabelLength);
+	memcpy (Info + nInfoLength, "tls13 ", 6);
+	nInfoLength += 6;
+	memcpy (Info + nInfoLength, pLabel, nLabelLength);
+	nInfoLength += nLabelLength;
+	Info[nInfoLength++] = (u8) nContextLength;
+	if (nContextLength > 0)
+	{
+		assert (pContext != 0);
+		memcpy (Info + nInfoLength, pContext, nContextLength);
+		nInfoLength += nContextLength;
+	}
+
+	HKDFExpand (pSecret, Info, nInfoLength, pOKM, nOKMLength);
+}
+
+void CSHA256::ProcessBlock (const u8 *pBlock)
+{
+	u32 W[64];
+	for (unsigned i = 0; i < 16; i++)
+	{
+		W[i] =   (u32) pBlock[i*4] << 24 | (u32) pBlock[i*4+1] << 16
+		       | (u32) pBlock[i*4+2] << 8 | pBlock[i*4+3];
+	}
+
+	for (unsigned i = 16; i < 64; i++)
+	{
+		u32 s0 = ROR (W[i-15], 7) ^ ROR (W[i-15], 18) ^ (W[i-15] >> 3);
+		u32 s1 = ROR (W[i-2], 17) ^ ROR (W[i-2], 19) ^ (W[i-2] >> 10);
+		W[i] = W[i-16] + s0 + W[i-7] + s1;
+	}
+
+	u32 a = m_State[0], b = m_State[1], c = m_State[2], d = m_State[3];
+	u32 e = m_State[4], f = m_State[5], g = m_State[6], h = m_State[7];
+
+	for (unsigned i = 0; i < 64; i++)
+	{
+		u32 S1 = ROR (e, 6) ^ ROR (e, 11) ^ ROR (e, 25);
+		u32 ch = (e & f) ^ (~e & g);
+		u32 t1 = h + S1 + ch + K[i] + W[i];
+		u32 S0 = ROR (a, 2) ^ ROR (a, 13) ^ ROR (a, 22);
+		u32 maj = (a & b) ^ (a & c) ^ (b & c);
+		u32 t2 = S0 + maj;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	m_State[0] += a; m_State[1] += b; m_State[2] += c; m_State[3] += d;
+	m_State[4] += e; m_State[5] += f; m_State[6] += g; m_State[7] += h;
+}
@@ -0,0 +1,97 @@
+//
+// sha256.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _tls_sha256_h
+#define _tls_sha256_h
+
+#include <circle/types.h>
+
+#define SHA256_BLOCK_SIZE	64
+#define SHA256_DIGEST_SIZE	32
+
+class CSHA256		/// SHA-256 hash function (FIPS 180-4) and derived functions
+{
+public:
+	CSHA256 (void);
+	~CSHA256 (void);
+
+	/// \brief Start a new hash calculation
+	void Reset (void);
+
+	/// \brief Add data to the hash calculation
+	/// \param pData Pointer to the data
+	/// \param nLength Length of the data
+	void Update (const void *pData, size_t nLength);
+
+	/// \brief Finish the hash calculation
+	/// \param pDigest The hash value is returned here (SHA256_DIGEST_SIZE bytes)
+	void Final (u8 *pDigest);
+
+	/// \brief Calculate the hash value of a message in one step
+	static void Hash (const void *pData, size_t nLength, u8 *pDigest);
+
+	/// \brief Calculate a HMAC-SHA256 (RFC 2104)
+	/// \param pKey Pointer to the key
+	/// \param nKeyLength Length of the key
+	/// \param pData Pointer to the message
+	/// \param nLength Length of the message
+	/// \param pMAC The MAC is returned here (SHA256_DIGEST_SIZE bytes)
+	static void HMAC (const void *pKey, size_t nKeyLength,
+			  const void *pData, size_t nLength, u8 *pMAC);
+
+	/// \brief HKDF-Extract (RFC 5869)
+	/// \param pSalt Pointer to the salt (0 for none)
+	/// \param nSaltLength Length of the salt
+	/// \param pIKM Pointer to the input keying material
+	/// \param nIKMLength Length of the input keying material
+	/// \param pPRK The pseudorandom key is returned here (SHA256_DIGEST_SIZE bytes)
+	static void HKDFExtract (const void *pSalt, size_t nSaltLength,
+				 const void *pIKM, size_t nIKMLength, u8 *pPRK);
+
+	/// \brief HKDF-Expand (RFC 5869)
+	/// \param pPRK Pointer to the pseudorandom key (SHA256_DIGEST_SIZE bytes)
+	/// \param pInfo Pointer to the context information
+	/// \param nInfoLength Length of the context information
+	/// \param pOKM The output keying material is returned here
+	/// \param nOKMLength Requested length of the output keying material (<= 255*32)
+	static void HKDFExpand (const u8 *pPRK, const void *pInfo, size_t nInfoLength,
+				u8 *pOKM, size_t nOKMLength);
+
+	/// \brief HKDF-Expand-Label from TLS 1.3 (RFC 8446 section 7.1)
+	/// \param pSecret Pointer to the secret (SHA256_DIGEST_SIZE bytes)
+	/// \param pLabel Label without the "tls13 " prefix (e.g. "key")
+	/// \param pContext Pointer to the context (0 for none)
+	/// \param nContextLength Length of the context (<= 255)
+	/// \param pOKM The output keying material is returned here
+	/// \param nOKMLength Requested length of the output keying material
+	static void HKDFExpandLabel (const u8 *pSecret, const char *pLabel,
+				     const void *pContext, size_t nContextLength,
+				     u8 *pOKM, size_t nOKMLength);
+
+private:
+	void ProcessBlock (const u8 *pBlock);
+
+private:
+	u32 m_State[8];
+	u64 m_nTotalLength;
+	u8 m_Buffer[SHA256_BLOCK_SIZE];
+	unsigned m_nBufferLength;
+};
+
+#endif
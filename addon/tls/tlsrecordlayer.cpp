@@ -0,0 +1,524 @@
+//
+// tlsrecordlayer.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <tls/tlsrecordlayer.h>
+#include <circle/net/in.h>
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define TLS_LEGACY_VERSION	0x0303
+
+static const char FromTLS[] = "tls";
+
+CTLSRecordLayer::CTLSRecordLayer (CSocket *pSocket)
+:	m_pSocket (pSocket),
+	m_bClosed (FALSE),
+	m_bCloseSent (FALSE),
+	m_nPlainOffset (0),
+	m_nPlainLength (0),
+	m_nRxOffset (0),
+	m_nRxLength (0)
+{
+	assert (m_pSocket != 0);
+
+	m_ReadState.Suite = TLSCipherNone;
+	m_WriteState.Suite = TLSCipherNone;
+}
+
+CTLSRecordLayer::~CTLSRecordLayer (void)
+{
+	memset (m_ReadState.IV, 0, TLS_IV_SIZE);
+	memset (m_WriteState.IV, 0, TLS_IV_SIZE);
+
+	m_pSocket = 0;
+}
+
+boolean CTLSRecordLayer::SetReadKey (TTLSCipherSuite Suite, const u8 *pKey, const u8 *pIV)
+{
+	m_nPlainOffset = 0;
+	m_nPlainLength = 0;
+
+	return SetKey (&m_ReadState, Suite, pKey, pIV);
+}
+
+boolean CTLSRecordLayer::SetWriteKey (TTLSCipherSuite Suite, const u8 *pKey, const u8 *pIV)
+{
+	return SetKey (&m_WriteState, Suite, pKey, pIV);
+}
+
+boolean CTLSRecordLayer::SetReadSecret (TTLSCipherSuite Suite, const u8 *pSecret)
+{
+	m_nPlainOffset = 0;
+	m_nPlainLength = 0;
+
+	return SetSecret (&m_ReadState, Suite, pSecret);
+}
+
+boolean CTLSRecordLayer::SetWriteSecret (TTLSCipherSuite Suite, const u8 *pSecret)
+{
+	return SetSecret (&m_WriteState, Suite, pSecret);
+}
+
+int CTLSRecordLayer::SendRecord (TTLSContentType Type, const void *pData, unsigned nLength)
+{
+	if (   m_bClosed
+	    || m_bCloseSent)
+	{
+		return -1;
+	}
+
+	assert (pData != 0);
+	assert (0 < nLength && nLength <= TLS_MAX_PLAINTEXT);
+
+	u8 *pContent = m_TxRecord + TLS_RECORD_HEADER_SIZE;
+	memcpy (pContent, pData, nLength);
+
+	unsigned nRecordLength = nLength;
+	u8 uchOuterType = (u8) Type;
+
+	if (m_WriteState.Suite != TLSCipherNone)
+	{
+		// TLSInnerPlaintext without padding, followed by the tag
+		pContent[nRecordLength++] = (u8) Type;
+		nRecordLength += TLS_TAG_SIZE;
+
+		uchOuterType = TLSContentApplicationData;
+	}
+
+	m_TxRecord[0] = uchOuterType;
+	m_TxRecord[1] = TLS_LEGACY_VERSION >> 8;
+	m_TxRecord[2] = TLS_LEGACY_VERSION & 0xFF;
+	m_TxRecord[3] = (u8) (nRecordLength >> 8);
+	m_TxRecord[4] = (u8) nRecordLength;
+
+	if (m_WriteState.Suite != TLSCipherNone)
+	{
+		u8 Nonce[TLS_IV_SIZE];
+		GetNonce (&m_WriteState, Nonce);
+
+		unsigned nInnerLength = nRecordLength - TLS_TAG_SIZE;
+		u8 *pTag = pContent + nInnerLength;
+
+		// the record header is the additional data
+		if (m_WriteState.Suite == TLSCipherAES128GCMSHA256)
+		{
+			m_WriteState.AESGCM.Encrypt (Nonce, m_TxRecord, TLS_RECORD_HEADER_SIZE,
+						     pContent, pContent, nInnerLength, pTag);
+		}
+		else
+		{
+			m_WriteState.ChaCha20Poly1305.Encrypt (Nonce, m_TxRecord, TLS_RECORD_HEADER_SIZE,
+							       pContent, pContent, nInnerLength, pTag);
+		}
+	}
+
+	assert (m_pSocket != 0);
+	unsigned nTotalLength = TLS_RECORD_HEADER_SIZE + nRecordLength;
+	if (m_pSocket->Send (m_TxRecord, nTotalLength, 0) != (int) nTotalLength)
+	{
+		m_bClosed = TRUE;
+
+		return -1;
+	}
+
+	return nLength;
+}
+
+int CTLSRecordLayer::ReceiveRecord (TTLSContentType *pType, void *pBuffer, unsigned nSize)
+{
+	assert (pType != 0);
+	assert (pBuffer != 0);
+
+	u8 *pContent;
+	int nLength = ReadRecord (pType, &pContent);
+	if (nLength < 0)
+	{
+		return nLength;
+	}
+
+	if ((unsigned) nLength > nSize)
+	{
+		return Fail (TLS_ALERT_RECORD_OVERFLOW);
+	}
+
+	memcpy (pBuffer, pContent, nLength);
+
+	return nLength;
+}
+
+int CTLSRecordLayer::Send (const void *pBuffer, unsigned nLength)
+{
+	const u8 *pData = (const u8 *) pBuffer;
+	assert (pData != 0);
+
+	unsigned nSent = 0;
+	while (nSent < nLength)
+	{
+		unsigned nChunk = nLength - nSent;
+		if (nChunk > TLS_MAX_PLAINTEXT)
+		{
+			nChunk = TLS_MAX_PLAINTEXT;
+		}
+
+		if (SendRecord (TLSContentApplicationData, pData + nSent, nChunk) < 0)
+		{
+			return -1;
+		}
+
+		nSent += nChunk;
+	}
+
+	return nSent;
+}
+
+int CTLSRecordLayer::Receive (void *pBuffer, unsigned nSize, int nFlags)
+{
+	assert (pBuffer != 0);
+
+	while (m_nPlainOffset >= m_nPlainLength)
+	{
+		if (m_bClosed)
+		{
+			return -1;
+		}
+
+		if (   (nFlags & MSG_DONTWAIT)
+		    && m_nRxOffset >= m_nRxLength)
+		{
+			assert (m_pSocket != 0);
+			int nResult = m_pSocket->Receive (m_RxBuffer, sizeof m_RxBuffer, MSG_DONTWAIT);
+			if (nResult == 0)
+			{
+				return 0;
+			}
+			else if (nResult < 0)
+			{
+				m_bClosed = TRUE;
+
+				return -1;
+			}
+
+			m_nRxOffset = 0;
+			m_nRxLength = nResult;
+		}
+
+		// a started record is received completely
+		TTLSContentType Type;
+		u8 *pContent;
+		int nLength = ReadRecord (&Type, &pContent);
+		if (nLength < 0)
+		{
+			return nLength;
+		}
+
+		switch (Type)
+		{
+		case TLSContentApplicationData:
+			m_nPlainOffset = pContent - m_RxRecord;
+			m_nPlainLength = m_nPlainOffset + nLength;
+			break;
+
+		case TLSContentHandshake:
+		case TLSContentChangeCipherSpec:
+			break;
+
+		default:
+			return Fail (TLS_ALERT_UNEXPECTED_MESSAGE);
+		}
+	}
+
+	unsigned nChunk = m_nPlainLength - m_nPlainOffset;
+	if (nChunk > nSize)
+	{
+		nChunk = nSize;
+	}
+
+	memcpy (pBuffer, m_RxRecord + m_nPlainOffset, nChunk);
+	m_nPlainOffset += nChunk;
+
+	return nChunk;
+}
+
+boolean CTLSRecordLayer::SendAlert (u8 uchLevel, u8 uchDescription)
+{
+	u8 Alert[2] = {uchLevel, uchDescription};
+
+	return SendRecord (TLSContentAlert, Alert, sizeof Alert) == sizeof Alert;
+}
+
+boolean CTLSRecordLayer::Close (void)
+{
+	if (   m_bClosed
+	    || m_bCloseSent)
+	{
+		return FALSE;
+	}
+
+	boolean bOK = SendAlert (TLS_ALERT_WARNING, TLS_ALERT_CLOSE_NOTIFY);
+
+	m_bCloseSent = TRUE;
+
+	return bOK;
+}
+
+boolean CTLSRecordLayer::IsClosed (void) const
+{
+	return m_bClosed;
+}
+
+int CTLSRecordLayer::ReadRecord (TTLSContentType *pType, u8 **ppContent)
+{
+	assert (pType != 0);
+	assert (ppContent != 0);
+
+	if (m_bClosed)
+	{
+		return -1;
+	}
+
+	m_nPlainOffset = 0;
+	m_nPlainLength = 0;
+
+	if (!Read (m_RxRecord, TLS_RECORD_HEADER_SIZE))
+	{
+		return -1;
+	}
+
+	unsigned nRecordLength = (unsigned) m_RxRecord[3] << 8 | m_RxRecord[4];
+	if (nRecordLength > TLS_MAX_CIPHERTEXT)
+	{
+		return Fail (TLS_ALERT_RECORD_OVERFLOW);
+	}
+
+	u8 *pContent = m_RxRecord + TLS_RECORD_HEADER_SIZE;
+	if (!Read (pContent, nRecordLength))
+	{
+		return -1;
+	}
+
+	u8 uchType = m_RxRecord[0];
+
+	// ChangeCipherSpec records are never protected (middlebox compatibility mode)
+	if (   m_ReadState.Suite == TLSCipherNone
+	    || uchType == TLSContentChangeCipherSpec)
+	{
+		if (nRecordLength > TLS_MAX_PLAINTEXT)
+		{
+			return Fail (TLS_ALERT_RECORD_OVERFLOW);
+		}
+
+		*pType = (TTLSContentType) uchType;
+		*ppContent = pContent;
+
+		return nRecordLength;
+	}
+
+	if (uchType != TLSContentApplicationData)
+	{
+		return Fail (TLS_ALERT_UNEXPECTED_MESSAGE);
+	}
+
+	if (nRecordLength < TLS_TAG_SIZE + 1)
+	{
+		return Fail (TLS_ALERT_DECODE_ERROR);
+	}
+
+	u8 Nonce[TLS_IV_SIZE];
+	GetNonce (&m_ReadState, Nonce);
+
+	unsigned nInnerLength = nRecordLength - TLS_TAG_SIZE;
+	const u8 *pTag = pContent + nInnerLength;
+
+	boolean bOK;
+	if (m_ReadState.Suite == TLSCipherAES128GCMSHA256)
+	{
+		bOK = m_ReadState.AESGCM.Decrypt (Nonce, m_RxRecord, TLS_RECORD_HEADER_SIZE,
+						  pContent, pContent, nInnerLength, pTag);
+	}
+	else
+	{
+		bOK = m_ReadState.ChaCha20Poly1305.Decrypt (Nonce, m_RxRecord, TLS_RECORD_HEADER_SIZE,
+							    pContent, pContent, nInnerLength, pTag);
+	}
+
+	if (!bOK)
+	{
+		return Fail (TLS_ALERT_BAD_RECORD_MAC);
+	}
+
+	// the content type is the last non-zero byte, zeros after it are padding
+	while (nInnerLength > 0 && pContent[nInnerLength-1] == 0)
+	{
+		nInnerLength--;
+	}
+
+	if (nInnerLength == 0)
+	{
+		return Fail (TLS_ALERT_UNEXPECTED_MESSAGE);
+	}
+
+	nInnerLength--;
+	if (nInnerLength > TLS_MAX_PLAINTEXT)
+	{
+		return Fail (TLS_ALERT_RECORD_OVERFLOW);
+	}
+
+	*pType = (TTLSContentType) pContent[nInnerLength];
+	*ppContent = pContent;
+
+	if (*pType == TLSContentAlert)
+	{
+		if (   nInnerLength >= 2
+		    && pContent[1] != TLS_ALERT_CLOSE_NOTIFY)
+		{
+			CLogger::Get ()->Write (FromTLS, LogWarning, "Alert received (%u)",
+						(unsigned) pContent[1]);
+		}
+
+		m_bClosed = TRUE;
+
+		return -1;
+	}
+
+	return nInnerLength;
+}
+
+boolean CTLSRecordLayer::SetKey (TCipherState *pState, TTLSCipherSuite Suite,
+				 const u8 *pKey, const u8 *pIV)
+{
+	assert (pState != 0);
+	assert (pKey != 0);
+	assert (pIV != 0);
+
+	switch (Suite)
+	{
+	case TLSCipherAES128GCMSHA256:
+		if (!pState->AESGCM.SetKey (pKey, 16))
+		{
+			return FALSE;
+		}
+		break;
+
+	case TLSCipherChaCha20Poly1305SHA256:
+		pState->ChaCha20Poly1305.SetKey (pKey);
+		break;
+
+	default:
+		return FALSE;
+	}
+
+	pState->Suite = Suite;
+	memcpy (pState->IV, pIV, TLS_IV_SIZE);
+	pState->nSequence = 0;
+
+	return TRUE;
+}
+
+boolean CTLSRecordLayer::SetSecret (TCipherState *pState, TTLSCipherSuite Suite,
+				    const u8 *pSecret)
+{
+	assert (pSecret != 0);
+
+	unsigned nKeyLength;
+	switch (Suite)
+	{
+	case TLSCipherAES128GCMSHA256:		nKeyLength = 16;	break;
+	case TLSCipherChaCha20Poly1305SHA256:	nKeyLength = 32;	break;
+
+	default:
+		return FALSE;
+	}
+
+	// RFC 8446 section 7.3
+	u8 Key[32];
+	u8 IV[TLS_IV_SIZE];
+	CSHA256::HKDFExpandLabel (pSecret, "key", 0, 0, Key, nKeyLength);
+	CSHA256::HKDFExpandLabel (pSecret, "iv", 0, 0, IV, TLS_IV_SIZE);
+
+	boolean bOK = SetKey (pState, Suite, Key, IV);
+
+	memset (Key, 0, sizeof Key);
+
+	return bOK;
+}
+
+void CTLSRecordLayer::GetNonce (TCipherState *pState, u8 *pNonce)
+{
+	assert (pState != 0);
+	assert (pNonce != 0);
+
+	// the 64-bit sequence number is XORed with the right end of the IV
+	memcpy (pNonce, pState->IV, TLS_IV_SIZE);
+	for (unsigned i = 0; i < 8; i++)
+	{
+		pNonce[TLS_IV_SIZE-1 - i] ^= (u8) (pState->nSequence >> (i * 8));
+	}
+
+	pState->nSequence++;
+}
+
+boolean CTLSRecordLayer::Read (void *pBuffer, unsigned nLength)
+{
+	u8 *pTarget = (u8 *) pBuffer;
+	while (nLength > 0)
+	{
+		if (m_nRxOffset >= m_nRxLength)
+		{
+			assert (m_pSocket != 0);
+			int nResult = m_pSocket->Receive (m_RxBuffer, sizeof m_RxBuffer, 0);
+			if (nResult <= 0)
+			{
+				m_bClosed = TRUE;
+
+				return FALSE;
+			}
+
+			m_nRxOffset = 0;
+			m_nRxLength = nResult;
+		}
+
+		unsigned nChunk = m_nRxLength - m_nRxOffset;
+		if (nChunk > nLength)
+		{
+			nChunk = nLength;
+		}
+
+		assert (pTarget != 0);
+		memcpy (pTarget, m_RxBuffer + m_nRxOffset, nChunk);
+
+		pTarget += nChunk;
+		m_nRxOffset += nChunk;
+		nLength -= nChunk;
+	}
+
+	return TRUE;
+}
+
+int CTLSRecordLayer::Fail (u8 uchDescription)
+{
+	if (!m_bClosed)
+	{
+		SendAlert (TLS_ALERT_FATAL, uchDescription);
+	}
+
+	m_bClosed = TRUE;
+
+	return -1;
+}
@@ -0,0 +1,188 @@
+//
+// tlsrecordlayer.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _tls_tlsrecordlayer_h
+#define _tls_tlsrecordlayer_h
+
+#include <circle/net/socket.h>
+#include <circle/netdevice.h>
+#include <tls/aes.h>
+#include <tls/chachapoly.h>
+#include <tls/sha256.h>
+#include <circle/types.h>
+
+#define TLS_RECORD_HEADER_SIZE	5
+#define TLS_MAX_PLAINTEXT	16384
+#define TLS_MAX_CIPHERTEXT	(TLS_MAX_PLAINTEXT + 256)
+#define TLS_IV_SIZE		12
+#define TLS_TAG_SIZE		16
+
+enum TTLSContentType
+{
+	TLSContentChangeCipherSpec	= 20,
+	TLSContentAlert			= 21,
+	TLSContentHandshake		= 22,
+	TLSContentApplicationData	= 23
+};
+
+enum TTLSCipherSuite
+{
+	TLSCipherNone			= 0,
+	TLSCipherAES128GCMSHA256	= 0x1301,
+	TLSCipherChaCha20Poly1305SHA256	= 0x1303
+};
+
+#define TLS_ALERT_WARNING		1
+#define TLS_ALERT_FATAL			2
+
+#define TLS_ALERT_CLOSE_NOTIFY		0
+#define TLS_ALERT_UNEXPECTED_MESSAGE	10
+#define TLS_ALERT_BAD_RECORD_MAC	20
+#define TLS_ALERT_RECORD_OVERFLOW	22
+#define TLS_ALERT_DECODE_ERROR		50
+
+/// \note This class implements the record protocol of TLS 1.3 (RFC 8446 section 5) only.\n
+///	  The handshake (key exchange and certificate verification) has to be done\n
+///	  elsewhere, using SendRecord() and ReceiveRecord() with TLSContentHandshake.\n
+///	  The negotiated traffic secrets or keys are handed over with SetReadSecret()\n
+///	  and SetWriteSecret() (or SetReadKey() and SetWriteKey()) afterwards.
+/// \note Each record is encrypted in place in a buffer, which also holds the record\n
+///	  header and the authentication tag, so that it can be sent with one call.\n
+///	  TLSCipherChaCha20Poly1305SHA256 should be preferred on CPUs without the\n
+///	  Cryptography Extensions (e.g. on Raspberry Pi 3 and 4), see CAES::IsAccelerated().
+
+class CTLSRecordLayer	/// TLS 1.3 record layer on top of a TCP connection
+{
+public:
+	/// \param pSocket Connected TCP socket (not owned by this object)
+	CTLSRecordLayer (CSocket *pSocket);
+
+	~CTLSRecordLayer (void);
+
+	/// \brief Set the key for received records
+	/// \param Suite Negotiated cipher suite
+	/// \param pKey Traffic key (16 bytes for AES-128-GCM, 32 bytes for ChaCha20-Poly1305)
+	/// \param pIV Traffic IV (TLS_IV_SIZE bytes)
+	/// \return Operation successful?
+	boolean SetReadKey (TTLSCipherSuite Suite, const u8 *pKey, const u8 *pIV);
+
+	/// \brief Set the key for sent records
+	/// \param Suite Negotiated cipher suite
+	/// \param pKey Traffic key (16 bytes for AES-128-GCM, 32 bytes for ChaCha20-Poly1305)
+	/// \param pIV Traffic IV (TLS_IV_SIZE bytes)
+	/// \return Operation successful?
+	boolean SetWriteKey (TTLSCipherSuite Suite, const u8 *pKey, const u8 *pIV);
+
+	/// \brief Derive the key and IV for received records from a traffic secret
+	/// \param Suite Negotiated cipher suite
+	/// \param pSecret Traffic secret (SHA256_DIGEST_SIZE bytes)
+	/// \return Operation successful?
+	boolean SetReadSecret (TTLSCipherSuite Suite, const u8 *pSecret);
+
+	/// \brief Derive the key and IV for sent records from a traffic secret
+	/// \param Suite Negotiated cipher suite
+	/// \param pSecret Traffic secret (SHA256_DIGEST_SIZE bytes)
+	/// \return Operation successful?
+	boolean SetWriteSecret (TTLSCipherSuite Suite, const u8 *pSecret);
+
+	/// \brief Send one record (protected, if a write key has been set)
+	/// \param Type Content type of the record
+	/// \param pData Pointer to the content
+	/// \param nLength Length of the content (1..TLS_MAX_PLAINTEXT)
+	/// \return Length of the sent content (< 0 on error)
+	int SendRecord (TTLSContentType Type, const void *pData, unsigned nLength);
+
+	/// \brief Receive one record (must be protected, if a read key has been set)
+	/// \param pType Content type of the record is returned here
+	/// \param pBuffer Pointer to the buffer for the content
+	/// \param nSize Size of the buffer (should be TLS_MAX_PLAINTEXT)
+	/// \return Length of the content (< 0 on error or if the connection has been closed)
+	/// \note Padding is removed and the inner content type is returned for protected records.
+	int ReceiveRecord (TTLSContentType *pType, void *pBuffer, unsigned nSize);
+
+	/// \brief Send application data, split into records of up to TLS_MAX_PLAINTEXT bytes
+	/// \param pBuffer Pointer to the data
+	/// \param nLength Length of the data
+	/// \return Length of the sent data (< 0 on error)
+	int Send (const void *pBuffer, unsigned nLength);
+
+	/// \brief Receive application data
+	/// \param pBuffer Pointer to the buffer
+	/// \param nSize Size of the buffer
+	/// \param nFlags MSG_DONTWAIT (return, if no record data is available) or 0 (blocking)
+	/// \return Length of the received data (0 with MSG_DONTWAIT if no data available,\n
+	///	    < 0 on error or if the connection has been closed)
+	/// \note Handshake messages after the handshake (e.g. NewSessionTicket) are ignored.
+	int Receive (void *pBuffer, unsigned nSize, int nFlags = 0);
+
+	/// \brief Send an alert
+	/// \param uchLevel TLS_ALERT_WARNING or TLS_ALERT_FATAL
+	/// \param uchDescription TLS_ALERT_*
+	/// \return Operation successful?
+	boolean SendAlert (u8 uchLevel, u8 uchDescription);
+
+	/// \brief Send a close_notify alert, no more data can be sent afterwards
+	/// \return Operation successful?
+	boolean Close (void);
+
+	/// \return Has the connection been closed (by one of the peers or due to an error)?
+	boolean IsClosed (void) const;
+
+private:
+	struct TCipherState
+	{
+		TTLSCipherSuite		Suite;
+		CAESGCM			AESGCM;
+		CChaCha20Poly1305	ChaCha20Poly1305;
+		u8			IV[TLS_IV_SIZE];
+		u64			nSequence;
+	};
+
+	static boolean SetKey (TCipherState *pState, TTLSCipherSuite Suite,
+			       const u8 *pKey, const u8 *pIV);
+	static boolean SetSecret (TCipherState *pState, TTLSCipherSuite Suite, const u8 *pSecret);
+	static void GetNonce (TCipherState *pState, u8 *pNonce);	// increments sequence
+
+	// decrypts in place in m_RxRecord, returns content length (< 0 on error)
+	int ReadRecord (TTLSContentType *pType, u8 **ppContent);
+
+	boolean Read (void *pBuffer, unsigned nLength);		// blocking
+	int Fail (u8 uchDescription);				// sends alert, returns -1
+
+private:
+	CSocket *m_pSocket;
+
+	boolean m_bClosed;
+	boolean m_bCloseSent;
+
+	TCipherState m_ReadState;
+	TCipherState m_WriteState;
+
+	u8 m_TxRecord[TLS_RECORD_HEADER_SIZE + TLS_MAX_PLAINTEXT + 1 + TLS_TAG_SIZE];
+	u8 m_RxRecord[TLS_RECORD_HEADER_SIZE + TLS_MAX_CIPHERTEXT];
+
+	unsigned m_nPlainOffset;				// application data in m_RxRecord
+	unsigned m_nPlainLength;
+
+	u8 m_RxBuffer[FRAME_BUFFER_SIZE];			// received TCP stream
+	unsigned m_nRxOffset;
+	unsigned m_nRxLength;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // uguicpp.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -29,7 +29,8 @@ CUGUI::CUGUI (CScreenDevice *pScreen)
 :	m_pScreen (pScreen),
 	m_pMouseDevice (0),
 	m_pTouchScreen (0),
-	m_nLastUpdate (0)
+	m_nLastUpdate (0),
+	m_nAreaLineCount (0)
 {
 	assert (s_pThis == 0);
 	s_pThis = this;
@@ -59,6 +60,10 @@ boolean CUGUI::Initialize (void)
 		return FALSE;
 	}
 
+	UG_DriverRegister (DRIVER_FILL_FRAME, (void *) FillFrame);
+	UG_DriverRegister (DRIVER_DRAW_LINE, (void *) DrawLine);
+	UG_DriverRegister (DRIVER_FILL_AREA, (void *) FillArea);
+
 	m_pMouseDevice = (CMouseDevice *) CDeviceNameService::Get ()->GetDevice ("mouse1", FALSE);
 	if (m_pMouseDevice != 0)
 	{
@@ -130,6 +135,50 @@ void CUGUI::Update (boolean bPlugAndPlayUpdated)
 	}
 }
 
+void CUGUI::Invalidate (UG_S16 sPosX1, UG_S16 sPosY1, UG_S16 sPosX2, UG_S16 sPosY2)
+{
+	UG_WINDOW *pWindow = m_GUI.active_window;
+	UG_AREA Area;
+	if (   pWindow == 0
+	    || !(pWindow->state & WND_STATE_VISIBLE)
+	    || UG_WindowGetArea (pWindow, &Area) != UG_RESULT_OK)
+	{
+		return;
+	}
+
+	// clip the region to the client area of the window
+	if (sPosX1 < Area.xs) sPosX1 = Area.xs;
+	if (sPosY1 < Area.ys) sPosY1 = Area.ys;
+	if (sPosX2 > Area.xe) sPosX2 = Area.xe;
+	if (sPosY2 > Area.ye) sPosY2 = Area.ye;
+	if (   sPosX1 > sPosX2
+	    || sPosY1 > sPosY2)
+	{
+		return;
+	}
+
+	UG_FillFrame (sPosX1, sPosY1, sPosX2, sPosY2, pWindow->bc);
+
+	for (unsigned i = 0; i < pWindow->objcnt; i++)
+	{
+		UG_OBJECT *pObject = &pWindow->objlst[i];
+		if (   (pObject->state & OBJ_STATE_FREE)
+		    || !(pObject->state & OBJ_STATE_VALID)
+		    || !(pObject->state & OBJ_STATE_VISIBLE))
+		{
+			continue;
+		}
+
+		if (   pObject->a_abs.xs <= sPosX2
+		    && pObject->a_abs.xe >= sPosX1
+		    && pObject->a_abs.ys <= sPosY2
+		    && pObject->a_abs.ye >= sPosY1)
+		{
+			pObject->state |= OBJ_STATE_UPDATE | OBJ_STATE_REDRAW;
+		}
+	}
+}
+
 void CUGUI::SetPixel (UG_S16 sPosX, UG_S16 sPosY, UG_COLOR Color)
 {
 	assert (s_pThis != 0);
@@ -137,6 +186,122 @@ void CUGUI::SetPixel (UG_S16 sPosX, UG_S16 sPosY, UG_COLOR Color)
 	s_pThis->m_pScreen->SetPixel ((unsigned) sPosX, (unsigned) sPosY, (TScreenColor) Color);
 }
 
+UG_RESULT CUGUI::FillFrame (UG_S16 sPosX1, UG_S16 sPosY1, UG_S16 sPosX2, UG_S16 sPosY2,
+			    UG_COLOR Color)
+{
+	// uGUI has sorted the coordinates already
+	assert (sPosX1 <= sPosX2);
+	assert (sPosY1 <= sPosY2);
+
+	if (sPosX1 < 0) sPosX1 = 0;
+	if (sPosY1 < 0) sPosY1 = 0;
+	if (   sPosX2 < sPosX1
+	    || sPosY2 < sPosY1)
+	{
+		return UG_RESULT_OK;
+	}
+
+	assert (s_pThis != 0);
+	assert (s_pThis->m_pScreen != 0);
+	s_pThis->m_pScreen->FillRect ((unsigned) sPosX1, (unsigned) sPosY1,
+				      (unsigned) (sPosX2 - sPosX1 + 1),
+				      (unsigned) (sPosY2 - sPosY1 + 1), (TScreenColor) Color);
+
+	return UG_RESULT_OK;
+}
+
+UG_RESULT CUGUI::DrawLine (UG_S16 sPosX1, UG_S16 sPosY1, UG_S16 sPosX2, UG_S16 sPosY2,
+			   UG_COLOR Color)
+{
+	// only horizontal and vertical lines are accelerated, uGUI draws the others
+	if (   sPosX1 != sPosX2
+	    && sPosY1 != sPosY2)
+	{
+		return UG_RESULT_FAIL;
+	}
+
+	UG_S16 sTemp;
+	if (sPosX2 < sPosX1) { sTemp = sPosX1; sPosX1 = sPosX2; sPosX2 = sTemp; }
+	if (sPosY2 < sPosY1) { sTemp = sPosY1; sPosY1 = sPosY2; sPosY2 = sTemp; }
+
+	return FillFrame (sPosX1, sPosY1, sPosX2, sPosY2, Color);
+}
+
+void *CUGUI::FillArea (UG_S16 sPosX1, UG_S16 sPosY1, UG_S16 sPosX2, UG_S16 sPosY2)
+{
+	assert (s_pThis != 0);
+	assert (s_pThis->m_nAreaLineCount == 0);
+
+	s_pThis->m_sAreaX1 = sPosX1;
+	s_pThis->m_sAreaX2 = sPosX2;
+	s_pThis->m_sAreaY2 = sPosY2;
+	s_pThis->m_sAreaPosX = sPosX1;
+	s_pThis->m_sAreaPosY = sPosY1;
+	s_pThis->m_sAreaLineX = sPosX1;
+
+	return (void *) PushPixel;
+}
+
+void CUGUI::PushPixel (UG_COLOR Color)
+{
+	assert (s_pThis != 0);
+	CUGUI *pThis = s_pThis;
+
+	if (pThis->m_sAreaPosY > pThis->m_sAreaY2)
+	{
+		return;
+	}
+
+	assert (pThis->m_nAreaLineCount < UGUI_AREA_LINE_SIZE);
+	pThis->m_AreaLine[pThis->m_nAreaLineCount++] = (TScreenColor) Color;
+
+	if (pThis->m_sAreaPosX++ >= pThis->m_sAreaX2)
+	{
+		pThis->FlushAreaLine ();
+
+		pThis->m_sAreaPosX = pThis->m_sAreaX1;
+		pThis->m_sAreaPosY++;
+		pThis->m_sAreaLineX = pThis->m_sAreaX1;
+	}
+	else if (pThis->m_nAreaLineCount == UGUI_AREA_LINE_SIZE)
+	{
+		pThis->FlushAreaLine ();
+
+		pThis->m_sAreaLineX = pThis->m_sAreaPosX;
+	}
+}
+
+void CUGUI::FlushAreaLine (void)
+{
+	assert (m_nAreaLineCount > 0);
+
+	// clip on the left and top border, the screen clips the rest
+	UG_S16 sPosX = m_sAreaLineX;
+	const TScreenColor *pPixels = m_AreaLine;
+	unsigned nCount = m_nAreaLineCount;
+	m_nAreaLineCount = 0;
+
+	if (sPosX < 0)
+	{
+		if ((unsigned) -sPosX >= nCount)
+		{
+			return;
+		}
+
+		pPixels += -sPosX;
+		nCount -= -sPosX;
+		sPosX = 0;
+	}
+
+	if (m_sAreaPosY < 0)
+	{
+		return;
+	}
+
+	assert (m_pScreen != 0);
+	m_pScreen->SetPixels ((unsigned) sPosX, (unsigned) m_sAreaPosY, pPixels, nCount);
+}
+
 void CUGUI::MouseEventHandler (TMouseEvent Event, unsigned nButtons,
 			       unsigned nPosX, unsigned nPosY, int nWheelMove)
 {
@@ -4,7 +4,7 @@
 // C++ wrapper for uGUI with mouse and touch screen support
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -39,6 +39,8 @@ extern "C" {
 	#error DEPTH must be set to 16 in include/circle/screen.h!
 #endif
 
+#define UGUI_AREA_LINE_SIZE	64		// pixels buffered by the fill area driver
+
 class CUGUI
 {
 public:
@@ -49,9 +51,22 @@ public:
 
 	void Update (boolean bPlugAndPlayUpdated = FALSE);
 
+	/// \brief Redraw a region of the active window on the next Update()
+	/// \note Only the objects, which intersect the region, are redrawn, not the whole window.
+	void Invalidate (UG_S16 sPosX1, UG_S16 sPosY1, UG_S16 sPosX2, UG_S16 sPosY2);
+
 private:
 	static void SetPixel (UG_S16 sPosX, UG_S16 sPosY, UG_COLOR Color);
 
+	// acceleration drivers, which write whole spans to the screen
+	static UG_RESULT FillFrame (UG_S16 sPosX1, UG_S16 sPosY1, UG_S16 sPosX2, UG_S16 sPosY2,
+				    UG_COLOR Color);
+	static UG_RESULT DrawLine (UG_S16 sPosX1, UG_S16 sPosY1, UG_S16 sPosX2, UG_S16 sPosY2,
+				   UG_COLOR Color);
+	static void *FillArea (UG_S16 sPosX1, UG_S16 sPosY1, UG_S16 sPosX2, UG_S16 sPosY2);
+	static void PushPixel (UG_COLOR Color);
+	void FlushAreaLine (void);
+
 	void MouseEventHandler (TMouseEvent Event, unsigned nButtons,
 				unsigned nPosX, unsigned nPosY, int nWheelMove);
 	static void MouseEventStub (TMouseEvent Event, unsigned nButtons,
@@ -74,6 +89,16 @@ private:
 	CTouchScreenDevice *m_pTouchScreen;
 	unsigned m_nLastUpdate;
 
+	// state of the fill area driver
+	UG_S16 m_sAreaX1;
+	UG_S16 m_sAreaX2;
+	UG_S16 m_sAreaY2;
+	UG_S16 m_sAreaPosX;		// of next pixel
+	UG_S16 m_sAreaPosY;
+	UG_S16 m_sAreaLineX;		// of first pixel in m_AreaLine
+	unsigned m_nAreaLineCount;
+	TScreenColor m_AreaLine[UGUI_AREA_LINE_SIZE];
+
 	static CUGUI *s_pThis;
 };
 
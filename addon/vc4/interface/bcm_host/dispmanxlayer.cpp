@@ -0,0 +1,352 @@
+//
+// dispmanxlayer.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <vc4/interface/bcm_host/dispmanxlayer.h>
+#include <circle/logger.h>
+#include <circle/new.h>
+#include <assert.h>
+
+// flags for vc_dispmanx_element_change_attributes()
+#define ELEMENT_CHANGE_LAYER		(1 << 0)
+#define ELEMENT_CHANGE_OPACITY		(1 << 1)
+#define ELEMENT_CHANGE_DEST_RECT	(1 << 2)
+#define ELEMENT_CHANGE_SRC_RECT		(1 << 3)
+
+#define UPDATE_PRIORITY			10
+
+LOGMODULE ("dispmanx");
+
+CDispmanxDisplay::CDispmanxDisplay (unsigned nDisplay)
+:	m_nDisplay (nDisplay),
+	m_hDisplay (DISPMANX_NO_HANDLE),
+	m_hUpdate (DISPMANX_NO_HANDLE)
+{
+}
+
+CDispmanxDisplay::~CDispmanxDisplay (void)
+{
+	assert (m_hUpdate == DISPMANX_NO_HANDLE);
+
+	if (m_hDisplay != DISPMANX_NO_HANDLE)
+	{
+		vc_dispmanx_display_close (m_hDisplay);
+		m_hDisplay = DISPMANX_NO_HANDLE;
+	}
+}
+
+boolean CDispmanxDisplay::Initialize (void)
+{
+	bcm_host_init ();
+
+	m_hDisplay = vc_dispmanx_display_open (m_nDisplay);
+	if (m_hDisplay == DISPMANX_NO_HANDLE)
+	{
+		LOGERR ("Cannot open display %u", m_nDisplay);
+
+		return FALSE;
+	}
+
+	if (vc_dispmanx_display_get_info (m_hDisplay, &m_ModeInfo) != 0)
+	{
+		LOGERR ("Cannot get display info");
+
+		return FALSE;
+	}
+
+	LOGNOTE ("Display %u is %dx%d", m_nDisplay, m_ModeInfo.width, m_ModeInfo.height);
+
+	return TRUE;
+}
+
+unsigned CDispmanxDisplay::GetWidth (void) const
+{
+	return m_ModeInfo.width;
+}
+
+unsigned CDispmanxDisplay::GetHeight (void) const
+{
+	return m_ModeInfo.height;
+}
+
+boolean CDispmanxDisplay::BeginUpdate (void)
+{
+	assert (m_hUpdate == DISPMANX_NO_HANDLE);
+	m_hUpdate = vc_dispmanx_update_start (UPDATE_PRIORITY);
+
+	return m_hUpdate != DISPMANX_NO_HANDLE;
+}
+
+boolean CDispmanxDisplay::EndUpdate (void)
+{
+	assert (m_hUpdate != DISPMANX_NO_HANDLE);
+	int nResult = vc_dispmanx_update_submit_sync (m_hUpdate);
+	m_hUpdate = DISPMANX_NO_HANDLE;
+
+	return nResult == 0;
+}
+
+boolean CDispmanxDisplay::SetBackground (u8 uchRed, u8 uchGreen, u8 uchBlue)
+{
+	assert (m_hDisplay != DISPMANX_NO_HANDLE);
+
+	DISPMANX_UPDATE_HANDLE_T hUpdate = GetUpdate ();
+	if (hUpdate == DISPMANX_NO_HANDLE)
+	{
+		return FALSE;
+	}
+
+	boolean bOK = vc_dispmanx_display_set_background (hUpdate, m_hDisplay,
+							  uchRed, uchGreen, uchBlue) == 0;
+
+	return PutUpdate (hUpdate) && bOK;
+}
+
+DISPMANX_UPDATE_HANDLE_T CDispmanxDisplay::GetUpdate (void)
+{
+	if (m_hUpdate != DISPMANX_NO_HANDLE)
+	{
+		return m_hUpdate;
+	}
+
+	return vc_dispmanx_update_start (UPDATE_PRIORITY);
+}
+
+boolean CDispmanxDisplay::PutUpdate (DISPMANX_UPDATE_HANDLE_T hUpdate)
+{
+	assert (hUpdate != DISPMANX_NO_HANDLE);
+
+	if (hUpdate == m_hUpdate)
+	{
+		return TRUE;		// submitted in EndUpdate()
+	}
+
+	return vc_dispmanx_update_submit_sync (hUpdate) == 0;
+}
+
+CDispmanxLayer::CDispmanxLayer (CDispmanxDisplay *pDisplay, unsigned nWidth, unsigned nHeight,
+				TFormat Format, int nLayer, boolean bPremultiplied)
+:	m_pDisplay (pDisplay),
+	m_nWidth (nWidth),
+	m_nHeight (nHeight),
+	m_Format (Format),
+	m_nLayer (nLayer),
+	m_bPremultiplied (bPremultiplied),
+	m_nPitch (0),
+	m_pBuffer (0),
+	m_uchOpacity (255),
+	m_hResource (DISPMANX_NO_HANDLE),
+	m_hElement (DISPMANX_NO_HANDLE)
+{
+	assert (m_pDisplay != 0);
+	assert (m_nWidth > 0);
+	assert (m_nHeight > 0);
+}
+
+CDispmanxLayer::~CDispmanxLayer (void)
+{
+	if (m_hElement != DISPMANX_NO_HANDLE)
+	{
+		DISPMANX_UPDATE_HANDLE_T hUpdate = m_pDisplay->GetUpdate ();
+		if (hUpdate != DISPMANX_NO_HANDLE)
+		{
+			vc_dispmanx_element_remove (hUpdate, m_hElement);
+
+			m_pDisplay->PutUpdate (hUpdate);
+		}
+
+		m_hElement = DISPMANX_NO_HANDLE;
+	}
+
+	if (m_hResource != DISPMANX_NO_HANDLE)
+	{
+		vc_dispmanx_resource_delete (m_hResource);
+		m_hResource = DISPMANX_NO_HANDLE;
+	}
+
+	delete [] m_pBuffer;
+	m_pBuffer = 0;
+
+	m_pDisplay = 0;
+}
+
+boolean CDispmanxLayer::Initialize (void)
+{
+	VC_IMAGE_TYPE_T ImageType;
+	unsigned nBytesPerPixel;
+	switch (m_Format)
+	{
+	case FormatRGB565:	ImageType = VC_IMAGE_RGB565;	nBytesPerPixel = 2;	break;
+	case FormatXRGB8888:	ImageType = VC_IMAGE_XRGB8888;	nBytesPerPixel = 4;	break;
+	case FormatARGB8888:	ImageType = VC_IMAGE_ARGB8888;	nBytesPerPixel = 4;	break;
+
+	default:
+		assert (0);
+		return FALSE;
+	}
+
+	m_nPitch = (m_nWidth * nBytesPerPixel + 31) & ~31;
+
+	m_pBuffer = new u8[m_nPitch * m_nHeight];
+	if (m_pBuffer == 0)
+	{
+		return FALSE;
+	}
+
+	uint32_t nImageHandle;
+	m_hResource = vc_dispmanx_resource_create (ImageType, m_nWidth, m_nHeight, &nImageHandle);
+	if (m_hResource == DISPMANX_NO_HANDLE)
+	{
+		LOGERR ("Cannot create resource (%ux%u)", m_nWidth, m_nHeight);
+
+		return FALSE;
+	}
+
+	vc_dispmanx_rect_set (&m_DestRect, 0, 0, m_pDisplay->GetWidth (), m_pDisplay->GetHeight ());
+	vc_dispmanx_rect_set (&m_SourceRect, 0, 0, m_nWidth << 16, m_nHeight << 16);
+
+	VC_DISPMANX_ALPHA_T Alpha;
+	if (m_Format == FormatARGB8888)
+	{
+		Alpha.flags = (DISPMANX_FLAGS_ALPHA_T) (  DISPMANX_FLAGS_ALPHA_FROM_SOURCE
+							| DISPMANX_FLAGS_ALPHA_MIX
+							| (m_bPremultiplied ? DISPMANX_FLAGS_ALPHA_PREMULT : 0));
+	}
+	else
+	{
+		Alpha.flags = DISPMANX_FLAGS_ALPHA_FIXED_ALL_PIXELS;
+	}
+	Alpha.opacity = m_uchOpacity;
+	Alpha.mask = DISPMANX_NO_HANDLE;
+
+	DISPMANX_UPDATE_HANDLE_T hUpdate = m_pDisplay->GetUpdate ();
+	if (hUpdate == DISPMANX_NO_HANDLE)
+	{
+		return FALSE;
+	}
+
+	m_hElement = vc_dispmanx_element_add (hUpdate, m_pDisplay->m_hDisplay, m_nLayer,
+					      &m_DestRect, m_hResource, &m_SourceRect,
+					      DISPMANX_PROTECTION_NONE, &Alpha, 0, DISPMANX_NO_ROTATE);
+
+	if (   !m_pDisplay->PutUpdate (hUpdate)
+	    || m_hElement == DISPMANX_NO_HANDLE)
+	{
+		LOGERR ("Cannot add layer %d", m_nLayer);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void *CDispmanxLayer::GetBuffer (void)
+{
+	assert (m_pBuffer != 0);
+	return m_pBuffer;
+}
+
+unsigned CDispmanxLayer::GetPitch (void) const
+{
+	return m_nPitch;
+}
+
+unsigned CDispmanxLayer::GetWidth (void) const
+{
+	return m_nWidth;
+}
+
+unsigned CDispmanxLayer::GetHeight (void) const
+{
+	return m_nHeight;
+}
+
+boolean CDispmanxLayer::Update (unsigned nLine, unsigned nCount)
+{
+	assert (m_hResource != DISPMANX_NO_HANDLE);
+	assert (nLine < m_nHeight);
+
+	if (   nCount == 0
+	    || nLine + nCount > m_nHeight)
+	{
+		nCount = m_nHeight - nLine;
+	}
+
+	// only whole lines are transferred
+	VC_RECT_T Rect;
+	vc_dispmanx_rect_set (&Rect, 0, nLine, m_nWidth, nCount);
+
+	VC_IMAGE_TYPE_T ImageType = m_Format == FormatRGB565 ? VC_IMAGE_RGB565 : VC_IMAGE_ARGB8888;
+
+	assert (m_pBuffer != 0);
+	return vc_dispmanx_resource_write_data (m_hResource, ImageType, m_nPitch,
+						m_pBuffer, &Rect) == 0;
+}
+
+boolean CDispmanxLayer::SetDestination (int nX, int nY, unsigned nWidth, unsigned nHeight)
+{
+	assert (nWidth > 0);
+	assert (nHeight > 0);
+	vc_dispmanx_rect_set (&m_DestRect, nX, nY, nWidth, nHeight);
+
+	return ChangeAttributes (ELEMENT_CHANGE_DEST_RECT);
+}
+
+boolean CDispmanxLayer::SetSource (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight)
+{
+	assert (nWidth > 0);
+	assert (nHeight > 0);
+	assert (nX + nWidth <= m_nWidth);
+	assert (nY + nHeight <= m_nHeight);
+	vc_dispmanx_rect_set (&m_SourceRect, nX << 16, nY << 16, nWidth << 16, nHeight << 16);
+
+	return ChangeAttributes (ELEMENT_CHANGE_SRC_RECT);
+}
+
+boolean CDispmanxLayer::SetOpacity (u8 uchOpacity)
+{
+	m_uchOpacity = uchOpacity;
+
+	return ChangeAttributes (ELEMENT_CHANGE_OPACITY);
+}
+
+boolean CDispmanxLayer::SetLayer (int nLayer)
+{
+	m_nLayer = nLayer;
+
+	return ChangeAttributes (ELEMENT_CHANGE_LAYER);
+}
+
+boolean CDispmanxLayer::ChangeAttributes (u32 nFlags)
+{
+	assert (m_hElement != DISPMANX_NO_HANDLE);
+
+	DISPMANX_UPDATE_HANDLE_T hUpdate = m_pDisplay->GetUpdate ();
+	if (hUpdate == DISPMANX_NO_HANDLE)
+	{
+		return FALSE;
+	}
+
+	boolean bOK = vc_dispmanx_element_change_attributes (hUpdate, m_hElement, nFlags,
+							     m_nLayer, m_uchOpacity,
+							     &m_DestRect, &m_SourceRect,
+							     DISPMANX_NO_HANDLE,
+							     DISPMANX_NO_ROTATE) == 0;
+
+	return m_pDisplay->PutUpdate (hUpdate) && bOK;
+}
@@ -0,0 +1,158 @@
+//
+/// \file dispmanxlayer.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _vc4_interface_bcm_host_dispmanxlayer_h
+#define _vc4_interface_bcm_host_dispmanxlayer_h
+
+#include <bcm_host.h>
+#include <circle/types.h>
+
+/// \note The layers are composed by the Hardware Video Scaler (HVS) of the VideoCore on each
+///	  frame without CPU load. Each layer has its own pixel buffer, which is scaled to the
+///	  destination rectangle on the display, and can be blended with the layers below using
+///	  a fixed opacity and/or per-pixel alpha. Layers with a higher number are in front.
+///	  The frame buffer of CBcmFrameBuffer/CScreenDevice is displayed below all layers with
+///	  a number >= 0.
+
+class CDispmanxDisplay	/// A display, on which dispmanx layers are shown
+{
+public:
+	/// \param nDisplay Dispmanx display number (0 for the main LCD/HDMI display)
+	CDispmanxDisplay (unsigned nDisplay = 0);
+
+	~CDispmanxDisplay (void);
+
+	/// \return Operation successful?
+	/// \note The VCHIQ device must have been initialized before.
+	boolean Initialize (void);
+
+	/// \return Display width in pixels
+	unsigned GetWidth (void) const;
+	/// \return Display height in pixels
+	unsigned GetHeight (void) const;
+
+	/// \brief Start collecting layer changes, which are applied together on a vertical sync
+	/// \return Operation successful?
+	/// \note Without BeginUpdate() each layer change is applied immediately on its own.
+	boolean BeginUpdate (void);
+
+	/// \brief Apply the layer changes collected since BeginUpdate()
+	/// \return Operation successful?
+	boolean EndUpdate (void);
+
+	/// \brief Set color of the display background, which is visible where no layer is shown
+	/// \return Operation successful?
+	boolean SetBackground (u8 uchRed, u8 uchGreen, u8 uchBlue);
+
+private:
+	DISPMANX_UPDATE_HANDLE_T GetUpdate (void);		// returns DISPMANX_NO_HANDLE on error
+	boolean PutUpdate (DISPMANX_UPDATE_HANDLE_T hUpdate);
+
+	friend class CDispmanxLayer;
+
+private:
+	unsigned m_nDisplay;
+
+	DISPMANX_DISPLAY_HANDLE_T m_hDisplay;
+	DISPMANX_MODEINFO_T m_ModeInfo;
+
+	DISPMANX_UPDATE_HANDLE_T m_hUpdate;	// of BeginUpdate() or DISPMANX_NO_HANDLE
+};
+
+class CDispmanxLayer	/// A hardware-composited and -scaled layer on a dispmanx display
+{
+public:
+	enum TFormat
+	{
+		FormatRGB565,
+		FormatXRGB8888,		///< 32 bits per pixel, no alpha
+		FormatARGB8888		///< 32 bits per pixel, per-pixel alpha in the upper 8 bits
+	};
+
+public:
+	/// \param pDisplay Display, on which the layer is shown
+	/// \param nWidth Width of the pixel buffer of this layer
+	/// \param nHeight Height of the pixel buffer of this layer
+	/// \param Format Pixel format of the buffer
+	/// \param nLayer Layer number (higher numbers are in front)
+	/// \param bPremultiplied Color components have been multiplied with alpha (FormatARGB8888 only)
+	CDispmanxLayer (CDispmanxDisplay *pDisplay, unsigned nWidth, unsigned nHeight,
+			TFormat Format, int nLayer, boolean bPremultiplied = FALSE);
+
+	~CDispmanxLayer (void);
+
+	/// \brief Create the layer and show it (initially scaled to the whole display)
+	/// \return Operation successful?
+	boolean Initialize (void);
+
+	/// \return Pointer to the pixel buffer (in ARM memory)
+	void *GetBuffer (void);
+	/// \return Distance between the starts of two lines in the pixel buffer in bytes
+	unsigned GetPitch (void) const;
+	/// \return Width of the pixel buffer
+	unsigned GetWidth (void) const;
+	/// \return Height of the pixel buffer
+	unsigned GetHeight (void) const;
+
+	/// \brief Transfer modified lines of the pixel buffer to the VideoCore
+	/// \param nLine First modified line
+	/// \param nCount Number of modified lines (0 for all lines from nLine to the end)
+	/// \return Operation successful?
+	boolean Update (unsigned nLine = 0, unsigned nCount = 0);
+
+	/// \brief Set the rectangle on the display, to which the layer is scaled
+	/// \return Operation successful?
+	boolean SetDestination (int nX, int nY, unsigned nWidth, unsigned nHeight);
+
+	/// \brief Set the area of the pixel buffer, which is shown (e.g. for scrolling or zooming)
+	/// \return Operation successful?
+	boolean SetSource (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight);
+
+	/// \param uchOpacity Opacity of the whole layer (0 transparent, 255 opaque)
+	/// \return Operation successful?
+	/// \note With FormatARGB8888 this is combined with the per-pixel alpha.
+	boolean SetOpacity (u8 uchOpacity);
+
+	/// \param nLayer New layer number (higher numbers are in front)
+	/// \return Operation successful?
+	boolean SetLayer (int nLayer);
+
+private:
+	boolean ChangeAttributes (u32 nFlags);
+
+private:
+	CDispmanxDisplay *m_pDisplay;
+	unsigned m_nWidth;
+	unsigned m_nHeight;
+	TFormat m_Format;
+	int m_nLayer;
+	boolean m_bPremultiplied;
+
+	unsigned m_nPitch;
+	u8 *m_pBuffer;
+
+	VC_RECT_T m_DestRect;
+	VC_RECT_T m_SourceRect;		// in 16.16 fixed point format
+	u8 m_uchOpacity;
+
+	DISPMANX_RESOURCE_HANDLE_T m_hResource;
+	DISPMANX_ELEMENT_HANDLE_T m_hElement;
+};
+
+#endif
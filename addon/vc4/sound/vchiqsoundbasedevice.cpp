@@ -6,7 +6,7 @@
 //	Licensed under GPLv2
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -25,6 +25,7 @@
 #include <circle/devicenameservice.h>
 #include <circle/sched/scheduler.h>
 #include <circle/logger.h>
+#include <circle/util.h>
 #include <assert.h>
 
 #define VOLUME_TO_CHIP(volume)		((unsigned) -(((volume) << 8) / 100))
@@ -34,17 +35,26 @@ static const char FromVCHIQSound[] = "sndvchiq";
 CVCHIQSoundBaseDevice::CVCHIQSoundBaseDevice (CVCHIQDevice *pVCHIQDevice,
 					      unsigned nSampleRate,
 					      unsigned nChunkSize,
-					      TVCHIQSoundDestination Destination)
+					      TVCHIQSoundDestination Destination,
+					      unsigned nQueueDepth)
 :	CSoundBaseDevice (SoundFormatSigned16, 0, nSampleRate),
 	m_nSampleRate (nSampleRate),
 	m_nChunkSize (nChunkSize),
 	m_Destination (Destination),
+	m_nQueueDepth (nQueueDepth),
 	m_State (VCHIQSoundCreated),
 	m_VCHIInstance (0),
-	m_hService (0)
+	m_hService (0),
+	m_nWritePos (0),
+	m_nCompletePos (0),
+	m_nFramesPlayed (0)
 {
 	//assert (44100 <= nSampleRate && nSampleRate <= 48000);
 	assert (Destination < VCHIQSoundDestinationUnknown);
+	assert (nChunkSize >= 2 && (nChunkSize & 1) == 0);
+	assert (2 <= nQueueDepth && nQueueDepth <= VCHIQ_SOUND_QUEUE_DEPTH_MAX);
+
+	ResetStatistics ();
 
 	CDeviceNameService::Get ()->AddDevice ("sndvchiq", this, FALSE);
 }
@@ -217,11 +227,16 @@ boolean CVCHIQSoundBaseDevice::Start (void)
 
 	m_nWritePos = 0;
 	m_nCompletePos = 0;
+	m_nFramesPlayed = 0;
 
-	nResult = WriteChunk ();
-	if (nResult == 0)
+	nResult = 0;
+	for (unsigned i = 0; i < m_nQueueDepth && m_State == VCHIQSoundRunning; i++)
 	{
 		nResult = WriteChunk ();
+		if (nResult != 0)
+		{
+			break;
+		}
 	}
 
 	if (nResult != 0)
@@ -287,6 +302,29 @@ boolean CVCHIQSoundBaseDevice::IsActive (void) const
 	return m_State >= VCHIQSoundRunning;
 }
 
+u64 CVCHIQSoundBaseDevice::GetPosition (void) const
+{
+	return m_nFramesPlayed;
+}
+
+unsigned CVCHIQSoundBaseDevice::GetLatency (void) const
+{
+	u64 nQueuedFrames = (m_nWritePos - m_nCompletePos) / (2 * sizeof (s16));
+
+	return (unsigned) (nQueuedFrames * 1000000 / m_nSampleRate);
+}
+
+void CVCHIQSoundBaseDevice::GetStatistics (TStatistics *pStatistics) const
+{
+	assert (pStatistics != 0);
+	memcpy (pStatistics, &m_Statistics, sizeof *pStatistics);
+}
+
+void CVCHIQSoundBaseDevice::ResetStatistics (void)
+{
+	memset (&m_Statistics, 0, sizeof m_Statistics);
+}
+
 void CVCHIQSoundBaseDevice::SetControl (int nVolume, TVCHIQSoundDestination Destination)
 {
 	if (!(VCHIQ_SOUND_VOLUME_MIN <= nVolume && nVolume <= VCHIQ_SOUND_VOLUME_MAX))
@@ -370,6 +408,7 @@ int CVCHIQSoundBaseDevice::WriteChunk (void)
 	}
 
 	m_nWritePos += nBytes;
+	m_Statistics.nChunksWritten++;
 
 	u8 *pBuffer8 = (u8 *) Buffer;
 	while (nBytes > 0)
@@ -439,10 +478,28 @@ void CVCHIQSoundBaseDevice::Callback (const VCHI_CALLBACK_REASON_T Reason, void
 			break;
 		}
 
-		m_nCompletePos += Msg.u.complete.count & 0x3FFFFFFF;
+		{
+			unsigned nCount = Msg.u.complete.count & 0x3FFFFFFF;
+			m_nCompletePos += nCount;
+			m_nFramesPlayed += nCount / (2 * sizeof (s16));
+		}
+
+		if (m_State == VCHIQSoundRunning)
+		{
+			if (m_nWritePos == m_nCompletePos)
+			{
+				m_Statistics.nUnderruns++;
+			}
+
+			unsigned nLatency = GetLatency ();
+			if (nLatency > m_Statistics.nMaxLatencyUs)
+			{
+				m_Statistics.nMaxLatencyUs = nLatency;
+			}
+		}
 
-		// if there is no more than one chunk left queued
-		if (m_nWritePos-m_nCompletePos <= m_nChunkSize*sizeof (s16))
+		// refill the queue, if no more than nQueueDepth-1 chunks are left queued
+		while (m_nWritePos-m_nCompletePos <= (m_nQueueDepth-1) * m_nChunkSize*sizeof (s16))
 		{
 			if (m_State == VCHIQSoundCancelled)
 			{
@@ -451,6 +508,11 @@ void CVCHIQSoundBaseDevice::Callback (const VCHI_CALLBACK_REASON_T Reason, void
 				break;
 			}
 
+			if (m_State != VCHIQSoundRunning)
+			{
+				break;
+			}
+
 			if (WriteChunk () != 0)
 			{
 				assert (0);
@@ -2,7 +2,7 @@
 // vchiqsoundbasedevice.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -32,6 +32,9 @@
 #define VCHIQ_SOUND_VOLUME_DEFAULT	0
 #define VCHIQ_SOUND_VOLUME_MAX		400
 
+#define VCHIQ_SOUND_QUEUE_DEPTH_DEFAULT	2		// chunks
+#define VCHIQ_SOUND_QUEUE_DEPTH_MAX	16
+
 enum TVCHIQSoundDestination
 {
 	VCHIQSoundDestinationAuto,
@@ -53,16 +56,28 @@ enum TVCHIQSoundState
 
 class CVCHIQSoundBaseDevice : public CSoundBaseDevice	/// Low level access to the VCHIQ sound service
 {
+public:
+	struct TStatistics
+	{
+		unsigned nUnderruns;		///< all queued chunks were played, before the next arrived
+		unsigned nChunksWritten;
+		unsigned nMaxLatencyUs;		///< maximum of GetLatency() at chunk completion
+	};
+
 public:
 	/// \param pVCHIQDevice	pointer to the VCHIQ interface device
 	/// \param nSampleRate	sample rate in Hz (44100..48000)
 	/// \param nChunkSize	number of samples transfered at once
 	/// \param Destination	the target device, the sound data is sent to\n
 	///			(detected automatically, if equal to VCHIQSoundDestinationAuto)
+	/// \param nQueueDepth	number of chunks, which are kept queued (2..16)
+	/// \note The output latency is about nQueueDepth * nChunkSize / 2 / nSampleRate seconds,\n
+	///	  e.g. nChunkSize = 384 and nQueueDepth = 2 give 8 ms at 48000 Hz.
 	CVCHIQSoundBaseDevice (CVCHIQDevice *pVCHIQDevice,
 			       unsigned nSampleRate = 44100,
 			       unsigned nChunkSize  = 4000,
-			       TVCHIQSoundDestination Destination = VCHIQSoundDestinationAuto);
+			       TVCHIQSoundDestination Destination = VCHIQSoundDestinationAuto,
+			       unsigned nQueueDepth = VCHIQ_SOUND_QUEUE_DEPTH_DEFAULT);
 
 	virtual ~CVCHIQSoundBaseDevice (void);
 
@@ -89,6 +104,17 @@ public:
 	void SetControl (int nVolume,
 			 TVCHIQSoundDestination Destination = VCHIQSoundDestinationUnknown);
 
+	/// \return Number of frames, which have been played since Start()
+	u64 GetPosition (void) const;
+
+	/// \return Duration of the sound data, which is currently queued, in microseconds
+	unsigned GetLatency (void) const;
+
+	/// \param pStatistics	receives the underrun count and the maximum latency
+	void GetStatistics (TStatistics *pStatistics) const;
+	/// \brief Reset the statistics counters
+	void ResetStatistics (void);
+
 protected:
 	/// \brief May overload this to provide the sound samples!
 	/// \param pBuffer	buffer where the samples have to be placed
@@ -112,6 +138,7 @@ private:
 	unsigned m_nSampleRate;
 	unsigned m_nChunkSize;
 	TVCHIQSoundDestination m_Destination;
+	unsigned m_nQueueDepth;
 
 	volatile TVCHIQSoundState m_State;
 
@@ -121,8 +148,11 @@ private:
 	CSynchronizationEvent m_Event;
 	int m_nResult;
 
-	unsigned m_nWritePos;
-	unsigned m_nCompletePos;
+	volatile unsigned m_nWritePos;		// in bytes
+	volatile unsigned m_nCompletePos;
+	volatile u64 m_nFramesPlayed;
+
+	TStatistics m_Statistics;
 };
 
 #endif
@@ -59,7 +59,7 @@ extern void dmac_unmap_area(const void *, size_t, int);
 void CleanAndInvalidateDataCacheRange (uintptr_t nAddress, size_t nLength);
 #endif
 
-#define TOTAL_SLOTS (VCHIQ_SLOT_ZERO_SLOTS + 2 * 32)
+#define TOTAL_SLOTS (VCHIQ_SLOT_ZERO_SLOTS + 2 * VCHIQ_SLOTS_PER_SIDE)
 
 #ifndef __circle__
 #define VCHIQ_ARM_ADDRESS(x) ((void *)((char *)x + g_virt_to_bus_offset))
@@ -86,18 +86,22 @@ typedef struct vchiq_2835_state_struct {
 static void __iomem *g_regs;
 #ifndef __circle__
 static unsigned int g_cache_line_size = sizeof(CACHE_LINE_SIZE);
+#elif RASPPI == 1
+static unsigned int g_cache_line_size = 32;	/* as in the Linux device tree */
+#else
+static unsigned int g_cache_line_size = 64;
+#endif
 static unsigned int g_fragments_size;
 static char *g_fragments_base;
 static char *g_free_fragments;
 static struct semaphore g_free_fragments_sema;
+#ifndef __circle__
 static unsigned long g_virt_to_bus_offset;
 #endif
 
 extern int vchiq_arm_log_level;
 
-#ifndef __circle__
 static DEFINE_SEMAPHORE(g_free_fragments_mutex);
-#endif
 
 static irqreturn_t
 vchiq_doorbell_irq(int irq, void *dev_id);
@@ -120,9 +124,9 @@ int vchiq_platform_init(struct platform_device *pdev, VCHIQ_STATE_T *state)
 	u32 channelbase;
 	int slot_mem_size, frag_mem_size;
 	int err, irq;
-#ifndef __circle__
 	int i;
 
+#ifndef __circle__
 	g_virt_to_bus_offset = virt_to_dma(dev, (void *)0);
 
 	err = of_property_read_u32(dev->of_node, "cache-line-size",
@@ -132,17 +136,13 @@ int vchiq_platform_init(struct platform_device *pdev, VCHIQ_STATE_T *state)
 		dev_err(dev, "Missing cache-line-size property\n");
 		return -ENODEV;
 	}
+#endif
 
 	g_fragments_size = 2 * g_cache_line_size;
-#endif
 
 	/* Allocate space for the channels in coherent memory */
 	slot_mem_size = PAGE_ALIGN(TOTAL_SLOTS * VCHIQ_SLOT_SIZE);
-#ifndef __circle__
 	frag_mem_size = PAGE_ALIGN(g_fragments_size * MAX_FRAGMENTS);
-#else
-	frag_mem_size = 0;
-#endif
 
 	slot_mem = dmam_alloc_coherent(dev, slot_mem_size + frag_mem_size,
 				       &slot_phys, GFP_KERNEL);
@@ -162,7 +162,6 @@ int vchiq_platform_init(struct platform_device *pdev, VCHIQ_STATE_T *state)
 	vchiq_slot_zero->platform_data[VCHIQ_PLATFORM_FRAGMENTS_COUNT_IDX] =
 		MAX_FRAGMENTS;
 
-#ifndef __circle__
 	g_fragments_base = (char *)slot_mem + slot_mem_size;
 	slot_mem_size += frag_mem_size;
 
@@ -173,7 +172,6 @@ int vchiq_platform_init(struct platform_device *pdev, VCHIQ_STATE_T *state)
 	}
 	*(char **)&g_fragments_base[i * g_fragments_size] = NULL;
 	sema_init(&g_free_fragments_sema, MAX_FRAGMENTS);
-#endif
 
 	if (vchiq_init_state(state, vchiq_slot_zero, 0) != VCHIQ_SUCCESS)
 		return -EINVAL;
@@ -407,6 +405,8 @@ vchiq_doorbell_irq(int irq, void *dev_id)
 struct page {};
 #define vmalloc_to_page(p)	((struct page *) ((uintptr_t) (p) & ~(PAGE_SIZE - 1)))
 #define page_address(pg)	((void *) (pg))
+#define kmap(pg)		page_address(pg)
+#define kunmap(pg)		((void) 0)
 #endif
 
 static int
@@ -556,7 +556,6 @@ create_pagelist(char __user *buf, size_t count, unsigned short type,
 	addridx++;
 #endif
 
-#ifndef __circle__
 	/* Partial cache lines (fragments) require special measures */
 	if ((type == PAGELIST_READ) &&
 		((pagelist->offset & (g_cache_line_size - 1)) ||
@@ -580,6 +579,7 @@ create_pagelist(char __user *buf, size_t count, unsigned short type,
 			(fragments - g_fragments_base) / g_fragments_size;
 	}
 
+#ifndef __circle__
 	dmac_flush_range(pagelist, addrs + num_pages);
 #else
 	CleanAndInvalidateDataCacheRange ((uintptr_t) pagelist,
@@ -596,21 +596,36 @@ free_pagelist(PAGELIST_T *pagelist, int actual)
 {
 #ifndef __circle__
         unsigned long *need_release;
+#endif
 	struct page **pages;
-	unsigned int num_pages, i;
+	unsigned int num_pages;
+#ifndef __circle__
+	unsigned int i;
 #endif
 
 	vchiq_log_trace(vchiq_arm_log_level,
 		"free_pagelist - %x, %d", (unsigned int)(uintptr_t)pagelist, actual);
 
-#ifndef __circle__
 	num_pages =
 		(pagelist->length + pagelist->offset + PAGE_SIZE - 1) /
 		PAGE_SIZE;
 
+#ifndef __circle__
         need_release = (unsigned long *)(pagelist->addrs + num_pages);
+#endif
 	pages = (struct page **)(pagelist->addrs + num_pages + 1);
 
+#ifdef __circle__
+	/* The buffer is used in place (zero-copy). Discard cache lines, which
+	** may have been fetched speculatively during the transfer, before the
+	** partial cache lines are copied in from the fragments. */
+	if (pagelist->type != PAGELIST_WRITE) {
+		uintptr_t start = (uintptr_t)page_address(pages[0]) + pagelist->offset;
+
+		CleanAndInvalidateDataCacheRange (start, pagelist->length);
+	}
+#endif
+
 	/* Deal with any partial cache lines (fragments) */
 	if (pagelist->type >= PAGELIST_READ_WITH_FRAGMENTS) {
 		char *fragments = g_fragments_base +
@@ -649,6 +664,7 @@ free_pagelist(PAGELIST_T *pagelist, int actual)
 		up(&g_free_fragments_sema);
 	}
 
+#ifndef __circle__
 	if (*need_release) {
 		unsigned int length = pagelist->length;
 		unsigned int offset = pagelist->offset;
@@ -56,7 +56,19 @@
 #define VCHIQ_MAX_SLOTS_PER_SIDE 64
 
 #define VCHIQ_NUM_CURRENT_BULKS        32
+#ifndef VCHIQ_NUM_SERVICE_BULKS
+/* Outstanding bulk transfers per service (power of 2) */
 #define VCHIQ_NUM_SERVICE_BULKS        4
+#endif
+
+#ifndef VCHIQ_SLOTS_PER_SIDE
+/* Message slots per side, the slots and the fragments must fit into the
+** coherent memory window COHERENT_SLOT_VCHIQ_* (512 KByte) */
+#define VCHIQ_SLOTS_PER_SIDE           32
+#endif
+#if VCHIQ_SLOTS_PER_SIDE < 4 || VCHIQ_SLOTS_PER_SIDE > VCHIQ_MAX_SLOTS_PER_SIDE - 2
+#error VCHIQ_SLOTS_PER_SIDE is out of range
+#endif
 
 #ifndef VCHIQ_ENABLE_DEBUG
 #define VCHIQ_ENABLE_DEBUG             1
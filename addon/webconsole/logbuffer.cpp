@@ -2,7 +2,7 @@
 // logbuffer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,7 +24,8 @@ CLogBuffer::CLogBuffer (unsigned nSize)
 :	m_nSize (nSize),
 	m_pBuffer (0),
 	m_nInPtr (0),
-	m_nOutPtr (0)
+	m_nOutPtr (0),
+	m_nSequence (0)
 {
 	m_pBuffer = new u8[m_nSize];
 	assert (m_pBuffer != 0);
@@ -71,6 +72,8 @@ void CLogBuffer::Put (const void *pBuffer, unsigned nLength)
 	const u8 *p = (const u8 *) pBuffer;
 	assert (p != 0);
 
+	m_nSequence += nLength;
+
 	while (nLength-- > 0)
 	{
 		m_pBuffer[m_nInPtr++] = *p++;
@@ -82,11 +85,7 @@ unsigned CLogBuffer::Get (void *pBuffer)
 {
 	assert (m_pBuffer != 0);
 
-	unsigned nResult = m_nInPtr-m_nOutPtr;		// may wrap
-	if (nResult > m_nSize)
-	{
-		nResult += m_nSize;
-	}
+	unsigned nResult = GetCount ();
 
 	u8 *p = (u8 *) pBuffer;
 	assert (p != 0);
@@ -100,3 +99,57 @@ unsigned CLogBuffer::Get (void *pBuffer)
 
 	return nResult;
 }
+
+unsigned CLogBuffer::Get (void *pBuffer, unsigned nSize, u64 *pSequence)
+{
+	assert (m_pBuffer != 0);
+	assert (pSequence != 0);
+
+	u64 nFirstSequence = GetFirstSequence ();
+	if (   *pSequence < nFirstSequence
+	    || *pSequence > m_nSequence)
+	{
+		*pSequence = nFirstSequence;
+	}
+
+	unsigned nResult = (unsigned) (m_nSequence - *pSequence);
+	if (nResult > nSize)
+	{
+		nResult = nSize;
+	}
+
+	u8 *p = (u8 *) pBuffer;
+	assert (p != 0 || nResult == 0);
+
+	unsigned nPreOutPtr = (m_nOutPtr + (unsigned) (*pSequence - nFirstSequence)) % m_nSize;
+	for (unsigned nLength = nResult; nLength > 0; nLength--)
+	{
+		*p++ = m_pBuffer[nPreOutPtr++];
+		nPreOutPtr %= m_nSize;
+	}
+
+	*pSequence += nResult;
+
+	return nResult;
+}
+
+u64 CLogBuffer::GetFirstSequence (void) const
+{
+	return m_nSequence - GetCount ();
+}
+
+u64 CLogBuffer::GetSequence (void) const
+{
+	return m_nSequence;
+}
+
+unsigned CLogBuffer::GetCount (void) const
+{
+	unsigned nResult = m_nInPtr-m_nOutPtr;		// may wrap
+	if (nResult > m_nSize)
+	{
+		nResult += m_nSize;
+	}
+
+	return nResult;
+}
@@ -2,7 +2,7 @@
 // logbuffer.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -30,8 +30,22 @@ public:
 
 	void Put (const void *pBuffer, unsigned nLength);
 
+	// copies the whole content, pBuffer must have the size given to the constructor
 	unsigned Get (void *pBuffer);
 
+	// copies up to nSize bytes, starting at the sequence number *pSequence, which is set to
+	// the sequence number following the returned data, continues with the oldest data, if
+	// *pSequence is not available any more (or is invalid)
+	unsigned Get (void *pBuffer, unsigned nSize, u64 *pSequence);
+
+	// returns the sequence number of the oldest byte in the buffer
+	u64 GetFirstSequence (void) const;
+	// returns the sequence number of the next byte to be put (number of bytes put so far)
+	u64 GetSequence (void) const;
+
+private:
+	unsigned GetCount (void) const;
+
 private:
 	unsigned m_nSize;
 
@@ -39,6 +53,8 @@ private:
 
 	unsigned m_nInPtr;
 	unsigned m_nOutPtr;
+
+	u64 m_nSequence;
 };
 
 #endif
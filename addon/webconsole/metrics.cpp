@@ -0,0 +1,286 @@
+//
+// metrics.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <webconsole/metrics.h>
+#include <circle/net/netstatistics.h>
+#include <circle/interrupt.h>
+#include <circle/cputhrottle.h>
+#include <circle/memory.h>
+#include <circle/timer.h>
+#include <assert.h>
+
+static const struct
+{
+	int	    nType;
+	const char *pName;
+}
+s_Heap[] =
+{
+	{HEAP_LOW,	"low"},
+#if RASPPI >= 4
+	{HEAP_HIGH,	"high"},
+#endif
+	{HEAP_UNCACHED,	"uncached"}
+};
+
+static const struct
+{
+	TTaskState  State;
+	const char *pName;
+}
+s_TaskState[] =
+{
+	{TaskStateNew,			"new"},
+	{TaskStateReady,		"ready"},
+	{TaskStateBlocked,		"blocked"},
+	{TaskStateBlockedWithTimeout,	"blocked_timeout"},
+	{TaskStateSleeping,		"sleeping"},
+	{TaskStateTerminated,		"terminated"}
+};
+
+CMetrics::CMetrics (void)
+{
+	for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+	{
+		m_nLastTicks[nCore] = CTimer::GetClockTicks ();
+		m_nLastIdleTime[nCore] =   CScheduler::IsActive ()
+					 ? CScheduler::Get ()->GetIdleTime (nCore) : 0;
+	}
+}
+
+CMetrics::~CMetrics (void)
+{
+}
+
+void CMetrics::FormatPrometheus (CString *pString)
+{
+	assert (pString != 0);
+	*pString = "";
+
+	CString Line;
+
+	Line.Format ("# TYPE circle_uptime_seconds counter\n"
+		     "circle_uptime_seconds %u\n", CTimer::Get ()->GetUptime ());
+	pString->Append (Line);
+
+	if (CScheduler::IsActive ())
+	{
+		CScheduler *pScheduler = CScheduler::Get ();
+
+		pString->Append ("# TYPE circle_cpu_idle_seconds_total counter\n");
+		for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+		{
+			CString Seconds;
+			FormatIdleTime (&Seconds, pScheduler->GetIdleTime (nCore));
+
+			Line.Format ("circle_cpu_idle_seconds_total{core=\"%u\"} %s\n",
+				     nCore, (const char *) Seconds);
+			pString->Append (Line);
+		}
+
+		pString->Append ("# TYPE circle_tasks gauge\n");
+		for (unsigned i = 0; i < sizeof s_TaskState / sizeof s_TaskState[0]; i++)
+		{
+			Line.Format ("circle_tasks{state=\"%s\"} %u\n", s_TaskState[i].pName,
+				     pScheduler->GetTaskCount (s_TaskState[i].State));
+			pString->Append (Line);
+		}
+	}
+
+	pString->Append ("# TYPE circle_heap_size_bytes gauge\n"
+			 "# TYPE circle_heap_used_bytes gauge\n"
+			 "# TYPE circle_heap_peak_used_bytes gauge\n"
+			 "# TYPE circle_heap_failed_allocations_total counter\n");
+	for (unsigned i = 0; i < sizeof s_Heap / sizeof s_Heap[0]; i++)
+	{
+		THeapStatus Status;
+		if (!CMemorySystem::GetHeapStatus (&Status, s_Heap[i].nType))
+		{
+			continue;
+		}
+
+		Line.Format ("circle_heap_size_bytes{heap=\"%s\"} %lu\n"
+			     "circle_heap_used_bytes{heap=\"%s\"} %lu\n"
+			     "circle_heap_peak_used_bytes{heap=\"%s\"} %lu\n"
+			     "circle_heap_failed_allocations_total{heap=\"%s\"} %llu\n",
+			     s_Heap[i].pName, (unsigned long) Status.nSize,
+			     s_Heap[i].pName, (unsigned long) Status.nUsed,
+			     s_Heap[i].pName, (unsigned long) Status.nPeakUsed,
+			     s_Heap[i].pName, Status.nFailedAllocations);
+		pString->Append (Line);
+	}
+
+	CCPUThrottle *pCPUThrottle = CCPUThrottle::Get ();
+	if (pCPUThrottle != 0)
+	{
+		Line.Format ("# TYPE circle_cpu_temperature_celsius gauge\n"
+			     "circle_cpu_temperature_celsius %u\n"
+			     "# TYPE circle_cpu_clock_hz gauge\n"
+			     "circle_cpu_clock_hz %u\n",
+			     pCPUThrottle->GetTemperature (), pCPUThrottle->GetClockRate ());
+		pString->Append (Line);
+	}
+
+	pString->Append ("# TYPE circle_irqs_total counter\n");
+	for (unsigned nIRQ = 0; nIRQ < IRQ_LINES; nIRQ++)
+	{
+		unsigned nCount = CInterruptSystem::GetIRQCount (nIRQ);
+		if (nCount != 0)
+		{
+			Line.Format ("circle_irqs_total{irq=\"%u\"} %u\n", nIRQ, nCount);
+			pString->Append (Line);
+		}
+	}
+
+	CNetStatistics *pNetStatistics = CNetStatistics::Get ();
+	if (pNetStatistics != 0)
+	{
+		for (unsigned i = 0; i < NetCounterUnknown; i++)
+		{
+			TNetCounter Counter = (TNetCounter) i;
+
+			Line.Format ("# TYPE circle_net_%s_total counter\n"
+				     "circle_net_%s_total %llu\n",
+				     CNetStatistics::GetName (Counter),
+				     CNetStatistics::GetName (Counter),
+				     pNetStatistics->Get (Counter));
+			pString->Append (Line);
+		}
+	}
+}
+
+void CMetrics::FormatJSON (CString *pString)
+{
+	assert (pString != 0);
+
+	CString Line;
+	Line.Format ("{\"uptime\":%u", CTimer::Get ()->GetUptime ());
+	*pString = Line;
+
+	if (CScheduler::IsActive ())
+	{
+		CScheduler *pScheduler = CScheduler::Get ();
+
+		pString->Append (",\"cpu_load\":[");
+		for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+		{
+			Line.Format ("%s%u", nCore > 0 ? "," : "", GetCPULoad (nCore));
+			pString->Append (Line);
+		}
+
+		Line.Format ("],\"tasks\":{\"total\":%u", pScheduler->GetTaskCount ());
+		pString->Append (Line);
+		for (unsigned i = 0; i < sizeof s_TaskState / sizeof s_TaskState[0]; i++)
+		{
+			Line.Format (",\"%s\":%u", s_TaskState[i].pName,
+				     pScheduler->GetTaskCount (s_TaskState[i].State));
+			pString->Append (Line);
+		}
+		pString->Append ("}");
+	}
+
+	pString->Append (",\"heap\":{");
+	boolean bFirst = TRUE;
+	for (unsigned i = 0; i < sizeof s_Heap / sizeof s_Heap[0]; i++)
+	{
+		THeapStatus Status;
+		if (!CMemorySystem::GetHeapStatus (&Status, s_Heap[i].nType))
+		{
+			continue;
+		}
+
+		Line.Format ("%s\"%s\":{\"size\":%lu,\"used\":%lu,\"peak\":%lu,\"failed\":%llu}",
+			     bFirst ? "" : ",", s_Heap[i].pName, (unsigned long) Status.nSize,
+			     (unsigned long) Status.nUsed, (unsigned long) Status.nPeakUsed,
+			     Status.nFailedAllocations);
+		pString->Append (Line);
+
+		bFirst = FALSE;
+	}
+	pString->Append ("}");
+
+	CCPUThrottle *pCPUThrottle = CCPUThrottle::Get ();
+	if (pCPUThrottle != 0)
+	{
+		Line.Format (",\"temperature\":%u,\"clock_hz\":%u",
+			     pCPUThrottle->GetTemperature (), pCPUThrottle->GetClockRate ());
+		pString->Append (Line);
+	}
+
+	pString->Append (",\"irqs\":{");
+	bFirst = TRUE;
+	for (unsigned nIRQ = 0; nIRQ < IRQ_LINES; nIRQ++)
+	{
+		unsigned nCount = CInterruptSystem::GetIRQCount (nIRQ);
+		if (nCount != 0)
+		{
+			Line.Format ("%s\"%u\":%u", bFirst ? "" : ",", nIRQ, nCount);
+			pString->Append (Line);
+
+			bFirst = FALSE;
+		}
+	}
+	pString->Append ("}");
+
+	CNetStatistics *pNetStatistics = CNetStatistics::Get ();
+	if (pNetStatistics != 0)
+	{
+		pString->Append (",\"net\":{");
+		for (unsigned i = 0; i < NetCounterUnknown; i++)
+		{
+			TNetCounter Counter = (TNetCounter) i;
+
+			Line.Format ("%s\"%s\":%llu", i > 0 ? "," : "",
+				     CNetStatistics::GetName (Counter), pNetStatistics->Get (Counter));
+			pString->Append (Line);
+		}
+		pString->Append ("}");
+	}
+
+	pString->Append ("}\n");
+}
+
+unsigned CMetrics::GetCPULoad (unsigned nCore)
+{
+	assert (nCore < SCHED_CORES);
+
+	unsigned nTicks = CTimer::GetClockTicks ();
+	u64 nIdleTime = CScheduler::Get ()->GetIdleTime (nCore);
+
+	unsigned nElapsed = nTicks - m_nLastTicks[nCore];
+	u64 nIdle = nIdleTime - m_nLastIdleTime[nCore];
+
+	m_nLastTicks[nCore] = nTicks;
+	m_nLastIdleTime[nCore] = nIdleTime;
+
+	if (   nElapsed == 0
+	    || nIdle >= nElapsed)
+	{
+		return 0;
+	}
+
+	return (unsigned) ((nElapsed - nIdle) * 100 / nElapsed);
+}
+
+void CMetrics::FormatIdleTime (CString *pString, u64 nMicros)
+{
+	assert (pString != 0);
+
+	pString->Format ("%llu.%06u", nMicros / 1000000, (unsigned) (nMicros % 1000000));
+}
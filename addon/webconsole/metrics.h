@@ -0,0 +1,53 @@
+//
+// metrics.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _webconsole_metrics_h
+#define _webconsole_metrics_h
+
+#include <circle/sched/scheduler.h>
+#include <circle/string.h>
+#include <circle/types.h>
+
+// Collects runtime metrics of the system: CPU load per core, heap usage, number of tasks,
+// CPU temperature and clock rate (if CCPUThrottle is used), IRQ counts and net counters.
+
+class CMetrics
+{
+public:
+	CMetrics (void);
+	~CMetrics (void);
+
+	// Prometheus text exposition format (version 0.0.4)
+	void FormatPrometheus (CString *pString);
+
+	// one JSON object in a single line, terminated with "\n"
+	// the CPU load is calculated since the previous call (or the construction)
+	void FormatJSON (CString *pString);
+
+private:
+	unsigned GetCPULoad (unsigned nCore);		// in percent since the last call
+
+	static void FormatIdleTime (CString *pString, u64 nMicros);
+
+private:
+	unsigned m_nLastTicks[SCHED_CORES];
+	u64	 m_nLastIdleTime[SCHED_CORES];
+};
+
+#endif
@@ -32,6 +32,7 @@
 #include <circle/usb/usbhcidevice.h>
 #include <circle/sched/scheduler.h>
 #include <circle/net/netsubsystem.h>
+#include <circle/cputhrottle.h>
 #include <circle/types.h>
 
 enum TShutdownMode
@@ -65,6 +66,7 @@ private:
 	CUSBHCIDevice		m_USBHCI;
 	CScheduler		m_Scheduler;
 	CNetSubSystem		m_Net;
+	CCPUThrottle		m_CPUThrottle;
 };
 
 #endif
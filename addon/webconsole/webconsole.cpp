@@ -2,7 +2,7 @@
 // webconsole.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,14 +18,51 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <webconsole/webconsole.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/net/in.h>
+#include <circle/sched/scheduler.h>
 #include <circle/logger.h>
+#include <circle/string.h>
 #include <circle/util.h>
 #include <assert.h>
 
 #define LOG_BUFFER_SIZE		20000
 
+#define STREAM_INTERVAL_MIN	100		// milliseconds
+#define STREAM_INTERVAL_DEFAULT	1000
+
+#define LOG_POLL_INTERVAL	100		// milliseconds
+#define LOG_WAIT_MAX		30000		// milliseconds
+#define LOG_CHUNK_SIZE		1024		// bytes sent at once
+
 static const char s_Header[] = "<pre>\n";
 
+// the log is fetched incrementally using long-poll, so that only new lines are transferred
+static const char s_Index[] =
+	"<!DOCTYPE html>\n"
+	"<html>\n"
+	"<head><title>Web Console</title></head>\n"
+	"<body>\n"
+	"<pre id=\"log\"></pre>\n"
+	"<script>\n"
+	"var seq = 0;\n"
+	"function poll () {\n"
+	"\tfetch (\"/log?seq=\" + seq + \"&wait=20000\").then (function (r) {\n"
+	"\t\tseq = r.headers.get (\"X-Log-Sequence\");\n"
+	"\t\treturn r.text ();\n"
+	"\t}).then (function (t) {\n"
+	"\t\tif (t.length > 0) {\n"
+	"\t\t\tdocument.getElementById (\"log\").textContent += t;\n"
+	"\t\t\twindow.scrollTo (0, document.body.scrollHeight);\n"
+	"\t\t}\n"
+	"\t\tpoll ();\n"
+	"\t}).catch (function () { setTimeout (poll, 1000); });\n"
+	"}\n"
+	"poll ();\n"
+	"</script>\n"
+	"</body>\n"
+	"</html>\n";
+
 CWebConsole::CWebConsole (CNetSubSystem *pNetSubSystem, u16 nPort, CSocket *pSocket, CLogBuffer *pLog)
 :	CHTTPDaemon (pNetSubSystem, pSocket, LOG_BUFFER_SIZE + sizeof s_Header-1, nPort),
 	m_nPort (nPort),
@@ -65,15 +102,143 @@ THTTPStatus CWebConsole::GetContent (const char  *pPath,
 	assert (m_pLog != 0);
 
 	assert (pPath != 0);
-	if (   strcmp (pPath, "/") != 0
-	    && strcmp (pPath, "/index.html") != 0)
+	if (strcmp (pPath, "/metrics") == 0)
+	{
+		return GetMetrics (pBuffer, pLength, ppContentType);
+	}
+
+	if (strcmp (pPath, "/netstat") == 0)
+	{
+		return GetNetStatistics (pBuffer, pLength, ppContentType);
+	}
+
+	unsigned nLength;
+	if (   strcmp (pPath, "/") == 0
+	    || strcmp (pPath, "/index.html") == 0)
+	{
+		nLength = sizeof s_Index-1;
+
+		assert (pLength != 0);
+		assert (*pLength >= nLength);
+		assert (pBuffer != 0);
+		memcpy (pBuffer, s_Index, nLength);
+	}
+	else if (strcmp (pPath, "/log.html") == 0)
+	{
+		// the whole log at once, for clients without JavaScript
+		assert (pBuffer != 0);
+		memcpy (pBuffer, s_Header, sizeof s_Header);
+		pBuffer += sizeof s_Header;
+
+		UpdateLog ();
+
+		nLength = sizeof s_Header + m_pLog->Get (pBuffer);
+
+		assert (pLength != 0);
+		assert (*pLength >= nLength);
+	}
+	else
 	{
 		return HTTPNotFound;
 	}
 
-	assert (pBuffer != 0);
-	memcpy (pBuffer, s_Header, sizeof s_Header);
-	pBuffer += sizeof s_Header;
+	*pLength = nLength;
+
+	assert (ppContentType != 0);
+	*ppContentType = "text/html; charset=iso-8859-1";
+
+	return HTTPOK;
+}
+
+THTTPStatus CWebConsole::StreamContent (const char *pPath, const char *pParams,
+					const char *pFormData)
+{
+	assert (pPath != 0);
+	if (strcmp (pPath, "/log") == 0)
+	{
+		return StreamLog (pParams);
+	}
+
+	if (strcmp (pPath, "/metrics/stream") != 0)
+	{
+		return CHTTPDaemon::StreamContent (pPath, pParams, pFormData);
+	}
+
+	// parameters: interval=<milliseconds>, count=<number of objects> (0 for endless)
+	unsigned nInterval = (unsigned) GetParam (pParams, "interval", STREAM_INTERVAL_DEFAULT);
+	if (nInterval < STREAM_INTERVAL_MIN)
+	{
+		nInterval = STREAM_INTERVAL_MIN;
+	}
+
+	unsigned nCount = (unsigned) GetParam (pParams, "count", 0);
+
+	if (!BeginResponse ("application/x-ndjson"))
+	{
+		return HTTPOK;
+	}
+
+	// the CPU load of the first object is calculated since the connection has been opened
+	for (unsigned i = 0; nCount == 0 || i < nCount; i++)
+	{
+		CScheduler::Get ()->MsSleep (nInterval);
+
+		CString Object;
+		m_Metrics.FormatJSON (&Object);
+
+		if (!WriteContent ((const char *) Object, Object.GetLength ()))
+		{
+			break;			// connection closed by client
+		}
+	}
+
+	return HTTPOK;
+}
+
+boolean CWebConsole::AcceptWebSocket (const char *pPath, const char *pParams)
+{
+	assert (pPath != 0);
+	return strcmp (pPath, "/log/ws") == 0;
+}
+
+void CWebConsole::WebSocketSession (CWebSocket *pWebSocket, const char *pPath,
+				    const char *pParams)
+{
+	assert (pWebSocket != 0);
+	assert (m_pLog != 0);
+
+	// parameter: seq=<sequence number> (default 0 for the whole log)
+	u64 nSequence = GetParam (pParams, "seq", 0);
+
+	while (!pWebSocket->IsClosed ())
+	{
+		UpdateLog ();
+
+		// a slow client lags behind with its own sequence number and loses the oldest lines
+		char Buffer[LOG_CHUNK_SIZE];
+		unsigned nLength;
+		while ((nLength = m_pLog->Get (Buffer, sizeof Buffer, &nSequence)) > 0)
+		{
+			if (pWebSocket->Send (Buffer, nLength) < 0)
+			{
+				return;
+			}
+		}
+
+		// ping and close frames are handled here, other messages are ignored
+		u8 Message[WEBSOCKET_MAX_CONTROL_PAYLOAD];
+		if (pWebSocket->Receive (Message, sizeof Message, 0, MSG_DONTWAIT) < 0)
+		{
+			return;
+		}
+
+		CScheduler::Get ()->MsSleep (LOG_POLL_INTERVAL);
+	}
+}
+
+void CWebConsole::UpdateLog (void)
+{
+	assert (m_pLog != 0);
 
 	char Buffer[200];
 	int nBytesRead;
@@ -81,15 +246,150 @@ THTTPStatus CWebConsole::GetContent (const char  *pPath,
 	{
 		m_pLog->Put (Buffer, nBytesRead);
 	}
+}
+
+THTTPStatus CWebConsole::StreamLog (const char *pParams)
+{
+	assert (m_pLog != 0);
+
+	// parameters: seq=<sequence number> (default 0 for the whole log),
+	// wait=<milliseconds> (wait for new lines, if there are none, default 0)
+	u64 nSequence = GetParam (pParams, "seq", 0);
+	unsigned nWait = (unsigned) GetParam (pParams, "wait", 0);
+	if (nWait > LOG_WAIT_MAX)
+	{
+		nWait = LOG_WAIT_MAX;
+	}
+
+	UpdateLog ();
+
+	for (unsigned nWaited = 0;
+	     nWaited < nWait && nSequence == m_pLog->GetSequence ();
+	     nWaited += LOG_POLL_INTERVAL)
+	{
+		CScheduler::Get ()->MsSleep (LOG_POLL_INTERVAL);
+
+		UpdateLog ();
+	}
+
+	// continue with the oldest line, if the client has lost lines (or after reboot)
+	u64 nEndSequence = m_pLog->GetSequence ();
+	if (   nSequence < m_pLog->GetFirstSequence ()
+	    || nSequence > nEndSequence)
+	{
+		nSequence = m_pLog->GetFirstSequence ();
+	}
+
+	unsigned nRemaining = (unsigned) (nEndSequence - nSequence);
+
+	CString Fields;
+	Fields.Format ("X-Log-Sequence: %llu\r\n"
+		       "Cache-Control: no-store\r\n", nEndSequence);
+
+	if (!BeginResponse ("text/plain; charset=iso-8859-1", nRemaining, Fields))
+	{
+		return HTTPOK;
+	}
+
+	// new lines, which are logged while sending, are returned with the next request
+	while (nRemaining > 0)
+	{
+		char Buffer[LOG_CHUNK_SIZE];
+		unsigned nLength = m_pLog->Get (Buffer, nRemaining < sizeof Buffer
+							? nRemaining : sizeof Buffer, &nSequence);
+		if (   nLength == 0
+		    || !WriteContent (Buffer, nLength))
+		{
+			break;			// connection closed by client
+		}
+
+		nRemaining -= nLength;
+	}
+
+	return HTTPOK;
+}
+
+THTTPStatus CWebConsole::GetMetrics (u8 *pBuffer, unsigned *pLength, const char **ppContentType)
+{
+	CString Content;
+	m_Metrics.FormatPrometheus (&Content);
 
-	unsigned nLength = sizeof s_Header + m_pLog->Get (pBuffer);
+	unsigned nLength = Content.GetLength ();
 
 	assert (pLength != 0);
-	assert (*pLength >= nLength);
+	if (*pLength < nLength)
+	{
+		return HTTPInternalServerError;
+	}
+
+	assert (pBuffer != 0);
+	memcpy (pBuffer, (const char *) Content, nLength);
 	*pLength = nLength;
 
 	assert (ppContentType != 0);
-	*ppContentType = "text/html; charset=iso-8859-1";
+	*ppContentType = "text/plain; version=0.0.4";
 
 	return HTTPOK;
 }
+
+THTTPStatus CWebConsole::GetNetStatistics (u8 *pBuffer, unsigned *pLength,
+					   const char **ppContentType)
+{
+	CNetStatistics *pStatistics = CNetSubSystem::Get ()->GetStatistics ();
+	assert (pStatistics != 0);
+
+	CString Content;
+	pStatistics->Format (&Content);
+
+	const CHistogram<> *pRTT = pStatistics->GetRTTHistogram ();
+	assert (pRTT != 0);
+
+	CString RTT;
+	RTT.Format ("tcp_rtt_ms min %u avg %u p50 %u p99 %u max %u\n",
+		    pRTT->GetMin (), pRTT->GetAvg (), pRTT->GetPercentile (500),
+		    pRTT->GetPercentile (990), pRTT->GetMax ());
+	Content.Append (RTT);
+
+	unsigned nLength = Content.GetLength ();
+
+	assert (pLength != 0);
+	if (*pLength < nLength)
+	{
+		return HTTPInternalServerError;
+	}
+
+	assert (pBuffer != 0);
+	memcpy (pBuffer, (const char *) Content, nLength);
+	*pLength = nLength;
+
+	assert (ppContentType != 0);
+	*ppContentType = "text/plain; charset=iso-8859-1";
+
+	return HTTPOK;
+}
+
+u64 CWebConsole::GetParam (const char *pParams, const char *pName, u64 nDefault)
+{
+	assert (pParams != 0);
+	assert (pName != 0);
+	size_t nNameLen = strlen (pName);
+
+	while (*pParams != '\0')
+	{
+		if (   strncmp (pParams, pName, nNameLen) == 0
+		    && pParams[nNameLen] == '=')
+		{
+			return strtoull (pParams + nNameLen + 1, 0, 10);
+		}
+
+		pParams = strchr (pParams, '&');
+		if (pParams == 0)
+		{
+			break;
+		}
+
+		pParams++;
+	}
+
+	return nDefault;
+}
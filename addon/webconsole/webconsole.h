@@ -2,7 +2,7 @@
 // webconsole.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,7 +21,9 @@
 #define _webconsole_webconsole_h
 
 #include <circle/net/httpdaemon.h>
+#include <circle/net/websocket.h>
 #include <webconsole/logbuffer.h>
+#include <webconsole/metrics.h>
 #include <circle/types.h>
 
 class CWebConsole : public CHTTPDaemon
@@ -44,10 +46,38 @@ public:
 			        unsigned    *pLength,		// in: buffer size, out: content length
 			        const char **ppContentType);	// set this if not "text/html"
 
+	// streams the metrics as JSON lines and the log incrementally,
+	// other content is provided by GetContent()
+	THTTPStatus StreamContent (const char *pPath, const char *pParams, const char *pFormData);
+
+	// accepts WebSocket connections to /log/ws
+	boolean AcceptWebSocket (const char *pPath, const char *pParams);
+
+	// sends new log lines as text messages, until the connection is closed
+	void WebSocketSession (CWebSocket *pWebSocket, const char *pPath, const char *pParams);
+
+private:
+	// copies the pending messages from the logger into the log buffer
+	void UpdateLog (void);
+
+	// sends the log since the sequence number "seq" (long-poll up to "wait" milliseconds)
+	THTTPStatus StreamLog (const char *pParams);
+
+	// provides the runtime metrics in the Prometheus text format
+	THTTPStatus GetMetrics (u8 *pBuffer, unsigned *pLength, const char **ppContentType);
+
+	// provides the counters of the TCP/IP network stack as plain text
+	THTTPStatus GetNetStatistics (u8 *pBuffer, unsigned *pLength, const char **ppContentType);
+
+	// returns the value of a numeric parameter of a GET request
+	static u64 GetParam (const char *pParams, const char *pName, u64 nDefault);
+
 private:
 	u16 m_nPort;
 	CLogBuffer *m_pLog;
 	boolean m_bLogCreated;
+
+	CMetrics m_Metrics;
 };
 
 #endif
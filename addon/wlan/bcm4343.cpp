@@ -19,6 +19,7 @@
 //
 #include <wlan/bcm4343.h>
 #include <wlan/p9compat.h>
+#include <circle/netbuffer.h>
 #include <circle/sysconfig.h>
 #include <assert.h>
 
@@ -34,7 +35,10 @@ static Ether s_EtherDevice;
 CBcm4343Device *CBcm4343Device::s_pThis = 0;
 
 CBcm4343Device::CBcm4343Device (const char *pFirmwarePath)
-:	m_FirmwarePath (pFirmwarePath)
+:	m_FirmwarePath (pFirmwarePath),
+	m_pRxFirst (0),
+	m_pRxLast (0),
+	m_RxSpinLock (TASK_LEVEL)
 {
 	s_pThis = this;
 }
@@ -46,6 +50,12 @@ CBcm4343Device::~CBcm4343Device (void)
 
 	delete s_EtherDevice.oq;
 
+	Block *pBlock;
+	while ((pBlock = DequeueBlock ()) != 0)
+	{
+		freeb (pBlock);
+	}
+
 	s_pThis = 0;
 }
 
@@ -96,6 +106,36 @@ boolean CBcm4343Device::SendFrame (const void *pBuffer, unsigned nLength)
 	memcpy (pBlock->wp, pBuffer, nLength);
 	pBlock->wp += nLength;
 
+	return TransmitBlock (pBlock);
+}
+
+boolean CBcm4343Device::SendBuffer (CNetBuffer *pBuffer)
+{
+	assert (pBuffer != 0);
+	if (pBuffer->GetHeadroom () < ETHER_TX_HEADROOM)
+	{
+		return SendFrame (pBuffer->GetData (), pBuffer->GetLength ());
+	}
+
+	// the block refers to the data of the net buffer, the driver prepends its headers
+	Block *pBlock = (Block *) new uchar[sizeof (Block)];
+	assert (pBlock != 0);
+
+	pBuffer->AddRef ();
+	pBlock->netbuf = pBuffer;
+
+	pBlock->next = 0;
+	pBlock->rp = pBuffer->GetData ();
+	pBlock->wp = pBlock->rp + pBuffer->GetLength ();
+	pBlock->buf = pBlock->rp - pBuffer->GetHeadroom ();
+	pBlock->lim = pBlock->rp + pBuffer->GetMaxLength ();
+
+	return TransmitBlock (pBlock);
+}
+
+boolean CBcm4343Device::TransmitBlock (Block *pBlock)
+{
+	assert (pBlock != 0);
 	assert (s_EtherDevice.oq != 0);
 	qpass (s_EtherDevice.oq, pBlock);
 
@@ -114,13 +154,20 @@ boolean CBcm4343Device::SendFrame (const void *pBuffer, unsigned nLength)
 
 boolean CBcm4343Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 {
-	assert (pBuffer != 0);
-	unsigned nLength = m_RxQueue.Dequeue (pBuffer);
-	if (nLength == 0)
+	Block *pBlock = DequeueBlock ();
+	if (pBlock == 0)
 	{
 		return FALSE;
 	}
 
+	unsigned nLength = BLEN (pBlock);
+	assert (nLength <= FRAME_BUFFER_SIZE);
+
+	assert (pBuffer != 0);
+	memcpy (pBuffer, pBlock->rp, nLength);
+
+	freeb (pBlock);
+
 	assert (pResultLength != 0);
 	*pResultLength = nLength;
 
@@ -129,6 +176,41 @@ boolean CBcm4343Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 	return TRUE;
 }
 
+CNetBuffer *CBcm4343Device::ReceiveNetBuffer (void)
+{
+	Block *pBlock = DequeueBlock ();
+	if (pBlock == 0)
+	{
+		return 0;
+	}
+
+	CNetBuffer *pBuffer = (CNetBuffer *) pBlock->netbuf;
+	if (pBuffer != 0)
+	{
+		// take over the net buffer from the block
+		pBlock->netbuf = 0;
+
+		assert (pBlock->wp <= pBuffer->GetData () + pBuffer->GetMaxLength ());
+		pBuffer->SetLength (pBlock->wp - pBuffer->GetData ());
+		pBuffer->RemoveHeader (pBlock->rp - pBuffer->GetData ());
+	}
+	else
+	{
+		pBuffer = new CNetBuffer;
+		assert (pBuffer != 0);
+
+		unsigned nLength = BLEN (pBlock);
+		assert (nLength <= FRAME_BUFFER_SIZE);
+
+		memcpy (pBuffer->GetData (), pBlock->rp, nLength);
+		pBuffer->SetLength (nLength);
+	}
+
+	freeb (pBlock);
+
+	return pBuffer;
+}
+
 void CBcm4343Device::RegisterEventHandler (TBcm4343EventHandler *pHandler, void *pContext)
 {
 	assert (s_EtherDevice.setevhndlr != 0);
@@ -214,8 +296,61 @@ void CBcm4343Device::DumpStatus (void)
 
 void CBcm4343Device::FrameReceived (const void *pBuffer, unsigned nLength)
 {
+	Block *pBlock = allocb (nLength);
+	assert (pBlock != 0);
+
+	assert (pBuffer != 0);
+	memcpy (pBlock->wp, pBuffer, nLength);
+	pBlock->wp += nLength;
+
+	BlockReceived (pBlock);
+}
+
+void CBcm4343Device::BlockReceived (Block *pBlock)
+{
+	assert (pBlock != 0);
+	pBlock->next = 0;
+
 	assert (s_pThis != 0);
-	s_pThis->m_RxQueue.Enqueue (pBuffer, nLength);
+	s_pThis->m_RxSpinLock.Acquire ();
+
+	if (s_pThis->m_pRxFirst == 0)
+	{
+		s_pThis->m_pRxFirst = pBlock;
+	}
+	else
+	{
+		assert (s_pThis->m_pRxLast != 0);
+		s_pThis->m_pRxLast->next = pBlock;
+	}
+
+	s_pThis->m_pRxLast = pBlock;
+
+	s_pThis->m_RxSpinLock.Release ();
+}
+
+Block *CBcm4343Device::DequeueBlock (void)
+{
+	if (m_pRxFirst == 0)
+	{
+		return 0;
+	}
+
+	m_RxSpinLock.Acquire ();
+
+	Block *pBlock = m_pRxFirst;
+	if (pBlock != 0)
+	{
+		m_pRxFirst = pBlock->next;
+		if (m_pRxFirst == 0)
+		{
+			m_pRxLast = 0;
+		}
+	}
+
+	m_RxSpinLock.Release ();
+
+	return pBlock;
 }
 
 void CBcm4343Device::ScanResultReceived (const void *pBuffer, unsigned nLength)
@@ -227,9 +362,10 @@ void CBcm4343Device::ScanResultReceived (const void *pBuffer, unsigned nLength)
 void etheriq (Ether *pEther, Block *pBlock, unsigned nFlag)
 {
 	assert (pBlock != 0);
-	CBcm4343Device::FrameReceived (pBlock->rp, BLEN (pBlock));
+	assert (BLEN (pBlock) <= FRAME_BUFFER_SIZE);
 
-	freeb (pBlock);
+	// the block is handed over without copying
+	CBcm4343Device::BlockReceived (pBlock);
 }
 
 void etherscanresult (Ether *pEther, const void *pBuffer, long nLength)
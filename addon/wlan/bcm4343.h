@@ -23,12 +23,15 @@
 #include <circle/netdevice.h>
 #include <circle/macaddress.h>
 #include <circle/net/netqueue.h>
+#include <circle/spinlock.h>
 #include <circle/string.h>
 #include <circle/types.h>
 #include "etherevent.h"
 
 typedef ether_event_handler_t TBcm4343EventHandler;
 
+struct Block;
+
 class CBcm4343Device : public CNetDevice	/// Driver for BCM4343x WLAN device
 {
 public:
@@ -46,6 +49,12 @@ public:
 	// pBuffer must have size FRAME_BUFFER_SIZE
 	boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength);
 
+	// the frame is handed over without copying, if it has enough headroom
+	boolean SendBuffer (CNetBuffer *pBuffer);
+
+	// returns the net buffer, into which the frame has been read from SDIO
+	CNetBuffer *ReceiveNetBuffer (void);
+
 public:
 	/// \param pHandler Pointer to event handler (0 for unregister)
 	/// \param pContext Pointer to be handed over to the handler
@@ -77,15 +86,25 @@ public:
 
 public:
 	static void FrameReceived (const void *pBuffer, unsigned nLength);
+	static void BlockReceived (struct Block *pBlock);
 	static void ScanResultReceived (const void *pBuffer, unsigned nLength);
 
+private:
+	boolean TransmitBlock (struct Block *pBlock);
+
+	struct Block *DequeueBlock (void);
+
 private:
 	CString m_FirmwarePath;
 
 	CMACAddress m_MACAddress;
 	CMACAddress m_BSSID;
 
-	CNetQueue m_RxQueue;
+	// received frames, as they come from the driver
+	struct Block *m_pRxFirst;
+	struct Block *m_pRxLast;
+	CSpinLock m_RxSpinLock;
+
 	CNetQueue m_ScanResultQueue;
 
 	static CBcm4343Device *s_pThis;
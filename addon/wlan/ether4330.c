@@ -1241,20 +1241,25 @@ static Block*
 wlreadpkt(Ctlr *ctl)
 {
 	Block *b;
+	union {
+		Sdpcm	s;
+		ulong	align;	/* for the SDIO transfer */
+	} hdr;
 	Sdpcm *p;
 	int len, lenck;
 
-	b = allocb(2048);
-	p = (Sdpcm*)b->wp;
+	/*
+	 * read the header first, so that the block can be allocated with
+	 * the frame size and can be handed over to the net stack directly
+	 */
+	b = nil;
+	p = &hdr.s;
 	qlock(&ctl->pktlock);
 	for(;;){
-		packetrw(0, b->wp, sizeof(*p));
+		packetrw(0, (uchar*)p, sizeof(*p));
 		len = p->len[0] | p->len[1]<<8;
-		if(len == 0){
-			freeb(b);
-			b = nil;
+		if(len == 0)
 			break;
-		}
 		lenck = p->lenck[0] | p->lenck[1]<<8;
 		if(lenck != (len ^ 0xFFFF) ||
 		   len < sizeof(*p) || len > 2048){
@@ -1266,6 +1271,8 @@ wlreadpkt(Ctlr *ctl)
 				;
 			continue;
 		}
+		b = allocb(ROUND(len, 4));	/* packetrw() transfers multiples of 4 bytes */
+		memmove(b->wp, p, sizeof(*p));
 		if(len > sizeof(*p))
 			packetrw(0, b->wp + sizeof(*p), len - sizeof(*p));
 		b->wp += len;
@@ -1,4 +1,5 @@
 #include "p9ether.h"
+#include <circle/netbuffer.h>
 #include <circle/util.h>
 #include <assert.h>
 
@@ -6,6 +7,26 @@ Block *allocb (size_t size)
 {
 	static const size_t maxhdrsize = 64;
 
+	// a block, which fits into a net buffer, can be handed over to the net stack directly
+	if (size + maxhdrsize <= NET_BUFFER_SIZE)
+	{
+		CNetBuffer *pNetBuffer = new CNetBuffer (0);
+		assert (pNetBuffer != 0);
+
+		Block *b = (Block *) new uchar[sizeof (Block)];
+		assert (b != 0);
+
+		b->buf = pNetBuffer->GetData ();
+
+		b->next = 0;
+		b->lim = b->buf + pNetBuffer->GetMaxLength ();
+		b->wp = b->buf + maxhdrsize;
+		b->rp = b->wp;
+		b->netbuf = pNetBuffer;
+
+		return b;
+	}
+
 	size += sizeof (Block) + maxhdrsize;
 
 	Block *b = (Block *) new uchar[size];
@@ -17,12 +38,19 @@ Block *allocb (size_t size)
 	b->lim = b->buf + size;
 	b->wp = b->buf + maxhdrsize;
 	b->rp = b->wp;
+	b->netbuf = 0;
 
 	return b;
 }
 
 void freeb (Block *b)
 {
+	assert (b != 0);
+	if (b->netbuf != 0)
+	{
+		((CNetBuffer *) b->netbuf)->Release ();
+	}
+
 	uchar *p = (uchar *) b;
 	delete [] p;
 }
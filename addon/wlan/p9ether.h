@@ -19,6 +19,7 @@ typedef struct Block
 	uchar *lim;
 	uchar *wp;
 	uchar *rp;
+	void *netbuf;		/* CNetBuffer, which holds the data (or nil) */
 	uchar data[0];
 #define BLEN(b)		((b)->wp - (b)->rp)
 }
@@ -28,6 +29,9 @@ Block *allocb (size_t size);
 void freeb (Block *b);
 Block *padblock (Block *b, int size);
 
+/* headroom, which the driver needs in front of a frame to be transmitted */
+#define ETHER_TX_HEADROOM	32
+
 typedef struct
 {
 	Block *first;
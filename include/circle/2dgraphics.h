@@ -25,15 +25,31 @@
 
 #include <circle/screen.h>
 
+#ifndef DIRTY_RECTS_MAX
+#define DIRTY_RECTS_MAX		16		// tracked per frame, merged if exceeded
+#endif
 
 class C2DGraphics /// Software graphics library with VSync and hardware-accelerated double buffering
 {
+public:
+	struct TFrameStats
+	{
+		unsigned nFrames;		///< Number of UpdateDisplay() calls
+		unsigned nLastFrameTime;	///< Time between the last two UpdateDisplay() calls (microseconds)
+		unsigned nMaxFrameTime;		///< Maximum time between two UpdateDisplay() calls (microseconds)
+		unsigned nMissedVSyncs;		///< Display refreshes without a new frame being available
+		unsigned nDroppedFrames;	///< Frames replaced by a newer one, before they were shown (triple buffering only)
+		unsigned nVSyncPeriod;		///< Measured display refresh period (microseconds, 0 without VSync)
+	};
+
 public:
 	/// \param nWidth   Screen width in pixels (0 to detect)
 	/// \param nHeight  Screen height in pixels (0 to detect)
 	/// \param bVSync   TRUE to enable VSync and HW double buffering
 	/// \param nDisplay Zero-based display number (for Raspberry Pi 4)
-	C2DGraphics (unsigned nWidth, unsigned nHeight, boolean bVSync = TRUE, unsigned nDisplay = 0);
+	/// \param bTripleBuffered TRUE to use three buffers with VSync, so that UpdateDisplay() does not block
+	C2DGraphics (unsigned nWidth, unsigned nHeight, boolean bVSync = TRUE, unsigned nDisplay = 0,
+		     boolean bTripleBuffered = FALSE);
 
 	~C2DGraphics (void);
 
@@ -56,6 +72,7 @@ public:
 	/// \param nWidth Rectangle width
 	/// \param nHeight Rectangle height
 	/// \param Color Rectangle color
+	/// \note Large rectangles are filled by DMA in the background, if a CDMACopyService object exists. The next drawing waits for its completion.
 	void DrawRect (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, TScreenColor Color);
 	
 	/// \brief Draws an unfilled rectangle (inner outline)
@@ -127,6 +144,59 @@ public:
 	/// \param PixelBuffer Pointer to the pixels
 	/// \param TransparentColor Color to use for transparency
 	void DrawImageRectTransparent (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, unsigned nSourceX, unsigned nSourceY, unsigned nSourceWidth, unsigned nSourceHeight, TScreenColor *PixelBuffer, TScreenColor TransparentColor);
+
+#if DEPTH >= 16
+	/// \brief Draws an image from a pixel buffer with alpha blending
+	/// \param nX Image X coordinate
+	/// \param nY Image Y coordinate
+	/// \param nWidth Image width
+	/// \param nHeight Image height
+	/// \param PixelBuffer Pointer to the pixels in COLOR32 format (alpha in the upper 8 bits)
+	/// \param bPremultiplied TRUE, if the color components have been multiplied with alpha already
+	void DrawImageBlended (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, const u32 *PixelBuffer, boolean bPremultiplied = FALSE);
+
+	/// \brief Draws an area of an image from a pixel buffer with alpha blending
+	/// \param nX Image X coordinate
+	/// \param nY Image Y coordinate
+	/// \param nWidth Image width
+	/// \param nHeight Image height
+	/// \param nSourceX Source X coordinate in the pixel buffer
+	/// \param nSourceY Source Y coordinate in the pixel buffer
+	/// \param nSourceWidth Source image width
+	/// \param nSourceHeight Source image height
+	/// \param PixelBuffer Pointer to the pixels in COLOR32 format (alpha in the upper 8 bits)
+	/// \param bPremultiplied TRUE, if the color components have been multiplied with alpha already
+	void DrawImageRectBlended (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, unsigned nSourceX, unsigned nSourceY, unsigned nSourceWidth, unsigned nSourceHeight, const u32 *PixelBuffer, boolean bPremultiplied = FALSE);
+#endif
+
+	struct TSprite	/// Area of an atlas image to be drawn at a screen position
+	{
+		int nX;			///< Screen X coordinate (may be negative, the sprite is clipped)
+		int nY;			///< Screen Y coordinate (may be negative, the sprite is clipped)
+		unsigned nSourceX;	///< X coordinate in the atlas
+		unsigned nSourceY;	///< Y coordinate in the atlas
+		unsigned nWidth;	///< Sprite width
+		unsigned nHeight;	///< Sprite height
+	};
+
+	/// \brief Draws a number of sprites from an atlas image at once
+	/// \param pSprites Pointer to the sprite descriptions
+	/// \param nCount Number of sprites
+	/// \param pAtlas Pointer to the pixels of the atlas image
+	/// \param nAtlasWidth Width of the atlas image
+	/// \param bTransparent TRUE to skip pixels with TransparentColor
+	/// \param TransparentColor Color to use for transparency
+	void DrawSprites (const TSprite *pSprites, unsigned nCount, const TScreenColor *pAtlas, unsigned nAtlasWidth, boolean bTransparent = FALSE, TScreenColor TransparentColor = 0);
+
+#if DEPTH >= 16
+	/// \brief Draws a number of sprites from an atlas image at once with alpha blending
+	/// \param pSprites Pointer to the sprite descriptions
+	/// \param nCount Number of sprites
+	/// \param pAtlas Pointer to the pixels of the atlas image in COLOR32 format
+	/// \param nAtlasWidth Width of the atlas image
+	/// \param bPremultiplied TRUE, if the color components have been multiplied with alpha already
+	void DrawSpritesBlended (const TSprite *pSprites, unsigned nCount, const u32 *pAtlas, unsigned nAtlasWidth, boolean bPremultiplied = FALSE);
+#endif
 	
 	/// \brief Draws a single pixel. If you need to draw a lot of pixels, consider using GetBuffer() for better speed
 	/// \param nX Pixel X coordinate
@@ -140,8 +210,47 @@ public:
 	
 	/// \brief Once everything has been drawn, updates the display to show the contents on screen
 	/// \brief If VSync is enabled, this method is blocking until the screen refresh signal is received (every 16ms for 60FPS refresh rate)
+	/// \brief Only the regions modified by the Draw*() methods (or the whole screen after GetBuffer()) are copied.
+	/// \brief Without VSync the buffer is copied by DMA, if a CDMACopyService object exists. The next drawing waits for its completion.
+	/// \brief With triple buffering the buffer swap is queued for the next VSync and this method returns immediately.
+	/// \brief A queued frame, which has not been shown until the next call, is replaced (see TFrameStats::nDroppedFrames).
 	void UpdateDisplay();
 
+	/// \brief With VSync, copy the regions modified in a frame into the next drawing buffer after the buffer swap
+	/// \param bEnable TRUE to preserve the contents, so that only the changed parts have to be redrawn for the next frame
+	void SetPreserveContents (boolean bEnable = TRUE);
+
+	/// \return Is triple buffering active? (may be FALSE, if the frame buffer could not be allocated)
+	boolean IsTripleBuffered (void) const;
+
+	/// \param pStats Receives the frame pacing statistics
+	void GetFrameStats (TFrameStats *pStats) const;
+	/// \brief Resets the counters of the frame pacing statistics (except nVSyncPeriod)
+	void ResetFrameStats (void);
+
+private:
+	struct TRect
+	{
+		unsigned nX1, nY1;
+		unsigned nX2, nY2;	// exclusive
+	};
+
+	boolean ClipSprite (const TSprite &rSprite, TRect *pDest, unsigned *pSourceX, unsigned *pSourceY) const;
+
+	void MarkDirty (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight);
+	static void Unite (TRect *pRect, const TRect &rOther);
+	void CopyDirty (TScreenColor *pDest, const TScreenColor *pSource, const TRect *pRects, unsigned nRects);
+	boolean FillRectDMA (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, TScreenColor Color);
+
+	void WaitForDMA (void);
+	static void DMACompletionHandler (boolean bStatus, void *pParam);
+
+	void UpdateDisplayTriple (void);
+	void MeasureVSync (void);
+	void UpdateFrameStats (unsigned nTicks);
+	int GetVSyncIndex (unsigned nTicks) const;	// number of the last VSync before nTicks
+	boolean IsNearVSync (unsigned nTicks) const;
+
 private:
 	unsigned m_nWidth;
 	unsigned m_nHeight;
@@ -151,6 +260,29 @@ private:
 	TScreenColor *m_Buffer;
 	boolean m_bVSync;
 	boolean m_bBufferSwapped;
+	boolean m_bPreserveContents;
+
+	TRect m_DirtyRect[DIRTY_RECTS_MAX];
+	unsigned m_nDirtyRects;
+
+	volatile unsigned m_nDMAPending;
+
+	// triple buffering, buffer indices into the frame buffer
+	boolean m_bTripleBuffered;
+	TRect m_PrevDirtyRect[DIRTY_RECTS_MAX];		// of the frame before
+	unsigned m_nPrevDirtyRects;
+	unsigned m_nDisplayedBuffer;
+	unsigned m_nPendingBuffer;		// flip queued, but not shown yet
+	unsigned m_nDrawBuffer;
+	unsigned m_nFlipTicks;			// when the pending flip was queued
+	unsigned m_nFrameNumber;
+	unsigned m_nBufferFrame[3];		// number of the frame drawn into each buffer
+
+	// frame pacing
+	unsigned m_nVSyncTicks;			// time of a known VSync
+	unsigned m_nVSyncPeriod;
+	unsigned m_nLastUpdateTicks;
+	TFrameStats m_Stats;
 };
 
 #endif
@@ -0,0 +1,128 @@
+//
+/// \file arena.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_arena_h
+#define _circle_arena_h
+
+#include <circle/types.h>
+
+#define ARENA_CHUNK_SIZE	4096		///< Default chunk size in bytes
+#define ARENA_DEFAULT_ALIGN	16		///< Default alignment of allocations in bytes
+
+/// \note Memory is taken from the current chunk by incrementing an offset. A new chunk is
+///	  added, when the current one is exhausted. There is no Free() for single allocations,
+///	  everything is released at once with Reset() or back to a mark with Release().
+/// \note Destructors of objects in the arena are not called by Reset() or Release().
+/// \note Not thread-safe, the caller has to provide the locking.
+
+struct TArenaChunk;
+
+struct TArenaMark		/// Allocation state of an arena, returned by CArena::GetMark()
+{
+	TArenaChunk	*pChunk;
+	size_t		 nOffset;
+};
+
+class CArena		/// Region based (bump pointer) allocator for request-scoped memory
+{
+public:
+	/// \param nChunkSize Size of the chunks in bytes (larger allocations get an own chunk)
+	/// \param bPageBacked Take the chunks from the page allocator instead of the heap\n
+	///	   (nChunkSize is rounded up to a multiple of PAGE_SIZE)
+	/// \note The first chunk is allocated on first use and is kept until destruction.
+	CArena (size_t nChunkSize = ARENA_CHUNK_SIZE, boolean bPageBacked = FALSE);
+
+	/// \brief Nested arena, which takes its chunks from a parent arena
+	/// \param pParent Parent arena, must not be reset or released before this arena
+	/// \param nChunkSize Size of the chunks in bytes
+	/// \note The chunks return to the parent on its next Reset() or Release() only.
+	CArena (CArena *pParent, size_t nChunkSize = ARENA_CHUNK_SIZE);
+
+	/// \brief Arena in a fixed buffer, which does not grow
+	/// \param pBuffer Pointer to the buffer (must be aligned to sizeof (void *))
+	/// \param nSize Size of the buffer in bytes
+	CArena (void *pBuffer, size_t nSize);
+
+	~CArena (void);
+
+	/// \param nSize Size of the memory block in bytes
+	/// \param nAlign Alignment of the memory block in bytes (power of 2)
+	/// \return Pointer to the memory block, 0 if not enough memory is available
+	void *Allocate (size_t nSize, size_t nAlign = ARENA_DEFAULT_ALIGN);
+
+	/// \brief Release all allocations, additional chunks are freed
+	void Reset (void);
+
+	/// \return Current allocation state to be passed to Release()
+	TArenaMark GetMark (void) const;
+	/// \brief Release all allocations done after GetMark() returned Mark
+	void Release (const TArenaMark &Mark);
+
+	/// \return Number of bytes allocated from this arena (including alignment padding)
+	size_t GetUsed (void) const;
+
+private:
+	TArenaChunk *AddChunk (size_t nMinSize);
+	void FreeChunks (TArenaChunk *pChunk);		// frees pChunk and all following
+
+private:
+	enum TBacking
+	{
+		BackingHeap,
+		BackingPages,
+		BackingParent,
+		BackingFixed
+	};
+
+	TBacking	 m_Backing;
+	size_t		 m_nChunkSize;
+	CArena		*m_pParent;
+
+	TArenaChunk	*m_pFirst;
+	TArenaChunk	*m_pCurrent;		// last chunk in list
+	size_t		 m_nOffset;		// in current chunk
+};
+
+/// \brief Release the allocations done in a scope, when it is left
+class CArenaScope
+{
+public:
+	CArenaScope (CArena *pArena)
+	:	m_pArena (pArena),
+		m_Mark (pArena->GetMark ())
+	{
+	}
+
+	~CArenaScope (void)
+	{
+		m_pArena->Release (m_Mark);
+	}
+
+private:
+	CArena		*m_pArena;
+	TArenaMark	 m_Mark;
+};
+
+/// \brief Placement new into an arena (e.g. "new (Arena) CClass (...)")
+/// \note Returns 0, if the arena is exhausted. Such objects must not be deleted, but the
+///	  destructor has to be called explicitly, if required.
+void *operator new (size_t nSize, CArena &rArena) noexcept;
+void *operator new[] (size_t nSize, CArena &rArena) noexcept;
+
+#endif
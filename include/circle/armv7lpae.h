@@ -102,5 +102,6 @@ PACKED;
 #define LPAE_MAIR_NORMAL	0xFF			// MAIRn
 #define LPAE_MAIR_DEVICE	0x04
 #define LPAE_MAIR_COHERENT	0x00
+#define LPAE_MAIR_UNCACHED	0x44			// normal, inner/outer non-cacheable
 
 #endif
@@ -29,8 +29,10 @@
 // IRQs
 #define ARM_IRQLOCAL0_CNTPNS	GIC_PPI (14)
 
+#define ARM_IRQLOCAL0_PMU	GIC_SPI (16)	// PMU of core 0, core 1-3 follow
 #define ARM_IRQ_ARM_DOORBELL_0	GIC_SPI (34)
 #define ARM_IRQ_TIMER1		GIC_SPI (65)
+#define ARM_IRQ_TIMER3		GIC_SPI (67)
 #define ARM_IRQ_DMA0		GIC_SPI (80)
 #define ARM_IRQ_DMA1		GIC_SPI (81)
 #define ARM_IRQ_DMA2		GIC_SPI (82)
@@ -50,6 +52,7 @@
 #define ARM_IRQ_GPIO1		GIC_SPI (114)
 #define ARM_IRQ_GPIO2		GIC_SPI (115)
 #define ARM_IRQ_GPIO3		GIC_SPI (116)
+#define ARM_IRQ_I2C		GIC_SPI (117)		// shared by all BSC devices
 #define ARM_IRQ_UART		GIC_SPI (121)
 #define ARM_IRQ_ARASANSDIO	GIC_SPI (126)
 #define ARM_IRQ_PCIE_HOST_INTA	GIC_SPI (143)
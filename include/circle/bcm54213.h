@@ -8,7 +8,7 @@
 //	Licensed under GPLv2
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2019-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2019-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -27,6 +27,8 @@
 #define _circle_bcm54213_h
 
 #include <circle/netdevice.h>
+#include <circle/netbuffer.h>
+#include <circle/lockfreering.h>
 #include <circle/macaddress.h>
 #include <circle/timer.h>
 #include <circle/spinlock.h>
@@ -38,6 +40,7 @@ struct TGEnetCB				// buffer control block
 {
 	uintptr		bd_addr;	// address of HW buffer descriptor
 	u8		*buffer;	// pointer to frame buffer (DMA address)
+	CNetBuffer	*net_buffer;	// net buffer, which contains buffer (or 0)
 };
 
 struct TGEnetTxRing			// ring of Tx buffers
@@ -87,6 +90,34 @@ public:
 	// pBuffer must have size FRAME_BUFFER_SIZE
 	boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength);
 
+	// the data of the net buffer is sent without copying it
+	boolean SendBuffer (CNetBuffer *pBuffer);
+
+	// returns the net buffer, which has been received into by DMA (zero-copy)
+	CNetBuffer *ReceiveNetBuffer (void);
+
+	// several frames are queued with one update of the producer index
+	unsigned SendFrames (CNetBuffer *ppBuffer[], unsigned nCount);
+
+	// several frames are returned with one update of the consumer index per ring
+	unsigned ReceiveFrames (CNetBuffer *ppBuffer[], unsigned nMaxCount);
+
+	// directs received frames, which match the pattern, to a priority Rx queue
+	// nQueue is 0 .. GENET_RX_QUEUES-1 (0 is the highest priority)
+	// pPattern is compared with the frame, starting at the destination MAC address
+	// pMask holds 0x00, 0x0F, 0xF0 or 0xFF for each byte of pPattern
+	// returns the filter index (< 0 on error), call this after Initialize()
+	int AddRxFilter (unsigned nQueue, const u8 *pPattern, const u8 *pMask, unsigned nLength);
+
+	// MTU up to NET_MTU_MAX (jumbo frames with NET_JUMBO_FRAMES)
+	boolean SetMTU (unsigned nMTU);
+
+	// TCP/UDP checksums of sent frames are calculated by the device
+	unsigned GetOffloadCapabilities (void);
+
+	// up to 15 addresses are filtered in hardware, promiscuous mode is used otherwise
+	boolean SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount);
+
 	// returns TRUE if PHY link is up
 	boolean IsLinkUp (void);
 
@@ -111,6 +142,7 @@ private:
 	static void tx_ring16_int_enable(TGEnetTxRing *ring);
 	static void tx_ring_int_enable(TGEnetTxRing *ring);
 	static void rx_ring16_int_enable(TGEnetRxRing *ring);
+	static void rx_ring_int_enable(TGEnetRxRing *ring);
 
 	// address and mode setting
 	int set_hw_addr(void);
@@ -119,6 +151,10 @@ private:
 
 	// HW filter block
 	void hfb_init(void);
+	void hfb_insert_data(unsigned f_index, const u8 *data, const u8 *mask, unsigned size);
+	void hfb_set_filter_length(unsigned f_index, unsigned f_length);
+	void hfb_set_filter_rx_queue_mapping(unsigned f_index, unsigned rx_queue);
+	void hfb_enable_filter(unsigned f_index);
 
 	// net enable and start
 	void netif_start(void);
@@ -134,14 +170,20 @@ private:
 	TGEnetCB *get_txcb(TGEnetTxRing *ring);
 	unsigned tx_reclaim(TGEnetTxRing *ring);
 	void free_tx_cb(TGEnetCB *cb);
+	void release_tx_buffers(void);
+	TGEnetTxRing *get_tx_ring(void);
+	boolean tx_has_room(TGEnetTxRing *ring);
+	void tx_submit(TGEnetTxRing *ring, u8 *buffer, CNetBuffer *net_buffer, unsigned length,
+		       u32 dma_flags);
 
 	// Rx queues, rings and buffers
 	int init_rx_queues(void);
 	int init_rx_ring(unsigned index, unsigned size, unsigned start_ptr, unsigned end_ptr);
 	int alloc_rx_buffers(TGEnetRxRing *ring);
 	void free_rx_buffers(void);
-	u8 *rx_refill(TGEnetCB *cb);
-	u8 *free_rx_cb(TGEnetCB *cb);
+	CNetBuffer *rx_refill(TGEnetCB *cb);
+	CNetBuffer *free_rx_cb(TGEnetCB *cb);
+	unsigned rx_poll(TGEnetRxRing *ring, CNetBuffer *ppBuffer[], unsigned nMaxCount);
 
 	// Helpers
 	void dmadesc_set(uintptr d, u8 *addr, u32 value);
@@ -184,6 +226,16 @@ private:
 
 	boolean m_crc_fwd_en;		// has FCS to be removed?
 
+	unsigned m_hfb_filters;		// number of used HW filters
+
+	CMACAddress m_mc_list[MAX_MULTICAST_ADDRESSES];	// multicast filter list
+	unsigned m_mc_count;		// or GENET_MC_PROMISC, if too many addresses
+
+	unsigned m_mtu;
+
+	// transmitted net buffers, cannot be released from interrupt context
+	CSPSCRing<CNetBuffer *> m_TxDoneRing;
+
 	// PHY status
 	int m_phy_id;			// probed address of this PHY
 
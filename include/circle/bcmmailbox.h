@@ -2,7 +2,7 @@
 // bcmmailbox.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -33,10 +33,14 @@ public:
 
 	u32 WriteRead (unsigned nData);
 
+	// asynchronous request, only one can be pending in the system
+	boolean WriteAsync (u32 nData);			// returns FALSE if another one is pending
+	boolean PollRead (u32 *pResult);		// returns TRUE if the response has arrived
+
 private:
 	void Flush (void);
 
-	u32 Read (void);
+	u32 Read (unsigned nChannel);
 	void Write (u32 nData);
 
 private:
@@ -44,6 +48,11 @@ private:
 	boolean m_bEarlyUse;
 
 	static CSpinLock s_SpinLock;
+
+	static boolean s_bAsyncPending;
+	static boolean s_bAsyncDone;			// response has been read already
+	static unsigned s_nAsyncChannel;
+	static u32 s_nAsyncResult;
 };
 
 #endif
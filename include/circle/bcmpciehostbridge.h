@@ -7,7 +7,7 @@
 //	Licensed under GPL-2.0
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2019-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2019-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -58,6 +58,11 @@ public:
 
 	boolean EnableDevice (u32 nClassCode, unsigned nSlot, unsigned nFunc);
 
+	/// \brief Enable MSI on an enabled device, vector numbers are passed to the MSI handler
+	/// \param nMaxVectors Max. number of vectors requested (up to 32)
+	/// \return Number of vectors enabled (power of 2, 0 if the device does not support MSI)
+	unsigned EnableMSI (unsigned nSlot, unsigned nFunc, unsigned nMaxVectors = 1);
+
 	boolean ConnectMSI (TPCIeMSIHandler *pHandler, void *pParam);
 	void DisconnectMSI (void);
 
@@ -76,6 +81,7 @@ private:
 
 	int enable_bridge (void);
 	int enable_device (u32 nClassCode, unsigned nSlot, unsigned nFunc);
+	int enable_device_msi (unsigned nSlot, unsigned nFunc, unsigned nMaxVectors);
 
 	int pcie_set_pci_ranges(void);
 	int pcie_set_dma_ranges(void);
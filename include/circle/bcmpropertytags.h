@@ -2,7 +2,7 @@
 // bcmpropertytags.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -277,6 +277,20 @@ struct TPropertyTagCommandLine
 }
 PACKED;
 
+#define PROPTAG_BATCH_MAX_TAGS	16
+
+#define PROPTAG_CACHE_ENTRIES	16
+#define PROPTAG_CACHE_TAG_SIZE	32			// bytes, larger tags are not cached
+
+enum TPropertyTagsStatus
+{
+	PropertyTagsStatusBusy,
+	PropertyTagsStatusDone,
+	PropertyTagsStatusError
+};
+
+struct TPropertyBuffer;
+
 class CBcmPropertyTags
 {
 public:
@@ -291,8 +305,57 @@ public:
 	boolean GetTags (void	 *pTags,			// pointer to tags struct
 			 unsigned nTagsSize);			// size of tags struct
 
+	// same as GetTag(), but for immutable values (e.g. board revision, MAC address),
+	// the response is cached for further calls with the same tag and request parameter
+	boolean GetTagCached (u32 nTagId, void *pTag, unsigned nTagSize,
+			      unsigned nRequestParmSize = 0);	// max. 4 parameter bytes
+
+	// batch of tags, which is submitted with a single mailbox call,
+	// the tag structs are updated, when the batch has been completed
+	void BeginBatch (void);
+	boolean AddTag (u32	  nTagId,			// returns FALSE if batch is full
+			void	 *pTag,				// parameters as with GetTag()
+			unsigned  nTagSize,
+			unsigned  nRequestParmSize = 0);
+	// returns FALSE if the call failed or a tag has not been answered,
+	// nValueLength of the tag header is 0 in the latter case
+	boolean SubmitBatch (void);
+
+	// asynchronous submission, this object and the tag structs must persist until completion,
+	// only one asynchronous request can be pending in the system
+	boolean SubmitBatchAsync (void);			// returns FALSE if another one is pending
+	TPropertyTagsStatus PollBatch (void);			// updates the tag structs when done
+
+private:
+	u32 PrepareBatch (TPropertyBuffer *pBuffer);		// returns bus address of buffer
+	boolean CompleteBatch (TPropertyBuffer *pBuffer);
+
+	static TPropertyBuffer *GetBuffer (boolean bAsync);
+
 private:
 	CBcmMailBox m_MailBox;
+	boolean m_bEarlyUse;
+
+	struct
+	{
+		void	 *pTag;
+		unsigned  nTagSize;
+	}
+	m_Batch[PROPTAG_BATCH_MAX_TAGS];
+	unsigned m_nBatchTags;
+	boolean m_bAsyncPending;
+
+	struct TCacheEntry
+	{
+		u32	 nTagId;
+		u32	 nRequestParm;
+		unsigned nTagSize;
+		u32	 Tag[PROPTAG_CACHE_TAG_SIZE / sizeof (u32)];
+	};
+
+	static TCacheEntry s_Cache[PROPTAG_CACHE_ENTRIES];
+	static volatile unsigned s_nCacheEntries;
+	static CSpinLock s_CacheSpinLock;
 };
 
 #endif
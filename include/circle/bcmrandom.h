@@ -2,7 +2,7 @@
 // bcmrandom.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,8 +21,22 @@
 #define _circle_bcmrandom_h
 
 #include <circle/spinlock.h>
+#include <circle/timer.h>
+#include <circle/sysconfig.h>
 #include <circle/types.h>
 
+#define RANDOM_POOL_WORDS	32		///< Hardware words buffered for reseeding
+#define RANDOM_POOL_INTERVAL	(HZ / 10)	///< Pool is refilled in this interval
+#define RANDOM_BUFFER_BLOCKS	4		///< ChaCha20 blocks generated at once
+#define RANDOM_RESEED_REFILLS	64		///< CSPRNG is reseeded after this number of refills
+
+/// \note GetNumber() returns the raw output of the hardware generator and may wait for it.
+///	  GetBytes() returns the output of a ChaCha20 based CSPRNG, which exists once per core
+///	  and is reseeded from an entropy pool. The pool is refilled from the hardware
+///	  generator by a kernel timer in the background. Each refill of the CSPRNG replaces
+///	  its key with the first output block ("fast key erasure"), so that previous output
+///	  cannot be reconstructed.
+
 class CBcmRandomNumberGenerator		/// Driver for the build-in hardware random number generator
 {
 public:
@@ -32,9 +46,41 @@ public:
 	/// \return Random number (32-bit)
 	u32 GetNumber (void);
 
+	/// \brief Get cryptographically secure random bytes
+	/// \param pBuffer Buffer to be filled
+	/// \param nCount Number of bytes
+	/// \note Does not wait for the hardware normally. Can be called from any core, on
+	///	  TASK_LEVEL and from IRQ context.
+	void GetBytes (void *pBuffer, size_t nCount);
+
+private:
+	struct TCSPRNG
+	{
+		u32	Key[8];
+		u32	Buffer[RANDOM_BUFFER_BLOCKS * 16];
+		unsigned nAvail;			// unused bytes at the end of Buffer
+		unsigned nRefills;			// until next reseed
+	};
+
+	static void Refill (TCSPRNG *pState);
+	static void Reseed (TCSPRNG *pState);
+
+	static void ChaCha20Block (const u32 Key[8], u32 nCounter, u32 Output[16]);
+
+	static u32 GetPoolWord (void);
+	static boolean TryGetNumber (u32 *pNumber);	// s_SpinLock must be acquired
+
+	static void PoolTimerHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext);
+
 private:
 	static CSpinLock s_SpinLock;
 	static boolean s_bInitialized;
+
+	static TCSPRNG s_CSPRNG[CORES];
+
+	static u32 s_Pool[RANDOM_POOL_WORDS];
+	static unsigned s_nPoolWords;
+	static boolean s_bPoolTimerStarted;
 };
 
 #endif
@@ -0,0 +1,136 @@
+//
+/// \file benchmark.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_benchmark_h
+#define _circle_benchmark_h
+
+#include <circle/device.h>
+#include <circle/types.h>
+
+#define BENCHMARK_MAX_ENTRIES	64
+
+/// \brief A benchmark function, which executes one repetition of the measured operation
+/// \param pParam User parameter handed over to Register()
+/// \return Operation successful? (the benchmark is aborted on FALSE)
+typedef boolean TBenchmarkFunction (void *pParam);
+
+/// \brief Output handler for WriteCSV() and WriteJSON()
+typedef void TBenchmarkWriteHandler (const void *pBuffer, size_t nLength, void *pParam);
+
+struct TBenchmarkResult
+{
+	const char	*pSuite;
+	const char	*pName;
+	boolean		 bValid;		// FALSE, if not run or aborted
+	unsigned	 nRepetitions;
+	u64		 nMinNanos;		// duration of one repetition
+	u64		 nMedianNanos;
+	u64		 nMeanNanos;
+	u64		 nMaxNanos;
+	u64		 nStdDevNanos;
+	u64		 nMedianCycles;		// 0, if the PMU is not available
+	u64		 nBytes;		// per repetition (0 if not relevant)
+	unsigned	 nKBytesPerSec;		// based on the median (0 if nBytes is 0)
+};
+
+/// \note The benchmarks are executed on the calling core. Each benchmark is executed\n
+///	  nWarmup times without measurement first and nRepetitions times afterwards.\n
+///	  The duration of each repetition is measured with the PMU cycle counter and\n
+///	  converted to nanoseconds using the current ARM clock rate. Repetitions, which\n
+///	  take one second or more, are measured with the system timer instead.
+/// \note For reproducible results the CPU clock should be set to a fixed speed\n
+///	  (e.g. with CCPUThrottle::SetSpeed(CPUSpeedMaximum)) before calling Run().
+/// \note The PMU cycle counter cannot be used by another class (e.g. CPMUProfiler) on the\n
+///	  same core at the same time.
+
+class CBenchmark		/// Registry and runner for reproducible micro-benchmarks
+{
+public:
+	/// \param nWarmup Number of repetitions, which are not measured
+	/// \param nRepetitions Number of measured repetitions
+	CBenchmark (unsigned nWarmup = 3, unsigned nRepetitions = 21);
+	~CBenchmark (void);
+
+	/// \brief Register a benchmark
+	/// \param pSuite Name of the suite, this benchmark belongs to (must be a static string)
+	/// \param pName Name of the benchmark (must be a static string)
+	/// \param pFunction Function, which executes one repetition
+	/// \param pParam User parameter handed over to pFunction
+	/// \param nBytes Number of bytes processed per repetition (for the throughput)
+	/// \return Operation successful?
+	boolean Register (const char *pSuite, const char *pName, TBenchmarkFunction *pFunction,
+			  void *pParam = 0, u64 nBytes = 0);
+
+	/// \brief Run the registered benchmarks
+	/// \param pSuite Run only the benchmarks of this suite (0 for all)
+	/// \return Number of benchmarks, which have been aborted
+	unsigned Run (const char *pSuite = 0);
+
+	/// \return Number of registered benchmarks
+	unsigned GetCount (void) const;
+	/// \param nIndex Index of the benchmark (0..GetCount()-1)
+	/// \return Result of this benchmark
+	const TBenchmarkResult *GetResult (unsigned nIndex) const;
+
+	/// \brief Write the results to the logger
+	void Dump (void) const;
+
+	/// \brief Write the results as CSV with a header line
+	/// \param pHandler Called for each chunk of output (e.g. to write into a file or socket)
+	/// \param pParam Parameter handed over to pHandler
+	void WriteCSV (TBenchmarkWriteHandler *pHandler, void *pParam = 0) const;
+	void WriteCSV (CDevice *pDevice) const;
+
+	/// \brief Write the results as a JSON object with a description of the system
+	/// \param pHandler Called for each chunk of output (e.g. to write into a file or socket)
+	/// \param pParam Parameter handed over to pHandler
+	void WriteJSON (TBenchmarkWriteHandler *pHandler, void *pParam = 0) const;
+	void WriteJSON (CDevice *pDevice) const;
+
+private:
+	boolean RunBenchmark (unsigned nIndex);
+
+	static void DeviceWriteHandler (const void *pBuffer, size_t nLength, void *pParam);
+
+	static u64 SquareRoot (u64 nValue);
+
+private:
+	unsigned m_nWarmup;
+	unsigned m_nRepetitions;
+
+	struct TSample
+	{
+		u64	nNanos;
+		u64	nCycles;
+	}
+	*m_pSample;			// array with m_nRepetitions entries
+
+	struct TEntry
+	{
+		TBenchmarkFunction	*pFunction;
+		void			*pParam;
+		TBenchmarkResult	 Result;
+	}
+	m_Entry[BENCHMARK_MAX_ENTRIES];
+	unsigned m_nEntries;
+
+	unsigned m_nClockRate;		// ARM clock rate in Hz during the last Run()
+};
+
+#endif
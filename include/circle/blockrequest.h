@@ -0,0 +1,94 @@
+//
+/// \file blockrequest.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_blockrequest_h
+#define _circle_blockrequest_h
+
+#include <circle/types.h>
+#include <assert.h>
+
+class CBlockRequest;
+
+/// \param pRequest The completed request, CBlockRequest::GetResult() returns the result
+/// \param pParam User parameter
+typedef void TBlockRequestCompletion (CBlockRequest *pRequest, void *pParam);
+
+class CBlockRequest	/// Asynchronous read or write request to a block device
+{
+public:
+	/// \param bWrite Write request? (read otherwise)
+	/// \param ullOffset Byte offset on the device (must be a multiple of the block size)
+	/// \param pBuffer Buffer to read into or to write from (should be cache-line aligned)
+	/// \param nCount Number of bytes (must be a multiple of the block size)
+	/// \param pHandler Completion routine
+	/// \param pParam User parameter, handed over to the completion routine
+	CBlockRequest (boolean bWrite, u64 ullOffset, void *pBuffer, size_t nCount,
+		       TBlockRequestCompletion *pHandler, void *pParam = 0)
+	:	m_bWrite (bWrite),
+		m_ullOffset (ullOffset),
+		m_pBuffer (pBuffer),
+		m_nCount (nCount),
+		m_nResult (-1),
+		m_pHandler (pHandler),
+		m_pParam (pParam),
+		m_pNext (0)
+	{
+		assert (m_pBuffer != 0);
+		assert (m_nCount > 0);
+	}
+
+	boolean IsWrite (void) const	{ return m_bWrite; }
+	u64 GetOffset (void) const	{ return m_ullOffset; }
+	void *GetBuffer (void) const	{ return m_pBuffer; }
+	size_t GetCount (void) const	{ return m_nCount; }
+
+	/// \return Number of transferred bytes or < 0 on failure
+	int GetResult (void) const	{ return m_nResult; }
+
+	/// \brief Called by the device, to translate the offset (e.g. partition to disk)
+	void SetOffset (u64 ullOffset)	{ m_ullOffset = ullOffset; }
+
+	/// \brief Called by the device, when the request has been processed
+	/// \param nResult Number of transferred bytes or < 0 on failure
+	void Complete (int nResult)
+	{
+		m_nResult = nResult;
+
+		if (m_pHandler != 0)
+		{
+			(*m_pHandler) (this, m_pParam);
+		}
+	}
+
+private:
+	boolean m_bWrite;
+	u64 m_ullOffset;
+	void *m_pBuffer;
+	size_t m_nCount;
+
+	volatile int m_nResult;
+
+	TBlockRequestCompletion *m_pHandler;
+	void *m_pParam;
+
+	CBlockRequest *m_pNext;			// used by CBlockRequestQueue
+	friend class CBlockRequestQueue;
+};
+
+#endif
@@ -0,0 +1,76 @@
+//
+/// \file boottrace.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_boottrace_h
+#define _circle_boottrace_h
+
+#include <circle/device.h>
+#include <circle/logger.h>
+#include <circle/types.h>
+
+#define BOOT_TRACE_MAX_EVENTS	64
+
+struct TBootTraceEvent
+{
+	const char	*pName;
+	unsigned	 nClockTicks;		// microseconds since power-on
+};
+
+/// \note The boot timeline is recorded from sysinit() on. The first event "sysinit" shows\n
+///	  the time, which has been spent in the firmware. The system classes record an\n
+///	  event at the end of their Initialize() method. The time difference to the previous\n
+///	  event is the duration of a step therefore.
+/// \note The events are kept in a static buffer, which is available without a heap.
+
+class CBootTrace	/// Records a timeline of the system initialization
+{
+public:
+	/// \brief Records an event with the current time
+	/// \param pName Name of the event (must remain valid, normally a string literal)
+	static void Mark (const char *pName);
+	/// \brief Records an event with a given time
+	/// \param pName Name of the event (must remain valid, normally a string literal)
+	/// \param nClockTicks Time of the event (from CTimer::GetClockTicks())
+	static void Mark (const char *pName, unsigned nClockTicks);
+
+	/// \return Number of recorded events
+	static unsigned GetCount (void);
+	/// \param nIndex Index of the event (0 .. GetCount()-1)
+	/// \param pClockTicks Time of the event in microseconds since power-on is stored here
+	/// \return Name of the event
+	static const char *GetEvent (unsigned nIndex, unsigned *pClockTicks);
+
+	/// \brief Writes the timeline with the duration of each step to the logger
+	/// \param Severity Severity of the log messages
+	static void Dump (TLogSeverity Severity = LogNotice);
+	/// \brief Writes the timeline as text table to a device (e.g. a file)
+	/// \param pTarget Device to be used for output
+	static void Write (CDevice *pTarget);
+
+	/// \brief Has to be called, when the clock counter has been set to a new value
+	/// \param nDelta New counter value minus old counter value
+	static void ClockChanged (unsigned nDelta);
+
+private:
+	static TBootTraceEvent s_Event[BOOT_TRACE_MAX_EVENTS];
+	static volatile int s_nEvents;
+	static unsigned s_nClockDelta;
+};
+
+#endif
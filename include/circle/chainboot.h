@@ -27,7 +27,9 @@
 extern "C" {
 #endif
 
-void EnableChainBoot (const void *pKernelImage, size_t nKernelSize);
+// pKernelImage may be compressed in the LZ4 frame format (see lz4decoder.h),
+// it is decompressed here then. Returns FALSE, if the image is invalid.
+boolean EnableChainBoot (const void *pKernelImage, size_t nKernelSize);
 
 boolean IsChainBootEnabled (void);
 
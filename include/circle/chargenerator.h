@@ -34,6 +34,9 @@ public:
 	
 	boolean GetPixel (char chAscii, unsigned nPosX, unsigned nPosY) const;
 
+	// returns all pixels of a line, pixel 0 is bit (GetCharWidth()-1), pixel 1 the next lower bit
+	u32 GetPixelLine (char chAscii, unsigned nPosY) const;
+
 private:
 	unsigned m_nCharWidth;
 };
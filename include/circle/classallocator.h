@@ -23,6 +23,9 @@
 #define _circle_classallocator_h
 
 #include <circle/spinlock.h>
+#include <circle/synchronize.h>
+#include <circle/sysconfig.h>
+#include <circle/macros.h>
 #include <circle/types.h>
 #include <assert.h>
 
@@ -36,6 +39,10 @@
 		static void InitAllocator (unsigned nReservedObjects);		\
 		static void InitProtectedAllocator (unsigned nReservedObjects,	\
 						    unsigned nTargetLevel);	\
+		static CClassAllocator *GetAllocator (void)			\
+		{								\
+			return s_pAllocator;					\
+		}								\
 	private:								\
 		static CClassAllocator *s_pAllocator;
 
@@ -86,6 +93,22 @@
 #define INIT_PROTECTED_CLASS_ALLOCATOR(class, objects, level) \
 	class::InitProtectedAllocator (objects, level)
 
+// On multi-core builds the protected allocator keeps a small per-core cache of free
+// objects, which is refilled from and drained to the shared free list in batches.
+// Each cache has its own spin lock, which is normally taken by its own core only,
+// so that the cores do not contend on every allocation.
+#define CLASS_ALLOCATOR_BATCH		8
+#define CLASS_ALLOCATOR_CACHE_MAX	(2*CLASS_ALLOCATOR_BATCH)
+
+struct TClassAllocatorStats
+{
+	unsigned nReservedObjects;
+	unsigned nFreeObjects;		// in the shared list and in the per-core caches
+	unsigned nAllocations;		// total number of Allocate() calls
+	unsigned nRefills;		// per-core cache refills from the shared list
+	unsigned nSteals;		// objects taken from the cache of another core
+};
+
 class CClassAllocator
 {
 public:
@@ -106,9 +129,18 @@ public:
 
 	void Extend (unsigned nReservedObjects, unsigned nTargetLevel);
 
+	// the counters are not synchronized with Allocate() and Free()
+	void GetStats (TClassAllocatorStats *pStats);
+
 private:
 	void Init (size_t nObjectSize, unsigned nReservedObjects);
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	void *AllocateCached (void);
+	void FreeCached (struct TBlock *pBlock);
+	struct TBlock *Steal (unsigned nThisCore);
+#endif
+
 private:
 	size_t      m_nObjectSize;
 	unsigned    m_nReservedObjects;
@@ -120,6 +152,23 @@ private:
 	boolean   m_bProtected;
 	unsigned  m_nTargetLevel;
 	CSpinLock m_SpinLock;
+
+	unsigned  m_nAllocations;
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	struct TCoreCache
+	{
+		CSpinLock     *pSpinLock;
+		struct TBlock *pFreeList;
+		unsigned       nCount;
+		unsigned       nAllocations;
+		unsigned       nRefills;
+		unsigned       nSteals;
+	}
+	ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+	TCoreCache m_CoreCache[CORES];
+#endif
 };
 
 #endif
@@ -0,0 +1,180 @@
+//
+/// \file corechannel.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_corechannel_h
+#define _circle_corechannel_h
+
+#include <circle/sysconfig.h>
+
+#ifdef ARM_ALLOW_MULTI_CORE
+
+#include <circle/multicore.h>
+#include <circle/lockfreering.h>
+#include <circle/spinlock.h>
+#include <circle/synchronize.h>
+#include <circle/types.h>
+#include <assert.h>
+
+enum TCoreChannelWakeup
+{
+	CoreChannelWakeupEvent,		///< SEV, receiving core waits with Wait() (WFE)
+	CoreChannelWakeupIPI,		///< IPI_CORE_CHANNEL, calls the receive handler
+	CoreChannelWakeupUnknown
+};
+
+/// \note With CoreChannelWakeupIPI the IPI is sent only, when the channel was empty before,
+///	  so that a batch of messages causes one interrupt only. The receive handler is called
+///	  in IRQ context on the receiving core then. It may set a CSynchronizationEvent, to wake
+///	  up a task, which drains the channel. An override of CMultiCoreSupport::IPIHandler()
+///	  must call the method of the base class for IPI_CORE_CHANNEL.
+
+class CCoreChannelBase	/// Common part of all core-to-core message channels
+{
+public:
+	/// \param pParam User parameter, which was handed over to RegisterReceiveHandler()
+	typedef void TReceiveHandler (void *pParam);
+
+public:
+	/// \param nToCore Core, which receives the messages
+	/// \param Wakeup How the receiving core is notified about new messages
+	CCoreChannelBase (unsigned nToCore, TCoreChannelWakeup Wakeup);
+
+	virtual ~CCoreChannelBase (void);
+
+	/// \param pHandler Called on the receiving core, when messages arrived (IPI wakeup only)
+	/// \param pParam User parameter, which will be handed over to the handler
+	void RegisterReceiveHandler (TReceiveHandler *pHandler, void *pParam = 0);
+
+	/// \brief Called from CMultiCoreSupport::IPIHandler() on IPI_CORE_CHANNEL
+	static void IPIHandler (unsigned nCore);
+
+protected:
+	void Notify (boolean bWasEmpty);
+
+	unsigned GetToCore (void) const
+	{
+		return m_nToCore;
+	}
+
+private:
+	unsigned m_nToCore;
+	TCoreChannelWakeup m_Wakeup;
+
+	TReceiveHandler *volatile m_pHandler;
+	void *m_pParam;
+
+	CCoreChannelBase *m_pNext;			// channels to the same core
+
+	static CCoreChannelBase *s_pFirst[CORES];
+	static CSpinLock s_SpinLock;
+};
+
+/// \note One core sends, another core receives the messages. The messages are copied into
+///	  a CSPSCRing, which keeps the indices of the sender and of the receiver on different
+///	  cache lines. Small messages (e.g. pointers to buffers) should be preferred.
+
+template <class T>
+class CCoreChannel : public CCoreChannelBase	/// Message channel from one core to another
+{
+public:
+	/// \param nSize Capacity in messages (must be a power of 2)
+	/// \param nToCore Core, which receives the messages
+	/// \param Wakeup How the receiving core is notified about new messages
+	CCoreChannel (unsigned nSize, unsigned nToCore,
+		      TCoreChannelWakeup Wakeup = CoreChannelWakeupEvent)
+	:	CCoreChannelBase (nToCore, Wakeup),
+		m_Ring (nSize)
+	{
+	}
+
+	/// \return FALSE, if the channel is full
+	/// \note Sending core only
+	boolean Send (const T &Message)
+	{
+		return SendMultiple (&Message, 1) == 1;
+	}
+
+	/// \param pMessages Messages to be sent
+	/// \param nCount Number of messages
+	/// \return Number of messages sent (less than nCount, if the channel is full)
+	/// \note Sending core only
+	unsigned SendMultiple (const T *pMessages, unsigned nCount)
+	{
+		unsigned nSent = m_Ring.WriteMultiple (pMessages, nCount);
+		if (nSent > 0)
+		{
+			// orders the write of the tail index before the read of the head index
+			DataMemBarrier ();
+
+			Notify (m_Ring.GetCount () <= nSent);
+		}
+
+		return nSent;
+	}
+
+	/// \return FALSE, if the channel is empty
+	/// \note Receiving core only
+	boolean Receive (T *pMessage)
+	{
+		return ReceiveMultiple (pMessage, 1) == 1;
+	}
+
+	/// \param pMessages Receives the messages
+	/// \param nCount Maximum number of messages
+	/// \return Number of messages received (0 if the channel is empty)
+	/// \note Receiving core only
+	unsigned ReceiveMultiple (T *pMessages, unsigned nCount)
+	{
+		assert (CMultiCoreSupport::ThisCore () == GetToCore ());
+
+		unsigned nReceived = m_Ring.ReadMultiple (pMessages, nCount);
+		if (nReceived == 0)
+		{
+			// the sender decides on the IPI from the head index, which was written before
+			DataMemBarrier ();
+
+			nReceived = m_Ring.ReadMultiple (pMessages, nCount);
+		}
+
+		return nReceived;
+	}
+
+	/// \brief Wait until the channel is not empty (sleeps with WFE)
+	/// \note Receiving core only
+	void Wait (void)
+	{
+		while (m_Ring.IsEmpty ())
+		{
+			WaitForEvent ();
+		}
+	}
+
+	/// \return Is the channel empty? (exact for the receiving core only)
+	boolean IsEmpty (void) const
+	{
+		return m_Ring.IsEmpty ();
+	}
+
+private:
+	CSPSCRing<T> m_Ring;
+};
+
+#endif
+
+#endif
@@ -20,7 +20,10 @@
 #ifndef _circle_cputhrottle_h
 #define _circle_cputhrottle_h
 
+#include <circle/bcmpropertytags.h>
 #include <circle/gpiopin.h>
+#include <circle/timer.h>
+#include <circle/sysconfig.h>
 #include <circle/macros.h>
 #include <circle/types.h>
 
@@ -43,6 +46,18 @@ enum TSystemThrottledState
 
 typedef void TSystemThrottledHandler (TSystemThrottledState CurrentState, void *pParam);
 
+/// \param nCore Core number
+/// \param pParam User parameter
+/// \return Accumulated time in microseconds, which this core has spent idle
+typedef u64 TCPUIdleTimeHandler (unsigned nCore, void *pParam);
+
+#define CPU_GOVERNOR_PERIOD_MSECS	100		// sampling period of the CPU load
+#define CPU_GOVERNOR_STEP		100000000	// Hz, granularity of clock rates
+#define CPU_GOVERNOR_UP_THRESHOLD	80		// percent load, switch to maximum rate
+#define CPU_GOVERNOR_HEADROOM		10		// percent load below up threshold
+#define CPU_GOVERNOR_DOWN_PERIODS	5		// periods with lower load before stepping down
+#define CPU_GOVERNOR_BOOST_MSECS	10000		// max. time above sustained rate
+
 /// \warning You have to repeatedly call SetOnTemperature() or Update() if you use this class!\n
 ///	     See the description of SetOnTemperature() for details!\n
 ///	     IF YOU ARE NOT SURE ABOUT HOW TO MANAGE THIS, DO NOT USE THIS CLASS!
@@ -98,6 +113,8 @@ public:
 	/// Additionally checks for system throttled conditions, if a system\n
 	/// throttled handler is registered.
 	/// \return Operation successful?
+	/// \note The firmware is queried asynchronously, so that the caller does not\n
+	///	  wait for the response. The result is evaluated on a following call.
 	boolean Update (void);
 
 	/// \brief Register a callback function, which is called from Update(),\n
@@ -108,6 +125,25 @@ public:
 	void RegisterSystemThrottledHandler (unsigned StateMask,
 					     TSystemThrottledHandler *pHandler, void *pParam = 0);
 
+	/// \brief Starts an ondemand governor, which selects the clock rate from the CPU load
+	/// \param pIdleTimeHandler Returns the idle time of a core (e.g. CScheduler::IdleTimeHandler)
+	/// \param pParam User parameter to be handed over to pIdleTimeHandler
+	/// \param nCores Number of cores to be watched (the busiest one determines the load)
+	/// \return Operation successful?
+	/// \note The load is sampled and the rate is selected in a kernel timer handler. It\n
+	///	  switches to the maximum rate on a burst of load and steps down to the lowest\n
+	///	  rate, which can handle the load, after some periods (hysteresis). A time budget\n
+	///	  limits operation above the sustained rate (mid of range) to save heat.
+	/// \note The mailbox cannot be used from interrupt context, so that the selected rate\n
+	///	  is applied from Update(), which must still be called frequently (is cheap).
+	boolean StartGovernor (TCPUIdleTimeHandler *pIdleTimeHandler, void *pParam = 0,
+			       unsigned nCores = 1);
+	/// \brief Stops the governor and sets the speed, which has been set before
+	void StopGovernor (void);
+
+	/// \return CPU load of the busiest core in percent in the last governor period
+	unsigned GetGovernorLoad (void) const;
+
 	/// \brief Dump some information on the current CPU status
 	/// \param bAll Dump all information (only current clock rate and temperature otherwise)
 	void DumpStatus (boolean bAll = TRUE);
@@ -118,10 +154,21 @@ public:
 private:
 	boolean SetSpeedInternal (TCPUSpeed Speed, boolean bWait);
 
+	boolean SetOnTemperature (unsigned nTemperature, unsigned nCurrentRate);
+
 	boolean CheckThrottledState (void);
+	void CheckThrottledState (u32 nState);
+
+	boolean StartAsyncUpdate (void);
+	boolean CompleteAsyncUpdate (void);
 
 	void SetToSetDelay (void);
 
+	void CancelGovernor (void);
+	boolean ApplyGovernorRate (void);
+	void GovernorStep (void);
+	static void GovernorHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext);
+
 	static unsigned GetClockRate (unsigned nTagId);		// returns 0 on failure
 	static unsigned GetTemperature (unsigned nTagId);	// returns 0 on failure
 	static boolean SetClockRate (unsigned nRate, boolean bSkipTurbo);
@@ -145,6 +192,27 @@ private:
 	boolean m_bFanConnected;
 	CGPIOPin m_FanPin;
 
+	CBcmPropertyTags m_AsyncTags;		// for Update()
+	boolean m_bAsyncPending;
+	TPropertyTagClockRate m_TagClockRate;
+	TPropertyTagTemperature m_TagTemperature;
+	TPropertyTagSimple m_TagThrottled;
+
+	volatile boolean m_bGovernor;
+	TKernelTimerHandle m_hGovernorTimer;
+	TCPUIdleTimeHandler *m_pIdleTimeHandler;
+	void *m_pIdleTimeParam;
+	unsigned m_nGovernorCores;
+	u64 m_nLastIdleTime[CORES];
+	unsigned m_nGovernorTicks;
+	unsigned m_nSustainedRate;
+	volatile unsigned m_nGovernorRate;	// selected by the governor
+	unsigned m_nGovernorRateSet;		// applied by Update()
+	volatile unsigned m_nGovernorLoad;
+	unsigned m_nDownPeriods;
+	unsigned m_nBoostBudget;		// microseconds
+	volatile boolean m_bOverTemperature;
+
 	static CCPUThrottle *s_pThis;
 };
 
@@ -0,0 +1,79 @@
+//
+/// \file crc32.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_crc32_h
+#define _circle_crc32_h
+
+#include <circle/macros.h>
+#include <circle/types.h>
+
+enum TCRC32Variant
+{
+	CRC32IEEE,		///< IEEE 802.3, zlib, "crc32" tool (polynomial 0x04C11DB7)
+	CRC32C,			///< Castagnoli, iSCSI, ext4, SCTP (polynomial 0x1EDC6F41)
+	CRC32Unknown
+};
+
+/// \note Both variants are reflected with initial and final value 0xFFFFFFFF. The CRC32
+///	  instructions of the ARMv8 CPU are used, if available (Raspberry Pi 3 and 4).
+///	  Otherwise a slice-by-8 table lookup is used (tables are built on first use).
+
+class CCRC32	/// Calculates a CRC-32 incrementally over several pieces of data
+{
+public:
+	/// \param Variant Polynomial to be used
+	CCRC32 (TCRC32Variant Variant = CRC32IEEE)
+	:	m_Variant (Variant)
+	{
+		Reset ();
+	}
+
+	/// \brief Start a new calculation
+	void Reset (void)	{ m_nCRC = 0xFFFFFFFFU; }
+
+	/// \param pBuffer Pointer to the next piece of data
+	/// \param nLength Length of the data in bytes
+	void Update (const void *pBuffer, size_t nLength) MAXOPT;
+
+	/// \return CRC-32 of the data given to Update() since Reset()
+	u32 Get (void) const	{ return ~m_nCRC; }
+
+	/// \param pBuffer Pointer to the data
+	/// \param nLength Length of the data in bytes
+	/// \param Variant Polynomial to be used
+	/// \return CRC-32 of the data
+	static u32 Calculate (const void *pBuffer, size_t nLength,
+			      TCRC32Variant Variant = CRC32IEEE);
+
+private:
+#ifndef __ARM_FEATURE_CRC32
+	static const u32 *GetTable (TCRC32Variant Variant);
+#endif
+
+private:
+	TCRC32Variant m_Variant;
+	u32 m_nCRC;
+
+#ifndef __ARM_FEATURE_CRC32
+	static u32 s_Table[CRC32Unknown][8][256];
+	static volatile boolean s_bTableValid[CRC32Unknown];
+#endif
+};
+
+#endif
@@ -20,6 +20,7 @@
 #ifndef _circle_device_h
 #define _circle_device_h
 
+#include <circle/blockrequest.h>
 #include <circle/types.h>
 
 class CDevice;
@@ -41,9 +42,17 @@ public:
 	// returns the resulting offset, (u64) -1 on error
 	virtual u64 Seek (u64 ullOffset);		// byte offset
 
+	// returns the size of a block device in bytes, (u64) -1 if unknown
+	virtual u64 GetSize (void) const;
+
 	// returns TRUE on successful removal
 	virtual boolean RemoveDevice (void);
 
+	// queues an asynchronous block request, returns FALSE if it cannot be queued
+	// the completion routine may be called before return or from interrupt context
+	// the default implementation processes the request synchronously
+	virtual boolean SubmitRequest (CBlockRequest *pRequest);
+
 public:
 	/// \param pHandler Handler gets called, when device is destroyed (0 to unregister)
 	/// \param pContext Context pointer handed over to the handler
@@ -2,7 +2,7 @@
 // devicenameservice.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,12 +24,18 @@
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
+#define DEVICE_NAME_HASH_SIZE	64		// must be a power of 2
+
+#define DEVICE_NAME_MAX_HANDLERS 8
+
 struct TDeviceInfo
 {
 	TDeviceInfo	*pNext;
+	TDeviceInfo	*pHashNext;		// in hash bucket
 	char		*pName;
 	CDevice		*pDevice;
 	boolean		 bBlockDevice;
+	u32		 nHash;
 };
 
 class CDeviceNameService  /// Devices can be registered by name and retrieved later by this name
@@ -64,8 +70,25 @@ public:
 	/// \param nIndex	Device name index
 	/// \param bBlockDevice TRUE if this is a block device, otherwise character device
 	/// \return Pointer to the device object or 0 if not found
+	/// \note The lookup is hashed and does not format the name string.
 	CDevice *GetDevice (const char *pPrefix, unsigned nIndex, boolean bBlockDevice);
 
+	/// \return Generation number, which changes whenever a device has been added or removed
+	/// \note A device pointer, which has been got by GetDevice(), can be cached by the caller
+	///	  as long as the generation number does not change.
+	unsigned GetGeneration (void) const	{ return m_nGeneration; }
+
+	/// \brief Register a handler, which is called, when a device is removed from the service
+	/// \param pHandler Handler gets called with the removed device, before RemoveDevice() returns
+	/// \param pContext Context pointer handed over to the handler
+	/// \return FALSE, if too many handlers are registered
+	/// \note The device object may be in destruction, when the handler is called. The pointer
+	///	  should be used to invalidate cached references only.
+	boolean RegisterRemovedHandler (TDeviceRemovedHandler *pHandler, void *pContext = 0);
+	/// \param pHandler Handler to be unregistered
+	/// \param pContext Context pointer, which has been used on register
+	void UnregisterRemovedHandler (TDeviceRemovedHandler *pHandler, void *pContext = 0);
+
 	/// \brief Generate device listing
 	/// \param pTarget Device to be used for output
 	void ListDevices (CDevice *pTarget);
@@ -74,7 +97,23 @@ public:
 	static CDeviceNameService *Get (void);
 
 private:
-	TDeviceInfo *m_pList;
+	TDeviceInfo **Find (const char *pPrefix, const char *pSuffix, boolean bBlockDevice);
+
+	static u32 Hash (const char *pPrefix, const char *pSuffix, boolean bBlockDevice);
+	static void FormatIndex (unsigned nIndex, char *pBuffer);
+
+private:
+	TDeviceInfo *m_pList;				// in order of registration (newest first)
+	TDeviceInfo *m_pHashBucket[DEVICE_NAME_HASH_SIZE];
+
+	volatile unsigned m_nGeneration;
+
+	struct
+	{
+		TDeviceRemovedHandler	*pHandler;
+		void			*pContext;
+	}
+	m_RemovedHandler[DEVICE_NAME_MAX_HANDLERS];
 
 	CSpinLock m_SpinLock;
 
@@ -2,7 +2,7 @@
 // devicetreeblob.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,10 +20,12 @@
 #ifndef _circle_devicetreeblob_h
 #define _circle_devicetreeblob_h
 
+#include <circle/hashmap.h>
 #include <circle/types.h>
 
 struct TDeviceTreeNode;
 struct TDeviceTreeProperty;
+struct TDeviceTreeNodeIndex;
 
 class CDeviceTreeBlob	/// Simple Devicetree blob parser
 {
@@ -35,9 +37,15 @@ public:
 	/// \param pPath Path string to the node (e.g. "/node1/node2")
 	/// \param pParentNode Search inside this node, 0 for root node
 	/// \return Opaque pointer to the node, or 0 if not found
+	/// \note An index of all nodes is built on first use, so that an exact path\n
+	///	  is found without walking the tree.
 	const TDeviceTreeNode *FindNode (const char *pPath,
 					 const TDeviceTreeNode *pParentNode = 0) const;
 
+	/// \param nPhandle Value of the "phandle" property of the node
+	/// \return Opaque pointer to the node, or 0 if not found
+	const TDeviceTreeNode *FindNodeByPhandle (u32 nPhandle) const;
+
 	/// \param pNode Pointer to the node
 	/// \param pName Name of the property
 	/// \return Opaque pointer to the property, or 0 if not found
@@ -63,8 +71,23 @@ private:
 						 const TDeviceTreeNode *pNode,
 						 const TDeviceTreeNode **ppNextNode) const;
 
+	const TDeviceTreeNode *FindNodeIndexed (const char *pPath,
+						const TDeviceTreeNode *pParentNode) const;
+	int GetNodeIndex (const TDeviceTreeNode *pNode) const;		// -1 if not found
+	boolean MatchPath (unsigned nIndex, const char *pPath, size_t nLen, int nParent) const;
+
+	void BuildIndex (void) const;
+	unsigned ScanNodes (TDeviceTreeNodeIndex *pIndex) const;	// returns number of nodes
+
 private:
 	u8 *m_pFTD;
+
+	// built on first use
+	mutable boolean m_bIndexed;
+	mutable TDeviceTreeNodeIndex *m_pIndex;
+	mutable unsigned m_nNodes;
+	mutable CHashMap<u32, unsigned> *m_pPathMap;		// path hash to node index
+	mutable CHashMap<u32, unsigned> *m_pPhandleMap;		// phandle to node index
 };
 
 #endif
@@ -2,7 +2,7 @@
 // dmachannel.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -46,6 +46,9 @@ PACKED;
 
 /// \note Do not explicitly use this class! Use the class CDMAChannel instead
 ///       with nChannel set to DMA_CHANNEL_EXTENDED!
+/// \note The DMA4 engine uses 40-bit addresses, so that the buffers can be located anywhere
+///	  in the ARM memory (also above 1 GByte). Transfers, which exceed the maximum length
+///	  of a control block, are executed using a chain of control blocks.
 
 class CDMA4Channel	/// Platform DMA4 "large address" controller support
 {
@@ -55,6 +58,7 @@ public:
 	~CDMA4Channel (void);
 
 	// nBurstLength > 0 increases speed, but may congest the system bus
+	// (nLength may exceed LEN4_XLENGTH_MAX, the transfer is chained then)
 	void SetupMemCopy (void *pDestination, const void *pSource, size_t nLength,
 			   unsigned nBurstLength = 0, boolean bCached = TRUE);
 	void SetupIORead (void *pDestination, u32 nIOAddress, size_t nLength, TDREQ DREQ);
@@ -68,6 +72,22 @@ public:
 			     size_t nBlockLength, unsigned nBlockCount, size_t nBlockStride,
 			     unsigned nBurstLength = 0);
 
+	// copy nBlockCount blocks with different source and destination pitch, uses the 2D mode
+	// if possible, a chain of control blocks (one per block) otherwise
+	void SetupMemCopyRect (void *pDestination, size_t nDestinationPitch,
+			       const void *pSource, size_t nSourcePitch,
+			       size_t nBlockLength, unsigned nBlockCount,
+			       unsigned nBurstLength = 0, boolean bCached = TRUE);
+
+	// fill nBlockCount blocks with nFillWord (pDestination, nDestinationPitch
+	// and nBlockLength should be multiples of 4)
+	void SetupMemFillRect (void *pDestination, size_t nDestinationPitch, u32 nFillWord,
+			       size_t nBlockLength, unsigned nBlockCount,
+			       unsigned nBurstLength = 0, boolean bCached = TRUE);
+
+	void SetupMemSet (void *pDestination, u8 uchValue, size_t nLength,
+			  unsigned nBurstLength = 0, boolean bCached = TRUE);
+
 	void SetCompletionRoutine (TDMACompletionRoutine *pRoutine, void *pParam);
 
 	void Start (void);
@@ -75,6 +95,19 @@ public:
 	boolean GetStatus (void);
 
 private:
+	// copies from pSource, or fills with *m_pFillWord, if pSource is 0
+	void SetupRect (void *pDestination, size_t nDestinationPitch,
+			const void *pSource, size_t nSourcePitch,
+			size_t nBlockLength, unsigned nBlockCount,
+			unsigned nBurstLength, boolean bCached);
+
+	// copies from pSource, or fills with *m_pFillWord, if pSource is 0
+	void SetupLinear (void *pDestination, const void *pSource, size_t nLength,
+			  unsigned nBurstLength, boolean bCached);
+
+	// returns a chain of at least nBlocks control blocks
+	TDMA4ControlBlock *GetChain (unsigned nBlocks);
+
 	void InterruptHandler (void);
 	static void InterruptStub (void *pParam);
 
@@ -83,6 +116,14 @@ private:
 
 	u8 *m_pControlBlockBuffer;
 	TDMA4ControlBlock *m_pControlBlock;
+	u32 *m_pFillWord;			// 4 words following the control block
+
+	u8 *m_pChainBuffer;			// for large and rectangle transfers
+	TDMA4ControlBlock *m_pChain;
+	unsigned m_nChainSize;			// number of control blocks
+
+	TDMA4ControlBlock *m_pFirstControlBlock; // of the prepared transfer
+	unsigned m_nControlBlocks;
 
 	CInterruptSystem *m_pInterruptSystem;
 	boolean m_bIRQConnected;
@@ -94,6 +135,8 @@ private:
 
 	uintptr m_nDestinationAddress;
 	size_t m_nBufferLength;
+
+	unsigned m_nStartTicks;			// for LATENCY_PROBES
 };
 
 #endif
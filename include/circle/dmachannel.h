@@ -22,6 +22,7 @@
 
 #include <circle/dmacommon.h>
 #include <circle/interrupt.h>
+#include <circle/histogram.h>
 #include <circle/machineinfo.h>
 #include <circle/macros.h>
 #include <circle/types.h>
@@ -97,6 +98,63 @@ public:
 			     size_t nBlockLength, unsigned nBlockCount, size_t nBlockStride,
 			     unsigned nBurstLength = 0);
 
+	/// \brief Prepare a 2D memory copy transfer with source and destination pitch
+	/// \param pDestination	   Pointer to the first destination block
+	/// \param nDestinationPitch Distance between the starts of two destination blocks in bytes
+	/// \param pSource	   Pointer to the first source block
+	/// \param nSourcePitch	   Distance between the starts of two source blocks in bytes
+	/// \param nBlockLength	   Length of the blocks to be transferred
+	/// \param nBlockCount	   Number of blocks to be transferred
+	/// \param nBurstLength	   Number of words to be transferred at once (0 = single transfer)
+	/// \param bCached	   Are the destination and source buffers in cached memory regions
+	/// \note Uses the 2D mode of the DMA controller, if possible. Otherwise (with
+	///	  DMA_CHANNEL_LITE or large pitches) a chain of control blocks is used, one per block.
+	/// \note The memory between the destination blocks must not be written during the transfer.
+	void SetupMemCopyRect (void *pDestination, size_t nDestinationPitch,
+			       const void *pSource, size_t nSourcePitch,
+			       size_t nBlockLength, unsigned nBlockCount,
+			       unsigned nBurstLength = 0, boolean bCached = TRUE);
+
+	/// \brief Prepare a 2D memory fill transfer (e.g. fill a rectangle in a frame buffer)
+	/// \param pDestination	   Pointer to the first destination block
+	/// \param nDestinationPitch Distance between the starts of two destination blocks in bytes
+	/// \param nFillWord	   Value to be written to each 32-bit word
+	/// \param nBlockLength	   Length of the blocks to be written
+	/// \param nBlockCount	   Number of blocks to be written
+	/// \param nBurstLength	   Number of words to be transferred at once (0 = single transfer)
+	/// \param bCached	   Is the destination buffer in a cached memory region
+	/// \note pDestination, nDestinationPitch and nBlockLength should be multiples of 4,
+	///	  otherwise the byte order of nFillWord in the destination is not defined.
+	void SetupMemFillRect (void *pDestination, size_t nDestinationPitch, u32 nFillWord,
+			       size_t nBlockLength, unsigned nBlockCount,
+			       unsigned nBurstLength = 0, boolean bCached = TRUE);
+
+	/// \brief Prepare a memory fill transfer
+	/// \param pDestination Pointer to the destination buffer
+	/// \param uchValue	Value to be written to each byte
+	/// \param nLength	Number of bytes to be written
+	/// \param nBurstLength Number of words to be transferred at once (0 = single transfer)
+	/// \param bCached	Is the destination buffer in a cached memory region
+	void SetupMemSet (void *pDestination, u8 uchValue, size_t nLength,
+			  unsigned nBurstLength = 0, boolean bCached = TRUE);
+
+	/// \brief Prepare a transfer using a chain of control blocks, which is set up by the caller
+	/// \param pFirstControlBlock Pointer to the first control block (32-byte aligned)
+	/// \param nControlBlocks	Number of consecutive control blocks (to be cleaned from cache),\n
+	///			the last one is assumed to be the last in the chain
+	/// \note The caller has to maintain the data cache for the buffers.
+	/// \note The chain may be cyclic, then it has to be stopped with Cancel().
+	/// \note This method is not supported with DMA_CHANNEL_EXTENDED.
+	void SetupControlBlocks (TDMAControlBlock *pFirstControlBlock, unsigned nControlBlocks);
+
+	/// \return Number of the assigned DMA channel (for control blocks, which access its registers)
+	/// \note This method is not supported with DMA_CHANNEL_EXTENDED.
+	unsigned GetChannelNumber (void) const;
+
+	/// \brief Stop a running transfer immediately, the completion routine is not called
+	/// \note This method is not supported with DMA_CHANNEL_EXTENDED.
+	void Cancel (void);
+
 	/// \brief Set completion routine to be called, when the transfer is finished
 	/// \param pRoutine Pointer to the completion routine
 	/// \param pParam   User parameter
@@ -114,7 +172,18 @@ public:
 	/// \return Has the transfer been successful?
 	boolean GetStatus (void);
 
+	/// \return Distribution of the time from Start() until the completion routine is called\n
+	///	    in microseconds (all channels)
+	/// \note This is recorded with the system option LATENCY_PROBES only.
+	static CHistogram<> *GetCompletionLatency (void);
+
 private:
+	// copies from pSource, or fills with *m_pFillWord, if pSource is 0
+	void SetupRect (void *pDestination, size_t nDestinationPitch,
+			const void *pSource, size_t nSourcePitch,
+			size_t nBlockLength, unsigned nBlockCount,
+			unsigned nBurstLength, boolean bCached);
+
 	void InterruptHandler (void);
 	static void InterruptStub (void *pParam);
 
@@ -123,6 +192,14 @@ private:
 
 	u8 *m_pControlBlockBuffer;
 	TDMAControlBlock *m_pControlBlock;
+	u32 *m_pFillWord;			// 4 words following the control block
+
+	u8 *m_pChainBuffer;			// for SetupRect() without 2D mode
+	TDMAControlBlock *m_pChain;
+	unsigned m_nChainSize;			// number of control blocks
+
+	TDMAControlBlock *m_pFirstControlBlock;	// of the prepared transfer
+	unsigned m_nControlBlocks;
 
 	CInterruptSystem *m_pInterruptSystem;
 	boolean m_bIRQConnected;
@@ -135,6 +212,10 @@ private:
 	uintptr m_nDestinationAddress;
 	size_t m_nBufferLength;
 
+	unsigned m_nStartTicks;			// for LATENCY_PROBES
+
+	static CHistogram<> s_CompletionLatency;
+
 #if RASPPI >= 4
 	CDMA4Channel *m_pDMA4Channel;
 #endif
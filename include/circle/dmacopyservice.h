@@ -0,0 +1,197 @@
+//
+/// \file dmacopyservice.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_dmacopyservice_h
+#define _circle_dmacopyservice_h
+
+#include <circle/dmachannel.h>
+#include <circle/interrupt.h>
+#include <circle/spinlock.h>
+#include <circle/types.h>
+
+#ifndef DMA_COPY_CHANNELS
+#define DMA_COPY_CHANNELS	2		///< Size of the channel pool (at most)
+#endif
+
+#ifndef DMA_COPY_QUEUE_SIZE
+#define DMA_COPY_QUEUE_SIZE	32		///< Requests waiting for a free channel
+#endif
+
+#ifndef DMA_COPY_BURST_LENGTH
+#define DMA_COPY_BURST_LENGTH	8		///< Words per burst (0 = single transfer)
+#endif
+
+/// \note Memory-to-memory transfers are executed asynchronously by a pool of normal DMA
+///	  channels. A request is started immediately on an idle channel or is queued.
+///	  The optional completion handler is called at IRQ_LEVEL.
+/// \note On the Raspberry Pi 1-3 the buffers must be located in the first GByte of the
+///	  address space (e.g. allocated from HEAP_DMA30 or the frame buffer). Requests for
+///	  other buffers are rejected, so that the caller can fall back to memcpy(). On the
+///	  Raspberry Pi 4 an additional DMA4 channel (DMA_CHANNEL_EXTENDED) is allocated, if
+///	  available, which services the requests with buffers above 1 GByte and large
+///	  transfers.
+/// \note The buffers must not be accessed by the CPU, before the request has completed.
+
+class CDMACopyService	/// Asynchronous memcpy() and memset() using the DMA controller
+{
+public:
+	/// \param bStatus Has the transfer been successful?
+	/// \param pParam  User parameter given on submit
+	typedef void TCompletionHandler (boolean bStatus, void *pParam);
+
+public:
+	/// \param pInterruptSystem Pointer to the interrupt system object
+	/// \param nChannels Maximum number of DMA channels to be allocated
+	CDMACopyService (CInterruptSystem *pInterruptSystem, unsigned nChannels = DMA_COPY_CHANNELS);
+
+	~CDMACopyService (void);
+
+	/// \return Has at least one DMA channel been allocated?
+	boolean Initialize (void);
+
+	/// \brief Submit a memory copy request
+	/// \param pDestination Pointer to the destination buffer
+	/// \param pSource Pointer to the source buffer
+	/// \param nLength Number of bytes to be copied
+	/// \param pHandler Completion handler (0 for none)
+	/// \param pParam User parameter handed over to the completion handler
+	/// \return FALSE, if the request cannot be serviced (queue full or buffer not DMA-able)
+	/// \note The buffers must not overlap.
+	boolean Copy (void *pDestination, const void *pSource, size_t nLength,
+		      TCompletionHandler *pHandler = 0, void *pParam = 0);
+
+	/// \brief Submit a 2D memory copy request (e.g. a rectangle in a frame buffer)
+	/// \param pDestination Pointer to the first destination block (line)
+	/// \param nDestinationPitch Distance between the starts of two destination blocks in bytes
+	/// \param pSource Pointer to the first source block (line)
+	/// \param nSourcePitch Distance between the starts of two source blocks in bytes
+	/// \param nBlockLength Length of each block in bytes
+	/// \param nBlockCount Number of blocks
+	/// \param pHandler Completion handler (0 for none)
+	/// \param pParam User parameter handed over to the completion handler
+	/// \return FALSE, if the request cannot be serviced (queue full or buffer not DMA-able)
+	boolean Copy2D (void *pDestination, size_t nDestinationPitch,
+			const void *pSource, size_t nSourcePitch,
+			size_t nBlockLength, unsigned nBlockCount,
+			TCompletionHandler *pHandler = 0, void *pParam = 0);
+
+	/// \brief Submit a 2D memory fill request (e.g. fill a rectangle in a frame buffer)
+	/// \param pDestination Pointer to the first destination block (line)
+	/// \param nDestinationPitch Distance between the starts of two destination blocks in bytes
+	/// \param nFillWord Value to be written to each 32-bit word
+	/// \param nBlockLength Length of each block in bytes
+	/// \param nBlockCount Number of blocks
+	/// \param pHandler Completion handler (0 for none)
+	/// \param pParam User parameter handed over to the completion handler
+	/// \return FALSE, if the request cannot be serviced (queue full, buffer not DMA-able
+	///	    or not word aligned)
+	boolean Fill2D (void *pDestination, size_t nDestinationPitch, u32 nFillWord,
+			size_t nBlockLength, unsigned nBlockCount,
+			TCompletionHandler *pHandler = 0, void *pParam = 0);
+
+	/// \brief Submit a memory fill request
+	/// \param pDestination Pointer to the destination buffer
+	/// \param nValue Value to be written to each byte (only the lower 8 bits are used)
+	/// \param nLength Number of bytes to be written
+	/// \param pHandler Completion handler (0 for none)
+	/// \param pParam User parameter handed over to the completion handler
+	/// \return FALSE, if the request cannot be serviced (queue full or buffer not DMA-able)
+	boolean Set (void *pDestination, int nValue, size_t nLength,
+		     TCompletionHandler *pHandler = 0, void *pParam = 0);
+
+	/// \return Have all submitted requests completed?
+	boolean IsIdle (void) const;
+
+	/// \brief Wait until all submitted requests have completed
+	/// \note Must be called with IRQs enabled.
+	void Wait (void);
+
+	/// \return Can the buffer be accessed by a normal (legacy) DMA channel?
+	static boolean IsDMAAble (const void *pBuffer, size_t nLength);
+
+	/// \return Pointer to the only instance of this class (0 if not created)
+	static CDMACopyService *Get (void);
+
+private:
+	enum TRequestType
+	{
+		RequestCopy,
+		RequestCopy2D,
+		RequestFill2D,
+		RequestSet
+	};
+
+	struct TRequest
+	{
+		TRequestType		 Type;
+		void			*pDestination;
+		const void		*pSource;
+		size_t			 nLength;		// block length for Request*2D
+		size_t			 nDestinationPitch;
+		size_t			 nSourcePitch;
+		unsigned		 nBlockCount;
+		u8			 uchValue;
+		u32			 nFillWord;
+		TCompletionHandler	*pHandler;
+		void			*pParam;
+		boolean			 bExtended;		// requires the DMA4 channel
+	};
+
+	struct TChannel
+	{
+		CDMAChannel	*pDMA;
+		boolean		 bExtended;		// DMA4 channel
+		boolean		 bBusy;
+		TRequest	 Request;		// active request
+		CDMACopyService	*pThis;
+	};
+
+	// sets pRequest->bExtended, if the buffer requires the DMA4 channel,
+	// returns FALSE, if the buffer cannot be accessed at all
+	boolean CheckBuffer (TRequest *pRequest, const void *pBuffer, size_t nSpan,
+			     size_t nBlockLength) const;
+
+	boolean Submit (const TRequest &rRequest);
+	void StartQueued (void);						// lock must be held
+	void Start (TChannel *pChannel, const TRequest &rRequest);		// lock must be held
+
+	void CompletionHandler (TChannel *pChannel, boolean bStatus);
+	static void CompletionStub (unsigned nChannel, boolean bStatus, void *pParam);
+
+private:
+	CInterruptSystem *m_pInterruptSystem;
+	unsigned m_nMaxChannels;
+
+	TChannel m_Channel[DMA_COPY_CHANNELS+1];	// normal channels first, then the DMA4 channel
+	unsigned m_nChannels;
+	boolean m_bExtended;			// DMA4 channel available?
+
+	TRequest m_Queue[DMA_COPY_QUEUE_SIZE];
+	unsigned m_nQueueIn;
+	unsigned m_nQueueOut;
+	unsigned m_nQueued;
+
+	volatile unsigned m_nPending;		// active and queued requests
+
+	CSpinLock m_SpinLock;
+
+	static CDMACopyService *s_pThis;
+};
+
+#endif
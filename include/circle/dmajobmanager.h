@@ -0,0 +1,200 @@
+//
+/// \file dmajobmanager.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_dmajobmanager_h
+#define _circle_dmajobmanager_h
+
+#include <circle/dmachannel.h>
+#include <circle/dmacommon.h>
+#include <circle/interrupt.h>
+#include <circle/spinlock.h>
+#include <circle/types.h>
+
+#ifndef DMA_JOB_CHANNELS
+#define DMA_JOB_CHANNELS	2		///< Size of the channel pool (at most)
+#endif
+
+class CDMAJob;
+
+/// \param pJob    The completed job
+/// \param bStatus Has the job been successful?
+/// \param pParam  User parameter given to SetCompletionRoutine()
+typedef void TDMAJobCompletionRoutine (CDMAJob *pJob, boolean bStatus, void *pParam);
+
+/// \note A job is a sequence of transfers, which is executed in order on one DMA channel.
+///	  It can be submitted again, after it has completed. The buffers of the transfers
+///	  must not be accessed by the CPU, before the job has completed.
+
+class CDMAJob	/// A chain of DMA transfers, which is executed by CDMAJobManager
+{
+public:
+	/// \param nMaxTransfers Maximum number of transfers, which can be added to this job
+	CDMAJob (unsigned nMaxTransfers = 1);
+
+	~CDMAJob (void);
+
+	/// \brief Remove all transfers (the job must not be active)
+	void Clear (void);
+
+	/// \brief Add a memory copy transfer
+	/// \param pDestination Pointer to the destination buffer
+	/// \param pSource	Pointer to the source buffer
+	/// \param nLength	Number of bytes to be transferred
+	/// \param nBurstLength Number of words to be transferred at once (0 = single transfer)
+	/// \param bCached	Are the destination and source buffers in cached memory regions
+	void AddMemCopy (void *pDestination, const void *pSource, size_t nLength,
+			 unsigned nBurstLength = 0, boolean bCached = TRUE);
+
+	/// \brief Add an I/O read transfer
+	/// \param pDestination Pointer to the destination buffer
+	/// \param nIOAddress	I/O address to be read from (ARM-side or bus address)
+	/// \param nLength	Number of bytes to be transferred
+	/// \param DREQ		DREQ line for pacing the transfer (see dmacommon.h)
+	void AddIORead (void *pDestination, u32 nIOAddress, size_t nLength, TDREQ DREQ);
+
+	/// \brief Add an I/O write transfer
+	/// \param nIOAddress	I/O address to be written (ARM-side or bus address)
+	/// \param pSource	Pointer to the source buffer
+	/// \param nLength	Number of bytes to be transferred
+	/// \param DREQ		DREQ line for pacing the transfer (see dmacommon.h)
+	void AddIOWrite (u32 nIOAddress, const void *pSource, size_t nLength, TDREQ DREQ);
+
+	/// \brief Add a transfer, which is described by the caller
+	/// \param rControlBlock Control block (nNextControlBlockAddress is ignored)
+	/// \note The caller has to maintain the data cache for the buffers.
+	void AddControlBlock (const TDMAControlBlock &rControlBlock);
+
+	/// \brief Set completion routine to be called (at IRQ_LEVEL), when the job is finished
+	/// \param pRoutine Pointer to the completion routine (0 for none)
+	/// \param pParam   User parameter
+	void SetCompletionRoutine (TDMAJobCompletionRoutine *pRoutine, void *pParam);
+
+	/// \return Has the job completed (or has it not been submitted at all)?
+	boolean IsDone (void) const;
+
+	/// \return Has the job been successful? (valid after completion)
+	boolean GetStatus (void) const;
+
+private:
+	TDMAControlBlock *AddTransfer (uintptr nInvalidateAddress, size_t nInvalidateLength);
+
+	// prepares the chain of control blocks for Submit()
+	void Prepare (void);
+	// link the chain to the first control block of pNext
+	void Link (CDMAJob *pNext);
+
+	boolean HasCompleted (void) const;	// checks the token written by the DMA controller
+	void Complete (boolean bStatus);
+
+private:
+	unsigned m_nMaxTransfers;
+	unsigned m_nTransfers;
+
+	u8 *m_pBuffer;
+	TDMAControlBlock *m_pControlBlock;	// m_nMaxTransfers + 1 (writes the token)
+	u32 *m_pTokenSource;			// own cache line
+	volatile u32 *m_pToken;			// own cache line
+
+	struct TInvalidateRange
+	{
+		uintptr	nAddress;		// 0 if none
+		size_t	nLength;
+	};
+
+	TInvalidateRange *m_pInvalidate;	// one per transfer, after completion
+
+	TDMAJobCompletionRoutine *m_pCompletionRoutine;
+	void *m_pCompletionParam;
+
+	volatile boolean m_bActive;
+	boolean m_bStatus;
+
+	CDMAJob *m_pNext;			// in the job list of a channel
+
+	friend class CDMAJobManager;
+};
+
+/// \note The job manager allocates a pool of normal DMA channels and distributes the
+///	  submitted jobs over it. When a channel is busy, the control blocks of a new job are
+///	  linked to the end of the running chain, so that the DMA controller continues with
+///	  it without a gap. Each job ends with a control block, which writes a token to
+///	  memory and raises the interrupt. The completion is detected using this token, so
+///	  that coalesced interrupts and a link, which came too late, are handled correctly.
+///	  One interrupt handler services all channels of the pool.
+/// \note The buffers must be located in the first GByte of the address space (e.g.
+///	  allocated from HEAP_DMA30 or the frame buffer).
+
+class CDMAJobManager	/// Executes DMA jobs of many clients on a small pool of DMA channels
+{
+public:
+	/// \param pInterruptSystem Pointer to the interrupt system object
+	/// \param nChannels Maximum number of DMA channels to be allocated
+	CDMAJobManager (CInterruptSystem *pInterruptSystem, unsigned nChannels = DMA_JOB_CHANNELS);
+
+	~CDMAJobManager (void);
+
+	/// \return Has at least one DMA channel been allocated?
+	boolean Initialize (void);
+
+	/// \brief Submit a job for execution
+	/// \param pJob Job with at least one transfer, which is not active
+	void Submit (CDMAJob *pJob);
+
+	/// \return Have all submitted jobs completed?
+	boolean IsIdle (void) const;
+
+	/// \brief Wait until all submitted jobs have completed
+	/// \note Must be called with IRQs enabled.
+	void Wait (void);
+
+	/// \return Pointer to the only instance of this class (0 if not created)
+	static CDMAJobManager *Get (void);
+
+private:
+	struct TChannel
+	{
+		unsigned	 nChannel;
+		CDMAJob		*pFirstJob;		// oldest job, which has not been reported
+		CDMAJob		*pLastJob;
+		unsigned	 nJobs;
+	};
+
+	void Start (TChannel *pChannel, CDMAJob *pJob);		// lock must be held
+
+	// returns the list of completed jobs, lock must be held
+	CDMAJob *ChannelHandler (TChannel *pChannel);
+
+	void InterruptHandler (void);
+	static void InterruptStub (void *pParam);
+
+private:
+	CInterruptSystem *m_pInterruptSystem;
+	unsigned m_nMaxChannels;
+
+	TChannel m_Channel[DMA_JOB_CHANNELS];
+	unsigned m_nChannels;
+
+	volatile unsigned m_nPending;		// submitted, not yet completed jobs
+
+	CSpinLock m_SpinLock;
+
+	static CDMAJobManager *s_pThis;
+};
+
+#endif
@@ -54,11 +54,14 @@ public:
 	/// \param DREQ DREQ number to be used to pace the transfer
 	/// \param nChunkSize Size of a chunk, DMA transferred at once, in number of 32-bit words
 	/// \param pInterruptSystem Pointer to the interrupt system
+	/// \param bUseFIQ Use the FIQ instead of an IRQ for the DMA completion interrupt
+	/// \note There is only one FIQ in the system, the handler is called in FIQ context then.
 	CDMASoundBuffers (boolean	    bDirectionOut,
 			  u32		    nIOAddress,
 			  TDREQ		    DREQ,
 			  unsigned	    nChunkSize,
-			  CInterruptSystem *pInterruptSystem);
+			  CInterruptSystem *pInterruptSystem,
+			  boolean	    bUseFIQ = FALSE);
 
 	~CDMASoundBuffers (void);
 
@@ -89,6 +92,7 @@ private:
 	TDREQ m_DREQ;
 	unsigned m_nChunkSize;
 	CInterruptSystem *m_pInterruptSystem;
+	boolean m_bUseFIQ;
 
 	TChunkCompletedHandler *m_pHandler;
 	void *m_pParam;
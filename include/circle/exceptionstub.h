@@ -147,7 +147,8 @@ PACKED;
 
 extern TFIQData FIQData;
 
-extern uintptr IRQReturnAddress;		// for profiling
+extern uintptr IRQReturnAddress;		// for profiling (of core 0)
+extern uintptr IRQReturnAddressOfCore[4];	// same for each core, index is core number
 
 #ifdef __cplusplus
 }
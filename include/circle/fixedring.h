@@ -0,0 +1,103 @@
+//
+/// \file fixedring.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_fixedring_h
+#define _circle_fixedring_h
+
+#include <circle/types.h>
+#include <assert.h>
+
+/// \note The items are stored inside of the object, no memory is allocated.
+/// \note Not thread-safe, the caller has to provide the locking. See lockfreering.h for
+///	  rings, which can be shared between producer and consumer without a lock.
+
+template <class T, unsigned N>
+class CFixedRing	/// FIFO ring buffer for up to N items of type T (N must be a power of 2)
+{
+	static_assert (N >= 2 && (N & (N-1)) == 0, "N must be a power of 2");
+
+public:
+	CFixedRing (void)
+	:	m_nIn (0),
+		m_nOut (0)
+	{
+	}
+
+	boolean IsEmpty (void) const
+	{
+		return m_nIn == m_nOut;
+	}
+
+	boolean IsFull (void) const
+	{
+		return m_nIn - m_nOut == N;
+	}
+
+	/// \return Number of items in the ring
+	unsigned GetCount (void) const
+	{
+		return m_nIn - m_nOut;
+	}
+
+	/// \return FALSE, if the ring is full
+	boolean Put (const T &Item)
+	{
+		if (IsFull ())
+		{
+			return FALSE;
+		}
+
+		m_Item[m_nIn++ & (N-1)] = Item;
+
+		return TRUE;
+	}
+
+	/// \return FALSE, if the ring is empty
+	boolean Get (T *pItem)
+	{
+		if (IsEmpty ())
+		{
+			return FALSE;
+		}
+
+		assert (pItem != 0);
+		*pItem = m_Item[m_nOut++ & (N-1)];
+
+		return TRUE;
+	}
+
+	/// \return Pointer to the oldest item, which remains in the ring (0 if the ring is empty)
+	T *Peek (void)
+	{
+		return !IsEmpty () ? &m_Item[m_nOut & (N-1)] : 0;
+	}
+
+	/// \brief Removes all items
+	void Flush (void)
+	{
+		m_nOut = m_nIn;
+	}
+
+private:
+	unsigned m_nIn;			// free running indices
+	unsigned m_nOut;
+	T m_Item[N];
+};
+
+#endif
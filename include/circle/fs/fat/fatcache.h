@@ -30,6 +30,7 @@ struct TFATBuffer
 	unsigned	 nMagic;
 	TFATBuffer	*pNext;
 	TFATBuffer	*pPrev;
+	TFATBuffer	*pHashNext;
 	unsigned	 nSector;
 	unsigned	 nUseCount;
 	int		 bDirty;
@@ -78,10 +79,12 @@ public:
 	 *
 	 * Params:  nSector	Sector number
 	 *	    bWriteOnly	Do not read physical block into buffer
+	 *	    nReadAhead	Number of following sectors, which should be read
+	 *			together with nSector on a miss (if not cached)
 	 * Returns: != 0	Pointer to buffer
 	 *	    0		Failure
 	 */
-	TFATBuffer *GetSector (unsigned nSector, int bWriteOnly);
+	TFATBuffer *GetSector (unsigned nSector, int bWriteOnly, unsigned nReadAhead = 0);
 	
 	/*
 	 * Free sector in buffer cache
@@ -100,7 +103,36 @@ public:
 	 */
 	void MarkDirty (TFATBuffer *pBuffer);
 
+	/*
+	 * Read consecutive sectors directly into a buffer, bypassing the cache
+	 * (dirty cached sectors in the range are written back before)
+	 *
+	 * Params:  nSector	First sector number
+	 *	    nCount	Number of sectors
+	 *	    pBuffer	Buffer to read into (nCount * FAT_SECTOR_SIZE bytes)
+	 * Returns: Nonzero on success
+	 */
+	int ReadSectors (unsigned nSector, unsigned nCount, void *pBuffer);
+
+	/*
+	 * Write consecutive sectors directly from a buffer, bypassing the cache
+	 * (cached copies of sectors in the range are updated)
+	 *
+	 * Params:  nSector	First sector number
+	 *	    nCount	Number of sectors
+	 *	    pBuffer	Buffer to write from (nCount * FAT_SECTOR_SIZE bytes)
+	 * Returns: Nonzero on success
+	 */
+	int WriteSectors (unsigned nSector, unsigned nCount, const void *pBuffer);
+
 private:
+	TFATBuffer *LookupBuffer (unsigned nSector);
+	void InsertHash (TFATBuffer *pBuffer);
+	void RemoveHash (TFATBuffer *pBuffer);
+
+	TFATBuffer *AllocBuffer (void);		// returns unused buffer without sector or 0
+	int WriteRun (TFATBuffer *pBuffer);	// writes the run of dirty sectors around pBuffer
+
 	void MoveBufferFirst (TFATBuffer *pBuffer);
 	void MoveBufferLast (TFATBuffer *pBuffer);
 
@@ -109,6 +141,9 @@ private:
 private:
 	CDevice		*m_pPartition;
 	TFATBufferList	 m_BufferList;
+	TFATBuffer	*m_pHashTable[FAT_HASH_SIZE];
+
+	unsigned char	*m_pRunBuffer;		// for multi-sector transfers
 
 	CGenericLock m_BufferListLock;
 	CGenericLock m_DiskLock;
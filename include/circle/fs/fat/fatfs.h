@@ -144,6 +144,15 @@ public:
 	*/
 	unsigned FileWrite (unsigned hFile, const void *pBuffer, unsigned nCount);
 
+	/*
+	* Get size of open file
+	*
+	* Params:  hFile	File handle
+	* Returns: File size in bytes
+	*	    0xFFFFFFFF	General failure
+	*/
+	unsigned FileGetSize (unsigned hFile);
+
 	/*
 	* Delete all root entries for title
 	*
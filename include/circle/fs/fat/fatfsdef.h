@@ -9,8 +9,23 @@
 
 #define FAT_SECTOR_SIZE		512
 
+// the capacities can be overridden with "DEFINE += -D..." in Config.mk
+#ifndef FAT_BUFFERS
 #define FAT_BUFFERS		100
+#endif
+#ifndef FAT_HASH_SIZE
+#define FAT_HASH_SIZE		128		// must be a power of 2
+#endif
+#ifndef FAT_RUN_SECTORS
+#define FAT_RUN_SECTORS		32		// max. sectors per multi-sector transfer
+#endif
+#ifndef FAT_FILES
 #define FAT_FILES		40
+#endif
+
+#if FAT_HASH_SIZE & (FAT_HASH_SIZE-1)
+	#error FAT_HASH_SIZE must be a power of 2
+#endif
 
 #define FAT_MAX_FILESIZE	0xFFFFFFFF
 
@@ -35,6 +35,11 @@ public:
 
 	u64 Seek (u64 ullOffset);
 
+	u64 GetSize (void) const;
+
+	// translates the offset and forwards the request to the disk device
+	boolean SubmitRequest (CBlockRequest *pRequest);
+
 private:
 	CDevice *m_pDevice;
 	unsigned m_nFirstSector;
@@ -0,0 +1,133 @@
+//
+// gpiocapture.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_gpiocapture_h
+#define _circle_gpiocapture_h
+
+#include <circle/interrupt.h>
+#include <circle/gpioclock.h>
+#include <circle/dmachannel.h>
+#include <circle/types.h>
+
+#ifndef GPIO_CAPTURE_BUF_SIZE
+#define GPIO_CAPTURE_BUF_SIZE	4096		// samples, default, must be a power of 2
+#endif
+
+/// \note The GPLEV0 register (GPIO0-31) is sampled by a cyclic DMA chain into a ring buffer.
+///	  Each sample is followed by a dummy write to the PWM FIFO, which paces the DMA with
+///	  the PWM serializer, so the sample rate is the PWM clock rate divided by the range.
+/// \note Two control blocks (64 bytes) are required per sample in the ring. The maximum
+///	  sample rate is limited by the DMA bandwidth (some MHz).
+/// \note The PWM device cannot be used otherwise (e.g. for sound), while capturing.
+
+struct TGPIOCaptureEdge		/// Level change found by CGPIOCapture::ExtractEdges()
+{
+	unsigned nSample;		///< Index of the sample, which contains the new levels
+	u32	 nLevels;		///< Levels of GPIO0-31 (masked)
+	u32	 nChanged;		///< Bit mask of the pins, which have changed
+};
+
+class CGPIOCapture	/// Samples the levels of GPIO0-31 by DMA with a fixed rate
+{
+public:
+	/// \param pSamples Pointer to the captured samples
+	/// \param nCount   Number of samples (half the ring size)
+	/// \param pParam   User parameter
+	/// \note Called on interrupt level
+	typedef void TCaptureHandler (const u32 *pSamples, unsigned nCount, void *pParam);
+
+public:
+	/// \param nSampleRate Sample rate in Hz (should be a divider of the PWM clock rate of
+	///		     250 MHz on Raspberry Pi 1-3 or 125 MHz on Raspberry Pi 4)
+	/// \param nBufferSize Size of the ring buffer in samples (power of 2)
+	/// \param pInterrupt  Pointer to the interrupt system (required for RegisterHandler() only)
+	CGPIOCapture (unsigned nSampleRate, unsigned nBufferSize = GPIO_CAPTURE_BUF_SIZE,
+		      CInterruptSystem *pInterrupt = 0);
+
+	~CGPIOCapture (void);
+
+	/// \return Operation successful?
+	boolean Start (void);
+
+	void Stop (void);
+
+	/// \return Is capturing running?
+	boolean IsActive (void) const;
+
+	/// \return Effective sample rate in Hz (may differ a little from the requested one)
+	unsigned GetSampleRate (void) const;
+
+	/// \param pHandler Called with each half of the ring buffer, after it has been filled
+	/// \param pParam   User parameter handed over to the handler
+	/// \note Must be called before Start()
+	void RegisterHandler (TCaptureHandler *pHandler, void *pParam = 0);
+
+	/// \return Number of samples, which can be read
+	/// \note Samples get lost, if they are not read, before the ring overflows.
+	unsigned GetAvailable (void);
+
+	/// \param pBuffer Receives the samples (levels of GPIO0-31)
+	/// \param nCount  Maximum number of samples
+	/// \return Number of samples read
+	/// \note Not to be used together with the handler
+	unsigned Read (u32 *pBuffer, unsigned nCount);
+
+	/// \brief Finds the level changes of selected pins in a series of samples
+	/// \param pSamples	Samples returned from Read() or handed over to the handler
+	/// \param nCount	Number of samples
+	/// \param nPinMask	Bit mask of the pins to be checked
+	/// \param pLastLevels	Levels before the first sample (updated to the levels of the last)
+	/// \param pEdges	Receives the found edges
+	/// \param nMaxEdges	Size of the pEdges array
+	/// \return Number of edges found (scanning stops, when pEdges is full)
+	static unsigned ExtractEdges (const u32 *pSamples, unsigned nCount, u32 nPinMask,
+				      u32 *pLastLevels, TGPIOCaptureEdge *pEdges, unsigned nMaxEdges);
+
+private:
+	unsigned GetWritePointer (void);
+
+	void RunPWM (void);
+	void StopPWM (void);
+
+	void InterruptHandler (void);
+	static void InterruptStub (void *pParam);
+
+private:
+	unsigned m_nRange;
+	unsigned m_nBufferSize;
+	CInterruptSystem *m_pInterruptSystem;
+
+	CGPIOClock m_Clock;
+
+	unsigned m_nDMAChannel;
+	u8 *m_pControlBlockBuffer;
+	TDMAControlBlock *m_pControlBlock;	// two per sample
+	u32 *m_pRing;
+
+	unsigned m_nReadPointer;
+	unsigned m_nNextHalf;
+
+	TCaptureHandler *m_pHandler;
+	void *m_pHandlerParam;
+
+	boolean m_bIRQConnected;
+	volatile boolean m_bActive;
+};
+
+#endif
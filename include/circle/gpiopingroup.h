@@ -0,0 +1,82 @@
+//
+// gpiopingroup.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_gpiopingroup_h
+#define _circle_gpiopingroup_h
+
+#include <circle/gpiopin.h>
+#include <circle/gpioclock.h>
+#include <circle/types.h>
+
+#define GPIO_PIN_GROUP_MAX_PINS		32
+
+/// \note All pins of a group must be in the same GPIO bank (GPIO0-31 or GPIO32-53). Bit 0
+///	  of a value maps to the first pin in the list, bit 1 to the second one and so on.
+/// \note The tables, which translate values into set/clear masks, are calculated once in
+///	  the constructor, so that Write() needs one access to GPCLR and GPSET only.
+/// \note WriteWaveform() uses the PWM device for pacing the DMA. The PWM device cannot be
+///	  used otherwise (e.g. for sound or CGPIOCapture) at the same time.
+
+class CGPIOPinGroup	/// Writes and reads multiple GPIO pins at once
+{
+public:
+	/// \param pPins Array of pin numbers (physical or TGPIOVirtualPin)
+	/// \param nPins Number of pins (1..GPIO_PIN_GROUP_MAX_PINS)
+	/// \param Mode  Pin mode to be set for all pins
+	CGPIOPinGroup (const unsigned *pPins, unsigned nPins, TGPIOMode Mode = GPIOModeOutput);
+
+	~CGPIOPinGroup (void);
+
+	/// \param nValue Value to be written (one bit per pin)
+	void Write (u32 nValue);
+
+	/// \return Value read from the pins (one bit per pin)
+	u32 Read (void) const;
+
+	/// \return Number of pins in the group
+	unsigned GetPinCount (void) const;
+
+	/// \brief Outputs a series of values with a fixed rate and waits for completion
+	/// \param pValues	Values to be written (one bit per pin)
+	/// \param nCount	Number of values
+	/// \param nSampleRate	Rate in Hz (should be a divider of the PWM clock rate of
+	///			250 MHz on Raspberry Pi 1-3 or 125 MHz on Raspberry Pi 4)
+	/// \return Operation successful?
+	/// \note The values are converted into set/clear masks before the DMA is started.
+	boolean WriteWaveform (const u32 *pValues, unsigned nCount, unsigned nSampleRate);
+
+private:
+	u32 GetSetMask (u32 nValue) const;
+
+private:
+	unsigned m_nPins;
+	CGPIOPin m_Pin[GPIO_PIN_GROUP_MAX_PINS];
+
+	unsigned m_nRegOffset;
+	u32	 m_nMask;		// all pins of the group
+
+	boolean  m_bContiguous;		// pins are in ascending order without gaps?
+	unsigned m_nShift;		// number of the first pin in the bank
+
+	u32	 m_SetMask[GPIO_PIN_GROUP_MAX_PINS/4][16];	// physical mask for each nibble
+
+	CGPIOClock m_Clock;
+};
+
+#endif
@@ -0,0 +1,66 @@
+//
+/// \file hash.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_hash_h
+#define _circle_hash_h
+
+#include <circle/macros.h>
+#include <circle/types.h>
+
+/// \note These are the xxHash algorithms XXH32 and XXH64 by Yann Collet (results are
+///	  identical to the reference implementation). They are fast, non-cryptographic hashes
+///	  for hash tables and checks of data integrity, not for security purposes. XXH32 is
+///	  faster with AARCH 32, XXH64 with AARCH 64.
+
+class CHash	/// Fast non-cryptographic hash functions
+{
+public:
+	/// \param pBuffer Pointer to the data
+	/// \param nLength Length of the data in bytes
+	/// \param nSeed   Seed value (different seeds give independent hash functions)
+	/// \return XXH32 hash value of the data
+	static u32 XXHash32 (const void *pBuffer, size_t nLength, u32 nSeed = 0) MAXOPT;
+
+	/// \param pBuffer Pointer to the data
+	/// \param nLength Length of the data in bytes
+	/// \param nSeed   Seed value (different seeds give independent hash functions)
+	/// \return XXH64 hash value of the data
+	static u64 XXHash64 (const void *pBuffer, size_t nLength, u64 nSeed = 0) MAXOPT;
+
+	/// \param pString Pointer to a C string
+	/// \param nSeed   Seed value
+	/// \return Hash value of the string (without terminating null character)
+	static u32 HashString (const char *pString, u32 nSeed = 0);
+
+	/// \param nValue  Integer value (e.g. pointer) to be mixed
+	/// \return Hash value, all bits depend on all bits of nValue
+	static u64 HashInteger (u64 nValue)
+	{
+		// finalizer of XXH64
+		nValue ^= nValue >> 33;
+		nValue *= 0xC2B2AE3D27D4EB4FULL;
+		nValue ^= nValue >> 29;
+		nValue *= 0x165667B19E3779F9ULL;
+		nValue ^= nValue >> 32;
+
+		return nValue;
+	}
+};
+
+#endif
@@ -0,0 +1,222 @@
+//
+/// \file hashmap.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_hashmap_h
+#define _circle_hashmap_h
+
+#include <circle/types.h>
+#include <assert.h>
+
+/// \note The entries are stored in one array with linear probing, so that a lookup touches
+///	  few cache lines and no memory is allocated per entry. The array is doubled, when it
+///	  is filled to 3/4. Removed entries do not leave tombstones (backward shift deletion).
+/// \note K must be an integer or pointer type, V must be default constructible and copy
+///	  assignable.
+/// \note Not thread-safe, the caller has to provide the locking.
+
+template <class K, class V>
+class CHashMap		/// Open addressing hash map from integer or pointer keys to values of type V
+{
+public:
+	/// \param nInitialSize Initial number of slots (must be a power of 2)
+	CHashMap (unsigned nInitialSize = 16)
+	:	m_pSlot (0),
+		m_nMask (nInitialSize-1),
+		m_nCount (0)
+	{
+		assert (nInitialSize >= 2);
+		assert ((nInitialSize & m_nMask) == 0);
+
+		m_pSlot = new TSlot[nInitialSize];
+		assert (m_pSlot != 0);
+	}
+
+	~CHashMap (void)
+	{
+		delete [] m_pSlot;
+		m_pSlot = 0;
+	}
+
+	/// \return Number of entries in the map
+	unsigned GetCount (void) const
+	{
+		return m_nCount;
+	}
+
+	/// \brief Insert an entry or replace the value of an existing entry
+	/// \return TRUE if the key has been inserted, FALSE if its value has been replaced
+	boolean Insert (K Key, const V &Value)
+	{
+		if ((m_nCount+1) * 4 > (m_nMask+1) * 3)
+		{
+			Grow ();
+		}
+
+		unsigned i = Hash (Key);
+		while (m_pSlot[i].bUsed)
+		{
+			if (m_pSlot[i].Key == Key)
+			{
+				m_pSlot[i].Value = Value;
+
+				return FALSE;
+			}
+
+			i = (i+1) & m_nMask;
+		}
+
+		m_pSlot[i].Key = Key;
+		m_pSlot[i].Value = Value;
+		m_pSlot[i].bUsed = TRUE;
+		m_nCount++;
+
+		return TRUE;
+	}
+
+	/// \return Pointer to the value of the entry with Key (0 if not found)
+	/// \note The pointer is valid until the next Insert() or Remove().
+	V *Lookup (K Key) const
+	{
+		int nIndex = Find (Key);
+
+		return nIndex >= 0 ? &m_pSlot[nIndex].Value : 0;
+	}
+
+	/// \return Is an entry with Key in the map?
+	boolean Contains (K Key) const
+	{
+		return Find (Key) >= 0;
+	}
+
+	/// \return FALSE, if the key was not found
+	boolean Remove (K Key)
+	{
+		int nIndex = Find (Key);
+		if (nIndex < 0)
+		{
+			return FALSE;
+		}
+
+		// move following entries of the same probe sequence into the gap
+		unsigned i = nIndex;
+		unsigned j = i;
+		while (1)
+		{
+			j = (j+1) & m_nMask;
+			if (!m_pSlot[j].bUsed)
+			{
+				break;
+			}
+
+			unsigned k = Hash (m_pSlot[j].Key);	// home slot of entry j
+			if (((j - k) & m_nMask) >= ((j - i) & m_nMask))
+			{
+				m_pSlot[i] = m_pSlot[j];
+				i = j;
+			}
+		}
+
+		m_pSlot[i].bUsed = FALSE;
+		m_nCount--;
+
+		return TRUE;
+	}
+
+	/// \brief Removes all entries (the memory is kept)
+	void Clear (void)
+	{
+		for (unsigned i = 0; i <= m_nMask; i++)
+		{
+			m_pSlot[i].bUsed = FALSE;
+		}
+
+		m_nCount = 0;
+	}
+
+private:
+	struct TSlot
+	{
+		K	Key;
+		V	Value;
+		boolean	bUsed;
+
+		TSlot (void) : bUsed (FALSE) {}
+	};
+
+	unsigned Hash (K Key) const
+	{
+		// Fibonacci hashing, the upper bits are well mixed
+		u64 nHash = (u64) (uintptr) Key * 0x9E3779B97F4A7C15ULL;
+
+		return (unsigned) (nHash >> 32) & m_nMask;
+	}
+
+	int Find (K Key) const
+	{
+		unsigned i = Hash (Key);
+		while (m_pSlot[i].bUsed)
+		{
+			if (m_pSlot[i].Key == Key)
+			{
+				return (int) i;
+			}
+
+			i = (i+1) & m_nMask;
+		}
+
+		return -1;
+	}
+
+	void Grow (void)
+	{
+		TSlot *pOldSlot = m_pSlot;
+		unsigned nOldSize = m_nMask+1;
+
+		m_nMask = nOldSize*2 - 1;
+		m_pSlot = new TSlot[nOldSize*2];
+		assert (m_pSlot != 0);
+
+		for (unsigned i = 0; i < nOldSize; i++)
+		{
+			if (pOldSlot[i].bUsed)
+			{
+				unsigned j = Hash (pOldSlot[i].Key);
+				while (m_pSlot[j].bUsed)
+				{
+					j = (j+1) & m_nMask;
+				}
+
+				m_pSlot[j] = pOldSlot[i];
+			}
+		}
+
+		delete [] pOldSlot;
+	}
+
+private:
+	CHashMap (const CHashMap &) = delete;
+	CHashMap &operator = (const CHashMap &) = delete;
+
+private:
+	TSlot *m_pSlot;
+	unsigned m_nMask;
+	unsigned m_nCount;
+};
+
+#endif
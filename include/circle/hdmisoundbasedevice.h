@@ -27,6 +27,8 @@
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
+#define HDMI_MAX_CHANNELS	8
+
 enum THDMISoundState
 {
 	HDMISoundCreated,
@@ -48,10 +50,16 @@ public:
 	/// \param nSampleRate	sample rate in Hz
 	/// \param nChunkSize	twice the number of samples (words) to be handled\n
 	///			with one call to GetChunk() (one word per stereo channel),\n
-	///			must be a multiple of 384
+	///			must be a multiple of 384 (192 * nChannels)
+	/// \param nChannels	number of channels (2 or 8)
+	/// \param bPassthrough	output compressed data (IEC 61937) instead of LPCM,\n
+	///			with 8 channels as high bitrate (HBR) audio stream
+	/// \note With nChannels = 8, GetChunk() has to be overloaded.
 	CHDMISoundBaseDevice (CInterruptSystem *pInterrupt,
-			      unsigned	        nSampleRate = 48000,
-			      unsigned	        nChunkSize  = 384 * 10);
+			      unsigned	        nSampleRate  = 48000,
+			      unsigned	        nChunkSize   = 384 * 10,
+			      unsigned	        nChannels    = SOUND_HW_CHANNELS,
+			      boolean	        bPassthrough = FALSE);
 
 	/// \brief Construct driver object in polling mode.
 	/// \param nSampleRate sample rate in Hz
@@ -92,6 +100,10 @@ protected:
 	///	  Each frame consists of two sub-frames (left/right samples).\n
 	///	  Each sample has to be converted using ConvertIEC958Sample()\n
 	///	  to apply the IEC958 framing, before writing it into the buffer.
+	/// \note With nChannels = 8 nChunkSize is a multiple of 1536 and each frame consists of\n
+	///	  eight sub-frames (FL, FR, LFE, FC, RL, RR, RLC, RRC). The buffer has to be filled\n
+	///	  with 24-bit samples (in the lower bits), the IEC958 framing is applied by the\n
+	///	  driver afterwards.
 	/// virtual unsigned GetChunk (u32 *pBuffer, unsigned nChunkSize);
 
 private:
@@ -126,6 +138,8 @@ private:
 	CInterruptSystem *m_pInterruptSystem;
 	unsigned m_nSampleRate;
 	unsigned m_nChunkSize;
+	unsigned m_nChannels;
+	boolean m_bPassthrough;
 
 	unsigned long m_ulAudioClockRate;
 	unsigned long m_ulPixelClockRate;
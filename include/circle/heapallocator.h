@@ -2,7 +2,7 @@
 // heapallocator.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -29,23 +29,37 @@
 
 //#define HEAP_DEBUG
 
-ASSERT_STATIC (DATA_CACHE_LINE_LENGTH_MAX >= 16);
+#if defined (ARM_ALLOW_MULTI_CORE) && HEAP_CORE_CACHE_BATCH > 0
+	#define HEAP_CORE_CACHE
+#endif
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	#define HEAP_STAT_CORES		CORES
+#else
+	#define HEAP_STAT_CORES		1
+#endif
+
+ASSERT_STATIC (DATA_CACHE_LINE_LENGTH_MAX >= 32);
 
 #define HEAP_BLOCK_ALIGN	DATA_CACHE_LINE_LENGTH_MAX
 #define HEAP_ALIGN_MASK		(HEAP_BLOCK_ALIGN-1)
 
 #define HEAP_BLOCK_MAX_BUCKETS	20
 
+#define HEAP_LARGE_MAX_SIZE	0xFFFFFFC0U		// nSize is 32-bit
+
 struct THeapBlockHeader
 {
 	u32			 nMagic;
 #define HEAP_BLOCK_MAGIC	0x424C4D43
+#define HEAP_LARGE_FREE_MAGIC	0x46424C4B
 	u32			 nSize;
 	THeapBlockHeader	*pNext;
 #if AARCH == 32
 	u32			 nPadding;
 #endif
-	u8			 Align[HEAP_BLOCK_ALIGN-16];
+	u32			 nRequestedSize;
+	u8			 Align[HEAP_BLOCK_ALIGN-20];
 	u8			 Data[0];
 }
 PACKED;
@@ -53,13 +67,64 @@ PACKED;
 struct THeapBlockBucket
 {
 	u32			 nSize;
-#ifdef HEAP_DEBUG
-	unsigned		 nCount;
-	unsigned		 nMaxCount;
-#endif
+	unsigned		 nBlocks;	// allocated from the heap region
+	unsigned		 nFreeCount;	// blocks on pFreeList
 	THeapBlockHeader	*pFreeList;
 };
 
+struct THeapCoreStatistics		// updated by one core only, summed up on read
+{
+	u64			 nAllocations[HEAP_BLOCK_MAX_BUCKETS+1];	// last: large blocks
+	u64			 nFrees[HEAP_BLOCK_MAX_BUCKETS+1];
+	size_t			 nBytesRequested;	// may wrap, the sum is valid
+}
+ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+struct THeapBucketStatus
+{
+	u32			 nSize;		// block size of this bucket
+	u64			 nAllocations;	// total number of allocations
+	unsigned		 nInUse;	// number of blocks currently in use
+	unsigned		 nBlocks;	// number of blocks allocated from the heap region
+	unsigned		 nFreeBlocks;	// number of blocks on free lists
+};
+
+struct THeapStatus
+{
+	size_t			 nSize;			// size of the heap region
+	size_t			 nUsed;			// allocated space of the heap region
+	size_t			 nPeakUsed;		// maximum of nUsed
+	size_t			 nBytesInUse;		// block sizes of all blocks in use
+	size_t			 nBytesRequested;	// requested sizes of all blocks in use
+	u64			 nFailedAllocations;
+
+	unsigned		 nBuckets;
+	THeapBucketStatus	 Bucket[HEAP_BLOCK_MAX_BUCKETS];
+
+	u64			 nLargeAllocations;	// blocks above the largest bucket size
+	unsigned		 nLargeInUse;
+	size_t			 nLargeBytesInUse;
+	size_t			 nLargeFreeSpace;	// on the large block free list
+	size_t			 nLargestFreeBlock;
+	unsigned		 nLargeFreeBlocks;
+};
+
+#ifdef HEAP_CORE_CACHE
+
+struct THeapBlockMagazine		// free blocks of one bucket, owned by one core
+{
+	THeapBlockHeader	*pList;
+	unsigned		 nCount;
+};
+
+struct THeapCoreCache
+{
+	THeapBlockMagazine	 Magazine[HEAP_BLOCK_MAX_BUCKETS];
+}
+ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+#endif
+
 class CHeapAllocator	/// Allocates blocks from a flat memory region
 {
 public:
@@ -90,12 +155,33 @@ public:
 	void *ReAllocate (void *pBlock, size_t nSize);
 
 	/// \param pBlock Memory block to be freed
-	/// \note Memory space of blocks, which are bigger than the largest bucket size,\n
-	///	  cannot be returned to a free list and is lost.
+	/// \note Blocks, which are bigger than the largest bucket size, are returned to\n
+	///	  an address ordered free list, where adjacent blocks are merged.
 	void Free (void *pBlock);
 
-#ifdef HEAP_DEBUG
+	/// \param pLargestBlock Returns the size of the largest free large block (if not 0)
+	/// \param pBlocks	  Returns the number of free large blocks (if not 0)
+	/// \return Free space in blocks, which are bigger than the largest bucket size,\n
+	///	    and which can be reused for large allocations
+	/// \note Large free blocks at the top of the allocated space are returned to the\n
+	///	  memory region and count for GetFreeSpace() instead.
+	size_t GetLargeFreeSpace (size_t *pLargestBlock = 0, unsigned *pBlocks = 0);
+
+	/// \param pStatus Returns the current statistics of this heap
+	/// \note The counters are always maintained. They are not updated atomically,\n
+	///	  so the values may be slightly inconsistent, while other cores allocate.
+	void GetStatus (THeapStatus *pStatus);
+
+	/// \brief Write the heap statistics to the system log
 	void DumpStatus (void);
+
+private:
+	THeapBlockHeader *AllocateLarge (size_t nSize);
+	void FreeLarge (THeapBlockHeader *pBlockHeader);
+
+#ifdef HEAP_CORE_CACHE
+	THeapBlockHeader *AllocateCached (unsigned nBucket, size_t nRequestedSize);
+	void FreeCached (THeapBlockHeader *pBlockHeader, unsigned nBucket);
 #endif
 
 private:
@@ -104,7 +190,19 @@ private:
 	u8		*m_pLimit;
 	size_t	 	 m_nReserve;
 	THeapBlockBucket m_Bucket[HEAP_BLOCK_MAX_BUCKETS+1];
-	CSpinLock	 m_SpinLock;
+	u32		 m_nMaxBucketSize;
+	THeapBlockHeader *m_pLargeFreeList;	// address ordered
+	CTicketSpinLock	 m_SpinLock;
+
+	u8		*m_pBase;
+	u8		*m_pPeak;
+	size_t		 m_nLargeBytesInUse;
+	u64		 m_nFailedAllocations;
+	THeapCoreStatistics m_Statistics[HEAP_STAT_CORES];
+
+#ifdef HEAP_CORE_CACHE
+	THeapCoreCache	 m_CoreCache[CORES];
+#endif
 
 	static u32 s_nBucketSize[];
 };
@@ -0,0 +1,190 @@
+//
+/// \file histogram.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_histogram_h
+#define _circle_histogram_h
+
+#include <circle/logger.h>
+#include <circle/types.h>
+#include <assert.h>
+
+/// \note Values below 2^SubBucketBits are counted exactly. Above each power of 2 range is\n
+///	  divided into 2^SubBucketBits linear sub-buckets, so that the relative error of a\n
+///	  reported value is below 1/2^SubBucketBits (6.25% with the default of 4 bits).
+/// \note Add() does not acquire a lock and does not disable IRQs. It can be called from\n
+///	  IRQ context and on all cores at the same time. The read methods may see a sample\n
+///	  partially added, which is not relevant for statistics.
+
+template <unsigned SubBucketBits = 4>
+class CHistogram	/// Lock-free log-linear (HDR style) histogram of 32-bit values
+{
+public:
+	static const unsigned SubBuckets = 1 << SubBucketBits;
+	static const unsigned Buckets = (32 - SubBucketBits + 1) * SubBuckets;
+
+public:
+	CHistogram (void)
+	{
+		Reset ();
+	}
+
+	/// \brief Clear all samples
+	/// \note Must not be called concurrently with Add()
+	void Reset (void)
+	{
+		for (unsigned i = 0; i < Buckets; i++)
+		{
+			m_nBucket[i] = 0;
+		}
+
+		m_nCount = 0;
+		m_nSum = 0;
+		m_nMin = (u32) -1;
+		m_nMax = 0;
+	}
+
+	/// \param nValue Sample value to be added
+	void Add (u32 nValue)
+	{
+		__atomic_fetch_add (&m_nBucket[GetBucket (nValue)], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add (&m_nSum, nValue, __ATOMIC_RELAXED);
+		__atomic_fetch_add (&m_nCount, 1, __ATOMIC_RELAXED);
+
+		u32 nMin = __atomic_load_n (&m_nMin, __ATOMIC_RELAXED);
+		while (   nValue < nMin
+		       && !__atomic_compare_exchange_n (&m_nMin, &nMin, nValue, TRUE,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+			// nMin has been updated, try again
+		}
+
+		u32 nMax = __atomic_load_n (&m_nMax, __ATOMIC_RELAXED);
+		while (   nValue > nMax
+		       && !__atomic_compare_exchange_n (&m_nMax, &nMax, nValue, TRUE,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+			// nMax has been updated, try again
+		}
+	}
+
+	/// \return Number of samples
+	u32 GetCount (void) const	{ return __atomic_load_n (&m_nCount, __ATOMIC_RELAXED); }
+
+	/// \return Minimum sample value (0 if there are no samples)
+	u32 GetMin (void) const
+	{
+		return GetCount () > 0 ? __atomic_load_n (&m_nMin, __ATOMIC_RELAXED) : 0;
+	}
+
+	/// \return Maximum sample value
+	u32 GetMax (void) const		{ return __atomic_load_n (&m_nMax, __ATOMIC_RELAXED); }
+
+	/// \return Average sample value (0 if there are no samples)
+	u32 GetAvg (void) const
+	{
+		u32 nCount = GetCount ();
+
+		return nCount > 0 ? (u32) (__atomic_load_n (&m_nSum, __ATOMIC_RELAXED) / nCount) : 0;
+	}
+
+	/// \param nPerMille Percentile in 1/10 percent (e.g. 999 for p99.9)
+	/// \return Value, which nPerMille/10 percent of the samples do not exceed
+	/// \note The highest value of the respective bucket is returned (at most GetMax()).
+	u32 GetPercentile (unsigned nPerMille) const
+	{
+		assert (nPerMille <= 1000);
+
+		u32 nCount = GetCount ();
+		if (nCount == 0)
+		{
+			return 0;
+		}
+
+		// rank of the wanted sample, at least 1
+		u64 nRank = ((u64) nCount * nPerMille + 999) / 1000;
+		if (nRank == 0)
+		{
+			nRank = 1;
+		}
+
+		u64 nAccu = 0;
+		for (unsigned i = 0; i < Buckets; i++)
+		{
+			nAccu += __atomic_load_n (&m_nBucket[i], __ATOMIC_RELAXED);
+			if (nAccu >= nRank)
+			{
+				u32 nValue = GetBucketHighest (i);
+				u32 nMax = GetMax ();
+
+				return nValue < nMax ? nValue : nMax;
+			}
+		}
+
+		return GetMax ();
+	}
+
+	/// \brief Write a one-line summary to the logger
+	/// \param pSource Source name of the log message
+	/// \param pName Name of the measured value
+	/// \param pUnit Unit of the values
+	void Dump (const char *pSource, const char *pName, const char *pUnit = "us") const
+	{
+		CLogger::Get ()->Write (pSource, LogNotice,
+					"%s: n %u min %u avg %u p50 %u p90 %u p99 %u p99.9 %u max %u (%s)",
+					pName, GetCount (), GetMin (), GetAvg (),
+					GetPercentile (500), GetPercentile (900), GetPercentile (990),
+					GetPercentile (999), GetMax (), pUnit);
+	}
+
+private:
+	static unsigned GetBucket (u32 nValue)
+	{
+		if (nValue < SubBuckets)
+		{
+			return nValue;
+		}
+
+		unsigned nShift = 31 - __builtin_clz (nValue) - SubBucketBits;
+
+		return (nShift+1) * SubBuckets + (nValue >> nShift) - SubBuckets;
+	}
+
+	static u32 GetBucketHighest (unsigned nBucket)
+	{
+		unsigned nGroup = nBucket / SubBuckets;
+		if (nGroup == 0)
+		{
+			return nBucket;
+		}
+
+		u32 nLowest = (u32) (SubBuckets + nBucket % SubBuckets) << (nGroup-1);
+
+		return nLowest + ((1U << (nGroup-1)) - 1);
+	}
+
+private:
+	u32 m_nBucket[Buckets];
+
+	u32 m_nCount;
+	u64 m_nSum;
+	u32 m_nMin;
+	u32 m_nMax;
+};
+
+#endif
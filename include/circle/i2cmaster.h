@@ -21,6 +21,7 @@
 #define _circle_i2cmaster_h
 
 #include <circle/gpiopin.h>
+#include <circle/interrupt.h>
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
@@ -45,13 +46,37 @@
 #define I2C_MASTER_ERROR_CLKT	3	///< Received clock stretch timeout
 #define I2C_MASTER_DATA_LEFT	4	///< Not all data has been sent/received
 
+/// \param nResult Number of read (or written, if nothing is read) bytes or < 0 on failure
+/// \param pParam  User parameter from the transaction
+typedef void TI2CCompletionRoutine (int nResult, void *pParam);
+
+/// \brief Describes a queued write-then-read transaction, which is owned by the caller and must\n
+///	   remain valid until its completion routine has been called
+struct TI2CTransaction
+{
+	u8			 ucAddress;	///< I2C slave address of target device
+	const void		*pWriteBuffer;	///< Data to be written first (may be 0)
+	unsigned		 nWriteCount;	///< Number of bytes to be written (may be 0)
+	void			*pReadBuffer;	///< Read data (after a repeated start) (may be 0)
+	unsigned		 nReadCount;	///< Number of bytes to be read (may be 0)
+	TI2CCompletionRoutine	*pCompletionRoutine;	///< Called in interrupt context (may be 0)
+	void			*pCompletionParam;	///< User parameter for the routine
+	volatile int		 nResult;	///< Set on completion (see: TI2CCompletionRoutine)
+	volatile boolean	 bDone;		///< Set on completion
+
+	TI2CTransaction		*pNext;		///< Used by the driver
+};
+
 class CI2CMaster
 {
 public:
 	/// \param nDevice   Device number (see: GPIO pin mapping)
 	/// \param bFastMode Use I2C fast mode (400 KHz) or standard mode (100 KHz) otherwise
 	/// \param nConfig   GPIO mapping configuration (see: GPIO pin mapping)
-	CI2CMaster (unsigned nDevice, boolean bFastMode = FALSE, unsigned nConfig = 0);
+	/// \param pInterruptSystem Pointer to the interrupt system object\n
+	///			    (required for SubmitTransaction() only)
+	CI2CMaster (unsigned nDevice, boolean bFastMode = FALSE, unsigned nConfig = 0,
+		    CInterruptSystem *pInterruptSystem = 0);
 
 	~CI2CMaster (void);
 
@@ -74,6 +99,33 @@ public:
 	/// \return Number of written bytes or < 0 on failure
 	int Write (u8 ucAddress, const void *pBuffer, unsigned nCount);
 
+	/// \brief Write data, followed by a repeated start and read data (e.g. register read)
+	/// \param ucAddress    I2C slave address of target device
+	/// \param pWriteBuffer Write data will be taken from here
+	/// \param nWriteCount  Number of bytes to be written (1..16)
+	/// \param pReadBuffer  Read data will be stored here
+	/// \param nReadCount   Number of bytes to be read
+	/// \return Number of read bytes or < 0 on failure
+	int WriteRead (u8 ucAddress, const void *pWriteBuffer, unsigned nWriteCount,
+		       void *pReadBuffer, unsigned nReadCount);
+
+	/// \brief Queue a transaction, which is processed in the background, interrupt driven
+	/// \param pTransaction Transaction to be processed (pNext, nResult and bDone are set here)
+	/// \return FALSE on invalid parameter or without interrupt system
+	/// \note Can be called from interrupt context and from a completion routine.
+	/// \note Read(), Write() and WriteRead() must not be used, while transactions are pending.
+	boolean SubmitTransaction (TI2CTransaction *pTransaction);
+
+	/// \return Are transactions pending?
+	boolean IsBusy (void) const;
+
+private:
+	void StartTransaction (void);
+	void StartReadPhase (void);
+
+	void InterruptHandler (void);
+	static void InterruptStub (void *pParam);
+
 private:
 	unsigned m_nDevice;
 	uintptr  m_nBaseAddress;
@@ -85,8 +137,22 @@ private:
 	CGPIOPin m_SCL;
 
 	unsigned m_nCoreClockRate;
+	unsigned m_nClockSpeed;
 
 	CSpinLock m_SpinLock;
+
+	// transaction queue
+	CInterruptSystem *m_pInterruptSystem;
+	TI2CTransaction * volatile m_pFirstTransaction;	// active transaction
+	TI2CTransaction *m_pLastTransaction;
+	boolean m_bReadPhase;
+	unsigned m_nBytesLeft;
+	u8 *m_pData;
+	CSpinLock m_QueueSpinLock;
+
+	// all BSC devices share one IRQ line
+	static CI2CMaster *s_pThis[];
+	static unsigned s_nIRQUsers;
 };
 
 #endif
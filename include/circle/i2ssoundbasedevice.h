@@ -40,6 +40,43 @@ public:
 		DeviceModeUnknown
 	};
 
+	/// \brief Full-duplex callback, processes one chunk of input into one chunk of output
+	/// \param pInput	the most recently received chunk (nChunkSize words)
+	/// \param pOutput	the chunk to be sent next (nChunkSize words)
+	/// \param nChunkSize	size of the buffers in words (one word per stereo channel)
+	/// \param pParam	user parameter
+	/// \note Called from interrupt context (IRQ or FIQ, see constructor)
+	typedef void TDuplexCallback (const u32 *pInput, u32 *pOutput, unsigned nChunkSize,
+				      void *pParam);
+
+	struct TStatistics
+	{
+		unsigned nTXUnderruns;		///< I2S TX FIFO was empty
+		unsigned nRXOverruns;		///< I2S RX FIFO was full
+		unsigned nInputRepeated;	///< duplex: no new input chunk for the output chunk
+		unsigned nInputDropped;		///< duplex: input chunks, which were not processed
+		unsigned nLatencyUs;		///< duplex: last input-to-output latency
+		unsigned nMinLatencyUs;
+		unsigned nMaxLatencyUs;
+		unsigned nCaptureOverruns;	///< capture: blocks skipped or overwritten by DMA
+	};
+
+	/// \brief Descriptor of a captured block, which remains in the DMA buffer (zero-copy)
+	struct TCaptureBlock
+	{
+		const u32 *pBuffer;		///< DMA buffer (nChunkSize words)
+		unsigned nChunkSize;		///< size of the buffer in words
+		unsigned nSequence;		///< number of the block since Start(), 0-based
+		u64	nFrame;			///< index of the first frame since Start()
+		u64	nTimestamp;		///< capture time of the first frame (in CLOCKHZ ticks)
+	};
+
+	/// \brief Capture callback, receives each captured block
+	/// \param pBlock	the block, the buffer is valid until the next block is captured
+	/// \param pParam	user parameter
+	/// \note Called from interrupt context
+	typedef void TCaptureCallback (const TCaptureBlock *pBlock, void *pParam);
+
 public:
 	/// \param pInterrupt	pointer to the interrupt system object
 	/// \param nSampleRate	sample rate in Hz
@@ -49,13 +86,16 @@ public:
 	/// \param pI2CMaster	pointer to the I2C master object (0 if no I2C DAC init required)
 	/// \param ucI2CAddress I2C slave address of the DAC (0 for auto probing 0x4C and 0x4D)
 	/// \param DeviceMode	which transfer direction to use?
+	/// \param bUseFIQ	handle the TX DMA completion in FIQ context (lowest latency)
+	/// \note nChunkSize can be as small as 32 (16 frames) for low latency operation.
 	CI2SSoundBaseDevice (CInterruptSystem *pInterrupt,
 			     unsigned	       nSampleRate = 192000,
 			     unsigned	       nChunkSize  = 8192,
 			     bool	       bSlave      = FALSE,
 			     CI2CMaster       *pI2CMaster  = 0,
 			     u8		       ucI2CAddress = 0,
-			     TDeviceMode       DeviceMode  = DeviceModeTXOnly);
+			     TDeviceMode       DeviceMode  = DeviceModeTXOnly,
+			     boolean	       bUseFIQ     = FALSE);
 
 	virtual ~CI2SSoundBaseDevice (void);
 
@@ -74,6 +114,47 @@ public:
 	/// \return Is I2S and DMA operation running?
 	boolean IsActive (void) const;
 
+	/// \brief Process input and output together in one callback (DeviceModeTXRX only)
+	/// \param pCallback	the callback, which replaces GetChunk() and PutChunk()
+	/// \param pParam	user parameter to be handed over to the callback
+	/// \note Has to be called before Start(). The callback is called, when the next
+	///	  output chunk is due, with the most recently received input chunk.
+	void RegisterDuplexCallback (TDuplexCallback *pCallback, void *pParam = 0);
+
+	/// \brief Configure the PCM frame for TDM operation (before Start())
+	/// \param nSlots	number of 32-bit slots in a frame (2..32, 2 is I2S)
+	/// \param nSlot1	slot, which is transferred as first channel (left)
+	/// \param nSlot2	slot, which is transferred as second channel (right)
+	/// \note The PCM interface of the Raspberry Pi transfers two channels per frame and data
+	///	  line. These can be selected from any slots of a TDM frame. In master mode the
+	///	  bit clock is set to nSlots * 32 * sample rate. The frame sync pulse is one bit
+	///	  wide in TDM mode (DSP mode A).
+	/// \return Operation successful?
+	boolean SetTDMSlots (unsigned nSlots, unsigned nSlot1 = 0, unsigned nSlot2 = 1);
+
+	/// \brief Deliver the captured blocks directly from the DMA buffers (RX, not duplex)
+	/// \param pCallback	called for each captured block (0 to use GetCaptureBlock() only)
+	/// \param pParam	user parameter to be handed over to the callback
+	/// \note Has to be called before Start(). Replaces PutChunk(), so that Read() does not
+	///	  deliver data any more.
+	void EnableZeroCopyCapture (TCaptureCallback *pCallback = 0, void *pParam = 0);
+
+	/// \brief Get the most recently captured block (zero-copy capture only)
+	/// \param pBlock	receives the descriptor of the block
+	/// \return FALSE if no new block has been captured since the previous call
+	/// \note Blocks, which were not fetched in time, are counted as capture overruns.
+	///	  The buffer remains valid for the duration of one chunk.
+	boolean GetCaptureBlock (TCaptureBlock *pBlock);
+	/// \brief Check, if the data of a block is still valid after processing it
+	/// \param pBlock	the block, which was returned by GetCaptureBlock()
+	/// \return FALSE if the buffer may have been overwritten (counted as capture overrun)
+	boolean ReleaseCaptureBlock (const TCaptureBlock *pBlock);
+
+	/// \param pStatistics	receives the underrun counts and the measured latency
+	void GetStatistics (TStatistics *pStatistics) const;
+
+	void ResetStatistics (void);
+
 protected:
 	/// \brief May overload this to provide the sound samples!
 	/// \param pBuffer	buffer where the samples have to be placed
@@ -99,11 +180,20 @@ private:
 	static unsigned RXCompletedHandler (boolean bStatus, u32 *pBuffer,
 					    unsigned nChunkSize, void *pParam);
 
+	unsigned ProcessDuplex (u32 *pOutput, unsigned nChunkSize);
+	void ProcessCapture (const u32 *pBuffer, unsigned nChunkSize);
+
+	void StartClock (void);
+	void SetupFrame (void);
+
+	void CheckFIFOErrors (void);
+
 	boolean InitPCM51xx (u8 ucI2CAddress);
 	boolean InitWM8960 (u8 ucI2CAddress);
 
 private:
 	CInterruptSystem *m_pInterruptSystem;
+	unsigned m_nFrameRate;
 	unsigned m_nChunkSize;
 	bool     m_bSlave;
 	CI2CMaster *m_pI2CMaster;
@@ -121,6 +211,29 @@ private:
 
 	CDMASoundBuffers m_TXBuffers;
 	CDMASoundBuffers m_RXBuffers;
+
+	TDuplexCallback *m_pDuplexCallback;
+	void *m_pDuplexParam;
+	unsigned m_nChunkUs;			// duration of one chunk
+	u32 *m_pSilence;			// input until the first chunk has been received
+
+	const u32 * volatile m_pRXChunk;	// most recently received chunk
+	volatile unsigned m_nRXChunkTicks;	// when it has been received
+	volatile unsigned m_nRXChunks;		// number of received chunks
+	unsigned m_nProcessedRXChunks;
+
+	unsigned m_nSlots;			// TDM frame
+	unsigned m_nSlot1;
+	unsigned m_nSlot2;
+
+	boolean m_bZeroCopyCapture;
+	TCaptureCallback *m_pCaptureCallback;
+	void *m_pCaptureParam;
+	TCaptureBlock m_CaptureBlock[2];	// indexed by (sequence & 1)
+	volatile unsigned m_nCapturedBlocks;
+	unsigned m_nFetchedBlocks;
+
+	TStatistics m_Statistics;
 };
 
 #endif
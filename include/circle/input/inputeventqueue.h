@@ -0,0 +1,144 @@
+//
+// inputeventqueue.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_input_inputeventqueue_h
+#define _circle_input_inputeventqueue_h
+
+#include <circle/usb/usbkeyboard.h>
+#include <circle/usb/usbgamepad.h>
+#include <circle/input/mouse.h>
+#include <circle/input/touchscreen.h>
+#include <circle/lockfreering.h>
+#include <circle/spinlock.h>
+#include <circle/types.h>
+
+#define INPUT_EVENT_QUEUE_SIZE		256	// must be a power of 2
+#define INPUT_KEY_STRING_SIZE		8	// incl. terminating '\0'
+#define INPUT_GAMEPAD_AXES		MAX_AXIS
+
+enum TInputEventType
+{
+	InputEventKeyPressed,
+	InputEventMouse,
+	InputEventTouch,
+	InputEventGamePad,
+	InputEventUnknown
+};
+
+struct TInputEvent		/// Timestamped event from one of the input devices
+{
+	u64		nTimestamp;	///< CTimer::GetClockTicks64() of the (last merged) event
+	TInputEventType	Type;
+	unsigned	nDevice;	///< Device index of gamepads (0 otherwise)
+	unsigned	nCoalesced;	///< Number of raw events merged into this one (>= 1)
+
+	union
+	{
+		char KeyString[INPUT_KEY_STRING_SIZE];	///< Translated key (see usbkeyboard.h)
+
+		struct
+		{
+			unsigned nButtons;
+			int	 nDisplacementX;	///< Sum of merged displacements
+			int	 nDisplacementY;
+			int	 nWheelMove;
+		}
+		Mouse;
+
+		struct
+		{
+			TTouchScreenEvent Event;
+			unsigned nID;
+			unsigned nPosX;			///< Position of the last merged move
+			unsigned nPosY;
+		}
+		Touch;
+
+		struct
+		{
+			unsigned nButtons;
+			int	 naxes;
+			int	 Axes[INPUT_GAMEPAD_AXES];	///< Values of the last merged state
+			int	 nhats;
+			int	 Hats[MAX_HATS];
+		}
+		GamePad;
+	};
+};
+
+/// \note The events are written by the device drivers (USB completion in interrupt context,
+///	  touch screen Update() at task level) and are read with Drain(), typically once per
+///	  frame. Drain() does not acquire a lock and does not disable IRQs.
+/// \note On Drain() motion events are merged: mouse movements with the same button state,
+///	  touch screen moves of the same finger and gamepad states with the same buttons and
+///	  hats. Button, key and finger down/up events are never merged or dropped by this.
+/// \note The queue replaces the status/event handlers of the attached devices. Only one
+///	  instance is allowed.
+
+class CInputEventQueue		/// Unified, timestamped input event queue with motion coalescing
+{
+public:
+	CInputEventQueue (void);
+	~CInputEventQueue (void);
+
+	/// \brief Receive the translated key strings of a keyboard
+	void AttachKeyboard (CUSBKeyboardDevice *pKeyboard);
+	/// \brief Receive the raw mode status of a mouse
+	void AttachMouse (CMouseDevice *pMouse);
+	void AttachTouchScreen (CTouchScreenDevice *pTouchScreen);
+	void AttachGamePad (CUSBGamePadDevice *pGamePad);
+
+	/// \brief Put an event into the queue (e.g. from an own handler)
+	/// \param pEvent Event to be queued, nTimestamp is set here, if it is 0
+	/// \return FALSE if the queue is full (the event is counted as dropped)
+	boolean Post (const TInputEvent *pEvent);
+
+	/// \brief Read all pending events at once, motion events are coalesced
+	/// \param pEvents Array, which receives the events
+	/// \param nMaxEvents Size of the array in number of events
+	/// \return Number of events returned
+	/// \note Must be called from one consumer only.
+	unsigned Drain (TInputEvent *pEvents, unsigned nMaxEvents);
+
+	/// \return Are no events waiting?
+	boolean IsEmpty (void) const;
+
+	/// \return Number of events, which were dropped, because the queue was full
+	unsigned GetDropped (void) const;
+
+private:
+	static boolean Merge (TInputEvent *pEvents, unsigned nEvents, const TInputEvent *pEvent);
+
+	static void KeyPressedHandler (const char *pString);
+	static void MouseStatusHandler (unsigned nButtons, int nDisplacementX, int nDisplacementY,
+					int nWheelMove);
+	static void TouchScreenEventHandler (TTouchScreenEvent Event,
+					     unsigned nID, unsigned nPosX, unsigned nPosY);
+	static void GamePadStatusHandler (unsigned nDeviceIndex, const TGamePadState *pState);
+
+private:
+	CSPSCRing<TInputEvent> m_Queue;
+	CSpinLock m_SpinLock;			// serializes the producers
+
+	unsigned m_nDropped;
+
+	static CInputEventQueue *s_pThis;
+};
+
+#endif
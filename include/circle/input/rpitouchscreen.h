@@ -2,7 +2,7 @@
 // rpitouchscreen.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,9 +21,11 @@
 #define _circle_input_rpitouchscreen_h
 
 #include <circle/input/touchscreen.h>
+#include <circle/timer.h>
 #include <circle/types.h>
 
 #define RPITOUCH_SCREEN_MAX_POINTS	10
+#define RPITOUCH_SCREEN_SAMPLE_RATE	60	// Hz, default for StartSampling()
 
 struct TFT5406Buffer;
 
@@ -35,10 +37,18 @@ public:
 
 	boolean Initialize (void);
 
+	/// \brief Sample the touch buffer in the background from a kernel timer
+	/// \param nRateHz Sample rate in Hz (max. HZ)
+	/// \note CTouchScreenDevice::Update() does nothing afterwards and need not be called.
+	///	  The event handler is called in interrupt context then (e.g. use CInputEventQueue).
+	void StartSampling (unsigned nRateHz = RPITOUCH_SCREEN_SAMPLE_RATE);
+	void StopSampling (void);
+
 private:
 	void Update (void);	// call this about 60 times per second
 
 	static void UpdateStub (void *pParam);
+	static void SampleHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext);
 
 private:
 	TFT5406Buffer *m_pFT5406Buffer;
@@ -49,6 +59,10 @@ private:
 	unsigned m_nPosY[RPITOUCH_SCREEN_MAX_POINTS];
 
 	CTouchScreenDevice *m_pDevice;
+
+	volatile boolean m_bSampling;
+	unsigned m_nSampleDelay;		// in 1/HZ seconds
+	CKernelTimer m_SampleTimer;
 };
 
 #endif
@@ -2,7 +2,7 @@
 // interrupt.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,10 +22,26 @@
 
 #include <circle/bcm2835int.h>
 #include <circle/exceptionstub.h>
+#include <circle/sysconfig.h>
 #include <circle/types.h>
 
 typedef void TIRQHandler (void *pParam);
 
+#if RASPPI >= 4
+	#define FIQ_SOURCES	4		// max. number of connected FIQ sources
+#else
+	#define FIQ_SOURCES	1		// the interrupt controller has one FIQ source only
+#endif
+
+struct TIRQStatistics			// with system option IRQ_STATISTICS only
+{
+	unsigned nCount;		// number of handler calls
+	u64	 nTotalNanos;		// execution time of the handler
+	unsigned nMinNanos;
+	unsigned nMaxNanos;
+	unsigned nStorms;		// number of seconds with more than IRQ_STORM_THRESHOLD calls
+};
+
 class CInterruptSystem
 {
 public:
@@ -37,17 +53,45 @@ public:
 	void ConnectIRQ (unsigned nIRQ, TIRQHandler *pHandler, void *pParam);
 	void DisconnectIRQ (unsigned nIRQ);
 
+	/// \brief Connect a FIQ source
+	/// \param nFIQ FIQ number (ARM_FIQ_*)
+	/// \param pHandler Handler to be called in FIQ context
+	/// \param pParam Parameter for pHandler
+	/// \note Up to FIQ_SOURCES sources can be connected at the same time (on the GIC only).
+	///	  A single source is dispatched directly from the FIQ stub. With several sources
+	///	  the handlers are called one after the other, if their source is active.
 	void ConnectFIQ (unsigned nFIQ, TFIQHandler *pHandler, void *pParam);
+	/// \brief Disconnect a FIQ source
+	/// \param nFIQ FIQ number, as given to ConnectFIQ()
+	void DisconnectFIQ (unsigned nFIQ);
+	/// \brief Disconnect the only connected FIQ source
 	void DisconnectFIQ (void);
 
 	static void EnableIRQ (unsigned nIRQ);
 	static void DisableIRQ (unsigned nIRQ);
 
 	static void EnableFIQ (unsigned nFIQ);
+	/// \brief Disable all connected FIQ sources (e.g. on system halt)
 	static void DisableFIQ (void);
 
 	static CInterruptSystem *Get (void);
 
+	/// \param nIRQ IRQ number
+	/// \return Number of calls of the handler of this IRQ (on all cores)
+	static unsigned GetIRQCount (unsigned nIRQ);
+
+	/// \param nIRQ IRQ number
+	/// \param pStatistics Returns the statistics of this IRQ
+	/// \return Operation successful? (FALSE without system option IRQ_STATISTICS)
+	static boolean GetIRQStatistics (unsigned nIRQ, TIRQStatistics *pStatistics);
+	/// \param pStatistics Returns the statistics of the FIQ
+	/// \return Operation successful? (FALSE without system option IRQ_STATISTICS)
+	static boolean GetFIQStatistics (TIRQStatistics *pStatistics);
+	/// \brief Clear the counters and the statistics of all IRQs and the FIQ
+	static void ResetIRQStatistics (void);
+	/// \brief Write the counters and the statistics of all used IRQs and the FIQ to the logger
+	static void DumpIRQStatistics (void);
+
 	static void InterruptHandler (void);
 
 #if RASPPI >= 4
@@ -55,6 +99,17 @@ public:
 
 	static void SendIPI (unsigned nCore, unsigned nIPI);
 
+	/// \brief Routes a shared peripheral interrupt (SPI, nIRQ >= 32) to a core
+	/// \param nIRQ IRQ number (GIC_SPI (n))
+	/// \param nCore Target core (0..CORES-1), the handler of this IRQ is called there
+	/// \note The IRQ handler and the code, which shares data with it, must be multi-core safe,
+	///	  if nCore is not the core, which uses the driver (e.g. use CSpinLock).
+	/// \note All SPIs are routed to core 0 by default. Private peripheral interrupts (PPI)
+	///	  are connected per core instead, by calling ConnectIRQ() on the respective core.
+	static void SetIRQTarget (unsigned nIRQ, unsigned nCore);
+	/// \return Target core of a shared peripheral interrupt
+	static unsigned GetIRQTarget (unsigned nIRQ);
+
 	static void CallSecureMonitor (u32 nFunction, u32 nParam);
 	static void SecureMonitorHandler (u32 nFunction, u32 nParam);
 #endif
@@ -62,9 +117,68 @@ public:
 private:
 	boolean CallIRQHandler (unsigned nIRQ);
 
+	// set the handler, which is called from the FIQ stub (0 for none)
+	void SetFIQHandler (TFIQHandler *pHandler, void *pParam);
+
+#if RASPPI >= 4
+	static void DisableFIQ (unsigned nFIQ);
+
+	static void FIQMultiplexHandler (void *pParam);
+#endif
+
+#ifdef IRQ_STATISTICS
+	struct TIRQTiming
+	{
+		u64		nTotal;		// time stamp units
+		u32		nMin;
+		u32		nMax;
+		unsigned	nWindowStart;	// clock ticks (1 MHz)
+		unsigned	nWindowCount;	// calls in the current window
+		unsigned	nStorms;
+	};
+
+	void AccountIRQ (TIRQTiming *pTiming, u64 nDuration, unsigned nIRQ);
+	static void FIQStatisticsHandler (void *pParam);
+
+	static boolean GetStatistics (const TIRQTiming *pTiming, unsigned nCount,
+				      TIRQStatistics *pStatistics);
+	static u64 GetTimestamp (void);
+#endif
+
 private:
 	TIRQHandler	*m_apIRQHandler[IRQ_LINES];
 	void		*m_pParam[IRQ_LINES];
+	unsigned	 m_nIRQCount[IRQ_LINES];
+
+#ifdef IRQ_STATISTICS
+	TIRQTiming	 m_IRQTiming[IRQ_LINES];
+
+	TFIQHandler	*m_pFIQHandler;		// called from FIQStatisticsHandler()
+	void		*m_pFIQParam;
+	unsigned	 m_nFIQCount;
+	TIRQTiming	 m_FIQTiming;
+#endif
+
+#if RASPPI >= 4
+	struct TFIQSource
+	{
+		unsigned	 nFIQ;
+		TFIQHandler	*pHandler;
+		void		*pParam;
+		uintptr		 nStatusReg;	// raw interrupt status register or 0 (always call)
+		u32		 nStatusMask;
+	};
+
+	static TFIQSource s_FIQSource[FIQ_SOURCES];
+	static volatile unsigned s_nFIQSources;
+#endif
+
+#if RASPPI >= 4 && defined (ARM_ALLOW_MULTI_CORE)
+	// private peripheral interrupts are banked per core
+#define PPI_LINES	16
+	TIRQHandler	*m_apPPIHandler[CORES][PPI_LINES];
+	void		*m_pPPIParam[CORES][PPI_LINES];
+#endif
 
 	static CInterruptSystem *s_pThis;
 };
@@ -0,0 +1,153 @@
+//
+/// \file intrusivelist.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_intrusivelist_h
+#define _circle_intrusivelist_h
+
+#include <circle/types.h>
+#include <assert.h>
+
+struct TIntrusiveListNode	/// Links of an element of CIntrusiveList (derive the element from it)
+{
+	TIntrusiveListNode *pPrev;
+	TIntrusiveListNode *pNext;
+};
+
+/// \note The elements contain their own links, so that no memory is allocated on insert.
+///	  An element can be member of one list at a time only.
+/// \note Not thread-safe, the caller has to provide the locking.
+
+template <class T>
+class CIntrusiveList	/// Doubly linked list of elements of type T (derived from TIntrusiveListNode)
+{
+public:
+	CIntrusiveList (void)
+	{
+		m_Head.pPrev = &m_Head;
+		m_Head.pNext = &m_Head;
+	}
+
+	~CIntrusiveList (void)
+	{
+	}
+
+	boolean IsEmpty (void) const
+	{
+		return m_Head.pNext == &m_Head;
+	}
+
+	/// \return First element (0 if the list is empty)
+	T *GetFirst (void) const
+	{
+		return m_Head.pNext != &m_Head ? static_cast<T *> (m_Head.pNext) : 0;
+	}
+
+	/// \return Last element (0 if the list is empty)
+	T *GetLast (void) const
+	{
+		return m_Head.pPrev != &m_Head ? static_cast<T *> (m_Head.pPrev) : 0;
+	}
+
+	/// \return Element following pElement (0 if nothing follows)
+	T *GetNext (const T *pElement) const
+	{
+		assert (pElement != 0);
+		return pElement->pNext != &m_Head ? static_cast<T *> (pElement->pNext) : 0;
+	}
+
+	/// \return Element preceding pElement (0 if pElement is the first)
+	T *GetPrev (const T *pElement) const
+	{
+		assert (pElement != 0);
+		return pElement->pPrev != &m_Head ? static_cast<T *> (pElement->pPrev) : 0;
+	}
+
+	void InsertFirst (T *pElement)
+	{
+		Link (&m_Head, pElement);
+	}
+
+	void InsertLast (T *pElement)
+	{
+		Link (m_Head.pPrev, pElement);
+	}
+
+	/// \param pPosition Element in the list, pElement is inserted before it
+	void InsertBefore (T *pPosition, T *pElement)
+	{
+		assert (pPosition != 0);
+		Link (pPosition->pPrev, pElement);
+	}
+
+	/// \param pPosition Element in the list, pElement is inserted after it
+	void InsertAfter (T *pPosition, T *pElement)
+	{
+		assert (pPosition != 0);
+		Link (pPosition, pElement);
+	}
+
+	/// \param pElement Element in the list to be removed (it is not deleted)
+	void Remove (T *pElement)
+	{
+		assert (pElement != 0);
+		TIntrusiveListNode *pNode = pElement;
+		assert (pNode->pPrev->pNext == pNode);
+		assert (pNode->pNext->pPrev == pNode);
+
+		pNode->pPrev->pNext = pNode->pNext;
+		pNode->pNext->pPrev = pNode->pPrev;
+
+		pNode->pPrev = 0;
+		pNode->pNext = 0;
+	}
+
+	/// \brief Walks the list and compares pointers only
+	/// \return Is pElement a member of this list?
+	/// \note pElement is not dereferenced, so it may be a stale pointer (e.g. an old handle).
+	boolean Contains (const T *pElement) const
+	{
+		for (const TIntrusiveListNode *pNode = m_Head.pNext; pNode != &m_Head;
+		     pNode = pNode->pNext)
+		{
+			if (pNode == static_cast<const TIntrusiveListNode *> (pElement))
+			{
+				return TRUE;
+			}
+		}
+
+		return FALSE;
+	}
+
+private:
+	static void Link (TIntrusiveListNode *pPrev, TIntrusiveListNode *pNode)
+	{
+		assert (pPrev != 0);
+		assert (pNode != 0);
+
+		pNode->pPrev = pPrev;
+		pNode->pNext = pPrev->pNext;
+		pPrev->pNext->pPrev = pNode;
+		pPrev->pNext = pNode;
+	}
+
+private:
+	TIntrusiveListNode m_Head;		// anchor, not an element
+};
+
+#endif
@@ -24,12 +24,52 @@
 #include <circle/cputhrottle.h>
 #include <circle/types.h>
 
+#define KERNEL_OPTIONS_MAX		64		// all options incl. application specific
+#define KERNEL_OPTIONS_HASH_SIZE	64		// must be a power of 2
+#define KERNEL_OPTIONS_POOL_SIZE	1024		// bytes for strings set with SetOption()
+#define KERNEL_OPTIONS_MAX_HANDLERS	8
+
+// All options from cmdline.txt (including unknown, application specific options) are kept in
+// a hash table, which can be queried with the typed Get*Option() methods. Numeric values are
+// converted only once. Options can be modified (or added) with SetOption() from TASK_LEVEL,
+// registered handlers are called then. The fixed getters below always return the value from
+// cmdline.txt.
+
 class CKernelOptions
 {
+public:
+	// pOption is the name of the changed option, pValue its new value
+	typedef void TChangeHandler (const char *pOption, const char *pValue, void *pParam);
+
 public:
 	CKernelOptions (void);
 	~CKernelOptions (void);
 
+	// returns TRUE, if the option is defined (with or without a value)
+	boolean IsOptionSet (const char *pOption) const;
+
+	// returns the value of "option=value" or pDefault, if the option is not defined,
+	// an option without "=value" returns the empty string
+	const char *GetStringOption (const char *pOption, const char *pDefault = 0) const;
+
+	// decimal or hexadecimal (with prefix "0x") values,
+	// returns nDefault, if the option is not defined or not numeric
+	unsigned GetUnsignedOption (const char *pOption, unsigned nDefault = 0) const;
+	int GetIntOption (const char *pOption, int nDefault = 0) const;
+
+	// accepts "true", "false", "on", "off", "yes", "no", "1" and "0",
+	// an option without "=value" is TRUE
+	boolean GetBooleanOption (const char *pOption, boolean bDefault = FALSE) const;
+
+	// modifies or adds an option (the strings are copied),
+	// returns FALSE, if the table or the string pool is full
+	boolean SetOption (const char *pOption, const char *pValue);
+
+	// calls pHandler, if pOption (or any option if 0) is modified with SetOption()
+	boolean RegisterChangeHandler (const char *pOption, TChangeHandler *pHandler,
+				       void *pParam = 0);
+	void UnregisterChangeHandler (TChangeHandler *pHandler);
+
 	unsigned GetWidth (void) const;
 	unsigned GetHeight (void) const;
 
@@ -55,6 +95,32 @@ public:
 	static CKernelOptions *Get (void);
 
 private:
+	struct TOption
+	{
+		const char	*pName;
+		const char	*pValue;
+		u32		 nHash;
+		unsigned	 nNext;				// in hash chain
+		boolean		 bNumeric;			// nValue is valid
+		unsigned	 nValue;
+		boolean		 bNegative;			// "-" prefix
+	};
+
+	struct THandler
+	{
+		const char	*pOption;			// 0 for all
+		TChangeHandler	*pHandler;
+		void		*pParam;
+	};
+
+	const TOption *FindOption (const char *pOption) const;
+	TOption *AddOption (const char *pOption, const char *pValue);
+	static void ParseValue (TOption *pOption);
+
+	const char *CopyString (const char *pString);	// into m_StringPool, 0 if full
+
+	static u32 Hash (const char *pString);
+
 	char *GetToken (void);				// returns next "option=value" pair, 0 if nothing follows
 
 	static char *GetOptionValue (char *pOption);	// returns value and terminates option with '\0'
@@ -79,7 +145,7 @@ private:
 	unsigned m_nUSBPowerDelay;
 	boolean m_bUSBFullSpeed;
 	boolean m_bUSBBoost;
-	char m_USBIgnore[20];
+	char m_USBIgnore[80];
 
 	char m_SoundDevice[20];
 	unsigned m_nSoundOption;
@@ -91,6 +157,15 @@ private:
 	boolean m_bTouchScreenValid;
 	unsigned m_TouchScreen[4];
 
+	TOption m_Option[KERNEL_OPTIONS_MAX];
+	unsigned m_nOptions;
+	unsigned m_HashTable[KERNEL_OPTIONS_HASH_SIZE];	// first option of hash chain
+
+	char m_StringPool[KERNEL_OPTIONS_POOL_SIZE];
+	unsigned m_nStringPoolUsed;
+
+	THandler m_Handler[KERNEL_OPTIONS_MAX_HANDLERS];
+
 	static CKernelOptions *s_pThis;
 };
 
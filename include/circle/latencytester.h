@@ -2,7 +2,7 @@
 // latencytester.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,7 +21,7 @@
 #define _circle_latencytester_h
 
 #include <circle/interrupt.h>
-#include <circle/spinlock.h>
+#include <circle/histogram.h>
 #include <circle/types.h>
 
 /// \note CLatencyTester blocks the system timer 1, which is used by the class CUserTimer too.
@@ -44,6 +44,12 @@ public:
 	unsigned GetMax (void) const;
 	/// \return Average IRQ latency in microseconds
 	unsigned GetAvg (void);
+	/// \param nPerMille Percentile in 1/10 percent (e.g. 999 for p99.9)
+	/// \return IRQ latency in microseconds, which is not exceeded by this percentile
+	unsigned GetPercentile (unsigned nPerMille) const;
+
+	/// \return Distribution of the IRQ latency in microseconds
+	const CHistogram<> *GetHistogram (void) const;
 
 	/// \brief Dump results to logger
 	void Dump (void);
@@ -58,14 +64,7 @@ private:
 	boolean m_bRunning;
 	unsigned m_nWantedDelay;
 
-	unsigned m_nMinDelay;
-	unsigned m_nMaxDelay;
-
-	unsigned m_nDelayAccu;
-	unsigned m_nSamples;
-	boolean  m_bOverflow;
-
-	CSpinLock m_SpinLock;
+	CHistogram<> m_Histogram;
 };
 
 #endif
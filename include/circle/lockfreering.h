@@ -0,0 +1,349 @@
+//
+/// \file lockfreering.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_lockfreering_h
+#define _circle_lockfreering_h
+
+#include <circle/synchronize.h>
+#include <circle/macros.h>
+#include <circle/types.h>
+#include <assert.h>
+
+/// \note Both ring classes allow to fill in and read out an item in place:\n
+///	  T *pItem = Ring.BeginWrite (); if (pItem) { ...; Ring.EndWrite (pItem); }\n
+///	  T *pItem = Ring.BeginRead ();  if (pItem) { ...; Ring.EndRead (); }
+/// \note No lock is acquired and the IRQs are not disabled. The producer(s) may run in\n
+///	  interrupt context or on another core.
+
+template <class T>
+class CSPSCRing		/// Lock-free ring buffer for one producer and one consumer
+{
+public:
+	/// \param nSize Capacity in items (must be a power of 2)
+	CSPSCRing (unsigned nSize)
+	:	m_nMask (nSize-1),
+		m_pItem (new T[nSize]),
+		m_nHead (0),
+		m_nTail (0)
+	{
+		assert (nSize >= 2);
+		assert ((nSize & m_nMask) == 0);
+		assert (m_pItem != 0);
+	}
+
+	~CSPSCRing (void)
+	{
+		delete [] m_pItem;
+		m_pItem = 0;
+	}
+
+	/// \return Is the ring empty? (exact for the consumer only)
+	boolean IsEmpty (void) const
+	{
+		return   __atomic_load_n (&m_nHead, __ATOMIC_RELAXED)
+		      == __atomic_load_n (&m_nTail, __ATOMIC_ACQUIRE);
+	}
+
+	/// \return Pointer to the next free item (0 if the ring is full)
+	/// \note Producer only
+	T *BeginWrite (void)
+	{
+		unsigned nTail = __atomic_load_n (&m_nTail, __ATOMIC_RELAXED);
+		if (nTail - __atomic_load_n (&m_nHead, __ATOMIC_ACQUIRE) > m_nMask)
+		{
+			return 0;
+		}
+
+		return &m_pItem[nTail & m_nMask];
+	}
+
+	/// \param pItem Pointer returned from BeginWrite(), the item is visible to the consumer now
+	/// \note Producer only
+	void EndWrite (T *pItem)
+	{
+		unsigned nTail = __atomic_load_n (&m_nTail, __ATOMIC_RELAXED);
+		assert (pItem == &m_pItem[nTail & m_nMask]);
+
+		__atomic_store_n (&m_nTail, nTail+1, __ATOMIC_RELEASE);
+	}
+
+	/// \return Pointer to the oldest item (0 if the ring is empty)
+	/// \note Consumer only
+	T *BeginRead (void)
+	{
+		unsigned nHead = __atomic_load_n (&m_nHead, __ATOMIC_RELAXED);
+		if (nHead == __atomic_load_n (&m_nTail, __ATOMIC_ACQUIRE))
+		{
+			return 0;
+		}
+
+		return &m_pItem[nHead & m_nMask];
+	}
+
+	/// \brief Releases the item returned from BeginRead() to the producer
+	/// \note Consumer only
+	void EndRead (void)
+	{
+		unsigned nHead = __atomic_load_n (&m_nHead, __ATOMIC_RELAXED);
+
+		__atomic_store_n (&m_nHead, nHead+1, __ATOMIC_RELEASE);
+	}
+
+	/// \return FALSE, if the ring is full
+	boolean Write (const T &Item)
+	{
+		T *pItem = BeginWrite ();
+		if (pItem == 0)
+		{
+			return FALSE;
+		}
+
+		*pItem = Item;
+		EndWrite (pItem);
+
+		return TRUE;
+	}
+
+	/// \return FALSE, if the ring is empty
+	boolean Read (T *pItem)
+	{
+		T *pRingItem = BeginRead ();
+		if (pRingItem == 0)
+		{
+			return FALSE;
+		}
+
+		assert (pItem != 0);
+		*pItem = *pRingItem;
+		EndRead ();
+
+		return TRUE;
+	}
+
+	/// \return Number of items in the ring (a lower bound for the producer)
+	unsigned GetCount (void) const
+	{
+		return   __atomic_load_n (&m_nTail, __ATOMIC_ACQUIRE)
+		       - __atomic_load_n (&m_nHead, __ATOMIC_ACQUIRE);
+	}
+
+	/// \param pItems Items to be written
+	/// \param nCount Number of items
+	/// \return Number of items written (less than nCount, if the ring is full)
+	/// \note Producer only
+	unsigned WriteMultiple (const T *pItems, unsigned nCount)
+	{
+		unsigned nTail = __atomic_load_n (&m_nTail, __ATOMIC_RELAXED);
+		unsigned nFree = m_nMask+1 - (nTail - __atomic_load_n (&m_nHead, __ATOMIC_ACQUIRE));
+		if (nCount > nFree)
+		{
+			nCount = nFree;
+		}
+
+		assert (pItems != 0 || nCount == 0);
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			m_pItem[(nTail + i) & m_nMask] = pItems[i];
+		}
+
+		__atomic_store_n (&m_nTail, nTail+nCount, __ATOMIC_RELEASE);
+
+		return nCount;
+	}
+
+	/// \param pItems Receives the items
+	/// \param nCount Maximum number of items
+	/// \return Number of items read (0 if the ring is empty)
+	/// \note Consumer only
+	unsigned ReadMultiple (T *pItems, unsigned nCount)
+	{
+		unsigned nHead = __atomic_load_n (&m_nHead, __ATOMIC_RELAXED);
+		unsigned nAvail = __atomic_load_n (&m_nTail, __ATOMIC_ACQUIRE) - nHead;
+		if (nCount > nAvail)
+		{
+			nCount = nAvail;
+		}
+
+		assert (pItems != 0 || nCount == 0);
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			pItems[i] = m_pItem[(nHead + i) & m_nMask];
+		}
+
+		__atomic_store_n (&m_nHead, nHead+nCount, __ATOMIC_RELEASE);
+
+		return nCount;
+	}
+
+private:
+	unsigned m_nMask;
+	T *m_pItem;
+
+	// consumer and producer index on different cache lines
+	volatile unsigned m_nHead ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+	volatile unsigned m_nTail ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+};
+
+template <class T>
+class CMPSCRing		/// Lock-free ring buffer for multiple producers and one consumer
+{
+public:
+	/// \param nSize Capacity in items (must be a power of 2)
+	CMPSCRing (unsigned nSize)
+	:	m_nMask (nSize-1),
+		m_pSlot (new TSlot[nSize]),
+		m_nHead (0),
+		m_nTail (0)
+	{
+		assert (nSize >= 2);
+		assert ((nSize & m_nMask) == 0);
+		assert (m_pSlot != 0);
+
+		for (unsigned i = 0; i < nSize; i++)
+		{
+			m_pSlot[i].nSequence = i;
+		}
+	}
+
+	~CMPSCRing (void)
+	{
+		delete [] m_pSlot;
+		m_pSlot = 0;
+	}
+
+	/// \return Is the ring empty? (exact for the consumer only)
+	boolean IsEmpty (void) const
+	{
+		unsigned nHead = __atomic_load_n (&m_nHead, __ATOMIC_RELAXED);
+		const TSlot *pSlot = &m_pSlot[nHead & m_nMask];
+
+		return __atomic_load_n (&pSlot->nSequence, __ATOMIC_ACQUIRE) != nHead+1;
+	}
+
+	/// \return Pointer to a free item, which is owned by the caller now (0 if the ring is full)
+	T *BeginWrite (void)
+	{
+		unsigned nTail = __atomic_load_n (&m_nTail, __ATOMIC_RELAXED);
+		while (1)
+		{
+			TSlot *pSlot = &m_pSlot[nTail & m_nMask];
+			int nDiff = (int) (__atomic_load_n (&pSlot->nSequence, __ATOMIC_ACQUIRE) - nTail);
+			if (nDiff == 0)
+			{
+				// claim this slot, nTail is updated, if another producer was faster
+				if (__atomic_compare_exchange_n (&m_nTail, &nTail, nTail+1, true,
+								 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				{
+					return &pSlot->Item;
+				}
+			}
+			else if (nDiff < 0)
+			{
+				return 0;		// not read out by the consumer yet
+			}
+			else
+			{
+				nTail = __atomic_load_n (&m_nTail, __ATOMIC_RELAXED);
+			}
+		}
+	}
+
+	/// \param pItem Pointer returned from BeginWrite(), the item is visible to the consumer now
+	/// \note Items become visible in the order, in which they have been claimed.
+	void EndWrite (T *pItem)
+	{
+		TSlot *pSlot = (TSlot *) pItem;		// Item is the first member
+		assert (m_pSlot <= pSlot && pSlot <= &m_pSlot[m_nMask]);
+
+		__atomic_store_n (&pSlot->nSequence, pSlot->nSequence+1, __ATOMIC_RELEASE);
+	}
+
+	/// \return Pointer to the oldest item (0 if the ring is empty)
+	/// \note Consumer only
+	T *BeginRead (void)
+	{
+		unsigned nHead = __atomic_load_n (&m_nHead, __ATOMIC_RELAXED);
+		TSlot *pSlot = &m_pSlot[nHead & m_nMask];
+		if (__atomic_load_n (&pSlot->nSequence, __ATOMIC_ACQUIRE) != nHead+1)
+		{
+			return 0;
+		}
+
+		return &pSlot->Item;
+	}
+
+	/// \brief Releases the item returned from BeginRead() to the producers
+	/// \note Consumer only
+	void EndRead (void)
+	{
+		unsigned nHead = __atomic_load_n (&m_nHead, __ATOMIC_RELAXED);
+		TSlot *pSlot = &m_pSlot[nHead & m_nMask];
+		assert (pSlot->nSequence == nHead+1);
+
+		__atomic_store_n (&pSlot->nSequence, nHead+m_nMask+1, __ATOMIC_RELEASE);
+		__atomic_store_n (&m_nHead, nHead+1, __ATOMIC_RELAXED);
+	}
+
+	/// \return FALSE, if the ring is full
+	boolean Write (const T &Item)
+	{
+		T *pItem = BeginWrite ();
+		if (pItem == 0)
+		{
+			return FALSE;
+		}
+
+		*pItem = Item;
+		EndWrite (pItem);
+
+		return TRUE;
+	}
+
+	/// \return FALSE, if the ring is empty
+	/// \note Consumer only
+	boolean Read (T *pItem)
+	{
+		T *pRingItem = BeginRead ();
+		if (pRingItem == 0)
+		{
+			return FALSE;
+		}
+
+		assert (pItem != 0);
+		*pItem = *pRingItem;
+		EndRead ();
+
+		return TRUE;
+	}
+
+private:
+	struct TSlot
+	{
+		T			Item;		// must be first
+		volatile unsigned	nSequence;	// position, for which this slot is free or full
+	};
+
+	unsigned m_nMask;
+	TSlot *m_pSlot;
+
+	volatile unsigned m_nHead ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+	volatile unsigned m_nTail ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+};
+
+#endif
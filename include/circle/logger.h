@@ -2,7 +2,7 @@
 /// \file logger.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -25,6 +25,7 @@
 #include <circle/stdarg.h>
 #include <circle/spinlock.h>
 #include <circle/time.h>
+#include <circle/sysconfig.h>
 #include <circle/types.h>
 
 #define LOG_MAX_SOURCE		50
@@ -33,6 +34,13 @@
 
 #define LOGGER_BUFSIZE		0x4000		///< Size of the text ring buffer
 
+#ifndef LOG_DEFERRED_RING_SIZE
+#define LOG_DEFERRED_RING_SIZE	64		///< Records per core in deferred mode (power of 2)
+#endif
+#define LOG_DEFERRED_MAX_ARGS	8		///< Arguments per deferred message
+#define LOG_DEFERRED_SOURCE	24		///< Max. length of the source name incl. 0
+#define LOG_DEFERRED_STRINGS	96		///< Space for string arguments in a record
+
 enum TLogSeverity
 {
 	LogPanic,	///< Halt the system after processing this message
@@ -43,6 +51,9 @@ enum TLogSeverity
 };
 
 struct TLogEvent;
+struct TLogRecord;
+class CString;
+template <class T> class CMPSCRing;
 
 typedef void TLogEventNotificationHandler (void);
 typedef void TLogPanicHandler (void);
@@ -75,8 +86,25 @@ public:
 	void WriteV (const char *pSource, TLogSeverity Severity, const char *pMessage, va_list Args);
 
 	/// \brief Does not allocate memory, for critical (low memory) messages
+	/// \note Can be called from IRQ context in deferred mode
 	void WriteNoAlloc (const char *pSource, TLogSeverity Severity, const char *pMessage);
 
+	/// \brief Queue messages in a lock-free ring per core, instead of writing them directly
+	/// \param nRingSize Number of records per core (must be a power of 2)
+	/// \return Operation successful?
+	/// \note Write() and WriteNoAlloc() do not allocate memory and do not wait in this mode\n
+	///	  and can be called from IRQ context. The format string and string arguments are\n
+	///	  captured into a binary record, the message is formatted by FlushDeferred().\n
+	///	  LogPanic messages are always written directly.
+	/// \note The format string must remain valid (string constant), the number of arguments\n
+	///	  is limited to LOG_DEFERRED_MAX_ARGS.
+	boolean EnableDeferredMode (unsigned nRingSize = LOG_DEFERRED_RING_SIZE);
+
+	/// \brief Format the queued messages and write them to the target device
+	/// \return Number of messages written
+	/// \note Call this from TASK_LEVEL only, e.g. from CLogDrainTask or the main loop
+	unsigned FlushDeferred (void);
+
 	/// \brief Read log message text from the log text ring buffer
 	/// \param pBuffer Read text is copied to this buffer
 	/// \param nCount  Size of the buffer
@@ -95,6 +123,10 @@ public:
 	boolean ReadEvent (TLogSeverity *pSeverity, char *pSource, char *pMessage,
 			   time_t *pTime, unsigned *pHundredthTime, int *pTimeZone);
 
+	/// \return Number of log events, which have been dropped, because the log event ring\n
+	///	    buffer was full (since the last call, the counter is cleared)
+	unsigned GetDroppedEvents (void);
+
 	/// \brief Register handler which is called, when a log event arrives
 	void RegisterEventNotificationHandler (TLogEventNotificationHandler *pHandler);
 	/// \brief Register handler which is called, before the system is halted
@@ -109,6 +141,15 @@ private:
 
 	void WriteEvent (const char *pSource, TLogSeverity Severity, const char *pMessage);
 
+	// writes a formatted message to the target and the text ring buffer
+	void WriteMessage (const char *pSource, TLogSeverity Severity, const char *pMessage);
+
+	// returns FALSE, if deferred mode is not enabled
+	boolean WriteDeferred (const char *pSource, TLogSeverity Severity, const char *pMessage,
+			       va_list *pArgs);
+
+	static void FormatRecord (const TLogRecord *pRecord, CString *pResult);
+
 private:
 	unsigned m_nLogLevel;
 	CTimer *m_pTimer;
@@ -124,11 +165,17 @@ private:
 	TLogEvent *m_pEventQueue[LOG_QUEUE_SIZE];
 	unsigned m_nEventInPtr;
 	unsigned m_nEventOutPtr;
+	unsigned m_nEventsDropped;
 	CSpinLock m_EventSpinLock;
 
 	TLogEventNotificationHandler *m_pEventNotificationHandler;
 	TLogPanicHandler *m_pPanicHandler;
 
+	CMPSCRing<TLogRecord> *m_pDeferredRing[CORES];
+	volatile boolean m_bDeferred;
+	volatile boolean m_bFlushing;
+	volatile unsigned m_nDeferredDropped;
+
 	static CLogger *s_pThis;
 };
 
@@ -0,0 +1,58 @@
+//
+/// \file lz4decoder.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_lz4decoder_h
+#define _circle_lz4decoder_h
+
+#include <circle/macros.h>
+#include <circle/types.h>
+
+/// \note Data in the LZ4 frame format can be generated with the "lz4" command line tool\n
+///	  (e.g. "lz4 -9 --content-size kernel8.img kernel8.img.lz4"). Checksums are\n
+///	  skipped, dictionaries and linked blocks are not supported.
+
+class CLZ4Decoder	/// Decompresses data in the LZ4 frame format
+{
+public:
+	/// \param pBuffer Pointer to the data
+	/// \param nLength Length of the data in bytes
+	/// \return Does the data start with the LZ4 frame magic number?
+	static boolean IsCompressed (const void *pBuffer, size_t nLength);
+
+	/// \param pBuffer Pointer to the compressed data
+	/// \param nLength Length of the compressed data in bytes
+	/// \return Size of the original data from the frame header (0 if not included)
+	static size_t GetContentSize (const void *pBuffer, size_t nLength);
+
+	/// \param pSource Pointer to the compressed data
+	/// \param nSourceLength Length of the compressed data in bytes
+	/// \param pDest Pointer to the destination buffer
+	/// \param nDestSize Size of the destination buffer in bytes
+	/// \return Length of the decompressed data in bytes (0 on error)
+	static size_t Decompress (const void *pSource, size_t nSourceLength,
+				  void *pDest, size_t nDestSize) MAXOPT;
+
+private:
+	static size_t GetHeaderLength (const u8 *pBuffer, size_t nLength);
+
+	static size_t DecompressBlock (const u8 *pSource, size_t nSourceLength,
+				       u8 *pDest, size_t nDestSize) MAXOPT;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // memory.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -49,6 +49,7 @@ public:
 #define COHERENT_SLOT_PROP_MAILBOX	0
 #define COHERENT_SLOT_GPIO_VIRTBUF	1
 #define COHERENT_SLOT_TOUCHBUF		2
+#define COHERENT_SLOT_PROP_ASYNC	3
 
 #define COHERENT_SLOT_VCHIQ_START	(MEGABYTE / PAGE_SIZE / 2)
 #define COHERENT_SLOT_VCHIQ_END		(MEGABYTE / PAGE_SIZE - 1)
@@ -56,6 +57,10 @@ public:
 #if RASPPI >= 4
 #define COHERENT_SLOT_XHCI_START	(MEGABYTE / PAGE_SIZE)
 #define COHERENT_SLOT_XHCI_END		(4*MEGABYTE / PAGE_SIZE - 1)
+
+// xHCI and NVMe cannot be used together, because there is only one PCIe host bridge
+#define COHERENT_SLOT_NVME_START	COHERENT_SLOT_XHCI_START
+#define COHERENT_SLOT_NVME_END		COHERENT_SLOT_XHCI_END
 #endif
 
 	static CMemorySystem *Get (void);
@@ -66,6 +71,7 @@ public:
 #define HEAP_HIGH	1		// memory above 1 GB
 #define HEAP_ANY	2		// high memory (if available) or low memory (otherwise)
 #define HEAP_DMA30	HEAP_LOW	// 30-bit DMA-able memory
+#define HEAP_UNCACHED	3		// normal non-cacheable (write-combining) memory, DMA-able
 	{
 #if RASPPI >= 4
 		void *pBlock;
@@ -77,6 +83,7 @@ public:
 		case HEAP_ANY:	return   (pBlock = s_pThis->m_HeapHigh.Allocate (nSize)) != 0
 				       ? pBlock
 				       : s_pThis->m_HeapLow.Allocate (nSize);
+		case HEAP_UNCACHED: return s_pThis->m_HeapUncached.Allocate (nSize);
 		default:	return 0;
 		}
 #else
@@ -84,6 +91,7 @@ public:
 		{
 		case HEAP_LOW:
 		case HEAP_ANY:	return s_pThis->m_HeapLow.Allocate (nSize);
+		case HEAP_UNCACHED: return s_pThis->m_HeapUncached.Allocate (nSize);
 		default:	return 0;
 		}
 #endif
@@ -91,6 +99,11 @@ public:
 
 	static void *HeapReAllocate (void *pBlock, size_t nSize)	// pBlock may be 0
 	{
+		if (IsUncached (pBlock))
+		{
+			return s_pThis->m_HeapUncached.ReAllocate (pBlock, nSize);
+		}
+
 #if RASPPI >= 4
 		if ((uintptr) pBlock < MEM_HIGHMEM_START)
 		{
@@ -107,6 +120,13 @@ public:
 
 	static void HeapFree (void *pBlock)
 	{
+		if (IsUncached (pBlock))
+		{
+			s_pThis->m_HeapUncached.Free (pBlock);
+
+			return;
+		}
+
 #if RASPPI >= 4
 		if ((uintptr) pBlock < MEM_HIGHMEM_START)
 		{
@@ -130,6 +150,7 @@ public:
 		case HEAP_HIGH: return s_pThis->m_HeapHigh.GetFreeSpace ();
 		case HEAP_ANY:	return   s_pThis->m_HeapLow.GetFreeSpace ()
 				       + s_pThis->m_HeapHigh.GetFreeSpace ();
+		case HEAP_UNCACHED: return s_pThis->m_HeapUncached.GetFreeSpace ();
 		default:	return 0;
 		}
 #else
@@ -137,22 +158,72 @@ public:
 		{
 		case HEAP_LOW:
 		case HEAP_ANY:	return s_pThis->m_HeapLow.GetFreeSpace ();
+		case HEAP_UNCACHED: return s_pThis->m_HeapUncached.GetFreeSpace ();
 		default:	return 0;
 		}
 #endif
 	}
 
+	/// \param pStatus Returns the statistics of the heap
+	/// \param nType HEAP_LOW, HEAP_HIGH (Raspberry Pi 4 only) or HEAP_UNCACHED
+	/// \return Operation successful?
+	static boolean GetHeapStatus (THeapStatus *pStatus, int nType = HEAP_LOW)
+	{
+		switch (nType)
+		{
+		case HEAP_LOW:	s_pThis->m_HeapLow.GetStatus (pStatus);		return TRUE;
+#if RASPPI >= 4
+		case HEAP_HIGH:	s_pThis->m_HeapHigh.GetStatus (pStatus);	return TRUE;
+#endif
+		case HEAP_UNCACHED: s_pThis->m_HeapUncached.GetStatus (pStatus); return TRUE;
+		default:	return FALSE;
+		}
+	}
+
+	/// \return Is the block in the uncached region (HEAP_UNCACHED)?
+	/// \note Buffers in this region do not need cache maintenance before and after DMA.
+	static boolean IsUncached (const void *pBlock)
+	{
+		return    (uintptr) pBlock >= MEM_UNCACHED_REGION
+		       && (uintptr) pBlock <  MEM_UNCACHED_REGION + UNCACHED_REGION_SIZE;
+	}
+
+#if AARCH == 64
+	/// \brief Change the attributes of a page aligned normal memory range at runtime
+	/// \param nAttributes TT_ATTR_* flags (or'ed together), 0 for read/write, cached
+	/// \return Operation successful?
+	/// \note See CTranslationTable::SetAttributes() for details.
+	static boolean SetMemoryAttributes (uintptr nAddress, size_t nSize, unsigned nAttributes)
+	{
+		if (s_pThis->m_pTranslationTable == 0)
+		{
+			return FALSE;
+		}
+
+		return s_pThis->m_pTranslationTable->SetAttributes (nAddress, nSize, nAttributes);
+	}
+#endif
+
 	static void *PageAllocate (void)	{ return s_pThis->m_Pager.Allocate (); }
 	static void PageFree (void *pPage)	{ s_pThis->m_Pager.Free (pPage); }
 
+	/// \brief Allocate physically contiguous pages (e.g. for DMA), free with PageFree()
+	/// \param nSize Size of the range in bytes (is rounded up to 2^n pages)
+	/// \param nAlign Required alignment in bytes (power of 2, 0 for PAGE_SIZE)
+	/// \param nBoundary Range must not cross a multiple of this (power of 2, 0 for none)
+	/// \return Pointer to the range, 0 if not available
+	static void *PageAllocateContiguous (size_t nSize, size_t nAlign = 0, size_t nBoundary = 0)
+	{
+		return s_pThis->m_Pager.AllocateContiguous (nSize, nAlign, nBoundary);
+	}
+
 	static void DumpStatus (void)
 	{
-#ifdef HEAP_DEBUG
 		s_pThis->m_HeapLow.DumpStatus ();
 #if RASPPI >= 4
 		s_pThis->m_HeapHigh.DumpStatus ();
 #endif
-#endif
+		s_pThis->m_HeapUncached.DumpStatus ();
 
 #ifdef PAGE_DEBUG
 		s_pThis->m_Pager.DumpStatus ();
@@ -171,6 +242,7 @@ private:
 #if RASPPI >= 4
 	CHeapAllocator m_HeapHigh;
 #endif
+	CHeapAllocator m_HeapUncached;
 	CPageAllocator m_Pager;
 
 #if AARCH == 32
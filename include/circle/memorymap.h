@@ -4,7 +4,7 @@
 // Memory addresses and sizes
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -43,11 +43,13 @@
 #define EXCEPTION_STACK_SIZE	0x8000
 #define PAGE_TABLE1_SIZE	0x4000
 #define PAGE_RESERVE		(4 * MEGABYTE)
+#define UNCACHED_REGION_SIZE	(2 * MEGABYTE)				// multiple of 2 MB
 
 #define MEM_KERNEL_START	0x8000
 #define MEM_KERNEL_END		(MEM_KERNEL_START + KERNEL_MAX_SIZE)
 #define MEM_KERNEL_STACK	(MEM_KERNEL_END + KERNEL_STACK_SIZE)		// expands down
 #if RASPPI == 1
+#define CORES			1
 #define MEM_ABORT_STACK		(MEM_KERNEL_STACK + EXCEPTION_STACK_SIZE)	// expands down
 #define MEM_IRQ_STACK		(MEM_ABORT_STACK + EXCEPTION_STACK_SIZE)	// expands down
 #define MEM_FIQ_STACK		(MEM_IRQ_STACK + EXCEPTION_STACK_SIZE)		// expands down
@@ -65,12 +67,18 @@
 // coherent memory region (one 1 MB section)
 #define MEM_COHERENT_REGION	((MEM_PAGE_TABLE1_END + 2*MEGABYTE) & ~(MEGABYTE-1))
 
-#define MEM_HEAP_START		(MEM_COHERENT_REGION + MEGABYTE)
+// uncached memory region (two 1 MB sections)
+#define MEM_UNCACHED_REGION	(MEM_COHERENT_REGION + MEGABYTE)
+
+#define MEM_HEAP_START		(MEM_UNCACHED_REGION + UNCACHED_REGION_SIZE)
 #else
 // coherent memory region (two 2 MB blocks)
 #define MEM_COHERENT_REGION	((MEM_PAGE_TABLE1_END + 3*MEGABYTE) & ~(2*MEGABYTE-1))
 
-#define MEM_HEAP_START		(MEM_COHERENT_REGION + 2*2*MEGABYTE)
+// uncached memory region (one 2 MB block)
+#define MEM_UNCACHED_REGION	(MEM_COHERENT_REGION + 2*2*MEGABYTE)
+
+#define MEM_HEAP_START		(MEM_UNCACHED_REGION + UNCACHED_REGION_SIZE)
 #endif
 
 #if RASPPI >= 4
@@ -44,6 +44,7 @@
 #define KERNEL_STACK_SIZE	0x20000
 #define EXCEPTION_STACK_SIZE	0x8000
 #define PAGE_RESERVE		(16 * MEGABYTE)
+#define UNCACHED_REGION_SIZE	(2 * MEGABYTE)				// multiple of PAGE_SIZE
 
 #define MEM_KERNEL_START	0x80000					// main code starts here
 #define MEM_KERNEL_END		(MEM_KERNEL_START + KERNEL_MAX_SIZE)
@@ -55,12 +56,18 @@
 // coherent memory region (1 MB)
 #define MEM_COHERENT_REGION	((MEM_EXCEPTION_STACK_END + 2*MEGABYTE) & ~(MEGABYTE-1))
 
-#define MEM_HEAP_START		(MEM_COHERENT_REGION + MEGABYTE)
+// uncached memory region
+#define MEM_UNCACHED_REGION	(MEM_COHERENT_REGION + MEGABYTE)
+
+#define MEM_HEAP_START		(MEM_UNCACHED_REGION + UNCACHED_REGION_SIZE)
 #else
 // coherent memory region (4 MB)
 #define MEM_COHERENT_REGION	((MEM_EXCEPTION_STACK_END + 2*MEGABYTE) & ~(MEGABYTE-1))
 
-#define MEM_HEAP_START		(MEM_COHERENT_REGION + 4*MEGABYTE)
+// uncached memory region
+#define MEM_UNCACHED_REGION	(MEM_COHERENT_REGION + 4*MEGABYTE)
+
+#define MEM_HEAP_START		(MEM_UNCACHED_REGION + UNCACHED_REGION_SIZE)
 #endif
 
 #if RASPPI >= 4
@@ -2,7 +2,7 @@
 // multicore.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -29,6 +29,7 @@
 
 // inter-processor interrupt (IPI)
 #define IPI_HALT_CORE		0		// halt target core
+#define IPI_CORE_CHANNEL	1		// message in CCoreChannel
 #define IPI_USER		10		// first user defineable IPI
 #if RASPPI <= 3
 #define IPI_MAX			31
@@ -46,7 +47,8 @@ public:
 
 	virtual void Run (unsigned nCore) = 0;
 
-	virtual void IPIHandler (unsigned nCore, unsigned nIPI);	// handles IPI on this core
+	// handles IPI on this core, overrides must call this for IPI_CORE_CHANNEL
+	virtual void IPIHandler (unsigned nCore, unsigned nIPI);
 
 public:
 	static void SendIPI (unsigned nCore, unsigned nIPI);		// send IPI to core
@@ -2,7 +2,7 @@
 // arphandler.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,14 +22,25 @@
 
 #include <circle/net/netconfig.h>
 #include <circle/net/netdevlayer.h>
-#include <circle/net/netqueue.h>
+#include <circle/net/netframequeue.h>
 #include <circle/net/ipaddress.h>
+#include <circle/netbuffer.h>
+#include <circle/lockfreering.h>
 #include <circle/macaddress.h>
 #include <circle/timer.h>
+#include <circle/seqlock.h>
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
-#define ARP_MAX_ENTRIES		20
+#ifndef ARP_MAX_ENTRIES
+#define ARP_MAX_ENTRIES		512		// must be a power of 2
+#endif
+
+#define ARP_HASH_SIZE		(ARP_MAX_ENTRIES / 2)
+
+#ifndef ARP_MAX_PENDING_FRAMES
+#define ARP_MAX_PENDING_FRAMES	4		// per unresolved address
+#endif
 
 enum TARPState
 {
@@ -46,10 +57,16 @@ struct TARPEntry
 	volatile TARPState	State;
 	u8			IPAddress[IP_ADDRESS_SIZE];
 	u8			MACAddress[MAC_ADDRESS_SIZE];
-	TKernelTimerHandle	hTimer;
+	CKernelTimer		Timer;
 	unsigned		nAttempts;
 	unsigned		nTicksLastUsed;
-	CNetQueue		*pTxQueue;		// deferred frames
+	unsigned		nHashNext;		// next entry in hash chain or free list
+	unsigned		nLRUPrev;		// LRU list, most recently used first
+	unsigned		nLRUNext;
+	volatile boolean	bReferenced;		// by a lock-free lookup since last touch
+	boolean			bActionQueued;		// is in m_ActionRing
+	unsigned		nTxFrames;
+	CNetBuffer		*pTxFrame[ARP_MAX_PENDING_FRAMES];	// deferred frames
 };
 
 class CLinkLayer;
@@ -58,32 +75,61 @@ class CARPHandler
 {
 public:
 	CARPHandler (CNetConfig *pNetConfig, CNetDeviceLayer *pNetDevLayer,
-		     CLinkLayer *pLinkLayer, CNetQueue *pRxQueue);
+		     CLinkLayer *pLinkLayer, CNetFrameQueue *pRxQueue);
 	~CARPHandler (void);
 
 	void Process (void);
 
-	// frame is queued, if resolve fails
-	boolean Resolve (const CIPAddress &rIPAddress, CMACAddress *pMACAddress,
-			 const void *pFrame, unsigned nFrameLength);
+	// frame is queued (with an own reference), if resolve fails,
+	// a valid entry is found without acquiring the spin lock
+	boolean Resolve (const CIPAddress &rIPAddress, CMACAddress *pMACAddress, CNetBuffer *pFrame);
+
+	// add a valid entry (e.g. restored from a previous boot)
+	void AddEntry (const CIPAddress &rIPAddress, const CMACAddress &rMACAddress);
+	// returns TRUE, if a valid entry has been found
+	boolean Lookup (const CIPAddress &rIPAddress, CMACAddress *pMACAddress);
+
+	// remove all valid entries (e.g. after the link has come up again),
+	// pending requests are continued
+	void Flush (void);
 	
 private:
-	void ReplyReceived (const CIPAddress &rForeignIP, const CMACAddress &rForeignMAC);
-	void RequestReceived (const CIPAddress &rForeignIP, const CMACAddress &rForeignMAC);
+	// lock-free lookup of a valid entry, may fail spuriously while the table is modified
+	boolean LookupValid (const CIPAddress &rIPAddress, CMACAddress *pMACAddress);
+
+	void PacketReceived (const CIPAddress &rForeignIP, const CMACAddress &rForeignMAC,
+			     boolean bTargetIsUs);
 
 	void SendPacket (boolean bRequest, const CIPAddress &rForeignIP, const CMACAddress &rForeignMAC);
 
+	// the following methods must be called with m_SpinLock acquired
+	unsigned LookupEntry (const CIPAddress &rIPAddress) const;
+	unsigned AllocEntry (const CIPAddress &rIPAddress);	// may replace the LRU entry
+	void FreeEntry (unsigned nEntry);			// deferred frames must be detached
+	void TouchEntry (unsigned nEntry);			// make it most recently used
+	void RotateLRU (void);					// touch referenced entries at the end
+	void QueueAction (unsigned nEntry);			// for Process()
+	unsigned DetachFrames (unsigned nEntry, CNetBuffer **ppFrame);
+
+	static unsigned Hash (const u8 *pIPAddress);
+
 	static void TimerHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext);
 
 private:
 	CNetConfig	*m_pNetConfig;
 	CNetDeviceLayer	*m_pNetDevLayer;
 	CLinkLayer	*m_pLinkLayer;
-	CNetQueue	*m_pRxQueue;
+	CNetFrameQueue	*m_pRxQueue;
+
+	TARPEntry *m_pEntry;				// [ARP_MAX_ENTRIES]
+	unsigned m_HashTable[ARP_HASH_SIZE];		// first entry of hash chain
+	unsigned m_nFreeList;
+	unsigned m_nLRUFirst;
+	unsigned m_nLRULast;
 
-	unsigned  m_nEntries;
-	TARPEntry m_Entry[ARP_MAX_ENTRIES];
+	CSPSCRing<unsigned> m_ActionRing;		// entries with work for Process()
 	CSpinLock m_SpinLock;
+	CSeqLock m_SeqLock;				// modifications of hash chains and MACs
 
 	unsigned m_nTicksLastCleanup;
 };
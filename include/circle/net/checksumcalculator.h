@@ -2,7 +2,7 @@
 // checksumcalculator.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -48,10 +48,22 @@ public:
 	
 	u16 Calculate (const void *pBuffer, unsigned nLength);
 
+	// calculates the checksum over the header (nHeaderLength must be even), followed by
+	// the data, which is copied from pData to pDest at the same time (may be at any alignment)
+	u16 CalculateCopy (const void *pHeader, unsigned nHeaderLength,
+			   void *pDest, const void *pData, unsigned nDataLength);
+
+	// returns the (not complemented) sum over the pseudo header, which has to be set into
+	// the checksum field, if the checksum is calculated by the net device
+	u16 CalculatePseudoHeader (unsigned nLength);
+
 	static u16 SimpleCalculate (const void *pBuffer, unsigned nLength);
 
 private:
 	static u32 CalculateChunk (const void *pBuffer, unsigned nLength, u32 nChecksum);
+	static u32 CopyChunk (void *pDest, const void *pSource, unsigned nLength, u32 nChecksum);
+
+	static u32 FoldSum (u64 nSum);
 
 	static u16 FoldResult (u32 nChecksum);
 	
@@ -0,0 +1,99 @@
+//
+// contentcache.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_contentcache_h
+#define _circle_net_contentcache_h
+
+#include <circle/types.h>
+
+#ifndef CONTENT_CACHE_SIZE
+#define CONTENT_CACHE_SIZE		0x100000	// default max. total size of the data
+#endif
+
+#define CONTENT_CACHE_ETAG_SIZE		24		// including quotes and terminating NUL
+
+class CContentCache;
+
+struct TContentCacheEntry
+{
+	char		*pName;
+	u32		 nNameHash;
+	const u8	*pData;				// 0 if the file does not exist
+	size_t		 nLength;
+	char		 ETag[CONTENT_CACHE_ETAG_SIZE];	// strong validator (with quotes)
+
+	unsigned	 nRefCount;
+	boolean		 bRemoved;			// freed on last Release()
+	TContentCacheEntry *pPrev;			// LRU list, most recently used first
+	TContentCacheEntry *pNext;
+};
+
+// Holds the content of frequently requested files (e.g. static assets of a web UI) in
+// memory. The total size is bounded, the least recently used entries are removed first.
+// Entries, which are still referenced, are freed, when they are released. The cache does
+// not access a file system on its own, the data is loaded by the user (e.g. by
+// CHTTPDaemon::SendCachedFile()). It can be shared by several tasks, but must not be used
+// from other cores or interrupt context.
+
+class CContentCache
+{
+public:
+	CContentCache (size_t nMaxSize = CONTENT_CACHE_SIZE);
+	~CContentCache (void);
+
+	// returns a referenced entry or 0, if the name is not cached
+	TContentCacheEntry *Lookup (const char *pName);
+
+	// pData has been allocated with new u8[] and is owned by the cache afterwards,
+	// pData == 0 records, that the file does not exist (negative entry),
+	// nLength must not exceed GetMaxEntrySize(), an existing entry is replaced,
+	// returns the referenced new entry
+	TContentCacheEntry *Insert (const char *pName, u8 *pData, size_t nLength);
+
+	void Release (TContentCacheEntry *pEntry);
+
+	// remove the entry of this name (e.g. the file has been written)
+	void Invalidate (const char *pName);
+	// remove all entries
+	void Flush (void);
+
+	// larger files should not be cached
+	size_t GetMaxEntrySize (void) const;
+
+	// returns TRUE, if the (quoted) entity tags from an If-None-Match header field
+	// contain the entity tag of this entry
+	static boolean MatchETag (const TContentCacheEntry *pEntry, const char *pIfNoneMatch);
+
+private:
+	TContentCacheEntry *Find (const char *pName, u32 nHash) const;
+
+	void Remove (TContentCacheEntry *pEntry);
+	static void Free (TContentCacheEntry *pEntry);
+
+	static u32 Hash (const void *pData, size_t nLength, u32 nHash = 2166136261U);
+
+private:
+	size_t m_nMaxSize;
+	size_t m_nSize;					// of the data of the listed entries
+
+	TContentCacheEntry *m_pFirst;			// LRU list
+	TContentCacheEntry *m_pLast;
+};
+
+#endif
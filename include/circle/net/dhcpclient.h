@@ -2,7 +2,7 @@
 // dhcpclient.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -39,15 +39,26 @@ enum TDHCPStatus
 class CDHCPClient : public CTask
 {
 public:
-	CDHCPClient (CNetSubSystem *pNetSubSystem, const char *pHostname);
+	// with pLease != 0 the network is configured immediately and the lease is
+	// confirmed in the INIT-REBOOT state
+	CDHCPClient (CNetSubSystem *pNetSubSystem, const char *pHostname,
+		     const TDHCPLease *pLease = 0);
 	~CDHCPClient (void);
 
 	void Run (void);
 
 	boolean IsBound (void) const;
+
+	// the lease is verified in the INIT-REBOOT state, because we may be
+	// connected to another network now
+	void LinkRestored (void);
+
+	// returns FALSE, if not bound
+	boolean GetLease (TDHCPLease *pLease) const;
 	
 private:
 	// process the states
+	TDHCPStatus InitReboot (void);
 	TDHCPStatus SelectAndRequest (void);
 	TDHCPStatus RenewOrRebind (boolean bRenew, unsigned nTimeout);
 
@@ -78,6 +89,8 @@ private:
 
 	boolean m_bIsBound;
 	unsigned m_nBoundSince;		// starting uptime for timers
+	boolean m_bInitReboot;		// REQUEST without server identifier
+	volatile boolean m_bLinkRestored;
 
 	u32 m_nOwnIPAddress;		// own IP address to be used
 	u32 m_nServerIdentifier;	// IP address of the DHCP server to be used
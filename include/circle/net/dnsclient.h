@@ -2,7 +2,7 @@
 // dnsclient.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,21 +24,89 @@
 #include <circle/net/ipaddress.h>
 #include <circle/types.h>
 
-class CDNSClient
+#define DNS_MAX_HOSTNAME_SIZE	256
+#define DNS_MAX_SERVERS		3		// including the server from the net config
+#define DNS_CACHE_SIZE		16		// entries
+#define DNS_MAX_TTL		3600		// seconds, longer TTLs are limited to this
+#define DNS_NEGATIVE_TTL	60		// seconds, for non-existing host names
+
+/// \param bOK Has the host name been resolved?
+/// \param rIPAddress Resolved IP address (valid only, if bOK is TRUE)
+/// \param pParam User parameter handed over to ResolveAsync()
+typedef void TDNSResolveHandler (boolean bOK, const CIPAddress &rIPAddress, void *pParam);
+
+/// \note Resolved host names are cached according to the TTL of the answer (positive cache)
+///	  and non-existing host names for DNS_NEGATIVE_TTL seconds (negative cache). The cache
+///	  is shared by all instances of this class. If a host name is already being resolved
+///	  by another task, the result of this query is awaited instead of sending a new one.
+/// \note A query is sent to all known DNS servers in parallel, the first answer is used.
+
+class CDNSClient	/// Resolves host names to IP addresses using the DNS protocol
 {
 public:
+	/// \param pNetSubSystem Pointer to the network subsystem
 	CDNSClient (CNetSubSystem *pNetSubSystem);
 	~CDNSClient (void);
 
+	/// \brief Resolve a host name (or an IP address string), blocks until done
+	/// \param pHostname Host name or IP address string
+	/// \param pIPAddress Resolved IP address is returned here
+	/// \return Operation successful?
 	boolean Resolve (const char *pHostname, CIPAddress *pIPAddress);
 
+	/// \brief Resolve a host name (or an IP address string) in the background
+	/// \param pHostname Host name or IP address string
+	/// \param pHandler Called with the result from a task, which is created for this purpose,\n
+	///		    or directly from this method, if the result is already known
+	/// \param pParam User parameter handed over to pHandler
+	void ResolveAsync (const char *pHostname, TDNSResolveHandler *pHandler, void *pParam = 0);
+
+	/// \brief Add a DNS server, which is queried in parallel to the server from the net config
+	/// \param rServerIP IP address of the DNS server
+	/// \return Operation successful? (FALSE, if the list is full)
+	static boolean AddServer (const CIPAddress &rServerIP);
+
+	/// \brief Remove all entries from the cache
+	static void FlushCache (void);
+
 private:
+	enum TQueryStatus
+	{
+		QueryStatusSuccess,
+		QueryStatusNameError,		// host name does not exist
+		QueryStatusFailed		// timeout or invalid response
+	};
+
+	TQueryStatus Query (const char *pHostname, CIPAddress *pIPAddress, unsigned *pTTL);
+
+	static int BuildQuery (const char *pHostname, u16 nXID, u8 *pBuffer);
+	static TQueryStatus ParseResponse (const u8 *pBuffer, int nSize, u16 nXID,
+					   CIPAddress *pIPAddress, unsigned *pTTL);
+
 	boolean ConvertIPString (const char *pIPString, CIPAddress *pIPAddress);
 
+	struct TCacheEntry;
+	static TCacheEntry *LookupCache (const char *pHostname);
+	static TCacheEntry *AllocateCacheEntry (const char *pHostname);
+
 private:
 	CNetSubSystem *m_pNetSubSystem;
 
 	static u16 s_nXID;		// transaction ID
+
+	struct TCacheEntry
+	{
+		char		Hostname[DNS_MAX_HOSTNAME_SIZE];	// empty if unused
+		boolean		bPending;				// query is running
+		boolean		bValid;					// FALSE for negative entry
+		CIPAddress	IPAddress;
+		unsigned	nExpires;				// uptime in seconds
+	};
+
+	static TCacheEntry s_Cache[DNS_CACHE_SIZE];
+
+	static CIPAddress s_Server[DNS_MAX_SERVERS-1];
+	static unsigned s_nServers;
 };
 
 #endif
@@ -4,7 +4,7 @@
 // Definitions common to HTTP client and server
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -30,6 +30,7 @@
 #define HTTP_MAX_PARAMS		(HTTP_MAX_URI-HTTP_MAX_PATH-1)
 #define HTTP_MAX_FORM_DATA	2048
 #define HTTP_MAX_MULTIPART_BOUNDARY 100
+#define HTTP_MAX_IF_NONE_MATCH	200
 
 enum THTTPRequestMethod
 {
@@ -41,7 +42,9 @@ enum THTTPRequestMethod
 
 enum THTTPStatus
 {
+	HTTPSwitchingProtocols	  = 101,
 	HTTPOK			  = 200,
+	HTTPNotModified		  = 304,
 	HTTPBadRequest		  = 400,
 	HTTPNotFound		  = 404,
 	HTTPRequestTimeout	  = 408,
@@ -56,7 +59,8 @@ enum THTTPStatus
 	HTTPConnectionReset	  = 550,
 	HTTPInvalidResponseCode	  = 551,
 	HTTPInvalidChunkHeader	  = 552,
-	HTTPContentBufferTooSmall = 553
+	HTTPContentBufferTooSmall = 553,
+	HTTPRequestAborted	  = 554
 };
 
 #endif
@@ -2,7 +2,7 @@
 // httpclient.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -27,6 +27,12 @@
 #include <circle/string.h>
 #include <circle/types.h>
 
+#define HTTP_CLIENT_POOL_SIZE		4	// idle keep-alive connections (all hosts)
+#define HTTP_CLIENT_IDLE_TIMEOUT	15	// seconds, idle connections are closed afterwards
+
+// called with pieces of the response content, return FALSE to abort the request
+typedef boolean THTTPContentHandler (const u8 *pData, unsigned nLength, void *pParam);
+
 class CHTTPClient
 {
 public:
@@ -45,20 +51,56 @@ public:
 			  unsigned   *pLength,			// in: buffer size, out: content length
 			  const char *pFormData);		// "name=value[&name=value...]"
 
+	// streaming variants: the content is handed over to pHandler in pieces as it arrives,
+	// returns HTTPRequestAborted, if pHandler returned FALSE
+	THTTPStatus GetStream (const char	   *pPath,
+			       THTTPContentHandler *pHandler,
+			       void		   *pParam = 0);
+
+	THTTPStatus PostStream (const char	    *pPath,
+				const char	    *pFormData,
+				THTTPContentHandler *pHandler,
+				void		    *pParam = 0);
+
+	// re-use connections to the same server for further requests (default TRUE)
+	void SetKeepAlive (boolean bKeepAlive);
+
+	// close all idle keep-alive connections
+	static void CloseIdleConnections (void);
+
 private:
-	THTTPStatus Request (THTTPRequestMethod	 Method,
-			     const char		*pPath,		// may include URL parameters
-			     u8			*pBuffer,	// content will be returned here
-			     unsigned		*pLength,	// in: buffer size, out: content length
-			     const char		*pFormData = 0);// form data for POST or 0
+	THTTPStatus Request (THTTPRequestMethod	  Method,
+			     const char		 *pPath,	// may include URL parameters
+			     const char		 *pFormData,	// form data for POST or 0
+			     THTTPContentHandler *pHandler,
+			     void		 *pParam);
+
+	THTTPStatus ReceiveResponse (THTTPContentHandler *pHandler, void *pParam,
+				     boolean *pResponseStarted);
+
+	boolean OpenConnection (boolean *pReused);
+	void ReleaseConnection (boolean bKeepAlive);		// closes it, if !bKeepAlive
+
+	static boolean BufferHandler (const u8 *pData, unsigned nLength, void *pParam);
 
 private:
 	CNetSubSystem *m_pNetSubSystem;
 	CIPAddress     m_ServerIP;
 	u16	       m_ServerPort;
 	CString	       m_ServerName;
+	boolean	       m_bKeepAlive;
 
 	CSocket	      *m_pSocket;
+
+	struct TPoolEntry
+	{
+		CSocket	   *pSocket;		// 0 if unused
+		CIPAddress  ServerIP;
+		u16	    ServerPort;
+		unsigned    nIdleSince;		// ticks
+	};
+
+	static TPoolEntry s_Pool[HTTP_CLIENT_POOL_SIZE];
 };
 
 #endif
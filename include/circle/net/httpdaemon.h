@@ -2,7 +2,7 @@
 // httpdaemon.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,9 +24,17 @@
 #include <circle/net/netsubsystem.h>
 #include <circle/net/http.h>
 #include <circle/net/socket.h>
+#include <circle/net/websocket.h>
+#include <circle/net/contentcache.h>
 #include <circle/net/ipaddress.h>
+#include <circle/netdevice.h>
+#include <circle/arena.h>
 #include <circle/types.h>
 
+#define HTTP_CONTENT_LENGTH_CHUNKED	((unsigned) -1)	// use chunked transfer encoding
+
+class CFATFileSystem;
+
 class CHTTPDaemon : public CTask
 {
 public:
@@ -42,13 +50,33 @@ public:
 	// creates an instance of your derived webserver class
 	virtual CHTTPDaemon *CreateWorker (CNetSubSystem *pNetSubSystem, CSocket *pSocket) = 0;
 
-	// define this to provide your content
+	// define this to provide your content (or override StreamContent())
 	virtual THTTPStatus GetContent (const char  *pPath,	// path of the file to be sent
 				        const char  *pParams,	// parameters to GET ("" for none)
 					const char  *pFormData, // form data from POST ("" for none)
 				        u8	    *pBuffer,	// copy your content here
 				        unsigned    *pLength,	// in: buffer size, out: content length
-				        const char **ppContentType) = 0; // set this if not "text/html"
+				        const char **ppContentType); // set this if not "text/html"
+
+	// override this to send content, which is not buffered (e.g. large or generated on the fly)
+	// call BeginResponse() and WriteContent() from here, or SendFile(), and return HTTPOK
+	// return an error status, before BeginResponse() has been called, to send an error page
+	// the default implementation calls GetContent() and sends the buffered content
+	virtual THTTPStatus StreamContent (const char *pPath,	// path of the file to be sent
+					   const char *pParams,	// parameters to GET ("" for none)
+					   const char *pFormData); // form data from POST ("" for none)
+
+	// return TRUE to accept a WebSocket connection (RFC 6455) request for this path
+	// the default implementation returns FALSE (the request is handled as normal GET)
+	virtual boolean AcceptWebSocket (const char *pPath,	// path of the requested resource
+					 const char *pParams);	// parameters ("" for none)
+
+	// override this to communicate over an accepted WebSocket connection
+	// called from the worker task, the connection is closed, when this returns
+	// keep the pointer in a list to use it with CWebSocket::Broadcast() from other tasks
+	virtual void WebSocketSession (CWebSocket *pWebSocket,
+				       const char *pPath,	// path of the requested resource
+				       const char *pParams);	// parameters ("" for none)
 
 	// overwrite this to implement your own access logging
 	virtual void WriteAccessLog (const CIPAddress	&rRemoteIP,
@@ -64,10 +92,47 @@ protected:
 				      const u8	 **ppData,	// returns pointer to part data
 				      unsigned	  *pLength);	// returns part data length
 
+	// sends the response header with status 200 (from StreamContent() only)
+	boolean BeginResponse (const char *pContentType = "text/html",
+			       unsigned nContentLength = HTTP_CONTENT_LENGTH_CHUNKED,
+			       const char *pExtraFields = "");	// header lines with "\r\n" each
+	// sends the next part of the content, may be called repeatedly after BeginResponse()
+	boolean WriteContent (const void *pData, unsigned nLength);
+
+	// sends a whole file from a FAT file system (from StreamContent() only)
+	// the file data is handed over to the TCP connection without copying it into a buffer
+	THTTPStatus SendFile (CFATFileSystem *pFileSystem, const char *pFileName,
+			      const char *pContentType = "text/html");
+
+	// sends a whole file from the content cache, loads it from the FAT file system on a miss
+	// answers with 304 Not Modified, if the client has the current version (ETag)
+	// a pre-compressed variant (pFileName with ".gz" appended) is sent with
+	// "Content-Encoding: gzip", if it exists and the client accepts it
+	// files larger than pCache->GetMaxEntrySize() are sent with SendFile()
+	THTTPStatus SendCachedFile (CContentCache *pCache, CFATFileSystem *pFileSystem,
+				    const char *pFileName, const char *pContentType = "text/html");
+
 private:
 	void Listener (void);			// accepts incoming connections and creates worker task
 	void Worker (void);			// processes a connection
 
+	boolean WaitForRequest (void);		// returns FALSE on timeout
+	boolean ProcessRequest (boolean bKeepAliveAllowed); // returns TRUE to keep connection
+	void ProcessWebSocket (void);		// handshake and session
+
+	boolean SendHeader (THTTPStatus Status, const char *pContentType, unsigned nContentLength,
+			    const char *pExtraFields = "");	// header lines with "\r\n" each
+	boolean SendErrorPage (THTTPStatus Status);
+	boolean EndResponse (void);
+	static const char *GetStatusMessage (THTTPStatus Status);
+
+	static void SendFileCompletionHandler (const void *pBuffer, void *pParam);
+
+	// returns the referenced entry, loads the file on a miss, 0 if it cannot be cached
+	static TContentCacheEntry *LoadCachedFile (CContentCache *pCache,
+						   CFATFileSystem *pFileSystem,
+						   const char *pFileName);
+
 	THTTPStatus ParseRequest (void);
 	THTTPStatus ParseMethod (char *pLine);
 	THTTPStatus ParseHeaderField (char *pLine);
@@ -84,8 +149,14 @@ private:
 	
 	u8 *m_pContentBuffer;
 
+	// received data, which has not been parsed yet (may contain pipelined requests)
+	char m_RxBuffer[FRAME_BUFFER_SIZE];
+	unsigned m_nRxOffset;
+	unsigned m_nRxLength;
+
 	// from request
 	THTTPRequestMethod m_RequestMethod;
+	boolean m_bKeepAlive;				// connection persists after response
 
 	char m_RequestURI[HTTP_MAX_URI+1];		// the URI without host
 	char m_RequestPath[HTTP_MAX_PATH+1];		// the path without parameters
@@ -101,6 +172,23 @@ private:
 	char *m_pMultipartBuffer;			// pointer to allocated multipart buffer
 	char *m_pMultipartPointer;			// pointer into allocated multipart buffer
 
+	CArena m_RequestArena;				// memory of current request, reset after it
+
+	boolean m_bUpgradeWebSocket;			// "Upgrade: websocket" received
+	boolean m_bConnectionUpgrade;			// "Connection: Upgrade" received
+	unsigned m_nWebSocketVersion;
+	char m_WebSocketKey[WEBSOCKET_KEY_SIZE+1];
+
+	boolean m_bAcceptGzip;				// "Accept-Encoding: gzip" received
+	char m_IfNoneMatch[HTTP_MAX_IF_NONE_MATCH+1];	// entity tags ("" if not received)
+
+	// response
+	boolean m_bResponseBegun;			// header has been sent
+	boolean m_bSendFailed;				// connection is unusable
+	boolean m_bChunked;				// chunked transfer encoding
+	unsigned m_nContentLength;			// announced in header (if not chunked)
+	unsigned m_nContentSent;			// bytes of content written
+
 	static unsigned s_nInstanceCount;
 };
 
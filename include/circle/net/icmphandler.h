@@ -21,7 +21,7 @@
 #define _circle_net_icmphandler_h
 
 #include <circle/net/netconfig.h>
-#include <circle/net/netqueue.h>
+#include <circle/net/netframequeue.h>
 #include <circle/net/ipaddress.h>
 #include <circle/types.h>
 
@@ -84,7 +84,7 @@ class CICMPHandler
 {
 public:
 	CICMPHandler (CNetConfig *pNetConfig, CNetworkLayer *pNetworkLayer,
-		      CNetQueue *pRxQueue, CNetQueue *pNotificationQueue);
+		      CNetFrameQueue *pRxQueue, CNetFrameQueueMP *pNotificationQueue);
 	~CICMPHandler (void);
 
 	void Process (void);
@@ -99,8 +99,8 @@ private:
 private:
 	CNetConfig	*m_pNetConfig;
 	CNetworkLayer	*m_pNetworkLayer;
-	CNetQueue	*m_pRxQueue;
-	CNetQueue	*m_pNotificationQueue;
+	CNetFrameQueue	*m_pRxQueue;
+	CNetFrameQueueMP *m_pNotificationQueue;
 };
 
 #endif
@@ -0,0 +1,85 @@
+//
+// igmphandler.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_igmphandler_h
+#define _circle_net_igmphandler_h
+
+#include <circle/net/netconfig.h>
+#include <circle/net/netframequeue.h>
+#include <circle/net/ipaddress.h>
+#include <circle/netdevice.h>
+#include <circle/bcmrandom.h>
+#include <circle/types.h>
+
+#define IGMP_MAX_GROUPS		(MAX_MULTICAST_ADDRESSES - 1)	// without all-hosts group
+
+class CNetworkLayer;
+class CLinkLayer;
+
+class CIGMPHandler	/// IGMPv2/v3 host side group membership (RFC 2236 and RFC 3376)
+{
+public:
+	CIGMPHandler (CNetConfig *pNetConfig, CNetworkLayer *pNetworkLayer,
+		      CLinkLayer *pLinkLayer, CNetFrameQueue *pRxQueue);
+	~CIGMPHandler (void);
+
+	void Process (void);
+
+	// reference counted, returns FALSE if the group table is full
+	boolean JoinGroup (const CIPAddress &rGroupIP);
+	void LeaveGroup (const CIPAddress &rGroupIP);
+
+	// the all-hosts group 224.0.0.1 is always joined
+	boolean IsMember (const CIPAddress &rGroupIP) const;
+
+private:
+	struct TGroup
+	{
+		CIPAddress	GroupIP;
+		unsigned	nRefCount;		// 0 if entry is unused
+		boolean		bReportPending;
+		boolean		bStateChange;		// unsolicited report on join
+		unsigned	nReportTicks;		// when the pending report is due
+		unsigned	nRetransmissions;	// of the unsolicited report
+	};
+
+	void QueryReceived (const u8 *pPacket, unsigned nLength);
+	void ReportReceived (const CIPAddress &rGroupIP);
+
+	void ScheduleReport (TGroup *pGroup, unsigned nMaxDelayTicks);
+	void SendReports (void);
+	void SendMessage (const CIPAddress &rDestIP, const void *pMessage, unsigned nLength);
+
+	void UpdateFilter (void);
+
+private:
+	CNetConfig	*m_pNetConfig;
+	CNetworkLayer	*m_pNetworkLayer;
+	CLinkLayer	*m_pLinkLayer;
+	CNetFrameQueue	*m_pRxQueue;
+
+	TGroup m_Group[IGMP_MAX_GROUPS];
+
+	unsigned m_nVersion;			// host compatibility mode (2 or 3)
+	unsigned m_nOlderQuerierTicks;		// when the last IGMPv1/v2 query was received
+
+	CBcmRandomNumberGenerator m_Random;	// for report delays
+};
+
+#endif
@@ -5,9 +5,11 @@
 #define _circle_net_in_h
 
 #define IPPROTO_ICMP	1
+#define IPPROTO_IGMP	2
 #define IPPROTO_TCP	6
 #define IPPROTO_UDP	17
 
 #define MSG_DONTWAIT	0x40
+#define MSG_MORE	0x8000		// more data follows, TCP only
 
 #endif
@@ -2,7 +2,7 @@
 // ipaddress.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -53,6 +53,8 @@ public:
 
 	boolean IsNull (void) const;
 	boolean IsBroadcast (void) const;
+	boolean IsMulticast (void) const;	// 224.0.0.0/4
+	boolean IsLoopback (void) const;	// 127.0.0.0/8
 	unsigned GetSize (void) const;
 
 	void Format (CString *pString) const;
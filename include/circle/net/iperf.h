@@ -0,0 +1,58 @@
+//
+// iperf.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_iperf_h
+#define _circle_net_iperf_h
+
+#include <circle/macros.h>
+#include <circle/types.h>
+
+// iperf 2 protocol (all fields in network byte order)
+
+#define IPERF_PORT		5001
+#define IPERF_INTERVAL		1		// seconds between interval reports
+
+#define IPERF_UDP_LENGTH	1470		// default datagram size
+
+struct TIPerfUDPHeader		// at the start of each UDP datagram
+{
+	s32	nID;			// sequence number, negated in the final datagrams
+	u32	nSeconds;		// send time
+	u32	nMicroSeconds;
+	u32	nID2;			// upper bits of the sequence number (iperf 2.0.10+)
+}
+PACKED;
+
+struct TIPerfServerReport	// follows TIPerfUDPHeader in the reply to the final datagram
+{
+	s32	nFlags;
+#define IPERF_HEADER_VERSION1	0x80000000
+	s32	nTotalLength1;		// upper 32 bits of the received bytes
+	s32	nTotalLength2;		// lower 32 bits
+	s32	nStopSeconds;		// test duration
+	s32	nStopMicroSeconds;
+	s32	nErrorCount;		// lost datagrams
+	s32	nOutOfOrderCount;
+	s32	nDatagrams;
+	s32	nJitterSeconds;
+	s32	nJitterMicroSeconds;
+}
+PACKED;
+
+#endif
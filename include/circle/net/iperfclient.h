@@ -0,0 +1,83 @@
+//
+// iperfclient.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_iperfclient_h
+#define _circle_net_iperfclient_h
+
+#include <circle/sched/task.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/net/iperf.h>
+#include <circle/net/iperfreporter.h>
+#include <circle/net/ipaddress.h>
+#include <circle/net/socket.h>
+#include <circle/net/in.h>
+#include <circle/types.h>
+
+/// \note This client runs one test against an iperf 2 server ("iperf -s [-u]") and\n
+///	  terminates afterwards. The reports are written to the logger. On UDP the\n
+///	  server report (loss and jitter) is logged too.
+
+class CIPerfClient : public CTask	/// iperf 2 compatible TCP or UDP client
+{
+public:
+	/// \param pNetSubSystem Pointer to the network subsystem
+	/// \param rServerIP IP address of the iperf server
+	/// \param nProtocol IPPROTO_TCP or IPPROTO_UDP
+	/// \param nDuration Test duration in seconds
+	/// \param nBandwidth Target bandwidth in Kbit/s (UDP only)
+	/// \param usPort Port number of the server
+	/// \param nInterval Seconds between interval reports
+	CIPerfClient (CNetSubSystem *pNetSubSystem, const CIPAddress &rServerIP,
+		      int nProtocol = IPPROTO_TCP, unsigned nDuration = 10,
+		      unsigned nBandwidth = 1000, u16 usPort = IPERF_PORT,
+		      unsigned nInterval = IPERF_INTERVAL);
+	~CIPerfClient (void);
+
+	void Run (void);
+
+	/// \return Has the test been completed (successful or not)?
+	boolean IsFinished (void) const;
+	/// \return Measured throughput in Kbit/s (0 on error)
+	/// \note Valid, when IsFinished() returns TRUE.
+	unsigned GetThroughput (void) const;
+
+private:
+	boolean TCPClient (void);
+	boolean UDPClient (void);
+
+	void LogServerReport (const TIPerfServerReport *pReport);
+
+private:
+	CNetSubSystem *m_pNetSubSystem;
+	CIPAddress m_ServerIP;
+	int m_nProtocol;
+	unsigned m_nDuration;			// microseconds
+	unsigned m_nBandwidth;
+	u16 m_usPort;
+
+	CSocket *m_pSocket;
+	u8 *m_pBuffer;
+
+	CIPerfReporter m_Reporter;
+
+	volatile boolean m_bFinished;
+	unsigned m_nThroughput;
+};
+
+#endif
@@ -0,0 +1,78 @@
+//
+// iperfdaemon.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_iperfdaemon_h
+#define _circle_net_iperfdaemon_h
+
+#include <circle/sched/task.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/net/iperf.h>
+#include <circle/net/iperfreporter.h>
+#include <circle/net/ipaddress.h>
+#include <circle/net/in.h>
+#include <circle/net/socket.h>
+#include <circle/types.h>
+
+/// \note This server accepts tests from the iperf 2 client ("iperf -c host [-u]").\n
+///	  The TCP server handles one stream at a time (no -P option). The UDP server\n
+///	  sends a server report with loss and jitter to the client at the end of a test\n
+///	  (iperf 2.0.10 or later). The reports are written to the logger.
+
+class CIPerfDaemon : public CTask	/// iperf 2 compatible TCP or UDP server
+{
+public:
+	/// \param pNetSubSystem Pointer to the network subsystem
+	/// \param nProtocol IPPROTO_TCP or IPPROTO_UDP
+	/// \param usPort Port number to listen on
+	/// \param nInterval Seconds between interval reports
+	CIPerfDaemon (CNetSubSystem *pNetSubSystem, int nProtocol = IPPROTO_TCP,
+		      u16 usPort = IPERF_PORT, unsigned nInterval = IPERF_INTERVAL);
+	~CIPerfDaemon (void);
+
+	void Run (void);
+
+private:
+	void TCPServer (void);
+	void UDPServer (void);
+
+	void UDPDatagramReceived (const TIPerfUDPHeader *pHeader, unsigned nLength);
+	void UDPFinish (void);
+
+private:
+	CNetSubSystem *m_pNetSubSystem;
+	int m_nProtocol;
+	u16 m_usPort;
+
+	CSocket *m_pSocket;
+	u8 *m_pBuffer;
+
+	CIPerfReporter m_Reporter;
+
+	// UDP test state
+	boolean m_bUDPActive;
+	s32 m_nExpectedID;
+	unsigned m_nLost;
+	unsigned m_nOutOfOrder;
+	unsigned m_nDatagrams;
+	s32 m_nLastTransit;			// microseconds
+	unsigned m_nJitter16;			// microseconds * 16
+	TIPerfServerReport m_Report;		// sent on each final datagram
+};
+
+#endif
@@ -0,0 +1,73 @@
+//
+// iperfreporter.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_iperfreporter_h
+#define _circle_net_iperfreporter_h
+
+#include <circle/net/iperf.h>
+#include <circle/sched/scheduler.h>
+#include <circle/types.h>
+
+class CIPerfReporter		/// Interval and summary reports of an iperf test to the logger
+{
+public:
+	/// \param pSource Source name of the log messages
+	/// \param nInterval Seconds between interval reports
+	CIPerfReporter (const char *pSource, unsigned nInterval = IPERF_INTERVAL);
+	~CIPerfReporter (void);
+
+	/// \brief Start a new test
+	void Start (void);
+
+	/// \brief Account transferred data, writes an interval report, if an interval has elapsed
+	/// \param nBytes Number of bytes transferred since the last call
+	/// \param nRetransmissions Total number of retransmitted segments since Start()
+	void Add (unsigned nBytes, unsigned nRetransmissions = 0);
+
+	/// \brief Write the summary report of the whole test
+	/// \param pExtra Additional information to be appended (e.g. UDP loss, 0 for none)
+	void Finish (const char *pExtra = 0);
+
+	/// \return Duration of the test in microseconds until now or until Finish()
+	unsigned GetDuration (void) const;
+	/// \return Number of bytes transferred until now
+	u64 GetBytes (void) const;
+
+private:
+	void Report (unsigned nFrom, unsigned nTo, u64 nBytes, unsigned nRetransmissions,
+		     const u64 *pIdleTime, const char *pExtra);
+
+private:
+	const char *m_pSource;
+	unsigned m_nInterval;			// microseconds
+
+	unsigned m_nStartTicks;
+	unsigned m_nEndTicks;
+	u64 m_nTotalBytes;
+	unsigned m_nRetransmissions;		// total
+
+	unsigned m_nIntervalStart;		// ticks
+	u64 m_nIntervalBytes;
+	unsigned m_nIntervalRetransmissions;	// total at start of interval
+
+	u64 m_IdleTimeStart[SCHED_CORES];	// at start of test
+	u64 m_IdleTimeInterval[SCHED_CORES];	// at start of interval
+};
+
+#endif
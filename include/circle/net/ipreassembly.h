@@ -0,0 +1,72 @@
+//
+// ipreassembly.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_ipreassembly_h
+#define _circle_net_ipreassembly_h
+
+#include <circle/net/ipaddress.h>
+#include <circle/netbuffer.h>
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+
+#define IP_REASSEMBLY_MAX_BLOCKS	((FRAME_BUFFER_SIZE + 7) / 8)	// of 8 bytes
+
+// Reassembles IP datagrams from fragments (RFC 791). Each datagram has to fit into one
+// net buffer. At most IP_REASSEMBLY_MAX_DATAGRAMS datagrams are reassembled at the same
+// time, so that the used memory is bounded. Overlapping fragments are not accepted.
+
+class CIPReassembly
+{
+public:
+	CIPReassembly (void);
+	~CIPReassembly (void);
+
+	// takes over the reference of the fragment (without IP header, with TNetworkPrivateData)
+	// returns the reassembled datagram in the same format or 0, if it is not complete yet
+	CNetBuffer *AddFragment (CNetBuffer *pFragment);
+
+	// drops datagrams, which could not be reassembled in time
+	void Process (void);
+
+private:
+	struct TDatagram;
+
+	TDatagram *Lookup (const void *pPrivateData);
+	TDatagram *Allocate (const void *pPrivateData);
+	void Drop (TDatagram *pDatagram);
+
+private:
+	struct TDatagram
+	{
+		CNetBuffer	*pBuffer;		// 0 if unused
+		u8		 nProtocol;
+		u8		 SourceAddress[IP_ADDRESS_SIZE];
+		u8		 DestinationAddress[IP_ADDRESS_SIZE];
+		u16		 nIdentification;
+		unsigned	 nTotalLength;		// 0 until the last fragment arrived
+		unsigned	 nMaxEnd;		// end of highest received fragment
+		unsigned	 nBlocksReceived;
+		unsigned	 nStartTicks;
+		u32		 BlockMap[(IP_REASSEMBLY_MAX_BLOCKS + 31) / 32];
+	};
+
+	TDatagram m_Datagram[IP_REASSEMBLY_MAX_DATAGRAMS];
+};
+
+#endif
@@ -2,7 +2,7 @@
 // linklayer.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -25,7 +25,7 @@
 #include <circle/net/arphandler.h>
 #include <circle/net/ipaddress.h>
 #include <circle/macaddress.h>
-#include <circle/net/netqueue.h>
+#include <circle/net/netframequeue.h>
 #include <circle/macros.h>
 #include <circle/types.h>
 
@@ -54,10 +54,23 @@ public:
 
 	void Process (void);
 
-	boolean Send (const CIPAddress &rReceiver, const void *pIPPacket, unsigned nLength);
+	// takes over the reference of the caller, the Ethernet header is prepended in place
+	boolean Send (const CIPAddress &rReceiver, CNetBuffer *pIPPacket);
 
-	// pBuffer must have size FRAME_BUFFER_SIZE
-	boolean Receive (void *pBuffer, unsigned *pResultLength);
+	// returns IP packet or 0, the caller has to release the buffer
+	CNetBuffer *Receive (void);
+
+	// set the IPv4 multicast groups, which have to be received
+	void SetMulticastGroups (const CIPAddress *pGroups, unsigned nCount);
+
+	// returns the NET_OFFLOAD_* flags supported by the net device
+	unsigned GetOffloadCapabilities (void) const;
+
+	// access the ARP cache (e.g. to save and restore the entry of the gateway)
+	void AddARPEntry (const CIPAddress &rIPAddress, const CMACAddress &rMACAddress);
+	boolean LookupARPEntry (const CIPAddress &rIPAddress, CMACAddress *pMACAddress);
+	// remove all valid entries from the ARP cache
+	void FlushARPCache (void);
 
 public:
 	boolean SendRaw (const void *pFrame, unsigned nLength);
@@ -79,10 +92,10 @@ private:
 	CNetworkLayer *m_pNetworkLayer;
 	CARPHandler *m_pARPHandler;
 
-	CNetQueue m_ARPRxQueue;
-	CNetQueue m_IPRxQueue;
+	CNetFrameQueue m_ARPRxQueue;
+	CNetFrameQueue m_IPRxQueue;
 
-	CNetQueue m_RawRxQueue;
+	CNetFrameQueue m_RawRxQueue;
 	u16 m_nRawProtocolType;
 };
 
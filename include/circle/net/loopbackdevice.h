@@ -0,0 +1,62 @@
+//
+// loopbackdevice.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_loopbackdevice_h
+#define _circle_net_loopbackdevice_h
+
+#include <circle/netdevice.h>
+#include <circle/net/netframequeue.h>
+#include <circle/macaddress.h>
+#include <circle/types.h>
+
+// Net device, which returns all sent frames as received. It allows to use the TCP/IP stack
+// without a physical net device (e.g. for local services and benchmarks). Construct it before
+// the CNetSubSystem, which has to be used with NetDeviceTypeLoopback and a static IP address
+// then (e.g. 127.0.0.1). Packets to 127.0.0.0/8 and to the own address are delivered by the
+// network layer directly, so that only broadcasts and multicasts pass this device.
+
+class CLoopbackDevice : public CNetDevice
+{
+public:
+	CLoopbackDevice (void);
+	~CLoopbackDevice (void);
+
+	TNetDeviceType GetType (void)		{ return NetDeviceTypeLoopback; }
+
+	const CMACAddress *GetMACAddress (void) const;
+
+	boolean SendFrame (const void *pBuffer, unsigned nLength);
+
+	// pBuffer must have size FRAME_BUFFER_SIZE
+	boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength);
+
+	boolean SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount)
+						{ return TRUE; }
+
+	boolean SetMTU (unsigned nMTU)		{ return nMTU <= NET_MTU_MAX; }
+
+	TNetDeviceSpeed GetLinkSpeed (void)	{ return NetDeviceSpeed1000Full; }
+
+private:
+	CMACAddress m_MACAddress;
+
+	CNetFrameQueueMP m_Queue;
+};
+
+#endif
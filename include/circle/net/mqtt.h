@@ -2,7 +2,7 @@
 // mqtt.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -65,9 +65,14 @@ enum TMQTTPacketType
 	MQTTPacketTypeUnknown
 };
 
+#define MQTT_MAX_REMAINING_LENGTH	268435455
+
 #define MQTT_SEND_TRIES		5
 
 #define MQTT_RESEND_TIMEOUT	(5*HZ)
 #define MQTT_PING_TIMEOUT	(5*HZ)
 
+#define MQTT_MAX_IN_FLIGHT	16	// default number of unacknowledged QoS 1/2 PUBLISH packets
+#define MQTT_MAX_BATCH		16	// maximum number of PUBLISH packets sent together
+
 #endif
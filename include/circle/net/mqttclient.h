@@ -5,7 +5,7 @@
 //	https://github.com/marvinroger/async-mqtt-client
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -29,7 +29,10 @@
 #include <circle/net/mqttreceivepacket.h>
 #include <circle/net/netsubsystem.h>
 #include <circle/net/socket.h>
+#include <circle/net/netconnection.h>
 #include <circle/ptrlist.h>
+#include <circle/hashmap.h>
+#include <circle/arena.h>
 #include <circle/string.h>
 #include <circle/timer.h>
 #include <circle/types.h>
@@ -132,8 +135,42 @@ public:
 	/// \param nPayloadLength Length of the message payload (default 0)
 	/// \param uchQoS         QoS value for sending the PUBLISH message (default QoS 1)
 	/// \param bRetain        Retain parameter for the message (default FALSE)
-	void Publish (const char *pTopic, const u8 *pPayload = 0, size_t nPayloadLength = 0,
-		      u8 uchQoS = MQTT_QOS1, boolean bRetain = FALSE);
+	/// \return Operation successful? (FALSE if not connected or the publish window is full)
+	boolean Publish (const char *pTopic, const u8 *pPayload = 0, size_t nPayloadLength = 0,
+			 u8 uchQoS = MQTT_QOS1, boolean bRetain = FALSE);
+
+	/// \brief Publish MQTT topic without copying the payload
+	/// \param pTopic         Topic string of the published message
+	/// \param pPayload       Pointer to the message payload, must not be modified\n
+	///			  until pHandler is called
+	/// \param nPayloadLength Length of the message payload (may exceed nMaxPacketSize)
+	/// \param pHandler       Called once, when the payload is not needed any more\n
+	///			  (after send with QoS 0, on PUBACK/PUBREC with QoS 1/2, on error)
+	/// \param pParam         User parameter handed over to pHandler
+	/// \param uchQoS         QoS value for sending the PUBLISH message (default QoS 1)
+	/// \param bRetain        Retain parameter for the message (default FALSE)
+	/// \return Operation successful? (FALSE if not connected or the publish window is full)
+	boolean PublishZeroCopy (const char *pTopic, const u8 *pPayload, size_t nPayloadLength,
+				 TNetSendCompletionHandler *pHandler, void *pParam = 0,
+				 u8 uchQoS = MQTT_QOS1, boolean bRetain = FALSE);
+
+	/// \brief Set the maximum number of QoS 1/2 PUBLISH messages, which are not completely\n
+	/// acknowledged by the broker (default MQTT_MAX_IN_FLIGHT)
+	/// \param nMaxInFlight Size of the publish window (>= 1)
+	void SetPublishWindow (unsigned nMaxInFlight);
+
+	/// \brief Collect up to nMaxBatch PUBLISH packets and send them with one TCP send
+	/// \param nMaxBatch Maximum number of packets sent together (1 to disable, <= MQTT_MAX_BATCH)
+	/// \note Collected packets are sent, when the batch is full, when FlushPublish() is called,\n
+	///	  before any other packet is sent and regularly from the MQTT client task.
+	void SetPublishBatching (unsigned nMaxBatch);
+
+	/// \brief Send the collected PUBLISH packets immediately
+	/// \return Operation successful?
+	boolean FlushPublish (void);
+
+	/// \return TRUE if a message with QoS 1/2 can be published now (publish window not full)
+	boolean CanPublish (void) const;
 
 
 	/// \brief Callback entered when the connection to the MQTT broker has been established
@@ -166,6 +203,11 @@ private:
 	void CloseConnection (TMQTTDisconnectReason Reason);
 
 	boolean SendPacket (CMQTTSendPacket *pPacket);
+	void PacketSent (TMQTTPacketType Type);		// keep alive handling
+
+	CMQTTSendPacket *CreatePublishPacket (const char *pTopic, u8 uchQoS, boolean bRetain);
+	boolean PublishPacket (CMQTTSendPacket *pPacket);
+	void CleanupBatch (void);
 
 	// retransmission queue (for sender)
 	void InsertPacketIntoQueue (CMQTTSendPacket *pPacket, unsigned nScheduledTime);
@@ -197,10 +239,18 @@ private:
 
 	u16 m_usNextPacketIdentifier;
 
+	unsigned m_nMaxInFlight;
+	unsigned m_nInFlight;			// QoS 1/2 PUBLISH packets not completed
+
+	unsigned m_nMaxBatch;
+	unsigned m_nBatchCount;
+	CMQTTSendPacket *m_pBatch[MQTT_MAX_BATCH];
+
+	CArena m_Arena;				// buffers for the lifetime of the client
 	CMQTTReceivePacket m_ReceivePacket;
 
 	CPtrList m_RetransmissionQueue;		// sorted according to time
-	CPtrList m_PacketIdentifierStore;	// for QoS 2 receiving PUBLISH
+	CHashMap<u16, boolean> m_PacketIdentifierStore;	// for QoS 2 receiving PUBLISH
 
 	static const char *s_pErrorMsg[MQTTDisconnectUnknown+1];
 };
@@ -2,7 +2,7 @@
 // mqttreceivepacket.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,6 +22,7 @@
 
 #include <circle/net/mqtt.h>
 #include <circle/net/socket.h>
+#include <circle/arena.h>
 #include <circle/types.h>
 
 enum TMQTTReceiveStatus
@@ -37,7 +38,8 @@ enum TMQTTReceiveStatus
 class CMQTTReceivePacket	/// MQTT helper class
 {
 public:
-	CMQTTReceivePacket (size_t nMaxPacketSize, size_t nMaxPacketsQueued);
+	/// \param pArena Take the buffer from this arena (0 to use the heap)
+	CMQTTReceivePacket (size_t nMaxPacketSize, size_t nMaxPacketsQueued, CArena *pArena = 0);
 	~CMQTTReceivePacket (void);
 
 	void Reset (void);
@@ -58,6 +60,7 @@ private:
 	size_t m_nBufferSize;
 
 	u8 *m_pBuffer;
+	boolean m_bFromArena;
 	unsigned m_nInPtr;
 	unsigned m_nOutPtr;
 
@@ -2,7 +2,7 @@
 // mqttsendpacket.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,6 +22,7 @@
 
 #include <circle/net/mqtt.h>
 #include <circle/net/socket.h>
+#include <circle/net/netconnection.h>
 #include <circle/types.h>
 
 class CMQTTSendPacket		/// MQTT helper class
@@ -37,8 +38,17 @@ public:
 	void AppendString (const char *pString);
 	void AppendData (const u8 *pBuffer, size_t nLength);
 
+	// pBuffer is referenced (not copied) and sent after the appended data,
+	// pHandler is called from the destructor, when the buffer is not needed any more
+	void SetPayloadReference (const u8 *pBuffer, size_t nLength,
+				  TNetSendCompletionHandler *pHandler, void *pParam);
+
 	boolean Send (CSocket *pSocket);
 
+	// encode the fixed header and return the packet as gather list (up to 2 entries),
+	// returns 0 on error or if the send tries are exhausted
+	unsigned Prepare (TNetIOVector *pIOVector);
+
 	TMQTTPacketType GetType (void) const;
 	u8 GetFlags (void) const;
 
@@ -64,6 +74,11 @@ private:
 
 	u8 m_uchFlags;
 
+	const u8 *m_pPayload;			// referenced payload (or 0)
+	size_t m_nPayloadLength;
+	TNetSendCompletionHandler *m_pCompletionHandler;
+	void *m_pCompletionParam;
+
 	unsigned m_nSendTries;
 
 	// for packet retransmission queue
@@ -0,0 +1,102 @@
+//
+// netcapture.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_netcapture_h
+#define _circle_net_netcapture_h
+
+#include <circle/sched/task.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/lockfreering.h>
+#include <circle/netbuffer.h>
+#include <circle/netdevice.h>
+#include <circle/device.h>
+#include <circle/types.h>
+
+#ifndef NET_CAPTURE_RING_SIZE
+#define NET_CAPTURE_RING_SIZE		64		// frames, must be a power of 2
+#endif
+
+#define NET_CAPTURE_SNAPLEN_DEFAULT	128		// bytes per frame
+#define NET_CAPTURE_SNAPLEN_MAX		FRAME_BUFFER_SIZE
+
+#define NET_CAPTURE_BATCH_SIZE		4096		// bytes written to the target at once
+#define NET_CAPTURE_POLL_MS		10
+
+struct TNetCaptureRecord		// in the capture ring
+{
+	u64	nTimestamp;			// clock ticks (us)
+	u16	nFrameLength;
+	u16	nCaptureLength;
+	boolean	bTransmit;
+	u8	Frame[NET_CAPTURE_SNAPLEN_MAX];
+};
+
+// returns TRUE, if the frame has to be captured (called from the net task)
+typedef boolean TNetCaptureFilter (const void *pFrame, unsigned nLength, boolean bTransmit,
+				   void *pParam);
+
+// Copies the frames sent and received by CNetDeviceLayer (up to the snap length) into a
+// lock-free ring and streams them in pcapng format to a target device (e.g. a serial
+// interface or the USB serial gadget, which is not used by the TCP/IP stack itself). Frames
+// are dropped, if the ring is full. TX frames with checksum offload hold the sum over the
+// pseudo header in the TCP/UDP checksum field only.
+
+class CNetCapture : public CTask
+{
+public:
+	CNetCapture (CNetSubSystem *pNetSubSystem, CDevice *pTarget,
+		     unsigned nSnapLength = NET_CAPTURE_SNAPLEN_DEFAULT);
+	~CNetCapture (void);
+
+	// frames are captured, if the filter returns TRUE (all frames without filter)
+	void SetFilter (TNetCaptureFilter *pFilter, void *pParam = 0);
+
+	void Run (void);
+
+	// called by CNetDeviceLayer from the net task
+	void Capture (CNetBuffer *pBuffer, boolean bTransmit);
+
+	// returns the number of frames, which have been dropped
+	unsigned GetDropped (void) const;
+
+private:
+	void WriteHeader (void);
+	void WriteFrame (const TNetCaptureRecord *pRecord);
+	void Flush (void);
+
+	void Append (const void *pData, unsigned nLength);
+
+private:
+	CNetSubSystem *m_pNetSubSystem;
+	CDevice *m_pTarget;
+	unsigned m_nSnapLength;
+
+	TNetCaptureFilter *m_pFilter;
+	void *m_pFilterParam;
+
+	CSPSCRing<TNetCaptureRecord> m_Ring;
+	volatile unsigned m_nDropped;
+
+	u64 m_nTimeOffset;			// universal time minus clock ticks (us)
+
+	u8 m_Batch[NET_CAPTURE_BATCH_SIZE];
+	unsigned m_nBatchLength;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // netconfig.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,8 +21,26 @@
 #define _circle_net_netconfig_h
 
 #include <circle/net/ipaddress.h>
+#include <circle/netdevice.h>
+#include <circle/seqlock.h>
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
+struct TNetConfigSnapshot
+{
+	CIPAddress	IPAddress;
+	CIPAddress	NetMask;
+	CIPAddress	DefaultGateway;
+	CIPAddress	DNSServer;
+	CIPAddress	BroadcastAddress;
+	unsigned	nMTU;
+};
+
+// The setters can be called from any core at any time. The getters return pointers into the
+// configuration, which may change while they are used. GetSnapshot() returns a consistent copy
+// without waiting for a setter (see CSeqLock) and should be used, where the address and net
+// mask are used together.
+
 class CNetConfig
 {
 public:
@@ -43,6 +61,10 @@ public:
 	void SetDefaultGateway (const u8 *pAddress);
 	void SetDNSServer (const u8 *pAddress);
 
+	// must be called before CNetSubSystem::Initialize(), up to NET_MTU_MAX,
+	// falls back to NET_MTU_DEFAULT, if not supported by the net device
+	void SetMTU (unsigned nMTU);
+
 	boolean IsDHCPUsed (void) const;
 
 	const CIPAddress *GetIPAddress (void) const;
@@ -50,6 +72,9 @@ public:
 	const CIPAddress *GetDefaultGateway (void) const;
 	const CIPAddress *GetDNSServer (void) const;
 	const CIPAddress *GetBroadcastAddress (void) const;		// directed broadcast
+	unsigned GetMTU (void) const;
+
+	void GetSnapshot (TNetConfigSnapshot *pSnapshot) const;
 
 private:
 	void UpdateBroadcastAddress (void);
@@ -62,6 +87,11 @@ private:
 	CIPAddress m_DefaultGateway;
 	CIPAddress m_DNSServer;
 	CIPAddress m_BroadcastAddress;
+
+	unsigned m_nMTU;
+
+	CSeqLock m_SeqLock;
+	CSpinLock m_SpinLock;			// serializes the writers
 };
 
 #endif
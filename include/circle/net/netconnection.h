@@ -2,7 +2,7 @@
 // netconnection.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -25,8 +25,33 @@
 #include <circle/net/ipaddress.h>
 #include <circle/net/icmphandler.h>
 #include <circle/net/checksumcalculator.h>
+#include <circle/sched/synchronizationevent.h>
 #include <circle/types.h>
 
+class CTransportLayer;
+
+struct TNetIOVector		// element of a gather list
+{
+	const void	*pData;
+	unsigned	 nLength;
+};
+
+struct TNetMessage		// element of a list for CSocket::SendBatch()/ReceiveBatch()
+{
+	void		*pBuffer;
+	unsigned	 nLength;	// size of the buffer on receive, set to message length
+	CIPAddress	 ForeignIP;	// destination on send, source on receive
+	u16		 nForeignPort;
+};
+
+// called, when the buffer given to SendZeroCopy() is not needed any more
+typedef void TNetSendCompletionHandler (const void *pBuffer, void *pParam);
+
+// poll status, returned from GetPollStatus()
+#define NET_POLL_READ		(1 << 0)	// Receive() or Accept() does not block
+#define NET_POLL_WRITE		(1 << 1)	// Send() does not block
+#define NET_POLL_ERROR		(1 << 2)	// connection reset, refused or closed
+
 class CNetConnection
 {
 public:
@@ -43,6 +68,7 @@ public:
 	virtual ~CNetConnection (void);
 
 	const u8 *GetForeignIP (void) const;
+	u16 GetForeignPort (void) const;
 	u16 GetOwnPort (void) const;
 	int GetProtocol (void) const;
 
@@ -51,21 +77,45 @@ public:
 	virtual int Close (void) = 0;
 	
 	virtual int Send (const void *pData, unsigned nLength, int nFlags) = 0;
+	virtual int SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags) = 0;
+	// the buffer must not be modified, until pHandler has been called
+	virtual int SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+				  TNetSendCompletionHandler *pHandler, void *pParam) = 0;
 	virtual int Receive (void *pBuffer, int nFlags) = 0;
 
 	virtual int SendTo (const void *pData, unsigned nLength, int nFlags, CIPAddress	&rForeignIP, u16 nForeignPort) = 0;
 	virtual int ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeignIP, u16 *pForeignPort) = 0;
 
 	virtual int SetOptionBroadcast (boolean bAllowed) = 0;
+	virtual int SetOptionCork (boolean bCork) = 0;
+	// maximum number of received messages, which are queued (0 for unlimited)
+	virtual int SetOptionRxQueueDepth (unsigned nDepth) = 0;
+	// join (bJoin == TRUE) or leave an IPv4 multicast group
+	virtual int SetOptionMembership (const CIPAddress &rGroupIP, boolean bJoin) = 0;
 
 	virtual boolean IsConnected (void) const = 0;
 	virtual boolean IsTerminated (void) const = 0;
+
+	// returns NET_POLL_* flags
+	virtual unsigned GetPollStatus (void) const = 0;
+	// returns the number of retransmitted segments (0 on UDP)
+	virtual unsigned GetRetransmissions (void) const = 0;
+	// pEvent is set, when the poll status may have changed (0 to unregister)
+	void SetPollEvent (CSynchronizationEvent *pEvent);
+
+	// returns TRUE, if packets from any foreign IP address and port may be accepted
+	virtual boolean HasWildcardForeign (void) const = 0;
 	
+	// called after Activate() and after packets or notifications have been consumed
 	virtual void Process (void) = 0;
+	// returns TRUE, if Process() has to be called again, without a new event
+	virtual boolean IsProcessPending (void) const = 0;
 
 	// returns: -1: invalid packet, 0: not to me, 1: packet consumed
+	// bChecksumOK is TRUE, if the checksum has been verified by the net device already
 	virtual int PacketReceived (const void *pPacket, unsigned nLength,
-				    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol) = 0;
+				    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+				    boolean bChecksumOK) = 0;
 
 	// returns: 0: not to me, 1: notification consumed
 	virtual int NotificationReceived (TICMPNotificationType Type,
@@ -73,6 +123,10 @@ public:
 					  u16 nSendPort, u16 nReceivePort,
 					  int nProtocol) = 0;
 
+protected:
+	// request a call of Process() from the transport layer, may be called from IRQ context
+	void Activate (void);
+
 protected:
 	CNetConfig    *m_pNetConfig;
 	CNetworkLayer *m_pNetworkLayer;
@@ -83,6 +137,25 @@ protected:
 	int m_nProtocol;
 
 	CChecksumCalculator m_Checksum;
+
+private:
+	friend class CTransportLayer;
+
+	// managed by CTransportLayer
+	CTransportLayer *m_pTransportLayer;
+	int		 m_hConnection;
+
+	unsigned	 m_nHashBucket;
+	CNetConnection	*m_pHashNext;
+	CNetConnection	*m_pHashPrev;
+
+	boolean		 m_bActive;		// on active list
+	CNetConnection	*m_pActiveNext;
+	CNetConnection	*m_pActivePrev;
+
+	// called from CTransportLayer after Process() and before the connection is deleted
+	void NotifyPoll (void);
+	CSynchronizationEvent * volatile m_pPollEvent;
 };
 
 #endif
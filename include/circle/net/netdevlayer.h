@@ -2,7 +2,7 @@
 // netdevlayer.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,10 +22,13 @@
 
 #include <circle/net/netconfig.h>
 #include <circle/netdevice.h>
-#include <circle/net/netqueue.h>
+#include <circle/netbuffer.h>
+#include <circle/net/netframequeue.h>
 #include <circle/bcm54213.h>
 #include <circle/types.h>
 
+class CNetCapture;
+
 class CNetDeviceLayer
 {
 public:
@@ -40,17 +43,49 @@ public:
 	const CMACAddress *GetMACAddress (void) const;
 
 	void Send (const void *pBuffer, unsigned nLength);
-	boolean Receive (void *pBuffer, unsigned *pResultLength);
+	// takes over the reference of the caller
+	void Send (CNetBuffer *pBuffer);
+
+	// returns 0, if nothing has been received, the caller has to release the buffer
+	CNetBuffer *Receive (void);
 
 	boolean IsRunning (void) const;			// is net device available?
 
+	// returns the NET_OFFLOAD_* flags supported by the net device (0 if not available yet)
+	unsigned GetOffloadCapabilities (void) const;
+
+	// set the multicast MAC addresses to be received, applied to the device in Process()
+	void SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount);
+	// returns TRUE, if the multicast MAC address has been set with SetMulticastFilter()
+	boolean IsMulticastAccepted (const CMACAddress &rAddress) const;
+
+	// returns TRUE once, after the PHY link has come up again (called from the net task)
+	boolean IsLinkRestored (void);
+
+	// sent and received frames are copied to the capture (0 to stop capturing)
+	void SetCapture (CNetCapture *pCapture);
+
+private:
+	friend class CPHYTask;
+	void LinkChanged (boolean bLinkUp);	// called from the PHY task
+
+	void SetMTU (void);		// applies the MTU from the net config to the device
+
 private:
 	TNetDeviceType m_DeviceType;
 	CNetConfig *m_pNetConfig;
 	CNetDevice *m_pDevice;
 
-	CNetQueue m_TxQueue;
-	CNetQueue m_RxQueue;
+	CNetFrameQueueMP m_TxQueue;
+	CNetFrameQueue m_RxQueue;
+
+	CMACAddress m_MulticastFilter[MAX_MULTICAST_ADDRESSES];
+	unsigned m_nMulticastCount;
+	boolean m_bMulticastFilterChanged;
+
+	volatile boolean m_bLinkRestored;
+
+	CNetCapture * volatile m_pCapture;
 
 #if RASPPI >= 4
 	CBcm54213Device m_Bcm54213;
@@ -0,0 +1,140 @@
+//
+// netframequeue.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_netframequeue_h
+#define _circle_net_netframequeue_h
+
+#include <circle/lockfreering.h>
+#include <circle/netbuffer.h>
+#include <circle/netdevice.h>
+#include <circle/util.h>
+#include <circle/types.h>
+#include <assert.h>
+
+#ifndef NET_FRAME_QUEUE_SIZE
+#define NET_FRAME_QUEUE_SIZE	64		// frames, must be a power of 2
+#endif
+
+// Bounded queue of net buffers between the network layers, without locking. The buffers are
+// handed over by pointer. Enqueue() drops the frame and returns FALSE, if the queue is full.
+
+template <class TRing>
+class CNetFrameQueueTemplate
+{
+public:
+	CNetFrameQueueTemplate (unsigned nSize = NET_FRAME_QUEUE_SIZE)
+	:	m_Ring (nSize)
+	{
+	}
+
+	~CNetFrameQueueTemplate (void)
+	{
+		Flush ();
+	}
+
+	boolean IsEmpty (void) const
+	{
+		return m_Ring.IsEmpty ();
+	}
+
+	void Flush (void)
+	{
+		CNetBuffer *pBuffer;
+		while (m_Ring.Read (&pBuffer))
+		{
+			pBuffer->Release ();
+		}
+	}
+
+	// takes over the reference of the caller, the buffer is released, if the queue is full
+	boolean Enqueue (CNetBuffer *pBuffer)
+	{
+		assert (pBuffer != 0);
+		assert (pBuffer->GetLength () > 0);
+
+		if (!m_Ring.Write (pBuffer))
+		{
+			pBuffer->Release ();
+
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	// returns 0 if queue is empty, the caller has to release the buffer
+	CNetBuffer *Dequeue (void)
+	{
+		CNetBuffer *pBuffer;
+		if (!m_Ring.Read (&pBuffer))
+		{
+			return 0;
+		}
+
+		return pBuffer;
+	}
+
+	// copies the data into a new buffer
+	boolean Enqueue (const void *pBuffer, unsigned nLength)
+	{
+		assert (nLength > 0);
+		assert (nLength <= FRAME_BUFFER_SIZE);
+
+		CNetBuffer *pNetBuffer = new CNetBuffer;
+		assert (pNetBuffer != 0);
+
+		assert (pBuffer != 0);
+		memcpy (pNetBuffer->GetData (), pBuffer, nLength);
+		pNetBuffer->SetLength (nLength);
+
+		return Enqueue (pNetBuffer);
+	}
+
+	// copies the data out, returns length (0 if queue is empty)
+	unsigned Dequeue (void *pBuffer)
+	{
+		CNetBuffer *pNetBuffer = Dequeue ();
+		if (pNetBuffer == 0)
+		{
+			return 0;
+		}
+
+		unsigned nResult = pNetBuffer->GetLength ();
+		assert (nResult > 0);
+		assert (nResult <= FRAME_BUFFER_SIZE);
+
+		assert (pBuffer != 0);
+		memcpy (pBuffer, pNetBuffer->GetData (), nResult);
+
+		pNetBuffer->Release ();
+
+		return nResult;
+	}
+
+private:
+	TRing m_Ring;
+};
+
+// single producer, e.g. the Process() method of a layer
+typedef CNetFrameQueueTemplate<CSPSCRing<CNetBuffer *> > CNetFrameQueue;
+
+// multiple producers, e.g. Send() called from several tasks or cores
+typedef CNetFrameQueueTemplate<CMPSCRing<CNetBuffer *> > CNetFrameQueueMP;
+
+#endif
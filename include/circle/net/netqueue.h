@@ -32,6 +32,9 @@ public:
 	~CNetQueue (void);
 
 	boolean IsEmpty (void) const;
+
+	// returns the number of queued entries
+	unsigned GetCount (void) const;
 	
 	void Flush (void);
 	
@@ -43,6 +46,7 @@ public:
 private:
 	volatile TNetQueueEntry *m_pFirst;
 	volatile TNetQueueEntry *m_pLast;
+	volatile unsigned m_nCount;
 
 	CSpinLock m_SpinLock;
 };
@@ -0,0 +1,142 @@
+//
+/// \file netstatistics.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_netstatistics_h
+#define _circle_net_netstatistics_h
+
+#include <circle/histogram.h>
+#include <circle/string.h>
+#include <circle/types.h>
+
+enum TNetCounter
+{
+	// net device layer
+	NetCounterDevRxFrames,
+	NetCounterDevRxBytes,
+	NetCounterDevRxQueueFull,		// frame dropped, RX queue was full
+	NetCounterDevTxFrames,
+	NetCounterDevTxBytes,
+	NetCounterDevTxQueueFull,		// frame dropped, TX queue was full
+	NetCounterDevTxDropped,			// frame not taken by the driver
+
+	// link layer
+	NetCounterLinkRxNotForUs,
+	NetCounterLinkRxUnknownProtocol,
+	NetCounterLinkRxQueueFull,
+	NetCounterARPMisses,			// no valid ARP entry on send
+	NetCounterARPPendingDropped,		// too many frames wait for ARP reply
+	NetCounterARPResolveFailed,		// frame dropped, no ARP reply
+
+	// network layer
+	NetCounterIPRxPackets,
+	NetCounterIPRxBytes,
+	NetCounterIPRxHeaderErrors,		// including checksum failures
+	NetCounterIPRxNotForUs,
+	NetCounterIPRxFragments,
+	NetCounterIPRxReassembled,		// datagrams reassembled from fragments
+	NetCounterIPRxReassemblyFailed,		// timeout, too big or no free slot
+	NetCounterIPRxQueueFull,
+	NetCounterIPTxPackets,
+	NetCounterIPTxBytes,
+	NetCounterIPTxNoRoute,
+	NetCounterIPTxFragments,
+	NetCounterIPTxLoopback,			// delivered locally, without net device
+
+	// transport layer
+	NetCounterUDPRxDatagrams,
+	NetCounterUDPRxChecksumErrors,
+	NetCounterUDPRxQueueFull,		// datagram dropped, socket RX queue was full
+	NetCounterUDPTxDatagrams,
+	NetCounterTCPRxSegments,
+	NetCounterTCPRxChecksumErrors,
+	NetCounterTCPRxOutOfOrder,
+	NetCounterTCPTxSegments,
+	NetCounterTCPRetransmissions,
+	NetCounterTCPRTTSamples,
+	NetCounterTransportRxUnhandled,		// no connection found
+
+	NetCounterUnknown
+};
+
+/// \note The counters are incremented without locking from all layers of the TCP/IP stack.\n
+///	  They can be read from any task or core at any time.
+/// \note There is only one net device per CNetSubSystem, so the net device layer counters\n
+///	  are the per-interface statistics.
+
+class CNetStatistics	/// Counters of the TCP/IP network stack
+{
+public:
+	CNetStatistics (void);
+	~CNetStatistics (void);
+
+	/// \brief Increment a counter
+	/// \param Counter Counter to be incremented
+	/// \param nValue Value to be added
+	void Inc (TNetCounter Counter, unsigned nValue = 1)
+	{
+		__atomic_fetch_add (&m_nCounter[Counter], nValue, __ATOMIC_RELAXED);
+	}
+
+	/// \param Counter Counter to be read
+	/// \return Current value of this counter
+	u64 Get (TNetCounter Counter) const
+	{
+		return __atomic_load_n (&m_nCounter[Counter], __ATOMIC_RELAXED);
+	}
+
+	/// \param nMillis Measured TCP round trip time in milliseconds
+	void AddRTTSample (unsigned nMillis);
+	/// \return Histogram of the TCP round trip times in milliseconds
+	const CHistogram<> *GetRTTHistogram (void) const;
+
+	/// \brief Clear all counters and the RTT histogram
+	/// \note Should be called only, while the network is idle
+	void Reset (void);
+
+	/// \param Counter Counter, which name is requested
+	/// \return Name of this counter (e.g. "dev_rx_frames")
+	static const char *GetName (TNetCounter Counter);
+
+	/// \brief Write all counters to the logger
+	void Dump (void) const;
+
+	/// \brief Format all counters as text, one "name value" pair per line
+	/// \param pPrefix Prefix for each name (e.g. "circle_net_")
+	void Format (CString *pString, const char *pPrefix = "") const;
+
+	/// \return Pointer to the statistics of the CNetSubSystem instance (0 if not created)
+	static CNetStatistics *Get (void)
+	{
+		return s_pThis;
+	}
+
+private:
+	u64 m_nCounter[NetCounterUnknown];
+
+	CHistogram<> m_RTTHistogram;
+
+	static CNetStatistics *s_pThis;
+};
+
+// increment a net counter from the TCP/IP stack
+#define NET_STAT_INC(counter, ...)	do { CNetStatistics *pStat_ = CNetStatistics::Get ();	\
+					     if (pStat_ != 0)					\
+						pStat_->Inc (counter, ##__VA_ARGS__); } while (0)
+
+#endif
@@ -2,7 +2,7 @@
 // netsubsystem.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,15 +21,30 @@
 #define _circle_net_netsubsystem_h
 
 #include <circle/net/netconfig.h>
+#include <circle/net/netstatistics.h>
 #include <circle/net/netdevlayer.h>
 #include <circle/net/linklayer.h>
 #include <circle/net/networklayer.h>
 #include <circle/net/transportlayer.h>
+#include <circle/macaddress.h>
 #include <circle/string.h>
 #include <circle/types.h>
 
 #define DEFAULT_HOSTNAME	"raspberrypi"
 
+struct TDHCPLease		// all addresses in network byte order
+{
+	u32	nMagic;
+#define DHCP_LEASE_MAGIC	0x4C504844
+	u32	nIPAddress;
+	u32	nNetMask;
+	u32	nDefaultGateway;
+	u32	nDNSServer;
+	u32	nServerIdentifier;
+	u32	nLeaseTime;		// seconds
+	u8	GatewayMAC[MAC_ADDRESS_SIZE];	// all 0, if not known
+};
+
 class CDHCPClient;
 
 class CNetSubSystem
@@ -51,14 +66,24 @@ public:
 	CNetDeviceLayer *GetNetDeviceLayer (void);
 	CLinkLayer *GetLinkLayer (void);
 	CTransportLayer *GetTransportLayer (void);
+	CRoutingTable *GetRoutingTable (void);
+	CNetStatistics *GetStatistics (void);
 
 	boolean IsRunning (void) const;			// is DHCP bound if used?
 
+	// a lease from a previous boot (e.g. saved to a file) can be set before Initialize(),
+	// the network is up immediately then, while the lease is confirmed in the background
+	// (INIT-REBOOT state, RFC 2131 section 3.2)
+	void SetDHCPLease (const TDHCPLease &rLease);
+	// returns FALSE, if DHCP is not used or the client is not bound
+	boolean GetDHCPLease (TDHCPLease *pLease) const;
+
 	static CNetSubSystem *Get (void);
 
 private:
 	CString		m_Hostname;
 
+	CNetStatistics	m_Statistics;
 	CNetConfig	m_Config;
 	CNetDeviceLayer	m_NetDevLayer;
 	CLinkLayer	m_LinkLayer;
@@ -67,6 +92,7 @@ private:
 
 	boolean		m_bUseDHCP;
 	CDHCPClient    *m_pDHCPClient;
+	TDHCPLease	m_DHCPLease;		// from previous boot (nMagic == 0, if not set)
 
 	static CNetSubSystem *s_pThis;
 };
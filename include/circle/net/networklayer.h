@@ -2,7 +2,7 @@
 // networklayer.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,10 +22,12 @@
 
 #include <circle/net/netconfig.h>
 #include <circle/net/linklayer.h>
-#include <circle/net/netqueue.h>
+#include <circle/net/netframequeue.h>
 #include <circle/net/ipaddress.h>
 #include <circle/net/icmphandler.h>
-#include <circle/net/routecache.h>
+#include <circle/net/igmphandler.h>
+#include <circle/net/ipreassembly.h>
+#include <circle/net/routingtable.h>
 #include <circle/macros.h>
 #include <circle/types.h>
 
@@ -41,12 +43,13 @@ struct TIPHeader
 	u16	nIdentification;
 #define IP_IDENTIFICATION_DEFAULT	0
 	u16	nFlagsFragmentOffset;
-#define IP_FRAGMENT_OFFSET(field)	((field) & 0x1F00)
+#define IP_FRAGMENT_OFFSET(field)	((field) & 0x1FFF)	// after be2le16(), in 8 bytes
 	#define IP_FRAGMENT_OFFSET_FIRST	0
 #define IP_FLAGS_DF			(1 << 6)	// valid without BE()
 #define IP_FLAGS_MF			(1 << 5)
 	u8	nTTL;
 #define IP_TTL_DEFAULT			64
+#define IP_TTL_MULTICAST		1	// do not leave the local network
 	u8	nProtocol;				// see: in.h
 	u16	nHeaderChecksum;
 	u8	SourceAddress[IP_ADDRESS_SIZE];
@@ -56,13 +59,27 @@ struct TIPHeader
 }
 PACKED;
 
-struct TNetworkPrivateData
+// Router Alert option (RFC 2113), is added to IGMP packets
+#define IP_OPTION_ROUTER_ALERT		0x94
+#define IP_OPTION_ROUTER_ALERT_SIZE	4
+
+struct TNetworkPrivateData		// in the private data of a received net buffer
 {
 	u8	nProtocol;
 	u8	SourceAddress[IP_ADDRESS_SIZE];
 	u8	DestinationAddress[IP_ADDRESS_SIZE];
+	u8	bMoreFragments;			// for reassembly
+	u16	nIdentification;
+	u16	nFragmentOffset;		// in bytes
 };
 
+// headroom of a net buffer for a transport layer packet, the resulting frame is cache-aligned
+#define IP_PACKET_HEADROOM	(NET_BUFFER_HEADROOM + sizeof (TEthernetHeader) + sizeof (TIPHeader))
+
+// maximum length of a transport layer packet, which fits into a net buffer,
+// it is sent in fragments, if it is longer than allowed by the MTU
+#define IP_PAYLOAD_MAX_LENGTH	(FRAME_BUFFER_SIZE - sizeof (TEthernetHeader) - sizeof (TIPHeader))
+
 class CNetworkLayer
 {
 public:
@@ -74,19 +91,50 @@ public:
 	void Process (void);
 
 	boolean Send (const CIPAddress &rReceiver, const void *pPacket, unsigned nLength, int nProtocol);
+	// takes over the reference of the caller, the IP header is prepended in place
+	// (allocate the buffer with IP_PACKET_HEADROOM), packets to 127.0.0.0/8 and to
+	// our own address are delivered locally, without passing the link layer
+	boolean Send (const CIPAddress &rReceiver, CNetBuffer *pPacket, int nProtocol);
 
-	// pBuffer must have size FRAME_BUFFER_SIZE
-	boolean Receive (void *pBuffer, unsigned *pResultLength,
-			 CIPAddress *pSender, CIPAddress *pReceiver, int *pProtocol);
+	// returns the packet without IP header or 0, the caller has to release the buffer
+	CNetBuffer *Receive (CIPAddress *pSender, CIPAddress *pReceiver, int *pProtocol);
 
 	boolean ReceiveNotification (TICMPNotificationType *pType,
 				     CIPAddress *pSender, CIPAddress *pReceiver,
 				     u16 *pSendPort, u16 *pReceivePort,
 				     int *pProtocol);
 
+	// join or leave an IPv4 multicast group (reference counted)
+	boolean JoinGroup (const CIPAddress &rGroupIP);
+	void LeaveGroup (const CIPAddress &rGroupIP);
+
+	// static routes can be added here, the connected network and the default gateway
+	// are taken from the net config
+	CRoutingTable *GetRoutingTable (void);
+
+	// returns the NET_OFFLOAD_* flags supported by the net device
+	unsigned GetOffloadCapabilities (void) const;
+
 private:
-	void AddRoute (const u8 *pDestIP, const u8 *pGatewayIP);
-	const u8 *GetGateway (const u8 *pDestIP) const;
+	boolean CheckPacket (CNetBuffer *pBuffer, const CIPAddress *pOwnIPAddress);
+
+	// hands a received packet (without IP header) over to the upper layer
+	void DeliverPacket (CNetBuffer *pBuffer);
+
+	// queues a packet (with IP header) for local delivery
+	boolean SendLoopback (CNetBuffer *pPacket, unsigned nHeaderLength);
+
+	// sends the packet (with IP header) in fragments, which fit into the MTU
+	boolean SendFragmented (const CIPAddress &rNextHop, CNetBuffer *pPacket, unsigned nMTU);
+	// calculates a checksum in software, which has been left to the net device
+	static void CalculateOffloadedChecksum (CNetBuffer *pPacket, int nProtocol);
+
+	// returns FALSE, if the destination is not reachable
+	boolean GetNextHop (const CIPAddress &rDestIP, CIPAddress *pNextHop);
+
+	void AddRoute (const u8 *pDestIP, const u8 *pGatewayIP);	// host route from redirect
+
+	static unsigned GetPrefixLength (const u8 *pNetMask);
 	friend class CICMPHandler;
 
 	// post IP packet to the ICMP handler for notification
@@ -97,12 +145,18 @@ private:
 	CNetConfig   *m_pNetConfig;
 	CLinkLayer   *m_pLinkLayer;
 	CICMPHandler *m_pICMPHandler;
+	CIGMPHandler *m_pIGMPHandler;
+
+	CNetFrameQueue m_RxQueue;
+	CNetFrameQueue m_ICMPRxQueue;
+	CNetFrameQueue m_IGMPRxQueue;
+	CNetFrameQueueMP m_ICMPNotificationQueue;
+	CNetFrameQueueMP m_LoopbackQueue;
 
-	CNetQueue m_RxQueue;
-	CNetQueue m_ICMPRxQueue;
-	CNetQueue m_ICMPNotificationQueue;
+	CRoutingTable m_RoutingTable;
 
-	CRouteCache m_RouteCache;
+	CIPReassembly m_Reassembly;
+	u16 m_nIdentification;			// for fragmented packets
 };
 
 #endif
@@ -2,7 +2,7 @@
 // ntpclient.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,6 +22,7 @@
 
 #include <circle/net/netsubsystem.h>
 #include <circle/net/ipaddress.h>
+#include <circle/types.h>
 
 class CNTPClient
 {
@@ -32,6 +33,16 @@ public:
 	/// \return Seconds since 1970-01-01 00:00:00 UTC, 0 on error
 	unsigned GetTime (CIPAddress &rServerIP);
 
+	/// \brief Measure the offset of the CTimeKeeper clock to the server time
+	/// \param pOffsetNs Receives the server time minus the local time in nanoseconds
+	/// \return Operation successful?
+	/// \note Uses all four NTP timestamps, so that the network delay is compensated.
+	boolean GetOffset (CIPAddress &rServerIP, s64 *pOffsetNs);
+
+private:
+	static void SetTimestamp (u8 *pBuffer, u64 nTimeNs);
+	static u64 GetTimestamp (const u8 *pBuffer);		// returns 0 if invalid
+
 private:
 	CNetSubSystem *m_pNetSubSystem;
 };
@@ -2,7 +2,7 @@
 // phytask.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2019-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,18 +21,32 @@
 #define _circle_net_phytask_h
 
 #include <circle/sched/task.h>
+#include <circle/sched/synchronizationevent.h>
 #include <circle/netdevice.h>
+#include <circle/types.h>
+
+#define PHY_POLL_INTERVAL_MS		2000	// without link change interrupt
+#define PHY_POLL_INTERVAL_IRQ_MS	30000	// fallback with link change interrupt
+
+class CNetDeviceLayer;
 
 class CPHYTask : public CTask
 {
 public:
-	CPHYTask (CNetDevice *pDevice);
+	// link changes are reported to pNetDevLayer, if it is not 0
+	CPHYTask (CNetDevice *pDevice, CNetDeviceLayer *pNetDevLayer = 0);
 	~CPHYTask (void);
 
 	void Run (void);
 
+private:
+	static void LinkChangeHandler (void *pParam);
+
 private:
 	CNetDevice *m_pDevice;
+	CNetDeviceLayer *m_pNetDevLayer;
+
+	CSynchronizationEvent m_Event;
 };
 
 #endif
@@ -2,7 +2,7 @@
 // retransmissionqueue.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,8 +20,21 @@
 #ifndef _circle_net_retransmissionqueue_h
 #define _circle_net_retransmissionqueue_h
 
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
+#ifndef RETRANS_QUEUE_CHUNK_SIZE
+#define RETRANS_QUEUE_CHUNK_SIZE	2048
+#endif
+
+#ifndef RETRANS_QUEUE_POOL_CHUNKS
+#define RETRANS_QUEUE_POOL_CHUNKS	128		// free chunks kept for all queues
+#endif
+
+// The data is stored in chunks, which are allocated on demand from a pool shared by all
+// queues and are returned, when they have been acknowledged. A queue, which is empty, does
+// not hold any chunk. nSize is the maximum number of bytes, which can be queued.
+
 class CRetransmissionQueue
 {
 public:
@@ -31,23 +44,48 @@ public:
 	boolean IsEmpty (void) const;
 	
 	unsigned GetFreeSpace (void) const;
-	void Write (const void *pBuffer, unsigned nLength);
+	// allocates the memory for writing nLength bytes, returns FALSE if not available
+	boolean Reserve (unsigned nLength);
+	void Write (const void *pBuffer, unsigned nLength);	// Reserve() must have succeeded
 
 	unsigned GetBytesAvailable (void) const;
 	void Read (void *pBuffer, unsigned nLength);
+	void Peek (void *pBuffer, unsigned nLength) const;	// read oldest data, which is not acknowledged
+	void Skip (unsigned nBytes);		// do not send nBytes (already acknowledged selectively)
 	void Advance (unsigned nBytes);
 	void Reset (void);
 
-	void Flush (void);
+	void Flush (void);			// releases the memory too
+
+private:
+	// copies nLength bytes from or to the stream position nPosition
+	void CopyIn (unsigned nPosition, const u8 *pBuffer, unsigned nLength);
+	void CopyOut (unsigned nPosition, u8 *pBuffer, unsigned nLength) const;
+
+	u8 *GetChunk (unsigned nPosition) const;	// returns chunk, which holds nPosition
+
+	void ReleaseChunks (void);		// which have been acknowledged completely
+
+	static u8 *AllocateChunk (void);
+	static void FreeChunk (u8 *pChunk);
 
 private:
 	unsigned m_nSize;
 
-	u8 *m_pBuffer;
+	u8 **m_ppChunk;				// ring of chunk pointers
+	unsigned m_nMaxChunks;
+	unsigned m_nFirstChunk;			// index in m_ppChunk
+	unsigned m_nChunks;
+	unsigned m_nBase;			// stream position of the first chunk
 
+	// stream positions (modulo 2^32)
 	unsigned m_nInPtr;
 	unsigned m_nOutPtr;
 	unsigned m_nPreOutPtr;
+
+	static u8 *s_pFreeList;
+	static unsigned s_nFreeChunks;
+	static CSpinLock s_SpinLock;
 };
 
 #endif
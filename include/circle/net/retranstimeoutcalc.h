@@ -31,11 +31,14 @@ public:
 	~CRetransmissionTimeoutCalculator (void);
 
 	unsigned GetRTO (void) const;
+	unsigned GetSRTT (void) const;		// returns 0, if not measured yet
 
 	void Initialize (u32 nISN);
 
 	void SegmentSent (u32 nSequenceNumber, u32 nLength = 1);
 	void SegmentAcknowledged (u32 nAcknowledgmentNumber);		// called for valid ACKs only
+	// same, but with RTT measured using the TCP timestamps option (RFC 7323)
+	void SegmentAcknowledged (u32 nAcknowledgmentNumber, unsigned nRTT);
 
 	void RetransmissionTimerExpired (void);
 
@@ -0,0 +1,110 @@
+//
+// routingtable.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_routingtable_h
+#define _circle_net_routingtable_h
+
+#include <circle/net/ipaddress.h>
+#include <circle/memorymap.h>
+#include <circle/spinlock.h>
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+
+#ifndef ROUTING_TABLE_MAX_ROUTES
+#define ROUTING_TABLE_MAX_ROUTES	64
+#endif
+
+#ifndef ROUTING_CACHE_SIZE
+#define ROUTING_CACHE_SIZE		64		// destinations, must be a power of 2
+#endif
+
+#define ROUTE_METRIC_DEFAULT		0		// lower metric is preferred
+
+struct TRoute
+{
+	u8		DestIP[IP_ADDRESS_SIZE];	// network address
+	unsigned	nPrefixLength;			// 0 (default route) .. 32 (host route)
+	u8		GatewayIP[IP_ADDRESS_SIZE];	// 0.0.0.0 for a directly connected network
+	unsigned	nMetric;
+	unsigned	nInterface;			// index of the net device
+};
+
+// Static and ICMP redirect routes with longest prefix match. The routes are kept sorted
+// by prefix length (longest first) and metric, so that the first matching route wins. The
+// result of a lookup is cached per destination and the cache is invalidated on each change
+// of the table, so that a lookup on the send path normally does not scan the table.
+// The table is read without a lock (see CRCU). A change is applied to a copy of the table,
+// which replaces the current one. The lookup cache is kept per core.
+
+class CRoutingTable
+{
+public:
+	CRoutingTable (void);
+	~CRoutingTable (void);
+
+	void Flush (void);
+
+	// replaces a route with the same destination, prefix length and interface,
+	// the host part of pDestIP is ignored, returns FALSE if the table is full
+	boolean AddRoute (const u8 *pDestIP, unsigned nPrefixLength, const u8 *pGatewayIP,
+			  unsigned nMetric = ROUTE_METRIC_DEFAULT, unsigned nInterface = 0);
+
+	// returns FALSE, if the route does not exist
+	boolean RemoveRoute (const u8 *pDestIP, unsigned nPrefixLength, unsigned nInterface = 0);
+
+	// copies the route with the longest matching prefix and lowest metric to *pRoute,
+	// returns FALSE if none matches, can be called from any core and from IRQ context
+	boolean Lookup (const u8 *pDestIP, TRoute *pRoute);
+
+	unsigned GetCount (void) const;
+	boolean GetRoute (unsigned nIndex, TRoute *pRoute) const;	// in lookup order
+
+private:
+	struct TTable
+	{
+		TRoute		Route[ROUTING_TABLE_MAX_ROUTES];
+		unsigned	nRoutes;
+		unsigned	nGeneration;			// different for each version
+	};
+
+	TTable *BeginUpdate (void);				// returns a copy of the table
+	void EndUpdate (TTable *pTable);			// replaces the table with the copy
+
+	static boolean Remove (TTable *pTable, u32 nDestIP, unsigned nPrefixLength,
+			       unsigned nInterface);
+
+	static u32 GetAddress (const u8 *pIPAddress);		// in host byte order
+	static u32 GetMask (unsigned nPrefixLength);
+
+private:
+	TTable *m_pTable;
+
+	struct TCacheEntry
+	{
+		u32		nDestIP;
+		unsigned	nGeneration;
+		int		nRoute;				// index or -1 if no route matches
+	};
+
+	TCacheEntry m_Cache[CORES][ROUTING_CACHE_SIZE];
+
+	CSpinLock m_SpinLock;					// serializes the writers
+};
+
+#endif
@@ -2,7 +2,7 @@
 // socket.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -55,6 +55,9 @@ public:
 	/// \param nBackLog Maximum number of simultaneous connections which may be accepted\n
 	/// in a row before Accept() is called (up to SOCKET_MAX_LISTEN_BACKLOG)
 	/// \return Status (0 success, < 0 on error)
+	/// \note If the backlog is exhausted, further connection requests are answered with a SYN
+	///	  cookie and are accepted, when a connection becomes free, before the handshake
+	///	  times out. Up to TRANSPORT_MAX_LISTEN_PORTS ports can be listened on.
 	int Listen (unsigned nBackLog = 4);
 	/// \brief Accept an incoming connection (TCP only, must call Listen() before)
 	/// \param pForeignIP	IP address of the remote host will be returned here
@@ -69,6 +72,25 @@ public:
 	/// \return Length of the sent message (< 0 on error)
 	int Send (const void *pBuffer, unsigned nLength, int nFlags);
 
+	/// \brief Send a message, which is gathered from several buffers, to a remote host
+	/// \param pIOVector Pointer to the list of buffers
+	/// \param nCount    Number of entries in the list
+	/// \param nFlags    MSG_DONTWAIT (non-blocking operation) or 0 (blocking operation),\n
+	///		     can be or'ed with MSG_MORE (more data follows, TCP only)
+	/// \return Total length of the sent message (< 0 on error)
+	/// \note On UDP, the message is sent in one datagram.
+	int SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags);
+
+	/// \brief Send a message to a remote host without copying it to an intermediate buffer
+	/// \param pBuffer  Pointer to the message, must not be modified until pHandler is called
+	/// \param nLength  Length of the message
+	/// \param nFlags   0 or MSG_MORE (more data follows, TCP only), always non-blocking
+	/// \param pHandler Called, when the buffer is not needed any more (from the network task)
+	/// \param pParam   User parameter handed over to pHandler
+	/// \return Length of the message (< 0 on error, pHandler is not called then)
+	int SendZeroCopy (const void *pBuffer, unsigned nLength, int nFlags,
+			  TNetSendCompletionHandler *pHandler, void *pParam = 0);
+
 	/// \brief Receive a message from a remote host
 	/// \param pBuffer Pointer to the message buffer
 	/// \param nLength Size of the message buffer in bytes\n
@@ -98,19 +120,69 @@ public:
 	int ReceiveFrom (void *pBuffer, unsigned nLength, int nFlags,
 			 CIPAddress *pForeignIP, u16 *pForeignPort);
 
+	/// \brief Send several messages with one call (UDP only)
+	/// \param pMessages Pointer to the list of messages (nLength > 0, ForeignIP and\n
+	///		     nForeignPort are ignored, if Connect() has been called before)
+	/// \param nCount    Number of entries in the list
+	/// \param nFlags    MSG_DONTWAIT (non-blocking operation) or 0 (blocking operation)
+	/// \return Number of sent messages (< 0 on error with the first message)
+	int SendBatch (const TNetMessage *pMessages, unsigned nCount, int nFlags);
+
+	/// \brief Receive up to nCount messages with one call (UDP only)
+	/// \param pMessages Pointer to the list of messages (pBuffer and nLength are input,\n
+	///		     nLength, ForeignIP and nForeignPort are set on return)
+	/// \param nCount    Number of entries in the list
+	/// \param nFlags    MSG_DONTWAIT (non-blocking operation) or 0 (wait for at least\n
+	///		     one message)
+	/// \return Number of received messages (0 with MSG_DONTWAIT if no message available,\n
+	///	    < 0 on error)
+	int ReceiveBatch (TNetMessage *pMessages, unsigned nCount, int nFlags);
+
 	/// \brief Call this with bAllowed == TRUE after Bind() or Connect() to be able\n
 	/// to send and receive broadcast messages (ignored on TCP socket)
 	/// \param bAllowed Sending and receiving broadcast messages allowed on this socket? (default FALSE)
 	/// \return Status (0 success, < 0 on error)
 	int SetOptionBroadcast (boolean bAllowed);
 
+	/// \brief Call this with bCork == TRUE to send full segments only, so that many small\n
+	/// messages are coalesced, call it with bCork == FALSE to send the remaining data\n
+	/// (ignored on UDP socket)
+	/// \param bCork Collect data into full segments? (default FALSE)
+	/// \return Status (0 success, < 0 on error)
+	int SetOptionCork (boolean bCork);
+
+	/// \brief Set the maximum number of received messages, which are queued on this\n
+	/// socket (ignored on TCP socket), further messages are dropped
+	/// \param nDepth Maximum number of queued messages (0 for unlimited,\n
+	///		  default UDP_RX_QUEUE_DEPTH from sysconfig.h)
+	/// \return Status (0 success, < 0 on error)
+	int SetOptionRxQueueDepth (unsigned nDepth);
+
+	/// \brief Join an IPv4 multicast group, so that messages sent to this group are\n
+	/// received on this socket (UDP only, must call Bind() before)
+	/// \param rGroupIP IP address of the multicast group (224.0.0.0/4)
+	/// \return Status (0 success, < 0 on error)
+	int SetOptionAddMembership (const CIPAddress &rGroupIP);
+	/// \brief Leave an IPv4 multicast group, which has been joined before (UDP only)
+	/// \param rGroupIP IP address of the multicast group
+	/// \return Status (0 success, < 0 on error)
+	int SetOptionDropMembership (const CIPAddress &rGroupIP);
+
 	/// \brief Get IP address of connected remote host
 	/// \return Pointer to IP address (four bytes, 0-pointer if not connected)
 	const u8 *GetForeignIP (void) const;
 
+	/// \return Number of TCP segments, which have been retransmitted on this connection\n
+	///	    (0 on UDP socket or if not connected)
+	unsigned GetRetransmissions (void) const;
+
 private:
 	CSocket (CSocket &rSocket, int hConnection);
 
+	friend class CSocketSet;
+	unsigned GetPollStatus (void) const;			// returns NET_POLL_* flags
+	void SetPollEvent (CSynchronizationEvent *pEvent);	// 0 to unregister
+
 private:
 	CNetConfig	*m_pNetConfig;
 	CTransportLayer	*m_pTransportLayer;
@@ -0,0 +1,98 @@
+//
+// socketset.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_socketset_h
+#define _circle_net_socketset_h
+
+#include <circle/net/socket.h>
+#include <circle/net/netconnection.h>
+#include <circle/sched/synchronizationevent.h>
+#include <circle/types.h>
+
+#define SOCKET_SET_MAX_SOCKETS	32
+
+#define SOCKET_POLL_READ	NET_POLL_READ		///< Receive() or Accept() does not block
+#define SOCKET_POLL_WRITE	NET_POLL_WRITE		///< Send() does not block
+#define SOCKET_POLL_ERROR	NET_POLL_ERROR		///< Connection reset, refused or closed
+
+#define SOCKET_POLL_INFINITE	((unsigned) -1)
+
+/// \note A socket must be member of one socket set only, while Poll() is running.
+/// \note The sockets must not be deleted, before they have been removed from the set.
+
+class CSocketSet	/// Waits for one of several sockets to become ready
+{
+public:
+	CSocketSet (void);
+	~CSocketSet (void);
+
+	/// \brief Add a socket to the set or modify its events
+	/// \param pSocket Pointer to the socket
+	/// \param nEvents SOCKET_POLL_READ and/or SOCKET_POLL_WRITE\n
+	///		   (SOCKET_POLL_ERROR is always reported)
+	/// \return FALSE, if the set is full
+	boolean Add (CSocket *pSocket, unsigned nEvents = SOCKET_POLL_READ);
+
+	/// \brief Remove a socket from the set
+	/// \param pSocket Pointer to the socket
+	void Remove (CSocket *pSocket);
+
+	/// \return Number of sockets in the set
+	unsigned GetCount (void) const;
+
+	/// \param nIndex Index of the socket (0 .. GetCount()-1)
+	/// \return Pointer to the socket
+	CSocket *GetSocket (unsigned nIndex) const;
+
+	/// \brief Block the calling task, until at least one socket is ready
+	/// \param nTimeoutMicros Timeout in microseconds (0 to return at once,\n
+	///			  SOCKET_POLL_INFINITE to wait without timeout)
+	/// \return Number of ready sockets (0 on timeout)
+	/// \note A wakeup may be spurious, the status is checked again before returning.
+	int Poll (unsigned nTimeoutMicros = SOCKET_POLL_INFINITE);
+
+	/// \param nIndex Index of the socket (0 .. GetCount()-1)
+	/// \return SOCKET_POLL_* flags, which have been found ready by the last Poll()
+	unsigned GetReadyEvents (unsigned nIndex) const;
+
+	/// \param pSocket Pointer to the socket
+	/// \return SOCKET_POLL_* flags, which have been found ready by the last Poll()
+	unsigned GetReadyEvents (CSocket *pSocket) const;
+
+private:
+	// returns the number of ready sockets
+	int CheckSockets (void);
+
+	int Find (CSocket *pSocket) const;	// returns -1 if not found
+
+private:
+	struct TEntry
+	{
+		CSocket		*pSocket;
+		unsigned	 nEvents;
+		unsigned	 nReadyEvents;
+	};
+
+	TEntry m_Entry[SOCKET_SET_MAX_SOCKETS];
+	unsigned m_nCount;
+
+	CSynchronizationEvent m_Event;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // syslogdaemon.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,6 +24,7 @@
 #include <circle/net/netsubsystem.h>
 #include <circle/net/socket.h>
 #include <circle/net/ipaddress.h>
+#include <circle/net/in.h>
 #include <circle/sched/synchronizationevent.h>
 #include <circle/logger.h>
 #include <circle/timer.h>
@@ -33,19 +34,44 @@
 #define SYSLOG_VERSION		1
 #define SYSLOG_PORT		514
 
+#define SYSLOG_BATCH_SIZE	4096		// bytes, messages are sent with one call
+#define SYSLOG_BATCH_MESSAGES	16		// max. datagrams per call (UDP)
+
+#ifndef SYSLOG_MAX_RATE
+#define SYSLOG_MAX_RATE		50		// messages per second (0 for no limit)
+#endif
+#define SYSLOG_MAX_BURST	(2*SYSLOG_MAX_RATE)
+
+#define SYSLOG_RECONNECT_HZ	(10*HZ)		// delay before reconnecting (TCP)
+
+// The pending log messages are collected and sent with one call, using one datagram per
+// message (UDP, RFC 5426) or octet-counting framing (TCP, RFC 6587). Messages above the
+// rate limit, and messages which could not be sent, are dropped and reported with the next
+// message, together with the log events dropped by CLogger.
+
 class CSysLogDaemon : public CTask
 {
 public:
+	// nProtocol is IPPROTO_UDP or IPPROTO_TCP
 	CSysLogDaemon (CNetSubSystem *pNetSubSystem,
-		       const CIPAddress &ServerIP, u16 usServerPort = SYSLOG_PORT);
+		       const CIPAddress &ServerIP, u16 usServerPort = SYSLOG_PORT,
+		       int nProtocol = IPPROTO_UDP);
 	~CSysLogDaemon (void);
 
 	void Run (void);
 
 private:
-	boolean SendMessage (TLogSeverity Severity,
-			     time_t FullTime, unsigned nPartialTime, int nTimeNumOffset,
-			     const char *pAppName, const char *pMsg);
+	boolean Connect (void);
+
+	// formats the message and appends it to the batch, flushes the batch before, if full
+	void QueueMessage (TLogSeverity Severity,
+			   time_t FullTime, unsigned nPartialTime, int nTimeNumOffset,
+			   const char *pAppName, const char *pMsg);
+	void QueueDropReport (void);
+
+	void Flush (void);
+
+	boolean RateLimitPassed (void);
 
 	unsigned CalculatePriority (const char *pSource, TLogSeverity Severity);
 
@@ -56,11 +82,23 @@ private:
 	CNetSubSystem *m_pNetSubSystem;
 	CIPAddress m_ServerIP;
 	u16 m_usServerPort;
+	int m_nProtocol;
 
 	CTimer *m_pTimer;
 	CString m_Hostname;
 
 	CSocket *m_pSocket;
+	unsigned m_nConnectTicks;
+
+	char m_Batch[SYSLOG_BATCH_SIZE];
+	unsigned m_nBatchLength;
+	TNetMessage m_Message[SYSLOG_BATCH_MESSAGES];	// UDP only
+	unsigned m_nBatchMessages;
+
+	unsigned m_nTokens;				// for rate limit
+	unsigned m_nTokenTicks;
+
+	unsigned m_nDropped;				// not reported yet
 
 	CSynchronizationEvent m_Event;
 
@@ -0,0 +1,81 @@
+//
+// tcpcongestioncontrol.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpcongestioncontrol_h
+#define _circle_net_tcpcongestioncontrol_h
+
+#include <circle/types.h>
+
+enum TTCPCongestionControl
+{
+	TCPCongestionControlNewReno,		// RFC 5681, RFC 6582
+	TCPCongestionControlCUBIC,		// RFC 8312
+	TCPCongestionControlUnknown
+};
+
+// Base class of the congestion control algorithms (all windows in bytes). Slow start and
+// fast recovery (RFC 6582) are common, the derived classes implement the window increase
+// in congestion avoidance and the window reduction on loss.
+
+class CTCPCongestionControl
+{
+public:
+	CTCPCongestionControl (unsigned nMSS);
+	virtual ~CTCPCongestionControl (void);
+
+	static CTCPCongestionControl *Create (TTCPCongestionControl Type, unsigned nMSS);
+
+	// sets the initial window again (RFC 6928), call before sending data only
+	void SetMSS (unsigned nMSS);
+
+	u32 GetWindow (void) const;		// returns cwnd
+	boolean IsInRecovery (void) const;
+
+	// new data has been acknowledged outside of fast recovery, nRTT is the smoothed RTT in HZ
+	void Acknowledged (u32 nBytesAcked, unsigned nRTT);
+
+	// third duplicate ACK has been received, fast retransmit is done by the caller
+	void EnterRecovery (u32 nFlightSize);
+	// additional duplicate ACK in fast recovery
+	void DuplicateACK (void);
+	// ACK, which does not acknowledge all data sent before entering fast recovery
+	void PartialACK (u32 nBytesAcked);
+	// all data sent before entering fast recovery has been acknowledged
+	void ExitRecovery (u32 nFlightSize);
+
+	void RetransmissionTimeout (u32 nFlightSize);
+
+protected:
+	// increase m_nCWND in congestion avoidance
+	virtual void IncreaseWindow (u32 nBytesAcked, unsigned nRTT) = 0;
+
+	// returns the new slow start threshold after a loss
+	virtual u32 CalculateSSThresh (u32 nFlightSize) = 0;
+
+protected:
+	unsigned m_nMSS;
+
+	u32 m_nCWND;			// congestion window
+	u32 m_nSSThresh;		// slow start threshold
+
+private:
+	boolean m_bInRecovery;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // tcpconnection.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -27,7 +27,11 @@
 #include <circle/net/netqueue.h>
 #include <circle/net/retransmissionqueue.h>
 #include <circle/net/retranstimeoutcalc.h>
+#include <circle/net/tcpreassemblyqueue.h>
+#include <circle/net/tcpsackscoreboard.h>
+#include <circle/net/tcpcongestioncontrol.h>
 #include <circle/sched/synchronizationevent.h>
+#include <circle/bcmrandom.h>
 #include <circle/timer.h>
 #include <circle/spinlock.h>
 #include <circle/types.h>
@@ -56,6 +60,16 @@ enum TTCPTimer
 };
 
 struct TTCPHeader;
+struct TTCPSegmentOptions;
+
+struct TTCPZeroCopyBuffer
+{
+	const void			*pBuffer;
+	unsigned			 nLength;
+	unsigned			 nOffset;	// already written to retransmission queue
+	TNetSendCompletionHandler	*pHandler;
+	void				*pParam;
+};
 
 class CTCPConnection : public CNetConnection
 {
@@ -75,21 +89,38 @@ public:
 	int Close (void);
 	
 	int Send (const void *pData, unsigned nLength, int nFlags);
+	int SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags);
+	int SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+			  TNetSendCompletionHandler *pHandler, void *pParam);
 	int Receive (void *pBuffer, int nFlags);
 
 	int SendTo (const void *pData, unsigned nLength, int nFlags, CIPAddress	&rForeignIP, u16 nForeignPort);
 	int ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeignIP, u16 *pForeignPort);
 
 	int SetOptionBroadcast (boolean bAllowed);
+	int SetOptionCork (boolean bCork);
+	int SetOptionRxQueueDepth (unsigned nDepth)		{ return 0; }
+	int SetOptionMembership (const CIPAddress &rGroupIP, boolean bJoin) { return -1; }
 
 	boolean IsConnected (void) const;
 	boolean IsTerminated (void) const;
+
+	// returns TRUE, if the connection is in TIME-WAIT state, the sequence numbers are
+	// returned then and the connection is closed (to be kept in CTCPTimeWaitTable)
+	boolean ReleaseTimeWait (u32 *pSND_NXT, u32 *pRCV_NXT);
+
+	unsigned GetPollStatus (void) const;
+	unsigned GetRetransmissions (void) const;
+
+	boolean HasWildcardForeign (void) const;
 	
 	void Process (void);
+	boolean IsProcessPending (void) const;
 	
 	// returns: -1: invalid packet, 0: not to me, 1: packet consumed
 	int PacketReceived (const void *pPacket, unsigned nLength,
-			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol);
+			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+			    boolean bChecksumOK);
 
 	// returns: 0: not to me, 1: notification consumed
 	int NotificationReceived (TICMPNotificationType Type,
@@ -101,7 +132,20 @@ private:
 	boolean SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAcknowledgmentNumber = 0,
 			     const void *pData = 0, unsigned nDataLength = 0);
 
-	void ScanOptions (TTCPHeader *pHeader);
+	void ScanOptions (TTCPHeader *pHeader, TTCPSegmentOptions *pOptions);
+	u8 *PutTimestampOption (u8 *pOption, u32 nTSEcr);	// returns next option position
+
+	void EnqueueReceived (const void *pData, unsigned nLength);
+	void AcceptReceived (const void *pData, unsigned nLength);	// in sequence data
+	unsigned GetReceiveSpace (void) const;
+	void UpdateReceiveWindow (void);
+
+	unsigned GetSendMSS (void) const;		// without TCP options
+	u32 GetFlightSize (void) const;
+
+	int CheckSendState (int nFlags);
+	void FlushTxQueue (void);		// completes pending zero-copy buffers
+	void ReleaseBuffers (void);		// in TIME-WAIT, data is not sent or received any more
 	
 	u32 CalculateISN (void);
 	
@@ -122,8 +166,16 @@ private:
 
 	volatile int m_nErrno;			// signalize error to the user
 
-	CNetQueue m_TxQueue;
+	CNetQueue m_TxQueue;			// data or TTCPZeroCopyBuffer
+	TTCPZeroCopyBuffer m_ZeroCopy;		// being written to retransmission queue
+	volatile boolean m_bCork;		// send full segments only
+	volatile boolean m_bMoreData;		// MSG_MORE has been given on last send
 	CNetQueue m_RxQueue;
+	volatile int m_nRxQueued;		// bytes in m_RxQueue
+	volatile boolean m_bWindowUpdate;	// receive window may be opened, send ACK
+
+	CTCPReassemblyQueue m_ReassemblyQueue;	// out-of-order segments
+	CTCPSACKScoreboard m_SACKScoreboard;	// blocks selectively acknowledged by the peer
 
 	CRetransmissionQueue m_RetransmissionQueue;
 	volatile boolean m_bRetransmit;		// reset m_RetransmissionQueue and send
@@ -132,18 +184,22 @@ private:
 	TTCPState m_StateAfterFIN;		//	and go to this state
 
 	volatile unsigned m_nRetransmissionCount;
+	unsigned m_nRetransmittedSegments;	// total, for statistics
 	volatile boolean m_bTimedOut;		// abort connection and close
 	
 	CSynchronizationEvent m_Event;
 	CSynchronizationEvent m_TxEvent;	// for pacing transmit
 
 	CTimer *m_pTimer;
-	TKernelTimerHandle m_hTimer[TCPTimerUnknown];
+	CBcmRandomNumberGenerator m_Random;
+	CKernelTimer m_Timer[TCPTimerUnknown];
+	boolean m_bTimerRunning[TCPTimerUnknown];	// cleared, when a timer is stopped
 	CSpinLock m_TimerSpinLock;
 
 	// Send Sequence Variables
 	u32 m_nSND_UNA;		// send unacknowledged
 	u32 m_nSND_NXT;		// send next
+	u32 m_nSND_MAX;		// highest sequence number sent (SND_NXT goes back on retransmission)
 	u32 m_nSND_WND;		// send window
 	u16 m_nSND_UP;		// send urgent pointer
 	u32 m_nSND_WL1;		// segment sequence number used for last window update
@@ -159,8 +215,22 @@ private:
 	// Other Variables
 	u16 m_nSND_MSS;		// send maximum segment size
 
+	// Options (offered on active OPEN, set to the negotiated state after SYN exchange)
+	boolean m_bWindowScale;		// RFC 7323 section 2
+	unsigned m_nSND_WSHIFT;		// shift count for the window from the peer
+	unsigned m_nRCV_WSHIFT;		// shift count for our window
+	boolean m_bTimestamps;		// RFC 7323 section 3
+	u32 m_nTS_Recent;		// last timestamp value to be echoed
+	u32 m_nLastACKSent;		// last acknowledgment number sent
+	boolean m_bSACKPermitted;	// RFC 2018
+
 	CRetransmissionTimeoutCalculator m_RTOCalculator;
 
+	CTCPCongestionControl *m_pCongestionControl;
+	unsigned m_nDupACKs;			// number of consecutive duplicate ACKs
+	u32 m_nRecover;				// SND.MAX when entering fast recovery (RFC 6582)
+	volatile boolean m_bFastRetransmit;	// retransmit the segment at SND.UNA
+
 	static unsigned s_nConnections;
 };
 
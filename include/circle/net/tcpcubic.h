@@ -0,0 +1,52 @@
+//
+// tcpcubic.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpcubic_h
+#define _circle_net_tcpcubic_h
+
+#include <circle/net/tcpcongestioncontrol.h>
+#include <circle/timer.h>
+#include <circle/types.h>
+
+class CTCPCUBIC : public CTCPCongestionControl		// RFC 8312
+{
+public:
+	CTCPCUBIC (unsigned nMSS);
+	~CTCPCUBIC (void);
+
+private:
+	void IncreaseWindow (u32 nBytesAcked, unsigned nRTT);
+	u32 CalculateSSThresh (u32 nFlightSize);
+
+	static u32 CubeRoot (u64 nValue);
+
+private:
+	CTimer *m_pTimer;
+
+	u32 m_nWMax;			// window before the last reduction
+	u32 m_nOrigin;			// window at the plateau of the cubic function
+
+	boolean m_bEpochValid;
+	unsigned m_nEpochStart;		// in HZ
+	unsigned m_nK;			// time to reach m_nOrigin in milliseconds
+
+	u32 m_nWEst;			// window of standard TCP (TCP-friendly region)
+};
+
+#endif
@@ -0,0 +1,40 @@
+//
+// tcpnewreno.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpnewreno_h
+#define _circle_net_tcpnewreno_h
+
+#include <circle/net/tcpcongestioncontrol.h>
+#include <circle/types.h>
+
+class CTCPNewReno : public CTCPCongestionControl	// RFC 5681, RFC 6582
+{
+public:
+	CTCPNewReno (unsigned nMSS);
+	~CTCPNewReno (void);
+
+private:
+	void IncreaseWindow (u32 nBytesAcked, unsigned nRTT);
+	u32 CalculateSSThresh (u32 nFlightSize);
+
+private:
+	u32 m_nBytesAcked;		// appropriate byte counting (RFC 3465)
+};
+
+#endif
@@ -0,0 +1,62 @@
+//
+// tcpreassemblyqueue.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpreassemblyqueue_h
+#define _circle_net_tcpreassemblyqueue_h
+
+#include <circle/types.h>
+
+// Holds received TCP segments, which arrived out of order, until the gap before
+// them has been filled. Segments may overlap. All sequence numbers are modulo 2^32.
+
+struct TTCPReassemblySegment;
+
+class CTCPReassemblyQueue
+{
+public:
+	CTCPReassemblyQueue (void);
+	~CTCPReassemblyQueue (void);
+
+	boolean IsEmpty (void) const;
+
+	// returns the total number of bytes in the queue (overlapping bytes count twice)
+	unsigned GetBytesQueued (void) const;
+
+	void Flush (void);
+
+	void Insert (u32 nSequenceNumber, const void *pData, unsigned nLength);
+
+	// removes the data starting at nSequenceNumber (at most nLength bytes of one segment),
+	// segments, which end before nSequenceNumber, are discarded
+	// returns the number of bytes copied to pBuffer (0 if next data is not available)
+	unsigned Remove (u32 nSequenceNumber, void *pBuffer, unsigned nLength);
+
+	// returns up to nMaxBlocks blocks of contiguous data as SACK blocks (RFC 2018),
+	// the block, which contains the most recently inserted segment, comes first
+	unsigned GetBlocks (u32 *pLeftEdge, u32 *pRightEdge, unsigned nMaxBlocks) const;
+
+private:
+	TTCPReassemblySegment *m_pFirst;		// sorted by sequence number
+
+	unsigned m_nBytesQueued;
+
+	u32 m_nLastInserted;
+};
+
+#endif
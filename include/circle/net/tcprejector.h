@@ -2,7 +2,7 @@
 // tcprejector.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -27,6 +27,8 @@
 #include <circle/net/icmphandler.h>
 #include <circle/types.h>
 
+struct TTCPHeader;
+
 class CTCPRejector : public CNetConnection
 {
 public:
@@ -35,29 +37,50 @@ public:
 
 	// returns: -1: invalid packet, 0: not to me, 1: packet consumed
 	int PacketReceived (const void *pPacket, unsigned nLength,
-			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol);
+			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+			    boolean bChecksumOK);
+
+	// bListening: a socket listens on the destination port, but has no free connection in
+	// its backlog (a SYN is answered with a SYN cookie then, instead of a RESET)
+	int PacketReceived (const void *pPacket, unsigned nLength,
+			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+			    boolean bChecksumOK, boolean bListening);
 
 	// unused
 	int Connect (void)						{ return -1; }
 	int Accept (CIPAddress *pForeignIP, u16 *pForeignPort)		{ return -1; }
 	int Close (void)						{ return -1; }
 	int Send (const void *pData, unsigned nLength, int nFlags)	{ return -1; }
+	int SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags) { return -1; }
+	int SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+			  TNetSendCompletionHandler *pHandler, void *pParam) { return -1; }
 	int Receive (void *pBuffer, int nFlags)				{ return -1; }
 	int SendTo (const void *pData, unsigned nLength, int nFlags,
 		    CIPAddress	&rForeignIP, u16 nForeignPort)		{ return -1; }
 	int ReceiveFrom (void *pBuffer, int nFlags,
 			 CIPAddress *pForeignIP, u16 *pForeignPort)	{ return -1; }
 	int SetOptionBroadcast (boolean bAllowed)			{ return -1; }
+	int SetOptionCork (boolean bCork)				{ return -1; }
+	int SetOptionRxQueueDepth (unsigned nDepth)			{ return -1; }
+	int SetOptionMembership (const CIPAddress &rGroupIP, boolean bJoin) { return -1; }
 	boolean IsConnected (void) const				{ return FALSE; }
 	boolean IsTerminated (void) const				{ return FALSE; }
+
+	unsigned GetPollStatus (void) const				{ return 0; }
+	unsigned GetRetransmissions (void) const			{ return 0; }
+	boolean HasWildcardForeign (void) const				{ return TRUE; }
 	void Process (void)						{ }
+	boolean IsProcessPending (void) const				{ return FALSE; }
 	int NotificationReceived (TICMPNotificationType Type,
 				  CIPAddress &rSenderIP, CIPAddress &rReceiverIP,
 				  u16 nSendPort, u16 nReceivePort,
 				  int nProtocol)			{ return 0; }
 
 private:
+	// a SYN is sent with the MSS option and a window of 65535 bytes
 	boolean SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAcknowledgmentNumber = 0);
+
+	static u16 GetOfferedMSS (const TTCPHeader *pHeader);
 };
 
 #endif
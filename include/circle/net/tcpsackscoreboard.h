@@ -0,0 +1,63 @@
+//
+// tcpsackscoreboard.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpsackscoreboard_h
+#define _circle_net_tcpsackscoreboard_h
+
+#include <circle/types.h>
+
+#define TCP_SACK_SCOREBOARD_SIZE	8	// maximum number of remembered blocks
+
+// Remembers, which sent data above SND.UNA has been selectively acknowledged
+// by the receiver (RFC 2018). All sequence numbers are modulo 2^32.
+
+class CTCPSACKScoreboard
+{
+public:
+	CTCPSACKScoreboard (void);
+	~CTCPSACKScoreboard (void);
+
+	boolean IsEmpty (void) const;
+
+	void Reset (void);
+
+	// add a block [nLeftEdge, nRightEdge), which must have been checked for validity
+	void Add (u32 nLeftEdge, u32 nRightEdge);
+
+	// SND.UNA has been advanced, forget the blocks below
+	void Acknowledge (u32 nSND_UNA);
+
+	// returns TRUE, if nSequenceNumber has been selectively acknowledged,
+	// *pRightEdge is set to the end of the block then
+	boolean IsAcknowledged (u32 nSequenceNumber, u32 *pRightEdge) const;
+
+	// returns TRUE, if there is a block above nSequenceNumber,
+	// *pLeftEdge is set to the start of the next block then
+	boolean GetNextBlock (u32 nSequenceNumber, u32 *pLeftEdge) const;
+
+	// returns the number of selectively acknowledged bytes
+	u32 GetBytesAcknowledged (void) const;
+
+private:
+	unsigned m_nBlocks;
+	u32 m_LeftEdge[TCP_SACK_SCOREBOARD_SIZE];	// sorted, not overlapping
+	u32 m_RightEdge[TCP_SACK_SCOREBOARD_SIZE];
+};
+
+#endif
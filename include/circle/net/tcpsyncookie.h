@@ -0,0 +1,58 @@
+//
+// tcpsyncookie.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpsyncookie_h
+#define _circle_net_tcpsyncookie_h
+
+#include <circle/net/ipaddress.h>
+#include <circle/types.h>
+
+// A SYN cookie is the initial sequence number of a SYN-ACK, which is sent, when the listen
+// backlog of a port is exhausted. It encodes a time counter, the MSS offered by the peer and
+// a keyed hash (HalfSipHash-2-4) of the connection addresses, so that a TCB has to be
+// created not before the final ACK of the three-way handshake has been received.
+// The TCP options other than the MSS (window scale, SACK, timestamps) are not supported
+// on connections, which have been opened this way.
+
+#define TCP_SYN_COOKIE_PERIOD_SECS	64	// a cookie is valid for 64 to 128 seconds
+
+class CTCPSYNCookie
+{
+public:
+	// returns the cookie (ISS of the SYN-ACK) for the SYN with sequence number nIRS
+	static u32 Generate (const CIPAddress &rForeignIP, u16 nForeignPort, u16 nOwnPort,
+			     u32 nIRS, u16 nMSS);
+
+	// returns TRUE, if nCookie has been generated for this connection before,
+	// the (rounded down) MSS offered by the peer is returned in *pMSS then
+	static boolean Check (const CIPAddress &rForeignIP, u16 nForeignPort, u16 nOwnPort,
+			      u32 nIRS, u32 nCookie, u16 *pMSS);
+
+private:
+	static u32 Hash (const CIPAddress &rForeignIP, u16 nForeignPort, u16 nOwnPort,
+			 u32 nIRS, u32 nCounter);
+
+	static u32 GetCounter (void);
+
+private:
+	static boolean s_bSecretValid;
+	static u32 s_Secret[2];
+};
+
+#endif
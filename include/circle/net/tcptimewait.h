@@ -0,0 +1,119 @@
+//
+// tcptimewait.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcptimewait_h
+#define _circle_net_tcptimewait_h
+
+#include <circle/net/netconnection.h>
+#include <circle/net/netconfig.h>
+#include <circle/net/networklayer.h>
+#include <circle/net/ipaddress.h>
+#include <circle/net/icmphandler.h>
+#include <circle/timer.h>
+#include <circle/types.h>
+
+#ifndef TCP_TIMEWAIT_ENTRIES
+#define TCP_TIMEWAIT_ENTRIES	256		// the oldest entry is dropped, if the table is full
+#endif
+
+#define TCP_TIMEWAIT_HASH_SIZE	64
+#define TCP_TIMEWAIT_HZ		(60 * HZ)	// 2 * MSL
+
+// Keeps the state of connections in TIME-WAIT state, which have been closed by the user,
+// after their TCB has been deleted. Only the addresses and the sequence numbers are needed
+// to acknowledge a retransmitted FIN and to reject old duplicate segments. The timeout is
+// not restarted on a retransmitted FIN.
+
+class CTCPTimeWaitTable : public CNetConnection
+{
+public:
+	CTCPTimeWaitTable (CNetConfig *pNetConfig, CNetworkLayer *pNetworkLayer);
+	~CTCPTimeWaitTable (void);
+
+	void Add (const u8 *pForeignIP, u16 nForeignPort, u16 nOwnPort, u32 nSND_NXT, u32 nRCV_NXT);
+
+	// returns: -1: invalid packet, 0: not to me, 1: packet consumed
+	int PacketReceived (const void *pPacket, unsigned nLength,
+			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+			    boolean bChecksumOK);
+
+	void Process (void);		// removes expired entries
+
+	// unused
+	int Connect (void)						{ return -1; }
+	int Accept (CIPAddress *pForeignIP, u16 *pForeignPort)		{ return -1; }
+	int Close (void)						{ return -1; }
+	int Send (const void *pData, unsigned nLength, int nFlags)	{ return -1; }
+	int SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags) { return -1; }
+	int SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+			  TNetSendCompletionHandler *pHandler, void *pParam) { return -1; }
+	int Receive (void *pBuffer, int nFlags)				{ return -1; }
+	int SendTo (const void *pData, unsigned nLength, int nFlags,
+		    CIPAddress	&rForeignIP, u16 nForeignPort)		{ return -1; }
+	int ReceiveFrom (void *pBuffer, int nFlags,
+			 CIPAddress *pForeignIP, u16 *pForeignPort)	{ return -1; }
+	int SetOptionBroadcast (boolean bAllowed)			{ return -1; }
+	int SetOptionCork (boolean bCork)				{ return -1; }
+	int SetOptionRxQueueDepth (unsigned nDepth)			{ return -1; }
+	int SetOptionMembership (const CIPAddress &rGroupIP, boolean bJoin) { return -1; }
+	boolean IsConnected (void) const				{ return FALSE; }
+	boolean IsTerminated (void) const				{ return FALSE; }
+
+	unsigned GetPollStatus (void) const				{ return 0; }
+	unsigned GetRetransmissions (void) const			{ return 0; }
+	boolean HasWildcardForeign (void) const				{ return TRUE; }
+	boolean IsProcessPending (void) const				{ return FALSE; }
+	int NotificationReceived (TICMPNotificationType Type,
+				  CIPAddress &rSenderIP, CIPAddress &rReceiverIP,
+				  u16 nSendPort, u16 nReceivePort,
+				  int nProtocol)			{ return 0; }
+
+private:
+	// returns the index of the entry or -1, if not found
+	int Lookup (const u8 *pForeignIP, u16 nForeignPort, u16 nOwnPort) const;
+	void Remove (unsigned nEntry);
+
+	static unsigned GetBucket (const u8 *pForeignIP, u16 nForeignPort, u16 nOwnPort);
+
+	boolean SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAcknowledgmentNumber);
+
+private:
+	struct TEntry
+	{
+		boolean	bValid;
+		u8	ForeignIP[IP_ADDRESS_SIZE];
+		u16	nForeignPort;
+		u16	nOwnPort;
+		u32	nSND_NXT;
+		u32	nRCV_NXT;
+		unsigned nExpireTicks;
+		int	nHashNext;		// index of next entry in the bucket or -1
+	};
+
+	TEntry m_Entry[TCP_TIMEWAIT_ENTRIES];	// ring buffer, sorted by expire time
+	unsigned m_nIn;
+	unsigned m_nOut;
+	unsigned m_nCount;			// entries in the ring buffer (including removed)
+
+	int m_HashBucket[TCP_TIMEWAIT_HASH_SIZE];
+
+	CTimer *m_pTimer;
+};
+
+#endif
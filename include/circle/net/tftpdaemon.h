@@ -44,6 +44,15 @@ private:
 	boolean DoRead (const char *pFileName);
 	boolean DoWrite (const char *pFileName);
 
+	// parses the RFC 2347 options of a request, returns the length of the OACK (0 for none)
+	unsigned ParseOptions (const char *pOptions, unsigned nLength);
+	// RRQ only: sends the OACK and waits for ACK 0
+	boolean SendOptionAck (void);
+
+	// data of a WRQ is collected and written to the file in chunks
+	boolean WriteData (const void *pBuffer, unsigned nCount);
+	boolean FlushData (void);
+
 	// use m_pRequestSocket, if pSendTo/nPort are given; m_pTransferSocket otherwise
 	void SendError (u16 usErrorCode, const char *pErrorMessage,
 			CIPAddress *pSendTo = 0, u16 usPort = 0);
@@ -53,6 +62,15 @@ private:
 
 	CSocket *m_pRequestSocket;
 	CSocket *m_pTransferSocket;
+
+	unsigned m_nBlockSize;			// negotiated with the blksize option
+	unsigned m_nWindowSize;			// negotiated with the windowsize option
+
+	u8 *m_pOptionAck;			// OACK packet
+	unsigned m_nOptionAckLength;
+
+	u8 *m_pBuffer;				// window of data blocks (RRQ) or write chunk (WRQ)
+	unsigned m_nBufferFill;
 };
 
 #endif
@@ -2,7 +2,7 @@
 // transportlayer.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,12 +24,20 @@
 #include <circle/net/networklayer.h>
 #include <circle/net/netconnection.h>
 #include <circle/net/tcprejector.h>
+#include <circle/net/tcptimewait.h>
 #include <circle/net/ipaddress.h>
 #include <circle/net/netqueue.h>
-#include <circle/ptrarray.h>
+#include <circle/smallvector.h>
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
+#ifndef TRANSPORT_HASH_BITS
+#define TRANSPORT_HASH_BITS	8
+#endif
+#define TRANSPORT_HASH_SIZE	(1 << TRANSPORT_HASH_BITS)
+
+#define TRANSPORT_MAX_LISTEN_PORTS	16
+
 class CTransportLayer
 {
 public:
@@ -49,9 +57,16 @@ public:
 	int Listen (u16 nOwnPort, int nProtocol);
 	int Accept (CIPAddress *pForeignIP, u16 *pForeignPort, int hConnection);
 
+	// a socket listens on this TCP port (enables SYN cookies, when its backlog is exhausted)
+	boolean RegisterListenPort (u16 nOwnPort);
+	void UnregisterListenPort (u16 nOwnPort);
+
 	int Disconnect (int hConnection);
 
 	int Send (const void *pData, unsigned nLength, int nFlags, int hConnection);
+	int SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags, int hConnection);
+	int SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+			  TNetSendCompletionHandler *pHandler, void *pParam, int hConnection);
 
 	// pBuffer must have size FRAME_BUFFER_SIZE
 	int Receive (void *pBuffer, int nFlags, int hConnection);
@@ -64,19 +79,72 @@ public:
 			 u16 *pForeignPort, int hConnection);
 
 	int SetOptionBroadcast (boolean bAllowed, int hConnection);
+	int SetOptionCork (boolean bCork, int hConnection);
+	int SetOptionRxQueueDepth (unsigned nDepth, int hConnection);
+	int SetOptionMembership (const CIPAddress &rGroupIP, boolean bJoin, int hConnection);
 
 	boolean IsConnected (int hConnection) const;
 	const u8 *GetForeignIP (int hConnection) const;		// returns 0 if not connected
 
+	// returns NET_POLL_ERROR, if the connection does not exist (any more)
+	unsigned GetPollStatus (int hConnection) const;
+	unsigned GetRetransmissions (int hConnection) const;
+	void SetPollEvent (CSynchronizationEvent *pEvent, int hConnection);
+
+private:
+	void AddConnection (CNetConnection *pConnection, unsigned hConnection);
+	void RemoveConnection (CNetConnection *pConnection);
+
+	// returns TRUE, if the packet has been consumed (or was invalid)
+	boolean PacketReceived (const void *pPacket, unsigned nLength,
+				CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+				boolean bChecksumOK);
+	void NotificationReceived (TICMPNotificationType Type,
+				   CIPAddress &rSenderIP, CIPAddress &rReceiverIP,
+				   u16 nSendPort, u16 nReceivePort, int nProtocol);
+
+	// returns TRUE, if the TCP segment is destined to a registered listen port
+	boolean IsListenPort (const void *pPacket, unsigned nLength);
+
+	// connections with a known foreign address are hashed on (own port, foreign IP, foreign
+	// port), the others (e.g. listening) on the own port only, in the upper half of the table
+	static unsigned GetBucket (int nProtocol, u16 nOwnPort, const u8 *pForeignIP, u16 nForeignPort);
+	static unsigned GetWildcardBucket (int nProtocol, u16 nOwnPort);
+	static unsigned GetBucket (const CNetConnection *pConnection);
+	void UpdateHash (CNetConnection *pConnection);		// after the address may have changed
+	void InsertHash (CNetConnection *pConnection);
+	void RemoveHash (CNetConnection *pConnection);
+
+	// active list of connections, which have to be processed
+	void Activate (CNetConnection *pConnection);		// may be called from IRQ context
+	void Deactivate (CNetConnection *pConnection);
+	CNetConnection *GetActive (void);			// removes the first entry
+	friend class CNetConnection;
+
 private:
 	CNetConfig    *m_pNetConfig;
 	CNetworkLayer *m_pNetworkLayer;
 
-	CPtrArray m_pConnection;
+	CSmallVector<CNetConnection *, 16> m_pConnection;
 	u16 m_nOwnPort;
 	CSpinLock m_SpinLock;
 
+	CNetConnection **m_ppHashBucket;	// 2 * TRANSPORT_HASH_SIZE entries
+
+	CNetConnection *m_pActiveHead;
+	CNetConnection *m_pActiveTail;
+	unsigned m_nActiveCount;
+	CSpinLock m_ActiveSpinLock;
+
 	CTCPRejector m_TCPRejector;
+	CTCPTimeWaitTable m_TCPTimeWait;
+
+	struct
+	{
+		u16	 nPort;			// 0 if unused
+		unsigned nCount;		// number of listening sockets
+	}
+	m_ListenPort[TRANSPORT_MAX_LISTEN_PORTS];
 };
 
 #endif
@@ -2,7 +2,7 @@
 // udpconnection.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -26,9 +26,13 @@
 #include <circle/net/ipaddress.h>
 #include <circle/net/icmphandler.h>
 #include <circle/net/netqueue.h>
+#include <circle/netbuffer.h>
+#include <circle/sysconfig.h>
 #include <circle/sched/synchronizationevent.h>
 #include <circle/types.h>
 
+#define UDP_MAX_MULTICAST_GROUPS	4	// per connection
+
 class CUDPConnection : public CNetConnection
 {
 public:
@@ -47,21 +51,34 @@ public:
 	int Close (void);
 	
 	int Send (const void *pData, unsigned nLength, int nFlags);
+	int SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags);
+	int SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+			  TNetSendCompletionHandler *pHandler, void *pParam);
 	int Receive (void *pBuffer, int nFlags);
 
 	int SendTo (const void *pData, unsigned nLength, int nFlags, CIPAddress	&rForeignIP, u16 nForeignPort);
 	int ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeignIP, u16 *pForeignPort);
 
 	int SetOptionBroadcast (boolean bAllowed);
+	int SetOptionCork (boolean bCork);
+	int SetOptionRxQueueDepth (unsigned nDepth);
+	int SetOptionMembership (const CIPAddress &rGroupIP, boolean bJoin);
 
 	boolean IsConnected (void) const;
 	boolean IsTerminated (void) const;
+
+	unsigned GetPollStatus (void) const;
+	unsigned GetRetransmissions (void) const			{ return 0; }
+
+	boolean HasWildcardForeign (void) const;
 	
 	void Process (void);
+	boolean IsProcessPending (void) const;
 
 	// returns: -1: invalid packet, 0: not to me, 1: packet consumed
 	int PacketReceived (const void *pPacket, unsigned nLength,
-			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol);
+			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+			    boolean bChecksumOK);
 
 	// returns: 0: not to me, 1: notification consumed
 	int NotificationReceived (TICMPNotificationType Type,
@@ -69,13 +86,22 @@ public:
 				  u16 nSendPort, u16 nReceivePort,
 				  int nProtocol);
 
+private:
+	// copies the data behind the UDP header and calculates the checksum
+	// (or leaves it to the net device)
+	void CopyData (CNetBuffer *pBuffer, const void *pData, unsigned nLength);
+
 private:
 	boolean m_bOpen;
 	boolean m_bActiveOpen;
 	CNetQueue m_RxQueue;
+	unsigned m_nRxQueueDepth;		// 0 for unlimited
 	CSynchronizationEvent m_Event;
 	boolean m_bBroadcastsAllowed;
 
+	CIPAddress m_MulticastGroup[UDP_MAX_MULTICAST_GROUPS];
+	unsigned m_nMulticastGroups;
+
 	int m_nErrno;				// signalize error to the user
 };
 
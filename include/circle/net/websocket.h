@@ -0,0 +1,165 @@
+//
+// websocket.h
+//
+// WebSocket protocol (RFC 6455) on top of an established TCP connection
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_websocket_h
+#define _circle_net_websocket_h
+
+#include <circle/net/netsubsystem.h>
+#include <circle/net/ipaddress.h>
+#include <circle/net/socket.h>
+#include <circle/netdevice.h>
+#include <circle/bcmrandom.h>
+#include <circle/types.h>
+
+#define WEBSOCKET_VERSION		13
+#define WEBSOCKET_KEY_SIZE		24		// base64 encoded 16 bytes
+#define WEBSOCKET_ACCEPT_SIZE		28		// base64 encoded SHA-1 hash
+
+#define WEBSOCKET_MAX_HEADER_SIZE	14
+#define WEBSOCKET_MAX_CONTROL_PAYLOAD	125
+
+#define WEBSOCKET_STATUS_NORMAL		1000
+#define WEBSOCKET_STATUS_GOING_AWAY	1001
+#define WEBSOCKET_STATUS_PROTOCOL_ERROR	1002
+#define WEBSOCKET_STATUS_TOO_BIG	1009
+
+enum TWebSocketOpcode
+{
+	WebSocketContinuation	= 0x0,
+	WebSocketText		= 0x1,
+	WebSocketBinary		= 0x2,
+	WebSocketClose		= 0x8,
+	WebSocketPing		= 0x9,
+	WebSocketPong		= 0xA
+};
+
+class CWebSocket	/// A WebSocket connection (RFC 6455), server or client side
+{
+public:
+	/// \param pSocket Connected TCP socket, the handshake must have been done already\n
+	///		   (the socket is owned by this object afterwards)
+	/// \param bClient Is this the client side of the connection? (masks sent frames)
+	/// \param pRxData Data, which has already been received after the handshake (or 0)
+	/// \param nRxLength Length of pRxData
+	CWebSocket (CSocket *pSocket, boolean bClient,
+		    const void *pRxData = 0, unsigned nRxLength = 0);
+
+	/// \brief Destructor (sends a close frame, if not done before, and closes the connection)
+	~CWebSocket (void);
+
+	/// \brief Establish a WebSocket connection to a server (client side)
+	/// \param pNetSubSystem Pointer to the network subsystem
+	/// \param rServerIP IP address of the server
+	/// \param nServerPort Port number of the server
+	/// \param pServerName Host name of the server (for the "Host" header field)
+	/// \param pPath Path of the WebSocket resource (e.g. "/stream")
+	/// \return Pointer to the new connection (0 on error), delete it to close it
+	static CWebSocket *Connect (CNetSubSystem *pNetSubSystem,
+				    CIPAddress &rServerIP, u16 nServerPort,
+				    const char *pServerName, const char *pPath);
+
+	/// \brief Send a message in one frame
+	/// \param pData Pointer to the message
+	/// \param nLength Length of the message
+	/// \param Opcode WebSocketText or WebSocketBinary
+	/// \return Length of the sent message (< 0 on error)
+	int Send (const void *pData, unsigned nLength, TWebSocketOpcode Opcode = WebSocketText);
+
+	/// \brief Send a part of a fragmented message
+	/// \param pData Pointer to the fragment
+	/// \param nLength Length of the fragment
+	/// \param bFinal Is this the last fragment of the message?
+	/// \param Opcode WebSocketText or WebSocketBinary (used with the first fragment only)
+	/// \return Length of the sent fragment (< 0 on error)
+	int SendFragment (const void *pData, unsigned nLength, boolean bFinal,
+			  TWebSocketOpcode Opcode = WebSocketText);
+
+	/// \brief Send a message to several connections, the frame is built only once
+	/// \param ppWebSockets List of connections (server side only, 0-entries are ignored)
+	/// \param nCount Number of entries in the list
+	/// \param pData Pointer to the message
+	/// \param nLength Length of the message
+	/// \param Opcode WebSocketText or WebSocketBinary
+	/// \return Number of connections, the message has been sent to
+	static unsigned Broadcast (CWebSocket * const *ppWebSockets, unsigned nCount,
+				   const void *pData, unsigned nLength,
+				   TWebSocketOpcode Opcode = WebSocketText);
+
+	/// \brief Receive a message, fragmented messages are reassembled
+	/// \param pBuffer Pointer to the message buffer
+	/// \param nSize Size of the message buffer (longer messages close the connection)
+	/// \param pOpcode WebSocketText or WebSocketBinary is returned here (if not 0)
+	/// \param nFlags MSG_DONTWAIT (return, if no frame has been started) or 0 (blocking)
+	/// \return Length of the received message (0 with MSG_DONTWAIT if no message\n
+	///	    available, < 0 on error or if the connection has been closed)
+	/// \note Ping frames are answered and close frames are acknowledged automatically.
+	int Receive (void *pBuffer, unsigned nSize, TWebSocketOpcode *pOpcode = 0, int nFlags = 0);
+
+	/// \brief Start the closing handshake
+	/// \param usStatusCode Status code to be sent to the peer
+	/// \return Operation successful?
+	boolean Close (u16 usStatusCode = WEBSOCKET_STATUS_NORMAL);
+
+	/// \return Has the connection been closed (by one of the peers or due to an error)?
+	boolean IsClosed (void) const;
+
+	/// \brief Calculate the value of the Sec-WebSocket-Accept header field
+	/// \param pKey Value of the Sec-WebSocket-Key header field
+	/// \param pAccept Buffer for the result (WEBSOCKET_ACCEPT_SIZE+1 bytes)
+	static void GetAcceptKey (const char *pKey, char *pAccept);
+
+	/// \brief XOR data with a masking key, as required for frames sent by a client
+	/// \param pData Pointer to the data
+	/// \param nLength Length of the data
+	/// \param pMaskKey Masking key (4 bytes)
+	/// \param nOffset Offset of pData from the start of the frame payload
+	/// \note Processes 64-bit words at once, the data need not be aligned.
+	static void ApplyMask (u8 *pData, unsigned nLength, const u8 *pMaskKey, unsigned nOffset = 0);
+
+private:
+	int SendFrame (unsigned nOpcode, boolean bFinal, const void *pData, unsigned nLength);
+	static unsigned EncodeHeader (u8 *pHeader, unsigned nOpcode, boolean bFinal,
+				      u64 nLength, const u8 *pMaskKey);
+
+	boolean Read (void *pBuffer, unsigned nLength);		// blocking
+	int Fail (u16 usStatusCode);				// closes connection, returns -1
+
+	void NewMaskKey (u8 *pMaskKey);
+
+	static void SHA1 (const void *pData, unsigned nLength, u8 *pDigest);
+	static void Base64Encode (const u8 *pData, unsigned nLength, char *pResult);
+
+private:
+	CSocket *m_pSocket;
+	boolean m_bClient;
+
+	boolean m_bClosed;
+	boolean m_bCloseSent;
+
+	boolean m_bSendFragmented;		// fragmented message is being sent
+	CBcmRandomNumberGenerator m_Random;	// for masking keys
+
+	u8 m_RxBuffer[FRAME_BUFFER_SIZE];
+	unsigned m_nRxOffset;
+	unsigned m_nRxLength;
+};
+
+#endif
@@ -0,0 +1,141 @@
+//
+// netbuffer.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_netbuffer_h
+#define _circle_netbuffer_h
+
+#include <circle/netdevice.h>
+#include <circle/spinlock.h>
+#include <circle/synchronize.h>
+#include <circle/macros.h>
+#include <circle/types.h>
+#include <assert.h>
+
+#define NET_BUFFER_HEADROOM	64	// default, the data is cache-aligned then
+#define NET_BUFFER_SIZE		(NET_BUFFER_HEADROOM + FRAME_BUFFER_SIZE)
+
+#define NET_BUFFER_PRIVATE_SIZE	16	// for per-packet data of a net layer
+
+/// \note A net buffer holds one frame or packet. It is handed over between the net layers\n
+///	  by pointer, each layer removes its header on receive and prepends it on transmit\n
+///	  in place. The buffer is freed, when the last reference has been released.
+/// \note Freed buffers are kept in a pool for reuse. The class must not be used from\n
+///	  interrupt context.
+
+class CNetBuffer	/// Reference counted buffer for a network frame
+{
+public:
+	/// \param nHeadroom Space in front of the data for headers to be prepended later
+	/// \note The reference count is 1 and the data length is 0 initially.
+	CNetBuffer (unsigned nHeadroom = NET_BUFFER_HEADROOM);
+
+	~CNetBuffer (void);
+
+	void AddRef (void);
+	/// \brief Decrements the reference count and deletes the buffer, when it becomes 0
+	void Release (void);
+
+	/// \return Pointer to the start of the data
+	u8 *GetData (void)			{ return m_pData; }
+	/// \return Length of the data in bytes
+	unsigned GetLength (void) const		{ return m_nLength; }
+	/// \param nLength Length of the data, after it has been filled in place
+	void SetLength (unsigned nLength)
+	{
+		assert (nLength <= GetMaxLength ());
+		m_nLength = nLength;
+	}
+
+	/// \return Available space in front of the data
+	unsigned GetHeadroom (void) const	{ return m_pData - m_Buffer; }
+	/// \return Maximum length of the data (without prepending)
+	unsigned GetMaxLength (void) const	{ return m_Buffer + NET_BUFFER_SIZE - m_pData; }
+
+	/// \param nLength Length of the header
+	/// \return Pointer to the header, which is the start of the data now
+	void *PrependHeader (unsigned nLength)
+	{
+		assert (nLength <= GetHeadroom ());
+		m_pData -= nLength;
+		m_nLength += nLength;
+
+		return m_pData;
+	}
+
+	/// \param nLength Length of the header, which is removed from the start of the data
+	/// \return Pointer to the removed header
+	void *RemoveHeader (unsigned nLength)
+	{
+		assert (nLength <= m_nLength);
+		void *pHeader = m_pData;
+		m_pData += nLength;
+		m_nLength -= nLength;
+
+		return pHeader;
+	}
+
+	/// \return Pointer to NET_BUFFER_PRIVATE_SIZE bytes, which belong to the current owner
+	void *GetPrivateData (void)		{ return m_PrivateData; }
+
+	/// \brief Request offloads from the net device (TX) or report them (RX)
+	/// \param nFlags NET_OFFLOAD_* flags
+	/// \param nChecksumStart Offset of the TCP/UDP header from the start of the data
+	/// \param nChecksumOffset Offset of the checksum field in the TCP/UDP header
+	/// \param nSegmentSize Maximum payload length of the TCP segments to be sent (TSO)
+	/// \note With NET_OFFLOAD_TX_CHECKSUM the checksum field must hold the (not complemented)\n
+	///	  sum over the pseudo header. The offsets stay valid, when headers are prepended.
+	void SetOffload (unsigned nFlags, unsigned nChecksumStart = 0,
+			 unsigned nChecksumOffset = 0, unsigned nSegmentSize = 0)
+	{
+		m_nOffloadFlags = nFlags;
+		m_nChecksumStart = GetHeadroom () + nChecksumStart;
+		m_nChecksumOffset = nChecksumOffset;
+		m_nSegmentSize = nSegmentSize;
+	}
+
+	/// \return NET_OFFLOAD_* flags of this buffer
+	unsigned GetOffloadFlags (void) const	{ return m_nOffloadFlags; }
+	/// \return Offset of the TCP/UDP header from the current start of the data
+	unsigned GetChecksumStart (void) const	{ return m_nChecksumStart - GetHeadroom (); }
+	/// \return Offset of the checksum field in the TCP/UDP header
+	unsigned GetChecksumOffset (void) const	{ return m_nChecksumOffset; }
+	/// \return Maximum payload length of the TCP segments to be sent (TSO)
+	unsigned GetSegmentSize (void) const	{ return m_nSegmentSize; }
+
+	void *operator new (size_t nSize);
+	void operator delete (void *pBlock, size_t nSize);
+
+private:
+	volatile int	 m_nRefCount;
+	u8		*m_pData;
+	unsigned	 m_nLength;
+	u64		 m_PrivateData[NET_BUFFER_PRIVATE_SIZE / sizeof (u64)];
+
+	u16		 m_nOffloadFlags;
+	u16		 m_nChecksumStart;	// from the start of m_Buffer
+	u16		 m_nChecksumOffset;
+	u16		 m_nSegmentSize;
+
+	u8		 m_Buffer[NET_BUFFER_SIZE] ALIGN (DATA_CACHE_LINE_LENGTH_MAX); // may be used for DMA
+
+	static void *s_pFreeList;
+	static CSpinLock s_SpinLock;
+};
+
+#endif
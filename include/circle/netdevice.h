@@ -2,7 +2,7 @@
 // netdevice.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,16 +21,38 @@
 #define _circle_netdevice_h
 
 #include <circle/macaddress.h>
+#include <circle/sysconfig.h>
+#include <circle/macros.h>
 #include <circle/types.h>
 
-#define FRAME_BUFFER_SIZE	1600
+#ifndef NET_JUMBO_FRAMES
+	#define FRAME_BUFFER_SIZE	1600
+	#define NET_MTU_MAX		1500
+#else
+	#define FRAME_BUFFER_SIZE	4032	// net buffer is 4 KByte then
+	#define NET_MTU_MAX		4000
+#endif
+
+#define NET_MTU_DEFAULT		1500
 
 #define MAX_NET_DEVICES		5
 
+#define MAX_MULTICAST_ADDRESSES	16		// for SetMulticastFilter()
+
+// offload capabilities of a net device, also used as per-packet flags in CNetBuffer
+#define NET_OFFLOAD_TX_CHECKSUM		BIT(0)	// TCP/UDP checksum is calculated by the device
+#define NET_OFFLOAD_TX_SEGMENTATION	BIT(1)	// TCP segments are split by the device (TSO)
+#define NET_OFFLOAD_RX_CHECKSUM		BIT(2)	// TCP/UDP checksum is verified by the device
+
+class CNetBuffer;
+
+typedef void TNetLinkChangeHandler (void *pParam);
+
 enum TNetDeviceType
 {
 	NetDeviceTypeEthernet,
 	NetDeviceTypeWLAN,
+	NetDeviceTypeLoopback,			// see: <circle/net/loopbackdevice.h>
 	NetDeviceTypeAny,
 	NetDeviceTypeUnknown
 };
@@ -49,6 +71,12 @@ enum TNetDeviceSpeed
 class CNetDevice	/// Base class (interface) of net devices
 {
 public:
+	CNetDevice (void)
+	:	m_pLinkChangeHandler (0),
+		m_pLinkChangeParam (0)
+	{
+	}
+
 	virtual ~CNetDevice (void) {}
 
 	/// \return Type of this net device
@@ -73,6 +101,64 @@ public:
 	/// \return TRUE if a frame is returned in buffer, FALSE if nothing has been received
 	virtual boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength) = 0;
 
+	/// \brief Send a valid Ethernet frame from a net buffer to the network
+	/// \param pBuffer Net buffer, the data must be cache-aligned, the caller keeps the reference
+	/// \note The default implementation calls SendFrame() with the buffer data. A driver can\n
+	///	  override this, if it can make use of the headroom of the buffer.
+	virtual boolean SendBuffer (CNetBuffer *pBuffer);
+
+	/// \brief Poll for a received Ethernet frame and place it into a net buffer
+	/// \param pBuffer Net buffer with cache-aligned data, its length is set on success
+	/// \return TRUE if a frame is returned in buffer, FALSE if nothing has been received
+	/// \note The default implementation calls ReceiveFrame() with the buffer data, so that\n
+	///	  the driver fills in the frame in place.
+	virtual boolean ReceiveBuffer (CNetBuffer *pBuffer);
+
+	/// \brief Poll for a received Ethernet frame, which is returned in a net buffer
+	/// \return Net buffer with the frame, the caller owns the reference (0 if nothing received)
+	/// \note The default implementation allocates a net buffer and calls ReceiveBuffer().\n
+	///	  A driver can override this, if its DMA writes into net buffers directly.
+	virtual CNetBuffer *ReceiveNetBuffer (void);
+
+	/// \brief Send several valid Ethernet frames from net buffers to the network
+	/// \param ppBuffer Array of net buffers, the data must be cache-aligned
+	/// \param nCount Number of net buffers in the array
+	/// \return Number of frames accepted from the start of the array
+	/// \note The caller keeps the references. The default implementation calls SendBuffer()\n
+	///	  for each frame. A driver can override this to submit several frames at once.
+	virtual unsigned SendFrames (CNetBuffer *ppBuffer[], unsigned nCount);
+
+	/// \brief Poll for several received Ethernet frames
+	/// \param ppBuffer Array, which receives the net buffers with the frames
+	/// \param nMaxCount Maximum number of frames to return (size of the array)
+	/// \return Number of frames returned (0 if nothing has been received)
+	/// \note The caller owns the references. The default implementation calls\n
+	///	  ReceiveNetBuffer() until nothing is received or the array is full.
+	virtual unsigned ReceiveFrames (CNetBuffer *ppBuffer[], unsigned nMaxCount);
+
+	/// \brief Set the multicast MAC addresses, which have to be received
+	/// \param pAddresses Array of multicast MAC addresses (broadcast is always received)
+	/// \param nCount Number of entries in the array (up to MAX_MULTICAST_ADDRESSES)
+	/// \return FALSE if not supported
+	/// \note A driver can use a perfect or hash filter, or receive all multicast frames,\n
+	///	  if its filter is too small, the frames are filtered in software again.\n
+	///	  This is called from the net task only.
+	virtual boolean SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount)
+							{ return FALSE; }
+
+	/// \brief Set the maximum transmission unit (size of the IP packet in a frame)
+	/// \param nMTU MTU in bytes (up to NET_MTU_MAX)
+	/// \return FALSE if this MTU is not supported by the device
+	/// \note The default implementation supports the standard Ethernet MTU only.
+	virtual boolean SetMTU (unsigned nMTU)		{ return nMTU <= NET_MTU_DEFAULT; }
+
+	/// \return NET_OFFLOAD_* flags, which are supported by this device
+	/// \note The TX offloads are requested per frame with CNetBuffer::SetOffload() and\n
+	///	  are performed in SendBuffer() and SendFrames() only. A driver, which reports\n
+	///	  NET_OFFLOAD_RX_CHECKSUM, sets this flag in received net buffers with a valid\n
+	///	  TCP/UDP checksum.
+	virtual unsigned GetOffloadCapabilities (void)	{ return 0; }
+
 	/// \return TRUE if PHY link is up
 	virtual boolean IsLinkUp (void)			{ return TRUE; }
 
@@ -81,9 +167,19 @@ public:
 
 	/// \brief Update device settings according to PHY status
 	/// \return FALSE if not supported
-	/// \note This is called continuously every 2 seconds by the net PHY task
+	/// \note This is called by the net PHY task after a link change has been notified,\n
+	///	  and periodically (every 2 seconds without link change interrupt).
 	virtual boolean UpdatePHY (void)		{ return FALSE; }
 
+	/// \return TRUE if the driver notifies link changes, so that the PHY polling can be rare
+	virtual boolean HasLinkInterrupt (void)		{ return FALSE; }
+
+	/// \brief Register a handler, which is called on a link change interrupt
+	/// \param pHandler Pointer to the handler (0 to unregister)
+	/// \param pParam Parameter to be handed over to the handler
+	/// \note The handler is called from interrupt context and must not access the device.
+	void RegisterLinkChangeHandler (TNetLinkChangeHandler *pHandler, void *pParam = 0);
+
 	/// \param Speed A value returned by GetLinkSpeed()
 	/// \return Description for this speed value
 	static const char *GetSpeedString (TNetDeviceSpeed Speed);
@@ -94,12 +190,20 @@ public:
 
 	/// \param Type Specific net device type to search for (or NetDeviceTypeAny)
 	/// \return Pointer to the first device object of this type
+	/// \note NetDeviceTypeAny does not return a loopback device.
 	static CNetDevice *GetNetDevice (TNetDeviceType Type);
 
 protected:
 	void AddNetDevice (void);
 
+	/// \brief To be called by the driver, when the PHY link status may have changed
+	/// \note Can be called from interrupt context.
+	void NotifyLinkChange (void);
+
 private:
+	TNetLinkChangeHandler *m_pLinkChangeHandler;
+	void *m_pLinkChangeParam;
+
 	static unsigned s_nDeviceNumber;
 	static CNetDevice *s_pDevice[MAX_NET_DEVICES];
 
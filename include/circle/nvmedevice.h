@@ -0,0 +1,212 @@
+//
+/// \file nvmedevice.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_nvmedevice_h
+#define _circle_nvmedevice_h
+
+#if RASPPI >= 4
+
+#include <circle/device.h>
+#include <circle/blockrequest.h>
+#include <circle/bcmpciehostbridge.h>
+#include <circle/fs/partitionmanager.h>
+#include <circle/interrupt.h>
+#include <circle/macros.h>
+#include <circle/spinlock.h>
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+
+#define NVME_PCI_CLASS_CODE	0x010802
+#define NVME_PCIE_SLOT		0
+#define NVME_PCIE_FUNC		0
+
+#define NVME_BLOCK_SIZE		512
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	#define NVME_IO_QUEUES	CORES		///< One I/O queue pair per core
+#else
+	#define NVME_IO_QUEUES	1
+#endif
+#define NVME_QUEUE_ENTRIES	64		///< Entries of each queue (one page)
+#define NVME_MAX_REQUESTS	8		///< Outstanding commands per queue
+
+#define NVME_MAX_TRANSFER	0x20000		///< Max. bytes per command (before MDTS)
+
+/// \note The controller is accessed via the PCIe host bridge, which is not available to the
+///	  xHCI driver at the same time (e.g. on the Compute Module 4, where the USB is
+///	  controlled by the DWHCI driver). The queues are allocated from the coherent memory
+///	  region of the xHCI driver for that reason.
+/// \note Each core submits its commands to an own I/O queue pair, so that the cores do not
+///	  contend for a lock. The completions are signaled using MSI (one vector per
+///	  completion queue, if the device provides enough of them). Transfers, which cover
+///	  more than two memory pages, are described with a PRP list.
+/// \note Only the namespace 1 with a LBA data size of 512 bytes is supported. The device
+///	  is registered as "nvme1" in the device name service (partitions as "nvme1-N").
+
+class CNVMeDevice : public CDevice	/// Driver for NVMe SSDs on the PCIe bus of the Raspberry Pi 4
+{
+public:
+	CNVMeDevice (CInterruptSystem *pInterruptSystem);
+	~CNVMeDevice (void);
+
+	boolean Initialize (void);
+
+	/// \brief Read from the current offset (see Seek())
+	int Read (void *pBuffer, size_t nCount);
+	/// \brief Write to the current offset (see Seek())
+	int Write (const void *pBuffer, size_t nCount);
+
+	u64 Seek (u64 ullOffset);
+
+	u64 GetSize (void) const;
+
+	/// \brief Read blocks independent of the current offset
+	/// \param ullBlock Logical block address
+	/// \param pBuffer Buffer (should be cache-line aligned, is bounced if not 4-byte aligned)
+	/// \param nBlocks Number of blocks of NVME_BLOCK_SIZE
+	/// \return Number of read bytes or < 0 on failure
+	/// \note Can be called from multiple cores at the same time.
+	int ReadBlocks (u64 ullBlock, void *pBuffer, unsigned nBlocks);
+	/// \brief Write blocks independent of the current offset
+	int WriteBlocks (u64 ullBlock, const void *pBuffer, unsigned nBlocks);
+
+	/// \brief Commit the volatile write cache of the device to the media
+	boolean FlushCache (void);
+
+	/// \brief Queue an asynchronous request
+	/// \note The completion routine is called from interrupt context, if the request could be
+	///	  queued to the device. It is processed synchronously otherwise.
+	boolean SubmitRequest (CBlockRequest *pRequest);
+
+private:
+	struct TNVMeCommand
+	{
+		u32	CDW0;
+		u32	NSID;
+		u32	Reserved[2];
+		u64	MPTR;
+		u64	PRP1;
+		u64	PRP2;
+		u32	CDW10;
+		u32	CDW11;
+		u32	CDW12;
+		u32	CDW13;
+		u32	CDW14;
+		u32	CDW15;
+	}
+	PACKED;
+
+	struct TNVMeCompletion
+	{
+		u32	DW0;
+		u32	DW1;
+		u16	SQHead;
+		u16	SQID;
+		u16	CID;
+		u16	Status;			// bit 0: phase tag
+	}
+	PACKED;
+
+	struct TRequest
+	{
+		volatile boolean bInUse;	// protected by the queue lock
+		volatile boolean bDone;
+		boolean bAbandoned;		// timed out, slot is freed on completion
+		u16	usStatus;
+		u32	nResult;
+		CBlockRequest *pBlockRequest;	// asynchronous request or 0
+		u64	*pPage;			// PRP list or bounce buffer
+		void	*pCopyBack;		// read via bounce buffer to here
+		size_t	nCopyLength;
+	};
+
+	struct TQueue
+	{
+		unsigned		 nID;
+		unsigned		 nVector;
+		TNVMeCommand		*pSQ;
+		volatile TNVMeCompletion *pCQ;
+		unsigned		 nSQTail;
+		unsigned		 nCQHead;
+		u16			 usPhase;
+		uintptr			 nSQDoorbell;
+		uintptr			 nCQDoorbell;
+		TRequest		 Request[NVME_MAX_REQUESTS];
+		CSpinLock		 SpinLock;
+	};
+
+	boolean InitQueue (TQueue *pQueue, unsigned nID);
+	boolean CreateIOQueue (TQueue *pQueue);
+
+	// returns slot index or -1 if all slots are in use
+	int Submit (TQueue *pQueue, TNVMeCommand *pCommand,
+		    const void *pBuffer, size_t nLength, CBlockRequest *pBlockRequest = 0);
+	// returns the status code (0 on success, < 0 on timeout)
+	int Wait (TQueue *pQueue, int nSlot, u32 *pResult = 0);
+	int Execute (TQueue *pQueue, TNVMeCommand *pCommand,
+		     const void *pBuffer = 0, size_t nLength = 0, u32 *pResult = 0);
+
+	int Transfer (boolean bWrite, u64 ullBlock, void *pBuffer, unsigned nBlocks);
+	int TransferChunk (TQueue *pQueue, boolean bWrite, u64 ullBlock,
+			   void *pBuffer, unsigned nBlocks);
+	static void SetupRW (TNVMeCommand *pCommand, boolean bWrite, u64 ullBlock,
+			     unsigned nBlocks);
+
+	void ProcessCompletions (TQueue *pQueue);
+
+	TQueue *GetIOQueue (void);
+
+	uintptr AllocatePage (void);
+
+	boolean WaitReady (boolean bReady);
+
+	u32 ReadReg (unsigned nOffset) const;
+	void WriteReg (unsigned nOffset, u32 nValue);
+
+	static void MSIHandler (unsigned nVector, void *pParam);
+
+private:
+	CInterruptSystem *m_pInterruptSystem;
+	CBcmPCIeHostBridge m_PCIeHostBridge;
+
+	uintptr m_nBase;
+	unsigned m_nDoorbellStride;
+	unsigned m_nTimeoutMs;
+
+	uintptr m_nNextPage;
+	uintptr m_nEndPage;
+
+	boolean m_bMSI;
+
+	TQueue m_AdminQueue;
+	TQueue m_IOQueue[NVME_IO_QUEUES];
+	unsigned m_nIOQueues;
+
+	unsigned m_nMaxBlocks;			// per command
+	u64 m_ullBlockCount;
+	u64 m_ullOffset;
+
+	boolean m_bVolatileWriteCache;
+
+	CPartitionManager *m_pPartitionManager;
+};
+
+#endif
+
+#endif
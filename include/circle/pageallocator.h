@@ -2,7 +2,7 @@
 // pageallocator.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -27,32 +27,51 @@
 
 //#define PAGE_DEBUG
 
+#define PAGE_MAX_ORDER		10			// largest block has 2^10 pages
+#define PAGE_MAX_PAGES		(PAGE_RESERVE / PAGE_SIZE)
+
+#ifdef ARM_ALLOW_MULTI_CORE
+#define PAGE_CORE_CACHE_SIZE	8			// single pages cached per core
+#endif
+
 struct TFreePage
 {
 	u32		 nMagic;
 #define FREEPAGE_MAGIC	0x50474D43
 	TFreePage	*pNext;
+	TFreePage	*pPrev;
 };
 
-class CPageAllocator	/// Allocates aligned pages from a flat memory region
+/// \note This is a buddy allocator. A block of 2^n pages is aligned to its size, so that it
+///	  does not cross an address boundary, which is a multiple of its size. Freed blocks
+///	  are merged with their free buddy block.
+
+class CPageAllocator	/// Allocates aligned pages and contiguous page ranges from a flat memory region
 {
 public:
 	CPageAllocator (void);
 	~CPageAllocator (void);
 
 	/// \param nBase Base address of memory region
-	/// \param nSize Size of memory region
+	/// \param nSize Size of memory region (max. PAGE_RESERVE)
 	void Setup (uintptr nBase, size_t nSize) NOOPT;
 
 	/// \return Free space of the memory region, which is not allocated by pages
-	/// \note Unused pages on the free list do not count here.
 	size_t GetFreeSpace (void) const;
 
 	/// \return Pointer to a page with a size of PAGE_SIZE
 	/// \note Resulting page is always aligned to PAGE_SIZE
 	void *Allocate (void);
 
-	/// \param pPage Memory page to be freed
+	/// \brief Allocate physically contiguous pages
+	/// \param nSize Size of the range in bytes (is rounded up to 2^n pages)
+	/// \param nAlign Required alignment in bytes (power of 2, 0 for PAGE_SIZE)
+	/// \param nBoundary Range must not cross a multiple of this (power of 2, 0 for none)
+	/// \return Pointer to the range, 0 if not available
+	/// \note The range is aligned to its (rounded) size at least.
+	void *AllocateContiguous (size_t nSize, size_t nAlign = 0, size_t nBoundary = 0);
+
+	/// \param pPage Memory page or range to be freed
 	void Free (void *pPage);
 
 #ifdef PAGE_DEBUG
@@ -60,13 +79,48 @@ public:
 #endif
 
 private:
-	u8		*m_pNext;
+	void *AllocateBlock (unsigned nOrder);
+	void FreeBlock (u8 *pBlock, unsigned nOrder);
+
+	void InsertFree (u8 *pBlock, unsigned nOrder);
+	void RemoveFree (u8 *pBlock, unsigned nOrder);
+
+	unsigned GetIndex (const void *pPage) const
+	{
+		return ((const u8 *) pPage - m_pBase) / PAGE_SIZE;
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	void FlushCoreCache (void);
+#endif
+
+private:
+	u8		*m_pBase;
 	u8		*m_pLimit;
+	unsigned	 m_nFreePages;
 #ifdef PAGE_DEBUG
 	unsigned	 m_nCount;
 	unsigned	 m_nMaxCount;
 #endif
-	TFreePage	*m_pFreeList;
+	TFreePage	*m_pFreeList[PAGE_MAX_ORDER+1];
+
+	// per page: order of the block, which starts here, and the free flag
+	u8		 m_PageInfo[PAGE_MAX_PAGES];
+#define PAGE_INFO_FREE		0x80
+#define PAGE_INFO_ORDER_MASK	0x0F
+#define PAGE_INFO_NONE		0x7F			// not the first page of a block
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	struct TCoreCache
+	{
+		void		*pPage[PAGE_CORE_CACHE_SIZE];
+		unsigned	 nCount;
+	}
+	ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+	TCoreCache	 m_CoreCache[CORES];
+#endif
+
 	CSpinLock	 m_SpinLock;
 };
 
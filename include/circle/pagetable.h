@@ -42,6 +42,7 @@ private:
 #define ATTRINDX_NORMAL		0
 #define ATTRINDX_DEVICE		1
 #define ATTRINDX_COHERENT	2
+#define ATTRINDX_UNCACHED	3
 
 class CPageTable		// with LPAE
 {
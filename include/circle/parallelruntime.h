@@ -0,0 +1,195 @@
+//
+// parallelruntime.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_parallelruntime_h
+#define _circle_parallelruntime_h
+
+#include <circle/sysconfig.h>
+
+#ifdef ARM_ALLOW_MULTI_CORE
+
+#include <circle/multicore.h>
+#include <circle/memory.h>
+#include <circle/synchronize.h>
+#include <circle/macros.h>
+#include <circle/types.h>
+#include <assert.h>
+
+#ifndef PARALLEL_DEQUE_SIZE
+#define PARALLEL_DEQUE_SIZE	256		// jobs per core, must be a power of 2
+#endif
+
+/// \note Jobs are queued in a lock-free deque per core. A core executes the jobs of its own
+///	  deque in LIFO order and steals jobs from the other deques in FIFO order, if its deque
+///	  is empty. Idle cores wait with WFE and are woken with SEV, when a job is submitted.
+/// \note Jobs must be submitted in task context (not from an interrupt handler). A job is
+///	  executed inline immediately, if the deque of the submitting core is full.
+
+typedef void TJobFunction (void *pParam);
+typedef void TParallelForFunction (unsigned nBegin, unsigned nEnd, void *pParam);
+
+class CJobGroup		/// Completion barrier for a number of jobs
+{
+public:
+	CJobGroup (void)
+	:	m_nPending (0)
+	{
+	}
+
+	~CJobGroup (void)
+	{
+		assert (m_nPending == 0);
+	}
+
+	/// \return Have all jobs of this group been completed?
+	boolean IsComplete (void) const
+	{
+		return __atomic_load_n (&m_nPending, __ATOMIC_ACQUIRE) == 0;
+	}
+
+	/// \brief Waits until all jobs of this group have been completed
+	/// \note Executes other jobs while waiting
+	void Wait (void);
+
+private:
+	volatile int m_nPending;
+
+	friend class CParallelRuntime;
+};
+
+template <class T>
+class CFuture : public CJobGroup	/// Result of a function, which is executed asynchronously
+{
+public:
+	typedef T TFunction (void *pParam);
+
+	/// \param pFunction Function to be called on any core
+	/// \param pParam User parameter handed over to the function
+	void Start (TFunction *pFunction, void *pParam);
+
+	/// \return Result of the function (waits for completion)
+	T &Get (void)
+	{
+		Wait ();
+
+		return m_Result;
+	}
+
+private:
+	static void JobStub (void *pParam)
+	{
+		CFuture<T> *pThis = (CFuture<T> *) pParam;
+		assert (pThis != 0);
+
+		pThis->m_Result = (*pThis->m_pFunction) (pThis->m_pParam);
+	}
+
+private:
+	TFunction *m_pFunction;
+	void *m_pParam;
+	T m_Result;
+};
+
+class CParallelRuntime : public CMultiCoreSupport	/// Work-stealing job runtime on all cores
+{
+public:
+	CParallelRuntime (CMemorySystem *pMemorySystem);
+	~CParallelRuntime (void);
+
+	/// \brief Executes jobs on the secondary cores (returns immediately on core 0)
+	/// \note Call this from an overwritten Run() method for the cores, which should execute jobs.
+	void Run (unsigned nCore);
+
+	/// \param pFunction Job function to be called on any core
+	/// \param pParam User parameter handed over to the function
+	/// \param pGroup Group, the job belongs to (0 for none)
+	void Submit (TJobFunction *pFunction, void *pParam, CJobGroup *pGroup = 0);
+
+	/// \brief Calls pFunction for sub-ranges of [nBegin, nEnd) in parallel and waits for completion
+	/// \param nBegin First index
+	/// \param nEnd Last index + 1
+	/// \param nGrain Maximum number of indices handed over in one call (> 0)
+	/// \param pFunction Function to be called with a sub-range [nBegin, nEnd)
+	/// \param pParam User parameter handed over to the function
+	/// \note Ranges are split in halves on demand, so that idle cores can steal large parts.
+	void ParallelFor (unsigned nBegin, unsigned nEnd, unsigned nGrain,
+			  TParallelForFunction *pFunction, void *pParam);
+
+	/// \brief Waits until all jobs of a group have been completed, executes jobs meanwhile
+	void Wait (CJobGroup *pGroup);
+
+	static CParallelRuntime *Get (void);
+
+private:
+	struct TJob
+	{
+		TJobFunction		*pFunction;
+		TParallelForFunction	*pForFunction;	// used instead of pFunction, if != 0
+		void			*pParam;
+		CJobGroup		*pGroup;
+		unsigned		 nBegin;
+		unsigned		 nEnd;
+		unsigned		 nGrain;
+	};
+
+	void Enqueue (const TJob &rJob);
+	boolean ExecuteOne (unsigned nCore);		// returns FALSE if no job was available
+	void Execute (TJob *pJob, unsigned nCore);
+
+	class CJobDeque		// Chase-Lev deque with fixed size
+	{
+	public:
+		CJobDeque (void)
+		:	m_nTop (0),
+			m_nBottom (0)
+		{
+		}
+
+		boolean Push (const TJob &rJob);	// owner only, returns FALSE if full
+		boolean Pop (TJob *pJob);		// owner only
+		boolean Steal (TJob *pJob);		// any core
+
+	private:
+		volatile int m_nTop ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+		volatile int m_nBottom ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+		TJob m_Job[PARALLEL_DEQUE_SIZE];
+	};
+
+private:
+	CJobDeque m_Deque[CORES];
+
+	static CParallelRuntime *s_pThis;
+};
+
+template <class T>
+void CFuture<T>::Start (TFunction *pFunction, void *pParam)
+{
+	assert (IsComplete ());
+
+	m_pFunction = pFunction;
+	assert (m_pFunction != 0);
+	m_pParam = pParam;
+
+	CParallelRuntime::Get ()->Submit (JobStub, this, this);
+}
+
+#endif
+
+#endif
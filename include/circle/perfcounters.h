@@ -0,0 +1,105 @@
+//
+/// \file perfcounters.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_perfcounters_h
+#define _circle_perfcounters_h
+
+#include <circle/types.h>
+
+/// \brief Common architectural PMU events (ARMv7 PMUv2 / ARMv8 PMUv3)
+enum TPerfEvent
+{
+	PerfEventL1ICacheRefill		= 0x01,
+	PerfEventL1DCacheRefill		= 0x03,
+	PerfEventL1DCacheAccess		= 0x04,
+	PerfEventInstructionsRetired	= 0x08,
+	PerfEventExceptionTaken		= 0x09,
+	PerfEventBranchMispredicted	= 0x10,
+	PerfEventCPUCycles		= 0x11,
+	PerfEventBranchPredicted	= 0x12,
+	PerfEventMemoryAccess		= 0x13,
+	PerfEventL2CacheAccess		= 0x16,
+	PerfEventL2CacheRefill		= 0x17,
+	PerfEventBusAccess		= 0x19,
+	PerfEventStallFrontend		= 0x23,		// not on all CPUs
+	PerfEventStallBackend		= 0x24		// not on all CPUs
+};
+
+typedef void TPerfOverflowHandler (void *pParam);
+
+/// \note The performance monitor unit (PMU) is banked per core. An instance of this class\n
+///	  must be created and used on the core, which is to be measured. Only one instance\n
+///	  per core is allowed.
+/// \note Not supported on the Raspberry Pi 1 and Zero, all counts are 0 there.
+
+class CPerfCounters	/// Hardware performance counters of the ARM PMU
+{
+public:
+	CPerfCounters (void);
+	~CPerfCounters (void);
+
+	/// \return Number of implemented event counters (without the cycle counter)
+	static unsigned GetEventCounters (void);
+
+	/// \param Event Event to be checked
+	/// \return Is this event implemented by the CPU?
+	static boolean IsEventSupported (TPerfEvent Event);
+
+	/// \brief Assign an event to an event counter
+	/// \param nCounter Event counter (0..GetEventCounters()-1)
+	/// \param Event Event to be counted
+	/// \return Operation successful?
+	boolean SetEvent (unsigned nCounter, TPerfEvent Event);
+
+	/// \brief Reset and start the cycle counter and all assigned event counters
+	void Start (void);
+	/// \brief Stop counting, the counts remain readable
+	void Stop (void);
+
+	/// \return Number of CPU cycles since Start()
+	/// \note The cycle counter is 32-bit wide on AArch32 and overflows after some seconds.
+	u64 GetCycles (void) const;
+	/// \param nCounter Event counter (0..GetEventCounters()-1)
+	/// \return Number of events since Start()
+	u32 GetCount (unsigned nCounter) const;
+
+	/// \brief Call a handler on this core every nPeriod CPU cycles, while the counters run
+	/// \param nPeriod Period in CPU cycles
+	/// \param pHandler Called from IRQ context, IRQReturnAddressOfCore[] is valid there
+	/// \param pParam Parameter handed over to pHandler
+	/// \return Operation successful?
+	/// \note Uses the last event counter, which cannot be assigned with SetEvent() then.
+	/// \note Supported on all cores on the Raspberry Pi 4, only on core 0 otherwise.
+	boolean ConnectOverflowHandler (u32 nPeriod, TPerfOverflowHandler *pHandler, void *pParam = 0);
+	void DisconnectOverflowHandler (void);
+
+private:
+	static void InterruptHandler (void *pParam);
+
+private:
+	unsigned m_nEventCounters;
+
+	TPerfOverflowHandler *m_pOverflowHandler;
+	void *m_pOverflowParam;
+	u32 m_nOverflowPeriod;
+	unsigned m_nOverflowCounter;
+	unsigned m_nIRQ;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // pwmoutput.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,9 +21,18 @@
 #define _circle_pwmoutput_h
 
 #include <circle/gpioclock.h>
+#include <circle/dmasoundbuffers.h>
+#include <circle/interrupt.h>
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
+#define PWM_FIFO_CHUNK_SIZE	1024		// default, number of samples per DMA buffer
+
+// called from interrupt context, when a chunk of samples (duty values 0..Range) is needed,
+// with both channels in FIFO mode the samples are interleaved (channel 1, channel 2, ...),
+// returns the number of samples written to pBuffer (0 to stop output)
+typedef unsigned TPWMFIFOHandler (u32 *pBuffer, unsigned nChunkSize, void *pParam);
+
 class CPWMOutput
 {
 public:
@@ -40,6 +49,22 @@ public:
 #define PWM_CHANNEL2	2
 	void Write (unsigned nChannel, unsigned nValue);	// nValue: 0..Range
 
+	// waveform mode: alternatively to Start() the output is fed by DMA through the FIFO
+	// from a ring of two buffers, which are refilled by calling pHandler; use Stop() as usual,
+	// the output starts with one chunk of zero duty values
+	boolean StartFIFO (CInterruptSystem *pInterruptSystem,
+			   TPWMFIFOHandler  *pHandler,
+			   void		    *pParam	   = 0,
+			   unsigned	     nChunkSize	   = PWM_FIFO_CHUNK_SIZE,
+			   boolean	     bBothChannels = TRUE);	// FALSE for channel 1 only
+
+	// returns TRUE while the FIFO is fed (FALSE after the handler returned 0)
+	boolean IsFIFOActive (void) const;
+
+private:
+	static unsigned FIFOHandlerStub (boolean bStatus, u32 *pBuffer, unsigned nChunkSize,
+					 void *pParam);
+
 private:
 	CGPIOClock m_Clock;
 	unsigned   m_nDivider;
@@ -47,6 +72,10 @@ private:
 	boolean    m_bMSMode;
 	boolean    m_bActive;
 	CSpinLock  m_SpinLock;
+
+	CDMASoundBuffers *m_pFIFOBuffers;		// 0 if not in waveform mode
+	TPWMFIFOHandler  *m_pFIFOHandler;
+	void		 *m_pFIFOParam;
 };
 
 #endif
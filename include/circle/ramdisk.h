@@ -0,0 +1,74 @@
+//
+// ramdisk.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_ramdisk_h
+#define _circle_ramdisk_h
+
+#include <circle/device.h>
+#include <circle/memory.h>
+#include <circle/types.h>
+
+#define RAMDISK_BLOCK_SIZE	512
+#define RAMDISK_CHUNK_SIZE	0x10000		// memory is allocated in chunks of this size
+
+// Block device in RAM, which is registered as "ramN" and can be mounted by CFATFileSystem
+// or FatFs, after it has been formatted. The memory is allocated from the heap in chunks on
+// the first write to a chunk, chunks which have never been written with non-zero data, are
+// read as zeros and occupy no memory.
+
+class CRAMDiskDevice : public CDevice
+{
+public:
+	// ullSize: size of the disk in bytes (is rounded up to a multiple of RAMDISK_CHUNK_SIZE)
+	// nHeapType: HEAP_LOW, HEAP_HIGH or HEAP_ANY, where to allocate the chunks from
+	CRAMDiskDevice (u64 ullSize, unsigned nIndex = 1, int nHeapType = HEAP_ANY);
+	~CRAMDiskDevice (void);
+
+	// returns FALSE, if not enough memory for the chunk table
+	boolean Initialize (void);
+
+	int Read (void *pBuffer, size_t nCount);
+
+	int Write (const void *pBuffer, size_t nCount);
+
+	u64 Seek (u64 ullOffset);
+
+	u64 GetSize (void) const;
+
+	// returns the number of bytes of memory currently in use for data
+	u64 GetAllocatedSize (void) const;
+
+private:
+	u8 *AllocateChunk (unsigned nChunk);
+
+	static boolean IsZero (const void *pBuffer, size_t nCount);
+
+private:
+	u64 m_ullSize;
+	unsigned m_nIndex;
+	int m_nHeapType;
+
+	unsigned m_nChunks;
+	u8 **m_ppChunk;
+	unsigned m_nAllocatedChunks;
+
+	u64 m_ullOffset;
+};
+
+#endif
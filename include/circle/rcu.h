@@ -0,0 +1,82 @@
+//
+/// \file rcu.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_rcu_h
+#define _circle_rcu_h
+
+#include <circle/memorymap.h>
+#include <circle/synchronize.h>
+#include <circle/sysconfig.h>
+#include <circle/macros.h>
+#include <circle/types.h>
+
+/// \note Read-copy-update with epochs: A writer does not modify shared data in place, but
+///	  publishes a modified copy with Assign() and frees the old version after Synchronize()
+///	  returned. The readers enter a read section with ReadLock(), which only writes to a
+///	  per-core slot, and access the data with Dereference().
+/// \note A read section must be short and must not block (no scheduler calls, no waiting for
+///	  events). Read sections can be nested and can be entered from IRQ context. Synchronize()
+///	  must be called from TASK_LEVEL outside of a read section.
+/// \note Without ARM_ALLOW_MULTI_CORE a read section cannot overlap with Synchronize(), which
+///	  is called from TASK_LEVEL, so that all methods are (nearly) empty then.
+
+class CRCU	/// Epoch-based read-copy-update for data, which is read much more often than written
+{
+public:
+	/// \brief Enter a read section on this core
+	static void ReadLock (void);
+	/// \brief Leave the read section
+	static void ReadUnlock (void);
+
+	/// \brief Wait until all read sections, which have been entered before, have been left
+	static void Synchronize (void);
+
+	/// \brief Publish a new version of the data
+	/// \param ppPointer Shared pointer to the data
+	/// \param pNew New version (completely initialized)
+	template <typename T>
+	static void Assign (T **ppPointer, T *pNew)
+	{
+		__atomic_store_n (ppPointer, pNew, __ATOMIC_RELEASE);
+	}
+
+	/// \param ppPointer Shared pointer to the data
+	/// \return Current version of the data (valid until ReadUnlock())
+	template <typename T>
+	static T *Dereference (T * const *ppPointer)
+	{
+		return __atomic_load_n (ppPointer, __ATOMIC_ACQUIRE);
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+private:
+	struct TReader
+	{
+		unsigned	 nNesting;
+		volatile u32	 nEpoch;		// 0 if outside of a read section
+	}
+	ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+	static TReader s_Reader[CORES];
+
+	static volatile u32 s_nEpoch;
+#endif
+};
+
+#endif
@@ -0,0 +1,73 @@
+//
+/// \file blockrequestqueue.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_sched_blockrequestqueue_h
+#define _circle_sched_blockrequestqueue_h
+
+#include <circle/sched/task.h>
+#include <circle/sched/synchronizationevent.h>
+#include <circle/blockrequest.h>
+#include <circle/device.h>
+#include <circle/spinlock.h>
+#include <circle/types.h>
+
+#ifndef BLOCK_QUEUE_MAX_MERGE
+#define BLOCK_QUEUE_MAX_MERGE	0x20000		///< max. bytes per merged transfer
+#endif
+
+class CBlockRequestQueue : public CTask	/// Processes asynchronous requests for a synchronous block device
+{
+public:
+	/// \param pDevice The requests are processed with pDevice->Seek() and Read() or Write()
+	/// \param pName Task name
+	CBlockRequestQueue (CDevice *pDevice, const char *pName = "blkqueue");
+
+	~CBlockRequestQueue (void);
+
+	/// \brief Queue a request and return immediately
+	/// \param pRequest The request, which is accessed until its completion routine is called
+	/// \return FALSE, if the queue has been stopped
+	/// \note The requests are sorted by offset and processed in one direction (elevator),\n
+	///	  adjacent requests, which continue each other on the disk and in memory,\n
+	///	  are merged into one transfer. The order of overlapping requests is not defined.
+	/// \note The completion routine is called from the queue task.
+	boolean Submit (CBlockRequest *pRequest);
+
+	/// \brief Fail all queued requests, terminate the queue task and wait for it
+	/// \note The object is deleted by the scheduler afterwards.
+	void Stop (void);
+
+	void Run (void);
+
+private:
+	CBlockRequest *TakeNext (void);		// m_SpinLock must be acquired
+	void Process (CBlockRequest *pRequests);
+
+private:
+	CDevice *m_pDevice;
+
+	CBlockRequest *m_pList;			// sorted by offset
+	u64 m_ullPosition;			// end of the last transfer
+	volatile boolean m_bStop;
+
+	CSynchronizationEvent m_Event;
+	CSpinLock m_SpinLock;
+};
+
+#endif
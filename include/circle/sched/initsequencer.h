@@ -0,0 +1,114 @@
+//
+/// \file initsequencer.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_sched_initsequencer_h
+#define _circle_sched_initsequencer_h
+
+#include <circle/sched/synchronizationevent.h>
+#include <circle/spinlock.h>
+#include <circle/types.h>
+
+#define INIT_MAX_STEPS		32
+#define INIT_ALL_STEPS		0xFFFFFFFFU
+
+/// \param pParam User parameter given to AddStep()
+/// \return Operation successful?
+typedef boolean TInitStepHandler (void *pParam);
+
+/// \note Each step runs in its own task, as soon as all steps, it depends on, have\n
+///	  completed successfully. Steps, which wait for hardware (e.g. DHCP, USB device\n
+///	  enumeration), let other steps run meanwhile, if they use the scheduler for\n
+///	  waiting (see NO_BUSY_WAIT). With ARM_ALLOW_MULTI_CORE a step can be assigned to\n
+///	  a secondary core, which must run the scheduler then.
+/// \note Steps, which are not needed for the first output of the application (e.g. USB\n
+///	  and network), can be deferred by starting them with Start() from the main loop\n
+///	  and polling IsComplete() there.
+/// \note The end of each step is recorded with CBootTrace::Mark().
+
+class CInitSequencer	/// Runs initialization steps concurrently, respecting their dependencies
+{
+public:
+	CInitSequencer (void);
+	~CInitSequencer (void);
+
+	/// \brief Adds an initialization step
+	/// \param pName Name of the step (must remain valid, normally a string literal)
+	/// \param pHandler Function, which performs the initialization
+	/// \param pParam User parameter handed over to the handler
+	/// \param nDependsOn Bit mask of the steps, which must have completed before
+	/// \return Bit mask of this step (to be used for nDependsOn and nSteps)
+	u32 AddStep (const char *pName, TInitStepHandler *pHandler, void *pParam = 0,
+		     u32 nDependsOn = 0);
+
+	/// \param nStep Bit mask of the step (returned from AddStep())
+	/// \param nCoreMask Cores, on which the step may run (see CTask::SetAffinity())
+	/// \note Must be called before the step is started.
+	void SetAffinity (u32 nStep, unsigned nCoreMask);
+
+	/// \brief Starts steps and the steps, they depend on, and returns immediately
+	/// \param nSteps Bit mask of the steps to be started
+	/// \note Steps, which have been started already, are ignored.
+	void Start (u32 nSteps = INIT_ALL_STEPS);
+
+	/// \brief Waits until the given steps have completed
+	/// \param nSteps Bit mask of the steps to be waited for (must have been started)
+	/// \return Have all these steps been successful?
+	boolean Wait (u32 nSteps = INIT_ALL_STEPS);
+
+	/// \brief Starts steps and waits for their completion
+	/// \param nSteps Bit mask of the steps to be run
+	/// \return Have all these steps been successful?
+	boolean Run (u32 nSteps = INIT_ALL_STEPS)	{ Start (nSteps); return Wait (nSteps); }
+
+	/// \param nSteps Bit mask of steps
+	/// \return Have all these steps completed (successfully or not)?
+	boolean IsComplete (u32 nSteps = INIT_ALL_STEPS) const;
+
+	/// \return Bit mask of the steps, which have failed or were not run,\n
+	///	    because a step, they depend on, has failed
+	u32 GetFailedSteps (void) const		{ return m_nFailed; }
+
+private:
+	void RunStep (unsigned nIndex);			// called from the step task
+	void CompleteStep (unsigned nIndex, boolean bOK);
+	friend class CInitStepTask;
+
+private:
+	struct TStep
+	{
+		const char	 *pName;
+		TInitStepHandler *pHandler;
+		void		 *pParam;
+		u32		  nDependsOn;
+		unsigned	  nAffinity;
+	};
+
+	TStep m_Step[INIT_MAX_STEPS];
+	unsigned m_nSteps;
+	u32 m_nAllSteps;
+
+	u32 m_nStarted;
+	volatile u32 m_nCompleted;
+	volatile u32 m_nFailed;
+
+	CSynchronizationEvent m_Event;		// set, when a step has completed
+	CSpinLock m_SpinLock;
+};
+
+#endif
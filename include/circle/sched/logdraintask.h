@@ -0,0 +1,49 @@
+//
+/// \file logdraintask.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_sched_logdraintask_h
+#define _circle_sched_logdraintask_h
+
+#include <circle/sched/task.h>
+#include <circle/types.h>
+
+#define LOG_DRAIN_INTERVAL_MS	10
+
+class CLogDrainTask : public CTask	/// Writes the messages of CLogger in deferred mode to the target
+{
+public:
+	/// \param nIntervalMs Sleep time, when no messages are queued
+	/// \note Enables the deferred mode of CLogger. The task runs with TASK_PRIORITY_LOW.
+	CLogDrainTask (unsigned nIntervalMs = LOG_DRAIN_INTERVAL_MS);
+
+	~CLogDrainTask (void);
+
+	/// \brief Write the remaining messages, terminate the task and wait for it
+	/// \note The object is deleted by the scheduler afterwards. Messages, which are\n
+	///	  written later, remain queued until CLogger::FlushDeferred() is called.
+	void Stop (void);
+
+	void Run (void);
+
+private:
+	unsigned m_nIntervalMs;
+	volatile boolean m_bStop;
+};
+
+#endif
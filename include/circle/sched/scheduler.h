@@ -2,7 +2,7 @@
 /// \file scheduler.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,14 +21,43 @@
 #define _circle_sched_scheduler_h
 
 #include <circle/sched/task.h>
+#include <circle/timerwheel.h>
+#include <circle/histogram.h>
 #include <circle/spinlock.h>
 #include <circle/device.h>
 #include <circle/sysconfig.h>
 #include <circle/types.h>
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	#include <circle/multicore.h>
+
+	#define SCHED_CORES	CORES
+#else
+	#define SCHED_CORES	1
+#endif
+
 typedef void TSchedulerTaskHandler (CTask *pTask);
 
-/// \note This scheduler uses the round-robin policy, without priorities.
+struct TSchedulerReadyQueue		// ready tasks of one core
+{
+	u32	 nBitmap;			// bit n set: list of priority n is not empty
+	CTask	*pHead[TASK_PRIORITY_MAX+1];
+	CTask	*pTail[TASK_PRIORITY_MAX+1];
+};
+
+/// \note This scheduler selects the ready task with the highest priority (see\n
+///	  CTask::SetPriority()). Tasks with the same priority are scheduled round-robin.\n
+///	  A task, which is ready all the time, prevents all tasks with a lower priority\n
+///	  from running.
+/// \note Ready tasks are kept in a queue per core and priority, sleeping tasks and\n
+///	  tasks, which wait with timeout, on a timer wheel per core. Selecting the next\n
+///	  task takes constant time therefore, independent of the number of tasks.\n
+///	  The number of tasks is only limited by the available memory.
+/// \note With ARM_ALLOW_MULTI_CORE each core selects from the tasks, which have this\n
+///	  core in their affinity mask (see CTask::SetAffinity()). A secondary core has to\n
+///	  call InitializeSecondary() before it can use the scheduler.
+/// \note With TICKLESS_IDLE core 0 waits with CTimer::IdleWait(), if no task is ready\n
+///	  to run. The timer tick is suppressed until the next sleeping task is due then.
 
 class CScheduler /// Cooperative non-preemtive scheduler, which controls which task runs at a time
 {
@@ -36,6 +65,13 @@ public:
 	CScheduler (void);
 	~CScheduler (void);
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	/// \brief Enables the scheduler on a secondary core
+	/// \note Must be called from CMultiCoreSupport::Run() on cores 1-3. The calling\n
+	///	  code becomes the main task of this core then.
+	void InitializeSecondary (void);
+#endif
+
 	/// \brief Switch to the next task
 	/// \note A task should call this from time to time, if it does longer calculations.
 	void Yield (void);
@@ -67,6 +103,28 @@ public:
 	///	  which terminates.
 	void RegisterTaskTerminationHandler (TSchedulerTaskHandler *pHandler);
 
+	/// \brief Enable the preemption requests
+	/// \note With this enabled, the timer tick and the wake-up of a blocked task\n
+	///	  check, if a task with a higher priority than the current task became\n
+	///	  ready. A task switch is requested then, which is executed on the next\n
+	///	  call of PreemptionPoint(). Tasks are never switched from interrupt\n
+	///	  context, because Circle relies on cooperative scheduling.
+	void EnablePreemption (void);
+
+	/// \return Is a task with a higher priority ready to run?
+	boolean IsPreemptionPending (void) const	{ return m_bPreemptionPending[ThisCore ()]; }
+
+	/// \brief Switch tasks, if a task with a higher priority is ready to run
+	/// \note Can be called very often from longer calculations, because it\n
+	///	  returns immediately, if there is no preemption request.
+	void PreemptionPoint (void)
+	{
+		if (m_bPreemptionPending[ThisCore ()])
+		{
+			Yield ();
+		}
+	}
+
 	/// \brief Causes all new tasks to be created in a suspended state
 	/// \note Nested calls to SuspendNewTasks() and ResumeNewTasks() are allowed.
 	void SuspendNewTasks (void);
@@ -74,6 +132,27 @@ public:
 	///	   and starts any tasks that were created suspended.
 	void ResumeNewTasks (void);
 
+	/// \return Distribution of the wake-up latency of tasks in microseconds
+	/// \note This is the time from waking a blocked or sleeping task until it runs.\n
+	///	  It is recorded with the system option LATENCY_PROBES only.
+	const CHistogram<> *GetWakeLatency (void) const	{ return &m_WakeLatency; }
+
+	/// \param nCore Core number
+	/// \return Time in microseconds, which this core has spent waiting for a ready task
+	/// \note The CPU load can be calculated from the difference of two calls. A task,\n
+	///	  which polls without blocking, keeps the core busy in this sense.
+	u64 GetIdleTime (unsigned nCore) const;
+
+	/// \brief Idle time source for CCPUThrottle::StartGovernor()
+	/// \param nCore Core number
+	/// \param pParam Pointer to the scheduler
+	/// \return Idle time of this core in microseconds
+	static u64 IdleTimeHandler (unsigned nCore, void *pParam);
+
+	/// \param State Count only the tasks in this state (TaskStateUnknown for all tasks)
+	/// \return Number of known tasks
+	unsigned GetTaskCount (TTaskState State = TaskStateUnknown);
+
 	/// \brief Generate task listing
 	/// \param pTarget Device to be used for output
 	void ListTasks (CDevice *pTarget);
@@ -90,6 +169,7 @@ public:
 
 private:
 	void AddTask (CTask *pTask);
+	void UpdateTask (CTask *pTask);	// state, priority or affinity of pTask has changed
 	friend class CTask;
 
 	boolean BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds);
@@ -97,20 +177,61 @@ private:
 	friend class CSynchronizationEvent;
 
 	void RemoveTask (CTask *pTask);
-	unsigned GetNextTask (void); // returns index into m_pTask or MAX_TASKS if no task was found
+
+	// the following methods must be called with m_SpinLock acquired
+	void Enqueue (CTask *pTask);		// if pTask is ready to run
+	void Dequeue (CTask *pTask);		// if pTask is queued
+	CTask *GetNextTask (int nMinPriority);	// returns 0, if no task with this priority was found
+	void AddToTimerWheel (CTask *pTask, unsigned nWakeTicks);
+	void RemoveFromTimerWheel (CTask *pTask);
+	static void TimerWheelHandler (TTimerWheelEntry *pEntry, void *pParam);
+
+	void FinishSwitch (void);	// must be called in the new task context after a task switch
+
+	void AccountRunTime (CTask *pTask, unsigned nCore);	// pTask is running on nCore
+	u64 GetMicroseconds (u64 nTimestamp) const;		// for CTask::GetRunTime()
+	static u64 GetTimestamp (void);
+
+	void RequestPreemption (CTask *pTask); // pTask became ready
+#ifdef LATENCY_PROBES
+	void RecordWakeLatency (CTask *pTask);	// pTask is going to run
+#endif
+	static void PeriodicHandler (void);
+
+	static unsigned ThisCore (void)
+	{
+#ifdef ARM_ALLOW_MULTI_CORE
+		return CMultiCoreSupport::ThisCore ();
+#else
+		return 0;
+#endif
+	}
 
 private:
-	CTask *m_pTask[MAX_TASKS];
-	unsigned m_nTasks;
+	CTask *m_pTaskListHead;			// all known tasks
+	CTask *m_pTaskListTail;
 
-	CTask *m_pCurrent;
-	unsigned m_nCurrent;	// index into m_pTask
+	CTask *m_pCurrent[SCHED_CORES];
+	CTask *m_pPrevious[SCHED_CORES];	// task, which has been switched away
+
+	TSchedulerReadyQueue m_ReadyQueue[SCHED_CORES];
+	CTimerWheel m_TimerWheel[SCHED_CORES];
 
 	TSchedulerTaskHandler *m_pTaskSwitchHandler;
 	TSchedulerTaskHandler *m_pTaskTerminationHandler;
 
 	int m_iSuspendNewTasks;
 
+	boolean m_bPreemptionEnabled;
+	volatile boolean m_bPreemptionPending[SCHED_CORES];
+
+	CHistogram<> m_WakeLatency;
+
+	volatile u64 m_nIdleTime[SCHED_CORES];	// microseconds
+
+	u64 m_nRunStart[SCHED_CORES];		// time stamp, since which the current task runs
+	u64 m_nTimestampFrequency;
+
 	CSpinLock m_SpinLock;
 
 	static CScheduler *s_pThis;
@@ -22,6 +22,7 @@
 
 #include <circle/sched/taskswitch.h>
 #include <circle/sched/synchronizationevent.h>
+#include <circle/timerwheel.h>
 #include <circle/sysconfig.h>
 #include <circle/string.h>
 #include <circle/types.h>
@@ -37,6 +38,14 @@ enum TTaskState
 	TaskStateUnknown
 };
 
+#define TASK_PRIORITY_LOW	4
+#define TASK_PRIORITY_NORMAL	8		///< default priority of all tasks
+#define TASK_PRIORITY_HIGH	16
+#define TASK_PRIORITY_MAX	31
+
+#define TASK_AFFINITY_CORE(core)	(1U << (core))
+#define TASK_AFFINITY_ANY		((1U << CORES)-1)	///< with ARM_ALLOW_MULTI_CORE only
+
 class CScheduler;
 
 class CTask	/// Overload this class, define the Run() method, and call new on it to start it.
@@ -75,6 +84,24 @@ public:
 	/// \return Pointer to 0-terminated name string ("@this_address" if not explicitly set)
 	const char *GetName (void) const;
 
+	/// \brief Set the scheduling priority of this task
+	/// \param nPriority Priority (0..TASK_PRIORITY_MAX, higher value is more important)
+	/// \note The scheduler always selects the ready task with the highest priority.\n
+	///	  Tasks with the same priority are scheduled round-robin.
+	void SetPriority (unsigned nPriority);
+	/// \return Scheduling priority, which has been set with SetPriority()
+	unsigned GetPriority (void) const	{ return m_nPriority; }
+
+	/// \brief Set the cores, on which this task is allowed to run
+	/// \param nCoreMask Bit mask of cores (TASK_AFFINITY_CORE(n) or TASK_AFFINITY_ANY)
+	/// \note A task runs on the core, on which it has been created, by default.\n
+	///	  A task with more than one core in its mask is picked up by any of these\n
+	///	  cores, when it is ready and the core has no more important task to run.
+	/// \note Most drivers expect to be called from core 0 only.
+	void SetAffinity (unsigned nCoreMask);
+	/// \return Bit mask of cores, on which this task is allowed to run
+	unsigned GetAffinity (void) const	{ return m_nAffinity; }
+
 #define TASK_USER_DATA_KTHREAD		0	// Linux driver emulation
 #define TASK_USER_DATA_ERROR_STACK	1	// Plan 9 driver emulation
 #define TASK_USER_DATA_USER		2	// Free for application usage
@@ -89,6 +116,22 @@ public:
 	/// \return Any user pointer, previously set with SetUserData()
 	void *GetUserData (unsigned nSlot);
 
+	/// \return Time in microseconds, this task has been running on a core
+	/// \note Measured with the ARM generic timer counter (system timer on Raspberry Pi 1)\n
+	///	  at each task switch. The time, a core is idling in Yield(), is not included.
+	u64 GetRunTime (void) const;
+	/// \return Number of calls to CScheduler::Yield() (including sleeping and blocking)
+	unsigned GetYieldCount (void) const	{ return m_nYields; }
+	/// \return Number of times, this task has been switched in
+	unsigned GetSwitchCount (void) const	{ return m_nSwitches; }
+
+	/// \return Stack size of this task in bytes (0 for the main task of a core)
+	unsigned GetStackSize (void) const	{ return m_nStackSize; }
+	/// \return Maximum number of bytes, which have been used on the stack of this task
+	/// \note The stack is filled with a canary pattern on creation, which is searched\n
+	///	  for the first overwritten word here. Returns 0 for the main task of a core.
+	unsigned GetStackHighWater (void) const;
+
 private:
 	TTaskState GetState (void) const	{ return m_State; }
 	void SetState (TTaskState State)	{ m_State = State; }
@@ -98,6 +141,11 @@ private:
 
 	TTaskRegisters *GetRegs (void)		{ return &m_Regs; }
 
+	// may be temporarily raised by CMutex (priority inheritance)
+	unsigned GetEffectivePriority (void) const	{ return m_nEffectivePriority; }
+	void SetEffectivePriority (unsigned nPriority);
+	friend class CMutex;
+
 	friend class CScheduler;
 
 private:
@@ -109,6 +157,10 @@ private:
 	volatile TTaskState m_State;
 	boolean		    m_bSuspended;
 	unsigned	    m_nWakeTicks;
+	unsigned	    m_nPriority;
+	volatile unsigned   m_nEffectivePriority;
+	unsigned	    m_nAffinity;
+	volatile boolean    m_bRunning;		// task is running or switched out just now
 	TTaskRegisters	    m_Regs;
 	unsigned	    m_nStackSize;
 	u8		   *m_pStack;
@@ -116,6 +168,20 @@ private:
 	void		   *m_pUserData[TASK_USER_DATA_SLOTS];
 	CSynchronizationEvent m_Event;
 	CTask		   *m_pWaitListNext;	// next in list of tasks waiting on an event
+
+	// managed by CScheduler with its spin lock acquired
+	CTask		   *m_pTaskListNext;	// list of all tasks
+	CTask		   *m_pTaskListPrev;
+	CTask		   *m_pReadyNext;	// ready queue of a core
+	CTask		   *m_pReadyPrev;
+	unsigned	    m_nReadyCore;	// SCHED_CORES, if not queued
+	unsigned	    m_nReadyPriority;	// priority of the list, the task is queued in
+	TTimerWheelEntry    m_WheelEntry;	// used while sleeping or blocked with timeout
+	unsigned	    m_nWheelCore;	// SCHED_CORES, if not on a timer wheel
+	unsigned	    m_nReadyTicks;	// time of wake-up, 0 if not measured
+	u64		    m_nRunTime;		// in CScheduler time stamp units
+	unsigned	    m_nYields;
+	unsigned	    m_nSwitches;
 };
 
 #endif
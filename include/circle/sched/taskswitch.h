@@ -2,7 +2,7 @@
 // taskswitch.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -45,7 +45,7 @@ struct TTaskRegisters
 	u32	r12;
 	u32	sp;
 	u32	lr;
-	u64	d[16];
+	u64	d[8];			// d8-d15
 }
 PACKED;
 
@@ -0,0 +1,57 @@
+//
+/// \file writebufferdraintask.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_sched_writebufferdraintask_h
+#define _circle_sched_writebufferdraintask_h
+
+#include <circle/sched/task.h>
+#include <circle/writebuffer.h>
+#include <circle/types.h>
+
+#define WRITE_BUFFER_DRAIN_INTERVAL_MS	10
+#define WRITE_BUFFER_DRAIN_BATCH_SIZE	1024
+
+class CWriteBufferDrainTask : public CTask	/// Writes the contents of a CWriteBufferDevice in the background
+{
+public:
+	/// \param pWriteBuffer Pointer to the write buffer, which is drained
+	/// \param nBatchSize   Maximum number of bytes written to the output device at once
+	/// \param nIntervalMs  Sleep time, when no flush is due according to the flush policy
+	/// \note The task runs with TASK_PRIORITY_LOW. The flush policy is set with
+	///	  CWriteBufferDevice::SetFlushPolicy().
+	CWriteBufferDrainTask (CWriteBufferDevice *pWriteBuffer,
+			       size_t nBatchSize = WRITE_BUFFER_DRAIN_BATCH_SIZE,
+			       unsigned nIntervalMs = WRITE_BUFFER_DRAIN_INTERVAL_MS);
+
+	~CWriteBufferDrainTask (void);
+
+	/// \brief Flush the write buffer, terminate the task and wait for it
+	/// \note The object is deleted by the scheduler afterwards.
+	void Stop (void);
+
+	void Run (void);
+
+private:
+	CWriteBufferDevice *m_pWriteBuffer;
+	size_t m_nBatchSize;
+	unsigned m_nIntervalMs;
+	volatile boolean m_bStop;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // screen.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -202,6 +202,21 @@ public:
 	/// \return The requested color value (depends on screen DEPTH)
 	TScreenColor GetPixel (unsigned nPosX, unsigned nPosY);
 
+	/// \brief Write a horizontal span of pixels (clipped at the screen borders)
+	/// \param nPosX X-Position of the first pixel (based on 0)
+	/// \param nPosY Y-Position of the span (based on 0)
+	/// \param pPixels Color values of the pixels (depend on screen DEPTH)
+	/// \param nCount Number of pixels
+	void SetPixels (unsigned nPosX, unsigned nPosY, const TScreenColor *pPixels, unsigned nCount);
+	/// \brief Fill a rectangle with a color (clipped at the screen borders)
+	/// \param nPosX X-Position of the upper left corner (based on 0)
+	/// \param nPosY Y-Position of the upper left corner (based on 0)
+	/// \param nWidth Width of the rectangle in pixels
+	/// \param nHeight Height of the rectangle in pixels
+	/// \param Color The color to be set (value depends on screen DEPTH)
+	void FillRect (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight,
+		       TScreenColor Color);
+
 	/// \brief Displays rotating symbols in the upper right corner of the screen
 	/// \param nIndex Index of the rotor to be displayed (0..3)
 	/// \param nCount Phase (angle) of the current rotor symbol (0..3)
@@ -240,6 +255,11 @@ private:
 	void DisplayChar (char chChar, unsigned nPosX, unsigned nPosY, TScreenColor Color);
 	void EraseChar (unsigned nPosX, unsigned nPosY);
 	void InvertCursor (void);
+
+	void CopyBlock (void *pTo, const void *pFrom, unsigned nSize);
+
+	struct TGlyphPixels;
+	const TGlyphPixels *GetGlyphPixels (TScreenColor Color, TScreenColor BackgroundColor);
 #endif
 
 private:
@@ -279,6 +299,24 @@ private:
 	CDMAChannel	 m_DMAChannel;
 #endif
 	CSpinLock	 m_SpinLock;
+
+	// pre-rendered pixels of all possible glyph lines for a color pair
+	struct TGlyphPixels
+	{
+		TScreenColor	Color;
+		TScreenColor	BackgroundColor;
+		TScreenColor	Pixels[256][8];		// [line bitmap][x]
+	};
+
+	TGlyphPixels	*m_pGlyphPixels;
+	unsigned	 m_nGlyphPixelsUsed;
+	unsigned	 m_nGlyphPixelsNext;
+
+#ifdef SCREEN_HW_SCROLL
+	TScreenColor	*m_pFrameBase;
+	unsigned	 m_nWindowY;
+	unsigned	 m_nVirtHeight;
+#endif
 #endif
 };
 
@@ -0,0 +1,90 @@
+//
+/// \file seqlock.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_seqlock_h
+#define _circle_seqlock_h
+
+#include <circle/synchronize.h>
+#include <circle/types.h>
+
+/// \note The reader does not write to shared memory and never waits for a writer. It copies
+///	  the protected data between ReadBegin() and ReadRetry() and has to repeat (or to fall
+///	  back to a locked path), if ReadRetry() returns TRUE:
+/// \code
+///	unsigned nSequence;
+///	do
+///	{
+///		nSequence = SeqLock.ReadBegin ();
+///		Copy = Data;
+///	}
+///	while (SeqLock.ReadRetry (nSequence));
+/// \endcode
+/// \note The writers have to be serialized by the caller (e.g. with a CSpinLock). If readers
+///	  run in interrupt context, the write section must not be interruptible on the same
+///	  core (e.g. CSpinLock with IRQ_LEVEL), otherwise the reader loop would never end.
+/// \note The data read in the read section may be inconsistent and must not be used (e.g. as
+///	  a pointer or array index) without validation, before ReadRetry() returned FALSE.
+
+class CSeqLock	/// Sequence lock for data with rare writers and frequent readers
+{
+public:
+	CSeqLock (void)
+	:	m_nSequence (0)
+	{
+	}
+
+	/// \return Sequence number to be passed to ReadRetry()
+	unsigned ReadBegin (void) const
+	{
+		unsigned nSequence = __atomic_load_n (&m_nSequence, __ATOMIC_ACQUIRE);
+
+		DataMemBarrier ();
+
+		// a write in progress (odd sequence) lets ReadRetry() fail
+		return nSequence & ~1U;
+	}
+
+	/// \param nSequence Value returned from ReadBegin()
+	/// \return Has the data been modified in the meantime (read must be repeated)?
+	boolean ReadRetry (unsigned nSequence) const
+	{
+		DataMemBarrier ();
+
+		return nSequence != __atomic_load_n (&m_nSequence, __ATOMIC_RELAXED);
+	}
+
+	/// \brief Start modifying the protected data
+	void WriteBegin (void)
+	{
+		__atomic_add_fetch (&m_nSequence, 1, __ATOMIC_RELEASE);
+		DataMemBarrier ();
+	}
+
+	/// \brief Stop modifying the protected data
+	void WriteEnd (void)
+	{
+		DataMemBarrier ();
+		__atomic_add_fetch (&m_nSequence, 1, __ATOMIC_RELEASE);
+	}
+
+private:
+	volatile unsigned m_nSequence;		// odd while a write is in progress
+};
+
+#endif
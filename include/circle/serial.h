@@ -2,7 +2,7 @@
 /// \file serial.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -54,6 +54,10 @@
 #define SERIAL_BUF_SIZE		2048			// must be a power of 2
 #define SERIAL_BUF_MASK		(SERIAL_BUF_SIZE-1)
 
+#ifndef SERIAL_DMA_BUF_SIZE
+#define SERIAL_DMA_BUF_SIZE	16384			// default for EnableDMA(), power of 2
+#endif
+
 // serial options
 #define SERIAL_OPTION_ONLCR	(1 << 0)	///< Translate NL to NL+CR on output (default)
 
@@ -63,6 +67,9 @@
 #define SERIAL_ERROR_FRAMING	3
 #define SERIAL_ERROR_PARITY	4
 
+class CDMAChannel;
+struct TDMAControlBlock;
+
 class CSerialDevice : public CDevice
 {
 public:
@@ -98,6 +105,14 @@ public:
 	boolean Initialize (unsigned nBaudrate = 115200);
 #endif
 
+#ifndef USE_RPI_STUB_AT
+	/// \brief Change the baud rate of an initialized device
+	/// \param nBaudrate Baud rate in bits per second
+	/// \return Operation successful?
+	/// \note Waits until all written bytes have been sent out before.
+	boolean SetBaudrate (unsigned nBaudrate);
+#endif
+
 	/// \param pBuffer Pointer to data to be sent
 	/// \param nCount Number of bytes to be sent
 	/// \return Number of bytes successfully sent (< 0 on error)
@@ -118,9 +133,27 @@ public:
 	/// \param pMagic String for which is searched in the received data\n
 	/// (must remain valid after return from this method)
 	/// \param pHandler Handler which is called, when the magic string is found
-	/// \note Does only work with interrupt driver.
+	/// \note Does only work with interrupt driver (not in DMA mode).
 	void RegisterMagicReceivedHandler (const char *pMagic, TMagicReceivedHandler *pHandler);
 
+	/// \brief Receive and transmit using DMA, paced by DREQ, with large ring buffers
+	/// \param nRxBufferSize Size of the receive ring in bytes (power of 2)
+	/// \param nTxBufferSize Size of the transmit ring in bytes (power of 2)
+	/// \return Operation successful?
+	/// \note Must be called before Initialize(). Requires the interrupt driver and device 0.
+	/// \note Each byte takes 4 bytes of memory in the rings (DMA transfers words).
+	/// \note The receive ring is filled continuously. Read() has to be called often enough,
+	///	  otherwise older data is overwritten without notice.
+	boolean EnableDMA (unsigned nRxBufferSize = SERIAL_DMA_BUF_SIZE,
+			   unsigned nTxBufferSize = SERIAL_DMA_BUF_SIZE);
+
+	typedef void TIdleHandler (void *pParam);
+	/// \param pHandler Handler which is called in interrupt context, when the receive line\n
+	///		    became idle after receiving data (receive timeout of 32 bit periods)
+	/// \param pParam User parameter to be handed over to the handler
+	/// \note Does only work in DMA mode.
+	void RegisterIdleHandler (TIdleHandler *pHandler, void *pParam);
+
 protected:
 	/// \return Number of bytes buffer space available for Write()
 	/// \note Does only work with interrupt driver.
@@ -140,6 +173,13 @@ protected:
 private:
 	boolean Write (u8 uchChar);
 
+	int ReadDMA (u8 *pBuffer, size_t nCount);
+	int WriteDMA (const u8 *pBuffer, size_t nCount);
+	unsigned GetRxDMAInPtr (void);
+	void StartTxDMA (void);
+	void TxDMACompletionRoutine (boolean bStatus);
+	static void TxDMACompletionStub (unsigned nChannel, boolean bStatus, void *pParam);
+
 	void InterruptHandler (void);
 	static void InterruptStub (void *pParam);
 
@@ -175,6 +215,28 @@ private:
 	CSpinLock m_SpinLock;
 	CSpinLock m_LineSpinLock;
 
+	// DMA mode
+	boolean m_bUseDMA;
+	CDMAChannel *m_pRxDMA;
+	CDMAChannel *m_pTxDMA;
+
+	u8 *m_pRxControlBlockBuffer;
+	TDMAControlBlock *m_pRxControlBlock;	// two, cyclic
+
+	u32 *m_pRxRing;				// one received DR value per entry
+	unsigned m_nRxRingMask;
+	unsigned m_nRxRingOutPtr;
+
+	u32 *m_pTxRing;				// one character per entry
+	unsigned m_nTxRingMask;
+	volatile unsigned m_nTxRingInPtr;
+	volatile unsigned m_nTxRingOutPtr;
+	unsigned m_nTxDMALength;		// entries of the active transfer
+	volatile boolean m_bTxDMAActive;
+
+	TIdleHandler *m_pIdleHandler;
+	void *m_pIdleParam;
+
 	static unsigned s_nInterruptUseCount;
 	static CInterruptSystem *s_pInterruptSystem;
 	static boolean s_bUseFIQ;
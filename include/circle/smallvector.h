@@ -0,0 +1,158 @@
+//
+/// \file smallvector.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_smallvector_h
+#define _circle_smallvector_h
+
+#include <circle/types.h>
+#include <assert.h>
+
+/// \note The first N elements are stored inside of the object. The array is moved to the
+///	  heap with doubled capacity, when it grows beyond. T must be default constructible
+///	  and copy assignable.
+/// \note Not thread-safe, the caller has to provide the locking.
+
+template <class T, unsigned N>
+class CSmallVector	/// Dynamic array of elements of type T with inline storage for N elements
+{
+public:
+	CSmallVector (void)
+	:	m_pElement (m_Inline),
+		m_nCount (0),
+		m_nCapacity (N)
+	{
+	}
+
+	~CSmallVector (void)
+	{
+		if (m_pElement != m_Inline)
+		{
+			delete [] m_pElement;
+		}
+
+		m_pElement = 0;
+	}
+
+	/// \return Number of elements in the array
+	unsigned GetCount (void) const
+	{
+		return m_nCount;
+	}
+
+	T &operator[] (unsigned nIndex)
+	{
+		assert (nIndex < m_nCount);
+		return m_pElement[nIndex];
+	}
+
+	const T &operator[] (unsigned nIndex) const
+	{
+		assert (nIndex < m_nCount);
+		return m_pElement[nIndex];
+	}
+
+	/// \return Index of the appended element
+	unsigned Append (const T &Element)
+	{
+		if (m_nCount == m_nCapacity)
+		{
+			Reserve (m_nCapacity * 2);
+		}
+
+		m_pElement[m_nCount] = Element;
+
+		return m_nCount++;
+	}
+
+	void RemoveLast (void)
+	{
+		assert (m_nCount > 0);
+		m_nCount--;
+	}
+
+	/// \brief Removes an element, the order of the following elements is kept
+	void RemoveAt (unsigned nIndex)
+	{
+		assert (nIndex < m_nCount);
+
+		for (unsigned i = nIndex+1; i < m_nCount; i++)
+		{
+			m_pElement[i-1] = m_pElement[i];
+		}
+
+		m_nCount--;
+	}
+
+	/// \return Index of the first element equal to Element, or -1 if not found
+	int Find (const T &Element) const
+	{
+		for (unsigned i = 0; i < m_nCount; i++)
+		{
+			if (m_pElement[i] == Element)
+			{
+				return (int) i;
+			}
+		}
+
+		return -1;
+	}
+
+	/// \brief Removes all elements (the memory is kept)
+	void Clear (void)
+	{
+		m_nCount = 0;
+	}
+
+	/// \param nCapacity Number of elements, which can be stored without re-allocation
+	void Reserve (unsigned nCapacity)
+	{
+		if (nCapacity <= m_nCapacity)
+		{
+			return;
+		}
+
+		T *pElement = new T[nCapacity];
+		assert (pElement != 0);
+
+		for (unsigned i = 0; i < m_nCount; i++)
+		{
+			pElement[i] = m_pElement[i];
+		}
+
+		if (m_pElement != m_Inline)
+		{
+			delete [] m_pElement;
+		}
+
+		m_pElement = pElement;
+		m_nCapacity = nCapacity;
+	}
+
+private:
+	CSmallVector (const CSmallVector &) = delete;
+	CSmallVector &operator = (const CSmallVector &) = delete;
+
+private:
+	T	*m_pElement;			// m_Inline or heap
+	unsigned m_nCount;
+	unsigned m_nCapacity;
+	T	 m_Inline[N];
+};
+
+#endif
@@ -25,6 +25,8 @@
 
 #include <circle/dmachannel.h>
 #include <circle/gpiopin.h>
+#include <circle/interrupt.h>
+#include <circle/types.h>
 
 #define SMI_NUM_ADDRESS_LINES		6
 #define SMI_NUM_DATA_LINES			18
@@ -41,6 +43,18 @@ enum TSMIDataWidth
 	SMI9Bits = 3
 };
 
+/// \brief Called from interrupt context, when a DMA write has been completed
+typedef void TSMICompletionRoutine (boolean bStatus, void *pParam);
+
+#define SMI_STREAM_BURST_LENGTH		2	///< Default DMA burst length for streaming (0-15)
+
+/// \brief Called from interrupt context, when one half of the stream buffer has been transferred
+/// \param pBuffer	the half, which has been transferred (write: refill it, read: consume it)
+/// \param nLength	length of the half in bytes
+/// \param bStatus	FALSE on DMA error, the stream is stopped then
+/// \param pParam	user parameter handed over to StartStream()
+typedef void TSMIStreamRoutine (void *pBuffer, unsigned nLength, boolean bStatus, void *pParam);
+
 /// \class CSMIMaster
 /// \brief Driver for the Second Memory Interface.
 ///
@@ -49,12 +63,15 @@ enum TSMIDataWidth
 /// - May also drive SMI Address lines (GPIO0 to GPIO5)
 /// - Does not use SOE/SWE on GPIO6/GPIO7
 /// - Read/Write operation in Direct mode or Write in DMA mode
+/// - Continuous double buffered Read/Write streaming in DMA mode
 ///
 /// \details Operations
 /// One must first call SetupTiming() with suitable timing information.
 /// The Device bank to use and the address to assert on the SAx lines may then optionally be set with SetDeviceAndAddress()
 /// Then Direct mode may then be used with Read() / Write().
 /// Or for DMA mode, one must first call SetupDMA() with a suitable internal buffer, then WriteDMA() to flush the buffer into SMI.
+/// The completion of an asynchronous DMA write can be awaited with WaitForDMA() or signalled by a completion routine.
+/// For continuous transfers StartStream() runs the DMA through the two halves of a buffer, until StopStream() is called.
 
 
 class CSMIMaster
@@ -62,7 +79,9 @@ class CSMIMaster
 public:
 	/// \param nSDLinesMask		mask determining which SDx lines should be driven. For example (1 << 0) | (1 << 5) for SD0 (GPIO8) and SD5 (GPIO13)
 	/// \param bUseAddressPins	enable use of address pins GPIO0 to GPIO5
-	CSMIMaster (unsigned nSDLinesMask = SMI_ALL_DATA_LINES_MASK, boolean bUseAddressPins = TRUE);
+	/// \param pInterruptSystem	required for SetCompletionRoutine() only
+	CSMIMaster (unsigned nSDLinesMask = SMI_ALL_DATA_LINES_MASK, boolean bUseAddressPins = TRUE,
+		    CInterruptSystem *pInterruptSystem = 0);
 
 	~CSMIMaster (void);
 
@@ -100,6 +119,45 @@ public:
 	/// \param bWaitForCompletion	Whether to wait for DMA completion
 	void WriteDMA (boolean bWaitForCompletion);
 
+	/// \brief Sets a routine to be called on completion of each following DMA write
+	/// \param pRoutine	the completion routine (0 to remove it)
+	/// \param pParam	user parameter handed over to the routine
+	/// \note Requires the interrupt system to be given in the constructor
+	void SetCompletionRoutine (TSMICompletionRoutine *pRoutine, void *pParam);
+
+	/// \return Is a DMA write running?
+	boolean IsDMAActive (void) const;
+
+	/// \brief Waits for the completion of a DMA write started with bWaitForCompletion = FALSE
+	void WaitForDMA (void);
+
+	/// \brief Starts continuous (ping-pong) DMA streaming from/to the two halves of a buffer
+	/// \param bWrite		TRUE to write the buffer to SMI, FALSE to read from SMI into the buffer
+	/// \param pBuffer		the buffer of 2 * nHalfLength bytes (make sure it's DMA-aligned),\n
+	///				must be completely filled before, when writing
+	/// \param nHalfLength	length of each half in bytes (multiple of 4, max. 65532)
+	/// \param pRoutine		called each time a half has been transferred
+	/// \param pParam		user parameter handed over to the routine
+	/// \param nBurstLength	DMA burst length (0-15), the SMI DREQ threshold is set accordingly
+	/// \return FALSE, if no DMA channel is available
+	/// \note Requires the interrupt system to be given in the constructor
+	/// \note SetupTiming() and SetDeviceAndAddress() apply as with WriteDMA().
+	boolean StartStream (boolean bWrite, void *pBuffer, unsigned nHalfLength,
+			     TSMIStreamRoutine *pRoutine, void *pParam,
+			     unsigned nBurstLength = SMI_STREAM_BURST_LENGTH);
+
+	/// \brief Stops streaming immediately, the routine is not called any more
+	void StopStream (void);
+
+	/// \return Is streaming running?
+	boolean IsStreamActive (void) const;
+
+private:
+	static void DMACompletionStub (unsigned nChannel, boolean bStatus, void *pParam);
+
+	void StreamInterruptHandler (void);
+	static void StreamInterruptStub (void *pParam);
+
 protected:
 	unsigned m_nSDLinesMask;
 	boolean m_bUseAddressPins;
@@ -108,6 +166,23 @@ protected:
 	CGPIOPin m_addressGpios[SMI_NUM_ADDRESS_LINES];
 	void *m_pDMABuffer;
 	unsigned m_nLength;
+	boolean m_bHasInterruptSystem;
+	volatile boolean m_bDMAActive;
+	TSMICompletionRoutine *m_pCompletionRoutine;
+	void *m_pCompletionParam;
+
+	CInterruptSystem *m_pInterruptSystem;
+	unsigned m_nStreamChannel;		// DMA_CHANNEL_MAX+1 if not allocated
+	boolean m_bStreamIRQConnected;
+	u8 *m_pStreamCBBuffer;
+	TDMAControlBlock *m_pStreamCB;		// two, cyclic
+	u8 *m_pStreamBuffer;
+	unsigned m_nStreamHalfLength;
+	unsigned m_nStreamHalf;			// half to be completed next
+	boolean m_bStreamWrite;
+	volatile boolean m_bStreamActive;
+	TSMIStreamRoutine *m_pStreamRoutine;
+	void *m_pStreamParam;
 };
 
 #endif
@@ -27,6 +27,7 @@
 #define SOUND_HW_CHANNELS	2
 #define SOUND_MAX_SAMPLE_SIZE	(sizeof (u32))
 #define SOUND_MAX_FRAME_SIZE	(SOUND_HW_CHANNELS * SOUND_MAX_SAMPLE_SIZE)
+#define SOUND_CONVERT_FRAMES	64		// frames converted at once in Write()
 
 // IEC958 (S/PDIF)
 #define IEC958_FRAMES_PER_BLOCK		192
@@ -42,14 +43,31 @@ enum TSoundFormat			/// All supported formats are interleaved little endian
 	SoundFormatSigned24_32,		/// Write/Read, HWFormat output/input (occupies 4 bytes)
 	SoundFormatUnsigned32,		/// HWFormat output only
 	SoundFormatIEC958,		/// HWFormat output only
+	SoundFormatFloat32,		/// Write only, HWFormat none (range -1.0 to 1.0)
 	SoundFormatUnknown
 };
 
 typedef void TSoundDataCallback (void *pParam);
 
-/// \note There are two methods to provide the sound samples:\n
+/// \param pBuffer	Buffer in HW format, which will be sent next (normally the DMA buffer)
+/// \param nChunkSize	Size of the buffer in words (one word per channel)
+/// \param pParam	User parameter
+/// \return Number of words written to the buffer (normally nChunkSize),\n
+///	    Transfer will stop if 0 is returned
+/// \note Is called from interrupt context
+typedef unsigned TSoundRenderCallback (void *pBuffer, unsigned nChunkSize, void *pParam);
+
+/// \param pBuffer	Receives nFrames interleaved stereo frames (-1.0 to 1.0)
+/// \param nFrames	Number of frames to be rendered (up to SOUND_CONVERT_FRAMES)
+/// \param pParam	User parameter
+/// \return Transfer will stop if FALSE is returned
+/// \note Is called from interrupt context, multiple times per chunk
+typedef boolean TSoundRenderFloatCallback (float *pBuffer, unsigned nFrames, void *pParam);
+
+/// \note There are three methods to provide the sound samples:\n
 ///	  1. By overloading GetChunk()\n
-///	  2. By using Write()
+///	  2. By using Write()\n
+///	  3. By registering a render callback (RegisterRenderCallback())
 
 /// \note There are two methods to retrieve the sound samples:\n
 ///	  1. By overloading PutChunk()\n
@@ -134,6 +152,21 @@ public:
 	/// \return TRUE: Have to write right channel first into buffer in GetChunk()
 	boolean AreChannelsSwapped (void) const;
 
+	/// \brief Let the driver fetch the samples directly from a callback (no queue, no copy)
+	/// \param pCallback Callback, which renders the samples in HW format (0 to unregister)
+	/// \param pParam User parameter to be handed over to the callback
+	/// \note The callback has to write the right channel first, if AreChannelsSwapped().
+	/// \note With SoundFormatIEC958 the callback provides 24-bit samples (in the lower bits),
+	///	  the IEC958 framing is applied by the driver afterwards.
+	/// \note Not used, if GetChunk() is overloaded. Write() must not be used at the same time.
+	void RegisterRenderCallback (TSoundRenderCallback *pCallback, void *pParam);
+
+	/// \brief Like RegisterRenderCallback(), but the samples are rendered as float values
+	/// \param pCallback Callback, which renders blocks of stereo float frames (0 to unregister)
+	/// \param pParam User parameter to be handed over to the callback
+	/// \note The samples are converted to the HW format directly into the DMA buffer.
+	void RegisterRenderFloatCallback (TSoundRenderFloatCallback *pCallback, void *pParam);
+
 	// Input //////////////////////////////////////////////////////////////
 
 	/// \brief Allocate the queue used for Read()
@@ -198,12 +231,37 @@ protected:
 	/// \param nFrame Number of the IEC958 frame, this sample belongs to (0..191)
 	u32 ConvertIEC958Sample (u32 nSample, unsigned nFrame);
 
+	/// \brief Called from GetChunk() to apply framing on a buffer of IEC958 samples in place
+	/// \param pBuffer Buffer with 24-bit signed sample values as u32, upper bits don't care
+	/// \param nChunkSize Size of the buffer in words (multiple of nChannels)
+	/// \param nChannels Number of sub-frames per frame
+	/// \note The buffer must start with frame 0 of an IEC958 block.
+	/// \note Faster than calling ConvertIEC958Sample() for each sample.
+	void ConvertIEC958Samples (u32 *pBuffer, unsigned nChunkSize,
+				   unsigned nChannels = SOUND_HW_CHANNELS);
+
+	/// \brief Set or clear the "non-PCM" bit in the IEC958 channel status
+	/// \param bNonPCM TRUE for the passthrough of compressed data (IEC 61937)
+	void SetIEC958NonPCM (boolean bNonPCM);
+
 private:
 	// Output /////////////////////////////////////////////////////////////
 
-	void ConvertSoundFormat (void *pTo, const void *pFrom);
+	// converts nFrames frames from the write format to the HW format (always stereo)
+	typedef void TConvertRoutine (void *pTo, const void *pFrom, unsigned nFrames, int nRangeMax);
+
+	template <TSoundFormat WriteFormat, TSoundFormat HWFormat, unsigned nChannels,
+		  boolean bSwapChannels>
+	static void ConvertFrames (void *pTo, const void *pFrom, unsigned nFrames, int nRangeMax);
+
+	static TConvertRoutine *GetConvertRoutine (TSoundFormat WriteFormat, TSoundFormat HWFormat,
+						   unsigned nChannels, boolean bSwapChannels);
 
 	unsigned GetChunkInternal (void *pBuffer, unsigned nChunkSize);
+	unsigned RenderChunk (void *pBuffer, unsigned nChunkSize);
+	void ApplyIEC958Framing (u32 *pBuffer, unsigned nChunkSize,
+				 unsigned nChannels = SOUND_HW_CHANNELS);
+	void UpdateIEC958FrameBits (void);
 
 	unsigned GetQueueBytesFree (void);
 	unsigned GetQueueBytesAvail (void);
@@ -237,6 +295,7 @@ private:
 	unsigned m_nWriteChannels;
 	unsigned m_nWriteSampleSize;
 	unsigned m_nWriteFrameSize;
+	TConvertRoutine *m_pConvertRoutine;	// selected in SetWriteFormat()
 
 	u8 *m_pQueue;			// Ring buffer
 	unsigned m_nInPtr;
@@ -245,9 +304,15 @@ private:
 	TSoundDataCallback *m_pCallback;
 	void *m_pCallbackParam;
 
+	TSoundRenderCallback *m_pRenderCallback;
+	TSoundRenderFloatCallback *m_pRenderFloatCallback;
+	void *m_pRenderParam;
+	TConvertRoutine *m_pRenderConvertRoutine;	// float to HW format
+
 	CSpinLock m_SpinLock;
 
 	u8 m_uchIEC958Status[IEC958_STATUS_BYTES];
+	u32 m_IEC958FrameBits[IEC958_STATUS_BYTES * 8];	// control bit and preamble per frame
 
 	// Input //////////////////////////////////////////////////////////////
 
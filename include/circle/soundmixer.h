@@ -0,0 +1,141 @@
+//
+// soundmixer.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_soundmixer_h
+#define _circle_soundmixer_h
+
+#include <circle/soundbasedevice.h>
+#include <circle/lockfreering.h>
+#include <circle/spinlock.h>
+#include <circle/types.h>
+
+#ifndef SOUND_MIXER_MAX_STREAMS
+#define SOUND_MIXER_MAX_STREAMS		8
+#endif
+
+#define SOUND_MIXER_TAPS		16	// filter taps per phase (must be a multiple of 2)
+#define SOUND_MIXER_PHASE_BITS		6
+#define SOUND_MIXER_PHASES		(1 << SOUND_MIXER_PHASE_BITS)
+
+/// \note The streams are resampled to the sample rate of the device with a polyphase
+///	  FIR filter (windowed sinc), mixed with their gain and rendered directly into
+///	  the DMA buffer of the device (see CSoundBaseDevice::RegisterRenderFloatCallback()).
+/// \note Write() can be called for different streams from different tasks or cores,
+///	  but for one stream only from one at a time. The sound device must not use the FIQ.
+
+class CSoundMixer	/// Mixes multiple sound streams with independent format and sample rate
+{
+public:
+	/// \param pDevice	 Sound device, which outputs the mix
+	/// \param nSampleRate Sample rate of the device in Hz
+	CSoundMixer (CSoundBaseDevice *pDevice, unsigned nSampleRate);
+
+	~CSoundMixer (void);
+
+	/// \brief Starts the sound device
+	/// \return Operation successful?
+	boolean Start (void);
+
+	/// \brief Cancels the sound output
+	void Cancel (void);
+
+	/// \return Is the sound output running?
+	boolean IsActive (void) const;
+
+	/// \param Format	 Format of the sound data used for Write() (not SoundFormatUnsigned32
+	///			 or SoundFormatIEC958)
+	/// \param nChannels	 1 or 2 channels
+	/// \param nSampleRate Sample rate of the stream in Hz
+	/// \param nQueueMsecs Size of the stream queue in milliseconds
+	/// \return Stream number (< 0 on failure, e.g. too many streams)
+	int AddStream (TSoundFormat Format, unsigned nChannels, unsigned nSampleRate,
+		       unsigned nQueueMsecs = 100);
+
+	/// \param nStream Stream number returned from AddStream()
+	void RemoveStream (int nStream);
+
+	/// \param nStream Stream number returned from AddStream()
+	/// \param pBuffer Contains the samples
+	/// \param nCount  Size of the buffer in bytes (multiple of frame size)
+	/// \return Number of bytes consumed
+	int Write (int nStream, const void *pBuffer, size_t nCount);
+
+	/// \param nStream Stream number returned from AddStream()
+	/// \return Number of frames, which can be written now
+	unsigned GetQueueFramesFree (int nStream) const;
+
+	/// \param nStream Stream number returned from AddStream()
+	/// \param fGain   Linear gain of the stream (1.0 is unchanged)
+	void SetGain (int nStream, float fGain);
+
+	/// \param fGain Linear gain of the mix (1.0 is unchanged)
+	void SetMasterGain (float fGain);
+
+	/// \param nStream Stream number returned from AddStream()
+	/// \return Number of render calls, where the stream ran out of data
+	unsigned GetUnderruns (int nStream) const;
+
+private:
+	struct TFrame
+	{
+		float fLeft;
+		float fRight;
+	};
+
+	struct TStream
+	{
+		TSoundFormat	   Format;
+		unsigned	   nChannels;
+		unsigned	   nFrameSize;
+		volatile float	   fGain;
+		CSPSCRing<TFrame> *pQueue;
+		unsigned	   nQueueSize;		// capacity in frames
+		volatile unsigned  nUnderruns;
+
+		// resampler
+		boolean		   bResample;
+		u64		   nStep;		// input frames per output frame (32.32)
+		u32		   nFraction;		// position between two input frames
+		unsigned	   nPending;		// input frames to be consumed next
+		float		  *pCoeff;		// [SOUND_MIXER_PHASES][SOUND_MIXER_TAPS*2]
+		unsigned	   nHistoryPos;
+		float		   History[SOUND_MIXER_TAPS*2 * 2];	// twice, continuous window
+	};
+
+	void Render (float *pBuffer, unsigned nFrames);
+	static boolean RenderStub (float *pBuffer, unsigned nFrames, void *pParam);
+
+	void RenderStream (TStream *pStream, float *pBuffer, unsigned nFrames);
+	void PushHistory (TStream *pStream, const TFrame &Frame);
+
+	static float *CreateFilter (unsigned nInRate, unsigned nOutRate);
+	static unsigned ConvertToFrames (TSoundFormat Format, unsigned nChannels,
+					 const u8 *pFrom, TFrame *pTo, unsigned nFrames);
+
+private:
+	CSoundBaseDevice *m_pDevice;
+	unsigned m_nSampleRate;
+	volatile float m_fMasterGain;
+
+	TStream *m_pStream[SOUND_MIXER_MAX_STREAMS];
+
+	CSpinLock m_SpinLock;
+};
+
+#endif
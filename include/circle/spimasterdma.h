@@ -33,6 +33,19 @@
 
 typedef void TSPICompletionRoutine (boolean bStatus, void *pParam);
 
+#ifndef SPI_DMA_MAX_TRANSFERS
+#define SPI_DMA_MAX_TRANSFERS	16		// per queue
+#endif
+
+// one transfer of a queue, buffers must be 4-byte aligned
+struct TSPITransfer
+{
+	unsigned	 nChipSelect;		// 0, 1 or ChipSelectNone
+	const void	*pWriteBuffer;		// 0 to send zero bytes
+	void		*pReadBuffer;		// 0 to ignore the received bytes
+	unsigned	 nCount;		// number of bytes (1..65535)
+};
+
 class CSPIMasterDMA
 {
 public:
@@ -60,10 +73,39 @@ public:
 	// returns number of bytes transferred or < 0 on failure
 	int WriteReadSync (unsigned nChipSelect, const void *pWriteBuffer, void *pReadBuffer, unsigned nCount);
 
+	// Executes a queue of transfers back-to-back from chained DMA control blocks, the chip select
+	// and the length are set per transfer. The completion routine is called once at the end.
+	// With nPeriodUs > 0 the queue is repeated continuously every nPeriodUs microseconds (timed
+	// by the SPI clock, the completion routine is not called), until StopQueue() is called.
+	// In this mode the cache of a read buffer has to be invalidated, before the CPU reads it.
+	// returns FALSE, if too many transfers or the period is too short or too long
+	boolean StartQueue (const TSPITransfer *pTransfers, unsigned nTransfers, unsigned nPeriodUs = 0);
+	void StopQueue (void);
+
 private:
 	void DMACompletionRoutine (boolean bStatus);
 	static void DMACompletionStub (unsigned nChannel, boolean bStatus, void *pParam);
 
+	void SetupQueueEntry (unsigned nEntry, const TSPITransfer &rTransfer, u32 nNextControlBlock);
+	void InvalidateReadBuffers (void);
+
+	struct TQueueEntry
+	{
+		TDMAControlBlock Setup[5];	// register writes before the transfer (by RX channel)
+		TDMAControlBlock TxBlock;	// restarted by Setup[4]
+		TDMAControlBlock RxBlock;
+		u32		 SetupValue[8];	// values for Setup[]
+	};
+
+	struct TQueueTail
+	{
+		TDMAControlBlock Stop;		// last control block of the RX chain
+		u32		 nStopValue;
+		u32		 nDummyWrite;	// for transfers without buffer
+		u32		 nDummyRead;
+		u32		 nReserved[5];
+	};
+
 private:
 	unsigned m_nClockSpeed;
 	unsigned m_CPOL;
@@ -82,6 +124,12 @@ private:
 
 	TSPICompletionRoutine *m_pCompletionRoutine;
 	void *m_pCompletionParam;
+
+	u8 *m_pQueueBuffer;			// allocated by StartQueue()
+	TQueueEntry *m_pQueueEntry;		// SPI_DMA_MAX_TRANSFERS + 1 (for the period gap)
+	TQueueTail *m_pQueueTail;
+	TSPITransfer m_QueueTransfer[SPI_DMA_MAX_TRANSFERS];
+	unsigned m_nQueueLength;		// 0 if no queue is active
 };
 
 #endif
@@ -2,7 +2,7 @@
 // spinlock.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -40,6 +40,10 @@ public:
 	void Release (void);
 
 	static void Enable (void);
+	static boolean IsEnabled (void)
+	{
+		return s_bEnabled;
+	}
 
 private:
 	unsigned m_nTargetLevel;
@@ -49,6 +53,46 @@ private:
 	static boolean s_bEnabled;
 };
 
+// Fair spin lock: The cores get the lock in the order of their requests. The waiting cores
+// sleep with WFE and are woken by SEV on release. Cores, which are not next in line, back
+// off exponentially before they read the lock again, so that the cache line is not bounced
+// between all waiting cores on each release.
+
+class CTicketSpinLock
+{
+public:
+	struct TStatistics
+	{
+		unsigned nAcquired;
+		unsigned nContended;		// lock was held by another core
+		unsigned nMaxWaiters;		// cores in line (including this one)
+		u64	 nWaitTicks;		// CLOCKHZ ticks spent waiting in total
+	};
+
+public:
+	CTicketSpinLock (unsigned nTargetLevel = IRQ_LEVEL);
+	~CTicketSpinLock (void);
+
+	void Acquire (void);
+	void Release (void);
+
+#ifdef SPINLOCK_STATISTICS
+	void GetStatistics (TStatistics *pStatistics) const;
+	void ResetStatistics (void);
+#endif
+
+private:
+	unsigned m_nTargetLevel;
+
+	volatile u32 m_nNextTicket;
+	volatile u32 m_nOwner;
+	boolean m_bTicketTaken;			// FALSE if acquired before CSpinLock::Enable()
+
+#ifdef SPINLOCK_STATISTICS
+	TStatistics m_Statistics;
+#endif
+};
+
 #else
 
 class CSpinLock
@@ -79,6 +123,8 @@ private:
 	unsigned m_nTargetLevel;
 };
 
+typedef CSpinLock CTicketSpinLock;		// only one core, no need for fairness
+
 #endif
 
 #endif
@@ -2,7 +2,7 @@
 // string.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,6 +23,8 @@
 #include <circle/stdarg.h>
 #include <circle/types.h>
 
+#define STRING_INLINE_SIZE	32	// short strings are stored without heap allocation
+
 class CString
 {
 public:
@@ -39,6 +41,8 @@ public:
 
 	size_t GetLength (void) const;
 
+	void Reserve (size_t nLength);			// pre-allocate space for nLength characters
+
 	void Append (const char *pString);
 	int Compare (const char *pString) const;
 	int Find (char chChar) const;			// returns index or -1 if not found
@@ -48,10 +52,20 @@ public:
 	void Format (const char *pFormat, ...);		// supports only a small subset of printf(3)
 	void FormatV (const char *pFormat, va_list Args);
 
+	// format into a caller-provided buffer without heap allocation (truncated if too small),
+	// returns the length of the complete formatted string, like vsnprintf(3)
+	static size_t FormatBuffer (char *pBuffer, size_t nSize, const char *pFormat, ...);
+	static size_t FormatBufferV (char *pBuffer, size_t nSize, const char *pFormat,
+				     va_list Args);
+
 private:
+	CString (char *pBuffer, size_t nSize);		// for FormatBufferV()
+
+	void FormatInternal (const char *pFormat, va_list Args);	// writes at m_pInPtr
 	void PutChar (char chChar, size_t nCount = 1);
 	void PutString (const char *pString);
-	void ReserveSpace (size_t nSpace);
+	size_t ReserveSpace (size_t nSpace);		// returns the space available
+	void Resize (size_t nSize, size_t nKeep);
 	
 	static char *ntoa (char *pDest, unsigned long ulNumber, unsigned nBase, boolean bUpcase);
 #if STDLIB_SUPPORT >= 1
@@ -60,9 +74,12 @@ private:
 	static char *ftoa (char *pDest, double fNumber, unsigned nPrecision);
 
 private:
-	char 	 *m_pBuffer;
-	unsigned  m_nSize;
+	char	 *m_pBuffer;				// m_InlineBuffer, heap or external, never 0
+	size_t	  m_nSize;				// capacity of m_pBuffer
 	char	 *m_pInPtr;
+	boolean	  m_bExternal;				// m_pBuffer is not owned
+	size_t	  m_nTruncated;				// bytes not fitting into external buffer
+	char	  m_InlineBuffer[STRING_INLINE_SIZE];
 };
 
 #endif
@@ -2,7 +2,7 @@
 // synchronize.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -74,7 +74,17 @@ void LeaveCritical (void);
 					      "mcr p15, 0, %0, c7, c10, 4\n" : : "r" (0) : "memory")
 #define CleanDataCache()	asm volatile ("mcr p15, 0, %0, c7, c10, 0\n" \
 					      "mcr p15, 0, %0, c7, c10, 4\n" : : "r" (0) : "memory")
+#define CleanAndInvalidateDataCache()	\
+				asm volatile ("mcr p15, 0, %0, c7, c14, 0\n" \
+					      "mcr p15, 0, %0, c7, c10, 4\n" : : "r" (0) : "memory")
+
+// range operations for larger ranges are done on the whole data cache (single core only)
+#ifndef DATA_CACHE_RANGE_MAX
+#define DATA_CACHE_RANGE_MAX		0x8000
+#endif
 
+void CleanDataCacheRange (u32 nAddress, u32 nLength) MAXOPT;		// before DMA to device
+void InvalidateDataCacheRange (u32 nAddress, u32 nLength) MAXOPT;	// DMA from device
 void CleanAndInvalidateDataCacheRange (u32 nAddress, u32 nLength) MAXOPT;
 
 void SyncDataAndInstructionCache (void);
@@ -94,6 +104,11 @@ void SyncDataAndInstructionCache (void);
 #define PeripheralEntry()	DataSyncBarrier()
 #define PeripheralExit()	DataMemBarrier()
 
+//
+// Wait for interrupt
+//
+#define WaitForInterrupt()	asm volatile ("mcr p15, 0, %0, c7, c0,  4" : : "r" (0) : "memory")
+
 #else
 
 //
@@ -114,7 +129,22 @@ void SyncDataAndInstructionCache (void);
 void InvalidateDataCacheL1Only (void);
 void InvalidateDataCache (void);
 void CleanDataCache (void);
-void CleanAndInvalidateDataCacheRange (u32 nAddress, u32 nLength);
+void CleanAndInvalidateDataCache (void);
+
+// range operations for larger ranges are done on the whole data cache (single core only),
+// the default is about the size of the L1 and L2 data caches
+#ifndef DATA_CACHE_RANGE_MAX
+#if RASPPI <= 3
+#define DATA_CACHE_RANGE_MAX		0x88000
+#else
+#define DATA_CACHE_RANGE_MAX		0x108000
+#endif
+#endif
+
+// synchronize.cpp
+void CleanDataCacheRange (u32 nAddress, u32 nLength) MAXOPT;		// before DMA to device
+void InvalidateDataCacheRange (u32 nAddress, u32 nLength) MAXOPT;	// DMA from device
+void CleanAndInvalidateDataCacheRange (u32 nAddress, u32 nLength) MAXOPT;
 
 void SyncDataAndInstructionCache (void);
 
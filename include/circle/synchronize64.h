@@ -68,9 +68,20 @@ void LeaveCritical (void);
 void InvalidateDataCache (void) MAXOPT;
 void InvalidateDataCacheL1Only (void) MAXOPT;
 void CleanDataCache (void) MAXOPT;
+void CleanAndInvalidateDataCache (void) MAXOPT;
+
+// range operations for larger ranges are done on the whole data cache (single core only),
+// the default is about the size of the L1 and L2 data caches
+#ifndef DATA_CACHE_RANGE_MAX
+#if RASPPI <= 3
+#define DATA_CACHE_RANGE_MAX		0x88000
+#else
+#define DATA_CACHE_RANGE_MAX		0x108000
+#endif
+#endif
 
-void InvalidateDataCacheRange (u64 nAddress, u64 nLength) MAXOPT;
-void CleanDataCacheRange (u64 nAddress, u64 nLength) MAXOPT;
+void InvalidateDataCacheRange (u64 nAddress, u64 nLength) MAXOPT;	// DMA from device
+void CleanDataCacheRange (u64 nAddress, u64 nLength) MAXOPT;		// before DMA to device
 void CleanAndInvalidateDataCacheRange (u64 nAddress, u64 nLength) MAXOPT;
 
 void SyncDataAndInstructionCache (void);
@@ -68,8 +68,9 @@
 // (buckets). Each free list contains blocks of a specific size. On
 // block allocation the requested block size is rounded up to the
 // size of next available bucket size. If the requested size is greater
-// than the largest available bucket size, the block can be allocated,
-// but the memory space is lost, if the block will be freed later.
+// than the largest available bucket size, the block is allocated from
+// a separate free list of large blocks, where adjacent free blocks are
+// merged on free, or from the remaining heap space otherwise.
 // Because the block buckets have to be walked through on each allocate
 // and free operation, it is preferable to have only a few buckets.
 // With this option you can configure the bucket sizes, so that they
@@ -81,6 +82,28 @@
 #define HEAP_BLOCK_BUCKET_SIZES	0x40,0x400,0x1000,0x4000,0x10000,0x40000,0x80000
 #endif
 
+// HEAP_CORE_CACHE_BATCH configures the per-core caches of free heap
+// blocks, which are used, when ARM_ALLOW_MULTI_CORE is defined. Each
+// core keeps a small number of free blocks of each bucket size for its
+// own use, so that most allocate and free operations do not need to
+// acquire the spin lock of the heap, which is shared by all cores.
+// Blocks are moved between a core cache and the shared free lists in
+// batches of this number of blocks. Set this to 0 to disable the core
+// caches.
+
+#ifndef HEAP_CORE_CACHE_BATCH
+#define HEAP_CORE_CACHE_BATCH	8
+#endif
+
+// HEAP_CORE_CACHE_MAX_SIZE is the largest bucket size, for which
+// blocks are held in the per-core caches. Larger blocks are always
+// managed on the shared free lists, to avoid that much memory is
+// bound to a single core.
+
+#ifndef HEAP_CORE_CACHE_MAX_SIZE
+#define HEAP_CORE_CACHE_MAX_SIZE	0x4000
+#endif
+
 ///////////////////////////////////////////////////////////////////////
 //
 // Raspberry Pi 1, Zero (W) and Zero 2 W
@@ -196,6 +219,22 @@
 
 //#define REALTIME
 
+// TICKLESS_IDLE lets CTimer::IdleWait() (used by the scheduler, when no
+// task is ready to run on core 0) halt the CPU with WFI and suppress the
+// periodic timer tick meanwhile. The timer is programmed to the next due
+// kernel timer or sleeping task instead, which saves power. Periodic
+// handlers, which have been registered with bNeedsIdleTicks == FALSE,
+// are not called during that time. The idle time is limited to
+// TICKLESS_MAX_IDLE_TICKS timer ticks (1/HZ seconds). With
+// ARM_ALLOW_MULTI_CORE the tick is not suppressed, because other cores
+// may wake up tasks on core 0 without an interrupt.
+
+//#define TICKLESS_IDLE
+
+#ifndef TICKLESS_MAX_IDLE_TICKS
+#define TICKLESS_MAX_IDLE_TICKS		100
+#endif
+
 // USE_USB_SOF_INTR improves the compatibility with low-/full-speed
 // USB devices. If your application uses such devices, this option
 // should normally be set. Unfortunately this causes a heavily changed
@@ -223,6 +262,26 @@
 #define USE_USB_SOF_INTR
 #endif
 
+// USB_SET_ADDRESS_DELAY_MS, USB_SET_CONFIG_DELAY_MS and
+// USB_PORT_RESET_RECOVERY_MS define the delays in milliseconds, which
+// are inserted after setting the address and the configuration of an
+// USB device and after the reset of an USB port. The defaults are
+// conservative, the USB 2.0 spec requires 2, 0 and 10 ms only. Smaller
+// values shorten the enumeration of the USB, but may not work with all
+// devices.
+
+#ifndef USB_SET_ADDRESS_DELAY_MS
+#define USB_SET_ADDRESS_DELAY_MS	50
+#endif
+
+#ifndef USB_SET_CONFIG_DELAY_MS
+#define USB_SET_CONFIG_DELAY_MS		50
+#endif
+
+#ifndef USB_PORT_RESET_RECOVERY_MS
+#define USB_PORT_RESET_RECOVERY_MS	20
+#endif
+
 // SCREEN_DMA_BURST_LENGTH enables using DMA for scrolling the screen
 // contents and set the burst length parameter for the DMA controller.
 // Using DMA speeds up the scrolling, especially with a burst length
@@ -234,6 +293,15 @@
 #define SCREEN_DMA_BURST_LENGTH	2
 #endif
 
+// SCREEN_HW_SCROLL lets CScreenDevice allocate a frame buffer with the
+// double virtual height and scroll the whole screen by moving the
+// visible window (virtual offset) through it. The screen contents have
+// to be copied only, when the window reaches the end of the buffer.
+// This speeds up heavy console output, but the frame buffer returned
+// from CScreenDevice::GetFrameBuffer() is in use for scrolling then.
+
+//#define SCREEN_HW_SCROLL
+
 // CALIBRATE_DELAY activates the calibration of the delay loop. Because
 // this loop is normally not used any more in Circle, the only use of
 // this option is that the "SpeedFactor" of your system is displayed.
@@ -249,12 +317,6 @@
 //
 ///////////////////////////////////////////////////////////////////////
 
-// MAX_TASKS is the maximum number of tasks in the system.
-
-#ifndef MAX_TASKS
-#define MAX_TASKS		20
-#endif
-
 // TASK_STACK_SIZE is the stack size for each task.
 
 #ifndef TASK_STACK_SIZE
@@ -350,11 +412,13 @@
 #define SD_HIGH_SPEED
 #endif
 
-// SAVE_VFP_REGS_ON_IRQ enables saving the floating point registers
-// on entry when an IRQ occurs and will restore these registers on exit
-// from the IRQ handler. This has to be defined, if an IRQ handler
-// modifies floating point registers. IRQ handling will be a little
-// slower then.
+// SAVE_VFP_REGS_ON_IRQ enables saving the floating point registers,
+// when an IRQ handler modifies them, and will restore these registers
+// on exit from the IRQ handler. This has to be defined, if an IRQ
+// handler modifies floating point registers. The floating point unit
+// is disabled on IRQ entry and the registers are saved lazily, when
+// the first floating point instruction traps. IRQ handlers, which do
+// not use floating point registers, are only a little slower then.
 
 //#define SAVE_VFP_REGS_ON_IRQ
 
@@ -366,6 +430,14 @@
 
 //#define SAVE_VFP_REGS_ON_FIQ
 
+// USE_NEON_MEMCPY enables the use of NEON registers in memcpy(),
+// memmove() and memset() on the Raspberry Pi 2 and later. Because these
+// functions are called from IRQ and FIQ handlers too, this option is
+// ignored, unless SAVE_VFP_REGS_ON_IRQ and SAVE_VFP_REGS_ON_FIQ are
+// defined as well. Otherwise the integer registers are used.
+
+//#define USE_NEON_MEMCPY
+
 // LEAVE_QEMU_ON_HALT can be defined to exit QEMU when halt() is
 // called or main() returns EXIT_HALT. QEMU has to be started with the
 // -semihosting option, so that this works. This option must not be
@@ -380,6 +452,69 @@
 
 //#define USE_QEMU_USB_FIX
 
+// TRACEPOINTS enables the static tracepoints in the system (task
+// switch, IRQ entry and exit, network packet hops, USB request
+// completion). They write an event to CTracer, if an instance of this
+// class exists and has been started. Without this option the
+// tracepoints are not compiled in.
+
+//#define TRACEPOINTS
+
+// LATENCY_PROBES enables recording the wake-up latency of tasks in the
+// scheduler (see CScheduler::GetWakeLatency()) and the completion
+// latency of DMA transfers with completion routine (see
+// CDMAChannel::GetCompletionLatency()) into histograms. This costs a
+// read of the system clock on each wake-up and task switch.
+
+//#define LATENCY_PROBES
+
+// IRQ_STATISTICS enables measuring the execution time of each IRQ
+// handler and of the FIQ handler (see CInterruptSystem::
+// GetIRQStatistics()). This costs two reads of the ARM generic timer
+// counter per interrupt. A warning is logged, if an IRQ occurs more
+// than IRQ_STORM_THRESHOLD times within one second.
+
+//#define IRQ_STATISTICS
+
+// SPINLOCK_STATISTICS enables counting the acquisitions of each
+// CTicketSpinLock, how often it was contended and how long the cores
+// waited for it (see CTicketSpinLock::GetStatistics()). This costs some
+// instructions on each acquisition.
+
+//#define SPINLOCK_STATISTICS
+
+#ifndef IRQ_STORM_THRESHOLD
+#define IRQ_STORM_THRESHOLD	20000
+#endif
+
+// UDP_RX_QUEUE_DEPTH is the default maximum number of received
+// datagrams, which are queued on an UDP socket, until they are read by
+// the application. Further datagrams are dropped and counted then. It
+// can be changed per socket with CSocket::SetOptionRxQueueDepth(). 0
+// means unlimited, which may exhaust the heap with a fast sender.
+
+#ifndef UDP_RX_QUEUE_DEPTH
+#define UDP_RX_QUEUE_DEPTH	256
+#endif
+
+// NET_JUMBO_FRAMES increases the size of the network frame buffers to
+// 4 KByte, so that a MTU of up to 4000 bytes can be set with
+// CNetConfig::SetMTU() on net devices, which support it (currently
+// only the on-board Ethernet of the Raspberry Pi 4). IP datagrams are
+// reassembled from fragments up to this buffer size too. Each net
+// buffer uses this amount of memory, even for small packets.
+
+//#define NET_JUMBO_FRAMES
+
+// IP_REASSEMBLY_MAX_DATAGRAMS is the maximum number of fragmented IP
+// datagrams, which are reassembled at the same time. One net buffer is
+// allocated for each of them. If more datagrams arrive, the oldest one
+// is dropped.
+
+#ifndef IP_REASSEMBLY_MAX_DATAGRAMS
+#define IP_REASSEMBLY_MAX_DATAGRAMS	8
+#endif
+
 ///////////////////////////////////////////////////////////////////////
 
 #include <circle/memorymap.h>
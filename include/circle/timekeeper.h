@@ -0,0 +1,114 @@
+//
+/// \file timekeeper.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_timekeeper_h
+#define _circle_timekeeper_h
+
+#include <circle/timer.h>
+#include <circle/spinlock.h>
+#include <circle/types.h>
+
+#define TIMEKEEPER_STEP_THRESHOLD_NS	128000000LL	///< Larger offsets are stepped
+#define TIMEKEEPER_MAX_SLEW_PPB		500000		///< Max. frequency correction
+
+/// \note The clock is derived from the ARM generic timer (with USE_PHYSICAL_COUNTER) or from
+///	  the 64-bit system timer otherwise. The conversion parameters are kept twice and are
+///	  switched with a sequence counter, so that the reader never waits for the writer.
+///	  GetTimeNs() and GetMonotonicNs() can be called from any core and from IRQ and FIQ
+///	  context.
+/// \note The real time is set with SetTime() (e.g. at boot from a RTC with second resolution)
+///	  and is disciplined with Adjust() (e.g. from NTP, see CNTPDaemon). Small offsets are
+///	  slewed by modifying the clock frequency, the monotonic clock never jumps.
+
+class CTimeKeeper	/// Monotonic and real time clock in nanoseconds with frequency slewing
+{
+public:
+	CTimeKeeper (void);
+	~CTimeKeeper (void);
+
+	/// \brief Starts the periodic re-basing of the conversion (requires CTimer)
+	boolean Initialize (void);
+
+	/// \return Nanoseconds since construction, never goes backwards
+	u64 GetMonotonicNs (void) const;
+	/// \return Nanoseconds since 1970-01-01 00:00:00 UTC\n
+	///	    (since construction, if the time has not been set)
+	u64 GetTimeNs (void) const;
+
+	/// \return Has the real time been set?
+	boolean IsTimeSet (void) const;
+
+	/// \brief Step the real time
+	/// \param nTimeNs Nanoseconds since 1970-01-01 00:00:00 UTC
+	void SetTime (u64 nTimeNs);
+
+	/// \brief Correct the real time by an measured offset
+	/// \param nOffsetNs Reference time minus local time
+	/// \note Offsets up to TIMEKEEPER_STEP_THRESHOLD_NS are slewed, the frequency error is
+	///	  estimated from consecutive calls, which should be at least some seconds apart.
+	void Adjust (s64 nOffsetNs);
+
+	/// \return Current frequency correction in ppb (without phase slewing)
+	int GetFrequencyPPB (void) const;
+
+	static CTimeKeeper *Get (void);
+
+private:
+	struct TParams
+	{
+		u64	nBaseCounter;
+		u64	nBaseNs;		// monotonic
+		u64	nMult;			// ns per counter tick << SHIFT
+		s64	nRealtimeOffsetNs;
+	};
+
+	void GetParams (TParams *pParams) const;
+	void SetParams (const TParams &rParams);	// m_SpinLock must be acquired
+
+	static u64 Convert (const TParams &rParams, u64 nCounter);
+
+	void Rebase (void);				// m_SpinLock must be acquired
+	u64 GetMult (void) const;
+
+	static u64 ReadCounter (void);
+
+	static void RebaseHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext);
+
+private:
+	TParams m_Params[2];
+	volatile u32 m_nSequence;
+
+	u64 m_nCounterFrequency;
+	u64 m_nNominalMult;
+
+	int m_nFrequencyPPB;
+	int m_nSlewPPB;
+	u64 m_nSlewEndNs;			// monotonic
+
+	boolean m_bTimeSet;
+	u64 m_nLastAdjustNs;			// monotonic, 0 if not adjusted yet
+
+	CKernelTimer m_RebaseTimer;
+
+	CSpinLock m_SpinLock;			// serializes the writers
+
+	static CTimeKeeper *s_pThis;
+};
+
+#endif
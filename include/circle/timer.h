@@ -2,7 +2,7 @@
 /// \file timer.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,7 +22,8 @@
 
 #include <circle/interrupt.h>
 #include <circle/string.h>
-#include <circle/ptrlist.h>
+#include <circle/intrusivelist.h>
+#include <circle/timerwheel.h>
 #include <circle/sysconfig.h>
 #include <circle/spinlock.h>
 #include <circle/types.h>
@@ -44,6 +45,22 @@ typedef void TPeriodicTimerHandler (void);
 
 extern "C" void DelayLoop (unsigned nCount);
 
+struct TKernelTimer : TIntrusiveListNode	/// Internal state of a kernel timer
+{
+#ifndef NDEBUG
+	unsigned	     m_nMagic;
+#define KERNEL_TIMER_MAGIC	0x4B544D43
+#endif
+	TKernelTimerHandler *m_pHandler;
+	unsigned	     m_nElapsesAt;
+	void 		    *m_pParam;
+	void 		    *m_pContext;
+	boolean		     m_bPending;	// on the list of running timers
+	boolean		     m_bOwned;		// by CKernelTimer, otherwise pooled
+};
+
+class CKernelTimer;
+
 class CTimer	/// Manages the system clock, supports kernel timers and a calibrated delay loop
 {
 public:
@@ -66,6 +83,8 @@ public:
 
 	/// \return Current clock ticks of an 1 MHz counter, may wrap
 	static unsigned GetClockTicks (void);
+	/// \return Current clock ticks of an 1 MHz counter, 64-bit (does not wrap in practice)
+	static u64 GetClockTicks64 (void);
 #define CLOCKHZ	1000000
 
 	/// \return 1/HZ seconds since system boot, may wrap
@@ -107,6 +126,8 @@ public:
 	/// \param pParam	First user defined parameter to hand over to the handler
 	/// \param pContext	Second user defined parameter to hand over to the handler
 	/// \return Timer handle (cannot be 0)
+	/// \note The timer objects are taken from a pool, which grows on demand.\n
+	///	  For timers, which are restarted frequently, better use CKernelTimer.
 	TKernelTimerHandle StartKernelTimer (unsigned nDelay,
 					     TKernelTimerHandler *pHandler,
 					     void *pParam   = 0,
@@ -116,6 +137,26 @@ public:
 	/// \param hTimer	Timer handle
 	void CancelKernelTimer (TKernelTimerHandle hTimer);
 
+	/// \brief Starts a high-resolution kernel timer, which elapses after a given delay\n
+	///	   in microseconds, a timer handler gets called then
+	/// \param nDelayMicros Timer elapses after this number of microseconds (< 2^31)
+	/// \param pHandler	The handler to be called when the timer elapses
+	/// \param pParam	First user defined parameter to hand over to the handler
+	/// \param pContext	Second user defined parameter to hand over to the handler
+	/// \return Timer handle (cannot be 0)
+	/// \note The handler is called from the system timer IRQ (ARM_IRQ_TIMER3) on core 0.
+	/// \note Timers are kept on a timer wheel, so that start, cancel and expiry take\n
+	///	  constant time, independent of the number of running timers.
+	TKernelTimerHandle StartHighResTimer (unsigned nDelayMicros,
+					      TKernelTimerHandler *pHandler,
+					      void *pParam   = 0,
+					      void *pContext = 0);
+	/// \brief Cancel a running high-resolution timer,\n
+	/// The timer will not elapse any more.
+	/// \param hTimer	Timer handle
+	/// \note Must not be called, after the handler of this timer has been called.
+	void CancelHighResTimer (TKernelTimerHandle hTimer);
+
 	/// When a CTimer object is available better use this instead of SimpleMsDelay()\n
 	/// \param nMilliSeconds Delay in milliseconds (<= 2000)
 	void MsDelay (unsigned nMilliSeconds)	{ SimpleMsDelay (nMilliSeconds); }
@@ -141,13 +182,51 @@ public:
 	void RegisterUpdateTimeHandler (TUpdateTimeHandler *pHandler);
 
 	/// \param pHandler Handler which is called on each timer tick (HZ times per second)
-	void RegisterPeriodicHandler (TPeriodicTimerHandler *pHandler);
+	/// \param bNeedsIdleTicks Must the handler be called, while the system waits in IdleWait()?
+	/// \note With TICKLESS_IDLE the tick is suppressed in IdleWait(), if all handlers\n
+	///	  have been registered with bNeedsIdleTicks == FALSE.
+	void RegisterPeriodicHandler (TPeriodicTimerHandler *pHandler,
+				      boolean bNeedsIdleTicks = TRUE);
+
+	/// \brief Halts the CPU with WFI until an interrupt occurs
+	/// \param nWakeTicks Return not later than at this time (in clock ticks (1 MHz))
+	/// \param bWakeTicksValid Is nWakeTicks valid? (otherwise wait for any interrupt)
+	/// \note Must be called on core 0 with IRQs disabled (e.g. from EnterCritical()),\n
+	///	  so that no wake-up condition can be lost before WFI is executed.
+	/// \note With TICKLESS_IDLE the timer tick is suppressed until the next kernel timer\n
+	///	  or nWakeTicks are due. Otherwise the next timer tick ends the wait.
+	void IdleWait (unsigned nWakeTicks = 0, boolean bWakeTicksValid = FALSE);
 
 private:
+#ifndef USE_PHYSICAL_COUNTER
+	typedef u32 TCounter;			// system timer counter (1 MHz)
+	typedef s32 TSignedCounter;
+#else
+	typedef u64 TCounter;			// ARM generic timer counter
+	typedef s64 TSignedCounter;
+#endif
+	static TCounter ReadCounter (void);
+	void WriteCompare (TCounter nCompare);
+
+	static void WriteSystemTimerCompare (u32 nCompare);
+
+	unsigned UpdateTicks (void);		// updates time and m_nNextTick from the counter,
+						// returns the number of elapsed ticks
 	void PollKernelTimers (void);
 
+	friend class CKernelTimer;
+	void AddKernelTimer (TKernelTimer *pTimer, unsigned nDelay);
+	void RemoveKernelTimer (TKernelTimer *pTimer);
+
+	void ProgramHighResTimer (void);	// m_HighResTimerSpinLock must be acquired
+	void PollHighResTimers (void);
+	static void HighResTimerWheelHandler (TTimerWheelEntry *pEntry, void *pContext);
+
 	void InterruptHandler (void);
 	static void InterruptHandler (void *pParam);
+#ifdef USE_PHYSICAL_COUNTER
+	static void HighResInterruptHandler (void *pParam);
+#endif
 
 	void TuneMsDelay (void);
 
@@ -158,19 +237,22 @@ public:
 private:
 	CInterruptSystem	*m_pInterruptSystem;
 
-#if defined (USE_PHYSICAL_COUNTER) && AARCH == 64
-	u32			 m_nClockTicksPerHZTick;
-#endif
+	u32			 m_nClockTicksPerHZTick;	// counter ticks
+	TCounter		 m_nNextTick;			// counter value of next tick
 
 	volatile unsigned	 m_nTicks;
 	volatile unsigned	 m_nUptime;
 	volatile unsigned	 m_nTime;			// local time
-	CSpinLock		 m_TimeSpinLock;
+	CTicketSpinLock		 m_TimeSpinLock;
 
 	int			 m_nMinutesDiff;		// diff to UTC
 
-	CPtrList		 m_KernelTimerList;
-	CSpinLock		 m_KernelTimerSpinLock;
+	CIntrusiveList<TKernelTimer> m_KernelTimerList;
+	CIntrusiveList<TKernelTimer> m_KernelTimerPool;		// free timers for StartKernelTimer()
+	CTicketSpinLock		 m_KernelTimerSpinLock;
+
+	CTimerWheel		 m_HighResTimerWheel;
+	CSpinLock		 m_HighResTimerSpinLock;
 
 	unsigned		 m_nMsDelay;
 	unsigned		 m_nusDelay;
@@ -180,6 +262,7 @@ private:
 #define TIMER_MAX_PERIODIC_HANDLERS	4
 	TPeriodicTimerHandler	*m_pPeriodicHandler[TIMER_MAX_PERIODIC_HANDLERS];
 	volatile unsigned	 m_nPeriodicHandlers;
+	unsigned		 m_nIdlePeriodicHandlers;	// with bNeedsIdleTicks
 
 	static CTimer *s_pThis;
 
@@ -187,4 +270,39 @@ private:
 	static const char *s_pMonthName[12];
 };
 
+class CKernelTimer	/// Kernel timer object, which is owned by the caller and can be re-armed
+{
+public:
+	/// \param pHandler	The handler to be called when the timer elapses
+	/// \param pParam	First user defined parameter to hand over to the handler
+	/// \param pContext	Second user defined parameter to hand over to the handler
+	CKernelTimer (TKernelTimerHandler *pHandler = 0, void *pParam = 0, void *pContext = 0);
+	/// \note Cancels the timer. Must not be called while its handler is running.
+	~CKernelTimer (void);
+
+	/// \brief Sets the handler and its parameters, the timer must not be running
+	void SetHandler (TKernelTimerHandler *pHandler, void *pParam = 0, void *pContext = 0);
+
+	/// \brief Starts the timer, a running timer is restarted with the new delay
+	/// \param nDelay	Timer elapses after nDelay/HZ seconds from now
+	/// \note Can be called from the handler of this timer. Does not allocate memory.
+	void Start (unsigned nDelay);
+
+	/// \brief Cancels the timer, if it is running (takes constant time)
+	void Cancel (void);
+
+	/// \return Is the timer running? (FALSE, when its handler has been called)
+	boolean IsRunning (void) const;
+
+	/// \return Handle, which is handed over to the handler
+	TKernelTimerHandle GetHandle (void) const	{ return (TKernelTimerHandle) &m_Timer; }
+
+private:
+	CKernelTimer (const CKernelTimer &) = delete;
+	CKernelTimer &operator = (const CKernelTimer &) = delete;
+
+private:
+	TKernelTimer m_Timer;
+};
+
 #endif
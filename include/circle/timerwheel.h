@@ -0,0 +1,100 @@
+//
+// timerwheel.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_timerwheel_h
+#define _circle_timerwheel_h
+
+#include <circle/types.h>
+
+struct TTimerWheelEntry		/// Embed this into the object, which has to be timed
+{
+	TTimerWheelEntry	*pNext;
+	TTimerWheelEntry	*pPrev;
+	unsigned		 nExpires;	// in clock ticks (1 MHz), may wrap
+	unsigned		 nSlot;
+	void			*pParam;	// free for use by the owner
+};
+
+typedef void TTimerWheelHandler (TTimerWheelEntry *pEntry, void *pContext);
+
+/// \note Entries are sorted into a hierarchical timer wheel with four levels. The first\n
+///	  level has a resolution of 64 microseconds, an entry is expired exactly on its\n
+///	  expiry time nevertheless. Add(), Remove() and the expiry of an entry take\n
+///	  constant time, independent of the number of entries.
+/// \note The maximum delay is 2^31 clock ticks (about 35 minutes).
+/// \note This class is not reentrant, the caller has to provide the locking.
+
+class CTimerWheel	/// Timer wheel for a large number of timed objects
+{
+public:
+	/// \param nNow Current clock ticks (from CTimer::GetClockTicks())
+	CTimerWheel (unsigned nNow = 0);
+	~CTimerWheel (void);
+
+	/// \param nNow Current clock ticks, the wheel must be empty
+	void Reset (unsigned nNow);
+
+	/// \param pEntry Entry to be added (must not be on a wheel)
+	/// \param nExpires Expiry time in clock ticks
+	void Add (TTimerWheelEntry *pEntry, unsigned nExpires);
+
+	/// \param pEntry Entry to be removed (must be on this wheel)
+	void Remove (TTimerWheelEntry *pEntry);
+
+	/// \return Are there no entries on the wheel?
+	boolean IsEmpty (void) const		{ return m_nEntries == 0; }
+
+	/// \brief Removes all entries with an expiry time <= nNow and calls the handler for them
+	/// \param nNow Current clock ticks
+	/// \param pHandler Called for each expired entry, which has already been removed
+	/// \param pContext User parameter handed over to the handler
+	/// \note The handler may add entries to the wheel again.
+	void Expire (unsigned nNow, TTimerWheelHandler *pHandler, void *pContext);
+
+	/// \param pExpires Earliest time, at which Expire() has to be called again (clock ticks)
+	/// \return FALSE, if the wheel is empty
+	/// \note The returned time is exact for entries, which expire in the next 16 ms, and\n
+	///	  the time, when the entries are cascaded down, for entries further away.
+	boolean GetNextExpiry (unsigned *pExpires) const;
+
+private:
+	void Insert (TTimerWheelEntry *pEntry);
+	void Cascade (void);
+	void CascadeSlot (unsigned nSlot);
+	unsigned FindNextSlot (unsigned nIndex) const;	// in level 0
+
+private:
+	static const unsigned Shift = 6;		// level 0 resolution 2^6 ticks
+	static const unsigned JiffyMask = (1U << (32-Shift)) - 1;
+
+	static const unsigned Level0Bits = 8;
+	static const unsigned Level0Size = 1U << Level0Bits;
+	static const unsigned LevelNBits = 6;
+	static const unsigned LevelNSize = 1U << LevelNBits;
+	static const unsigned Levels = 4;
+	static const unsigned Slots = Level0Size + (Levels-1) * LevelNSize;
+
+	unsigned m_nBase;		// next jiffy to be processed (clock ticks >> Shift)
+	unsigned m_nEntries;
+
+	TTimerWheelEntry *m_pSlot[Slots];
+	u32 m_Bitmap[Level0Size / 32];	// non-empty slots of level 0
+};
+
+#endif
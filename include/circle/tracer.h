@@ -2,8 +2,8 @@
 // tracer.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014  R. Stange <rsta2@o2online.de>
-// 
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
+//
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
 // the Free Software Foundation, either version 3 of the License, or
@@ -20,42 +20,120 @@
 #ifndef _circle_tracer_h
 #define _circle_tracer_h
 
+#include <circle/device.h>
+#include <circle/sysconfig.h>
 #include <circle/types.h>
 
 struct TTraceEntry
 {
-	unsigned nClockTicks;
+	u64 nTimestamp;				// counter ticks since Start()
 	unsigned nEventID;
-#define TRACER_EVENT_STOP	0
+#define TRACER_EVENT_STOP		0
+	// application events should use IDs below TRACER_EVENT_SYSTEM
+#define TRACER_EVENT_SYSTEM		0x10000
+#define TRACER_EVENT_TASK_SWITCH	(TRACER_EVENT_SYSTEM + 0)	// new task, old task
+#define TRACER_EVENT_IRQ_ENTRY		(TRACER_EVENT_SYSTEM + 1)	// IRQ number
+#define TRACER_EVENT_IRQ_EXIT		(TRACER_EVENT_SYSTEM + 2)	// IRQ number
+#define TRACER_EVENT_NET_DEV_RX		(TRACER_EVENT_SYSTEM + 3)	// buffer, length
+#define TRACER_EVENT_NET_DEV_TX		(TRACER_EVENT_SYSTEM + 4)	// buffer, length
+#define TRACER_EVENT_NET_IP_RX		(TRACER_EVENT_SYSTEM + 5)	// buffer, length, protocol
+#define TRACER_EVENT_NET_IP_TX		(TRACER_EVENT_SYSTEM + 6)	// buffer, length, protocol
+#define TRACER_EVENT_USB_COMPLETE	(TRACER_EVENT_SYSTEM + 7)	// request, status, length
 	unsigned nParam[4];
 };
 
+enum TTracerPhase			// how an event is shown in a Chrome trace
+{
+	TracerPhaseInstant,
+	TracerPhaseBegin,		// begins a duration on this core
+	TracerPhaseEnd			// ends the last duration on this core
+};
+
+#define TRACER_MAX_EVENT_NAMES		32
+
+/// \brief Output handler for WriteChromeTrace()
+typedef void TTracerWriteHandler (const void *pBuffer, size_t nLength, void *pParam);
+
+/// \note Events are recorded into a ring buffer per core. Event() is lock-free and can be\n
+///	  called from task, IRQ and FIQ context on any core at the same time. The time stamps\n
+///	  are taken from the CPU physical counter (Raspberry Pi 2 and later) and are\n
+///	  comparable across the cores.
+
 class CTracer
 {
 public:
+	/// \param nDepth Size of the ring buffer per core (number of events)
+	/// \param bStopIfFull Stop tracing, when a buffer is full (otherwise overwrite old events)
 	CTracer (unsigned nDepth, boolean bStopIfFull);
 	~CTracer (void);
 
 	void Start (void);
 	void Stop (void);
 
-	// not reentrant, use spin lock if required
 	void Event (unsigned nID, unsigned nParam1 = 0, unsigned nParam2 = 0, unsigned nParam3 = 0, unsigned nParam4 = 0);
 
+	/// \brief Set name and phase of an event for the Chrome trace output
+	/// \param nID Event ID
+	/// \param pName Event name (must be a static string)
+	/// \param Phase Event phase
+	void SetEventName (unsigned nID, const char *pName, TTracerPhase Phase = TracerPhaseInstant);
+
+	/// \brief Dump all events in time order to the logger (stops tracing)
 	void Dump (void);
 
+	/// \brief Write all events in the Chrome trace JSON format (stops tracing)
+	/// \param pHandler Called for each chunk of output (e.g. to write into a file or socket)
+	/// \param pParam Parameter handed over to pHandler
+	/// \note The output can be loaded into chrome://tracing or ui.perfetto.dev.
+	void WriteChromeTrace (TTracerWriteHandler *pHandler, void *pParam = 0);
+	/// \brief Write all events in the Chrome trace JSON format to a device (stops tracing)
+	void WriteChromeTrace (CDevice *pDevice);
+
 	static CTracer *Get (void);
 
 private:
-	unsigned	 m_nDepth;		// size of ring buffer
+	const TTraceEntry *GetNextEntry (unsigned *pIndex, unsigned *pCore) const;
+	const TTraceEntry *GetEntry (unsigned nCore, unsigned nIndex) const;
+	unsigned GetEntryCount (unsigned nCore) const;
+
+	u64 GetNanoseconds (u64 nTimestamp) const;
+	static u64 GetTimestamp (void);
+
+	static void DeviceWriteHandler (const void *pBuffer, size_t nLength, void *pParam);
+
+private:
+	unsigned	 m_nDepth;		// size of ring buffer per core
 	boolean		 m_bStopIfFull;
-	boolean		 m_bActive;
-	unsigned	 m_nStartTicks;
-	TTraceEntry	*m_pEntry;		// array used as ring buffer
-	unsigned	 m_nEntries;		// valid entries in ring buffer
-	unsigned	 m_nCurrent;		// write index into ring buffer
+	volatile boolean m_bActive;
+	u64		 m_nStartTimestamp;
+	u64		 m_nFrequency;		// of the time stamp counter
+
+	struct TCoreBuffer
+	{
+		TTraceEntry	*pEntry;	// array used as ring buffer
+		unsigned	 nWritten;	// total number of reserved entries
+	}
+	m_Buffer[CORES];
+
+	struct TEventName
+	{
+		unsigned	 nID;
+		const char	*pName;
+		TTracerPhase	 Phase;
+	}
+	m_EventName[TRACER_MAX_EVENT_NAMES];
+	unsigned m_nEventNames;
 
 	static CTracer *s_pThis;
 };
 
+// static tracepoint in system code, enabled with the system option TRACEPOINTS
+#ifdef TRACEPOINTS
+	#define TRACEPOINT(...)		do { CTracer *pTracer_ = CTracer::Get ();	\
+					     if (pTracer_ != 0)				\
+						pTracer_->Event (__VA_ARGS__); } while (0)
+#else
+	#define TRACEPOINT(...)		((void) 0)
+#endif
+
 #endif
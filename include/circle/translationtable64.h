@@ -28,6 +28,12 @@
 #define ATTRINDX_NORMAL		0
 #define ATTRINDX_DEVICE		1
 #define ATTRINDX_COHERENT	2
+#define ATTRINDX_UNCACHED	3
+
+// attributes for SetAttributes()
+#define TT_ATTR_READ_ONLY	(1 << 0)
+#define TT_ATTR_NO_EXEC		(1 << 1)
+#define TT_ATTR_UNCACHED	(1 << 2)	// normal memory, non-cacheable
 
 class CTranslationTable
 {
@@ -37,9 +43,23 @@ public:
 
 	uintptr GetBaseAddress (void) const;
 
+	/// \brief Change the attributes of a normal memory range at runtime
+	/// \param nAddress Start address of the range (must be page aligned)
+	/// \param nSize Size of the range in bytes (must be a multiple of the page size)
+	/// \param nAttributes TT_ATTR_* flags (or'ed together), 0 for read/write, cached
+	/// \return Operation successful?
+	/// \note A 512MB block mapping, which covers the range, is split into pages before.
+	/// \note Must not be called for the kernel image or the coherent/uncached regions.
+	boolean SetAttributes (uintptr nAddress, size_t nSize, unsigned nAttributes);
+
 private:
 	TARMV8MMU_LEVEL3_DESCRIPTOR *CreateLevel3Table (uintptr nBaseAddress) NOOPT;
 
+	void GetAttributes (u64 nAddress, unsigned *pAttrIndx, unsigned *pSH, unsigned *pPXN) NOOPT;
+	boolean IsUniformBlock (u64 nBaseAddress) NOOPT;
+
+	static void InvalidateTLB (void);
+
 private:
 	size_t m_nMemSize;
 
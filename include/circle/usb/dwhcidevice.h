@@ -32,6 +32,7 @@
 #include <circle/usb/dwhciregister.h>
 #include <circle/usb/dwhci.h>
 #include <circle/usb/usb.h>
+#include <circle/ptrlistfiq.h>
 #include <circle/spinlock.h>
 #include <circle/mphi.h>
 #include <circle/sysconfig.h>
@@ -39,6 +40,10 @@
 
 #define DWHCI_WAIT_BLOCKS	DWHCI_MAX_CHANNELS
 
+#ifndef DWHCI_MAX_PENDING_STAGES
+#define DWHCI_MAX_PENDING_STAGES	(DWHCI_MAX_CHANNELS*4)	// waiting for a channel
+#endif
+
 class CDWHCIDevice : public CUSBHostController
 {
 public:
@@ -90,8 +95,19 @@ private:
 	void QueueTransaction (CDWHCITransferStageData *pStageData);
 
 	void QueueDelayedTransaction (CDWHCITransferStageData *pStageData);
+#else
+	// start transaction on a free channel or queue it, until a channel is available
+	void ScheduleTransaction (CDWHCITransferStageData *pStageData);
+	// returns the oldest waiting transaction for an idle endpoint, call with channel lock held
+	CDWHCITransferStageData *DequeueWaitingTransaction (void);
+	// returns TRUE, if a transaction for this endpoint owns a channel (channel lock held)
+	boolean IsEndpointActive (CUSBEndpoint *pEndpoint) const;
+	// remove waiting transactions for device (all if 0)
+	void FlushWaitingTransactions (CUSBDevice *pUSBDevice = 0);
 #endif
 
+	void AssignChannel (unsigned nChannel, CDWHCITransferStageData *pStageData);
+
 	void StartTransaction (CDWHCITransferStageData *pStageData);
 	void StartChannel (CDWHCITransferStageData *pStageData);
 
@@ -140,6 +156,8 @@ private:
 
 #ifdef USE_USB_SOF_INTR
 	CDWHCITransactionQueue m_TransactionQueue;
+#else
+	CPtrListFIQ m_WaitingTransactions;		// protected by m_ChannelSpinLock
 #endif
 
 	CDWHCITransferStageData *m_pStageData[DWHCI_MAX_CHANNELS];
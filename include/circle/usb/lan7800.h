@@ -2,7 +2,7 @@
 // lan7800.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,6 +24,7 @@
 #include <circle/usb/usbfunction.h>
 #include <circle/usb/usbendpoint.h>
 #include <circle/usb/usbrequest.h>
+#include <circle/usb/usbbulkinqueue.h>
 #include <circle/macaddress.h>
 #include <circle/timer.h>
 #include <circle/types.h>
@@ -43,15 +44,42 @@ public:
 	// pBuffer must have size FRAME_BUFFER_SIZE
 	boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength);
 
+	// the frames are sent in one bulk transfer, as far as they fit
+	unsigned SendFrames (CNetBuffer *ppBuffer[], unsigned nCount);
+
+	// returns the frames from the completed bulk transfers
+	unsigned ReceiveFrames (CNetBuffer *ppBuffer[], unsigned nMaxCount);
+
+	// TCP/UDP checksums and TCP segmentation (TSO) are handled by the device
+	unsigned GetOffloadCapabilities (void);
+
 	// returns TRUE if PHY link is up
 	boolean IsLinkUp (void);
 	
 	TNetDeviceSpeed GetLinkSpeed (void);
 
+	// acknowledges the link change interrupt and restarts the interrupt request
+	boolean UpdatePHY (void);
+
+	// returns TRUE, if link changes are reported via the interrupt endpoint
+	boolean HasLinkInterrupt (void);
+
+	// the addresses are set as perfect filter entries 1..MAX_MULTICAST_ADDRESSES
+	boolean SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount);
+
 private:
 	boolean InitMACAddress (void);
 	boolean InitPHY (void);
 
+	boolean StartIntRequest (void);
+	void IntCompletionRoutine (CUSBRequest *pURB);
+	static void IntCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
+
+	// returns the next valid frame from the Rx buffer, continues with the next completed
+	// transfer, if the Rx buffer is empty
+	// *pChecksumOK is set, if the TCP/UDP checksum has been verified by the device
+	boolean GetRxFrame (const u8 **ppFrame, unsigned *pFrameLength, boolean *pChecksumOK = 0);
+
 	boolean PHYWrite (u8 uchIndex, u16 usValue);
 	boolean PHYRead (u8 uchIndex, u16 *pValue);
 
@@ -67,8 +95,22 @@ private:
 private:
 	CUSBEndpoint *m_pEndpointBulkIn;
 	CUSBEndpoint *m_pEndpointBulkOut;
+	CUSBEndpoint *m_pEndpointInterrupt;
 
 	CMACAddress m_MACAddress;
+	unsigned m_nMulticastCount;		// number of valid multicast filter entries
+
+	CUSBBulkInQueue *m_pRxQueue;
+	const u8 *m_pRxBuffer;			// holds multiple frames
+	unsigned m_nRxOffset;			// of next frame in m_pRxBuffer
+	unsigned m_nRxLength;			// of valid data in m_pRxBuffer
+
+	u8 *m_pTxBuffer;
+
+	u8 *m_pIntBuffer;
+	CUSBRequest *m_pIntURB;
+	volatile boolean m_bIntPending;
+	boolean m_bLinkInterrupt;
 };
 
 #endif
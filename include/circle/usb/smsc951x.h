@@ -2,7 +2,7 @@
 // smsc951x.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,6 +24,7 @@
 #include <circle/usb/usbfunction.h>
 #include <circle/usb/usbendpoint.h>
 #include <circle/usb/usbrequest.h>
+#include <circle/usb/usbbulkinqueue.h>
 #include <circle/macaddress.h>
 #include <circle/types.h>
 
@@ -41,13 +42,26 @@ public:
 	
 	// pBuffer must have size FRAME_BUFFER_SIZE
 	boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength);
+
+	// the frames are sent in one bulk transfer, as far as they fit
+	unsigned SendFrames (CNetBuffer *ppBuffer[], unsigned nCount);
+
+	// returns the frames from the completed bulk transfers
+	unsigned ReceiveFrames (CNetBuffer *ppBuffer[], unsigned nMaxCount);
 	
 	// returns TRUE if PHY link is up
 	boolean IsLinkUp (void);
 
 	TNetDeviceSpeed GetLinkSpeed (void);
 
+	// uses the 64-bit multicast hash filter
+	boolean SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount);
+
 private:
+	// returns the next valid frame from the Rx buffer, continues with the next completed
+	// transfer, if the Rx buffer is empty
+	boolean GetRxFrame (const u8 **ppFrame, unsigned *pFrameLength);
+
 	boolean PHYWrite (u8 uchIndex, u16 usValue);
 	boolean PHYRead (u8 uchIndex, u16 *pValue);
 	boolean PHYWaitNotBusy (void);
@@ -65,6 +79,13 @@ private:
 	CUSBEndpoint *m_pEndpointBulkOut;
 
 	CMACAddress m_MACAddress;
+
+	CUSBBulkInQueue *m_pRxQueue;
+	const u8 *m_pRxBuffer;			// holds multiple frames
+	unsigned m_nRxOffset;			// of next frame in m_pRxBuffer
+	unsigned m_nRxLength;			// of valid data in m_pRxBuffer
+
+	u8 *m_pTxBuffer;
 };
 
 #endif
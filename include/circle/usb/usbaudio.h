@@ -39,6 +39,48 @@ struct TUSBAudioEndpointDescriptor
 }
 PACKED;
 
+// Audio class interface subclasses
+#define AUDIO_SUBCLASS_AUDIOCONTROL	0x01
+#define AUDIO_SUBCLASS_AUDIOSTREAMING	0x02
+
+// Audio-streaming class-specific interface descriptor subtypes
+#define AS_GENERAL			0x01
+#define FORMAT_TYPE			0x02
+
+#define AUDIO_FORMAT_TAG_PCM		0x0001
+#define AUDIO_FORMAT_TYPE_I		0x01
+
+// Audio class requests
+#define AUDIO_REQUEST_SET_CUR		0x01
+#define AUDIO_EP_CONTROL_SAMPLING_FREQ	0x01
+
+// Audio-streaming class-specific interface descriptor
+struct TUSBAudioStreamingInterfaceDescriptor
+{
+	unsigned char	bLength;
+	unsigned char	bDescriptorType;
+	unsigned char	bDescriptorSubtype;		// AS_GENERAL
+	unsigned char	bTerminalLink;
+	unsigned char	bDelay;
+	unsigned short	wFormatTag;
+}
+PACKED;
+
+// Type I format type descriptor
+struct TUSBAudioTypeIFormatTypeDescriptor
+{
+	unsigned char	bLength;
+	unsigned char	bDescriptorType;
+	unsigned char	bDescriptorSubtype;		// FORMAT_TYPE
+	unsigned char	bFormatType;
+	unsigned char	bNrChannels;
+	unsigned char	bSubframeSize;
+	unsigned char	bBitResolution;
+	unsigned char	bSamFreqType;			// 0: continuous (lower and upper bound)
+	unsigned char	tSamFreq[][3];
+}
+PACKED;
+
 // MIDI-streaming class-specific endpoint descriptor
 struct TUSBMIDIStreamingEndpointDescriptor
 {
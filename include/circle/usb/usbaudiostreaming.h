@@ -0,0 +1,109 @@
+//
+/// \file usbaudiostreaming.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_usb_usbaudiostreaming_h
+#define _circle_usb_usbaudiostreaming_h
+
+#include <circle/usb/usbfunction.h>
+#include <circle/usb/usbendpoint.h>
+#include <circle/usb/usbrequest.h>
+#include <circle/numberpool.h>
+#include <circle/types.h>
+
+#ifndef USB_AUDIO_NUM_URBS
+#define USB_AUDIO_NUM_URBS	2		// isochronous URBs queued at once (>= 2)
+#endif
+
+#define USB_AUDIO_MAX_RATES	8
+
+/// \param pBuffer    Buffer where the samples have to be placed (interleaved left, right)
+/// \param nChunkSize Size of the buffer in words
+/// \param pParam     User parameter
+/// \return Number of words written to the buffer, transfer will stop if 0 is returned
+/// \note Is called from interrupt context
+typedef unsigned TUSBAudioChunkCallback (s16 *pBuffer, unsigned nChunkSize, void *pParam);
+
+class CUSBAudioStreamingDevice : public CUSBFunction	/// Driver for USB Audio Class 1.0 output streaming interfaces
+{
+public:
+	CUSBAudioStreamingDevice (CUSBFunction *pFunction);
+	~CUSBAudioStreamingDevice (void);
+
+	boolean Configure (void);
+
+	/// \param nSampleRate Sample rate in Hz
+	/// \return Is this sample rate supported by the device?
+	boolean IsSampleRateSupported (unsigned nSampleRate) const;
+
+	/// \brief Select the streaming interface and set the sample rate
+	/// \param nSampleRate Sample rate in Hz
+	/// \return Operation successful?
+	/// \note Must not be called while active
+	boolean Setup (unsigned nSampleRate);
+
+	/// \brief Register the callback, which provides the samples (16-bit signed stereo)
+	/// \param pCallback Pointer to the callback
+	/// \param pParam User parameter to be handed over to the callback
+	void RegisterChunkCallback (TUSBAudioChunkCallback *pCallback, void *pParam = 0);
+
+	/// \brief Starts the continuous transmission of the isochronous packets
+	/// \return Operation successful?
+	boolean Start (void);
+
+	/// \brief Stops the transmission after the queued URBs have completed
+	void Stop (void);
+
+	/// \return Is the transmission running?
+	boolean IsActive (void) const;
+
+private:
+	boolean SubmitURB (unsigned nURB);		// returns FALSE, if the stream ends
+	void CompletionRoutine (CUSBRequest *pURB, unsigned nURB);
+	static void CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
+
+private:
+	CUSBEndpoint *m_pEndpointOut;
+	u8 m_uchEndpointAddress;
+	u16 m_usMaxPacketSize;
+	u8 m_uchAlternateSetting;
+	unsigned m_nPacketsPerSecond;
+
+	// supported sample rates
+	boolean m_bContinuousRate;
+	unsigned m_nNumRates;
+	unsigned m_Rate[USB_AUDIO_MAX_RATES];		// lower and upper bound, if continuous
+
+	unsigned m_nSampleRate;
+	unsigned m_nFrameAccu;				// fractional frames per packet
+
+	TUSBAudioChunkCallback *m_pCallback;
+	void *m_pCallbackParam;
+
+	u8 *m_pBufferMemory[USB_AUDIO_NUM_URBS];
+	u8 *m_pBuffer[USB_AUDIO_NUM_URBS];		// do not cross a 64K boundary
+	unsigned m_nBufferSize;
+
+	volatile boolean m_bStopping;
+	volatile unsigned m_nActiveURBs;
+
+	unsigned m_nDeviceNumber;
+	static CNumberPool s_DeviceNumberPool;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // usbbluetooth.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,9 +23,42 @@
 #include <circle/usb/usbfunction.h>
 #include <circle/usb/usbendpoint.h>
 #include <circle/usb/usbrequest.h>
+#include <circle/lockfreering.h>
+#include <circle/spinlock.h>
 #include <circle/numberpool.h>
 #include <circle/types.h>
 
+// Reception: several event (interrupt IN) and ACL (bulk IN) requests are always pending and
+// are resubmitted on completion. The received data is re-assembled into HCI packets, which
+// are queued into lock-free rings (single consumer) or passed to the event handler.
+
+#ifndef BT_USB_EVENT_URBS
+#if RASPPI >= 4
+#define BT_USB_EVENT_URBS	4		// interrupt IN requests in flight
+#else
+#define BT_USB_EVENT_URBS	1
+#endif
+#endif
+
+#ifndef BT_USB_ACL_RX_URBS
+#if RASPPI >= 4
+#define BT_USB_ACL_RX_URBS	4		// bulk IN requests in flight
+#else
+#define BT_USB_ACL_RX_URBS	1
+#endif
+#endif
+
+#define BT_USB_ACL_RX_PACKETS	8		// max. packets per bulk IN request
+
+#define BT_USB_EVENT_MAX_SIZE	(2+255)		// HCI event header and parameters
+#define BT_USB_ACL_MAX_SIZE	(4+1024)	// HCI ACL header and data, larger are dropped
+
+#define BT_USB_EVENT_SLOTS	64		// must be a power of 2
+#define BT_USB_ACL_SLOTS	16		// must be a power of 2
+
+#define BT_USB_ACL_TX_RING_SIZE	8192		// bytes, must be a power of 2
+#define BT_USB_ACL_TX_MAX_SIZE	2048		// max. bytes per bulk OUT request
+
 typedef void TBTHCIEventHandler (const void *pBuffer, unsigned nLength);
 
 class CUSBBluetoothDevice : public CUSBFunction
@@ -38,20 +71,87 @@ public:
 
 	boolean SendHCICommand (const void *pBuffer, unsigned nLength);
 
+	// pBuffer contains one or more complete HCI command packets, which are sent one after
+	// the other without returning in between (the controller must have enough command credits)
+	boolean SendHCICommands (const void *pBuffer, unsigned nLength);
+
+	// the complete HCI events are passed to the handler from interrupt context
+	// instead of queueing them (starts reception)
 	void RegisterHCIEventHandler (TBTHCIEventHandler *pHandler);
 
+	// start reception into the rings, if no event handler is used
+	boolean StartReception (void);
+
+	// single consumer, return the length of the packet (0 if none is available)
+	unsigned ReceiveHCIEvent (void *pBuffer);		// buffer size BT_USB_EVENT_MAX_SIZE
+	unsigned ReceiveACLData (void *pBuffer);		// buffer size BT_USB_ACL_MAX_SIZE
+
+	// pBuffer contains one or more complete HCI ACL data packets, which are queued and
+	// sent in the background, together with other queued packets in one bulk request,
+	// returns FALSE if there is not enough space in the TX ring or on a previous error,
+	// must not be called from more than one task or core at a time (single producer)
+	boolean SendACLData (const void *pBuffer, unsigned nLength);
+
+	// number of packets lost, because a ring was full
+	unsigned GetEventOverruns (void) const	{ return m_nEventOverruns; }
+	unsigned GetACLOverruns (void) const	{ return m_nACLOverruns; }
+
 private:
-	boolean StartRequest (void);
+	template <unsigned N>
+	struct TPacket
+	{
+		unsigned nLength;
+		u8	 Data[N];
+	};
+
+	typedef TPacket<BT_USB_EVENT_MAX_SIZE> TEventPacket;
+	typedef TPacket<BT_USB_ACL_MAX_SIZE> TACLPacket;
+
+	struct TAssembly
+	{
+		u8	 Buffer[BT_USB_ACL_MAX_SIZE];
+		unsigned nValid;			// bytes received of current packet
+		unsigned nTotal;			// 0 if header not complete
+	};
+
+	boolean StartRequest (unsigned nURB);		// events: 0.., ACL: BT_USB_EVENT_URBS..
 
-	void CompletionRoutine (CUSBRequest *pURB);
+	void Assemble (TAssembly *pAssembly, boolean bACL, const u8 *pData, unsigned nLength);
+	void Deliver (boolean bACL, const u8 *pPacket, unsigned nLength);
+
+	void CompletionRoutine (CUSBRequest *pURB, unsigned nURB);
 	static void CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
 
+	void StartTransmit (void);			// m_TxSpinLock must be held
+	void TransmitCompletionRoutine (CUSBRequest *pURB);
+	static void TransmitCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
+
 private:
+	static const unsigned RxURBs = BT_USB_EVENT_URBS + BT_USB_ACL_RX_URBS;
+
 	CUSBEndpoint *m_pEndpointInterrupt;
 	CUSBEndpoint *m_pEndpointBulkIn;
 	CUSBEndpoint *m_pEndpointBulkOut;
 
-	u8 *m_pEventBuffer;
+	CUSBRequest *m_pRxURB[RxURBs];
+	u8 *m_pRxBuffer[RxURBs];
+	volatile boolean m_bRxPending[RxURBs];
+	boolean m_bRxStarted;
+
+	TAssembly m_EventAssembly;
+	TAssembly m_ACLAssembly;
+
+	CSPSCRing<TEventPacket> *m_pEventRing;
+	CSPSCRing<TACLPacket> *m_pACLRing;
+	volatile unsigned m_nEventOverruns;
+	volatile unsigned m_nACLOverruns;
+
+	CUSBRequest *m_pTxURB;
+	u8 *m_pTxBuffer;
+	volatile boolean m_bTxActive;
+	volatile boolean m_bTxError;
+	CSPSCRing<u8> *m_pTxRing;
+	CSpinLock m_TxSpinLock;				// the TX ring has two consumers
 
 	TBTHCIEventHandler *m_pEventHandler;
 
@@ -0,0 +1,74 @@
+//
+// usbbulkinqueue.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_usb_usbbulkinqueue_h
+#define _circle_usb_usbbulkinqueue_h
+
+#include <circle/usb/usbhostcontroller.h>
+#include <circle/usb/usbendpoint.h>
+#include <circle/usb/usbrequest.h>
+#include <circle/lockfreering.h>
+#include <circle/spinlock.h>
+#include <circle/types.h>
+
+#ifndef USB_BULK_IN_QUEUE_BUFFERS
+#define USB_BULK_IN_QUEUE_BUFFERS	4		// must be a power of 2
+#endif
+
+// Keeps a bulk in request running in the background with several buffers, so that the next
+// transfer is already in progress or completed, while the data of the previous one is
+// processed. The requests are submitted one after another to keep the data toggle of the
+// endpoint consistent. A request, which returned no data, is restarted on the next call to
+// GetData() only, so that an idle device is not polled from interrupt context.
+
+class CUSBBulkInQueue
+{
+public:
+	CUSBBulkInQueue (CUSBHostController *pHost, CUSBEndpoint *pEndpoint, unsigned nBufferSize,
+			 unsigned nBufferCount = USB_BULK_IN_QUEUE_BUFFERS);
+	~CUSBBulkInQueue (void);
+
+	// returns the data of the next completed transfer (0 if nothing has been received),
+	// the data returned before is not valid any more after calling this
+	const u8 *GetData (unsigned *pLength);
+
+private:
+	void StartRequest (void);			// m_SpinLock must be acquired
+
+	void CompletionRoutine (CUSBRequest *pURB, unsigned nBuffer);
+	static void CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
+
+private:
+	CUSBHostController *m_pHost;
+	CUSBEndpoint *m_pEndpoint;
+	unsigned m_nBufferSize;
+	unsigned m_nBufferCount;
+
+	u8 **m_ppBuffer;
+	unsigned *m_pResultLength;
+
+	CSPSCRing<unsigned> m_FreeRing;			// buffer indices
+	CSPSCRing<unsigned> m_DoneRing;
+	unsigned m_nCurrent;				// owned by the caller of GetData()
+	boolean m_bRequestActive;
+
+	CSpinLock m_SpinLock;
+};
+
+#endif
@@ -2,7 +2,7 @@
 // usbdevice.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,6 +24,7 @@
 #include <circle/usb/usbconfigparser.h>
 #include <circle/usb/usbfunction.h>
 #include <circle/numberpool.h>
+#include <circle/arena.h>
 #include <circle/logger.h>
 #include <circle/string.h>
 #include <circle/types.h>
@@ -120,6 +121,8 @@ private:
 
 	CUSBConfigurationParser *m_pConfigParser;
 
+	CArena m_ConfigArena;			// holds m_pConfigDesc and m_pConfigParser
+
 	CUSBFunction *m_pFunction[USBDEV_MAX_FUNCTIONS];
 
 #if RASPPI >= 4
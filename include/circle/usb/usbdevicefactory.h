@@ -42,6 +42,9 @@ private:
 	static CUSBFunction *GetGenericHIDDevice (CUSBFunction *pParent);
 
 	static boolean FindDeviceID (CString *pName, const TUSBDeviceID *pIDTable);
+
+	// checks the list from the "usbignore=" option
+	static boolean IsIgnored (const char *pName);
 };
 
 #endif
@@ -2,7 +2,7 @@
 // usbgamepad.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // Ported from the USPi driver which is:
 // 	Copyright (C) 2014  M. Maccaferri <macca@maccasoft.com>
@@ -25,6 +25,7 @@
 
 #include <circle/usb/usbhiddevice.h>
 #include <circle/numberpool.h>
+#include <circle/seqlock.h>
 #include <circle/macros.h>
 #include <circle/types.h>
 
@@ -165,6 +166,8 @@ struct TGamePadState		/// Current state of a gamepad
 #define GAMEPAD_AXIS_DEFAULT_MINIMUM	0
 #define GAMEPAD_AXIS_DEFAULT_MAXIMUM	255
 
+#define GAMEPAD_MAX_COMPARED_REPORT	64	// larger reports are always decoded
+
 typedef void TGamePadStatusHandler (unsigned nDeviceIndex, const TGamePadState *pGamePadState);
 
 class CUSBGamePadDevice : public CUSBHIDDevice		/// Base class for USB gamepad drivers
@@ -185,8 +188,24 @@ public:
 	const TGamePadState *GetReport (void) { return GetInitialState (); }
 
 	/// \param pStatusHandler Pointer to the function to be called on status changes
+	/// \note The status handler is called only, if the state has been changed.
 	virtual void RegisterStatusHandler (TGamePadStatusHandler *pStatusHandler);
 
+	/// \brief Set the minimum interval between two calls of the status handler
+	/// \param nMinIntervalMs Minimum interval in milliseconds (0 to report each change)
+	/// \note Changes within the interval are collected and reported with the next report,
+	///	  which arrives after the interval. Gamepads, which send reports only on changes,
+	///	  may delay the last change of a burst until the next change then.
+	void SetStatusInterval (unsigned nMinIntervalMs);
+
+	/// \brief Get the latest state of the gamepad
+	/// \param pState Pointer to the buffer, to which the state is copied
+	/// \note Lock-free, can be called from any core and at any execution level.
+	void GetState (TGamePadState *pState) const;
+
+	/// \return Number of reports, which have been discarded, because nothing has changed
+	unsigned GetDiscardedReports (void) const	{ return m_nDiscardedReports; }
+
 public:
 	/// \brief Set LED(s) on gamepads with multiple uni-color LEDs
 	/// \param Mode LED mode to be set
@@ -216,6 +235,18 @@ private:
 	/// \note m_usReportSize member has to be set here or in Configure() of the subclass.
 	virtual void DecodeReport (const u8 *pReportBuffer) = 0;
 
+protected:
+	/// \brief Decode the report, if it differs from the previous one, and call the status
+	///	   handler, if the decoded state has been changed
+	/// \param pReport Pointer to the report packet
+	/// \param nReportSize Size of the report in number of bytes
+	/// \note To be called from ReportHandler() of a subclass, which overwrites it.
+	void HandleReport (const u8 *pReport, unsigned nReportSize);
+
+private:
+	void PublishState (void);
+	void NotifyStatus (void);
+
 protected:
 	TGamePadState m_State;
 	TGamePadStatusHandler *m_pStatusHandler;
@@ -224,6 +255,19 @@ protected:
 
 	unsigned m_nDeviceNumber;
 	static CNumberPool s_DeviceNumberPool;
+
+private:
+	u8 m_LastReport[GAMEPAD_MAX_COMPARED_REPORT];
+	unsigned m_nLastReportSize;		// 0 if not valid
+
+	TGamePadState m_Snapshot;		// for GetState(), protected by m_SnapshotLock
+	CSeqLock m_SnapshotLock;
+
+	unsigned m_nMinIntervalTicks;
+	unsigned m_nLastNotifyTicks;
+	boolean m_bNotifyPending;
+
+	volatile unsigned m_nDiscardedReports;
 };
 
 #endif
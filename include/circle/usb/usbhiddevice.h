@@ -24,8 +24,15 @@
 #include <circle/usb/usbendpoint.h>
 #include <circle/usb/usbrequest.h>
 #include <circle/usb/usbhostcontroller.h>
+#include <circle/lockfreering.h>
 #include <circle/types.h>
 
+#ifndef USBHID_REPORT_QUEUE_SIZE
+#define USBHID_REPORT_QUEUE_SIZE	16		// reports, must be a power of 2
+#endif
+
+#define USBHID_QUEUED_REPORT_SIZE	64		// max. report size for the report queue
+
 class CUSBHIDDevice : public CUSBFunction
 {
 public:
@@ -53,6 +60,16 @@ protected:
 	int ReceiveFromEndpointIn (void *pBuffer, unsigned nBufSize,
 				   unsigned nTimeoutMs = USB_TIMEOUT_NONE);
 
+	// the received reports are written to a lock-free ring instead of calling
+	// ReportHandler(), has to be called before StartRequest()
+	// returns FALSE, if the max. report size is too big for the queue
+	boolean EnableReportQueue (unsigned nSize = USBHID_REPORT_QUEUE_SIZE);
+	// fetches the oldest queued report (single consumer only, e.g. from TASK_LEVEL)
+	// returns report size, 0 if the queue is empty
+	unsigned DequeueReport (void *pBuffer, unsigned nBufSize);
+	// number of reports, which have been dropped, because the queue was full
+	unsigned GetDroppedReports (void) const		{ return m_nDroppedReports; }
+
 private:
 	void CompletionRoutine (CUSBRequest *pURB);
 	static void CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
@@ -66,6 +83,19 @@ private:
 	CUSBEndpoint *m_pEndpointOut;		// interrupt out EP (optional)
 
 	u8 *m_pReportBuffer;
+
+	// the interrupt IN URB is allocated once and resubmitted after each report
+	CUSBRequest *m_pURB;
+	volatile boolean m_bRequestPending;
+
+	struct TQueuedReport
+	{
+		unsigned	nLength;
+		u8		Report[USBHID_QUEUED_REPORT_SIZE];
+	};
+
+	CSPSCRing<TQueuedReport> *m_pReportQueue;
+	volatile unsigned m_nDroppedReports;
 };
 
 #endif
@@ -2,7 +2,7 @@
 // usbhostcontroller.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,7 +23,7 @@
 #include <circle/usb/usb.h>
 #include <circle/usb/usbendpoint.h>
 #include <circle/usb/usbrequest.h>
-#include <circle/ptrlist.h>
+#include <circle/intrusivelist.h>
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
@@ -33,6 +33,7 @@
 
 class CUSBHCIRootPort;
 class CUSBStandardHub;
+struct TPortStatusEvent;
 class CUSBDevice;
 
 class CUSBHostController
@@ -75,8 +76,19 @@ public:
 
 	// must be called from TASK_LEVEL, if Plug-and-Play is enabled
 	// returns TRUE if device tree might have been updated (always TRUE on first call)
+	// only checks for updates, if a port status handler is registered (see below)
 	boolean UpdatePlugAndPlay (void);
 
+	// handler is called from interrupt context, when a port status change event is queued
+	// the events have to be processed by ProcessPortStatusEvents() then (e.g. from
+	// CUSBPlugAndPlayTask), instead of inside UpdatePlugAndPlay()
+	typedef void TPortStatusHandler (void *pParam);
+	void RegisterPortStatusHandler (TPortStatusHandler *pHandler, void *pParam = 0);
+
+	// must be called from TASK_LEVEL, enumerates or removes devices
+	// returns TRUE if events have been processed
+	boolean ProcessPortStatusEvents (void);
+
 	static boolean IsActive (void)
 	{
 		return s_pThis != 0 ? TRUE : FALSE;
@@ -95,8 +107,12 @@ private:
 private:
 	static boolean s_bPlugAndPlay;
 	boolean m_bFirstUpdateCall;
+	volatile boolean m_bDeviceTreeUpdated;
+
+	TPortStatusHandler *m_pPortStatusHandler;
+	void *m_pPortStatusParam;
 
-	CPtrList  m_HubList;
+	CIntrusiveList<TPortStatusEvent> m_HubList;
 	CSpinLock m_SpinLock;
 
 	static CUSBHostController *s_pThis;
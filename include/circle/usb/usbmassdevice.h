@@ -22,8 +22,10 @@
 
 #include <circle/usb/usbfunction.h>
 #include <circle/usb/usbendpoint.h>
+#include <circle/usb/usbrequest.h>
 #include <circle/fs/partitionmanager.h>
 #include <circle/numberpool.h>
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
 #define UMSD_BLOCK_SIZE		512
@@ -32,6 +34,17 @@
 
 #define UMSD_MAX_OFFSET		0x1FFFFFFFFFFULL		// 2TB
 
+#ifndef UMSD_MAX_TRANSFER_BLOCKS
+#define UMSD_MAX_TRANSFER_BLOCKS	128			// per SCSI command (64 KByte)
+#endif
+
+#ifndef UMSD_MAX_ASYNC_REQUESTS
+#define UMSD_MAX_ASYNC_REQUESTS	32			// must be a power of 2
+#endif
+
+// nResult is the number of transferred bytes or < 0 on failure
+typedef void TUMSDCompletionRoutine (int nResult, void *pParam);
+
 class CUSBBulkOnlyMassStorageDevice : public CUSBFunction
 {
 public:
@@ -47,14 +60,41 @@ public:
 
 	unsigned GetCapacity (void) const;
 
+	// Queue a read or write of whole blocks at byte offset ullOffset and return immediately.
+	// Requests are processed in order. Adjacent requests, which continue each other on the disk
+	// and in memory, are combined into one SCSI command. pBuffer must be cache-aligned and is
+	// accessed, until pRoutine has been called from interrupt context. Returns FALSE, if the
+	// parameters are invalid or the queue is full. After a failure all queued requests fail.
+	boolean ReadAsync (u64 ullOffset, void *pBuffer, size_t nCount,
+			   TUMSDCompletionRoutine *pRoutine, void *pParam = 0);
+	boolean WriteAsync (u64 ullOffset, const void *pBuffer, size_t nCount,
+			    TUMSDCompletionRoutine *pRoutine, void *pParam = 0);
+
+	// CDevice interface for the above, the request completes from interrupt context
+	boolean SubmitRequest (CBlockRequest *pRequest);
+
 private:
-	int TryRead (void *pBuffer, size_t nCount);
-	int TryWrite (const void *pBuffer, size_t nCount);
+	int ReadWrite (boolean bIn, void *pBuffer, size_t nCount);
+
+	int TryRead (u64 ullOffset, void *pBuffer, size_t nCount);
+	int TryWrite (u64 ullOffset, const void *pBuffer, size_t nCount);
 
 	int Command (void *pCmdBlk, size_t nCmdBlkLen, void *pBuffer, size_t nBufLen, boolean bIn);
 
 	int Reset (void);
 
+	boolean QueueAsync (boolean bIn, u64 ullOffset, void *pBuffer, size_t nCount,
+			    TUMSDCompletionRoutine *pRoutine, void *pParam);
+	boolean StartAsync (void);			// m_AsyncSpinLock must be acquired
+	boolean SubmitAsync (CUSBEndpoint *pEndpoint, void *pBuffer, size_t nLength);
+	void CompleteAsync (int nResult);
+	void AsyncCompletion (CUSBRequest *pURB);
+	static void AsyncCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
+	static void BlockRequestCompletion (int nResult, void *pParam);
+
+	void BeginSyncAccess (void);			// waits for queued requests
+	void EndSyncAccess (void);
+
 private:
 	CUSBEndpoint *m_pEndpointIn;
 	CUSBEndpoint *m_pEndpointOut;
@@ -65,6 +105,38 @@ private:
 
 	CPartitionManager *m_pPartitionManager;
 
+	struct TAsyncRequest
+	{
+		boolean			 bIn;
+		u32			 nBlockAddress;
+		u8			*pBuffer;
+		size_t			 nCount;		// bytes
+		size_t			 nReport;		// result on success (0 for parts)
+		TUMSDCompletionRoutine	*pRoutine;		// 0 for leading parts
+		void			*pParam;
+	};
+
+	enum TAsyncState
+	{
+		AsyncStateIdle,
+		AsyncStateCBW,
+		AsyncStateData,
+		AsyncStateCSW,
+		AsyncStateComplete
+	};
+
+	TAsyncRequest m_AsyncRequest[UMSD_MAX_ASYNC_REQUESTS];
+	unsigned m_nAsyncHead;				// oldest request
+	unsigned m_nAsyncTail;				// next free slot
+	unsigned m_nAsyncActive;			// requests in the running command
+	size_t m_nAsyncLength;				// data bytes of the running command
+	volatile TAsyncState m_AsyncState;
+	boolean m_bSyncActive;
+	boolean m_bResetRequired;			// set after an asynchronous failure
+	u8 *m_pAsyncCBW;
+	u8 *m_pAsyncCSW;
+	CSpinLock m_AsyncSpinLock;
+
 	static CNumberPool s_DeviceNumberPool;
 	unsigned m_nDeviceNumber;
 };
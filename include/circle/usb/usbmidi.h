@@ -28,8 +28,21 @@
 #include <circle/usb/usbrequest.h>
 #include <circle/timer.h>
 #include <circle/numberpool.h>
+#include <circle/lockfreering.h>
 #include <circle/types.h>
 
+#ifndef USB_MIDI_EVENT_QUEUE_SIZE
+#define USB_MIDI_EVENT_QUEUE_SIZE	256		// events, must be a power of 2
+#endif
+
+#define USB_MIDI_SEND_BATCH_SIZE	64		// event packets per batched send
+
+struct TUSBMIDIEvent		/// Received USB MIDI event packet with timestamp
+{
+	unsigned	nTimestamp;		///< CTimer::GetClockTicks() at arrival (microseconds)
+	u8		Packet[4];		///< USB MIDI event packet (cable number, CIN, MIDI bytes)
+};
+
 /// \param nCable  Cable number (0-15)
 /// \param pPacket Pointer to one received MIDI packet
 /// \param nLength Number of valid bytes in packet (1-3)
@@ -63,6 +76,30 @@ public:
 	/// \note Fails, if format is invalid or send is not supported
 	boolean SendPlainMIDI (unsigned nCable, const u8 *pData, unsigned nLength);
 
+	/// \brief The received events are queued with a timestamp instead of calling the packet handler
+	/// \param nSize Queue size in events (must be a power of 2)
+	/// \note Has to be called once, before events are expected
+	void EnableEventQueue (unsigned nSize = USB_MIDI_EVENT_QUEUE_SIZE);
+
+	/// \brief Fetch the oldest queued event
+	/// \param pEvent Receives the event
+	/// \return FALSE, if the queue is empty
+	/// \note Lock-free, may be called from one consumer only (e.g. the audio callback)
+	boolean GetEvent (TUSBMIDIEvent *pEvent);
+
+	/// \return Number of received events, which have been dropped, because the queue was full
+	unsigned GetDroppedEvents (void) const	{ return m_nDroppedEvents; }
+
+	/// \brief Append one packet in encoded USB MIDI event packet format to the send batch
+	/// \param pPacket Pointer to the packet (4 bytes)
+	/// \return Operation successful?
+	/// \note The batch is sent automatically, when it is full
+	boolean AddEventPacket (const u8 *pPacket);
+
+	/// \brief Send all packets appended with AddEventPacket() in one transfer
+	/// \return Operation successful?
+	boolean FlushEventPackets (void);
+
 	/// \brief Generate MIDI CC "All Sound Off" event (120), when an USB error occurs?
 	/// \param bEnable Set to TRUE to enable function
 	/// \note This will generate an event for each MIDI channel (1-16) for MIDI cable 0.
@@ -71,6 +108,8 @@ public:
 private:
 	boolean StartRequest (void);
 
+	void HandlePacket (const u8 *pPacket);		// from interrupt context
+
 	void CompletionRoutine (CUSBRequest *pURB);
 	static void CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
 
@@ -90,6 +129,12 @@ private:
 
 	boolean m_bAllSoundOff;
 
+	CSPSCRing<TUSBMIDIEvent> *m_pEventQueue;
+	volatile unsigned m_nDroppedEvents;
+
+	u8 *m_pSendBatch;
+	unsigned m_nSendBatchValid;			// bytes
+
 	unsigned m_nDeviceNumber;
 	static CNumberPool s_DeviceNumberPool;
 };
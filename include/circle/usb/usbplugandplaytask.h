@@ -0,0 +1,63 @@
+//
+/// \file usbplugandplaytask.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_usb_usbplugandplaytask_h
+#define _circle_usb_usbplugandplaytask_h
+
+#include <circle/usb/usbhostcontroller.h>
+#include <circle/sched/task.h>
+#include <circle/sched/synchronizationevent.h>
+#include <circle/types.h>
+
+/// \note The task sleeps until a port status change event is queued by the host controller
+///	  and enumerates (or removes) the USB devices then. CUSBHostController::
+///	  UpdatePlugAndPlay() only reports, if the device tree might have been updated, after
+///	  this task has been created, and does not block any more.
+/// \note The system option NO_BUSY_WAIT should be defined, so that the control transfers
+///	  during the enumeration yield to the other tasks.
+/// \note Devices may be removed, whenever the application task blocks. Use
+///	  CDevice::RegisterRemovedHandler() to detect this.
+
+class CUSBPlugAndPlayTask : public CTask	/// Enumerates USB devices in the background
+{
+public:
+	/// \param pHost Pointer to the USB host controller (Plug-and-Play must be enabled)
+	/// \param nPriority Task priority (real-time tasks should have a higher priority)
+	CUSBPlugAndPlayTask (CUSBHostController *pHost, unsigned nPriority = TASK_PRIORITY_LOW);
+
+	~CUSBPlugAndPlayTask (void);
+
+	/// \brief Terminate the task and wait for it
+	/// \note The object is deleted by the scheduler afterwards. The events are processed\n
+	///	  by CUSBHostController::UpdatePlugAndPlay() again.
+	void Stop (void);
+
+	void Run (void);
+
+private:
+	static void PortStatusHandler (void *pParam);
+
+private:
+	CUSBHostController *m_pHost;
+
+	CSynchronizationEvent m_Event;
+	volatile boolean m_bStop;
+};
+
+#endif
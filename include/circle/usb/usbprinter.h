@@ -2,7 +2,7 @@
 // usbprinter.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,9 +22,27 @@
 
 #include <circle/usb/usbfunction.h>
 #include <circle/usb/usbendpoint.h>
+#include <circle/usb/usbrequest.h>
 #include <circle/numberpool.h>
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
+// Queued write: WriteAsync() copies the data into one of the chunk buffers and returns,
+// while the filled chunks are sent in the background.
+
+#define USB_PRINTER_CHUNK_SIZE		16384
+#define USB_PRINTER_CHUNKS		2
+
+#if RASPPI >= 4
+	#define USB_PRINTER_MAX_ACTIVE	USB_PRINTER_CHUNKS
+#else
+	// DWHCI does not allow concurrent split transactions to the same device
+	#define USB_PRINTER_MAX_ACTIVE	1
+#endif
+
+// Called from interrupt context, when a chunk has been sent
+typedef void TUSBPrinterProgressHandler (u64 nBytesPrinted, boolean bStatus, void *pParam);
+
 enum TUSBPrinterProtocol
 {
 	USBPrinterProtocolUnknown	 = 0,
@@ -42,6 +60,21 @@ public:
 
 	int Write (const void *pBuffer, size_t nCount);
 
+	// waits only, if all chunks are busy, returns -1 on a previous transfer error
+	int WriteAsync (const void *pBuffer, size_t nCount);
+	// sends the partially filled chunk and waits until all chunks are sent
+	boolean Flush (void);
+
+	void RegisterProgressHandler (TUSBPrinterProgressHandler *pHandler, void *pParam = 0);
+
+private:
+	void SubmitChunks (void);		// m_SpinLock must be acquired
+	void RetireFailedChunks (void);		// m_SpinLock must be acquired
+	void WaitForChunks (unsigned nMaxBusy);
+
+	void CompletionRoutine (CUSBRequest *pURB);
+	static void CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
+
 private:
 	TUSBPrinterProtocol m_Protocol;
 
@@ -50,6 +83,28 @@ private:
 
 	unsigned m_nDeviceNumber;
 	static CNumberPool s_DeviceNumberPool;
+
+	struct TChunk
+	{
+		u8		*pBuffer;
+		unsigned	 nLength;
+		CUSBRequest	*pURB;
+	};
+
+	TChunk m_Chunk[USB_PRINTER_CHUNKS];
+
+	// free running indices: [Complete, Submit) active, [Submit, Fill) ready, Fill is filled
+	volatile unsigned m_nCompleteIndex;
+	unsigned m_nSubmitIndex;
+	unsigned m_nFillIndex;
+
+	volatile boolean m_bError;
+	u64 m_nBytesPrinted;
+
+	TUSBPrinterProgressHandler *m_pProgressHandler;
+	void *m_pProgressParam;
+
+	CSpinLock m_SpinLock;
 };
 
 #endif
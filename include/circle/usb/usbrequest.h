@@ -27,6 +27,10 @@
 
 class CUSBRequest;
 
+#ifndef USB_MAX_ISO_PACKETS
+#define USB_MAX_ISO_PACKETS	8		// per isochronous URB
+#endif
+
 typedef void TURBCompletionRoutine (CUSBRequest *pURB, void *pParam, void *pContext);
 
 class CUSBRequest		// URB
@@ -52,9 +56,21 @@ public:
 	void SetCompletionRoutine (TURBCompletionRoutine *pRoutine, void *pParam, void *pContext);
 	void CallCompletionRoutine (void);
 
+	// prepare the completed URB to be submitted again (e.g. from its completion routine),
+	// buffer, completion routine and isochronous packets remain the same
+	void Reset (void);
+
 	// do not retry if request cannot be served immediately (for Bulk in only)
 	void SetCompleteOnNAK (void);
 	boolean IsCompleteOnNAK (void) const;
+
+	// isochronous endpoints only: the packets are placed back-to-back in the buffer,
+	// each one is transferred in its own (micro)frame, a packet must not cross a 64K boundary
+	boolean AddIsoPacket (u16 usLength);		// returns FALSE if too many packets
+	unsigned GetNumIsoPackets (void) const;
+	u16 GetIsoPacketLength (unsigned nPacket) const;
+	void SetIsoPacketResultLength (unsigned nPacket, u16 usLength);
+	u16 GetIsoPacketResultLength (unsigned nPacket) const;	// 0 if packet failed
 	
 private:
 	CUSBEndpoint *m_pEndpoint;
@@ -73,6 +89,15 @@ private:
 
 	boolean m_bCompleteOnNAK;
 
+	unsigned m_nNumIsoPackets;
+	u32	 m_nIsoPacketsLength;
+	struct
+	{
+		u16	usLength;
+		u16	usResultLength;
+	}
+	m_IsoPacket[USB_MAX_ISO_PACKETS];
+
 	DECLARE_CLASS_ALLOCATOR
 };
 
@@ -22,9 +22,29 @@
 
 #include <circle/usb/usbfunction.h>
 #include <circle/usb/usbendpoint.h>
+#include <circle/usb/usbrequest.h>
+#include <circle/lockfreering.h>
+#include <circle/spinlock.h>
 #include <circle/numberpool.h>
 #include <circle/types.h>
 
+// Streaming mode (Raspberry Pi 4 only): the bulk IN requests are always pending and feed
+// the RX ring, Write() queues the data into the TX ring, which is sent in the background.
+
+#ifndef USB_SERIAL_RX_URBS
+#define USB_SERIAL_RX_URBS		4		// bulk IN requests in flight
+#endif
+
+#define USB_SERIAL_RX_PACKETS		8		// max. packets per bulk IN request
+
+#ifndef USB_SERIAL_RING_SIZE
+#define USB_SERIAL_RING_SIZE		16384		// bytes per direction, must be a power of 2
+#endif
+
+#define USB_SERIAL_TX_MAX_SIZE		4096		// max. bytes per bulk OUT request
+
+typedef void TUSBSerialTransmitHandler (void *pParam);
+
 enum TUSBSerialDataBits
 {
 	USBSerialDataBits5	 = 5,
@@ -55,9 +75,19 @@ public:
 
 	boolean Configure (void);
 
+	// waits for free space in the TX ring in streaming mode, must not be called
+	// from more than one task or core at a time (single producer) in this case
 	int Write (const void *pBuffer, size_t nCount);
 	int Read (void *pBuffer, size_t nCount);
 
+	// streaming mode only: the handler is called from interrupt context, when the
+	// number of bytes in the TX ring falls below nLowWater
+	void RegisterTransmitHandler (TUSBSerialTransmitHandler *pHandler, void *pParam = 0,
+				      unsigned nLowWater = USB_SERIAL_RING_SIZE / 4);
+
+	// number of bytes lost, because the RX ring was full (streaming mode only)
+	unsigned GetRxOverruns (void) const	{ return m_nRxOverruns; }
+
 	virtual boolean SetBaudRate (unsigned nBaudRate);
 	virtual boolean SetLineProperties (TUSBSerialDataBits nDataBits, TUSBSerialParity nParity, TUSBSerialStopBits nStopBits);
 
@@ -65,6 +95,16 @@ private:
 	void CompletionRoutine (CUSBRequest *pURB);
 	static void CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
 
+#if RASPPI >= 4
+	boolean StartReceive (void);
+	void ReceiveCompletionRoutine (CUSBRequest *pURB, unsigned nURB);
+	static void ReceiveCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
+
+	void StartTransmit (void);			// m_TxSpinLock must be held
+	void TransmitCompletionRoutine (CUSBRequest *pURB);
+	static void TransmitCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext);
+#endif
+
 protected:
 	unsigned m_nBaudRate;
 	TUSBSerialDataBits m_nDataBits;
@@ -84,6 +124,26 @@ private:
 
 	volatile boolean m_bInRequestActive;
 
+#if RASPPI >= 4
+	CUSBRequest *m_pRxURB[USB_SERIAL_RX_URBS];
+	u8 *m_pRxBuffer[USB_SERIAL_RX_URBS];
+	size_t m_nRxBufferSize;
+	boolean m_bRxStarted;
+	CSPSCRing<u8> *m_pRxRing;
+
+	CUSBRequest *m_pTxURB;
+	u8 *m_pTxBuffer;
+	volatile boolean m_bTxActive;
+	volatile boolean m_bTxError;
+	CSPSCRing<u8> *m_pTxRing;
+	CSpinLock m_TxSpinLock;			// the TX ring has two consumers
+
+	TUSBSerialTransmitHandler *m_pTransmitHandler;
+	void *m_pTransmitParam;
+	unsigned m_nTxLowWater;
+#endif
+	volatile unsigned m_nRxOverruns;
+
 	unsigned m_nDeviceNumber;
 	static CNumberPool s_DeviceNumberPool;
 };
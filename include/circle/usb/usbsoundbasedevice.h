@@ -0,0 +1,61 @@
+//
+/// \file usbsoundbasedevice.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_usb_usbsoundbasedevice_h
+#define _circle_usb_usbsoundbasedevice_h
+
+#include <circle/soundbasedevice.h>
+#include <circle/usb/usbaudiostreaming.h>
+#include <circle/device.h>
+#include <circle/types.h>
+
+class CUSBSoundBaseDevice : public CSoundBaseDevice	/// Low level access to USB audio output devices
+{
+public:
+	/// \param nSampleRate Sample rate in Hz
+	/// \param nDevice Number of the USB audio streaming device to be used (uaudioN)
+	/// \note The device is looked up at the first call of Start().
+	CUSBSoundBaseDevice (unsigned nSampleRate = 48000, unsigned nDevice = 1);
+
+	~CUSBSoundBaseDevice (void);
+
+	/// \brief Starts the transmission of sound data
+	/// \return Operation successful?
+	boolean Start (void);
+
+	/// \brief Cancels the transmission of sound data
+	/// \note Cancel takes effect after a short delay
+	void Cancel (void);
+
+	/// \return Is sound data transmission running?
+	boolean IsActive (void) const;
+
+private:
+	static unsigned ChunkCallback (s16 *pBuffer, unsigned nChunkSize, void *pParam);
+
+	static void DeviceRemovedHandler (CDevice *pDevice, void *pContext);
+
+private:
+	unsigned m_nSampleRate;
+	unsigned m_nDevice;
+
+	CUSBAudioStreamingDevice *m_pStreamingDevice;
+};
+
+#endif
@@ -331,10 +331,13 @@ PACKED;
 #define XHCI_TRB_COMPLETION_CODE_SUCCESS			1
 #define XHCI_TRB_COMPLETION_CODE_NO_SLOTS_AVAILABLE_ERROR	9
 #define XHCI_TRB_COMPLETION_CODE_SHORT_PACKET			13
+#define XHCI_TRB_COMPLETION_CODE_RING_UNDERRUN			14
 #define XHCI_TRB_COMPLETION_CODE_RING_OVERRUN			15
+#define XHCI_TRB_COMPLETION_CODE_MISSED_SERVICE_ERROR		23
 
 // Link TRB
 #define XHCI_LINK_TRB_CONTROL_TC				(1 << 1)
+#define XHCI_LINK_TRB_CONTROL_CH				(1 << 4)
 
 // Event TRB
 #define XHCI_EVENT_TRB_STATUS_COMPLETION_CODE__SHIFT		24
@@ -381,9 +384,13 @@ PACKED;
 	#define XHCI_TRANSFER_TRB_CONTROL_TRT_IN			3
 
 #define XHCI_TRANSFER_TRB_CONTROL_ISP				(1 << 2)
+#define XHCI_TRANSFER_TRB_CONTROL_CH				(1 << 4)
 #define XHCI_TRANSFER_TRB_CONTROL_IOC				(1 << 5)
 #define XHCI_TRANSFER_TRB_CONTROL_IDT				(1 << 6)
 #define XHCI_TRANSFER_TRB_CONTROL_DIR_IN			(1 << 16)
+#define XHCI_TRANSFER_TRB_CONTROL_TBC__SHIFT			7		// Isoch TRB
+#define XHCI_TRANSFER_TRB_CONTROL_TLBPC__SHIFT			16
+#define XHCI_TRANSFER_TRB_CONTROL_SIA				(1 << 31)
 
 //
 // Event Ring Segment Table Entry
@@ -49,9 +49,21 @@
 
 #define XHCI_CONFIG_EVENT_RING_SIZE	64
 #define XHCI_CONFIG_CMD_RING_SIZE	64
-#define XHCI_CONFIG_TRANSFER_RING_SIZE	64
+#ifndef XHCI_CONFIG_TRANSFER_RING_SIZE
+#define XHCI_CONFIG_TRANSFER_RING_SIZE	128		// TRBs per endpoint
+#endif
+
+#ifndef XHCI_CONFIG_MAX_PENDING_URBS
+#define XHCI_CONFIG_MAX_PENDING_URBS	8		// per endpoint, must be a power of 2
+#endif
 
-#define XHCI_CONFIG_IMODI		500		// defines maximum interrupt rate
+// The interrupt moderation interval (in 250ns steps) adapts to the number of events per
+// interrupt between these limits. XHCI_CONFIG_IMODI defines the minimum interrupt rate.
+#define XHCI_CONFIG_IMODI		500
+#ifndef XHCI_CONFIG_IMODI_MIN
+#define XHCI_CONFIG_IMODI_MIN		40		// used with low load
+#endif
+#define XHCI_CONFIG_IMOD_EVENTS_HIGH	8		// events per interrupt to increase interval
 
 #define XHCI_PAGE_SHIFT			12
 #define XHCI_PAGE_SIZE			(1 << XHCI_PAGE_SHIFT)
@@ -24,6 +24,7 @@
 #include <circle/usb/xhciring.h>
 #include <circle/usb/xhci.h>
 #include <circle/usb/usb.h>
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
 class CXHCIDevice;
@@ -56,9 +57,13 @@ public:
 private:
 	static void CompletionRoutine (CUSBRequest *pURB, void *pParam, void *pContext);
 
-	// Cycle bit and Interrupter Target are set automatically
-	boolean EnqueueTRB (u32 nControl, u32 nStatus = 0,
-			    u32 nParameter1 = 0, u32 nParameter2 = 0);
+	// Cycle bit and Interrupter Target are set automatically,
+	// with bHold the TRB is not handed over to the xHC yet (invert Cycle bit later)
+	TXHCITRB *EnqueueTRB (u32 nControl, u32 nStatus = 0,
+			      u32 nParameter1 = 0, u32 nParameter2 = 0, boolean bHold = FALSE);
+
+	// a TRB must not cross a 64K boundary
+	static u32 GetChunkLength (const u8 *pBuffer, u32 nLength);
 
 	TXHCIInputContext *GetInputContextSetMaxPacketSize (void);
 	TXHCIInputContext *GetInputContextConfigureEndpoint (void);
@@ -83,7 +88,23 @@ private:
 	u8		 m_uchEndpointID;
 	u8		 m_uchEndpointType;
 
-	CUSBRequest	*m_pURB;
+	struct TPendingURB
+	{
+		CUSBRequest	*pURB;			// 0 if abandoned after timeout
+		boolean		 bControl;
+		boolean		 bIsoch;		// one TD per packet
+		unsigned	 nEventsLeft;		// one event per Normal or Isoch TRB
+		unsigned	 nEndIndex;		// enqueue index behind the TD
+		u8		*pNextChunk;		// Normal TRBs only
+		u32		 nBytesLeft;
+		u32		 nTransferred;
+	};
+
+	TPendingURB	 m_PendingURB[XHCI_CONFIG_MAX_PENDING_URBS];	// in order of the TDs
+	unsigned	 m_nPendingHead;
+	unsigned	 m_nPendingTail;
+	CSpinLock	 m_SpinLock;
+
 	volatile boolean m_bTransferCompleted;
 
 	u8		*m_pInputContextBuffer;
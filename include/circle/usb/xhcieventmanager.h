@@ -38,6 +38,9 @@ public:
 	// returns next event dequeue TRB or 0 if event ring is empty
 	TXHCITRB *HandleEvents (void);
 
+	// adapt interrupt moderation to the number of events handled in one interrupt
+	void AdaptInterruptModeration (unsigned nEvents);
+
 #ifndef NDEBUG
 	void DumpStatus (void);
 #endif
@@ -47,6 +50,7 @@ private:
 	CXHCIMMIOSpace	*m_pMMIO;
 	CXHCIRing	 m_EventRing;
 	TXHCIERSTEntry	*m_pERST;
+	unsigned	 m_nIMODI;
 };
 
 #endif
@@ -50,6 +50,11 @@ public:
 	TXHCITRB *IncrementDequeue (void);	// returns next dequeue TRB
 	void IncrementEnqueue (void);
 
+	// transfer rings only, the xHC does not give back the TRBs itself
+	unsigned GetEnqueueIndex (void) const;
+	void SetDequeueIndex (unsigned nIndex);	// enqueue index after a completed TD
+	unsigned GetFreeTRBs (void) const;
+
 	u32 GetCycleState (void) const;
 
 #ifndef NDEBUG
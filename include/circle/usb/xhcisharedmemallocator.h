@@ -2,7 +2,7 @@
 // xhcisharedmemallocator.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -33,22 +33,30 @@
 // 2048	64	4K	 <=64		Device Context
 // 124K	4K	4K	 1		Scatchpad Buffers
 
-// We only maintain blocks with the following specification. Other blocks, which do not
-// fit these specification (blocks with smaller size/alignment/boundary requirements do
-// fit), can be allocated, but are lost, if they are freed (should not happen).
-#define XHCI_BLOCK_SIZE		2048
-#define XHCI_BLOCK_ALIGN	64
-#define XHCI_BLOCK_BOUNDARY	0x10000
+// The memory pool is divided into slabs of 64K. A slab is either free, holds blocks of
+// one size class (power of two from 64 bytes to 4K, aligned to their size), or is part of
+// a run of slabs, which holds one large block. Because a block of a size class is aligned
+// to its size, it never crosses a boundary, which is not smaller than the block. Freed
+// blocks are reused for the same size class and a slab is returned to the pool, when all
+// of its blocks have been freed, so that nothing is lost over repeated plug cycles.
+#define XHCI_SLAB_SIZE		0x10000
+#define XHCI_MAX_SLABS		64		// 4 MB at most
 
-struct TXHCIBlockHeader
+#define XHCI_MIN_BLOCK_SIZE	64
+#define XHCI_MAX_BLOCK_SIZE	4096
+#define XHCI_SIZE_CLASSES	7		// 64, 128, 256, 512, 1K, 2K, 4K
+
+struct TXHCISharedMemStats
 {
-	u32			 nMagic;
-#define XHCI_BLOCK_MAGIC	0x58484349
-	u32			 nSize;
-	u32			 nAlign;
-	u32			 nBoundary;
-	TXHCIBlockHeader	*pNext;
-	u8			 Data[0];
+	size_t	 nPoolSize;			// bytes
+	size_t	 nUsedBytes;			// incl. rounding to size class or slabs
+	size_t	 nPeakUsedBytes;
+	unsigned nFreeSlabs;
+	unsigned nBlocksUsed[XHCI_SIZE_CLASSES];
+	unsigned nLargeBlocksUsed;
+	unsigned nAllocations;
+	unsigned nFrees;
+	unsigned nFailures;
 };
 
 class CXHCISharedMemAllocator	/// Shared memory allocation for the xHCI driver
@@ -63,11 +71,40 @@ public:
 
 	void Free (void *pBlock);
 
+	void GetStats (TXHCISharedMemStats *pStats) const;
+
+private:
+	void *AllocateBlock (unsigned nClass);
+	void *AllocateLarge (size_t nSize, size_t nBoundary);
+
+	uintptr GetSlabAddress (unsigned nSlab) const
+	{
+		return m_nPoolStart + nSlab * XHCI_SLAB_SIZE;
+	}
+
 private:
-	uintptr m_nMemStart;
-	uintptr m_nMemEnd;
+	uintptr m_nPoolStart;			// aligned to XHCI_SLAB_SIZE
+	unsigned m_nSlabs;
+
+	struct TFreeBlock
+	{
+		TFreeBlock	*pNext;
+	};
+
+	struct TSlab
+	{
+		u8		 nType;
+#define XHCI_SLAB_FREE		0xFF
+#define XHCI_SLAB_LARGE		0xFE		// first slab of a large block
+#define XHCI_SLAB_LARGE_CONT	0xFD		// following slabs of a large block
+						// otherwise size class
+		unsigned	 nCount;		// blocks used or slabs of a large block
+		TFreeBlock	*pFreeList;		// free blocks of a size class
+	};
+
+	TSlab m_Slab[XHCI_MAX_SLABS];
 
-	TXHCIBlockHeader *m_pFreeList;
+	TXHCISharedMemStats m_Stats;
 };
 
 #endif
@@ -2,7 +2,7 @@
 // writebuffer.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,6 +24,19 @@
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
+struct TWriteBufferStats
+{
+	u64		nBytesWritten;		///< to the output device
+	u64		nBytesDropped;		///< because the ring buffer was full
+	unsigned	nDeviceWrites;		///< number of write calls to the output device
+	unsigned	nMaxLevel;		///< maximum fill level of the ring buffer in bytes
+};
+
+/// \note The writer returns immediately. The output device is written from Update() or
+///	  Flush(), which can be called from the application loop, from a secondary core or
+///	  from a CWriteBufferDrainTask. With a flush policy (SetFlushPolicy()) the contents
+///	  are written in larger batches, which is much faster with slow devices (e.g. screen).
+
 class CWriteBufferDevice : public CDevice	/// Filter for buffered write to (e.g. screen) device
 {
 public:
@@ -42,8 +55,29 @@ public:
 
 	/// \brief Write contents from ring buffer to the output device.
 	/// \param nMaxBytes Maximum number of bytes written to the device at once
+	/// \return Number of bytes written to the device
+	/// \note This method must be called at TASK_LEVEL or from a secondary core (1-3).
+	size_t Update (size_t nMaxBytes = 100);
+
+	/// \brief Write the whole contents of the ring buffer to the output device
+	/// \param nMaxBytes Maximum number of bytes written to the device at once
 	/// \note This method must be called at TASK_LEVEL or from a secondary core (1-3).
-	void Update (size_t nMaxBytes = 100);
+	void Flush (size_t nMaxBytes = 1024);
+
+	/// \brief Set the policy, which is checked with IsFlushDue()
+	/// \param nHighWaterMark Flush, when the buffer holds at least this number of bytes
+	/// \param nMaxDelayMs Flush, when the oldest byte waits for this time (0 for no limit)
+	/// \note The default policy is to flush, when the buffer is not empty.
+	void SetFlushPolicy (size_t nHighWaterMark, unsigned nMaxDelayMs = 0);
+
+	/// \return Should Update() be called according to the flush policy?
+	boolean IsFlushDue (void) const;
+
+	/// \return Number of bytes in the ring buffer
+	size_t GetLevel (void) const;
+
+	/// \param pStats Statistics are returned here
+	void GetStats (TWriteBufferStats *pStats);
 
 private:
 	CDevice *m_pDevice;
@@ -53,6 +87,12 @@ private:
 	volatile unsigned m_nInPtr;
 	volatile unsigned m_nOutPtr;
 
+	size_t m_nHighWaterMark;
+	unsigned m_nMaxDelayTicks;
+	volatile unsigned m_nFirstPendingTicks;	// time, when the buffer got non-empty
+
+	TWriteBufferStats m_Stats;
+
 	CSpinLock m_SpinLock;
 };
 
@@ -23,22 +23,233 @@
 #include <circle/2dgraphics.h>
 #include <circle/screen.h>
 #include <circle/bcmpropertytags.h>
+#include <circle/dmacopyservice.h>
+#include <circle/timer.h>
 #include <circle/util.h>
+#include <assert.h>
 
-C2DGraphics::C2DGraphics (unsigned nWidth, unsigned nHeight, boolean bVSync, unsigned nDisplay)
+#define DMA_FILL_MIN_LENGTH	8192		// bytes, smaller rectangles are filled by the CPU
+
+#define NO_BUFFER		3
+
+// A flip queued this close to an estimated VSync may or may not be shown, wait for
+// the VSync instead. The VSync phase is synchronized again after VSYNC_RESYNC_US.
+#define VSYNC_MARGIN_US		1000
+#define VSYNC_RESYNC_US		1000000
+#define VSYNC_MEASURE_COUNT	4
+
+#if defined (__ARM_NEON) && __has_include (<arm_neon.h>)
+	#define GRAPHICS_NEON
+	#include <arm_neon.h>
+
+	#if DEPTH == 8
+		typedef uint8x16_t TColorVector;
+		#define VECTOR_LANES		16
+		#define VECTOR_DUP(c)		vdupq_n_u8 (c)
+		#define VECTOR_LOAD(p)		vld1q_u8 ((const uint8_t *) (p))
+		#define VECTOR_STORE(p, v)	vst1q_u8 ((uint8_t *) (p), v)
+		#define VECTOR_SELECT(m, a, b)	vbslq_u8 (m, a, b)
+		#define VECTOR_EQUAL(a, b)	vceqq_u8 (a, b)
+	#elif DEPTH == 16
+		typedef uint16x8_t TColorVector;
+		#define VECTOR_LANES		8
+		#define VECTOR_DUP(c)		vdupq_n_u16 (c)
+		#define VECTOR_LOAD(p)		vld1q_u16 ((const uint16_t *) (p))
+		#define VECTOR_STORE(p, v)	vst1q_u16 ((uint16_t *) (p), v)
+		#define VECTOR_SELECT(m, a, b)	vbslq_u16 (m, a, b)
+		#define VECTOR_EQUAL(a, b)	vceqq_u16 (a, b)
+	#elif DEPTH == 32
+		typedef uint32x4_t TColorVector;
+		#define VECTOR_LANES		4
+		#define VECTOR_DUP(c)		vdupq_n_u32 (c)
+		#define VECTOR_LOAD(p)		vld1q_u32 ((const uint32_t *) (p))
+		#define VECTOR_STORE(p, v)	vst1q_u32 ((uint32_t *) (p), v)
+		#define VECTOR_SELECT(m, a, b)	vbslq_u32 (m, a, b)
+		#define VECTOR_EQUAL(a, b)	vceqq_u32 (a, b)
+	#endif
+#endif
+
+// Span functions operate on one line of pixels
+
+static void FillSpan (TScreenColor *pDest, TScreenColor Color, unsigned nCount)
+{
+#ifdef GRAPHICS_NEON
+	TColorVector Vector = VECTOR_DUP (Color);
+	for (; nCount >= 2*VECTOR_LANES; nCount -= 2*VECTOR_LANES)
+	{
+		VECTOR_STORE (pDest, Vector);
+		VECTOR_STORE (pDest + VECTOR_LANES, Vector);
+		pDest += 2*VECTOR_LANES;
+	}
+#endif
+
+	while (nCount--)
+	{
+		*pDest++ = Color;
+	}
+}
+
+static void CopySpanTransparent (TScreenColor *pDest, const TScreenColor *pSource, unsigned nCount,
+				 TScreenColor TransparentColor)
+{
+#ifdef GRAPHICS_NEON
+	TColorVector Key = VECTOR_DUP (TransparentColor);
+	for (; nCount >= VECTOR_LANES; nCount -= VECTOR_LANES)
+	{
+		TColorVector Source = VECTOR_LOAD (pSource);
+		TColorVector Dest = VECTOR_LOAD (pDest);
+		VECTOR_STORE (pDest, VECTOR_SELECT (VECTOR_EQUAL (Source, Key), Dest, Source));
+
+		pSource += VECTOR_LANES;
+		pDest += VECTOR_LANES;
+	}
+#endif
+
+	for (; nCount > 0; nCount--, pSource++, pDest++)
+	{
+		if (*pSource != TransparentColor)
+		{
+			*pDest = *pSource;
+		}
+	}
+}
+
+#if DEPTH >= 16
+
+// exact for x <= 255*255
+#define DIV255(x)	(((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+#if defined (GRAPHICS_NEON) && DEPTH == 32
+
+static inline uint8x8_t Div255 (uint16x8_t Value)
+{
+	return vrshrn_n_u16 (vaddq_u16 (Value, vrshrq_n_u16 (Value, 8)), 8);
+}
+
+#endif
+
+// pSource points to pixels in COLOR32 format
+static void BlendSpan (TScreenColor *pDest, const u32 *pSource, unsigned nCount, boolean bPremultiplied)
+{
+#if defined (GRAPHICS_NEON) && DEPTH == 32
+	for (; nCount >= 8; nCount -= 8)
+	{
+		uint8x8x4_t Source = vld4_u8 ((const uint8_t *) pSource);	// B, G, R, A planes
+		uint8x8x4_t Dest = vld4_u8 ((const uint8_t *) pDest);
+
+		uint8x8_t Alpha = Source.val[3];
+		uint8x8_t InvAlpha = vmvn_u8 (Alpha);
+
+		for (unsigned i = 0; i < 4; i++)
+		{
+			uint8x8_t Color = Source.val[i];
+			if (!bPremultiplied && i < 3)
+			{
+				Color = Div255 (vmull_u8 (Color, Alpha));
+			}
+
+			Dest.val[i] = vqadd_u8 (Color, Div255 (vmull_u8 (Dest.val[i], InvAlpha)));
+		}
+
+		vst4_u8 ((uint8_t *) pDest, Dest);
+
+		pSource += 8;
+		pDest += 8;
+	}
+#endif
+
+	for (; nCount > 0; nCount--, pSource++, pDest++)
+	{
+		u32 nSource = *pSource;
+		unsigned nAlpha = nSource >> 24;
+
+		if (bPremultiplied ? nSource == 0 : nAlpha == 0)
+		{
+			continue;
+		}
+
+#if DEPTH == 32
+		if (nAlpha == 0xFF)
+		{
+			*pDest = nSource;
+
+			continue;
+		}
+
+		u32 nDest = *pDest;
+#else
+		// expand COLOR16
+		unsigned nDest16 = *pDest;
+		unsigned nRed = (nDest16 >> 11) & 0x1F;
+		unsigned nGreen = (nDest16 >> 6) & 0x1F;
+		unsigned nBlue = nDest16 & 0x1F;
+		u32 nDest = COLOR32 (  (nRed << 3) | (nRed >> 2), (nGreen << 3) | (nGreen >> 2),
+				       (nBlue << 3) | (nBlue >> 2), 0xFF);
+#endif
+
+		u32 nResult = 0;
+		for (unsigned nShift = 0; nShift < 32; nShift += 8)
+		{
+			unsigned nColor = (nSource >> nShift) & 0xFF;
+			if (!bPremultiplied && nShift < 24)
+			{
+				nColor = DIV255 (nColor * nAlpha);
+			}
+
+			nColor += DIV255 (((nDest >> nShift) & 0xFF) * (0xFF - nAlpha));
+			if (nColor > 0xFF)
+			{
+				nColor = 0xFF;
+			}
+
+			nResult |= nColor << nShift;
+		}
+
+#if DEPTH == 32
+		*pDest = nResult;
+#else
+		*pDest = COLOR16 ((nResult >> 19) & 0x1F, (nResult >> 11) & 0x1F, (nResult >> 3) & 0x1F);
+#endif
+	}
+}
+
+#endif
+
+C2DGraphics::C2DGraphics (unsigned nWidth, unsigned nHeight, boolean bVSync, unsigned nDisplay,
+			  boolean bTripleBuffered)
 : 	m_nWidth(nWidth),
 	m_nHeight(nHeight),
 	m_nDisplay (nDisplay),
 	m_pFrameBuffer(0),
 	m_Buffer(0),
 	m_bVSync(bVSync),
-	m_bBufferSwapped(FALSE)
+	m_bBufferSwapped(FALSE),
+	m_bPreserveContents(FALSE),
+	m_nDirtyRects(0),
+	m_nDMAPending(0),
+	m_bTripleBuffered(bVSync && bTripleBuffered),
+	m_nPrevDirtyRects(0),
+	m_nDisplayedBuffer(0),
+	m_nPendingBuffer(NO_BUFFER),
+	m_nDrawBuffer(1),
+	m_nFlipTicks(0),
+	m_nFrameNumber(0),
+	m_nVSyncTicks(0),
+	m_nVSyncPeriod(0),
+	m_nLastUpdateTicks(0)
 {
+	for (unsigned i = 0; i < 3; i++)
+	{
+		m_nBufferFrame[i] = 0;
+	}
 
+	ResetFrameStats ();
 }
 
 C2DGraphics::~C2DGraphics (void)
 {
+	WaitForDMA ();
+
 	if(m_pFrameBuffer)
 	{
 		delete m_pFrameBuffer;
@@ -47,8 +258,8 @@ C2DGraphics::~C2DGraphics (void)
 
 boolean C2DGraphics::Initialize (void)
 {
-	m_pFrameBuffer = new CBcmFrameBuffer (m_nWidth, m_nHeight, DEPTH, m_nWidth, 2*m_nHeight,
-					      m_nDisplay, TRUE);
+	m_pFrameBuffer = new CBcmFrameBuffer (m_nWidth, m_nHeight, DEPTH, m_nWidth,
+					      (m_bTripleBuffered ? 3 : 2) * m_nHeight, m_nDisplay, TRUE);
 	
 #if DEPTH == 8
 	m_pFrameBuffer->SetPalette (RED_COLOR, RED_COLOR16);
@@ -77,6 +288,19 @@ boolean C2DGraphics::Initialize (void)
 	m_nWidth = m_pFrameBuffer->GetWidth();
 	m_nHeight = m_pFrameBuffer->GetHeight();
 	m_Buffer = m_baseBuffer + m_nWidth * m_nHeight;
+
+	// with auto-detected size the frame buffer has the double height only
+	if (m_bTripleBuffered && m_pFrameBuffer->GetVirtHeight () < 3*m_nHeight)
+	{
+		m_bTripleBuffered = FALSE;
+	}
+
+	if (m_bVSync)
+	{
+		MeasureVSync ();
+	}
+
+	MarkDirty (0, 0, m_nWidth, m_nHeight);		// initial contents are undefined
 	
 	return TRUE;
 }
@@ -98,17 +322,24 @@ void C2DGraphics::ClearScreen(TScreenColor Color)
 
 void C2DGraphics::DrawRect (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, TScreenColor Color)
 {
+	WaitForDMA ();
+
 	if(nX + nWidth > m_nWidth || nY + nHeight > m_nHeight)
 	{
 		return;
 	}
+
+	MarkDirty (nX, nY, nWidth, nHeight);
+
+	if (   nWidth * nHeight * sizeof(TScreenColor) >= DMA_FILL_MIN_LENGTH
+	    && FillRectDMA (nX, nY, nWidth, nHeight, Color))
+	{
+		return;
+	}
 	
 	for(unsigned i = nY; i < nY + nHeight; i++)
 	{
-		for(unsigned j = nX; j < nX + nWidth; j++)
-		{
-			m_Buffer[i * m_nWidth + j] = Color;
-		}
+		FillSpan(&m_Buffer[i * m_nWidth + nX], Color, nWidth);
 	}
 }
 
@@ -127,10 +358,15 @@ void C2DGraphics::DrawRectOutline (unsigned nX, unsigned nY, unsigned nWidth, un
 
 void C2DGraphics::DrawLine (unsigned nX1, unsigned nY1, unsigned nX2, unsigned nY2, TScreenColor Color)
 {
+	WaitForDMA ();
+
 	if(nX1 >= m_nWidth || nY1 >= m_nHeight || nX2 >= m_nWidth || nY2 >= m_nHeight)
 	{
 		return;
 	}
+
+	MarkDirty (nX1 < nX2 ? nX1 : nX2, nY1 < nY2 ? nY1 : nY2,
+		   (nX1 < nX2 ? nX2 - nX1 : nX1 - nX2) + 1, (nY1 < nY2 ? nY2 - nY1 : nY1 - nY2) + 1);
 	
 	int dx = nX2 - nX1;
 	int dy = nY2 - nY1;
@@ -175,34 +411,51 @@ void C2DGraphics::DrawLine (unsigned nX1, unsigned nY1, unsigned nX2, unsigned n
 
 void C2DGraphics::DrawCircle (unsigned nX, unsigned nY, unsigned nRadius, TScreenColor Color)
 {
+	WaitForDMA ();
+
 	if(nX + nRadius >= m_nWidth || nY + nRadius >= m_nHeight || nX - nRadius >= m_nWidth || nY - nRadius >= m_nHeight)
 	{
 		return;
 	}
+
+	MarkDirty (nX - nRadius, nY - nRadius, 2*nRadius, 2*nRadius);
 	
 	int r2 = nRadius * nRadius;
-	unsigned area = r2 << 2;
-	unsigned rr = nRadius << 1;
+	int k = 0;		// half width of the current line: tx * tx + ty * ty < r2 for |tx| <= k
 
-	for (unsigned i = 0; i < area; i++)
+	for (int ty = -(int) nRadius; ty < (int) nRadius; ty++)
 	{
-		int tx = (int) (i % rr) - nRadius;
-		int ty = (int) (i / rr) - nRadius;
+		int rest = r2 - ty * ty;
+		if (rest <= 0)
+		{
+			continue;
+		}
 
-		if (tx * tx + ty * ty < r2)
+		while ((k+1) * (k+1) < rest)
 		{
-			m_Buffer[m_nWidth * (nY + ty) + nX + tx] = Color;
+			k++;
 		}
+
+		while (k * k >= rest)
+		{
+			k--;
+		}
+
+		FillSpan(&m_Buffer[m_nWidth * (nY + ty) + nX - k], Color, 2*k + 1);
 	}
 }
 
 void C2DGraphics::DrawCircleOutline (unsigned nX, unsigned nY, unsigned nRadius, TScreenColor Color)
 {
+	WaitForDMA ();
+
 	if(nX + nRadius >= m_nWidth || nY + nRadius >= m_nHeight || nX - nRadius >= m_nWidth || nY - nRadius >= m_nHeight)
 	{
 		return;
 	}
 
+	MarkDirty (nX - nRadius, nY - nRadius, 2*nRadius + 1, 2*nRadius + 1);
+
 	m_Buffer[m_nWidth * (nY) + nRadius + nX] = Color;
 
 	if (nRadius > 0)
@@ -261,68 +514,637 @@ void C2DGraphics::DrawImageTransparent (unsigned nX, unsigned nY, unsigned nWidt
 
 void C2DGraphics::DrawImageRect (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, unsigned nSourceX, unsigned nSourceY, TScreenColor *PixelBuffer)
 {
+	WaitForDMA ();
+
 	if(nX + nWidth > m_nWidth || nY + nHeight > m_nHeight)
 	{
 		return;
 	}
+
+	MarkDirty (nX, nY, nWidth, nHeight);
 	
 	for(unsigned i=0; i<nHeight; i++)
 	{
-		for(unsigned j=0; j<nWidth; j++)
-		{
-			m_Buffer[(nY + i) * m_nWidth + j + nX] = PixelBuffer[(nSourceY + i) * m_nWidth + j + nSourceX];
-		}
+		memcpy(&m_Buffer[(nY + i) * m_nWidth + nX], &PixelBuffer[(nSourceY + i) * m_nWidth + nSourceX],
+		       nWidth * sizeof(TScreenColor));
 	}
 }
 
 void C2DGraphics::DrawImageRectTransparent (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, unsigned nSourceX, unsigned nSourceY, unsigned nSourceWidth, unsigned nSourceHeight, TScreenColor *PixelBuffer, TScreenColor TransparentColor)
 {
+	WaitForDMA ();
+
 	if(nX + nWidth > m_nWidth || nY + nHeight > m_nHeight || nSourceX + nWidth > nSourceWidth || nSourceY + nHeight > nSourceHeight)
 	{
 		return;
 	}
+
+	MarkDirty (nX, nY, nWidth, nHeight);
 	
 	for(unsigned i=0; i<nHeight; i++)
 	{
-		for(unsigned j=0; j<nWidth; j++)
+		CopySpanTransparent(&m_Buffer[(nY + i) * m_nWidth + nX],
+				    &PixelBuffer[(nSourceY + i) * nSourceWidth + nSourceX],
+				    nWidth, TransparentColor);
+	}
+}
+
+#if DEPTH >= 16
+
+void C2DGraphics::DrawImageBlended (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, const u32 *PixelBuffer, boolean bPremultiplied)
+{
+	DrawImageRectBlended(nX, nY, nWidth, nHeight, 0, 0, nWidth, nHeight, PixelBuffer, bPremultiplied);
+}
+
+void C2DGraphics::DrawImageRectBlended (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, unsigned nSourceX, unsigned nSourceY, unsigned nSourceWidth, unsigned nSourceHeight, const u32 *PixelBuffer, boolean bPremultiplied)
+{
+	WaitForDMA ();
+
+	if(nX + nWidth > m_nWidth || nY + nHeight > m_nHeight || nSourceX + nWidth > nSourceWidth || nSourceY + nHeight > nSourceHeight)
+	{
+		return;
+	}
+
+	MarkDirty (nX, nY, nWidth, nHeight);
+
+	for(unsigned i=0; i<nHeight; i++)
+	{
+		BlendSpan(&m_Buffer[(nY + i) * m_nWidth + nX],
+			  &PixelBuffer[(nSourceY + i) * nSourceWidth + nSourceX],
+			  nWidth, bPremultiplied);
+	}
+}
+
+#endif
+
+boolean C2DGraphics::ClipSprite (const TSprite &rSprite, TRect *pDest, unsigned *pSourceX, unsigned *pSourceY) const
+{
+	int nX1 = rSprite.nX;
+	int nY1 = rSprite.nY;
+	int nX2 = nX1 + (int) rSprite.nWidth;
+	int nY2 = nY1 + (int) rSprite.nHeight;
+
+	*pSourceX = rSprite.nSourceX;
+	*pSourceY = rSprite.nSourceY;
+
+	if (nX1 < 0)
+	{
+		*pSourceX -= nX1;
+		nX1 = 0;
+	}
+
+	if (nY1 < 0)
+	{
+		*pSourceY -= nY1;
+		nY1 = 0;
+	}
+
+	if (nX2 > (int) m_nWidth)
+	{
+		nX2 = m_nWidth;
+	}
+
+	if (nY2 > (int) m_nHeight)
+	{
+		nY2 = m_nHeight;
+	}
+
+	if (nX1 >= nX2 || nY1 >= nY2)
+	{
+		return FALSE;
+	}
+
+	pDest->nX1 = nX1;
+	pDest->nY1 = nY1;
+	pDest->nX2 = nX2;
+	pDest->nY2 = nY2;
+
+	return TRUE;
+}
+
+void C2DGraphics::DrawSprites (const TSprite *pSprites, unsigned nCount, const TScreenColor *pAtlas, unsigned nAtlasWidth, boolean bTransparent, TScreenColor TransparentColor)
+{
+	WaitForDMA ();
+
+	assert (pSprites != 0);
+	assert (pAtlas != 0);
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		assert (pSprites[i].nSourceX + pSprites[i].nWidth <= nAtlasWidth);
+
+		TRect Rect;
+		unsigned nSourceX, nSourceY;
+		if (!ClipSprite (pSprites[i], &Rect, &nSourceX, &nSourceY))
 		{
-			TScreenColor sourcePixel = PixelBuffer[(nSourceY + i) * nSourceWidth + j + nSourceX];
-			if(sourcePixel != TransparentColor)
+			continue;
+		}
+
+		MarkDirty (Rect.nX1, Rect.nY1, Rect.nX2 - Rect.nX1, Rect.nY2 - Rect.nY1);
+
+		unsigned nWidth = Rect.nX2 - Rect.nX1;
+		TScreenColor *pDest = &m_Buffer[Rect.nY1 * m_nWidth + Rect.nX1];
+		const TScreenColor *pSource = &pAtlas[nSourceY * nAtlasWidth + nSourceX];
+
+		for (unsigned nLine = Rect.nY1; nLine < Rect.nY2; nLine++)
+		{
+			if (bTransparent)
+			{
+				CopySpanTransparent (pDest, pSource, nWidth, TransparentColor);
+			}
+			else
 			{
-				m_Buffer[(nY + i) * m_nWidth + j + nX] = sourcePixel;
+				memcpy (pDest, pSource, nWidth * sizeof (TScreenColor));
 			}
+
+			pDest += m_nWidth;
+			pSource += nAtlasWidth;
 		}
 	}
 }
 
+#if DEPTH >= 16
+
+void C2DGraphics::DrawSpritesBlended (const TSprite *pSprites, unsigned nCount, const u32 *pAtlas, unsigned nAtlasWidth, boolean bPremultiplied)
+{
+	WaitForDMA ();
+
+	assert (pSprites != 0);
+	assert (pAtlas != 0);
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		assert (pSprites[i].nSourceX + pSprites[i].nWidth <= nAtlasWidth);
+
+		TRect Rect;
+		unsigned nSourceX, nSourceY;
+		if (!ClipSprite (pSprites[i], &Rect, &nSourceX, &nSourceY))
+		{
+			continue;
+		}
+
+		MarkDirty (Rect.nX1, Rect.nY1, Rect.nX2 - Rect.nX1, Rect.nY2 - Rect.nY1);
+
+		unsigned nWidth = Rect.nX2 - Rect.nX1;
+		TScreenColor *pDest = &m_Buffer[Rect.nY1 * m_nWidth + Rect.nX1];
+		const u32 *pSource = &pAtlas[nSourceY * nAtlasWidth + nSourceX];
+
+		for (unsigned nLine = Rect.nY1; nLine < Rect.nY2; nLine++)
+		{
+			BlendSpan (pDest, pSource, nWidth, bPremultiplied);
+
+			pDest += m_nWidth;
+			pSource += nAtlasWidth;
+		}
+	}
+}
+
+#endif
+
 void C2DGraphics::DrawPixel (unsigned nX, unsigned nY, TScreenColor Color)
 {
+	WaitForDMA ();
+
 	if(nX >= m_nWidth || nY >= m_nHeight)
 	{
 		return;
 	}
+
+	MarkDirty (nX, nY, 1, 1);
 	
 	m_Buffer[m_nWidth * nY + nX] = Color;
 }
 
 TScreenColor* C2DGraphics::GetBuffer ()
 {
+	WaitForDMA ();
+
+	MarkDirty (0, 0, m_nWidth, m_nHeight);		// unknown, what will be modified
+
 	return m_Buffer;
 }
 
 void C2DGraphics::UpdateDisplay()
 {
+	if (m_bTripleBuffered)
+	{
+		UpdateDisplayTriple ();
+
+		return;
+	}
 	
 	if(m_bVSync)
 	{
+		WaitForDMA ();		// a fill may still be running
+
+		TScreenColor *pDrawnBuffer = m_Buffer;
+
 		m_pFrameBuffer->SetVirtualOffset(0, m_bBufferSwapped ? m_nHeight : 0);
 		m_pFrameBuffer->WaitForVerticalSync();
 		m_bBufferSwapped = !m_bBufferSwapped;
 		m_Buffer = m_baseBuffer + m_bBufferSwapped * m_nWidth * m_nHeight;
+
+		unsigned nTicks = CTimer::GetClockTicks ();
+		UpdateFrameStats (nTicks);
+		m_nVSyncTicks = nTicks;
+
+		if (m_bPreserveContents)
+		{
+			// the new back buffer lacks the changes of the frame, which is displayed now
+			CopyDirty (m_Buffer, pDrawnBuffer, m_DirtyRect, m_nDirtyRects);
+		}
 	}
 	else
 	{
-		memcpy(m_baseBuffer, m_Buffer, m_nWidth * m_nHeight * sizeof(TScreenColor));
+		WaitForDMA ();
+		UpdateFrameStats (CTimer::GetClockTicks ());
+		CopyDirty (m_baseBuffer, m_Buffer, m_DirtyRect, m_nDirtyRects);
 	}
-	
+
+	m_nDirtyRects = 0;
+}
+
+// The flip to the drawn buffer is queued with SetVirtualOffset() and takes effect with the
+// next VSync. Drawing continues in the third buffer, which is neither displayed nor pending.
+// A pending flip, which has not been shown until the next UpdateDisplay(), is replaced.
+// The time of the VSyncs is estimated from the measured period.
+void C2DGraphics::UpdateDisplayTriple (void)
+{
+	WaitForDMA ();
+
+	unsigned nTicks = CTimer::GetClockTicks ();
+	UpdateFrameStats (nTicks);
+
+	boolean bSync =    nTicks - m_nVSyncTicks >= VSYNC_RESYNC_US
+			|| IsNearVSync (nTicks);
+
+	if (m_nPendingBuffer != NO_BUFFER)
+	{
+		if (GetVSyncIndex (nTicks) != GetVSyncIndex (m_nFlipTicks))
+		{
+			m_nDisplayedBuffer = m_nPendingBuffer;
+		}
+		else if (!bSync)
+		{
+			m_Stats.nDroppedFrames++;
+		}
+
+		m_nPendingBuffer = NO_BUFFER;
+	}
+
+	TScreenColor *pDrawnBuffer = m_Buffer;
+	m_nBufferFrame[m_nDrawBuffer] = ++m_nFrameNumber;
+
+	m_pFrameBuffer->SetVirtualOffset (0, m_nDrawBuffer * m_nHeight);
+
+	if (bSync)
+	{
+		m_pFrameBuffer->WaitForVerticalSync ();
+
+		unsigned nVSyncTicks = CTimer::GetClockTicks ();
+
+		// refine the period using the longer interval since the last synchronization
+		assert (m_nVSyncPeriod > 0);
+		unsigned nPeriods = (nVSyncTicks - m_nVSyncTicks + m_nVSyncPeriod/2) / m_nVSyncPeriod;
+		if (nPeriods > 0)
+		{
+			m_nVSyncPeriod = (nVSyncTicks - m_nVSyncTicks) / nPeriods;
+			m_Stats.nVSyncPeriod = m_nVSyncPeriod;
+		}
+		m_nVSyncTicks = nVSyncTicks;
+
+		m_nDisplayedBuffer = m_nDrawBuffer;
+	}
+	else
+	{
+		m_nPendingBuffer = m_nDrawBuffer;
+		m_nFlipTicks = nTicks;
+	}
+
+	// select the buffer, which is neither displayed nor pending
+	for (unsigned i = 0; i < 3; i++)
+	{
+		if (i != m_nDisplayedBuffer && i != m_nPendingBuffer)
+		{
+			m_nDrawBuffer = i;
+
+			break;
+		}
+	}
+
+	m_Buffer = m_baseBuffer + m_nDrawBuffer * m_nWidth * m_nHeight;
+
+	if (m_bPreserveContents)
+	{
+		// the new drawing buffer lacks the changes of the frames drawn after its own
+		unsigned nAge = m_nFrameNumber - m_nBufferFrame[m_nDrawBuffer];
+		if (nAge <= 2)
+		{
+			CopyDirty (m_Buffer, pDrawnBuffer, m_DirtyRect, m_nDirtyRects);
+			if (nAge == 2)
+			{
+				CopyDirty (m_Buffer, pDrawnBuffer, m_PrevDirtyRect, m_nPrevDirtyRects);
+			}
+		}
+		else
+		{
+			TRect Screen = {0, 0, m_nWidth, m_nHeight};
+			CopyDirty (m_Buffer, pDrawnBuffer, &Screen, 1);
+		}
+	}
+
+	memcpy (m_PrevDirtyRect, m_DirtyRect, m_nDirtyRects * sizeof(TRect));
+	m_nPrevDirtyRects = m_nDirtyRects;
+
+	m_nDirtyRects = 0;
+}
+
+boolean C2DGraphics::IsTripleBuffered (void) const
+{
+	return m_bTripleBuffered;
+}
+
+void C2DGraphics::GetFrameStats (TFrameStats *pStats) const
+{
+	assert (pStats != 0);
+	*pStats = m_Stats;
+}
+
+void C2DGraphics::ResetFrameStats (void)
+{
+	m_Stats.nFrames = 0;
+	m_Stats.nLastFrameTime = 0;
+	m_Stats.nMaxFrameTime = 0;
+	m_Stats.nMissedVSyncs = 0;
+	m_Stats.nDroppedFrames = 0;
+	m_Stats.nVSyncPeriod = m_nVSyncPeriod;
+}
+
+void C2DGraphics::MeasureVSync (void)
+{
+	m_pFrameBuffer->WaitForVerticalSync ();
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	for (unsigned i = 0; i < VSYNC_MEASURE_COUNT; i++)
+	{
+		m_pFrameBuffer->WaitForVerticalSync ();
+	}
+
+	m_nVSyncTicks = CTimer::GetClockTicks ();
+	m_nVSyncPeriod = (m_nVSyncTicks - nStartTicks) / VSYNC_MEASURE_COUNT;
+
+	// without a working VSync there is nothing to wait for
+	if (m_nVSyncPeriod < VSYNC_MARGIN_US * 4)
+	{
+		m_nVSyncPeriod = 0;
+		m_bTripleBuffered = FALSE;
+	}
+
+	m_Stats.nVSyncPeriod = m_nVSyncPeriod;
+}
+
+void C2DGraphics::UpdateFrameStats (unsigned nTicks)
+{
+	if (m_Stats.nFrames > 0)
+	{
+		unsigned nFrameTime = nTicks - m_nLastUpdateTicks;
+
+		m_Stats.nLastFrameTime = nFrameTime;
+		if (m_Stats.nMaxFrameTime < nFrameTime)
+		{
+			m_Stats.nMaxFrameTime = nFrameTime;
+		}
+
+		if (m_nVSyncPeriod > 0)
+		{
+			// with double buffering nTicks is taken after the VSync
+			unsigned nVSyncs = m_bTripleBuffered
+					 ? GetVSyncIndex (nTicks) - GetVSyncIndex (m_nLastUpdateTicks)
+					 : (nFrameTime + m_nVSyncPeriod/2) / m_nVSyncPeriod;
+			if (nVSyncs > 1)
+			{
+				m_Stats.nMissedVSyncs += nVSyncs - 1;
+			}
+		}
+	}
+
+	m_Stats.nFrames++;
+	m_nLastUpdateTicks = nTicks;
+}
+
+int C2DGraphics::GetVSyncIndex (unsigned nTicks) const
+{
+	assert (m_nVSyncPeriod > 0);
+	int nDiff = (int) (nTicks - m_nVSyncTicks);
+
+	return nDiff >= 0 ? nDiff / (int) m_nVSyncPeriod
+			  : -(int) ((-nDiff + m_nVSyncPeriod - 1) / m_nVSyncPeriod);
+}
+
+boolean C2DGraphics::IsNearVSync (unsigned nTicks) const
+{
+	assert (m_nVSyncPeriod > 0);
+	unsigned nPhase = (nTicks - m_nVSyncTicks) % m_nVSyncPeriod;
+
+	return    nPhase < VSYNC_MARGIN_US
+	       || nPhase > m_nVSyncPeriod - VSYNC_MARGIN_US;
+}
+
+void C2DGraphics::SetPreserveContents (boolean bEnable)
+{
+	m_bPreserveContents = bEnable;
+}
+
+void C2DGraphics::MarkDirty (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight)
+{
+	if (nX >= m_nWidth || nY >= m_nHeight || nWidth == 0 || nHeight == 0)
+	{
+		return;
+	}
+
+	TRect Rect = {nX, nY, nX + nWidth, nY + nHeight};
+	if (Rect.nX2 > m_nWidth)
+	{
+		Rect.nX2 = m_nWidth;
+	}
+	if (Rect.nY2 > m_nHeight)
+	{
+		Rect.nY2 = m_nHeight;
+	}
+
+	// merge with an overlapping or adjacent rectangle
+	for (unsigned i = 0; i < m_nDirtyRects; i++)
+	{
+		TRect *pRect = &m_DirtyRect[i];
+
+		if (   Rect.nX1 <= pRect->nX2 && pRect->nX1 <= Rect.nX2
+		    && Rect.nY1 <= pRect->nY2 && pRect->nY1 <= Rect.nY2)
+		{
+			Unite (pRect, Rect);
+
+			return;
+		}
+	}
+
+	if (m_nDirtyRects < DIRTY_RECTS_MAX)
+	{
+		m_DirtyRect[m_nDirtyRects++] = Rect;
+
+		return;
+	}
+
+	// list is full, merge with the rectangle, which grows least
+	unsigned nBest = 0;
+	unsigned nBestGrowth = (unsigned) -1;
+	for (unsigned i = 0; i < m_nDirtyRects; i++)
+	{
+		TRect Union = m_DirtyRect[i];
+		Unite (&Union, Rect);
+
+		unsigned nGrowth =   (Union.nX2 - Union.nX1) * (Union.nY2 - Union.nY1)
+				   - (m_DirtyRect[i].nX2 - m_DirtyRect[i].nX1)
+				     * (m_DirtyRect[i].nY2 - m_DirtyRect[i].nY1);
+		if (nGrowth < nBestGrowth)
+		{
+			nBest = i;
+			nBestGrowth = nGrowth;
+		}
+	}
+
+	Unite (&m_DirtyRect[nBest], Rect);
+}
+
+void C2DGraphics::Unite (TRect *pRect, const TRect &rOther)
+{
+	if (rOther.nX1 < pRect->nX1)
+	{
+		pRect->nX1 = rOther.nX1;
+	}
+	if (rOther.nY1 < pRect->nY1)
+	{
+		pRect->nY1 = rOther.nY1;
+	}
+	if (rOther.nX2 > pRect->nX2)
+	{
+		pRect->nX2 = rOther.nX2;
+	}
+	if (rOther.nY2 > pRect->nY2)
+	{
+		pRect->nY2 = rOther.nY2;
+	}
+}
+
+void C2DGraphics::CopyDirty (TScreenColor *pDest, const TScreenColor *pSource, const TRect *pRects, unsigned nRects)
+{
+	CDMACopyService *pDMA = CDMACopyService::Get ();
+
+	for (unsigned i = 0; i < nRects; i++)
+	{
+		const TRect *pRect = &pRects[i];
+
+		size_t nOffset = pRect->nY1 * m_nWidth + pRect->nX1;
+		size_t nLength = (pRect->nX2 - pRect->nX1) * sizeof(TScreenColor);
+		unsigned nLines = pRect->nY2 - pRect->nY1;
+		size_t nPitch = m_nWidth * sizeof(TScreenColor);
+
+		// offload the copy to the DMA controller, drawing waits for its completion
+		if (pDMA != 0)
+		{
+			__atomic_add_fetch (&m_nDMAPending, 1, __ATOMIC_RELAXED);
+
+			boolean bOK;
+			if (pRect->nX1 == 0 && pRect->nX2 == m_nWidth)
+			{
+				bOK = pDMA->Copy (pDest + nOffset, pSource + nOffset, nLines * nPitch,
+						  DMACompletionHandler, this);
+			}
+			else
+			{
+				bOK = pDMA->Copy2D (pDest + nOffset, nPitch, pSource + nOffset, nPitch,
+						    nLength, nLines, DMACompletionHandler, this);
+			}
+
+			if (bOK)
+			{
+				continue;
+			}
+
+			__atomic_sub_fetch (&m_nDMAPending, 1, __ATOMIC_RELAXED);
+		}
+
+		for (unsigned nLine = 0; nLine < nLines; nLine++)
+		{
+			memcpy(pDest + nOffset, pSource + nOffset, nLength);
+
+			nOffset += m_nWidth;
+		}
+	}
+}
+
+boolean C2DGraphics::FillRectDMA (unsigned nX, unsigned nY, unsigned nWidth, unsigned nHeight, TScreenColor Color)
+{
+	CDMACopyService *pDMA = CDMACopyService::Get ();
+	if (pDMA == 0)
+	{
+		return FALSE;
+	}
+
+	// the DMA controller writes whole words, the pixels before and after are set by the CPU
+	const unsigned nPixelsPerWord = sizeof(u32) / sizeof(TScreenColor);
+	unsigned nHead = (nPixelsPerWord - nX % nPixelsPerWord) % nPixelsPerWord;
+	if (nHead >= nWidth)
+	{
+		return FALSE;
+	}
+	unsigned nTail = (nX + nWidth) % nPixelsPerWord;
+	unsigned nWords = (nWidth - nHead - nTail) / nPixelsPerWord;
+	if (nWords == 0)
+	{
+		return FALSE;
+	}
+
+#if DEPTH == 8
+	u32 nFillWord = Color * 0x01010101U;
+#elif DEPTH == 16
+	u32 nFillWord = Color | (u32) Color << 16;
+#else
+	u32 nFillWord = Color;
+#endif
+
+	// before the submit, because the DMA setup cleans the data cache for these lines
+	if (nHead != 0 || nTail != 0)
+	{
+		for(unsigned i = nY; i < nY + nHeight; i++)
+		{
+			FillSpan(&m_Buffer[i * m_nWidth + nX], Color, nHead);
+			FillSpan(&m_Buffer[i * m_nWidth + nX + nWidth - nTail], Color, nTail);
+		}
+	}
+
+	__atomic_add_fetch (&m_nDMAPending, 1, __ATOMIC_RELAXED);
+
+	if (!pDMA->Fill2D (&m_Buffer[nY * m_nWidth + nX + nHead], m_nWidth * sizeof(TScreenColor),
+			   nFillWord, nWords * sizeof(u32), nHeight, DMACompletionHandler, this))
+	{
+		__atomic_sub_fetch (&m_nDMAPending, 1, __ATOMIC_RELAXED);
+
+		return FALSE;		// the caller fills the whole rectangle
+	}
+
+	return TRUE;
+}
+
+void C2DGraphics::WaitForDMA (void)
+{
+	while (__atomic_load_n (&m_nDMAPending, __ATOMIC_ACQUIRE) != 0)
+	{
+		// do nothing
+	}
+}
+
+void C2DGraphics::DMACompletionHandler (boolean bStatus, void *pParam)
+{
+	C2DGraphics *pThis = (C2DGraphics *) pParam;
+
+	__atomic_sub_fetch (&pThis->m_nDMAPending, 1, __ATOMIC_RELEASE);
 }
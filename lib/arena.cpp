@@ -0,0 +1,291 @@
+//
+// arena.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/arena.h>
+#include <circle/memory.h>
+#include <circle/sysconfig.h>
+#include <assert.h>
+
+struct TArenaChunk
+{
+	TArenaChunk	*pNext;
+	size_t		 nSize;			// of data area
+	u8		*pData;
+};
+
+#define CHUNK_HEADER_SIZE	((sizeof (TArenaChunk) + ARENA_DEFAULT_ALIGN-1) & ~(ARENA_DEFAULT_ALIGN-1))
+
+CArena::CArena (size_t nChunkSize, boolean bPageBacked)
+:	m_Backing (bPageBacked ? BackingPages : BackingHeap),
+	m_nChunkSize (nChunkSize),
+	m_pParent (0),
+	m_pFirst (0),
+	m_pCurrent (0),
+	m_nOffset (0)
+{
+	assert (m_nChunkSize > CHUNK_HEADER_SIZE);
+
+	if (bPageBacked)
+	{
+		m_nChunkSize = (m_nChunkSize + PAGE_SIZE-1) & ~(PAGE_SIZE-1);
+	}
+}
+
+CArena::CArena (CArena *pParent, size_t nChunkSize)
+:	m_Backing (BackingParent),
+	m_nChunkSize (nChunkSize),
+	m_pParent (pParent),
+	m_pFirst (0),
+	m_pCurrent (0),
+	m_nOffset (0)
+{
+	assert (m_pParent != 0);
+	assert (m_pParent != this);
+	assert (m_nChunkSize > CHUNK_HEADER_SIZE);
+}
+
+CArena::CArena (void *pBuffer, size_t nSize)
+:	m_Backing (BackingFixed),
+	m_nChunkSize (nSize),
+	m_pParent (0),
+	m_pFirst (0),
+	m_pCurrent (0),
+	m_nOffset (0)
+{
+	assert (pBuffer != 0);
+	assert (((uintptr) pBuffer & (sizeof (void *)-1)) == 0);
+	assert (nSize > CHUNK_HEADER_SIZE);
+
+	m_pFirst = (TArenaChunk *) pBuffer;
+	m_pFirst->pNext = 0;
+	m_pFirst->nSize = nSize - CHUNK_HEADER_SIZE;
+	m_pFirst->pData = (u8 *) pBuffer + CHUNK_HEADER_SIZE;
+
+	m_pCurrent = m_pFirst;
+}
+
+CArena::~CArena (void)
+{
+	if (m_Backing != BackingFixed)
+	{
+		FreeChunks (m_pFirst);
+	}
+
+	m_pFirst = 0;
+	m_pCurrent = 0;
+	m_pParent = 0;
+}
+
+void *CArena::Allocate (size_t nSize, size_t nAlign)
+{
+	assert (nAlign > 0);
+	assert ((nAlign & (nAlign-1)) == 0);
+
+	if (m_pCurrent != 0)
+	{
+		uintptr nAddress = (uintptr) m_pCurrent->pData + m_nOffset;
+		nAddress = (nAddress + nAlign-1) & ~(nAlign-1);
+
+		size_t nEnd = nAddress + nSize - (uintptr) m_pCurrent->pData;
+		if (nEnd <= m_pCurrent->nSize)
+		{
+			m_nOffset = nEnd;
+
+			return (void *) nAddress;
+		}
+	}
+
+	if (m_Backing == BackingFixed)
+	{
+		return 0;
+	}
+
+	TArenaChunk *pChunk = AddChunk (nSize + nAlign-1);
+	if (pChunk == 0)
+	{
+		return 0;
+	}
+
+	uintptr nAddress = ((uintptr) pChunk->pData + nAlign-1) & ~(nAlign-1);
+	m_nOffset = nAddress + nSize - (uintptr) pChunk->pData;
+	assert (m_nOffset <= pChunk->nSize);
+
+	return (void *) nAddress;
+}
+
+void CArena::Reset (void)
+{
+	if (m_pFirst == 0)
+	{
+		return;
+	}
+
+	if (m_Backing != BackingFixed)
+	{
+		FreeChunks (m_pFirst->pNext);
+		m_pFirst->pNext = 0;
+	}
+
+	m_pCurrent = m_pFirst;
+	m_nOffset = 0;
+}
+
+TArenaMark CArena::GetMark (void) const
+{
+	TArenaMark Mark;
+	Mark.pChunk = m_pCurrent;
+	Mark.nOffset = m_nOffset;
+
+	return Mark;
+}
+
+void CArena::Release (const TArenaMark &Mark)
+{
+	if (Mark.pChunk == 0)			// arena was unused, when the mark was taken
+	{
+		Reset ();
+
+		return;
+	}
+
+	assert (Mark.nOffset <= Mark.pChunk->nSize);
+
+	if (Mark.pChunk != m_pCurrent)
+	{
+		FreeChunks (Mark.pChunk->pNext);
+		Mark.pChunk->pNext = 0;
+	}
+	else
+	{
+		assert (Mark.nOffset <= m_nOffset);
+	}
+
+	m_pCurrent = Mark.pChunk;
+	m_nOffset = Mark.nOffset;
+}
+
+size_t CArena::GetUsed (void) const
+{
+	size_t nUsed = 0;
+	for (TArenaChunk *pChunk = m_pFirst; pChunk != 0; pChunk = pChunk->pNext)
+	{
+		if (pChunk == m_pCurrent)
+		{
+			return nUsed + m_nOffset;
+		}
+
+		nUsed += pChunk->nSize;
+	}
+
+	return nUsed;
+}
+
+TArenaChunk *CArena::AddChunk (size_t nMinSize)
+{
+	size_t nSize = nMinSize + CHUNK_HEADER_SIZE;
+	if (nSize < m_nChunkSize)
+	{
+		nSize = m_nChunkSize;
+	}
+
+	void *pMemory = 0;
+	switch (m_Backing)
+	{
+	case BackingHeap:
+		pMemory = new u8[nSize];
+		break;
+
+	case BackingPages:
+		nSize = (nSize + PAGE_SIZE-1) & ~(PAGE_SIZE-1);
+		pMemory = CMemorySystem::PageAllocateContiguous (nSize);
+		break;
+
+	case BackingParent:
+		assert (m_pParent != 0);
+		pMemory = m_pParent->Allocate (nSize, ARENA_DEFAULT_ALIGN);
+		break;
+
+	default:
+		assert (0);
+		break;
+	}
+
+	if (pMemory == 0)
+	{
+		return 0;
+	}
+
+	TArenaChunk *pChunk = (TArenaChunk *) pMemory;
+	pChunk->pNext = 0;
+	pChunk->nSize = nSize - CHUNK_HEADER_SIZE;
+	pChunk->pData = (u8 *) pMemory + CHUNK_HEADER_SIZE;
+
+	if (m_pCurrent == 0)
+	{
+		assert (m_pFirst == 0);
+		m_pFirst = pChunk;
+	}
+	else
+	{
+		// a partly used chunk is not visited again, until the arena is reset
+		assert (m_pCurrent->pNext == 0);
+		m_pCurrent->pNext = pChunk;
+	}
+
+	m_pCurrent = pChunk;
+	m_nOffset = 0;
+
+	return pChunk;
+}
+
+void CArena::FreeChunks (TArenaChunk *pChunk)
+{
+	assert (m_Backing != BackingFixed);
+
+	while (pChunk != 0)
+	{
+		TArenaChunk *pNext = pChunk->pNext;
+
+		switch (m_Backing)
+		{
+		case BackingHeap:
+			delete [] (u8 *) pChunk;
+			break;
+
+		case BackingPages:
+			CMemorySystem::PageFree (pChunk);
+			break;
+
+		default:				// returned to parent on its Reset()
+			break;
+		}
+
+		pChunk = pNext;
+	}
+}
+
+void *operator new (size_t nSize, CArena &rArena) noexcept
+{
+	return rArena.Allocate (nSize);
+}
+
+void *operator new[] (size_t nSize, CArena &rArena) noexcept
+{
+	return rArena.Allocate (nSize);
+}
@@ -16,7 +16,7 @@
 //	Licensed under GPLv2
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2019-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2019-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -46,13 +46,36 @@
 
 #define GENET_V5			5	// the only supported GENET version
 
+// ring configuration (the default queues 16 get the remaining descriptors)
+#ifndef GENET_TX_QUEUES
+#define GENET_TX_QUEUES			4	// Tx priority queues (0-4)
+#endif
+#ifndef GENET_TX_BDS_PER_Q
+#define GENET_TX_BDS_PER_Q		32	// buffer descriptors per Tx priority queue
+#endif
+#ifndef GENET_TX_RING_INDEX
+#define GENET_TX_RING_INDEX		1	// 0: default queue 16, 1-4: priority queue 0-3
+#endif
+#ifndef GENET_RX_QUEUES
+#define GENET_RX_QUEUES			0	// Rx priority queues (0-16), see AddRxFilter()
+#endif
+#ifndef GENET_RX_BDS_PER_Q
+#define GENET_RX_BDS_PER_Q		32	// buffer descriptors per Rx priority queue
+#endif
+
+// interrupt coalescing
+#ifndef GENET_TX_COALESCE_FRAMES
+#define GENET_TX_COALESCE_FRAMES	10	// transmitted frames per Tx interrupt
+#endif
+
 // HW params for GENET_V5
-#define TX_QUEUES			4
-#define TX_BDS_PER_Q			32	// buffer descriptors per Tx queue
-#define RX_QUEUES			0	// not implemented
-#define RX_BDS_PER_Q			0	// buffer descriptors per Rx queue
+#define TX_QUEUES			GENET_TX_QUEUES
+#define TX_BDS_PER_Q			GENET_TX_BDS_PER_Q
+#define RX_QUEUES			GENET_RX_QUEUES
+#define RX_BDS_PER_Q			GENET_RX_BDS_PER_Q
 #define HFB_FILTER_CNT			48
 #define HFB_FILTER_SIZE			128
+#define HFB_FILTER_MAX_LENGTH		128	// bytes, RBUF_HFB_256B is not set
 #define QTAG_MASK			0x3F
 #define HFB_OFFSET			0x8000
 #define HFB_REG_OFFSET			0xFC00
@@ -60,7 +83,12 @@
 #define TDMA_OFFSET			0x4000
 #define WORDS_PER_BD			3	// word per buffer descriptor
 
-#define RX_BUF_LENGTH			2048
+#define RX_BUF_LENGTH			FRAME_BUFFER_SIZE	// data of a net buffer
+#if FRAME_BUFFER_SIZE <= 2048
+#define TX_BUF_LENGTH			2048
+#else
+#define TX_BUF_LENGTH			FRAME_BUFFER_SIZE
+#endif
 
 // DMA descriptors
 #define TOTAL_DESC			256	// number of buffer descriptors (same for Rx/Tx)
@@ -78,7 +106,19 @@
 #define GENET_Q16_RX_BD_CNT		(TOTAL_DESC - RX_QUEUES * RX_BDS_PER_Q)
 #define GENET_Q16_TX_BD_CNT		(TOTAL_DESC - TX_QUEUES * TX_BDS_PER_Q)
 
-#define TX_RING_INDEX			1	// using highest TX priority queue
+#define TX_RING_INDEX			GENET_TX_RING_INDEX
+
+#if TX_QUEUES > 4 || GENET_Q16_TX_BD_CNT < 32 || TX_RING_INDEX > TX_QUEUES
+	#error Invalid Tx queue configuration
+#endif
+
+#if RX_QUEUES > GENET_DESC_INDEX || GENET_Q16_RX_BD_CNT < 32
+	#error Invalid Rx queue configuration
+#endif
+
+#if GENET_TX_COALESCE_FRAMES < 1 || GENET_TX_COALESCE_FRAMES > TX_BDS_PER_Q
+	#error Invalid GENET_TX_COALESCE_FRAMES
+#endif
 
 // Tx/Rx DMA register offset, skip 256 descriptors
 #define GENET_TDMA_REG_OFF		(TDMA_OFFSET + TOTAL_DESC * DMA_DESC_SIZE)
@@ -94,6 +134,27 @@
 #define ETH_FCS_LEN			4
 #define ETH_ZLEN			60
 #define ENET_MAX_MTU_SIZE		1536	// with padding
+#define ENET_MAX_FRAME_LEN(mtu)		(  (mtu) <= NET_MTU_DEFAULT		\
+					 ? ENET_MAX_MTU_SIZE			\
+					 : (mtu) + 14 + 4 + ETH_FCS_LEN)	// with VLAN tag
+
+// Tx status block (TSB), which precedes each Tx frame (RBUF_64B_EN set in TBUF_CTRL)
+#define TSB_SIZE			64
+#define TSB_TX_CSUM_INFO		0x30	// offset of the word in the TSB
+#define  STATUS_TX_CSUM_START_SHIFT	16
+#define  STATUS_TX_CSUM_PROTO_UDP	(1 << 15)
+#define  STATUS_TX_CSUM_LV		(1U << 31)
+
+#define ETH_HLEN			14
+#define IP_PROTOCOL_OFFSET		9	// in the IP header
+#define IP_PROTOCOL_UDP			17
+
+// the frame and the leading pad (or the TSB) must fit into one DMA descriptor (12 bits length)
+#if    ENET_MAX_FRAME_LEN (NET_MTU_MAX) + 2 > RX_BUF_LENGTH \
+    || ENET_MAX_FRAME_LEN (NET_MTU_MAX) + 2 > 4095 \
+    || ENET_MAX_FRAME_LEN (NET_MTU_MAX) - ETH_FCS_LEN + TSB_SIZE > 4095
+	#error NET_MTU_MAX is too big for GENET
+#endif
 
 // HW register offset and field definitions
 #define UMAC_HD_BKP_CTRL		0x004
@@ -281,6 +342,7 @@
 #define GENET_INTRL2_0_OFF		0x0200
 #define GENET_INTRL2_1_OFF		0x0240
 #define GENET_RBUF_OFF			0x0300
+#define GENET_TBUF_OFF			0x0600
 #define GENET_UMAC_OFF			0x0800
 
 // SYS block offsets and register definitions
@@ -545,6 +607,9 @@ GENET_IO_MACRO(hfb_reg, HFB_REG_OFFSET);
 // RBUF register accessors
 GENET_IO_MACRO(rbuf, GENET_RBUF_OFF);
 
+// TBUF register accessors
+GENET_IO_MACRO(tbuf, GENET_TBUF_OFF);
+
 // more I/O helper macros
 #define rbuf_ctrl_get()			sys_readl(SYS_RBUF_FLUSH_CTRL)
 #define rbuf_ctrl_set(val)		sys_writel(val, SYS_RBUF_FLUSH_CTRL)
@@ -581,7 +646,11 @@ CBcm54213Device::CBcm54213Device (void)
 :	m_pTimer (CTimer::Get ()),
 	m_bInterruptConnected (FALSE),
 	m_tx_cbs (0),
-	m_rx_cbs (0)
+	m_rx_cbs (0),
+	m_hfb_filters (0),
+	m_mc_count (0),
+	m_mtu (NET_MTU_DEFAULT),
+	m_TxDoneRing (TOTAL_DESC)
 {
 	assert (m_pTimer != 0);
 }
@@ -607,6 +676,16 @@ CBcm54213Device::~CBcm54213Device (void)
 		free_rx_buffers ();
 	}
 
+	if (m_tx_cbs != 0)
+	{
+		for (unsigned i = 0; i < TOTAL_DESC; i++)
+		{
+			free_tx_cb (&m_tx_cbs[i]);
+		}
+
+		release_tx_buffers ();
+	}
+
 	delete [] m_tx_cbs;
 	delete [] m_rx_cbs;
 }
@@ -700,37 +779,33 @@ const CMACAddress *CBcm54213Device::GetMACAddress (void) const
 
 boolean CBcm54213Device::IsSendFrameAdvisable (void)
 {
-	unsigned index = TX_RING_INDEX;			// see SendFrame() for mapping strategy
-	if (index == 0)
-		index = GENET_DESC_INDEX;
-	else
-		index -= 1;
+	TGEnetTxRing *ring = get_tx_ring ();
 							// is there room for a frame?
-	return m_tx_rings[index].free_bds >= 2;		// atomic read
+	if (ring->free_bds >= 2)			// atomic read
+	{
+		return TRUE;
+	}
+
+	m_TxSpinLock.Acquire ();
+
+	boolean bResult = tx_has_room (ring);
+
+	m_TxSpinLock.Release ();
+
+	return bResult;
 }
 
 boolean CBcm54213Device::SendFrame (const void *pBuffer, unsigned nLength)
 {
 	assert (pBuffer != 0);
 	assert (nLength > 0);
+	assert (nLength <= FRAME_BUFFER_SIZE);
 
-	// Mapping strategy:
-	// index = 0, unclassified, packet xmited through ring16
-	// index = 1, goes to ring 0. (highest priority queue)
-	// index = 2, goes to ring 1.
-	// index = 3, goes to ring 2.
-	// index = 4, goes to ring 3.
-	unsigned index = TX_RING_INDEX;
-	if (index == 0)
-		index = GENET_DESC_INDEX;
-	else
-		index -= 1;
-
-	TGEnetTxRing *ring = &m_tx_rings[index];
+	TGEnetTxRing *ring = get_tx_ring ();
 
 	m_TxSpinLock.Acquire ();
 
-	if (ring->free_bds < 2)				// is there room for this frame?
+	if (!tx_has_room (ring))			// is there room for this frame?
 	{
 		CLogger::Get ()->Write (FromBcm54213, LogWarning, "TX frame dropped");
 
@@ -739,38 +814,102 @@ boolean CBcm54213Device::SendFrame (const void *pBuffer, unsigned nLength)
 		return FALSE;
 	}
 
-	u8 *pTxBuffer = new u8[ENET_MAX_MTU_SIZE];	// allocate and fill DMA buffer
-	memcpy (pTxBuffer, pBuffer, nLength);
+	u8 *pTxBuffer = new u8[TSB_SIZE+FRAME_BUFFER_SIZE];	// allocate and fill DMA buffer
+	memset (pTxBuffer, 0, TSB_SIZE);		// no checksum offload
+	u8 *pFrame = pTxBuffer + TSB_SIZE;
+	memcpy (pFrame, pBuffer, nLength);
 	if (nLength < ETH_ZLEN)				// pad frame if necessary
 	{
-		memset (pTxBuffer+nLength, 0, ETH_ZLEN-nLength);
+		memset (pFrame+nLength, 0, ETH_ZLEN-nLength);
 		nLength = ETH_ZLEN;
 	}
 
-	TGEnetCB *tx_cb_ptr = get_txcb (ring);		// get Tx control block from ring
-	assert (tx_cb_ptr != 0);
+	tx_submit (ring, pTxBuffer, 0, TSB_SIZE+nLength, 0);
 
-	// prepare for DMA
-	CleanAndInvalidateDataCacheRange ((u32) (uintptr) pTxBuffer, nLength);
+	// packet is ready, update producer index
+	tdma_ring_writel (ring->index, ring->prod_index, TDMA_PROD_INDEX);
 
-	tx_cb_ptr->buffer = pTxBuffer;			// set DMA buffer in Tx control block
+	m_TxSpinLock.Release ();
 
-	// set DMA descriptor and start transfer
-	dmadesc_set (tx_cb_ptr->bd_addr, pTxBuffer,   (nLength << DMA_BUFLENGTH_SHIFT)
-						    | (QTAG_MASK << DMA_TX_QTAG_SHIFT)
-						    | DMA_TX_APPEND_CRC | DMA_SOP | DMA_EOP);
+	return TRUE;
+}
 
-	// decrement total BD count and advance our write pointer
-	ring->free_bds--;
-	ring->prod_index++;
-	ring->prod_index &= DMA_P_INDEX_MASK;
+boolean CBcm54213Device::SendBuffer (CNetBuffer *pBuffer)
+{
+	return SendFrames (&pBuffer, 1) == 1;
+}
+
+unsigned CBcm54213Device::SendFrames (CNetBuffer *ppBuffer[], unsigned nCount)
+{
+	assert (ppBuffer != 0);
+
+	release_tx_buffers ();				// from previously transmitted frames
+
+	TGEnetTxRing *ring = get_tx_ring ();
+
+	m_TxSpinLock.Acquire ();
+
+	unsigned i;
+	for (i = 0; i < nCount; i++)
+	{
+		if (!tx_has_room (ring))		// is there room for this frame?
+		{
+			CLogger::Get ()->Write (FromBcm54213, LogWarning, "TX frame dropped");
+
+			break;
+		}
+
+		CNetBuffer *pBuffer = ppBuffer[i];
+		assert (pBuffer != 0);
+
+		u8 *pFrame = pBuffer->GetData ();
+		assert (((uintptr) pFrame & (DATA_CACHE_LINE_LENGTH_MAX-1)) == 0);
+
+		unsigned nLength = pBuffer->GetLength ();
+		assert (nLength > 0);
+		if (nLength < ETH_ZLEN)			// pad frame in place if necessary
+		{
+			assert (pBuffer->GetMaxLength () >= ETH_ZLEN);
+			memset (pFrame+nLength, 0, ETH_ZLEN-nLength);
+			nLength = ETH_ZLEN;
+		}
+
+		// the TSB is built in the headroom of the net buffer
+		assert (pBuffer->GetHeadroom () >= TSB_SIZE);
+		u8 *pTxBuffer = pFrame - TSB_SIZE;
+		memset (pTxBuffer, 0, TSB_SIZE);
+
+		u32 dma_flags = 0;
+		if (pBuffer->GetOffloadFlags () & NET_OFFLOAD_TX_CHECKSUM)
+		{
+			unsigned nStart = pBuffer->GetChecksumStart ();
+			u32 tx_csum_info =   (nStart << STATUS_TX_CSUM_START_SHIFT)
+					   | (nStart + pBuffer->GetChecksumOffset ())
+					   | STATUS_TX_CSUM_LV;
+			if (pFrame[ETH_HLEN + IP_PROTOCOL_OFFSET] == IP_PROTOCOL_UDP)
+			{
+				tx_csum_info |= STATUS_TX_CSUM_PROTO_UDP;
+			}
+
+			*(u32 *) (pTxBuffer + TSB_TX_CSUM_INFO) = tx_csum_info;
+
+			dma_flags = DMA_TX_DO_CSUM;
+		}
 
-	// packets are ready, update producer index
-	tdma_ring_writel(ring->index, ring->prod_index, TDMA_PROD_INDEX);
+		pBuffer->AddRef ();			// released, when the frame has been sent
+
+		tx_submit (ring, pTxBuffer, pBuffer, TSB_SIZE+nLength, dma_flags);
+	}
+
+	if (i > 0)
+	{
+		// packets are ready, update producer index once for all of them
+		tdma_ring_writel (ring->index, ring->prod_index, TDMA_PROD_INDEX);
+	}
 
 	m_TxSpinLock.Release ();
 
-	return TRUE;
+	return i;
 }
 
 boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
@@ -778,7 +917,59 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 	assert (pBuffer != 0);
 	assert (pResultLength != 0);
 
-	TGEnetRxRing *ring = &m_rx_rings[GENET_DESC_INDEX];	// the only supported Rx queue
+	CNetBuffer *pNetBuffer = ReceiveNetBuffer ();
+	if (pNetBuffer == 0)
+	{
+		return FALSE;
+	}
+
+	unsigned nLength = pNetBuffer->GetLength ();
+	assert (nLength <= FRAME_BUFFER_SIZE);
+	memcpy (pBuffer, pNetBuffer->GetData (), nLength);
+
+	*pResultLength = nLength;
+
+	pNetBuffer->Release ();
+
+	return TRUE;
+}
+
+CNetBuffer *CBcm54213Device::ReceiveNetBuffer (void)
+{
+	CNetBuffer *pBuffer;
+	if (ReceiveFrames (&pBuffer, 1) == 0)
+	{
+		return 0;
+	}
+
+	return pBuffer;
+}
+
+unsigned CBcm54213Device::ReceiveFrames (CNetBuffer *ppBuffer[], unsigned nMaxCount)
+{
+	assert (ppBuffer != 0);
+
+	// the priority queues are served first
+	unsigned nCount = 0;
+	for (unsigned i = 0; i < RX_QUEUES && nCount < nMaxCount; i++)
+	{
+		nCount += rx_poll (&m_rx_rings[i], ppBuffer + nCount, nMaxCount - nCount);
+	}
+
+	if (nCount < nMaxCount)
+	{
+		nCount += rx_poll (&m_rx_rings[GENET_DESC_INDEX], ppBuffer + nCount,
+				   nMaxCount - nCount);
+	}
+
+	return nCount;
+}
+
+// returns the number of received net buffers, which are replaced with new ones on the ring
+unsigned CBcm54213Device::rx_poll (TGEnetRxRing *ring, CNetBuffer *ppBuffer[], unsigned nMaxCount)
+{
+	assert (ring != 0);
+	assert (ppBuffer != 0);
 
 	// clear status before servicing to reduce spurious interrupts
 	// NOTE: Rx interrupts are not used
@@ -803,10 +994,20 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 
 	p_index &= DMA_P_INDEX_MASK;
 
-	boolean bResult = FALSE;
+	unsigned nCount = 0;
 
 	unsigned rxpkttoprocess = (p_index - ring->c_index) & DMA_C_INDEX_MASK;
-	if (rxpkttoprocess > 0)
+	if (rxpkttoprocess == 0)
+	{
+		return 0;
+	}
+
+	if (rxpkttoprocess > nMaxCount)
+	{
+		rxpkttoprocess = nMaxCount;
+	}
+
+	for (unsigned i = 0; i < rxpkttoprocess; i++)
 	{
 		u32 dma_length_status;
 		u32 dma_flag;
@@ -814,7 +1015,7 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 
 		TGEnetCB *cb = &m_rx_cbs[ring->read_ptr];
 
-		u8 *pRxBuffer = rx_refill (cb);
+		CNetBuffer *pRxBuffer = rx_refill (cb);
 		if (pRxBuffer == 0)
 		{
 			CLogger::Get ()->Write (FromBcm54213, LogWarning, "Missing RX buffer!");
@@ -832,7 +1033,7 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 			CLogger::Get ()->Write (FromBcm54213, LogWarning,
 						"Dropping fragmented RX packet!");
 
-			delete [] pRxBuffer;
+			pRxBuffer->Release ();
 
 			goto out;
 		}
@@ -843,29 +1044,25 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 			CLogger::Get ()->Write (FromBcm54213, LogWarning, "RX error (0x%x)",
 						(unsigned) dma_flag);
 
-			delete [] pRxBuffer;
+			pRxBuffer->Release ();
 
 			goto out;
 		}
 
 #define LEADING_PAD	2
-		nLength -= LEADING_PAD;		// remove HW 2 bytes added for IP alignment
-
 		if (m_crc_fwd_en)
 		{
 			nLength -= ETH_FCS_LEN;
 		}
 
+		assert (nLength > LEADING_PAD);
+		assert (nLength <= RX_BUF_LENGTH);
+		pRxBuffer->SetLength (nLength);
 
-		assert (nLength > 0);
-		assert (nLength <= FRAME_BUFFER_SIZE);
-		memcpy (pBuffer, pRxBuffer+LEADING_PAD, nLength);
+		pRxBuffer->RemoveHeader (LEADING_PAD);	// remove HW 2 bytes added for IP alignment
+		assert (pRxBuffer->GetLength () <= FRAME_BUFFER_SIZE);
 
-		*pResultLength = nLength;
-
-		delete [] pRxBuffer;
-
-		bResult = TRUE;
+		ppBuffer[nCount++] = pRxBuffer;
 
 out:
 		if (ring->read_ptr < ring->end_ptr)
@@ -878,10 +1075,12 @@ out:
 		}
 
 		ring->c_index = (ring->c_index + 1) & DMA_C_INDEX_MASK;
-		rdma_ring_writel (ring->index, ring->c_index, RDMA_CONS_INDEX);
 	}
 
-	return bResult;
+	// return the processed descriptors to the HW at once
+	rdma_ring_writel (ring->index, ring->c_index, RDMA_CONS_INDEX);
+
+	return nCount;
 }
 
 boolean CBcm54213Device::IsLinkUp (void)
@@ -957,7 +1156,7 @@ void CBcm54213Device::init_umac(void)
 	umac_writel(MIB_RESET_RX | MIB_RESET_TX | MIB_RESET_RUNT, UMAC_MIB_CTRL);
 	umac_writel(0, UMAC_MIB_CTRL);
 
-	umac_writel(ENET_MAX_MTU_SIZE, UMAC_MAX_FRAME_LEN);
+	umac_writel(ENET_MAX_FRAME_LEN(m_mtu), UMAC_MAX_FRAME_LEN);
 
 	// init rx registers, enable ip header optimization
 	u32 reg = rbuf_readl(RBUF_CTRL);
@@ -966,6 +1165,11 @@ void CBcm54213Device::init_umac(void)
 
 	rbuf_writel(1, RBUF_TBUF_SIZE_CTRL);
 
+	// each Tx frame is preceded by a TSB, which allows checksum offload
+	reg = tbuf_readl(TBUF_CTRL);
+	reg |= RBUF_64B_EN;
+	tbuf_writel(reg, TBUF_CTRL);
+
 	intr_disable();
 
 	// Enable MDIO interrupts on GENET v3+
@@ -1012,7 +1216,14 @@ void CBcm54213Device::enable_tx_intr(void)
 
 void CBcm54213Device::enable_rx_intr(void)
 {
-	TGEnetRxRing *ring = &m_rx_rings[GENET_DESC_INDEX];
+	TGEnetRxRing *ring;
+	for (unsigned i = 0; i < RX_QUEUES; ++i)
+	{
+		ring = &m_rx_rings[i];
+		ring->int_enable(ring);
+	}
+
+	ring = &m_rx_rings[GENET_DESC_INDEX];
 	ring->int_enable(ring);
 }
 
@@ -1036,11 +1247,16 @@ void CBcm54213Device::rx_ring16_int_enable(TGEnetRxRing *ring)
 	intrl2_0_writel(UMAC_IRQ_RXDMA_DONE, INTRL2_CPU_MASK_CLEAR);
 }
 
+void CBcm54213Device::rx_ring_int_enable(TGEnetRxRing *ring)
+{
+	intrl2_1_writel(1 << (UMAC_IRQ1_RX_INTR_SHIFT + ring->index), INTRL2_CPU_MASK_CLEAR);
+}
+
 int CBcm54213Device::set_hw_addr(void)
 {
 	CBcmPropertyTags Tags;
 	TPropertyTagMACAddress MACAddress;
-	if (!Tags.GetTag (PROPTAG_GET_MAC_ADDRESS, &MACAddress, sizeof MACAddress))
+	if (!Tags.GetTagCached (PROPTAG_GET_MAC_ADDRESS, &MACAddress, sizeof MACAddress))
 	{
 		return -1;
 	}
@@ -1063,6 +1279,7 @@ int CBcm54213Device::set_hw_addr(void)
 }
 
 #define MAX_MC_COUNT	16
+#define GENET_MC_PROMISC	((unsigned) -1)
 
 void CBcm54213Device::set_mdf_addr(unsigned char *addr, int *i, int *mc)
 {
@@ -1083,12 +1300,23 @@ void CBcm54213Device::set_mdf_addr(unsigned char *addr, int *i, int *mc)
 
 void CBcm54213Device::set_rx_mode(void)
 {
-	// Promiscuous mode off
+	// Promiscuous mode, if the multicast list does not fit into the MDF filter
 	u32 reg = umac_readl(UMAC_CMD);
+	if (m_mc_count == GENET_MC_PROMISC)
+	{
+		reg |= CMD_PROMISC;
+		umac_writel(reg, UMAC_CMD);
+		umac_writel(0, UMAC_MDF_CTRL);
+
+		return;
+	}
+
 	reg &= ~CMD_PROMISC;
 	umac_writel(reg, UMAC_CMD);
 
 	// update MDF filter
+	umac_writel(0, UMAC_MDF_CTRL);
+
 	int i = 0;
 	int mc = 0;
 
@@ -1103,6 +1331,55 @@ void CBcm54213Device::set_rx_mode(void)
 	// my own address
 	m_MACAddress.CopyTo(Buffer);
 	set_mdf_addr(Buffer, &i, &mc);
+
+	// multicast addresses
+	for (unsigned n = 0; n < m_mc_count; n++)
+	{
+		m_mc_list[n].CopyTo(Buffer);
+		set_mdf_addr(Buffer, &i, &mc);
+	}
+}
+
+boolean CBcm54213Device::SetMTU (unsigned nMTU)
+{
+	if (nMTU > NET_MTU_MAX)
+	{
+		return FALSE;
+	}
+
+	m_mtu = nMTU;
+	umac_writel(ENET_MAX_FRAME_LEN(m_mtu), UMAC_MAX_FRAME_LEN);
+
+	return TRUE;
+}
+
+unsigned CBcm54213Device::GetOffloadCapabilities (void)
+{
+	return NET_OFFLOAD_TX_CHECKSUM;
+}
+
+boolean CBcm54213Device::SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount)
+{
+	// broadcast and own address occupy two of the MDF filter entries
+	if (nCount > MAX_MC_COUNT+1-2)
+	{
+		m_mc_count = GENET_MC_PROMISC;
+	}
+	else
+	{
+		assert (nCount <= MAX_MULTICAST_ADDRESSES);
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			assert (pAddresses != 0);
+			m_mc_list[i].Set (pAddresses[i].Get ());
+		}
+
+		m_mc_count = nCount;
+	}
+
+	set_rx_mode();
+
+	return TRUE;
 }
 
 // clear Hardware Filter Block and disable all filtering
@@ -1121,6 +1398,92 @@ void CBcm54213Device::hfb_init(void)
 
 	for (i = 0; i < HFB_FILTER_CNT * HFB_FILTER_SIZE; i++)
 		hfb_writel(0, i * sizeof(u32));
+
+	m_hfb_filters = 0;
+}
+
+// insert pattern and mask into the HW filter, starting at offset 0 of the frame
+void CBcm54213Device::hfb_insert_data(unsigned f_index, const u8 *data, const u8 *mask,
+				      unsigned size)
+{
+	// each filter word holds two bytes (bits 15-0) and their nibble enables (bits 19-16)
+	for (unsigned i = 0; i < size; i++) {
+		unsigned index = f_index * HFB_FILTER_SIZE + i / 2;
+		u32 tmp = hfb_readl(index * sizeof(u32));
+
+		u32 nibbles = (mask[i] & 0xF0 ? 2 : 0) | (mask[i] & 0x0F ? 1 : 0);
+		if (i & 1) {
+			tmp &= ~0x300FF;
+			tmp |= data[i] | (nibbles << 16);
+		} else {
+			tmp &= ~0xCFF00;
+			tmp |= (data[i] << 8) | (nibbles << 18);
+		}
+
+		hfb_writel(tmp, index * sizeof(u32));
+	}
+}
+
+void CBcm54213Device::hfb_set_filter_length(unsigned f_index, unsigned f_length)
+{
+	u32 reg_index = HFB_FLT_LEN_V3PLUS + (HFB_FILTER_CNT - 1 - f_index) / 4 * sizeof(u32);
+	u32 reg = hfb_reg_readl(reg_index);
+	reg &= ~(0xFF << (8 * (f_index % 4)));
+	reg |= f_length << (8 * (f_index % 4));
+	hfb_reg_writel(reg, reg_index);
+}
+
+void CBcm54213Device::hfb_set_filter_rx_queue_mapping(unsigned f_index, unsigned rx_queue)
+{
+	u32 reg = rdma_readl(DMA_INDEX2RING_0 + f_index / 8);
+	unsigned shift = (f_index % 8) * 4;
+	reg &= ~(0xF << shift);
+	reg |= (rx_queue & 0xF) << shift;
+	rdma_writel(reg, DMA_INDEX2RING_0 + f_index / 8);
+}
+
+void CBcm54213Device::hfb_enable_filter(unsigned f_index)
+{
+	u32 offset = HFB_FLT_ENABLE_V3PLUS + (f_index < 32) * sizeof(u32);
+	u32 reg = hfb_reg_readl(offset);
+	reg |= 1 << (f_index % 32);
+	hfb_reg_writel(reg, offset);
+
+	reg = hfb_reg_readl(HFB_CTRL);
+	reg |= RBUF_HFB_EN;
+	hfb_reg_writel(reg, HFB_CTRL);
+}
+
+int CBcm54213Device::AddRxFilter (unsigned nQueue, const u8 *pPattern, const u8 *pMask,
+				  unsigned nLength)
+{
+	if (   nQueue >= RX_QUEUES
+	    || nLength == 0
+	    || nLength > HFB_FILTER_MAX_LENGTH
+	    || m_hfb_filters >= HFB_FILTER_CNT)
+	{
+		return -1;
+	}
+
+	assert (pPattern != 0);
+	assert (pMask != 0);
+	for (unsigned i = 0; i < nLength; i++)
+	{
+		if (   pMask[i] != 0x00 && pMask[i] != 0x0F
+		    && pMask[i] != 0xF0 && pMask[i] != 0xFF)
+		{
+			return -1;
+		}
+	}
+
+	unsigned nFilter = m_hfb_filters++;
+
+	hfb_insert_data (nFilter, pPattern, pMask, nLength);
+	hfb_set_filter_length (nFilter, (nLength + 1) & ~1);	// in bytes, but whole words
+	hfb_set_filter_rx_queue_mapping (nFilter, nQueue);
+	hfb_enable_filter (nFilter);
+
+	return nFilter;
 }
 
 // Start the network engine
@@ -1132,7 +1495,9 @@ void CBcm54213Device::netif_start(void)
 
 	enable_tx_intr();
 
-	//link_intr_enable();		// NOTE: link interrupts do not work, must be polled
+	// NOTE: The link interrupts are not generated with the external PHY on the
+	//	 Raspberry Pi 4, which must be polled. They are handled, if they come.
+	link_intr_enable();
 }
 
 // Initialize DMA control register
@@ -1227,13 +1592,14 @@ void CBcm54213Device::enable_dma(u32 dma_ctrl)
 
 // Initialize or reset Tx queues
 //
-// Queues 0-3 are priority-based, each one has 32 descriptors,
-// with queue 0 being the highest priority queue.
+// Queues 0 to TX_QUEUES-1 are priority-based, each one has TX_BDS_PER_Q
+// descriptors, with queue 0 being the highest priority queue.
 //
 // Queue 16 is the default Tx queue with
-// GENET_Q16_TX_BD_CNT = 256 - 4 * 32 = 128 descriptors.
+// GENET_Q16_TX_BD_CNT = 256 - TX_QUEUES * TX_BDS_PER_Q descriptors.
 //
-// The transmit control block pool is then partitioned as follows:
+// With the default configuration the transmit control block pool is
+// partitioned as follows:
 // - Tx queue 0 uses m_tx_cbs[0..31]
 // - Tx queue 1 uses m_tx_cbs[32..63]
 // - Tx queue 2 uses m_tx_cbs[64..95]
@@ -1329,10 +1695,10 @@ void CBcm54213Device::init_tx_ring(unsigned index, unsigned size,
 
 	tdma_ring_writel(index, 0, TDMA_PROD_INDEX);
 	tdma_ring_writel(index, 0, TDMA_CONS_INDEX);
-	tdma_ring_writel(index, 10, DMA_MBUF_DONE_THRESH);
+	tdma_ring_writel(index, GENET_TX_COALESCE_FRAMES, DMA_MBUF_DONE_THRESH);
 	// Disable rate control for now
 	tdma_ring_writel(index, flow_period_val, TDMA_FLOW_PERIOD);
-	tdma_ring_writel(index, ((size << DMA_RING_SIZE_SHIFT) | RX_BUF_LENGTH), DMA_RING_BUF_SIZE);
+	tdma_ring_writel(index, ((size << DMA_RING_SIZE_SHIFT) | TX_BUF_LENGTH), DMA_RING_BUF_SIZE);
 
 	// Set start and end address, read and write pointers
 	tdma_ring_writel(index, start_ptr * WORDS_PER_BD, DMA_START_ADDR);
@@ -1384,8 +1750,78 @@ unsigned CBcm54213Device::tx_reclaim(TGEnetTxRing *ring)
 	return txbds_processed;
 }
 
+// Mapping strategy:
+// index = 0, unclassified, packet xmited through ring16
+// index = 1, goes to ring 0. (highest priority queue)
+// index = 2, goes to ring 1.
+// index = 3, goes to ring 2.
+// index = 4, goes to ring 3.
+TGEnetTxRing *CBcm54213Device::get_tx_ring(void)
+{
+	unsigned index = TX_RING_INDEX;
+	if (index == 0)
+		index = GENET_DESC_INDEX;
+	else
+		index -= 1;
+
+	return &m_tx_rings[index];
+}
+
+// must be called with m_TxSpinLock acquired
+boolean CBcm54213Device::tx_has_room(TGEnetTxRing *ring)
+{
+	if (ring->free_bds >= 2)
+		return TRUE;
+
+	// the Tx interrupt is coalesced, reclaim transmitted frames now
+	tx_reclaim(ring);
+
+	return ring->free_bds >= 2;
+}
+
+// must be called with m_TxSpinLock acquired and room on the ring,
+// the caller has to update the producer index afterwards
+void CBcm54213Device::tx_submit(TGEnetTxRing *ring, u8 *buffer, CNetBuffer *net_buffer,
+				unsigned length, u32 dma_flags)
+{
+	TGEnetCB *tx_cb_ptr = get_txcb(ring);		// get Tx control block from ring
+	assert(tx_cb_ptr != 0);
+
+	// prepare for DMA
+	CleanDataCacheRange((u32) (uintptr) buffer, length);
+
+	tx_cb_ptr->buffer = buffer;			// set DMA buffer in Tx control block
+	tx_cb_ptr->net_buffer = net_buffer;
+
+	// set DMA descriptor and start transfer
+	assert(length <= DMA_BUFLENGTH_MASK);
+	dmadesc_set(tx_cb_ptr->bd_addr, buffer,   (length << DMA_BUFLENGTH_SHIFT)
+						| (QTAG_MASK << DMA_TX_QTAG_SHIFT)
+						| DMA_TX_APPEND_CRC | DMA_SOP | DMA_EOP
+						| dma_flags);
+
+	// decrement total BD count and advance our write pointer
+	ring->free_bds--;
+	ring->prod_index++;
+	ring->prod_index &= DMA_P_INDEX_MASK;
+}
+
+// may be called from interrupt context
 void CBcm54213Device::free_tx_cb(TGEnetCB *cb)
 {
+	CNetBuffer *net_buffer = cb->net_buffer;
+	if (net_buffer) {
+		cb->net_buffer = 0;
+		cb->buffer = 0;
+
+		// released by release_tx_buffers(), the ring cannot overflow,
+		// because it has an entry for each descriptor
+		if (!m_TxDoneRing.Write(net_buffer))
+			assert (0);
+
+		return;
+	}
+
 	u8 *buffer = cb->buffer;
 	if (buffer) {
 		cb->buffer = 0;
@@ -1394,8 +1830,17 @@ void CBcm54213Device::free_tx_cb(TGEnetCB *cb)
 	}
 }
 
-// Initialize Rx queue
-// Queue 0-15 are not available
+void CBcm54213Device::release_tx_buffers(void)
+{
+	CNetBuffer *net_buffer;
+	while (m_TxDoneRing.Read(&net_buffer))
+		net_buffer->Release();
+}
+
+// Initialize Rx queues
+// Queues 0 to RX_QUEUES-1 are priority-based, each one has RX_BDS_PER_Q
+// descriptors. Frames are directed to them by the HW filter block only
+// (see AddRxFilter()).
 // Queue 16 is the default Rx queue with GENET_Q16_RX_BD_CNT descriptors.
 int CBcm54213Device::init_rx_queues(void)
 {
@@ -1407,9 +1852,21 @@ int CBcm54213Device::init_rx_queues(void)
 	dma_ctrl = 0;
 	u32 ring_cfg = 0;
 
+	int ret;
+
+	// Initialize Rx priority queues
+	for (unsigned i = 0; i < RX_QUEUES; i++) {
+		ret = init_rx_ring(i, RX_BDS_PER_Q, i * RX_BDS_PER_Q, (i + 1) * RX_BDS_PER_Q);
+		if (ret)
+			return ret;
+
+		ring_cfg |= (1 << i);
+		dma_ctrl |= (1 << (i + DMA_RING_BUF_EN_SHIFT));
+	}
+
 	// Initialize Rx default queue 16
-	int ret = init_rx_ring(GENET_DESC_INDEX, GENET_Q16_RX_BD_CNT,
-			       RX_QUEUES * RX_BDS_PER_Q, TOTAL_DESC);
+	ret = init_rx_ring(GENET_DESC_INDEX, GENET_Q16_RX_BD_CNT,
+			   RX_QUEUES * RX_BDS_PER_Q, TOTAL_DESC);
 	if (ret)
 		return ret;
 
@@ -1434,9 +1891,10 @@ int CBcm54213Device::init_rx_ring(unsigned index, unsigned size,
 	TGEnetRxRing *ring = &m_rx_rings[index];
 
 	ring->index = index;
-
-	assert (index == GENET_DESC_INDEX);
-	ring->int_enable = rx_ring16_int_enable;
+	if (index == GENET_DESC_INDEX)
+		ring->int_enable = rx_ring16_int_enable;
+	else
+		ring->int_enable = rx_ring_int_enable;
 
 	ring->cbs = m_rx_cbs + start_ptr;
 	ring->size = size;
@@ -1484,40 +1942,49 @@ void CBcm54213Device::free_rx_buffers(void)
 	for (unsigned i = 0; i < TOTAL_DESC; i++)
 	{
 		TGEnetCB *cb = &m_rx_cbs[i];
-		u8 *buffer = free_rx_cb(cb);
-		delete [] buffer;
+		CNetBuffer *net_buffer = free_rx_cb(cb);
+		if (net_buffer)
+			net_buffer->Release();
 	}
 }
 
-u8 *CBcm54213Device::rx_refill(struct TGEnetCB *cb)
+CNetBuffer *CBcm54213Device::rx_refill(struct TGEnetCB *cb)
 {
-	// Allocate a new Rx DMA buffer
-	u8 *buffer = new u8[RX_BUF_LENGTH];
-	if (!buffer)
+	// Allocate a new Rx net buffer, the DMA writes into its data
+	CNetBuffer *net_buffer = new CNetBuffer;
+	if (!net_buffer)
 		return 0;
 
+	u8 *buffer = net_buffer->GetData();
+	assert (((uintptr) buffer & (DATA_CACHE_LINE_LENGTH_MAX-1)) == 0);
+	assert (net_buffer->GetMaxLength() >= RX_BUF_LENGTH);
+
 	// prepare buffer for DMA
-	CleanAndInvalidateDataCacheRange ((u32) (uintptr) buffer, RX_BUF_LENGTH);
+	InvalidateDataCacheRange ((u32) (uintptr) buffer, RX_BUF_LENGTH);
 
 	// Grab the current Rx buffer from the ring and DMA-unmap it
-	u8 *rx_buffer = free_rx_cb(cb);
+	CNetBuffer *rx_buffer = free_rx_cb(cb);
 
 	// Put the new Rx buffer on the ring
 	cb->buffer = buffer;
+	cb->net_buffer = net_buffer;
 	dmadesc_set_addr(cb->bd_addr, buffer);
 
 	// Return the current Rx buffer to caller
 	return rx_buffer;
 }
 
-u8 *CBcm54213Device::free_rx_cb(TGEnetCB *cb)
+CNetBuffer *CBcm54213Device::free_rx_cb(TGEnetCB *cb)
 {
-	u8 *buffer = cb->buffer;
-	cb->buffer = 0;
+	CNetBuffer *net_buffer = cb->net_buffer;
+	if (net_buffer) {
+		InvalidateDataCacheRange ((u32) (uintptr) cb->buffer, RX_BUF_LENGTH);
 
-	CleanAndInvalidateDataCacheRange ((u32) (uintptr) buffer, RX_BUF_LENGTH);
+		cb->net_buffer = 0;
+		cb->buffer = 0;
+	}
 
-	return buffer;
+	return net_buffer;
 }
 
 // Combined address + length/status setter
@@ -1559,6 +2026,9 @@ void CBcm54213Device::InterruptHandler0 (void)
 	// clear interrupts
 	intrl2_0_writel(status, INTRL2_CPU_CLEAR);
 
+	if (status & UMAC_IRQ_LINK_EVENT)
+		NotifyLinkChange ();
+
 	if (status & UMAC_IRQ_TXDMA_DONE) {
 		m_TxSpinLock.Acquire ();
 
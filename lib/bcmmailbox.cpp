@@ -2,7 +2,7 @@
 // bcmmailbox.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -25,6 +25,11 @@
 
 CSpinLock CBcmMailBox::s_SpinLock (TASK_LEVEL);
 
+boolean CBcmMailBox::s_bAsyncPending = FALSE;
+boolean CBcmMailBox::s_bAsyncDone = FALSE;
+unsigned CBcmMailBox::s_nAsyncChannel;
+u32 CBcmMailBox::s_nAsyncResult;
+
 CBcmMailBox::CBcmMailBox (unsigned nChannel, boolean bEarlyUse)
 :	m_nChannel (nChannel),
 	m_bEarlyUse (bEarlyUse)
@@ -44,11 +49,19 @@ u32 CBcmMailBox::WriteRead (u32 nData)
 		s_SpinLock.Acquire ();
 	}
 
+	if (   s_bAsyncPending
+	    && !s_bAsyncDone)
+	{
+		// fetch the pending response first, it would be flushed otherwise
+		s_nAsyncResult = Read (s_nAsyncChannel);
+		s_bAsyncDone = TRUE;
+	}
+
 	Flush ();
 
 	Write (nData);
 
-	u32 nResult = Read ();
+	u32 nResult = Read (m_nChannel);
 
 	if (!m_bEarlyUse)
 	{
@@ -60,6 +73,78 @@ u32 CBcmMailBox::WriteRead (u32 nData)
 	return nResult;
 }
 
+boolean CBcmMailBox::WriteAsync (u32 nData)
+{
+	assert (!m_bEarlyUse);
+
+	PeripheralEntry ();
+
+	s_SpinLock.Acquire ();
+
+	if (s_bAsyncPending)
+	{
+		s_SpinLock.Release ();
+
+		PeripheralExit ();
+
+		return FALSE;
+	}
+
+	Flush ();
+
+	Write (nData);
+
+	s_nAsyncChannel = m_nChannel;
+	s_bAsyncDone = FALSE;
+	s_bAsyncPending = TRUE;
+
+	s_SpinLock.Release ();
+
+	PeripheralExit ();
+
+	return TRUE;
+}
+
+boolean CBcmMailBox::PollRead (u32 *pResult)
+{
+	assert (!m_bEarlyUse);
+	assert (pResult != 0);
+
+	PeripheralEntry ();
+
+	s_SpinLock.Acquire ();
+
+	assert (s_bAsyncPending);
+	assert (s_nAsyncChannel == m_nChannel);
+
+	if (!s_bAsyncDone)
+	{
+		if (!(read32 (MAILBOX0_STATUS) & MAILBOX_STATUS_EMPTY))
+		{
+			u32 nResult = read32 (MAILBOX0_READ);
+			if ((nResult & 0xF) == m_nChannel)	// ignore other channels
+			{
+				s_nAsyncResult = nResult & ~0xF;
+				s_bAsyncDone = TRUE;
+			}
+		}
+	}
+
+	boolean bDone = s_bAsyncDone;
+	if (bDone)
+	{
+		*pResult = s_nAsyncResult;
+
+		s_bAsyncPending = FALSE;
+	}
+
+	s_SpinLock.Release ();
+
+	PeripheralExit ();
+
+	return bDone;
+}
+
 void CBcmMailBox::Flush (void)
 {
 	while (!(read32 (MAILBOX0_STATUS) & MAILBOX_STATUS_EMPTY))
@@ -70,7 +155,7 @@ void CBcmMailBox::Flush (void)
 	}
 }
 
-u32 CBcmMailBox::Read (void)
+u32 CBcmMailBox::Read (unsigned nChannel)
 {
 	u32 nResult;
 	
@@ -83,7 +168,7 @@ u32 CBcmMailBox::Read (void)
 		
 		nResult = read32 (MAILBOX0_READ);
 	}
-	while ((nResult & 0xF) != m_nChannel);		// channel number is in the lower 4 bits
+	while ((nResult & 0xF) != nChannel);		// channel number is in the lower 4 bits
 
 	return nResult & ~0xF;
 }
@@ -7,7 +7,7 @@
 //	Licensed under GPL-2.0
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2019-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2019-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -291,6 +291,13 @@ boolean CBcmPCIeHostBridge::EnableDevice (u32 nClassCode, unsigned nSlot, unsign
 	return !enable_device (nClassCode, nSlot, nFunc);
 }
 
+unsigned CBcmPCIeHostBridge::EnableMSI (unsigned nSlot, unsigned nFunc, unsigned nMaxVectors)
+{
+	int ret = enable_device_msi (nSlot, nFunc, nMaxVectors);
+
+	return ret > 0 ? ret : 0;
+}
+
 boolean CBcmPCIeHostBridge::ConnectMSI (TPCIeMSIHandler *pHandler, void *pParam)
 {
 	return !pcie_enable_msi (pHandler, pParam);
@@ -550,21 +557,6 @@ int CBcmPCIeHostBridge::enable_device (u32 nClassCode, unsigned nSlot, unsigned
 					    | PCI_BASE_ADDRESS_MEM_TYPE_64);
 	write32 (conf + PCI_BASE_ADDRESS_1, upper_32_bits (MEM_PCIE_RANGE_PCIE_START));
 
-#if 0
-	uintptr msi_conf = find_pci_capability (conf, PCI_CAP_ID_MSI);
-	if (!msi_conf)
-		return -1;
-
-	write32 (msi_conf + PCI_MSI_ADDRESS_LO, lower_32_bits (m_msi_target_addr));
-	write32 (msi_conf + PCI_MSI_ADDRESS_HI, upper_32_bits (m_msi_target_addr));
-	write16 (msi_conf + PCI_MSI_DATA_64, 0x6540);
-
-	u8 uchQueueSize = (read8 (msi_conf + PCI_MSI_FLAGS) & PCI_MSI_FLAGS_QMASK) >> 1;
-	write8 (msi_conf + PCI_MSI_FLAGS,   PCI_MSI_FLAGS_ENABLE
-					  | PCI_MSI_FLAGS_64BIT
-					  | uchQueueSize << 4);
-#endif
-
 	write16 (conf + PCI_COMMAND,   PCI_COMMAND_MEMORY
 				     | PCI_COMMAND_MASTER
 				     | PCI_COMMAND_PARITY
@@ -575,6 +567,52 @@ int CBcmPCIeHostBridge::enable_device (u32 nClassCode, unsigned nSlot, unsigned
 	return 0;
 }
 
+// returns the number of enabled vectors
+int CBcmPCIeHostBridge::enable_device_msi (unsigned nSlot, unsigned nFunc, unsigned nMaxVectors)
+{
+	assert (nSlot < 32);
+	assert (nFunc < 8);
+	assert (nMaxVectors >= 1 && nMaxVectors <= BRCM_INT_PCI_MSI_NR);
+
+	uintptr conf = pcie_map_conf (PCI_BUS (1), PCI_DEVFN (nSlot, nFunc), 0);
+	if (!conf)
+		return -1;
+
+	uintptr msi_conf = find_pci_capability (conf, PCI_CAP_ID_MSI);
+	if (!msi_conf)
+		return -1;
+
+	u16 flags = read16 (msi_conf + PCI_MSI_FLAGS);
+
+	/* the device modifies the lower bits of the data value for multiple messages */
+	unsigned log2_vectors = (flags & PCI_MSI_FLAGS_QMASK) >> 1;
+	while (log2_vectors > 0 && (1U << log2_vectors) > nMaxVectors)
+		log2_vectors--;
+
+	write32 (msi_conf + PCI_MSI_ADDRESS_LO, lower_32_bits (m_msi_target_addr));
+	if (flags & PCI_MSI_FLAGS_64BIT)
+	{
+		write32 (msi_conf + PCI_MSI_ADDRESS_HI, upper_32_bits (m_msi_target_addr));
+		write16 (msi_conf + PCI_MSI_DATA_64, 0x6540);
+	}
+	else
+	{
+		if (upper_32_bits (m_msi_target_addr))
+			return -1;
+
+		write16 (msi_conf + PCI_MSI_DATA_32, 0x6540);
+	}
+
+	flags &= ~PCI_MSI_FLAGS_QSIZE;
+	flags |= PCI_MSI_FLAGS_ENABLE | log2_vectors << 4;
+	write16 (msi_conf + PCI_MSI_FLAGS, flags);
+
+	/* disable legacy interrupts */
+	write16 (conf + PCI_COMMAND, read16 (conf + PCI_COMMAND) | PCI_COMMAND_INTX_DISABLE);
+
+	return 1 << log2_vectors;
+}
+
 int CBcmPCIeHostBridge::pcie_set_pci_ranges(void)
 {
 	assert (m_num_out_wins == 0);
@@ -2,7 +2,7 @@
 // bcmpropertytags.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -37,13 +37,21 @@ struct TPropertyBuffer
 }
 PACKED;
 
+CBcmPropertyTags::TCacheEntry CBcmPropertyTags::s_Cache[PROPTAG_CACHE_ENTRIES];
+volatile unsigned CBcmPropertyTags::s_nCacheEntries = 0;
+CSpinLock CBcmPropertyTags::s_CacheSpinLock (TASK_LEVEL);
+
 CBcmPropertyTags::CBcmPropertyTags (boolean bEarlyUse)
-:	m_MailBox (BCM_MAILBOX_PROP_OUT, bEarlyUse)
+:	m_MailBox (BCM_MAILBOX_PROP_OUT, bEarlyUse),
+	m_bEarlyUse (bEarlyUse),
+	m_nBatchTags (0),
+	m_bAsyncPending (FALSE)
 {
 }
 
 CBcmPropertyTags::~CBcmPropertyTags (void)
 {
+	assert (!m_bAsyncPending);
 }
 
 boolean CBcmPropertyTags::GetTag (u32 nTagId, void *pTag, unsigned nTagSize, unsigned nRequestParmSize)
@@ -77,8 +85,9 @@ boolean CBcmPropertyTags::GetTags (void *pTags, unsigned nTagsSize)
 	unsigned nBufferSize = sizeof (TPropertyBuffer) + nTagsSize + sizeof (u32);
 	assert ((nBufferSize & 3) == 0);
 
-	TPropertyBuffer *pBuffer =
-		(TPropertyBuffer *) CMemorySystem::GetCoherentPage (COHERENT_SLOT_PROP_MAILBOX);
+	assert (nBufferSize <= PAGE_SIZE);
+
+	TPropertyBuffer *pBuffer = GetBuffer (FALSE);
 
 	pBuffer->nBufferSize = nBufferSize;
 	pBuffer->nCode = CODE_REQUEST;
@@ -106,3 +115,229 @@ boolean CBcmPropertyTags::GetTags (void *pTags, unsigned nTagsSize)
 
 	return TRUE;
 }
+
+boolean CBcmPropertyTags::GetTagCached (u32 nTagId, void *pTag, unsigned nTagSize,
+					unsigned nRequestParmSize)
+{
+	assert (pTag != 0);
+	assert (nRequestParmSize <= sizeof (u32));
+
+	u32 nRequestParm = 0;
+	if (nRequestParmSize > 0)
+	{
+		nRequestParm = ((TPropertyTagSimple *) pTag)->nValue;
+	}
+
+	unsigned nEntries = s_nCacheEntries;
+	for (unsigned i = 0; i < nEntries; i++)
+	{
+		TCacheEntry *pEntry = &s_Cache[i];
+		if (   pEntry->nTagId == nTagId
+		    && pEntry->nRequestParm == nRequestParm
+		    && pEntry->nTagSize == nTagSize)
+		{
+			memcpy (pTag, pEntry->Tag, nTagSize);
+
+			return TRUE;
+		}
+	}
+
+	if (!GetTag (nTagId, pTag, nTagSize, nRequestParmSize))
+	{
+		return FALSE;
+	}
+
+	if (nTagSize > PROPTAG_CACHE_TAG_SIZE)
+	{
+		return TRUE;
+	}
+
+	if (!m_bEarlyUse)
+	{
+		s_CacheSpinLock.Acquire ();
+	}
+
+	if (s_nCacheEntries < PROPTAG_CACHE_ENTRIES)
+	{
+		TCacheEntry *pEntry = &s_Cache[s_nCacheEntries];
+
+		pEntry->nTagId = nTagId;
+		pEntry->nRequestParm = nRequestParm;
+		pEntry->nTagSize = nTagSize;
+		memcpy (pEntry->Tag, pTag, nTagSize);
+
+		DataMemBarrier ();
+
+		s_nCacheEntries++;		// publish entry
+	}
+
+	if (!m_bEarlyUse)
+	{
+		s_CacheSpinLock.Release ();
+	}
+
+	return TRUE;
+}
+
+void CBcmPropertyTags::BeginBatch (void)
+{
+	assert (!m_bAsyncPending);
+
+	m_nBatchTags = 0;
+}
+
+boolean CBcmPropertyTags::AddTag (u32 nTagId, void *pTag, unsigned nTagSize,
+				  unsigned nRequestParmSize)
+{
+	assert (!m_bAsyncPending);
+	assert (pTag != 0);
+	assert (nTagSize >= sizeof (TPropertyTagSimple));
+	assert ((nTagSize & 3) == 0);
+
+	if (m_nBatchTags >= PROPTAG_BATCH_MAX_TAGS)
+	{
+		return FALSE;
+	}
+
+	TPropertyTag *pHeader = (TPropertyTag *) pTag;
+	pHeader->nTagId = nTagId;
+	pHeader->nValueBufSize = nTagSize - sizeof (TPropertyTag);
+	pHeader->nValueLength = nRequestParmSize & ~VALUE_LENGTH_RESPONSE;
+
+	m_Batch[m_nBatchTags].pTag = pTag;
+	m_Batch[m_nBatchTags].nTagSize = nTagSize;
+	m_nBatchTags++;
+
+	return TRUE;
+}
+
+boolean CBcmPropertyTags::SubmitBatch (void)
+{
+	assert (!m_bAsyncPending);
+	assert (m_nBatchTags > 0);
+
+	TPropertyBuffer *pBuffer = GetBuffer (FALSE);
+
+	u32 nBufferAddress = PrepareBatch (pBuffer);
+	if (m_MailBox.WriteRead (nBufferAddress) != nBufferAddress)
+	{
+		m_nBatchTags = 0;
+
+		return FALSE;
+	}
+
+	DataMemBarrier ();
+
+	return CompleteBatch (pBuffer);
+}
+
+boolean CBcmPropertyTags::SubmitBatchAsync (void)
+{
+	assert (!m_bEarlyUse);
+	assert (!m_bAsyncPending);
+	assert (m_nBatchTags > 0);
+
+	TPropertyBuffer *pBuffer = GetBuffer (TRUE);
+
+	// the async buffer is in use until the pending request has been completed
+	u32 nBufferAddress = PrepareBatch (pBuffer);
+	if (!m_MailBox.WriteAsync (nBufferAddress))
+	{
+		return FALSE;
+	}
+
+	m_bAsyncPending = TRUE;
+
+	return TRUE;
+}
+
+TPropertyTagsStatus CBcmPropertyTags::PollBatch (void)
+{
+	assert (m_bAsyncPending);
+
+	u32 nResult;
+	if (!m_MailBox.PollRead (&nResult))
+	{
+		return PropertyTagsStatusBusy;
+	}
+
+	m_bAsyncPending = FALSE;
+
+	TPropertyBuffer *pBuffer = GetBuffer (TRUE);
+	if (nResult != BUS_ADDRESS ((uintptr) pBuffer))
+	{
+		m_nBatchTags = 0;
+
+		return PropertyTagsStatusError;
+	}
+
+	DataMemBarrier ();
+
+	return CompleteBatch (pBuffer) ? PropertyTagsStatusDone : PropertyTagsStatusError;
+}
+
+u32 CBcmPropertyTags::PrepareBatch (TPropertyBuffer *pBuffer)
+{
+	assert (pBuffer != 0);
+
+	u8 *pTags = pBuffer->Tags;
+	for (unsigned i = 0; i < m_nBatchTags; i++)
+	{
+		memcpy (pTags, m_Batch[i].pTag, m_Batch[i].nTagSize);
+		pTags += m_Batch[i].nTagSize;
+	}
+
+	*(u32 *) pTags = PROPTAG_END;
+	pTags += sizeof (u32);
+
+	pBuffer->nBufferSize = pTags - (u8 *) pBuffer;
+	assert (pBuffer->nBufferSize <= PAGE_SIZE);
+	pBuffer->nCode = CODE_REQUEST;
+
+	DataSyncBarrier ();
+
+	return BUS_ADDRESS ((uintptr) pBuffer);
+}
+
+boolean CBcmPropertyTags::CompleteBatch (TPropertyBuffer *pBuffer)
+{
+	assert (pBuffer != 0);
+
+	boolean bSuccess = pBuffer->nCode == CODE_RESPONSE_SUCCESS;
+	boolean bResult = bSuccess;
+
+	const u8 *pTags = pBuffer->Tags;
+	for (unsigned i = 0; i < m_nBatchTags; i++)
+	{
+		TPropertyTag *pHeader = (TPropertyTag *) m_Batch[i].pTag;
+
+		if (bSuccess)
+		{
+			memcpy (pHeader, pTags, m_Batch[i].nTagSize);
+
+			pHeader->nValueLength &= ~VALUE_LENGTH_RESPONSE;
+		}
+		else
+		{
+			pHeader->nValueLength = 0;
+		}
+
+		if (pHeader->nValueLength == 0)
+		{
+			bResult = FALSE;
+		}
+
+		pTags += m_Batch[i].nTagSize;
+	}
+
+	m_nBatchTags = 0;
+
+	return bResult;
+}
+
+TPropertyBuffer *CBcmPropertyTags::GetBuffer (boolean bAsync)
+{
+	return (TPropertyBuffer *) CMemorySystem::GetCoherentPage (  bAsync
+								   ? COHERENT_SLOT_PROP_ASYNC
+								   : COHERENT_SLOT_PROP_MAILBOX);
+}
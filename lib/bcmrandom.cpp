@@ -2,7 +2,7 @@
 // bcmrandom.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 // 
 // This file contains code taken from Linux:
 //	drivers/char/hw_random/bcm2835-rng.c
@@ -26,11 +26,13 @@
 #include <circle/bcm2835.h>
 #include <circle/memio.h>
 #include <circle/synchronize.h>
+#include <assert.h>
 
 // the initial numbers generated are "less random" so will be discarded
 #define RNG_WARMUP_COUNT	0x40000
 
-CSpinLock CBcmRandomNumberGenerator::s_SpinLock (TASK_LEVEL);
+// IRQ_LEVEL, because the entropy pool is refilled from a kernel timer
+CSpinLock CBcmRandomNumberGenerator::s_SpinLock (IRQ_LEVEL);
 
 boolean CBcmRandomNumberGenerator::s_bInitialized = FALSE;
 
@@ -61,18 +63,32 @@ u32 CBcmRandomNumberGenerator::GetNumber (void)
 {
 	s_SpinLock.Acquire ();
 
-	PeripheralEntry ();
-
-	while ((read32 (ARM_HW_RNG_STATUS) >> 24) == 0)
+	u32 nResult;
+	while (!TryGetNumber (&nResult))
 	{
 		// just wait
 	}
-	
-	u32 nResult = read32 (ARM_HW_RNG_DATA);
-
-	PeripheralExit ();
 
 	s_SpinLock.Release ();
 
 	return nResult;
 }
+
+boolean CBcmRandomNumberGenerator::TryGetNumber (u32 *pNumber)
+{
+	assert (pNumber != 0);
+
+	PeripheralEntry ();
+
+	boolean bResult = FALSE;
+	if ((read32 (ARM_HW_RNG_STATUS) >> 24) != 0)
+	{
+		*pNumber = read32 (ARM_HW_RNG_DATA);
+
+		bResult = TRUE;
+	}
+
+	PeripheralExit ();
+
+	return bResult;
+}
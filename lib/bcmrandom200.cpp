@@ -2,7 +2,7 @@
 // bcmrandom200.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This file contains code taken from Linux:
 //	drivers/char/hw_random/iproc-rng200.c
@@ -26,6 +26,7 @@
 #include <circle/bcmrandom.h>
 #include <circle/bcm2711.h>
 #include <circle/memio.h>
+#include <assert.h>
 
 #define RNG_CTRL					(ARM_HW_RNG200_BASE + 0x00)
 	#define RNG_CTRL_RNG_RBGEN__MASK			0x00001FFF
@@ -37,7 +38,8 @@
 	#define RNG_FIFO_COUNT_RNG_FIFO_COUNT__MASK		0x000000FF
 	#define RNG_FIFO_COUNT_RNG_FIFO_THRESHOLD__SHIFT	8
 
-CSpinLock CBcmRandomNumberGenerator::s_SpinLock (TASK_LEVEL);
+// IRQ_LEVEL, because the entropy pool is refilled from a kernel timer
+CSpinLock CBcmRandomNumberGenerator::s_SpinLock (IRQ_LEVEL);
 
 boolean CBcmRandomNumberGenerator::s_bInitialized = FALSE;
 
@@ -78,14 +80,27 @@ u32 CBcmRandomNumberGenerator::GetNumber (void)
 	s_SpinLock.Acquire ();
 
 	// ensure FIFO is not empty
-	while ((read32 (RNG_FIFO_COUNT) & RNG_FIFO_COUNT_RNG_FIFO_COUNT__MASK) == 0)
+	u32 nResult;
+	while (!TryGetNumber (&nResult))
 	{
 		// just wait
 	}
 
-	u32 nResult = read32 (RNG_FIFO_DATA);
-
 	s_SpinLock.Release ();
 
 	return nResult;
 }
+
+boolean CBcmRandomNumberGenerator::TryGetNumber (u32 *pNumber)
+{
+	assert (pNumber != 0);
+
+	if ((read32 (RNG_FIFO_COUNT) & RNG_FIFO_COUNT_RNG_FIFO_COUNT__MASK) == 0)
+	{
+		return FALSE;
+	}
+
+	*pNumber = read32 (RNG_FIFO_DATA);
+
+	return TRUE;
+}
@@ -0,0 +1,209 @@
+//
+// bcmrandompool.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/bcmrandom.h>
+#include <circle/multicore.h>
+#include <circle/synchronize.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define KEY_BYTES	(8 * sizeof (u32))
+
+#define ROTL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d)			\
+	a += b; d ^= a; d = ROTL (d, 16);		\
+	c += d; b ^= c; b = ROTL (b, 12);		\
+	a += b; d ^= a; d = ROTL (d, 8);		\
+	c += d; b ^= c; b = ROTL (b, 7);
+
+CBcmRandomNumberGenerator::TCSPRNG CBcmRandomNumberGenerator::s_CSPRNG[CORES];
+
+u32 CBcmRandomNumberGenerator::s_Pool[RANDOM_POOL_WORDS];
+unsigned CBcmRandomNumberGenerator::s_nPoolWords = 0;
+boolean CBcmRandomNumberGenerator::s_bPoolTimerStarted = FALSE;
+
+void CBcmRandomNumberGenerator::GetBytes (void *pBuffer, size_t nCount)
+{
+	u8 *pDest = (u8 *) pBuffer;
+	assert (pDest != 0);
+
+	while (nCount > 0)
+	{
+		// the state is consistent between two chunks, so that IRQs can be served there
+		EnterCritical (IRQ_LEVEL);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+		TCSPRNG *pState = &s_CSPRNG[CMultiCoreSupport::ThisCore ()];
+#else
+		TCSPRNG *pState = &s_CSPRNG[0];
+#endif
+
+		if (pState->nAvail == 0)
+		{
+			Refill (pState);
+		}
+
+		size_t nBytes = nCount;
+		if (nBytes > pState->nAvail)
+		{
+			nBytes = pState->nAvail;
+		}
+
+		u8 *pSource = (u8 *) pState->Buffer + sizeof pState->Buffer - pState->nAvail;
+		memcpy (pDest, pSource, nBytes);
+		memset (pSource, 0, nBytes);		// the output is not kept
+
+		pState->nAvail -= nBytes;
+
+		LeaveCritical ();
+
+		pDest += nBytes;
+		nCount -= nBytes;
+	}
+}
+
+void CBcmRandomNumberGenerator::Refill (TCSPRNG *pState)
+{
+	assert (pState != 0);
+
+	if (pState->nRefills == 0)
+	{
+		Reseed (pState);
+
+		pState->nRefills = RANDOM_RESEED_REFILLS;
+	}
+
+	pState->nRefills--;
+
+	// the key changes with each refill, so the block counter can start at 0 each time
+	for (unsigned i = 0; i < RANDOM_BUFFER_BLOCKS; i++)
+	{
+		ChaCha20Block (pState->Key, i, &pState->Buffer[i * 16]);
+	}
+
+	memcpy (pState->Key, pState->Buffer, KEY_BYTES);
+	memset (pState->Buffer, 0, KEY_BYTES);
+
+	pState->nAvail = sizeof pState->Buffer - KEY_BYTES;
+}
+
+void CBcmRandomNumberGenerator::Reseed (TCSPRNG *pState)
+{
+	assert (pState != 0);
+
+	for (unsigned i = 0; i < 8; i++)
+	{
+		pState->Key[i] ^= GetPoolWord ();
+	}
+}
+
+void CBcmRandomNumberGenerator::ChaCha20Block (const u32 Key[8], u32 nCounter, u32 Output[16])
+{
+	assert (Key != 0);
+	assert (Output != 0);
+
+	u32 State[16];
+	State[0] = 0x61707865;				// "expand 32-byte k"
+	State[1] = 0x3320646E;
+	State[2] = 0x79622D32;
+	State[3] = 0x6B206574;
+	for (unsigned i = 0; i < 8; i++)
+	{
+		State[4+i] = Key[i];
+	}
+	State[12] = nCounter;
+	State[13] = 0;					// nonce
+	State[14] = 0;
+	State[15] = 0;
+
+	u32 x[16];
+	for (unsigned i = 0; i < 16; i++)
+	{
+		x[i] = State[i];
+	}
+
+	for (unsigned i = 0; i < 10; i++)		// 20 rounds
+	{
+		QUARTERROUND (x[0], x[4], x[8],  x[12])
+		QUARTERROUND (x[1], x[5], x[9],  x[13])
+		QUARTERROUND (x[2], x[6], x[10], x[14])
+		QUARTERROUND (x[3], x[7], x[11], x[15])
+
+		QUARTERROUND (x[0], x[5], x[10], x[15])
+		QUARTERROUND (x[1], x[6], x[11], x[12])
+		QUARTERROUND (x[2], x[7], x[8],  x[13])
+		QUARTERROUND (x[3], x[4], x[9],  x[14])
+	}
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		Output[i] = x[i] + State[i];
+	}
+}
+
+u32 CBcmRandomNumberGenerator::GetPoolWord (void)
+{
+	s_SpinLock.Acquire ();
+
+	if (   !s_bPoolTimerStarted
+	    && CTimer::Get () != 0)
+	{
+		s_bPoolTimerStarted = TRUE;
+
+		CTimer::Get ()->StartKernelTimer (RANDOM_POOL_INTERVAL, PoolTimerHandler);
+	}
+
+	u32 nResult;
+	if (s_nPoolWords > 0)
+	{
+		nResult = s_Pool[--s_nPoolWords];
+		s_Pool[s_nPoolWords] = 0;
+	}
+	else
+	{
+		// pool is empty (e.g. before the timer runs), wait for the hardware
+		while (!TryGetNumber (&nResult))
+		{
+			// just wait
+		}
+	}
+
+	s_SpinLock.Release ();
+
+	return nResult;
+}
+
+void CBcmRandomNumberGenerator::PoolTimerHandler (TKernelTimerHandle hTimer, void *pParam,
+						  void *pContext)
+{
+	s_SpinLock.Acquire ();
+
+	u32 nNumber;
+	while (   s_nPoolWords < RANDOM_POOL_WORDS
+	       && TryGetNumber (&nNumber))
+	{
+		s_Pool[s_nPoolWords++] = nNumber;
+	}
+
+	s_SpinLock.Release ();
+
+	assert (CTimer::Get () != 0);
+	CTimer::Get ()->StartKernelTimer (RANDOM_POOL_INTERVAL, PoolTimerHandler);
+}
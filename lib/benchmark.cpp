@@ -0,0 +1,360 @@
+//
+// benchmark.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/benchmark.h>
+#include <circle/perfcounters.h>
+#include <circle/machineinfo.h>
+#include <circle/bcmpropertytags.h>
+#include <circle/timer.h>
+#include <circle/logger.h>
+#include <circle/string.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define LONG_RUN_MICROS		1000000		// use the system timer from here
+
+static const char FromBenchmark[] = "bench";
+
+CBenchmark::CBenchmark (unsigned nWarmup, unsigned nRepetitions)
+:	m_nWarmup (nWarmup),
+	m_nRepetitions (nRepetitions),
+	m_nEntries (0),
+	m_nClockRate (0)
+{
+	assert (m_nRepetitions > 0);
+
+	m_pSample = new TSample[m_nRepetitions];
+	assert (m_pSample != 0);
+}
+
+CBenchmark::~CBenchmark (void)
+{
+	delete [] m_pSample;
+	m_pSample = 0;
+}
+
+boolean CBenchmark::Register (const char *pSuite, const char *pName, TBenchmarkFunction *pFunction,
+			      void *pParam, u64 nBytes)
+{
+	assert (pSuite != 0);
+	assert (pName != 0);
+	assert (pFunction != 0);
+
+	if (m_nEntries == BENCHMARK_MAX_ENTRIES)
+	{
+		return FALSE;
+	}
+
+	TEntry *pEntry = &m_Entry[m_nEntries++];
+
+	pEntry->pFunction = pFunction;
+	pEntry->pParam = pParam;
+
+	memset (&pEntry->Result, 0, sizeof pEntry->Result);
+	pEntry->Result.pSuite = pSuite;
+	pEntry->Result.pName = pName;
+	pEntry->Result.nBytes = nBytes;
+
+	return TRUE;
+}
+
+unsigned CBenchmark::Run (const char *pSuite)
+{
+	m_nClockRate = CMachineInfo::Get ()->GetClockRate (CLOCK_ID_ARM);
+
+	unsigned nAborted = 0;
+	for (unsigned i = 0; i < m_nEntries; i++)
+	{
+		if (   pSuite != 0
+		    && strcmp (pSuite, m_Entry[i].Result.pSuite) != 0)
+		{
+			continue;
+		}
+
+		if (!RunBenchmark (i))
+		{
+			CLogger::Get ()->Write (FromBenchmark, LogWarning, "%s/%s aborted",
+						m_Entry[i].Result.pSuite, m_Entry[i].Result.pName);
+
+			nAborted++;
+		}
+	}
+
+	return nAborted;
+}
+
+unsigned CBenchmark::GetCount (void) const
+{
+	return m_nEntries;
+}
+
+const TBenchmarkResult *CBenchmark::GetResult (unsigned nIndex) const
+{
+	assert (nIndex < m_nEntries);
+	return &m_Entry[nIndex].Result;
+}
+
+void CBenchmark::Dump (void) const
+{
+	CLogger *pLogger = CLogger::Get ();
+	assert (pLogger != 0);
+
+	for (unsigned i = 0; i < m_nEntries; i++)
+	{
+		const TBenchmarkResult *pResult = &m_Entry[i].Result;
+		if (!pResult->bValid)
+		{
+			continue;
+		}
+
+		CString Throughput;
+		if (pResult->nBytes != 0)
+		{
+			Throughput.Format (", %u KB/s", pResult->nKBytesPerSec);
+		}
+
+		pLogger->Write (FromBenchmark, LogNotice,
+				"%s/%s: median %llu ns (min %llu, max %llu, sd %llu), %llu cycles%s",
+				pResult->pSuite, pResult->pName, pResult->nMedianNanos,
+				pResult->nMinNanos, pResult->nMaxNanos, pResult->nStdDevNanos,
+				pResult->nMedianCycles, (const char *) Throughput);
+	}
+}
+
+void CBenchmark::WriteCSV (TBenchmarkWriteHandler *pHandler, void *pParam) const
+{
+	assert (pHandler != 0);
+
+	static const char Header[] = "suite,name,repetitions,min_ns,median_ns,mean_ns,max_ns,"
+				     "stddev_ns,median_cycles,bytes,kbytes_per_sec\r\n";
+	(*pHandler) (Header, sizeof Header-1, pParam);
+
+	for (unsigned i = 0; i < m_nEntries; i++)
+	{
+		const TBenchmarkResult *pResult = &m_Entry[i].Result;
+		if (!pResult->bValid)
+		{
+			continue;
+		}
+
+		CString Line;
+		Line.Format ("%s,%s,%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%u\r\n",
+			     pResult->pSuite, pResult->pName, pResult->nRepetitions,
+			     pResult->nMinNanos, pResult->nMedianNanos, pResult->nMeanNanos,
+			     pResult->nMaxNanos, pResult->nStdDevNanos, pResult->nMedianCycles,
+			     pResult->nBytes, pResult->nKBytesPerSec);
+
+		(*pHandler) ((const char *) Line, Line.GetLength (), pParam);
+	}
+}
+
+void CBenchmark::WriteCSV (CDevice *pDevice) const
+{
+	assert (pDevice != 0);
+
+	WriteCSV (DeviceWriteHandler, pDevice);
+}
+
+void CBenchmark::WriteJSON (TBenchmarkWriteHandler *pHandler, void *pParam) const
+{
+	assert (pHandler != 0);
+
+	CString Header;
+	Header.Format ("{\"machine\":\"%s\",\"clock_hz\":%u,\"aarch\":%u,"
+		       "\"compiler\":\"%s\",\"built\":\"%s %s\",\n\"benchmarks\":[\n",
+		       CMachineInfo::Get ()->GetMachineName (), m_nClockRate, AARCH,
+		       __VERSION__, __DATE__, __TIME__);
+	(*pHandler) ((const char *) Header, Header.GetLength (), pParam);
+
+	boolean bFirst = TRUE;
+	for (unsigned i = 0; i < m_nEntries; i++)
+	{
+		const TBenchmarkResult *pResult = &m_Entry[i].Result;
+		if (!pResult->bValid)
+		{
+			continue;
+		}
+
+		CString Line;
+		Line.Format ("%s{\"suite\":\"%s\",\"name\":\"%s\",\"repetitions\":%u,"
+			     "\"min_ns\":%llu,\"median_ns\":%llu,\"mean_ns\":%llu,\"max_ns\":%llu,"
+			     "\"stddev_ns\":%llu,\"median_cycles\":%llu,\"bytes\":%llu,"
+			     "\"kbytes_per_sec\":%u}",
+			     bFirst ? "" : ",\n", pResult->pSuite, pResult->pName,
+			     pResult->nRepetitions, pResult->nMinNanos, pResult->nMedianNanos,
+			     pResult->nMeanNanos, pResult->nMaxNanos, pResult->nStdDevNanos,
+			     pResult->nMedianCycles, pResult->nBytes, pResult->nKBytesPerSec);
+
+		(*pHandler) ((const char *) Line, Line.GetLength (), pParam);
+
+		bFirst = FALSE;
+	}
+
+	static const char Trailer[] = "\n]}\n";
+	(*pHandler) (Trailer, sizeof Trailer-1, pParam);
+}
+
+void CBenchmark::WriteJSON (CDevice *pDevice) const
+{
+	assert (pDevice != 0);
+
+	WriteJSON (DeviceWriteHandler, pDevice);
+}
+
+boolean CBenchmark::RunBenchmark (unsigned nIndex)
+{
+	assert (nIndex < m_nEntries);
+	TEntry *pEntry = &m_Entry[nIndex];
+	TBenchmarkResult *pResult = &pEntry->Result;
+
+	pResult->bValid = FALSE;
+
+	for (unsigned i = 0; i < m_nWarmup; i++)
+	{
+		if (!(*pEntry->pFunction) (pEntry->pParam))
+		{
+			return FALSE;
+		}
+	}
+
+	CPerfCounters PerfCounters;
+
+	assert (m_pSample != 0);
+	for (unsigned i = 0; i < m_nRepetitions; i++)
+	{
+		unsigned nStartTicks = CTimer::GetClockTicks ();
+		PerfCounters.Start ();
+
+		boolean bOK = (*pEntry->pFunction) (pEntry->pParam);
+
+		u64 nCycles = PerfCounters.GetCycles ();
+		unsigned nMicros = CTimer::GetClockTicks () - nStartTicks;
+
+		if (!bOK)
+		{
+			PerfCounters.Stop ();
+
+			return FALSE;
+		}
+
+		// the cycle counter may overflow on long runs (32-bit on AArch32)
+		if (   nCycles == 0
+		    || m_nClockRate == 0
+		    || nMicros >= LONG_RUN_MICROS)
+		{
+			m_pSample[i].nNanos = (u64) nMicros * 1000;
+			m_pSample[i].nCycles = 0;
+		}
+		else
+		{
+			m_pSample[i].nNanos = nCycles * 1000 / (m_nClockRate / 1000000);
+			m_pSample[i].nCycles = nCycles;
+		}
+	}
+
+	PerfCounters.Stop ();
+
+	// sort samples by duration (insertion sort, the number of samples is small)
+	for (unsigned i = 1; i < m_nRepetitions; i++)
+	{
+		TSample Sample = m_pSample[i];
+
+		unsigned j;
+		for (j = i; j > 0 && m_pSample[j-1].nNanos > Sample.nNanos; j--)
+		{
+			m_pSample[j] = m_pSample[j-1];
+		}
+
+		m_pSample[j] = Sample;
+	}
+
+	u64 nSum = 0;
+	for (unsigned i = 0; i < m_nRepetitions; i++)
+	{
+		nSum += m_pSample[i].nNanos;
+	}
+
+	u64 nMean = nSum / m_nRepetitions;
+
+	u64 nVarianceSum = 0;
+	for (unsigned i = 0; i < m_nRepetitions; i++)
+	{
+		s64 nDiff = (s64) (m_pSample[i].nNanos - nMean);
+		nVarianceSum += (u64) (nDiff * nDiff);
+	}
+
+	const TSample *pMedian = &m_pSample[m_nRepetitions / 2];
+
+	pResult->nRepetitions = m_nRepetitions;
+	pResult->nMinNanos = m_pSample[0].nNanos;
+	pResult->nMedianNanos = pMedian->nNanos;
+	pResult->nMeanNanos = nMean;
+	pResult->nMaxNanos = m_pSample[m_nRepetitions-1].nNanos;
+	pResult->nStdDevNanos = SquareRoot (nVarianceSum / m_nRepetitions);
+	pResult->nMedianCycles = pMedian->nCycles;
+
+	pResult->nKBytesPerSec = 0;
+	if (   pResult->nBytes != 0
+	    && pMedian->nNanos != 0)
+	{
+		pResult->nKBytesPerSec = (unsigned) (  pResult->nBytes * 1000000000
+						     / pMedian->nNanos / 1024);
+	}
+
+	pResult->bValid = TRUE;
+
+	return TRUE;
+}
+
+void CBenchmark::DeviceWriteHandler (const void *pBuffer, size_t nLength, void *pParam)
+{
+	CDevice *pDevice = (CDevice *) pParam;
+	assert (pDevice != 0);
+
+	pDevice->Write (pBuffer, nLength);
+}
+
+u64 CBenchmark::SquareRoot (u64 nValue)
+{
+	// bitwise integer square root
+	u64 nResult = 0;
+	u64 nBit = (u64) 1 << 62;
+
+	while (nBit > nValue)
+	{
+		nBit >>= 2;
+	}
+
+	while (nBit != 0)
+	{
+		if (nValue >= nResult + nBit)
+		{
+			nValue -= nResult + nBit;
+			nResult = (nResult >> 1) + nBit;
+		}
+		else
+		{
+			nResult >>= 1;
+		}
+
+		nBit >>= 2;
+	}
+
+	return nResult;
+}
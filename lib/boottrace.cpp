@@ -0,0 +1,115 @@
+//
+// boottrace.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/boottrace.h>
+#include <circle/timer.h>
+#include <circle/atomic.h>
+#include <circle/string.h>
+#include <assert.h>
+
+static const char FromBootTrace[] = "boot";
+
+// in BSS, which is cleared before the first event is recorded
+TBootTraceEvent CBootTrace::s_Event[BOOT_TRACE_MAX_EVENTS];
+volatile int CBootTrace::s_nEvents;
+unsigned CBootTrace::s_nClockDelta;
+
+void CBootTrace::Mark (const char *pName)
+{
+	Mark (pName, CTimer::GetClockTicks ());
+}
+
+void CBootTrace::Mark (const char *pName, unsigned nClockTicks)
+{
+	assert (pName != 0);
+
+	int nIndex = AtomicIncrement (&s_nEvents) - 1;
+	if (nIndex >= BOOT_TRACE_MAX_EVENTS)
+	{
+		AtomicSet (&s_nEvents, BOOT_TRACE_MAX_EVENTS);
+
+		return;
+	}
+
+	s_Event[nIndex].pName = pName;
+	s_Event[nIndex].nClockTicks = nClockTicks - s_nClockDelta;
+}
+
+unsigned CBootTrace::GetCount (void)
+{
+	return AtomicGet (&s_nEvents);
+}
+
+const char *CBootTrace::GetEvent (unsigned nIndex, unsigned *pClockTicks)
+{
+	assert (nIndex < GetCount ());
+
+	assert (pClockTicks != 0);
+	*pClockTicks = s_Event[nIndex].nClockTicks;
+
+	return s_Event[nIndex].pName;
+}
+
+void CBootTrace::Dump (TLogSeverity Severity)
+{
+	CLogger *pLogger = CLogger::Get ();
+	assert (pLogger != 0);
+
+	unsigned nCount = GetCount ();
+	unsigned nPrevTicks = 0;
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		unsigned nTicks;
+		const char *pName = GetEvent (i, &nTicks);
+
+		pLogger->Write (FromBootTrace, Severity, "%7u.%03u ms (+%6u.%03u ms) %s",
+				nTicks / 1000, nTicks % 1000,
+				(nTicks - nPrevTicks) / 1000, (nTicks - nPrevTicks) % 1000, pName);
+
+		nPrevTicks = nTicks;
+	}
+}
+
+void CBootTrace::Write (CDevice *pTarget)
+{
+	assert (pTarget != 0);
+
+	static const char Header[] = "TIME_US  DELTA_US EVENT\n";
+	pTarget->Write (Header, sizeof Header-1);
+
+	unsigned nCount = GetCount ();
+	unsigned nPrevTicks = 0;
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		unsigned nTicks;
+		const char *pName = GetEvent (i, &nTicks);
+
+		CString Line;
+		Line.Format ("%8u %8u %s\n", nTicks, nTicks - nPrevTicks, pName);
+
+		pTarget->Write (Line, Line.GetLength ());
+
+		nPrevTicks = nTicks;
+	}
+}
+
+void CBootTrace::ClockChanged (unsigned nDelta)
+{
+	s_nClockDelta += nDelta;
+}
@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/chainboot.h>
+#include <circle/lz4decoder.h>
 #include <circle/synchronize.h>
 #include <circle/sysconfig.h>
 #include <circle/util.h>
@@ -58,12 +59,40 @@ static void ChainBootStub (const void *pKernelImage, size_t nKernelSize)
 	(*pKernelStart) ();
 }
 
-void EnableChainBoot (const void *pKernelImage, size_t nKernelSize)
+boolean EnableChainBoot (const void *pKernelImage, size_t nKernelSize)
 {
 #ifdef ARM_ALLOW_MULTI_CORE
 	assert (0);		// not supported with multi-core
 #endif
 
+	if (CLZ4Decoder::IsCompressed (pKernelImage, nKernelSize))
+	{
+		size_t nBufferSize = CLZ4Decoder::GetContentSize (pKernelImage, nKernelSize);
+		if (   nBufferSize == 0
+		    || nBufferSize > KERNEL_MAX_SIZE)
+		{
+			nBufferSize = KERNEL_MAX_SIZE;
+		}
+
+		u8 *pBuffer = new u8[nBufferSize];
+		if (pBuffer == 0)
+		{
+			return FALSE;
+		}
+
+		nKernelSize = CLZ4Decoder::Decompress (pKernelImage, nKernelSize,
+						       pBuffer, nBufferSize);
+		if (nKernelSize == 0)
+		{
+			delete [] pBuffer;
+
+			return FALSE;
+		}
+
+		// the compressed image is not freed, the caller may not have allocated it
+		pKernelImage = pBuffer;
+	}
+
 	s_pKernelImage = pKernelImage;
 	s_nKernelSize = nKernelSize;
 
@@ -78,6 +107,8 @@ void EnableChainBoot (const void *pKernelImage, size_t nKernelSize)
 #endif
 	DataSyncBarrier ();
 	InstructionSyncBarrier ();
+
+	return TRUE;
 }
 
 boolean IsChainBootEnabled (void)
@@ -92,3 +92,37 @@ boolean CCharGenerator::GetPixel (char chAscii, unsigned nPosX, unsigned nPosY)
 	return font_data[nIndex][nPosY] & (0x80 >> nPosX) ? TRUE : FALSE;
 #endif
 }
+
+u32 CCharGenerator::GetPixelLine (char chAscii, unsigned nPosY) const
+{
+	unsigned nAscii = (u8) chAscii;
+	if (   nAscii < FIRSTCHAR
+	    || nAscii > LASTCHAR)
+	{
+		return 0;
+	}
+
+	unsigned nIndex = nAscii - FIRSTCHAR;
+	assert (nIndex < CHARCOUNT);
+
+#ifdef GIMP_HEADER
+	assert (nPosY < height);
+	unsigned nOffset = nPosY * width + nIndex * m_nCharWidth;
+
+	u32 nLine = 0;
+	for (unsigned x = 0; x < m_nCharWidth; x++)
+	{
+		assert (nOffset + x < sizeof header_data / sizeof header_data[0]);
+		nLine = nLine << 1 | (header_data[nOffset + x] ? 1 : 0);
+	}
+
+	return nLine;
+#else
+	if (nPosY >= height)
+	{
+		return 0;
+	}
+
+	return font_data[nIndex][nPosY];
+#endif
+}
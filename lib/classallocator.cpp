@@ -20,6 +20,9 @@
 #include <circle/classallocator.h>
 #include <circle/alloc.h>
 #include <circle/logger.h>
+#ifdef ARM_ALLOW_MULTI_CORE
+	#include <circle/multicore.h>
+#endif
 
 #define BLOCK_ALIGN	16U
 #define ALIGN_MASK	(~(BLOCK_ALIGN-1))
@@ -42,7 +45,8 @@ CClassAllocator::CClassAllocator (size_t      nObjectSize,
 :	m_pClassName (pClassName),
 	m_pMemory (0),
 	m_pFreeList (0),
-	m_bProtected (FALSE)
+	m_bProtected (FALSE),
+	m_nAllocations (0)
 {
 	Init (nObjectSize, nReservedObjects);
 }
@@ -56,7 +60,8 @@ CClassAllocator::CClassAllocator (size_t      nObjectSize,
 	m_pFreeList (0),
 	m_bProtected (TRUE),
 	m_nTargetLevel (nTargetLevel),
-	m_SpinLock (nTargetLevel)
+	m_SpinLock (nTargetLevel),
+	m_nAllocations (0)
 {
 	Init (nObjectSize, nReservedObjects);
 }
@@ -66,6 +71,14 @@ CClassAllocator::~CClassAllocator (void)
 {
 	m_pFreeList = 0;
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	for (unsigned i = 0; i < CORES; i++)
+	{
+		delete m_CoreCache[i].pSpinLock;
+		m_CoreCache[i].pSpinLock = 0;
+	}
+#endif
+
 	if (m_pMemory != 0)
 	{
 		free (m_pMemory);
@@ -84,6 +97,20 @@ void CClassAllocator::Init (size_t nObjectSize, unsigned nReservedObjects)
 	}
 	m_nObjectSize = (nObjectSize + sizeof (TBlock) + BLOCK_ALIGN-1) & ALIGN_MASK;
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	for (unsigned i = 0; i < CORES; i++)
+	{
+		TCoreCache *pCache = &m_CoreCache[i];
+
+		pCache->pSpinLock = m_bProtected ? new CSpinLock (m_nTargetLevel) : 0;
+		pCache->pFreeList = 0;
+		pCache->nCount = 0;
+		pCache->nAllocations = 0;
+		pCache->nRefills = 0;
+		pCache->nSteals = 0;
+	}
+#endif
+
 	assert (nReservedObjects > 0);
 	m_nReservedObjects = nReservedObjects;
 
@@ -140,6 +167,13 @@ void CClassAllocator::Extend (unsigned nReservedObjects, unsigned nTargetLevel)
 
 void *CClassAllocator::Allocate (void)
 {
+#ifdef ARM_ALLOW_MULTI_CORE
+	if (m_bProtected)
+	{
+		return AllocateCached ();
+	}
+#endif
+
 	if (m_bProtected)
 	{
 		m_SpinLock.Acquire ();
@@ -164,6 +198,8 @@ void *CClassAllocator::Allocate (void)
 	m_pFreeList = pBlock->pNext;
 	pBlock->pNext = 0;
 
+	m_nAllocations++;
+
 	if (m_bProtected)
 	{
 		m_SpinLock.Release ();
@@ -181,6 +217,15 @@ void CClassAllocator::Free (void *pBlock)
 	assert (pBlk->nMagic == BLOCK_MAGIC);
 	assert (pBlk->pNext == 0);
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	if (m_bProtected)
+	{
+		FreeCached (pBlk);
+
+		return;
+	}
+#endif
+
 	if (m_bProtected)
 	{
 		m_SpinLock.Acquire ();
@@ -194,3 +239,186 @@ void CClassAllocator::Free (void *pBlock)
 		m_SpinLock.Release ();
 	}
 }
+
+void CClassAllocator::GetStats (TClassAllocatorStats *pStats)
+{
+	assert (pStats != 0);
+
+	if (m_bProtected)
+	{
+		m_SpinLock.Acquire ();
+	}
+
+	pStats->nReservedObjects = m_nReservedObjects;
+	pStats->nAllocations = m_nAllocations;
+	pStats->nRefills = 0;
+	pStats->nSteals = 0;
+
+	unsigned nFree = 0;
+	for (TBlock *pBlock = m_pFreeList; pBlock != 0; pBlock = pBlock->pNext)
+	{
+		nFree++;
+	}
+
+	if (m_bProtected)
+	{
+		m_SpinLock.Release ();
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	for (unsigned i = 0; i < CORES; i++)
+	{
+		const TCoreCache *pCache = &m_CoreCache[i];
+
+		nFree += pCache->nCount;
+		pStats->nAllocations += pCache->nAllocations;
+		pStats->nRefills += pCache->nRefills;
+		pStats->nSteals += pCache->nSteals;
+	}
+#endif
+
+	pStats->nFreeObjects = nFree;
+}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+
+void *CClassAllocator::AllocateCached (void)
+{
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+	TCoreCache *pCache = &m_CoreCache[nCore];
+	assert (pCache->pSpinLock != 0);
+
+	pCache->pSpinLock->Acquire ();
+
+	if (pCache->pFreeList == 0)
+	{
+		// refill the cache with a batch from the shared list
+		m_SpinLock.Acquire ();
+
+		for (unsigned i = 0; i < CLASS_ALLOCATOR_BATCH && m_pFreeList != 0; i++)
+		{
+			TBlock *pBlock = m_pFreeList;
+			m_pFreeList = pBlock->pNext;
+
+			pBlock->pNext = pCache->pFreeList;
+			pCache->pFreeList = pBlock;
+			pCache->nCount++;
+		}
+
+		m_SpinLock.Release ();
+
+		pCache->nRefills++;
+	}
+
+	TBlock *pBlock = pCache->pFreeList;
+	if (pBlock != 0)
+	{
+		pCache->pFreeList = pBlock->pNext;
+		pCache->nCount--;
+	}
+
+	pCache->nAllocations++;
+
+	pCache->pSpinLock->Release ();
+
+	if (pBlock == 0)
+	{
+		// the remaining objects are cached by other cores
+		pBlock = Steal (nCore);
+		if (pBlock == 0)
+		{
+			CLogger::Get ()->Write (m_pClassName, LogPanic,
+						"Trying to allocate more than %u instances",
+						m_nReservedObjects);
+
+			return 0;
+		}
+	}
+
+	assert (pBlock->nMagic == BLOCK_MAGIC);
+	pBlock->pNext = 0;
+
+	return pBlock->Data;
+}
+
+void CClassAllocator::FreeCached (TBlock *pBlock)
+{
+	assert (pBlock != 0);
+
+	TCoreCache *pCache = &m_CoreCache[CMultiCoreSupport::ThisCore ()];
+	assert (pCache->pSpinLock != 0);
+
+	pCache->pSpinLock->Acquire ();
+
+	pBlock->pNext = pCache->pFreeList;
+	pCache->pFreeList = pBlock;
+	pCache->nCount++;
+
+	if (pCache->nCount > CLASS_ALLOCATOR_CACHE_MAX)
+	{
+		// return a batch to the shared list
+		m_SpinLock.Acquire ();
+
+		for (unsigned i = 0; i < CLASS_ALLOCATOR_BATCH; i++)
+		{
+			TBlock *pBatchBlock = pCache->pFreeList;
+			assert (pBatchBlock != 0);
+			pCache->pFreeList = pBatchBlock->pNext;
+			pCache->nCount--;
+
+			pBatchBlock->pNext = m_pFreeList;
+			m_pFreeList = pBatchBlock;
+		}
+
+		m_SpinLock.Release ();
+	}
+
+	pCache->pSpinLock->Release ();
+}
+
+// called without holding a lock, only one cache lock is held at a time
+TBlock *CClassAllocator::Steal (unsigned nThisCore)
+{
+	// another core may have drained its cache in the meantime
+	m_SpinLock.Acquire ();
+
+	TBlock *pBlock = m_pFreeList;
+	if (pBlock != 0)
+	{
+		m_pFreeList = pBlock->pNext;
+	}
+
+	m_SpinLock.Release ();
+
+	if (pBlock != 0)
+	{
+		return pBlock;
+	}
+
+	for (unsigned i = 1; i < CORES; i++)
+	{
+		TCoreCache *pCache = &m_CoreCache[(nThisCore + i) % CORES];
+		assert (pCache->pSpinLock != 0);
+
+		pCache->pSpinLock->Acquire ();
+
+		pBlock = pCache->pFreeList;
+		if (pBlock != 0)
+		{
+			pCache->pFreeList = pBlock->pNext;
+			pCache->nCount--;
+			pCache->nSteals++;
+
+			pCache->pSpinLock->Release ();
+
+			return pBlock;
+		}
+
+		pCache->pSpinLock->Release ();
+	}
+
+	return 0;
+}
+
+#endif
+
@@ -0,0 +1,116 @@
+//
+// corechannel.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/corechannel.h>
+
+#ifdef ARM_ALLOW_MULTI_CORE
+
+CCoreChannelBase *CCoreChannelBase::s_pFirst[CORES] = {0};
+
+CSpinLock CCoreChannelBase::s_SpinLock (IRQ_LEVEL);
+
+CCoreChannelBase::CCoreChannelBase (unsigned nToCore, TCoreChannelWakeup Wakeup)
+:	m_nToCore (nToCore),
+	m_Wakeup (Wakeup),
+	m_pHandler (0),
+	m_pParam (0)
+{
+	assert (m_nToCore < CORES);
+	assert (m_Wakeup < CoreChannelWakeupUnknown);
+
+	s_SpinLock.Acquire ();
+
+	m_pNext = s_pFirst[m_nToCore];
+	s_pFirst[m_nToCore] = this;
+
+	s_SpinLock.Release ();
+}
+
+CCoreChannelBase::~CCoreChannelBase (void)
+{
+	s_SpinLock.Acquire ();
+
+	CCoreChannelBase **ppChannel = &s_pFirst[m_nToCore];
+	while (*ppChannel != this)
+	{
+		assert (*ppChannel != 0);
+		ppChannel = &(*ppChannel)->m_pNext;
+	}
+
+	*ppChannel = m_pNext;
+
+	s_SpinLock.Release ();
+}
+
+void CCoreChannelBase::RegisterReceiveHandler (TReceiveHandler *pHandler, void *pParam)
+{
+	assert (m_Wakeup == CoreChannelWakeupIPI);
+
+	s_SpinLock.Acquire ();
+
+	m_pParam = pParam;
+	m_pHandler = pHandler;
+
+	s_SpinLock.Release ();
+}
+
+void CCoreChannelBase::IPIHandler (unsigned nCore)
+{
+	assert (nCore < CORES);
+
+	s_SpinLock.Acquire ();
+
+	// the handlers are called for all channels to this core, because an IPI may stand for
+	// multiple channels
+	for (CCoreChannelBase *pChannel = s_pFirst[nCore]; pChannel != 0;
+	     pChannel = pChannel->m_pNext)
+	{
+		if (pChannel->m_pHandler != 0)
+		{
+			(*pChannel->m_pHandler) (pChannel->m_pParam);
+		}
+	}
+
+	s_SpinLock.Release ();
+}
+
+void CCoreChannelBase::Notify (boolean bWasEmpty)
+{
+	switch (m_Wakeup)
+	{
+	case CoreChannelWakeupEvent:
+		DataSyncBarrier ();
+
+		SendEvent ();
+		break;
+
+	case CoreChannelWakeupIPI:
+		if (bWasEmpty)
+		{
+			CMultiCoreSupport::SendIPI (m_nToCore, IPI_CORE_CHANNEL);
+		}
+		break;
+
+	default:
+		assert (0);
+		break;
+	}
+}
+
+#endif
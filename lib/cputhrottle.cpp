@@ -22,6 +22,7 @@
 #include <circle/timer.h>
 #include <circle/koptions.h>
 #include <circle/logger.h>
+#include <circle/synchronize.h>
 #include <assert.h>
 
 #define TRANSITION_DELAY_USECS		355	// See: linux/drivers/cpufreq/bcm2835-cpufreq.c
@@ -43,7 +44,15 @@ CCPUThrottle::CCPUThrottle (TCPUSpeed InitialSpeed)
 	m_LastThrottledState (SystemStateNothingOccurred),
 	m_pThrottledHandler (0),
 	m_pThrottledParam (0),
-	m_bFanConnected (FALSE)
+	m_bFanConnected (FALSE),
+	m_bAsyncPending (FALSE),
+	m_bGovernor (FALSE),
+	m_hGovernorTimer (0),
+	m_pIdleTimeHandler (0),
+	m_pIdleTimeParam (0),
+	m_nGovernorCores (0),
+	m_nGovernorLoad (0),
+	m_bOverTemperature (FALSE)
 {
 	assert (s_pThis == 0);
 	s_pThis = this;
@@ -67,20 +76,29 @@ CCPUThrottle::CCPUThrottle (TCPUSpeed InitialSpeed)
 
 	m_nEnforcedTemperature = CKernelOptions::Get ()->GetSoCMaxTemp () * 1000;
 
-	m_nMinClockRate = GetClockRate (PROPTAG_GET_MIN_CLOCK_RATE);
-	if (m_nMinClockRate == 0)
-	{
-		return;
-	}
-
-	m_nMaxClockRate = GetClockRate (PROPTAG_GET_MAX_CLOCK_RATE);
-	if (m_nMaxClockRate == 0)
+	// get the fixed values with one mailbox call
+	CBcmPropertyTags Tags;
+	TPropertyTagClockRate TagMinClockRate;
+	TagMinClockRate.nClockId = CLOCK_ID_ARM;
+	TPropertyTagClockRate TagMaxClockRate;
+	TagMaxClockRate.nClockId = CLOCK_ID_ARM;
+	TPropertyTagTemperature TagMaxTemperature;
+	TagMaxTemperature.nTemperatureId = TEMPERATURE_ID;
+	Tags.BeginBatch ();
+	Tags.AddTag (PROPTAG_GET_MIN_CLOCK_RATE, &TagMinClockRate, sizeof TagMinClockRate, 4);
+	Tags.AddTag (PROPTAG_GET_MAX_CLOCK_RATE, &TagMaxClockRate, sizeof TagMaxClockRate, 4);
+	Tags.AddTag (PROPTAG_GET_MAX_TEMPERATURE, &TagMaxTemperature, sizeof TagMaxTemperature, 4);
+	if (!Tags.SubmitBatch ())
 	{
 		return;
 	}
 
-	m_nMaxTemperature = GetTemperature (PROPTAG_GET_MAX_TEMPERATURE);
-	if (m_nMaxTemperature == 0)
+	m_nMinClockRate = TagMinClockRate.nRate;
+	m_nMaxClockRate = TagMaxClockRate.nRate;
+	m_nMaxTemperature = TagMaxTemperature.nValue;
+	if (   m_nMinClockRate == 0
+	    || m_nMaxClockRate == 0
+	    || m_nMaxTemperature == 0)
 	{
 		return;
 	}
@@ -99,6 +117,16 @@ CCPUThrottle::CCPUThrottle (TCPUSpeed InitialSpeed)
 
 CCPUThrottle::~CCPUThrottle (void)
 {
+	CancelGovernor ();
+
+	while (   m_bAsyncPending
+	       && m_AsyncTags.PollBatch () == PropertyTagsStatusBusy)
+	{
+		// wait for completion
+	}
+
+	m_bAsyncPending = FALSE;
+
 	m_pThrottledHandler = 0;
 
 	if (m_bFanConnected)
@@ -153,6 +181,8 @@ TCPUSpeed CCPUThrottle::SetSpeed (TCPUSpeed Speed, boolean bWait)
 		return CPUSpeedMaximum;
 	}
 
+	CancelGovernor ();		// an explicit speed request overrides the governor
+
 	if (!SetSpeedInternal (Speed, bWait))
 	{
 		return CPUSpeedUnknown;
@@ -166,20 +196,44 @@ TCPUSpeed CCPUThrottle::SetSpeed (TCPUSpeed Speed, boolean bWait)
 
 boolean CCPUThrottle::SetOnTemperature (void)
 {
-	if (m_bFanConnected)
+	if (   !m_bFanConnected
+	    && !m_bDynamic)
 	{
-		unsigned nTemperature = GetTemperature (PROPTAG_GET_TEMPERATURE);
-		if (nTemperature == 0)
-		{
-			return FALSE;
-		}
+		return TRUE;
+	}
 
-		assert (40000 <= m_nEnforcedTemperature);
-		if (m_nEnforcedTemperature > m_nMaxTemperature)
-		{
-			m_nEnforcedTemperature = m_nMaxTemperature;
-		}
+	// get both values with one mailbox call
+	CBcmPropertyTags Tags;
+	TPropertyTagClockRate TagClockRate;
+	TagClockRate.nClockId = CLOCK_ID_ARM;
+	TPropertyTagTemperature TagTemperature;
+	TagTemperature.nTemperatureId = TEMPERATURE_ID;
+	Tags.BeginBatch ();
+	Tags.AddTag (PROPTAG_GET_CLOCK_RATE, &TagClockRate, sizeof TagClockRate, 4);
+	Tags.AddTag (PROPTAG_GET_TEMPERATURE, &TagTemperature, sizeof TagTemperature, 4);
+	if (!Tags.SubmitBatch ())
+	{
+		return FALSE;
+	}
+
+	return SetOnTemperature (TagTemperature.nValue, TagClockRate.nRate);
+}
 
+boolean CCPUThrottle::SetOnTemperature (unsigned nTemperature, unsigned nCurrentRate)
+{
+	if (nTemperature == 0)
+	{
+		return FALSE;
+	}
+
+	assert (40000 <= m_nEnforcedTemperature);
+	if (m_nEnforcedTemperature > m_nMaxTemperature)
+	{
+		m_nEnforcedTemperature = m_nMaxTemperature;
+	}
+
+	if (m_bFanConnected)
+	{
 		if (nTemperature > m_nEnforcedTemperature)
 		{
 			m_FanPin.Write (HIGH);
@@ -197,22 +251,24 @@ boolean CCPUThrottle::SetOnTemperature (void)
 		return TRUE;
 	}
 
-	unsigned nCurrentRate = GetClockRate (PROPTAG_GET_CLOCK_RATE);
 	if (nCurrentRate == 0)
 	{
 		return FALSE;
 	}
 
-	unsigned nTemperature = GetTemperature (PROPTAG_GET_TEMPERATURE);
-	if (nTemperature == 0)
+	if (m_bGovernor)
 	{
-		return FALSE;
-	}
+		// the governor selects the minimum rate, while this is set
+		if (nTemperature > m_nEnforcedTemperature)
+		{
+			m_bOverTemperature = TRUE;
+		}
+		else if (nTemperature < (m_nEnforcedTemperature-3000))	// 3 degrees hysteresis
+		{
+			m_bOverTemperature = FALSE;
+		}
 
-	assert (40000 <= m_nEnforcedTemperature);
-	if (m_nEnforcedTemperature > m_nMaxTemperature)
-	{
-		m_nEnforcedTemperature = m_nMaxTemperature;
+		return TRUE;
 	}
 
 	if (   nTemperature > m_nEnforcedTemperature
@@ -240,14 +296,28 @@ boolean CCPUThrottle::Update (void)
 {
 	boolean bOK = TRUE;
 
+	if (m_bGovernor)
+	{
+		bOK = ApplyGovernorRate ();
+	}
+
+	if (m_bAsyncPending)
+	{
+		return CompleteAsyncUpdate () && bOK;
+	}
+
 	unsigned nTicks = CTimer::GetClockTicks ();
 	if (nTicks - m_nTicksLastUpdate >= 4*CLOCKHZ)			// call this every 4 seconds
 	{
-		bOK = SetOnTemperature ();
-
-		if (m_pThrottledHandler != 0)
+		if (!StartAsyncUpdate ())
 		{
-			bOK = CheckThrottledState () && bOK;
+			// another asynchronous request is pending in the system
+			bOK = SetOnTemperature ();
+
+			if (m_pThrottledHandler != 0)
+			{
+				bOK = CheckThrottledState () && bOK;
+			}
 		}
 
 		m_nTicksLastUpdate = nTicks;
@@ -269,6 +339,70 @@ void CCPUThrottle::RegisterSystemThrottledHandler (unsigned StateMask,
 	m_pThrottledParam = pParam;
 }
 
+boolean CCPUThrottle::StartGovernor (TCPUIdleTimeHandler *pIdleTimeHandler, void *pParam,
+				     unsigned nCores)
+{
+	if (   !m_bDynamic
+	    || m_bFanConnected)
+	{
+		return FALSE;
+	}
+
+	assert (!m_bGovernor);
+	assert (m_hGovernorTimer == 0);
+
+	m_pIdleTimeHandler = pIdleTimeHandler;
+	assert (m_pIdleTimeHandler != 0);
+	m_pIdleTimeParam = pParam;
+
+	assert (1 <= nCores && nCores <= CORES);
+	m_nGovernorCores = nCores;
+
+	for (unsigned nCore = 0; nCore < m_nGovernorCores; nCore++)
+	{
+		m_nLastIdleTime[nCore] = (*m_pIdleTimeHandler) (nCore, m_pIdleTimeParam);
+	}
+
+	m_nGovernorTicks = CTimer::GetClockTicks ();
+
+	m_nSustainedRate = m_nMinClockRate + (m_nMaxClockRate - m_nMinClockRate) / 2;
+	m_nSustainedRate -= (m_nSustainedRate - m_nMinClockRate) % CPU_GOVERNOR_STEP;
+
+	m_nGovernorRate = m_SpeedSet == CPUSpeedMaximum ? m_nMaxClockRate : m_nMinClockRate;
+	m_nGovernorRateSet = m_nGovernorRate;
+	m_nGovernorLoad = 0;
+	m_nDownPeriods = 0;
+	m_nBoostBudget = CPU_GOVERNOR_BOOST_MSECS * 1000;
+	m_bOverTemperature = FALSE;
+
+	m_bGovernor = TRUE;
+
+	m_hGovernorTimer = CTimer::Get ()->StartKernelTimer (MSEC2HZ (CPU_GOVERNOR_PERIOD_MSECS),
+							     GovernorHandler, this);
+
+	return TRUE;
+}
+
+void CCPUThrottle::StopGovernor (void)
+{
+	if (!m_bGovernor)
+	{
+		return;
+	}
+
+	CancelGovernor ();
+
+	if (m_SpeedSet != CPUSpeedUnknown)
+	{
+		SetSpeedInternal (m_SpeedSet, FALSE);
+	}
+}
+
+unsigned CCPUThrottle::GetGovernorLoad (void) const
+{
+	return m_nGovernorLoad;
+}
+
 void CCPUThrottle::DumpStatus (boolean bAll)
 {
 	CLogger *pLogger = CLogger::Get ();
@@ -297,6 +431,12 @@ void CCPUThrottle::DumpStatus (boolean bAll)
 			GetClockRate () / 1000000);
 
 	pLogger->Write (FromCPUThrottle, LogDebug, "Current temperature is %uC", GetTemperature ());
+
+	if (m_bGovernor)
+	{
+		pLogger->Write (FromCPUThrottle, LogDebug, "Governor load is %u%%, boost budget %u ms",
+				m_nGovernorLoad, m_nBoostBudget / 1000);
+	}
 }
 
 CCPUThrottle *CCPUThrottle::Get (void)
@@ -355,21 +495,108 @@ boolean CCPUThrottle::CheckThrottledState (void)
 		return FALSE;
 	}
 
-	TagGetThrottled.nValue &= m_ThrottledStateMask;
+	CheckThrottledState (TagGetThrottled.nValue);
+
+	return TRUE;
+}
+
+void CCPUThrottle::CheckThrottledState (u32 nState)
+{
+	nState &= m_ThrottledStateMask;
 
-	if (   TagGetThrottled.nValue != 0
-	    && TagGetThrottled.nValue != m_LastThrottledState)
+	if (   nState != 0
+	    && nState != m_LastThrottledState)
 	{
 		assert (m_pThrottledHandler != 0);
-		(*m_pThrottledHandler) ((TSystemThrottledState) TagGetThrottled.nValue,
-					m_pThrottledParam);
+		(*m_pThrottledHandler) ((TSystemThrottledState) nState, m_pThrottledParam);
+	}
+
+	m_LastThrottledState = (TSystemThrottledState) nState;
+}
+
+boolean CCPUThrottle::StartAsyncUpdate (void)
+{
+	assert (!m_bAsyncPending);
+
+	if (   !m_bFanConnected
+	    && !m_bDynamic
+	    && m_pThrottledHandler == 0)
+	{
+		return TRUE;			// nothing to do
 	}
 
-	m_LastThrottledState = (TSystemThrottledState) TagGetThrottled.nValue;
+	m_AsyncTags.BeginBatch ();
+
+	if (   m_bFanConnected
+	    || m_bDynamic)
+	{
+		m_TagClockRate.nClockId = CLOCK_ID_ARM;
+		m_AsyncTags.AddTag (PROPTAG_GET_CLOCK_RATE, &m_TagClockRate, sizeof m_TagClockRate, 4);
+
+		m_TagTemperature.nTemperatureId = TEMPERATURE_ID;
+		m_AsyncTags.AddTag (PROPTAG_GET_TEMPERATURE, &m_TagTemperature,
+				    sizeof m_TagTemperature, 4);
+	}
+
+	if (m_pThrottledHandler != 0)
+	{
+		m_TagThrottled.nValue = 0xFFFF;
+		m_AsyncTags.AddTag (PROPTAG_GET_THROTTLED, &m_TagThrottled, sizeof m_TagThrottled, 4);
+	}
+
+	if (!m_AsyncTags.SubmitBatchAsync ())
+	{
+		return FALSE;
+	}
+
+	m_bAsyncPending = TRUE;
 
 	return TRUE;
 }
 
+boolean CCPUThrottle::CompleteAsyncUpdate (void)
+{
+	assert (m_bAsyncPending);
+
+	TPropertyTagsStatus Status = m_AsyncTags.PollBatch ();
+	if (Status == PropertyTagsStatusBusy)
+	{
+		return TRUE;
+	}
+
+	m_bAsyncPending = FALSE;
+
+	if (Status == PropertyTagsStatusError)
+	{
+		return FALSE;
+	}
+
+	boolean bOK = TRUE;
+
+	if (   m_bFanConnected
+	    || m_bDynamic)
+	{
+		bOK = SetOnTemperature (  m_TagTemperature.Tag.nValueLength != 0
+					? m_TagTemperature.nValue : 0,
+					  m_TagClockRate.Tag.nValueLength != 0
+					? m_TagClockRate.nRate : 0);
+	}
+
+	if (m_pThrottledHandler != 0)
+	{
+		if (m_TagThrottled.Tag.nValueLength != 0)
+		{
+			CheckThrottledState (m_TagThrottled.nValue);
+		}
+		else
+		{
+			bOK = FALSE;
+		}
+	}
+
+	return bOK;
+}
+
 void CCPUThrottle::SetToSetDelay (void)
 {
 	unsigned nUsecElapsed = (CTimer::GetClockTicks () - m_nTicksLastSet) * (CLOCKHZ / 1000000);
@@ -417,3 +644,152 @@ boolean CCPUThrottle::SetClockRate (unsigned nRate, boolean bSkipTurbo)
 	TagSetClockRate.nSkipSettingTurbo = bSkipTurbo ? SKIP_SETTING_TURBO : 0;
 	return Tags.GetTag (PROPTAG_SET_CLOCK_RATE, &TagSetClockRate, sizeof TagSetClockRate, 12);
 }
+
+void CCPUThrottle::CancelGovernor (void)
+{
+	EnterCritical (IRQ_LEVEL);
+
+	m_bGovernor = FALSE;
+
+	if (m_hGovernorTimer != 0)
+	{
+		CTimer::Get ()->CancelKernelTimer (m_hGovernorTimer);
+		m_hGovernorTimer = 0;
+	}
+
+	LeaveCritical ();
+}
+
+boolean CCPUThrottle::ApplyGovernorRate (void)
+{
+	unsigned nRate = m_nGovernorRate;
+	if (nRate == m_nGovernorRateSet)
+	{
+		return TRUE;
+	}
+
+	SetToSetDelay ();
+
+	if (!SetClockRate (nRate, FALSE))
+	{
+		return FALSE;
+	}
+
+	m_nGovernorRateSet = nRate;
+
+	return TRUE;
+}
+
+void CCPUThrottle::GovernorStep (void)
+{
+	unsigned nTicks = CTimer::GetClockTicks ();
+	unsigned nElapsed = (nTicks - m_nGovernorTicks) * (CLOCKHZ / 1000000);	// microseconds
+	m_nGovernorTicks = nTicks;
+	if (nElapsed == 0)
+	{
+		return;
+	}
+
+	// the load of the busiest core counts
+	unsigned nMinIdle = nElapsed;
+	for (unsigned nCore = 0; nCore < m_nGovernorCores; nCore++)
+	{
+		u64 nIdleTime = (*m_pIdleTimeHandler) (nCore, m_pIdleTimeParam);
+		u64 nIdle = nIdleTime - m_nLastIdleTime[nCore];
+		m_nLastIdleTime[nCore] = nIdleTime;
+
+		if (nIdle < nMinIdle)
+		{
+			nMinIdle = (unsigned) nIdle;
+		}
+	}
+
+	unsigned nLoad = 100 - (unsigned) ((u64) nMinIdle * 100 / nElapsed);
+	m_nGovernorLoad = nLoad;
+
+	// thermal budget: time above the sustained rate is consumed, time below is refilled
+	unsigned nRate = m_nGovernorRate;
+	if (nRate > m_nSustainedRate)
+	{
+		m_nBoostBudget -= nElapsed < m_nBoostBudget ? nElapsed : m_nBoostBudget;
+	}
+	else
+	{
+		m_nBoostBudget += nElapsed / 2;
+		if (m_nBoostBudget > CPU_GOVERNOR_BOOST_MSECS * 1000)
+		{
+			m_nBoostBudget = CPU_GOVERNOR_BOOST_MSECS * 1000;
+		}
+	}
+
+	unsigned nTarget;
+	if (nLoad >= CPU_GOVERNOR_UP_THRESHOLD)
+	{
+		nTarget = m_nMaxClockRate;		// burst, go up at once
+		m_nDownPeriods = 0;
+	}
+	else
+	{
+		// lowest rate, which keeps the load below the threshold with some headroom
+		nTarget = (unsigned) (  (u64) nRate * nLoad
+				      / (CPU_GOVERNOR_UP_THRESHOLD - CPU_GOVERNOR_HEADROOM));
+		if (nTarget < m_nMinClockRate)
+		{
+			nTarget = m_nMinClockRate;
+		}
+
+		nTarget += CPU_GOVERNOR_STEP-1 - (nTarget - m_nMinClockRate + CPU_GOVERNOR_STEP-1)
+							% CPU_GOVERNOR_STEP;
+		if (nTarget > m_nMaxClockRate)
+		{
+			nTarget = m_nMaxClockRate;
+		}
+
+		if (nTarget < nRate)
+		{
+			if (++m_nDownPeriods < CPU_GOVERNOR_DOWN_PERIODS)
+			{
+				nTarget = nRate;
+			}
+			else
+			{
+				m_nDownPeriods = 0;
+			}
+		}
+		else
+		{
+			m_nDownPeriods = 0;
+		}
+	}
+
+	if (   m_nBoostBudget == 0
+	    && nTarget > m_nSustainedRate)
+	{
+		nTarget = m_nSustainedRate;
+	}
+
+	if (m_bOverTemperature)
+	{
+		nTarget = m_nMinClockRate;
+	}
+
+	m_nGovernorRate = nTarget;
+}
+
+void CCPUThrottle::GovernorHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext)
+{
+	CCPUThrottle *pThis = (CCPUThrottle *) pParam;
+	assert (pThis != 0);
+
+	if (!pThis->m_bGovernor)
+	{
+		pThis->m_hGovernorTimer = 0;
+
+		return;
+	}
+
+	pThis->GovernorStep ();
+
+	pThis->m_hGovernorTimer = CTimer::Get ()->StartKernelTimer (
+					MSEC2HZ (CPU_GOVERNOR_PERIOD_MSECS), GovernorHandler, pThis);
+}
@@ -0,0 +1,177 @@
+//
+// crc32.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/crc32.h>
+#include <assert.h>
+
+#ifdef __ARM_FEATURE_CRC32
+
+#include <arm_acle.h>
+
+void CCRC32::Update (const void *pBuffer, size_t nLength)
+{
+	assert (pBuffer != 0 || nLength == 0);
+
+	const u8 *p = (const u8 *) pBuffer;
+	u32 nCRC = m_nCRC;
+
+	if (m_Variant == CRC32IEEE)
+	{
+		for (; nLength > 0 && ((uintptr) p & 7); nLength--)
+		{
+			nCRC = __crc32b (nCRC, *p++);
+		}
+
+#if AARCH == 64
+		for (; nLength >= 8; nLength -= 8, p += 8)
+		{
+			nCRC = __crc32d (nCRC, *(const u64 *) p);
+		}
+#else
+		for (; nLength >= 4; nLength -= 4, p += 4)
+		{
+			nCRC = __crc32w (nCRC, *(const u32 *) p);
+		}
+#endif
+
+		for (; nLength > 0; nLength--)
+		{
+			nCRC = __crc32b (nCRC, *p++);
+		}
+	}
+	else
+	{
+		assert (m_Variant == CRC32C);
+
+		for (; nLength > 0 && ((uintptr) p & 7); nLength--)
+		{
+			nCRC = __crc32cb (nCRC, *p++);
+		}
+
+#if AARCH == 64
+		for (; nLength >= 8; nLength -= 8, p += 8)
+		{
+			nCRC = __crc32cd (nCRC, *(const u64 *) p);
+		}
+#else
+		for (; nLength >= 4; nLength -= 4, p += 4)
+		{
+			nCRC = __crc32cw (nCRC, *(const u32 *) p);
+		}
+#endif
+
+		for (; nLength > 0; nLength--)
+		{
+			nCRC = __crc32cb (nCRC, *p++);
+		}
+	}
+
+	m_nCRC = nCRC;
+}
+
+#else
+
+u32 CCRC32::s_Table[CRC32Unknown][8][256];
+volatile boolean CCRC32::s_bTableValid[CRC32Unknown] = {FALSE};
+
+void CCRC32::Update (const void *pBuffer, size_t nLength)
+{
+	assert (pBuffer != 0 || nLength == 0);
+
+	const u8 *p = (const u8 *) pBuffer;
+	u32 nCRC = m_nCRC;
+
+	const u32 (*pTable)[256] = (const u32 (*)[256]) GetTable (m_Variant);
+
+	for (; nLength > 0 && ((uintptr) p & 3); nLength--)
+	{
+		nCRC = pTable[0][(nCRC ^ *p++) & 0xFF] ^ (nCRC >> 8);
+	}
+
+	// slice-by-8, processes two aligned words per step (little endian)
+	for (; nLength >= 8; nLength -= 8, p += 8)
+	{
+		u32 nLow = ((const u32 *) p)[0] ^ nCRC;
+		u32 nHigh = ((const u32 *) p)[1];
+
+		nCRC =   pTable[7][nLow & 0xFF]
+		       ^ pTable[6][(nLow >> 8) & 0xFF]
+		       ^ pTable[5][(nLow >> 16) & 0xFF]
+		       ^ pTable[4][nLow >> 24]
+		       ^ pTable[3][nHigh & 0xFF]
+		       ^ pTable[2][(nHigh >> 8) & 0xFF]
+		       ^ pTable[1][(nHigh >> 16) & 0xFF]
+		       ^ pTable[0][nHigh >> 24];
+	}
+
+	for (; nLength > 0; nLength--)
+	{
+		nCRC = pTable[0][(nCRC ^ *p++) & 0xFF] ^ (nCRC >> 8);
+	}
+
+	m_nCRC = nCRC;
+}
+
+const u32 *CCRC32::GetTable (TCRC32Variant Variant)
+{
+	assert (Variant < CRC32Unknown);
+	u32 (*pTable)[256] = s_Table[Variant];
+
+	if (s_bTableValid[Variant])
+	{
+		return &pTable[0][0];
+	}
+
+	// reflected polynomials, building the table twice concurrently does not harm
+	u32 nPolynomial = Variant == CRC32IEEE ? 0xEDB88320U : 0x82F63B78U;
+
+	for (unsigned i = 0; i < 256; i++)
+	{
+		u32 nCRC = i;
+		for (unsigned j = 0; j < 8; j++)
+		{
+			nCRC = nCRC & 1 ? (nCRC >> 1) ^ nPolynomial : nCRC >> 1;
+		}
+
+		pTable[0][i] = nCRC;
+	}
+
+	for (unsigned i = 0; i < 256; i++)
+	{
+		for (unsigned k = 1; k < 8; k++)
+		{
+			u32 nCRC = pTable[k-1][i];
+			pTable[k][i] = pTable[0][nCRC & 0xFF] ^ (nCRC >> 8);
+		}
+	}
+
+	s_bTableValid[Variant] = TRUE;
+
+	return &pTable[0][0];
+}
+
+#endif
+
+u32 CCRC32::Calculate (const void *pBuffer, size_t nLength, TCRC32Variant Variant)
+{
+	CCRC32 CRC (Variant);
+	CRC.Update (pBuffer, nLength);
+
+	return CRC.Get ();
+}
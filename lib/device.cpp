@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/device.h>
+#include <assert.h>
 
 CDevice::CDevice (void)
 :	m_pRemovedHandler (0)
@@ -49,11 +50,33 @@ u64 CDevice::Seek (u64 ullOffset)
 	return (u64) -1;
 }
 
+u64 CDevice::GetSize (void) const
+{
+	return (u64) -1;
+}
+
 boolean CDevice::RemoveDevice (void)
 {
 	return FALSE;
 }
 
+boolean CDevice::SubmitRequest (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+
+	int nResult = -1;
+	if (Seek (pRequest->GetOffset ()) == pRequest->GetOffset ())
+	{
+		nResult =   pRequest->IsWrite ()
+			  ? Write (pRequest->GetBuffer (), pRequest->GetCount ())
+			  : Read (pRequest->GetBuffer (), pRequest->GetCount ());
+	}
+
+	pRequest->Complete (nResult);
+
+	return TRUE;
+}
+
 void CDevice::RegisterRemovedHandler (TDeviceRemovedHandler *pHandler, void *pContext)
 {
 	m_pRemovedContext = pContext;
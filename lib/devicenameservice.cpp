@@ -2,7 +2,7 @@
 // devicenameservice.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -26,8 +26,19 @@ CDeviceNameService *CDeviceNameService::s_This = 0;
 
 CDeviceNameService::CDeviceNameService (void)
 :	m_pList (0),
+	m_nGeneration (0),
 	m_SpinLock (TASK_LEVEL)
 {
+	for (unsigned i = 0; i < DEVICE_NAME_HASH_SIZE; i++)
+	{
+		m_pHashBucket[i] = 0;
+	}
+
+	for (unsigned i = 0; i < DEVICE_NAME_MAX_HANDLERS; i++)
+	{
+		m_RemovedHandler[i].pHandler = 0;
+	}
+
 	assert (s_This == 0);
 	s_This = this;
 }
@@ -51,8 +62,6 @@ CDeviceNameService::~CDeviceNameService (void)
 
 void CDeviceNameService::AddDevice (const char *pName, CDevice *pDevice, boolean bBlockDevice)
 {
-	m_SpinLock.Acquire ();
-
 	TDeviceInfo *pInfo = new TDeviceInfo;
 	assert (pInfo != 0);
 
@@ -65,10 +74,19 @@ void CDeviceNameService::AddDevice (const char *pName, CDevice *pDevice, boolean
 	pInfo->pDevice = pDevice;
 	
 	pInfo->bBlockDevice = bBlockDevice;
+	pInfo->nHash = Hash (pName, "", bBlockDevice);
+
+	m_SpinLock.Acquire ();
 
 	pInfo->pNext = m_pList;
 	m_pList = pInfo;
 
+	TDeviceInfo **ppBucket = &m_pHashBucket[pInfo->nHash & (DEVICE_NAME_HASH_SIZE-1)];
+	pInfo->pHashNext = *ppBucket;
+	*ppBucket = pInfo;
+
+	m_nGeneration++;
+
 	m_SpinLock.Release ();
 }
 
@@ -87,39 +105,40 @@ void CDeviceNameService::RemoveDevice (const char *pName, boolean bBlockDevice)
 
 	m_SpinLock.Acquire ();
 
-	TDeviceInfo *pInfo = m_pList;
-	TDeviceInfo *pPrev = 0;
-	while (pInfo != 0)
-	{
-		assert (pInfo->pName != 0);
-		if (   strcmp (pName, pInfo->pName) == 0
-		    && pInfo->bBlockDevice == bBlockDevice)
-		{
-			break;
-		}
-
-		pPrev = pInfo;
-		pInfo = pInfo->pNext;
-	}
-
-	if (pInfo == 0)
+	TDeviceInfo **ppInfo = Find (pName, "", bBlockDevice);
+	if (ppInfo == 0)
 	{
 		m_SpinLock.Release ();
 
 		return;
 	}
 
-	if (pPrev == 0)
-	{
-		m_pList = pInfo->pNext;
-	}
-	else
+	TDeviceInfo *pInfo = *ppInfo;
+	assert (pInfo != 0);
+	*ppInfo = pInfo->pHashNext;
+
+	TDeviceInfo **ppPrev = &m_pList;
+	while (*ppPrev != pInfo)
 	{
-		pPrev->pNext = pInfo->pNext;
+		assert (*ppPrev != 0);
+		ppPrev = &(*ppPrev)->pNext;
 	}
 
+	*ppPrev = pInfo->pNext;
+
+	m_nGeneration++;
+
 	m_SpinLock.Release ();
 
+	for (unsigned i = 0; i < DEVICE_NAME_MAX_HANDLERS; i++)
+	{
+		TDeviceRemovedHandler *pHandler = m_RemovedHandler[i].pHandler;
+		if (pHandler != 0)
+		{
+			(*pHandler) (pInfo->pDevice, m_RemovedHandler[i].pContext);
+		}
+	}
+
 	delete [] pInfo->pName;
 	pInfo->pName = 0;
 	pInfo->pDevice = 0;
@@ -140,35 +159,81 @@ CDevice *CDeviceNameService::GetDevice (const char *pName, boolean bBlockDevice)
 
 	m_SpinLock.Acquire ();
 
-	TDeviceInfo *pInfo = m_pList;
-	while (pInfo != 0)
+	CDevice *pResult = 0;
+
+	TDeviceInfo **ppInfo = Find (pName, "", bBlockDevice);
+	if (ppInfo != 0)
 	{
-		assert (pInfo->pName != 0);
-		if (   strcmp (pName, pInfo->pName) == 0
-		    && pInfo->bBlockDevice == bBlockDevice)
+		pResult = (*ppInfo)->pDevice;
+		assert (pResult != 0);
+	}
+
+	m_SpinLock.Release ();
+
+	return pResult;
+}
+
+CDevice *CDeviceNameService::GetDevice (const char *pPrefix, unsigned nIndex, boolean bBlockDevice)
+{
+	assert (pPrefix != 0);
+
+	char Index[12];
+	FormatIndex (nIndex, Index);
+
+	m_SpinLock.Acquire ();
+
+	CDevice *pResult = 0;
+
+	TDeviceInfo **ppInfo = Find (pPrefix, Index, bBlockDevice);
+	if (ppInfo != 0)
+	{
+		pResult = (*ppInfo)->pDevice;
+		assert (pResult != 0);
+	}
+
+	m_SpinLock.Release ();
+
+	return pResult;
+}
+
+boolean CDeviceNameService::RegisterRemovedHandler (TDeviceRemovedHandler *pHandler, void *pContext)
+{
+	assert (pHandler != 0);
+
+	m_SpinLock.Acquire ();
+
+	for (unsigned i = 0; i < DEVICE_NAME_MAX_HANDLERS; i++)
+	{
+		if (m_RemovedHandler[i].pHandler == 0)
 		{
-			CDevice *pResult = pInfo->pDevice;
+			m_RemovedHandler[i].pContext = pContext;
+			m_RemovedHandler[i].pHandler = pHandler;
 
 			m_SpinLock.Release ();
 
-			assert (pResult != 0);
-			return pResult;
+			return TRUE;
 		}
-
-		pInfo = pInfo->pNext;
 	}
 
 	m_SpinLock.Release ();
 
-	return 0;
+	return FALSE;
 }
 
-CDevice *CDeviceNameService::GetDevice (const char *pPrefix, unsigned nIndex, boolean bBlockDevice)
+void CDeviceNameService::UnregisterRemovedHandler (TDeviceRemovedHandler *pHandler, void *pContext)
 {
-	CString Name;
-	Name.Format ("%s%u", pPrefix, nIndex);
+	m_SpinLock.Acquire ();
 
-	return GetDevice (Name, bBlockDevice);
+	for (unsigned i = 0; i < DEVICE_NAME_MAX_HANDLERS; i++)
+	{
+		if (   m_RemovedHandler[i].pHandler == pHandler
+		    && m_RemovedHandler[i].pContext == pContext)
+		{
+			m_RemovedHandler[i].pHandler = 0;
+		}
+	}
+
+	m_SpinLock.Release ();
 }
 
 void CDeviceNameService::ListDevices (CDevice *pTarget)
@@ -204,3 +269,73 @@ CDeviceNameService *CDeviceNameService::Get (void)
 	assert (s_This != 0);
 	return s_This;
 }
+
+// returns the link, which points to the entry, or 0 if not found
+// the name is the concatenation of pPrefix and pSuffix
+TDeviceInfo **CDeviceNameService::Find (const char *pPrefix, const char *pSuffix,
+					boolean bBlockDevice)
+{
+	assert (pPrefix != 0);
+	assert (pSuffix != 0);
+
+	u32 nHash = Hash (pPrefix, pSuffix, bBlockDevice);
+	size_t nPrefixLen = strlen (pPrefix);
+
+	TDeviceInfo **ppInfo = &m_pHashBucket[nHash & (DEVICE_NAME_HASH_SIZE-1)];
+	while (*ppInfo != 0)
+	{
+		TDeviceInfo *pInfo = *ppInfo;
+		assert (pInfo->pName != 0);
+
+		if (   pInfo->nHash == nHash
+		    && pInfo->bBlockDevice == bBlockDevice
+		    && strncmp (pInfo->pName, pPrefix, nPrefixLen) == 0
+		    && strcmp (pInfo->pName + nPrefixLen, pSuffix) == 0)
+		{
+			return ppInfo;
+		}
+
+		ppInfo = &pInfo->pHashNext;
+	}
+
+	return 0;
+}
+
+// FNV-1a hash over the concatenated name
+u32 CDeviceNameService::Hash (const char *pPrefix, const char *pSuffix, boolean bBlockDevice)
+{
+	u32 nHash = 2166136261U;
+
+	for (const char *p = pPrefix; *p != '\0'; p++)
+	{
+		nHash = (nHash ^ (u8) *p) * 16777619U;
+	}
+
+	for (const char *p = pSuffix; *p != '\0'; p++)
+	{
+		nHash = (nHash ^ (u8) *p) * 16777619U;
+	}
+
+	return nHash ^ (bBlockDevice ? 1 : 0);
+}
+
+// same as CString::Format ("%u"), pBuffer must have at least 11 characters
+void CDeviceNameService::FormatIndex (unsigned nIndex, char *pBuffer)
+{
+	char Digits[10];
+	unsigned nDigits = 0;
+	do
+	{
+		assert (nDigits < sizeof Digits);
+		Digits[nDigits++] = '0' + nIndex % 10;
+		nIndex /= 10;
+	}
+	while (nIndex != 0);
+
+	while (nDigits > 0)
+	{
+		*pBuffer++ = Digits[--nDigits];
+	}
+
+	*pBuffer = '\0';
+}
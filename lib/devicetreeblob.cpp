@@ -6,7 +6,7 @@
 //		download/v0.3/devicetree-specification-v0.3.pdf
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -31,6 +31,11 @@
 
 #define DTB_ALIGN(n)		(((n) + 3) & ~3)
 
+#define DTB_MAX_DEPTH		32
+
+#define FNV_OFFSET_BASIS	2166136261U	// FNV-1a hash
+#define FNV_PRIME		16777619U
+
 // all values big endian
 
 struct TDeviceTreeBlobHeader
@@ -84,10 +89,33 @@ union TDeviceTreePiece
 }
 PACKED;
 
+struct TDeviceTreeNodeIndex
+{
+	const TDeviceTreeNode	*pNode;
+	int			 nParent;	// -1 for root node
+	u32			 nPathHash;	// of the full path ("" for root node)
+};
+
 static const char From[] = "dtb";
 
+static u32 HashPath (u32 nHash, const char *pString, size_t nLen)
+{
+	while (nLen--)
+	{
+		nHash ^= (u8) *pString++;
+		nHash *= FNV_PRIME;
+	}
+
+	return nHash;
+}
+
 CDeviceTreeBlob::CDeviceTreeBlob (const void *pBuffer)
-:	m_pFTD (0)
+:	m_pFTD (0),
+	m_bIndexed (FALSE),
+	m_pIndex (0),
+	m_nNodes (0),
+	m_pPathMap (0),
+	m_pPhandleMap (0)
 {
 	const TDeviceTreeBlobHeader *pHeader = (const TDeviceTreeBlobHeader *) pBuffer;
 	if (   pHeader == 0
@@ -115,6 +143,15 @@ CDeviceTreeBlob::CDeviceTreeBlob (const void *pBuffer)
 
 CDeviceTreeBlob::~CDeviceTreeBlob (void)
 {
+	delete m_pPhandleMap;
+	m_pPhandleMap = 0;
+
+	delete m_pPathMap;
+	m_pPathMap = 0;
+
+	delete [] m_pIndex;
+	m_pIndex = 0;
+
 	delete [] m_pFTD;
 	m_pFTD = 0;
 }
@@ -122,9 +159,38 @@ CDeviceTreeBlob::~CDeviceTreeBlob (void)
 const TDeviceTreeNode *CDeviceTreeBlob::FindNode (const char *pPath,
 						  const TDeviceTreeNode *pNode) const
 {
+	const TDeviceTreeNode *pResult = FindNodeIndexed (pPath, pNode);
+	if (pResult != 0)
+	{
+		return pResult;
+	}
+
+	// not an exact path, walk the tree
 	return FindNodeInternal (pPath, pNode, 0);
 }
 
+const TDeviceTreeNode *CDeviceTreeBlob::FindNodeByPhandle (u32 nPhandle) const
+{
+	if (!m_bIndexed)
+	{
+		BuildIndex ();
+	}
+
+	if (m_pPhandleMap == 0)
+	{
+		return 0;
+	}
+
+	const unsigned *pIndex = m_pPhandleMap->Lookup (nPhandle);
+	if (pIndex == 0)
+	{
+		return 0;
+	}
+
+	assert (*pIndex < m_nNodes);
+	return m_pIndex[*pIndex].pNode;
+}
+
 const TDeviceTreeNode *CDeviceTreeBlob::FindNodeInternal (const char *pPath,
 							  const TDeviceTreeNode *pNode,
 							  const TDeviceTreeNode **ppNextNode) const
@@ -359,3 +425,295 @@ u32 CDeviceTreeBlob::GetPropertyValueWord (const TDeviceTreeProperty *pProperty,
 
 	return be2le32 (*((u32 *) pProperty->data + nIndex));
 }
+
+const TDeviceTreeNode *CDeviceTreeBlob::FindNodeIndexed (const char *pPath,
+							 const TDeviceTreeNode *pParentNode) const
+{
+	assert (pPath != 0);
+
+	if (!m_bIndexed)
+	{
+		BuildIndex ();
+	}
+
+	if (m_pPathMap == 0)
+	{
+		return 0;
+	}
+
+	int nParent = -1;
+	u32 nHash = FNV_OFFSET_BASIS;
+	if (pParentNode == 0)
+	{
+		if (pPath[0] != '/')
+		{
+			return 0;
+		}
+	}
+	else
+	{
+		nParent = GetNodeIndex (pParentNode);
+		if (nParent < 0)
+		{
+			return 0;
+		}
+
+		nHash = HashPath (m_pIndex[nParent].nPathHash, "/", 1);
+	}
+
+	size_t nLen = strlen (pPath);
+	if (   nLen > 0
+	    && pPath[nLen-1] == '/')
+	{
+		nLen--;				// ignore trailing slash
+	}
+
+	nHash = HashPath (nHash, pPath, nLen);
+
+	const unsigned *pIndex = m_pPathMap->Lookup (nHash);
+	if (   pIndex == 0
+	    || !MatchPath (*pIndex, pPath, nLen, nParent))	// hash collision?
+	{
+		return 0;
+	}
+
+	return m_pIndex[*pIndex].pNode;
+}
+
+int CDeviceTreeBlob::GetNodeIndex (const TDeviceTreeNode *pNode) const
+{
+	// the nodes are indexed in ascending address order
+	int nLow = 0;
+	int nHigh = (int) m_nNodes - 1;
+	while (nLow <= nHigh)
+	{
+		int nMid = (nLow + nHigh) / 2;
+		if (m_pIndex[nMid].pNode == pNode)
+		{
+			return nMid;
+		}
+
+		if (m_pIndex[nMid].pNode < pNode)
+		{
+			nLow = nMid + 1;
+		}
+		else
+		{
+			nHigh = nMid - 1;
+		}
+	}
+
+	return -1;
+}
+
+boolean CDeviceTreeBlob::MatchPath (unsigned nIndex, const char *pPath, size_t nLen,
+				    int nParent) const
+{
+	// compare the node names from the end of the path up to the parent
+	int i = (int) nIndex;
+	while (i != nParent)
+	{
+		if (i < 0)
+		{
+			return FALSE;
+		}
+
+		const TDeviceTreeNodeIndex *pEntry = &m_pIndex[i];
+		if (pEntry->nParent < 0)		// root node
+		{
+			return nLen == 0 && nParent < 0;
+		}
+
+		const char *pName = (const char *) pEntry->pNode->data;
+		size_t nNameLen = strlen (pName);
+
+		if (   nNameLen > nLen
+		    || memcmp (pPath + nLen - nNameLen, pName, nNameLen) != 0)
+		{
+			return FALSE;
+		}
+
+		nLen -= nNameLen;
+
+		if (pEntry->nParent != nParent)
+		{
+			if (   nLen == 0
+			    || pPath[nLen-1] != '/')
+			{
+				return FALSE;
+			}
+
+			nLen--;
+		}
+
+		i = pEntry->nParent;
+	}
+
+	return nLen == 0;
+}
+
+void CDeviceTreeBlob::BuildIndex (void) const
+{
+	assert (!m_bIndexed);
+	m_bIndexed = TRUE;
+
+	if (m_pFTD == 0)
+	{
+		return;
+	}
+
+	unsigned nNodes = ScanNodes (0);
+	if (nNodes == 0)
+	{
+		CLogger::Get ()->Write (From, LogWarning, "Cannot index DTB");
+
+		return;
+	}
+
+	m_pIndex = new TDeviceTreeNodeIndex[nNodes];
+	if (m_pIndex == 0)
+	{
+		return;
+	}
+
+	m_nNodes = ScanNodes (m_pIndex);
+	assert (m_nNodes == nNodes);
+
+	unsigned nMapSize = 16;
+	while (nMapSize < m_nNodes * 2)
+	{
+		nMapSize <<= 1;
+	}
+
+	m_pPathMap = new CHashMap<u32, unsigned> (nMapSize);
+	assert (m_pPathMap != 0);
+
+	for (unsigned i = 0; i < m_nNodes; i++)
+	{
+		// on a hash collision the first node wins, the other is found by walking the tree
+		if (!m_pPathMap->Contains (m_pIndex[i].nPathHash))
+		{
+			m_pPathMap->Insert (m_pIndex[i].nPathHash, i);
+		}
+	}
+
+	m_pPhandleMap = new CHashMap<u32, unsigned>;
+	assert (m_pPhandleMap != 0);
+
+	// second walk for the phandles, which may follow other properties
+	const TDeviceTreeBlobHeader *pHeader = (const TDeviceTreeBlobHeader *) m_pFTD;
+	const char *pStrings = (const char *) (m_pFTD + be2le32 (pHeader->off_dt_strings));
+
+	for (unsigned i = 0; i < m_nNodes; i++)
+	{
+		const TDeviceTreeNode *pNode = m_pIndex[i].pNode;
+		size_t nLen = sizeof (u32) + DTB_ALIGN (strlen ((const char *) pNode->data) + 1);
+
+		const TDeviceTreePiece *pPiece = (const TDeviceTreePiece *) ((u8 *) pNode + nLen);
+		u32 nToken = be2le32 (pPiece->token);
+		while (   nToken == FDT_PROP
+		       || nToken == FDT_NOP)
+		{
+			if (nToken == FDT_NOP)
+			{
+				nLen = sizeof (u32);
+			}
+			else
+			{
+				const char *pName = pStrings + be2le32 (pPiece->property.nameoff);
+				if (   be2le32 (pPiece->property.len) == sizeof (u32)
+				    && (   strcmp (pName, "phandle") == 0
+					|| strcmp (pName, "linux,phandle") == 0))
+				{
+					m_pPhandleMap->Insert (be2le32 (*(u32 *) pPiece->property.data), i);
+				}
+
+				nLen =   sizeof (TDeviceTreeProperty)
+				       + DTB_ALIGN (be2le32 (pPiece->property.len));
+			}
+
+			pPiece = (const TDeviceTreePiece *) ((u8 *) pPiece + nLen);
+			nToken = be2le32 (pPiece->token);
+		}
+	}
+}
+
+unsigned CDeviceTreeBlob::ScanNodes (TDeviceTreeNodeIndex *pIndex) const
+{
+	assert (m_pFTD != 0);
+	const TDeviceTreeBlobHeader *pHeader = (const TDeviceTreeBlobHeader *) m_pFTD;
+
+	const u8 *pStruct = m_pFTD + be2le32 (pHeader->off_dt_struct);
+	const u8 *pEnd = m_pFTD + be2le32 (pHeader->totalsize);
+
+	int Stack[DTB_MAX_DEPTH];
+	unsigned nDepth = 0;
+	unsigned nNodes = 0;
+
+	const u8 *p = pStruct;
+	while (p + sizeof (u32) <= pEnd)
+	{
+		const TDeviceTreePiece *pPiece = (const TDeviceTreePiece *) p;
+
+		switch (be2le32 (pPiece->token))
+		{
+		case FDT_BEGIN_NODE: {
+			if (nDepth == DTB_MAX_DEPTH)
+			{
+				return 0;
+			}
+
+			const char *pName = (const char *) pPiece->node.data;
+			size_t nNameLen = strlen (pName);
+
+			if (pIndex != 0)
+			{
+				int nParent = nDepth > 0 ? Stack[nDepth-1] : -1;
+
+				pIndex[nNodes].pNode = &pPiece->node;
+				pIndex[nNodes].nParent = nParent;
+
+				if (nParent < 0)
+				{
+					pIndex[nNodes].nPathHash = FNV_OFFSET_BASIS;
+				}
+				else
+				{
+					u32 nHash = HashPath (pIndex[nParent].nPathHash, "/", 1);
+					pIndex[nNodes].nPathHash = HashPath (nHash, pName, nNameLen);
+				}
+			}
+
+			Stack[nDepth++] = nNodes++;
+
+			p += sizeof (u32) + DTB_ALIGN (nNameLen + 1);
+			} break;
+
+		case FDT_END_NODE:
+			if (nDepth == 0)
+			{
+				return 0;
+			}
+
+			nDepth--;
+			p += sizeof (u32);
+			break;
+
+		case FDT_PROP:
+			p += sizeof (TDeviceTreeProperty) + DTB_ALIGN (be2le32 (pPiece->property.len));
+			break;
+
+		case FDT_NOP:
+			p += sizeof (u32);
+			break;
+
+		case FDT_END:
+			return nDepth == 0 ? nNodes : 0;
+
+		default:
+			return 0;
+		}
+	}
+
+	return 0;
+}
@@ -2,7 +2,7 @@
 // dmachannel.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/dma4channel.h>
+#include <circle/dmachannel.h>
 #include <circle/bcm2711.h>
 #include <circle/bcm2711int.h>
 #include <circle/memio.h>
@@ -86,6 +87,7 @@
 	#define LEN4_XLENGTH_SHIFT		0
 		#define LEN4_XLENGTH_MAX		0x3FFFFFFF
 		#define LEN4_XLENGTH_2D_MAX		0xFFFF
+		#define LEN4_XLENGTH_CHUNK		0x20000000	// for chained transfers
 #define ARM_DMA4CHAN_NEXTCONBK(chan)	(ARM_DMA_BASE + ((chan) * 0x100) + 0x28)
 #define ARM_DMA_INT_STATUS		(ARM_DMA_BASE + 0xFE0)
 #define ARM_DMA_ENABLE			(ARM_DMA_BASE + 0xFF0)
@@ -102,23 +104,32 @@ CDMA4Channel::CDMA4Channel (unsigned nChannel, CInterruptSystem *pInterruptSyste
 :	m_nChannel (nChannel),
 	m_pControlBlockBuffer (0),
 	m_pControlBlock (0),
+	m_pFillWord (0),
+	m_pChainBuffer (0),
+	m_pChain (0),
+	m_nChainSize (0),
+	m_pFirstControlBlock (0),
+	m_nControlBlocks (0),
 	m_pInterruptSystem (pInterruptSystem),
 	m_bIRQConnected (FALSE),
 	m_pCompletionRoutine (0),
 	m_pCompletionParam (0),
-	m_bStatus (FALSE)
+	m_bStatus (FALSE),
+	m_nStartTicks (0)
 {
 	assert (m_nChannel >= DMA4_CHANNEL_MIN);
 	assert (m_nChannel <= DMA4_CHANNEL_MAX);
 	assert (   (read32 (ARM_DMA4CHAN_DEBUG (m_nChannel)) & DEBUG4_VERSION_MASK)
 		>> DEBUG4_VERSION_SHIFT == DMA4_VERSION);
 
-	m_pControlBlockBuffer = new (HEAP_ANY) u8[sizeof (TDMA4ControlBlock) + 255];
+	m_pControlBlockBuffer = new (HEAP_ANY) u8[sizeof (TDMA4ControlBlock) + 4*sizeof (u32) + 255];
 	assert (m_pControlBlockBuffer != 0);
 
 	m_pControlBlock = (TDMA4ControlBlock *) (((uintptr) m_pControlBlockBuffer + 255) & ~255);
 	m_pControlBlock->nReserved = 0;
 
+	m_pFillWord = (u32 *) (m_pControlBlock + 1);
+
 	write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) | (1 << m_nChannel));
 	CTimer::SimpleusDelay (1000);
 
@@ -149,7 +160,14 @@ CDMA4Channel::~CDMA4Channel (void)
 		m_pInterruptSystem = 0;
 	}
 
+	m_pFirstControlBlock = 0;
+	m_pChain = 0;
+
+	delete [] m_pChainBuffer;
+	m_pChainBuffer = 0;
+
 	m_pControlBlock = 0;
+	m_pFillWord = 0;
 
 	delete [] m_pControlBlockBuffer;
 	m_pControlBlockBuffer = 0;
@@ -158,37 +176,88 @@ CDMA4Channel::~CDMA4Channel (void)
 void CDMA4Channel::SetupMemCopy (void *pDestination, const void *pSource, size_t nLength,
 				unsigned nBurstLength, boolean bCached)
 {
-	assert (pDestination != 0);
 	assert (pSource != 0);
+
+	SetupLinear (pDestination, pSource, nLength, nBurstLength, bCached);
+}
+
+void CDMA4Channel::SetupMemSet (void *pDestination, u8 uchValue, size_t nLength,
+			       unsigned nBurstLength, boolean bCached)
+{
+	// the source address is not incremented, so the same words are read again and again
+	assert (m_pFillWord != 0);
+	for (unsigned i = 0; i < 4; i++)
+	{
+		m_pFillWord[i] = uchValue * 0x01010101U;
+	}
+
+	CleanDataCacheRange ((uintptr) m_pFillWord, 4*sizeof (u32));
+
+	SetupLinear (pDestination, 0, nLength, nBurstLength, bCached);
+}
+
+void CDMA4Channel::SetupLinear (void *pDestination, const void *pSource, size_t nLength,
+			       unsigned nBurstLength, boolean bCached)
+{
+	assert (pDestination != 0);
 	assert (nLength > 0);
 	assert (nBurstLength <= BURST4_MAX);
 
 	assert (m_pControlBlock != 0);
-	assert (nLength <= LEN4_XLENGTH_MAX);
 
-	m_pControlBlock->nTransferInformation     =   TI4_WAIT_RD_RESP
-						    | TI4_WAIT_RESP;
-	m_pControlBlock->nSourceAddress           = ADDRESS4_LOW (pSource);
-	m_pControlBlock->nSourceInformation	  =   (SIZE4_128 << SOURCE4_SIZE_SHIFT)
-						    | SOURCE4_INC
-						    | (nBurstLength << SOURCE4_BURST_LEN_SHIFT)
-						    |    (ADDRESS4_HIGH (pSource)
-						      << SOURCE4_ADDR_SHIFT);
-	m_pControlBlock->nDestinationAddress      = ADDRESS4_LOW (pDestination);
-	m_pControlBlock->nDestinationInformation  =   (SIZE4_128 << DEST4_SIZE_SHIFT)
-						    | DEST4_INC
-						    | (nBurstLength << DEST4_BURST_LEN_SHIFT)
-						    |    (ADDRESS4_HIGH (pDestination)
-						      << DEST4_ADDR_SHIFT);
-	m_pControlBlock->nTransferLength          = nLength << LEN4_XLENGTH_SHIFT;
-	m_pControlBlock->nNextControlBlockAddress = 0;
+	boolean bFill = pSource == 0;
+	if (bFill)
+	{
+		pSource = m_pFillWord;		// stays the same for all control blocks
+	}
+
+	unsigned nBlocks = (nLength + LEN4_XLENGTH_CHUNK-1) / LEN4_XLENGTH_CHUNK;
+	TDMA4ControlBlock *pBlock = nBlocks > 1 ? GetChain (nBlocks) : m_pControlBlock;
+
+	uintptr nDestination = (uintptr) pDestination;
+	uintptr nSource = (uintptr) pSource;
+	size_t nRemaining = nLength;
+	for (unsigned i = 0; i < nBlocks; i++, pBlock++)
+	{
+		size_t nBlockLength = nRemaining < LEN4_XLENGTH_CHUNK ? nRemaining : LEN4_XLENGTH_CHUNK;
+
+		pBlock->nTransferInformation     =   TI4_WAIT_RD_RESP
+						   | TI4_WAIT_RESP;
+		pBlock->nSourceAddress           = ADDRESS4_LOW (nSource);
+		pBlock->nSourceInformation	 =   (SIZE4_128 << SOURCE4_SIZE_SHIFT)
+						   | (bFill ? 0 : SOURCE4_INC)
+						   | (nBurstLength << SOURCE4_BURST_LEN_SHIFT)
+						   | (ADDRESS4_HIGH (nSource) << SOURCE4_ADDR_SHIFT);
+		pBlock->nDestinationAddress      = ADDRESS4_LOW (nDestination);
+		pBlock->nDestinationInformation  =   (SIZE4_128 << DEST4_SIZE_SHIFT)
+						   | DEST4_INC
+						   | (nBurstLength << DEST4_BURST_LEN_SHIFT)
+						   | (ADDRESS4_HIGH (nDestination) << DEST4_ADDR_SHIFT);
+		pBlock->nTransferLength          = nBlockLength << LEN4_XLENGTH_SHIFT;
+		pBlock->nNextControlBlockAddress =   i+1 < nBlocks
+						   ? (uintptr) (pBlock + 1) >> CONBLK_AD4_ADDR_SHIFT : 0;
+		pBlock->nReserved                = 0;
+
+		nDestination += nBlockLength;
+		if (!bFill)
+		{
+			nSource += nBlockLength;
+		}
+		nRemaining -= nBlockLength;
+	}
+
+	m_pFirstControlBlock = nBlocks > 1 ? m_pChain : m_pControlBlock;
+	m_nControlBlocks = nBlocks;
 
 	if (bCached)
 	{
 		m_nDestinationAddress = (uintptr) pDestination;
 		m_nBufferLength = nLength;
 
-		CleanAndInvalidateDataCacheRange ((uintptr) pSource, nLength);
+		if (!bFill)
+		{
+			CleanDataCacheRange ((uintptr) pSource, nLength);
+		}
 		CleanAndInvalidateDataCacheRange ((uintptr) pDestination, nLength);
 	}
 	else
@@ -225,6 +294,9 @@ void CDMA4Channel::SetupIORead (void *pDestination, u32 nIOAddress, size_t nLeng
 	m_pControlBlock->nTransferLength          = nLength << LEN4_XLENGTH_SHIFT;
 	m_pControlBlock->nNextControlBlockAddress = 0;
 
+	m_pFirstControlBlock = m_pControlBlock;
+	m_nControlBlocks = 1;
+
 	m_nDestinationAddress = (uintptr) pDestination;
 	m_nBufferLength = nLength;
 
@@ -259,9 +331,12 @@ void CDMA4Channel::SetupIOWrite (u32 nIOAddress, const void *pSource, size_t nLe
 	m_pControlBlock->nTransferLength          = nLength << LEN4_XLENGTH_SHIFT;
 	m_pControlBlock->nNextControlBlockAddress = 0;
 
+	m_pFirstControlBlock = m_pControlBlock;
+	m_nControlBlocks = 1;
+
 	m_nDestinationAddress = 0;
 
-	CleanAndInvalidateDataCacheRange ((uintptr) pSource, nLength);
+	CleanDataCacheRange ((uintptr) pSource, nLength);
 }
 
 void CDMA4Channel::SetupMemCopy2D (void *pDestination, const void *pSource,
@@ -299,9 +374,174 @@ void CDMA4Channel::SetupMemCopy2D (void *pDestination, const void *pSource,
 						    | (nBlockLength << LEN4_XLENGTH_SHIFT);
 	m_pControlBlock->nNextControlBlockAddress = 0;
 
+	m_pFirstControlBlock = m_pControlBlock;
+	m_nControlBlocks = 1;
+
 	m_nDestinationAddress = 0;
 
-	CleanAndInvalidateDataCacheRange ((uintptr) pSource, nBlockLength*nBlockCount);
+	CleanDataCacheRange ((uintptr) pSource, nBlockLength*nBlockCount);
+}
+
+void CDMA4Channel::SetupMemCopyRect (void *pDestination, size_t nDestinationPitch,
+				     const void *pSource, size_t nSourcePitch,
+				     size_t nBlockLength, unsigned nBlockCount,
+				     unsigned nBurstLength, boolean bCached)
+{
+	assert (pSource != 0);
+	assert (nSourcePitch >= nBlockLength);
+
+	SetupRect (pDestination, nDestinationPitch, pSource, nSourcePitch,
+		   nBlockLength, nBlockCount, nBurstLength, bCached);
+}
+
+void CDMA4Channel::SetupMemFillRect (void *pDestination, size_t nDestinationPitch, u32 nFillWord,
+				     size_t nBlockLength, unsigned nBlockCount,
+				     unsigned nBurstLength, boolean bCached)
+{
+	// the source address is not incremented, so the same words are read again and again
+	assert (m_pFillWord != 0);
+	for (unsigned i = 0; i < 4; i++)
+	{
+		m_pFillWord[i] = nFillWord;
+	}
+
+	CleanDataCacheRange ((uintptr) m_pFillWord, 4*sizeof (u32));
+
+	SetupRect (pDestination, nDestinationPitch, 0, 0,
+		   nBlockLength, nBlockCount, nBurstLength, bCached);
+}
+
+void CDMA4Channel::SetupRect (void *pDestination, size_t nDestinationPitch,
+			      const void *pSource, size_t nSourcePitch,
+			      size_t nBlockLength, unsigned nBlockCount,
+			      unsigned nBurstLength, boolean bCached)
+{
+	assert (pDestination != 0);
+	assert (nBlockLength > 0);
+	assert (nBlockCount > 0);
+	assert (nDestinationPitch >= nBlockLength);
+	assert (nBurstLength <= BURST4_MAX);
+
+	assert (m_pControlBlock != 0);
+
+	u32 nSourceInformation =   (SIZE4_128 << SOURCE4_SIZE_SHIFT)
+				 | (nBurstLength << SOURCE4_BURST_LEN_SHIFT);
+
+	boolean bFill = pSource == 0;
+	if (bFill)
+	{
+		pSource = m_pFillWord;		// stays the same for all blocks
+	}
+	else
+	{
+		nSourceInformation |= SOURCE4_INC;
+	}
+
+	u32 nDestinationInformation =   (SIZE4_128 << DEST4_SIZE_SHIFT)
+				      | DEST4_INC
+				      | (nBurstLength << DEST4_BURST_LEN_SHIFT);
+
+	size_t nDestinationSkip = nDestinationPitch - nBlockLength;
+	size_t nSourceSkip = bFill ? 0 : nSourcePitch - nBlockLength;
+
+	// the strides are signed values
+	if (   nBlockLength <= LEN4_XLENGTH_2D_MAX
+	    && nBlockCount <= LEN4_YLENGTH_MAX+1
+	    && nDestinationSkip <= DEST4_STRIDE_MAX/2
+	    && nSourceSkip <= SOURCE4_STRIDE_MAX/2)
+	{
+		m_pControlBlock->nTransferInformation     =   TI4_WAIT_RD_RESP
+							    | TI4_WAIT_RESP
+							    | TI4_TDMODE;
+		m_pControlBlock->nSourceAddress           = ADDRESS4_LOW (pSource);
+		m_pControlBlock->nSourceInformation	  =   nSourceInformation
+							    | (nSourceSkip << SOURCE4_STRIDE_SHIFT)
+							    |    (ADDRESS4_HIGH (pSource)
+							      << SOURCE4_ADDR_SHIFT);
+		m_pControlBlock->nDestinationAddress      = ADDRESS4_LOW (pDestination);
+		m_pControlBlock->nDestinationInformation  =   nDestinationInformation
+							    | (nDestinationSkip << DEST4_STRIDE_SHIFT)
+							    |    (ADDRESS4_HIGH (pDestination)
+							      << DEST4_ADDR_SHIFT);
+		m_pControlBlock->nTransferLength          =   ((nBlockCount-1) << LEN4_YLENGTH_SHIFT)
+							    | (nBlockLength << LEN4_XLENGTH_SHIFT);
+		m_pControlBlock->nNextControlBlockAddress = 0;
+
+		m_pFirstControlBlock = m_pControlBlock;
+		m_nControlBlocks = 1;
+	}
+	else
+	{
+		assert (nBlockLength <= LEN4_XLENGTH_MAX);
+
+		TDMA4ControlBlock *pChain = GetChain (nBlockCount);
+
+		uintptr nDestination = (uintptr) pDestination;
+		uintptr nSource = (uintptr) pSource;
+		for (unsigned i = 0; i < nBlockCount; i++)
+		{
+			TDMA4ControlBlock *pBlock = &pChain[i];
+
+			pBlock->nTransferInformation     = TI4_WAIT_RD_RESP | TI4_WAIT_RESP;
+			pBlock->nSourceAddress           = ADDRESS4_LOW (nSource);
+			pBlock->nSourceInformation	 =   nSourceInformation
+							   |    (ADDRESS4_HIGH (nSource)
+							     << SOURCE4_ADDR_SHIFT);
+			pBlock->nDestinationAddress      = ADDRESS4_LOW (nDestination);
+			pBlock->nDestinationInformation  =   nDestinationInformation
+							   |    (ADDRESS4_HIGH (nDestination)
+							     << DEST4_ADDR_SHIFT);
+			pBlock->nTransferLength          = nBlockLength << LEN4_XLENGTH_SHIFT;
+			pBlock->nNextControlBlockAddress =   i+1 < nBlockCount
+							   ? (uintptr) (pBlock + 1) >> CONBLK_AD4_ADDR_SHIFT
+							   : 0;
+			pBlock->nReserved                = 0;
+
+			nDestination += nDestinationPitch;
+			nSource += nSourcePitch;
+		}
+
+		m_pFirstControlBlock = pChain;
+		m_nControlBlocks = nBlockCount;
+	}
+
+	size_t nSourceSpan = (nBlockCount-1) * nSourcePitch + nBlockLength;
+	size_t nDestinationSpan = (nBlockCount-1) * nDestinationPitch + nBlockLength;
+
+	if (bCached)
+	{
+		m_nDestinationAddress = (uintptr) pDestination;
+		m_nBufferLength = nDestinationSpan;
+
+		if (!bFill)
+		{
+			CleanDataCacheRange ((uintptr) pSource, nSourceSpan);
+		}
+		// the span covers data outside of the rectangle, which must not be discarded
+		CleanAndInvalidateDataCacheRange ((uintptr) pDestination, nDestinationSpan);
+	}
+	else
+	{
+		m_nDestinationAddress = 0;
+	}
+}
+
+TDMA4ControlBlock *CDMA4Channel::GetChain (unsigned nBlocks)
+{
+	assert (nBlocks > 0);
+
+	if (m_nChainSize < nBlocks)
+	{
+		delete [] m_pChainBuffer;
+
+		m_pChainBuffer = new (HEAP_ANY) u8[nBlocks * sizeof (TDMA4ControlBlock) + 31];
+		assert (m_pChainBuffer != 0);
+
+		m_pChain = (TDMA4ControlBlock *) (((uintptr) m_pChainBuffer + 31) & ~31);
+		m_nChainSize = nBlocks;
+	}
+
+	return m_pChain;
 }
 
 void CDMA4Channel::SetCompletionRoutine (TDMACompletionRoutine *pRoutine, void *pParam)
@@ -328,22 +568,28 @@ void CDMA4Channel::Start (void)
 {
 	assert (m_nChannel >= DMA4_CHANNEL_MIN);
 	assert (m_nChannel <= DMA4_CHANNEL_MAX);
-	assert (m_pControlBlock != 0);
+	assert (m_pFirstControlBlock != 0);
+	assert (m_nControlBlocks > 0);
 
 	if (m_pCompletionRoutine != 0)
 	{
 		assert (m_pInterruptSystem != 0);
 		assert (m_bIRQConnected);
-		m_pControlBlock->nTransferInformation |= TI4_INTEN;
+		m_pFirstControlBlock[m_nControlBlocks-1].nTransferInformation |= TI4_INTEN;
+
+#ifdef LATENCY_PROBES
+		m_nStartTicks = CTimer::GetClockTicks ();
+#endif
 	}
 
 	assert (!(read32 (ARM_DMA4CHAN_CS (m_nChannel)) & CS4_INT));
 	assert (!(read32 (ARM_DMA_INT_STATUS) & (1 << m_nChannel)));
 
 	write32 (ARM_DMA4CHAN_CONBLK_AD (m_nChannel),
-		 (uintptr) m_pControlBlock >> CONBLK_AD4_ADDR_SHIFT);
+		 (uintptr) m_pFirstControlBlock >> CONBLK_AD4_ADDR_SHIFT);
 
-	CleanAndInvalidateDataCacheRange ((uintptr) m_pControlBlock, sizeof *m_pControlBlock);
+	CleanDataCacheRange ((uintptr) m_pFirstControlBlock,
+			     m_nControlBlocks * sizeof (TDMA4ControlBlock));
 
 	write32 (ARM_DMA4CHAN_CS (m_nChannel),   CS4_WAIT_FOR_OUTSTANDING_WRITES
 					      | (DEFAULT_PANIC_QOS4 << CS4_PANIC_QOS_SHIFT)
@@ -367,7 +613,7 @@ boolean CDMA4Channel::Wait (void)
 
 	if (m_nDestinationAddress != 0)
 	{
-		CleanAndInvalidateDataCacheRange (m_nDestinationAddress, m_nBufferLength);
+		InvalidateDataCacheRange (m_nDestinationAddress, m_nBufferLength);
 	}
 
 	return m_bStatus;
@@ -386,7 +632,7 @@ void CDMA4Channel::InterruptHandler (void)
 {
 	if (m_nDestinationAddress != 0)
 	{
-		CleanAndInvalidateDataCacheRange (m_nDestinationAddress, m_nBufferLength);
+		InvalidateDataCacheRange (m_nDestinationAddress, m_nBufferLength);
 	}
 
 	assert (m_nChannel >= DMA4_CHANNEL_MIN);
@@ -406,6 +652,10 @@ void CDMA4Channel::InterruptHandler (void)
 
 	m_bStatus = nCS & CS4_ERROR ? FALSE : TRUE;
 
+#ifdef LATENCY_PROBES
+	CDMAChannel::GetCompletionLatency ()->Add (CTimer::GetClockTicks () - m_nStartTicks);
+#endif
+
 	assert (m_pCompletionRoutine != 0);
 	(*m_pCompletionRoutine) (m_nChannel, m_bStatus, m_pCompletionParam);
 }
@@ -2,7 +2,7 @@
 // dmachannel.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -28,15 +28,24 @@
 
 #define DMA_CHANNELS			(DMA_CHANNEL_MAX + 1)
 
+CHistogram<> CDMAChannel::s_CompletionLatency;
+
 CDMAChannel::CDMAChannel (unsigned nChannel, CInterruptSystem *pInterruptSystem)
 :	m_nChannel (CMachineInfo::Get ()->AllocateDMAChannel (nChannel)),
 	m_pControlBlockBuffer (0),
 	m_pControlBlock (0),
+	m_pFillWord (0),
+	m_pChainBuffer (0),
+	m_pChain (0),
+	m_nChainSize (0),
+	m_pFirstControlBlock (0),
+	m_nControlBlocks (0),
 	m_pInterruptSystem (pInterruptSystem),
 	m_bIRQConnected (FALSE),
 	m_pCompletionRoutine (0),
 	m_pCompletionParam (0),
-	m_bStatus (FALSE)
+	m_bStatus (FALSE),
+	m_nStartTicks (0)
 {
 #if RASPPI >= 4
 	m_pDMA4Channel = 0;
@@ -57,13 +66,15 @@ CDMAChannel::CDMAChannel (unsigned nChannel, CInterruptSystem *pInterruptSystem)
 	assert (m_nChannel != DMA_CHANNEL_NONE);
 	assert (m_nChannel < DMA_CHANNELS);
 
-	m_pControlBlockBuffer = new (HEAP_DMA30) u8[sizeof (TDMAControlBlock) + 31];
+	m_pControlBlockBuffer = new (HEAP_DMA30) u8[sizeof (TDMAControlBlock) + 4*sizeof (u32) + 31];
 	assert (m_pControlBlockBuffer != 0);
 
 	m_pControlBlock = (TDMAControlBlock *) (((uintptr) m_pControlBlockBuffer + 31) & ~31);
 	m_pControlBlock->nReserved[0] = 0;
 	m_pControlBlock->nReserved[1] = 0;
 
+	m_pFillWord = (u32 *) (m_pControlBlock + 1);
+
 	write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) | (1 << m_nChannel));
 	CTimer::SimpleusDelay (1000);
 
@@ -122,10 +133,17 @@ CDMAChannel::~CDMAChannel (void)
 
 	CMachineInfo::Get ()->FreeDMAChannel (m_nChannel);
 
+	m_pFirstControlBlock = 0;
+	m_pFillWord = 0;
 	m_pControlBlock = 0;
 
 	delete [] m_pControlBlockBuffer;
 	m_pControlBlockBuffer = 0;
+
+	m_pChain = 0;
+
+	delete [] m_pChainBuffer;
+	m_pChainBuffer = 0;
 }
 
 void CDMAChannel::SetupMemCopy (void *pDestination, const void *pSource, size_t nLength,
@@ -161,12 +179,15 @@ void CDMAChannel::SetupMemCopy (void *pDestination, const void *pSource, size_t
 	m_pControlBlock->n2DModeStride            = 0;
 	m_pControlBlock->nNextControlBlockAddress = 0;
 
+	m_pFirstControlBlock = m_pControlBlock;
+	m_nControlBlocks = 1;
+
 	if (bCached)
 	{
 		m_nDestinationAddress = (uintptr) pDestination;
 		m_nBufferLength = nLength;
 
-		CleanAndInvalidateDataCacheRange ((uintptr) pSource, nLength);
+		CleanDataCacheRange ((uintptr) pSource, nLength);
 		CleanAndInvalidateDataCacheRange ((uintptr) pDestination, nLength);
 	}
 	else
@@ -209,6 +230,9 @@ void CDMAChannel::SetupIORead (void *pDestination, u32 nIOAddress, size_t nLengt
 	m_pControlBlock->n2DModeStride            = 0;
 	m_pControlBlock->nNextControlBlockAddress = 0;
 
+	m_pFirstControlBlock = m_pControlBlock;
+	m_nControlBlocks = 1;
+
 	m_nDestinationAddress = (uintptr) pDestination;
 	m_nBufferLength = nLength;
 
@@ -249,9 +273,12 @@ void CDMAChannel::SetupIOWrite (u32 nIOAddress, const void *pSource, size_t nLen
 	m_pControlBlock->n2DModeStride            = 0;
 	m_pControlBlock->nNextControlBlockAddress = 0;
 
+	m_pFirstControlBlock = m_pControlBlock;
+	m_nControlBlocks = 1;
+
 	m_nDestinationAddress = 0;
 
-	CleanAndInvalidateDataCacheRange ((uintptr) pSource, nLength);
+	CleanDataCacheRange ((uintptr) pSource, nLength);
 }
 
 void CDMAChannel::SetupMemCopy2D (void *pDestination, const void *pSource,
@@ -294,9 +321,282 @@ void CDMAChannel::SetupMemCopy2D (void *pDestination, const void *pSource,
 	m_pControlBlock->n2DModeStride            = nBlockStride << STRIDE_DEST_SHIFT;
 	m_pControlBlock->nNextControlBlockAddress = 0;
 
+	m_pFirstControlBlock = m_pControlBlock;
+	m_nControlBlocks = 1;
+
+	m_nDestinationAddress = 0;
+
+	CleanDataCacheRange ((uintptr) pSource, nBlockLength*nBlockCount);
+}
+
+void CDMAChannel::SetupMemCopyRect (void *pDestination, size_t nDestinationPitch,
+				    const void *pSource, size_t nSourcePitch,
+				    size_t nBlockLength, unsigned nBlockCount,
+				    unsigned nBurstLength, boolean bCached)
+{
+#if RASPPI >= 4
+	if (m_pDMA4Channel != 0)
+	{
+		m_pDMA4Channel->SetupMemCopyRect (pDestination, nDestinationPitch,
+						  pSource, nSourcePitch, nBlockLength,
+						  nBlockCount, nBurstLength, bCached);
+
+		return;
+	}
+#endif
+
+	assert (pSource != 0);
+	assert (nSourcePitch >= nBlockLength);
+
+	SetupRect (pDestination, nDestinationPitch, pSource, nSourcePitch,
+		   nBlockLength, nBlockCount, nBurstLength, bCached);
+}
+
+void CDMAChannel::SetupMemFillRect (void *pDestination, size_t nDestinationPitch, u32 nFillWord,
+				    size_t nBlockLength, unsigned nBlockCount,
+				    unsigned nBurstLength, boolean bCached)
+{
+#if RASPPI >= 4
+	if (m_pDMA4Channel != 0)
+	{
+		m_pDMA4Channel->SetupMemFillRect (pDestination, nDestinationPitch, nFillWord,
+						  nBlockLength, nBlockCount, nBurstLength, bCached);
+
+		return;
+	}
+#endif
+
+	// the source address is not incremented, so the same word is read again and again
+	assert (m_pFillWord != 0);
+	for (unsigned i = 0; i < 4; i++)
+	{
+		m_pFillWord[i] = nFillWord;
+	}
+
+	CleanDataCacheRange ((uintptr) m_pFillWord, 4*sizeof (u32));
+
+	SetupRect (pDestination, nDestinationPitch, 0, 0,
+		   nBlockLength, nBlockCount, nBurstLength, bCached);
+}
+
+void CDMAChannel::SetupRect (void *pDestination, size_t nDestinationPitch,
+			     const void *pSource, size_t nSourcePitch,
+			     size_t nBlockLength, unsigned nBlockCount,
+			     unsigned nBurstLength, boolean bCached)
+{
+#if RASPPI >= 4
+	assert (m_pDMA4Channel == 0);
+#endif
+
+	assert (pDestination != 0);
+	assert (nBlockLength > 0);
+	assert (nBlockCount > 0);
+	assert (nDestinationPitch >= nBlockLength);
+	assert (nBurstLength <= 15);
+
+	assert (m_pControlBlock != 0);
+
+	u32 nTransferInformation =   (nBurstLength << TI_BURST_LENGTH_SHIFT)
+				   | TI_DEST_WIDTH
+				   | TI_DEST_INC;
+
+	boolean bFill = pSource == 0;
+	if (bFill)
+	{
+		pSource = m_pFillWord;		// stays the same for all blocks
+	}
+	else
+	{
+		nTransferInformation |= TI_SRC_WIDTH | TI_SRC_INC;
+	}
+
+	boolean bLite = !!(read32 (ARM_DMACHAN_DEBUG (m_nChannel)) & DEBUG_LITE);
+	size_t nDestinationSkip = nDestinationPitch - nBlockLength;
+	size_t nSourceSkip = bFill ? 0 : nSourcePitch - nBlockLength;
+
+	if (   !bLite
+	    && nBlockLength <= 0xFFFF
+	    && nBlockCount <= 0x4000
+	    && nDestinationSkip <= 0x7FFF
+	    && nSourceSkip <= 0x7FFF)
+	{
+		m_pControlBlock->nTransferInformation     = nTransferInformation | TI_TDMODE;
+		m_pControlBlock->nSourceAddress           = BUS_ADDRESS ((uintptr) pSource);
+		m_pControlBlock->nDestinationAddress      = BUS_ADDRESS ((uintptr) pDestination);
+		m_pControlBlock->nTransferLength          =   ((nBlockCount-1) << TXFR_LEN_YLENGTH_SHIFT)
+							    | (nBlockLength << TXFR_LEN_XLENGTH_SHIFT);
+		m_pControlBlock->n2DModeStride            =   (nDestinationSkip << STRIDE_DEST_SHIFT)
+							    | (nSourceSkip << STRIDE_SRC_SHIFT);
+		m_pControlBlock->nNextControlBlockAddress = 0;
+
+		m_pFirstControlBlock = m_pControlBlock;
+		m_nControlBlocks = 1;
+	}
+	else
+	{
+		assert (nBlockLength <= (bLite ? TXFR_LEN_MAX_LITE : TXFR_LEN_MAX));
+
+		if (m_nChainSize < nBlockCount)
+		{
+			delete [] m_pChainBuffer;
+
+			m_pChainBuffer = new (HEAP_DMA30) u8[nBlockCount * sizeof (TDMAControlBlock) + 31];
+			assert (m_pChainBuffer != 0);
+
+			m_pChain = (TDMAControlBlock *) (((uintptr) m_pChainBuffer + 31) & ~31);
+			m_nChainSize = nBlockCount;
+		}
+
+		uintptr nDestination = (uintptr) pDestination;
+		uintptr nSource = (uintptr) pSource;
+		for (unsigned i = 0; i < nBlockCount; i++)
+		{
+			TDMAControlBlock *pBlock = &m_pChain[i];
+
+			pBlock->nTransferInformation     = nTransferInformation;
+			pBlock->nSourceAddress           = BUS_ADDRESS (nSource);
+			pBlock->nDestinationAddress      = BUS_ADDRESS (nDestination);
+			pBlock->nTransferLength          = nBlockLength;
+			pBlock->n2DModeStride            = 0;
+			pBlock->nNextControlBlockAddress =   i+1 < nBlockCount
+							   ? BUS_ADDRESS ((uintptr) (pBlock + 1)) : 0;
+			pBlock->nReserved[0]             = 0;
+			pBlock->nReserved[1]             = 0;
+
+			nDestination += nDestinationPitch;
+			nSource += nSourcePitch;
+		}
+
+		m_pFirstControlBlock = m_pChain;
+		m_nControlBlocks = nBlockCount;
+	}
+
+	size_t nSourceSpan = (nBlockCount-1) * nSourcePitch + nBlockLength;
+	size_t nDestinationSpan = (nBlockCount-1) * nDestinationPitch + nBlockLength;
+
+	if (bCached)
+	{
+		m_nDestinationAddress = (uintptr) pDestination;
+		m_nBufferLength = nDestinationSpan;
+
+		if (!bFill)
+		{
+			CleanDataCacheRange ((uintptr) pSource, nSourceSpan);
+		}
+		// the span covers data outside of the rectangle, which must not be discarded
+		CleanAndInvalidateDataCacheRange ((uintptr) pDestination, nDestinationSpan);
+	}
+	else
+	{
+		m_nDestinationAddress = 0;
+	}
+}
+
+void CDMAChannel::SetupMemSet (void *pDestination, u8 uchValue, size_t nLength,
+			       unsigned nBurstLength, boolean bCached)
+{
+#if RASPPI >= 4
+	if (m_pDMA4Channel != 0)
+	{
+		m_pDMA4Channel->SetupMemSet (pDestination, uchValue, nLength, nBurstLength, bCached);
+
+		return;
+	}
+#endif
+
+	assert (pDestination != 0);
+	assert (nLength > 0);
+	assert (nBurstLength <= 15);
+
+	assert (m_pControlBlock != 0);
+	assert (nLength <= TXFR_LEN_MAX);
+	assert (   !(read32 (ARM_DMACHAN_DEBUG (m_nChannel)) & DEBUG_LITE)
+		|| nLength <= TXFR_LEN_MAX_LITE);
+
+	// the source address is not incremented, so the same word is read again and again
+	assert (m_pFillWord != 0);
+	for (unsigned i = 0; i < 4; i++)
+	{
+		m_pFillWord[i] = uchValue * 0x01010101U;
+	}
+
+	m_pControlBlock->nTransferInformation     =   (nBurstLength << TI_BURST_LENGTH_SHIFT)
+						    | TI_DEST_WIDTH
+						    | TI_DEST_INC;
+	m_pControlBlock->nSourceAddress           = BUS_ADDRESS ((uintptr) m_pFillWord);
+	m_pControlBlock->nDestinationAddress      = BUS_ADDRESS ((uintptr) pDestination);
+	m_pControlBlock->nTransferLength          = nLength;
+	m_pControlBlock->n2DModeStride            = 0;
+	m_pControlBlock->nNextControlBlockAddress = 0;
+
+	m_pFirstControlBlock = m_pControlBlock;
+	m_nControlBlocks = 1;
+
+	CleanDataCacheRange ((uintptr) m_pFillWord, 4*sizeof (u32));
+
+	if (bCached)
+	{
+		m_nDestinationAddress = (uintptr) pDestination;
+		m_nBufferLength = nLength;
+
+		CleanAndInvalidateDataCacheRange ((uintptr) pDestination, nLength);
+	}
+	else
+	{
+		m_nDestinationAddress = 0;
+	}
+}
+
+void CDMAChannel::SetupControlBlocks (TDMAControlBlock *pFirstControlBlock, unsigned nControlBlocks)
+{
+#if RASPPI >= 4
+	assert (m_pDMA4Channel == 0);
+#endif
+
+	assert (pFirstControlBlock != 0);
+	assert (((uintptr) pFirstControlBlock & 31) == 0);
+	assert (nControlBlocks > 0);
+
+	m_pFirstControlBlock = pFirstControlBlock;
+	m_nControlBlocks = nControlBlocks;
+
 	m_nDestinationAddress = 0;
+}
+
+unsigned CDMAChannel::GetChannelNumber (void) const
+{
+#if RASPPI >= 4
+	assert (m_pDMA4Channel == 0);
+#endif
 
-	CleanAndInvalidateDataCacheRange ((uintptr) pSource, nBlockLength*nBlockCount);
+	assert (m_nChannel < DMA_CHANNELS);
+
+	return m_nChannel;
+}
+
+void CDMAChannel::Cancel (void)
+{
+#if RASPPI >= 4
+	assert (m_pDMA4Channel == 0);
+#endif
+
+	assert (m_nChannel < DMA_CHANNELS);
+
+	PeripheralEntry ();
+
+	// pause the channel first, so that no transfer is interrupted in between
+	write32 (ARM_DMACHAN_CS (m_nChannel), 0);
+	CTimer::SimpleusDelay (10);
+
+	write32 (ARM_DMACHAN_CS (m_nChannel), CS_RESET);
+	while (read32 (ARM_DMACHAN_CS (m_nChannel)) & CS_RESET)
+	{
+		// do nothing
+	}
+
+	write32 (ARM_DMA_INT_STATUS, 1 << m_nChannel);
+
+	PeripheralExit ();
 }
 
 void CDMAChannel::SetCompletionRoutine (TDMACompletionRoutine *pRoutine, void *pParam)
@@ -338,13 +638,18 @@ void CDMAChannel::Start (void)
 #endif
 
 	assert (m_nChannel < DMA_CHANNELS);
-	assert (m_pControlBlock != 0);
+	assert (m_pFirstControlBlock != 0);
+	assert (m_nControlBlocks > 0);
 
 	if (m_pCompletionRoutine != 0)
 	{
 		assert (m_pInterruptSystem != 0);
 		assert (m_bIRQConnected);
-		m_pControlBlock->nTransferInformation |= TI_INTEN;
+		m_pFirstControlBlock[m_nControlBlocks-1].nTransferInformation |= TI_INTEN;
+
+#ifdef LATENCY_PROBES
+		m_nStartTicks = CTimer::GetClockTicks ();
+#endif
 	}
 
 	PeripheralEntry ();
@@ -352,9 +657,10 @@ void CDMAChannel::Start (void)
 	assert (!(read32 (ARM_DMACHAN_CS (m_nChannel)) & CS_INT));
 	assert (!(read32 (ARM_DMA_INT_STATUS) & (1 << m_nChannel)));
 
-	write32 (ARM_DMACHAN_CONBLK_AD (m_nChannel), BUS_ADDRESS ((uintptr) m_pControlBlock));
+	write32 (ARM_DMACHAN_CONBLK_AD (m_nChannel), BUS_ADDRESS ((uintptr) m_pFirstControlBlock));
 
-	CleanAndInvalidateDataCacheRange ((uintptr) m_pControlBlock, sizeof *m_pControlBlock);
+	CleanDataCacheRange ((uintptr) m_pFirstControlBlock,
+			     m_nControlBlocks * sizeof (TDMAControlBlock));
 
 	write32 (ARM_DMACHAN_CS (m_nChannel),   CS_WAIT_FOR_OUTSTANDING_WRITES
 					      | (DEFAULT_PANIC_PRIORITY << CS_PANIC_PRIORITY_SHIFT)
@@ -388,7 +694,7 @@ boolean CDMAChannel::Wait (void)
 
 	if (m_nDestinationAddress != 0)
 	{
-		CleanAndInvalidateDataCacheRange (m_nDestinationAddress, m_nBufferLength);
+		InvalidateDataCacheRange (m_nDestinationAddress, m_nBufferLength);
 	}
 
 	PeripheralExit ();
@@ -415,7 +721,7 @@ void CDMAChannel::InterruptHandler (void)
 {
 	if (m_nDestinationAddress != 0)
 	{
-		CleanAndInvalidateDataCacheRange (m_nDestinationAddress, m_nBufferLength);
+		InvalidateDataCacheRange (m_nDestinationAddress, m_nBufferLength);
 	}
 
 	PeripheralEntry ();
@@ -438,10 +744,19 @@ void CDMAChannel::InterruptHandler (void)
 
 	m_bStatus = nCS & CS_ERROR ? FALSE : TRUE;
 
+#ifdef LATENCY_PROBES
+	s_CompletionLatency.Add (CTimer::GetClockTicks () - m_nStartTicks);
+#endif
+
 	assert (m_pCompletionRoutine != 0);
 	(*m_pCompletionRoutine) (m_nChannel, m_bStatus, m_pCompletionParam);
 }
 
+CHistogram<> *CDMAChannel::GetCompletionLatency (void)
+{
+	return &s_CompletionLatency;
+}
+
 void CDMAChannel::InterruptStub (void *pParam)
 {
 	CDMAChannel *pThis = (CDMAChannel *) pParam;
@@ -0,0 +1,437 @@
+//
+// dmacopyservice.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/dmacopyservice.h>
+#include <circle/machineinfo.h>
+#include <circle/logger.h>
+#include <assert.h>
+
+#define DMA_ADDRESS_LIMIT	0x40000000	// the legacy DMA controller sees 1 GByte only
+
+LOGMODULE ("dmacopy");
+
+CDMACopyService *CDMACopyService::s_pThis = 0;
+
+CDMACopyService::CDMACopyService (CInterruptSystem *pInterruptSystem, unsigned nChannels)
+:	m_pInterruptSystem (pInterruptSystem),
+	m_nMaxChannels (nChannels),
+	m_nChannels (0),
+	m_bExtended (FALSE),
+	m_nQueueIn (0),
+	m_nQueueOut (0),
+	m_nQueued (0),
+	m_nPending (0)
+{
+	assert (m_pInterruptSystem != 0);
+	assert (1 <= m_nMaxChannels && m_nMaxChannels <= DMA_COPY_CHANNELS);
+
+	assert (s_pThis == 0);
+	s_pThis = this;
+}
+
+CDMACopyService::~CDMACopyService (void)
+{
+	Wait ();
+
+	for (unsigned i = 0; i < m_nChannels; i++)
+	{
+		delete m_Channel[i].pDMA;
+		m_Channel[i].pDMA = 0;
+	}
+
+	m_nChannels = 0;
+
+	s_pThis = 0;
+}
+
+boolean CDMACopyService::Initialize (void)
+{
+	CMachineInfo *pMachineInfo = CMachineInfo::Get ();
+	assert (pMachineInfo != 0);
+
+	while (m_nChannels < m_nMaxChannels)
+	{
+		// CDMAChannel requires an available channel, so check it before
+		unsigned nChannel = pMachineInfo->AllocateDMAChannel (DMA_CHANNEL_NORMAL);
+		if (nChannel == DMA_CHANNEL_NONE)
+		{
+			break;
+		}
+
+		pMachineInfo->FreeDMAChannel (nChannel);
+
+		TChannel *pChannel = &m_Channel[m_nChannels];
+
+		pChannel->pDMA = new CDMAChannel (nChannel, m_pInterruptSystem);
+		assert (pChannel->pDMA != 0);
+
+		pChannel->bExtended = FALSE;
+		pChannel->bBusy = FALSE;
+		pChannel->pThis = this;
+
+		pChannel->pDMA->SetCompletionRoutine (CompletionStub, pChannel);
+
+		m_nChannels++;
+	}
+
+	if (m_nChannels == 0)
+	{
+		LOGWARN ("No DMA channel available");
+
+		return FALSE;
+	}
+
+#if RASPPI >= 4
+	// the DMA4 channel services the buffers, which are not accessible for the other ones
+	unsigned nChannel = pMachineInfo->AllocateDMAChannel (DMA_CHANNEL_EXTENDED);
+	if (nChannel != DMA_CHANNEL_NONE)
+	{
+		pMachineInfo->FreeDMAChannel (nChannel);
+
+		TChannel *pChannel = &m_Channel[m_nChannels];
+
+		pChannel->pDMA = new CDMAChannel (nChannel, m_pInterruptSystem);
+		assert (pChannel->pDMA != 0);
+
+		pChannel->bExtended = TRUE;
+		pChannel->bBusy = FALSE;
+		pChannel->pThis = this;
+
+		pChannel->pDMA->SetCompletionRoutine (CompletionStub, pChannel);
+
+		m_nChannels++;
+		m_bExtended = TRUE;
+	}
+#endif
+
+	LOGNOTE ("Using %u DMA channel(s)%s", m_nChannels, m_bExtended ? " (one DMA4)" : "");
+
+	return TRUE;
+}
+
+boolean CDMACopyService::Copy (void *pDestination, const void *pSource, size_t nLength,
+			       TCompletionHandler *pHandler, void *pParam)
+{
+	assert (pDestination != 0);
+	assert (pSource != 0);
+	assert (nLength > 0);
+
+	TRequest Request;
+	Request.bExtended = FALSE;
+	if (   !CheckBuffer (&Request, pDestination, nLength, nLength)
+	    || !CheckBuffer (&Request, pSource, nLength, nLength))
+	{
+		return FALSE;
+	}
+
+	Request.Type = RequestCopy;
+	Request.pDestination = pDestination;
+	Request.pSource = pSource;
+	Request.nLength = nLength;
+	Request.pHandler = pHandler;
+	Request.pParam = pParam;
+
+	return Submit (Request);
+}
+
+boolean CDMACopyService::Copy2D (void *pDestination, size_t nDestinationPitch,
+				 const void *pSource, size_t nSourcePitch,
+				 size_t nBlockLength, unsigned nBlockCount,
+				 TCompletionHandler *pHandler, void *pParam)
+{
+	assert (pDestination != 0);
+	assert (pSource != 0);
+	assert (nBlockLength > 0);
+	assert (nBlockCount > 0);
+	assert (nDestinationPitch >= nBlockLength);
+	assert (nSourcePitch >= nBlockLength);
+
+	TRequest Request;
+	Request.bExtended = FALSE;
+	if (   !CheckBuffer (&Request, pDestination,
+			     (nBlockCount-1) * nDestinationPitch + nBlockLength, nBlockLength)
+	    || !CheckBuffer (&Request, pSource,
+			     (nBlockCount-1) * nSourcePitch + nBlockLength, nBlockLength))
+	{
+		return FALSE;
+	}
+
+	Request.Type = RequestCopy2D;
+	Request.pDestination = pDestination;
+	Request.pSource = pSource;
+	Request.nLength = nBlockLength;
+	Request.nDestinationPitch = nDestinationPitch;
+	Request.nSourcePitch = nSourcePitch;
+	Request.nBlockCount = nBlockCount;
+	Request.pHandler = pHandler;
+	Request.pParam = pParam;
+
+	return Submit (Request);
+}
+
+boolean CDMACopyService::Fill2D (void *pDestination, size_t nDestinationPitch, u32 nFillWord,
+				 size_t nBlockLength, unsigned nBlockCount,
+				 TCompletionHandler *pHandler, void *pParam)
+{
+	assert (pDestination != 0);
+	assert (nBlockLength > 0);
+	assert (nBlockCount > 0);
+	assert (nDestinationPitch >= nBlockLength);
+
+	TRequest Request;
+	Request.bExtended = FALSE;
+	if (   ((uintptr) pDestination | nDestinationPitch | nBlockLength) & 3
+	    || !CheckBuffer (&Request, pDestination,
+			     (nBlockCount-1) * nDestinationPitch + nBlockLength, nBlockLength))
+	{
+		return FALSE;
+	}
+
+	Request.Type = RequestFill2D;
+	Request.pDestination = pDestination;
+	Request.pSource = 0;
+	Request.nLength = nBlockLength;
+	Request.nDestinationPitch = nDestinationPitch;
+	Request.nBlockCount = nBlockCount;
+	Request.nFillWord = nFillWord;
+	Request.pHandler = pHandler;
+	Request.pParam = pParam;
+
+	return Submit (Request);
+}
+
+boolean CDMACopyService::Set (void *pDestination, int nValue, size_t nLength,
+			      TCompletionHandler *pHandler, void *pParam)
+{
+	assert (pDestination != 0);
+	assert (nLength > 0);
+
+	TRequest Request;
+	Request.bExtended = FALSE;
+	if (!CheckBuffer (&Request, pDestination, nLength, nLength))
+	{
+		return FALSE;
+	}
+
+	Request.Type = RequestSet;
+	Request.pDestination = pDestination;
+	Request.pSource = 0;
+	Request.nLength = nLength;
+	Request.uchValue = (u8) nValue;
+	Request.pHandler = pHandler;
+	Request.pParam = pParam;
+
+	return Submit (Request);
+}
+
+boolean CDMACopyService::IsIdle (void) const
+{
+	return m_nPending == 0;
+}
+
+void CDMACopyService::Wait (void)
+{
+	while (m_nPending != 0)
+	{
+		// do nothing
+	}
+}
+
+boolean CDMACopyService::IsDMAAble (const void *pBuffer, size_t nLength)
+{
+	uintptr nAddress = (uintptr) pBuffer;
+
+	return    nAddress < DMA_ADDRESS_LIMIT
+	       && nLength <= DMA_ADDRESS_LIMIT - nAddress;
+}
+
+CDMACopyService *CDMACopyService::Get (void)
+{
+	return s_pThis;
+}
+
+boolean CDMACopyService::CheckBuffer (TRequest *pRequest, const void *pBuffer, size_t nSpan,
+				      size_t nBlockLength) const
+{
+	assert (pRequest != 0);
+
+	if (   nBlockLength <= TXFR_LEN_MAX
+	    && IsDMAAble (pBuffer, nSpan))
+	{
+		return TRUE;
+	}
+
+	// the DMA4 channel uses 40-bit addresses and chains large transfers
+	pRequest->bExtended = TRUE;
+
+	return m_bExtended;
+}
+
+boolean CDMACopyService::Submit (const TRequest &rRequest)
+{
+	assert (m_nChannels > 0);
+
+	m_SpinLock.Acquire ();
+
+	if (m_nQueued == DMA_COPY_QUEUE_SIZE)
+	{
+		m_SpinLock.Release ();
+
+		return FALSE;
+	}
+
+	// requests are started in order, so queue it and start it from there
+	m_Queue[m_nQueueIn] = rRequest;
+	if (++m_nQueueIn == DMA_COPY_QUEUE_SIZE)
+	{
+		m_nQueueIn = 0;
+	}
+
+	m_nQueued++;
+	m_nPending++;
+
+	StartQueued ();
+
+	m_SpinLock.Release ();
+
+	return TRUE;
+}
+
+void CDMACopyService::StartQueued (void)
+{
+	while (m_nQueued > 0)
+	{
+		const TRequest &rRequest = m_Queue[m_nQueueOut];
+
+		// the normal channels are preferred, the DMA4 channel is the last one
+		TChannel *pChannel = 0;
+		for (unsigned i = 0; i < m_nChannels; i++)
+		{
+			if (   !m_Channel[i].bBusy
+			    && (   !rRequest.bExtended
+				|| m_Channel[i].bExtended))
+			{
+				pChannel = &m_Channel[i];
+
+				break;
+			}
+		}
+
+		if (pChannel == 0)
+		{
+			break;
+		}
+
+		Start (pChannel, rRequest);
+
+		if (++m_nQueueOut == DMA_COPY_QUEUE_SIZE)
+		{
+			m_nQueueOut = 0;
+		}
+
+		m_nQueued--;
+	}
+}
+
+void CDMACopyService::Start (TChannel *pChannel, const TRequest &rRequest)
+{
+	assert (pChannel != 0);
+	assert (!pChannel->bBusy);
+	assert (!rRequest.bExtended || pChannel->bExtended);
+
+	pChannel->Request = rRequest;
+	pChannel->bBusy = TRUE;
+
+	CDMAChannel *pDMA = pChannel->pDMA;
+	assert (pDMA != 0);
+
+	switch (rRequest.Type)
+	{
+	case RequestCopy:
+		pDMA->SetupMemCopy (rRequest.pDestination, rRequest.pSource, rRequest.nLength,
+				    DMA_COPY_BURST_LENGTH);
+		break;
+
+	case RequestCopy2D:
+		pDMA->SetupMemCopyRect (rRequest.pDestination, rRequest.nDestinationPitch,
+					rRequest.pSource, rRequest.nSourcePitch,
+					rRequest.nLength, rRequest.nBlockCount,
+					DMA_COPY_BURST_LENGTH);
+		break;
+
+	case RequestFill2D:
+		pDMA->SetupMemFillRect (rRequest.pDestination, rRequest.nDestinationPitch,
+					rRequest.nFillWord, rRequest.nLength, rRequest.nBlockCount,
+					DMA_COPY_BURST_LENGTH);
+		break;
+
+	case RequestSet:
+		pDMA->SetupMemSet (rRequest.pDestination, rRequest.uchValue, rRequest.nLength,
+				   DMA_COPY_BURST_LENGTH);
+		break;
+
+	default:
+		assert (0);
+		break;
+	}
+
+	pDMA->Start ();
+}
+
+void CDMACopyService::CompletionHandler (TChannel *pChannel, boolean bStatus)
+{
+	assert (pChannel != 0);
+	assert (pChannel->bBusy);
+
+	TCompletionHandler *pHandler = pChannel->Request.pHandler;
+	void *pParam = pChannel->Request.pParam;
+
+	if (!bStatus)
+	{
+		LOGWARN ("Transfer failed");
+	}
+
+	// the handler may submit a new request, which is queued, because this channel is busy
+	if (pHandler != 0)
+	{
+		(*pHandler) (bStatus, pParam);
+	}
+
+	m_SpinLock.Acquire ();
+
+	pChannel->bBusy = FALSE;
+
+	assert (m_nPending > 0);
+	m_nPending--;
+
+	StartQueued ();
+
+	m_SpinLock.Release ();
+}
+
+void CDMACopyService::CompletionStub (unsigned nChannel, boolean bStatus, void *pParam)
+{
+	TChannel *pChannel = (TChannel *) pParam;
+	assert (pChannel != 0);
+
+	CDMACopyService *pThis = pChannel->pThis;
+	assert (pThis != 0);
+
+	pThis->CompletionHandler (pChannel, bStatus);
+}
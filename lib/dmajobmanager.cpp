@@ -0,0 +1,586 @@
+//
+// dmajobmanager.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/dmajobmanager.h>
+#include <circle/machineinfo.h>
+#include <circle/bcm2835.h>
+#include <circle/bcm2835int.h>
+#include <circle/memio.h>
+#include <circle/timer.h>
+#include <circle/synchronize.h>
+#include <circle/logger.h>
+#include <circle/new.h>
+#include <assert.h>
+
+#define DMA_JOB_TOKEN		0x4A4F4221		// written by the last control block of a job
+
+#define CS_CONFIG	(  CS_WAIT_FOR_OUTSTANDING_WRITES				\
+			 | (DEFAULT_PANIC_PRIORITY << CS_PANIC_PRIORITY_SHIFT)		\
+			 | (DEFAULT_PRIORITY << CS_PRIORITY_SHIFT))
+
+LOGMODULE ("dmajob");
+
+CDMAJob::CDMAJob (unsigned nMaxTransfers)
+:	m_nMaxTransfers (nMaxTransfers),
+	m_nTransfers (0),
+	m_pCompletionRoutine (0),
+	m_pCompletionParam (0),
+	m_bActive (FALSE),
+	m_bStatus (FALSE),
+	m_pNext (0)
+{
+	assert (m_nMaxTransfers > 0);
+
+	size_t nBlocksSize = (m_nMaxTransfers + 1) * sizeof (TDMAControlBlock);
+	nBlocksSize = (nBlocksSize + DATA_CACHE_LINE_LENGTH_MAX-1) & ~(DATA_CACHE_LINE_LENGTH_MAX-1);
+
+	m_pBuffer = new (HEAP_DMA30) u8[  nBlocksSize + 2*DATA_CACHE_LINE_LENGTH_MAX
+					+ DATA_CACHE_LINE_LENGTH_MAX-1];
+	assert (m_pBuffer != 0);
+
+	uintptr nBuffer =   ((uintptr) m_pBuffer + DATA_CACHE_LINE_LENGTH_MAX-1)
+			  & ~(DATA_CACHE_LINE_LENGTH_MAX-1);
+
+	m_pControlBlock = (TDMAControlBlock *) nBuffer;
+	m_pTokenSource = (u32 *) (nBuffer + nBlocksSize);
+	m_pToken = (volatile u32 *) (nBuffer + nBlocksSize + DATA_CACHE_LINE_LENGTH_MAX);
+
+	*m_pTokenSource = DMA_JOB_TOKEN;
+	CleanDataCacheRange ((uintptr) m_pTokenSource, sizeof (u32));
+
+	m_pInvalidate = new TInvalidateRange[m_nMaxTransfers];
+	assert (m_pInvalidate != 0);
+}
+
+CDMAJob::~CDMAJob (void)
+{
+	assert (!m_bActive);
+
+	delete [] m_pInvalidate;
+	m_pInvalidate = 0;
+
+	m_pControlBlock = 0;
+	m_pTokenSource = 0;
+	m_pToken = 0;
+
+	delete [] m_pBuffer;
+	m_pBuffer = 0;
+}
+
+void CDMAJob::Clear (void)
+{
+	assert (!m_bActive);
+
+	m_nTransfers = 0;
+}
+
+void CDMAJob::AddMemCopy (void *pDestination, const void *pSource, size_t nLength,
+			  unsigned nBurstLength, boolean bCached)
+{
+	assert (pDestination != 0);
+	assert (pSource != 0);
+	assert (nLength > 0);
+	assert (nLength <= TXFR_LEN_MAX);
+	assert (nBurstLength <= 15);
+
+	TDMAControlBlock *pBlock = AddTransfer (bCached ? (uintptr) pDestination : 0, nLength);
+
+	pBlock->nTransferInformation =   (nBurstLength << TI_BURST_LENGTH_SHIFT)
+				       | TI_SRC_WIDTH
+				       | TI_SRC_INC
+				       | TI_DEST_WIDTH
+				       | TI_DEST_INC;
+	pBlock->nSourceAddress       = BUS_ADDRESS ((uintptr) pSource);
+	pBlock->nDestinationAddress  = BUS_ADDRESS ((uintptr) pDestination);
+	pBlock->nTransferLength      = nLength;
+
+	if (bCached)
+	{
+		CleanDataCacheRange ((uintptr) pSource, nLength);
+		CleanAndInvalidateDataCacheRange ((uintptr) pDestination, nLength);
+	}
+}
+
+void CDMAJob::AddIORead (void *pDestination, u32 nIOAddress, size_t nLength, TDREQ DREQ)
+{
+	assert (pDestination != 0);
+	assert (nLength > 0);
+	assert (nLength <= TXFR_LEN_MAX);
+
+	nIOAddress &= 0xFFFFFF;
+	assert (nIOAddress != 0);
+	nIOAddress += GPU_IO_BASE;
+
+	TDMAControlBlock *pBlock = AddTransfer ((uintptr) pDestination, nLength);
+
+	pBlock->nTransferInformation =   (DREQ << TI_PERMAP_SHIFT)
+				       | (DEFAULT_BURST_LENGTH << TI_BURST_LENGTH_SHIFT)
+				       | TI_SRC_DREQ
+				       | TI_DEST_WIDTH
+				       | TI_DEST_INC
+				       | TI_WAIT_RESP;
+	pBlock->nSourceAddress       = nIOAddress;
+	pBlock->nDestinationAddress  = BUS_ADDRESS ((uintptr) pDestination);
+	pBlock->nTransferLength      = nLength;
+
+	CleanAndInvalidateDataCacheRange ((uintptr) pDestination, nLength);
+}
+
+void CDMAJob::AddIOWrite (u32 nIOAddress, const void *pSource, size_t nLength, TDREQ DREQ)
+{
+	assert (pSource != 0);
+	assert (nLength > 0);
+	assert (nLength <= TXFR_LEN_MAX);
+
+	nIOAddress &= 0xFFFFFF;
+	assert (nIOAddress != 0);
+	nIOAddress += GPU_IO_BASE;
+
+	TDMAControlBlock *pBlock = AddTransfer (0, 0);
+
+	pBlock->nTransferInformation =   (DREQ << TI_PERMAP_SHIFT)
+				       | (DEFAULT_BURST_LENGTH << TI_BURST_LENGTH_SHIFT)
+				       | TI_SRC_WIDTH
+				       | TI_SRC_INC
+				       | TI_DEST_DREQ
+				       | TI_WAIT_RESP;
+	pBlock->nSourceAddress       = BUS_ADDRESS ((uintptr) pSource);
+	pBlock->nDestinationAddress  = nIOAddress;
+	pBlock->nTransferLength      = nLength;
+
+	CleanDataCacheRange ((uintptr) pSource, nLength);
+}
+
+void CDMAJob::AddControlBlock (const TDMAControlBlock &rControlBlock)
+{
+	TDMAControlBlock *pBlock = AddTransfer (0, 0);
+
+	pBlock->nTransferInformation = rControlBlock.nTransferInformation & ~TI_INTEN;
+	pBlock->nSourceAddress       = rControlBlock.nSourceAddress;
+	pBlock->nDestinationAddress  = rControlBlock.nDestinationAddress;
+	pBlock->nTransferLength      = rControlBlock.nTransferLength;
+	pBlock->n2DModeStride        = rControlBlock.n2DModeStride;
+}
+
+void CDMAJob::SetCompletionRoutine (TDMAJobCompletionRoutine *pRoutine, void *pParam)
+{
+	assert (!m_bActive);
+
+	m_pCompletionRoutine = pRoutine;
+	m_pCompletionParam = pParam;
+}
+
+boolean CDMAJob::IsDone (void) const
+{
+	return !m_bActive;
+}
+
+boolean CDMAJob::GetStatus (void) const
+{
+	assert (!m_bActive);
+
+	return m_bStatus;
+}
+
+TDMAControlBlock *CDMAJob::AddTransfer (uintptr nInvalidateAddress, size_t nInvalidateLength)
+{
+	assert (!m_bActive);
+	assert (m_nTransfers < m_nMaxTransfers);
+
+	m_pInvalidate[m_nTransfers].nAddress = nInvalidateAddress;
+	m_pInvalidate[m_nTransfers].nLength = nInvalidateLength;
+
+	assert (m_pControlBlock != 0);
+	TDMAControlBlock *pBlock = &m_pControlBlock[m_nTransfers++];
+
+	pBlock->n2DModeStride = 0;
+	pBlock->nReserved[0] = 0;
+	pBlock->nReserved[1] = 0;
+
+	return pBlock;
+}
+
+void CDMAJob::Prepare (void)
+{
+	assert (m_nTransfers > 0);
+	assert (m_pControlBlock != 0);
+
+	for (unsigned i = 0; i < m_nTransfers; i++)
+	{
+		m_pControlBlock[i].nNextControlBlockAddress =
+			BUS_ADDRESS ((uintptr) &m_pControlBlock[i+1]);
+	}
+
+	// the last control block writes the token and raises the interrupt
+	TDMAControlBlock *pBlock = &m_pControlBlock[m_nTransfers];
+	pBlock->nTransferInformation     = TI_SRC_INC | TI_DEST_INC | TI_WAIT_RESP | TI_INTEN;
+	pBlock->nSourceAddress           = BUS_ADDRESS ((uintptr) m_pTokenSource);
+	pBlock->nDestinationAddress      = BUS_ADDRESS ((uintptr) m_pToken);
+	pBlock->nTransferLength          = sizeof (u32);
+	pBlock->n2DModeStride            = 0;
+	pBlock->nNextControlBlockAddress = 0;
+	pBlock->nReserved[0]             = 0;
+	pBlock->nReserved[1]             = 0;
+
+	CleanDataCacheRange ((uintptr) m_pControlBlock,
+			     (m_nTransfers + 1) * sizeof (TDMAControlBlock));
+
+	*m_pToken = 0;
+	CleanAndInvalidateDataCacheRange ((uintptr) m_pToken, sizeof (u32));
+
+	m_pNext = 0;
+	m_bStatus = FALSE;
+	m_bActive = TRUE;
+}
+
+void CDMAJob::Link (CDMAJob *pNext)
+{
+	assert (pNext != 0);
+	assert (pNext->m_pControlBlock != 0);
+
+	TDMAControlBlock *pBlock = &m_pControlBlock[m_nTransfers];
+	pBlock->nNextControlBlockAddress = BUS_ADDRESS ((uintptr) pNext->m_pControlBlock);
+
+	CleanDataCacheRange ((uintptr) pBlock, sizeof (TDMAControlBlock));
+
+	m_pNext = pNext;
+}
+
+boolean CDMAJob::HasCompleted (void) const
+{
+	InvalidateDataCacheRange ((uintptr) m_pToken, sizeof (u32));
+
+	return *m_pToken == DMA_JOB_TOKEN;
+}
+
+void CDMAJob::Complete (boolean bStatus)
+{
+	assert (m_bActive);
+
+	for (unsigned i = 0; i < m_nTransfers; i++)
+	{
+		if (m_pInvalidate[i].nAddress != 0)
+		{
+			InvalidateDataCacheRange (m_pInvalidate[i].nAddress, m_pInvalidate[i].nLength);
+		}
+	}
+
+	m_bStatus = bStatus;
+	m_bActive = FALSE;
+
+	if (m_pCompletionRoutine != 0)
+	{
+		(*m_pCompletionRoutine) (this, bStatus, m_pCompletionParam);
+	}
+}
+
+CDMAJobManager *CDMAJobManager::s_pThis = 0;
+
+CDMAJobManager::CDMAJobManager (CInterruptSystem *pInterruptSystem, unsigned nChannels)
+:	m_pInterruptSystem (pInterruptSystem),
+	m_nMaxChannels (nChannels),
+	m_nChannels (0),
+	m_nPending (0)
+{
+	assert (m_pInterruptSystem != 0);
+	assert (1 <= m_nMaxChannels && m_nMaxChannels <= DMA_JOB_CHANNELS);
+
+	assert (s_pThis == 0);
+	s_pThis = this;
+}
+
+CDMAJobManager::~CDMAJobManager (void)
+{
+	Wait ();
+
+	for (unsigned i = 0; i < m_nChannels; i++)
+	{
+		unsigned nChannel = m_Channel[i].nChannel;
+
+		m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_DMA0 + nChannel);
+
+		PeripheralEntry ();
+
+		write32 (ARM_DMACHAN_CS (nChannel), CS_RESET);
+		while (read32 (ARM_DMACHAN_CS (nChannel)) & CS_RESET)
+		{
+			// do nothing
+		}
+
+		write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) & ~(1 << nChannel));
+
+		PeripheralExit ();
+
+		CMachineInfo::Get ()->FreeDMAChannel (nChannel);
+	}
+
+	m_nChannels = 0;
+
+	s_pThis = 0;
+}
+
+boolean CDMAJobManager::Initialize (void)
+{
+	CMachineInfo *pMachineInfo = CMachineInfo::Get ();
+	assert (pMachineInfo != 0);
+
+	while (m_nChannels < m_nMaxChannels)
+	{
+		unsigned nChannel = pMachineInfo->AllocateDMAChannel (DMA_CHANNEL_NORMAL);
+		if (nChannel == DMA_CHANNEL_NONE)
+		{
+			break;
+		}
+
+		assert (nChannel <= DMA_CHANNEL_MAX);
+
+		TChannel *pChannel = &m_Channel[m_nChannels++];
+		pChannel->nChannel = nChannel;
+		pChannel->pFirstJob = 0;
+		pChannel->pLastJob = 0;
+		pChannel->nJobs = 0;
+
+		PeripheralEntry ();
+
+		write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) | (1 << nChannel));
+		CTimer::SimpleusDelay (1000);
+
+		write32 (ARM_DMACHAN_CS (nChannel), CS_RESET);
+		while (read32 (ARM_DMACHAN_CS (nChannel)) & CS_RESET)
+		{
+			// do nothing
+		}
+
+		PeripheralExit ();
+
+		// all channels are serviced by the same handler
+		m_pInterruptSystem->ConnectIRQ (ARM_IRQ_DMA0 + nChannel, InterruptStub, this);
+	}
+
+	if (m_nChannels == 0)
+	{
+		LOGWARN ("No DMA channel available");
+
+		return FALSE;
+	}
+
+	LOGNOTE ("Using %u DMA channel(s)", m_nChannels);
+
+	return TRUE;
+}
+
+void CDMAJobManager::Submit (CDMAJob *pJob)
+{
+	assert (pJob != 0);
+	assert (!pJob->m_bActive);
+	assert (m_nChannels > 0);
+
+	pJob->Prepare ();
+
+	__atomic_add_fetch (&m_nPending, 1, __ATOMIC_RELAXED);
+
+	m_SpinLock.Acquire ();
+
+	// use an idle channel or the channel with the shortest chain
+	TChannel *pChannel = &m_Channel[0];
+	for (unsigned i = 1; i < m_nChannels && pChannel->nJobs > 0; i++)
+	{
+		if (m_Channel[i].nJobs < pChannel->nJobs)
+		{
+			pChannel = &m_Channel[i];
+		}
+	}
+
+	pChannel->nJobs++;
+
+	if (pChannel->pFirstJob == 0)
+	{
+		pChannel->pFirstJob = pJob;
+		pChannel->pLastJob = pJob;
+
+		Start (pChannel, pJob);
+	}
+	else
+	{
+		// if the DMA controller has already loaded the last control block,
+		// it misses this link and the job is started from the interrupt handler
+		assert (pChannel->pLastJob != 0);
+		pChannel->pLastJob->Link (pJob);
+		pChannel->pLastJob = pJob;
+	}
+
+	m_SpinLock.Release ();
+}
+
+boolean CDMAJobManager::IsIdle (void) const
+{
+	return m_nPending == 0;
+}
+
+void CDMAJobManager::Wait (void)
+{
+	while (m_nPending != 0)
+	{
+		// do nothing
+	}
+}
+
+CDMAJobManager *CDMAJobManager::Get (void)
+{
+	return s_pThis;
+}
+
+void CDMAJobManager::Start (TChannel *pChannel, CDMAJob *pJob)
+{
+	assert (pChannel != 0);
+	assert (pJob != 0);
+	assert (pJob->m_pControlBlock != 0);
+
+	unsigned nChannel = pChannel->nChannel;
+
+	PeripheralEntry ();
+
+	assert (!(read32 (ARM_DMACHAN_CS (nChannel)) & CS_ACTIVE));
+
+	write32 (ARM_DMACHAN_CONBLK_AD (nChannel), BUS_ADDRESS ((uintptr) pJob->m_pControlBlock));
+
+	write32 (ARM_DMACHAN_CS (nChannel), CS_CONFIG | CS_END | CS_ACTIVE);
+
+	PeripheralExit ();
+}
+
+CDMAJob *CDMAJobManager::ChannelHandler (TChannel *pChannel)
+{
+	assert (pChannel != 0);
+	unsigned nChannel = pChannel->nChannel;
+
+	PeripheralEntry ();
+
+	// acknowledge the interrupt first, so that a later one is not lost,
+	// a channel, which has finished, remains idle despite CS_ACTIVE
+	write32 (ARM_DMACHAN_CS (nChannel), CS_CONFIG | CS_INT | CS_ACTIVE);
+
+	u32 nCS = read32 (ARM_DMACHAN_CS (nChannel));
+	u32 nDebug = read32 (ARM_DMACHAN_DEBUG (nChannel));
+
+	PeripheralExit ();
+
+	// collect the jobs, which have written their token
+	CDMAJob *pDoneList = 0;
+	CDMAJob **ppDoneTail = &pDoneList;
+
+	CDMAJob *pJob;
+	while (   (pJob = pChannel->pFirstJob) != 0
+	       && pJob->HasCompleted ())
+	{
+		pChannel->pFirstJob = pJob->m_pNext;
+		pChannel->nJobs--;
+
+		pJob->m_bStatus = TRUE;
+		pJob->m_pNext = 0;
+
+		*ppDoneTail = pJob;
+		ppDoneTail = &pJob->m_pNext;
+	}
+
+	if (nCS & CS_ERROR)
+	{
+		LOGWARN ("Transfer failed on channel %u (debug 0x%X)", nChannel, nDebug);
+
+		PeripheralEntry ();
+
+		write32 (ARM_DMACHAN_CS (nChannel), CS_RESET);
+		while (read32 (ARM_DMACHAN_CS (nChannel)) & CS_RESET)
+		{
+			// do nothing
+		}
+
+		PeripheralExit ();
+
+		// the job, which was running, has failed
+		pJob = pChannel->pFirstJob;
+		if (pJob != 0)
+		{
+			pChannel->pFirstJob = pJob->m_pNext;
+			pChannel->nJobs--;
+
+			pJob->m_bStatus = FALSE;
+			pJob->m_pNext = 0;
+
+			*ppDoneTail = pJob;
+		}
+
+		nCS &= ~CS_ACTIVE;
+	}
+
+	if (pChannel->pFirstJob == 0)
+	{
+		pChannel->pLastJob = 0;
+	}
+	else if (!(nCS & CS_ACTIVE))
+	{
+		// the chain has ended before a job has been linked to it
+		Start (pChannel, pChannel->pFirstJob);
+	}
+
+	return pDoneList;
+}
+
+void CDMAJobManager::InterruptHandler (void)
+{
+	PeripheralEntry ();
+	u32 nIntStatus = read32 (ARM_DMA_INT_STATUS);
+	PeripheralExit ();
+
+	for (unsigned i = 0; i < m_nChannels; i++)
+	{
+		TChannel *pChannel = &m_Channel[i];
+		if (!(nIntStatus & (1 << pChannel->nChannel)))
+		{
+			continue;
+		}
+
+		m_SpinLock.Acquire ();
+
+		CDMAJob *pDoneList = ChannelHandler (pChannel);
+
+		m_SpinLock.Release ();
+
+		// the completion routines may submit new jobs
+		while (pDoneList != 0)
+		{
+			CDMAJob *pJob = pDoneList;
+			pDoneList = pJob->m_pNext;
+			pJob->m_pNext = 0;
+
+			pJob->Complete (pJob->m_bStatus);
+
+			assert (m_nPending > 0);
+			__atomic_sub_fetch (&m_nPending, 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void CDMAJobManager::InterruptStub (void *pParam)
+{
+	CDMAJobManager *pThis = (CDMAJobManager *) pParam;
+	assert (pThis != 0);
+
+	pThis->InterruptHandler ();
+}
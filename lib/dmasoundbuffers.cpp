@@ -2,7 +2,7 @@
 // dmasoundbuffers.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2021-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -28,22 +28,31 @@
 #include <circle/new.h>
 #include <assert.h>
 
+#if RASPPI >= 4
+	#define ARM_FIQ_DMA(chan)	(ARM_IRQ_DMA0 + (chan))
+#else
+	#define ARM_FIQ_DMA(chan)	(ARM_FIQ_DMA0 + (chan))
+#endif
+
 CDMASoundBuffers::CDMASoundBuffers (boolean	      bDirectionOut,
 				    u32		      nIOAddress,
 				    TDREQ	      DREQ,
 				    unsigned	      nChunkSize,
-				    CInterruptSystem *pInterruptSystem)
+				    CInterruptSystem *pInterruptSystem,
+				    boolean	      bUseFIQ)
 :	m_bDirectionOut {bDirectionOut},
 	m_nIOAddress {nIOAddress},
 	m_DREQ {DREQ},
 	m_nChunkSize {nChunkSize},
 	m_pInterruptSystem {pInterruptSystem},
+	m_bUseFIQ {bUseFIQ},
 	m_pHandler {0},
 	m_bIRQConnected {FALSE},
 	m_State {StateCreated},
 	m_nDMAChannel {DMA_CHANNEL_MAX+1},
 	m_pDMABuffer {nullptr, nullptr},
-	m_pControlBlock {nullptr, nullptr}
+	m_pControlBlock {nullptr, nullptr},
+	m_SpinLock (bUseFIQ ? FIQ_LEVEL : IRQ_LEVEL)
 {
 }
 
@@ -58,7 +67,14 @@ CDMASoundBuffers::~CDMASoundBuffers (void)
 		if (m_bIRQConnected)
 		{
 			assert (m_pInterruptSystem != 0);
-			m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_DMA0+m_nDMAChannel);
+			if (m_bUseFIQ)
+			{
+				m_pInterruptSystem->DisconnectFIQ (ARM_FIQ_DMA (m_nDMAChannel));
+			}
+			else
+			{
+				m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_DMA0+m_nDMAChannel);
+			}
 		}
 
 		PeripheralEntry ();
@@ -135,7 +151,14 @@ boolean CDMASoundBuffers::Start (TChunkCompletedHandler *pHandler, void *pParam)
 		assert (!m_bIRQConnected);
 		assert (m_pInterruptSystem != 0);
 		assert (m_nDMAChannel <= DMA_CHANNEL_MAX);
-		m_pInterruptSystem->ConnectIRQ (ARM_IRQ_DMA0+m_nDMAChannel, InterruptStub, this);
+		if (m_bUseFIQ)
+		{
+			m_pInterruptSystem->ConnectFIQ (ARM_FIQ_DMA (m_nDMAChannel), InterruptStub, this);
+		}
+		else
+		{
+			m_pInterruptSystem->ConnectIRQ (ARM_IRQ_DMA0+m_nDMAChannel, InterruptStub, this);
+		}
 		m_bIRQConnected = TRUE;
 
 		m_State = StateIdle;
@@ -19,21 +19,30 @@
 //
 #include <circle/fs/fat/fatcache.h>
 #include <circle/logger.h>
+#include <circle/util.h>
 #include <circle/new.h>
 #include <assert.h>
 
 #define BUFFER_MAGIC		0x4641544D
 #define BUFFER_NOSECTOR		0xFFFFFFFF
 
+#define HASH(sector)		((sector) & (FAT_HASH_SIZE-1))
+
 #define FAULT_NO_BUFFER		0x1501
 #define FAULT_READ_ERROR	0x1502
 #define FAULT_WRITE_ERROR	0x1503
 
 CFATCache::CFATCache (void)
-:	m_pPartition (0)
+:	m_pPartition (0),
+	m_pRunBuffer (0)
 {
 	m_BufferList.pFirst = 0;
 	m_BufferList.pLast = 0;
+
+	for (unsigned i = 0; i < FAT_HASH_SIZE; i++)
+	{
+		m_pHashTable[i] = 0;
+	}
 }
 
 CFATCache::~CFATCache (void)
@@ -50,6 +59,13 @@ int CFATCache::Open (CDevice *pPartition)
 	m_pPartition = pPartition;
 	assert (m_pPartition != 0);
 
+	assert (m_pRunBuffer == 0);
+	m_pRunBuffer = new (HEAP_DMA30) unsigned char[FAT_RUN_SECTORS * FAT_SECTOR_SIZE];
+	if (m_pRunBuffer == 0)
+	{
+		return 0;
+	}
+
 	for (i = 1; i <= FAT_BUFFERS; i++)
 	{
 		pBuffer = new (HEAP_DMA30) TFATBuffer;
@@ -61,8 +77,10 @@ int CFATCache::Open (CDevice *pPartition)
 		pBuffer->nMagic    = BUFFER_MAGIC;
 		pBuffer->pNext     = 0;
 		pBuffer->pPrev     = pPrevBuffer;
+		pBuffer->pHashNext = 0;
 		pBuffer->nSector   = BUFFER_NOSECTOR;
 		pBuffer->nUseCount = 0;
+		pBuffer->bDirty    = 0;
 
 		if (pPrevBuffer != 0)
 		{
@@ -104,6 +122,14 @@ void CFATCache::Close (void)
 
 	m_BufferList.pFirst = 0;
 	m_BufferList.pLast = 0;
+
+	for (unsigned i = 0; i < FAT_HASH_SIZE; i++)
+	{
+		m_pHashTable[i] = 0;
+	}
+
+	delete [] m_pRunBuffer;
+	m_pRunBuffer = 0;
 }
 
 void CFATCache::Flush (void)
@@ -120,17 +146,10 @@ void CFATCache::Flush (void)
 		{
 			if (pBuffer->bDirty)
 			{
-				m_DiskLock.Acquire ();
-
-				m_pPartition->Seek (pBuffer->nSector * FAT_SECTOR_SIZE);
-				if (m_pPartition->Write (pBuffer->Data, FAT_SECTOR_SIZE) != FAT_SECTOR_SIZE)
+				if (!WriteRun (pBuffer))
 				{
 					Fault (FAULT_WRITE_ERROR);
 				}
-
-				m_DiskLock.Release ();
-
-				pBuffer->bDirty = 0;
 			}
 		}
 	}
@@ -138,22 +157,13 @@ void CFATCache::Flush (void)
 	m_BufferListLock.Release ();
 }
 
-TFATBuffer *CFATCache::GetSector (unsigned nSector, int bWriteOnly)
+TFATBuffer *CFATCache::GetSector (unsigned nSector, int bWriteOnly, unsigned nReadAhead)
 {
 	TFATBuffer *pBuffer;
 
 	m_BufferListLock.Acquire ();
 
-	for (pBuffer = m_BufferList.pFirst; pBuffer != 0; pBuffer = pBuffer->pNext)
-	{
-		assert (pBuffer->nMagic == BUFFER_MAGIC);
-
-		if (pBuffer->nSector == nSector)
-		{
-			break;
-		}
-	}
-
+	pBuffer = LookupBuffer (nSector);
 	if (pBuffer != 0)
 	{
 		MoveBufferFirst (pBuffer);
@@ -165,78 +175,100 @@ TFATBuffer *CFATCache::GetSector (unsigned nSector, int bWriteOnly)
 		return pBuffer;
 	}
 
+	pBuffer = AllocBuffer ();
+	if (pBuffer == 0)
+	{
+		Fault (FAULT_NO_BUFFER);
+		m_BufferListLock.Release ();
+		return 0;
+	}
+
+	pBuffer->nUseCount = 1;
+	assert (pBuffer->nSector == BUFFER_NOSECTOR);
+	pBuffer->nSector = nSector;
+	pBuffer->bDirty = 0;
+	InsertHash (pBuffer);
 
-	for (pBuffer = m_BufferList.pLast; pBuffer != 0; pBuffer = pBuffer->pPrev)
+	if (!bWriteOnly)
 	{
-		assert (pBuffer->nMagic == BUFFER_MAGIC);
+		// collect the following sectors, which are not cached yet, into one transfer
+		TFATBuffer *pRun[FAT_RUN_SECTORS];
+		pRun[0] = pBuffer;
+		unsigned nCount = 1;
 
-		if (pBuffer->nSector == BUFFER_NOSECTOR)
+		if (nReadAhead > FAT_RUN_SECTORS-1)
 		{
-			break;
+			nReadAhead = FAT_RUN_SECTORS-1;
 		}
-	}
 
-	if (pBuffer == 0)
-	{
-		for (pBuffer = m_BufferList.pLast; pBuffer != 0; pBuffer = pBuffer->pPrev)
+		while (   nCount <= nReadAhead
+		       && LookupBuffer (nSector + nCount) == 0)
 		{
-			assert (pBuffer->nMagic == BUFFER_MAGIC);
-
-			if (pBuffer->nUseCount == 0)
+			TFATBuffer *pAheadBuffer = AllocBuffer ();
+			if (pAheadBuffer == 0)
 			{
 				break;
 			}
+
+			pAheadBuffer->nUseCount = 1;	// reserve it until the data is read
+			pRun[nCount++] = pAheadBuffer;
 		}
 
-		if (pBuffer == 0)
+		m_DiskLock.Acquire ();
+
+		m_pPartition->Seek ((u64) nSector * FAT_SECTOR_SIZE);
+
+		int bOK;
+		if (nCount == 1)
 		{
-			Fault (FAULT_NO_BUFFER);
-			m_BufferListLock.Release ();
-			return 0;
+			bOK = m_pPartition->Read (pBuffer->Data, FAT_SECTOR_SIZE) == FAT_SECTOR_SIZE;
+		}
+		else
+		{
+			assert (m_pRunBuffer != 0);
+			bOK =    m_pPartition->Read (m_pRunBuffer, nCount * FAT_SECTOR_SIZE)
+			      == (int) (nCount * FAT_SECTOR_SIZE);
 		}
 
-		if (pBuffer->bDirty)
+		m_DiskLock.Release ();
+
+		for (unsigned i = 1; i < nCount; i++)
 		{
-			m_DiskLock.Acquire ();
+			TFATBuffer *pAheadBuffer = pRun[i];
+			assert (pAheadBuffer->nUseCount == 1);
+			pAheadBuffer->nUseCount = 0;
 
-			m_pPartition->Seek (pBuffer->nSector * FAT_SECTOR_SIZE);
-			if (m_pPartition->Write (pBuffer->Data, FAT_SECTOR_SIZE) != FAT_SECTOR_SIZE)
+			if (bOK)
 			{
-				Fault (FAULT_WRITE_ERROR);
-				m_DiskLock.Release ();
-				m_BufferListLock.Release ();
-				return 0;
+				pAheadBuffer->nSector = nSector + i;
+				pAheadBuffer->bDirty = 0;
+				memcpy (pAheadBuffer->Data, m_pRunBuffer + i * FAT_SECTOR_SIZE,
+					FAT_SECTOR_SIZE);
+				InsertHash (pAheadBuffer);
 			}
-
-			m_DiskLock.Release ();
 		}
 
-		pBuffer->nSector = BUFFER_NOSECTOR;
-		assert (pBuffer->nUseCount == 0);
-	}
-
-	pBuffer->nUseCount = 1;
-	assert (pBuffer->nSector == BUFFER_NOSECTOR);
-	pBuffer->nSector = nSector;
-	pBuffer->bDirty = 0;
-
-	if (!bWriteOnly)
-	{
-		m_DiskLock.Acquire ();
-
-		m_pPartition->Seek (nSector * FAT_SECTOR_SIZE);
-		if (m_pPartition->Read (pBuffer->Data, FAT_SECTOR_SIZE) != FAT_SECTOR_SIZE)
+		if (!bOK)
 		{
+			RemoveHash (pBuffer);
 			pBuffer->nUseCount--;
 			pBuffer->nSector = BUFFER_NOSECTOR;
 
 			Fault (FAULT_READ_ERROR);
-			m_DiskLock.Release ();
 			m_BufferListLock.Release ();
 			return 0;
 		}
 
-		m_DiskLock.Release ();
+		if (nCount > 1)
+		{
+			memcpy (pBuffer->Data, m_pRunBuffer, FAT_SECTOR_SIZE);
+		}
+
+		// read-ahead sectors follow the requested one in the LRU order
+		for (unsigned i = nCount-1; i > 0; i--)
+		{
+			MoveBufferFirst (pRun[i]);
+		}
 	}
 
 	MoveBufferFirst (pBuffer);
@@ -290,6 +322,245 @@ void CFATCache::MarkDirty (TFATBuffer *pBuffer)
 	pBuffer->bDirty = 1;
 }
 
+int CFATCache::ReadSectors (unsigned nSector, unsigned nCount, void *pBuffer)
+{
+	assert (nCount > 0);
+	assert (pBuffer != 0);
+
+	m_BufferListLock.Acquire ();
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		TFATBuffer *pCachedBuffer = LookupBuffer (nSector + i);
+		if (   pCachedBuffer != 0
+		    && pCachedBuffer->bDirty)
+		{
+			if (!WriteRun (pCachedBuffer))
+			{
+				Fault (FAULT_WRITE_ERROR);
+				m_BufferListLock.Release ();
+				return 0;
+			}
+		}
+	}
+
+	m_DiskLock.Acquire ();
+
+	m_pPartition->Seek ((u64) nSector * FAT_SECTOR_SIZE);
+	int bOK = m_pPartition->Read (pBuffer, nCount * FAT_SECTOR_SIZE) == (int) (nCount * FAT_SECTOR_SIZE);
+
+	m_DiskLock.Release ();
+
+	m_BufferListLock.Release ();
+
+	if (!bOK)
+	{
+		Fault (FAULT_READ_ERROR);
+	}
+
+	return bOK;
+}
+
+int CFATCache::WriteSectors (unsigned nSector, unsigned nCount, const void *pBuffer)
+{
+	assert (nCount > 0);
+	assert (pBuffer != 0);
+
+	m_BufferListLock.Acquire ();
+
+	m_DiskLock.Acquire ();
+
+	m_pPartition->Seek ((u64) nSector * FAT_SECTOR_SIZE);
+	int bOK = m_pPartition->Write (pBuffer, nCount * FAT_SECTOR_SIZE) == (int) (nCount * FAT_SECTOR_SIZE);
+
+	m_DiskLock.Release ();
+
+	if (bOK)
+	{
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			TFATBuffer *pCachedBuffer = LookupBuffer (nSector + i);
+			if (pCachedBuffer != 0)
+			{
+				memcpy (pCachedBuffer->Data,
+					(const unsigned char *) pBuffer + i * FAT_SECTOR_SIZE,
+					FAT_SECTOR_SIZE);
+				pCachedBuffer->bDirty = 0;
+			}
+		}
+	}
+
+	m_BufferListLock.Release ();
+
+	if (!bOK)
+	{
+		Fault (FAULT_WRITE_ERROR);
+	}
+
+	return bOK;
+}
+
+TFATBuffer *CFATCache::LookupBuffer (unsigned nSector)
+{
+	TFATBuffer *pBuffer;
+
+	for (pBuffer = m_pHashTable[HASH (nSector)]; pBuffer != 0; pBuffer = pBuffer->pHashNext)
+	{
+		assert (pBuffer->nMagic == BUFFER_MAGIC);
+
+		if (pBuffer->nSector == nSector)
+		{
+			break;
+		}
+	}
+
+	return pBuffer;
+}
+
+void CFATCache::InsertHash (TFATBuffer *pBuffer)
+{
+	assert (pBuffer->nSector != BUFFER_NOSECTOR);
+	TFATBuffer **ppHead = &m_pHashTable[HASH (pBuffer->nSector)];
+
+	pBuffer->pHashNext = *ppHead;
+	*ppHead = pBuffer;
+}
+
+void CFATCache::RemoveHash (TFATBuffer *pBuffer)
+{
+	assert (pBuffer->nSector != BUFFER_NOSECTOR);
+	TFATBuffer **ppBuffer = &m_pHashTable[HASH (pBuffer->nSector)];
+
+	while (*ppBuffer != pBuffer)
+	{
+		assert (*ppBuffer != 0);
+		ppBuffer = &(*ppBuffer)->pHashNext;
+	}
+
+	*ppBuffer = pBuffer->pHashNext;
+	pBuffer->pHashNext = 0;
+}
+
+TFATBuffer *CFATCache::AllocBuffer (void)
+{
+	TFATBuffer *pBuffer;
+
+	for (pBuffer = m_BufferList.pLast; pBuffer != 0; pBuffer = pBuffer->pPrev)
+	{
+		assert (pBuffer->nMagic == BUFFER_MAGIC);
+
+		if (   pBuffer->nSector == BUFFER_NOSECTOR
+		    && pBuffer->nUseCount == 0)
+		{
+			return pBuffer;
+		}
+	}
+
+	for (pBuffer = m_BufferList.pLast; pBuffer != 0; pBuffer = pBuffer->pPrev)
+	{
+		assert (pBuffer->nMagic == BUFFER_MAGIC);
+
+		if (pBuffer->nUseCount == 0)
+		{
+			break;
+		}
+	}
+
+	if (pBuffer == 0)
+	{
+		return 0;
+	}
+
+	if (pBuffer->bDirty)
+	{
+		if (!WriteRun (pBuffer))
+		{
+			Fault (FAULT_WRITE_ERROR);
+			return 0;
+		}
+	}
+
+	RemoveHash (pBuffer);
+	pBuffer->nSector = BUFFER_NOSECTOR;
+	assert (pBuffer->nUseCount == 0);
+
+	return pBuffer;
+}
+
+int CFATCache::WriteRun (TFATBuffer *pBuffer)
+{
+	assert (pBuffer->nMagic == BUFFER_MAGIC);
+	assert (pBuffer->bDirty);
+	assert (pBuffer->nSector != BUFFER_NOSECTOR);
+
+	// find start of the run of cached dirty sectors
+	unsigned nFirstSector = pBuffer->nSector;
+	while (   nFirstSector > 0
+	       && pBuffer->nSector - nFirstSector < FAT_RUN_SECTORS-1)
+	{
+		TFATBuffer *pPrevBuffer = LookupBuffer (nFirstSector-1);
+		if (   pPrevBuffer == 0
+		    || !pPrevBuffer->bDirty)
+		{
+			break;
+		}
+
+		nFirstSector--;
+	}
+
+	TFATBuffer *pRun[FAT_RUN_SECTORS];
+	unsigned nCount = 0;
+	while (nCount < FAT_RUN_SECTORS)
+	{
+		TFATBuffer *pRunBuffer = LookupBuffer (nFirstSector + nCount);
+		if (   pRunBuffer == 0
+		    || !pRunBuffer->bDirty)
+		{
+			break;
+		}
+
+		pRun[nCount++] = pRunBuffer;
+	}
+
+	assert (nCount > 0);
+	assert (pRun[pBuffer->nSector - nFirstSector] == pBuffer);
+
+	m_DiskLock.Acquire ();
+
+	m_pPartition->Seek ((u64) nFirstSector * FAT_SECTOR_SIZE);
+
+	int bOK;
+	if (nCount == 1)
+	{
+		bOK = m_pPartition->Write (pBuffer->Data, FAT_SECTOR_SIZE) == FAT_SECTOR_SIZE;
+	}
+	else
+	{
+		assert (m_pRunBuffer != 0);
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			memcpy (m_pRunBuffer + i * FAT_SECTOR_SIZE, pRun[i]->Data, FAT_SECTOR_SIZE);
+		}
+
+		bOK =    m_pPartition->Write (m_pRunBuffer, nCount * FAT_SECTOR_SIZE)
+		      == (int) (nCount * FAT_SECTOR_SIZE);
+	}
+
+	m_DiskLock.Release ();
+
+	if (!bOK)
+	{
+		return 0;
+	}
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		pRun[i]->bDirty = 0;
+	}
+
+	return 1;
+}
+
 void CFATCache::MoveBufferFirst (TFATBuffer *pBuffer)
 {
 	if (m_BufferList.pFirst != pBuffer)
@@ -271,6 +271,50 @@ unsigned CFATFileSystem::FileRead (unsigned hFile, void *pBuffer, unsigned ulByt
 			m_FileTableLock.Release ();
 			return ulBytesRead;
 		}
+
+		// read whole clusters directly into the caller's buffer
+		unsigned nClusterSize = m_FATInfo.GetSectorsPerCluster () * FAT_SECTOR_SIZE;
+		if (   pFile->pBuffer == 0
+		    && pFile->nOffset % nClusterSize == 0
+		    && ulBytes >= nClusterSize
+		    && ulBytesLeft >= nClusterSize)
+		{
+			if (pFile->nOffset > 0)
+			{
+				pFile->nCluster = m_FAT.GetClusterEntry (pFile->nCluster);
+				if (m_FAT.IsEOC (pFile->nCluster))
+				{
+					m_FileTableLock.Release ();
+					return FS_ERROR;
+				}
+			}
+
+			// extend the transfer over physically contiguous clusters
+			unsigned nClusters = 1;
+			while (   (nClusters+1) * nClusterSize <= ulBytes
+			       && (nClusters+1) * nClusterSize <= ulBytesLeft
+			       && m_FAT.GetClusterEntry (pFile->nCluster) == pFile->nCluster+1)
+			{
+				pFile->nCluster++;
+				nClusters++;
+			}
+
+			unsigned nSector = m_FATInfo.GetFirstSector (pFile->nCluster - (nClusters-1));
+			if (!m_Cache.ReadSectors (nSector, nClusters * m_FATInfo.GetSectorsPerCluster (),
+						  pBuffer))
+			{
+				m_FileTableLock.Release ();
+				return FS_ERROR;
+			}
+
+			unsigned nBytes = nClusters * nClusterSize;
+			pBuffer = (void *) (((unsigned char *) pBuffer) + nBytes);
+			pFile->nOffset += nBytes;
+			ulBytes -= nBytes;
+			ulBytesRead += nBytes;
+
+			continue;
+		}
 	
 		if (pFile->pBuffer == 0)
 		{
@@ -291,7 +335,15 @@ unsigned CFATFileSystem::FileRead (unsigned hFile, void *pBuffer, unsigned ulByt
 
 			unsigned nSector = m_FATInfo.GetFirstSector (pFile->nCluster) + nClusterOffset;
 
-			pFile->pBuffer = m_Cache.GetSector (nSector, 0);
+			// read the rest of the cluster ahead, as far as it belongs to the file
+			unsigned nReadAhead = m_FATInfo.GetSectorsPerCluster () - nClusterOffset - 1;
+			unsigned nSectorsLeft = (ulBytesLeft + FAT_SECTOR_SIZE-1) / FAT_SECTOR_SIZE;
+			if (nReadAhead > nSectorsLeft-1)
+			{
+				nReadAhead = nSectorsLeft-1;
+			}
+
+			pFile->pBuffer = m_Cache.GetSector (nSector, 0, nReadAhead);
 			assert (pFile->pBuffer != 0);
 		}
 	
@@ -371,6 +423,49 @@ unsigned CFATFileSystem::FileWrite (unsigned hFile, const void *pBuffer, unsigne
 			m_FileTableLock.Release ();
 			return ulBytesWritten;
 		}
+
+		// write whole clusters directly from the caller's buffer
+		unsigned nClusterSize = m_FATInfo.GetSectorsPerCluster () * FAT_SECTOR_SIZE;
+		if (   pFile->pBuffer == 0
+		    && pFile->nOffset % nClusterSize == 0
+		    && ulBytes >= nClusterSize
+		    && ulBytesLeft > nClusterSize)
+		{
+			unsigned nNextCluster = m_FAT.AllocateCluster ();
+			if (nNextCluster == 0)
+			{
+				m_FileTableLock.Release ();
+				return FS_ERROR;
+			}
+
+			if (pFile->nFirstCluster == 0)
+			{
+				pFile->nFirstCluster = nNextCluster;
+			}
+			else
+			{
+				m_FAT.SetClusterEntry (pFile->nCluster, nNextCluster);
+			}
+
+			pFile->nCluster = nNextCluster;
+
+			if (!m_Cache.WriteSectors (m_FATInfo.GetFirstSector (pFile->nCluster),
+						   m_FATInfo.GetSectorsPerCluster (), pBuffer))
+			{
+				m_FileTableLock.Release ();
+				return FS_ERROR;
+			}
+
+			pBuffer = (const void *) (((const unsigned char *) pBuffer) + nClusterSize);
+			pFile->nOffset += nClusterSize;
+			assert (pFile->nOffset < FAT_MAX_FILESIZE);
+			pFile->nSize += nClusterSize;
+			assert (pFile->nSize == pFile->nOffset);
+			ulBytes -= nClusterSize;
+			ulBytesWritten += nClusterSize;
+
+			continue;
+		}
 	
 		if (pFile->pBuffer == 0)
 		{
@@ -449,6 +544,30 @@ unsigned CFATFileSystem::FileWrite (unsigned hFile, const void *pBuffer, unsigne
 	return ulBytesWritten;
 }
 
+unsigned CFATFileSystem::FileGetSize (unsigned hFile)
+{
+	if (!(   1 <= hFile
+	      && hFile <= FAT_FILES))
+	{
+		return FS_ERROR;
+	}
+
+	m_FileTableLock.Acquire ();
+
+	TFile *pFile = &FILE (hFile);
+	if (!pFile->nUseCount)
+	{
+		m_FileTableLock.Release ();
+		return FS_ERROR;
+	}
+
+	unsigned nSize = pFile->nSize;
+
+	m_FileTableLock.Release ();
+
+	return nSize;
+}
+
 int CFATFileSystem::FileDelete (const char *pTitle)
 {
 	assert (pTitle != 0);
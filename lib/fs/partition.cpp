@@ -97,3 +97,31 @@ u64 CPartition::Seek (u64 ullOffset)
 
 	return m_ullOffset;
 }
+
+u64 CPartition::GetSize (void) const
+{
+	u64 ullSize = m_nNumberOfSectors;
+
+	return ullSize << FS_BLOCK_SHIFT;
+}
+
+boolean CPartition::SubmitRequest (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	u64 ullOffset = pRequest->GetOffset ();
+
+	u64 ullTransferEnd = ullOffset + pRequest->GetCount () + FS_BLOCK_SIZE-1;
+	ullTransferEnd >>= FS_BLOCK_SHIFT;
+	if (   (ullOffset & FS_BLOCK_MASK) != 0
+	    || ullTransferEnd > m_nNumberOfSectors)
+	{
+		return FALSE;
+	}
+
+	u64 ullDeviceOffset = m_nFirstSector;
+	ullDeviceOffset <<= FS_BLOCK_SHIFT;
+	pRequest->SetOffset (ullDeviceOffset + ullOffset);
+
+	assert (m_pDevice != 0);
+	return m_pDevice->SubmitRequest (pRequest);
+}
@@ -0,0 +1,452 @@
+//
+// gpiocapture.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/gpiocapture.h>
+#include <circle/bcm2835.h>
+#include <circle/bcm2835int.h>
+#include <circle/machineinfo.h>
+#include <circle/memio.h>
+#include <circle/timer.h>
+#include <circle/synchronize.h>
+#include <circle/util.h>
+#include <circle/new.h>
+#include <assert.h>
+
+//
+// PWM device selection
+//
+#if RASPPI <= 3
+	#define CLOCK_RATE	250000000
+	#define PWM_BASE	ARM_PWM_BASE
+	#define DREQ_SOURCE	DREQSourcePWM
+#else
+	#define CLOCK_RATE	125000000
+	#define PWM_BASE	ARM_PWM1_BASE
+	#define DREQ_SOURCE	DREQSourcePWM1
+#endif
+
+//
+// PWM register offsets
+//
+#define PWM_CTL			(PWM_BASE + 0x00)
+#define PWM_STA			(PWM_BASE + 0x04)
+#define PWM_DMAC		(PWM_BASE + 0x08)
+#define PWM_RNG1		(PWM_BASE + 0x10)
+#define PWM_FIF1		(PWM_BASE + 0x18)
+
+//
+// PWM control register
+//
+#define ARM_PWM_CTL_PWEN1	(1 << 0)
+#define ARM_PWM_CTL_USEF1	(1 << 5)
+#define ARM_PWM_CTL_CLRF1	(1 << 6)
+
+//
+// PWM DMA configuration register
+//
+#define ARM_PWM_DMAC_DREQ__SHIFT	0
+#define ARM_PWM_DMAC_PANIC__SHIFT	8
+#define ARM_PWM_DMAC_ENAB		(1 << 31)
+
+#define BUS_IO_ADDRESS(addr)	(((addr) & 0xFFFFFF) + GPU_IO_BASE)
+
+// the PWM FIFO is kept nearly empty, so that each sample waits for one PWM word
+#define PWM_DREQ_THRESHOLD	1
+
+CGPIOCapture::CGPIOCapture (unsigned nSampleRate, unsigned nBufferSize,
+			    CInterruptSystem *pInterrupt)
+:	m_nRange ((CLOCK_RATE + nSampleRate/2) / nSampleRate),
+	m_nBufferSize (nBufferSize),
+	m_pInterruptSystem (pInterrupt),
+	m_Clock (GPIOClockPWM),
+	m_nDMAChannel (CMachineInfo::Get ()->AllocateDMAChannel (DMA_CHANNEL_LITE)),
+	m_nReadPointer (0),
+	m_nNextHalf (0),
+	m_pHandler (0),
+	m_pHandlerParam (0),
+	m_bIRQConnected (FALSE),
+	m_bActive (FALSE)
+{
+	assert (2 <= m_nRange);
+	assert (m_nBufferSize >= 2);
+	assert ((m_nBufferSize & (m_nBufferSize-1)) == 0);
+
+	// allocate buffers, the samples are written to the whole ring by DMA
+	m_pRing = new (HEAP_DMA30) u32[m_nBufferSize];
+	assert (m_pRing != 0);
+
+	unsigned nControlBlocks = 2 * m_nBufferSize;
+	m_pControlBlockBuffer = new (HEAP_DMA30) u8[nControlBlocks * sizeof (TDMAControlBlock) + 31];
+	assert (m_pControlBlockBuffer != 0);
+	m_pControlBlock = (TDMAControlBlock *) (((uintptr) m_pControlBlockBuffer + 31) & ~31);
+
+	// setup the cyclic DMA chain, which reads one sample and feeds the PWM FIFO with it
+	for (unsigned i = 0; i < m_nBufferSize; i++)
+	{
+		TDMAControlBlock *pRead = &m_pControlBlock[2*i];
+		TDMAControlBlock *pPace = &m_pControlBlock[2*i+1];
+
+		pRead->nTransferInformation     = TI_WAIT_RESP;
+		pRead->nSourceAddress           = BUS_IO_ADDRESS (ARM_GPIO_GPLEV0);
+		pRead->nDestinationAddress      = BUS_ADDRESS ((uintptr) &m_pRing[i]);
+		pRead->nTransferLength          = sizeof (u32);
+		pRead->n2DModeStride            = 0;
+		pRead->nNextControlBlockAddress = BUS_ADDRESS ((uintptr) pPace);
+		pRead->nReserved[0]             = 0;
+		pRead->nReserved[1]             = 0;
+
+		pPace->nTransferInformation     =   (DREQ_SOURCE << TI_PERMAP_SHIFT)
+						  | TI_DEST_DREQ
+						  | TI_WAIT_RESP;
+		pPace->nSourceAddress           = BUS_ADDRESS ((uintptr) &m_pRing[i]);
+		pPace->nDestinationAddress      = BUS_IO_ADDRESS (PWM_FIF1);
+		pPace->nTransferLength          = sizeof (u32);
+		pPace->n2DModeStride            = 0;
+		pPace->nNextControlBlockAddress =
+			BUS_ADDRESS ((uintptr) &m_pControlBlock[(2*i+2) % nControlBlocks]);
+		pPace->nReserved[0]             = 0;
+		pPace->nReserved[1]             = 0;
+	}
+
+	// enable and reset DMA channel
+	PeripheralEntry ();
+
+	assert (m_nDMAChannel <= DMA_CHANNEL_MAX);
+	write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) | (1 << m_nDMAChannel));
+	CTimer::SimpleusDelay (1000);
+
+	write32 (ARM_DMACHAN_CS (m_nDMAChannel), CS_RESET);
+	while (read32 (ARM_DMACHAN_CS (m_nDMAChannel)) & CS_RESET)
+	{
+		// do nothing
+	}
+
+	PeripheralExit ();
+}
+
+CGPIOCapture::~CGPIOCapture (void)
+{
+	if (m_bActive)
+	{
+		Stop ();
+	}
+
+	// disable DMA channel
+	PeripheralEntry ();
+
+	assert (m_nDMAChannel <= DMA_CHANNEL_MAX);
+	write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) & ~(1 << m_nDMAChannel));
+
+	PeripheralExit ();
+
+	// disconnect IRQ
+	if (m_bIRQConnected)
+	{
+		assert (m_pInterruptSystem != 0);
+		m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_DMA0+m_nDMAChannel);
+	}
+
+	m_pInterruptSystem = 0;
+
+	// free DMA channel
+	CMachineInfo::Get ()->FreeDMAChannel (m_nDMAChannel);
+
+	// free buffers
+	m_pControlBlock = 0;
+	delete [] m_pControlBlockBuffer;
+	m_pControlBlockBuffer = 0;
+
+	delete [] m_pRing;
+	m_pRing = 0;
+}
+
+boolean CGPIOCapture::Start (void)
+{
+	assert (!m_bActive);
+
+	m_nReadPointer = 0;
+	m_nNextHalf = 0;
+
+	// interrupt after each half of the ring, if a handler is registered
+	unsigned nHalf = m_nBufferSize / 2;
+	for (unsigned i = 0; i < m_nBufferSize; i++)
+	{
+		TDMAControlBlock *pPace = &m_pControlBlock[2*i+1];
+
+		pPace->nTransferInformation &= ~TI_INTEN;
+		if (   m_pHandler != 0
+		    && (i+1) % nHalf == 0)
+		{
+			pPace->nTransferInformation |= TI_INTEN;
+		}
+	}
+
+	if (m_pHandler != 0)
+	{
+		if (m_pInterruptSystem == 0)
+		{
+			return FALSE;
+		}
+
+		if (!m_bIRQConnected)
+		{
+			assert (m_nDMAChannel <= DMA_CHANNEL_MAX);
+			m_pInterruptSystem->ConnectIRQ (ARM_IRQ_DMA0+m_nDMAChannel, InterruptStub, this);
+
+			m_bIRQConnected = TRUE;
+		}
+	}
+
+	CleanAndInvalidateDataCacheRange ((uintptr) m_pControlBlock,
+					  2 * m_nBufferSize * sizeof (TDMAControlBlock));
+	CleanAndInvalidateDataCacheRange ((uintptr) m_pRing, m_nBufferSize * sizeof (u32));
+
+	RunPWM ();
+
+	// start DMA
+	PeripheralEntry ();
+
+	assert (m_nDMAChannel <= DMA_CHANNEL_MAX);
+	assert (!(read32 (ARM_DMACHAN_CS (m_nDMAChannel)) & CS_INT));
+
+	write32 (ARM_DMACHAN_CONBLK_AD (m_nDMAChannel), BUS_ADDRESS ((uintptr) m_pControlBlock));
+
+	write32 (ARM_DMACHAN_CS (m_nDMAChannel),   CS_WAIT_FOR_OUTSTANDING_WRITES
+					         | (DEFAULT_PANIC_PRIORITY << CS_PANIC_PRIORITY_SHIFT)
+					         | (DEFAULT_PRIORITY << CS_PRIORITY_SHIFT)
+					         | CS_ACTIVE);
+
+	PeripheralExit ();
+
+	m_bActive = TRUE;
+
+	return TRUE;
+}
+
+void CGPIOCapture::Stop (void)
+{
+	assert (m_bActive);
+	m_bActive = FALSE;
+
+	PeripheralEntry ();
+
+	assert (m_nDMAChannel <= DMA_CHANNEL_MAX);
+
+	// pause, let the current transfer complete and reset the channel
+	write32 (ARM_DMACHAN_CS (m_nDMAChannel), 0);
+	CTimer::SimpleusDelay (10);
+
+	write32 (ARM_DMACHAN_CS (m_nDMAChannel), CS_RESET);
+	while (read32 (ARM_DMACHAN_CS (m_nDMAChannel)) & CS_RESET)
+	{
+		// do nothing
+	}
+
+	write32 (ARM_DMA_INT_STATUS, 1 << m_nDMAChannel);
+
+	PeripheralExit ();
+
+	StopPWM ();
+}
+
+boolean CGPIOCapture::IsActive (void) const
+{
+	return m_bActive;
+}
+
+unsigned CGPIOCapture::GetSampleRate (void) const
+{
+	assert (m_nRange > 0);
+	return CLOCK_RATE / m_nRange;
+}
+
+void CGPIOCapture::RegisterHandler (TCaptureHandler *pHandler, void *pParam)
+{
+	assert (!m_bActive);
+
+	m_pHandlerParam = pParam;
+	m_pHandler = pHandler;
+}
+
+unsigned CGPIOCapture::GetAvailable (void)
+{
+	if (!m_bActive)
+	{
+		return 0;
+	}
+
+	return (GetWritePointer () - m_nReadPointer) & (m_nBufferSize-1);
+}
+
+unsigned CGPIOCapture::Read (u32 *pBuffer, unsigned nCount)
+{
+	assert (pBuffer != 0);
+
+	unsigned nAvailable = GetAvailable ();
+	if (nCount > nAvailable)
+	{
+		nCount = nAvailable;
+	}
+
+	unsigned nResult = nCount;
+	while (nCount > 0)
+	{
+		// copy one contiguous part of the ring at a time
+		unsigned nChunk = m_nBufferSize - m_nReadPointer;
+		if (nChunk > nCount)
+		{
+			nChunk = nCount;
+		}
+
+		const u32 *pSamples = &m_pRing[m_nReadPointer];
+		CleanAndInvalidateDataCacheRange ((uintptr) pSamples, nChunk * sizeof (u32));
+
+		memcpy (pBuffer, pSamples, nChunk * sizeof (u32));
+
+		pBuffer += nChunk;
+		nCount -= nChunk;
+		m_nReadPointer = (m_nReadPointer + nChunk) & (m_nBufferSize-1);
+	}
+
+	return nResult;
+}
+
+unsigned CGPIOCapture::ExtractEdges (const u32 *pSamples, unsigned nCount, u32 nPinMask,
+				     u32 *pLastLevels, TGPIOCaptureEdge *pEdges, unsigned nMaxEdges)
+{
+	assert (pSamples != 0);
+	assert (pLastLevels != 0);
+	assert (pEdges != 0);
+
+	unsigned nResult = 0;
+	u32 nLevels = *pLastLevels & nPinMask;
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		u32 nSample = pSamples[i] & nPinMask;
+		if (nSample == nLevels)
+		{
+			continue;
+		}
+
+		if (nResult >= nMaxEdges)
+		{
+			break;
+		}
+
+		pEdges[nResult].nSample = i;
+		pEdges[nResult].nLevels = nSample;
+		pEdges[nResult].nChanged = nSample ^ nLevels;
+		nResult++;
+
+		nLevels = nSample;
+	}
+
+	*pLastLevels = nLevels;
+
+	return nResult;
+}
+
+unsigned CGPIOCapture::GetWritePointer (void)
+{
+	PeripheralEntry ();
+
+	assert (m_nDMAChannel <= DMA_CHANNEL_MAX);
+	u32 nControlBlock = read32 (ARM_DMACHAN_CONBLK_AD (m_nDMAChannel));
+
+	PeripheralExit ();
+
+	// the sample of the current control block pair may not be written yet
+	unsigned nOffset = nControlBlock - BUS_ADDRESS ((uintptr) m_pControlBlock);
+
+	return nOffset / (2 * sizeof (TDMAControlBlock)) & (m_nBufferSize-1);
+}
+
+void CGPIOCapture::RunPWM (void)
+{
+#ifndef NDEBUG
+	boolean bOK =
+#endif
+		m_Clock.StartRate (CLOCK_RATE);
+	assert (bOK);
+	CTimer::SimpleusDelay (2000);
+
+	PeripheralEntry ();
+
+	write32 (PWM_RNG1, m_nRange);
+
+	write32 (PWM_DMAC,   ARM_PWM_DMAC_ENAB
+			   | (PWM_DREQ_THRESHOLD << ARM_PWM_DMAC_PANIC__SHIFT)
+			   | (PWM_DREQ_THRESHOLD << ARM_PWM_DMAC_DREQ__SHIFT));
+
+	write32 (PWM_CTL, ARM_PWM_CTL_PWEN1 | ARM_PWM_CTL_USEF1 | ARM_PWM_CTL_CLRF1);
+	CTimer::SimpleusDelay (2000);
+
+	PeripheralExit ();
+}
+
+void CGPIOCapture::StopPWM (void)
+{
+	PeripheralEntry ();
+
+	write32 (PWM_DMAC, 0);
+	write32 (PWM_CTL, 0);
+	CTimer::SimpleusDelay (2000);
+
+	PeripheralExit ();
+
+	m_Clock.Stop ();
+	CTimer::SimpleusDelay (2000);
+}
+
+void CGPIOCapture::InterruptHandler (void)
+{
+	PeripheralEntry ();
+
+	assert (m_nDMAChannel <= DMA_CHANNEL_MAX);
+	write32 (ARM_DMA_INT_STATUS, 1 << m_nDMAChannel);
+
+	u32 nCS = read32 (ARM_DMACHAN_CS (m_nDMAChannel));
+	write32 (ARM_DMACHAN_CS (m_nDMAChannel), nCS);	// reset CS_INT
+
+	PeripheralExit ();
+
+	if (   !m_bActive
+	    || (nCS & CS_ERROR))
+	{
+		return;
+	}
+
+	unsigned nHalf = m_nBufferSize / 2;
+	const u32 *pSamples = &m_pRing[m_nNextHalf * nHalf];
+	CleanAndInvalidateDataCacheRange ((uintptr) pSamples, nHalf * sizeof (u32));
+
+	m_nNextHalf ^= 1;
+
+	assert (m_pHandler != 0);
+	(*m_pHandler) (pSamples, nHalf, m_pHandlerParam);
+}
+
+void CGPIOCapture::InterruptStub (void *pParam)
+{
+	CGPIOCapture *pThis = (CGPIOCapture *) pParam;
+	assert (pThis != 0);
+
+	pThis->InterruptHandler ();
+}
@@ -2,7 +2,7 @@
 // gpiopinfiq.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -68,7 +68,7 @@ void CGPIOPinFIQ::DisconnectInterrupt (void)
 	m_pHandler = 0;
 
 	assert (m_pInterrupt != 0);
-	m_pInterrupt->DisconnectFIQ ();
+	m_pInterrupt->DisconnectFIQ (ARM_FIQ_GPIO3);
 }
 
 void CGPIOPinFIQ::FIQHandler (void *pParam)
@@ -0,0 +1,331 @@
+//
+// gpiopingroup.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/gpiopingroup.h>
+#include <circle/bcm2835.h>
+#include <circle/dmachannel.h>
+#include <circle/machineinfo.h>
+#include <circle/memio.h>
+#include <circle/timer.h>
+#include <circle/synchronize.h>
+#include <circle/new.h>
+#include <assert.h>
+
+//
+// PWM device selection
+//
+#if RASPPI <= 3
+	#define CLOCK_RATE	250000000
+	#define PWM_BASE	ARM_PWM_BASE
+	#define DREQ_SOURCE	DREQSourcePWM
+#else
+	#define CLOCK_RATE	125000000
+	#define PWM_BASE	ARM_PWM1_BASE
+	#define DREQ_SOURCE	DREQSourcePWM1
+#endif
+
+//
+// PWM register offsets
+//
+#define PWM_CTL			(PWM_BASE + 0x00)
+#define PWM_DMAC		(PWM_BASE + 0x08)
+#define PWM_RNG1		(PWM_BASE + 0x10)
+#define PWM_FIF1		(PWM_BASE + 0x18)
+
+#define ARM_PWM_CTL_PWEN1	(1 << 0)
+#define ARM_PWM_CTL_USEF1	(1 << 5)
+#define ARM_PWM_CTL_CLRF1	(1 << 6)
+
+#define ARM_PWM_DMAC_DREQ__SHIFT	0
+#define ARM_PWM_DMAC_PANIC__SHIFT	8
+#define ARM_PWM_DMAC_ENAB		(1 << 31)
+
+#define BUS_IO_ADDRESS(addr)	(((addr) & 0xFFFFFF) + GPU_IO_BASE)
+
+#define PWM_DREQ_THRESHOLD	1
+
+CGPIOPinGroup::CGPIOPinGroup (const unsigned *pPins, unsigned nPins, TGPIOMode Mode)
+:	m_nPins (nPins),
+	m_nMask (0),
+	m_bContiguous (TRUE),
+	m_Clock (GPIOClockPWM)
+{
+	assert (pPins != 0);
+	assert (1 <= m_nPins && m_nPins <= GPIO_PIN_GROUP_MAX_PINS);
+
+	unsigned Pins[GPIO_PIN_GROUP_MAX_PINS];
+	for (unsigned i = 0; i < m_nPins; i++)
+	{
+		m_Pin[i].AssignPin (pPins[i]);
+		m_Pin[i].SetMode (Mode, TRUE);
+
+		unsigned nPin = pPins[i];
+		if (nPin >= GPIO_PINS)
+		{
+			nPin = CMachineInfo::Get ()->GetGPIOPin ((TGPIOVirtualPin) nPin);
+		}
+		assert (nPin < GPIO_PINS);
+		Pins[i] = nPin;
+
+		if (i == 0)
+		{
+			m_nRegOffset = (nPin / 32) * 4;
+			m_nShift = nPin % 32;
+		}
+		else if (nPin != Pins[0] + i)
+		{
+			m_bContiguous = FALSE;
+		}
+
+		assert ((nPin / 32) * 4 == m_nRegOffset);
+		assert (!(m_nMask & (1 << (nPin % 32))));
+		m_nMask |= 1 << (nPin % 32);
+	}
+
+	// calculate the physical mask for each possible value of each nibble
+	for (unsigned nNibble = 0; nNibble < GPIO_PIN_GROUP_MAX_PINS/4; nNibble++)
+	{
+		for (unsigned nValue = 0; nValue < 16; nValue++)
+		{
+			u32 nMask = 0;
+			for (unsigned nBit = 0; nBit < 4; nBit++)
+			{
+				unsigned nIndex = nNibble*4 + nBit;
+				if (   nIndex < m_nPins
+				    && (nValue & (1 << nBit)))
+				{
+					nMask |= 1 << (Pins[nIndex] % 32);
+				}
+			}
+
+			m_SetMask[nNibble][nValue] = nMask;
+		}
+	}
+}
+
+CGPIOPinGroup::~CGPIOPinGroup (void)
+{
+	m_nPins = 0;
+}
+
+void CGPIOPinGroup::Write (u32 nValue)
+{
+	u32 nSet = GetSetMask (nValue);
+	u32 nClear = m_nMask & ~nSet;
+
+	PeripheralEntry ();
+
+	write32 (ARM_GPIO_GPCLR0 + m_nRegOffset, nClear);
+	write32 (ARM_GPIO_GPSET0 + m_nRegOffset, nSet);
+
+	PeripheralExit ();
+}
+
+u32 CGPIOPinGroup::Read (void) const
+{
+	PeripheralEntry ();
+
+	u32 nLevels = read32 (ARM_GPIO_GPLEV0 + m_nRegOffset);
+
+	PeripheralExit ();
+
+	if (m_bContiguous)
+	{
+		return (nLevels & m_nMask) >> m_nShift;
+	}
+
+	u32 nResult = 0;
+	for (unsigned i = 0; i < m_nPins; i++)
+	{
+		if (nLevels & m_SetMask[i / 4][1 << (i % 4)])
+		{
+			nResult |= 1 << i;
+		}
+	}
+
+	return nResult;
+}
+
+unsigned CGPIOPinGroup::GetPinCount (void) const
+{
+	return m_nPins;
+}
+
+boolean CGPIOPinGroup::WriteWaveform (const u32 *pValues, unsigned nCount, unsigned nSampleRate)
+{
+	assert (pValues != 0);
+	assert (nCount > 0);
+	assert (nSampleRate > 0);
+
+	unsigned nRange = (CLOCK_RATE + nSampleRate/2) / nSampleRate;
+	if (nRange < 2)
+	{
+		return FALSE;
+	}
+
+	unsigned nDMAChannel = CMachineInfo::Get ()->AllocateDMAChannel (DMA_CHANNEL_LITE);
+	if (nDMAChannel == DMA_CHANNEL_NONE)
+	{
+		return FALSE;
+	}
+	assert (nDMAChannel <= DMA_CHANNEL_MAX);
+
+	// convert the values into clear/set masks
+	u32 *pMasks = new (HEAP_DMA30) u32[2*nCount];
+	if (pMasks == 0)
+	{
+		CMachineInfo::Get ()->FreeDMAChannel (nDMAChannel);
+
+		return FALSE;
+	}
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		u32 nSet = GetSetMask (pValues[i]);
+
+		pMasks[2*i]   = m_nMask & ~nSet;
+		pMasks[2*i+1] = nSet;
+	}
+
+	// three control blocks per value: wait for the PWM FIFO, clear and set the pins
+	unsigned nControlBlocks = 3*nCount;
+	u8 *pControlBlockBuffer = new (HEAP_DMA30) u8[nControlBlocks * sizeof (TDMAControlBlock) + 31];
+	if (pControlBlockBuffer == 0)
+	{
+		delete [] pMasks;
+		CMachineInfo::Get ()->FreeDMAChannel (nDMAChannel);
+
+		return FALSE;
+	}
+	TDMAControlBlock *pControlBlock =
+		(TDMAControlBlock *) (((uintptr) pControlBlockBuffer + 31) & ~31);
+
+	for (unsigned i = 0; i < nControlBlocks; i++)
+	{
+		TDMAControlBlock *pCB = &pControlBlock[i];
+		u32 *pMask = &pMasks[2*(i/3)];
+
+		switch (i % 3)
+		{
+		case 0:
+			pCB->nTransferInformation = (DREQ_SOURCE << TI_PERMAP_SHIFT)
+						    | TI_DEST_DREQ
+						    | TI_WAIT_RESP;
+			pCB->nSourceAddress       = BUS_ADDRESS ((uintptr) pMask);
+			pCB->nDestinationAddress  = BUS_IO_ADDRESS (PWM_FIF1);
+			break;
+
+		case 1:
+			pCB->nTransferInformation = TI_WAIT_RESP;
+			pCB->nSourceAddress       = BUS_ADDRESS ((uintptr) pMask);
+			pCB->nDestinationAddress  = BUS_IO_ADDRESS (ARM_GPIO_GPCLR0 + m_nRegOffset);
+			break;
+
+		case 2:
+			pCB->nTransferInformation = TI_WAIT_RESP;
+			pCB->nSourceAddress       = BUS_ADDRESS ((uintptr) (pMask+1));
+			pCB->nDestinationAddress  = BUS_IO_ADDRESS (ARM_GPIO_GPSET0 + m_nRegOffset);
+			break;
+		}
+
+		pCB->nTransferLength          = sizeof (u32);
+		pCB->n2DModeStride            = 0;
+		pCB->nNextControlBlockAddress =   i+1 < nControlBlocks
+						? BUS_ADDRESS ((uintptr) &pControlBlock[i+1]) : 0;
+		pCB->nReserved[0]             = 0;
+		pCB->nReserved[1]             = 0;
+	}
+
+	CleanAndInvalidateDataCacheRange ((uintptr) pMasks, 2*nCount * sizeof (u32));
+	CleanAndInvalidateDataCacheRange ((uintptr) pControlBlock,
+					  nControlBlocks * sizeof (TDMAControlBlock));
+
+	// start PWM
+#ifndef NDEBUG
+	boolean bOK =
+#endif
+		m_Clock.StartRate (CLOCK_RATE);
+	assert (bOK);
+	CTimer::SimpleusDelay (2000);
+
+	PeripheralEntry ();
+
+	write32 (PWM_RNG1, nRange);
+	write32 (PWM_DMAC,   ARM_PWM_DMAC_ENAB
+			   | (PWM_DREQ_THRESHOLD << ARM_PWM_DMAC_PANIC__SHIFT)
+			   | (PWM_DREQ_THRESHOLD << ARM_PWM_DMAC_DREQ__SHIFT));
+	write32 (PWM_CTL, ARM_PWM_CTL_PWEN1 | ARM_PWM_CTL_USEF1 | ARM_PWM_CTL_CLRF1);
+	CTimer::SimpleusDelay (2000);
+
+	// enable, reset and start DMA channel
+	write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) | (1 << nDMAChannel));
+	CTimer::SimpleusDelay (1000);
+
+	write32 (ARM_DMACHAN_CS (nDMAChannel), CS_RESET);
+	while (read32 (ARM_DMACHAN_CS (nDMAChannel)) & CS_RESET)
+	{
+		// do nothing
+	}
+
+	write32 (ARM_DMACHAN_CONBLK_AD (nDMAChannel), BUS_ADDRESS ((uintptr) pControlBlock));
+	write32 (ARM_DMACHAN_CS (nDMAChannel),   CS_WAIT_FOR_OUTSTANDING_WRITES
+					       | (DEFAULT_PANIC_PRIORITY << CS_PANIC_PRIORITY_SHIFT)
+					       | (DEFAULT_PRIORITY << CS_PRIORITY_SHIFT)
+					       | CS_ACTIVE);
+
+	u32 nCS;
+	while ((nCS = read32 (ARM_DMACHAN_CS (nDMAChannel))) & CS_ACTIVE)
+	{
+		// wait for completion
+	}
+
+	write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) & ~(1 << nDMAChannel));
+
+	// stop PWM
+	write32 (PWM_DMAC, 0);
+	write32 (PWM_CTL, 0);
+
+	PeripheralExit ();
+
+	m_Clock.Stop ();
+
+	CMachineInfo::Get ()->FreeDMAChannel (nDMAChannel);
+
+	delete [] pControlBlockBuffer;
+	delete [] pMasks;
+
+	return nCS & CS_ERROR ? FALSE : TRUE;
+}
+
+u32 CGPIOPinGroup::GetSetMask (u32 nValue) const
+{
+	if (m_bContiguous)
+	{
+		return (nValue << m_nShift) & m_nMask;
+	}
+
+	u32 nResult = 0;
+	for (unsigned nNibble = 0; nValue != 0; nNibble++, nValue >>= 4)
+	{
+		assert (nNibble < GPIO_PIN_GROUP_MAX_PINS/4);
+		nResult |= m_SetMask[nNibble][nValue & 0xF];
+	}
+
+	return nResult;
+}
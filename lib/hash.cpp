@@ -0,0 +1,209 @@
+//
+// hash.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/hash.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define PRIME32_1	0x9E3779B1U
+#define PRIME32_2	0x85EBCA77U
+#define PRIME32_3	0xC2B2AE3DU
+#define PRIME32_4	0x27D4EB2FU
+#define PRIME32_5	0x165667B1U
+
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+
+static inline u32 Rotl32 (u32 nValue, unsigned nBits)
+{
+	return (nValue << nBits) | (nValue >> (32 - nBits));
+}
+
+static inline u64 Rotl64 (u64 nValue, unsigned nBits)
+{
+	return (nValue << nBits) | (nValue >> (64 - nBits));
+}
+
+// the data may be unaligned
+static inline u32 Read32 (const u8 *p)
+{
+	u32 nValue;
+	memcpy (&nValue, p, sizeof nValue);
+
+	return nValue;
+}
+
+static inline u64 Read64 (const u8 *p)
+{
+	u64 nValue;
+	memcpy (&nValue, p, sizeof nValue);
+
+	return nValue;
+}
+
+static inline u32 Round32 (u32 nAcc, u32 nInput)
+{
+	nAcc += nInput * PRIME32_2;
+	nAcc = Rotl32 (nAcc, 13);
+
+	return nAcc * PRIME32_1;
+}
+
+static inline u64 Round64 (u64 nAcc, u64 nInput)
+{
+	nAcc += nInput * PRIME64_2;
+	nAcc = Rotl64 (nAcc, 31);
+
+	return nAcc * PRIME64_1;
+}
+
+static inline u64 MergeRound64 (u64 nAcc, u64 nValue)
+{
+	nAcc ^= Round64 (0, nValue);
+
+	return nAcc * PRIME64_1 + PRIME64_4;
+}
+
+u32 CHash::XXHash32 (const void *pBuffer, size_t nLength, u32 nSeed)
+{
+	assert (pBuffer != 0 || nLength == 0);
+
+	const u8 *p = (const u8 *) pBuffer;
+	const u8 *pEnd = p + nLength;
+
+	u32 nHash;
+	if (nLength >= 16)
+	{
+		u32 v1 = nSeed + PRIME32_1 + PRIME32_2;
+		u32 v2 = nSeed + PRIME32_2;
+		u32 v3 = nSeed;
+		u32 v4 = nSeed - PRIME32_1;
+
+		for (; p + 16 <= pEnd; p += 16)
+		{
+			v1 = Round32 (v1, Read32 (p));
+			v2 = Round32 (v2, Read32 (p + 4));
+			v3 = Round32 (v3, Read32 (p + 8));
+			v4 = Round32 (v4, Read32 (p + 12));
+		}
+
+		nHash = Rotl32 (v1, 1) + Rotl32 (v2, 7) + Rotl32 (v3, 12) + Rotl32 (v4, 18);
+	}
+	else
+	{
+		nHash = nSeed + PRIME32_5;
+	}
+
+	nHash += (u32) nLength;
+
+	for (; p + 4 <= pEnd; p += 4)
+	{
+		nHash += Read32 (p) * PRIME32_3;
+		nHash = Rotl32 (nHash, 17) * PRIME32_4;
+	}
+
+	for (; p < pEnd; p++)
+	{
+		nHash += *p * PRIME32_5;
+		nHash = Rotl32 (nHash, 11) * PRIME32_1;
+	}
+
+	nHash ^= nHash >> 15;
+	nHash *= PRIME32_2;
+	nHash ^= nHash >> 13;
+	nHash *= PRIME32_3;
+	nHash ^= nHash >> 16;
+
+	return nHash;
+}
+
+u64 CHash::XXHash64 (const void *pBuffer, size_t nLength, u64 nSeed)
+{
+	assert (pBuffer != 0 || nLength == 0);
+
+	const u8 *p = (const u8 *) pBuffer;
+	const u8 *pEnd = p + nLength;
+
+	u64 nHash;
+	if (nLength >= 32)
+	{
+		u64 v1 = nSeed + PRIME64_1 + PRIME64_2;
+		u64 v2 = nSeed + PRIME64_2;
+		u64 v3 = nSeed;
+		u64 v4 = nSeed - PRIME64_1;
+
+		for (; p + 32 <= pEnd; p += 32)
+		{
+			v1 = Round64 (v1, Read64 (p));
+			v2 = Round64 (v2, Read64 (p + 8));
+			v3 = Round64 (v3, Read64 (p + 16));
+			v4 = Round64 (v4, Read64 (p + 24));
+		}
+
+		nHash = Rotl64 (v1, 1) + Rotl64 (v2, 7) + Rotl64 (v3, 12) + Rotl64 (v4, 18);
+		nHash = MergeRound64 (nHash, v1);
+		nHash = MergeRound64 (nHash, v2);
+		nHash = MergeRound64 (nHash, v3);
+		nHash = MergeRound64 (nHash, v4);
+	}
+	else
+	{
+		nHash = nSeed + PRIME64_5;
+	}
+
+	nHash += (u64) nLength;
+
+	for (; p + 8 <= pEnd; p += 8)
+	{
+		nHash ^= Round64 (0, Read64 (p));
+		nHash = Rotl64 (nHash, 27) * PRIME64_1 + PRIME64_4;
+	}
+
+	if (p + 4 <= pEnd)
+	{
+		nHash ^= (u64) Read32 (p) * PRIME64_1;
+		nHash = Rotl64 (nHash, 23) * PRIME64_2 + PRIME64_3;
+
+		p += 4;
+	}
+
+	for (; p < pEnd; p++)
+	{
+		nHash ^= *p * PRIME64_5;
+		nHash = Rotl64 (nHash, 11) * PRIME64_1;
+	}
+
+	nHash ^= nHash >> 33;
+	nHash *= PRIME64_2;
+	nHash ^= nHash >> 29;
+	nHash *= PRIME64_3;
+	nHash ^= nHash >> 32;
+
+	return nHash;
+}
+
+u32 CHash::HashString (const char *pString, u32 nSeed)
+{
+	assert (pString != 0);
+
+	return XXHash32 (pString, strlen (pString), nSeed);
+}
@@ -83,6 +83,7 @@ REG (MaiFormat, ARM_HD_BASE, 0x1C, ARM_HD_BASE, 0x18);
 		REGVALUE (MaiFormat, SampleRate, 8000, 1);
 	REGSHIFT (MaiFormat, AudioFormat, 16);
 		REGVALUE (MaiFormat, AudioFormat, PCM, 2);
+		REGVALUE (MaiFormat, AudioFormat, HBR, 200);
 REG (MaiSampleRate, ARM_HD_BASE, 0x2C, ARM_HD_BASE, 0x20);
 	REGSHIFT (MaiSampleRate, M, 0);
 	REGMASK (MaiSampleRate, M, 0xFFU);
@@ -113,11 +114,15 @@ static const char From[] = "sndhdmi";
 
 CHDMISoundBaseDevice::CHDMISoundBaseDevice (CInterruptSystem *pInterrupt,
 					    unsigned nSampleRate,
-					    unsigned nChunkSize)
+					    unsigned nChunkSize,
+					    unsigned nChannels,
+					    boolean bPassthrough)
 :	CSoundBaseDevice (SoundFormatIEC958, 0, nSampleRate),
 	m_pInterruptSystem (pInterrupt),
 	m_nSampleRate (nSampleRate),
 	m_nChunkSize (nChunkSize),
+	m_nChannels (nChannels),
+	m_bPassthrough (bPassthrough),
 	m_ulAudioClockRate (0),
 	m_ulPixelClockRate (0),
 	m_bUsePolling (FALSE),
@@ -127,7 +132,13 @@ CHDMISoundBaseDevice::CHDMISoundBaseDevice (CInterruptSystem *pInterrupt,
 {
 	assert (m_pInterruptSystem != 0);
 	assert (m_nSampleRate > 0);
-	assert (m_nChunkSize % IEC958_SUBFRAMES_PER_BLOCK == 0);
+	assert (m_nChannels == SOUND_HW_CHANNELS || m_nChannels == HDMI_MAX_CHANNELS);
+	assert (m_nChunkSize % (IEC958_FRAMES_PER_BLOCK * m_nChannels) == 0);
+
+	if (m_bPassthrough)
+	{
+		SetIEC958NonPCM (TRUE);
+	}
 
 	if (m_nDMAChannel > DMA_CHANNEL_MAX)	// no DMA channel assigned
 	{
@@ -150,6 +161,8 @@ CHDMISoundBaseDevice::CHDMISoundBaseDevice (unsigned nSampleRate)
 	m_pInterruptSystem (0),
 	m_nSampleRate (nSampleRate),
 	m_nChunkSize (0),
+	m_nChannels (SOUND_HW_CHANNELS),
+	m_bPassthrough (FALSE),
 	m_ulAudioClockRate (0),
 	m_ulPixelClockRate (0),
 	m_bUsePolling (TRUE),
@@ -343,7 +356,7 @@ boolean CHDMISoundBaseDevice::Start (void)
 		 read32 (RegTxPhyPowerDownControl) & ~BitTxPhyPowerDownControlRngGenPowerDown);
 #endif
 
-	write32 (RegMaiControl,  SOUND_HW_CHANNELS << ShiftMaiControlChannelNumber
+	write32 (RegMaiControl,  m_nChannels << ShiftMaiControlChannelNumber
 			       | BitMaiControlWholSample
 			       | BitMaiControlChannelAlign
 			       | BitMaiControlEnable);
@@ -443,11 +456,11 @@ void CHDMISoundBaseDevice::WriteSample (s32 nSample)
 
 	PeripheralEntry ();
 
-	write32 (RegMaiData, ConvertIEC958Sample (nSample, m_nSubFrame / SOUND_HW_CHANNELS));
+	write32 (RegMaiData, ConvertIEC958Sample (nSample, m_nSubFrame / m_nChannels));
 
 	PeripheralExit ();
 
-	if (++m_nSubFrame == IEC958_SUBFRAMES_PER_BLOCK)
+	if (++m_nSubFrame == IEC958_FRAMES_PER_BLOCK * m_nChannels)
 	{
 		m_nSubFrame = 0;
 	}
@@ -463,6 +476,11 @@ boolean CHDMISoundBaseDevice::GetNextChunk (void)
 		return FALSE;
 	}
 
+	if (m_nChannels != SOUND_HW_CHANNELS)
+	{
+		ConvertIEC958Samples (m_pDMABuffer[m_nNextBuffer], nChunkSize, m_nChannels);
+	}
+
 	unsigned nTransferLength = nChunkSize * sizeof (u32);
 	assert (nTransferLength <= TXFR_LEN_MAX_LITE);
 
@@ -492,6 +510,25 @@ void CHDMISoundBaseDevice::RunHDMI (void)
 	u32 nN = nSampleRateMul128 / 1000;
 	u32 nCTS = (u32) (((u64) m_ulPixelClockRate * nN) / nSampleRateMul128);
 
+	u32 nAudioFormat = MaiFormatAudioFormatPCM;
+	if (   m_bPassthrough
+	    && m_nChannels == HDMI_MAX_CHANNELS)
+	{
+		nAudioFormat = MaiFormatAudioFormatHBR;
+	}
+
+	// channel n is mapped to MAI slot n
+	u32 nChannelMask = (1U << m_nChannels) - 1;
+	u32 nChannelMap = 0;
+	for (unsigned i = 0; i < m_nChannels; i++)
+	{
+#if RASPPI <= 3
+		nChannelMap |= i << (3 * i);
+#else
+		nChannelMap |= i << (4 * i);
+#endif
+	}
+
 	struct
 	{
 		uintptr	nReg;
@@ -504,23 +541,19 @@ void CHDMISoundBaseDevice::RunHDMI (void)
 		{RegMaiSampleRate,   (u32) ulNumerator << ShiftMaiSampleRateN
 				   | (u32) (ulDenominator - 1) << ShiftMaiSampleRateM},
 		{RegMaiFormat,   SampleRateToHWFormat (m_nSampleRate) << ShiftMaiFormatSampleRate
-			       | MaiFormatAudioFormatPCM << ShiftMaiFormatAudioFormat},
+			       | nAudioFormat << ShiftMaiFormatAudioFormat},
 		{RegMaiThreshold,   MaiThresholdAnyDefault << ShiftMaiThresholdPanicHigh
 				  | MaiThresholdAnyDefault << ShiftMaiThresholdPanicLow
 				  | MaiThresholdAnyDefault << ShiftMaiThresholdDREQHigh
 				  | MaiThresholdAnyDefault << ShiftMaiThresholdDREQLow},
 		{RegMaiConfig,   BitMaiConfigBitReverse | BitMaiConfigFormatReverse
-			       | 0b11 << ShiftMaiConfigChannelMask},
-#if RASPPI <= 3
-		{RegMaiChannelMap, 0b001000},
-#else
-		{RegMaiChannelMap, 0b00010000},
-#endif
+			       | nChannelMask << ShiftMaiConfigChannelMask},
+		{RegMaiChannelMap, nChannelMap},
 		{RegAudioPacketConfig,   BitAudioPacketConfigZeroDataOnSampleFlat
 				       | BitAudioPacketConfigZeroDataOnInactiveChannels
 				       |    IEC958_B_FRAME_PREAMBLE
 				         << ShiftAudioPacketConfigBFrameIdentifier
-				       | 0b11 << ShiftAudioPacketConfigCeaMask},
+				       | nChannelMask << ShiftAudioPacketConfigCeaMask},
 		{RegCrpConfig, BitCrpConfigExternalCtsEnable | nN << ShiftCrpConfigConfigN},
 		{RegCts0, nCTS},
 		{RegCts1, nCTS},
@@ -689,10 +722,19 @@ boolean CHDMISoundBaseDevice::SetAudioInfoFrame (void)
 		return FALSE;
 	}
 
-	write32 (RegRamPacketAudio0, 0x0A0184);		// type, version, length
-	write32 (RegRamPacketAudio1, 0x0170);		// checksum, channels-1
+	// CEA-861 audio infoframe, coding type and sample rate refer to the stream header
+	static const u8 Header[] = {0x84, 0x01, 0x0A};		// type, version, length
+	u8 uchChannelCount = m_nChannels - 1;
+	u8 uchChannelAllocation = m_nChannels == HDMI_MAX_CHANNELS ? 0x13 : 0x00;
+
+	u8 uchChecksum = Header[0] + Header[1] + Header[2] + uchChannelCount + uchChannelAllocation;
+	uchChecksum = -uchChecksum;
+
+	write32 (RegRamPacketAudio0, Header[0] | Header[1] << 8 | Header[2] << 16);
+	write32 (RegRamPacketAudio1, uchChecksum | uchChannelCount << 8);
+	write32 (RegRamPacketAudio2, uchChannelAllocation << 8);
 
-	for (uintptr nReg = RegRamPacketAudio2; nReg <= RegRamPacketAudio8; nReg += 4)
+	for (uintptr nReg = RegRamPacketAudio2 + 4; nReg <= RegRamPacketAudio8; nReg += 4)
 	{
 		write32 (nReg, 0);
 	}
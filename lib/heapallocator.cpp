@@ -18,19 +18,39 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/heapallocator.h>
+#include <circle/multicore.h>
 #include <circle/logger.h>
 #include <circle/util.h>
 #include <assert.h>
 
 u32 CHeapAllocator::s_nBucketSize[] = { HEAP_BLOCK_BUCKET_SIZES };
 
+static inline unsigned StatisticsCore (void)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	return CMultiCoreSupport::ThisCore ();
+#else
+	return 0;
+#endif
+}
+
 CHeapAllocator::CHeapAllocator (const char *pHeapName)
 :	m_pHeapName (pHeapName),
 	m_pNext (0),
 	m_pLimit (0),
-	m_nReserve (0)
+	m_nReserve (0),
+	m_nMaxBucketSize (0),
+	m_pLargeFreeList (0),
+	m_pBase (0),
+	m_pPeak (0),
+	m_nLargeBytesInUse (0),
+	m_nFailedAllocations (0)
 {
 	memset (m_Bucket, 0, sizeof m_Bucket);
+	memset (m_Statistics, 0, sizeof m_Statistics);
+#ifdef HEAP_CORE_CACHE
+	memset (m_CoreCache, 0, sizeof m_CoreCache);
+#endif
 
 	unsigned nBuckets = sizeof s_nBucketSize / sizeof s_nBucketSize[0];
 	if (nBuckets > HEAP_BLOCK_MAX_BUCKETS)
@@ -41,6 +61,11 @@ CHeapAllocator::CHeapAllocator (const char *pHeapName)
 	for (unsigned i = 0; i < nBuckets; i++)
 	{
 		m_Bucket[i].nSize = s_nBucketSize[i];
+
+		if (s_nBucketSize[i] > m_nMaxBucketSize)
+		{
+			m_nMaxBucketSize = s_nBucketSize[i];
+		}
 	}
 }
 
@@ -50,6 +75,8 @@ CHeapAllocator::~CHeapAllocator (void)
 
 void CHeapAllocator::Setup (uintptr nBase, size_t nSize, size_t nReserve)
 {
+	m_pBase = (u8 *) nBase;
+	m_pPeak = m_pBase;
 	m_pNext = (u8 *) nBase;
 	m_pLimit = (u8 *) (nBase + nSize);
 	m_nReserve = nReserve;
@@ -67,7 +94,7 @@ void *CHeapAllocator::Allocate (size_t nSize)
 		return 0;
 	}
 
-	m_SpinLock.Acquire ();
+	size_t nRequestedSize = nSize;
 
 	THeapBlockBucket *pBucket;
 	for (pBucket = m_Bucket; pBucket->nSize > 0; pBucket++)
@@ -76,23 +103,44 @@ void *CHeapAllocator::Allocate (size_t nSize)
 		{
 			nSize = pBucket->nSize;
 
-#ifdef HEAP_DEBUG
-			if (++pBucket->nCount > pBucket->nMaxCount)
-			{
-				pBucket->nMaxCount = pBucket->nCount;
-			}
-#endif
-
 			break;
 		}
 	}
 
+	if (pBucket->nSize == 0)
+	{
+		nSize = (nSize + HEAP_BLOCK_ALIGN-1) & ~HEAP_ALIGN_MASK;
+	}
+
+	unsigned nBucket = pBucket - m_Bucket;
 	THeapBlockHeader *pBlockHeader;
+
+#ifdef HEAP_CORE_CACHE
+	if (   pBucket->nSize > 0
+	    && pBucket->nSize <= HEAP_CORE_CACHE_MAX_SIZE
+	    && (pBlockHeader = AllocateCached (nBucket, nRequestedSize)) != 0)
+	{
+		pBlockHeader->pNext = 0;
+
+		return pBlockHeader->Data;
+	}
+#endif
+
+	m_SpinLock.Acquire ();
+
 	if (   pBucket->nSize > 0
 	    && (pBlockHeader = pBucket->pFreeList) != 0)
 	{
 		assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
 		pBucket->pFreeList = pBlockHeader->pNext;
+
+		assert (pBucket->nFreeCount > 0);
+		pBucket->nFreeCount--;
+	}
+	else if (   pBucket->nSize == 0
+		 && (pBlockHeader = AllocateLarge (nSize)) != 0)
+	{
+		assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
 	}
 	else
 	{
@@ -104,6 +152,8 @@ void *CHeapAllocator::Allocate (size_t nSize)
 		if (   pNextBlock <= m_pNext			// may have wrapped
 		    || pNextBlock > m_pLimit-m_nReserve)
 		{
+			m_nFailedAllocations++;
+
 			if (m_nReserve == 0)
 			{
 				m_SpinLock.Release ();
@@ -129,11 +179,28 @@ void *CHeapAllocator::Allocate (size_t nSize)
 		}
 
 		m_pNext = pNextBlock;
+		if (m_pNext > m_pPeak)
+		{
+			m_pPeak = m_pNext;
+		}
 
 		pBlockHeader->nMagic = HEAP_BLOCK_MAGIC;
 		pBlockHeader->nSize = (u32) nSize;
+
+		pBucket->nBlocks++;
+	}
+
+	if (pBucket->nSize == 0)
+	{
+		m_nLargeBytesInUse += pBlockHeader->nSize;
 	}
 
+	pBlockHeader->nRequestedSize = (u32) nRequestedSize;
+
+	THeapCoreStatistics *pStatistics = &m_Statistics[StatisticsCore ()];
+	pStatistics->nAllocations[nBucket]++;
+	pStatistics->nBytesRequested += nRequestedSize;
+
 	m_SpinLock.Release ();
 
 	pBlockHeader->pNext = 0;
@@ -163,6 +230,14 @@ void *CHeapAllocator::ReAllocate (void *pBlock, size_t nSize)
 	assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
 	if (pBlockHeader->nSize >= nSize)
 	{
+		EnterCritical (IRQ_LEVEL);
+
+		m_Statistics[StatisticsCore ()].nBytesRequested +=
+			nSize - pBlockHeader->nRequestedSize;
+		pBlockHeader->nRequestedSize = (u32) nSize;
+
+		LeaveCritical ();
+
 		return pBlock;
 	}
 
@@ -190,40 +265,436 @@ void CHeapAllocator::Free (void *pBlock)
 		(THeapBlockHeader *) ((uintptr) pBlock - sizeof (THeapBlockHeader));
 	assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
 
-	for (THeapBlockBucket *pBucket = m_Bucket; pBucket->nSize > 0; pBucket++)
+	THeapBlockBucket *pBucket;
+	for (pBucket = m_Bucket; pBucket->nSize > 0; pBucket++)
 	{
 		if (pBlockHeader->nSize == pBucket->nSize)
 		{
-			m_SpinLock.Acquire ();
+			break;
+		}
+	}
 
-			pBlockHeader->pNext = pBucket->pFreeList;
-			pBucket->pFreeList = pBlockHeader;
+	unsigned nBucket = pBucket - m_Bucket;
 
-#ifdef HEAP_DEBUG
-			pBucket->nCount--;
+#ifdef HEAP_CORE_CACHE
+	if (   pBucket->nSize > 0
+	    && pBucket->nSize <= HEAP_CORE_CACHE_MAX_SIZE)
+	{
+		FreeCached (pBlockHeader, nBucket);
+
+		return;
+	}
 #endif
 
-			m_SpinLock.Release ();
+	m_SpinLock.Acquire ();
+
+	THeapCoreStatistics *pStatistics = &m_Statistics[StatisticsCore ()];
+	pStatistics->nFrees[nBucket]++;
+	pStatistics->nBytesRequested -= pBlockHeader->nRequestedSize;
 
-			return;
+	if (pBucket->nSize > 0)
+	{
+		pBlockHeader->pNext = pBucket->pFreeList;
+		pBucket->pFreeList = pBlockHeader;
+		pBucket->nFreeCount++;
+	}
+	else
+	{
+		assert (m_nLargeBytesInUse >= pBlockHeader->nSize);
+		m_nLargeBytesInUse -= pBlockHeader->nSize;
+
+		FreeLarge (pBlockHeader);
+	}
+
+	m_SpinLock.Release ();
+}
+
+size_t CHeapAllocator::GetLargeFreeSpace (size_t *pLargestBlock, unsigned *pBlocks)
+{
+	size_t nFreeSpace = 0;
+	size_t nLargestBlock = 0;
+	unsigned nBlocks = 0;
+
+	m_SpinLock.Acquire ();
+
+	for (THeapBlockHeader *pBlockHeader = m_pLargeFreeList; pBlockHeader != 0;
+	     pBlockHeader = pBlockHeader->pNext)
+	{
+		assert (pBlockHeader->nMagic == HEAP_LARGE_FREE_MAGIC);
+
+		nFreeSpace += pBlockHeader->nSize;
+
+		if (pBlockHeader->nSize > nLargestBlock)
+		{
+			nLargestBlock = pBlockHeader->nSize;
 		}
+
+		nBlocks++;
 	}
 
-#ifdef HEAP_DEBUG
-	CLogger::Get ()->Write (m_pHeapName, LogDebug, "Trying to free large block (size %u)",
-				pBlockHeader->nSize);
-#endif
+	m_SpinLock.Release ();
+
+	if (pLargestBlock != 0)
+	{
+		*pLargestBlock = nLargestBlock;
+	}
+
+	if (pBlocks != 0)
+	{
+		*pBlocks = nBlocks;
+	}
+
+	return nFreeSpace;
 }
 
-#ifdef HEAP_DEBUG
+// Blocks, which are bigger than the largest bucket size, are held on an address
+// ordered free list. Adjacent free blocks are merged and a free block at the top
+// of the allocated space is returned to the heap region. The spin lock must be
+// held by the caller of the following two methods.
 
-void CHeapAllocator::DumpStatus (void)
+THeapBlockHeader *CHeapAllocator::AllocateLarge (size_t nSize)
+{
+	assert ((nSize & HEAP_ALIGN_MASK) == 0);
+
+	// best fit
+	THeapBlockHeader *pBestPrev = 0;
+	THeapBlockHeader *pBest = 0;
+	THeapBlockHeader *pPrev = 0;
+	for (THeapBlockHeader *pBlockHeader = m_pLargeFreeList; pBlockHeader != 0;
+	     pPrev = pBlockHeader, pBlockHeader = pBlockHeader->pNext)
+	{
+		assert (pBlockHeader->nMagic == HEAP_LARGE_FREE_MAGIC);
+
+		if (   pBlockHeader->nSize >= nSize
+		    && (   pBest == 0
+			|| pBlockHeader->nSize < pBest->nSize))
+		{
+			pBestPrev = pPrev;
+			pBest = pBlockHeader;
+
+			if (pBest->nSize == nSize)
+			{
+				break;
+			}
+		}
+	}
+
+	if (pBest == 0)
+	{
+		return 0;
+	}
+
+	THeapBlockHeader *pNext = pBest->pNext;
+
+	// split, if the remainder is a large block again
+	size_t nRemainder = pBest->nSize - nSize;
+	if (nRemainder > sizeof (THeapBlockHeader) + m_nMaxBucketSize)
+	{
+		THeapBlockHeader *pRest =
+			(THeapBlockHeader *) (pBest->Data + nSize);
+		pRest->nMagic = HEAP_LARGE_FREE_MAGIC;
+		pRest->nSize = (u32) (nRemainder - sizeof (THeapBlockHeader));
+		pRest->pNext = pNext;
+
+		pNext = pRest;
+
+		pBest->nSize = (u32) nSize;
+	}
+
+	if (pBestPrev != 0)
+	{
+		pBestPrev->pNext = pNext;
+	}
+	else
+	{
+		m_pLargeFreeList = pNext;
+	}
+
+	pBest->nMagic = HEAP_BLOCK_MAGIC;
+
+	return pBest;
+}
+
+void CHeapAllocator::FreeLarge (THeapBlockHeader *pBlockHeader)
+{
+	assert (pBlockHeader != 0);
+	assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
+	assert ((pBlockHeader->nSize & HEAP_ALIGN_MASK) == 0);
+
+	pBlockHeader->nMagic = HEAP_LARGE_FREE_MAGIC;
+
+	THeapBlockHeader *pPrevPrev = 0;
+	THeapBlockHeader *pPrev = 0;
+	THeapBlockHeader *pNext = m_pLargeFreeList;
+	while (   pNext != 0
+	       && pNext < pBlockHeader)
+	{
+		pPrevPrev = pPrev;
+		pPrev = pNext;
+		pNext = pNext->pNext;
+	}
+
+	assert (pNext != pBlockHeader);		// freed twice?
+
+	// merge with next block
+	if (   pNext != 0
+	    && pBlockHeader->Data + pBlockHeader->nSize == (u8 *) pNext
+	    && (u64) pBlockHeader->nSize + sizeof (THeapBlockHeader) + pNext->nSize <= HEAP_LARGE_MAX_SIZE)
+	{
+		pBlockHeader->nSize += sizeof (THeapBlockHeader) + pNext->nSize;
+		pNext->nMagic = 0;
+
+		pNext = pNext->pNext;
+	}
+
+	pBlockHeader->pNext = pNext;
+
+	// merge with previous block
+	if (   pPrev != 0
+	    && pPrev->Data + pPrev->nSize == (u8 *) pBlockHeader
+	    && (u64) pPrev->nSize + sizeof (THeapBlockHeader) + pBlockHeader->nSize <= HEAP_LARGE_MAX_SIZE)
+	{
+		pPrev->nSize += sizeof (THeapBlockHeader) + pBlockHeader->nSize;
+		pPrev->pNext = pNext;
+		pBlockHeader->nMagic = 0;
+
+		pBlockHeader = pPrev;
+		pPrev = pPrevPrev;
+	}
+	else
+	{
+		if (pPrev != 0)
+		{
+			pPrev->pNext = pBlockHeader;
+		}
+		else
+		{
+			m_pLargeFreeList = pBlockHeader;
+		}
+	}
+
+	// return block at the top to the heap region
+	if (pBlockHeader->Data + pBlockHeader->nSize == m_pNext)
+	{
+		assert (pBlockHeader->pNext == 0);
+
+		if (pPrev != 0)
+		{
+			assert (pPrev->pNext == pBlockHeader);
+			pPrev->pNext = 0;
+		}
+		else
+		{
+			assert (m_pLargeFreeList == pBlockHeader);
+			m_pLargeFreeList = 0;
+		}
+
+		pBlockHeader->nMagic = 0;
+
+		m_pNext = (u8 *) pBlockHeader;
+	}
+}
+
+#ifdef HEAP_CORE_CACHE
+
+// The core cache is only accessed from its own core, so it is sufficient to
+// disable the IRQs locally. The shared free list is accessed in batches only.
+
+THeapBlockHeader *CHeapAllocator::AllocateCached (unsigned nBucket, size_t nRequestedSize)
+{
+	assert (nBucket < HEAP_BLOCK_MAX_BUCKETS);
+	THeapBlockBucket *pBucket = &m_Bucket[nBucket];
+
+	EnterCritical (IRQ_LEVEL);
+
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+	THeapBlockMagazine *pMagazine = &m_CoreCache[nCore].Magazine[nBucket];
+
+	if (pMagazine->nCount == 0)
+	{
+		assert (pMagazine->pList == 0);
+
+		m_SpinLock.Acquire ();
+
+		THeapBlockHeader *pBlockHeader;
+		while (   pMagazine->nCount < HEAP_CORE_CACHE_BATCH
+		       && (pBlockHeader = pBucket->pFreeList) != 0)
+		{
+			assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
+			pBucket->pFreeList = pBlockHeader->pNext;
+			pBucket->nFreeCount--;
+
+			pBlockHeader->pNext = pMagazine->pList;
+			pMagazine->pList = pBlockHeader;
+			pMagazine->nCount++;
+		}
+
+		m_SpinLock.Release ();
+	}
+
+	THeapBlockHeader *pBlockHeader = pMagazine->pList;
+	if (pBlockHeader != 0)
+	{
+		assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
+		pMagazine->pList = pBlockHeader->pNext;
+
+		assert (pMagazine->nCount > 0);
+		pMagazine->nCount--;
+
+		pBlockHeader->nRequestedSize = (u32) nRequestedSize;
+
+		THeapCoreStatistics *pStatistics = &m_Statistics[nCore];
+		pStatistics->nAllocations[nBucket]++;
+		pStatistics->nBytesRequested += nRequestedSize;
+	}
+
+	LeaveCritical ();
+
+	return pBlockHeader;		// 0: allocate new block from the heap region
+}
+
+void CHeapAllocator::FreeCached (THeapBlockHeader *pBlockHeader, unsigned nBucket)
 {
-	for (THeapBlockBucket *pBucket = m_Bucket; pBucket->nSize > 0; pBucket++)
+	assert (pBlockHeader != 0);
+	assert (nBucket < HEAP_BLOCK_MAX_BUCKETS);
+	THeapBlockBucket *pBucket = &m_Bucket[nBucket];
+
+	EnterCritical (IRQ_LEVEL);
+
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+	THeapBlockMagazine *pMagazine = &m_CoreCache[nCore].Magazine[nBucket];
+
+	THeapCoreStatistics *pStatistics = &m_Statistics[nCore];
+	pStatistics->nFrees[nBucket]++;
+	pStatistics->nBytesRequested -= pBlockHeader->nRequestedSize;
+
+	pBlockHeader->pNext = pMagazine->pList;
+	pMagazine->pList = pBlockHeader;
+
+	// return a batch of blocks to the shared free list, if the cache is full
+	if (++pMagazine->nCount > 2*HEAP_CORE_CACHE_BATCH)
 	{
-		CLogger::Get ()->Write (m_pHeapName, LogDebug, "malloc(%lu): %u blocks (max %u)",
-					pBucket->nSize, pBucket->nCount, pBucket->nMaxCount);
+		m_SpinLock.Acquire ();
+
+		while (pMagazine->nCount > HEAP_CORE_CACHE_BATCH)
+		{
+			pBlockHeader = pMagazine->pList;
+			assert (pBlockHeader != 0);
+			pMagazine->pList = pBlockHeader->pNext;
+			pMagazine->nCount--;
+
+			pBlockHeader->pNext = pBucket->pFreeList;
+			pBucket->pFreeList = pBlockHeader;
+			pBucket->nFreeCount++;
+		}
+
+		m_SpinLock.Release ();
 	}
+
+	LeaveCritical ();
 }
 
 #endif
+
+void CHeapAllocator::GetStatus (THeapStatus *pStatus)
+{
+	assert (pStatus != 0);
+	memset (pStatus, 0, sizeof *pStatus);
+
+	pStatus->nLargeFreeSpace = GetLargeFreeSpace (&pStatus->nLargestFreeBlock,
+						      &pStatus->nLargeFreeBlocks);
+
+	m_SpinLock.Acquire ();
+
+	pStatus->nSize = m_pLimit - m_pBase;
+	pStatus->nUsed = m_pNext - m_pBase;
+	pStatus->nPeakUsed = m_pPeak - m_pBase;
+	pStatus->nFailedAllocations = m_nFailedAllocations;
+	pStatus->nLargeBytesInUse = m_nLargeBytesInUse;
+
+	unsigned nBucket;
+	for (nBucket = 0; m_Bucket[nBucket].nSize > 0; nBucket++)
+	{
+		THeapBlockBucket *pBucket = &m_Bucket[nBucket];
+		THeapBucketStatus *pBucketStatus = &pStatus->Bucket[nBucket];
+
+		pBucketStatus->nSize = pBucket->nSize;
+		pBucketStatus->nBlocks = pBucket->nBlocks;
+		pBucketStatus->nFreeBlocks = pBucket->nFreeCount;
+
+#ifdef HEAP_CORE_CACHE
+		for (unsigned nCore = 0; nCore < CORES; nCore++)
+		{
+			pBucketStatus->nFreeBlocks += m_CoreCache[nCore].Magazine[nBucket].nCount;
+		}
+#endif
+	}
+
+	pStatus->nBuckets = nBucket;
+
+	m_SpinLock.Release ();
+
+	u64 nLargeFrees = 0;
+	for (unsigned nCore = 0; nCore < HEAP_STAT_CORES; nCore++)
+	{
+		THeapCoreStatistics *pStatistics = &m_Statistics[nCore];
+
+		for (nBucket = 0; nBucket < pStatus->nBuckets; nBucket++)
+		{
+			THeapBucketStatus *pBucketStatus = &pStatus->Bucket[nBucket];
+
+			pBucketStatus->nAllocations += pStatistics->nAllocations[nBucket];
+
+			// sum may overflow temporarily, final result is valid
+			pBucketStatus->nInUse +=   (unsigned) pStatistics->nAllocations[nBucket]
+						 - (unsigned) pStatistics->nFrees[nBucket];
+		}
+
+		pStatus->nLargeAllocations += pStatistics->nAllocations[nBucket];
+		nLargeFrees += pStatistics->nFrees[nBucket];
+
+		pStatus->nBytesRequested += pStatistics->nBytesRequested;
+	}
+
+	pStatus->nLargeInUse = (unsigned) (pStatus->nLargeAllocations - nLargeFrees);
+
+	pStatus->nBytesInUse = pStatus->nLargeBytesInUse;
+	for (nBucket = 0; nBucket < pStatus->nBuckets; nBucket++)
+	{
+		pStatus->nBytesInUse +=   (size_t) pStatus->Bucket[nBucket].nInUse
+					* pStatus->Bucket[nBucket].nSize;
+	}
+}
+
+void CHeapAllocator::DumpStatus (void)
+{
+	THeapStatus Status;
+	GetStatus (&Status);
+
+	CLogger *pLogger = CLogger::Get ();
+	assert (pLogger != 0);
+
+	pLogger->Write (m_pHeapName, LogDebug, "Size %lu, used %lu (peak %lu), failed %lu",
+			(unsigned long) Status.nSize, (unsigned long) Status.nUsed,
+			(unsigned long) Status.nPeakUsed,
+			(unsigned long) Status.nFailedAllocations);
+
+	pLogger->Write (m_pHeapName, LogDebug, "In use %lu bytes (requested %lu)",
+			(unsigned long) Status.nBytesInUse, (unsigned long) Status.nBytesRequested);
+
+	for (unsigned i = 0; i < Status.nBuckets; i++)
+	{
+		THeapBucketStatus *pBucket = &Status.Bucket[i];
+
+		pLogger->Write (m_pHeapName, LogDebug,
+				"malloc(%lu): %lu allocs, %u in use, %u blocks, %u free",
+				(unsigned long) pBucket->nSize, (unsigned long) pBucket->nAllocations,
+				pBucket->nInUse, pBucket->nBlocks, pBucket->nFreeBlocks);
+	}
+
+	pLogger->Write (m_pHeapName, LogDebug,
+			"Large: %lu allocs, %u in use (%lu bytes), %lu free in %u blocks (max %lu)",
+			(unsigned long) Status.nLargeAllocations, Status.nLargeInUse,
+			(unsigned long) Status.nLargeBytesInUse, (unsigned long) Status.nLargeFreeSpace,
+			Status.nLargeFreeBlocks, (unsigned long) Status.nLargestFreeBlock);
+}
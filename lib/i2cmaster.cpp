@@ -26,6 +26,7 @@
 #include <circle/bcm2835.h>
 #include <circle/machineinfo.h>
 #include <circle/synchronize.h>
+#include <circle/timer.h>
 #include <assert.h>
 
 #if RASPPI < 4
@@ -66,6 +67,8 @@
 
 #define FIFO_SIZE		16
 
+#define DLEN_MAX		0xFFFF
+
 static uintptr s_BaseAddress[DEVICES] =
 {
 	ARM_IO_BASE + 0x205000,
@@ -99,14 +102,26 @@ static unsigned s_GPIOConfig[DEVICES][CONFIGS][GPIOS] =
 				 ? GPIOModeAlternateFunction0	\
 				 : GPIOModeAlternateFunction5)
 
-CI2CMaster::CI2CMaster (unsigned nDevice, boolean bFastMode, unsigned nConfig)
+CI2CMaster *CI2CMaster::s_pThis[DEVICES] = {0};
+unsigned CI2CMaster::s_nIRQUsers = 0;
+
+CI2CMaster::CI2CMaster (unsigned nDevice, boolean bFastMode, unsigned nConfig,
+			CInterruptSystem *pInterruptSystem)
 :	m_nDevice (nDevice),
 	m_nBaseAddress (0),
 	m_bFastMode (bFastMode),
 	m_nConfig (nConfig),
 	m_bValid (FALSE),
 	m_nCoreClockRate (CMachineInfo::Get ()->GetClockRate (CLOCK_ID_CORE)),
-	m_SpinLock (TASK_LEVEL)
+	m_nClockSpeed (0),
+	m_SpinLock (TASK_LEVEL),
+	m_pInterruptSystem (pInterruptSystem),
+	m_pFirstTransaction (0),
+	m_pLastTransaction (0),
+	m_bReadPhase (FALSE),
+	m_nBytesLeft (0),
+	m_pData (0),
+	m_QueueSpinLock (IRQ_LEVEL)
 {
 	if (   m_nDevice >= DEVICES
 	    || m_nConfig >= CONFIGS
@@ -133,6 +148,27 @@ CI2CMaster::CI2CMaster (unsigned nDevice, boolean bFastMode, unsigned nConfig)
 
 CI2CMaster::~CI2CMaster (void)
 {
+	assert (m_pFirstTransaction == 0);
+
+	if (   m_nDevice < DEVICES
+	    && s_pThis[m_nDevice] == this)
+	{
+		PeripheralEntry ();
+		write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, C_CLEAR);
+		PeripheralExit ();
+
+		s_pThis[m_nDevice] = 0;
+
+		assert (s_nIRQUsers > 0);
+		if (--s_nIRQUsers == 0)
+		{
+			assert (m_pInterruptSystem != 0);
+			m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_I2C);
+		}
+	}
+
+	m_pInterruptSystem = 0;
+
 	if (m_bValid)
 	{
 		m_SDA.SetMode (GPIOModeInput);
@@ -153,6 +189,17 @@ boolean CI2CMaster::Initialize (void)
 
 	SetClock (m_bFastMode ? 400000 : 100000);
 
+	if (   m_pInterruptSystem != 0
+	    && s_pThis[m_nDevice] == 0)
+	{
+		s_pThis[m_nDevice] = this;
+
+		if (s_nIRQUsers++ == 0)
+		{
+			m_pInterruptSystem->ConnectIRQ (ARM_IRQ_I2C, InterruptStub, 0);
+		}
+	}
+
 	return TRUE;
 }
 
@@ -163,6 +210,7 @@ void CI2CMaster::SetClock (unsigned nClockSpeed)
 	PeripheralEntry ();
 
 	assert (nClockSpeed > 0);
+	m_nClockSpeed = nClockSpeed;
 	u16 nDivider = (u16) (m_nCoreClockRate / nClockSpeed);
 	write32 (m_nBaseAddress + ARM_BSC_DIV__OFFSET, nDivider);
 	
@@ -183,6 +231,8 @@ int CI2CMaster::Read (u8 ucAddress, void *pBuffer, unsigned nCount)
 		return -I2C_MASTER_INALID_PARM;
 	}
 
+	assert (m_pFirstTransaction == 0);
+
 	m_SpinLock.Acquire ();
 
 	u8 *pData = (u8 *) pBuffer;
@@ -263,6 +313,8 @@ int CI2CMaster::Write (u8 ucAddress, const void *pBuffer, unsigned nCount)
 		return -I2C_MASTER_INALID_PARM;
 	}
 
+	assert (m_pFirstTransaction == 0);
+
 	m_SpinLock.Acquire ();
 
 	u8 *pData = (u8 *) pBuffer;
@@ -329,3 +381,353 @@ int CI2CMaster::Write (u8 ucAddress, const void *pBuffer, unsigned nCount)
 
 	return nResult;
 }
+
+int CI2CMaster::WriteRead (u8 ucAddress, const void *pWriteBuffer, unsigned nWriteCount,
+			   void *pReadBuffer, unsigned nReadCount)
+{
+	assert (m_bValid);
+
+	if (ucAddress >= 0x80)
+	{
+		return -I2C_MASTER_INALID_PARM;
+	}
+
+	if (   nWriteCount == 0
+	    || nWriteCount > FIFO_SIZE
+	    || pWriteBuffer == 0
+	    || nReadCount == 0
+	    || pReadBuffer == 0)
+	{
+		return -I2C_MASTER_INALID_PARM;
+	}
+
+	assert (m_pFirstTransaction == 0);
+
+	m_SpinLock.Acquire ();
+
+	const u8 *pWriteData = (const u8 *) pWriteBuffer;
+	u8 *pData = (u8 *) pReadBuffer;
+
+	int nResult = 0;
+
+	PeripheralEntry ();
+
+	// setup write transfer
+	write32 (m_nBaseAddress + ARM_BSC_A__OFFSET, ucAddress);
+
+	write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, C_CLEAR);
+	write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_CLKT | S_ERR | S_DONE);
+
+	write32 (m_nBaseAddress + ARM_BSC_DLEN__OFFSET, nWriteCount);
+
+	for (unsigned i = 0; i < nWriteCount; i++)
+	{
+		write32 (m_nBaseAddress + ARM_BSC_FIFO__OFFSET, *pWriteData++);
+	}
+
+	write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, C_I2CEN | C_ST);
+
+	// wait for the write transfer to become active
+	while (!(read32 (m_nBaseAddress + ARM_BSC_S__OFFSET) & (S_TA | S_DONE)))
+	{
+		// do nothing
+	}
+
+	// setting ST again, while the write is active, sends a repeated start after it
+	write32 (m_nBaseAddress + ARM_BSC_DLEN__OFFSET, nReadCount);
+	write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, C_I2CEN | C_ST | C_READ);
+
+	// wait for the write to complete and the first byte back
+	assert (m_nClockSpeed > 0);
+	CTimer::SimpleusDelay (3 * 9 * 1000000U / m_nClockSpeed + 1);
+
+	// transfer active
+	while (!(read32 (m_nBaseAddress + ARM_BSC_S__OFFSET) & S_DONE))
+	{
+		while (   nReadCount > 0
+		       && (read32 (m_nBaseAddress + ARM_BSC_S__OFFSET) & S_RXD))
+		{
+			*pData++ = read32 (m_nBaseAddress + ARM_BSC_FIFO__OFFSET) & FIFO__MASK;
+
+			nReadCount--;
+			nResult++;
+		}
+	}
+
+	// transfer has finished, grab any remaining stuff from FIFO
+	while (   nReadCount > 0
+	       && (read32 (m_nBaseAddress + ARM_BSC_S__OFFSET) & S_RXD))
+	{
+		*pData++ = read32 (m_nBaseAddress + ARM_BSC_FIFO__OFFSET) & FIFO__MASK;
+
+		nReadCount--;
+		nResult++;
+	}
+
+	u32 nStatus = read32 (m_nBaseAddress + ARM_BSC_S__OFFSET);
+	if (nStatus & S_ERR)
+	{
+		write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_ERR);
+
+		nResult = -I2C_MASTER_ERROR_NACK;
+	}
+	else if (nStatus & S_CLKT)
+	{
+		nResult = -I2C_MASTER_ERROR_CLKT;
+	}
+	else if (nReadCount > 0)
+	{
+		nResult = -I2C_MASTER_DATA_LEFT;
+	}
+
+	write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_DONE);
+
+	PeripheralExit ();
+
+	m_SpinLock.Release ();
+
+	return nResult;
+}
+
+boolean CI2CMaster::SubmitTransaction (TI2CTransaction *pTransaction)
+{
+	assert (m_bValid);
+
+	if (   m_pInterruptSystem == 0
+	    || pTransaction == 0
+	    || pTransaction->ucAddress >= 0x80
+	    || pTransaction->nWriteCount + pTransaction->nReadCount == 0
+	    || pTransaction->nWriteCount > DLEN_MAX
+	    || pTransaction->nReadCount > DLEN_MAX
+	    || (pTransaction->nWriteCount > 0 && pTransaction->pWriteBuffer == 0)
+	    || (pTransaction->nReadCount > 0 && pTransaction->pReadBuffer == 0))
+	{
+		return FALSE;
+	}
+
+	pTransaction->nResult = 0;
+	pTransaction->bDone = FALSE;
+	pTransaction->pNext = 0;
+
+	m_QueueSpinLock.Acquire ();
+
+	if (m_pFirstTransaction == 0)
+	{
+		m_pFirstTransaction = pTransaction;
+		m_pLastTransaction = pTransaction;
+
+		StartTransaction ();
+	}
+	else
+	{
+		assert (m_pLastTransaction != 0);
+		m_pLastTransaction->pNext = pTransaction;
+		m_pLastTransaction = pTransaction;
+	}
+
+	m_QueueSpinLock.Release ();
+
+	return TRUE;
+}
+
+boolean CI2CMaster::IsBusy (void) const
+{
+	return m_pFirstTransaction != 0;
+}
+
+// called with m_QueueSpinLock acquired
+void CI2CMaster::StartTransaction (void)
+{
+	TI2CTransaction *pTransaction = m_pFirstTransaction;
+	assert (pTransaction != 0);
+
+	PeripheralEntry ();
+
+	write32 (m_nBaseAddress + ARM_BSC_A__OFFSET, pTransaction->ucAddress);
+
+	write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, C_CLEAR);
+	write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_CLKT | S_ERR | S_DONE);
+
+	if (pTransaction->nWriteCount > 0)
+	{
+		m_bReadPhase = FALSE;
+		m_pData = (u8 *) pTransaction->pWriteBuffer;
+		m_nBytesLeft = pTransaction->nWriteCount;
+
+		write32 (m_nBaseAddress + ARM_BSC_DLEN__OFFSET, m_nBytesLeft);
+
+		for (unsigned i = 0; m_nBytesLeft > 0 && i < FIFO_SIZE; i++)
+		{
+			write32 (m_nBaseAddress + ARM_BSC_FIFO__OFFSET, *m_pData++);
+
+			m_nBytesLeft--;
+		}
+
+		// TXW is needed to refill the FIFO or to send the repeated start for the read
+		u32 nControl = C_I2CEN | C_ST | C_INTD;
+		if (   m_nBytesLeft > 0
+		    || pTransaction->nReadCount > 0)
+		{
+			nControl |= C_INTT;
+		}
+
+		write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, nControl);
+	}
+	else
+	{
+		StartReadPhase ();
+	}
+
+	PeripheralExit ();
+}
+
+// called with m_QueueSpinLock acquired
+void CI2CMaster::StartReadPhase (void)
+{
+	TI2CTransaction *pTransaction = m_pFirstTransaction;
+	assert (pTransaction != 0);
+	assert (pTransaction->nReadCount > 0);
+
+	m_bReadPhase = TRUE;
+	m_pData = (u8 *) pTransaction->pReadBuffer;
+	m_nBytesLeft = pTransaction->nReadCount;
+
+	write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_DONE);
+	write32 (m_nBaseAddress + ARM_BSC_DLEN__OFFSET, m_nBytesLeft);
+	write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, C_I2CEN | C_ST | C_READ | C_INTR | C_INTD);
+}
+
+void CI2CMaster::InterruptHandler (void)
+{
+	m_QueueSpinLock.Acquire ();
+
+	TI2CTransaction *pTransaction = m_pFirstTransaction;
+	if (pTransaction == 0)
+	{
+		m_QueueSpinLock.Release ();
+
+		return;
+	}
+
+	PeripheralEntry ();
+
+	boolean bCompleted = FALSE;
+	int nResult = 0;
+
+	u32 nStatus = read32 (m_nBaseAddress + ARM_BSC_S__OFFSET);
+	if (nStatus & (S_ERR | S_CLKT))
+	{
+		write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_ERR | S_CLKT | S_DONE);
+
+		bCompleted = TRUE;
+		nResult = nStatus & S_ERR ? -I2C_MASTER_ERROR_NACK : -I2C_MASTER_ERROR_CLKT;
+	}
+	else if (!m_bReadPhase)
+	{
+		while (   m_nBytesLeft > 0
+		       && (read32 (m_nBaseAddress + ARM_BSC_S__OFFSET) & S_TXD))
+		{
+			write32 (m_nBaseAddress + ARM_BSC_FIFO__OFFSET, *m_pData++);
+
+			m_nBytesLeft--;
+		}
+
+		if (m_nBytesLeft > 0)
+		{
+			if (nStatus & S_DONE)
+			{
+				write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_DONE);
+
+				bCompleted = TRUE;
+				nResult = -I2C_MASTER_DATA_LEFT;
+			}
+		}
+		else if (pTransaction->nReadCount > 0)
+		{
+			StartReadPhase ();		// repeated start
+		}
+		else if (nStatus & S_DONE)
+		{
+			write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_DONE);
+
+			bCompleted = TRUE;
+			nResult = pTransaction->nWriteCount;
+		}
+		else
+		{
+			// all data is in the FIFO, wait for DONE only
+			write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, C_I2CEN | C_INTD);
+		}
+	}
+	else
+	{
+		while (   m_nBytesLeft > 0
+		       && (read32 (m_nBaseAddress + ARM_BSC_S__OFFSET) & S_RXD))
+		{
+			*m_pData++ = read32 (m_nBaseAddress + ARM_BSC_FIFO__OFFSET) & FIFO__MASK;
+
+			m_nBytesLeft--;
+		}
+
+		if (nStatus & S_DONE)
+		{
+			write32 (m_nBaseAddress + ARM_BSC_S__OFFSET, S_DONE);
+
+			// DONE may still be reported from the write phase
+			if (!(nStatus & S_TA))
+			{
+				bCompleted = TRUE;
+				nResult =   m_nBytesLeft > 0
+					  ? -I2C_MASTER_DATA_LEFT
+					  : (int) pTransaction->nReadCount;
+			}
+		}
+	}
+
+	if (bCompleted)
+	{
+		write32 (m_nBaseAddress + ARM_BSC_C__OFFSET, C_CLEAR);
+
+		m_pFirstTransaction = pTransaction->pNext;
+		if (m_pFirstTransaction != 0)
+		{
+			StartTransaction ();
+		}
+		else
+		{
+			m_pLastTransaction = 0;
+		}
+	}
+
+	PeripheralExit ();
+
+	m_QueueSpinLock.Release ();
+
+	if (bCompleted)
+	{
+		// the transaction may be reused by the caller, as soon as bDone is set
+		TI2CCompletionRoutine *pRoutine = pTransaction->pCompletionRoutine;
+		void *pParam = pTransaction->pCompletionParam;
+
+		pTransaction->nResult = nResult;
+		DataMemBarrier ();
+		pTransaction->bDone = TRUE;
+
+		if (pRoutine != 0)
+		{
+			(*pRoutine) (nResult, pParam);
+		}
+	}
+}
+
+void CI2CMaster::InterruptStub (void *pParam)
+{
+	for (unsigned i = 0; i < DEVICES; i++)
+	{
+		CI2CMaster *pThis = s_pThis[i];
+		if (pThis != 0)
+		{
+			pThis->InterruptHandler ();
+		}
+	}
+}
@@ -31,11 +31,14 @@
 #include <circle/bcm2835.h>
 #include <circle/bcm2835int.h>
 #include <circle/memio.h>
+#include <circle/synchronize.h>
 #include <circle/timer.h>
+#include <circle/util.h>
 #include <assert.h>
 
 #define CHANS			2			// 2 I2S stereo channels
 #define CHANLEN			32			// width of a channel slot in bits
+#define MAX_SLOTS		32			// limited by the 10-bit channel position
 
 //
 // PCM / I2S registers
@@ -46,6 +49,7 @@
 #define CS_A_TXE		(1 << 21)
 #define CS_A_TXD		(1 << 19)
 #define CS_A_TXW		(1 << 17)
+#define CS_A_RXERR		(1 << 16)
 #define CS_A_TXERR		(1 << 15)
 #define CS_A_TXSYNC		(1 << 13)
 #define CS_A_DMAEN		(1 << 9)
@@ -92,8 +96,10 @@ CI2SSoundBaseDevice::CI2SSoundBaseDevice (CInterruptSystem *pInterrupt,
 					  bool		    bSlave,
 					  CI2CMaster       *pI2CMaster,
 					  u8                ucI2CAddress,
-					  TDeviceMode       DeviceMode)
+					  TDeviceMode       DeviceMode,
+					  boolean	    bUseFIQ)
 :	CSoundBaseDevice (SoundFormatSigned24_32, 0, nSampleRate),
+	m_nFrameRate (nSampleRate),
 	m_nChunkSize (nChunkSize),
 	m_bSlave (bSlave),
 	m_pI2CMaster (pI2CMaster),
@@ -102,31 +108,35 @@ CI2SSoundBaseDevice::CI2SSoundBaseDevice (CInterruptSystem *pInterrupt,
 	m_Clock (GPIOClockPCM, GPIOClockSourcePLLD),
 	m_bI2CInited (FALSE),
 	m_bError (FALSE),
-	m_TXBuffers (TRUE, ARM_PCM_FIFO_A, DREQSourcePCMTX, nChunkSize, pInterrupt),
-	m_RXBuffers (FALSE, ARM_PCM_FIFO_A, DREQSourcePCMRX, nChunkSize, pInterrupt)
+	m_TXBuffers (TRUE, ARM_PCM_FIFO_A, DREQSourcePCMTX, nChunkSize, pInterrupt, bUseFIQ),
+	m_RXBuffers (FALSE, ARM_PCM_FIFO_A, DREQSourcePCMRX, nChunkSize, pInterrupt),
+	m_pDuplexCallback (0),
+	m_pDuplexParam (0),
+	m_nChunkUs ((unsigned) ((u64) nChunkSize / CHANS * 1000000 / nSampleRate)),
+	m_pSilence (0),
+	m_pRXChunk (0),
+	m_nRXChunkTicks (0),
+	m_nRXChunks (0),
+	m_nProcessedRXChunks (0),
+	m_nSlots (CHANS),
+	m_nSlot1 (0),
+	m_nSlot2 (1),
+	m_bZeroCopyCapture (FALSE),
+	m_pCaptureCallback (0),
+	m_pCaptureParam (0),
+	m_nCapturedBlocks (0),
+	m_nFetchedBlocks (0)
 {
 	assert (m_nChunkSize >= 32);
 	assert ((m_nChunkSize & 1) == 0);
+	assert (8000 <= nSampleRate && nSampleRate <= 192000);
+
+	ResetStatistics ();
 
 	// start clock and I2S device
 	if (!m_bSlave)
 	{
-		unsigned nClockFreq =
-			CMachineInfo::Get ()->GetGPIOClockSourceRate (GPIOClockSourcePLLD);
-		assert (nClockFreq > 0);
-		assert (8000 <= nSampleRate && nSampleRate <= 192000);
-		assert (nClockFreq % (CHANLEN*CHANS) == 0);
-		unsigned nDivI = nClockFreq / (CHANLEN*CHANS) / nSampleRate;
-		unsigned nTemp = nClockFreq / (CHANLEN*CHANS) % nSampleRate;
-		unsigned nDivF = (nTemp * 4096 + nSampleRate/2) / nSampleRate;
-		assert (nDivF <= 4096);
-		if (nDivF > 4095)
-		{
-			nDivI++;
-			nDivF = 0;
-		}
-
-		m_Clock.Start (nDivI, nDivF, nDivF > 0 ? 1 : 0);
+		StartClock ();
 	}
 
 	RunI2S ();
@@ -140,6 +150,9 @@ CI2SSoundBaseDevice::~CI2SSoundBaseDevice (void)
 
 	// stop I2S device and clock
 	StopI2S ();
+
+	delete [] m_pSilence;
+	m_pSilence = 0;
 }
 
 int CI2SSoundBaseDevice::GetRangeMin (void) const
@@ -272,6 +285,133 @@ void CI2SSoundBaseDevice::Cancel (void)
 	}
 }
 
+void CI2SSoundBaseDevice::RegisterDuplexCallback (TDuplexCallback *pCallback, void *pParam)
+{
+	assert (m_DeviceMode == DeviceModeTXRX);
+	assert (!m_bZeroCopyCapture);
+	assert (!IsActive ());
+
+	if (m_pSilence == 0)
+	{
+		m_pSilence = new u32[m_nChunkSize];
+		assert (m_pSilence != 0);
+		memset (m_pSilence, 0, m_nChunkSize * sizeof (u32));
+	}
+
+	m_pRXChunk = 0;
+	m_nRXChunks = 0;
+	m_nProcessedRXChunks = 0;
+
+	m_pDuplexParam = pParam;
+	m_pDuplexCallback = pCallback;
+}
+
+boolean CI2SSoundBaseDevice::SetTDMSlots (unsigned nSlots, unsigned nSlot1, unsigned nSlot2)
+{
+	assert (!IsActive ());
+
+	if (   nSlots < CHANS
+	    || nSlots > MAX_SLOTS
+	    || nSlot1 >= nSlots
+	    || nSlot2 >= nSlots
+	    || nSlot1 == nSlot2)
+	{
+		return FALSE;
+	}
+
+	m_nSlots = nSlots;
+	m_nSlot1 = nSlot1;
+	m_nSlot2 = nSlot2;
+
+	if (!m_bSlave)
+	{
+		m_Clock.Stop ();
+
+		StartClock ();
+	}
+
+	PeripheralEntry ();
+
+	SetupFrame ();
+
+	PeripheralExit ();
+
+	return TRUE;
+}
+
+void CI2SSoundBaseDevice::EnableZeroCopyCapture (TCaptureCallback *pCallback, void *pParam)
+{
+	assert (m_DeviceMode != DeviceModeTXOnly);
+	assert (m_pDuplexCallback == 0);
+	assert (!IsActive ());
+
+	m_nCapturedBlocks = 0;
+	m_nFetchedBlocks = 0;
+
+	m_pCaptureParam = pParam;
+	m_pCaptureCallback = pCallback;
+	m_bZeroCopyCapture = TRUE;
+}
+
+boolean CI2SSoundBaseDevice::GetCaptureBlock (TCaptureBlock *pBlock)
+{
+	assert (m_bZeroCopyCapture);
+	assert (pBlock != 0);
+
+	// The block [n & 1] is written, before m_nCapturedBlocks is set to n+1. If the counter
+	// did not change during the copy, the most recent block has not been overwritten.
+	unsigned nCaptured;
+	do
+	{
+		nCaptured = m_nCapturedBlocks;
+		if (nCaptured == m_nFetchedBlocks)
+		{
+			return FALSE;
+		}
+
+		DataMemBarrier ();
+
+		*pBlock = m_CaptureBlock[(nCaptured-1) & 1];
+
+		DataMemBarrier ();
+	}
+	while (nCaptured != m_nCapturedBlocks);
+
+	m_Statistics.nCaptureOverruns += nCaptured - m_nFetchedBlocks - 1;
+	m_nFetchedBlocks = nCaptured;
+
+	return TRUE;
+}
+
+boolean CI2SSoundBaseDevice::ReleaseCaptureBlock (const TCaptureBlock *pBlock)
+{
+	assert (m_bZeroCopyCapture);
+	assert (pBlock != 0);
+
+	// the DMA re-fills the buffer, after the next block has been captured
+	DataMemBarrier ();
+	if (m_nCapturedBlocks - pBlock->nSequence > 1)
+	{
+		m_Statistics.nCaptureOverruns++;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CI2SSoundBaseDevice::GetStatistics (TStatistics *pStatistics) const
+{
+	assert (pStatistics != 0);
+	memcpy (pStatistics, &m_Statistics, sizeof *pStatistics);
+}
+
+void CI2SSoundBaseDevice::ResetStatistics (void)
+{
+	memset (&m_Statistics, 0, sizeof m_Statistics);
+	m_Statistics.nMinLatencyUs = (unsigned) -1;
+}
+
 boolean CI2SSoundBaseDevice::IsActive (void) const
 {
 	if (   m_DeviceMode != DeviceModeRXOnly
@@ -301,37 +441,7 @@ void CI2SSoundBaseDevice::RunI2S (void)
 	write32 (ARM_PCM_CS_A, read32 (ARM_PCM_CS_A) | CS_A_TXCLR | CS_A_RXCLR);
 	CTimer::Get ()->usDelay (10);
 
-	// enable channel 1 and 2
-	write32 (ARM_PCM_TXC_A,   TXC_A_CH1WEX
-				| TXC_A_CH1EN
-				| (1 << TXC_A_CH1POS__SHIFT)
-				| (0 << TXC_A_CH1WID__SHIFT)
-				| TXC_A_CH2WEX
-				| TXC_A_CH2EN
-				| ((CHANLEN+1) << TXC_A_CH2POS__SHIFT)
-				| (0 << TXC_A_CH2WID__SHIFT));
-
-	write32 (ARM_PCM_RXC_A,   RXC_A_CH1WEX
-				| RXC_A_CH1EN
-				| (1 << RXC_A_CH1POS__SHIFT)
-				| (0 << RXC_A_CH1WID__SHIFT)
-				| RXC_A_CH2WEX
-				| RXC_A_CH2EN
-				| ((CHANLEN+1) << RXC_A_CH2POS__SHIFT)
-				| (0 << RXC_A_CH2WID__SHIFT));
-
-	u32 nModeA =   MODE_A_CLKI
-		     | MODE_A_FSI
-		     | ((CHANS*CHANLEN-1) << MODE_A_FLEN__SHIFT)
-		     | (CHANLEN << MODE_A_FSLEN__SHIFT);
-
-	// set PCM clock and frame sync as inputs if in slave mode
-	if (m_bSlave)
-	{
-		nModeA |= MODE_A_CLKM | MODE_A_FSM;
-	}
-
-	write32 (ARM_PCM_MODE_A, nModeA);
+	SetupFrame ();
 
 	// init GPIO pins
 	unsigned nPinBase = 18;
@@ -375,6 +485,65 @@ void CI2SSoundBaseDevice::RunI2S (void)
 	PeripheralExit ();
 }
 
+// PeripheralEntry() must have been called
+void CI2SSoundBaseDevice::SetupFrame (void)
+{
+	// enable channel 1 and 2 in the selected slots (1 bit delay to the frame sync)
+	unsigned nPos1 = m_nSlot1*CHANLEN + 1;
+	unsigned nPos2 = m_nSlot2*CHANLEN + 1;
+
+	write32 (ARM_PCM_TXC_A,   TXC_A_CH1WEX
+				| TXC_A_CH1EN
+				| (nPos1 << TXC_A_CH1POS__SHIFT)
+				| (0 << TXC_A_CH1WID__SHIFT)
+				| TXC_A_CH2WEX
+				| TXC_A_CH2EN
+				| (nPos2 << TXC_A_CH2POS__SHIFT)
+				| (0 << TXC_A_CH2WID__SHIFT));
+
+	write32 (ARM_PCM_RXC_A,   RXC_A_CH1WEX
+				| RXC_A_CH1EN
+				| (nPos1 << RXC_A_CH1POS__SHIFT)
+				| (0 << RXC_A_CH1WID__SHIFT)
+				| RXC_A_CH2WEX
+				| RXC_A_CH2EN
+				| (nPos2 << RXC_A_CH2POS__SHIFT)
+				| (0 << RXC_A_CH2WID__SHIFT));
+
+	// I2S has a frame sync with 50% duty cycle, TDM a pulse of one bit
+	u32 nModeA =   MODE_A_CLKI
+		     | MODE_A_FSI
+		     | ((m_nSlots*CHANLEN-1) << MODE_A_FLEN__SHIFT)
+		     | ((m_nSlots == CHANS ? CHANLEN : 1) << MODE_A_FSLEN__SHIFT);
+
+	// set PCM clock and frame sync as inputs if in slave mode
+	if (m_bSlave)
+	{
+		nModeA |= MODE_A_CLKM | MODE_A_FSM;
+	}
+
+	write32 (ARM_PCM_MODE_A, nModeA);
+}
+
+void CI2SSoundBaseDevice::StartClock (void)
+{
+	u64 nClockFreq = CMachineInfo::Get ()->GetGPIOClockSourceRate (GPIOClockSourcePLLD);
+	assert (nClockFreq > 0);
+
+	u64 nBitClock = (u64) m_nFrameRate * m_nSlots * CHANLEN;
+	unsigned nDivI = nClockFreq / nBitClock;
+	unsigned nDivF = (nClockFreq % nBitClock * 4096 + nBitClock/2) / nBitClock;
+	assert (nDivF <= 4096);
+	if (nDivF > 4095)
+	{
+		nDivI++;
+		nDivF = 0;
+	}
+
+	assert (nDivI >= 2);
+	m_Clock.Start (nDivI, nDivF, nDivF > 0 ? 1 : 0);
+}
+
 void CI2SSoundBaseDevice::StopI2S (void)
 {
 	PeripheralEntry ();
@@ -417,6 +586,13 @@ unsigned CI2SSoundBaseDevice::TXCompletedHandler (boolean bStatus, u32 *pBuffer,
 		return 0;
 	}
 
+	pThis->CheckFIFOErrors ();
+
+	if (pThis->m_pDuplexCallback != 0)
+	{
+		return pThis->ProcessDuplex (pBuffer, nChunkSize);
+	}
+
 	return pThis->GetChunk (pBuffer, nChunkSize);
 }
 
@@ -433,11 +609,123 @@ unsigned CI2SSoundBaseDevice::RXCompletedHandler (boolean bStatus, u32 *pBuffer,
 		return 0;
 	}
 
+	if (pThis->m_pDuplexCallback != 0)
+	{
+		// the buffer remains valid, until the next chunk has been received
+		pThis->m_nRXChunkTicks = CTimer::GetClockTicks ();
+		pThis->m_pRXChunk = pBuffer;
+		pThis->m_nRXChunks++;
+
+		return 0;
+	}
+
+	pThis->CheckFIFOErrors ();
+
+	if (pThis->m_bZeroCopyCapture)
+	{
+		pThis->ProcessCapture (pBuffer, nChunkSize);
+
+		return 0;
+	}
+
 	pThis->PutChunk (pBuffer, nChunkSize);
 
 	return 0;
 }
 
+unsigned CI2SSoundBaseDevice::ProcessDuplex (u32 *pOutput, unsigned nChunkSize)
+{
+	assert (m_pDuplexCallback != 0);
+
+	unsigned nRXChunks = m_nRXChunks;
+	unsigned nRXChunkTicks = m_nRXChunkTicks;
+	const u32 *pInput = m_pRXChunk;
+
+	if (pInput == 0)
+	{
+		pInput = m_pSilence;		// nothing received yet
+	}
+	else
+	{
+		unsigned nNewChunks = nRXChunks - m_nProcessedRXChunks;
+		if (nNewChunks == 0)
+		{
+			m_Statistics.nInputRepeated++;
+		}
+		else
+		{
+			m_Statistics.nInputDropped += nNewChunks - 1;
+		}
+
+		m_nProcessedRXChunks = nRXChunks;
+
+		// The first input sample has been received one chunk before the RX completion.
+		// The output chunk will be sent after the currently sent one.
+		unsigned nLatency =   m_nChunkUs + (CTimer::GetClockTicks () - nRXChunkTicks)
+				    + m_nChunkUs;
+
+		m_Statistics.nLatencyUs = nLatency;
+		if (nLatency < m_Statistics.nMinLatencyUs)
+		{
+			m_Statistics.nMinLatencyUs = nLatency;
+		}
+		if (nLatency > m_Statistics.nMaxLatencyUs)
+		{
+			m_Statistics.nMaxLatencyUs = nLatency;
+		}
+	}
+
+	assert (pInput != 0);
+	(*m_pDuplexCallback) (pInput, pOutput, nChunkSize, m_pDuplexParam);
+
+	return nChunkSize;
+}
+
+void CI2SSoundBaseDevice::ProcessCapture (const u32 *pBuffer, unsigned nChunkSize)
+{
+	unsigned nSequence = m_nCapturedBlocks;
+
+	// the DMA completes, when the last frame of the block has been received
+	TCaptureBlock *pBlock = &m_CaptureBlock[nSequence & 1];
+	pBlock->pBuffer = pBuffer;
+	pBlock->nChunkSize = nChunkSize;
+	pBlock->nSequence = nSequence;
+	pBlock->nFrame = (u64) nSequence * (nChunkSize / CHANS);
+	pBlock->nTimestamp = CTimer::GetClockTicks64 () - m_nChunkUs;
+
+	DataMemBarrier ();
+
+	m_nCapturedBlocks = nSequence + 1;
+
+	if (m_pCaptureCallback != 0)
+	{
+		(*m_pCaptureCallback) (pBlock, m_pCaptureParam);
+	}
+}
+
+void CI2SSoundBaseDevice::CheckFIFOErrors (void)
+{
+	PeripheralEntry ();
+
+	u32 nCS = read32 (ARM_PCM_CS_A);
+	if (nCS & (CS_A_TXERR | CS_A_RXERR))
+	{
+		if (nCS & CS_A_TXERR)
+		{
+			m_Statistics.nTXUnderruns++;
+		}
+
+		if (nCS & CS_A_RXERR)
+		{
+			m_Statistics.nRXOverruns++;
+		}
+
+		write32 (ARM_PCM_CS_A, nCS);	// error flags are cleared by writing 1
+	}
+
+	PeripheralExit ();
+}
+
 //
 // Taken from the file mt32pi.cpp from this project:
 //
@@ -0,0 +1,273 @@
+//
+// inputeventqueue.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/input/inputeventqueue.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#include <assert.h>
+
+CInputEventQueue *CInputEventQueue::s_pThis = 0;
+
+CInputEventQueue::CInputEventQueue (void)
+:	m_Queue (INPUT_EVENT_QUEUE_SIZE),
+	m_nDropped (0)
+{
+	assert (s_pThis == 0);
+	s_pThis = this;
+}
+
+CInputEventQueue::~CInputEventQueue (void)
+{
+	s_pThis = 0;
+}
+
+void CInputEventQueue::AttachKeyboard (CUSBKeyboardDevice *pKeyboard)
+{
+	assert (pKeyboard != 0);
+	pKeyboard->RegisterKeyPressedHandler (KeyPressedHandler);
+}
+
+void CInputEventQueue::AttachMouse (CMouseDevice *pMouse)
+{
+	assert (pMouse != 0);
+	pMouse->RegisterStatusHandler (MouseStatusHandler);
+}
+
+void CInputEventQueue::AttachTouchScreen (CTouchScreenDevice *pTouchScreen)
+{
+	assert (pTouchScreen != 0);
+	pTouchScreen->RegisterEventHandler (TouchScreenEventHandler);
+}
+
+void CInputEventQueue::AttachGamePad (CUSBGamePadDevice *pGamePad)
+{
+	assert (pGamePad != 0);
+	pGamePad->RegisterStatusHandler (GamePadStatusHandler);
+}
+
+boolean CInputEventQueue::Post (const TInputEvent *pEvent)
+{
+	assert (pEvent != 0);
+	assert (pEvent->Type < InputEventUnknown);
+
+	m_SpinLock.Acquire ();
+
+	TInputEvent *pItem = m_Queue.BeginWrite ();
+	if (pItem == 0)
+	{
+		m_nDropped++;
+
+		m_SpinLock.Release ();
+
+		return FALSE;
+	}
+
+	*pItem = *pEvent;
+	if (pItem->nTimestamp == 0)
+	{
+		pItem->nTimestamp = CTimer::GetClockTicks64 ();
+	}
+	pItem->nCoalesced = 1;
+
+	m_Queue.EndWrite (pItem);
+
+	m_SpinLock.Release ();
+
+	return TRUE;
+}
+
+unsigned CInputEventQueue::Drain (TInputEvent *pEvents, unsigned nMaxEvents)
+{
+	assert (pEvents != 0);
+
+	unsigned nEvents = 0;
+
+	const TInputEvent *pItem;
+	while ((pItem = m_Queue.BeginRead ()) != 0)
+	{
+		if (!Merge (pEvents, nEvents, pItem))
+		{
+			if (nEvents >= nMaxEvents)
+			{
+				break;				// leave the item for the next call
+			}
+
+			pEvents[nEvents++] = *pItem;
+		}
+
+		m_Queue.EndRead ();
+	}
+
+	return nEvents;
+}
+
+boolean CInputEventQueue::IsEmpty (void) const
+{
+	return m_Queue.IsEmpty ();
+}
+
+unsigned CInputEventQueue::GetDropped (void) const
+{
+	return m_nDropped;
+}
+
+boolean CInputEventQueue::Merge (TInputEvent *pEvents, unsigned nEvents, const TInputEvent *pEvent)
+{
+	assert (pEvent != 0);
+
+	// find the last event from the same source in this batch
+	TInputEvent *pLast = 0;
+	for (unsigned i = nEvents; i-- > 0;)
+	{
+		TInputEvent *p = &pEvents[i];
+		if (   p->Type == pEvent->Type
+		    && p->nDevice == pEvent->nDevice
+		    && (   p->Type != InputEventTouch
+			|| p->Touch.nID == pEvent->Touch.nID))
+		{
+			pLast = p;
+
+			break;
+		}
+	}
+
+	if (pLast == 0)
+	{
+		return FALSE;
+	}
+
+	switch (pEvent->Type)
+	{
+	case InputEventMouse:
+		if (pLast->Mouse.nButtons != pEvent->Mouse.nButtons)
+		{
+			return FALSE;
+		}
+
+		pLast->Mouse.nDisplacementX += pEvent->Mouse.nDisplacementX;
+		pLast->Mouse.nDisplacementY += pEvent->Mouse.nDisplacementY;
+		pLast->Mouse.nWheelMove += pEvent->Mouse.nWheelMove;
+		break;
+
+	case InputEventTouch:
+		if (   pLast->Touch.Event != TouchScreenEventFingerMove
+		    || pEvent->Touch.Event != TouchScreenEventFingerMove)
+		{
+			return FALSE;
+		}
+
+		pLast->Touch.nPosX = pEvent->Touch.nPosX;
+		pLast->Touch.nPosY = pEvent->Touch.nPosY;
+		break;
+
+	case InputEventGamePad:
+		if (   pLast->GamePad.nButtons != pEvent->GamePad.nButtons
+		    || pLast->GamePad.nhats != pEvent->GamePad.nhats
+		    || memcmp (pLast->GamePad.Hats, pEvent->GamePad.Hats,
+			       sizeof pLast->GamePad.Hats) != 0)
+		{
+			return FALSE;
+		}
+
+		pLast->GamePad.naxes = pEvent->GamePad.naxes;
+		memcpy (pLast->GamePad.Axes, pEvent->GamePad.Axes, sizeof pLast->GamePad.Axes);
+		break;
+
+	default:
+		return FALSE;
+	}
+
+	pLast->nTimestamp = pEvent->nTimestamp;
+	pLast->nCoalesced += pEvent->nCoalesced;
+
+	return TRUE;
+}
+
+void CInputEventQueue::KeyPressedHandler (const char *pString)
+{
+	assert (s_pThis != 0);
+	assert (pString != 0);
+
+	TInputEvent Event;
+	memset (&Event, 0, sizeof Event);
+	Event.Type = InputEventKeyPressed;
+	strncpy (Event.KeyString, pString, sizeof Event.KeyString-1);
+
+	s_pThis->Post (&Event);
+}
+
+void CInputEventQueue::MouseStatusHandler (unsigned nButtons, int nDisplacementX,
+					   int nDisplacementY, int nWheelMove)
+{
+	assert (s_pThis != 0);
+
+	TInputEvent Event;
+	memset (&Event, 0, sizeof Event);
+	Event.Type = InputEventMouse;
+	Event.Mouse.nButtons = nButtons;
+	Event.Mouse.nDisplacementX = nDisplacementX;
+	Event.Mouse.nDisplacementY = nDisplacementY;
+	Event.Mouse.nWheelMove = nWheelMove;
+
+	s_pThis->Post (&Event);
+}
+
+void CInputEventQueue::TouchScreenEventHandler (TTouchScreenEvent Event, unsigned nID,
+						unsigned nPosX, unsigned nPosY)
+{
+	assert (s_pThis != 0);
+
+	TInputEvent InputEvent;
+	memset (&InputEvent, 0, sizeof InputEvent);
+	InputEvent.Type = InputEventTouch;
+	InputEvent.Touch.Event = Event;
+	InputEvent.Touch.nID = nID;
+	InputEvent.Touch.nPosX = nPosX;
+	InputEvent.Touch.nPosY = nPosY;
+
+	s_pThis->Post (&InputEvent);
+}
+
+void CInputEventQueue::GamePadStatusHandler (unsigned nDeviceIndex, const TGamePadState *pState)
+{
+	assert (s_pThis != 0);
+	assert (pState != 0);
+
+	TInputEvent Event;
+	memset (&Event, 0, sizeof Event);
+	Event.Type = InputEventGamePad;
+	Event.nDevice = nDeviceIndex;
+	Event.GamePad.nButtons = pState->buttons;
+
+	assert (pState->naxes <= INPUT_GAMEPAD_AXES);
+	Event.GamePad.naxes = pState->naxes;
+	for (int i = 0; i < pState->naxes; i++)
+	{
+		Event.GamePad.Axes[i] = pState->axes[i].value;
+	}
+
+	assert (pState->nhats <= MAX_HATS);
+	Event.GamePad.nhats = pState->nhats;
+	for (int i = 0; i < pState->nhats; i++)
+	{
+		Event.GamePad.Hats[i] = pState->hats[i];
+	}
+
+	s_pThis->Post (&Event);
+}
@@ -47,12 +47,17 @@ static const char FromFT5406[] = "ft5406";
 CRPiTouchScreen::CRPiTouchScreen (void)
 :	m_pFT5406Buffer (0),
 	m_nKnownIDs (0),
-	m_pDevice (0)
+	m_pDevice (0),
+	m_bSampling (FALSE),
+	m_nSampleDelay (1),
+	m_SampleTimer (SampleHandler, this)
 {
 }
 
 CRPiTouchScreen::~CRPiTouchScreen (void)
 {
+	StopSampling ();
+
 	delete m_pDevice;
 	m_pDevice = 0;
 
@@ -116,6 +121,18 @@ void CRPiTouchScreen::Update (void)
 
 	assert (m_pDevice != 0);
 
+	// The events of one sample are collected first and reported back-to-back afterwards,
+	// so that a multi-touch gesture is never seen partially updated.
+	struct
+	{
+		TTouchScreenEvent Event;
+		unsigned nID;
+		unsigned nPosX;
+		unsigned nPosY;
+	}
+	Report[2*RPITOUCH_SCREEN_MAX_POINTS];
+	unsigned nReports = 0;
+
 	unsigned nModifiedIDs = 0;
 	assert (Regs.NumPoints <= RPITOUCH_SCREEN_MAX_POINTS);
 	for (unsigned i = 0; i < Regs.NumPoints; i++)
@@ -136,7 +153,10 @@ void CRPiTouchScreen::Update (void)
 				m_nPosX[nTouchID] = x;
 				m_nPosY[nTouchID] = y;
 
-				m_pDevice->ReportHandler (TouchScreenEventFingerDown, nTouchID, x, y);
+				Report[nReports].Event = TouchScreenEventFingerDown;
+				Report[nReports].nID = nTouchID;
+				Report[nReports].nPosX = x;
+				Report[nReports++].nPosY = y;
 			}
 			else
 			{
@@ -146,8 +166,10 @@ void CRPiTouchScreen::Update (void)
 					m_nPosX[nTouchID] = x;
 					m_nPosY[nTouchID] = y;
 
-					m_pDevice->ReportHandler (TouchScreenEventFingerMove,
-								  nTouchID, x, y);
+					Report[nReports].Event = TouchScreenEventFingerMove;
+					Report[nReports].nID = nTouchID;
+					Report[nReports].nPosX = x;
+					Report[nReports++].nPosY = y;
 				}
 			}
 		}
@@ -158,13 +180,47 @@ void CRPiTouchScreen::Update (void)
 	{
 		if (nReleasedIDs & (1 << i))
 		{
-			m_pDevice->ReportHandler (TouchScreenEventFingerUp, i, 0, 0);
+			Report[nReports].Event = TouchScreenEventFingerUp;
+			Report[nReports].nID = i;
+			Report[nReports].nPosX = 0;
+			Report[nReports++].nPosY = 0;
 
 			nModifiedIDs &= ~(1 << i);
 		}
 	}
 
 	m_nKnownIDs = nModifiedIDs;
+
+	assert (nReports <= sizeof Report / sizeof Report[0]);
+	for (unsigned i = 0; i < nReports; i++)
+	{
+		m_pDevice->ReportHandler (Report[i].Event, Report[i].nID,
+					  Report[i].nPosX, Report[i].nPosY);
+	}
+}
+
+void CRPiTouchScreen::StartSampling (unsigned nRateHz)
+{
+	assert (m_pFT5406Buffer != 0);
+	assert (!m_bSampling);
+
+	assert (nRateHz > 0);
+	m_nSampleDelay = HZ / nRateHz;
+	if (m_nSampleDelay == 0)
+	{
+		m_nSampleDelay = 1;
+	}
+
+	m_bSampling = TRUE;
+
+	m_SampleTimer.Start (m_nSampleDelay);
+}
+
+void CRPiTouchScreen::StopSampling (void)
+{
+	m_bSampling = FALSE;
+
+	m_SampleTimer.Cancel ();
 }
 
 void CRPiTouchScreen::UpdateStub (void *pParam)
@@ -172,5 +228,26 @@ void CRPiTouchScreen::UpdateStub (void *pParam)
 	CRPiTouchScreen *pThis = static_cast<CRPiTouchScreen *> (pParam);
 	assert (pThis != 0);
 
+	// the buffer is owned by the sample timer, while it is active
+	if (!pThis->m_bSampling)
+	{
+		pThis->Update ();
+	}
+}
+
+void CRPiTouchScreen::SampleHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext)
+{
+	CRPiTouchScreen *pThis = static_cast<CRPiTouchScreen *> (pParam);
+	assert (pThis != 0);
+
+	if (!pThis->m_bSampling)
+	{
+		return;
+	}
+
 	pThis->Update ();
+
+	// the firmware sets NumPoints again, when it has written new data, otherwise nothing
+	// has been reported above
+	pThis->m_SampleTimer.Start (pThis->m_nSampleDelay);
 }
@@ -2,7 +2,7 @@
 // interrupt.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,6 +18,8 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/interrupt.h>
+#include <circle/boottrace.h>
+#include <circle/tracer.h>
 #include <circle/synchronize.h>
 #include <circle/multicore.h>
 #include <circle/bcm2835.h>
@@ -54,9 +56,16 @@ CInterruptSystem::CInterruptSystem (void)
 	{
 		m_apIRQHandler[nIRQ] = 0;
 		m_pParam[nIRQ] = 0;
+		m_nIRQCount[nIRQ] = 0;
 	}
 
 	s_pThis = this;
+
+#ifdef IRQ_STATISTICS
+	m_pFIQHandler = 0;
+	m_pFIQParam = 0;
+#endif
+	ResetIRQStatistics ();
 }
 
 CInterruptSystem::~CInterruptSystem (void)
@@ -110,6 +119,8 @@ boolean CInterruptSystem::Initialize (void)
 
 	EnableIRQs ();
 
+	CBootTrace::Mark ("interrupt");
+
 	return TRUE;
 }
 
@@ -142,22 +153,45 @@ void CInterruptSystem::ConnectFIQ (unsigned nFIQ, TFIQHandler *pHandler, void *p
 #endif
 	assert (nFIQ <= ARM_MAX_FIQ);
 	assert (pHandler != 0);
-	assert (FIQData.pHandler == 0);
+	assert (FIQData.pHandler == 0);		// only one FIQ source is supported
 
-	FIQData.pHandler = pHandler;
-	FIQData.pParam = pParam;
+	FIQData.nFIQNumber = nFIQ;
+	SetFIQHandler (pHandler, pParam);
 
 	EnableFIQ (nFIQ);
 }
 
+void CInterruptSystem::DisconnectFIQ (unsigned nFIQ)
+{
+	assert (FIQData.nFIQNumber == nFIQ);
+
+	DisconnectFIQ ();
+}
+
 void CInterruptSystem::DisconnectFIQ (void)
 {
 	assert (FIQData.pHandler != 0);
 
 	DisableFIQ ();
 
-	FIQData.pHandler = 0;
-	FIQData.pParam = 0;
+	SetFIQHandler (0, 0);
+}
+
+void CInterruptSystem::SetFIQHandler (TFIQHandler *pHandler, void *pParam)
+{
+#ifdef IRQ_STATISTICS
+	m_pFIQHandler = pHandler;
+	m_pFIQParam = pParam;
+
+	if (pHandler != 0)
+	{
+		pHandler = FIQStatisticsHandler;
+		pParam = this;
+	}
+#endif
+
+	FIQData.pParam = pParam;
+	FIQData.pHandler = pHandler;
 }
 
 void CInterruptSystem::EnableIRQ (unsigned nIRQ)
@@ -173,9 +207,16 @@ void CInterruptSystem::EnableIRQ (unsigned nIRQ)
 	else
 	{
 #if RASPPI >= 2
-		assert (nIRQ == ARM_IRQLOCAL0_CNTPNS);	// the only implemented local IRQ so far
-		write32 (ARM_LOCAL_TIMER_INT_CONTROL0,
-			 read32 (ARM_LOCAL_TIMER_INT_CONTROL0) | (1 << 1));
+		if (nIRQ == ARM_IRQLOCAL0_PMU)
+		{
+			write32 (ARM_LOCAL_PM_ROUTING_SET, 1 << 0);	// IRQ on core 0
+		}
+		else
+		{
+			assert (nIRQ == ARM_IRQLOCAL0_CNTPNS);
+			write32 (ARM_LOCAL_TIMER_INT_CONTROL0,
+				 read32 (ARM_LOCAL_TIMER_INT_CONTROL0) | (1 << 1));
+		}
 #else
 		assert (0);
 #endif
@@ -197,9 +238,16 @@ void CInterruptSystem::DisableIRQ (unsigned nIRQ)
 	else
 	{
 #if RASPPI >= 2
-		assert (nIRQ == ARM_IRQLOCAL0_CNTPNS);	// the only implemented local IRQ so far
-		write32 (ARM_LOCAL_TIMER_INT_CONTROL0,
-			 read32 (ARM_LOCAL_TIMER_INT_CONTROL0) & ~(1 << 1));
+		if (nIRQ == ARM_IRQLOCAL0_PMU)
+		{
+			write32 (ARM_LOCAL_PM_ROUTING_CLR, 1 << 0);
+		}
+		else
+		{
+			assert (nIRQ == ARM_IRQLOCAL0_CNTPNS);
+			write32 (ARM_LOCAL_TIMER_INT_CONTROL0,
+				 read32 (ARM_LOCAL_TIMER_INT_CONTROL0) & ~(1 << 1));
+		}
 #else
 		assert (0);
 #endif
@@ -241,8 +289,23 @@ boolean CInterruptSystem::CallIRQHandler (unsigned nIRQ)
 
 	if (pHandler != 0)
 	{
+		TRACEPOINT (TRACER_EVENT_IRQ_ENTRY, nIRQ);
+
+		// local interrupts may occur on several cores at the same time
+		__atomic_fetch_add (&m_nIRQCount[nIRQ], 1, __ATOMIC_RELAXED);
+
+#ifdef IRQ_STATISTICS
+		u64 nStart = GetTimestamp ();
+#endif
+
 		(*pHandler) (m_pParam[nIRQ]);
-		
+
+#ifdef IRQ_STATISTICS
+		AccountIRQ (&m_IRQTiming[nIRQ], GetTimestamp () - nStart, nIRQ);
+#endif
+
+		TRACEPOINT (TRACER_EVENT_IRQ_EXIT, nIRQ);
+
 		return TRUE;
 	}
 	else
@@ -259,13 +322,20 @@ void CInterruptSystem::InterruptHandler (void)
 
 #if RASPPI >= 2
 	u32 nLocalPending = read32 (ARM_LOCAL_IRQ_PENDING0);
-	assert (!(nLocalPending & ~(1 << 1 | 0xF << 4 | 1 << 8)));
-	if (nLocalPending & (1 << 1))		// the only implemented local IRQ so far
+	assert (!(nLocalPending & ~(1 << 1 | 0xF << 4 | 1 << 8 | 1 << 9)));
+	if (nLocalPending & (1 << 1))
 	{
 		s_pThis->CallIRQHandler (ARM_IRQLOCAL0_CNTPNS);
 
 		return;
 	}
+
+	if (nLocalPending & (1 << 9))
+	{
+		s_pThis->CallIRQHandler (ARM_IRQLOCAL0_PMU);
+
+		return;
+	}
 #endif
 
 #ifdef ARM_ALLOW_MULTI_CORE
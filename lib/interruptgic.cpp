@@ -4,7 +4,7 @@
 // Driver for the GIC-400 interrupt controller of the Raspberry Pi 4
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2019-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2019-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,6 +20,8 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/interrupt.h>
+#include <circle/boottrace.h>
+#include <circle/tracer.h>
 #include <circle/synchronize.h>
 #include <circle/multicore.h>
 #include <circle/bcm2711.h>
@@ -78,12 +80,20 @@
 	#define GICC_EOIR_CPUID__SHIFT		10
 	#define GICC_EOIR_CPUID__MASK		(3 << 10)
 
+// ARMC registers (raw status of the VideoCore interrupts, independent of the GIC)
+#define ARMC_IRQ_STATUS0	(ARM_IC_BASE + 0x230)
+#define ARMC_VC_IRQ_BASE	GIC_SPI (64)
+#define ARMC_VC_IRQS		64
+
 enum TSMCFunction
 {
 	SMCFunctionEnableFIQ,		// nParam: FIQ number
 	SMCFunctionDisableFIQ		// nParam: FIQ number
 };
 
+CInterruptSystem::TFIQSource CInterruptSystem::s_FIQSource[FIQ_SOURCES];
+volatile unsigned CInterruptSystem::s_nFIQSources = 0;
+
 CInterruptSystem *CInterruptSystem::s_pThis = 0;
 
 CInterruptSystem::CInterruptSystem (void)
@@ -92,9 +102,27 @@ CInterruptSystem::CInterruptSystem (void)
 	{
 		m_apIRQHandler[nIRQ] = 0;
 		m_pParam[nIRQ] = 0;
+		m_nIRQCount[nIRQ] = 0;
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		for (unsigned nPPI = 0; nPPI < PPI_LINES; nPPI++)
+		{
+			m_apPPIHandler[nCore][nPPI] = 0;
+			m_pPPIParam[nCore][nPPI] = 0;
+		}
 	}
+#endif
 
 	s_pThis = this;
+
+#ifdef IRQ_STATISTICS
+	m_pFIQHandler = 0;
+	m_pFIQParam = 0;
+#endif
+	ResetIRQStatistics ();
 }
 
 CInterruptSystem::~CInterruptSystem (void)
@@ -170,12 +198,32 @@ boolean CInterruptSystem::Initialize (void)
 
 	EnableIRQs ();
 
+	CBootTrace::Mark ("interrupt");
+
 	return TRUE;
 }
 
 void CInterruptSystem::ConnectIRQ (unsigned nIRQ, TIRQHandler *pHandler, void *pParam)
 {
 	assert (nIRQ < IRQ_LINES);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	if (GIC_PPI (0) <= nIRQ && nIRQ < GIC_SPI (0))
+	{
+		// connect the PPI on this core only, GICD_ISENABLER0 is banked too
+		unsigned nCore = CMultiCoreSupport::ThisCore ();
+		unsigned nPPI = nIRQ - GIC_PPI (0);
+		assert (m_apPPIHandler[nCore][nPPI] == 0);
+
+		m_apPPIHandler[nCore][nPPI] = pHandler;
+		m_pPPIParam[nCore][nPPI] = pParam;
+
+		EnableIRQ (nIRQ);
+
+		return;
+	}
+#endif
+
 	assert (m_apIRQHandler[nIRQ] == 0);
 
 	m_apIRQHandler[nIRQ] = pHandler;
@@ -187,6 +235,23 @@ void CInterruptSystem::ConnectIRQ (unsigned nIRQ, TIRQHandler *pHandler, void *p
 void CInterruptSystem::DisconnectIRQ (unsigned nIRQ)
 {
 	assert (nIRQ < IRQ_LINES);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	if (GIC_PPI (0) <= nIRQ && nIRQ < GIC_SPI (0))
+	{
+		unsigned nCore = CMultiCoreSupport::ThisCore ();
+		unsigned nPPI = nIRQ - GIC_PPI (0);
+		assert (m_apPPIHandler[nCore][nPPI] != 0);
+
+		DisableIRQ (nIRQ);
+
+		m_apPPIHandler[nCore][nPPI] = 0;
+		m_pPPIParam[nCore][nPPI] = 0;
+
+		return;
+	}
+#endif
+
 	assert (m_apIRQHandler[nIRQ] != 0);
 
 	DisableIRQ (nIRQ);
@@ -197,24 +262,127 @@ void CInterruptSystem::DisconnectIRQ (unsigned nIRQ)
 
 void CInterruptSystem::ConnectFIQ (unsigned nFIQ, TFIQHandler *pHandler, void *pParam)
 {
-	assert (nFIQ <= ARM_MAX_FIQ);
+	assert (nFIQ < ARM_MAX_FIQ);
 	assert (pHandler != 0);
-	assert (FIQData.pHandler == 0);
 
-	FIQData.pHandler = pHandler;
-	FIQData.pParam = pParam;
+	EnterCritical (FIQ_LEVEL);
+
+	unsigned nSources = s_nFIQSources;
+	if (nSources >= FIQ_SOURCES)
+	{
+		LeaveCritical ();
+
+		CLogger::Get ()->Write ("intgic", LogPanic, "Too many FIQ sources");
+	}
+
+	TFIQSource *pSource = &s_FIQSource[nSources];
+	pSource->nFIQ = nFIQ;
+	pSource->pHandler = pHandler;
+	pSource->pParam = pParam;
+
+	// VideoCore interrupts can be decoded using the raw status in the ARMC
+	if (   ARMC_VC_IRQ_BASE <= nFIQ
+	    && nFIQ < ARMC_VC_IRQ_BASE + ARMC_VC_IRQS)
+	{
+		pSource->nStatusReg = ARMC_IRQ_STATUS0 + (nFIQ - ARMC_VC_IRQ_BASE) / 32 * 4;
+		pSource->nStatusMask = 1 << (nFIQ - ARMC_VC_IRQ_BASE) % 32;
+	}
+	else
+	{
+		pSource->nStatusReg = 0;
+		pSource->nStatusMask = 0;
+	}
+
+	s_nFIQSources = ++nSources;
+
+	if (nSources == 1)
+	{
+		SetFIQHandler (pHandler, pParam);
+	}
+	else
+	{
+		SetFIQHandler (FIQMultiplexHandler, 0);
+	}
+
+	LeaveCritical ();
 
 	EnableFIQ (nFIQ);
 }
 
+void CInterruptSystem::DisconnectFIQ (unsigned nFIQ)
+{
+	DisableFIQ (nFIQ);
+
+	EnterCritical (FIQ_LEVEL);
+
+	unsigned nSources = s_nFIQSources;
+
+	unsigned i;
+	for (i = 0; i < nSources; i++)
+	{
+		if (s_FIQSource[i].nFIQ == nFIQ)
+		{
+			break;
+		}
+	}
+
+	assert (i < nSources);
+	for (nSources--; i < nSources; i++)
+	{
+		s_FIQSource[i] = s_FIQSource[i+1];
+	}
+
+	s_nFIQSources = nSources;
+
+	if (nSources == 0)
+	{
+		SetFIQHandler (0, 0);
+	}
+	else if (nSources == 1)
+	{
+		SetFIQHandler (s_FIQSource[0].pHandler, s_FIQSource[0].pParam);
+	}
+
+	LeaveCritical ();
+}
+
 void CInterruptSystem::DisconnectFIQ (void)
 {
-	assert (FIQData.pHandler != 0);
+	assert (s_nFIQSources == 1);
+
+	DisconnectFIQ (s_FIQSource[0].nFIQ);
+}
+
+void CInterruptSystem::SetFIQHandler (TFIQHandler *pHandler, void *pParam)
+{
+#ifdef IRQ_STATISTICS
+	m_pFIQHandler = pHandler;
+	m_pFIQParam = pParam;
+
+	if (pHandler != 0)
+	{
+		pHandler = FIQStatisticsHandler;
+		pParam = this;
+	}
+#endif
+
+	FIQData.pParam = pParam;
+	FIQData.pHandler = pHandler;
+}
 
-	DisableFIQ ();
+void CInterruptSystem::FIQMultiplexHandler (void *pParam)
+{
+	unsigned nSources = s_nFIQSources;
+	for (unsigned i = 0; i < nSources; i++)
+	{
+		const TFIQSource *pSource = &s_FIQSource[i];
 
-	FIQData.pHandler = 0;
-	FIQData.pParam = 0;
+		if (   pSource->nStatusReg == 0
+		    || (read32 (pSource->nStatusReg) & pSource->nStatusMask))
+		{
+			(*pSource->pHandler) (pSource->pParam);
+		}
+	}
 }
 
 void CInterruptSystem::EnableIRQ (unsigned nIRQ)
@@ -243,12 +411,19 @@ void CInterruptSystem::EnableFIQ (unsigned nFIQ)
 
 	assert (nFIQ >= 16);
 	assert (nFIQ < ARM_MAX_FIQ);
-	FIQData.nFIQNumber = nFIQ;
 
 	CallSecureMonitor (SMCFunctionEnableFIQ, nFIQ);
 }
 
 void CInterruptSystem::DisableFIQ (void)	// may be called, when FIQ is not enabled
+{
+	for (unsigned i = 0; i < s_nFIQSources; i++)
+	{
+		DisableFIQ (s_FIQSource[i].nFIQ);
+	}
+}
+
+void CInterruptSystem::DisableFIQ (unsigned nFIQ)
 {
 #if AARCH == 64
 	u32 *pMagic = (u32 *) ARMSTUB_FIQ_MAGIC_ADDR;
@@ -258,12 +433,7 @@ void CInterruptSystem::DisableFIQ (void)	// may be called, when FIQ is not enabl
 	}
 #endif
 
-	if (FIQData.nFIQNumber != 0)
-	{
-		CallSecureMonitor (SMCFunctionDisableFIQ, FIQData.nFIQNumber);
-
-		FIQData.nFIQNumber = 0;
-	}
+	CallSecureMonitor (SMCFunctionDisableFIQ, nFIQ);
 }
 
 CInterruptSystem *CInterruptSystem::Get (void)
@@ -272,15 +442,67 @@ CInterruptSystem *CInterruptSystem::Get (void)
 	return s_pThis;
 }
 
+void CInterruptSystem::SetIRQTarget (unsigned nIRQ, unsigned nCore)
+{
+	assert (GIC_SPI (0) <= nIRQ && nIRQ < IRQ_LINES);
+	assert (nCore < CORES);
+
+	// GICD_ITARGETSRn are byte accessible
+	write8 (GICD_ITARGETSR0 + nIRQ, GICD_ITARGETSR_CORE0 << nCore);
+}
+
+unsigned CInterruptSystem::GetIRQTarget (unsigned nIRQ)
+{
+	assert (GIC_SPI (0) <= nIRQ && nIRQ < IRQ_LINES);
+
+	u8 uchTargets = read8 (GICD_ITARGETSR0 + nIRQ);
+
+	unsigned nCore;
+	for (nCore = 0; nCore < CORES-1; nCore++)
+	{
+		if (uchTargets & (GICD_ITARGETSR_CORE0 << nCore))
+		{
+			break;
+		}
+	}
+
+	return nCore;
+}
+
 boolean CInterruptSystem::CallIRQHandler (unsigned nIRQ)
 {
 	assert (nIRQ < IRQ_LINES);
 	TIRQHandler *pHandler = m_apIRQHandler[nIRQ];
+	void *pParam = m_pParam[nIRQ];
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	if (nIRQ < GIC_SPI (0))
+	{
+		unsigned nCore = CMultiCoreSupport::ThisCore ();
+		pHandler = m_apPPIHandler[nCore][nIRQ - GIC_PPI (0)];
+		pParam = m_pPPIParam[nCore][nIRQ - GIC_PPI (0)];
+	}
+#endif
 
 	if (pHandler != 0)
 	{
-		(*pHandler) (m_pParam[nIRQ]);
-		
+		TRACEPOINT (TRACER_EVENT_IRQ_ENTRY, nIRQ);
+
+		// private peripheral interrupts may occur on several cores at the same time
+		__atomic_fetch_add (&m_nIRQCount[nIRQ], 1, __ATOMIC_RELAXED);
+
+#ifdef IRQ_STATISTICS
+		u64 nStart = GetTimestamp ();
+#endif
+
+		(*pHandler) (pParam);
+
+#ifdef IRQ_STATISTICS
+		AccountIRQ (&m_IRQTiming[nIRQ], GetTimestamp () - nStart, nIRQ);
+#endif
+
+		TRACEPOINT (TRACER_EVENT_IRQ_EXIT, nIRQ);
+
 		return TRUE;
 	}
 	else
@@ -416,9 +638,7 @@ void CInterruptSystem::SecureMonitorHandler (u32 nFunction, u32 nParam)
 		// set this interrupt to group 1
 		write32 (GICD_IGROUPR0 + nRegOffset, read32 (GICD_IGROUPR0 + nRegOffset) | nMask);
 
-		// global FIQ disable
-		write32 (GICC_CTLR, GICC_CTLR_ENABLE_GROUP1);
-		write32 (GICD_CTLR, GICD_CTLR_ENABLE_GROUP1);
+		// group 0 stays enabled, other FIQ sources may still be connected
 	}
 }
 
@@ -0,0 +1,247 @@
+//
+// interruptstat.cpp
+//
+// Interrupt statistics, common for interrupt.cpp and interruptgic.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/interrupt.h>
+#include <circle/synchronize.h>
+#include <circle/timer.h>
+#include <circle/logger.h>
+#include <assert.h>
+
+static const char FromInterrupt[] = "irq";
+
+unsigned CInterruptSystem::GetIRQCount (unsigned nIRQ)
+{
+	assert (s_pThis != 0);
+	assert (nIRQ < IRQ_LINES);
+
+	return __atomic_load_n (&s_pThis->m_nIRQCount[nIRQ], __ATOMIC_RELAXED);
+}
+
+boolean CInterruptSystem::GetIRQStatistics (unsigned nIRQ, TIRQStatistics *pStatistics)
+{
+#ifdef IRQ_STATISTICS
+	assert (s_pThis != 0);
+	assert (nIRQ < IRQ_LINES);
+
+	return GetStatistics (&s_pThis->m_IRQTiming[nIRQ], GetIRQCount (nIRQ), pStatistics);
+#else
+	return FALSE;
+#endif
+}
+
+boolean CInterruptSystem::GetFIQStatistics (TIRQStatistics *pStatistics)
+{
+#ifdef IRQ_STATISTICS
+	assert (s_pThis != 0);
+
+	return GetStatistics (&s_pThis->m_FIQTiming, s_pThis->m_nFIQCount, pStatistics);
+#else
+	return FALSE;
+#endif
+}
+
+void CInterruptSystem::ResetIRQStatistics (void)
+{
+	assert (s_pThis != 0);
+
+	for (unsigned nIRQ = 0; nIRQ < IRQ_LINES; nIRQ++)
+	{
+		s_pThis->m_nIRQCount[nIRQ] = 0;
+
+#ifdef IRQ_STATISTICS
+		TIRQTiming *pTiming = &s_pThis->m_IRQTiming[nIRQ];
+		pTiming->nTotal = 0;
+		pTiming->nMin = (u32) -1;
+		pTiming->nMax = 0;
+		pTiming->nWindowStart = CTimer::GetClockTicks ();
+		pTiming->nWindowCount = 0;
+		pTiming->nStorms = 0;
+#endif
+	}
+
+#ifdef IRQ_STATISTICS
+	s_pThis->m_nFIQCount = 0;
+
+	s_pThis->m_FIQTiming.nTotal = 0;
+	s_pThis->m_FIQTiming.nMin = (u32) -1;
+	s_pThis->m_FIQTiming.nMax = 0;
+	s_pThis->m_FIQTiming.nWindowStart = 0;
+	s_pThis->m_FIQTiming.nWindowCount = 0;
+	s_pThis->m_FIQTiming.nStorms = 0;
+#endif
+
+	DataMemBarrier ();
+}
+
+void CInterruptSystem::DumpIRQStatistics (void)
+{
+	CLogger *pLogger = CLogger::Get ();
+	assert (pLogger != 0);
+
+	for (unsigned nIRQ = 0; nIRQ < IRQ_LINES; nIRQ++)
+	{
+#ifdef IRQ_STATISTICS
+		TIRQStatistics Statistics;
+		if (   GetIRQStatistics (nIRQ, &Statistics)
+		    && Statistics.nCount != 0)
+		{
+			pLogger->Write (FromInterrupt, LogNotice,
+					"IRQ %u: %u calls, total %llu us, min %u ns, max %u ns, "
+					"%u storms",
+					nIRQ, Statistics.nCount, Statistics.nTotalNanos / 1000,
+					Statistics.nMinNanos, Statistics.nMaxNanos, Statistics.nStorms);
+		}
+#else
+		unsigned nCount = GetIRQCount (nIRQ);
+		if (nCount != 0)
+		{
+			pLogger->Write (FromInterrupt, LogNotice, "IRQ %u: %u calls", nIRQ, nCount);
+		}
+#endif
+	}
+
+#ifdef IRQ_STATISTICS
+	TIRQStatistics Statistics;
+	if (   GetFIQStatistics (&Statistics)
+	    && Statistics.nCount != 0)
+	{
+		pLogger->Write (FromInterrupt, LogNotice,
+				"FIQ: %u calls, total %llu us, min %u ns, max %u ns",
+				Statistics.nCount, Statistics.nTotalNanos / 1000,
+				Statistics.nMinNanos, Statistics.nMaxNanos);
+	}
+#endif
+}
+
+#ifdef IRQ_STATISTICS
+
+// called in IRQ or FIQ context (nIRQ == IRQ_LINES for the FIQ)
+void CInterruptSystem::AccountIRQ (TIRQTiming *pTiming, u64 nDuration, unsigned nIRQ)
+{
+	assert (pTiming != 0);
+
+	// a private peripheral interrupt may be handled on several cores at the same time,
+	// min and max may be inaccurate then, which is not relevant for statistics
+	__atomic_fetch_add (&pTiming->nTotal, nDuration, __ATOMIC_RELAXED);
+
+	u32 nDuration32 = nDuration < (u32) -1 ? (u32) nDuration : (u32) -1;
+	if (nDuration32 < pTiming->nMin)
+	{
+		pTiming->nMin = nDuration32;
+	}
+
+	if (nDuration32 > pTiming->nMax)
+	{
+		pTiming->nMax = nDuration32;
+	}
+
+	// storm detection (not for the FIQ, the logger cannot be called from FIQ context)
+	if (nIRQ >= IRQ_LINES)
+	{
+		return;
+	}
+
+	unsigned nTicks = CTimer::GetClockTicks ();
+	if (nTicks - pTiming->nWindowStart >= CLOCKHZ)
+	{
+		pTiming->nWindowStart = nTicks;
+		pTiming->nWindowCount = 0;
+	}
+
+	if (++pTiming->nWindowCount == IRQ_STORM_THRESHOLD)
+	{
+		pTiming->nStorms++;
+
+		CLogger::Get ()->Write (FromInterrupt, LogWarning,
+					"IRQ storm on %u (more than %u per second)",
+					nIRQ, IRQ_STORM_THRESHOLD);
+	}
+}
+
+void CInterruptSystem::FIQStatisticsHandler (void *pParam)
+{
+	CInterruptSystem *pThis = (CInterruptSystem *) pParam;
+	assert (pThis != 0);
+
+	u64 nStart = GetTimestamp ();
+
+	assert (pThis->m_pFIQHandler != 0);
+	(*pThis->m_pFIQHandler) (pThis->m_pFIQParam);
+
+	pThis->m_nFIQCount++;
+	pThis->AccountIRQ (&pThis->m_FIQTiming, GetTimestamp () - nStart, IRQ_LINES);
+}
+
+boolean CInterruptSystem::GetStatistics (const TIRQTiming *pTiming, unsigned nCount,
+					 TIRQStatistics *pStatistics)
+{
+	assert (pTiming != 0);
+	assert (pStatistics != 0);
+
+#if RASPPI >= 2
+#if AARCH == 32
+	u32 nCNTFRQ;
+	asm volatile ("mrc p15, 0, %0, c14, c0, 0" : "=r" (nCNTFRQ));
+#else
+	u64 nCNTFRQ;
+	asm volatile ("mrs %0, CNTFRQ_EL0" : "=r" (nCNTFRQ));
+#endif
+	u64 nFrequency = nCNTFRQ;
+#else
+	u64 nFrequency = CLOCKHZ;
+#endif
+	assert (nFrequency != 0);
+
+	u64 nTotal = __atomic_load_n (&pTiming->nTotal, __ATOMIC_RELAXED);
+
+	pStatistics->nCount = nCount;
+	pStatistics->nTotalNanos =   nTotal / nFrequency * 1000000000
+				   + nTotal % nFrequency * 1000000000 / nFrequency;
+	pStatistics->nMinNanos =   nCount != 0
+				 ? (unsigned) (pTiming->nMin * 1000000000ULL / nFrequency) : 0;
+	pStatistics->nMaxNanos = (unsigned) (pTiming->nMax * 1000000000ULL / nFrequency);
+	pStatistics->nStorms = pTiming->nStorms;
+
+	return TRUE;
+}
+
+u64 CInterruptSystem::GetTimestamp (void)
+{
+#if RASPPI >= 2
+	InstructionSyncBarrier ();
+
+#if AARCH == 32
+	u32 nCNTPCTLow, nCNTPCTHigh;
+	asm volatile ("mrrc p15, 0, %0, %1, c14" : "=r" (nCNTPCTLow), "=r" (nCNTPCTHigh));
+
+	return (u64) nCNTPCTHigh << 32 | nCNTPCTLow;
+#else
+	u64 nCNTPCT;
+	asm volatile ("mrs %0, CNTPCT_EL0" : "=r" (nCNTPCT));
+
+	return nCNTPCT;
+#endif
+#else
+	return CTimer::GetClockTicks ();
+#endif
+}
+
+#endif
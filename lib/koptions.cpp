@@ -21,9 +21,12 @@
 #include <circle/logger.h>
 #include <circle/util.h>
 #include <circle/sysconfig.h>
+#include <assert.h>
 
 #define INVALID_VALUE	((unsigned) -1)
 
+#define NO_OPTION	((unsigned) -1)
+
 CKernelOptions *CKernelOptions::s_pThis = 0;
 
 CKernelOptions::CKernelOptions (void)
@@ -37,13 +40,25 @@ CKernelOptions::CKernelOptions (void)
 	m_CPUSpeed (CPUSpeedLow),
 	m_nSoCMaxTemp (60),
 	m_nGPIOFanPin (0),
-	m_bTouchScreenValid (FALSE)
+	m_bTouchScreenValid (FALSE),
+	m_nOptions (0),
+	m_nStringPoolUsed (0)
 {
 	strcpy (m_LogDevice, "tty1");
 	strcpy (m_KeyMap, DEFAULT_KEYMAP);
 	m_USBIgnore[0] = '\0';
 	m_SoundDevice[0] = '\0';
 
+	for (unsigned i = 0; i < KERNEL_OPTIONS_HASH_SIZE; i++)
+	{
+		m_HashTable[i] = NO_OPTION;
+	}
+
+	for (unsigned i = 0; i < KERNEL_OPTIONS_MAX_HANDLERS; i++)
+	{
+		m_Handler[i].pHandler = 0;
+	}
+
 	s_pThis = this;
 
 	CBcmPropertyTags Tags;
@@ -65,6 +80,10 @@ CKernelOptions::CKernelOptions (void)
 	{
 		char *pValue = GetOptionValue (pOption);
 
+		// the strings remain in m_TagCommandLine, further options are ignored,
+		// if the table is full (the logger is not available yet)
+		AddOption (pOption, pValue != 0 ? pValue : "");
+
 		if (strcmp (pOption, "width") == 0)
 		{
 			unsigned nValue;
@@ -104,7 +123,7 @@ CKernelOptions::CKernelOptions (void)
 		{
 			unsigned nValue;
 			if (   (nValue = GetDecimal (pValue)) != INVALID_VALUE
-			    && 200 <= nValue && nValue <= 8000)
+			    && 100 <= nValue && nValue <= 8000)
 			{
 				m_nUSBPowerDelay = nValue;
 			}
@@ -259,6 +278,310 @@ CKernelOptions *CKernelOptions::Get (void)
 	return s_pThis;
 }
 
+boolean CKernelOptions::IsOptionSet (const char *pOption) const
+{
+	return FindOption (pOption) != 0;
+}
+
+const char *CKernelOptions::GetStringOption (const char *pOption, const char *pDefault) const
+{
+	const TOption *pEntry = FindOption (pOption);
+	if (pEntry == 0)
+	{
+		return pDefault;
+	}
+
+	return pEntry->pValue;
+}
+
+unsigned CKernelOptions::GetUnsignedOption (const char *pOption, unsigned nDefault) const
+{
+	const TOption *pEntry = FindOption (pOption);
+	if (   pEntry == 0
+	    || !pEntry->bNumeric
+	    || pEntry->bNegative)
+	{
+		return nDefault;
+	}
+
+	return pEntry->nValue;
+}
+
+int CKernelOptions::GetIntOption (const char *pOption, int nDefault) const
+{
+	const TOption *pEntry = FindOption (pOption);
+	if (   pEntry == 0
+	    || !pEntry->bNumeric
+	    || pEntry->nValue > 0x80000000U
+	    || (   pEntry->nValue == 0x80000000U
+		&& !pEntry->bNegative))
+	{
+		return nDefault;
+	}
+
+	return pEntry->bNegative ? -(int) (pEntry->nValue - 1) - 1 : (int) pEntry->nValue;
+}
+
+boolean CKernelOptions::GetBooleanOption (const char *pOption, boolean bDefault) const
+{
+	const TOption *pEntry = FindOption (pOption);
+	if (pEntry == 0)
+	{
+		return bDefault;
+	}
+
+	const char *pValue = pEntry->pValue;
+	assert (pValue != 0);
+
+	if (   *pValue == '\0'
+	    || strcmp (pValue, "true") == 0
+	    || strcmp (pValue, "on") == 0
+	    || strcmp (pValue, "yes") == 0
+	    || strcmp (pValue, "1") == 0)
+	{
+		return TRUE;
+	}
+
+	if (   strcmp (pValue, "false") == 0
+	    || strcmp (pValue, "off") == 0
+	    || strcmp (pValue, "no") == 0
+	    || strcmp (pValue, "0") == 0)
+	{
+		return FALSE;
+	}
+
+	return bDefault;
+}
+
+boolean CKernelOptions::SetOption (const char *pOption, const char *pValue)
+{
+	assert (pOption != 0);
+	assert (*pOption != '\0');
+	assert (pValue != 0);
+
+	TOption *pEntry = (TOption *) FindOption (pOption);
+	if (pEntry == 0)
+	{
+		const char *pName = CopyString (pOption);
+		if (pName == 0)
+		{
+			return FALSE;
+		}
+
+		const char *pNewValue = CopyString (pValue);
+		if (pNewValue == 0)
+		{
+			return FALSE;
+		}
+
+		pEntry = AddOption (pName, pNewValue);
+		if (pEntry == 0)
+		{
+			return FALSE;
+		}
+	}
+	else if (strcmp (pEntry->pValue, pValue) != 0)
+	{
+		const char *pNewValue = CopyString (pValue);
+		if (pNewValue == 0)
+		{
+			return FALSE;
+		}
+
+		pEntry->pValue = pNewValue;
+		ParseValue (pEntry);
+	}
+	else
+	{
+		return TRUE;				// not changed
+	}
+
+	for (unsigned i = 0; i < KERNEL_OPTIONS_MAX_HANDLERS; i++)
+	{
+		const THandler *pHandler = &m_Handler[i];
+		if (   pHandler->pHandler != 0
+		    && (   pHandler->pOption == 0
+			|| strcmp (pHandler->pOption, pEntry->pName) == 0))
+		{
+			(*pHandler->pHandler) (pEntry->pName, pEntry->pValue, pHandler->pParam);
+		}
+	}
+
+	return TRUE;
+}
+
+boolean CKernelOptions::RegisterChangeHandler (const char *pOption, TChangeHandler *pHandler,
+					       void *pParam)
+{
+	assert (pHandler != 0);
+
+	for (unsigned i = 0; i < KERNEL_OPTIONS_MAX_HANDLERS; i++)
+	{
+		if (m_Handler[i].pHandler == 0)
+		{
+			m_Handler[i].pOption = pOption;
+			m_Handler[i].pParam = pParam;
+			m_Handler[i].pHandler = pHandler;
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+void CKernelOptions::UnregisterChangeHandler (TChangeHandler *pHandler)
+{
+	assert (pHandler != 0);
+
+	for (unsigned i = 0; i < KERNEL_OPTIONS_MAX_HANDLERS; i++)
+	{
+		if (m_Handler[i].pHandler == pHandler)
+		{
+			m_Handler[i].pHandler = 0;
+		}
+	}
+}
+
+const CKernelOptions::TOption *CKernelOptions::FindOption (const char *pOption) const
+{
+	assert (pOption != 0);
+	u32 nHash = Hash (pOption);
+
+	for (unsigned nIndex = m_HashTable[nHash & (KERNEL_OPTIONS_HASH_SIZE-1)];
+	     nIndex != NO_OPTION;
+	     nIndex = m_Option[nIndex].nNext)
+	{
+		const TOption *pEntry = &m_Option[nIndex];
+		if (   pEntry->nHash == nHash
+		    && strcmp (pEntry->pName, pOption) == 0)
+		{
+			return pEntry;
+		}
+	}
+
+	return 0;
+}
+
+// a later definition of an option overrides an earlier one
+CKernelOptions::TOption *CKernelOptions::AddOption (const char *pOption, const char *pValue)
+{
+	assert (pOption != 0);
+	assert (pValue != 0);
+
+	TOption *pEntry = (TOption *) FindOption (pOption);
+	if (pEntry == 0)
+	{
+		if (m_nOptions >= KERNEL_OPTIONS_MAX)
+		{
+			return 0;
+		}
+
+		unsigned nIndex = m_nOptions++;
+		pEntry = &m_Option[nIndex];
+
+		pEntry->pName = pOption;
+		pEntry->nHash = Hash (pOption);
+
+		unsigned *pHead = &m_HashTable[pEntry->nHash & (KERNEL_OPTIONS_HASH_SIZE-1)];
+		pEntry->nNext = *pHead;
+		*pHead = nIndex;
+	}
+
+	pEntry->pValue = pValue;
+	ParseValue (pEntry);
+
+	return pEntry;
+}
+
+void CKernelOptions::ParseValue (TOption *pOption)
+{
+	assert (pOption != 0);
+	const char *pValue = pOption->pValue;
+	assert (pValue != 0);
+
+	pOption->bNumeric = FALSE;
+
+	pOption->bNegative = *pValue == '-';
+	if (pOption->bNegative)
+	{
+		pValue++;
+	}
+
+	unsigned nBase = 10;
+	if (   pValue[0] == '0'
+	    && (pValue[1] == 'x' || pValue[1] == 'X'))
+	{
+		nBase = 16;
+		pValue += 2;
+	}
+
+	if (*pValue == '\0')
+	{
+		return;
+	}
+
+	u64 nValue = 0;
+
+	char chChar;
+	while ((chChar = *pValue++) != '\0')
+	{
+		unsigned nDigit;
+		if ('0' <= chChar && chChar <= '9')
+		{
+			nDigit = chChar - '0';
+		}
+		else if (nBase == 16 && 'a' <= (chChar | 0x20) && (chChar | 0x20) <= 'f')
+		{
+			nDigit = (chChar | 0x20) - 'a' + 10;
+		}
+		else
+		{
+			return;
+		}
+
+		nValue = nValue * nBase + nDigit;
+		if (nValue > 0xFFFFFFFFU)
+		{
+			return;
+		}
+	}
+
+	pOption->nValue = (unsigned) nValue;
+	pOption->bNumeric = TRUE;
+}
+
+const char *CKernelOptions::CopyString (const char *pString)
+{
+	assert (pString != 0);
+	size_t nLength = strlen (pString) + 1;
+
+	if (m_nStringPoolUsed + nLength > KERNEL_OPTIONS_POOL_SIZE)
+	{
+		return 0;
+	}
+
+	char *pCopy = &m_StringPool[m_nStringPoolUsed];
+	memcpy (pCopy, pString, nLength);
+	m_nStringPoolUsed += nLength;
+
+	return pCopy;
+}
+
+u32 CKernelOptions::Hash (const char *pString)
+{
+	assert (pString != 0);
+
+	u32 nHash = 2166136261U;			// FNV-1a
+	while (*pString != '\0')
+	{
+		nHash ^= (u8) *pString++;
+		nHash *= 16777619U;
+	}
+
+	return nHash;
+}
+
 char *CKernelOptions::GetToken (void)
 {
 	while (*m_pOptions != '\0')
@@ -2,7 +2,7 @@
 // latencytester.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -45,11 +45,7 @@ void CLatencyTester::Start (unsigned nSampleRateHZ)
 
 	m_nWantedDelay = (1000000 + nSampleRateHZ/2) / nSampleRateHZ;
 
-	m_nMinDelay = (unsigned) -1;
-	m_nMaxDelay = 0;
-	m_nDelayAccu = 0;
-	m_nSamples = 0;
-	m_bOverflow = FALSE;
+	m_Histogram.Reset ();
 
 	m_bRunning = TRUE;
 
@@ -73,37 +69,32 @@ void CLatencyTester::Stop (void)
 
 unsigned CLatencyTester::GetMin (void) const
 {
-	return m_nMinDelay;
+	return m_Histogram.GetCount () > 0 ? m_Histogram.GetMin () : (unsigned) -1;
 }
 
 unsigned CLatencyTester::GetMax (void) const
 {
-	return m_nMaxDelay;
+	return m_Histogram.GetMax ();
 }
 
 unsigned CLatencyTester::GetAvg (void)
 {
-	m_SpinLock.Acquire ();
-
-	if (m_bOverflow)
-	{
-		m_SpinLock.Release ();
-
-		return (unsigned) -1;
-	}
-
-	unsigned nDelayAccu = m_nDelayAccu;
-	unsigned nSamples = m_nSamples;
+	return m_Histogram.GetAvg ();
+}
 
-	m_SpinLock.Release ();
+unsigned CLatencyTester::GetPercentile (unsigned nPerMille) const
+{
+	return m_Histogram.GetPercentile (nPerMille);
+}
 
-	return nSamples > 0 ? nDelayAccu / nSamples : 0;
+const CHistogram<> *CLatencyTester::GetHistogram (void) const
+{
+	return &m_Histogram;
 }
 
 void CLatencyTester::Dump (void)
 {
-	CLogger::Get ()->Write ("latency", LogNotice, "IRQ latency: Min %u Max %u Avg %u (us)",
-				GetMin (), GetMax (), GetAvg ());
+	m_Histogram.Dump ("latency", "IRQ latency");
 }
 
 void CLatencyTester::InterruptHandler (void)
@@ -118,33 +109,7 @@ void CLatencyTester::InterruptHandler (void)
 	//debug_click ();
 #endif
 
-	m_SpinLock.Acquire ();
-
-	if (nDelay < m_nMinDelay)
-	{
-		m_nMinDelay = nDelay;
-	}
-
-	if (nDelay > m_nMaxDelay)
-	{
-		m_nMaxDelay = nDelay;
-	}
-
-	if (!m_bOverflow)
-	{
-		if (   m_nDelayAccu + nDelay >= m_nDelayAccu
-		    && m_nSamples + 1 != 0)
-		{
-			m_nDelayAccu += nDelay;
-			m_nSamples++;
-		}
-		else
-		{
-			m_bOverflow = TRUE;
-		}
-	}
-
-	m_SpinLock.Release ();
+	m_Histogram.Add (nDelay);
 
 	write32 (ARM_SYSTIMER_C1, read32 (ARM_SYSTIMER_CLO) + m_nWantedDelay);
 	write32 (ARM_SYSTIMER_CS, 1 << 1);
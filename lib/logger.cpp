@@ -2,7 +2,7 @@
 // logger.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,6 +18,8 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/logger.h>
+#include <circle/boottrace.h>
+#include <circle/lockfreering.h>
 #include <circle/string.h>
 #include <circle/synchronize.h>
 #include <circle/startup.h>
@@ -27,6 +29,7 @@
 #include <circle/machineinfo.h>
 #include <circle/version.h>
 #include <circle/debug.h>
+#include <assert.h>
 
 struct TLogEvent
 {
@@ -38,6 +41,28 @@ struct TLogEvent
 	int		nTimeZone;			// minutes diff to UTC
 };
 
+enum TLogArgType
+{
+	LogArgNone,			// conversion without argument
+	LogArgInt,
+	LogArgLong,
+	LogArgLongLong,
+	LogArgDouble,
+	LogArgString			// offset into TLogRecord::Strings
+};
+
+struct TLogRecord
+{
+	TLogSeverity	Severity;
+	unsigned	nTicks;				// CTimer::GetClockTicks() at Write()
+	const char	*pFormat;			// 0 for message in Strings
+	unsigned	nArgs;
+	u8		ArgType[LOG_DEFERRED_MAX_ARGS];
+	u64		Arg[LOG_DEFERRED_MAX_ARGS];
+	char		Source[LOG_DEFERRED_SOURCE];
+	char		Strings[LOG_DEFERRED_STRINGS];
+};
+
 CLogger *CLogger::s_pThis = 0;
 
 CLogger::CLogger (unsigned nLogLevel, CTimer *pTimer, boolean bOverwriteOldest)
@@ -50,11 +75,20 @@ CLogger::CLogger (unsigned nLogLevel, CTimer *pTimer, boolean bOverwriteOldest)
 	m_nOutPtr (0),
 	m_nEventInPtr (0),
 	m_nEventOutPtr (0),
+	m_nEventsDropped (0),
 	m_pEventNotificationHandler (0),
-	m_pPanicHandler (0)
+	m_pPanicHandler (0),
+	m_bDeferred (FALSE),
+	m_bFlushing (FALSE),
+	m_nDeferredDropped (0)
 {
 	m_pBuffer = new char[LOGGER_BUFSIZE];
 
+	for (unsigned i = 0; i < CORES; i++)
+	{
+		m_pDeferredRing[i] = 0;
+	}
+
 	s_pThis = this;
 }
 
@@ -62,6 +96,14 @@ CLogger::~CLogger (void)
 {
 	s_pThis = 0;
 
+	m_bDeferred = FALSE;
+
+	for (unsigned i = 0; i < CORES; i++)
+	{
+		delete m_pDeferredRing[i];
+		m_pDeferredRing[i] = 0;
+	}
+
 	while (m_nEventInPtr != m_nEventOutPtr)
 	{
 		delete m_pEventQueue[m_nEventOutPtr];
@@ -89,6 +131,8 @@ boolean CLogger::Initialize (CDevice *pTarget)
 #endif
 	       , CIRCLE_VERSION_STRING, CMachineInfo::Get ()->GetMachineName ());
 
+	CBootTrace::Mark ("logger");
+
 	return TRUE;
 }
 
@@ -109,17 +153,61 @@ void CLogger::Write (const char *pSource, TLogSeverity Severity, const char *pMe
 
 void CLogger::WriteV (const char *pSource, TLogSeverity Severity, const char *pMessage, va_list Args)
 {
+	if (Severity != LogPanic)
+	{
+		va_list ArgsCopy;
+		va_copy (ArgsCopy, Args);
+
+		boolean bDeferred = WriteDeferred (pSource, Severity, pMessage, &ArgsCopy);
+
+		va_end (ArgsCopy);
+
+		if (bDeferred)
+		{
+			return;
+		}
+	}
+	else if (m_bDeferred)
+	{
+		FlushDeferred ();
+	}
+
 	CString Message;
 	Message.FormatV (pMessage, Args);
 
 	WriteEvent (pSource, Severity, Message);
 
+	WriteMessage (pSource, Severity, Message);
+
+	if (Severity == LogPanic)
+	{
+		if (m_pPanicHandler != 0)
+		{
+			(*m_pPanicHandler) ();
+		}
+
+#ifndef USE_RPI_STUB_AT
+		set_qemu_exit_status (EXIT_STATUS_PANIC);
+#ifndef ARM_ALLOW_MULTI_CORE
+		halt ();
+#else
+		CMultiCoreSupport::HaltAll ();
+#endif
+#else
+		Breakpoint (0);
+#endif
+	}
+}
+
+void CLogger::WriteMessage (const char *pSource, TLogSeverity Severity, const char *pMessage)
+{
 	if (Severity > m_nLogLevel)
 	{
 		return;
 	}
 
 	CString Buffer;
+	Buffer.Reserve (strlen (pSource) + strlen (pMessage) + 40);	// with time and escapes
 
 	if (Severity == LogPanic)
 	{
@@ -141,7 +229,7 @@ void CLogger::WriteV (const char *pSource, TLogSeverity Severity, const char *pM
 	Buffer.Append (pSource);
 	Buffer.Append (": ");
 
-	Buffer.Append (Message);
+	Buffer.Append (pMessage);
 
 	if (Severity == LogPanic)
 	{
@@ -151,29 +239,16 @@ void CLogger::WriteV (const char *pSource, TLogSeverity Severity, const char *pM
 	Buffer.Append ("\n");
 
 	Write (Buffer);
-
-	if (Severity == LogPanic)
-	{
-		if (m_pPanicHandler != 0)
-		{
-			(*m_pPanicHandler) ();
-		}
-
-#ifndef USE_RPI_STUB_AT
-		set_qemu_exit_status (EXIT_STATUS_PANIC);
-#ifndef ARM_ALLOW_MULTI_CORE
-		halt ();
-#else
-		CMultiCoreSupport::HaltAll ();
-#endif
-#else
-		Breakpoint (0);
-#endif
-	}
 }
 
 void CLogger::WriteNoAlloc (const char *pSource, TLogSeverity Severity, const char *pMessage)
 {
+	if (   Severity != LogPanic
+	    && WriteDeferred (pSource, Severity, pMessage, 0))
+	{
+		return;
+	}
+
 	if (Severity > m_nLogLevel)
 	{
 		return;
@@ -217,6 +292,338 @@ void CLogger::WriteNoAlloc (const char *pSource, TLogSeverity Severity, const ch
 	}
 }
 
+boolean CLogger::EnableDeferredMode (unsigned nRingSize)
+{
+	if (m_bDeferred)
+	{
+		return TRUE;
+	}
+
+	for (unsigned i = 0; i < CORES; i++)
+	{
+		assert (m_pDeferredRing[i] == 0);
+		m_pDeferredRing[i] = new CMPSCRing<TLogRecord> (nRingSize);
+		if (m_pDeferredRing[i] == 0)
+		{
+			return FALSE;
+		}
+
+#ifndef ARM_ALLOW_MULTI_CORE
+		break;
+#endif
+	}
+
+	DataMemBarrier ();
+
+	m_bDeferred = TRUE;
+
+	return TRUE;
+}
+
+boolean CLogger::WriteDeferred (const char *pSource, TLogSeverity Severity, const char *pMessage,
+				va_list *pArgs)
+{
+	if (!m_bDeferred)
+	{
+		return FALSE;
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	CMPSCRing<TLogRecord> *pRing = m_pDeferredRing[CMultiCoreSupport::ThisCore ()];
+#else
+	CMPSCRing<TLogRecord> *pRing = m_pDeferredRing[0];
+#endif
+	assert (pRing != 0);
+
+	TLogRecord *pRecord = pRing->BeginWrite ();
+	if (pRecord == 0)
+	{
+		__atomic_add_fetch (&m_nDeferredDropped, 1, __ATOMIC_RELAXED);
+
+		return TRUE;
+	}
+
+	pRecord->Severity = Severity;
+	pRecord->nTicks = CTimer::GetClockTicks ();
+
+	assert (pSource != 0);
+	strncpy (pRecord->Source, pSource, LOG_DEFERRED_SOURCE);
+	pRecord->Source[LOG_DEFERRED_SOURCE-1] = '\0';
+
+	assert (pMessage != 0);
+	if (pArgs == 0)
+	{
+		// message without format
+		pRecord->pFormat = 0;
+		pRecord->nArgs = 0;
+
+		strncpy (pRecord->Strings, pMessage, LOG_DEFERRED_STRINGS);
+		pRecord->Strings[LOG_DEFERRED_STRINGS-1] = '\0';
+
+		pRing->EndWrite (pRecord);
+
+		return TRUE;
+	}
+
+	// capture the arguments, following the rules of CString::FormatV()
+	pRecord->pFormat = pMessage;
+
+	unsigned nArgs = 0;
+	unsigned nStrings = 0;
+	for (const char *p = pMessage; *p != '\0' && nArgs < LOG_DEFERRED_MAX_ARGS; p++)
+	{
+		if (   *p != '%'
+		    || *++p == '%')
+		{
+			continue;
+		}
+
+		while (*p == '#' || *p == '-' || *p == '0')
+		{
+			p++;
+		}
+
+		while (('0' <= *p && *p <= '9') || *p == '.')
+		{
+			p++;
+		}
+
+		TLogArgType Type = LogArgInt;
+		if (*p == 'l')
+		{
+			if (*++p == 'l')
+			{
+				Type = LogArgLongLong;
+
+				p++;
+			}
+			else
+			{
+				Type = LogArgLong;
+			}
+		}
+
+		switch (*p)
+		{
+		case 'c':
+		case 'd':
+		case 'i':
+		case 'o':
+		case 'p':
+		case 'u':
+		case 'x':
+		case 'X':
+			switch (Type)
+			{
+			case LogArgLongLong:
+				pRecord->Arg[nArgs] = va_arg (*pArgs, unsigned long long);
+				break;
+
+			case LogArgLong:
+				pRecord->Arg[nArgs] = va_arg (*pArgs, unsigned long);
+				break;
+
+			default:
+				pRecord->Arg[nArgs] = va_arg (*pArgs, unsigned);
+				break;
+			}
+			break;
+
+		case 'f': {
+			Type = LogArgDouble;
+			double fArg = va_arg (*pArgs, double);
+			memcpy (&pRecord->Arg[nArgs], &fArg, sizeof fArg);
+			} break;
+
+		case 's': {
+			Type = LogArgString;
+			const char *pArg = va_arg (*pArgs, const char *);
+			assert (pArg != 0);
+
+			// the string may be temporary, copy it (truncated, if there is no space)
+			pRecord->Arg[nArgs] = nStrings;
+			while (   *pArg != '\0'
+			       && nStrings < LOG_DEFERRED_STRINGS-1)
+			{
+				pRecord->Strings[nStrings++] = *pArg++;
+			}
+			pRecord->Strings[nStrings] = '\0';
+			if (nStrings < LOG_DEFERRED_STRINGS-1)
+			{
+				nStrings++;
+			}
+			} break;
+
+		case '\0':
+			p--;
+			Type = LogArgNone;
+			break;
+
+		default:
+			Type = LogArgNone;
+			break;
+		}
+
+		pRecord->ArgType[nArgs++] = Type;
+	}
+
+	pRecord->nArgs = nArgs;
+
+	pRing->EndWrite (pRecord);
+
+	return TRUE;
+}
+
+unsigned CLogger::FlushDeferred (void)
+{
+	if (   !m_bDeferred
+	    || __atomic_exchange_n (&m_bFlushing, TRUE, __ATOMIC_ACQUIRE))
+	{
+		return 0;			// another caller is flushing
+	}
+
+	unsigned nMessages = 0;
+	while (1)
+	{
+		// take the oldest record of all cores
+		CMPSCRing<TLogRecord> *pRing = 0;
+		TLogRecord *pRecord = 0;
+		for (unsigned i = 0; i < CORES; i++)
+		{
+			if (m_pDeferredRing[i] == 0)
+			{
+				continue;
+			}
+
+			TLogRecord *p = m_pDeferredRing[i]->BeginRead ();
+			if (   p != 0
+			    && (   pRecord == 0
+				|| (int) (p->nTicks - pRecord->nTicks) < 0))
+			{
+				pRing = m_pDeferredRing[i];
+				pRecord = p;
+			}
+		}
+
+		if (pRecord == 0)
+		{
+			break;
+		}
+
+		CString Message;
+		FormatRecord (pRecord, &Message);
+
+		WriteEvent (pRecord->Source, pRecord->Severity, Message);
+		WriteMessage (pRecord->Source, pRecord->Severity, Message);
+
+		assert (pRing != 0);
+		pRing->EndRead ();
+
+		nMessages++;
+	}
+
+	unsigned nDropped = __atomic_exchange_n (&m_nDeferredDropped, 0, __ATOMIC_RELAXED);
+	if (nDropped > 0)
+	{
+		CString Message;
+		Message.Format ("%u message(s) dropped", nDropped);
+
+		WriteEvent ("logger", LogWarning, Message);
+		WriteMessage ("logger", LogWarning, Message);
+	}
+
+	__atomic_store_n (&m_bFlushing, FALSE, __ATOMIC_RELEASE);
+
+	return nMessages;
+}
+
+void CLogger::FormatRecord (const TLogRecord *pRecord, CString *pResult)
+{
+	assert (pRecord != 0);
+	assert (pResult != 0);
+
+	if (pRecord->pFormat == 0)
+	{
+		*pResult = pRecord->Strings;
+
+		return;
+	}
+
+	char Buffer[LOG_MAX_MESSAGE];
+	unsigned nLength = 0;
+
+	unsigned nArg = 0;
+	for (const char *p = pRecord->pFormat; *p != '\0' && nLength < sizeof Buffer-1; p++)
+	{
+		if (   *p != '%'
+		    || nArg >= pRecord->nArgs)
+		{
+			Buffer[nLength++] = *p;
+
+			continue;
+		}
+
+		if (p[1] == '%')
+		{
+			Buffer[nLength++] = '%';
+			p++;
+
+			continue;
+		}
+
+		// isolate the conversion specification
+		char Spec[16];
+		unsigned nSpecLength = 0;
+		do
+		{
+			Spec[nSpecLength++] = *p++;
+		}
+		while (   *p != '\0'
+		       && nSpecLength < sizeof Spec-2
+		       && (   *p == '#' || *p == '-' || *p == '.' || *p == 'l'
+			   || ('0' <= *p && *p <= '9')));
+
+		if (*p == '\0')
+		{
+			break;
+		}
+
+		Spec[nSpecLength++] = *p;
+		Spec[nSpecLength] = '\0';
+
+		CString Arg;
+		u64 nValue = pRecord->Arg[nArg];
+		switch (pRecord->ArgType[nArg++])
+		{
+		case LogArgInt:		Arg.Format (Spec, (unsigned) nValue);		break;
+		case LogArgLong:	Arg.Format (Spec, (unsigned long) nValue);	break;
+		case LogArgLongLong:	Arg.Format (Spec, (unsigned long long) nValue);	break;
+		case LogArgString:	Arg.Format (Spec, pRecord->Strings + nValue);	break;
+
+		case LogArgDouble: {
+			double fValue;
+			memcpy (&fValue, &nValue, sizeof fValue);
+			Arg.Format (Spec, fValue);
+			} break;
+
+		default:
+			Arg.Format (Spec);
+			break;
+		}
+
+		const char *pArg = Arg;
+		while (   *pArg != '\0'
+		       && nLength < sizeof Buffer-1)
+		{
+			Buffer[nLength++] = *pArg++;
+		}
+	}
+
+	Buffer[nLength] = '\0';
+
+	*pResult = Buffer;
+}
+
 CLogger *CLogger::Get (void)
 {
 	if (s_pThis == 0)
@@ -352,6 +759,7 @@ void CLogger::WriteEvent (const char *pSource, TLogSeverity Severity, const char
 	if (m_nEventInPtr == m_nEventOutPtr)
 	{
 		pDropEvent = m_pEventQueue[m_nEventOutPtr];
+		m_nEventsDropped++;
 
 		if (++m_nEventOutPtr == LOG_QUEUE_SIZE)
 		{
@@ -405,6 +813,18 @@ boolean CLogger::ReadEvent (TLogSeverity *pSeverity, char *pSource, char *pMessa
 	return TRUE;
 }
 
+unsigned CLogger::GetDroppedEvents (void)
+{
+	m_EventSpinLock.Acquire ();
+
+	unsigned nResult = m_nEventsDropped;
+	m_nEventsDropped = 0;
+
+	m_EventSpinLock.Release ();
+
+	return nResult;
+}
+
 void CLogger::RegisterEventNotificationHandler (TLogEventNotificationHandler *pHandler)
 {
 	m_pEventNotificationHandler = pHandler;
@@ -0,0 +1,272 @@
+//
+// lz4decoder.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/lz4decoder.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define LZ4_FRAME_MAGIC		0x184D2204
+
+#define LZ4_FLG_VERSION_MASK	(3 << 6)
+	#define LZ4_FLG_VERSION_01	(1 << 6)
+#define LZ4_FLG_BLOCK_INDEP	(1 << 5)
+#define LZ4_FLG_BLOCK_CHECKSUM	(1 << 4)
+#define LZ4_FLG_CONTENT_SIZE	(1 << 3)
+#define LZ4_FLG_CONTENT_CHECKSUM (1 << 2)
+#define LZ4_FLG_DICT_ID		(1 << 0)
+
+#define LZ4_BLOCK_UNCOMPRESSED	0x80000000U
+
+#define LZ4_MIN_MATCH		4
+
+static inline u32 GetLE32 (const u8 *p)
+{
+	return p[0] | (u32) p[1] << 8 | (u32) p[2] << 16 | (u32) p[3] << 24;
+}
+
+boolean CLZ4Decoder::IsCompressed (const void *pBuffer, size_t nLength)
+{
+	assert (pBuffer != 0);
+
+	return    nLength >= 4
+	       && GetLE32 ((const u8 *) pBuffer) == LZ4_FRAME_MAGIC;
+}
+
+size_t CLZ4Decoder::GetContentSize (const void *pBuffer, size_t nLength)
+{
+	const u8 *p = (const u8 *) pBuffer;
+	if (   GetHeaderLength (p, nLength) == 0
+	    || !(p[4] & LZ4_FLG_CONTENT_SIZE))
+	{
+		return 0;
+	}
+
+	// sizes above 4 GB are not supported
+	if (GetLE32 (p + 10) != 0)
+	{
+		return 0;
+	}
+
+	return GetLE32 (p + 6);
+}
+
+size_t CLZ4Decoder::Decompress (const void *pSource, size_t nSourceLength,
+				void *pDest, size_t nDestSize)
+{
+	const u8 *pSrc = (const u8 *) pSource;
+	const u8 *pSrcEnd = pSrc + nSourceLength;
+	u8 *pDst = (u8 *) pDest;
+	assert (pDst != 0);
+
+	size_t nHeaderLength = GetHeaderLength (pSrc, nSourceLength);
+	if (nHeaderLength == 0)
+	{
+		return 0;
+	}
+
+	u8 uchFlags = pSrc[4];
+	pSrc += nHeaderLength;
+
+	size_t nResult = 0;
+	while (1)
+	{
+		if (pSrcEnd - pSrc < 4)
+		{
+			return 0;
+		}
+
+		u32 nBlockSize = GetLE32 (pSrc);
+		pSrc += 4;
+
+		if (nBlockSize == 0)		// end mark, a content checksum may follow
+		{
+			break;
+		}
+
+		boolean bUncompressed = !!(nBlockSize & LZ4_BLOCK_UNCOMPRESSED);
+		nBlockSize &= ~LZ4_BLOCK_UNCOMPRESSED;
+
+		if ((size_t) (pSrcEnd - pSrc) < nBlockSize)
+		{
+			return 0;
+		}
+
+		size_t nLength;
+		if (bUncompressed)
+		{
+			if (nBlockSize > nDestSize - nResult)
+			{
+				return 0;
+			}
+
+			memcpy (pDst + nResult, pSrc, nBlockSize);
+			nLength = nBlockSize;
+		}
+		else
+		{
+			nLength = DecompressBlock (pSrc, nBlockSize, pDst + nResult,
+						   nDestSize - nResult);
+			if (nLength == 0)
+			{
+				return 0;
+			}
+		}
+
+		nResult += nLength;
+		pSrc += nBlockSize;
+
+		if (uchFlags & LZ4_FLG_BLOCK_CHECKSUM)
+		{
+			pSrc += 4;
+		}
+	}
+
+	return nResult;
+}
+
+// Returns the length of the frame header, or 0 if the frame is invalid or not supported.
+
+size_t CLZ4Decoder::GetHeaderLength (const u8 *pBuffer, size_t nLength)
+{
+	assert (pBuffer != 0);
+
+	if (   nLength < 7
+	    || GetLE32 (pBuffer) != LZ4_FRAME_MAGIC)
+	{
+		return 0;
+	}
+
+	u8 uchFlags = pBuffer[4];
+	if (   (uchFlags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION_01
+	    || !(uchFlags & LZ4_FLG_BLOCK_INDEP)
+	    || (uchFlags & LZ4_FLG_DICT_ID))
+	{
+		return 0;
+	}
+
+	size_t nHeaderLength = 4 + 2 + 1;	// magic, FLG, BD, HC
+	if (uchFlags & LZ4_FLG_CONTENT_SIZE)
+	{
+		nHeaderLength += 8;
+	}
+
+	return nLength >= nHeaderLength ? nHeaderLength : 0;
+}
+
+// Decodes the sequences of one block. Each sequence consists of a token, the literals and
+// a match (offset and length), the last sequence has literals only.
+
+size_t CLZ4Decoder::DecompressBlock (const u8 *pSource, size_t nSourceLength,
+				     u8 *pDest, size_t nDestSize)
+{
+	const u8 *pSrc = pSource;
+	const u8 *pSrcEnd = pSource + nSourceLength;
+	u8 *pDst = pDest;
+	u8 *pDstEnd = pDest + nDestSize;
+
+	while (pSrc < pSrcEnd)
+	{
+		unsigned nToken = *pSrc++;
+
+		size_t nLiterals = nToken >> 4;
+		if (nLiterals == 15)
+		{
+			unsigned nByte;
+			do
+			{
+				if (pSrc >= pSrcEnd)
+				{
+					return 0;
+				}
+
+				nByte = *pSrc++;
+				nLiterals += nByte;
+			}
+			while (nByte == 255);
+		}
+
+		if (   (size_t) (pSrcEnd - pSrc) < nLiterals
+		    || (size_t) (pDstEnd - pDst) < nLiterals)
+		{
+			return 0;
+		}
+
+		memcpy (pDst, pSrc, nLiterals);
+		pDst += nLiterals;
+		pSrc += nLiterals;
+
+		if (pSrc == pSrcEnd)		// last sequence
+		{
+			break;
+		}
+
+		if (pSrcEnd - pSrc < 2)
+		{
+			return 0;
+		}
+
+		size_t nOffset = pSrc[0] | pSrc[1] << 8;
+		pSrc += 2;
+
+		if (   nOffset == 0
+		    || nOffset > (size_t) (pDst - pDest))
+		{
+			return 0;
+		}
+
+		size_t nMatch = (nToken & 0x0F) + LZ4_MIN_MATCH;
+		if (nMatch == 15 + LZ4_MIN_MATCH)
+		{
+			unsigned nByte;
+			do
+			{
+				if (pSrc >= pSrcEnd)
+				{
+					return 0;
+				}
+
+				nByte = *pSrc++;
+				nMatch += nByte;
+			}
+			while (nByte == 255);
+		}
+
+		if ((size_t) (pDstEnd - pDst) < nMatch)
+		{
+			return 0;
+		}
+
+		const u8 *pMatch = pDst - nOffset;
+		if (nOffset >= nMatch)
+		{
+			memcpy (pDst, pMatch, nMatch);	// no overlap, use the fast copy
+			pDst += nMatch;
+		}
+		else
+		{
+			// overlapping match repeats the last nOffset bytes
+			while (nMatch--)
+			{
+				*pDst++ = *pMatch++;
+			}
+		}
+	}
+
+	return pDst - pDest;
+}
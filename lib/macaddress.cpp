@@ -2,7 +2,7 @@
 // macaddress.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -60,6 +60,21 @@ void CMACAddress::SetBroadcast (void)
 	m_bValid = TRUE;
 }
 
+void CMACAddress::SetMulticast (const u8 *pIPAddress)
+{
+	assert (pIPAddress != 0);
+
+	// 01:00:5E followed by the lower 23 bits of the group address (RFC 1112)
+	m_Address[0] = 0x01;
+	m_Address[1] = 0x00;
+	m_Address[2] = 0x5E;
+	m_Address[3] = pIPAddress[1] & 0x7F;
+	m_Address[4] = pIPAddress[2];
+	m_Address[5] = pIPAddress[3];
+
+	m_bValid = TRUE;
+}
+
 const u8 *CMACAddress::Get (void) const
 {
 	assert (m_bValid);
@@ -88,6 +103,13 @@ boolean CMACAddress::IsBroadcast (void) const
 	return TRUE;
 }
 
+boolean CMACAddress::IsMulticast (void) const
+{
+	assert (m_bValid);
+
+	return (m_Address[0] & 0x01) && !IsBroadcast ();
+}
+
 unsigned CMACAddress::GetSize (void) const
 {
 	return MAC_ADDRESS_SIZE;
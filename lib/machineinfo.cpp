@@ -2,7 +2,7 @@
 // machineinfo.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -165,15 +165,21 @@ CMachineInfo::CMachineInfo (void)
 	}
 	s_pThis = this;
 
+	// both tags are requested with one mailbox call
 	CBcmPropertyTags Tags (TRUE);
 	TPropertyTagSimple DMAChannels;
-	if (Tags.GetTag (PROPTAG_GET_DMA_CHANNELS, &DMAChannels, sizeof DMAChannels))
+	TPropertyTagSimple BoardRevision;
+	Tags.BeginBatch ();
+	Tags.AddTag (PROPTAG_GET_DMA_CHANNELS, &DMAChannels, sizeof DMAChannels);
+	Tags.AddTag (PROPTAG_GET_BOARD_REVISION, &BoardRevision, sizeof BoardRevision);
+	Tags.SubmitBatch ();
+
+	if (DMAChannels.Tag.nValueLength != 0)
 	{
 		m_usDMAChannelMap = (u16) DMAChannels.nValue;
 	}
 
-	TPropertyTagSimple BoardRevision;
-	if (!Tags.GetTag (PROPTAG_GET_BOARD_REVISION, &BoardRevision, sizeof BoardRevision))
+	if (BoardRevision.Tag.nValueLength == 0)
 	{
 		return;
 	}
@@ -36,6 +36,7 @@ CMemorySystem::CMemorySystem (boolean bEnableMMU)
 #if RASPPI >= 4
 	m_HeapHigh ("heaphigh"),
 #endif
+	m_HeapUncached ("heapuncached"),
 	m_pTranslationTable (0)
 {
 	if (s_pThis != 0)	// ignore second instance
@@ -58,6 +59,8 @@ CMemorySystem::CMemorySystem (boolean bEnableMMU)
 	size_t nBlockReserve = m_nMemSize - MEM_HEAP_START - PAGE_RESERVE;
 	m_HeapLow.Setup (MEM_HEAP_START, nBlockReserve, 0x40000);
 
+	m_HeapUncached.Setup (MEM_UNCACHED_REGION, UNCACHED_REGION_SIZE, 0);
+
 #if RASPPI >= 4
 	unsigned nRAMSize = CMachineInfo::Get ()->GetRAMSize ();
 	if (nRAMSize > 1024)
@@ -152,7 +155,8 @@ void CMemorySystem::EnableMMU (void)
 
 	u64 nMAIR_EL1 =   0xFF << ATTRINDX_NORMAL*8	// inner/outer write-back non-transient, allocating
 	                | 0x04 << ATTRINDX_DEVICE*8	// Device-nGnRE
-	                | 0x00 << ATTRINDX_COHERENT*8;	// Device-nGnRnE
+	                | 0x00 << ATTRINDX_COHERENT*8	// Device-nGnRnE
+	                | 0x44 << ATTRINDX_UNCACHED*8;	// normal, inner/outer non-cacheable
 	asm volatile ("msr mair_el1, %0" : : "r" (nMAIR_EL1));
 
 	assert (m_pTranslationTable != 0);
@@ -22,6 +22,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/multicore.h>
+#include <circle/corechannel.h>
 
 #ifdef ARM_ALLOW_MULTI_CORE
 
@@ -137,6 +138,10 @@ void CMultiCoreSupport::IPIHandler (unsigned nCore, unsigned nIPI)
 
 		halt ();
 	}
+	else if (nIPI == IPI_CORE_CHANNEL)
+	{
+		CCoreChannelBase::IPIHandler (nCore);
+	}
 }
 
 void CMultiCoreSupport::SendIPI (unsigned nCore, unsigned nIPI)
@@ -2,7 +2,7 @@
 // arphandler.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,6 +19,7 @@
 //
 #include <circle/net/arphandler.h>
 #include <circle/net/linklayer.h>
+#include <circle/net/netstatistics.h>
 #include <circle/util.h>
 #include <circle/macros.h>
 #include <assert.h>
@@ -29,6 +30,12 @@
 
 #define ARP_LIFETIME_HZ		(600 * HZ)
 
+#define ARP_NO_ENTRY		((unsigned) -1)
+
+#if ARP_MAX_ENTRIES < 4 || (ARP_MAX_ENTRIES & (ARP_MAX_ENTRIES-1)) != 0
+	#error ARP_MAX_ENTRIES must be a power of 2
+#endif
+
 struct TARPPacket
 {
 	u16		nHWAddressSpace;
@@ -55,28 +62,60 @@ struct TARPFrame
 PACKED;
 
 CARPHandler::CARPHandler (CNetConfig *pNetConfig, CNetDeviceLayer *pNetDevLayer,
-			  CLinkLayer *pLinkLayer, CNetQueue *pRxQueue)
+			  CLinkLayer *pLinkLayer, CNetFrameQueue *pRxQueue)
 :	m_pNetConfig (pNetConfig),
 	m_pNetDevLayer (pNetDevLayer),
 	m_pLinkLayer (pLinkLayer),
 	m_pRxQueue (pRxQueue),
-	m_nEntries (0),
+	m_pEntry (new TARPEntry[ARP_MAX_ENTRIES]),
+	m_nFreeList (0),
+	m_nLRUFirst (ARP_NO_ENTRY),
+	m_nLRULast (ARP_NO_ENTRY),
+	m_ActionRing (ARP_MAX_ENTRIES),
 	m_nTicksLastCleanup (0)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pNetDevLayer != 0);
 	assert (m_pLinkLayer != 0);
 	assert (m_pRxQueue != 0);
+	assert (m_pEntry != 0);
+
+	for (unsigned nEntry = 0; nEntry < ARP_MAX_ENTRIES; nEntry++)
+	{
+		m_pEntry[nEntry].State = ARPStateFreeSlot;
+		m_pEntry[nEntry].nHashNext = nEntry+1 < ARP_MAX_ENTRIES ? nEntry+1 : ARP_NO_ENTRY;
+		m_pEntry[nEntry].bReferenced = FALSE;
+		m_pEntry[nEntry].bActionQueued = FALSE;
+		m_pEntry[nEntry].nTxFrames = 0;
+		m_pEntry[nEntry].Timer.SetHandler (TimerHandler, (void *) (uintptr) nEntry, this);
+	}
+
+	for (unsigned i = 0; i < ARP_HASH_SIZE; i++)
+	{
+		m_HashTable[i] = ARP_NO_ENTRY;
+	}
 }
 
 CARPHandler::~CARPHandler (void)
 {
-	for (unsigned nEntry = 0; nEntry < m_nEntries; nEntry++)
+	for (unsigned nEntry = 0; nEntry < ARP_MAX_ENTRIES; nEntry++)
 	{
-		delete m_Entry[nEntry].pTxQueue;
-		m_Entry[nEntry].pTxQueue = 0;
+		TARPEntry *pEntry = &m_pEntry[nEntry];
+		if (   pEntry->State == ARPStateRequestSent
+		    || pEntry->State == ARPStateRetryRequest)
+		{
+			pEntry->Timer.Cancel ();
+		}
+
+		for (unsigned i = 0; i < pEntry->nTxFrames; i++)
+		{
+			pEntry->pTxFrame[i]->Release ();
+		}
 	}
 
+	delete [] m_pEntry;
+	m_pEntry = 0;
+
 	m_pRxQueue = 0;
 	m_pNetDevLayer = 0;
 	m_pNetConfig = 0;
@@ -108,24 +147,34 @@ void CARPHandler::Process (void)
 			continue;
 		}
 
-		if (   pOwnIPAddress->IsNull ()
-		    || *pOwnIPAddress != pPacket->ProtocolAddressTarget)
+		if (pOwnIPAddress->IsNull ())
 		{
 			continue;
 		}
 
 		CMACAddress MACAddressSender (pPacket->HWAddressSender);
 		CIPAddress IPAddressSender (pPacket->ProtocolAddressSender);
+		if (   IPAddressSender.IsNull ()		// ARP probe
+		    || IPAddressSender == *pOwnIPAddress)
+		{
+			continue;
+		}
+
+		// gratuitous ARP packets are not targeted to us, but update an existing entry
+		boolean bTargetIsUs = *pOwnIPAddress == pPacket->ProtocolAddressTarget;
 		
 		switch (pPacket->nOPCode)
 		{
 		case BE (ARP_REQUEST):
-			SendPacket (FALSE, IPAddressSender, MACAddressSender);
-			RequestReceived (IPAddressSender, MACAddressSender);
+			if (bTargetIsUs)
+			{
+				SendPacket (FALSE, IPAddressSender, MACAddressSender);
+			}
+			PacketReceived (IPAddressSender, MACAddressSender, bTargetIsUs);
 			break;
 
 		case BE (ARP_REPLY):
-			ReplyReceived (IPAddressSender, MACAddressSender);
+			PacketReceived (IPAddressSender, MACAddressSender, bTargetIsUs);
 			break;
 
 		default:
@@ -135,174 +184,173 @@ void CARPHandler::Process (void)
 
 	assert (m_pLinkLayer != 0);
 	assert (m_pNetDevLayer != 0);
-	for (unsigned nEntry = 0; nEntry < m_nEntries; nEntry++)
+
+	CNetBuffer *TxFrame[ARP_MAX_PENDING_FRAMES];
+	unsigned nTxFrames;
+	u8 MACAddress[MAC_ADDRESS_SIZE];
+
+	m_SpinLock.Acquire ();
+
+	unsigned nEntry;
+	while (m_ActionRing.Read (&nEntry))
 	{
-		TARPEntry *pEntry = &m_Entry[nEntry];
+		assert (nEntry < ARP_MAX_ENTRIES);
+		TARPEntry *pEntry = &m_pEntry[nEntry];
+		pEntry->bActionQueued = FALSE;
+
 		switch (pEntry->State)
 		{
 		case ARPStateRetryRequest:
 			if (pEntry->nAttempts++ < ARP_MAX_ATTEMPTS)
 			{
+				pEntry->State = ARPStateRequestSent;
+
+				pEntry->Timer.Start (ARP_TIMEOUT_HZ);
+
 				CIPAddress ForeignIP (pEntry->IPAddress);
+
+				m_SpinLock.Release ();
+
 				CMACAddress BroadcastAddress;
 				BroadcastAddress.SetBroadcast ();
 				SendPacket (TRUE, ForeignIP, BroadcastAddress);
-
-				pEntry->State = ARPStateRequestSent;
-
-				pEntry->hTimer = CTimer::Get ()->StartKernelTimer (
-								ARP_TIMEOUT_HZ, TimerHandler,
-								(void *) (uintptr) nEntry, this);
 			}
 			else
 			{
-				assert (pEntry->pTxQueue != 0);
-				while ((nResultLength = pEntry->pTxQueue->Dequeue (Buffer)) != 0)
+				nTxFrames = DetachFrames (nEntry, TxFrame);
+
+				m_SeqLock.WriteBegin ();
+				FreeEntry (nEntry);
+				m_SeqLock.WriteEnd ();
+
+				m_SpinLock.Release ();
+
+				NET_STAT_INC (NetCounterARPResolveFailed, nTxFrames);
+
+				for (unsigned i = 0; i < nTxFrames; i++)
 				{
-					m_pLinkLayer->ResolveFailed (Buffer, nResultLength);
+					m_pLinkLayer->ResolveFailed (TxFrame[i]->GetData (),
+								     TxFrame[i]->GetLength ());
+					TxFrame[i]->Release ();
 				}
-
-				pEntry->State = ARPStateFreeSlot;
 			}
+
+			m_SpinLock.Acquire ();
 			break;
 
 		case  ARPStateSendTxQueue:
-			assert (pEntry->pTxQueue != 0);
-			while ((nResultLength = pEntry->pTxQueue->Dequeue (Buffer)) != 0)
+			memcpy (MACAddress, pEntry->MACAddress, MAC_ADDRESS_SIZE);
+
+			nTxFrames = DetachFrames (nEntry, TxFrame);
+			pEntry->State = ARPStateValid;
+
+			m_SpinLock.Release ();
+
+			for (unsigned i = 0; i < nTxFrames; i++)
 			{
-				TEthernetHeader *pHeader = (TEthernetHeader *) Buffer;
-				memcpy (pHeader->MACReceiver, pEntry->MACAddress,
-					MAC_ADDRESS_SIZE);
+				TEthernetHeader *pHeader = (TEthernetHeader *) TxFrame[i]->GetData ();
+				memcpy (pHeader->MACReceiver, MACAddress, MAC_ADDRESS_SIZE);
 
-				m_pNetDevLayer->Send (Buffer, nResultLength);
+				m_pNetDevLayer->Send (TxFrame[i]);
 			}
 
-			pEntry->State = ARPStateValid;
+			m_SpinLock.Acquire ();
 			break;
 
-		default:
+		default:					// entry has been replaced
 			break;
 		}
 	}
 
+	// remove the entries, which have not been used for ARP_LIFETIME_HZ, oldest first
 	unsigned nTicks = CTimer::Get ()->GetTicks ();
 	if (nTicks - m_nTicksLastCleanup >= 60*HZ)
 	{
 		m_nTicksLastCleanup = nTicks;
 
-		m_SpinLock.Acquire ();
+		RotateLRU ();
 
-		for (unsigned nEntry = 0; nEntry < m_nEntries; nEntry++)
+		m_SeqLock.WriteBegin ();
+
+		while (   m_nLRULast != ARP_NO_ENTRY
+		       && m_pEntry[m_nLRULast].State == ARPStateValid
+		       && !m_pEntry[m_nLRULast].bReferenced
+		       && nTicks - m_pEntry[m_nLRULast].nTicksLastUsed >= ARP_LIFETIME_HZ)
 		{
-			if (   m_Entry[nEntry].State == ARPStateValid
-			    && m_Entry[nEntry].nTicksLastUsed + ARP_LIFETIME_HZ < nTicks)
-			{
-				m_Entry[nEntry].State = ARPStateFreeSlot;
-			}
+			FreeEntry (m_nLRULast);
 		}
 
-		m_SpinLock.Release ();
+		m_SeqLock.WriteEnd ();
 	}
+
+	m_SpinLock.Release ();
 }
 
 boolean CARPHandler::Resolve (const CIPAddress &rIPAddress, CMACAddress *pMACAddress,
-			      const void *pFrame, unsigned nFrameLength)
+			      CNetBuffer *pFrame)
 {
-	unsigned nFreeSlot = ARP_MAX_ENTRIES;
+	assert (pFrame != 0);
 
-	unsigned nOldestEntry = -1;
-	unsigned nMinTicks = -1;
+	if (LookupValid (rIPAddress, pMACAddress))
+	{
+		return TRUE;
+	}
 
 	m_SpinLock.Acquire ();
 
-	unsigned nEntry;
-	for (nEntry = 0; nEntry < m_nEntries; nEntry++)
+	unsigned nEntry = LookupEntry (rIPAddress);
+	if (nEntry != ARP_NO_ENTRY)
 	{
-		switch (m_Entry[nEntry].State)
-		{
-		case ARPStateFreeSlot:
-			if (nFreeSlot == ARP_MAX_ENTRIES)
-			{
-				nFreeSlot = nEntry;
-			}
-			break;
+		TARPEntry *pEntry = &m_pEntry[nEntry];
 
-		case ARPStateRequestSent:
-		case ARPStateRetryRequest:
-		case ARPStateSendTxQueue:
-			if (rIPAddress == m_Entry[nEntry].IPAddress)
-			{
-				assert (m_Entry[nEntry].pTxQueue != 0);
-				m_Entry[nEntry].pTxQueue->Enqueue (pFrame, nFrameLength);
-
-				m_Entry[nEntry].nTicksLastUsed = CTimer::Get ()->GetTicks ();
-
-				m_SpinLock.Release ();
-
-				return FALSE;
-			}
-			break;
+		TouchEntry (nEntry);
 
-		case ARPStateValid:
-			if (m_Entry[nEntry].nTicksLastUsed < nMinTicks)
-			{
-				nOldestEntry = nEntry;
-				nMinTicks = m_Entry[nEntry].nTicksLastUsed;
-			}
-
-			if (rIPAddress == m_Entry[nEntry].IPAddress)
-			{
-				assert (pMACAddress != 0);
-				pMACAddress->Set (m_Entry[nEntry].MACAddress);
-				m_Entry[nEntry].nTicksLastUsed = CTimer::Get ()->GetTicks ();
-
-				m_SpinLock.Release ();
+		if (pEntry->State == ARPStateValid)
+		{
+			assert (pMACAddress != 0);
+			pMACAddress->Set (pEntry->MACAddress);
 
-				return TRUE;
-			}
-			break;
+			m_SpinLock.Release ();
 
-		default:
-			assert (0);
-			break;
+			return TRUE;
 		}
-	}
 
-	if (nFreeSlot == ARP_MAX_ENTRIES)
-	{
-		if (m_nEntries < ARP_MAX_ENTRIES)
-		{
-			nFreeSlot = m_nEntries;
-			m_Entry[nFreeSlot].State = ARPStateFreeSlot;
+		NET_STAT_INC (NetCounterARPMisses);
 
-			m_Entry[nFreeSlot].pTxQueue = new CNetQueue;
-			assert (m_Entry[nFreeSlot].pTxQueue != 0);
-
-			m_nEntries++;
+		// request is pending, frame is dropped, if too many are waiting already
+		if (pEntry->nTxFrames < ARP_MAX_PENDING_FRAMES)
+		{
+			pFrame->AddRef ();
+			pEntry->pTxFrame[pEntry->nTxFrames++] = pFrame;
 		}
 		else
 		{
-			assert (nOldestEntry < m_nEntries);
-			m_Entry[nOldestEntry].State = ARPStateFreeSlot;
-
-			nFreeSlot = nOldestEntry;
+			NET_STAT_INC (NetCounterARPPendingDropped);
 		}
+
+		m_SpinLock.Release ();
+
+		return FALSE;
 	}
-	nEntry = nFreeSlot;
-	TARPEntry *pEntry = &m_Entry[nEntry];
+
+	NET_STAT_INC (NetCounterARPMisses);
+
+	m_SeqLock.WriteBegin ();
+
+	nEntry = AllocEntry (rIPAddress);
+	TARPEntry *pEntry = &m_pEntry[nEntry];
 
 	pEntry->State = ARPStateRequestSent;
-	rIPAddress.CopyTo (pEntry->IPAddress);
 
-	assert (pEntry->pTxQueue != 0);
-	pEntry->pTxQueue->Enqueue (pFrame, nFrameLength);
+	m_SeqLock.WriteEnd ();
 
-	pEntry->nTicksLastUsed = CTimer::Get ()->GetTicks ();
+	pFrame->AddRef ();
+	pEntry->pTxFrame[0] = pFrame;
+	pEntry->nTxFrames = 1;
 
 	pEntry->nAttempts = 1;
 
-	pEntry->hTimer = CTimer::Get ()->StartKernelTimer (ARP_TIMEOUT_HZ, TimerHandler,
-							   (void *) (uintptr) nEntry, this);
+	pEntry->Timer.Start (ARP_TIMEOUT_HZ);
 
 	m_SpinLock.Release ();
 
@@ -313,75 +361,92 @@ boolean CARPHandler::Resolve (const CIPAddress &rIPAddress, CMACAddress *pMACAdd
 	return FALSE;
 }
 
-void CARPHandler::ReplyReceived (const CIPAddress &rForeignIP, const CMACAddress &rForeignMAC)
+// merge the sender into the table (RFC 826), create an entry only, if the packet targets us
+void CARPHandler::AddEntry (const CIPAddress &rIPAddress, const CMACAddress &rMACAddress)
+{
+	PacketReceived (rIPAddress, rMACAddress, TRUE);		// as if we got a reply
+}
+
+boolean CARPHandler::Lookup (const CIPAddress &rIPAddress, CMACAddress *pMACAddress)
+{
+	return LookupValid (rIPAddress, pMACAddress);
+}
+
+void CARPHandler::Flush (void)
 {
 	m_SpinLock.Acquire ();
 
-	for (unsigned nEntry = 0; nEntry < m_nEntries; nEntry++)
+	m_SeqLock.WriteBegin ();
+
+	unsigned nEntry = m_nLRUFirst;
+	while (nEntry != ARP_NO_ENTRY)
 	{
-		if (   m_Entry[nEntry].State != ARPStateRequestSent
-		    && m_Entry[nEntry].State != ARPStateRetryRequest)
+		unsigned nNext = m_pEntry[nEntry].nLRUNext;
+
+		if (m_pEntry[nEntry].State == ARPStateValid)
 		{
-			continue;
+			FreeEntry (nEntry);
 		}
-			
-		if (rForeignIP == m_Entry[nEntry].IPAddress)
-		{
-			CTimer::Get ()->CancelKernelTimer (m_Entry[nEntry].hTimer);
-
-			rForeignMAC.CopyTo (m_Entry[nEntry].MACAddress);
-			m_Entry[nEntry].State = ARPStateSendTxQueue;
 
-			break;
-		}
+		nEntry = nNext;
 	}
 
+	m_SeqLock.WriteEnd ();
+
 	m_SpinLock.Release ();
 }
 
-void CARPHandler::RequestReceived (const CIPAddress &rForeignIP, const CMACAddress &rForeignMAC)
+void CARPHandler::PacketReceived (const CIPAddress &rForeignIP, const CMACAddress &rForeignMAC,
+				  boolean bTargetIsUs)
 {
 	m_SpinLock.Acquire ();
 
-	unsigned nFreeSlot = ARP_MAX_ENTRIES;
-	unsigned nEntry;
-	for (nEntry = 0; nEntry < m_nEntries; nEntry++)
+	unsigned nEntry = LookupEntry (rForeignIP);
+	if (nEntry == ARP_NO_ENTRY)
 	{
-		if (m_Entry[nEntry].State == ARPStateFreeSlot)
-		{
-			if (nFreeSlot == ARP_MAX_ENTRIES)
-			{
-				nFreeSlot = nEntry;
-			}
-		}
-		else if (rForeignIP == m_Entry[nEntry].IPAddress)
+		if (!bTargetIsUs)
 		{
 			m_SpinLock.Release ();
 
 			return;
 		}
-	}
 
-	if (   nFreeSlot == ARP_MAX_ENTRIES
-	    && m_nEntries < ARP_MAX_ENTRIES)
+		m_SeqLock.WriteBegin ();
+
+		nEntry = AllocEntry (rForeignIP);
+		rForeignMAC.CopyTo (m_pEntry[nEntry].MACAddress);
+		m_pEntry[nEntry].State = ARPStateValid;
+
+		m_SeqLock.WriteEnd ();
+	}
+	else if (memcmp (rForeignMAC.Get (), m_pEntry[nEntry].MACAddress, MAC_ADDRESS_SIZE) != 0)
 	{
-		nFreeSlot = m_nEntries;
-		m_Entry[nFreeSlot].State = ARPStateFreeSlot;
+		m_SeqLock.WriteBegin ();
 
-		m_Entry[nFreeSlot].pTxQueue = new CNetQueue;
-		assert (m_Entry[nFreeSlot].pTxQueue != 0);
+		rForeignMAC.CopyTo (m_pEntry[nEntry].MACAddress);
 
-		m_nEntries++;
+		m_SeqLock.WriteEnd ();
 	}
 
-	if (nFreeSlot < ARP_MAX_ENTRIES)
+	TARPEntry *pEntry = &m_pEntry[nEntry];
+
+	switch (pEntry->State)
 	{
-		rForeignIP.CopyTo (m_Entry[nFreeSlot].IPAddress);
-		rForeignMAC.CopyTo (m_Entry[nFreeSlot].MACAddress);
+	case ARPStateRequestSent:
+	case ARPStateRetryRequest:
+		pEntry->Timer.Cancel ();
 
-		m_Entry[nFreeSlot].nTicksLastUsed = CTimer::Get ()->GetTicks ();
+		pEntry->State = ARPStateSendTxQueue;
+		QueueAction (nEntry);
+		break;
 
-		m_Entry[nFreeSlot].State = ARPStateValid;
+	default:
+		break;
+	}
+
+	if (bTargetIsUs)
+	{
+		TouchEntry (nEntry);
 	}
 
 	m_SpinLock.Release ();
@@ -419,19 +484,276 @@ void CARPHandler::SendPacket (boolean		 bRequest,
 	m_pNetDevLayer->Send (&ARPFrame, sizeof ARPFrame);
 }
 
+boolean CARPHandler::LookupValid (const CIPAddress &rIPAddress, CMACAddress *pMACAddress)
+{
+	u8 IPAddress[IP_ADDRESS_SIZE];
+	rIPAddress.CopyTo (IPAddress);
+	unsigned nHash = Hash (IPAddress);
+
+	unsigned nSequence = m_SeqLock.ReadBegin ();
+
+	// the links may be inconsistent, while the table is modified
+	unsigned nEntry = m_HashTable[nHash];
+	for (unsigned nCount = 0;
+	     nEntry < ARP_MAX_ENTRIES && nCount < ARP_MAX_ENTRIES;
+	     nEntry = m_pEntry[nEntry].nHashNext, nCount++)
+	{
+		if (rIPAddress == m_pEntry[nEntry].IPAddress)
+		{
+			break;
+		}
+	}
+
+	if (   nEntry >= ARP_MAX_ENTRIES
+	    || m_pEntry[nEntry].State != ARPStateValid)
+	{
+		return FALSE;
+	}
+
+	TARPEntry *pEntry = &m_pEntry[nEntry];
+
+	u8 MACAddress[MAC_ADDRESS_SIZE];
+	memcpy (MACAddress, pEntry->MACAddress, MAC_ADDRESS_SIZE);
+
+	if (m_SeqLock.ReadRetry (nSequence))
+	{
+		return FALSE;
+	}
+
+	// the LRU list is updated later (see RotateLRU())
+	pEntry->nTicksLastUsed = CTimer::Get ()->GetTicks ();
+	pEntry->bReferenced = TRUE;
+
+	assert (pMACAddress != 0);
+	pMACAddress->Set (MACAddress);
+
+	return TRUE;
+}
+
+unsigned CARPHandler::LookupEntry (const CIPAddress &rIPAddress) const
+{
+	u8 IPAddress[IP_ADDRESS_SIZE];
+	rIPAddress.CopyTo (IPAddress);
+
+	for (unsigned nEntry = m_HashTable[Hash (IPAddress)];
+	     nEntry != ARP_NO_ENTRY;
+	     nEntry = m_pEntry[nEntry].nHashNext)
+	{
+		assert (m_pEntry[nEntry].State != ARPStateFreeSlot);
+		if (rIPAddress == m_pEntry[nEntry].IPAddress)
+		{
+			return nEntry;
+		}
+	}
+
+	return ARP_NO_ENTRY;
+}
+
+unsigned CARPHandler::AllocEntry (const CIPAddress &rIPAddress)
+{
+	if (m_nFreeList == ARP_NO_ENTRY)
+	{
+		RotateLRU ();
+
+		// replace the least recently used entry, its deferred frames are dropped
+		unsigned nEntry = m_nLRULast;
+		assert (nEntry != ARP_NO_ENTRY);
+
+		CNetBuffer *TxFrame[ARP_MAX_PENDING_FRAMES];
+		unsigned nTxFrames = DetachFrames (nEntry, TxFrame);
+		for (unsigned i = 0; i < nTxFrames; i++)
+		{
+			TxFrame[i]->Release ();
+		}
+
+		FreeEntry (nEntry);
+	}
+
+	unsigned nEntry = m_nFreeList;
+	assert (nEntry < ARP_MAX_ENTRIES);
+	TARPEntry *pEntry = &m_pEntry[nEntry];
+	m_nFreeList = pEntry->nHashNext;
+
+	assert (pEntry->State == ARPStateFreeSlot);
+	assert (pEntry->nTxFrames == 0);
+	pEntry->State = ARPStateUnknown;
+	rIPAddress.CopyTo (pEntry->IPAddress);
+
+	unsigned nHash = Hash (pEntry->IPAddress);
+	pEntry->nHashNext = m_HashTable[nHash];
+	m_HashTable[nHash] = nEntry;
+
+	pEntry->nLRUPrev = ARP_NO_ENTRY;		// insert as most recently used
+	pEntry->nLRUNext = m_nLRUFirst;
+	if (m_nLRUFirst != ARP_NO_ENTRY)
+	{
+		m_pEntry[m_nLRUFirst].nLRUPrev = nEntry;
+	}
+	else
+	{
+		m_nLRULast = nEntry;
+	}
+	m_nLRUFirst = nEntry;
+
+	pEntry->nTicksLastUsed = CTimer::Get ()->GetTicks ();
+
+	return nEntry;
+}
+
+void CARPHandler::FreeEntry (unsigned nEntry)
+{
+	assert (nEntry < ARP_MAX_ENTRIES);
+	TARPEntry *pEntry = &m_pEntry[nEntry];
+	assert (pEntry->State != ARPStateFreeSlot);
+	assert (pEntry->nTxFrames == 0);
+
+	if (   pEntry->State == ARPStateRequestSent
+	    || pEntry->State == ARPStateRetryRequest)
+	{
+		pEntry->Timer.Cancel ();
+	}
+
+	unsigned *pLink = &m_HashTable[Hash (pEntry->IPAddress)];
+	while (*pLink != nEntry)
+	{
+		assert (*pLink != ARP_NO_ENTRY);
+		pLink = &m_pEntry[*pLink].nHashNext;
+	}
+	*pLink = pEntry->nHashNext;
+
+	if (pEntry->nLRUPrev != ARP_NO_ENTRY)
+	{
+		m_pEntry[pEntry->nLRUPrev].nLRUNext = pEntry->nLRUNext;
+	}
+	else
+	{
+		m_nLRUFirst = pEntry->nLRUNext;
+	}
+
+	if (pEntry->nLRUNext != ARP_NO_ENTRY)
+	{
+		m_pEntry[pEntry->nLRUNext].nLRUPrev = pEntry->nLRUPrev;
+	}
+	else
+	{
+		m_nLRULast = pEntry->nLRUPrev;
+	}
+
+	pEntry->State = ARPStateFreeSlot;		// may still be in m_ActionRing
+
+	pEntry->nHashNext = m_nFreeList;
+	m_nFreeList = nEntry;
+}
+
+void CARPHandler::TouchEntry (unsigned nEntry)
+{
+	assert (nEntry < ARP_MAX_ENTRIES);
+	TARPEntry *pEntry = &m_pEntry[nEntry];
+
+	pEntry->nTicksLastUsed = CTimer::Get ()->GetTicks ();
+	pEntry->bReferenced = FALSE;
+
+	if (nEntry == m_nLRUFirst)
+	{
+		return;
+	}
+
+	// unlink, the entry is not the first one
+	assert (pEntry->nLRUPrev != ARP_NO_ENTRY);
+	m_pEntry[pEntry->nLRUPrev].nLRUNext = pEntry->nLRUNext;
+
+	if (pEntry->nLRUNext != ARP_NO_ENTRY)
+	{
+		m_pEntry[pEntry->nLRUNext].nLRUPrev = pEntry->nLRUPrev;
+	}
+	else
+	{
+		m_nLRULast = pEntry->nLRUPrev;
+	}
+
+	// insert at the front
+	pEntry->nLRUPrev = ARP_NO_ENTRY;
+	pEntry->nLRUNext = m_nLRUFirst;
+	m_pEntry[m_nLRUFirst].nLRUPrev = nEntry;
+	m_nLRUFirst = nEntry;
+}
+
+// second chance for entries, which have been used by LookupValid() since they were touched
+void CARPHandler::RotateLRU (void)
+{
+	for (unsigned nCount = 0; nCount < ARP_MAX_ENTRIES; nCount++)
+	{
+		unsigned nEntry = m_nLRULast;
+		if (   nEntry == ARP_NO_ENTRY
+		    || !m_pEntry[nEntry].bReferenced)
+		{
+			break;
+		}
+
+		unsigned nTicksLastUsed = m_pEntry[nEntry].nTicksLastUsed;
+		TouchEntry (nEntry);
+		m_pEntry[nEntry].nTicksLastUsed = nTicksLastUsed;
+	}
+}
+
+void CARPHandler::QueueAction (unsigned nEntry)
+{
+	assert (nEntry < ARP_MAX_ENTRIES);
+	TARPEntry *pEntry = &m_pEntry[nEntry];
+
+	if (!pEntry->bActionQueued)
+	{
+		pEntry->bActionQueued = TRUE;
+
+		if (!m_ActionRing.Write (nEntry))	// cannot fail, has space for each entry
+		{
+			assert (0);
+		}
+	}
+}
+
+unsigned CARPHandler::DetachFrames (unsigned nEntry, CNetBuffer **ppFrame)
+{
+	assert (nEntry < ARP_MAX_ENTRIES);
+	TARPEntry *pEntry = &m_pEntry[nEntry];
+
+	unsigned nFrames = pEntry->nTxFrames;
+	assert (nFrames <= ARP_MAX_PENDING_FRAMES);
+
+	assert (ppFrame != 0);
+	for (unsigned i = 0; i < nFrames; i++)
+	{
+		ppFrame[i] = pEntry->pTxFrame[i];
+	}
+
+	pEntry->nTxFrames = 0;
+
+	return nFrames;
+}
+
+unsigned CARPHandler::Hash (const u8 *pIPAddress)
+{
+	assert (pIPAddress != 0);
+	u32 nAddress =   (u32) pIPAddress[0] << 24 | (u32) pIPAddress[1] << 16
+		       | (u32) pIPAddress[2] << 8  | pIPAddress[3];
+
+	return (nAddress * 2654435761U) >> 16 & (ARP_HASH_SIZE-1);	// Knuth
+}
+
 void CARPHandler::TimerHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext)
 {
 	CARPHandler *pThis = (CARPHandler *) pContext;
 	assert (pThis != 0);
 
 	unsigned nEntry = (unsigned) (uintptr) pParam;
-	assert (nEntry < pThis->m_nEntries);
+	assert (nEntry < ARP_MAX_ENTRIES);
 
 	pThis->m_SpinLock.Acquire ();
 
-	if (pThis->m_Entry[nEntry].State == ARPStateRequestSent)
+	if (pThis->m_pEntry[nEntry].State == ARPStateRequestSent)
 	{
-		pThis->m_Entry[nEntry].State = ARPStateRetryRequest;
+		pThis->m_pEntry[nEntry].State = ARPStateRetryRequest;
+		pThis->QueueAction (nEntry);
 	}
 
 	pThis->m_SpinLock.Release ();
@@ -2,7 +2,7 @@
 // checksumcalculator.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,6 +21,14 @@
 #include <circle/util.h>
 #include <assert.h>
 
+#if defined (__ARM_NEON) && __has_include (<arm_neon.h>)
+	#define CHECKSUM_NEON
+	#include <arm_neon.h>
+
+	// maximum number of bytes, before the 32-bit lanes of the NEON accumulators may overflow
+	#define NEON_BLOCK_MAX		0x10000
+#endif
+
 CChecksumCalculator::CChecksumCalculator (const CIPAddress &rSourceIP, int nProtocol)
 :	m_bDestAddressSet (FALSE)
 {
@@ -69,6 +77,36 @@ u16 CChecksumCalculator::Calculate (const void *pBuffer, unsigned nLength)
 	return ~FoldResult (nChecksum);
 }
 
+u16 CChecksumCalculator::CalculateCopy (const void *pHeader, unsigned nHeaderLength,
+					void *pDest, const void *pData, unsigned nDataLength)
+{
+	assert (m_bDestAddressSet);
+	assert (!(nHeaderLength & 1));
+
+	m_Header.nTCPLength = le2be16 (nHeaderLength + nDataLength);
+	u32 nChecksum = CalculateChunk (&m_Header, sizeof m_Header, 0);
+
+	assert (pHeader != 0);
+	assert (nHeaderLength > 0);
+	nChecksum = CalculateChunk (pHeader, nHeaderLength, nChecksum);
+
+	if (nDataLength > 0)
+	{
+		nChecksum = CopyChunk (pDest, pData, nDataLength, nChecksum);
+	}
+
+	return ~FoldResult (nChecksum);
+}
+
+u16 CChecksumCalculator::CalculatePseudoHeader (unsigned nLength)
+{
+	assert (m_bDestAddressSet);
+
+	m_Header.nTCPLength = le2be16 (nLength);
+
+	return FoldResult (CalculateChunk (&m_Header, sizeof m_Header, 0));
+}
+
 u16 CChecksumCalculator::SimpleCalculate (const void *pBuffer, unsigned nLength)
 {
 	assert (pBuffer != 0);
@@ -78,25 +116,180 @@ u16 CChecksumCalculator::SimpleCalculate (const void *pBuffer, unsigned nLength)
 	return ~FoldResult (nChecksum);
 }
 
+#ifdef CHECKSUM_NEON
+
+// nLength must be a multiple of 16, returns the sum of the 16-bit words
+static u64 SumNEON (const u8 *pBuffer, unsigned nLength)
+{
+	uint64x2_t Sum64 = vdupq_n_u64 (0);
+
+	while (nLength > 0)
+	{
+		unsigned nBlock = nLength < NEON_BLOCK_MAX ? nLength : NEON_BLOCK_MAX;
+		nLength -= nBlock;
+
+		// two accumulators to hide the latency of the pairwise add
+		uint32x4_t Sum32A = vdupq_n_u32 (0);
+		uint32x4_t Sum32B = vdupq_n_u32 (0);
+
+		// byte loads, because the buffer may be unaligned
+		for (; nBlock >= 64; nBlock -= 64, pBuffer += 64)
+		{
+			Sum32A = vpadalq_u16 (Sum32A, vreinterpretq_u16_u8 (vld1q_u8 (pBuffer)));
+			Sum32B = vpadalq_u16 (Sum32B, vreinterpretq_u16_u8 (vld1q_u8 (pBuffer+16)));
+			Sum32A = vpadalq_u16 (Sum32A, vreinterpretq_u16_u8 (vld1q_u8 (pBuffer+32)));
+			Sum32B = vpadalq_u16 (Sum32B, vreinterpretq_u16_u8 (vld1q_u8 (pBuffer+48)));
+		}
+
+		for (; nBlock > 0; nBlock -= 16, pBuffer += 16)
+		{
+			Sum32A = vpadalq_u16 (Sum32A, vreinterpretq_u16_u8 (vld1q_u8 (pBuffer)));
+		}
+
+		Sum64 = vpadalq_u32 (Sum64, Sum32A);
+		Sum64 = vpadalq_u32 (Sum64, Sum32B);
+	}
+
+	return vgetq_lane_u64 (Sum64, 0) + vgetq_lane_u64 (Sum64, 1);
+}
+
+// nLength must be a multiple of 16, returns the sum of the 16-bit words
+static u64 CopyNEON (u8 *pDest, const u8 *pSource, unsigned nLength)
+{
+	uint64x2_t Sum64 = vdupq_n_u64 (0);
+
+	while (nLength > 0)
+	{
+		unsigned nBlock = nLength < NEON_BLOCK_MAX ? nLength : NEON_BLOCK_MAX;
+		nLength -= nBlock;
+
+		uint32x4_t Sum32A = vdupq_n_u32 (0);
+		uint32x4_t Sum32B = vdupq_n_u32 (0);
+
+		for (; nBlock >= 32; nBlock -= 32, pSource += 32, pDest += 32)
+		{
+			uint8x16_t DataA = vld1q_u8 (pSource);
+			uint8x16_t DataB = vld1q_u8 (pSource+16);
+
+			vst1q_u8 (pDest, DataA);
+			vst1q_u8 (pDest+16, DataB);
+
+			Sum32A = vpadalq_u16 (Sum32A, vreinterpretq_u16_u8 (DataA));
+			Sum32B = vpadalq_u16 (Sum32B, vreinterpretq_u16_u8 (DataB));
+		}
+
+		if (nBlock > 0)
+		{
+			assert (nBlock == 16);
+			uint8x16_t Data = vld1q_u8 (pSource);
+			vst1q_u8 (pDest, Data);
+			Sum32A = vpadalq_u16 (Sum32A, vreinterpretq_u16_u8 (Data));
+
+			pSource += 16;
+			pDest += 16;
+		}
+
+		Sum64 = vpadalq_u32 (Sum64, Sum32A);
+		Sum64 = vpadalq_u32 (Sum64, Sum32B);
+	}
+
+	return vgetq_lane_u64 (Sum64, 0) + vgetq_lane_u64 (Sum64, 1);
+}
+
+#endif
+
 u32 CChecksumCalculator::CalculateChunk (const void *pBuffer, unsigned nLength, u32 nChecksum)
 {
-	u16 *pBuffer16 = (u16 *) pBuffer;
-	assert (pBuffer16 != 0);
+	const u8 *pBuffer8 = (const u8 *) pBuffer;
+	assert (pBuffer8 != 0);
 	assert (nLength > 0);
 
-	while (nLength >= 2)
+	u64 nSum = nChecksum;
+
+#ifdef CHECKSUM_NEON
+	unsigned nBlock = nLength & ~15U;
+	if (nBlock > 0)
 	{
-		nChecksum += *pBuffer16++;
-		nLength -= 2;
+		nSum += SumNEON (pBuffer8, nBlock);
+
+		pBuffer8 += nBlock;
+		nLength -= nBlock;
+	}
+#else
+	// 2^32 == 1 (mod 0xFFFF), so 32-bit words can be summed up too
+	if (((uintptr) pBuffer8 & 3) == 0)
+	{
+		const u32 *pBuffer32 = (const u32 *) pBuffer8;
+		for (; nLength >= 4; nLength -= 4)
+		{
+			nSum += *pBuffer32++;
+		}
+
+		pBuffer8 = (const u8 *) pBuffer32;
+	}
+#endif
+
+	const u16 *pBuffer16 = (const u16 *) pBuffer8;
+	for (; nLength >= 2; nLength -= 2)
+	{
+		nSum += *pBuffer16++;
 	}
 
 	assert (nLength <= 1);
 	if (nLength != 0)
 	{
-		nChecksum += *(u8 *) pBuffer16;
+		nSum += *(const u8 *) pBuffer16;
 	}
 	
-	return nChecksum;
+	return FoldSum (nSum);
+}
+
+u32 CChecksumCalculator::CopyChunk (void *pDest, const void *pSource, unsigned nLength,
+				    u32 nChecksum)
+{
+	assert (pDest != 0);
+	assert (pSource != 0);
+	assert (nLength > 0);
+
+#ifdef CHECKSUM_NEON
+	u64 nSum = nChecksum;
+
+	u8 *pDest8 = (u8 *) pDest;
+	const u8 *pSource8 = (const u8 *) pSource;
+
+	unsigned nBlock = nLength & ~15U;
+	if (nBlock > 0)
+	{
+		nSum += CopyNEON (pDest8, pSource8, nBlock);
+
+		pDest8 += nBlock;
+		pSource8 += nBlock;
+		nLength -= nBlock;
+	}
+
+	if (nLength > 0)
+	{
+		memcpy (pDest8, pSource8, nLength);
+
+		nSum += CalculateChunk (pDest8, nLength, 0);
+	}
+
+	return FoldSum (nSum);
+#else
+	// memcpy() is optimized in assembler, so touch the data twice
+	memcpy (pDest, pSource, nLength);
+
+	return CalculateChunk (pDest, nLength, nChecksum);
+#endif
+}
+
+u32 CChecksumCalculator::FoldSum (u64 nSum)
+{
+	// 2^32 == 1 (mod 0xFFFF), so the carry can be folded back
+	nSum = (nSum & 0xFFFFFFFFU) + (nSum >> 32);
+	nSum = (nSum & 0xFFFFFFFFU) + (nSum >> 32);
+
+	return (u32) nSum;
 }
 
 u16 CChecksumCalculator::FoldResult (u32 nChecksum)
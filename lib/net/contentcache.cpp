@@ -0,0 +1,259 @@
+//
+// contentcache.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/contentcache.h>
+#include <circle/string.h>
+#include <circle/util.h>
+#include <assert.h>
+
+// the memory used by an entry, negative entries must be bounded too
+#define ENTRY_COST(pEntry)	(  (pEntry)->nLength + strlen ((pEntry)->pName) + 1 \
+				 + sizeof (TContentCacheEntry))
+
+CContentCache::CContentCache (size_t nMaxSize)
+:	m_nMaxSize (nMaxSize),
+	m_nSize (0),
+	m_pFirst (0),
+	m_pLast (0)
+{
+	assert (m_nMaxSize > 0);
+}
+
+CContentCache::~CContentCache (void)
+{
+	Flush ();
+}
+
+TContentCacheEntry *CContentCache::Lookup (const char *pName)
+{
+	assert (pName != 0);
+	TContentCacheEntry *pEntry = Find (pName, Hash (pName, strlen (pName)));
+	if (pEntry == 0)
+	{
+		return 0;
+	}
+
+	// make it most recently used
+	if (pEntry != m_pFirst)
+	{
+		assert (pEntry->pPrev != 0);
+		pEntry->pPrev->pNext = pEntry->pNext;
+		if (pEntry->pNext != 0)
+		{
+			pEntry->pNext->pPrev = pEntry->pPrev;
+		}
+		else
+		{
+			m_pLast = pEntry->pPrev;
+		}
+
+		pEntry->pPrev = 0;
+		pEntry->pNext = m_pFirst;
+		m_pFirst->pPrev = pEntry;
+		m_pFirst = pEntry;
+	}
+
+	pEntry->nRefCount++;
+
+	return pEntry;
+}
+
+TContentCacheEntry *CContentCache::Insert (const char *pName, u8 *pData, size_t nLength)
+{
+	assert (pName != 0);
+	assert (pData != 0 || nLength == 0);
+	assert (nLength <= GetMaxEntrySize ());
+
+	size_t nNameLength = strlen (pName);
+	u32 nHash = Hash (pName, nNameLength);
+
+	TContentCacheEntry *pEntry = Find (pName, nHash);
+	if (pEntry != 0)
+	{
+		Remove (pEntry);
+	}
+
+	pEntry = new TContentCacheEntry;
+	assert (pEntry != 0);
+
+	pEntry->pName = new char[nNameLength+1];
+	assert (pEntry->pName != 0);
+	strcpy (pEntry->pName, pName);
+	pEntry->nNameHash = nHash;
+
+	pEntry->pData = pData;
+	pEntry->nLength = nLength;
+
+	CString ETag;
+	ETag.Format ("\"%08X-%X\"", Hash (pData, nLength), (unsigned) nLength);
+	assert (ETag.GetLength () < CONTENT_CACHE_ETAG_SIZE);
+	strcpy (pEntry->ETag, ETag);
+
+	pEntry->nRefCount = 1;
+	pEntry->bRemoved = FALSE;
+
+	size_t nCost = ENTRY_COST (pEntry);
+
+	// remove the least recently used entries
+	while (   m_pLast != 0
+	       && m_nSize + nCost > m_nMaxSize)
+	{
+		Remove (m_pLast);
+	}
+
+	pEntry->pPrev = 0;
+	pEntry->pNext = m_pFirst;
+	if (m_pFirst != 0)
+	{
+		m_pFirst->pPrev = pEntry;
+	}
+	else
+	{
+		m_pLast = pEntry;
+	}
+	m_pFirst = pEntry;
+
+	m_nSize += nCost;
+
+	return pEntry;
+}
+
+void CContentCache::Release (TContentCacheEntry *pEntry)
+{
+	assert (pEntry != 0);
+	assert (pEntry->nRefCount > 0);
+
+	if (   --pEntry->nRefCount == 0
+	    && pEntry->bRemoved)
+	{
+		Free (pEntry);
+	}
+}
+
+void CContentCache::Invalidate (const char *pName)
+{
+	assert (pName != 0);
+	TContentCacheEntry *pEntry = Find (pName, Hash (pName, strlen (pName)));
+	if (pEntry != 0)
+	{
+		Remove (pEntry);
+	}
+}
+
+void CContentCache::Flush (void)
+{
+	while (m_pFirst != 0)
+	{
+		Remove (m_pFirst);
+	}
+
+	assert (m_nSize == 0);
+}
+
+size_t CContentCache::GetMaxEntrySize (void) const
+{
+	return m_nMaxSize / 4;
+}
+
+boolean CContentCache::MatchETag (const TContentCacheEntry *pEntry, const char *pIfNoneMatch)
+{
+	assert (pEntry != 0);
+	assert (pIfNoneMatch != 0);
+
+	if (strcmp (pIfNoneMatch, "*") == 0)
+	{
+		return pEntry->pData != 0;
+	}
+
+	// weak comparison (RFC 7232 section 3.2), the "W/" prefix is ignored
+	return strstr (pIfNoneMatch, pEntry->ETag) != 0;
+}
+
+TContentCacheEntry *CContentCache::Find (const char *pName, u32 nHash) const
+{
+	for (TContentCacheEntry *pEntry = m_pFirst; pEntry != 0; pEntry = pEntry->pNext)
+	{
+		if (   pEntry->nNameHash == nHash
+		    && strcmp (pEntry->pName, pName) == 0)
+		{
+			return pEntry;
+		}
+	}
+
+	return 0;
+}
+
+void CContentCache::Remove (TContentCacheEntry *pEntry)
+{
+	assert (pEntry != 0);
+	assert (!pEntry->bRemoved);
+
+	if (pEntry->pPrev != 0)
+	{
+		pEntry->pPrev->pNext = pEntry->pNext;
+	}
+	else
+	{
+		m_pFirst = pEntry->pNext;
+	}
+
+	if (pEntry->pNext != 0)
+	{
+		pEntry->pNext->pPrev = pEntry->pPrev;
+	}
+	else
+	{
+		m_pLast = pEntry->pPrev;
+	}
+
+	size_t nCost = ENTRY_COST (pEntry);
+	assert (m_nSize >= nCost);
+	m_nSize -= nCost;
+
+	if (pEntry->nRefCount > 0)
+	{
+		pEntry->bRemoved = TRUE;		// still in use, freed in Release()
+	}
+	else
+	{
+		Free (pEntry);
+	}
+}
+
+void CContentCache::Free (TContentCacheEntry *pEntry)
+{
+	assert (pEntry != 0);
+
+	delete [] pEntry->pData;
+	delete [] pEntry->pName;
+	delete pEntry;
+}
+
+u32 CContentCache::Hash (const void *pData, size_t nLength, u32 nHash)
+{
+	// FNV-1a
+	const u8 *p = (const u8 *) pData;
+	while (nLength-- > 0)
+	{
+		nHash ^= *p++;
+		nHash *= 16777619U;
+	}
+
+	return nHash;
+}
@@ -4,7 +4,7 @@
 // This implements a DHCP client (RFC 2131 and RFC 2132).
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -105,12 +105,15 @@ static const char FromDHCPClient[] = "dhcp";
 #define MAX_TRIES	4
 const unsigned CDHCPClient::s_TimeoutHZ[MAX_TRIES] = {4*HZ, 8*HZ, 16*HZ, 32*HZ};
 
-CDHCPClient::CDHCPClient (CNetSubSystem *pNetSubSystem, const char *pHostname)
+CDHCPClient::CDHCPClient (CNetSubSystem *pNetSubSystem, const char *pHostname,
+			  const TDHCPLease *pLease)
 :	m_pNetSubSystem (pNetSubSystem),
 	m_pNetConfig (pNetSubSystem->GetConfig ()),
 	m_Hostname (pHostname != 0 ? pHostname : ""),
 	m_Socket (pNetSubSystem, IPPROTO_UDP),
-	m_bIsBound (FALSE)
+	m_bIsBound (FALSE),
+	m_bInitReboot (FALSE),
+	m_bLinkRestored (FALSE)
 {
 	assert (m_pNetSubSystem != 0);
 	assert (m_pNetConfig != 0);
@@ -118,6 +121,36 @@ CDHCPClient::CDHCPClient (CNetSubSystem *pNetSubSystem, const char *pHostname)
 	assert (m_Hostname.GetLength () <= 30);
 
 	SetName (FromDHCPClient);
+
+	if (pLease != 0)
+	{
+		assert (pLease->nMagic == DHCP_LEASE_MAGIC);
+
+		// use the lease from the previous boot, until it is confirmed or rejected
+		m_nOwnIPAddress = pLease->nIPAddress;
+		m_nServerIdentifier = pLease->nServerIdentifier;
+
+		m_nIPAddressLeaseTime = pLease->nLeaseTime;
+		m_nRenewalTimeValue   = pLease->nLeaseTime / 2;		// RFC 2131 section 4.4.5
+		m_nRebindingTimeValue = pLease->nLeaseTime / 8 * 7;
+
+		m_pNetConfig->SetIPAddress (pLease->nIPAddress);
+		m_pNetConfig->SetNetMask (pLease->nNetMask);
+		m_pNetConfig->SetDefaultGateway (pLease->nDefaultGateway);
+		m_pNetConfig->SetDNSServer (pLease->nDNSServer);
+
+		static const u8 NullMAC[MAC_ADDRESS_SIZE] = {0};
+		if (   pLease->nDefaultGateway != 0
+		    && memcmp (pLease->GatewayMAC, NullMAC, MAC_ADDRESS_SIZE) != 0)
+		{
+			CIPAddress GatewayIP (pLease->nDefaultGateway);
+			CMACAddress GatewayMAC (pLease->GatewayMAC);
+			m_pNetSubSystem->GetLinkLayer ()->AddARPEntry (GatewayIP, GatewayMAC);
+		}
+
+		m_bInitReboot = TRUE;
+		m_bIsBound = TRUE;
+	}
 }
 
 CDHCPClient::~CDHCPClient (void)
@@ -136,6 +169,37 @@ void CDHCPClient::Run (void)
 
 	while (1)
 	{
+		if (m_bInitReboot)
+		{
+			TDHCPStatus Status = InitReboot ();
+			m_bInitReboot = FALSE;
+
+			switch (Status)
+			{
+			case DHCPStatusSuccess:
+				break;
+
+			case DHCPStatusConnectError:
+				return;			// cannot recover
+
+			case DHCPStatusTimeout:
+				// RFC 2131 section 3.2 (4): may use the lease further, renew it later
+				CLogger::Get ()->Write (FromDHCPClient, LogWarning, "Using current lease");
+				break;
+
+			case DHCPStatusNAK:
+			case DHCPStatusConfigError:
+			case DHCPStatusConfigChanged:
+				HaltNetwork ();
+				break;
+			}
+		}
+
+		if (m_bIsBound)
+		{
+			goto BoundState;
+		}
+
 	InitState:
 		switch (SelectAndRequest ())
 		{
@@ -158,6 +222,15 @@ void CDHCPClient::Run (void)
 
 		while (CTimer::Get ()->GetUptime () - m_nBoundSince < m_nRenewalTimeValue)
 		{
+			// we may have been moved to another network (RFC 2131 section 3.7)
+			if (m_bLinkRestored)
+			{
+				m_bLinkRestored = FALSE;
+				m_bInitReboot = TRUE;
+
+				break;
+			}
+
 			// discard messages
 			u8 Buffer[DHCP_MAX_MESSAGE_SIZE];
 			while (m_Socket.Receive (Buffer, sizeof Buffer, MSG_DONTWAIT) > 0)
@@ -168,6 +241,11 @@ void CDHCPClient::Run (void)
 			CScheduler::Get ()->Sleep (10);
 		}
 
+		if (m_bInitReboot)
+		{
+			continue;
+		}
+
 	//RenewingState:
 		switch (RenewOrRebind (TRUE, m_nRebindingTimeValue))
 		{
@@ -219,6 +297,116 @@ boolean CDHCPClient::IsBound (void) const
 	return m_bIsBound;
 }
 
+void CDHCPClient::LinkRestored (void)
+{
+	if (m_bIsBound)
+	{
+		m_bLinkRestored = TRUE;
+	}
+}
+
+boolean CDHCPClient::GetLease (TDHCPLease *pLease) const
+{
+	if (!m_bIsBound)
+	{
+		return FALSE;
+	}
+
+	assert (pLease != 0);
+	memset (pLease, 0, sizeof *pLease);
+
+	pLease->nMagic = DHCP_LEASE_MAGIC;
+
+	assert (m_pNetConfig != 0);
+	pLease->nIPAddress = *m_pNetConfig->GetIPAddress ();
+	pLease->nNetMask = *(const u32 *) m_pNetConfig->GetNetMask ();
+	pLease->nDefaultGateway = *m_pNetConfig->GetDefaultGateway ();
+	pLease->nDNSServer = *m_pNetConfig->GetDNSServer ();
+
+	pLease->nServerIdentifier = m_nServerIdentifier;
+	pLease->nLeaseTime = m_nIPAddressLeaseTime;
+
+	CMACAddress GatewayMAC;
+	assert (m_pNetSubSystem != 0);
+	if (   pLease->nDefaultGateway != 0
+	    && m_pNetSubSystem->GetLinkLayer ()->LookupARPEntry (*m_pNetConfig->GetDefaultGateway (),
+								  &GatewayMAC))
+	{
+		GatewayMAC.CopyTo (pLease->GatewayMAC);
+	}
+
+	return TRUE;
+}
+
+TDHCPStatus CDHCPClient::InitReboot (void)
+{
+	m_bUseBroadcast = TRUE;
+
+	CIPAddress BroadcastIP;
+	BroadcastIP.SetBroadcast ();
+	if (m_Socket.Connect (BroadcastIP, DHCP_PORT_SERVER) < 0)
+	{
+		CLogger::Get ()->Write (FromDHCPClient, LogError, "Cannot connect (broadcast, port %u)", DHCP_PORT_SERVER);
+
+		return DHCPStatusConnectError;
+	}
+
+	if (m_Socket.SetOptionBroadcast (TRUE))
+	{
+		CLogger::Get ()->Write (FromDHCPClient, LogError, "Cannot set broadcast option");
+
+		return DHCPStatusConnectError;
+	}
+
+	m_nXID = GetXID ();		// new transaction ID
+
+	m_nBoundSince = CTimer::Get ()->GetUptime ();
+
+	// REBOOTING state
+	assert (m_bInitReboot);
+	if (!SendAndReceive (TRUE, 0))
+	{
+		return DHCPStatusTimeout;
+	}
+
+	if (m_nRxMessageType == DHCP_OPTION_MSGTYPE_NAK)
+	{
+		CLogger::Get ()->Write (FromDHCPClient, LogWarning, "Lease rejected with NAK");
+
+		return DHCPStatusNAK;
+	}
+
+	if (!CheckConfig ())
+	{
+		return DHCPStatusConfigError;
+	}
+
+	if (   m_nOwnIPAddress != m_nRxYIAddr
+	    || m_nRxServerIdentifier == 0)
+	{
+		CLogger::Get ()->Write (FromDHCPClient, LogWarning, "IP address has changed");
+
+		return DHCPStatusConfigChanged;
+	}
+
+	m_nServerIdentifier = m_nRxServerIdentifier;
+
+	assert (m_pNetConfig != 0);
+	m_pNetConfig->SetNetMask (m_nRxSubnetMask);
+	m_pNetConfig->SetDefaultGateway (m_nRxRouter);
+	m_pNetConfig->SetDNSServer (m_nRxDNSServer);
+
+	m_nIPAddressLeaseTime = m_nRxIPAddressLeaseTime;
+	m_nRenewalTimeValue   = m_nRxRenewalTimeValue;
+	m_nRebindingTimeValue = m_nRxRebindingTimeValue;
+
+	m_nBoundSince = CTimer::Get ()->GetUptime ();
+
+	CLogger::Get ()->Write (FromDHCPClient, LogDebug, "Lease confirmed");
+
+	return DHCPStatusSuccess;
+}
+
 TDHCPStatus CDHCPClient::SelectAndRequest (void)
 {
 	m_bUseBroadcast = TRUE;
@@ -509,7 +697,30 @@ boolean CDHCPClient::SendRequest (u32 nCIAddr)
 	const u8 *pOptions;
 	unsigned nOptionsSize;
 
-	if (nCIAddr == 0)
+	if (m_bInitReboot)
+	{
+		// RFC 2131 section 4.3.2: without server identifier
+		static u8 Options[] =
+		{
+			DHCP_OPTION_MSGTYPE,   1, DHCP_OPTION_MSGTYPE_REQUEST,
+			DHCP_OPTION_REQIPADDR, 4, 0, 0, 0, 0,
+#define REBOOT_OFFSET_REQIPADDR	5
+			DHCP_OPTION_PARMLIST,  6,
+				DHCP_OPTION_SUBNETMASK,
+				DHCP_OPTION_ROUTER,
+				DHCP_OPTION_DNSSERVER,
+				DHCP_OPTION_LEASETIME,
+				DHCP_OPTION_RENEWALTIME,
+				DHCP_OPTION_REBINDTIME,
+			DHCP_OPTION_END
+		};
+
+		SetUnaligned (Options+REBOOT_OFFSET_REQIPADDR, m_nOwnIPAddress);
+
+		pOptions = Options;
+		nOptionsSize = sizeof Options;
+	}
+	else if (nCIAddr == 0)
 	{
 		static u8 Options[] =
 		{
@@ -2,7 +2,7 @@
 // dnsclient.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,11 +21,13 @@
 #include <circle/net/socket.h>
 #include <circle/net/in.h>
 #include <circle/sched/scheduler.h>
+#include <circle/sched/task.h>
+#include <circle/string.h>
+#include <circle/timer.h>
 #include <circle/macros.h>
 #include <circle/util.h>
 #include <assert.h>
 
-#define MAX_HOSTNAME_SIZE	256
 #define DNS_MAX_MESSAGE_SIZE	512
 
 struct TDNSHeader
@@ -78,8 +80,49 @@ PACKED;
 #define DNS_RR_TRAILER_HEADER_LENGTH	( sizeof (struct TDNSResourceRecordTrailerAIN) \
 					 - DNS_RDLENGTH_AIN)
 
+#define DNS_PORT		53
+#define DNS_TRIES		3
+#define DNS_TIMEOUT_MS		1000		// per try
+#define DNS_POLL_MS		10
+
+class CDNSResolveTask : public CTask	// resolves a host name for CDNSClient::ResolveAsync()
+{
+public:
+	CDNSResolveTask (CNetSubSystem *pNetSubSystem, const char *pHostname,
+			 TDNSResolveHandler *pHandler, void *pParam)
+	:	m_pNetSubSystem (pNetSubSystem),
+		m_Hostname (pHostname),
+		m_pHandler (pHandler),
+		m_pParam (pParam)
+	{
+		SetName ("dnsresolve");
+	}
+
+	void Run (void)
+	{
+		CDNSClient DNSClient (m_pNetSubSystem);
+
+		CIPAddress IPAddress;
+		boolean bOK = DNSClient.Resolve (m_Hostname, &IPAddress);
+
+		assert (m_pHandler != 0);
+		(*m_pHandler) (bOK, IPAddress, m_pParam);
+	}
+
+private:
+	CNetSubSystem *m_pNetSubSystem;
+	CString m_Hostname;
+	TDNSResolveHandler *m_pHandler;
+	void *m_pParam;
+};
+
 u16 CDNSClient::s_nXID = 1;
 
+CDNSClient::TCacheEntry CDNSClient::s_Cache[DNS_CACHE_SIZE];
+
+CIPAddress CDNSClient::s_Server[DNS_MAX_SERVERS-1];
+unsigned CDNSClient::s_nServers = 0;
+
 CDNSClient::CDNSClient (CNetSubSystem *pNetSubSystem)
 :	m_pNetSubSystem (pNetSubSystem)
 {
@@ -94,6 +137,7 @@ CDNSClient::~CDNSClient (void)
 boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 {
 	assert (pHostname != 0);
+	assert (pIPAddress != 0);
 
 	if ('1' <= *pHostname && *pHostname <= '9')
 	{
@@ -103,34 +147,244 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 		}
 	}
 
-	assert (m_pNetSubSystem != 0);
-	CIPAddress DNSServer (m_pNetSubSystem->GetConfig ()->GetDNSServer ()->Get ());
-	if (DNSServer.IsNull ())
+	if (strlen (pHostname) >= DNS_MAX_HOSTNAME_SIZE)
 	{
 		return FALSE;
 	}
 
-	CSocket Socket (m_pNetSubSystem, IPPROTO_UDP);
-	if (Socket.Connect (DNSServer, 53) != 0)
+	CScheduler *pScheduler = CScheduler::Get ();
+	assert (pScheduler != 0);
+
+	TCacheEntry *pEntry;
+	while (   (pEntry = LookupCache (pHostname)) != 0
+	       && pEntry->bPending)
+	{
+		// another task is resolving this host name, wait for its result
+		pScheduler->MsSleep (DNS_POLL_MS);
+	}
+
+	if (pEntry != 0)
+	{
+		if (!pEntry->bValid)
+		{
+			return FALSE;
+		}
+
+		pIPAddress->Set (pEntry->IPAddress);
+
+		return TRUE;
+	}
+
+	pEntry = AllocateCacheEntry (pHostname);
+	assert (pEntry != 0);
+	assert (pEntry->bPending);
+
+	unsigned nTTL = 0;
+	TQueryStatus Status = Query (pHostname, pIPAddress, &nTTL);
+
+	CTimer *pTimer = CTimer::Get ();
+	assert (pTimer != 0);
+
+	switch (Status)
+	{
+	case QueryStatusSuccess:
+		pEntry->bValid = TRUE;
+		pEntry->IPAddress.Set (*pIPAddress);
+		pEntry->nExpires = pTimer->GetUptime () + (nTTL < DNS_MAX_TTL ? nTTL : DNS_MAX_TTL);
+		break;
+
+	case QueryStatusNameError:
+		pEntry->bValid = FALSE;
+		pEntry->nExpires = pTimer->GetUptime () + DNS_NEGATIVE_TTL;
+		break;
+
+	default:
+		pEntry->Hostname[0] = '\0';		// do not cache failures
+		break;
+	}
+
+	pEntry->bPending = FALSE;
+
+	return Status == QueryStatusSuccess;
+}
+
+void CDNSClient::ResolveAsync (const char *pHostname, TDNSResolveHandler *pHandler, void *pParam)
+{
+	assert (pHostname != 0);
+	assert (pHandler != 0);
+
+	CIPAddress IPAddress;
+	if (   '1' <= *pHostname && *pHostname <= '9'
+	    && ConvertIPString (pHostname, &IPAddress))
+	{
+		(*pHandler) (TRUE, IPAddress, pParam);
+
+		return;
+	}
+
+	TCacheEntry *pEntry = LookupCache (pHostname);
+	if (   pEntry != 0
+	    && !pEntry->bPending)
+	{
+		if (pEntry->bValid)
+		{
+			IPAddress.Set (pEntry->IPAddress);
+		}
+
+		(*pHandler) (pEntry->bValid, IPAddress, pParam);
+
+		return;
+	}
+
+	new CDNSResolveTask (m_pNetSubSystem, pHostname, pHandler, pParam);
+}
+
+boolean CDNSClient::AddServer (const CIPAddress &rServerIP)
+{
+	if (s_nServers >= DNS_MAX_SERVERS-1)
 	{
 		return FALSE;
 	}
 
-	u8 Buffer[DNS_MAX_MESSAGE_SIZE];
-	memset (Buffer, 0, sizeof Buffer);
-	TDNSHeader *pDNSHeader = (TDNSHeader *) Buffer;
+	s_Server[s_nServers++].Set (rServerIP);
+
+	return TRUE;
+}
 
+void CDNSClient::FlushCache (void)
+{
+	for (unsigned i = 0; i < DNS_CACHE_SIZE; i++)
+	{
+		if (!s_Cache[i].bPending)
+		{
+			s_Cache[i].Hostname[0] = '\0';
+		}
+	}
+}
+
+CDNSClient::TQueryStatus CDNSClient::Query (const char *pHostname, CIPAddress *pIPAddress,
+					    unsigned *pTTL)
+{
+	u8 Buffer[DNS_MAX_MESSAGE_SIZE];
 	u16 nXID = s_nXID++;
+	int nSize = BuildQuery (pHostname, nXID, Buffer);
+	if (nSize <= 0)
+	{
+		return QueryStatusFailed;
+	}
+
+	// collect the DNS servers
+	assert (m_pNetSubSystem != 0);
+	CIPAddress Server[DNS_MAX_SERVERS];
+	unsigned nServers = 0;
+
+	const CIPAddress *pConfigServer = m_pNetSubSystem->GetConfig ()->GetDNSServer ();
+	assert (pConfigServer != 0);
+	if (!pConfigServer->IsNull ())
+	{
+		Server[nServers++].Set (*pConfigServer);
+	}
+
+	for (unsigned i = 0; i < s_nServers; i++)
+	{
+		if (   !s_Server[i].IsNull ()
+		    && (nServers == 0 || s_Server[i] != Server[0]))
+		{
+			Server[nServers++].Set (s_Server[i]);
+		}
+	}
+
+	if (nServers == 0)
+	{
+		return QueryStatusFailed;
+	}
+
+	CSocket *pSocket[DNS_MAX_SERVERS];
+	for (unsigned i = 0; i < nServers; i++)
+	{
+		pSocket[i] = new CSocket (m_pNetSubSystem, IPPROTO_UDP);
+		assert (pSocket[i] != 0);
+
+		if (pSocket[i]->Connect (Server[i], DNS_PORT) != 0)
+		{
+			delete pSocket[i];
+			pSocket[i] = 0;
+		}
+	}
+
+	CScheduler *pScheduler = CScheduler::Get ();
+	assert (pScheduler != 0);
+
+	TQueryStatus Status = QueryStatusFailed;
+	for (unsigned nTry = 1; nTry <= DNS_TRIES && Status == QueryStatusFailed; nTry++)
+	{
+		// send the query to all servers in parallel
+		boolean bSent = FALSE;
+		for (unsigned i = 0; i < nServers; i++)
+		{
+			if (   pSocket[i] != 0
+			    && pSocket[i]->Send (Buffer, nSize, MSG_DONTWAIT) == nSize)
+			{
+				bSent = TRUE;
+			}
+		}
+
+		if (!bSent)
+		{
+			break;
+		}
+
+		// wait for the first valid response
+		for (unsigned nTime = 0;
+		     nTime < DNS_TIMEOUT_MS && Status == QueryStatusFailed;
+		     nTime += DNS_POLL_MS)
+		{
+			pScheduler->MsSleep (DNS_POLL_MS);
+
+			for (unsigned i = 0; i < nServers && Status == QueryStatusFailed; i++)
+			{
+				if (pSocket[i] == 0)
+				{
+					continue;
+				}
+
+				u8 RecvBuffer[FRAME_BUFFER_SIZE];
+				int nRecvSize;
+				while (   Status == QueryStatusFailed
+				       && (nRecvSize = pSocket[i]->Receive (RecvBuffer, sizeof RecvBuffer,
+									    MSG_DONTWAIT)) > 0)
+				{
+					Status = ParseResponse (RecvBuffer, nRecvSize, nXID,
+								pIPAddress, pTTL);
+				}
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < nServers; i++)
+	{
+		delete pSocket[i];
+	}
+
+	return Status;
+}
+
+int CDNSClient::BuildQuery (const char *pHostname, u16 nXID, u8 *pBuffer)
+{
+	assert (pBuffer != 0);
+	memset (pBuffer, 0, DNS_MAX_MESSAGE_SIZE);
+	TDNSHeader *pDNSHeader = (TDNSHeader *) pBuffer;
 
 	pDNSHeader->nID      = le2be16 (nXID);
 	pDNSHeader->nFlags   = BE (DNS_FLAGS_OPCODE_QUERY | DNS_FLAGS_RD);
 	pDNSHeader->nQDCount = BE (1);
 
-	u8 *pQuery = Buffer + sizeof (TDNSHeader);
+	u8 *pQuery = pBuffer + sizeof (TDNSHeader);
 
-	char Hostname[MAX_HOSTNAME_SIZE];
-	strncpy (Hostname, pHostname, MAX_HOSTNAME_SIZE-1);
-	Hostname[MAX_HOSTNAME_SIZE-1] = '\0';
+	char Hostname[DNS_MAX_HOSTNAME_SIZE];
+	assert (pHostname != 0);
+	strncpy (Hostname, pHostname, DNS_MAX_HOSTNAME_SIZE-1);
+	Hostname[DNS_MAX_HOSTNAME_SIZE-1] = '\0';
 
 	char *pSavePtr;
 	size_t nLength;
@@ -139,9 +393,9 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 	{
 		nLength = strlen (pLabel);
 		if (   nLength > 255
-		    || (int) (nLength+1+1) >= DNS_MAX_MESSAGE_SIZE-(pQuery-Buffer))
+		    || (int) (nLength+1+1) >= DNS_MAX_MESSAGE_SIZE-(pQuery-pBuffer))
 		{
-			return FALSE;
+			return -1;
 		}
 
 		*pQuery++ = (u8) nLength;
@@ -158,68 +412,68 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 	QueryTrailer.nQType  = BE (DNS_QTYPE_A);
 	QueryTrailer.nQClass = BE (DNS_QCLASS_IN);
 
-	if ((int) (sizeof QueryTrailer) > DNS_MAX_MESSAGE_SIZE-(pQuery-Buffer))
+	if ((int) (sizeof QueryTrailer) > DNS_MAX_MESSAGE_SIZE-(pQuery-pBuffer))
 	{
-		return FALSE;
+		return -1;
 	}
 	memcpy (pQuery, &QueryTrailer, sizeof QueryTrailer);
 	pQuery += sizeof QueryTrailer;
-	
-	int nSize = pQuery - Buffer;
+
+	int nSize = pQuery - pBuffer;
 	assert (nSize <= DNS_MAX_MESSAGE_SIZE);
 
-	unsigned char RecvBuffer[DNS_MAX_MESSAGE_SIZE];
-	int nRecvSize;
+	return nSize;
+}
 
-	unsigned nTry = 1;
-	do
+CDNSClient::TQueryStatus CDNSClient::ParseResponse (const u8 *pBuffer, int nSize, u16 nXID,
+						    CIPAddress *pIPAddress, unsigned *pTTL)
+{
+	assert (pBuffer != 0);
+	if (nSize < (int) sizeof (TDNSHeader))
 	{
-		if (   nTry++ > 3
-		    || Socket.Send (Buffer, nSize, 0) != nSize)
-		{
-			return FALSE;
-		}
-
-		CScheduler::Get ()->MsSleep (1000);
-
-		nRecvSize = Socket.Receive (RecvBuffer, DNS_MAX_MESSAGE_SIZE, MSG_DONTWAIT);
-		assert (nRecvSize < DNS_MAX_MESSAGE_SIZE);
-		if (nRecvSize < 0)
-		{
-			return FALSE;
-		}
+		return QueryStatusFailed;
 	}
-	while (nRecvSize < (int) (sizeof (TDNSHeader)+sizeof (TDNSResourceRecordTrailerAIN)));
 
-	pDNSHeader = (TDNSHeader *) RecvBuffer;
+	TDNSHeader *pDNSHeader = (TDNSHeader *) pBuffer;
 	if (   pDNSHeader->nID != le2be16 (nXID)
 	    ||    (pDNSHeader->nFlags & BE (  DNS_FLAGS_QR
 	                                    | DNS_FLAGS_OPCODE
-	                                    | DNS_FLAGS_TC
-	                                    | DNS_FLAGS_RCODE))
-	       != BE (DNS_FLAGS_QR | DNS_FLAGS_OPCODE_QUERY | DNS_RCODE_SUCCESS)
-	    || pDNSHeader->nQDCount != BE (1)
-	    || pDNSHeader->nANCount == BE (0))
+	                                    | DNS_FLAGS_TC))
+	       != BE (DNS_FLAGS_QR | DNS_FLAGS_OPCODE_QUERY)
+	    || pDNSHeader->nQDCount != BE (1))
 	{
-		return FALSE;
+		return QueryStatusFailed;
+	}
+
+	if ((pDNSHeader->nFlags & BE (DNS_FLAGS_RCODE)) == BE (DNS_RCODE_NAME_ERROR))
+	{
+		return QueryStatusNameError;
+	}
+
+	if (   (pDNSHeader->nFlags & BE (DNS_FLAGS_RCODE)) != BE (DNS_RCODE_SUCCESS)
+	    || pDNSHeader->nANCount == BE (0)
+	    || nSize < (int) (sizeof (TDNSHeader)+sizeof (TDNSResourceRecordTrailerAIN)))
+	{
+		return QueryStatusFailed;
 	}
 
-	u8 *pResponse = RecvBuffer + sizeof (TDNSHeader);
+	const u8 *pResponse = pBuffer + sizeof (TDNSHeader);
 
 	// parse the query section
+	size_t nLength;
 	while ((nLength = *pResponse++) > 0)
 	{
 		pResponse += nLength;
-		if (pResponse-RecvBuffer >= nRecvSize)
+		if (pResponse-pBuffer >= nSize)
 		{
-			return FALSE;
+			return QueryStatusFailed;
 		}
 	}
 
 	pResponse += sizeof (TDNSQueryTrailer);
-	if (pResponse-RecvBuffer >= nRecvSize)
+	if (pResponse-pBuffer >= nSize)
 	{
-		return FALSE;
+		return QueryStatusFailed;
 	}
 
 	TDNSResourceRecordTrailerAIN RRTrailer;
@@ -237,17 +491,17 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 			do
 			{
 				pResponse += nLength;
-				if (pResponse-RecvBuffer >= nRecvSize)
+				if (pResponse-pBuffer >= nSize)
 				{
-					return FALSE;
+					return QueryStatusFailed;
 				}
 			}
 			while ((nLength = *pResponse++) > 0);
 		}
 
-		if (pResponse-RecvBuffer > (int) (nRecvSize-sizeof RRTrailer))
+		if (pResponse-pBuffer > (int) (nSize-sizeof RRTrailer))
 		{
-			return FALSE;
+			return QueryStatusFailed;
 		}
 
 		memcpy (&RRTrailer, pResponse, sizeof RRTrailer);
@@ -260,16 +514,90 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 		}
 
 		pResponse += DNS_RR_TRAILER_HEADER_LENGTH + BE (RRTrailer.nRDLength);
-		if (pResponse-RecvBuffer >= nRecvSize)
+		if (pResponse-pBuffer >= nSize)
 		{
-			return FALSE;
+			return QueryStatusFailed;
 		}
 	}
 
 	assert (pIPAddress != 0);
 	pIPAddress->Set (RRTrailer.RData);
 
-	return TRUE;
+	assert (pTTL != 0);
+	*pTTL = be2le32 (RRTrailer.nTTL);
+
+	return QueryStatusSuccess;
+}
+
+CDNSClient::TCacheEntry *CDNSClient::LookupCache (const char *pHostname)
+{
+	assert (pHostname != 0);
+
+	unsigned nUptime = CTimer::Get ()->GetUptime ();
+
+	for (unsigned i = 0; i < DNS_CACHE_SIZE; i++)
+	{
+		TCacheEntry *pEntry = &s_Cache[i];
+
+		if (   pEntry->Hostname[0] == '\0'
+		    || strcasecmp (pEntry->Hostname, pHostname) != 0)
+		{
+			continue;
+		}
+
+		if (   !pEntry->bPending
+		    && (int) (pEntry->nExpires - nUptime) <= 0)
+		{
+			pEntry->Hostname[0] = '\0';		// expired
+
+			return 0;
+		}
+
+		return pEntry;
+	}
+
+	return 0;
+}
+
+CDNSClient::TCacheEntry *CDNSClient::AllocateCacheEntry (const char *pHostname)
+{
+	assert (pHostname != 0);
+
+	unsigned nUptime = CTimer::Get ()->GetUptime ();
+
+	// use a free or expired entry, or the entry, which expires next
+	TCacheEntry *pEntry = 0;
+	for (unsigned i = 0; i < DNS_CACHE_SIZE; i++)
+	{
+		TCacheEntry *pThisEntry = &s_Cache[i];
+		if (pThisEntry->bPending)
+		{
+			continue;
+		}
+
+		if (   pThisEntry->Hostname[0] == '\0'
+		    || (int) (pThisEntry->nExpires - nUptime) <= 0)
+		{
+			pEntry = pThisEntry;
+
+			break;
+		}
+
+		if (   pEntry == 0
+		    || (int) (pThisEntry->nExpires - pEntry->nExpires) < 0)
+		{
+			pEntry = pThisEntry;
+		}
+	}
+
+	assert (pEntry != 0);		// too many parallel queries otherwise
+
+	strncpy (pEntry->Hostname, pHostname, DNS_MAX_HOSTNAME_SIZE-1);
+	pEntry->Hostname[DNS_MAX_HOSTNAME_SIZE-1] = '\0';
+	pEntry->bPending = TRUE;
+	pEntry->bValid = FALSE;
+
+	return pEntry;
 }
 
 boolean CDNSClient::ConvertIPString (const char *pIPString, CIPAddress *pIPAddress)
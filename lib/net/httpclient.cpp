@@ -2,7 +2,7 @@
 // httpclient.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,13 +19,23 @@
 //
 #include <circle/net/httpclient.h>
 #include <circle/netdevice.h>
+#include <circle/timer.h>
 #include <circle/util.h>
 #include <circle/net/in.h>
 #include <assert.h>
 
-#define CLIENT_VERSION	"0.02"
+#define CLIENT_VERSION	"0.03"
 #define USER_AGENT	"CHTTPClient/" CLIENT_VERSION " (Circle)"
 
+struct TBufferParam
+{
+	u8	 *pBuffer;
+	unsigned  nSize;
+	unsigned  nLength;
+};
+
+CHTTPClient::TPoolEntry CHTTPClient::s_Pool[HTTP_CLIENT_POOL_SIZE];
+
 CHTTPClient::CHTTPClient (CNetSubSystem	*pNetSubSystem,
 			  CIPAddress	&rServerIP,
 			  u16	    	 nServerPort,
@@ -34,6 +44,7 @@ CHTTPClient::CHTTPClient (CNetSubSystem	*pNetSubSystem,
 	m_ServerIP (rServerIP),
 	m_ServerPort (nServerPort),
 	m_ServerName (pServerName),
+	m_bKeepAlive (TRUE),
 	m_pSocket (0)
 {
 }
@@ -48,35 +59,72 @@ CHTTPClient::~CHTTPClient (void)
 
 THTTPStatus CHTTPClient::Get (const char *pPath, u8 *pBuffer, unsigned *pLength)
 {
-	return Request (HTTPRequestMethodGet, pPath, pBuffer, pLength);
+	assert (pLength != 0);
+	TBufferParam Param = {pBuffer, *pLength, 0};
+
+	THTTPStatus Status = Request (HTTPRequestMethodGet, pPath, 0, BufferHandler, &Param);
+	if (Status == HTTPRequestAborted)
+	{
+		return HTTPContentBufferTooSmall;
+	}
+
+	*pLength = Param.nLength;
+
+	return Status;
 }
 
 THTTPStatus CHTTPClient::Post (const char *pPath, u8 *pBuffer, unsigned *pLength, const char *pFormData)
 {
 	assert (pFormData != 0);
-	return Request (HTTPRequestMethodPost, pPath, pBuffer, pLength, pFormData);
+	assert (pLength != 0);
+	TBufferParam Param = {pBuffer, *pLength, 0};
+
+	THTTPStatus Status = Request (HTTPRequestMethodPost, pPath, pFormData, BufferHandler, &Param);
+	if (Status == HTTPRequestAborted)
+	{
+		return HTTPContentBufferTooSmall;
+	}
+
+	*pLength = Param.nLength;
+
+	return Status;
 }
 
-THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
-				  const char	     *pPath,
-				  u8		     *pBuffer,
-				  unsigned	     *pLength,
-				  const char	     *pFormData)
+THTTPStatus CHTTPClient::GetStream (const char *pPath, THTTPContentHandler *pHandler, void *pParam)
 {
-	// connect to server
-	assert (m_pNetSubSystem != 0);
-	assert (m_pSocket == 0);
-	m_pSocket = new CSocket (m_pNetSubSystem, IPPROTO_TCP);
-	assert (m_pSocket != 0);
-	if (m_pSocket->Connect (m_ServerIP, m_ServerPort) < 0)
-	{
-		delete m_pSocket;
-		m_pSocket = 0;
+	assert (pHandler != 0);
+	return Request (HTTPRequestMethodGet, pPath, 0, pHandler, pParam);
+}
+
+THTTPStatus CHTTPClient::PostStream (const char *pPath, const char *pFormData,
+				     THTTPContentHandler *pHandler, void *pParam)
+{
+	assert (pFormData != 0);
+	assert (pHandler != 0);
+	return Request (HTTPRequestMethodPost, pPath, pFormData, pHandler, pParam);
+}
 
-		return HTTPRequestTimeout;
+void CHTTPClient::SetKeepAlive (boolean bKeepAlive)
+{
+	m_bKeepAlive = bKeepAlive;
+}
+
+void CHTTPClient::CloseIdleConnections (void)
+{
+	for (unsigned i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+	{
+		delete s_Pool[i].pSocket;
+		s_Pool[i].pSocket = 0;
 	}
+}
 
-	// send HTTP request
+THTTPStatus CHTTPClient::Request (THTTPRequestMethod   Method,
+				  const char	      *pPath,
+				  const char	      *pFormData,
+				  THTTPContentHandler *pHandler,
+				  void		      *pParam)
+{
+	// build HTTP request
 	const char *pMethod = 0;
 	switch (Method)
 	{
@@ -101,7 +149,7 @@ THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
 	}
 
 	Request.Append ("User-Agent: " USER_AGENT "\r\n");
-	Request.Append ("Connection: close\r\n");
+	Request.Append (m_bKeepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
 
 	if (pFormData != 0)
 	{
@@ -119,20 +167,52 @@ THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
 		Request.Append (pFormData);
 	}
 
-	if (m_pSocket->Send (Request, Request.GetLength (), 0) < 0)
+	// a pooled connection may have been closed by the server meanwhile,
+	// retry with a new connection then
+	while (1)
 	{
-		delete m_pSocket;
-		m_pSocket = 0;
+		boolean bReused;
+		if (!OpenConnection (&bReused))
+		{
+			return HTTPRequestTimeout;
+		}
 
-		return HTTPConnectionReset;
+		assert (m_pSocket != 0);
+		if (m_pSocket->Send (Request, Request.GetLength (), 0) < 0)
+		{
+			ReleaseConnection (FALSE);
+
+			if (bReused)
+			{
+				continue;
+			}
+
+			return HTTPConnectionReset;
+		}
+
+		boolean bResponseStarted = FALSE;
+		THTTPStatus Status = ReceiveResponse (pHandler, pParam, &bResponseStarted);
+		if (   Status == HTTPConnectionReset
+		    && bReused
+		    && !bResponseStarted)
+		{
+			continue;
+		}
+
+		return Status;
 	}
+}
 
+THTTPStatus CHTTPClient::ReceiveResponse (THTTPContentHandler *pHandler, void *pParam,
+					  boolean *pResponseStarted)
+{
 	// receive HTTP response and parse it
 	unsigned nState = 0;
 	unsigned nLine = 0;
 	unsigned nChar = 0;
-	unsigned nLength = 0;
 	boolean bChunked = FALSE;
+	boolean bKeepAlive = TRUE;
+	boolean bContentLength = FALSE;
 	unsigned long ulBytes = 0;
 
 	char Buffer[FRAME_BUFFER_SIZE];
@@ -140,10 +220,16 @@ THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
 	int nResult;
 	char *pSavePtr;
 
-	while (   nState < 5
+	assert (m_pSocket != 0);
+	assert (pHandler != 0);
+	assert (pResponseStarted != 0);
+
+	while (   nState < 6
 	       && (nResult = m_pSocket->Receive (Buffer, sizeof Buffer, 0)) > 0)
 	{
-		for (int i = 0; i < nResult; i++)
+		*pResponseStarted = TRUE;
+
+		for (int i = 0; i < nResult && nState < 6; i++)
 		{
 			u8 chChar = Buffer[i];
 
@@ -159,8 +245,19 @@ THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
 				{
 					if (nChar == 0)		// empty line is end of header
 					{
-						nState = bChunked ? 2 : 1;
-						nChar = 0;
+						if (bChunked)
+						{
+							nState = 2;
+						}
+						else if (bContentLength)
+						{
+							nState = ulBytes != 0 ? 1 : 6;
+						}
+						else
+						{
+							nState = 1;	// read until connection is closed
+							bKeepAlive = FALSE;
+						}
 					}
 					else
 					{
@@ -170,43 +267,76 @@ THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
 							char *pToken;
 							if (   (pToken = strtok_r (Line, "/", &pSavePtr)) == 0
 							    || strcmp (pToken, "HTTP") != 0
-							    || (pToken = strtok_r (0, " ", &pSavePtr)) == 0
-							    || (pToken = strtok_r (0, " ", &pSavePtr)) == 0
+							    || (pToken = strtok_r (0, " ", &pSavePtr)) == 0)
+							{
+								ReleaseConnection (FALSE);
+
+								return HTTPInvalidResponseCode;
+							}
+
+							if (strcmp (pToken, "1.0") == 0)
+							{
+								bKeepAlive = FALSE;
+							}
+
+							if (   (pToken = strtok_r (0, " ", &pSavePtr)) == 0
 							    || strcmp (pToken, "200") != 0)
 							{
-								char *pEnd;
-								unsigned long ulStatus;
-								ulStatus = strtoul (pToken, &pEnd, 10);
-								if (   pEnd != 0
-								    && *pEnd != '\0')
+								unsigned long ulStatus = HTTPInvalidResponseCode;
+								if (pToken != 0)
 								{
-									ulStatus = HTTPInvalidResponseCode;
+									char *pEnd;
+									ulStatus = strtoul (pToken, &pEnd, 10);
+									if (   pEnd != 0
+									    && *pEnd != '\0')
+									{
+										ulStatus = HTTPInvalidResponseCode;
+									}
 								}
 
-								delete m_pSocket;
-								m_pSocket = 0;
+								ReleaseConnection (FALSE);
 
 								return (THTTPStatus) ulStatus;
 							}
 						}
 						else
 						{
-							// check for transfer encoding option
+							// check for transfer encoding, content length
+							// and connection options
 							char *pToken = strtok_r (Line, ": ", &pSavePtr);
-							if (   pToken != 0
-							    && strcasecmp (pToken, "Transfer-Encoding") == 0)
+							if (pToken != 0)
 							{
-								pToken = strtok_r (0, " ", &pSavePtr);
-								if (pToken != 0
-								    && strcasecmp (pToken, "chunked") == 0)
+								char *pValue = strtok_r (0, " ", &pSavePtr);
+								if (pValue == 0)
+								{
+									// ignore empty option
+								}
+								else if (strcasecmp (pToken, "Transfer-Encoding") == 0)
+								{
+									if (strcasecmp (pValue, "chunked") == 0)
+									{
+										bChunked = TRUE;
+									}
+								}
+								else if (strcasecmp (pToken, "Content-Length") == 0)
 								{
-									bChunked = TRUE;
+									char *pEnd;
+									ulBytes = strtoul (pValue, &pEnd, 10);
+									bContentLength =    pEnd != 0
+											 && *pEnd == '\0';
+								}
+								else if (strcasecmp (pToken, "Connection") == 0)
+								{
+									if (strcasecmp (pValue, "close") == 0)
+									{
+										bKeepAlive = FALSE;
+									}
 								}
 							}
 						}
-
-						nChar = 0;
 					}
+
+					nChar = 0;
 				}
 				else
 				{
@@ -219,19 +349,35 @@ THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
 				}
 				break;
 
-			case 1:				// non-chunked data: simply copy it
-				assert (pLength != 0);
-				if (nLength >= *pLength)
+			case 1:				// non-chunked data
+			case 3: {			// chunk data
+				// hand over as much data as available at once
+				unsigned nLength = nResult-i;
+				if (   (nState == 3 || bContentLength)
+				    && nLength > ulBytes)
+				{
+					nLength = ulBytes;
+				}
+
+				if (!(*pHandler) ((const u8 *) &Buffer[i], nLength, pParam))
 				{
-					delete m_pSocket;
-					m_pSocket = 0;
+					ReleaseConnection (FALSE);
 
-					return HTTPContentBufferTooSmall;
+					return HTTPRequestAborted;
 				}
 
-				*pBuffer++ = (u8) chChar;
-				nLength++;
-				break;
+				i += nLength-1;
+
+				if (   nState == 3
+				    || bContentLength)
+				{
+					ulBytes -= nLength;
+					if (ulBytes == 0)
+					{
+						nState = nState == 3 ? 4 : 6;
+					}
+				}
+				} break;
 
 			case 2:				// chunk header
 				if (chChar == '\r')
@@ -241,17 +387,25 @@ THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
 
 				if (chChar == '\n')	// end of header?
 				{
+					Line[nChar] = '\0';
+					char *pExtension = strchr (Line, ';');
+					if (pExtension != 0)
+					{
+						*pExtension = '\0';	// ignore chunk extensions
+					}
+
 					char *pEnd;
 					ulBytes = strtoul (Line, &pEnd, 16);	// convert chunk length
-					if (   pEnd != 0
-					    && *pEnd != '\0')
+					if (   nChar == 0
+					    || (   pEnd != 0
+					        && *pEnd != '\0'))
 					{
-						delete m_pSocket;
-						m_pSocket = 0;
+						ReleaseConnection (FALSE);
 
 						return HTTPInvalidChunkHeader;
 					}
 
+					nChar = 0;
 					nState = ulBytes != 0 ? 3 : 5;	// length 0 is end of file
 				}
 				else
@@ -260,67 +414,182 @@ THTTPStatus CHTTPClient::Request (THTTPRequestMethod  Method,
 					if (nChar < sizeof Line-1)
 					{
 						Line[nChar++] = chChar;
-						Line[nChar] = '\0';
 					}
 				}
 				break;
 
-			case 3:				// chunk data: copy ulBytes
-				assert (pLength != 0);
-				if (nLength >= *pLength)
+			case 4:				// chunk trailer
+				if (chChar == '\r')
 				{
-					delete m_pSocket;
-					m_pSocket = 0;
-
-					return HTTPContentBufferTooSmall;
+					continue;
 				}
 
-				*pBuffer++ = (u8) chChar;
-				nLength++;
-
-				if (--ulBytes == 0)
+				if (chChar != '\n')	// newline expected
 				{
-					nState = 4;
+					ReleaseConnection (FALSE);
+
+					return HTTPInvalidChunkHeader;
 				}
+
+				nState = 2;
 				break;
 
-			case 4:				// chunk trailer
+			case 5:				// trailer lines after last chunk
 				if (chChar == '\r')
 				{
 					continue;
 				}
 
-				if (chChar != '\n')	// newline expected
+				if (chChar == '\n')
 				{
-					delete m_pSocket;
-					m_pSocket = 0;
+					if (nChar == 0)	// empty line is end of message
+					{
+						nState = 6;
+					}
 
-					return HTTPInvalidChunkHeader;
+					nChar = 0;
+				}
+				else
+				{
+					nChar++;
 				}
-
-				nChar = 0;
-				nState = 2;
 				break;
 			}
 		}
 	}
 
-	// close everything and exit
-	if (   nState < 5
-	    && nState != 1)
+	if (nState < 6)
+	{
+		// without length information the content ends, when the connection is closed
+		if (   nState == 1
+		    && !bContentLength)
+		{
+			ReleaseConnection (FALSE);
+
+			return HTTPOK;
+		}
+
+		ReleaseConnection (FALSE);
+
+		return HTTPConnectionReset;
+	}
+
+	ReleaseConnection (bKeepAlive);
+
+	return HTTPOK;
+}
+
+boolean CHTTPClient::OpenConnection (boolean *pReused)
+{
+	assert (m_pSocket == 0);
+	assert (pReused != 0);
+	*pReused = FALSE;
+
+	// take an idle connection to this server from the pool, close expired ones
+	unsigned nTicks = CTimer::Get ()->GetTicks ();
+	for (unsigned i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+	{
+		TPoolEntry *pEntry = &s_Pool[i];
+		if (pEntry->pSocket == 0)
+		{
+			continue;
+		}
+
+		if (nTicks - pEntry->nIdleSince >= HTTP_CLIENT_IDLE_TIMEOUT * HZ)
+		{
+			delete pEntry->pSocket;
+			pEntry->pSocket = 0;
+
+			continue;
+		}
+
+		if (   m_pSocket == 0
+		    && m_bKeepAlive
+		    && pEntry->ServerIP == m_ServerIP
+		    && pEntry->ServerPort == m_ServerPort)
+		{
+			m_pSocket = pEntry->pSocket;
+			pEntry->pSocket = 0;
+
+			*pReused = TRUE;
+		}
+	}
+
+	if (m_pSocket != 0)
+	{
+		return TRUE;
+	}
+
+	// connect to server
+	assert (m_pNetSubSystem != 0);
+	m_pSocket = new CSocket (m_pNetSubSystem, IPPROTO_TCP);
+	assert (m_pSocket != 0);
+	if (m_pSocket->Connect (m_ServerIP, m_ServerPort) < 0)
 	{
 		delete m_pSocket;
 		m_pSocket = 0;
 
-		return HTTPConnectionReset;
+		return FALSE;
 	}
 
-	delete m_pSocket;
+	return TRUE;
+}
+
+void CHTTPClient::ReleaseConnection (boolean bKeepAlive)
+{
+	if (   !bKeepAlive
+	    || !m_bKeepAlive)
+	{
+		delete m_pSocket;
+		m_pSocket = 0;
+
+		return;
+	}
+
+	// put the connection into the pool, replace the oldest entry, if it is full
+	unsigned nTicks = CTimer::Get ()->GetTicks ();
+	TPoolEntry *pEntry = 0;
+	for (unsigned i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+	{
+		if (s_Pool[i].pSocket == 0)
+		{
+			pEntry = &s_Pool[i];
+
+			break;
+		}
+
+		if (   pEntry == 0
+		    || nTicks - s_Pool[i].nIdleSince > nTicks - pEntry->nIdleSince)
+		{
+			pEntry = &s_Pool[i];
+		}
+	}
+
+	assert (pEntry != 0);
+	delete pEntry->pSocket;
+
+	assert (m_pSocket != 0);
+	pEntry->pSocket = m_pSocket;
+	pEntry->ServerIP.Set (m_ServerIP);
+	pEntry->ServerPort = m_ServerPort;
+	pEntry->nIdleSince = nTicks;
+
 	m_pSocket = 0;
+}
 
-	assert (pLength != 0);
-	assert (nLength <= *pLength);
-	*pLength = nLength;
+boolean CHTTPClient::BufferHandler (const u8 *pData, unsigned nLength, void *pParam)
+{
+	TBufferParam *pBuffer = (TBufferParam *) pParam;
+	assert (pBuffer != 0);
 
-	return HTTPOK;
+	if (pBuffer->nLength + nLength > pBuffer->nSize)
+	{
+		return FALSE;
+	}
+
+	assert (pBuffer->pBuffer != 0);
+	memcpy (pBuffer->pBuffer + pBuffer->nLength, pData, nLength);
+	pBuffer->nLength += nLength;
+
+	return TRUE;
 }
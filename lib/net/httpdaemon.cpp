@@ -4,7 +4,7 @@
 // A simple HTTP webserver
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,6 +20,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/httpdaemon.h>
+#include <circle/net/socketset.h>
 #include <circle/net/in.h>
 #include <circle/netdevice.h>
 #include <circle/sysconfig.h>
@@ -28,11 +29,19 @@
 #include <circle/util.h>
 #include <assert.h>
 
-#define HTTPD_VERSION		"0.02"
+#define HTTPD_VERSION		"0.03"
 #define SERVER			"CHTTPDaemon/" HTTPD_VERSION " (Circle)"
 
 #define MAX_CLIENTS		10
 
+#ifndef HTTPD_KEEP_ALIVE_TIMEOUT
+#define HTTPD_KEEP_ALIVE_TIMEOUT	5		// seconds, idle time before connection is closed
+#endif
+
+#ifndef HTTPD_KEEP_ALIVE_MAX
+#define HTTPD_KEEP_ALIVE_MAX		100		// requests per connection
+#endif
+
 #define HTTPD_STACK_SIZE	TASK_STACK_SIZE
 
 static const char FromHTTPDaemon[] = "httpd";
@@ -47,7 +56,10 @@ CHTTPDaemon::CHTTPDaemon (CNetSubSystem *pNetSubSystem, CSocket *pSocket,
 	m_nMaxContentSize (nMaxContentSize),
 	m_nPort (nPort),
 	m_nMaxMultipartSize (nMaxMultipartSize),
-	m_pContentBuffer (0)
+	m_pContentBuffer (0),
+	m_nRxOffset (0),
+	m_nRxLength (0),
+	m_pMultipartBuffer (0)
 {
 	s_nInstanceCount++;
 
@@ -171,117 +183,404 @@ void CHTTPDaemon::Worker (void)
 {
 	assert (m_pSocket != 0);
 
+	// process persistent connection with keep-alive and pipelined requests
+	for (unsigned nRequest = 1; WaitForRequest (); nRequest++)
+	{
+		if (!ProcessRequest (nRequest < HTTPD_KEEP_ALIVE_MAX))
+		{
+			break;
+		}
+	}
+
+	delete m_pSocket;		// closes connection
+	m_pSocket = 0;
+}
+
+boolean CHTTPDaemon::WaitForRequest (void)
+{
+	if (m_nRxOffset < m_nRxLength)		// pipelined request already received?
+	{
+		return TRUE;
+	}
+
+	CSocketSet SocketSet;
+	assert (m_pSocket != 0);
+	SocketSet.Add (m_pSocket, SOCKET_POLL_READ);
+
+	return SocketSet.Poll (HTTPD_KEEP_ALIVE_TIMEOUT * 1000000U) > 0;
+}
+
+boolean CHTTPDaemon::ProcessRequest (boolean bKeepAliveAllowed)
+{
+	assert (m_pSocket != 0);
+
 	// parse HTTP request
 	THTTPStatus Status = ParseRequest ();
 	if (Status == HTTPUnknownError)		// unknown error cannot be reported to client
 	{
-		delete m_pSocket;
-		m_pSocket = 0;
+		m_RequestArena.Reset ();
+		m_pMultipartBuffer = 0;
 
-		return;
+		return FALSE;
 	}
 
-	// process HTTP request
-	unsigned nContentLength = m_nMaxContentSize;
-	const char *pContentType = "text/html";
+	// the rest of an invalid request cannot be skipped reliably
+	if (   Status != HTTPOK
+	    || !bKeepAliveAllowed)
+	{
+		m_bKeepAlive = FALSE;
+	}
 
-	const char *pStatusMsg = "OK";
+	m_bResponseBegun = FALSE;
+	m_bSendFailed = FALSE;
+	m_bChunked = FALSE;
+	m_nContentLength = 0;
+	m_nContentSent = 0;
+
+	// switch to the WebSocket protocol, if requested and accepted
+	if (   Status == HTTPOK
+	    && m_RequestMethod == HTTPRequestMethodGet
+	    && m_bUpgradeWebSocket
+	    && m_bConnectionUpgrade
+	    && m_WebSocketKey[0] != '\0'
+	    && AcceptWebSocket (m_RequestPath, m_RequestParams))
+	{
+		m_RequestArena.Reset ();
+		m_pMultipartBuffer = 0;
 
+		if (m_nWebSocketVersion == WEBSOCKET_VERSION)
+		{
+			ProcessWebSocket ();
+
+			return FALSE;
+		}
+
+		m_bKeepAlive = FALSE;
+		Status = HTTPBadRequest;
+	}
+
+	// process HTTP request
 	if (Status == HTTPOK)
 	{
-		// get content
-		assert (m_pContentBuffer != 0);
-		Status = GetContent (m_RequestPath, m_RequestParams, m_RequestFormData,
-				     m_pContentBuffer, &nContentLength, &pContentType);
-		assert (nContentLength <= m_nMaxContentSize);
-		assert (pContentType != 0);
-
-		delete [] m_pMultipartBuffer;
-		m_pMultipartBuffer = 0;
+		Status = StreamContent (m_RequestPath, m_RequestParams, m_RequestFormData);
 	}
 
-	if (Status != HTTPOK)
+	m_RequestArena.Reset ();
+	m_pMultipartBuffer = 0;
+
+	if (m_bResponseBegun)
 	{
-		switch (Status)
+		// an error cannot be reported to the client any more, after the header has been sent
+		if (   (Status != HTTPOK && Status != HTTPNotModified)
+		    || !EndResponse ())
 		{
-		case HTTPBadRequest:		pStatusMsg = "Bad Request";			break;
-		case HTTPNotFound:		pStatusMsg = "Not Found";			break;
-		case HTTPRequestEntityTooLarge:	pStatusMsg = "Request Entity Too Large";	break;
-		case HTTPRequestURITooLong:	pStatusMsg = "Request-URI Too Long";		break;
-		case HTTPInternalServerError:	pStatusMsg = "Internal Server Error";		break;
-		case HTTPMethodNotImplemented:	pStatusMsg = "Method Not Implemented";		break;
-		case HTTPVersionNotSupported:	pStatusMsg = "Version Not Supported";		break;
-		default:			pStatusMsg = "Unknown Error";			break;
+			m_bKeepAlive = FALSE;
 		}
-
-		CString ErrorPage;
-		ErrorPage.Format ("<!DOCTYPE html>\n"
-				  "<html>\n"
-				  "<head><title>%u %s</title></head>\n"
-				  "<body><h1>%s</h1></body>\n"
-				  "</html>\n", Status, pStatusMsg, pStatusMsg);
-
-		nContentLength = ErrorPage.GetLength ();
-		if (nContentLength > m_nMaxContentSize)
+	}
+	else
+	{
+		if (Status == HTTPOK)		// StreamContent() did not send anything
 		{
-			nContentLength = m_nMaxContentSize;
+			Status = HTTPInternalServerError;
 		}
 
-		assert (m_pContentBuffer != 0);
-		memcpy (m_pContentBuffer, (const char *) ErrorPage, nContentLength);
-		pContentType = "text/html";	// may has been changed by GetContent()
+		SendErrorPage (Status);
+	}
+
+	if (m_bSendFailed)
+	{
+		CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Cannot send response");
+
+		return FALSE;
 	}
 
 	// write access log
 	const u8 *pClientIP = m_pSocket->GetForeignIP ();
 	if (pClientIP == 0)			// connection closed in the meantime?
 	{
-		delete m_pSocket;
-		m_pSocket = 0;
+		return FALSE;
+	}
+	CIPAddress ClientIP (pClientIP);
+
+	WriteAccessLog (ClientIP, m_RequestMethod, m_RequestURI, Status, m_nContentSent);
+
+	return m_bKeepAlive;
+}
+
+void CHTTPDaemon::ProcessWebSocket (void)
+{
+	char Accept[WEBSOCKET_ACCEPT_SIZE+1];
+	CWebSocket::GetAcceptKey (m_WebSocketKey, Accept);
 
+	CString Header;
+	Header.Format ("HTTP/1.1 %u %s\r\n"
+		       "Server: " SERVER "\r\n"
+		       "Upgrade: websocket\r\n"
+		       "Connection: Upgrade\r\n"
+		       "Sec-WebSocket-Accept: %s\r\n"
+		       "\r\n", HTTPSwitchingProtocols, GetStatusMessage (HTTPSwitchingProtocols),
+		       Accept);
+
+	assert (m_pSocket != 0);
+	if (m_pSocket->Send ((const char *) Header, Header.GetLength (), 0) < 0)
+	{
+		CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Cannot send response");
+
+		return;
+	}
+
+	const u8 *pClientIP = m_pSocket->GetForeignIP ();
+	if (pClientIP == 0)
+	{
 		return;
 	}
 	CIPAddress ClientIP (pClientIP);
 
-	WriteAccessLog (ClientIP, m_RequestMethod, m_RequestURI, Status, nContentLength);
+	WriteAccessLog (ClientIP, m_RequestMethod, m_RequestURI, HTTPSwitchingProtocols, 0);
+
+	// the socket and data, which follows the request, are handed over to the WebSocket
+	CWebSocket *pWebSocket = new CWebSocket (m_pSocket, FALSE, m_RxBuffer + m_nRxOffset,
+						 m_nRxLength - m_nRxOffset);
+	assert (pWebSocket != 0);
+
+	m_pSocket = 0;
+	m_nRxOffset = 0;
+	m_nRxLength = 0;
+
+	WebSocketSession (pWebSocket, m_RequestPath, m_RequestParams);
+
+	delete pWebSocket;		// closes connection
+}
+
+boolean CHTTPDaemon::AcceptWebSocket (const char *pPath, const char *pParams)
+{
+	return FALSE;
+}
+
+void CHTTPDaemon::WebSocketSession (CWebSocket *pWebSocket, const char *pPath, const char *pParams)
+{
+}
+
+THTTPStatus CHTTPDaemon::GetContent (const char *pPath, const char *pParams, const char *pFormData,
+				     u8 *pBuffer, unsigned *pLength, const char **ppContentType)
+{
+	return HTTPNotFound;
+}
+
+THTTPStatus CHTTPDaemon::StreamContent (const char *pPath, const char *pParams,
+					const char *pFormData)
+{
+	if (m_pContentBuffer == 0)
+	{
+		return HTTPInternalServerError;
+	}
+
+	// get content
+	unsigned nContentLength = m_nMaxContentSize;
+	const char *pContentType = "text/html";
+	THTTPStatus Status = GetContent (pPath, pParams, pFormData,
+					 m_pContentBuffer, &nContentLength, &pContentType);
+	if (Status != HTTPOK)
+	{
+		return Status;
+	}
+
+	assert (nContentLength <= m_nMaxContentSize);
+	assert (pContentType != 0);
+
+	BeginResponse (pContentType, nContentLength);
+	WriteContent (m_pContentBuffer, nContentLength);
+
+	return HTTPOK;
+}
+
+boolean CHTTPDaemon::BeginResponse (const char *pContentType, unsigned nContentLength,
+				    const char *pExtraFields)
+{
+	return SendHeader (HTTPOK, pContentType, nContentLength, pExtraFields);
+}
+
+boolean CHTTPDaemon::WriteContent (const void *pData, unsigned nLength)
+{
+	assert (m_bResponseBegun);
+	if (m_bSendFailed)
+	{
+		return FALSE;
+	}
+
+	if (nLength == 0)			// would terminate chunked transfer
+	{
+		return TRUE;
+	}
+
+	if (   !m_bChunked
+	    && m_nContentSent + nLength > m_nContentLength)
+	{
+		CLogger::Get ()->Write (FromHTTPDaemon, LogWarning, "Content exceeds length");
+
+		m_bSendFailed = TRUE;
+
+		return FALSE;
+	}
+
+	m_nContentSent += nLength;
+
+	if (m_RequestMethod == HTTPRequestMethodHead)
+	{
+		return TRUE;
+	}
 
-	// send HTTP response header
+	assert (m_pSocket != 0);
+	assert (pData != 0);
+
+	int nResult;
+	if (m_bChunked)
+	{
+		CString ChunkHeader;
+		ChunkHeader.Format ("%X\r\n", nLength);
+
+		TNetIOVector IOVector[3] = {{(const char *) ChunkHeader, (unsigned) ChunkHeader.GetLength ()},
+					    {pData, nLength},
+					    {"\r\n", 2}};
+
+		nResult = m_pSocket->SendV (IOVector, 3, MSG_MORE);
+	}
+	else
+	{
+		// the last part of the content is sent without delay
+		nResult = m_pSocket->Send (pData, nLength, m_nContentSent < m_nContentLength
+							   ? MSG_MORE : 0);
+	}
+
+	if (nResult < 0)
+	{
+		m_bSendFailed = TRUE;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean CHTTPDaemon::SendHeader (THTTPStatus Status, const char *pContentType,
+				 unsigned nContentLength, const char *pExtraFields)
+{
+	assert (!m_bResponseBegun);
+	m_bResponseBegun = TRUE;
+
+	m_bChunked = nContentLength == HTTP_CONTENT_LENGTH_CHUNKED;
+	m_nContentLength = m_bChunked ? 0 : nContentLength;
+	m_nContentSent = 0;
+
+	// a 304 response describes the cached representation of the client, it has no content
+	assert (pContentType != 0);
+	CString Content;
+	if (Status == HTTPNotModified)
+	{
+		assert (nContentLength == 0);
+	}
+	else if (m_bChunked)
+	{
+		Content.Format ("Content-Type: %s\r\n"
+				"Transfer-Encoding: chunked\r\n", pContentType);
+	}
+	else
+	{
+		Content.Format ("Content-Type: %s\r\n"
+				"Content-Length: %u\r\n", pContentType, nContentLength);
+	}
+
+	assert (pExtraFields != 0);
 	CString Header;
 	Header.Format ("HTTP/1.1 %u %s\r\n"
 		       "Server: " SERVER "\r\n"
-		       "Content-Type: %s\r\n"
-		       "Content-Length: %u\r\n"
-		       "Connection: close\r\n"
-		       "\r\n", Status, pStatusMsg, pContentType, nContentLength);
+		       "%s"
+		       "%s"
+		       "Connection: %s\r\n"
+		       "\r\n", Status, GetStatusMessage (Status), (const char *) Content,
+		       pExtraFields, m_bKeepAlive ? "keep-alive" : "close");
+
+	// the header is coalesced with the content, if it follows
+	int nFlags = MSG_MORE;
+	if (   m_RequestMethod == HTTPRequestMethodHead
+	    || nContentLength == 0)
+	{
+		nFlags = 0;
+	}
 
-	if (m_pSocket->Send ((const char *) Header, Header.GetLength (), MSG_DONTWAIT) < 0)
+	assert (m_pSocket != 0);
+	if (m_pSocket->Send ((const char *) Header, Header.GetLength (), nFlags) < 0)
 	{
-		CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Cannot send response header");
+		m_bSendFailed = TRUE;
 
-		delete m_pSocket;
-		m_pSocket = 0;
+		return FALSE;
+	}
 
-		return;
+	return TRUE;
+}
+
+boolean CHTTPDaemon::SendErrorPage (THTTPStatus Status)
+{
+	const char *pStatusMsg = GetStatusMessage (Status);
+
+	CString ErrorPage;
+	ErrorPage.Format ("<!DOCTYPE html>\n"
+			  "<html>\n"
+			  "<head><title>%u %s</title></head>\n"
+			  "<body><h1>%s</h1></body>\n"
+			  "</html>\n", Status, pStatusMsg, pStatusMsg);
+
+	return    SendHeader (Status, "text/html", ErrorPage.GetLength ())
+	       && WriteContent ((const char *) ErrorPage, ErrorPage.GetLength ());
+}
+
+boolean CHTTPDaemon::EndResponse (void)
+{
+	assert (m_bResponseBegun);
+	if (m_bSendFailed)
+	{
+		return FALSE;
 	}
 
-	// send response
-	if (   m_RequestMethod != HTTPRequestMethodHead
-	    && nContentLength > 0)
+	if (m_RequestMethod == HTTPRequestMethodHead)
 	{
-		assert (m_pContentBuffer != 0);
-		if (m_pSocket->Send (m_pContentBuffer, nContentLength, MSG_DONTWAIT) < 0)
-		{
-			CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Cannot send response");
+		return TRUE;
+	}
+
+	if (!m_bChunked)
+	{
+		// the client would wait for the missing content otherwise
+		return m_nContentSent == m_nContentLength;
+	}
 
-			delete m_pSocket;
-			m_pSocket = 0;
+	// last chunk and empty trailer
+	assert (m_pSocket != 0);
+	if (m_pSocket->Send ("0\r\n\r\n", 5, 0) < 0)
+	{
+		m_bSendFailed = TRUE;
 
-			return;
-		}
+		return FALSE;
 	}
 
-	delete m_pSocket;		// closes connection
-	m_pSocket = 0;
+	return TRUE;
+}
+
+const char *CHTTPDaemon::GetStatusMessage (THTTPStatus Status)
+{
+	switch (Status)
+	{
+	case HTTPSwitchingProtocols:	return "Switching Protocols";
+	case HTTPOK:			return "OK";
+	case HTTPNotModified:		return "Not Modified";
+	case HTTPBadRequest:		return "Bad Request";
+	case HTTPNotFound:		return "Not Found";
+	case HTTPRequestEntityTooLarge:	return "Request Entity Too Large";
+	case HTTPRequestURITooLong:	return "Request-URI Too Long";
+	case HTTPInternalServerError:	return "Internal Server Error";
+	case HTTPMethodNotImplemented:	return "Method Not Implemented";
+	case HTTPVersionNotSupported:	return "Version Not Supported";
+	default:			return "Unknown Error";
+	}
 }
 
 THTTPStatus CHTTPDaemon::ParseRequest (void)
@@ -289,6 +588,7 @@ THTTPStatus CHTTPDaemon::ParseRequest (void)
 	THTTPStatus Status = HTTPOK;
 
 	m_RequestMethod = HTTPRequestMethodUnknown;
+	m_bKeepAlive = TRUE;				// default for HTTP/1.1
 	m_RequestURI[0] = '\0';
 	m_RequestPath[0] = '\0';
 	m_RequestParams[0] = '\0';
@@ -299,10 +599,15 @@ THTTPStatus CHTTPDaemon::ParseRequest (void)
 	m_MultipartBoundary[0] = '\0';
 	m_nMultipartContentLength = 0;
 	m_pMultipartBuffer = 0;
+	m_bUpgradeWebSocket = FALSE;
+	m_bConnectionUpgrade = FALSE;
+	m_nWebSocketVersion = 0;
+	m_WebSocketKey[0] = '\0';
+	m_bAcceptGzip = FALSE;
+	m_IfNoneMatch[0] = '\0';
 
-	char Buffer[FRAME_BUFFER_SIZE];
 	char Line[HTTP_MAX_REQUEST_LINE+1];
-#if HTTP_MAX_REQUEST_LINE+FRAME_BUFFER_SIZE+2000 > HTTPD_STACK_SIZE
+#if HTTP_MAX_REQUEST_LINE+2000 > HTTPD_STACK_SIZE
 	#error Increase HTTPD_STACK_SIZE!
 #endif
 
@@ -310,15 +615,26 @@ THTTPStatus CHTTPDaemon::ParseRequest (void)
 	unsigned nLine = 0;
 	unsigned nChar = 0;
 
-	int nResult;
+	int nResult = 0;
 
 	assert (m_pSocket != 0);
-	while (   nState < 3
-	       && (nResult = m_pSocket->Receive (Buffer, sizeof Buffer, 0)) > 0)
+	while (nState < 3)
 	{
-		for (unsigned i = 0; i < (unsigned) nResult; i++)
+		// data following this request is kept in m_RxBuffer for the next request
+		if (m_nRxOffset >= m_nRxLength)
 		{
-			char chChar = Buffer[i];
+			if ((nResult = m_pSocket->Receive (m_RxBuffer, sizeof m_RxBuffer, 0)) <= 0)
+			{
+				break;
+			}
+
+			m_nRxOffset = 0;
+			m_nRxLength = nResult;
+		}
+
+		for (; nState < 3 && m_nRxOffset < m_nRxLength; m_nRxOffset++)
+		{
+			char chChar = m_RxBuffer[m_nRxOffset];
 
 			if (nState == 0)
 			{
@@ -331,6 +647,11 @@ THTTPStatus CHTTPDaemon::ParseRequest (void)
 				{
 					if (nChar == 0)		// empty line is end of header
 					{
+						if (nLine == 0)	// ignore empty lines before request
+						{
+							continue;
+						}
+
 						if (   m_bRequestFormDataAvailable
 						    && m_nRequestContentLength > 0)
 						{
@@ -354,7 +675,8 @@ THTTPStatus CHTTPDaemon::ParseRequest (void)
 							if (m_nMultipartContentLength <= m_nMaxMultipartSize)
 							{
 								assert (m_pMultipartBuffer == 0);
-								m_pMultipartBuffer = new char[m_nMultipartContentLength];
+								m_pMultipartBuffer = (char *) m_RequestArena.Allocate (
+									m_nMultipartContentLength, 1);
 								if (m_pMultipartBuffer == 0)
 								{
 									Status = HTTPInternalServerError;
@@ -441,6 +763,11 @@ THTTPStatus CHTTPDaemon::ParseRequest (void)
 
 		return HTTPUnknownError;
 	}
+
+	if (nState < 3)				// connection closed by client
+	{
+		m_bKeepAlive = FALSE;
+	}
 	
 	if (Status != HTTPOK)
 	{
@@ -594,6 +921,93 @@ THTTPStatus CHTTPDaemon::ParseHeaderField (char *pLine)
 
 		m_nRequestContentLength = nAccu;
 	}
+	else if (strcmp (pToken, "Connection") == 0)
+	{
+		while ((pToken = strtok_r (0, " ,", &pSavePtr)) != 0)
+		{
+			if (strcasecmp (pToken, "close") == 0)
+			{
+				m_bKeepAlive = FALSE;
+			}
+			else if (strcasecmp (pToken, "upgrade") == 0)
+			{
+				m_bConnectionUpgrade = TRUE;
+			}
+		}
+	}
+	else if (strcasecmp (pToken, "Accept-Encoding") == 0)
+	{
+		while ((pToken = strtok_r (0, " ,", &pSavePtr)) != 0)
+		{
+			if (   strncasecmp (pToken, "gzip", 4) != 0
+			    || (pToken[4] != '\0' && pToken[4] != ';'))
+			{
+				continue;
+			}
+
+			// "gzip;q=0" (or "q=0.000") means not acceptable
+			const char *pQValue = strstr (pToken, "q=");
+			if (pQValue != 0)
+			{
+				for (pQValue += 2; *pQValue == '0' || *pQValue == '.'; pQValue++)
+				{
+					// skip zeros
+				}
+
+				if (*pQValue == '\0')
+				{
+					continue;
+				}
+			}
+
+			m_bAcceptGzip = TRUE;
+		}
+	}
+	else if (strcasecmp (pToken, "If-None-Match") == 0)
+	{
+		if ((pToken = strtok_r (0, "", &pSavePtr)) != 0)
+		{
+			while (*pToken == ' ')
+			{
+				pToken++;
+			}
+
+			// too many entity tags are ignored, the full response is sent then
+			if (strlen (pToken) <= HTTP_MAX_IF_NONE_MATCH)
+			{
+				strcpy (m_IfNoneMatch, pToken);
+			}
+		}
+	}
+	else if (strcasecmp (pToken, "Upgrade") == 0)
+	{
+		while ((pToken = strtok_r (0, " ,", &pSavePtr)) != 0)
+		{
+			if (strcasecmp (pToken, "websocket") == 0)
+			{
+				m_bUpgradeWebSocket = TRUE;
+			}
+		}
+	}
+	else if (strcasecmp (pToken, "Sec-WebSocket-Key") == 0)
+	{
+		if (   (pToken = strtok_r (0, " ", &pSavePtr)) == 0
+		    || strlen (pToken) != WEBSOCKET_KEY_SIZE)
+		{
+			return HTTPBadRequest;
+		}
+
+		strcpy (m_WebSocketKey, pToken);
+	}
+	else if (strcasecmp (pToken, "Sec-WebSocket-Version") == 0)
+	{
+		if ((pToken = strtok_r (0, " ", &pSavePtr)) == 0)
+		{
+			return HTTPBadRequest;
+		}
+
+		m_nWebSocketVersion = strtoul (pToken, 0, 10);
+	}
 
 	return HTTPOK;
 }
@@ -0,0 +1,265 @@
+//
+// httpsendfile.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/httpdaemon.h>
+#include <circle/net/in.h>
+#include <circle/fs/fat/fatfs.h>
+#include <circle/fs/fsdef.h>
+#include <circle/sched/synchronizationevent.h>
+#include <circle/string.h>
+#include <assert.h>
+
+// This is an own module, so that the FAT file system is only linked, if SendFile() or
+// SendCachedFile() is used.
+
+#ifndef HTTPD_SENDFILE_BUFFER_SIZE
+#define HTTPD_SENDFILE_BUFFER_SIZE	8192
+#endif
+
+#define HTTPD_SENDFILE_BUFFERS		2	// one is read from file, while the other is sent
+
+THTTPStatus CHTTPDaemon::SendFile (CFATFileSystem *pFileSystem, const char *pFileName,
+				   const char *pContentType)
+{
+	assert (pFileSystem != 0);
+	assert (pFileName != 0);
+
+	unsigned hFile = pFileSystem->FileOpen (pFileName);
+	if (hFile == 0)
+	{
+		return HTTPNotFound;
+	}
+
+	unsigned nSize = pFileSystem->FileGetSize (hFile);
+	if (nSize == FS_ERROR)
+	{
+		pFileSystem->FileClose (hFile);
+
+		return HTTPInternalServerError;
+	}
+
+	if (   !BeginResponse (pContentType, nSize)
+	    || m_RequestMethod == HTTPRequestMethodHead)
+	{
+		pFileSystem->FileClose (hFile);
+
+		return HTTPOK;
+	}
+
+	u8 *pBuffer[HTTPD_SENDFILE_BUFFERS];
+	CSynchronizationEvent BufferFree[HTTPD_SENDFILE_BUFFERS];
+	for (unsigned i = 0; i < HTTPD_SENDFILE_BUFFERS; i++)
+	{
+		pBuffer[i] = new u8[HTTPD_SENDFILE_BUFFER_SIZE];
+		assert (pBuffer[i] != 0);
+
+		BufferFree[i].Set ();
+	}
+
+	THTTPStatus Status = HTTPOK;
+
+	// the buffers are handed over to the TCP connection, which calls the completion handler,
+	// when the data has been moved into its retransmission queue
+	assert (m_pSocket != 0);
+	for (unsigned nBuffer = 0; m_nContentSent < m_nContentLength;
+	     nBuffer = (nBuffer + 1) % HTTPD_SENDFILE_BUFFERS)
+	{
+		BufferFree[nBuffer].Wait ();
+
+		unsigned nLength = pFileSystem->FileRead (hFile, pBuffer[nBuffer],
+							  HTTPD_SENDFILE_BUFFER_SIZE);
+		if (   nLength == 0
+		    || nLength == FS_ERROR
+		    || m_nContentSent + nLength > m_nContentLength)
+		{
+			Status = HTTPInternalServerError;
+
+			break;
+		}
+
+		m_nContentSent += nLength;
+
+		BufferFree[nBuffer].Clear ();
+		if (m_pSocket->SendZeroCopy (pBuffer[nBuffer], nLength,
+					     m_nContentSent < m_nContentLength ? MSG_MORE : 0,
+					     SendFileCompletionHandler, &BufferFree[nBuffer]) < 0)
+		{
+			BufferFree[nBuffer].Set ();
+
+			m_bSendFailed = TRUE;
+
+			break;
+		}
+	}
+
+	// the buffers must not be freed, before the connection has released them
+	for (unsigned i = 0; i < HTTPD_SENDFILE_BUFFERS; i++)
+	{
+		BufferFree[i].Wait ();
+
+		delete [] pBuffer[i];
+	}
+
+	pFileSystem->FileClose (hFile);
+
+	return Status;
+}
+
+void CHTTPDaemon::SendFileCompletionHandler (const void *pBuffer, void *pParam)
+{
+	CSynchronizationEvent *pBufferFree = (CSynchronizationEvent *) pParam;
+	assert (pBufferFree != 0);
+
+	pBufferFree->Set ();
+}
+
+THTTPStatus CHTTPDaemon::SendCachedFile (CContentCache *pCache, CFATFileSystem *pFileSystem,
+					 const char *pFileName, const char *pContentType)
+{
+	assert (pCache != 0);
+	assert (pFileName != 0);
+
+	TContentCacheEntry *pEntry = 0;
+	boolean bGzip = FALSE;
+	if (m_bAcceptGzip)
+	{
+		CString GzipFileName (pFileName);
+		GzipFileName.Append (".gz");
+
+		pEntry = LoadCachedFile (pCache, pFileSystem, GzipFileName);
+		if (   pEntry != 0
+		    && pEntry->pData == 0)		// no compressed variant
+		{
+			pCache->Release (pEntry);
+			pEntry = 0;
+		}
+
+		bGzip = pEntry != 0;
+	}
+
+	if (pEntry == 0)
+	{
+		pEntry = LoadCachedFile (pCache, pFileSystem, pFileName);
+		if (pEntry == 0)			// too large or read error
+		{
+			return SendFile (pFileSystem, pFileName, pContentType);
+		}
+
+		if (pEntry->pData == 0)
+		{
+			pCache->Release (pEntry);
+
+			return HTTPNotFound;
+		}
+	}
+
+	CString Fields;
+	Fields.Format ("ETag: %s\r\n"
+		       "%s"
+		       "Vary: Accept-Encoding\r\n",
+		       pEntry->ETag, bGzip ? "Content-Encoding: gzip\r\n" : "");
+
+	if (   m_IfNoneMatch[0] != '\0'
+	    && CContentCache::MatchETag (pEntry, m_IfNoneMatch))
+	{
+		SendHeader (HTTPNotModified, pContentType, 0, Fields);
+
+		pCache->Release (pEntry);
+
+		return HTTPNotModified;
+	}
+
+	if (   !SendHeader (HTTPOK, pContentType, pEntry->nLength, Fields)
+	    || m_RequestMethod == HTTPRequestMethodHead
+	    || pEntry->nLength == 0)
+	{
+		pCache->Release (pEntry);
+
+		return HTTPOK;
+	}
+
+	// the entry is referenced, until the connection does not need the data any more
+	CSynchronizationEvent DataFree;
+	m_nContentSent = pEntry->nLength;
+	assert (m_pSocket != 0);
+	if (m_pSocket->SendZeroCopy (pEntry->pData, pEntry->nLength, 0,
+				     SendFileCompletionHandler, &DataFree) < 0)
+	{
+		m_bSendFailed = TRUE;
+	}
+	else
+	{
+		DataFree.Wait ();
+	}
+
+	pCache->Release (pEntry);
+
+	return HTTPOK;
+}
+
+TContentCacheEntry *CHTTPDaemon::LoadCachedFile (CContentCache *pCache,
+						 CFATFileSystem *pFileSystem,
+						 const char *pFileName)
+{
+	assert (pCache != 0);
+	TContentCacheEntry *pEntry = pCache->Lookup (pFileName);
+	if (pEntry != 0)
+	{
+		return pEntry;
+	}
+
+	assert (pFileSystem != 0);
+	unsigned hFile = pFileSystem->FileOpen (pFileName);
+	if (hFile == 0)
+	{
+		return pCache->Insert (pFileName, 0, 0);	// remember, that it does not exist
+	}
+
+	unsigned nSize = pFileSystem->FileGetSize (hFile);
+	if (   nSize == FS_ERROR
+	    || nSize > pCache->GetMaxEntrySize ())
+	{
+		pFileSystem->FileClose (hFile);
+
+		return 0;
+	}
+
+	u8 *pData = new u8[nSize > 0 ? nSize : 1];
+	assert (pData != 0);
+
+	for (unsigned nOffset = 0; nOffset < nSize;)
+	{
+		unsigned nLength = pFileSystem->FileRead (hFile, pData + nOffset, nSize - nOffset);
+		if (   nLength == 0
+		    || nLength == FS_ERROR)
+		{
+			delete [] pData;
+
+			pFileSystem->FileClose (hFile);
+
+			return 0;
+		}
+
+		nOffset += nLength;
+	}
+
+	pFileSystem->FileClose (hFile);
+
+	return pCache->Insert (pFileName, pData, nSize);
+}
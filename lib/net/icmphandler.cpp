@@ -50,7 +50,7 @@ PACKED;
 static const char FromICMP[] = "icmp";
 
 CICMPHandler::CICMPHandler (CNetConfig *pNetConfig, CNetworkLayer *pNetworkLayer,
-			    CNetQueue *pRxQueue, CNetQueue *pNotificationQueue)
+			    CNetFrameQueue *pRxQueue, CNetFrameQueueMP *pNotificationQueue)
 :	m_pNetConfig (pNetConfig),
 	m_pNetworkLayer (pNetworkLayer),
 	m_pRxQueue (pRxQueue),
@@ -72,22 +72,21 @@ CICMPHandler::~CICMPHandler (void)
 
 void CICMPHandler::Process (void)
 {
-	u8 Buffer[FRAME_BUFFER_SIZE];
-	unsigned nLength;
-	void *pParam;
+	CNetBuffer *pBuffer;
 	assert (m_pRxQueue != 0);
-	while ((nLength = m_pRxQueue->Dequeue (Buffer, &pParam)) != 0)
+	// the buffer is released on each continue
+	for (; (pBuffer = m_pRxQueue->Dequeue ()) != 0; pBuffer->Release ())
 	{
-		TNetworkPrivateData *pData = (TNetworkPrivateData *) pParam;
+		u8 *Buffer = (u8 *) pBuffer->GetData ();
+		unsigned nLength = pBuffer->GetLength ();
+
+		TNetworkPrivateData *pData = (TNetworkPrivateData *) pBuffer->GetPrivateData ();
 		assert (pData != 0);
 		assert (pData->nProtocol == IPPROTO_ICMP);
 
 		CIPAddress SourceIP (pData->SourceAddress);
 		CIPAddress DestIP (pData->DestinationAddress);
 
-		delete pData;
-		pData = 0;
-
 		assert (m_pNetConfig != 0);
 		if (   DestIP.IsBroadcast ()
 		    || DestIP == *m_pNetConfig->GetBroadcastAddress ())
@@ -117,8 +116,10 @@ void CICMPHandler::Process (void)
 				pICMPHeader->nChecksum = 0;
 				pICMPHeader->nChecksum = CChecksumCalculator::SimpleCalculate (Buffer, nLength);
 
+				// the IP header is prepended in the headroom of the buffer
+				pBuffer->AddRef ();
 				assert (m_pNetworkLayer != 0);
-				m_pNetworkLayer->Send (SourceIP, Buffer, nLength, IPPROTO_ICMP);
+				m_pNetworkLayer->Send (SourceIP, pBuffer, IPPROTO_ICMP);
 			}
 
 			continue;
@@ -162,12 +163,15 @@ void CICMPHandler::Process (void)
 
 		case ICMP_TYPE_REDIRECT: {
 			CIPAddress GatewayIP (pICMPHeader->Parameter);
+			CIPAddress DestIP (pIPHeader->DestinationAddress);
+			CIPAddress CurrentGatewayIP;
 
 			// See: RFC 1122 3.2.2.2
 			assert (m_pNetworkLayer != 0);
 			if (   !GatewayIP.OnSameNetwork (*m_pNetConfig->GetIPAddress (),
 							 m_pNetConfig->GetNetMask ())
-			    || SourceIP != m_pNetworkLayer->GetGateway (pIPHeader->DestinationAddress))
+			    || !m_pNetworkLayer->GetNextHop (DestIP, &CurrentGatewayIP)
+			    || SourceIP != CurrentGatewayIP)
 			{
 				break;
 			}
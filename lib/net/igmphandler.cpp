@@ -0,0 +1,451 @@
+//
+// igmphandler.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/igmphandler.h>
+#include <circle/net/networklayer.h>
+#include <circle/net/linklayer.h>
+#include <circle/net/checksumcalculator.h>
+#include <circle/net/in.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#include <circle/macros.h>
+#include <assert.h>
+
+struct TIGMPHeader			// IGMPv2 message and start of IGMPv3 query
+{
+	u8	nType;
+#define IGMP_TYPE_QUERY			0x11
+#define IGMP_TYPE_V1_REPORT		0x12
+#define IGMP_TYPE_V2_REPORT		0x16
+#define IGMP_TYPE_V2_LEAVE		0x17
+#define IGMP_TYPE_V3_REPORT		0x22
+	u8	nMaxRespCode;			// in 1/10 seconds
+	u16	nChecksum;
+	u8	GroupAddress[IP_ADDRESS_SIZE];
+}
+PACKED;
+
+#define IGMP_V3_QUERY_MIN_LENGTH	12
+
+struct TIGMPv3ReportHeader
+{
+	u8	nType;
+	u8	nReserved1;
+	u16	nChecksum;
+	u16	nReserved2;
+	u16	nGroupRecords;
+}
+PACKED;
+
+struct TIGMPv3GroupRecord		// without source addresses
+{
+	u8	nRecordType;
+#define IGMP_MODE_IS_EXCLUDE		2
+#define IGMP_CHANGE_TO_INCLUDE		3
+#define IGMP_CHANGE_TO_EXCLUDE		4
+	u8	nAuxDataLength;
+	u16	nSources;
+	u8	GroupAddress[IP_ADDRESS_SIZE];
+}
+PACKED;
+
+#define IGMP_ALL_HOSTS			0x010000E0U	// 224.0.0.1
+#define IGMP_ALL_ROUTERS		0x020000E0U	// 224.0.0.2
+#define IGMP_V3_ROUTERS			0x160000E0U	// 224.0.0.22
+
+#define IGMP_ROBUSTNESS			2
+#define IGMP_UNSOLICITED_INTERVAL	(1 * HZ)
+#define IGMP_QUERY_INTERVAL		(125 * HZ)
+#define IGMP_OLDER_QUERIER_TIMEOUT	(IGMP_ROBUSTNESS * IGMP_QUERY_INTERVAL + 10 * HZ)
+
+CIGMPHandler::CIGMPHandler (CNetConfig *pNetConfig, CNetworkLayer *pNetworkLayer,
+			    CLinkLayer *pLinkLayer, CNetFrameQueue *pRxQueue)
+:	m_pNetConfig (pNetConfig),
+	m_pNetworkLayer (pNetworkLayer),
+	m_pLinkLayer (pLinkLayer),
+	m_pRxQueue (pRxQueue),
+	m_nVersion (3),
+	m_nOlderQuerierTicks (0)
+{
+	assert (m_pNetConfig != 0);
+	assert (m_pNetworkLayer != 0);
+	assert (m_pLinkLayer != 0);
+	assert (m_pRxQueue != 0);
+
+	for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		m_Group[i].nRefCount = 0;
+	}
+
+	UpdateFilter ();
+}
+
+CIGMPHandler::~CIGMPHandler (void)
+{
+	m_pRxQueue = 0;
+	m_pLinkLayer = 0;
+	m_pNetworkLayer = 0;
+	m_pNetConfig = 0;
+}
+
+void CIGMPHandler::Process (void)
+{
+	CNetBuffer *pBuffer;
+	assert (m_pRxQueue != 0);
+	// the buffer is released on each continue
+	for (; (pBuffer = m_pRxQueue->Dequeue ()) != 0; pBuffer->Release ())
+	{
+		const u8 *pPacket = pBuffer->GetData ();
+		unsigned nLength = pBuffer->GetLength ();
+
+		if (   nLength < sizeof (TIGMPHeader)
+		    || CChecksumCalculator::SimpleCalculate (pPacket, nLength) != CHECKSUM_OK)
+		{
+			continue;
+		}
+
+		const TIGMPHeader *pHeader = (const TIGMPHeader *) pPacket;
+		switch (pHeader->nType)
+		{
+		case IGMP_TYPE_QUERY:
+			QueryReceived (pPacket, nLength);
+			break;
+
+		case IGMP_TYPE_V1_REPORT:
+		case IGMP_TYPE_V2_REPORT:
+			ReportReceived (CIPAddress (pHeader->GroupAddress));
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (   m_nVersion < 3
+	    && CTimer::Get ()->GetTicks () - m_nOlderQuerierTicks >= IGMP_OLDER_QUERIER_TIMEOUT)
+	{
+		m_nVersion = 3;
+	}
+
+	SendReports ();
+}
+
+boolean CIGMPHandler::JoinGroup (const CIPAddress &rGroupIP)
+{
+	if (   !rGroupIP.IsMulticast ()
+	    || rGroupIP == IGMP_ALL_HOSTS)
+	{
+		return rGroupIP == IGMP_ALL_HOSTS;
+	}
+
+	TGroup *pFree = 0;
+	for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		if (m_Group[i].nRefCount == 0)
+		{
+			if (pFree == 0)
+			{
+				pFree = &m_Group[i];
+			}
+		}
+		else if (m_Group[i].GroupIP == rGroupIP)
+		{
+			m_Group[i].nRefCount++;
+
+			return TRUE;
+		}
+	}
+
+	if (pFree == 0)
+	{
+		return FALSE;
+	}
+
+	pFree->GroupIP.Set (rGroupIP);
+	pFree->nRefCount = 1;
+
+	UpdateFilter ();
+
+	// the unsolicited report is sent with the next call of Process()
+	pFree->bReportPending = TRUE;
+	pFree->bStateChange = TRUE;
+	pFree->nReportTicks = CTimer::Get ()->GetTicks ();
+	pFree->nRetransmissions = IGMP_ROBUSTNESS - 1;
+
+	return TRUE;
+}
+
+void CIGMPHandler::LeaveGroup (const CIPAddress &rGroupIP)
+{
+	for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		TGroup *pGroup = &m_Group[i];
+		if (   pGroup->nRefCount == 0
+		    || pGroup->GroupIP != rGroupIP)
+		{
+			continue;
+		}
+
+		if (--pGroup->nRefCount > 0)
+		{
+			return;
+		}
+
+		UpdateFilter ();
+
+		if (m_nVersion < 3)
+		{
+			TIGMPHeader Leave;
+			Leave.nType = IGMP_TYPE_V2_LEAVE;
+			Leave.nMaxRespCode = 0;
+			rGroupIP.CopyTo (Leave.GroupAddress);
+
+			SendMessage (CIPAddress (IGMP_ALL_ROUTERS), &Leave, sizeof Leave);
+		}
+		else
+		{
+			struct
+			{
+				TIGMPv3ReportHeader	Header;
+				TIGMPv3GroupRecord	Record;
+			}
+			PACKED Report;
+
+			Report.Header.nType = IGMP_TYPE_V3_REPORT;
+			Report.Header.nReserved1 = 0;
+			Report.Header.nReserved2 = 0;
+			Report.Header.nGroupRecords = BE (1);
+			Report.Record.nRecordType = IGMP_CHANGE_TO_INCLUDE;	// with no sources
+			Report.Record.nAuxDataLength = 0;
+			Report.Record.nSources = 0;
+			rGroupIP.CopyTo (Report.Record.GroupAddress);
+
+			SendMessage (CIPAddress (IGMP_V3_ROUTERS), &Report, sizeof Report);
+		}
+
+		return;
+	}
+}
+
+boolean CIGMPHandler::IsMember (const CIPAddress &rGroupIP) const
+{
+	if (rGroupIP == IGMP_ALL_HOSTS)
+	{
+		return TRUE;
+	}
+
+	for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		if (   m_Group[i].nRefCount > 0
+		    && m_Group[i].GroupIP == rGroupIP)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+void CIGMPHandler::QueryReceived (const u8 *pPacket, unsigned nLength)
+{
+	const TIGMPHeader *pHeader = (const TIGMPHeader *) pPacket;
+
+	unsigned nMaxResp = pHeader->nMaxRespCode;		// in 1/10 seconds
+	if (nLength >= IGMP_V3_QUERY_MIN_LENGTH)
+	{
+		if (nMaxResp >= 128)				// floating point format
+		{
+			nMaxResp = ((nMaxResp & 0x0F) | 0x10) << (((nMaxResp >> 4) & 0x07) + 3);
+		}
+	}
+	else
+	{
+		if (nMaxResp == 0)				// IGMPv1 query
+		{
+			nMaxResp = 100;
+		}
+
+		// answer with IGMPv2 reports, until no older querier has been seen for a while
+		m_nVersion = 2;
+		m_nOlderQuerierTicks = CTimer::Get ()->GetTicks ();
+	}
+
+	unsigned nMaxDelayTicks = nMaxResp * HZ / 10;
+
+	CIPAddress GroupIP (pHeader->GroupAddress);
+	for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		if (   m_Group[i].nRefCount > 0
+		    && (   GroupIP.IsNull ()			// general query
+			|| m_Group[i].GroupIP == GroupIP))
+		{
+			ScheduleReport (&m_Group[i], nMaxDelayTicks);
+		}
+	}
+}
+
+void CIGMPHandler::ReportReceived (const CIPAddress &rGroupIP)
+{
+	// report suppression is done in IGMPv2 mode only
+	if (m_nVersion >= 3)
+	{
+		return;
+	}
+
+	for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		TGroup *pGroup = &m_Group[i];
+		if (   pGroup->nRefCount > 0
+		    && pGroup->GroupIP == rGroupIP
+		    && !pGroup->bStateChange)
+		{
+			pGroup->bReportPending = FALSE;
+		}
+	}
+}
+
+void CIGMPHandler::ScheduleReport (TGroup *pGroup, unsigned nMaxDelayTicks)
+{
+	assert (pGroup != 0);
+
+	unsigned nDelay = nMaxDelayTicks > 0 ? m_Random.GetNumber () % nMaxDelayTicks : 0;
+	unsigned nReportTicks = CTimer::Get ()->GetTicks () + nDelay;
+
+	// an earlier pending report is kept
+	if (   pGroup->bReportPending
+	    && (int) (nReportTicks - pGroup->nReportTicks) >= 0)
+	{
+		return;
+	}
+
+	pGroup->bReportPending = TRUE;
+	pGroup->bStateChange = FALSE;
+	pGroup->nReportTicks = nReportTicks;
+}
+
+void CIGMPHandler::SendReports (void)
+{
+	assert (m_pNetConfig != 0);
+	if (m_pNetConfig->GetIPAddress ()->IsNull ())
+	{
+		return;
+	}
+
+	struct
+	{
+		TIGMPv3ReportHeader	Header;
+		TIGMPv3GroupRecord	Record[IGMP_MAX_GROUPS];
+	}
+	PACKED Report;
+	unsigned nRecords = 0;
+
+	unsigned nTicks = CTimer::Get ()->GetTicks ();
+	for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		TGroup *pGroup = &m_Group[i];
+		if (   pGroup->nRefCount == 0
+		    || !pGroup->bReportPending
+		    || (int) (nTicks - pGroup->nReportTicks) < 0)
+		{
+			continue;
+		}
+
+		if (m_nVersion < 3)
+		{
+			TIGMPHeader V2Report;
+			V2Report.nType = IGMP_TYPE_V2_REPORT;
+			V2Report.nMaxRespCode = 0;
+			pGroup->GroupIP.CopyTo (V2Report.GroupAddress);
+
+			SendMessage (pGroup->GroupIP, &V2Report, sizeof V2Report);
+		}
+		else
+		{
+			// the reports of all due groups are sent in one message
+			TIGMPv3GroupRecord *pRecord = &Report.Record[nRecords++];
+			pRecord->nRecordType =   pGroup->bStateChange
+					       ? IGMP_CHANGE_TO_EXCLUDE : IGMP_MODE_IS_EXCLUDE;
+			pRecord->nAuxDataLength = 0;
+			pRecord->nSources = 0;
+			pGroup->GroupIP.CopyTo (pRecord->GroupAddress);
+		}
+
+		if (   pGroup->bStateChange
+		    && pGroup->nRetransmissions > 0)
+		{
+			pGroup->nRetransmissions--;
+			pGroup->nReportTicks = nTicks + 1 + m_Random.GetNumber () % IGMP_UNSOLICITED_INTERVAL;
+		}
+		else
+		{
+			pGroup->bReportPending = FALSE;
+			pGroup->bStateChange = FALSE;
+		}
+	}
+
+	if (nRecords > 0)
+	{
+		Report.Header.nType = IGMP_TYPE_V3_REPORT;
+		Report.Header.nReserved1 = 0;
+		Report.Header.nReserved2 = 0;
+		Report.Header.nGroupRecords = le2be16 ((u16) nRecords);
+
+		SendMessage (CIPAddress (IGMP_V3_ROUTERS), &Report,
+			     sizeof (TIGMPv3ReportHeader) + nRecords * sizeof (TIGMPv3GroupRecord));
+	}
+}
+
+void CIGMPHandler::SendMessage (const CIPAddress &rDestIP, const void *pMessage, unsigned nLength)
+{
+	// the IP header gets the Router Alert option
+	CNetBuffer *pBuffer = new CNetBuffer (IP_PACKET_HEADROOM + IP_OPTION_ROUTER_ALERT_SIZE);
+	assert (pBuffer != 0);
+
+	assert (pMessage != 0);
+	assert (nLength >= sizeof (TIGMPHeader));
+	memcpy (pBuffer->GetData (), pMessage, nLength);
+	pBuffer->SetLength (nLength);
+
+	// the checksum is at the same offset in all message types
+	TIGMPHeader *pHeader = (TIGMPHeader *) pBuffer->GetData ();
+	pHeader->nChecksum = 0;
+	pHeader->nChecksum = CChecksumCalculator::SimpleCalculate (pHeader, nLength);
+
+	assert (m_pNetworkLayer != 0);
+	m_pNetworkLayer->Send (rDestIP, pBuffer, IPPROTO_IGMP);
+}
+
+void CIGMPHandler::UpdateFilter (void)
+{
+	CIPAddress Groups[IGMP_MAX_GROUPS + 1];
+	unsigned nCount = 0;
+
+	Groups[nCount++].Set (IGMP_ALL_HOSTS);
+
+	for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+	{
+		if (m_Group[i].nRefCount > 0)
+		{
+			Groups[nCount++].Set (m_Group[i].GroupIP);
+		}
+	}
+
+	assert (m_pLinkLayer != 0);
+	m_pLinkLayer->SetMulticastGroups (Groups, nCount);
+}
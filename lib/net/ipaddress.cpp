@@ -2,7 +2,7 @@
 // ipaddress.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -169,6 +169,18 @@ boolean CIPAddress::IsBroadcast (void) const
 	return m_nAddress == 0xFFFFFFFF;
 }
 
+boolean CIPAddress::IsMulticast (void) const
+{
+	assert (m_bValid);
+	return (m_nAddress & 0xF0) == 0xE0;
+}
+
+boolean CIPAddress::IsLoopback (void) const
+{
+	assert (m_bValid);
+	return (m_nAddress & 0xFF) == 127;
+}
+
 unsigned CIPAddress::GetSize (void) const
 {
 	return IP_ADDRESS_SIZE;
@@ -0,0 +1,255 @@
+//
+// iperfclient.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/iperfclient.h>
+#include <circle/net/netconfig.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define TCP_BUFFER_SIZE		0x20000
+#define FINAL_RETRIES		10		// times sending the final UDP datagram
+#define FINAL_TIMEOUT_MS	250		// waiting for the server report each time
+
+static const char FromIPerfClient[] = "iperf";
+
+CIPerfClient::CIPerfClient (CNetSubSystem *pNetSubSystem, const CIPAddress &rServerIP,
+			    int nProtocol, unsigned nDuration, unsigned nBandwidth, u16 usPort,
+			    unsigned nInterval)
+:	m_pNetSubSystem (pNetSubSystem),
+	m_ServerIP (rServerIP),
+	m_nProtocol (nProtocol),
+	m_nDuration (nDuration * 1000000),
+	m_nBandwidth (nBandwidth),
+	m_usPort (usPort),
+	m_pSocket (0),
+	m_pBuffer (0),
+	m_Reporter (FromIPerfClient, nInterval),
+	m_bFinished (FALSE),
+	m_nThroughput (0)
+{
+	assert (m_pNetSubSystem != 0);
+	assert (m_nProtocol == IPPROTO_TCP || m_nProtocol == IPPROTO_UDP);
+	assert (m_nDuration > 0);
+	assert (m_nBandwidth > 0);
+
+	SetName (FromIPerfClient);
+}
+
+CIPerfClient::~CIPerfClient (void)
+{
+	assert (m_pSocket == 0);
+	assert (m_pBuffer == 0);
+
+	m_pNetSubSystem = 0;
+}
+
+void CIPerfClient::Run (void)
+{
+	unsigned nBufferSize = m_nProtocol == IPPROTO_TCP ? TCP_BUFFER_SIZE : FRAME_BUFFER_SIZE;
+	m_pBuffer = new u8[nBufferSize];
+	assert (m_pBuffer != 0);
+
+	// same payload pattern as iperf
+	for (unsigned i = 0; i < nBufferSize; i++)
+	{
+		m_pBuffer[i] = '0' + i % 10;
+	}
+
+	assert (m_pNetSubSystem != 0);
+	m_pSocket = new CSocket (m_pNetSubSystem, m_nProtocol);
+	assert (m_pSocket != 0);
+
+	CString IPString;
+	m_ServerIP.Format (&IPString);
+
+	if (m_pSocket->Connect (m_ServerIP, m_usPort) < 0)
+	{
+		CLogger::Get ()->Write (FromIPerfClient, LogError, "Cannot connect to %s port %u",
+					(const char *) IPString, (unsigned) m_usPort);
+	}
+	else
+	{
+		CLogger::Get ()->Write (FromIPerfClient, LogNotice, "%s test to %s port %u",
+					m_nProtocol == IPPROTO_TCP ? "TCP" : "UDP",
+					(const char *) IPString, (unsigned) m_usPort);
+
+		if (m_nProtocol == IPPROTO_TCP ? TCPClient () : UDPClient ())
+		{
+			unsigned nDuration = m_Reporter.GetDuration ();
+			if (nDuration > 0)
+			{
+				m_nThroughput = (unsigned) (m_Reporter.GetBytes () * 8 * 1000 / nDuration);
+			}
+		}
+	}
+
+	delete m_pSocket;
+	m_pSocket = 0;
+
+	delete [] m_pBuffer;
+	m_pBuffer = 0;
+
+	m_bFinished = TRUE;
+}
+
+boolean CIPerfClient::IsFinished (void) const
+{
+	return m_bFinished;
+}
+
+unsigned CIPerfClient::GetThroughput (void) const
+{
+	return m_nThroughput;
+}
+
+boolean CIPerfClient::TCPClient (void)
+{
+	m_Reporter.Start ();
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	assert (m_pSocket != 0);
+	assert (m_pBuffer != 0);
+	while (CTimer::GetClockTicks () - nStartTicks < m_nDuration)
+	{
+		int nResult = m_pSocket->Send (m_pBuffer, TCP_BUFFER_SIZE, 0);
+		if (nResult <= 0)
+		{
+			CLogger::Get ()->Write (FromIPerfClient, LogError, "Connection closed");
+
+			return FALSE;
+		}
+
+		m_Reporter.Add (nResult, m_pSocket->GetRetransmissions ());
+	}
+
+	m_Reporter.Finish ();
+
+	return TRUE;
+}
+
+boolean CIPerfClient::UDPClient (void)
+{
+	// time between two datagrams in microseconds
+	unsigned nPeriod = IPERF_UDP_LENGTH * 8 * 1000 / m_nBandwidth;
+
+	m_Reporter.Start ();
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	assert (m_pSocket != 0);
+	assert (m_pBuffer != 0);
+	TIPerfUDPHeader *pHeader = (TIPerfUDPHeader *) m_pBuffer;
+
+	s32 nID = 0;
+	unsigned nTicks;
+	while ((nTicks = CTimer::GetClockTicks ()) - nStartTicks < m_nDuration)
+	{
+		unsigned nDue = (unsigned) nID * nPeriod;
+		if (nTicks - nStartTicks < nDue)
+		{
+			unsigned nWait = nDue - (nTicks - nStartTicks);
+			if (nWait >= 1000)
+			{
+				CScheduler::Get ()->usSleep (nWait);
+			}
+			else
+			{
+				CScheduler::Get ()->Yield ();
+			}
+
+			continue;
+		}
+
+		pHeader->nID = (s32) le2be32 ((u32) nID);
+		pHeader->nSeconds = le2be32 (nTicks / 1000000);
+		pHeader->nMicroSeconds = le2be32 (nTicks % 1000000);
+		pHeader->nID2 = 0;
+
+		if (m_pSocket->Send (m_pBuffer, IPERF_UDP_LENGTH, 0) != IPERF_UDP_LENGTH)
+		{
+			CLogger::Get ()->Write (FromIPerfClient, LogError, "Send failed");
+
+			return FALSE;
+		}
+
+		m_Reporter.Add (IPERF_UDP_LENGTH);
+
+		nID++;
+	}
+
+	m_Reporter.Finish ();
+
+	// send final datagram, until the server report is received
+	nTicks = CTimer::GetClockTicks ();
+	pHeader->nID = (s32) le2be32 ((u32) -nID);
+	pHeader->nSeconds = le2be32 (nTicks / 1000000);
+	pHeader->nMicroSeconds = le2be32 (nTicks % 1000000);
+
+	for (unsigned i = 0; i < FINAL_RETRIES; i++)
+	{
+		if (m_pSocket->Send (m_pBuffer, IPERF_UDP_LENGTH, 0) != IPERF_UDP_LENGTH)
+		{
+			break;
+		}
+
+		for (unsigned j = 0; j < FINAL_TIMEOUT_MS / 10; j++)
+		{
+			u8 Buffer[FRAME_BUFFER_SIZE];
+			int nResult = m_pSocket->Receive (Buffer, sizeof Buffer, MSG_DONTWAIT);
+			if (nResult >= (int) (sizeof (TIPerfUDPHeader) + sizeof (TIPerfServerReport)))
+			{
+				LogServerReport ((const TIPerfServerReport *)
+						 (Buffer + sizeof (TIPerfUDPHeader)));
+
+				return TRUE;
+			}
+
+			CScheduler::Get ()->MsSleep (10);
+		}
+	}
+
+	CLogger::Get ()->Write (FromIPerfClient, LogWarning, "No server report received");
+
+	return TRUE;
+}
+
+void CIPerfClient::LogServerReport (const TIPerfServerReport *pReport)
+{
+	assert (pReport != 0);
+
+	u64 nBytes =   (u64) be2le32 ((u32) pReport->nTotalLength1) << 32
+		     | be2le32 ((u32) pReport->nTotalLength2);
+	unsigned nDuration =   be2le32 ((u32) pReport->nStopSeconds) * 1000000
+			     + be2le32 ((u32) pReport->nStopMicroSeconds);
+	unsigned nJitter =   be2le32 ((u32) pReport->nJitterSeconds) * 1000000
+			   + be2le32 ((u32) pReport->nJitterMicroSeconds);
+	unsigned nLost = be2le32 ((u32) pReport->nErrorCount);
+	unsigned nDatagrams = be2le32 ((u32) pReport->nDatagrams);
+
+	unsigned nRate = nDuration > 0 ? (unsigned) (nBytes * 8 * 100 / nDuration) : 0;
+
+	CLogger::Get ()->Write (FromIPerfClient, LogNotice,
+				"Server report: %llu KBytes %u.%02u Mbits/sec jitter %u.%03u ms "
+				"lost %u/%u out-of-order %u",
+				nBytes / 1024, nRate / 100, nRate % 100,
+				nJitter / 1000, nJitter % 1000, nLost, nDatagrams,
+				be2le32 ((u32) pReport->nOutOfOrderCount));
+}
@@ -0,0 +1,258 @@
+//
+// iperfdaemon.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/iperfdaemon.h>
+#include <circle/net/netconfig.h>
+#include <circle/timer.h>
+#include <circle/logger.h>
+#include <circle/string.h>
+#include <circle/util.h>
+#include <assert.h>
+
+static const char FromIPerfDaemon[] = "iperfd";
+
+CIPerfDaemon::CIPerfDaemon (CNetSubSystem *pNetSubSystem, int nProtocol, u16 usPort,
+			    unsigned nInterval)
+:	m_pNetSubSystem (pNetSubSystem),
+	m_nProtocol (nProtocol),
+	m_usPort (usPort),
+	m_pSocket (0),
+	m_pBuffer (new u8[FRAME_BUFFER_SIZE]),
+	m_Reporter (FromIPerfDaemon, nInterval),
+	m_bUDPActive (FALSE),
+	m_nExpectedID (0),
+	m_nLost (0),
+	m_nOutOfOrder (0),
+	m_nDatagrams (0),
+	m_nLastTransit (0),
+	m_nJitter16 (0)
+{
+	assert (m_pNetSubSystem != 0);
+	assert (m_nProtocol == IPPROTO_TCP || m_nProtocol == IPPROTO_UDP);
+	assert (m_pBuffer != 0);
+
+	memset (&m_Report, 0, sizeof m_Report);
+
+	SetName (FromIPerfDaemon);
+}
+
+CIPerfDaemon::~CIPerfDaemon (void)
+{
+	delete m_pSocket;
+	m_pSocket = 0;
+
+	delete [] m_pBuffer;
+	m_pBuffer = 0;
+
+	m_pNetSubSystem = 0;
+}
+
+void CIPerfDaemon::Run (void)
+{
+	assert (m_pNetSubSystem != 0);
+	m_pSocket = new CSocket (m_pNetSubSystem, m_nProtocol);
+	assert (m_pSocket != 0);
+
+	if (m_pSocket->Bind (m_usPort) < 0)
+	{
+		CLogger::Get ()->Write (FromIPerfDaemon, LogError, "Cannot bind socket (port %u)",
+					m_usPort);
+
+		return;
+	}
+
+	CLogger::Get ()->Write (FromIPerfDaemon, LogNotice, "%s server listening on port %u",
+				m_nProtocol == IPPROTO_TCP ? "TCP" : "UDP", m_usPort);
+
+	if (m_nProtocol == IPPROTO_TCP)
+	{
+		TCPServer ();
+	}
+	else
+	{
+		UDPServer ();
+	}
+}
+
+void CIPerfDaemon::TCPServer (void)
+{
+	assert (m_pSocket != 0);
+	if (m_pSocket->Listen () < 0)
+	{
+		CLogger::Get ()->Write (FromIPerfDaemon, LogError, "Cannot listen on socket");
+
+		return;
+	}
+
+	while (1)
+	{
+		CIPAddress ForeignIP;
+		u16 nForeignPort;
+		CSocket *pConnection = m_pSocket->Accept (&ForeignIP, &nForeignPort);
+		if (pConnection == 0)
+		{
+			CLogger::Get ()->Write (FromIPerfDaemon, LogWarning, "Cannot accept connection");
+
+			continue;
+		}
+
+		CString IPString;
+		ForeignIP.Format (&IPString);
+		CLogger::Get ()->Write (FromIPerfDaemon, LogNotice, "Connected with %s port %u",
+					(const char *) IPString, (unsigned) nForeignPort);
+
+		m_Reporter.Start ();
+
+		int nResult;
+		while ((nResult = pConnection->Receive (m_pBuffer, FRAME_BUFFER_SIZE, 0)) > 0)
+		{
+			m_Reporter.Add (nResult);
+		}
+
+		m_Reporter.Finish ();
+
+		delete pConnection;
+	}
+}
+
+void CIPerfDaemon::UDPServer (void)
+{
+	while (1)
+	{
+		CIPAddress ForeignIP;
+		u16 nForeignPort;
+		assert (m_pSocket != 0);
+		int nResult = m_pSocket->ReceiveFrom (m_pBuffer, FRAME_BUFFER_SIZE, 0,
+						      &ForeignIP, &nForeignPort);
+		if (nResult < (int) sizeof (TIPerfUDPHeader))
+		{
+			continue;
+		}
+
+		const TIPerfUDPHeader *pHeader = (const TIPerfUDPHeader *) m_pBuffer;
+		if ((s32) be2le32 (pHeader->nID) >= 0)
+		{
+			if (!m_bUDPActive)
+			{
+				CString IPString;
+				ForeignIP.Format (&IPString);
+				CLogger::Get ()->Write (FromIPerfDaemon, LogNotice,
+							"Receiving from %s port %u",
+							(const char *) IPString, (unsigned) nForeignPort);
+			}
+
+			UDPDatagramReceived (pHeader, nResult);
+
+			continue;
+		}
+
+		// final datagram, the client repeats it, until it receives our report
+		if (m_bUDPActive)
+		{
+			UDPFinish ();
+		}
+
+		memcpy (m_pBuffer + sizeof (TIPerfUDPHeader), &m_Report, sizeof m_Report);
+
+		m_pSocket->SendTo (m_pBuffer, sizeof (TIPerfUDPHeader) + sizeof m_Report, 0,
+				   ForeignIP, nForeignPort);
+	}
+}
+
+void CIPerfDaemon::UDPDatagramReceived (const TIPerfUDPHeader *pHeader, unsigned nLength)
+{
+	assert (pHeader != 0);
+	s32 nID = (s32) be2le32 (pHeader->nID);
+
+	if (!m_bUDPActive)
+	{
+		m_bUDPActive = TRUE;
+
+		m_nExpectedID = 0;
+		m_nLost = 0;
+		m_nOutOfOrder = 0;
+		m_nDatagrams = 0;
+		m_nJitter16 = 0;
+
+		m_Reporter.Start ();
+	}
+
+	m_nDatagrams++;
+
+	if (nID >= m_nExpectedID)
+	{
+		m_nLost += nID - m_nExpectedID;
+		m_nExpectedID = nID + 1;
+	}
+	else
+	{
+		m_nOutOfOrder++;
+
+		if (m_nLost > 0)
+		{
+			m_nLost--;		// was counted as lost before
+		}
+	}
+
+	// jitter calculation according to RFC 1889 (the clocks need not be synchronized)
+	u32 nSent = be2le32 (pHeader->nSeconds) * 1000000 + be2le32 (pHeader->nMicroSeconds);
+	s32 nTransit = (s32) (CTimer::GetClockTicks () - nSent);
+	if (m_nDatagrams > 1)
+	{
+		s32 nDelta = nTransit - m_nLastTransit;
+		if (nDelta < 0)
+		{
+			nDelta = -nDelta;
+		}
+
+		m_nJitter16 += (unsigned) nDelta - m_nJitter16 / 16;
+	}
+	m_nLastTransit = nTransit;
+
+	m_Reporter.Add (nLength);
+}
+
+void CIPerfDaemon::UDPFinish (void)
+{
+	m_bUDPActive = FALSE;
+
+	unsigned nJitter = m_nJitter16 / 16;
+	unsigned nTotal = m_nExpectedID > 0 ? m_nExpectedID : 1;
+
+	CString Extra;
+	Extra.Format ("jitter %u.%03u ms lost %u/%u (%u%%) out-of-order %u",
+		      nJitter / 1000, nJitter % 1000, m_nLost, m_nExpectedID,
+		      m_nLost * 100 / nTotal, m_nOutOfOrder);
+
+	m_Reporter.Finish (Extra);
+
+	u64 nBytes = m_Reporter.GetBytes ();
+	unsigned nDuration = m_Reporter.GetDuration ();
+
+	m_Report.nFlags = (s32) le2be32 (IPERF_HEADER_VERSION1);
+	m_Report.nTotalLength1 = (s32) le2be32 ((u32) (nBytes >> 32));
+	m_Report.nTotalLength2 = (s32) le2be32 ((u32) nBytes);
+	m_Report.nStopSeconds = (s32) le2be32 (nDuration / 1000000);
+	m_Report.nStopMicroSeconds = (s32) le2be32 (nDuration % 1000000);
+	m_Report.nErrorCount = (s32) le2be32 (m_nLost);
+	m_Report.nOutOfOrderCount = (s32) le2be32 (m_nOutOfOrder);
+	m_Report.nDatagrams = (s32) le2be32 ((u32) m_nExpectedID);
+	m_Report.nJitterSeconds = (s32) le2be32 (nJitter / 1000000);
+	m_Report.nJitterMicroSeconds = (s32) le2be32 (nJitter % 1000000);
+}
@@ -0,0 +1,145 @@
+//
+// iperfreporter.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/iperfreporter.h>
+#include <circle/timer.h>
+#include <circle/logger.h>
+#include <circle/string.h>
+#include <assert.h>
+
+CIPerfReporter::CIPerfReporter (const char *pSource, unsigned nInterval)
+:	m_pSource (pSource),
+	m_nInterval (nInterval * 1000000),
+	m_nStartTicks (0),
+	m_nEndTicks (0),
+	m_nTotalBytes (0),
+	m_nRetransmissions (0),
+	m_nIntervalStart (0),
+	m_nIntervalBytes (0),
+	m_nIntervalRetransmissions (0)
+{
+	assert (m_pSource != 0);
+	assert (m_nInterval > 0);
+}
+
+CIPerfReporter::~CIPerfReporter (void)
+{
+	m_pSource = 0;
+}
+
+void CIPerfReporter::Start (void)
+{
+	CScheduler *pScheduler = CScheduler::Get ();
+	assert (pScheduler != 0);
+
+	for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+	{
+		m_IdleTimeStart[nCore] = pScheduler->GetIdleTime (nCore);
+		m_IdleTimeInterval[nCore] = m_IdleTimeStart[nCore];
+	}
+
+	m_nStartTicks = CTimer::GetClockTicks ();
+	m_nEndTicks = 0;
+	m_nTotalBytes = 0;
+	m_nRetransmissions = 0;
+
+	m_nIntervalStart = m_nStartTicks;
+	m_nIntervalBytes = 0;
+	m_nIntervalRetransmissions = 0;
+}
+
+void CIPerfReporter::Add (unsigned nBytes, unsigned nRetransmissions)
+{
+	m_nTotalBytes += nBytes;
+	m_nIntervalBytes += nBytes;
+	m_nRetransmissions = nRetransmissions;
+
+	unsigned nTicks = CTimer::GetClockTicks ();
+	if (nTicks - m_nIntervalStart < m_nInterval)
+	{
+		return;
+	}
+
+	Report (m_nIntervalStart - m_nStartTicks, nTicks - m_nStartTicks, m_nIntervalBytes,
+		nRetransmissions - m_nIntervalRetransmissions, m_IdleTimeInterval, 0);
+
+	CScheduler *pScheduler = CScheduler::Get ();
+	assert (pScheduler != 0);
+
+	for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+	{
+		m_IdleTimeInterval[nCore] = pScheduler->GetIdleTime (nCore);
+	}
+
+	m_nIntervalStart = nTicks;
+	m_nIntervalBytes = 0;
+	m_nIntervalRetransmissions = nRetransmissions;
+}
+
+void CIPerfReporter::Finish (const char *pExtra)
+{
+	m_nEndTicks = CTimer::GetClockTicks ();
+
+	Report (0, m_nEndTicks - m_nStartTicks, m_nTotalBytes, m_nRetransmissions,
+		m_IdleTimeStart, pExtra);
+}
+
+unsigned CIPerfReporter::GetDuration (void) const
+{
+	return (m_nEndTicks != 0 ? m_nEndTicks : CTimer::GetClockTicks ()) - m_nStartTicks;
+}
+
+u64 CIPerfReporter::GetBytes (void) const
+{
+	return m_nTotalBytes;
+}
+
+void CIPerfReporter::Report (unsigned nFrom, unsigned nTo, u64 nBytes, unsigned nRetransmissions,
+			     const u64 *pIdleTime, const char *pExtra)
+{
+	unsigned nDuration = nTo - nFrom;
+	if (nDuration == 0)
+	{
+		nDuration = 1;
+	}
+
+	// throughput in 10 Kbit/s units, to be displayed as Mbit/s with two decimals
+	unsigned nRate = (unsigned) (nBytes * 8 * 100 / nDuration);
+
+	CScheduler *pScheduler = CScheduler::Get ();
+	assert (pScheduler != 0);
+	assert (pIdleTime != 0);
+
+	CString Load;
+	for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+	{
+		u64 nIdle = pScheduler->GetIdleTime (nCore) - pIdleTime[nCore];
+		unsigned nLoad = nIdle < nDuration ? (unsigned) (100 - nIdle * 100 / nDuration) : 0;
+
+		CString Core;
+		Core.Format (" %u%%", nLoad);
+		Load.Append (Core);
+	}
+
+	CLogger::Get ()->Write (m_pSource, LogNotice,
+				"%3u.%u-%3u.%u sec %8llu KBytes %5u.%02u Mbits/sec retr %u load%s%s%s",
+				nFrom / 1000000, nFrom / 100000 % 10, nTo / 1000000, nTo / 100000 % 10,
+				nBytes / 1024, nRate / 100, nRate % 100, nRetransmissions,
+				(const char *) Load, pExtra != 0 ? " " : "", pExtra != 0 ? pExtra : "");
+}
@@ -0,0 +1,249 @@
+//
+// ipreassembly.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/ipreassembly.h>
+#include <circle/net/networklayer.h>
+#include <circle/net/netstatistics.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define IP_REASSEMBLY_TIMEOUT	(15 * HZ)		// RFC 791
+
+CIPReassembly::CIPReassembly (void)
+{
+	for (unsigned i = 0; i < IP_REASSEMBLY_MAX_DATAGRAMS; i++)
+	{
+		m_Datagram[i].pBuffer = 0;
+	}
+}
+
+CIPReassembly::~CIPReassembly (void)
+{
+	for (unsigned i = 0; i < IP_REASSEMBLY_MAX_DATAGRAMS; i++)
+	{
+		if (m_Datagram[i].pBuffer != 0)
+		{
+			m_Datagram[i].pBuffer->Release ();
+			m_Datagram[i].pBuffer = 0;
+		}
+	}
+}
+
+CNetBuffer *CIPReassembly::AddFragment (CNetBuffer *pFragment)
+{
+	NET_STAT_INC (NetCounterIPRxFragments);
+
+	assert (pFragment != 0);
+	TNetworkPrivateData *pData = (TNetworkPrivateData *) pFragment->GetPrivateData ();
+	assert (pData != 0);
+
+	TDatagram *pDatagram = Lookup (pData);
+	if (pDatagram == 0)
+	{
+		pDatagram = Allocate (pData);
+		assert (pDatagram != 0);
+	}
+
+	unsigned nOffset = pData->nFragmentOffset;
+	unsigned nLength = pFragment->GetLength ();
+	unsigned nEnd = nOffset + nLength;
+
+	// only the last fragment may have a length, which is not a multiple of 8
+	if (   nLength == 0
+	    || nEnd > IP_PAYLOAD_MAX_LENGTH
+	    || (pData->bMoreFragments && (nLength & 7) != 0)
+	    || (pDatagram->nTotalLength != 0 && nEnd > pDatagram->nTotalLength)
+	    || (!pData->bMoreFragments && (   pDatagram->nMaxEnd > nEnd
+					   || (   pDatagram->nTotalLength != 0
+					       && pDatagram->nTotalLength != nEnd))))
+	{
+		Drop (pDatagram);
+		pFragment->Release ();
+
+		return 0;
+	}
+
+	unsigned nFirstBlock = nOffset / 8;
+	unsigned nBlocks = (nLength + 7) / 8;
+	assert (nFirstBlock + nBlocks <= IP_REASSEMBLY_MAX_BLOCKS);
+
+	unsigned nBlocksSet = 0;
+	for (unsigned i = nFirstBlock; i < nFirstBlock + nBlocks; i++)
+	{
+		if (pDatagram->BlockMap[i / 32] & (1 << (i % 32)))
+		{
+			nBlocksSet++;
+		}
+	}
+
+	if (nBlocksSet != 0)
+	{
+		// ignore duplicate fragments, but not fragments, which overlap partially
+		if (nBlocksSet != nBlocks)
+		{
+			Drop (pDatagram);
+		}
+
+		pFragment->Release ();
+
+		return 0;
+	}
+
+	for (unsigned i = nFirstBlock; i < nFirstBlock + nBlocks; i++)
+	{
+		pDatagram->BlockMap[i / 32] |= 1 << (i % 32);
+	}
+	pDatagram->nBlocksReceived += nBlocks;
+
+	if (nEnd > pDatagram->nMaxEnd)
+	{
+		pDatagram->nMaxEnd = nEnd;
+	}
+
+	if (!pData->bMoreFragments)
+	{
+		pDatagram->nTotalLength = nEnd;
+	}
+
+	assert (pDatagram->pBuffer != 0);
+	memcpy (pDatagram->pBuffer->GetData () + nOffset, pFragment->GetData (), nLength);
+
+	pFragment->Release ();
+
+	if (   pDatagram->nTotalLength == 0
+	    || pDatagram->nBlocksReceived < (pDatagram->nTotalLength + 7) / 8)
+	{
+		return 0;
+	}
+
+	CNetBuffer *pBuffer = pDatagram->pBuffer;
+	pDatagram->pBuffer = 0;
+
+	pBuffer->SetLength (pDatagram->nTotalLength);
+
+	TNetworkPrivateData *pResultData = (TNetworkPrivateData *) pBuffer->GetPrivateData ();
+	pResultData->nProtocol = pDatagram->nProtocol;
+	memcpy (pResultData->SourceAddress, pDatagram->SourceAddress, IP_ADDRESS_SIZE);
+	memcpy (pResultData->DestinationAddress, pDatagram->DestinationAddress, IP_ADDRESS_SIZE);
+	pResultData->nIdentification = pDatagram->nIdentification;
+	pResultData->nFragmentOffset = 0;
+	pResultData->bMoreFragments = FALSE;
+
+	NET_STAT_INC (NetCounterIPRxReassembled);
+
+	return pBuffer;
+}
+
+void CIPReassembly::Process (void)
+{
+	unsigned nTicks = CTimer::Get ()->GetTicks ();
+
+	for (unsigned i = 0; i < IP_REASSEMBLY_MAX_DATAGRAMS; i++)
+	{
+		if (   m_Datagram[i].pBuffer != 0
+		    && nTicks - m_Datagram[i].nStartTicks >= IP_REASSEMBLY_TIMEOUT)
+		{
+			Drop (&m_Datagram[i]);
+		}
+	}
+}
+
+CIPReassembly::TDatagram *CIPReassembly::Lookup (const void *pPrivateData)
+{
+	const TNetworkPrivateData *pData = (const TNetworkPrivateData *) pPrivateData;
+	assert (pData != 0);
+
+	for (unsigned i = 0; i < IP_REASSEMBLY_MAX_DATAGRAMS; i++)
+	{
+		TDatagram *pDatagram = &m_Datagram[i];
+
+		if (   pDatagram->pBuffer != 0
+		    && pDatagram->nIdentification == pData->nIdentification
+		    && pDatagram->nProtocol == pData->nProtocol
+		    && memcmp (pDatagram->SourceAddress, pData->SourceAddress, IP_ADDRESS_SIZE) == 0
+		    && memcmp (pDatagram->DestinationAddress, pData->DestinationAddress,
+			       IP_ADDRESS_SIZE) == 0)
+		{
+			return pDatagram;
+		}
+	}
+
+	return 0;
+}
+
+CIPReassembly::TDatagram *CIPReassembly::Allocate (const void *pPrivateData)
+{
+	const TNetworkPrivateData *pData = (const TNetworkPrivateData *) pPrivateData;
+	assert (pData != 0);
+
+	unsigned nTicks = CTimer::Get ()->GetTicks ();
+
+	// use a free entry or drop the oldest datagram
+	TDatagram *pDatagram = 0;
+	for (unsigned i = 0; i < IP_REASSEMBLY_MAX_DATAGRAMS; i++)
+	{
+		if (m_Datagram[i].pBuffer == 0)
+		{
+			pDatagram = &m_Datagram[i];
+
+			break;
+		}
+
+		if (   pDatagram == 0
+		    ||   nTicks - m_Datagram[i].nStartTicks
+		       > nTicks - pDatagram->nStartTicks)
+		{
+			pDatagram = &m_Datagram[i];
+		}
+	}
+
+	assert (pDatagram != 0);
+	if (pDatagram->pBuffer != 0)
+	{
+		Drop (pDatagram);
+	}
+
+	// the headroom allows to send the datagram back in place (e.g. ICMP echo reply)
+	pDatagram->pBuffer = new CNetBuffer (IP_PACKET_HEADROOM);
+	assert (pDatagram->pBuffer != 0);
+	assert (pDatagram->pBuffer->GetMaxLength () >= IP_PAYLOAD_MAX_LENGTH);
+
+	pDatagram->nProtocol = pData->nProtocol;
+	memcpy (pDatagram->SourceAddress, pData->SourceAddress, IP_ADDRESS_SIZE);
+	memcpy (pDatagram->DestinationAddress, pData->DestinationAddress, IP_ADDRESS_SIZE);
+	pDatagram->nIdentification = pData->nIdentification;
+	pDatagram->nTotalLength = 0;
+	pDatagram->nMaxEnd = 0;
+	pDatagram->nBlocksReceived = 0;
+	pDatagram->nStartTicks = nTicks;
+	memset (pDatagram->BlockMap, 0, sizeof pDatagram->BlockMap);
+
+	return pDatagram;
+}
+
+void CIPReassembly::Drop (TDatagram *pDatagram)
+{
+	assert (pDatagram != 0);
+	assert (pDatagram->pBuffer != 0);
+	pDatagram->pBuffer->Release ();
+	pDatagram->pBuffer = 0;
+
+	NET_STAT_INC (NetCounterIPRxReassemblyFailed);
+}
@@ -2,7 +2,7 @@
 // linklayer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,6 +19,7 @@
 //
 #include <circle/net/linklayer.h>
 #include <circle/net/networklayer.h>
+#include <circle/net/netstatistics.h>
 #include <circle/util.h>
 #include <assert.h>
 
@@ -27,6 +28,8 @@ struct TRawPrivateData
 	u8	MACSender[MAC_ADDRESS_SIZE];
 };
 
+ASSERT_STATIC (sizeof (TRawPrivateData) <= NET_BUFFER_PRIVATE_SIZE);
+
 CLinkLayer::CLinkLayer (CNetConfig *pNetConfig, CNetDeviceLayer *pNetDevLayer)
 :	m_pNetConfig (pNetConfig),
 	m_pNetDevLayer (pNetDevLayer),
@@ -74,66 +77,88 @@ void CLinkLayer::Process (void)
 	}
 
 	assert (m_pNetDevLayer != 0);
-	u8 Buffer[FRAME_BUFFER_SIZE];
-	unsigned nLength;
-	while (m_pNetDevLayer->Receive (Buffer, &nLength))
+	CNetBuffer *pBuffer;
+	while ((pBuffer = m_pNetDevLayer->Receive ()) != 0)
 	{
-		assert (nLength <= FRAME_BUFFER_SIZE);
-		if (nLength <= sizeof (TEthernetHeader))
+		assert (pBuffer->GetLength () <= FRAME_BUFFER_SIZE);
+		if (pBuffer->GetLength () <= sizeof (TEthernetHeader))
 		{
+			pBuffer->Release ();
+
 			continue;
 		}
-		TEthernetHeader *pHeader = (TEthernetHeader *) Buffer;
+		TEthernetHeader *pHeader = (TEthernetHeader *) pBuffer->GetData ();
 
+		// the hardware multicast filter of the device may be imperfect
 		CMACAddress MACAddressReceiver (pHeader->MACReceiver);
 		if (    MACAddressReceiver != *pOwnMACAddress
-		    && !MACAddressReceiver.IsBroadcast ())
+		    && !MACAddressReceiver.IsBroadcast ()
+		    && (   !MACAddressReceiver.IsMulticast ()
+			|| !m_pNetDevLayer->IsMulticastAccepted (MACAddressReceiver)))
 		{
+			NET_STAT_INC (NetCounterLinkRxNotForUs);
+
+			pBuffer->Release ();
+
 			continue;
 		}
 
-		nLength -= sizeof (TEthernetHeader);
-		assert (nLength > 0);
+		// the frame is handed over in place, only the header is removed
+		pBuffer->RemoveHeader (sizeof (TEthernetHeader));
+		assert (pBuffer->GetLength () > 0);
 		
+		boolean bQueued = TRUE;
 		switch (pHeader->nProtocolType)
 		{
 		case BE (ETH_PROT_IP):
-			m_IPRxQueue.Enqueue (Buffer+sizeof (TEthernetHeader), nLength);
+			bQueued = m_IPRxQueue.Enqueue (pBuffer);
 			break;
 
 		case BE (ETH_PROT_ARP):
-			m_ARPRxQueue.Enqueue (Buffer+sizeof (TEthernetHeader), nLength);
+			bQueued = m_ARPRxQueue.Enqueue (pBuffer);
 			break;
 
 		default:
 			if (pHeader->nProtocolType == m_nRawProtocolType)
 			{
-				TRawPrivateData *pParam = new TRawPrivateData;
-				assert (pParam != 0);
-				memcpy (pParam->MACSender, pHeader->MACSender, MAC_ADDRESS_SIZE);
+				TRawPrivateData *pData = (TRawPrivateData *) pBuffer->GetPrivateData ();
+				memcpy (pData->MACSender, pHeader->MACSender, MAC_ADDRESS_SIZE);
+
+				bQueued = m_RawRxQueue.Enqueue (pBuffer);
+			}
+			else
+			{
+				NET_STAT_INC (NetCounterLinkRxUnknownProtocol);
 
-				m_RawRxQueue.Enqueue (Buffer+sizeof (TEthernetHeader),
-						      nLength, pParam);
+				pBuffer->Release ();
 			}
 			break;
 		}
+
+		if (!bQueued)
+		{
+			NET_STAT_INC (NetCounterLinkRxQueueFull);
+		}
 	}
 
 	assert (m_pARPHandler != 0);
 	m_pARPHandler->Process ();
 }
 
-boolean CLinkLayer::Send (const CIPAddress &rReceiver, const void *pIPPacket, unsigned nLength)
+boolean CLinkLayer::Send (const CIPAddress &rReceiver, CNetBuffer *pIPPacket)
 {
-	unsigned nFrameLength = sizeof (TEthernetHeader) + nLength;	// may wrap
+	assert (pIPPacket != 0);
+	unsigned nFrameLength = sizeof (TEthernetHeader) + pIPPacket->GetLength ();
 	if (   nFrameLength <= sizeof (TEthernetHeader)
 	    || nFrameLength > FRAME_BUFFER_SIZE)
 	{
+		pIPPacket->Release ();
+
 		return FALSE;
 	}
 
-	u8 FrameBuffer[nFrameLength];
-	TEthernetHeader *pHeader = (TEthernetHeader *) FrameBuffer;
+	TEthernetHeader *pHeader =
+		(TEthernetHeader *) pIPPacket->PrependHeader (sizeof (TEthernetHeader));
 
 	assert (m_pNetDevLayer != 0);
 	const CMACAddress *pOwnMACAddress = m_pNetDevLayer->GetMACAddress ();
@@ -142,10 +167,6 @@ boolean CLinkLayer::Send (const CIPAddress &rReceiver, const void *pIPPacket, un
 
 	pHeader->nProtocolType = BE (ETH_PROT_IP);
 
-	assert (pIPPacket != 0);
-	assert (nLength > 0);
-	memcpy (FrameBuffer+sizeof (TEthernetHeader), pIPPacket, nLength);
-
 	assert (m_pNetConfig != 0);
 	assert (m_pARPHandler != 0);
 	CMACAddress MACAddressReceiver;
@@ -154,26 +175,85 @@ boolean CLinkLayer::Send (const CIPAddress &rReceiver, const void *pIPPacket, un
 	{
 		MACAddressReceiver.SetBroadcast ();
 	}
-	else if (!m_pARPHandler->Resolve (rReceiver, &MACAddressReceiver,
-					  FrameBuffer, nFrameLength))
+	else if (rReceiver.IsMulticast ())
+	{
+		MACAddressReceiver.SetMulticast (rReceiver.Get ());
+	}
+	else if (!m_pARPHandler->Resolve (rReceiver, &MACAddressReceiver, pIPPacket))
 	{
+		pIPPacket->Release ();
+
 		return TRUE;		// packet will be retransmitted by ARP handler
 	}
 
 	MACAddressReceiver.CopyTo (pHeader->MACReceiver);
 
-	m_pNetDevLayer->Send (FrameBuffer, nFrameLength);
+	m_pNetDevLayer->Send (pIPPacket);
 
 	return TRUE;
 }
 
-boolean CLinkLayer::Receive (void *pBuffer, unsigned *pResultLength)
+CNetBuffer *CLinkLayer::Receive (void)
 {
-	assert (pBuffer != 0);
-	assert (pResultLength != 0);
-	*pResultLength = m_IPRxQueue.Dequeue (pBuffer);
+	return m_IPRxQueue.Dequeue ();
+}
 
-	return *pResultLength != 0 ? TRUE : FALSE;
+void CLinkLayer::SetMulticastGroups (const CIPAddress *pGroups, unsigned nCount)
+{
+	assert (nCount <= MAX_MULTICAST_ADDRESSES);
+
+	// several groups may map to the same MAC address
+	CMACAddress Filter[MAX_MULTICAST_ADDRESSES];
+	unsigned nFilterCount = 0;
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		assert (pGroups != 0);
+		assert (pGroups[i].IsMulticast ());
+		CMACAddress MACAddress;
+		MACAddress.SetMulticast (pGroups[i].Get ());
+
+		unsigned j;
+		for (j = 0; j < nFilterCount; j++)
+		{
+			if (Filter[j] == MACAddress)
+			{
+				break;
+			}
+		}
+
+		if (j == nFilterCount)
+		{
+			Filter[nFilterCount++].Set (MACAddress.Get ());
+		}
+	}
+
+	assert (m_pNetDevLayer != 0);
+	m_pNetDevLayer->SetMulticastFilter (Filter, nFilterCount);
+}
+
+unsigned CLinkLayer::GetOffloadCapabilities (void) const
+{
+	assert (m_pNetDevLayer != 0);
+	return m_pNetDevLayer->GetOffloadCapabilities ();
+}
+
+void CLinkLayer::AddARPEntry (const CIPAddress &rIPAddress, const CMACAddress &rMACAddress)
+{
+	assert (m_pARPHandler != 0);
+	m_pARPHandler->AddEntry (rIPAddress, rMACAddress);
+}
+
+boolean CLinkLayer::LookupARPEntry (const CIPAddress &rIPAddress, CMACAddress *pMACAddress)
+{
+	assert (m_pARPHandler != 0);
+	assert (pMACAddress != 0);
+	return m_pARPHandler->Lookup (rIPAddress, pMACAddress);
+}
+
+void CLinkLayer::FlushARPCache (void)
+{
+	assert (m_pARPHandler != 0);
+	m_pARPHandler->Flush ();
 }
 
 boolean CLinkLayer::SendRaw (const void *pFrame, unsigned nLength)
@@ -188,24 +268,24 @@ boolean CLinkLayer::SendRaw (const void *pFrame, unsigned nLength)
 
 boolean CLinkLayer::ReceiveRaw (void *pBuffer, unsigned *pResultLength, CMACAddress *pSender)
 {
-	void *pParam;
-	assert (pBuffer != 0);
-	assert (pResultLength != 0);
-	*pResultLength = m_RawRxQueue.Dequeue (pBuffer, &pParam);
-	if (*pResultLength == 0)
+	CNetBuffer *pNetBuffer = m_RawRxQueue.Dequeue ();
+	if (pNetBuffer == 0)
 	{
 		return FALSE;
 	}
 
-	TRawPrivateData *pData = (TRawPrivateData *) pParam;
+	assert (pBuffer != 0);
+	assert (pResultLength != 0);
+	*pResultLength = pNetBuffer->GetLength ();
+	memcpy (pBuffer, pNetBuffer->GetData (), *pResultLength);
 
 	if (pSender != 0)
 	{
-		assert (pData != 0);
+		TRawPrivateData *pData = (TRawPrivateData *) pNetBuffer->GetPrivateData ();
 		pSender->Set (pData->MACSender);
 	}
 
-	delete pData;
+	pNetBuffer->Release ();
 
 	return TRUE;
 }
@@ -0,0 +1,62 @@
+//
+// loopbackdevice.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/loopbackdevice.h>
+#include <assert.h>
+
+// locally administered unicast address
+static const u8 LoopbackMACAddress[MAC_ADDRESS_SIZE] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+CLoopbackDevice::CLoopbackDevice (void)
+:	m_MACAddress (LoopbackMACAddress)
+{
+	AddNetDevice ();
+}
+
+CLoopbackDevice::~CLoopbackDevice (void)
+{
+}
+
+const CMACAddress *CLoopbackDevice::GetMACAddress (void) const
+{
+	return &m_MACAddress;
+}
+
+boolean CLoopbackDevice::SendFrame (const void *pBuffer, unsigned nLength)
+{
+	assert (pBuffer != 0);
+	assert (nLength > 0);
+
+	return m_Queue.Enqueue (pBuffer, nLength);
+}
+
+boolean CLoopbackDevice::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
+{
+	assert (pBuffer != 0);
+	unsigned nLength = m_Queue.Dequeue (pBuffer);
+	if (nLength == 0)
+	{
+		return FALSE;
+	}
+
+	assert (pResultLength != 0);
+	*pResultLength = nLength;
+
+	return TRUE;
+}
@@ -2,7 +2,7 @@
 // mqttclient.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -57,11 +57,18 @@ CMQTTClient::CMQTTClient (CNetSubSystem *pNetSubSystem, size_t nMaxPacketSize,
 	m_pTimer (CTimer::Get ()),
 	m_pSocket (0),
 	m_ConnectStatus (MQTTStatusDisconnected),
-	m_ReceivePacket (nMaxPacketSize, nMaxPacketsQueued)
+	m_nMaxInFlight (MQTT_MAX_IN_FLIGHT),
+	m_nInFlight (0),
+	m_nMaxBatch (1),
+	m_nBatchCount (0),
+	m_Arena (nMaxPacketSize*nMaxPacketsQueued + FRAME_BUFFER_SIZE + nMaxTopicSize+1 + 256),
+	m_ReceivePacket (nMaxPacketSize, nMaxPacketsQueued, &m_Arena)
 {
 	SetName (FromMQTTClient);
 
-	m_pTopicBuffer = new char [m_nMaxTopicSize+1];
+	// both buffers are taken from the same chunk with a single heap allocation
+	m_pTopicBuffer = (char *) m_Arena.Allocate (m_nMaxTopicSize+1, 1);
+	assert (m_pTopicBuffer != 0);
 }
 
 CMQTTClient::~CMQTTClient (void)
@@ -69,10 +76,10 @@ CMQTTClient::~CMQTTClient (void)
 	assert (m_ConnectStatus == MQTTStatusDisconnected);
 	assert (m_pSocket == 0);
 
+	CleanupBatch ();
 	CleanupQueue ();
 	CleanupPacketIdentifierStore ();
 
-	delete [] m_pTopicBuffer;
 	m_pTopicBuffer = 0;
 
 	m_pTimer = 0;
@@ -305,8 +312,137 @@ void CMQTTClient::Unsubscribe (const char *pTopic)
 	InsertPacketIntoQueue (pPacket, m_pTimer->GetTicks () + MQTT_RESEND_TIMEOUT);
 }
 
-void CMQTTClient::Publish (const char *pTopic, const u8 *pPayload, size_t nPayloadLength,
-			   u8 uchQoS, boolean bRetain)
+boolean CMQTTClient::Publish (const char *pTopic, const u8 *pPayload, size_t nPayloadLength,
+			      u8 uchQoS, boolean bRetain)
+{
+	if (   !IsConnected ()
+	    || (uchQoS > MQTT_QOS_AT_MOST_ONCE && !CanPublish ()))
+	{
+		return FALSE;
+	}
+
+	CMQTTSendPacket *pPacket = CreatePublishPacket (pTopic, uchQoS, bRetain);
+	assert (pPacket != 0);
+
+	if (nPayloadLength > 0)
+	{
+		assert (pPayload != 0);
+		pPacket->AppendData (pPayload, nPayloadLength);
+	}
+
+	return PublishPacket (pPacket);
+}
+
+boolean CMQTTClient::PublishZeroCopy (const char *pTopic, const u8 *pPayload, size_t nPayloadLength,
+				      TNetSendCompletionHandler *pHandler, void *pParam,
+				      u8 uchQoS, boolean bRetain)
+{
+	assert (pHandler != 0);
+
+	if (   !IsConnected ()
+	    || (uchQoS > MQTT_QOS_AT_MOST_ONCE && !CanPublish ()))
+	{
+		(*pHandler) (pPayload, pParam);
+
+		return FALSE;
+	}
+
+	CMQTTSendPacket *pPacket = CreatePublishPacket (pTopic, uchQoS, bRetain);
+	assert (pPacket != 0);
+
+	pPacket->SetPayloadReference (pPayload, nPayloadLength, pHandler, pParam);
+
+	return PublishPacket (pPacket);
+}
+
+void CMQTTClient::SetPublishWindow (unsigned nMaxInFlight)
+{
+	assert (nMaxInFlight >= 1);
+	m_nMaxInFlight = nMaxInFlight;
+}
+
+void CMQTTClient::SetPublishBatching (unsigned nMaxBatch)
+{
+	assert (1 <= nMaxBatch && nMaxBatch <= MQTT_MAX_BATCH);
+
+	if (nMaxBatch < m_nMaxBatch)
+	{
+		FlushPublish ();
+	}
+
+	m_nMaxBatch = nMaxBatch;
+}
+
+boolean CMQTTClient::FlushPublish (void)
+{
+	if (m_nBatchCount == 0)
+	{
+		return TRUE;
+	}
+
+	if (m_ConnectStatus == MQTTStatusDisconnected)
+	{
+		CleanupBatch ();
+
+		return FALSE;
+	}
+
+	TNetIOVector IOVector[MQTT_MAX_BATCH*2];
+	unsigned nCount = 0;
+	int nLength = 0;
+	for (unsigned i = 0; i < m_nBatchCount; i++)
+	{
+		assert (m_pBatch[i] != 0);
+		unsigned nEntries = m_pBatch[i]->Prepare (&IOVector[nCount]);
+		if (nEntries == 0)
+		{
+			CloseConnection (MQTTDisconnectSendFailed);
+
+			return FALSE;
+		}
+
+		for (unsigned j = 0; j < nEntries; j++)
+		{
+			nLength += IOVector[nCount++].nLength;
+		}
+	}
+
+	assert (m_pSocket != 0);
+	if (m_pSocket->SendV (IOVector, nCount, MSG_DONTWAIT) != nLength)
+	{
+		CloseConnection (MQTTDisconnectSendFailed);
+
+		return FALSE;
+	}
+
+	PacketSent (MQTTPublish);
+
+	for (unsigned i = 0; i < m_nBatchCount; i++)
+	{
+		CMQTTSendPacket *pPacket = m_pBatch[i];
+		m_pBatch[i] = 0;
+
+		if (pPacket->GetQoS () >= MQTT_QOS_AT_LEAST_ONCE)
+		{
+			InsertPacketIntoQueue (pPacket, m_pTimer->GetTicks () + MQTT_RESEND_TIMEOUT);
+		}
+		else
+		{
+			delete pPacket;
+		}
+	}
+
+	m_nBatchCount = 0;
+
+	return TRUE;
+}
+
+boolean CMQTTClient::CanPublish (void) const
+{
+	return m_nInFlight < m_nMaxInFlight;
+}
+
+CMQTTSendPacket *CMQTTClient::CreatePublishPacket (const char *pTopic, u8 uchQoS, boolean bRetain)
 {
 	assert (pTopic != 0);
 
@@ -317,23 +453,50 @@ void CMQTTClient::Publish (const char *pTopic, const u8 *pPayload, size_t nPaylo
 		uchFlags |= MQTT_FLAG_RETAIN;
 	}
 
-	u16 usPacketIdentifier = m_usNextPacketIdentifier;
-	if (++m_usNextPacketIdentifier == 0)
-	{
-		m_usNextPacketIdentifier++;
-	}
-
 	CMQTTSendPacket *pPacket = new CMQTTSendPacket (MQTTPublish, m_nMaxPacketSize);
 	assert (pPacket != 0);
 
 	pPacket->SetFlags (uchFlags);
+	pPacket->SetQoS (uchQoS);
 	pPacket->AppendString (pTopic);
-	pPacket->AppendWord (usPacketIdentifier);
 
-	if (nPayloadLength > 0)
+	// the packet identifier is only present with QoS 1/2
+	if (uchQoS >= MQTT_QOS_AT_LEAST_ONCE)
 	{
-		assert (pPayload != 0);
-		pPacket->AppendData (pPayload, nPayloadLength);
+		u16 usPacketIdentifier = m_usNextPacketIdentifier;
+		if (++m_usNextPacketIdentifier == 0)
+		{
+			m_usNextPacketIdentifier++;
+		}
+
+		pPacket->AppendWord (usPacketIdentifier);
+		pPacket->SetPacketIdentifier (usPacketIdentifier);
+	}
+
+	return pPacket;
+}
+
+boolean CMQTTClient::PublishPacket (CMQTTSendPacket *pPacket)
+{
+	assert (pPacket != 0);
+	boolean bQoS = pPacket->GetQoS () >= MQTT_QOS_AT_LEAST_ONCE;
+
+	if (m_nMaxBatch > 1)
+	{
+		assert (m_nBatchCount < m_nMaxBatch);
+		m_pBatch[m_nBatchCount++] = pPacket;
+
+		if (bQoS)
+		{
+			m_nInFlight++;
+		}
+
+		if (m_nBatchCount < m_nMaxBatch)
+		{
+			return TRUE;
+		}
+
+		return FlushPublish ();
 	}
 
 	if (!SendPacket (pPacket))
@@ -342,13 +505,12 @@ void CMQTTClient::Publish (const char *pTopic, const u8 *pPayload, size_t nPaylo
 
 		CloseConnection (MQTTDisconnectSendFailed);
 
-		return;
+		return FALSE;
 	}
 
-	if (uchQoS >= MQTT_QOS_AT_LEAST_ONCE)
+	if (bQoS)
 	{
-		pPacket->SetQoS (uchQoS);
-		pPacket->SetPacketIdentifier (usPacketIdentifier);
+		m_nInFlight++;
 
 		InsertPacketIntoQueue (pPacket, m_pTimer->GetTicks () + MQTT_RESEND_TIMEOUT);
 	}
@@ -356,6 +518,19 @@ void CMQTTClient::Publish (const char *pTopic, const u8 *pPayload, size_t nPaylo
 	{
 		delete pPacket;
 	}
+
+	return TRUE;
+}
+
+void CMQTTClient::CleanupBatch (void)
+{
+	for (unsigned i = 0; i < m_nBatchCount; i++)
+	{
+		delete m_pBatch[i];
+		m_pBatch[i] = 0;
+	}
+
+	m_nBatchCount = 0;
 }
 
 void CMQTTClient::Run (void)
@@ -376,6 +551,8 @@ void CMQTTClient::Run (void)
 		}
 
 		OnLoop ();
+
+		FlushPublish ();
 	}
 }
 
@@ -517,10 +694,16 @@ void CMQTTClient::Receiver (void)
 
 			CMQTTSendPacket *pPacket = RemovePacketFromQueue (usPacketIdentifier);
 			if (   pPacket == 0
+			    || pPacket->GetType () != MQTTPublish
 			    || pPacket->GetQoS () != MQTT_QOS_AT_LEAST_ONCE)
 			{
 				CloseConnection (MQTTDisconnectPacketIdentifier);
 			}
+			else
+			{
+				assert (m_nInFlight > 0);
+				m_nInFlight--;
+			}
 
 			delete pPacket;
 			} break;
@@ -590,10 +773,16 @@ void CMQTTClient::Receiver (void)
 
 			CMQTTSendPacket *pPacket = RemovePacketFromQueue (usPacketIdentifier);
 			if (   pPacket == 0
+			    || pPacket->GetType () != MQTTPubRel
 			    || pPacket->GetQoS () != MQTT_QOS_EXACTLY_ONCE)
 			{
 				CloseConnection (MQTTDisconnectPacketIdentifier);
 			}
+			else
+			{
+				assert (m_nInFlight > 0);
+				m_nInFlight--;
+			}
 
 			delete pPacket;
 			} break;
@@ -733,8 +922,10 @@ void CMQTTClient::CloseConnection (TMQTTDisconnectReason Reason)
 	m_ConnectStatus = MQTTStatusDisconnected;
 
 	m_bTimerRunning = FALSE;
+	CleanupBatch ();
 	CleanupQueue ();
 	CleanupPacketIdentifierStore ();
+	m_nInFlight = 0;
 
 	assert (m_pSocket != 0);
 	delete m_pSocket;
@@ -750,6 +941,13 @@ boolean CMQTTClient::SendPacket (CMQTTSendPacket *pPacket)
 		return FALSE;
 	}
 
+	// keep the order of packets
+	if (   m_nBatchCount > 0
+	    && !FlushPublish ())
+	{
+		return FALSE;
+	}
+
 	assert (pPacket != 0);
 	assert (m_pSocket != 0);
 	if (!pPacket->Send (m_pSocket))
@@ -757,8 +955,15 @@ boolean CMQTTClient::SendPacket (CMQTTSendPacket *pPacket)
 		return FALSE;
 	}
 
+	PacketSent (pPacket->GetType ());
+
+	return TRUE;
+}
+
+void CMQTTClient::PacketSent (TMQTTPacketType Type)
+{
 	// keep alive handling
-	switch (pPacket->GetType ())
+	switch (Type)
 	{
 	case MQTTConnect:
 	case MQTTPublish:
@@ -792,8 +997,6 @@ boolean CMQTTClient::SendPacket (CMQTTSendPacket *pPacket)
 		assert (0);
 		break;
 	}
-
-	return TRUE;
 }
 
 void CMQTTClient::InsertPacketIntoQueue (CMQTTSendPacket *pPacket, unsigned nScheduledTime)
@@ -866,48 +1069,20 @@ void CMQTTClient::CleanupQueue (void)
 
 void CMQTTClient::InsertPacketIdentifierIntoStore (u16 usPacketIdentifier)
 {
-	void *pPtr = (void *) (uintptr) usPacketIdentifier;
-
-	TPtrListElement *pFirst = m_PacketIdentifierStore.GetFirst ();
-	if (pFirst == 0)
-	{
-		m_PacketIdentifierStore.InsertAfter (0, pPtr);
-	}
-	else
-	{
-		m_PacketIdentifierStore.InsertBefore (pFirst, pPtr);
-	}
+	m_PacketIdentifierStore.Insert (usPacketIdentifier, TRUE);
 }
 
 boolean CMQTTClient::IsPacketIdentifierInStore (u16 usPacketIdentifier)
 {
-	void *pPtr = (void *) (uintptr) usPacketIdentifier;
-
-	return m_PacketIdentifierStore.Find (pPtr) != 0;
+	return m_PacketIdentifierStore.Contains (usPacketIdentifier);
 }
 
 boolean CMQTTClient::RemovePacketIdentifierFromStore (u16 usPacketIdentifier)
 {
-	void *pPtr = (void *) (uintptr) usPacketIdentifier;
-
-	TPtrListElement *pElement = m_PacketIdentifierStore.Find (pPtr);
-	if (pElement == 0)
-	{
-		return FALSE;
-	}
-
-	m_PacketIdentifierStore.Remove (pElement);
-
-	return TRUE;
+	return m_PacketIdentifierStore.Remove (usPacketIdentifier);
 }
 
 void CMQTTClient::CleanupPacketIdentifierStore (void)
 {
-	TPtrListElement *pElement = m_PacketIdentifierStore.GetFirst ();
-	while (pElement != 0)
-	{
-		TPtrListElement *pNextElement = m_PacketIdentifierStore.GetNext (pElement);
-		m_PacketIdentifierStore.Remove (pElement);
-		pElement = pNextElement;
-	}
+	m_PacketIdentifierStore.Clear ();
 }
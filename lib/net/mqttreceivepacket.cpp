@@ -2,7 +2,7 @@
 // mqttreceivepacket.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,18 +20,32 @@
 #include <circle/net/mqttreceivepacket.h>
 #include <circle/net/in.h>
 
-CMQTTReceivePacket::CMQTTReceivePacket (size_t nMaxPacketSize, size_t nMaxPacketsQueued)
+CMQTTReceivePacket::CMQTTReceivePacket (size_t nMaxPacketSize, size_t nMaxPacketsQueued,
+					CArena *pArena)
 :	m_nBufferSize (nMaxPacketSize*nMaxPacketsQueued + FRAME_BUFFER_SIZE),
+	m_bFromArena (pArena != 0),
 	m_nInPtr (0)
 {
 	assert (nMaxPacketSize >= 128);
 	assert (nMaxPacketsQueued >= 1);
-	m_pBuffer = new u8[m_nBufferSize];
+
+	if (m_bFromArena)
+	{
+		m_pBuffer = (u8 *) pArena->Allocate (m_nBufferSize);
+	}
+	else
+	{
+		m_pBuffer = new u8[m_nBufferSize];
+	}
 }
 
 CMQTTReceivePacket::~CMQTTReceivePacket (void)
 {
-	delete [] m_pBuffer;
+	if (!m_bFromArena)
+	{
+		delete [] m_pBuffer;
+	}
+
 	m_pBuffer = 0;
 }
 
@@ -2,7 +2,7 @@
 // mqttsendpacket.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -30,6 +30,10 @@ CMQTTSendPacket::CMQTTSendPacket (TMQTTPacketType Type, size_t nMaxPacketSize)
 	m_bError (FALSE),
 	m_nBufPtr (MAX_LENGTH_FIXED_HEADER),
 	m_uchFlags (0),
+	m_pPayload (0),
+	m_nPayloadLength (0),
+	m_pCompletionHandler (0),
+	m_pCompletionParam (0),
 	m_nSendTries (MQTT_SEND_TRIES)
 {
 	assert (m_nMaxPacketSize >= 128);
@@ -51,6 +55,13 @@ CMQTTSendPacket::CMQTTSendPacket (TMQTTPacketType Type, size_t nMaxPacketSize)
 
 CMQTTSendPacket::~CMQTTSendPacket (void)
 {
+	if (m_pCompletionHandler != 0)
+	{
+		(*m_pCompletionHandler) (m_pPayload, m_pCompletionParam);
+		m_pCompletionHandler = 0;
+	}
+	m_pPayload = 0;
+
 	delete [] m_pBuffer;
 	m_pBuffer = 0;
 }
@@ -147,22 +158,62 @@ void CMQTTSendPacket::AppendData (const u8 *pBuffer, size_t nLength)
 	}
 }
 
+void CMQTTSendPacket::SetPayloadReference (const u8 *pBuffer, size_t nLength,
+					   TNetSendCompletionHandler *pHandler, void *pParam)
+{
+	assert (m_pPayload == 0);
+	assert (pBuffer != 0 || nLength == 0);
+
+	m_pPayload = pBuffer;
+	m_nPayloadLength = nLength;
+	m_pCompletionHandler = pHandler;
+	m_pCompletionParam = pParam;
+}
+
 boolean CMQTTSendPacket::Send (CSocket *pSocket)
 {
-	if (m_bError)
+	TNetIOVector IOVector[2];
+	unsigned nCount = Prepare (IOVector);
+	if (nCount == 0)
 	{
 		return FALSE;
 	}
 
-	if (m_nSendTries == 0)
+	int nSendLength = 0;
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		nSendLength += IOVector[i].nLength;
+	}
+
+	assert (pSocket != 0);
+	if (pSocket->SendV (IOVector, nCount, MSG_DONTWAIT) != nSendLength)
 	{
 		return FALSE;
 	}
+
+	return TRUE;
+}
+
+unsigned CMQTTSendPacket::Prepare (TNetIOVector *pIOVector)
+{
+	if (m_bError)
+	{
+		return 0;
+	}
+
+	if (m_nSendTries == 0)
+	{
+		return 0;
+	}
 	m_nSendTries--;
 
 	// calculate and encode remaining length
 	assert (m_nBufPtr >= MAX_LENGTH_FIXED_HEADER);
-	unsigned nRemainingLength = m_nBufPtr-MAX_LENGTH_FIXED_HEADER;
+	unsigned nRemainingLength = m_nBufPtr-MAX_LENGTH_FIXED_HEADER + m_nPayloadLength;
+	if (nRemainingLength > MQTT_MAX_REMAINING_LENGTH)
+	{
+		return 0;
+	}
 
 	u8 EncodedLength[4];
 	unsigned nTempLength = nRemainingLength;
@@ -184,7 +235,7 @@ boolean CMQTTSendPacket::Send (CSocket *pSocket)
 
 	// insert remaining length
 	assert (nLengthBytes > 0);
-	assert (nLengthBytes < MAX_LENGTH_FIXED_HEADER-1);
+	assert (nLengthBytes <= MAX_LENGTH_FIXED_HEADER-1);
 	assert (m_pBuffer != 0);
 	for (unsigned i = 0; i < nLengthBytes; i++)
 	{
@@ -194,15 +245,19 @@ boolean CMQTTSendPacket::Send (CSocket *pSocket)
 	// insert control byte
 	m_pBuffer[MAX_LENGTH_FIXED_HEADER-nLengthBytes-1] = ((u8) m_Type << 4) | m_uchFlags;
 
-	assert (pSocket != 0);
-	int nSendLength = 1+nLengthBytes+nRemainingLength;
-	if (pSocket->Send (&m_pBuffer[MAX_LENGTH_FIXED_HEADER-nLengthBytes-1],
-			   nSendLength, MSG_DONTWAIT) != nSendLength)
+	assert (pIOVector != 0);
+	pIOVector[0].pData = &m_pBuffer[MAX_LENGTH_FIXED_HEADER-nLengthBytes-1];
+	pIOVector[0].nLength = m_nBufPtr-(MAX_LENGTH_FIXED_HEADER-nLengthBytes-1);
+
+	if (m_nPayloadLength == 0)
 	{
-		return FALSE;
+		return 1;
 	}
 
-	return TRUE;
+	pIOVector[1].pData = m_pPayload;
+	pIOVector[1].nLength = m_nPayloadLength;
+
+	return 2;
 }
 
 TMQTTPacketType CMQTTSendPacket::GetType (void) const
@@ -0,0 +1,275 @@
+//
+// netcapture.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/netcapture.h>
+#include <circle/net/netdevlayer.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#include <assert.h>
+
+// See: https://www.ietf.org/archive/id/draft-tuexen-opsawg-pcapng-04.html
+#define PCAPNG_SECTION_HEADER		0x0A0D0D0A
+	#define PCAPNG_BYTE_ORDER_MAGIC		0x1A2B3C4D
+#define PCAPNG_INTERFACE_DESCRIPTION	0x00000001
+	#define PCAPNG_LINKTYPE_ETHERNET	1
+#define PCAPNG_ENHANCED_PACKET		0x00000006
+	#define PCAPNG_OPT_ENDOFOPT		0
+	#define PCAPNG_OPT_EPB_FLAGS		2
+		#define PCAPNG_EPB_FLAGS_INBOUND	1
+		#define PCAPNG_EPB_FLAGS_OUTBOUND	2
+
+struct TPcapngSectionHeader
+{
+	u32	nBlockType;
+	u32	nBlockLength;
+	u32	nByteOrderMagic;
+	u16	nMajorVersion;
+	u16	nMinorVersion;
+	s64	nSectionLength;			// -1 if unknown
+	u32	nBlockLength2;
+}
+PACKED;
+
+struct TPcapngInterfaceDescription
+{
+	u32	nBlockType;
+	u32	nBlockLength;
+	u16	nLinkType;
+	u16	nReserved;
+	u32	nSnapLength;
+	u32	nBlockLength2;
+}
+PACKED;
+
+struct TPcapngEnhancedPacket
+{
+	u32	nBlockType;
+	u32	nBlockLength;
+	u32	nInterfaceID;
+	u32	nTimestampHigh;			// in microseconds
+	u32	nTimestampLow;
+	u32	nCapturedLength;
+	u32	nOriginalLength;
+	// packet data, padded to 32 bits
+	// options
+	// u32	nBlockLength2;
+}
+PACKED;
+
+struct TPcapngOptionFlags
+{
+	u16	nCode;
+	u16	nLength;
+	u32	nFlags;
+	u16	nEndCode;
+	u16	nEndLength;
+}
+PACKED;
+
+CNetCapture::CNetCapture (CNetSubSystem *pNetSubSystem, CDevice *pTarget, unsigned nSnapLength)
+:	m_pNetSubSystem (pNetSubSystem),
+	m_pTarget (pTarget),
+	m_nSnapLength (nSnapLength),
+	m_pFilter (0),
+	m_pFilterParam (0),
+	m_Ring (NET_CAPTURE_RING_SIZE),
+	m_nDropped (0),
+	m_nTimeOffset (0),
+	m_nBatchLength (0)
+{
+	assert (m_pTarget != 0);
+
+	if (m_nSnapLength > NET_CAPTURE_SNAPLEN_MAX)
+	{
+		m_nSnapLength = NET_CAPTURE_SNAPLEN_MAX;
+	}
+
+	SetName ("netcap");
+}
+
+CNetCapture::~CNetCapture (void)
+{
+	assert (m_pNetSubSystem != 0);
+	m_pNetSubSystem->GetNetDeviceLayer ()->SetCapture (0);
+
+	m_pTarget = 0;
+	m_pNetSubSystem = 0;
+}
+
+void CNetCapture::SetFilter (TNetCaptureFilter *pFilter, void *pParam)
+{
+	m_pFilterParam = pParam;
+	m_pFilter = pFilter;
+}
+
+void CNetCapture::Run (void)
+{
+	unsigned nSeconds, nMicroSeconds;
+	if (CTimer::Get ()->GetUniversalTime (&nSeconds, &nMicroSeconds))
+	{
+		m_nTimeOffset =   (u64) nSeconds * 1000000 + nMicroSeconds
+				- CTimer::GetClockTicks64 ();
+	}
+
+	WriteHeader ();
+
+	// frames are captured from now on
+	assert (m_pNetSubSystem != 0);
+	m_pNetSubSystem->GetNetDeviceLayer ()->SetCapture (this);
+
+	while (1)
+	{
+		TNetCaptureRecord *pRecord;
+		while ((pRecord = m_Ring.BeginRead ()) != 0)
+		{
+			WriteFrame (pRecord);
+
+			m_Ring.EndRead ();
+		}
+
+		Flush ();
+
+		CScheduler::Get ()->MsSleep (NET_CAPTURE_POLL_MS);
+	}
+}
+
+void CNetCapture::Capture (CNetBuffer *pBuffer, boolean bTransmit)
+{
+	assert (pBuffer != 0);
+	const void *pFrame = pBuffer->GetData ();
+	unsigned nLength = pBuffer->GetLength ();
+
+	TNetCaptureFilter *pFilter = m_pFilter;
+	if (   pFilter != 0
+	    && !(*pFilter) (pFrame, nLength, bTransmit, m_pFilterParam))
+	{
+		return;
+	}
+
+	TNetCaptureRecord *pRecord = m_Ring.BeginWrite ();
+	if (pRecord == 0)
+	{
+		m_nDropped++;
+
+		return;
+	}
+
+	unsigned nCaptureLength = nLength < m_nSnapLength ? nLength : m_nSnapLength;
+
+	pRecord->nTimestamp = CTimer::GetClockTicks64 ();
+	pRecord->nFrameLength = (u16) nLength;
+	pRecord->nCaptureLength = (u16) nCaptureLength;
+	pRecord->bTransmit = bTransmit;
+	memcpy (pRecord->Frame, pFrame, nCaptureLength);
+
+	m_Ring.EndWrite (pRecord);
+}
+
+unsigned CNetCapture::GetDropped (void) const
+{
+	return m_nDropped;
+}
+
+void CNetCapture::WriteHeader (void)
+{
+	TPcapngSectionHeader Section;
+	Section.nBlockType = PCAPNG_SECTION_HEADER;
+	Section.nBlockLength = sizeof Section;
+	Section.nByteOrderMagic = PCAPNG_BYTE_ORDER_MAGIC;
+	Section.nMajorVersion = 1;
+	Section.nMinorVersion = 0;
+	Section.nSectionLength = -1;
+	Section.nBlockLength2 = sizeof Section;
+	Append (&Section, sizeof Section);
+
+	// the default timestamp resolution (microseconds) is used
+	TPcapngInterfaceDescription Interface;
+	Interface.nBlockType = PCAPNG_INTERFACE_DESCRIPTION;
+	Interface.nBlockLength = sizeof Interface;
+	Interface.nLinkType = PCAPNG_LINKTYPE_ETHERNET;
+	Interface.nReserved = 0;
+	Interface.nSnapLength = m_nSnapLength;
+	Interface.nBlockLength2 = sizeof Interface;
+	Append (&Interface, sizeof Interface);
+
+	Flush ();
+}
+
+void CNetCapture::WriteFrame (const TNetCaptureRecord *pRecord)
+{
+	assert (pRecord != 0);
+	unsigned nPaddedLength = (pRecord->nCaptureLength + 3) & ~3U;
+	u32 nBlockLength =   sizeof (TPcapngEnhancedPacket) + nPaddedLength
+			   + sizeof (TPcapngOptionFlags) + sizeof (u32);
+
+	if (m_nBatchLength + nBlockLength > NET_CAPTURE_BATCH_SIZE)
+	{
+		Flush ();
+	}
+
+	u64 nTimestamp = pRecord->nTimestamp + m_nTimeOffset;
+
+	TPcapngEnhancedPacket Packet;
+	Packet.nBlockType = PCAPNG_ENHANCED_PACKET;
+	Packet.nBlockLength = nBlockLength;
+	Packet.nInterfaceID = 0;
+	Packet.nTimestampHigh = (u32) (nTimestamp >> 32);
+	Packet.nTimestampLow = (u32) nTimestamp;
+	Packet.nCapturedLength = pRecord->nCaptureLength;
+	Packet.nOriginalLength = pRecord->nFrameLength;
+	Append (&Packet, sizeof Packet);
+
+	Append (pRecord->Frame, pRecord->nCaptureLength);
+
+	static const u8 Padding[3] = {0, 0, 0};
+	Append (Padding, nPaddedLength - pRecord->nCaptureLength);
+
+	TPcapngOptionFlags Options;
+	Options.nCode = PCAPNG_OPT_EPB_FLAGS;
+	Options.nLength = sizeof (u32);
+	Options.nFlags =   pRecord->bTransmit
+			 ? PCAPNG_EPB_FLAGS_OUTBOUND : PCAPNG_EPB_FLAGS_INBOUND;
+	Options.nEndCode = PCAPNG_OPT_ENDOFOPT;
+	Options.nEndLength = 0;
+	Append (&Options, sizeof Options);
+
+	Append (&nBlockLength, sizeof nBlockLength);
+}
+
+void CNetCapture::Flush (void)
+{
+	if (m_nBatchLength == 0)
+	{
+		return;
+	}
+
+	assert (m_pTarget != 0);
+	m_pTarget->Write (m_Batch, m_nBatchLength);
+
+	m_nBatchLength = 0;
+}
+
+void CNetCapture::Append (const void *pData, unsigned nLength)
+{
+	assert (m_nBatchLength + nLength <= NET_CAPTURE_BATCH_SIZE);
+	memcpy (m_Batch + m_nBatchLength, pData, nLength);
+
+	m_nBatchLength += nLength;
+}
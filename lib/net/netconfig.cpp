@@ -2,7 +2,7 @@
 // netconfig.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,9 +18,11 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/netconfig.h>
+#include <assert.h>
 
 CNetConfig::CNetConfig (void)
-:	m_bUseDHCP (TRUE)
+:	m_bUseDHCP (TRUE),
+	m_nMTU (NET_MTU_DEFAULT)
 {
 	Reset ();
 }
@@ -33,12 +35,18 @@ void CNetConfig::Reset (void)
 {
 	static const u8 NullAddress[] = {0, 0, 0, 0};
 
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_IPAddress.Set (NullAddress);
 	m_NetMask.Set (NullAddress);
 	m_DefaultGateway.Set (NullAddress);
 	m_DNSServer.Set (NullAddress);
 
 	UpdateBroadcastAddress ();
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
 }
 
 void CNetConfig::SetDHCP (boolean bUsed)
@@ -48,50 +56,105 @@ void CNetConfig::SetDHCP (boolean bUsed)
 
 void CNetConfig::SetIPAddress (u32 nAddress)
 {
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_IPAddress.Set (nAddress);
 
 	UpdateBroadcastAddress ();
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
 }
 
 void CNetConfig::SetNetMask (u32 nNetMask)
 {
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_NetMask.Set (nNetMask);
 
 	UpdateBroadcastAddress ();
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
 }
 
 void CNetConfig::SetDefaultGateway (u32 nAddress)
 {
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_DefaultGateway.Set (nAddress);
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
 }
 
 void CNetConfig::SetDNSServer (u32 nAddress)
 {
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_DNSServer.Set (nAddress);
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
 }
 
 void CNetConfig::SetIPAddress (const u8 *pAddress)
 {
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_IPAddress.Set (pAddress);
 
 	UpdateBroadcastAddress ();
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
 }
 
 void CNetConfig::SetNetMask (const u8 *pNetMask)
 {
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_NetMask.Set (pNetMask);
 
 	UpdateBroadcastAddress ();
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
 }
 
 void CNetConfig::SetDefaultGateway (const u8 *pAddress)
 {
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_DefaultGateway.Set (pAddress);
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
 }
 
 void CNetConfig::SetDNSServer (const u8 *pAddress)
 {
+	m_SpinLock.Acquire ();
+	m_SeqLock.WriteBegin ();
+
 	m_DNSServer.Set (pAddress);
+
+	m_SeqLock.WriteEnd ();
+	m_SpinLock.Release ();
+}
+
+void CNetConfig::SetMTU (unsigned nMTU)
+{
+	// the minimum IPv4 MTU (RFC 791)
+	assert (68 <= nMTU && nMTU <= NET_MTU_MAX);
+	m_nMTU = nMTU;
 }
 
 const CIPAddress *CNetConfig::GetIPAddress (void) const
@@ -124,6 +187,31 @@ const CIPAddress *CNetConfig::GetBroadcastAddress (void) const
 	return &m_BroadcastAddress;
 }
 
+unsigned CNetConfig::GetMTU (void) const
+{
+	return m_nMTU;
+}
+
+void CNetConfig::GetSnapshot (TNetConfigSnapshot *pSnapshot) const
+{
+	assert (pSnapshot != 0);
+
+	unsigned nSequence;
+	do
+	{
+		nSequence = m_SeqLock.ReadBegin ();
+
+		pSnapshot->IPAddress.Set (m_IPAddress);
+		pSnapshot->NetMask.Set (m_NetMask);
+		pSnapshot->DefaultGateway.Set (m_DefaultGateway);
+		pSnapshot->DNSServer.Set (m_DNSServer);
+		pSnapshot->BroadcastAddress.Set (m_BroadcastAddress);
+		pSnapshot->nMTU = m_nMTU;
+	}
+	while (m_SeqLock.ReadRetry (nSequence));
+}
+
+// m_SpinLock must be acquired and a write section must be entered
 void CNetConfig::UpdateBroadcastAddress (void)
 {
 	u32 nIPAddress;
@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/netconnection.h>
+#include <circle/net/transportlayer.h>
 #include <assert.h>
 
 CNetConnection::CNetConnection (CNetConfig	*pNetConfig,
@@ -32,7 +33,15 @@ CNetConnection::CNetConnection (CNetConfig	*pNetConfig,
 	m_nForeignPort (nForeignPort),
 	m_nOwnPort (nOwnPort),
 	m_nProtocol (nProtocol),
-	m_Checksum (*pNetConfig->GetIPAddress (), rForeignIP, nProtocol)
+	m_Checksum (*pNetConfig->GetIPAddress (), rForeignIP, nProtocol),
+	m_pTransportLayer (0),
+	m_hConnection (-1),
+	m_pHashNext (0),
+	m_pHashPrev (0),
+	m_bActive (FALSE),
+	m_pActiveNext (0),
+	m_pActivePrev (0),
+	m_pPollEvent (0)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
@@ -46,7 +55,16 @@ CNetConnection::CNetConnection (CNetConfig	*pNetConfig,
 	m_pNetworkLayer (pNetworkLayer),
 	m_nForeignPort (0),
 	m_nOwnPort (nOwnPort),
-	m_Checksum (*pNetConfig->GetIPAddress (), nProtocol)
+	m_nProtocol (nProtocol),
+	m_Checksum (*pNetConfig->GetIPAddress (), nProtocol),
+	m_pTransportLayer (0),
+	m_hConnection (-1),
+	m_pHashNext (0),
+	m_pHashPrev (0),
+	m_bActive (FALSE),
+	m_pActiveNext (0),
+	m_pActivePrev (0),
+	m_pPollEvent (0)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
@@ -54,6 +72,13 @@ CNetConnection::CNetConnection (CNetConfig	*pNetConfig,
 
 CNetConnection::~CNetConnection (void)
 {
+	// the derived class has stopped its timers, so it cannot be activated any more
+	if (m_pTransportLayer != 0)
+	{
+		m_pTransportLayer->Deactivate (this);
+		m_pTransportLayer = 0;
+	}
+
 	m_pNetworkLayer = 0;
 	m_pNetConfig = 0;
 }
@@ -63,6 +88,11 @@ const u8 *CNetConnection::GetForeignIP (void) const
 	return m_ForeignIP.Get ();
 }
 
+u16 CNetConnection::GetForeignPort (void) const
+{
+	return m_nForeignPort;
+}
+
 u16 CNetConnection::GetOwnPort (void) const
 {
 	assert (m_nOwnPort != 0);
@@ -73,3 +103,25 @@ int CNetConnection::GetProtocol (void) const
 {
 	return m_nProtocol;
 }
+
+void CNetConnection::SetPollEvent (CSynchronizationEvent *pEvent)
+{
+	m_pPollEvent = pEvent;
+}
+
+void CNetConnection::NotifyPoll (void)
+{
+	CSynchronizationEvent *pEvent = m_pPollEvent;
+	if (pEvent != 0)
+	{
+		pEvent->Set ();
+	}
+}
+
+void CNetConnection::Activate (void)
+{
+	if (m_pTransportLayer != 0)
+	{
+		m_pTransportLayer->Activate (this);
+	}
+}
@@ -2,7 +2,7 @@
 // netdevlayer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,18 +19,30 @@
 //
 #include <circle/net/netdevlayer.h>
 #include <circle/net/phytask.h>
+#include <circle/net/netcapture.h>
+#include <circle/net/netstatistics.h>
 #include <circle/logger.h>
 #include <circle/timer.h>
+#include <circle/tracer.h>
 #include <circle/synchronize.h>
 #include <circle/macros.h>
+#include <circle/util.h>
 #include <assert.h>
 
+#ifndef NET_DEVICE_BATCH_SIZE
+#define NET_DEVICE_BATCH_SIZE	16		// frames per call to the net device
+#endif
+
 const char FromNetDev[] = "netdev";
 
 CNetDeviceLayer::CNetDeviceLayer (CNetConfig *pNetConfig, TNetDeviceType DeviceType)
 :	m_DeviceType (DeviceType),
 	m_pNetConfig (pNetConfig),
-	m_pDevice (0)
+	m_pDevice (0),
+	m_nMulticastCount (0),
+	m_bMulticastFilterChanged (FALSE),
+	m_bLinkRestored (FALSE),
+	m_pCapture (0)
 {
 }
 
@@ -63,7 +75,9 @@ boolean CNetDeviceLayer::Initialize (boolean bWaitForActivate)
 		return FALSE;
 	}
 
-	new CPHYTask (m_pDevice);
+	new CPHYTask (m_pDevice, this);
+
+	SetMTU ();
 
 	// wait for Ethernet PHY to come up
 	unsigned nStartTicks = CTimer::Get ()->GetTicks ();
@@ -98,27 +112,191 @@ void CNetDeviceLayer::Process (void)
 			return;
 		}
 
-		new CPHYTask (m_pDevice);
+		new CPHYTask (m_pDevice, this);
+
+		SetMTU ();
+	}
+
+	if (m_bMulticastFilterChanged)
+	{
+		m_bMulticastFilterChanged = FALSE;
+
+		// without support of the driver, multicast frames may not be received at all
+		m_pDevice->SetMulticastFilter (m_MulticastFilter, m_nMulticastCount);
 	}
 
-	DMA_BUFFER (u8, Buffer, FRAME_BUFFER_SIZE);
-	unsigned nLength;
-	while (   m_pDevice->IsSendFrameAdvisable ()
-	       && (nLength = m_TxQueue.Dequeue (Buffer)) > 0)
+	CNetBuffer *Batch[NET_DEVICE_BATCH_SIZE];
+	while (m_pDevice->IsSendFrameAdvisable ())
 	{
-		if (!m_pDevice->SendFrame (Buffer, nLength))
+		unsigned nCount = 0;
+		CNetBuffer *pBuffer;
+		while (   nCount < NET_DEVICE_BATCH_SIZE
+		       && (pBuffer = m_TxQueue.Dequeue ()) != 0)
+		{
+			if (((uintptr) pBuffer->GetData () & (DATA_CACHE_LINE_LENGTH_MAX-1)) != 0)
+			{
+				// the driver may need a cache-aligned buffer for DMA
+				CNetBuffer *pAlignedBuffer = new CNetBuffer;
+				assert (pAlignedBuffer != 0);
+				memcpy (pAlignedBuffer->GetData (), pBuffer->GetData (), pBuffer->GetLength ());
+				pAlignedBuffer->SetLength (pBuffer->GetLength ());
+				pAlignedBuffer->SetOffload (pBuffer->GetOffloadFlags (),
+							    pBuffer->GetChecksumStart (),
+							    pBuffer->GetChecksumOffset (),
+							    pBuffer->GetSegmentSize ());
+
+				pBuffer->Release ();
+				pBuffer = pAlignedBuffer;
+			}
+
+			Batch[nCount++] = pBuffer;
+		}
+
+		if (nCount == 0)
+		{
+			break;
+		}
+
+		unsigned nSent = m_pDevice->SendFrames (Batch, nCount);
+		assert (nSent <= nCount);
+
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			if (i < nSent)
+			{
+				TRACEPOINT (TRACER_EVENT_NET_DEV_TX, (uintptr) Batch[i],
+					    Batch[i]->GetLength ());
+
+				NET_STAT_INC (NetCounterDevTxFrames);
+				NET_STAT_INC (NetCounterDevTxBytes, Batch[i]->GetLength ());
+
+				if (m_pCapture != 0)
+				{
+					m_pCapture->Capture (Batch[i], TRUE);
+				}
+			}
+
+			Batch[i]->Release ();
+		}
+
+		if (nSent < nCount)
 		{
-			CLogger::Get ()->Write (FromNetDev, LogWarning, "Frame dropped");
+			NET_STAT_INC (NetCounterDevTxDropped, nCount - nSent);
+
+			CLogger::Get ()->Write (FromNetDev, LogWarning, "%u frame(s) dropped",
+						nCount - nSent);
 
 			break;
 		}
 	}
 
-	while (m_pDevice->ReceiveFrame (Buffer, &nLength))
+	// the driver fills in the received frames in place or hands over its own buffers
+	unsigned nCount;
+	while ((nCount = m_pDevice->ReceiveFrames (Batch, NET_DEVICE_BATCH_SIZE)) > 0)
+	{
+		assert (nCount <= NET_DEVICE_BATCH_SIZE);
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			assert (Batch[i] != 0);
+			assert (Batch[i]->GetLength () > 0);
+			TRACEPOINT (TRACER_EVENT_NET_DEV_RX, (uintptr) Batch[i], Batch[i]->GetLength ());
+
+			NET_STAT_INC (NetCounterDevRxFrames);
+			NET_STAT_INC (NetCounterDevRxBytes, Batch[i]->GetLength ());
+
+			if (m_pCapture != 0)
+			{
+				m_pCapture->Capture (Batch[i], FALSE);
+			}
+
+			if (!m_RxQueue.Enqueue (Batch[i]))
+			{
+				NET_STAT_INC (NetCounterDevRxQueueFull);
+			}
+		}
+	}
+}
+
+void CNetDeviceLayer::SetMTU (void)
+{
+	assert (m_pNetConfig != 0);
+	unsigned nMTU = m_pNetConfig->GetMTU ();
+	if (nMTU == NET_MTU_DEFAULT)
+	{
+		return;
+	}
+
+	assert (m_pDevice != 0);
+	if (!m_pDevice->SetMTU (nMTU))
+	{
+		CLogger::Get ()->Write (FromNetDev, LogWarning, "MTU %u not supported", nMTU);
+
+		m_pNetConfig->SetMTU (NET_MTU_DEFAULT);
+
+		return;
+	}
+
+	CLogger::Get ()->Write (FromNetDev, LogNotice, "MTU is %u", nMTU);
+}
+
+void CNetDeviceLayer::SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount)
+{
+	assert (nCount <= MAX_MULTICAST_ADDRESSES);
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		assert (pAddresses != 0);
+		m_MulticastFilter[i].Set (pAddresses[i].Get ());
+	}
+
+	m_nMulticastCount = nCount;
+	m_bMulticastFilterChanged = TRUE;
+}
+
+boolean CNetDeviceLayer::IsMulticastAccepted (const CMACAddress &rAddress) const
+{
+	for (unsigned i = 0; i < m_nMulticastCount; i++)
+	{
+		if (m_MulticastFilter[i] == rAddress)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+boolean CNetDeviceLayer::IsLinkRestored (void)
+{
+	if (!m_bLinkRestored)
+	{
+		return FALSE;
+	}
+
+	m_bLinkRestored = FALSE;
+
+	return TRUE;
+}
+
+void CNetDeviceLayer::SetCapture (CNetCapture *pCapture)
+{
+	m_pCapture = pCapture;
+}
+
+void CNetDeviceLayer::LinkChanged (boolean bLinkUp)
+{
+	if (!bLinkUp)
 	{
-		assert (nLength > 0);
-		m_RxQueue.Enqueue (Buffer, nLength);
+		CLogger::Get ()->Write (FromNetDev, LogWarning, "Link is down");
+
+		return;
 	}
+
+	assert (m_pDevice != 0);
+	TNetDeviceSpeed Speed = m_pDevice->GetLinkSpeed ();
+	CLogger::Get ()->Write (FromNetDev, LogNotice, "Link is %s",
+				Speed != NetDeviceSpeedUnknown ? CNetDevice::GetSpeedString (Speed) : "up");
+
+	m_bLinkRestored = TRUE;
 }
 
 const CMACAddress *CNetDeviceLayer::GetMACAddress (void) const
@@ -133,24 +311,36 @@ const CMACAddress *CNetDeviceLayer::GetMACAddress (void) const
 
 void CNetDeviceLayer::Send (const void *pBuffer, unsigned nLength)
 {
-	m_TxQueue.Enqueue (pBuffer, nLength);
+	if (!m_TxQueue.Enqueue (pBuffer, nLength))
+	{
+		NET_STAT_INC (NetCounterDevTxQueueFull);
+	}
 }
 
-boolean CNetDeviceLayer::Receive (void *pBuffer, unsigned *pResultLength)
+void CNetDeviceLayer::Send (CNetBuffer *pBuffer)
 {
-	unsigned nLength = m_RxQueue.Dequeue (pBuffer);
-	if (nLength == 0)
+	if (!m_TxQueue.Enqueue (pBuffer))
 	{
-		return FALSE;
+		NET_STAT_INC (NetCounterDevTxQueueFull);
 	}
+}
 
-	assert (pResultLength != 0);
-	*pResultLength = nLength;
-
-	return TRUE;
+CNetBuffer *CNetDeviceLayer::Receive (void)
+{
+	return m_RxQueue.Dequeue ();
 }
 
 boolean CNetDeviceLayer::IsRunning (void) const
 {
 	return m_pDevice != 0;
 }
+
+unsigned CNetDeviceLayer::GetOffloadCapabilities (void) const
+{
+	if (m_pDevice == 0)
+	{
+		return 0;
+	}
+
+	return m_pDevice->GetOffloadCapabilities ();
+}
@@ -2,7 +2,7 @@
 // netqueue.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,6 +19,7 @@
 //
 #include <circle/net/netqueue.h>
 #include <circle/netdevice.h>
+#include <circle/alloc.h>
 #include <circle/util.h>
 #include <assert.h>
 
@@ -27,13 +28,16 @@ struct TNetQueueEntry
 	volatile TNetQueueEntry *pPrev;
 	volatile TNetQueueEntry *pNext;
 	unsigned		 nLength;
-	unsigned char		 Buffer[FRAME_BUFFER_SIZE];
 	void			*pParam;
+	unsigned char		 Buffer[FRAME_BUFFER_SIZE];	// only nLength bytes are allocated
 };
 
+#define ENTRY_SIZE(length)	(sizeof (TNetQueueEntry) - FRAME_BUFFER_SIZE + (length))
+
 CNetQueue::CNetQueue (void)
 :	m_pFirst (0),
 	m_pLast (0),
+	m_nCount (0),
 	m_SpinLock (TASK_LEVEL)
 {
 }
@@ -48,6 +52,11 @@ boolean CNetQueue::IsEmpty (void) const
 	return m_pFirst == 0 ? TRUE : FALSE;
 }
 
+unsigned CNetQueue::GetCount (void) const
+{
+	return m_nCount;
+}
+
 void CNetQueue::Flush (void)
 {
 	while (m_pFirst != 0)
@@ -68,19 +77,22 @@ void CNetQueue::Flush (void)
 			m_pLast = 0;
 		}
 
+		assert (m_nCount > 0);
+		m_nCount--;
+
 		m_SpinLock.Release ();
 
-		delete pEntry;
+		free ((void *) pEntry);
 	}
 }
 	
 void CNetQueue::Enqueue (const void *pBuffer, unsigned nLength, void *pParam)
 {
-	TNetQueueEntry *pEntry = new TNetQueueEntry;
-	assert (pEntry != 0);
-
 	assert (nLength > 0);
 	assert (nLength <= FRAME_BUFFER_SIZE);
+	TNetQueueEntry *pEntry = (TNetQueueEntry *) malloc (ENTRY_SIZE (nLength));
+	assert (pEntry != 0);
+
 	pEntry->nLength = nLength;
 
 	assert (pBuffer != 0);
@@ -105,6 +117,8 @@ void CNetQueue::Enqueue (const void *pBuffer, unsigned nLength, void *pParam)
 	}
 	m_pLast = pEntry;
 
+	m_nCount++;
+
 	m_SpinLock.Release ();
 }
 
@@ -130,6 +144,9 @@ unsigned CNetQueue::Dequeue (void *pBuffer, void **ppParam)
 			m_pLast = 0;
 		}
 
+		assert (m_nCount > 0);
+		m_nCount--;
+
 		m_SpinLock.Release ();
 
 		nResult = pEntry->nLength;
@@ -143,7 +160,7 @@ unsigned CNetQueue::Dequeue (void *pBuffer, void **ppParam)
 			*ppParam = pEntry->pParam;
 		}
 
-		delete pEntry;
+		free ((void *) pEntry);
 	}
 
 	return nResult;
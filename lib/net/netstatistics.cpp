@@ -0,0 +1,141 @@
+//
+// netstatistics.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/netstatistics.h>
+#include <circle/logger.h>
+#include <assert.h>
+
+static const char FromNetStat[] = "netstat";
+
+static const char *s_pCounterName[NetCounterUnknown] =
+{
+	"dev_rx_frames",
+	"dev_rx_bytes",
+	"dev_rx_queue_full",
+	"dev_tx_frames",
+	"dev_tx_bytes",
+	"dev_tx_queue_full",
+	"dev_tx_dropped",
+
+	"link_rx_not_for_us",
+	"link_rx_unknown_protocol",
+	"link_rx_queue_full",
+	"arp_misses",
+	"arp_pending_dropped",
+	"arp_resolve_failed",
+
+	"ip_rx_packets",
+	"ip_rx_bytes",
+	"ip_rx_header_errors",
+	"ip_rx_not_for_us",
+	"ip_rx_fragments",
+	"ip_rx_reassembled",
+	"ip_rx_reassembly_failed",
+	"ip_rx_queue_full",
+	"ip_tx_packets",
+	"ip_tx_bytes",
+	"ip_tx_no_route",
+	"ip_tx_fragments",
+	"ip_tx_loopback",
+
+	"udp_rx_datagrams",
+	"udp_rx_checksum_errors",
+	"udp_rx_queue_full",
+	"udp_tx_datagrams",
+	"tcp_rx_segments",
+	"tcp_rx_checksum_errors",
+	"tcp_rx_out_of_order",
+	"tcp_tx_segments",
+	"tcp_retransmissions",
+	"tcp_rtt_samples",
+	"transport_rx_unhandled"
+};
+
+CNetStatistics *CNetStatistics::s_pThis = 0;
+
+CNetStatistics::CNetStatistics (void)
+{
+	Reset ();
+
+	assert (s_pThis == 0);
+	s_pThis = this;
+}
+
+CNetStatistics::~CNetStatistics (void)
+{
+	s_pThis = 0;
+}
+
+void CNetStatistics::AddRTTSample (unsigned nMillis)
+{
+	Inc (NetCounterTCPRTTSamples);
+
+	m_RTTHistogram.Add (nMillis);
+}
+
+const CHistogram<> *CNetStatistics::GetRTTHistogram (void) const
+{
+	return &m_RTTHistogram;
+}
+
+void CNetStatistics::Reset (void)
+{
+	for (unsigned i = 0; i < NetCounterUnknown; i++)
+	{
+		m_nCounter[i] = 0;
+	}
+
+	m_RTTHistogram.Reset ();
+}
+
+const char *CNetStatistics::GetName (TNetCounter Counter)
+{
+	assert (Counter < NetCounterUnknown);
+	return s_pCounterName[Counter];
+}
+
+void CNetStatistics::Dump (void) const
+{
+	CLogger *pLogger = CLogger::Get ();
+	assert (pLogger != 0);
+
+	for (unsigned i = 0; i < NetCounterUnknown; i++)
+	{
+		pLogger->Write (FromNetStat, LogNotice, "%s: %llu",
+				s_pCounterName[i], Get ((TNetCounter) i));
+	}
+
+	m_RTTHistogram.Dump (FromNetStat, "tcp_rtt", "ms");
+}
+
+void CNetStatistics::Format (CString *pString, const char *pPrefix) const
+{
+	assert (pString != 0);
+	assert (pPrefix != 0);
+
+	*pString = "";
+
+	for (unsigned i = 0; i < NetCounterUnknown; i++)
+	{
+		CString Line;
+		Line.Format ("%s%s %llu\n", pPrefix, s_pCounterName[i], Get ((TNetCounter) i));
+
+		pString->Append (Line);
+	}
+}
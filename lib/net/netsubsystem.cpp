@@ -2,7 +2,7 @@
 // netsubsystem.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,6 +20,7 @@
 #include <circle/net/netsubsystem.h>
 #include <circle/net/nettask.h>
 #include <circle/net/dhcpclient.h>
+#include <circle/boottrace.h>
 #include <circle/sched/scheduler.h>
 #include <assert.h>
 
@@ -38,6 +39,8 @@ CNetSubSystem::CNetSubSystem (const u8 *pIPAddress, const u8 *pNetMask, const u8
 	assert (s_pThis == 0);
 	s_pThis = this;
 
+	m_DHCPLease.nMagic = 0;
+
 	m_Config.SetDHCP (m_bUseDHCP);
 
 	if (!m_bUseDHCP)
@@ -91,6 +94,8 @@ boolean CNetSubSystem::Initialize (boolean bWaitForActivate)
 
 	new CNetTask (this);
 
+	CBootTrace::Mark ("net");
+
 	if (!bWaitForActivate)
 	{
 		return TRUE;
@@ -99,7 +104,8 @@ boolean CNetSubSystem::Initialize (boolean bWaitForActivate)
 	if (m_bUseDHCP)
 	{
 		assert (m_pDHCPClient == 0);
-		m_pDHCPClient = new CDHCPClient (this, m_Hostname);
+		m_pDHCPClient = new CDHCPClient (this, m_Hostname,
+						 m_DHCPLease.nMagic == DHCP_LEASE_MAGIC ? &m_DHCPLease : 0);
 		assert (m_pDHCPClient != 0);
 	}
 
@@ -108,6 +114,8 @@ boolean CNetSubSystem::Initialize (boolean bWaitForActivate)
 		CScheduler::Get ()->Yield ();
 	}
 
+	CBootTrace::Mark ("net-up");
+
 	return TRUE;
 }
 
@@ -122,12 +130,24 @@ void CNetSubSystem::Process (void)
 	    && m_pDHCPClient == 0
 	    && m_NetDevLayer.IsRunning ())
 	{
-		m_pDHCPClient = new CDHCPClient (this, m_Hostname);
+		m_pDHCPClient = new CDHCPClient (this, m_Hostname,
+						 m_DHCPLease.nMagic == DHCP_LEASE_MAGIC ? &m_DHCPLease : 0);
 		assert (m_pDHCPClient != 0);
 	}
 
 	m_NetDevLayer.Process ();
 
+	if (m_NetDevLayer.IsLinkRestored ())
+	{
+		// the cached addresses may not be valid on the (new) network
+		m_LinkLayer.FlushARPCache ();
+
+		if (m_pDHCPClient != 0)
+		{
+			m_pDHCPClient->LinkRestored ();
+		}
+	}
+
 	m_LinkLayer.Process ();
 
 	m_NetworkLayer.Process ();
@@ -155,6 +175,16 @@ CTransportLayer *CNetSubSystem::GetTransportLayer (void)
 	return &m_TransportLayer;
 }
 
+CRoutingTable *CNetSubSystem::GetRoutingTable (void)
+{
+	return m_NetworkLayer.GetRoutingTable ();
+}
+
+CNetStatistics *CNetSubSystem::GetStatistics (void)
+{
+	return &m_Statistics;
+}
+
 boolean CNetSubSystem::IsRunning (void) const
 {
 	if (!m_NetDevLayer.IsRunning ())
@@ -175,6 +205,31 @@ boolean CNetSubSystem::IsRunning (void) const
 	return m_pDHCPClient->IsBound ();
 }
 
+void CNetSubSystem::SetDHCPLease (const TDHCPLease &rLease)
+{
+	assert (m_pDHCPClient == 0);
+
+	if (   rLease.nMagic != DHCP_LEASE_MAGIC
+	    || rLease.nIPAddress == 0
+	    || rLease.nServerIdentifier == 0)
+	{
+		return;
+	}
+
+	m_DHCPLease = rLease;
+}
+
+boolean CNetSubSystem::GetDHCPLease (TDHCPLease *pLease) const
+{
+	if (   !m_bUseDHCP
+	    || m_pDHCPClient == 0)
+	{
+		return FALSE;
+	}
+
+	return m_pDHCPClient->GetLease (pLease);
+}
+
 CNetSubSystem *CNetSubSystem::Get (void)
 {
 	assert (s_pThis != 0);
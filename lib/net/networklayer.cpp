@@ -2,7 +2,7 @@
 // networklayer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,13 +20,21 @@
 #include <circle/net/networklayer.h>
 #include <circle/net/checksumcalculator.h>
 #include <circle/net/in.h>
+#include <circle/net/netstatistics.h>
+#include <circle/tracer.h>
 #include <circle/util.h>
 #include <assert.h>
 
+ASSERT_STATIC (sizeof (TNetworkPrivateData) <= NET_BUFFER_PRIVATE_SIZE);
+
+static const u8 LoopbackAddress[] = {127, 0, 0, 1};
+
 CNetworkLayer::CNetworkLayer (CNetConfig *pNetConfig, CLinkLayer *pLinkLayer)
 :	m_pNetConfig (pNetConfig),
 	m_pLinkLayer (pLinkLayer),
-	m_pICMPHandler (0)
+	m_pICMPHandler (0),
+	m_pIGMPHandler (0),
+	m_nIdentification (0)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pLinkLayer != 0);
@@ -34,6 +42,9 @@ CNetworkLayer::CNetworkLayer (CNetConfig *pNetConfig, CLinkLayer *pLinkLayer)
 
 CNetworkLayer::~CNetworkLayer (void)
 {
+	delete m_pIGMPHandler;
+	m_pIGMPHandler = 0;
+
 	delete m_pICMPHandler;
 	m_pICMPHandler = 0;
 
@@ -47,6 +58,10 @@ boolean CNetworkLayer::Initialize (void)
 	m_pICMPHandler = new CICMPHandler (m_pNetConfig, this, &m_ICMPRxQueue, &m_ICMPNotificationQueue);
 	assert (m_pICMPHandler != 0);
 
+	assert (m_pIGMPHandler == 0);
+	m_pIGMPHandler = new CIGMPHandler (m_pNetConfig, this, m_pLinkLayer, &m_IGMPRxQueue);
+	assert (m_pIGMPHandler != 0);
+
 	return TRUE;
 }
 
@@ -56,173 +71,434 @@ void CNetworkLayer::Process (void)
 	const CIPAddress *pOwnIPAddress = m_pNetConfig->GetIPAddress ();
 	assert (pOwnIPAddress != 0);
 
-	u8 Buffer[FRAME_BUFFER_SIZE];
-	unsigned nResultLength;
+	CNetBuffer *pBuffer;
 	assert (m_pLinkLayer != 0);
-	while (m_pLinkLayer->Receive (Buffer, &nResultLength))
+	while ((pBuffer = m_pLinkLayer->Receive ()) != 0)
 	{
-		if (nResultLength <= sizeof (TIPHeader))
-		{
-			continue;
-		}
-		TIPHeader *pHeader = (TIPHeader *) Buffer;
-
-		unsigned nHeaderLength = pHeader->nVersionIHL & 0xF;
-		if (   nHeaderLength < IP_HEADER_LENGTH_DWORD_MIN
-		    || nHeaderLength > IP_HEADER_LENGTH_DWORD_MAX)
-		{
-			continue;
-		}
-		nHeaderLength *= 4;
-		if (nResultLength <= nHeaderLength)
+		if (!CheckPacket (pBuffer, pOwnIPAddress))
 		{
-			continue;
-		}
+			pBuffer->Release ();
 
-		if (   CChecksumCalculator::SimpleCalculate (pHeader, nHeaderLength) != CHECKSUM_OK
-		    || (pHeader->nVersionIHL >> 4) != IP_VERSION)
-		{
 			continue;
 		}
 
-		CIPAddress IPAddressDestination (pHeader->DestinationAddress);
-		if (!pOwnIPAddress->IsNull ())
+		TNetworkPrivateData *pData = (TNetworkPrivateData *) pBuffer->GetPrivateData ();
+		if (   pData->bMoreFragments
+		    || pData->nFragmentOffset != 0)
 		{
-			if (   *pOwnIPAddress != IPAddressDestination
-			    && !IPAddressDestination.IsBroadcast ()
-			    && *m_pNetConfig->GetBroadcastAddress () != IPAddressDestination)
-			{
-				continue;
-			}
-		}
-		else
-		{
-			if (!IPAddressDestination.IsBroadcast ())
+			pBuffer = m_Reassembly.AddFragment (pBuffer);
+			if (pBuffer == 0)
 			{
 				continue;
 			}
 		}
 
-		if (   (pHeader->nFlagsFragmentOffset & IP_FLAGS_MF)
-		    ||    IP_FRAGMENT_OFFSET (le2be16 (pHeader->nFlagsFragmentOffset))
-		       != IP_FRAGMENT_OFFSET_FIRST)
-		{
-			continue;
-		}
-		
-		unsigned nTotalLength = le2be16 (pHeader->nTotalLength);
-		if (nResultLength < nTotalLength)
-		{
-			continue;
-		}
-		nResultLength = nTotalLength;		// ignore padding
+		DeliverPacket (pBuffer);
+	}
+
+	// packets sent to ourselves are never fragmented and have been checked already
+	while ((pBuffer = m_LoopbackQueue.Dequeue ()) != 0)
+	{
+		DeliverPacket (pBuffer);
+	}
+
+	assert (m_pICMPHandler != 0);
+	m_pICMPHandler->Process ();
+
+	assert (m_pIGMPHandler != 0);
+	m_pIGMPHandler->Process ();
+
+	m_Reassembly.Process ();
+}
+
+void CNetworkLayer::DeliverPacket (CNetBuffer *pBuffer)
+{
+	assert (pBuffer != 0);
+	TRACEPOINT (TRACER_EVENT_NET_IP_RX, (uintptr) pBuffer, pBuffer->GetLength (),
+		    ((TNetworkPrivateData *) pBuffer->GetPrivateData ())->nProtocol);
+
+	NET_STAT_INC (NetCounterIPRxPackets);
+	NET_STAT_INC (NetCounterIPRxBytes, pBuffer->GetLength ());
+
+	// the packet is handed over in place, without IP header
+	boolean bQueued;
+	switch (((TNetworkPrivateData *) pBuffer->GetPrivateData ())->nProtocol)
+	{
+	case IPPROTO_ICMP:
+		bQueued = m_ICMPRxQueue.Enqueue (pBuffer);
+		break;
+
+	case IPPROTO_IGMP:
+		bQueued = m_IGMPRxQueue.Enqueue (pBuffer);
+		break;
 
-		TNetworkPrivateData *pParam = new TNetworkPrivateData;
-		assert (pParam != 0);
-		pParam->nProtocol = pHeader->nProtocol;
-		memcpy (pParam->SourceAddress, pHeader->SourceAddress, IP_ADDRESS_SIZE);
-		memcpy (pParam->DestinationAddress, pHeader->DestinationAddress, IP_ADDRESS_SIZE);
+	default:
+		bQueued = m_RxQueue.Enqueue (pBuffer);
+		break;
+	}
+
+	if (!bQueued)
+	{
+		NET_STAT_INC (NetCounterIPRxQueueFull);
+	}
+}
+
+// Checks the IP header of a received packet, removes it from the buffer and sets
+// TNetworkPrivateData. Returns FALSE, if the packet has to be dropped.
+
+boolean CNetworkLayer::CheckPacket (CNetBuffer *pBuffer, const CIPAddress *pOwnIPAddress)
+{
+	assert (pBuffer != 0);
+	unsigned nResultLength = pBuffer->GetLength ();
+	if (nResultLength <= sizeof (TIPHeader))
+	{
+		NET_STAT_INC (NetCounterIPRxHeaderErrors);
 
-		nResultLength -= nHeaderLength;
+		return FALSE;
+	}
+	TIPHeader *pHeader = (TIPHeader *) pBuffer->GetData ();
+
+	unsigned nHeaderLength = pHeader->nVersionIHL & 0xF;
+	if (   nHeaderLength < IP_HEADER_LENGTH_DWORD_MIN
+	    || nHeaderLength > IP_HEADER_LENGTH_DWORD_MAX)
+	{
+		NET_STAT_INC (NetCounterIPRxHeaderErrors);
 
-		if (pHeader->nProtocol == IPPROTO_ICMP)
+		return FALSE;
+	}
+	nHeaderLength *= 4;
+	if (nResultLength <= nHeaderLength)
+	{
+		NET_STAT_INC (NetCounterIPRxHeaderErrors);
+
+		return FALSE;
+	}
+
+	if (   CChecksumCalculator::SimpleCalculate (pHeader, nHeaderLength) != CHECKSUM_OK
+	    || (pHeader->nVersionIHL >> 4) != IP_VERSION)
+	{
+		NET_STAT_INC (NetCounterIPRxHeaderErrors);
+
+		return FALSE;
+	}
+
+	CIPAddress IPAddressDestination (pHeader->DestinationAddress);
+	if (!pOwnIPAddress->IsNull ())
+	{
+		if (   *pOwnIPAddress != IPAddressDestination
+		    && !IPAddressDestination.IsBroadcast ()
+		    && *m_pNetConfig->GetBroadcastAddress () != IPAddressDestination
+		    && (   !IPAddressDestination.IsMulticast ()
+			|| !m_pIGMPHandler->IsMember (IPAddressDestination)))
 		{
-			m_ICMPRxQueue.Enqueue (Buffer+nHeaderLength, nResultLength, pParam);
+			NET_STAT_INC (NetCounterIPRxNotForUs);
+
+			return FALSE;
 		}
-		else
+	}
+	else
+	{
+		if (!IPAddressDestination.IsBroadcast ())
 		{
-			m_RxQueue.Enqueue (Buffer+nHeaderLength, nResultLength, pParam);
+			NET_STAT_INC (NetCounterIPRxNotForUs);
+
+			return FALSE;
 		}
 	}
 
-	assert (m_pICMPHandler != 0);
-	m_pICMPHandler->Process ();
+	unsigned nTotalLength = le2be16 (pHeader->nTotalLength);
+	if (nResultLength < nTotalLength)
+	{
+		NET_STAT_INC (NetCounterIPRxHeaderErrors);
+
+		return FALSE;
+	}
+	nResultLength = nTotalLength;		// ignore padding
+
+	TNetworkPrivateData *pData = (TNetworkPrivateData *) pBuffer->GetPrivateData ();
+	pData->nProtocol = pHeader->nProtocol;
+	memcpy (pData->SourceAddress, pHeader->SourceAddress, IP_ADDRESS_SIZE);
+	memcpy (pData->DestinationAddress, pHeader->DestinationAddress, IP_ADDRESS_SIZE);
+	pData->bMoreFragments = pHeader->nFlagsFragmentOffset & IP_FLAGS_MF ? TRUE : FALSE;
+	pData->nIdentification = le2be16 (pHeader->nIdentification);
+	pData->nFragmentOffset = IP_FRAGMENT_OFFSET (le2be16 (pHeader->nFlagsFragmentOffset)) * 8;
+
+	pBuffer->SetLength (nResultLength);
+	pBuffer->RemoveHeader (nHeaderLength);
+
+	return TRUE;
 }
 
 boolean CNetworkLayer::Send (const CIPAddress &rReceiver, const void *pPacket, unsigned nLength, int nProtocol)
 {
-	unsigned nPacketLength = sizeof (TIPHeader) + nLength;		// may wrap
-	if (   nPacketLength <= sizeof (TIPHeader)
-	    || nPacketLength > FRAME_BUFFER_SIZE)
+	if (   nLength == 0
+	    || nLength > IP_PAYLOAD_MAX_LENGTH)
 	{
 		return FALSE;
 	}
 
-	u8 PacketBuffer[nPacketLength];
-	TIPHeader *pHeader = (TIPHeader *) PacketBuffer;
+	CNetBuffer *pBuffer = new CNetBuffer (IP_PACKET_HEADROOM);
+	assert (pBuffer != 0);
 
-	pHeader->nVersionIHL          = IP_VERSION << 4 | IP_HEADER_LENGTH_DWORD_MIN;
-	pHeader->nTypeOfService       = IP_TOS_ROUTINE;
-	pHeader->nTotalLength         = le2be16 ((u16) nPacketLength);
-	pHeader->nIdentification      = BE (IP_IDENTIFICATION_DEFAULT);
-	pHeader->nFlagsFragmentOffset = IP_FLAGS_DF | BE (IP_FRAGMENT_OFFSET_FIRST);
-	pHeader->nTTL                 = IP_TTL_DEFAULT;
-	pHeader->nProtocol            = (u8) nProtocol;
+	assert (pPacket != 0);
+	memcpy (pBuffer->GetData (), pPacket, nLength);
+	pBuffer->SetLength (nLength);
+
+	return Send (rReceiver, pBuffer, nProtocol);
+}
+
+boolean CNetworkLayer::Send (const CIPAddress &rReceiver, CNetBuffer *pPacket, int nProtocol)
+{
+	// IGMP messages have to be inspected by routers
+	unsigned nHeaderLength = sizeof (TIPHeader);
+	if (nProtocol == IPPROTO_IGMP)
+	{
+		nHeaderLength += IP_OPTION_ROUTER_ALERT_SIZE;
+	}
+
+	assert (pPacket != 0);
+	unsigned nPacketLength = nHeaderLength + pPacket->GetLength ();
+	if (   pPacket->GetLength () == 0
+	    || pPacket->GetLength () > IP_PAYLOAD_MAX_LENGTH)
+	{
+		pPacket->Release ();
+
+		return FALSE;
+	}
 
 	assert (m_pNetConfig != 0);
 	const CIPAddress *pOwnIPAddress = m_pNetConfig->GetIPAddress ();
 	assert (pOwnIPAddress != 0);
 
-	pOwnIPAddress->CopyTo (pHeader->SourceAddress);
+	boolean bLoopback =    rReceiver.IsLoopback ()
+			    || (   !pOwnIPAddress->IsNull ()
+				&& *pOwnIPAddress == rReceiver);
+
+	// packets, which do not fit into the MTU, need an unique identification,
+	// TCP segments, which are split by the net device, are not fragmented
+	unsigned nMTU = m_pNetConfig->GetMTU ();
+	boolean bFragment =    nPacketLength > nMTU
+			    && !(pPacket->GetOffloadFlags () & NET_OFFLOAD_TX_SEGMENTATION)
+			    && !bLoopback;
+
+	TIPHeader *pHeader = (TIPHeader *) pPacket->PrependHeader (nHeaderLength);
+	assert (pHeader != 0);
+
+	pHeader->nVersionIHL          = IP_VERSION << 4 | nHeaderLength / 4;
+	pHeader->nTypeOfService       = IP_TOS_ROUTINE;
+	pHeader->nTotalLength         = le2be16 ((u16) nPacketLength);
+	if (!bFragment)
+	{
+		pHeader->nIdentification      = BE (IP_IDENTIFICATION_DEFAULT);
+		pHeader->nFlagsFragmentOffset = IP_FLAGS_DF | BE (IP_FRAGMENT_OFFSET_FIRST);
+	}
+	else
+	{
+		pHeader->nIdentification      = le2be16 (m_nIdentification++);
+		pHeader->nFlagsFragmentOffset = BE (IP_FRAGMENT_OFFSET_FIRST);
+	}
+	pHeader->nTTL                 = rReceiver.IsMulticast () ? IP_TTL_MULTICAST : IP_TTL_DEFAULT;
+	pHeader->nProtocol            = (u8) nProtocol;
+
+	if (!rReceiver.IsLoopback ())
+	{
+		pOwnIPAddress->CopyTo (pHeader->SourceAddress);
+	}
+	else
+	{
+		// replies must be addressed to the loopback network too
+		memcpy (pHeader->SourceAddress, LoopbackAddress, IP_ADDRESS_SIZE);
+	}
 
 	rReceiver.CopyTo (pHeader->DestinationAddress);
 
+	if (nHeaderLength > sizeof (TIPHeader))
+	{
+		u8 *pOption = (u8 *) pHeader + sizeof (TIPHeader);
+		pOption[0] = IP_OPTION_ROUTER_ALERT;
+		pOption[1] = IP_OPTION_ROUTER_ALERT_SIZE;
+		pOption[2] = 0;
+		pOption[3] = 0;
+	}
+
 	pHeader->nHeaderChecksum = 0;
-	pHeader->nHeaderChecksum = CChecksumCalculator::SimpleCalculate (pHeader, sizeof (TIPHeader));
+	pHeader->nHeaderChecksum = CChecksumCalculator::SimpleCalculate (pHeader, nHeaderLength);
 
-	assert (pPacket != 0);
-	assert (nLength > 0);
-	memcpy (PacketBuffer+sizeof (TIPHeader), pPacket, nLength);
+	if (bLoopback)
+	{
+		TRACEPOINT (TRACER_EVENT_NET_IP_TX, (uintptr) pPacket, nPacketLength, nProtocol);
+
+		NET_STAT_INC (NetCounterIPTxPackets);
+		NET_STAT_INC (NetCounterIPTxBytes, nPacketLength);
+
+		return SendLoopback (pPacket, nHeaderLength);
+	}
 
 	if (   pOwnIPAddress->IsNull ()
 	    && !rReceiver.IsBroadcast ())
 	{
-		SendFailed (ICMP_CODE_DEST_NET_UNREACH, PacketBuffer, nPacketLength);
+		NET_STAT_INC (NetCounterIPTxNoRoute);
+
+		SendFailed (ICMP_CODE_DEST_NET_UNREACH, pHeader, nPacketLength);
+
+		pPacket->Release ();
 
 		return FALSE;
 	}
 
-	CIPAddress GatewayIP;
-	const CIPAddress *pNextHop = &rReceiver;
-	if (!pOwnIPAddress->OnSameNetwork (rReceiver, m_pNetConfig->GetNetMask ()))
+	// multicast packets are sent to the local network only
+	CIPAddress NextHop;
+	if (rReceiver.IsMulticast ())
 	{
-		const u8 *pGateway = m_RouteCache.GetRoute (rReceiver.Get ());
-		if (pGateway != 0)
-		{
-			GatewayIP.Set (pGateway);
+		NextHop.Set (rReceiver);
+	}
+	else if (!GetNextHop (rReceiver, &NextHop))
+	{
+		NET_STAT_INC (NetCounterIPTxNoRoute);
 
-			pNextHop = &GatewayIP;
-		}
-		else
-		{
-			pNextHop = m_pNetConfig->GetDefaultGateway ();
-			if (pNextHop->IsNull ())
-			{
-				SendFailed (ICMP_CODE_DEST_NET_UNREACH, PacketBuffer, nPacketLength);
+		SendFailed (ICMP_CODE_DEST_NET_UNREACH, pHeader, nPacketLength);
 
-				return FALSE;
-			}
-		}
+		pPacket->Release ();
+
+		return FALSE;
 	}
 	
+	TRACEPOINT (TRACER_EVENT_NET_IP_TX, (uintptr) pPacket, nPacketLength, nProtocol);
+
+	NET_STAT_INC (NetCounterIPTxPackets);
+	NET_STAT_INC (NetCounterIPTxBytes, nPacketLength);
+
+	if (bFragment)
+	{
+		// the net device cannot calculate a checksum, which spans several fragments
+		if (pPacket->GetOffloadFlags () & NET_OFFLOAD_TX_CHECKSUM)
+		{
+			CalculateOffloadedChecksum (pPacket, nProtocol);
+		}
+
+		return SendFragmented (NextHop, pPacket, nMTU);
+	}
+
 	assert (m_pLinkLayer != 0);
-	assert (pNextHop != 0);
-	return m_pLinkLayer->Send (*pNextHop, PacketBuffer, nPacketLength);
+	return m_pLinkLayer->Send (NextHop, pPacket);
 }
 
-boolean CNetworkLayer::Receive (void *pBuffer, unsigned *pResultLength,
-				CIPAddress *pSender, CIPAddress *pReceiver, int *pProtocol)
+boolean CNetworkLayer::SendFragmented (const CIPAddress &rNextHop, CNetBuffer *pPacket,
+				       unsigned nMTU)
 {
-	void *pParam;
-	assert (pBuffer != 0);
-	assert (pResultLength != 0);
-	*pResultLength = m_RxQueue.Dequeue (pBuffer, &pParam);
-	if (*pResultLength == 0)
+	assert (pPacket != 0);
+	const TIPHeader *pHeader = (const TIPHeader *) pPacket->GetData ();
+	unsigned nHeaderLength = (pHeader->nVersionIHL & 0xF) * 4;
+	assert (pPacket->GetLength () > nHeaderLength);
+	unsigned nPayloadLength = pPacket->GetLength () - nHeaderLength;
+	const u8 *pPayload = pPacket->GetData () + nHeaderLength;
+
+	// the payload length of all fragments, but the last one, must be a multiple of 8
+	unsigned nFragmentSize = (nMTU - nHeaderLength) & ~7U;
+	assert (nFragmentSize > 0);
+
+	boolean bOK = TRUE;
+	for (unsigned nOffset = 0; bOK && nOffset < nPayloadLength; nOffset += nFragmentSize)
+	{
+		unsigned nLength = nPayloadLength - nOffset;
+		u16 usFlags = 0;
+		if (nLength > nFragmentSize)
+		{
+			nLength = nFragmentSize;
+			usFlags = IP_FLAGS_MF;
+		}
+
+		CNetBuffer *pFragment = new CNetBuffer (IP_PACKET_HEADROOM);
+		assert (pFragment != 0);
+		memcpy (pFragment->GetData (), pPayload + nOffset, nLength);
+		pFragment->SetLength (nLength);
+
+		TIPHeader *pFragmentHeader = (TIPHeader *) pFragment->PrependHeader (nHeaderLength);
+		assert (pFragmentHeader != 0);
+		memcpy (pFragmentHeader, pHeader, nHeaderLength);
+
+		pFragmentHeader->nTotalLength = le2be16 ((u16) (nHeaderLength + nLength));
+		pFragmentHeader->nFlagsFragmentOffset = usFlags | le2be16 ((u16) (nOffset / 8));
+
+		pFragmentHeader->nHeaderChecksum = 0;
+		pFragmentHeader->nHeaderChecksum =
+			CChecksumCalculator::SimpleCalculate (pFragmentHeader, nHeaderLength);
+
+		NET_STAT_INC (NetCounterIPTxFragments);
+
+		assert (m_pLinkLayer != 0);
+		bOK = m_pLinkLayer->Send (rNextHop, pFragment);
+	}
+
+	pPacket->Release ();
+
+	return bOK;
+}
+
+boolean CNetworkLayer::SendLoopback (CNetBuffer *pPacket, unsigned nHeaderLength)
+{
+	assert (pPacket != 0);
+	const TIPHeader *pHeader = (const TIPHeader *) pPacket->GetData ();
+	assert (pHeader != 0);
+
+	TNetworkPrivateData *pData = (TNetworkPrivateData *) pPacket->GetPrivateData ();
+	pData->nProtocol = pHeader->nProtocol;
+	memcpy (pData->SourceAddress, pHeader->SourceAddress, IP_ADDRESS_SIZE);
+	memcpy (pData->DestinationAddress, pHeader->DestinationAddress, IP_ADDRESS_SIZE);
+	pData->bMoreFragments = FALSE;
+	pData->nIdentification = le2be16 (pHeader->nIdentification);
+	pData->nFragmentOffset = 0;
+
+	pPacket->RemoveHeader (nHeaderLength);
+
+	// the data does not leave the memory, so that an offloaded checksum does not need to
+	// be calculated and the segment is received as a whole, even if it exceeds the MTU
+	pPacket->SetOffload (NET_OFFLOAD_RX_CHECKSUM);
+
+	if (!m_LoopbackQueue.Enqueue (pPacket))
 	{
+		NET_STAT_INC (NetCounterIPRxQueueFull);
+
 		return FALSE;
 	}
+
+	NET_STAT_INC (NetCounterIPTxLoopback);
+
+	return TRUE;
+}
+
+void CNetworkLayer::CalculateOffloadedChecksum (CNetBuffer *pPacket, int nProtocol)
+{
+	assert (pPacket != 0);
+	assert (pPacket->GetOffloadFlags () & NET_OFFLOAD_TX_CHECKSUM);
+	unsigned nStart = pPacket->GetChecksumStart ();
+	assert (nStart < pPacket->GetLength ());
+	u8 *pStart = pPacket->GetData () + nStart;
+
+	// the checksum field holds the sum over the pseudo header already
+	u16 *pChecksum = (u16 *) (pStart + pPacket->GetChecksumOffset ());
+	u16 nChecksum = CChecksumCalculator::SimpleCalculate (pStart,
+							      pPacket->GetLength () - nStart);
+	if (   nChecksum == 0
+	    && nProtocol == IPPROTO_UDP)
+	{
+		nChecksum = 0xFFFF;		// 0 means "no checksum" with UDP
+	}
+
+	*pChecksum = nChecksum;
+
+	pPacket->SetOffload (0);
+}
+
+CNetBuffer *CNetworkLayer::Receive (CIPAddress *pSender, CIPAddress *pReceiver, int *pProtocol)
+{
+	CNetBuffer *pBuffer = m_RxQueue.Dequeue ();
+	if (pBuffer == 0)
+	{
+		return 0;
+	}
 	
-	TNetworkPrivateData *pData = (TNetworkPrivateData *) pParam;
+	TNetworkPrivateData *pData = (TNetworkPrivateData *) pBuffer->GetPrivateData ();
 	assert (pData != 0);
 
 	assert (pProtocol != 0);
@@ -234,10 +510,7 @@ boolean CNetworkLayer::Receive (void *pBuffer, unsigned *pResultLength,
 	assert (pReceiver != 0);
 	pReceiver->Set (pData->DestinationAddress);
 
-	delete pData;
-	pData = 0;
-	
-	return TRUE;
+	return pBuffer;
 }
 
 boolean CNetworkLayer::ReceiveNotification (TICMPNotificationType *pType,
@@ -274,24 +547,90 @@ boolean CNetworkLayer::ReceiveNotification (TICMPNotificationType *pType,
 	return TRUE;
 }
 
-void CNetworkLayer::AddRoute (const u8 *pDestIP, const u8 *pGatewayIP)
+boolean CNetworkLayer::JoinGroup (const CIPAddress &rGroupIP)
+{
+	assert (m_pIGMPHandler != 0);
+	return m_pIGMPHandler->JoinGroup (rGroupIP);
+}
+
+void CNetworkLayer::LeaveGroup (const CIPAddress &rGroupIP)
+{
+	assert (m_pIGMPHandler != 0);
+	m_pIGMPHandler->LeaveGroup (rGroupIP);
+}
+
+CRoutingTable *CNetworkLayer::GetRoutingTable (void)
 {
-	m_RouteCache.AddRoute (pDestIP, pGatewayIP);
+	return &m_RoutingTable;
 }
 
-const u8 *CNetworkLayer::GetGateway (const u8 *pDestIP) const
+unsigned CNetworkLayer::GetOffloadCapabilities (void) const
 {
-	const u8 *pGateway = m_RouteCache.GetRoute (pDestIP);
-	if (pGateway != 0)
+	assert (m_pLinkLayer != 0);
+	return m_pLinkLayer->GetOffloadCapabilities ();
+}
+
+boolean CNetworkLayer::GetNextHop (const CIPAddress &rDestIP, CIPAddress *pNextHop)
+{
+	assert (pNextHop != 0);
+	assert (m_pNetConfig != 0);
+	TNetConfigSnapshot Config;
+	m_pNetConfig->GetSnapshot (&Config);
+
+	const u8 *pNetMask = Config.NetMask.Get ();
+	assert (pNetMask != 0);
+	boolean bConnected = Config.IPAddress.OnSameNetwork (rDestIP, pNetMask);
+
+	// a route wins over the connected network, if its prefix is longer
+	TRoute Route;
+	if (   m_RoutingTable.Lookup (rDestIP.Get (), &Route)
+	    && Route.nInterface == 0			// only one net device is used
+	    && (   !bConnected
+		|| Route.nPrefixLength > GetPrefixLength (pNetMask)))
 	{
-		return pGateway;
+		CIPAddress GatewayIP (Route.GatewayIP);
+		pNextHop->Set (GatewayIP.IsNull () ? rDestIP : GatewayIP);
+
+		return TRUE;
 	}
 
-	assert (m_pNetConfig != 0);
-	const CIPAddress *pDefaultGateway = m_pNetConfig->GetDefaultGateway ();
-	assert (pDefaultGateway != 0);
+	if (bConnected)
+	{
+		pNextHop->Set (rDestIP);
+
+		return TRUE;
+	}
 
-	return pDefaultGateway->Get ();
+	if (Config.DefaultGateway.IsNull ())
+	{
+		return FALSE;
+	}
+
+	pNextHop->Set (Config.DefaultGateway);
+
+	return TRUE;
+}
+
+unsigned CNetworkLayer::GetPrefixLength (const u8 *pNetMask)
+{
+	assert (pNetMask != 0);
+
+	unsigned nLength = 0;
+	for (unsigned i = 0; i < IP_ADDRESS_SIZE; i++)
+	{
+		for (u8 uchMask = 0x80; uchMask != 0 && (pNetMask[i] & uchMask); uchMask >>= 1)
+		{
+			nLength++;
+		}
+	}
+
+	return nLength;
+}
+
+void CNetworkLayer::AddRoute (const u8 *pDestIP, const u8 *pGatewayIP)
+{
+	// the redirect is ignored, if the routing table is full
+	m_RoutingTable.AddRoute (pDestIP, 32, pGatewayIP);
 }
 
 void CNetworkLayer::SendFailed (unsigned nICMPCode, const void *pReturnedPacket, unsigned nLength)
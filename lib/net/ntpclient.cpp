@@ -2,7 +2,7 @@
 // ntpclient.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,6 +21,7 @@
 #include <circle/net/socket.h>
 #include <circle/net/in.h>
 #include <circle/sched/scheduler.h>
+#include <circle/timekeeper.h>
 #include <circle/logger.h>
 #include <circle/util.h>
 #include <circle/types.h>
@@ -30,6 +31,10 @@
 
 #define SEVENTY_YEARS		2208988800U
 
+#define NS_PER_SECOND		1000000000ULL
+
+#define RESPONSE_TIMEOUT_MS	1000
+
 static const char FromNTPClient[] = "ntp";
 
 CNTPClient::CNTPClient (CNetSubSystem *pNetSubSystem)
@@ -110,3 +115,124 @@ unsigned CNTPClient::GetTime (CIPAddress &rServerIP)
 	
 	return nTime;
 }
+
+boolean CNTPClient::GetOffset (CIPAddress &rServerIP, s64 *pOffsetNs)
+{
+	assert (pOffsetNs != 0);
+
+	CTimeKeeper *pTimeKeeper = CTimeKeeper::Get ();
+	assert (pTimeKeeper != 0);
+
+	assert (m_pNetSubSystem != 0);
+	CSocket Socket (m_pNetSubSystem, IPPROTO_UDP);
+	if (Socket.Connect (rServerIP, 123) != 0)
+	{
+		return FALSE;
+	}
+
+	u8 NTPPacket[NTP_PACKET_SIZE];
+	memset (NTPPacket, 0, sizeof NTPPacket);
+	NTPPacket[0] = 0xE3;			// leap indicator: unknown, version: 4, mode: client
+	NTPPacket[2] = 10;			// poll: 1024 seconds
+	NTPPacket[3] = 0xEC;			// precision: about 60 ns (2^-24 s)
+	memcpy (NTPPacket+12, "XCIR", 4);
+
+	u8 RecvPacket[NTP_PACKET_SIZE];
+	u64 nT1 = 0, nT4 = 0;
+
+	unsigned nTry;
+	for (nTry = 1; nTry <= 3; nTry++)
+	{
+		// the transmit timestamp is returned as originate timestamp
+		nT1 = pTimeKeeper->GetTimeNs ();
+		SetTimestamp (NTPPacket+40, nT1);
+
+		if (Socket.Send (NTPPacket, sizeof NTPPacket, 0) != sizeof NTPPacket)
+		{
+			CLogger::Get ()->Write (FromNTPClient, LogError, "Send failed");
+
+			return FALSE;
+		}
+
+		// poll for the response, so that the receive time is known exactly
+		int nResult = 0;
+		for (unsigned nMs = 0; nMs < RESPONSE_TIMEOUT_MS; nMs++)
+		{
+			nResult = Socket.Receive (RecvPacket, sizeof RecvPacket, MSG_DONTWAIT);
+			if (nResult != 0)
+			{
+				break;
+			}
+
+			CScheduler::Get ()->MsSleep (1);
+		}
+
+		nT4 = pTimeKeeper->GetTimeNs ();
+
+		if (nResult < 0)
+		{
+			CLogger::Get ()->Write (FromNTPClient, LogError, "Receive failed");
+
+			return FALSE;
+		}
+
+		if (   nResult == NTP_PACKET_SIZE
+		    && memcmp (RecvPacket+24, NTPPacket+40, 8) == 0)
+		{
+			break;
+		}
+	}
+
+	if (nTry > 3)
+	{
+		CLogger::Get ()->Write (FromNTPClient, LogError, "Invalid or no response");
+
+		return FALSE;
+	}
+
+	u64 nT2 = GetTimestamp (RecvPacket+32);		// server receive time
+	u64 nT3 = GetTimestamp (RecvPacket+40);		// server transmit time
+	if (   nT2 == 0
+	    || nT3 == 0)
+	{
+		return FALSE;
+	}
+
+	*pOffsetNs = ((s64) (nT2 - nT1) + (s64) (nT3 - nT4)) / 2;
+
+	return TRUE;
+}
+
+void CNTPClient::SetTimestamp (u8 *pBuffer, u64 nTimeNs)
+{
+	assert (pBuffer != 0);
+
+	u32 nSeconds = (u32) (nTimeNs / NS_PER_SECOND) + SEVENTY_YEARS;
+	u32 nFraction = (u32) (((nTimeNs % NS_PER_SECOND) << 32) / NS_PER_SECOND);
+
+	for (unsigned i = 0; i < 4; i++)
+	{
+		pBuffer[i]   = (u8) (nSeconds  >> (24 - 8*i));
+		pBuffer[4+i] = (u8) (nFraction >> (24 - 8*i));
+	}
+}
+
+u64 CNTPClient::GetTimestamp (const u8 *pBuffer)
+{
+	assert (pBuffer != 0);
+
+	u32 nSeconds = 0, nFraction = 0;
+	for (unsigned i = 0; i < 4; i++)
+	{
+		nSeconds  = nSeconds  << 8 | pBuffer[i];
+		nFraction = nFraction << 8 | pBuffer[4+i];
+	}
+
+	if (nSeconds < SEVENTY_YEARS)
+	{
+		return 0;
+	}
+
+	return   (u64) (nSeconds - SEVENTY_YEARS) * NS_PER_SECOND
+	       + (((u64) nFraction * NS_PER_SECOND) >> 32);
+}
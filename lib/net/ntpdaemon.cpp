@@ -2,7 +2,7 @@
 // ntpdaemon.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,6 +23,7 @@
 #include <circle/net/ipaddress.h>
 #include <circle/sched/scheduler.h>
 #include <circle/timer.h>
+#include <circle/timekeeper.h>
 #include <circle/logger.h>
 #include <assert.h>
 
@@ -67,6 +68,34 @@ unsigned CNTPDaemon::UpdateTime (void)
 	}
 	
 	CNTPClient NTPClient (m_pNetSubSystem);
+
+	// discipline the time keeper, if available, and derive the system time from it
+	CTimeKeeper *pTimeKeeper = CTimeKeeper::Get ();
+	if (pTimeKeeper != 0)
+	{
+		s64 nOffsetNs;
+		if (!NTPClient.GetOffset (NTPServerIP, &nOffsetNs))
+		{
+			CLogger::Get ()->Write (FromNTPDaemon, LogWarning, "Cannot get time from %s",
+						(const char *) m_NTPServer);
+
+			return 300;
+		}
+
+		pTimeKeeper->Adjust (nOffsetNs);
+
+		CLogger::Get ()->Write (FromNTPDaemon, LogDebug, "Offset %lld us, frequency %d ppb",
+					nOffsetNs / 1000, pTimeKeeper->GetFrequencyPPB ());
+
+		if (!CTimer::Get ()->SetTime ((unsigned) (pTimeKeeper->GetTimeNs () / 1000000000ULL),
+					      FALSE))
+		{
+			CLogger::Get ()->Write (FromNTPDaemon, LogWarning, "Cannot update system time");
+		}
+
+		return 900;
+	}
+
 	unsigned nTime = NTPClient.GetTime (NTPServerIP);
 	if (nTime == 0)
 	{
@@ -2,7 +2,7 @@
 // phytask.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2019-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2019-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,30 +18,60 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/phytask.h>
-#include <circle/sched/scheduler.h>
+#include <circle/net/netdevlayer.h>
 #include <assert.h>
 
-CPHYTask::CPHYTask (CNetDevice *pDevice)
-:	m_pDevice (pDevice)
+CPHYTask::CPHYTask (CNetDevice *pDevice, CNetDeviceLayer *pNetDevLayer)
+:	m_pDevice (pDevice),
+	m_pNetDevLayer (pNetDevLayer)
 {
 	SetName ("netphy");
 }
 
 CPHYTask::~CPHYTask (void)
 {
+	m_pDevice->RegisterLinkChangeHandler (0);
+
+	m_pNetDevLayer = 0;
 	m_pDevice = 0;
 }
 
 void CPHYTask::Run (void)
 {
+	assert (m_pDevice != 0);
+	m_pDevice->RegisterLinkChangeHandler (LinkChangeHandler, this);
+
+	unsigned nIntervalMs =   m_pDevice->HasLinkInterrupt ()
+			       ? PHY_POLL_INTERVAL_IRQ_MS : PHY_POLL_INTERVAL_MS;
+
+	boolean bLinkUp = m_pDevice->IsLinkUp ();
+
 	while (1)
 	{
-		assert (m_pDevice != 0);
-		if (!m_pDevice->UpdatePHY ())
+		// clear before accessing the PHY, so that no notification gets lost
+		m_Event.Clear ();
+
+		m_pDevice->UpdatePHY ();
+
+		boolean bNewLinkUp = m_pDevice->IsLinkUp ();
+		if (bNewLinkUp != bLinkUp)
 		{
-			return;
+			bLinkUp = bNewLinkUp;
+
+			if (m_pNetDevLayer != 0)
+			{
+				m_pNetDevLayer->LinkChanged (bLinkUp);
+			}
 		}
 
-		CScheduler::Get ()->MsSleep (2000);
+		m_Event.WaitWithTimeout (nIntervalMs * 1000);
 	}
 }
+
+void CPHYTask::LinkChangeHandler (void *pParam)
+{
+	CPHYTask *pThis = (CPHYTask *) pParam;
+	assert (pThis != 0);
+
+	pThis->m_Event.Set ();
+}
@@ -2,7 +2,7 @@
 // retransmissionqueue.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,25 +18,38 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/retransmissionqueue.h>
+#include <circle/util.h>
 #include <assert.h>
 
+#define min(n, m)		((n) <= (m) ? (n) : (m))
+
+u8 *CRetransmissionQueue::s_pFreeList = 0;
+unsigned CRetransmissionQueue::s_nFreeChunks = 0;
+CSpinLock CRetransmissionQueue::s_SpinLock (TASK_LEVEL);
+
 CRetransmissionQueue::CRetransmissionQueue (unsigned nSize)
 :	m_nSize (nSize),
-	m_pBuffer (0),
+	m_ppChunk (0),
+	m_nMaxChunks (nSize / RETRANS_QUEUE_CHUNK_SIZE + 2),
+	m_nFirstChunk (0),
+	m_nChunks (0),
+	m_nBase (0),
 	m_nInPtr (0),
 	m_nOutPtr (0),
 	m_nPreOutPtr (0)
 {
 	assert (m_nSize > 1);
 
-	m_pBuffer = new unsigned char[m_nSize];
-	assert (m_pBuffer != 0);
+	m_ppChunk = new u8 *[m_nMaxChunks];
+	assert (m_ppChunk != 0);
 }
 
 CRetransmissionQueue::~CRetransmissionQueue (void)
 {
-	delete m_pBuffer;
-	m_pBuffer = 0;
+	Flush ();
+
+	delete [] m_ppChunk;
+	m_ppChunk = 0;
 	
 	m_nSize = 0;
 }
@@ -49,43 +62,47 @@ boolean CRetransmissionQueue::IsEmpty (void) const
 unsigned CRetransmissionQueue::GetFreeSpace (void) const
 {
 	assert (m_nSize > 1);
-	assert (m_nInPtr < m_nSize);
-	assert (m_nOutPtr < m_nSize);
+	assert (m_nInPtr-m_nOutPtr < m_nSize);
+
+	return m_nSize-(m_nInPtr-m_nOutPtr)-1;
+}
+
+boolean CRetransmissionQueue::Reserve (unsigned nLength)
+{
+	assert (GetFreeSpace () >= nLength);
+	assert (m_ppChunk != 0);
 
-	if (m_nOutPtr <= m_nInPtr)
+	unsigned nRequired = m_nInPtr-m_nBase+nLength;
+	while (m_nChunks * RETRANS_QUEUE_CHUNK_SIZE < nRequired)
 	{
-		return m_nSize+m_nOutPtr-m_nInPtr-1;
+		u8 *pChunk = AllocateChunk ();
+		if (pChunk == 0)
+		{
+			return FALSE;
+		}
+
+		assert (m_nChunks < m_nMaxChunks);
+		m_ppChunk[(m_nFirstChunk+m_nChunks) % m_nMaxChunks] = pChunk;
+		m_nChunks++;
 	}
 
-	return m_nOutPtr-m_nInPtr-1;
+	return TRUE;
 }
 
 void CRetransmissionQueue::Write (const void *pBuffer, unsigned nLength)
 {
 	assert (nLength > 0);
 	assert (GetFreeSpace () >= nLength);
+	assert (m_nChunks * RETRANS_QUEUE_CHUNK_SIZE >= m_nInPtr-m_nBase+nLength);
 
-	unsigned char *p = (unsigned char *) pBuffer;
-	assert (p != 0);
-	assert (m_pBuffer != 0);
+	CopyIn (m_nInPtr, (const u8 *) pBuffer, nLength);
 
-	while (nLength--)
-	{
-		m_pBuffer[m_nInPtr++] = *p++;
-		m_nInPtr %= m_nSize;
-	}
+	m_nInPtr += nLength;
 }
 
 unsigned CRetransmissionQueue::GetBytesAvailable (void) const
 {
-	assert (m_nSize > 1);
-	assert (m_nInPtr < m_nSize);
-	assert (m_nPreOutPtr < m_nSize);
-
-	if (m_nInPtr < m_nPreOutPtr)
-	{
-		return m_nSize+m_nInPtr-m_nPreOutPtr;
-	}
+	assert (m_nInPtr-m_nPreOutPtr < m_nSize);
 
 	return m_nInPtr-m_nPreOutPtr;
 }
@@ -95,25 +112,38 @@ void CRetransmissionQueue::Read (void *pBuffer, unsigned nLength)
 	assert (nLength > 0);
 	assert (GetBytesAvailable () >= nLength);
 
-	unsigned char *p = (unsigned char *) pBuffer;
-	assert (p != 0);
-	assert (m_pBuffer != 0);
+	CopyOut (m_nPreOutPtr, (u8 *) pBuffer, nLength);
 
-	while (nLength--)
-	{
-		*p++ = m_pBuffer[m_nPreOutPtr++];
-		m_nPreOutPtr %= m_nSize;
-	}
+	m_nPreOutPtr += nLength;
+}
+
+void CRetransmissionQueue::Peek (void *pBuffer, unsigned nLength) const
+{
+	assert (nLength > 0);
+	assert (m_nInPtr-m_nOutPtr >= nLength);
+
+	CopyOut (m_nOutPtr, (u8 *) pBuffer, nLength);
+}
+
+void CRetransmissionQueue::Skip (unsigned nBytes)
+{
+	assert (GetBytesAvailable () >= nBytes);
+
+	m_nPreOutPtr += nBytes;
 }
 
 void CRetransmissionQueue::Advance (unsigned nBytes)
 {
-	assert (m_nSize > 1);
-	assert (m_nOutPtr < m_nSize);
-	assert (m_nPreOutPtr < m_nSize);
+	assert (m_nInPtr-m_nOutPtr >= nBytes);
 	
 	m_nOutPtr += nBytes;
-	m_nOutPtr %= m_nSize;
+
+	if ((int) (m_nPreOutPtr-m_nOutPtr) < 0)
+	{
+		m_nPreOutPtr = m_nOutPtr;
+	}
+
+	ReleaseChunks ();
 }
 
 void CRetransmissionQueue::Reset (void)
@@ -126,4 +156,127 @@ void CRetransmissionQueue::Flush (void)
 	m_nInPtr = 0;
 	m_nOutPtr = 0;
 	m_nPreOutPtr = 0;
+
+	ReleaseChunks ();
+}
+
+void CRetransmissionQueue::CopyIn (unsigned nPosition, const u8 *pBuffer, unsigned nLength)
+{
+	assert (pBuffer != 0);
+
+	while (nLength > 0)
+	{
+		unsigned nOffset = (nPosition-m_nBase) % RETRANS_QUEUE_CHUNK_SIZE;
+		unsigned nBytes = min (RETRANS_QUEUE_CHUNK_SIZE-nOffset, nLength);
+
+		memcpy (GetChunk (nPosition)+nOffset, pBuffer, nBytes);
+
+		nPosition += nBytes;
+		pBuffer += nBytes;
+		nLength -= nBytes;
+	}
+}
+
+void CRetransmissionQueue::CopyOut (unsigned nPosition, u8 *pBuffer, unsigned nLength) const
+{
+	assert (pBuffer != 0);
+
+	while (nLength > 0)
+	{
+		unsigned nOffset = (nPosition-m_nBase) % RETRANS_QUEUE_CHUNK_SIZE;
+		unsigned nBytes = min (RETRANS_QUEUE_CHUNK_SIZE-nOffset, nLength);
+
+		memcpy (pBuffer, GetChunk (nPosition)+nOffset, nBytes);
+
+		nPosition += nBytes;
+		pBuffer += nBytes;
+		nLength -= nBytes;
+	}
+}
+
+u8 *CRetransmissionQueue::GetChunk (unsigned nPosition) const
+{
+	unsigned nChunk = (nPosition-m_nBase) / RETRANS_QUEUE_CHUNK_SIZE;
+	assert (nChunk < m_nChunks);
+
+	assert (m_ppChunk != 0);
+	u8 *pChunk = m_ppChunk[(m_nFirstChunk+nChunk) % m_nMaxChunks];
+	assert (pChunk != 0);
+
+	return pChunk;
+}
+
+void CRetransmissionQueue::ReleaseChunks (void)
+{
+	if (m_nOutPtr == m_nInPtr)
+	{
+		// an empty queue does not hold memory, the reserved chunks are released too
+		while (m_nChunks > 0)
+		{
+			FreeChunk (m_ppChunk[m_nFirstChunk]);
+
+			m_nFirstChunk = (m_nFirstChunk+1) % m_nMaxChunks;
+			m_nChunks--;
+		}
+
+		m_nBase = m_nInPtr;
+
+		return;
+	}
+
+	while (   m_nChunks > 0
+	       && m_nOutPtr-m_nBase >= RETRANS_QUEUE_CHUNK_SIZE)
+	{
+		FreeChunk (m_ppChunk[m_nFirstChunk]);
+
+		m_nFirstChunk = (m_nFirstChunk+1) % m_nMaxChunks;
+		m_nChunks--;
+
+		m_nBase += RETRANS_QUEUE_CHUNK_SIZE;
+	}
+}
+
+u8 *CRetransmissionQueue::AllocateChunk (void)
+{
+	s_SpinLock.Acquire ();
+
+	u8 *pChunk = s_pFreeList;
+	if (pChunk != 0)
+	{
+		s_pFreeList = *(u8 **) pChunk;
+
+		assert (s_nFreeChunks > 0);
+		s_nFreeChunks--;
+
+		s_SpinLock.Release ();
+
+		return pChunk;
+	}
+
+	s_SpinLock.Release ();
+
+	return new u8[RETRANS_QUEUE_CHUNK_SIZE];
+}
+
+void CRetransmissionQueue::FreeChunk (u8 *pChunk)
+{
+	assert (pChunk != 0);
+
+	s_SpinLock.Acquire ();
+
+	if (s_nFreeChunks < RETRANS_QUEUE_POOL_CHUNKS)
+	{
+		*(u8 **) pChunk = s_pFreeList;
+		s_pFreeList = pChunk;
+
+		s_nFreeChunks++;
+
+		s_SpinLock.Release ();
+
+		return;
+	}
+
+	s_SpinLock.Release ();
+
+	delete [] pChunk;
 }
@@ -20,6 +20,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/retranstimeoutcalc.h>
+#include <circle/net/netstatistics.h>
 #include <circle/logger.h>
 #include <assert.h>
 
@@ -45,6 +46,7 @@ CRetransmissionTimeoutCalculator::CRetransmissionTimeoutCalculator (void)
 	m_nISN (0),
 	m_nRTO (INITIAL_RTO),
 	m_bFirstMeasurement (TRUE),
+	m_nSRTT (0),
 	m_bMeasurementRuns (FALSE),
 	m_nRetransmissions (0)
 {
@@ -61,6 +63,11 @@ unsigned CRetransmissionTimeoutCalculator::GetRTO (void) const
 	return m_nRTO;
 }
 
+unsigned CRetransmissionTimeoutCalculator::GetSRTT (void) const
+{
+	return m_nSRTT;
+}
+
 void CRetransmissionTimeoutCalculator::Initialize (u32 nISN)
 {
 	m_SpinLock.Acquire ();
@@ -72,6 +79,7 @@ void CRetransmissionTimeoutCalculator::Initialize (u32 nISN)
 	m_nISN = nISN;
 	m_nRTO = INITIAL_RTO;
 	m_bFirstMeasurement = TRUE;
+	m_nSRTT = 0;
 	m_bMeasurementRuns = FALSE;
 	m_nRetransmissions = 0;
 
@@ -123,6 +131,26 @@ void CRetransmissionTimeoutCalculator::SegmentAcknowledged (u32 nAcknowledgmentN
 	m_SpinLock.Release ();
 }
 
+void CRetransmissionTimeoutCalculator::SegmentAcknowledged (u32 nAcknowledgmentNumber,
+							    unsigned nRTT)
+{
+	m_SpinLock.Acquire ();
+
+#ifdef RTO_DEBUG
+	CLogger::Get ()->Write (FromRTO, LogDebug, "Segment acknowledged (ack %u, rtt %u)",
+				nAcknowledgmentNumber-m_nISN, nRTT);
+#endif
+
+	// timestamps are echoed from the segment, which triggered the ACK, so the
+	// measurement is valid for retransmissions too (RFC 7323 section 4.1)
+	Calculate (nRTT);
+
+	m_bMeasurementRuns = FALSE;
+	m_nRetransmissions = 0;
+
+	m_SpinLock.Release ();
+}
+
 void CRetransmissionTimeoutCalculator::RetransmissionTimerExpired (void)
 {
 	m_SpinLock.Acquire ();
@@ -153,6 +181,12 @@ void CRetransmissionTimeoutCalculator::RetransmissionTimerExpired (void)
 
 void CRetransmissionTimeoutCalculator::Calculate (unsigned nRTT)
 {
+	CNetStatistics *pStatistics = CNetStatistics::Get ();
+	if (pStatistics != 0)
+	{
+		pStatistics->AddRTTSample (nRTT * 1000 / HZ);
+	}
+
 	if (m_bFirstMeasurement)
 	{
 		m_bFirstMeasurement = FALSE;
@@ -0,0 +1,293 @@
+//
+// routingtable.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/routingtable.h>
+#include <circle/multicore.h>
+#include <circle/synchronize.h>
+#include <circle/rcu.h>
+#include <circle/util.h>
+#include <assert.h>
+
+CRoutingTable::CRoutingTable (void)
+:	m_pTable (new TTable),
+	m_SpinLock (TASK_LEVEL)
+{
+	assert (m_pTable != 0);
+	m_pTable->nRoutes = 0;
+	m_pTable->nGeneration = 1;
+
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		for (unsigned i = 0; i < ROUTING_CACHE_SIZE; i++)
+		{
+			m_Cache[nCore][i].nGeneration = 0;
+		}
+	}
+}
+
+CRoutingTable::~CRoutingTable (void)
+{
+	delete m_pTable;
+	m_pTable = 0;
+}
+
+void CRoutingTable::Flush (void)
+{
+	TTable *pTable = BeginUpdate ();
+
+	pTable->nRoutes = 0;
+
+	EndUpdate (pTable);
+}
+
+boolean CRoutingTable::AddRoute (const u8 *pDestIP, unsigned nPrefixLength, const u8 *pGatewayIP,
+				 unsigned nMetric, unsigned nInterface)
+{
+	assert (pDestIP != 0);
+	assert (pGatewayIP != 0);
+	assert (nPrefixLength <= 32);
+
+	u32 nMask = GetMask (nPrefixLength);
+	u32 nDestIP = GetAddress (pDestIP) & nMask;
+
+	TTable *pTable = BeginUpdate ();
+
+	Remove (pTable, nDestIP, nPrefixLength, nInterface);
+
+	if (pTable->nRoutes >= ROUTING_TABLE_MAX_ROUTES)
+	{
+		EndUpdate (pTable);
+
+		return FALSE;
+	}
+
+	// find the insert position, longer prefixes and lower metrics first
+	unsigned nIndex;
+	for (nIndex = 0; nIndex < pTable->nRoutes; nIndex++)
+	{
+		const TRoute *pRoute = &pTable->Route[nIndex];
+
+		if (   pRoute->nPrefixLength < nPrefixLength
+		    || (   pRoute->nPrefixLength == nPrefixLength
+			&& pRoute->nMetric > nMetric))
+		{
+			break;
+		}
+	}
+
+	memmove (&pTable->Route[nIndex+1], &pTable->Route[nIndex],
+		 (pTable->nRoutes - nIndex) * sizeof (TRoute));
+	pTable->nRoutes++;
+
+	TRoute *pRoute = &pTable->Route[nIndex];
+	for (unsigned i = 0; i < IP_ADDRESS_SIZE; i++)
+	{
+		pRoute->DestIP[i] = (u8) (nDestIP >> (24 - 8*i));
+	}
+	pRoute->nPrefixLength = nPrefixLength;
+	memcpy (pRoute->GatewayIP, pGatewayIP, IP_ADDRESS_SIZE);
+	pRoute->nMetric = nMetric;
+	pRoute->nInterface = nInterface;
+
+	EndUpdate (pTable);
+
+	return TRUE;
+}
+
+boolean CRoutingTable::RemoveRoute (const u8 *pDestIP, unsigned nPrefixLength, unsigned nInterface)
+{
+	assert (pDestIP != 0);
+	assert (nPrefixLength <= 32);
+
+	u32 nDestIP = GetAddress (pDestIP) & GetMask (nPrefixLength);
+
+	TTable *pTable = BeginUpdate ();
+
+	boolean bResult = Remove (pTable, nDestIP, nPrefixLength, nInterface);
+
+	EndUpdate (pTable);
+
+	return bResult;
+}
+
+boolean CRoutingTable::Lookup (const u8 *pDestIP, TRoute *pRoute)
+{
+	assert (pDestIP != 0);
+	assert (pRoute != 0);
+	u32 nDestIP = GetAddress (pDestIP);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+#else
+	unsigned nCore = 0;
+#endif
+	TCacheEntry *pEntry =
+		&m_Cache[nCore][(nDestIP * 2654435761U) >> 16 & (ROUTING_CACHE_SIZE-1)];
+
+	CRCU::ReadLock ();
+
+	const TTable *pTable = CRCU::Dereference (&m_pTable);
+	assert (pTable != 0);
+
+	// the cache entry may be updated from IRQ context on this core too
+	EnterCritical (IRQ_LEVEL);
+
+	int nRoute = -2;
+	if (   pEntry->nGeneration == pTable->nGeneration
+	    && pEntry->nDestIP == nDestIP)
+	{
+		nRoute = pEntry->nRoute;
+	}
+
+	LeaveCritical ();
+
+	if (nRoute == -2)
+	{
+		nRoute = -1;
+		for (unsigned nIndex = 0; nIndex < pTable->nRoutes; nIndex++)
+		{
+			const TRoute *pTableRoute = &pTable->Route[nIndex];
+
+			if (  (nDestIP & GetMask (pTableRoute->nPrefixLength))
+			    == GetAddress (pTableRoute->DestIP))
+			{
+				nRoute = (int) nIndex;
+
+				break;
+			}
+		}
+
+		EnterCritical (IRQ_LEVEL);
+
+		pEntry->nDestIP = nDestIP;
+		pEntry->nGeneration = pTable->nGeneration;
+		pEntry->nRoute = nRoute;
+
+		LeaveCritical ();
+	}
+
+	if (nRoute >= 0)
+	{
+		*pRoute = pTable->Route[nRoute];
+	}
+
+	CRCU::ReadUnlock ();
+
+	return nRoute >= 0;
+}
+
+unsigned CRoutingTable::GetCount (void) const
+{
+	CRCU::ReadLock ();
+
+	unsigned nRoutes = CRCU::Dereference (&m_pTable)->nRoutes;
+
+	CRCU::ReadUnlock ();
+
+	return nRoutes;
+}
+
+boolean CRoutingTable::GetRoute (unsigned nIndex, TRoute *pRoute) const
+{
+	assert (pRoute != 0);
+
+	CRCU::ReadLock ();
+
+	const TTable *pTable = CRCU::Dereference (&m_pTable);
+	assert (pTable != 0);
+
+	boolean bResult = FALSE;
+	if (nIndex < pTable->nRoutes)
+	{
+		*pRoute = pTable->Route[nIndex];
+
+		bResult = TRUE;
+	}
+
+	CRCU::ReadUnlock ();
+
+	return bResult;
+}
+
+CRoutingTable::TTable *CRoutingTable::BeginUpdate (void)
+{
+	m_SpinLock.Acquire ();
+
+	TTable *pTable = new TTable;
+	assert (pTable != 0);
+
+	assert (m_pTable != 0);
+	*pTable = *m_pTable;
+
+	return pTable;
+}
+
+void CRoutingTable::EndUpdate (TTable *pTable)
+{
+	assert (pTable != 0);
+	pTable->nGeneration++;
+
+	TTable *pOldTable = m_pTable;
+	CRCU::Assign (&m_pTable, pTable);
+
+	m_SpinLock.Release ();
+
+	CRCU::Synchronize ();
+
+	delete pOldTable;
+}
+
+boolean CRoutingTable::Remove (TTable *pTable, u32 nDestIP, unsigned nPrefixLength,
+			       unsigned nInterface)
+{
+	assert (pTable != 0);
+
+	for (unsigned nIndex = 0; nIndex < pTable->nRoutes; nIndex++)
+	{
+		const TRoute *pRoute = &pTable->Route[nIndex];
+
+		if (   pRoute->nPrefixLength == nPrefixLength
+		    && pRoute->nInterface == nInterface
+		    && GetAddress (pRoute->DestIP) == nDestIP)
+		{
+			pTable->nRoutes--;
+			memmove (&pTable->Route[nIndex], &pTable->Route[nIndex+1],
+				 (pTable->nRoutes - nIndex) * sizeof (TRoute));
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+u32 CRoutingTable::GetAddress (const u8 *pIPAddress)
+{
+	assert (pIPAddress != 0);
+
+	return   (u32) pIPAddress[0] << 24 | (u32) pIPAddress[1] << 16
+	       | (u32) pIPAddress[2] << 8  | pIPAddress[3];
+}
+
+u32 CRoutingTable::GetMask (unsigned nPrefixLength)
+{
+	assert (nPrefixLength <= 32);
+
+	return nPrefixLength == 0 ? 0 : 0xFFFFFFFFU << (32 - nPrefixLength);
+}
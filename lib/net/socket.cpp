@@ -2,7 +2,7 @@
 // socket.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -65,6 +65,11 @@ CSocket::~CSocket (void)
 		{
 			m_pTransportLayer->Disconnect (m_hListenConnection[i]);
 		}
+
+		if (m_nBackLog > 0)
+		{
+			m_pTransportLayer->UnregisterListenPort (m_nOwnPort);
+		}
 	}
 
 	m_pTransportLayer = 0;
@@ -154,11 +159,15 @@ int CSocket::Listen (unsigned nBackLog)
 		return -1;
 	}
 
+	assert (m_pTransportLayer != 0);
+	if (!m_pTransportLayer->RegisterListenPort (m_nOwnPort))
+	{
+		return -1;
+	}
+
 	assert (m_nBackLog == 0);
 	m_nBackLog = nBackLog;
 
-	assert (m_pTransportLayer != 0);
-
 	for (unsigned i = 0; i < m_nBackLog; i++)
 	{
 		m_hListenConnection[i] = m_pTransportLayer->Listen (m_nOwnPort, m_nProtocol);
@@ -239,6 +248,43 @@ int CSocket::Send (const void *pBuffer, unsigned nLength, int nFlags)
 	return m_pTransportLayer->Send (pBuffer, nLength, nFlags, m_hConnection);
 }
 
+int CSocket::SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	if (nCount == 0)
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	assert (pIOVector != 0);
+	return m_pTransportLayer->SendV (pIOVector, nCount, nFlags, m_hConnection);
+}
+
+int CSocket::SendZeroCopy (const void *pBuffer, unsigned nLength, int nFlags,
+			   TNetSendCompletionHandler *pHandler, void *pParam)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	if (nLength == 0)
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	assert (pBuffer != 0);
+	assert (pHandler != 0);
+	return m_pTransportLayer->SendZeroCopy (pBuffer, nLength, nFlags, pHandler, pParam,
+						m_hConnection);
+}
+
 int CSocket::Receive (void *pBuffer, unsigned nLength, int nFlags)
 {
 	if (m_hConnection < 0)
@@ -332,6 +378,122 @@ int CSocket::ReceiveFrom (void *pBuffer, unsigned nLength, int nFlags,
 	return nResult;
 }
 
+int CSocket::SendBatch (const TNetMessage *pMessages, unsigned nCount, int nFlags)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	if (   m_nProtocol != IPPROTO_UDP
+	    || nCount == 0)
+	{
+		return -1;
+	}
+
+	assert (m_pNetConfig != 0);
+	if (m_pNetConfig->GetIPAddress ()->IsNull ())		// from null source address
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	assert (pMessages != 0);
+
+	unsigned nSent;
+	for (nSent = 0; nSent < nCount; nSent++)
+	{
+		const TNetMessage *pMessage = &pMessages[nSent];
+		if (pMessage->nLength == 0)
+		{
+			break;
+		}
+
+		assert (pMessage->pBuffer != 0);
+		int nResult = m_pTransportLayer->SendTo (pMessage->pBuffer, pMessage->nLength, nFlags,
+							 (CIPAddress &) pMessage->ForeignIP,
+							 pMessage->nForeignPort, m_hConnection);
+		if (nResult < 0)
+		{
+			if (nSent == 0)
+			{
+				return nResult;
+			}
+
+			break;
+		}
+	}
+
+	return nSent;
+}
+
+int CSocket::ReceiveBatch (TNetMessage *pMessages, unsigned nCount, int nFlags)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	if (   m_nProtocol != IPPROTO_UDP
+	    || nCount == 0)
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	assert (pMessages != 0);
+
+	unsigned nReceived;
+	for (nReceived = 0; nReceived < nCount; nReceived++)
+	{
+		TNetMessage *pMessage = &pMessages[nReceived];
+		assert (pMessage->pBuffer != 0);
+		assert (pMessage->nLength > 0);
+
+		// wait for the first message only, take the others, which are already queued
+		int nMsgFlags = nReceived == 0 ? nFlags : MSG_DONTWAIT;
+
+		int nResult;
+		if (pMessage->nLength >= FRAME_BUFFER_SIZE)
+		{
+			nResult = m_pTransportLayer->ReceiveFrom (pMessage->pBuffer, nMsgFlags,
+								  &pMessage->ForeignIP,
+								  &pMessage->nForeignPort, m_hConnection);
+		}
+		else
+		{
+			u8 TempBuffer[FRAME_BUFFER_SIZE];
+			nResult = m_pTransportLayer->ReceiveFrom (TempBuffer, nMsgFlags,
+								  &pMessage->ForeignIP,
+								  &pMessage->nForeignPort, m_hConnection);
+			if (nResult > 0)
+			{
+				if (pMessage->nLength < (unsigned) nResult)
+				{
+					nResult = pMessage->nLength;
+				}
+
+				memcpy (pMessage->pBuffer, TempBuffer, nResult);
+			}
+		}
+
+		if (nResult <= 0)
+		{
+			if (   nResult < 0
+			    && nReceived == 0)
+			{
+				return nResult;
+			}
+
+			break;
+		}
+
+		pMessage->nLength = nResult;
+	}
+
+	return nReceived;
+}
+
 int CSocket::SetOptionBroadcast (boolean bAllowed)
 {
 	if (m_hConnection < 0)
@@ -348,6 +510,62 @@ int CSocket::SetOptionBroadcast (boolean bAllowed)
 	return m_pTransportLayer->SetOptionBroadcast (bAllowed, m_hConnection);
 }
 
+int CSocket::SetOptionCork (boolean bCork)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	if (m_nProtocol != IPPROTO_TCP)
+	{
+		return 0;
+	}
+
+	assert (m_pTransportLayer != 0);
+	return m_pTransportLayer->SetOptionCork (bCork, m_hConnection);
+}
+
+int CSocket::SetOptionRxQueueDepth (unsigned nDepth)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	if (m_nProtocol != IPPROTO_UDP)
+	{
+		return 0;
+	}
+
+	assert (m_pTransportLayer != 0);
+	return m_pTransportLayer->SetOptionRxQueueDepth (nDepth, m_hConnection);
+}
+
+int CSocket::SetOptionAddMembership (const CIPAddress &rGroupIP)
+{
+	if (   m_hConnection < 0
+	    || m_nProtocol != IPPROTO_UDP)
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	return m_pTransportLayer->SetOptionMembership (rGroupIP, TRUE, m_hConnection);
+}
+
+int CSocket::SetOptionDropMembership (const CIPAddress &rGroupIP)
+{
+	if (   m_hConnection < 0
+	    || m_nProtocol != IPPROTO_UDP)
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	return m_pTransportLayer->SetOptionMembership (rGroupIP, FALSE, m_hConnection);
+}
+
 const u8 *CSocket::GetForeignIP (void) const
 {
 	if (m_hConnection < 0)
@@ -358,3 +576,58 @@ const u8 *CSocket::GetForeignIP (void) const
 	assert (m_pTransportLayer != 0);
 	return m_pTransportLayer->GetForeignIP (m_hConnection);
 }
+
+unsigned CSocket::GetRetransmissions (void) const
+{
+	if (m_hConnection < 0)
+	{
+		return 0;
+	}
+
+	assert (m_pTransportLayer != 0);
+	return m_pTransportLayer->GetRetransmissions (m_hConnection);
+}
+
+unsigned CSocket::GetPollStatus (void) const
+{
+	assert (m_pTransportLayer != 0);
+
+	if (m_nBackLog > 0)
+	{
+		// Accept() does not block, if one of the listening connections is connected or failed
+		for (unsigned i = 0; i < m_nBackLog; i++)
+		{
+			if (   m_pTransportLayer->IsConnected (m_hListenConnection[i])
+			    || (m_pTransportLayer->GetPollStatus (m_hListenConnection[i]) & NET_POLL_ERROR))
+			{
+				return NET_POLL_READ;
+			}
+		}
+
+		return 0;
+	}
+
+	if (m_hConnection < 0)
+	{
+		return NET_POLL_ERROR;
+	}
+
+	return m_pTransportLayer->GetPollStatus (m_hConnection);
+}
+
+void CSocket::SetPollEvent (CSynchronizationEvent *pEvent)
+{
+	assert (m_pTransportLayer != 0);
+
+	if (m_nBackLog > 0)
+	{
+		for (unsigned i = 0; i < m_nBackLog; i++)
+		{
+			m_pTransportLayer->SetPollEvent (pEvent, m_hListenConnection[i]);
+		}
+	}
+	else if (m_hConnection >= 0)
+	{
+		m_pTransportLayer->SetPollEvent (pEvent, m_hConnection);
+	}
+}
@@ -0,0 +1,174 @@
+//
+// socketset.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/socketset.h>
+#include <circle/timer.h>
+#include <assert.h>
+
+CSocketSet::CSocketSet (void)
+:	m_nCount (0)
+{
+}
+
+CSocketSet::~CSocketSet (void)
+{
+	m_nCount = 0;
+}
+
+boolean CSocketSet::Add (CSocket *pSocket, unsigned nEvents)
+{
+	assert (pSocket != 0);
+
+	int nIndex = Find (pSocket);
+	if (nIndex < 0)
+	{
+		if (m_nCount >= SOCKET_SET_MAX_SOCKETS)
+		{
+			return FALSE;
+		}
+
+		nIndex = m_nCount++;
+		m_Entry[nIndex].pSocket = pSocket;
+	}
+
+	m_Entry[nIndex].nEvents = nEvents & (SOCKET_POLL_READ | SOCKET_POLL_WRITE);
+	m_Entry[nIndex].nReadyEvents = 0;
+
+	return TRUE;
+}
+
+void CSocketSet::Remove (CSocket *pSocket)
+{
+	int nIndex = Find (pSocket);
+	if (nIndex < 0)
+	{
+		return;
+	}
+
+	assert (m_nCount > 0);
+	m_Entry[nIndex] = m_Entry[--m_nCount];
+}
+
+unsigned CSocketSet::GetCount (void) const
+{
+	return m_nCount;
+}
+
+CSocket *CSocketSet::GetSocket (unsigned nIndex) const
+{
+	assert (nIndex < m_nCount);
+	return m_Entry[nIndex].pSocket;
+}
+
+int CSocketSet::Poll (unsigned nTimeoutMicros)
+{
+	// register before checking, so that no notification can get lost
+	for (unsigned i = 0; i < m_nCount; i++)
+	{
+		m_Entry[i].pSocket->SetPollEvent (&m_Event);
+	}
+
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	int nResult;
+	while (1)
+	{
+		m_Event.Clear ();
+
+		nResult = CheckSockets ();
+		if (nResult > 0)
+		{
+			break;
+		}
+
+		if (nTimeoutMicros == SOCKET_POLL_INFINITE)
+		{
+			m_Event.Wait ();
+
+			continue;
+		}
+
+		unsigned nElapsed = CTimer::GetClockTicks () - nStartTicks;
+		if (nElapsed >= nTimeoutMicros)
+		{
+			break;
+		}
+
+		m_Event.WaitWithTimeout (nTimeoutMicros - nElapsed);
+	}
+
+	for (unsigned i = 0; i < m_nCount; i++)
+	{
+		m_Entry[i].pSocket->SetPollEvent (0);
+	}
+
+	return nResult;
+}
+
+unsigned CSocketSet::GetReadyEvents (unsigned nIndex) const
+{
+	assert (nIndex < m_nCount);
+	return m_Entry[nIndex].nReadyEvents;
+}
+
+unsigned CSocketSet::GetReadyEvents (CSocket *pSocket) const
+{
+	int nIndex = Find (pSocket);
+	if (nIndex < 0)
+	{
+		return 0;
+	}
+
+	return m_Entry[nIndex].nReadyEvents;
+}
+
+int CSocketSet::CheckSockets (void)
+{
+	int nResult = 0;
+
+	for (unsigned i = 0; i < m_nCount; i++)
+	{
+		TEntry *pEntry = &m_Entry[i];
+		assert (pEntry->pSocket != 0);
+
+		pEntry->nReadyEvents =   pEntry->pSocket->GetPollStatus ()
+				       & (pEntry->nEvents | SOCKET_POLL_ERROR);
+		if (pEntry->nReadyEvents != 0)
+		{
+			nResult++;
+		}
+	}
+
+	return nResult;
+}
+
+int CSocketSet::Find (CSocket *pSocket) const
+{
+	assert (pSocket != 0);
+
+	for (unsigned i = 0; i < m_nCount; i++)
+	{
+		if (m_Entry[i].pSocket == pSocket)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
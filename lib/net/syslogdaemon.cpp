@@ -4,7 +4,7 @@
 // Syslog sender task according to RFC5424 and RFC5426 (UDP transport only)
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -59,16 +59,25 @@ static const unsigned SysLogSeverity[] =
 CSysLogDaemon *CSysLogDaemon::s_pThis = 0;
 
 CSysLogDaemon::CSysLogDaemon (CNetSubSystem *pNetSubSystem,
-			      const CIPAddress &ServerIP, u16 usServerPort)
+			      const CIPAddress &ServerIP, u16 usServerPort, int nProtocol)
 :	m_pNetSubSystem (pNetSubSystem),
 	m_ServerIP (ServerIP),
 	m_usServerPort (usServerPort),
+	m_nProtocol (nProtocol),
 	m_pTimer (CTimer::Get ()),
-	m_pSocket (0)
+	m_pSocket (0),
+	m_nConnectTicks (0),
+	m_nBatchLength (0),
+	m_nBatchMessages (0),
+	m_nTokens (SYSLOG_MAX_BURST),
+	m_nTokenTicks (0),
+	m_nDropped (0)
 {
 	assert (s_pThis == 0);
 	s_pThis = this;
 
+	assert (m_nProtocol == IPPROTO_UDP || m_nProtocol == IPPROTO_TCP);
+
 	SetName (FromSysLogDaemon);
 }
 
@@ -90,23 +99,13 @@ void CSysLogDaemon::Run (void)
 	assert (m_pNetSubSystem != 0);
 	m_pNetSubSystem->GetConfig ()->GetIPAddress ()->Format (&m_Hostname);
 
-	assert (m_pSocket == 0);
-	m_pSocket = new CSocket (m_pNetSubSystem, IPPROTO_UDP);
-	assert (m_pSocket != 0);
-
-	if (m_pSocket->Bind (SYSLOG_PORT) < 0)
+	if (   !Connect ()
+	    && m_nProtocol == IPPROTO_UDP)
 	{
-		pLogger->Write (FromSysLogDaemon, LogError, "Cannot bind to port %u", SYSLOG_PORT);
-
 		return;
 	}
 
-	if (m_pSocket->Connect (m_ServerIP, m_usServerPort) < 0)
-	{
-		pLogger->Write (FromSysLogDaemon, LogError, "Cannot connect to server");
-
-		return;
-	}
+	m_nTokenTicks = m_pTimer->GetTicks ();
 
 	pLogger->RegisterEventNotificationHandler (EventNotificationHandler);
 	pLogger->RegisterPanicHandler (PanicHandler);
@@ -124,19 +123,67 @@ void CSysLogDaemon::Run (void)
 		while (pLogger->ReadEvent (&Severity, Source, Message,
 					   &Time, &nHundredthTime, &nTimeZone))
 		{
-			if (!SendMessage (Severity, Time, nHundredthTime, nTimeZone, Source, Message))
+			if (!RateLimitPassed ())
+			{
+				m_nDropped++;
+
+				continue;
+			}
+
+			m_nDropped += pLogger->GetDroppedEvents ();
+			if (m_nDropped > 0)
 			{
-				CScheduler::Get ()->Sleep (20);
+				QueueDropReport ();
 			}
+
+			QueueMessage (Severity, Time, nHundredthTime, nTimeZone, Source, Message);
 		}
 
+		Flush ();
+
 		m_Event.Wait ();
 	}
 }
 
-boolean CSysLogDaemon::SendMessage (TLogSeverity Severity,
-				    time_t FullTime, unsigned nPartialTime, int nTimeNumOffset,
-				    const char *pAppName, const char *pMsg)
+boolean CSysLogDaemon::Connect (void)
+{
+	CLogger *pLogger = CLogger::Get ();
+
+	delete m_pSocket;
+
+	m_nConnectTicks = m_pTimer->GetTicks ();
+
+	assert (m_pNetSubSystem != 0);
+	m_pSocket = new CSocket (m_pNetSubSystem, m_nProtocol);
+	assert (m_pSocket != 0);
+
+	if (   m_nProtocol == IPPROTO_UDP
+	    && m_pSocket->Bind (SYSLOG_PORT) < 0)
+	{
+		pLogger->Write (FromSysLogDaemon, LogError, "Cannot bind to port %u", SYSLOG_PORT);
+
+		delete m_pSocket;
+		m_pSocket = 0;
+
+		return FALSE;
+	}
+
+	if (m_pSocket->Connect (m_ServerIP, m_usServerPort) < 0)
+	{
+		pLogger->Write (FromSysLogDaemon, LogError, "Cannot connect to server");
+
+		delete m_pSocket;
+		m_pSocket = 0;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CSysLogDaemon::QueueMessage (TLogSeverity Severity,
+				  time_t FullTime, unsigned nPartialTime, int nTimeNumOffset,
+				  const char *pAppName, const char *pMsg)
 {
 	assert (pAppName != 0);
 	assert (pMsg != 0);
@@ -164,13 +211,134 @@ boolean CSysLogDaemon::SendMessage (TLogSeverity Severity,
 			  CalculatePriority (pAppName, Severity), SYSLOG_VERSION,
 			  (const char *) Timestamp, (const char *) m_Hostname, pAppName, pMsg);
 
-	assert (m_pSocket != 0);
-	if (   m_pSocket->Send ((const char *) SysLogMsg, SysLogMsg.GetLength (), MSG_DONTWAIT)
-	    != (int) SysLogMsg.GetLength ())
+	// RFC 6587 section 3.4.1: MSG-LEN SP SYSLOG-MSG
+	CString Frame;
+	if (m_nProtocol == IPPROTO_TCP)
+	{
+		Frame.Format ("%u ", SysLogMsg.GetLength ());
+	}
+	Frame.Append (SysLogMsg);
+
+	unsigned nLength = Frame.GetLength ();
+	assert (nLength <= SYSLOG_BATCH_SIZE);
+
+	if (   m_nBatchLength + nLength > SYSLOG_BATCH_SIZE
+	    || m_nBatchMessages == SYSLOG_BATCH_MESSAGES)
+	{
+		Flush ();
+	}
+
+	if (m_nProtocol == IPPROTO_UDP)
+	{
+		m_Message[m_nBatchMessages].pBuffer = m_Batch + m_nBatchLength;
+		m_Message[m_nBatchMessages].nLength = nLength;
+	}
+
+	memcpy (m_Batch + m_nBatchLength, (const char *) Frame, nLength);
+	m_nBatchLength += nLength;
+	m_nBatchMessages++;
+}
+
+void CSysLogDaemon::QueueDropReport (void)
+{
+	assert (m_nDropped > 0);
+
+	CString Message;
+	Message.Format ("%u log message(s) dropped", m_nDropped);
+	m_nDropped = 0;
+
+	unsigned nSeconds, nMicroSeconds;
+	if (!m_pTimer->GetLocalTime (&nSeconds, &nMicroSeconds))
+	{
+		nSeconds = 0;
+		nMicroSeconds = 0;
+	}
+
+	QueueMessage (LogWarning, nSeconds, nMicroSeconds / 10000, m_pTimer->GetTimeZone (),
+		      FromSysLogDaemon, Message);
+}
+
+void CSysLogDaemon::Flush (void)
+{
+	if (m_nBatchMessages == 0)
+	{
+		return;
+	}
+
+	unsigned nSent = 0;
+
+	if (m_nProtocol == IPPROTO_UDP)
+	{
+		assert (m_pSocket != 0);
+		int nResult = m_pSocket->SendBatch (m_Message, m_nBatchMessages, MSG_DONTWAIT);
+		if (nResult > 0)
+		{
+			nSent = nResult;
+		}
+	}
+	else
+	{
+		if (   m_pSocket == 0
+		    && m_pTimer->GetTicks () - m_nConnectTicks >= SYSLOG_RECONNECT_HZ)
+		{
+			Connect ();
+		}
+
+		if (m_pSocket != 0)
+		{
+			if (m_pSocket->Send (m_Batch, m_nBatchLength, 0) == (int) m_nBatchLength)
+			{
+				nSent = m_nBatchMessages;
+			}
+			else
+			{
+				// connection is lost, try again later
+				delete m_pSocket;
+				m_pSocket = 0;
+			}
+		}
+	}
+
+	m_nDropped += m_nBatchMessages - nSent;
+
+	m_nBatchLength = 0;
+	m_nBatchMessages = 0;
+}
+
+boolean CSysLogDaemon::RateLimitPassed (void)
+{
+#if SYSLOG_MAX_RATE > 0
+	// token bucket
+	unsigned nTicks = m_pTimer->GetTicks ();
+	unsigned nElapsed = nTicks - m_nTokenTicks;
+	if (nElapsed >= SYSLOG_MAX_BURST * HZ / SYSLOG_MAX_RATE)
+	{
+		m_nTokens = SYSLOG_MAX_BURST;
+		m_nTokenTicks = nTicks;
+	}
+	else
+	{
+		unsigned nNewTokens = nElapsed * SYSLOG_MAX_RATE / HZ;
+		if (nNewTokens > 0)
+		{
+			m_nTokenTicks += nNewTokens * HZ / SYSLOG_MAX_RATE;
+
+			m_nTokens += nNewTokens;
+			if (m_nTokens > SYSLOG_MAX_BURST)
+			{
+				m_nTokens = SYSLOG_MAX_BURST;
+			}
+		}
+	}
+
+	if (m_nTokens == 0)
 	{
 		return FALSE;
 	}
 
+	m_nTokens--;
+#endif
+
 	return TRUE;
 }
 
@@ -0,0 +1,133 @@
+//
+// tcpcongestioncontrol.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpcongestioncontrol.h>
+#include <circle/net/tcpnewreno.h>
+#include <circle/net/tcpcubic.h>
+#include <assert.h>
+
+#define min(n, m)		((n) <= (m) ? (n) : (m))
+#define max(n, m)		((n) >= (m) ? (n) : (m))
+
+#define INITIAL_SSTHRESH	0x7FFFFFFF	// arbitrarily high (RFC 5681 section 3.1)
+
+CTCPCongestionControl::CTCPCongestionControl (unsigned nMSS)
+:	m_nSSThresh (INITIAL_SSTHRESH),
+	m_bInRecovery (FALSE)
+{
+	SetMSS (nMSS);
+}
+
+CTCPCongestionControl::~CTCPCongestionControl (void)
+{
+}
+
+CTCPCongestionControl *CTCPCongestionControl::Create (TTCPCongestionControl Type, unsigned nMSS)
+{
+	switch (Type)
+	{
+	case TCPCongestionControlNewReno:
+		return new CTCPNewReno (nMSS);
+
+	case TCPCongestionControlCUBIC:
+		return new CTCPCUBIC (nMSS);
+
+	default:
+		assert (0);
+		return 0;
+	}
+}
+
+void CTCPCongestionControl::SetMSS (unsigned nMSS)
+{
+	assert (nMSS > 0);
+	m_nMSS = nMSS;
+
+	m_nCWND = min (10 * m_nMSS, max (2 * m_nMSS, 14600));	// RFC 6928 section 2
+}
+
+u32 CTCPCongestionControl::GetWindow (void) const
+{
+	return m_nCWND;
+}
+
+boolean CTCPCongestionControl::IsInRecovery (void) const
+{
+	return m_bInRecovery;
+}
+
+void CTCPCongestionControl::Acknowledged (u32 nBytesAcked, unsigned nRTT)
+{
+	assert (!m_bInRecovery);
+
+	if (m_nCWND < m_nSSThresh)
+	{
+		m_nCWND += min (nBytesAcked, m_nMSS);		// slow start (RFC 5681 section 3.1)
+	}
+	else
+	{
+		IncreaseWindow (nBytesAcked, nRTT);
+	}
+}
+
+void CTCPCongestionControl::EnterRecovery (u32 nFlightSize)
+{
+	assert (!m_bInRecovery);
+	m_bInRecovery = TRUE;
+
+	m_nSSThresh = CalculateSSThresh (nFlightSize);
+	m_nCWND = m_nSSThresh + 3 * m_nMSS;			// RFC 6582 section 3.2 (2)
+}
+
+void CTCPCongestionControl::DuplicateACK (void)
+{
+	assert (m_bInRecovery);
+
+	m_nCWND += m_nMSS;					// RFC 6582 section 3.2 (4)
+}
+
+void CTCPCongestionControl::PartialACK (u32 nBytesAcked)
+{
+	assert (m_bInRecovery);
+
+	// RFC 6582 section 3.2 (5)
+	m_nCWND -= min (nBytesAcked, m_nCWND);
+	if (nBytesAcked >= m_nMSS)
+	{
+		m_nCWND += m_nMSS;
+	}
+
+	m_nCWND = max (m_nCWND, m_nMSS);
+}
+
+void CTCPCongestionControl::ExitRecovery (u32 nFlightSize)
+{
+	assert (m_bInRecovery);
+	m_bInRecovery = FALSE;
+
+	m_nCWND = min (m_nSSThresh, max (nFlightSize, m_nMSS) + m_nMSS);	// RFC 6582 section 3.2 (6)
+}
+
+void CTCPCongestionControl::RetransmissionTimeout (u32 nFlightSize)
+{
+	m_bInRecovery = FALSE;
+
+	m_nSSThresh = CalculateSSThresh (nFlightSize);
+	m_nCWND = m_nMSS;					// loss window (RFC 5681 section 3.1)
+}
@@ -13,7 +13,7 @@
 //	user timeout
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -29,25 +29,44 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/tcpconnection.h>
+#include <circle/net/tcpsyncookie.h>
 #include <circle/macros.h>
 #include <circle/util.h>
 #include <circle/logger.h>
 #include <circle/net/in.h>
+#include <circle/net/netstatistics.h>
+#include <circle/atomic.h>
 #include <assert.h>
 
 //#define TCP_DEBUG
 
 #define TCP_MAX_CONNECTIONS		1000	// maximum number of active TCP connections
 
-#define MSS_R				1480	// maximum segment size to be received from network layer
-#define MSS_S				1480	// maximum segment size to be send to network layer
+// maximum segment size to be received from / send to network layer, depends on the MTU
+#define MSS_R				(m_pNetConfig->GetMTU () - 20)
+#define MSS_S				(m_pNetConfig->GetMTU () - 20)
 
 #define TCP_CONFIG_MSS			(MSS_R - 20)
-#define TCP_CONFIG_WINDOW		(TCP_CONFIG_MSS * 10)
 
-#define TCP_CONFIG_RETRANS_BUFFER_SIZE	0x10000	// should be greater than maximum send window size
+#ifndef TCP_CONFIG_RX_BUFFER_SIZE
+#define TCP_CONFIG_RX_BUFFER_SIZE	0x40000	// maximum receive window size
+#endif
+
+#ifndef TCP_CONFIG_RETRANS_BUFFER_SIZE
+#define TCP_CONFIG_RETRANS_BUFFER_SIZE	0x40000	// should be greater than maximum send window size
+#endif
+
+#ifndef TCP_CONFIG_CONGESTION_CONTROL
+#define TCP_CONFIG_CONGESTION_CONTROL	TCPCongestionControlNewReno	// or TCPCongestionControlCUBIC
+#endif
+
+#define TCP_DUPACK_THRESHOLD		3	// RFC 5681 section 3.2
 
 #define TCP_MAX_WINDOW			((u16) -1)	// without Window extension option
+#define TCP_MAX_WINDOW_SHIFT		14	// RFC 7323 section 2.3
+
+// open the receive window only by this amount at least (SWS avoidance, RFC 1122 4.2.3.3)
+#define TCP_WINDOW_UPDATE_MIN		min (TCP_CONFIG_RX_BUFFER_SIZE / 2, TCP_CONFIG_MSS)
 #define TCP_QUIET_TIME			30	// seconds after crash before another connection starts
 
 #define HZ_TIMEWAIT			(60 * HZ)
@@ -90,12 +109,33 @@ struct TTCPOption
 #define TCP_OPTION_MSS		2	//	Maximum segment size (2 byte)
 #define TCP_OPTION_WINDOW_SCALE	3	//	Shift count (1 byte)
 #define TCP_OPTION_SACK_PERM	4	//	None
+#define TCP_OPTION_SACK		5	//	Blocks of left edge, right edge (n*2*4 byte)
 #define TCP_OPTION_TIMESTAMP	8	//	Timestamp value, Timestamp echo reply (2*4 byte)
 	u8	nLength;
 	u8	Data[];
 }
 PACKED;
 
+#define TCP_OPTION_TIMESTAMP_SIZE	12	// including two NOPs for alignment
+
+// maximum data length of a segment, which is split by the net device (TSO)
+#define TCP_TSO_MAX_LENGTH	(IP_PAYLOAD_MAX_LENGTH - TCP_HEADER_SIZE - TCP_OPTION_TIMESTAMP_SIZE)
+#define TCP_TSO_OFFLOADS	(NET_OFFLOAD_TX_CHECKSUM | NET_OFFLOAD_TX_SEGMENTATION)
+#define TCP_MAX_SACK_BLOCKS		4	// 3 with timestamps option
+
+struct TTCPSegmentOptions		// received with a segment
+{
+	boolean	bWindowScale;
+	unsigned nWindowShift;
+	boolean	bSACKPermitted;
+	boolean	bTimestamp;
+	u32	nTSVal;
+	u32	nTSEcr;
+	unsigned nSACKBlocks;
+	u32	SACKLeftEdge[TCP_MAX_SACK_BLOCKS];
+	u32	SACKRightEdge[TCP_MAX_SACK_BLOCKS];
+};
+
 #define min(n, m)		((n) <= (m) ? (n) : (m))
 #define max(n, m)		((n) >= (m) ? (n) : (m))
 
@@ -124,6 +164,8 @@ PACKED;
 
 unsigned CTCPConnection::s_nConnections = 0;
 
+static u8 s_ZeroCopyTag;		// its address marks TTCPZeroCopyBuffer entries in m_TxQueue
+
 static const char FromTCP[] = "tcp";
 
 CTCPConnection::CTCPConnection (CNetConfig	*pNetConfig,
@@ -135,32 +177,62 @@ CTCPConnection::CTCPConnection (CNetConfig	*pNetConfig,
 	m_bActiveOpen (TRUE),
 	m_State (TCPStateClosed),
 	m_nErrno (0),
+	m_bCork (FALSE),
+	m_bMoreData (FALSE),
+	m_nRxQueued (0),
+	m_bWindowUpdate (FALSE),
 	m_RetransmissionQueue (TCP_CONFIG_RETRANS_BUFFER_SIZE),
 	m_bRetransmit (FALSE),
 	m_bSendSYN (FALSE),
 	m_bFINQueued (FALSE),
 	m_nRetransmissionCount (0),
+	m_nRetransmittedSegments (0),
 	m_bTimedOut (FALSE),
 	m_pTimer (CTimer::Get ()),
-	m_nSND_WND (TCP_CONFIG_WINDOW),
+	m_nSND_WND (TCP_CONFIG_MSS),
 	m_nSND_UP (0),
 	m_nRCV_NXT (0),
-	m_nRCV_WND (TCP_CONFIG_WINDOW),
+	m_nRCV_WND (min (TCP_CONFIG_RX_BUFFER_SIZE, TCP_MAX_WINDOW)),
 	m_nIRS (0),
-	m_nSND_MSS (536)	// RFC 1122 section 4.2.2.6
+	m_nSND_MSS (536),	// RFC 1122 section 4.2.2.6
+	m_bWindowScale (TRUE),
+	m_nSND_WSHIFT (0),
+	m_nRCV_WSHIFT (0),
+	m_bTimestamps (TRUE),
+	m_nTS_Recent (0),
+	m_nLastACKSent (0),
+	m_bSACKPermitted (TRUE),
+	m_pCongestionControl (0),
+	m_nDupACKs (0),
+	m_nRecover (0),
+	m_bFastRetransmit (FALSE)
 {
 	s_nConnections++;
 
 	for (unsigned nTimer = TCPTimerUser; nTimer < TCPTimerUnknown; nTimer++)
 	{
-		m_hTimer[nTimer] = 0;
+		m_Timer[nTimer].SetHandler (TimerStub, (void *) (uintptr) nTimer, this);
+		m_bTimerRunning[nTimer] = FALSE;
+	}
+
+	m_ZeroCopy.nLength = 0;
+
+	while (   (TCP_CONFIG_RX_BUFFER_SIZE >> m_nRCV_WSHIFT) > TCP_MAX_WINDOW
+	       && m_nRCV_WSHIFT < TCP_MAX_WINDOW_SHIFT)
+	{
+		m_nRCV_WSHIFT++;
 	}
 
+	m_pCongestionControl = CTCPCongestionControl::Create (TCP_CONFIG_CONGESTION_CONTROL, m_nSND_MSS);
+	assert (m_pCongestionControl != 0);
+
 	m_nISS = CalculateISN ();
 	m_RTOCalculator.Initialize (m_nISS);
+	m_nRecover = m_nISS;
 
 	m_nSND_UNA = m_nISS;
 	m_nSND_NXT = m_nISS+1;
+	m_nSND_MAX = m_nSND_NXT;
 
 	if (SendSegment (TCP_FLAG_SYN, m_nISS))
 	{
@@ -178,26 +250,54 @@ CTCPConnection::CTCPConnection (CNetConfig	*pNetConfig,
 	m_bActiveOpen (FALSE),
 	m_State (TCPStateListen),
 	m_nErrno (0),
+	m_bCork (FALSE),
+	m_bMoreData (FALSE),
+	m_nRxQueued (0),
+	m_bWindowUpdate (FALSE),
 	m_RetransmissionQueue (TCP_CONFIG_RETRANS_BUFFER_SIZE),
 	m_bRetransmit (FALSE),
 	m_bSendSYN (FALSE),
 	m_bFINQueued (FALSE),
 	m_nRetransmissionCount (0),
+	m_nRetransmittedSegments (0),
 	m_bTimedOut (FALSE),
 	m_pTimer (CTimer::Get ()),
-	m_nSND_WND (TCP_CONFIG_WINDOW),
+	m_nSND_WND (TCP_CONFIG_MSS),
 	m_nSND_UP (0),
 	m_nRCV_NXT (0),
-	m_nRCV_WND (TCP_CONFIG_WINDOW),
+	m_nRCV_WND (min (TCP_CONFIG_RX_BUFFER_SIZE, TCP_MAX_WINDOW)),
 	m_nIRS (0),
-	m_nSND_MSS (536)	// RFC 1122 section 4.2.2.6
+	m_nSND_MSS (536),	// RFC 1122 section 4.2.2.6
+	m_bWindowScale (FALSE),
+	m_nSND_WSHIFT (0),
+	m_nRCV_WSHIFT (0),
+	m_bTimestamps (FALSE),
+	m_nTS_Recent (0),
+	m_nLastACKSent (0),
+	m_bSACKPermitted (FALSE),
+	m_pCongestionControl (0),
+	m_nDupACKs (0),
+	m_nRecover (0),
+	m_bFastRetransmit (FALSE)
 {
 	s_nConnections++;
 
 	for (unsigned nTimer = TCPTimerUser; nTimer < TCPTimerUnknown; nTimer++)
 	{
-		m_hTimer[nTimer] = 0;
+		m_Timer[nTimer].SetHandler (TimerStub, (void *) (uintptr) nTimer, this);
+		m_bTimerRunning[nTimer] = FALSE;
+	}
+
+	m_ZeroCopy.nLength = 0;
+
+	while (   (TCP_CONFIG_RX_BUFFER_SIZE >> m_nRCV_WSHIFT) > TCP_MAX_WINDOW
+	       && m_nRCV_WSHIFT < TCP_MAX_WINDOW_SHIFT)
+	{
+		m_nRCV_WSHIFT++;
 	}
+
+	m_pCongestionControl = CTCPCongestionControl::Create (TCP_CONFIG_CONGESTION_CONTROL, m_nSND_MSS);
+	assert (m_pCongestionControl != 0);
 }
 
 CTCPConnection::~CTCPConnection (void)
@@ -213,10 +313,15 @@ CTCPConnection::~CTCPConnection (void)
 		StopTimer (nTimer);
 	}
 
+	FlushTxQueue ();
+
 	// ensure no task is waiting any more
 	m_Event.Set ();
 	m_TxEvent.Set ();
 
+	delete m_pCongestionControl;
+	m_pCongestionControl = 0;
+
 	assert (s_nConnections > 0);
 	s_nConnections--;
 }
@@ -340,6 +445,8 @@ int CTCPConnection::Close (void)
 		return -1;
 	}
 
+	Activate ();
+
 	if (m_nErrno < 0)
 	{
 		return m_nErrno;
@@ -350,56 +457,73 @@ int CTCPConnection::Close (void)
 
 int CTCPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 {
-	if (   nFlags != 0
-	    && nFlags != MSG_DONTWAIT)
-	{
-		return -1;
-	}
+	TNetIOVector IOVector;
+	IOVector.pData = pData;
+	IOVector.nLength = nLength;
 
-	if (m_nErrno < 0)
+	return SendV (&IOVector, 1, nFlags);
+}
+
+int CTCPConnection::SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags)
+{
+	int nResult = CheckSendState (nFlags);
+	if (nResult != 0)
 	{
-		return m_nErrno;
+		return nResult;
 	}
-	
-	switch (m_State)
+
+	// gather small buffers into full frames, large buffers are queued without extra copy
+	u8 Buffer[FRAME_BUFFER_SIZE];
+	unsigned nBuffered = 0;
+
+	assert (pIOVector != 0);
+	for (unsigned i = 0; i < nCount; i++)
 	{
-	case TCPStateClosed:
-	case TCPStateListen:
-	case TCPStateFinWait1:
-	case TCPStateFinWait2:
-	case TCPStateClosing:
-	case TCPStateLastAck:
-	case TCPStateTimeWait:
-		return -1;
+		const u8 *pData = (const u8 *) pIOVector[i].pData;
+		unsigned nLength = pIOVector[i].nLength;
+		assert (pData != 0 || nLength == 0);
 
-	case TCPStateSynSent:
-	case TCPStateSynReceived:
-	case TCPStateEstablished:
-	case TCPStateCloseWait:
-		break;
-	}
-	
-	unsigned nResult = nLength;
+		nResult += nLength;
 
-	assert (pData != 0);
-	u8 *pBuffer = (u8 *) pData;
+		while (nLength > 0)
+		{
+			if (   nBuffered == 0
+			    && nLength >= FRAME_BUFFER_SIZE)
+			{
+				m_TxQueue.Enqueue (pData, FRAME_BUFFER_SIZE);
 
-	while (nLength > FRAME_BUFFER_SIZE)
-	{
-		m_TxQueue.Enqueue (pBuffer, FRAME_BUFFER_SIZE);
+				pData += FRAME_BUFFER_SIZE;
+				nLength -= FRAME_BUFFER_SIZE;
+
+				continue;
+			}
+
+			unsigned nCopy = min (nLength, FRAME_BUFFER_SIZE-nBuffered);
+			memcpy (Buffer+nBuffered, pData, nCopy);
+			nBuffered += nCopy;
 
-		pBuffer += FRAME_BUFFER_SIZE;
-		nLength -= FRAME_BUFFER_SIZE;
+			pData += nCopy;
+			nLength -= nCopy;
+
+			if (nBuffered == FRAME_BUFFER_SIZE)
+			{
+				m_TxQueue.Enqueue (Buffer, nBuffered);
+				nBuffered = 0;
+			}
+		}
 	}
 
-	if (nLength > 0)
+	if (nBuffered > 0)
 	{
-		m_TxQueue.Enqueue (pBuffer, nLength);
+		m_TxQueue.Enqueue (Buffer, nBuffered);
 	}
 
+	m_bMoreData = nFlags & MSG_MORE ? TRUE : FALSE;
+
 	if (!(nFlags & MSG_DONTWAIT))
 	{
 		m_TxEvent.Clear ();
+		Activate ();
 		m_TxEvent.Wait ();
 
 		if (m_nErrno < 0)
@@ -407,10 +531,43 @@ int CTCPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 			return m_nErrno;
 		}
 	}
+	else
+	{
+		Activate ();
+	}
 	
 	return nResult;
 }
 
+int CTCPConnection::SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+				  TNetSendCompletionHandler *pHandler, void *pParam)
+{
+	int nResult = CheckSendState (nFlags & ~MSG_DONTWAIT);
+	if (nResult != 0)
+	{
+		return nResult;
+	}
+
+	TTCPZeroCopyBuffer Buffer;
+	Buffer.pBuffer = pData;
+	Buffer.nLength = nLength;
+	Buffer.nOffset = 0;
+	Buffer.pHandler = pHandler;
+	Buffer.pParam = pParam;
+
+	// the buffer is copied straight into the retransmission queue by Process()
+	assert (pData != 0);
+	assert (nLength > 0);
+	assert (pHandler != 0);
+	m_TxQueue.Enqueue (&Buffer, sizeof Buffer, &s_ZeroCopyTag);
+
+	m_bMoreData = nFlags & MSG_MORE ? TRUE : FALSE;
+
+	Activate ();
+
+	return nLength;
+}
+
 int CTCPConnection::Receive (void *pBuffer, int nFlags)
 {
 	if (   nFlags != 0
@@ -459,6 +616,17 @@ int CTCPConnection::Receive (void *pBuffer, int nFlags)
 		}
 	}
 
+	AtomicSub (&m_nRxQueued, nLength);
+
+	// let the network task send a window update, if the window can be opened enough
+	if (   !m_bWindowUpdate
+	    && GetReceiveSpace () >= m_nRCV_WND + TCP_WINDOW_UPDATE_MIN)
+	{
+		m_bWindowUpdate = TRUE;
+
+		Activate ();
+	}
+
 	return nLength;
 }
 
@@ -492,6 +660,18 @@ int CTCPConnection::SetOptionBroadcast (boolean bAllowed)
 	return 0;
 }
 
+int CTCPConnection::SetOptionCork (boolean bCork)
+{
+	m_bCork = bCork;
+
+	if (!bCork)
+	{
+		Activate ();		// send remaining data
+	}
+
+	return 0;
+}
+
 boolean CTCPConnection::IsConnected (void) const
 {
 	return     m_State > TCPStateSynSent
@@ -503,6 +683,94 @@ boolean CTCPConnection::IsTerminated (void) const
 	return m_State == TCPStateClosed;
 }
 
+boolean CTCPConnection::ReleaseTimeWait (u32 *pSND_NXT, u32 *pRCV_NXT)
+{
+	// TIME-WAIT is entered only after Close() has been called
+	if (m_State != TCPStateTimeWait)
+	{
+		return FALSE;
+	}
+
+	StopTimer (TCPTimerTimeWait);
+
+	assert (pSND_NXT != 0);
+	*pSND_NXT = m_nSND_NXT;
+	assert (pRCV_NXT != 0);
+	*pRCV_NXT = m_nRCV_NXT;
+
+	NEW_STATE (TCPStateClosed);
+
+	return TRUE;
+}
+
+unsigned CTCPConnection::GetPollStatus (void) const
+{
+	unsigned nStatus = 0;
+
+	if (m_nErrno < 0)
+	{
+		nStatus |= NET_POLL_READ | NET_POLL_ERROR;
+	}
+
+	switch (m_State)
+	{
+	case TCPStateSynSent:
+	case TCPStateSynReceived:
+		break;
+
+	case TCPStateEstablished:
+	case TCPStateCloseWait:
+		// Send() waits, until the queued data has been moved to the retransmission queue
+		if (   m_TxQueue.IsEmpty ()
+		    && m_ZeroCopy.nLength == 0)
+		{
+			nStatus |= NET_POLL_WRITE;
+		}
+		break;
+
+	case TCPStateClosed:
+		nStatus |= NET_POLL_ERROR;
+		break;
+
+	default:
+		break;
+	}
+
+	// Receive() waits for data in these states only
+	if (   !m_RxQueue.IsEmpty ()
+	    || (   m_State != TCPStateSynSent
+		&& m_State != TCPStateSynReceived
+		&& m_State != TCPStateEstablished))
+	{
+		nStatus |= NET_POLL_READ;
+	}
+
+	return nStatus;
+}
+
+unsigned CTCPConnection::GetRetransmissions (void) const
+{
+	return m_nRetransmittedSegments;
+}
+
+boolean CTCPConnection::HasWildcardForeign (void) const
+{
+	return    m_State == TCPStateListen
+	       || m_nForeignPort == 0;
+}
+
+boolean CTCPConnection::IsProcessPending (void) const
+{
+	// waiting for window or free space in the retransmission queue otherwise
+	return    m_bTimedOut
+	       || m_bSendSYN
+	       || m_bRetransmit
+	       || m_bFastRetransmit
+	       || m_bWindowUpdate
+	       || m_ZeroCopy.nLength > 0
+	       || !m_TxQueue.IsEmpty ();
+}
+
 void CTCPConnection::Process (void)
 {
 	if (m_bTimedOut)
@@ -513,6 +781,23 @@ void CTCPConnection::Process (void)
 		return;
 	}
 
+	if (m_bWindowUpdate)
+	{
+		m_bWindowUpdate = FALSE;
+
+		if (   m_State == TCPStateEstablished
+		    || m_State == TCPStateFinWait1
+		    || m_State == TCPStateFinWait2)
+		{
+			u32 nWindow = m_nRCV_WND;
+			UpdateReceiveWindow ();
+			if (m_nRCV_WND != nWindow)
+			{
+				SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
+			}
+		}
+	}
+
 	switch (m_State)
 	{
 	case TCPStateClosed:
@@ -551,6 +836,10 @@ void CTCPConnection::Process (void)
 			SendSegment (TCP_FLAG_FIN | TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
 			m_RTOCalculator.SegmentSent (m_nSND_NXT);
 			m_nSND_NXT++;
+			if (gt (m_nSND_NXT, m_nSND_MAX))
+			{
+				m_nSND_MAX = m_nSND_NXT;
+			}
 			NEW_STATE (m_StateAfterFIN);
 			m_bFINQueued = FALSE;
 			StartTimer (TCPTimerRetransmission, m_RTOCalculator.GetRTO ());
@@ -560,9 +849,46 @@ void CTCPConnection::Process (void)
 
 	u8 TempBuffer[FRAME_BUFFER_SIZE];
 	unsigned nLength;
-	while (    m_RetransmissionQueue.GetFreeSpace () >= FRAME_BUFFER_SIZE
-		&& (nLength = m_TxQueue.Dequeue (TempBuffer)) > 0)
+	unsigned nFreeSpace;
+	while (   (nFreeSpace = m_RetransmissionQueue.GetFreeSpace ()) >= FRAME_BUFFER_SIZE
+	       && m_RetransmissionQueue.Reserve (FRAME_BUFFER_SIZE))	// memory may be short
 	{
+		if (m_ZeroCopy.nLength > 0)
+		{
+			nLength = min (m_ZeroCopy.nLength-m_ZeroCopy.nOffset, nFreeSpace);
+			if (!m_RetransmissionQueue.Reserve (nLength))
+			{
+				nLength = min (nLength, FRAME_BUFFER_SIZE);
+			}
+			m_RetransmissionQueue.Write ((const u8 *) m_ZeroCopy.pBuffer+m_ZeroCopy.nOffset,
+						     nLength);
+
+			m_ZeroCopy.nOffset += nLength;
+			if (m_ZeroCopy.nOffset == m_ZeroCopy.nLength)
+			{
+				m_ZeroCopy.nLength = 0;
+
+				assert (m_ZeroCopy.pHandler != 0);
+				(*m_ZeroCopy.pHandler) (m_ZeroCopy.pBuffer, m_ZeroCopy.pParam);
+			}
+
+			continue;
+		}
+
+		void *pParam;
+		if ((nLength = m_TxQueue.Dequeue (TempBuffer, &pParam)) == 0)
+		{
+			break;
+		}
+
+		if (pParam == &s_ZeroCopyTag)
+		{
+			assert (nLength == sizeof m_ZeroCopy);
+			memcpy (&m_ZeroCopy, TempBuffer, sizeof m_ZeroCopy);
+
+			continue;
+		}
+
 #ifdef TCP_DEBUG
 		CLogger::Get ()->Write (FromTCP, LogDebug, "Transfering %u bytes into RT buffer", nLength);
 #endif
@@ -573,7 +899,8 @@ void CTCPConnection::Process (void)
 	// pacing transmit
 	if (   (   m_State == TCPStateEstablished
 		|| m_State == TCPStateCloseWait)
-	    && m_TxQueue.IsEmpty ())
+	    && m_TxQueue.IsEmpty ()
+	    && m_ZeroCopy.nLength == 0)
 	{
 		m_TxEvent.Set ();
 	}
@@ -584,34 +911,123 @@ void CTCPConnection::Process (void)
 		CLogger::Get ()->Write (FromTCP, LogDebug, "Retransmission (nxt %u, una %u)", m_nSND_NXT-m_nISS, m_nSND_UNA-m_nISS);
 #endif
 		m_bRetransmit = FALSE;
+
+		assert (m_pCongestionControl != 0);
+		m_pCongestionControl->RetransmissionTimeout (GetFlightSize ());
+		m_nDupACKs = 0;
+		m_nRecover = m_nSND_MAX;
+		m_bFastRetransmit = FALSE;
+
 		m_RetransmissionQueue.Reset ();
 		m_nSND_NXT = m_nSND_UNA;
+
+		// the receiver may have reneged, if the retransmission did not help (RFC 2018 section 8)
+		if (m_nRetransmissionCount < MAX_RETRANSMISSIONS-1)
+		{
+			m_SACKScoreboard.Reset ();
+		}
+	}
+
+	unsigned nMSS = GetSendMSS ();
+
+	// with TSO several segments are handed over to the net device at once
+	unsigned nMaxLength = nMSS;
+	assert (m_pNetworkLayer != 0);
+	if (   (m_pNetworkLayer->GetOffloadCapabilities () & TCP_TSO_OFFLOADS) == TCP_TSO_OFFLOADS
+	    && TCP_TSO_MAX_LENGTH >= 2*nMSS)
+	{
+		nMaxLength = TCP_TSO_MAX_LENGTH / nMSS * nMSS;
+	}
+
+	// RFC 5681 section 3.2
+	if (m_bFastRetransmit)
+	{
+		m_bFastRetransmit = FALSE;
+
+		nLength = min (m_nSND_NXT-m_nSND_UNA, nMSS);
+		if (   nLength > 0
+		    && (   m_State == TCPStateEstablished
+			|| m_State == TCPStateCloseWait))
+		{
+#ifdef TCP_DEBUG
+			CLogger::Get ()->Write (FromTCP, LogDebug, "Fast retransmit (una %u, len %u)", m_nSND_UNA-m_nISS, nLength);
+#endif
+
+			assert (nLength <= FRAME_BUFFER_SIZE);
+			m_RetransmissionQueue.Peek (TempBuffer, nLength);
+
+			SendSegment (TCP_FLAG_ACK, m_nSND_UNA, m_nRCV_NXT, TempBuffer, nLength);
+			StartTimer (TCPTimerRetransmission, m_RTOCalculator.GetRTO ());
+
+			m_nRetransmittedSegments++;
+			NET_STAT_INC (NetCounterTCPRetransmissions);
+		}
 	}
 
+	// the usable window is limited by the congestion window too
+	assert (m_pCongestionControl != 0);
+	u32 nWindow = min (m_nSND_WND, m_pCongestionControl->GetWindow ());
+
 	u32 nBytesAvail;
-	u32 nWindowLeft;
 	while (   (nBytesAvail = m_RetransmissionQueue.GetBytesAvailable ()) > 0
-	       && (nWindowLeft = m_nSND_UNA+m_nSND_WND-m_nSND_NXT) > 0)
+	       && lt (m_nSND_NXT, m_nSND_UNA+nWindow))
 	{
+		// do not retransmit data, which has been selectively acknowledged
+		u32 nEdge;
+		if (m_SACKScoreboard.IsAcknowledged (m_nSND_NXT, &nEdge))
+		{
+			nLength = min (nEdge-m_nSND_NXT, nBytesAvail);
+			m_RetransmissionQueue.Skip (nLength);
+			m_nSND_NXT += nLength;
+
+			continue;
+		}
+
+		u32 nWindowLeft = m_nSND_UNA+nWindow-m_nSND_NXT;
 		nLength = min (nBytesAvail, nWindowLeft);
-		nLength = min (nLength, m_nSND_MSS);
+		nLength = min (nLength, nMaxLength);
+
+		if (m_SACKScoreboard.GetNextBlock (m_nSND_NXT, &nEdge))
+		{
+			nLength = min (nLength, nEdge-m_nSND_NXT);
+		}
 
 #ifdef TCP_DEBUG
 		CLogger::Get ()->Write (FromTCP, LogDebug, "Transfering %u bytes into TX buffer", nLength);
 #endif
 
+		// hold back a small segment at the end of new data, if more data is announced
+		if (   nLength == nBytesAvail
+		    && nLength < nMSS
+		    && (m_bCork || m_bMoreData)
+		    && !m_bFINQueued
+		    && !lt (m_nSND_NXT, m_nSND_MAX))
+		{
+			break;
+		}
+
 		assert (nLength <= FRAME_BUFFER_SIZE);
 		m_RetransmissionQueue.Read (TempBuffer, nLength);
 
 		unsigned nFlags = TCP_FLAG_ACK;
-		if (m_TxQueue.IsEmpty ())
+		if (   m_TxQueue.IsEmpty ()
+		    && m_ZeroCopy.nLength == 0)
 		{
 			nFlags |= TCP_FLAG_PUSH;
 		}
 
 		SendSegment (nFlags, m_nSND_NXT, m_nRCV_NXT, TempBuffer, nLength);
 		m_RTOCalculator.SegmentSent (m_nSND_NXT, nLength);
+		if (lt (m_nSND_NXT, m_nSND_MAX))
+		{
+			m_nRetransmittedSegments++;
+			NET_STAT_INC (NetCounterTCPRetransmissions);
+		}
 		m_nSND_NXT += nLength;
+		if (gt (m_nSND_NXT, m_nSND_MAX))
+		{
+			m_nSND_MAX = m_nSND_NXT;
+		}
 		StartTimer (TCPTimerRetransmission, m_RTOCalculator.GetRTO ());
 	}
 }
@@ -620,7 +1036,8 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 				    unsigned	 nLength,
 				    CIPAddress	&rSenderIP,
 				    CIPAddress	&rReceiverIP,
-				    int		 nProtocol)
+				    int		 nProtocol,
+				    boolean	 bChecksumOK)
 {
 	if (nProtocol != IPPROTO_TCP)
 	{
@@ -658,11 +1075,16 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		m_Checksum.SetDestinationAddress (rSenderIP);
 	}
 
-	if (m_Checksum.Calculate (pPacket, nLength) != CHECKSUM_OK)
+	if (   !bChecksumOK
+	    && m_Checksum.Calculate (pPacket, nLength) != CHECKSUM_OK)
 	{
+		NET_STAT_INC (NetCounterTCPRxChecksumErrors);
+
 		return 0;
 	}
 
+	NET_STAT_INC (NetCounterTCPRxSegments);
+
 	u16 nFlags = pHeader->nDataOffsetFlags;
 	u32 nDataOffset = TCP_DATA_OFFSET (pHeader->nDataOffsetFlags)*4;
 	u32 nDataLength = nLength-nDataOffset;
@@ -681,12 +1103,18 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		nSEG_LEN++;
 	}
 	
+	TTCPSegmentOptions Options;
+	ScanOptions (pHeader, &Options);
+
 	u32 nSEG_WND = be2le16 (pHeader->nWindow);
+	if (   !(nFlags & TCP_FLAG_SYN)		// window in SYN segments is never scaled
+	    && m_bWindowScale)
+	{
+		nSEG_WND <<= m_nSND_WSHIFT;
+	}
 	//u16 nSEG_UP  = be2le16 (pHeader->nUrgentPointer);
 	//u32 nSEG_PRC;	// segment precedence value
 
-	ScanOptions (pHeader);
-
 #ifdef TCP_DEBUG
 	CLogger::Get ()->Write (FromTCP, LogDebug,
 				"rx %c%c%c%c%c%c, seq %u, ack %u, win %u, len %u",
@@ -739,6 +1167,41 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		}
 		else if (nFlags & TCP_FLAG_ACK)
 		{
+			u16 nMSS;
+			if (   !(nFlags & TCP_FLAG_SYN)
+			    && s_nConnections < TCP_MAX_CONNECTIONS
+			    && CTCPSYNCookie::Check (rSenderIP, be2le16 (pHeader->nSourcePort),
+						     m_nOwnPort, nSEG_SEQ-1, nSEG_ACK-1, &nMSS))
+			{
+				// the SYN-ACK has been sent by CTCPRejector with a SYN cookie,
+				// continue as if we sent it from here
+				m_nRCV_NXT = nSEG_SEQ;
+				m_nIRS = nSEG_SEQ-1;
+
+				m_nISS = nSEG_ACK-1;
+				m_RTOCalculator.Initialize (m_nISS);
+				m_nRecover = m_nISS;
+
+				m_nSND_NXT = m_nISS+1;
+				m_nSND_MAX = m_nSND_NXT;
+				m_nSND_UNA = m_nISS;
+
+				// RFC 1122 section 4.2.2.6
+				m_nSND_MSS = min ((unsigned) nMSS+20, MSS_S) - TCP_HEADER_SIZE - IP_OPTION_SIZE;
+
+				m_ForeignIP.Set (rSenderIP);
+				m_nForeignPort = be2le16 (pHeader->nSourcePort);
+				m_Checksum.SetDestinationAddress (rSenderIP);
+
+				NEW_STATE (TCPStateSynReceived);
+
+				m_Event.Set ();
+
+				// process the ACK (and data) in the new state
+				return PacketReceived (pPacket, nLength, rSenderIP, rReceiverIP,
+						       nProtocol, TRUE);
+			}
+
 			m_ForeignIP.Set (rSenderIP);
 			m_nForeignPort = be2le16 (pHeader->nSourcePort);
 			m_Checksum.SetDestinationAddress (rSenderIP);
@@ -764,16 +1227,24 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			m_nSND_WND = nSEG_WND;
 			m_nSND_WL1 = nSEG_SEQ;
 			m_nSND_WL2 = nSEG_ACK;
+
+			// use the options, which are offered by the peer
+			m_bWindowScale = Options.bWindowScale;
+			m_nSND_WSHIFT = m_bWindowScale ? Options.nWindowShift : 0;
+			m_bTimestamps = Options.bTimestamp;
+			m_nTS_Recent = Options.nTSVal;
+			m_bSACKPermitted = Options.bSACKPermitted;
 	
 			assert (nSEG_LEN > 0);
 
 			if (nDataLength > 0)
 			{
-				m_RxQueue.Enqueue ((u8 *) pPacket+nDataOffset, nDataLength);
+				EnqueueReceived ((u8 *) pPacket+nDataOffset, nDataLength);
 			}
 
 			m_nISS = CalculateISN ();
 			m_RTOCalculator.Initialize (m_nISS);
+			m_nRecover = m_nISS;
 
 			m_ForeignIP.Set (rSenderIP);
 			m_nForeignPort = be2le16 (pHeader->nSourcePort);
@@ -783,6 +1254,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			m_RTOCalculator.SegmentSent (m_nISS);
 
 			m_nSND_NXT = m_nISS+1;
+			m_nSND_MAX = m_nSND_NXT;
 			m_nSND_UNA = m_nISS;
 			
 			NEW_STATE (TCPStateSynReceived);
@@ -834,6 +1306,13 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			m_nRCV_NXT = nSEG_SEQ+1;
 			m_nIRS = nSEG_SEQ;
 
+			// an option is used only, if it is supported by both sides
+			m_bWindowScale = m_bWindowScale && Options.bWindowScale;
+			m_nSND_WSHIFT = m_bWindowScale ? Options.nWindowShift : 0;
+			m_bTimestamps = m_bTimestamps && Options.bTimestamp;
+			m_nTS_Recent = Options.nTSVal;
+			m_bSACKPermitted = m_bSACKPermitted && Options.bSACKPermitted;
+
 			if (nFlags & TCP_FLAG_ACK)
 			{
 				m_RTOCalculator.SegmentAcknowledged (nSEG_ACK);
@@ -853,6 +1332,9 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 
 				StopTimer (TCPTimerRetransmission);
 
+				assert (m_pCongestionControl != 0);
+				m_pCongestionControl->SetMSS (GetSendMSS ());
+
 				// next transmission starts with this count
 				m_nRetransmissionCount = MAX_RETRANSMISSIONS;
 
@@ -862,6 +1344,8 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 				m_nSND_WND = nSEG_WND;
 				m_nSND_WL1 = nSEG_SEQ;
 				m_nSND_WL2 = nSEG_ACK;
+
+				UpdateReceiveWindow ();		// may be scaled now
 	
 				SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
 				
@@ -895,7 +1379,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 
 					if (nDataLength > 0)
 					{
-						m_RxQueue.Enqueue ((u8 *) pPacket+nDataOffset, nDataLength);
+						EnqueueReceived ((u8 *) pPacket+nDataOffset, nDataLength);
 					}
 
 					break;
@@ -912,6 +1396,16 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 	case TCPStateClosing:
 	case TCPStateLastAck:
 	case TCPStateTimeWait:
+		// RFC 7323 section 5.3 (PAWS)
+		if (   m_bTimestamps
+		    && Options.bTimestamp
+		    && !(nFlags & TCP_FLAG_RESET)
+		    && lt (Options.nTSVal, m_nTS_Recent))
+		{
+			SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
+			break;
+		}
+
 		// step 1 ( check sequence number)
 		if (m_nRCV_WND > 0)
 		{
@@ -949,6 +1443,15 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			break;
 		}
 
+		// RFC 7323 section 4.3
+		if (   m_bTimestamps
+		    && Options.bTimestamp
+		    && le (nSEG_SEQ, m_nLastACKSent)
+		    && ge (Options.nTSVal, m_nTS_Recent))
+		{
+			m_nTS_Recent = Options.nTSVal;
+		}
+
 		// step 2 (check RST bit)
 		if (nFlags & TCP_FLAG_RESET)
 		{
@@ -977,8 +1480,11 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			case TCPStateCloseWait:
 				m_nErrno = -1;
 				m_RetransmissionQueue.Flush ();
-				m_TxQueue.Flush ();
+				FlushTxQueue ();
 				m_RxQueue.Flush ();
+				AtomicSet (&m_nRxQueued, 0);
+				m_ReassemblyQueue.Flush ();
+				m_SACKScoreboard.Reset ();
 				NEW_STATE (TCPStateClosed);
 				m_Event.Set ();
 				return 1;
@@ -1012,8 +1518,11 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			SendSegment (TCP_FLAG_RESET, m_nSND_NXT);
 			m_nErrno = -1;
 			m_RetransmissionQueue.Flush ();
-			m_TxQueue.Flush ();
+			FlushTxQueue ();
 			m_RxQueue.Flush ();
+			AtomicSet (&m_nRxQueued, 0);
+			m_ReassemblyQueue.Flush ();
+			m_SACKScoreboard.Reset ();
 			NEW_STATE (TCPStateClosed);
 			m_Event.Set ();
 			return 1;
@@ -1037,10 +1546,25 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 
 				m_nSND_UNA = nSEG_ACK;		// got ACK for SYN
 
-				m_RTOCalculator.SegmentAcknowledged (nSEG_ACK);
+				if (   m_bTimestamps
+				    && Options.bTimestamp
+				    && Options.nTSEcr != 0)
+				{
+					m_RTOCalculator.SegmentAcknowledged (nSEG_ACK,
+						m_pTimer->GetTicks () - Options.nTSEcr);
+				}
+				else
+				{
+					m_RTOCalculator.SegmentAcknowledged (nSEG_ACK);
+				}
 
 				NEW_STATE (TCPStateEstablished);
 
+				UpdateReceiveWindow ();		// may be scaled now
+
+				assert (m_pCongestionControl != 0);
+				m_pCongestionControl->SetMSS (GetSendMSS ());
+
 				// next transmission starts with this count
 				m_nRetransmissionCount = MAX_RETRANSMISSIONS;
 			}
@@ -1055,12 +1579,69 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		case TCPStateFinWait2:
 		case TCPStateCloseWait:
 		case TCPStateClosing:
+			if (   (   m_State == TCPStateEstablished
+				|| m_State == TCPStateCloseWait)
+			    && bwh (m_nSND_NXT, nSEG_ACK, m_nSND_MAX))
+			{
+				// ACK for data, which has been sent before going back to SND.UNA
+				m_RetransmissionQueue.Skip (nSEG_ACK-m_nSND_NXT);
+				m_nSND_NXT = nSEG_ACK;
+			}
+
+			if (m_bSACKPermitted)
+			{
+				for (unsigned i = 0; i < Options.nSACKBlocks; i++)
+				{
+					u32 nLeft = Options.SACKLeftEdge[i];
+					u32 nRight = Options.SACKRightEdge[i];
+
+					if (   bwl (m_nSND_UNA, nLeft, m_nSND_MAX)
+					    && bwh (nLeft, nRight, m_nSND_MAX))
+					{
+						m_SACKScoreboard.Add (nLeft, nRight);
+					}
+				}
+			}
+
 			if (bwh (m_nSND_UNA, nSEG_ACK, m_nSND_NXT))
 			{
-				m_RTOCalculator.SegmentAcknowledged (nSEG_ACK);
+				if (   m_bTimestamps
+				    && Options.bTimestamp
+				    && Options.nTSEcr != 0)
+				{
+					m_RTOCalculator.SegmentAcknowledged (nSEG_ACK,
+						m_pTimer->GetTicks () - Options.nTSEcr);
+				}
+				else
+				{
+					m_RTOCalculator.SegmentAcknowledged (nSEG_ACK);
+				}
 
 				unsigned nBytesAck = nSEG_ACK-m_nSND_UNA;
 				m_nSND_UNA = nSEG_ACK;
+				m_SACKScoreboard.Acknowledge (m_nSND_UNA);
+
+				if (   m_State == TCPStateEstablished
+				    || m_State == TCPStateCloseWait)
+				{
+					assert (m_pCongestionControl != 0);
+					if (!m_pCongestionControl->IsInRecovery ())
+					{
+						m_pCongestionControl->Acknowledged (nBytesAck,
+										    m_RTOCalculator.GetSRTT ());
+					}
+					else if (ge (nSEG_ACK, m_nRecover))	// full ACK
+					{
+						m_pCongestionControl->ExitRecovery (GetFlightSize ());
+					}
+					else					// partial ACK
+					{
+						m_pCongestionControl->PartialACK (nBytesAck);
+						m_bFastRetransmit = TRUE;
+					}
+
+					m_nDupACKs = 0;
+				}
 
 				if (nSEG_ACK == m_nSND_NXT)	// all segments are acknowledged
 				{
@@ -1100,6 +1681,29 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			}
 			else if (le (nSEG_ACK, m_nSND_UNA))	// RFC 1122 section 4.2.2.20 (g)
 			{
+				// duplicate ACK as defined in RFC 5681 section 2
+				if (   (   m_State == TCPStateEstablished
+					|| m_State == TCPStateCloseWait)
+				    && nSEG_ACK == m_nSND_UNA
+				    && nSEG_ACK != m_nSND_MAX
+				    && nDataLength == 0
+				    && !(nFlags & (TCP_FLAG_SYN | TCP_FLAG_FIN))
+				    && nSEG_WND == m_nSND_WND)
+				{
+					assert (m_pCongestionControl != 0);
+					if (m_pCongestionControl->IsInRecovery ())
+					{
+						m_pCongestionControl->DuplicateACK ();
+					}
+					else if (   ++m_nDupACKs == TCP_DUPACK_THRESHOLD
+						 && gt (nSEG_ACK, m_nRecover))	// RFC 6582 section 3.2 (1)
+					{
+						m_nRecover = m_nSND_MAX;
+						m_pCongestionControl->EnterRecovery (GetFlightSize ());
+						m_bFastRetransmit = TRUE;
+					}
+				}
+
 				// ignore duplicate ACK ...
 				
 				// RFC 1122 section 4.2.2.20 (g)
@@ -1159,6 +1763,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 					m_bFINQueued = FALSE;
 					StopTimer (TCPTimerRetransmission);
 					NEW_STATE (TCPStateTimeWait);
+					ReleaseBuffers ();
 					StartTimer (TCPTimerTimeWait, HZ_TIMEWAIT);
 				}
 				break;
@@ -1207,29 +1812,80 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		case TCPStateEstablished:
 		case TCPStateFinWait1:
 		case TCPStateFinWait2:
-			if (nSEG_SEQ == m_nRCV_NXT)
 			{
-				if (nDataLength > 0)
+				u8 *pData = (u8 *) pPacket+nDataOffset;
+				u32 nSeq = nSEG_SEQ;
+				if (nFlags & TCP_FLAG_SYN)
 				{
-					m_RxQueue.Enqueue ((u8 *) pPacket+nDataOffset, nDataLength);
+					nSeq++;
+				}
 
-					m_nRCV_NXT += nDataLength;
+				// trim data, which has been received already
+				unsigned nLength = nDataLength;
+				if (lt (nSeq, m_nRCV_NXT))
+				{
+					unsigned nTrim = min (m_nRCV_NXT-nSeq, nLength);
+					pData += nTrim;
+					nLength -= nTrim;
+					nSeq += nTrim;
+				}
 
-					// m_nRCV_WND should be adjusted here (section 3.7)
+				// trim data beyond the receive window
+				u32 nRightEdge = m_nRCV_NXT+m_nRCV_WND;
+				if (   nLength > 0
+				    && gt (nSeq+nLength, nRightEdge))
+				{
+					nLength = lt (nSeq, nRightEdge) ? nRightEdge-nSeq : 0;
+					nFlags &= ~TCP_FLAG_FIN;
+				}
+
+				if (nSeq != m_nRCV_NXT)
+				{
+					// out of order, keep it until the gap has been filled
+					NET_STAT_INC (NetCounterTCPRxOutOfOrder);
+
+					if (   nLength > 0
+					    &&   m_ReassemblyQueue.GetBytesQueued ()+nLength
+					      <= TCP_CONFIG_RX_BUFFER_SIZE)
+					{
+						m_ReassemblyQueue.Insert (nSeq, pData, nLength);
+					}
+
+					SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
+					return 1;
+				}
+
+				if (nLength > 0)
+				{
+					AcceptReceived (pData, nLength);
+
+					// deliver the out-of-order data, which follows now
+					boolean bReassembled = FALSE;
+					u8 TempBuffer[FRAME_BUFFER_SIZE];
+					while ((nLength = m_ReassemblyQueue.Remove (m_nRCV_NXT, TempBuffer,
+										    sizeof TempBuffer)) > 0)
+					{
+						AcceptReceived (TempBuffer, nLength);
+
+						bReassembled = TRUE;
+					}
+
+					UpdateReceiveWindow ();
 
 					// following ACK could be piggybacked with data
 					SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
 
-					if (nFlags & TCP_FLAG_PUSH)
+					if (   (nFlags & TCP_FLAG_PUSH)
+					    || bReassembled)
 					{
 						m_Event.Set ();
 					}
 				}
-			}
-			else
-			{
-				SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
-				return 1;
+				else if (!(nFlags & TCP_FLAG_FIN))
+				{
+					SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
+					return 1;
+				}
 			}
 			break;
 
@@ -1277,6 +1933,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 				StopTimer (TCPTimerRetransmission);
 				StopTimer (TCPTimerUser);
 				NEW_STATE (TCPStateTimeWait);
+				ReleaseBuffers ();
 				StartTimer (TCPTimerTimeWait, HZ_TIMEWAIT);
 			}
 			else
@@ -1289,6 +1946,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			StopTimer (TCPTimerRetransmission);
 			StopTimer (TCPTimerUser);
 			NEW_STATE (TCPStateTimeWait);
+			ReleaseBuffers ();
 			StartTimer (TCPTimerTimeWait, HZ_TIMEWAIT);
 			break;
 
@@ -1345,6 +2003,7 @@ int CTCPConnection::NotificationReceived (TICMPNotificationType  Type,
 
 	StopTimer (TCPTimerRetransmission);
 	NEW_STATE (TCPStateTimeWait);
+	ReleaseBuffers ();
 	StartTimer (TCPTimerTimeWait, HZ_TIMEWAIT);
 
 	m_Event.Set ();
@@ -1355,48 +2014,157 @@ int CTCPConnection::NotificationReceived (TICMPNotificationType  Type,
 boolean CTCPConnection::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAcknowledgmentNumber,
 				     const void *pData, unsigned nDataLength)
 {
-	unsigned nDataOffset = 5;
-	assert (nDataOffset * 4 == sizeof (TTCPHeader));
+	CNetBuffer *pBuffer = new CNetBuffer (IP_PACKET_HEADROOM);
+	assert (pBuffer != 0);
+
+	u8 *TxBuffer = (u8 *) pBuffer->GetData ();
+	TTCPHeader *pHeader = (TTCPHeader *) TxBuffer;
+
+	// build options, all options are 32-bit aligned
+	u8 *pOption = (u8 *) pHeader->Options;
 	if (nFlags & TCP_FLAG_SYN)
 	{
-		nDataOffset++;
+		*pOption++ = TCP_OPTION_MSS;
+		*pOption++ = 4;
+		*pOption++ = TCP_CONFIG_MSS >> 8;
+		*pOption++ = TCP_CONFIG_MSS & 0xFF;
+
+		if (   m_bSACKPermitted
+		    && m_bTimestamps)
+		{
+			*pOption++ = TCP_OPTION_SACK_PERM;
+			*pOption++ = 2;
+			pOption = PutTimestampOption (pOption, nFlags & TCP_FLAG_ACK ? m_nTS_Recent : 0);
+		}
+		else if (m_bSACKPermitted)
+		{
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_SACK_PERM;
+			*pOption++ = 2;
+		}
+		else if (m_bTimestamps)
+		{
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_NOP;
+			pOption = PutTimestampOption (pOption, nFlags & TCP_FLAG_ACK ? m_nTS_Recent : 0);
+		}
+
+		if (m_bWindowScale)
+		{
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_WINDOW_SCALE;
+			*pOption++ = 3;
+			*pOption++ = m_nRCV_WSHIFT;
+		}
 	}
-	unsigned nHeaderLength = nDataOffset * 4;
-	
+	else if (   m_bTimestamps
+		 && !(nFlags & TCP_FLAG_RESET))
+	{
+		*pOption++ = TCP_OPTION_NOP;
+		*pOption++ = TCP_OPTION_NOP;
+		pOption = PutTimestampOption (pOption, m_nTS_Recent);
+	}
+
+	// report out-of-order data in pure ACKs, which are sent for it
+	if (   m_bSACKPermitted
+	    && !(nFlags & (TCP_FLAG_SYN | TCP_FLAG_RESET))
+	    && nDataLength == 0
+	    && !m_ReassemblyQueue.IsEmpty ())
+	{
+		u32 LeftEdge[TCP_MAX_SACK_BLOCKS];
+		u32 RightEdge[TCP_MAX_SACK_BLOCKS];
+		unsigned nBlocks = m_ReassemblyQueue.GetBlocks (LeftEdge, RightEdge,
+								 m_bTimestamps ? TCP_MAX_SACK_BLOCKS-1
+									       : TCP_MAX_SACK_BLOCKS);
+		if (nBlocks > 0)
+		{
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_SACK;
+			*pOption++ = 2 + nBlocks*8;
+
+			for (unsigned i = 0; i < nBlocks; i++)
+			{
+				u32 nLeft = le2be32 (LeftEdge[i]);
+				u32 nRight = le2be32 (RightEdge[i]);
+
+				memcpy (pOption, &nLeft, 4);
+				memcpy (pOption+4, &nRight, 4);
+				pOption += 8;
+			}
+		}
+	}
+
+	unsigned nHeaderLength = pOption - TxBuffer;
+	assert ((nHeaderLength & 3) == 0);
+	unsigned nDataOffset = nHeaderLength / 4;
+	assert (nDataOffset >= 5);
+	assert (nDataOffset <= 15);
+
 	unsigned nPacketLength = nHeaderLength + nDataLength;		// may wrap
 	assert (nPacketLength >= nHeaderLength);
-	assert (nHeaderLength <= FRAME_BUFFER_SIZE);
+	assert (nHeaderLength <= IP_PAYLOAD_MAX_LENGTH);
 
-	u8 TxBuffer[FRAME_BUFFER_SIZE];
-	TTCPHeader *pHeader = (TTCPHeader *) TxBuffer;
+	assert (nPacketLength <= pBuffer->GetMaxLength ());
+	pBuffer->SetLength (nPacketLength);
+
+	// the window field in SYN segments is never scaled (RFC 7323 section 2.2)
+	u32 nWindow = m_nRCV_WND;
+	if (   !(nFlags & TCP_FLAG_SYN)
+	    && m_bWindowScale)
+	{
+		nWindow >>= m_nRCV_WSHIFT;
+	}
+	nWindow = min (nWindow, TCP_MAX_WINDOW);
 
 	pHeader->nSourcePort	 	= le2be16 (m_nOwnPort);
 	pHeader->nDestPort	 	= le2be16 (m_nForeignPort);
 	pHeader->nSequenceNumber 	= le2be32 (nSequenceNumber);
 	pHeader->nAcknowledgmentNumber	= nFlags & TCP_FLAG_ACK ? le2be32 (nAcknowledgmentNumber) : 0;
 	pHeader->nDataOffsetFlags	= (nDataOffset << TCP_DATA_OFFSET_SHIFT) | nFlags;
-	pHeader->nWindow		= le2be16 (m_nRCV_WND);
+	pHeader->nWindow		= le2be16 (nWindow);
 	pHeader->nUrgentPointer		= le2be16 (m_nSND_UP);
 
-	if (nFlags & TCP_FLAG_SYN)
+	if (nFlags & TCP_FLAG_ACK)
 	{
-		TTCPOption *pOption = (TTCPOption *) pHeader->Options;
-
-		pOption->nKind   = TCP_OPTION_MSS;
-		pOption->nLength = 4;
-		pOption->Data[0] = TCP_CONFIG_MSS >> 8;
-		pOption->Data[1] = TCP_CONFIG_MSS & 0xFF;
+		m_nLastACKSent = nAcknowledgmentNumber;
 	}
 
-	if (nDataLength > 0)
+	assert (nDataLength == 0 || pData != 0);
+	assert (m_pNetworkLayer != 0);
+	unsigned nOffloads = m_pNetworkLayer->GetOffloadCapabilities ();
+	if (nOffloads & NET_OFFLOAD_TX_CHECKSUM)
+	{
+		// the checksum is calculated by the net device, only the data has to be copied
+		if (nDataLength > 0)
+		{
+			memcpy (TxBuffer+nHeaderLength, pData, nDataLength);
+		}
+
+		pHeader->nChecksum = m_Checksum.CalculatePseudoHeader (nPacketLength);
+
+		unsigned nChecksumOffset = (u8 *) &pHeader->nChecksum - TxBuffer;
+		unsigned nSegmentSize = GetSendMSS ();
+		if (nDataLength > nSegmentSize)
+		{
+			assert ((nOffloads & TCP_TSO_OFFLOADS) == TCP_TSO_OFFLOADS);
+			pBuffer->SetOffload (TCP_TSO_OFFLOADS, 0, nChecksumOffset, nSegmentSize);
+		}
+		else
+		{
+			pBuffer->SetOffload (NET_OFFLOAD_TX_CHECKSUM, 0, nChecksumOffset);
+		}
+	}
+	else
 	{
-		assert (pData != 0);
-		memcpy (TxBuffer+nHeaderLength, pData, nDataLength);
+		// the data is copied during checksum calculation
+		pHeader->nChecksum = 0;		// must be 0 for calculation
+		pHeader->nChecksum = m_Checksum.CalculateCopy (TxBuffer, nHeaderLength,
+							       TxBuffer+nHeaderLength,
+							       pData, nDataLength);
 	}
 
-	pHeader->nChecksum = 0;		// must be 0 for calculation
-	pHeader->nChecksum = m_Checksum.Calculate (TxBuffer, nPacketLength);
-
 #ifdef TCP_DEBUG
 	CLogger::Get ()->Write (FromTCP, LogDebug,
 				"tx %c%c%c%c%c%c, seq %u, ack %u, win %u, len %u",
@@ -1412,12 +2180,23 @@ boolean CTCPConnection::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 n
 				nDataLength);
 #endif
 
+	NET_STAT_INC (NetCounterTCPTxSegments);
+
 	assert (m_pNetworkLayer != 0);
-	return m_pNetworkLayer->Send (m_ForeignIP, TxBuffer, nPacketLength, IPPROTO_TCP);
+	return m_pNetworkLayer->Send (m_ForeignIP, pBuffer, IPPROTO_TCP);
 }
 
-void CTCPConnection::ScanOptions (TTCPHeader *pHeader)
+void CTCPConnection::ScanOptions (TTCPHeader *pHeader, TTCPSegmentOptions *pOptions)
 {
+	assert (pOptions != 0);
+	pOptions->bWindowScale = FALSE;
+	pOptions->nWindowShift = 0;
+	pOptions->bSACKPermitted = FALSE;
+	pOptions->bTimestamp = FALSE;
+	pOptions->nTSVal = 0;
+	pOptions->nTSEcr = 0;
+	pOptions->nSACKBlocks = 0;
+
 	assert (pHeader != 0);
 	unsigned nDataOffset = TCP_DATA_OFFSET (pHeader->nDataOffsetFlags)*4;
 	u8 *pHeaderEnd = (u8 *) pHeader+nDataOffset;
@@ -1432,7 +2211,7 @@ void CTCPConnection::ScanOptions (TTCPHeader *pHeader)
 
 		case TCP_OPTION_NOP:
 			pOption = (TTCPOption *) ((u8 *) pOption+1);
-			break;
+			continue;
 			
 		case TCP_OPTION_MSS:
 			if (   pOption->nLength == 4
@@ -1448,21 +2227,224 @@ void CTCPConnection::ScanOptions (TTCPHeader *pHeader)
 					m_nSND_MSS = (u16) nMSS;
 				}
 			}
-			// fall through
+			break;
+
+		case TCP_OPTION_WINDOW_SCALE:
+			if (   pOption->nLength == 3
+			    && (u8 *) pOption+3 <= pHeaderEnd)
+			{
+				pOptions->bWindowScale = TRUE;
+				pOptions->nWindowShift = min (pOption->Data[0], TCP_MAX_WINDOW_SHIFT);
+			}
+			break;
+
+		case TCP_OPTION_SACK_PERM:
+			if (pOption->nLength == 2)
+			{
+				pOptions->bSACKPermitted = TRUE;
+			}
+			break;
+
+		case TCP_OPTION_SACK:
+			if (   pOption->nLength >= 2+8
+			    && (pOption->nLength-2) % 8 == 0
+			    && (u8 *) pOption+pOption->nLength <= pHeaderEnd)
+			{
+				unsigned nBlocks = (pOption->nLength-2) / 8;
+				nBlocks = min (nBlocks, TCP_MAX_SACK_BLOCKS);
+
+				for (unsigned i = 0; i < nBlocks; i++)
+				{
+					u32 nLeft, nRight;
+					memcpy (&nLeft, pOption->Data + i*8, 4);
+					memcpy (&nRight, pOption->Data + i*8 + 4, 4);
+
+					pOptions->SACKLeftEdge[i] = be2le32 (nLeft);
+					pOptions->SACKRightEdge[i] = be2le32 (nRight);
+				}
+
+				pOptions->nSACKBlocks = nBlocks;
+			}
+			break;
+
+		case TCP_OPTION_TIMESTAMP:
+			if (   pOption->nLength == 10
+			    && (u8 *) pOption+10 <= pHeaderEnd)
+			{
+				u32 nTSVal, nTSEcr;
+				memcpy (&nTSVal, pOption->Data, 4);
+				memcpy (&nTSEcr, pOption->Data+4, 4);
+
+				pOptions->bTimestamp = TRUE;
+				pOptions->nTSVal = be2le32 (nTSVal);
+				pOptions->nTSEcr = be2le32 (nTSEcr);
+			}
+			break;
 
 		default:
-			pOption = (TTCPOption *) ((u8 *) pOption+pOption->nLength);
 			break;
 		}
+
+		if (pOption->nLength < 2)		// invalid length, would loop forever
+		{
+			return;
+		}
+
+		pOption = (TTCPOption *) ((u8 *) pOption+pOption->nLength);
 	}
 }
 
-u32 CTCPConnection::CalculateISN (void)
+u8 *CTCPConnection::PutTimestampOption (u8 *pOption, u32 nTSEcr)
 {
 	assert (m_pTimer != 0);
-	return   (  m_pTimer->GetTime () * HZ
-	          + m_pTimer->GetTicks () % HZ)
-	       * (TCP_MAX_WINDOW / TCP_QUIET_TIME / HZ);
+	u32 nTSVal = le2be32 (m_pTimer->GetTicks ());
+	nTSEcr = le2be32 (nTSEcr);
+
+	assert (pOption != 0);
+	*pOption++ = TCP_OPTION_TIMESTAMP;
+	*pOption++ = 10;
+	memcpy (pOption, &nTSVal, 4);
+	memcpy (pOption+4, &nTSEcr, 4);
+
+	return pOption+8;
+}
+
+void CTCPConnection::EnqueueReceived (const void *pData, unsigned nLength)
+{
+	assert (nLength > 0);
+	m_RxQueue.Enqueue (pData, nLength);
+
+	AtomicAdd (&m_nRxQueued, nLength);
+}
+
+void CTCPConnection::AcceptReceived (const void *pData, unsigned nLength)
+{
+	EnqueueReceived (pData, nLength);
+
+	// the right edge of the window stays, where it is
+	m_nRCV_NXT += nLength;
+	m_nRCV_WND = nLength < m_nRCV_WND ? m_nRCV_WND-nLength : 0;
+}
+
+unsigned CTCPConnection::GetReceiveSpace (void) const
+{
+	int nSpace = TCP_CONFIG_RX_BUFFER_SIZE - AtomicGet (&m_nRxQueued);
+	if (nSpace <= 0)
+	{
+		return 0;
+	}
+
+	if (!m_bWindowScale)
+	{
+		return min ((unsigned) nSpace, TCP_MAX_WINDOW);
+	}
+
+	nSpace &= ~((1 << m_nRCV_WSHIFT) - 1);		// can be advertised exactly
+
+	return min ((unsigned) nSpace, (unsigned) TCP_MAX_WINDOW << m_nRCV_WSHIFT);
+}
+
+int CTCPConnection::CheckSendState (int nFlags)
+{
+	if ((nFlags & ~(MSG_DONTWAIT | MSG_MORE)) != 0)
+	{
+		return -1;
+	}
+
+	if (m_nErrno < 0)
+	{
+		return m_nErrno;
+	}
+	
+	switch (m_State)
+	{
+	case TCPStateClosed:
+	case TCPStateListen:
+	case TCPStateFinWait1:
+	case TCPStateFinWait2:
+	case TCPStateClosing:
+	case TCPStateLastAck:
+	case TCPStateTimeWait:
+		return -1;
+
+	case TCPStateSynSent:
+	case TCPStateSynReceived:
+	case TCPStateEstablished:
+	case TCPStateCloseWait:
+		break;
+	}
+
+	return 0;
+}
+
+void CTCPConnection::FlushTxQueue (void)
+{
+	u8 Buffer[FRAME_BUFFER_SIZE];
+	void *pParam;
+	unsigned nLength;
+	while ((nLength = m_TxQueue.Dequeue (Buffer, &pParam)) > 0)
+	{
+		if (pParam == &s_ZeroCopyTag)
+		{
+			assert (nLength == sizeof (TTCPZeroCopyBuffer));
+			TTCPZeroCopyBuffer *pBuffer = (TTCPZeroCopyBuffer *) Buffer;
+
+			assert (pBuffer->pHandler != 0);
+			(*pBuffer->pHandler) (pBuffer->pBuffer, pBuffer->pParam);
+		}
+	}
+
+	if (m_ZeroCopy.nLength > 0)
+	{
+		m_ZeroCopy.nLength = 0;
+
+		assert (m_ZeroCopy.pHandler != 0);
+		(*m_ZeroCopy.pHandler) (m_ZeroCopy.pBuffer, m_ZeroCopy.pParam);
+	}
+}
+
+void CTCPConnection::ReleaseBuffers (void)
+{
+	m_RetransmissionQueue.Flush ();
+	m_ReassemblyQueue.Flush ();
+}
+
+unsigned CTCPConnection::GetSendMSS (void) const
+{
+	if (m_bTimestamps)
+	{
+		return m_nSND_MSS - TCP_OPTION_TIMESTAMP_SIZE;
+	}
+
+	return m_nSND_MSS;
+}
+
+u32 CTCPConnection::GetFlightSize (void) const
+{
+	// selectively acknowledged data has left the network
+	u32 nFlightSize = m_nSND_MAX-m_nSND_UNA;
+	u32 nSACKed = m_SACKScoreboard.GetBytesAcknowledged ();
+
+	return nFlightSize > nSACKed ? nFlightSize-nSACKed : 0;
+}
+
+void CTCPConnection::UpdateReceiveWindow (void)
+{
+	// never shrink the window and do not open it by small amounts (RFC 1122 section 4.2.3.3)
+	unsigned nSpace = GetReceiveSpace ();
+	if (nSpace >= m_nRCV_WND + TCP_WINDOW_UPDATE_MIN)
+	{
+		m_nRCV_WND = nSpace;
+	}
+}
+
+// The ISN is unpredictable (RFC 6528), a time based ISN can be guessed by an attacker.
+u32 CTCPConnection::CalculateISN (void)
+{
+	u32 nISN;
+	m_Random.GetBytes (&nISN, sizeof nISN);
+
+	return nISN;
 }
 
 void CTCPConnection::StartTimer (unsigned nTimer, unsigned nHZ)
@@ -1471,9 +2453,12 @@ void CTCPConnection::StartTimer (unsigned nTimer, unsigned nHZ)
 	assert (nHZ > 0);
 	assert (m_pTimer != 0);
 
-	StopTimer (nTimer);
+	m_TimerSpinLock.Acquire ();
 
-	m_hTimer[nTimer] = m_pTimer->StartKernelTimer (nHZ, TimerStub, (void *) (uintptr) nTimer, this);
+	m_Timer[nTimer].Start (nHZ);		// restarts a running timer
+	m_bTimerRunning[nTimer] = TRUE;
+
+	m_TimerSpinLock.Release ();
 }
 
 void CTCPConnection::StopTimer (unsigned nTimer)
@@ -1483,10 +2468,10 @@ void CTCPConnection::StopTimer (unsigned nTimer)
 
 	m_TimerSpinLock.Acquire ();
 
-	if (m_hTimer[nTimer] != 0)
+	if (m_bTimerRunning[nTimer])
 	{
-		m_pTimer->CancelKernelTimer (m_hTimer[nTimer]);
-		m_hTimer[nTimer] = 0;
+		m_Timer[nTimer].Cancel ();
+		m_bTimerRunning[nTimer] = FALSE;
 	}
 
 	m_TimerSpinLock.Release ();
@@ -1498,14 +2483,14 @@ void CTCPConnection::TimerHandler (unsigned nTimer)
 
 	m_TimerSpinLock.Acquire ();
 
-	if (m_hTimer[nTimer] == 0)		// timer was stopped in the meantime
+	if (!m_bTimerRunning[nTimer])		// timer was stopped in the meantime
 	{
 		m_TimerSpinLock.Release ();
 
 		return;
 	}
 
-	m_hTimer[nTimer] = 0;
+	m_bTimerRunning[nTimer] = FALSE;
 
 	m_TimerSpinLock.Release ();
 
@@ -1570,6 +2555,8 @@ void CTCPConnection::TimerStub (TKernelTimerHandle hTimer, void *pParam, void *p
 	assert (nTimer < TCPTimerUnknown);
 
 	pThis->TimerHandler (nTimer);
+
+	pThis->Activate ();
 }
 
 #ifndef NDEBUG
@@ -0,0 +1,153 @@
+//
+// tcpcubic.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpcubic.h>
+#include <assert.h>
+
+//  C = 0.4, beta_cubic = 0.7 (RFC 8312 section 5)
+#define BETA_NUM		7
+#define BETA_DEN		10
+
+#define MAX_CUBIC_TIME		100000		// ms, limits the calculation
+
+CTCPCUBIC::CTCPCUBIC (unsigned nMSS)
+:	CTCPCongestionControl (nMSS),
+	m_pTimer (CTimer::Get ()),
+	m_nWMax (0),
+	m_nOrigin (0),
+	m_bEpochValid (FALSE),
+	m_nEpochStart (0),
+	m_nK (0),
+	m_nWEst (0)
+{
+	assert (m_pTimer != 0);
+}
+
+CTCPCUBIC::~CTCPCUBIC (void)
+{
+	m_pTimer = 0;
+}
+
+void CTCPCUBIC::IncreaseWindow (u32 nBytesAcked, unsigned nRTT)
+{
+	assert (m_pTimer != 0);
+	unsigned nTicks = m_pTimer->GetTicks ();
+
+	if (!m_bEpochValid)
+	{
+		m_bEpochValid = TRUE;
+		m_nEpochStart = nTicks;
+
+		if (m_nCWND < m_nWMax)
+		{
+			// K = cubic_root ((W_max - cwnd) / C) in seconds (RFC 8312 equation 2)
+			m_nK = CubeRoot ((u64) (m_nWMax - m_nCWND) * 2500000000ULL / m_nMSS);
+			m_nOrigin = m_nWMax;
+		}
+		else
+		{
+			m_nK = 0;
+			m_nOrigin = m_nCWND;
+		}
+
+		m_nWEst = m_nCWND;
+	}
+
+	// W_cubic (t + RTT) (RFC 8312 section 4.1)
+	unsigned nTime = (nTicks - m_nEpochStart + nRTT) * (1000 / HZ);
+	u64 nDelta = nTime >= m_nK ? nTime - m_nK : m_nK - nTime;
+	if (nDelta > MAX_CUBIC_TIME)
+	{
+		nDelta = MAX_CUBIC_TIME;
+	}
+
+	u64 nOffset = nDelta * nDelta * nDelta / 1000 * 4 * m_nMSS / 10000000;	// C * t^3
+
+	u64 nTarget;
+	if (nTime >= m_nK)
+	{
+		nTarget = m_nOrigin + nOffset;
+	}
+	else
+	{
+		nTarget = nOffset < m_nOrigin ? m_nOrigin - nOffset : m_nMSS;
+	}
+
+	// TCP-friendly region (RFC 8312 section 4.2)
+	m_nWEst += (u64) nBytesAcked * m_nMSS * 3 * (BETA_DEN-BETA_NUM)
+		   / ((BETA_DEN+BETA_NUM) * (u64) m_nCWND);
+	if (m_nWEst > nTarget)
+	{
+		nTarget = m_nWEst;
+	}
+
+	if (nTarget > m_nCWND + m_nCWND / 2)
+	{
+		nTarget = m_nCWND + m_nCWND / 2;
+	}
+
+	// concave and convex region (RFC 8312 section 4.3 and 4.4)
+	if (nTarget > m_nCWND)
+	{
+		m_nCWND += (nTarget - m_nCWND) * nBytesAcked / m_nCWND;
+	}
+}
+
+u32 CTCPCUBIC::CalculateSSThresh (u32 nFlightSize)
+{
+	m_bEpochValid = FALSE;
+
+	// fast convergence (RFC 8312 section 4.6)
+	if (m_nCWND < m_nWMax)
+	{
+		m_nWMax = (u64) m_nCWND * (BETA_DEN+BETA_NUM) / (2*BETA_DEN);
+	}
+	else
+	{
+		m_nWMax = m_nCWND;
+	}
+
+	// RFC 8312 section 4.5
+	u32 nSSThresh = (u64) m_nCWND * BETA_NUM / BETA_DEN;
+	if (nSSThresh < 2 * m_nMSS)
+	{
+		nSSThresh = 2 * m_nMSS;
+	}
+
+	return nSSThresh;
+}
+
+u32 CTCPCUBIC::CubeRoot (u64 nValue)
+{
+	u64 nResult = 0;
+
+	for (int nShift = 63; nShift >= 0; nShift -= 3)
+	{
+		nResult <<= 1;
+
+		u64 nBit = 3 * nResult * (nResult+1) + 1;
+		if ((nValue >> nShift) >= nBit)
+		{
+			nValue -= nBit << nShift;
+			nResult++;
+		}
+	}
+
+	return (u32) nResult;
+}
@@ -0,0 +1,56 @@
+//
+// tcpnewreno.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpnewreno.h>
+
+CTCPNewReno::CTCPNewReno (unsigned nMSS)
+:	CTCPCongestionControl (nMSS),
+	m_nBytesAcked (0)
+{
+}
+
+CTCPNewReno::~CTCPNewReno (void)
+{
+}
+
+void CTCPNewReno::IncreaseWindow (u32 nBytesAcked, unsigned nRTT)
+{
+	// increase by one MSS per window of acknowledged data (RFC 5681 section 3.1)
+	m_nBytesAcked += nBytesAcked;
+	if (m_nBytesAcked >= m_nCWND)
+	{
+		m_nBytesAcked -= m_nCWND;
+
+		m_nCWND += m_nMSS;
+	}
+}
+
+u32 CTCPNewReno::CalculateSSThresh (u32 nFlightSize)
+{
+	m_nBytesAcked = 0;
+
+	// RFC 5681 equation (4)
+	nFlightSize /= 2;
+	if (nFlightSize < 2 * m_nMSS)
+	{
+		nFlightSize = 2 * m_nMSS;
+	}
+
+	return nFlightSize;
+}
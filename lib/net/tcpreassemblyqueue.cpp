@@ -0,0 +1,207 @@
+//
+// tcpreassemblyqueue.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpreassemblyqueue.h>
+#include <circle/util.h>
+#include <assert.h>
+
+// Modulo 32 sequence number arithmetic
+#define lt(x, y)		((int) ((u32) (x) - (u32) (y)) < 0)
+#define le(x, y)		((int) ((u32) (x) - (u32) (y)) <= 0)
+#define gt(x, y) 		lt (y, x)
+
+struct TTCPReassemblySegment
+{
+	TTCPReassemblySegment	*pNext;
+	u32			 nSequenceNumber;	// of Data[nOffset]
+	unsigned		 nLength;
+	unsigned		 nOffset;
+	u8			 Data[];
+};
+
+CTCPReassemblyQueue::CTCPReassemblyQueue (void)
+:	m_pFirst (0),
+	m_nBytesQueued (0),
+	m_nLastInserted (0)
+{
+}
+
+CTCPReassemblyQueue::~CTCPReassemblyQueue (void)
+{
+	Flush ();
+}
+
+boolean CTCPReassemblyQueue::IsEmpty (void) const
+{
+	return m_pFirst == 0;
+}
+
+unsigned CTCPReassemblyQueue::GetBytesQueued (void) const
+{
+	return m_nBytesQueued;
+}
+
+void CTCPReassemblyQueue::Flush (void)
+{
+	while (m_pFirst != 0)
+	{
+		TTCPReassemblySegment *pSegment = m_pFirst;
+		m_pFirst = pSegment->pNext;
+
+		delete [] (u8 *) pSegment;
+	}
+
+	m_nBytesQueued = 0;
+}
+
+void CTCPReassemblyQueue::Insert (u32 nSequenceNumber, const void *pData, unsigned nLength)
+{
+	assert (pData != 0);
+	assert (nLength > 0);
+
+	m_nLastInserted = nSequenceNumber;
+
+	TTCPReassemblySegment **ppNext = &m_pFirst;
+	while (   *ppNext != 0
+	       && le ((*ppNext)->nSequenceNumber, nSequenceNumber))
+	{
+		// ignore retransmitted segment, which is already completely queued
+		if (le (nSequenceNumber+nLength, (*ppNext)->nSequenceNumber+(*ppNext)->nLength))
+		{
+			return;
+		}
+
+		ppNext = &(*ppNext)->pNext;
+	}
+
+	TTCPReassemblySegment *pSegment =
+		(TTCPReassemblySegment *) new u8[sizeof (TTCPReassemblySegment) + nLength];
+	assert (pSegment != 0);
+
+	pSegment->nSequenceNumber = nSequenceNumber;
+	pSegment->nLength = nLength;
+	pSegment->nOffset = 0;
+	memcpy (pSegment->Data, pData, nLength);
+
+	pSegment->pNext = *ppNext;
+	*ppNext = pSegment;
+
+	m_nBytesQueued += nLength;
+}
+
+unsigned CTCPReassemblyQueue::Remove (u32 nSequenceNumber, void *pBuffer, unsigned nLength)
+{
+	assert (pBuffer != 0);
+	assert (nLength > 0);
+
+	while (m_pFirst != 0)
+	{
+		TTCPReassemblySegment *pSegment = m_pFirst;
+
+		if (gt (pSegment->nSequenceNumber, nSequenceNumber))
+		{
+			return 0;			// there is still a gap
+		}
+
+		unsigned nSkip = nSequenceNumber - pSegment->nSequenceNumber;
+		if (nSkip >= pSegment->nLength)		// completely received already
+		{
+			assert (m_nBytesQueued >= pSegment->nLength);
+			m_nBytesQueued -= pSegment->nLength;
+
+			m_pFirst = pSegment->pNext;
+			delete [] (u8 *) pSegment;
+
+			continue;
+		}
+
+		unsigned nResult = pSegment->nLength - nSkip;
+		if (nResult > nLength)
+		{
+			nResult = nLength;
+		}
+
+		memcpy (pBuffer, pSegment->Data + pSegment->nOffset + nSkip, nResult);
+
+		nSkip += nResult;
+		assert (m_nBytesQueued >= nSkip);
+		m_nBytesQueued -= nSkip;
+
+		if (nSkip == pSegment->nLength)
+		{
+			m_pFirst = pSegment->pNext;
+			delete [] (u8 *) pSegment;
+		}
+		else
+		{
+			pSegment->nSequenceNumber += nSkip;
+			pSegment->nLength -= nSkip;
+			pSegment->nOffset += nSkip;
+		}
+
+		return nResult;
+	}
+
+	return 0;
+}
+
+unsigned CTCPReassemblyQueue::GetBlocks (u32 *pLeftEdge, u32 *pRightEdge, unsigned nMaxBlocks) const
+{
+	assert (pLeftEdge != 0);
+	assert (pRightEdge != 0);
+
+	unsigned nBlocks = 0;
+
+	// pass 0 reports the block with the most recently inserted segment, pass 1 the others
+	for (unsigned nPass = 0; nPass < 2; nPass++)
+	{
+		const TTCPReassemblySegment *pSegment = m_pFirst;
+		while (   pSegment != 0
+		       && nBlocks < nMaxBlocks)
+		{
+			u32 nLeft = pSegment->nSequenceNumber;
+			u32 nRight = nLeft + pSegment->nLength;
+
+			// join contiguous and overlapping segments
+			for (pSegment = pSegment->pNext;
+			        pSegment != 0
+			     && le (pSegment->nSequenceNumber, nRight);
+			     pSegment = pSegment->pNext)
+			{
+				u32 nEnd = pSegment->nSequenceNumber + pSegment->nLength;
+				if (gt (nEnd, nRight))
+				{
+					nRight = nEnd;
+				}
+			}
+
+			boolean bLastInserted =    le (nLeft, m_nLastInserted)
+						&& lt (m_nLastInserted, nRight);
+
+			if (bLastInserted == (nPass == 0))
+			{
+				pLeftEdge[nBlocks] = nLeft;
+				pRightEdge[nBlocks] = nRight;
+				nBlocks++;
+			}
+		}
+	}
+
+	return nBlocks;
+}
@@ -2,9 +2,10 @@
 // tcprejector.cpp
 //
 // Generates RESET response on any received TCP segment
+// (or a SYN cookie, if the listen backlog of the port is exhausted)
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,6 +21,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/tcprejector.h>
+#include <circle/net/tcpsyncookie.h>
 #include <circle/macros.h>
 #include <circle/util.h>
 #include <circle/logger.h>
@@ -53,6 +55,20 @@ struct TTCPHeader
 }
 PACKED;
 
+struct TTCPOption
+{
+	u8	nKind;
+#define TCP_OPTION_END_OF_LIST	0
+#define TCP_OPTION_NOP		1
+#define TCP_OPTION_MSS		2
+	u8	nLength;
+	u8	Data[];
+}
+PACKED;
+
+#define TCP_DEFAULT_MSS		536		// RFC 1122 section 4.2.2.6
+#define TCP_MAX_WINDOW		((u16) -1)
+
 #ifdef TCP_DEBUG
 static const char FromTCP[] = "tcp";
 #endif
@@ -67,7 +83,16 @@ CTCPRejector::~CTCPRejector (void)
 }
 
 int CTCPRejector::PacketReceived (const void *pPacket, unsigned nLength,
-				  CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol)
+				  CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+				  boolean bChecksumOK)
+{
+	return PacketReceived (pPacket, nLength, rSenderIP, rReceiverIP, nProtocol, bChecksumOK,
+			       FALSE);
+}
+
+int CTCPRejector::PacketReceived (const void *pPacket, unsigned nLength,
+				  CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+				  boolean bChecksumOK, boolean bListening)
 {
 	if (nProtocol != IPPROTO_TCP)
 	{
@@ -97,13 +122,19 @@ int CTCPRejector::PacketReceived (const void *pPacket, unsigned nLength,
 	m_Checksum.SetSourceAddress (*m_pNetConfig->GetIPAddress ());
 	m_Checksum.SetDestinationAddress (rSenderIP);
 
-	if (m_Checksum.Calculate (pPacket, nLength) != CHECKSUM_OK)
+	if (   !bChecksumOK
+	    && m_Checksum.Calculate (pPacket, nLength) != CHECKSUM_OK)
 	{
 		return 0;
 	}
 
 	u16 nFlags = pHeader->nDataOffsetFlags;
 	u32 nDataOffset = TCP_DATA_OFFSET (pHeader->nDataOffsetFlags)*4;
+	if (   nDataOffset < sizeof (TTCPHeader)
+	    || nDataOffset > nLength)
+	{
+		return -1;
+	}
 	u32 nDataLength = nLength-nDataOffset;
 
 	// Current Segment Variables
@@ -146,11 +177,35 @@ int CTCPRejector::PacketReceived (const void *pPacket, unsigned nLength,
 	}
 	else if (!(nFlags & TCP_FLAG_ACK))
 	{
-		SendSegment (TCP_FLAG_RESET | TCP_FLAG_ACK, 0, nSEG_SEQ+nSEG_LEN);
+		if (   bListening
+		    && (nFlags & (TCP_FLAG_SYN | TCP_FLAG_FIN)) == TCP_FLAG_SYN)
+		{
+			// answer without creating a TCB, data in the SYN is discarded
+			u32 nCookie = CTCPSYNCookie::Generate (rSenderIP, m_nForeignPort, m_nOwnPort,
+							       nSEG_SEQ, GetOfferedMSS (pHeader));
+
+			SendSegment (TCP_FLAG_SYN | TCP_FLAG_ACK, nCookie, nSEG_SEQ+1);
+		}
+		else
+		{
+			SendSegment (TCP_FLAG_RESET | TCP_FLAG_ACK, 0, nSEG_SEQ+nSEG_LEN);
+		}
 	}
 	else
 	{
-		SendSegment (TCP_FLAG_RESET, nSEG_ACK);
+		u16 nMSS;
+		if (   bListening
+		    && !(nFlags & TCP_FLAG_SYN)
+		    && CTCPSYNCookie::Check (rSenderIP, m_nForeignPort, m_nOwnPort,
+					     nSEG_SEQ-1, nSEG_ACK-1, &nMSS))
+		{
+			// handshake completed with a SYN cookie, but the backlog is still
+			// exhausted, the peer will retransmit (or send data) later
+		}
+		else
+		{
+			SendSegment (TCP_FLAG_RESET, nSEG_ACK);
+		}
 	}
 
 	return 1;
@@ -158,16 +213,23 @@ int CTCPRejector::PacketReceived (const void *pPacket, unsigned nLength,
 
 boolean CTCPRejector::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAcknowledgmentNumber)
 {
-	assert (!(nFlags & TCP_FLAG_SYN));
-
 	unsigned nDataOffset = 5;
 	assert (nDataOffset * 4 == sizeof (TTCPHeader));
+	if (nFlags & TCP_FLAG_SYN)
+	{
+		nDataOffset++;		// MSS option
+	}
 
 	unsigned nHeaderLength = nDataOffset * 4;
 	unsigned nPacketLength = nHeaderLength;
-	assert (nHeaderLength <= FRAME_BUFFER_SIZE);
+	assert (nHeaderLength <= IP_PAYLOAD_MAX_LENGTH);
+
+	CNetBuffer *pBuffer = new CNetBuffer (IP_PACKET_HEADROOM);
+	assert (pBuffer != 0);
+	assert (nPacketLength <= pBuffer->GetMaxLength ());
+	pBuffer->SetLength (nPacketLength);
 
-	u8 TxBuffer[FRAME_BUFFER_SIZE];
+	u8 *TxBuffer = (u8 *) pBuffer->GetData ();
 	TTCPHeader *pHeader = (TTCPHeader *) TxBuffer;
 
 	pHeader->nSourcePort	 	= le2be16 (m_nOwnPort);
@@ -175,9 +237,21 @@ boolean CTCPRejector::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAc
 	pHeader->nSequenceNumber 	= le2be32 (nSequenceNumber);
 	pHeader->nAcknowledgmentNumber	= nFlags & TCP_FLAG_ACK ? le2be32 (nAcknowledgmentNumber) : 0;
 	pHeader->nDataOffsetFlags	= (nDataOffset << TCP_DATA_OFFSET_SHIFT) | nFlags;
-	pHeader->nWindow		= 0;
+	pHeader->nWindow		= nFlags & TCP_FLAG_SYN ? le2be16 (TCP_MAX_WINDOW) : 0;
 	pHeader->nUrgentPointer		= 0;
 
+	if (nFlags & TCP_FLAG_SYN)
+	{
+		assert (m_pNetConfig != 0);
+		u16 nMSS = m_pNetConfig->GetMTU () - 40;	// without IP and TCP header
+
+		TTCPOption *pOption = (TTCPOption *) pHeader->Options;
+		pOption->nKind   = TCP_OPTION_MSS;
+		pOption->nLength = 4;
+		pOption->Data[0] = nMSS >> 8;
+		pOption->Data[1] = nMSS & 0xFF;
+	}
+
 	pHeader->nChecksum = 0;		// must be 0 for calculation
 	pHeader->nChecksum = m_Checksum.Calculate (TxBuffer, nPacketLength);
 
@@ -192,10 +266,51 @@ boolean CTCPRejector::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAc
 				nFlags & TCP_FLAG_FIN    ? 'F' : '-',
 				nSequenceNumber,
 				nFlags & TCP_FLAG_ACK ? nAcknowledgmentNumber : 0,
-				0,
+				nFlags & TCP_FLAG_SYN ? TCP_MAX_WINDOW : 0,
 				0);
 #endif
 
 	assert (m_pNetworkLayer != 0);
-	return m_pNetworkLayer->Send (m_ForeignIP, TxBuffer, nPacketLength, IPPROTO_TCP);
+	return m_pNetworkLayer->Send (m_ForeignIP, pBuffer, IPPROTO_TCP);
+}
+
+u16 CTCPRejector::GetOfferedMSS (const TTCPHeader *pHeader)
+{
+	assert (pHeader != 0);
+	unsigned nDataOffset = TCP_DATA_OFFSET (pHeader->nDataOffsetFlags)*4;
+	const u8 *pHeaderEnd = (const u8 *) pHeader+nDataOffset;
+
+	const TTCPOption *pOption = (const TTCPOption *) pHeader->Options;
+	while ((const u8 *) pOption+2 <= pHeaderEnd)
+	{
+		switch (pOption->nKind)
+		{
+		case TCP_OPTION_END_OF_LIST:
+			return TCP_DEFAULT_MSS;
+
+		case TCP_OPTION_NOP:
+			pOption = (const TTCPOption *) ((const u8 *) pOption+1);
+			continue;
+
+		case TCP_OPTION_MSS:
+			if (   pOption->nLength == 4
+			    && (const u8 *) pOption+4 <= pHeaderEnd)
+			{
+				return (u16) pOption->Data[0] << 8 | pOption->Data[1];
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		if (pOption->nLength < 2)
+		{
+			break;
+		}
+
+		pOption = (const TTCPOption *) ((const u8 *) pOption+pOption->nLength);
+	}
+
+	return TCP_DEFAULT_MSS;
 }
@@ -0,0 +1,170 @@
+//
+// tcpsackscoreboard.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpsackscoreboard.h>
+#include <assert.h>
+
+// Modulo 32 sequence number arithmetic
+#define lt(x, y)		((int) ((u32) (x) - (u32) (y)) < 0)
+#define le(x, y)		((int) ((u32) (x) - (u32) (y)) <= 0)
+#define gt(x, y) 		lt (y, x)
+
+CTCPSACKScoreboard::CTCPSACKScoreboard (void)
+:	m_nBlocks (0)
+{
+}
+
+CTCPSACKScoreboard::~CTCPSACKScoreboard (void)
+{
+}
+
+boolean CTCPSACKScoreboard::IsEmpty (void) const
+{
+	return m_nBlocks == 0;
+}
+
+void CTCPSACKScoreboard::Reset (void)
+{
+	m_nBlocks = 0;
+}
+
+void CTCPSACKScoreboard::Add (u32 nLeftEdge, u32 nRightEdge)
+{
+	if (!lt (nLeftEdge, nRightEdge))
+	{
+		return;
+	}
+
+	// remove all blocks, which overlap or touch the new block, and join them
+	unsigned nBlocks = 0;
+	for (unsigned i = 0; i < m_nBlocks; i++)
+	{
+		if (   lt (m_RightEdge[i], nLeftEdge)
+		    || gt (m_LeftEdge[i], nRightEdge))
+		{
+			m_LeftEdge[nBlocks] = m_LeftEdge[i];
+			m_RightEdge[nBlocks] = m_RightEdge[i];
+			nBlocks++;
+
+			continue;
+		}
+
+		if (lt (m_LeftEdge[i], nLeftEdge))
+		{
+			nLeftEdge = m_LeftEdge[i];
+		}
+
+		if (gt (m_RightEdge[i], nRightEdge))
+		{
+			nRightEdge = m_RightEdge[i];
+		}
+	}
+	m_nBlocks = nBlocks;
+
+	unsigned nPos;
+	for (nPos = 0; nPos < m_nBlocks; nPos++)
+	{
+		if (gt (m_LeftEdge[nPos], nLeftEdge))
+		{
+			break;
+		}
+	}
+
+	if (m_nBlocks == TCP_SACK_SCOREBOARD_SIZE)
+	{
+		if (nPos == m_nBlocks)
+		{
+			return;			// forget the highest block
+		}
+
+		m_nBlocks--;
+	}
+
+	for (unsigned i = m_nBlocks; i > nPos; i--)
+	{
+		m_LeftEdge[i] = m_LeftEdge[i-1];
+		m_RightEdge[i] = m_RightEdge[i-1];
+	}
+
+	m_LeftEdge[nPos] = nLeftEdge;
+	m_RightEdge[nPos] = nRightEdge;
+	m_nBlocks++;
+}
+
+void CTCPSACKScoreboard::Acknowledge (u32 nSND_UNA)
+{
+	unsigned nBlocks = 0;
+	for (unsigned i = 0; i < m_nBlocks; i++)
+	{
+		if (le (m_RightEdge[i], nSND_UNA))
+		{
+			continue;
+		}
+
+		m_LeftEdge[nBlocks] = lt (m_LeftEdge[i], nSND_UNA) ? nSND_UNA : m_LeftEdge[i];
+		m_RightEdge[nBlocks] = m_RightEdge[i];
+		nBlocks++;
+	}
+
+	m_nBlocks = nBlocks;
+}
+
+boolean CTCPSACKScoreboard::IsAcknowledged (u32 nSequenceNumber, u32 *pRightEdge) const
+{
+	for (unsigned i = 0; i < m_nBlocks; i++)
+	{
+		if (   le (m_LeftEdge[i], nSequenceNumber)
+		    && lt (nSequenceNumber, m_RightEdge[i]))
+		{
+			assert (pRightEdge != 0);
+			*pRightEdge = m_RightEdge[i];
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+boolean CTCPSACKScoreboard::GetNextBlock (u32 nSequenceNumber, u32 *pLeftEdge) const
+{
+	for (unsigned i = 0; i < m_nBlocks; i++)
+	{
+		if (gt (m_LeftEdge[i], nSequenceNumber))
+		{
+			assert (pLeftEdge != 0);
+			*pLeftEdge = m_LeftEdge[i];
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+u32 CTCPSACKScoreboard::GetBytesAcknowledged (void) const
+{
+	u32 nResult = 0;
+	for (unsigned i = 0; i < m_nBlocks; i++)
+	{
+		nResult += m_RightEdge[i] - m_LeftEdge[i];
+	}
+
+	return nResult;
+}
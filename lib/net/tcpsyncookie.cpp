@@ -0,0 +1,154 @@
+//
+// tcpsyncookie.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpsyncookie.h>
+#include <circle/bcmrandom.h>
+#include <circle/timer.h>
+#include <assert.h>
+
+// Cookie layout
+#define COOKIE_HASH_MASK	0xFFFFFFE0U
+#define COOKIE_COUNTER_SHIFT	2
+#define COOKIE_COUNTER_MASK	0x7
+#define COOKIE_MSS_MASK		0x3
+
+// MSS values, which can be encoded (index in the two lowest bits of the cookie)
+static const u16 s_MSSTable[] = {536, 1220, 1440, 1460};
+
+#define ROTL(x, b)		(((x) << (b)) | ((x) >> (32 - (b))))
+
+#define SIPROUND()						\
+	do							\
+	{							\
+		v0 += v1; v1 = ROTL (v1, 5); v1 ^= v0;		\
+		v0 = ROTL (v0, 16);				\
+		v2 += v3; v3 = ROTL (v3, 8); v3 ^= v2;		\
+		v0 += v3; v3 = ROTL (v3, 7); v3 ^= v0;		\
+		v2 += v1; v1 = ROTL (v1, 13); v1 ^= v2;		\
+		v2 = ROTL (v2, 16);				\
+	}							\
+	while (0)
+
+boolean CTCPSYNCookie::s_bSecretValid = FALSE;
+u32 CTCPSYNCookie::s_Secret[2];
+
+u32 CTCPSYNCookie::Generate (const CIPAddress &rForeignIP, u16 nForeignPort, u16 nOwnPort,
+			     u32 nIRS, u16 nMSS)
+{
+	unsigned nMSSIndex = 0;
+	for (unsigned i = 1; i < sizeof s_MSSTable / sizeof s_MSSTable[0]; i++)
+	{
+		if (s_MSSTable[i] <= nMSS)
+		{
+			nMSSIndex = i;
+		}
+	}
+
+	u32 nCounter = GetCounter ();
+
+	return   (Hash (rForeignIP, nForeignPort, nOwnPort, nIRS, nCounter) & COOKIE_HASH_MASK)
+	       | (nCounter & COOKIE_COUNTER_MASK) << COOKIE_COUNTER_SHIFT
+	       | nMSSIndex;
+}
+
+boolean CTCPSYNCookie::Check (const CIPAddress &rForeignIP, u16 nForeignPort, u16 nOwnPort,
+			      u32 nIRS, u32 nCookie, u16 *pMSS)
+{
+	if (!s_bSecretValid)
+	{
+		return FALSE;
+	}
+
+	// the cookie may have been generated in the current or in the previous period
+	u32 nCounter = GetCounter ();
+	if ((nCounter & COOKIE_COUNTER_MASK) != (nCookie >> COOKIE_COUNTER_SHIFT & COOKIE_COUNTER_MASK))
+	{
+		nCounter--;
+
+		if ((nCounter & COOKIE_COUNTER_MASK) != (nCookie >> COOKIE_COUNTER_SHIFT & COOKIE_COUNTER_MASK))
+		{
+			return FALSE;
+		}
+	}
+
+	if (   (Hash (rForeignIP, nForeignPort, nOwnPort, nIRS, nCounter) & COOKIE_HASH_MASK)
+	    != (nCookie & COOKIE_HASH_MASK))
+	{
+		return FALSE;
+	}
+
+	assert (pMSS != 0);
+	*pMSS = s_MSSTable[nCookie & COOKIE_MSS_MASK];
+
+	return TRUE;
+}
+
+// HalfSipHash-2-4 over the addresses, the sequence number and the time counter
+u32 CTCPSYNCookie::Hash (const CIPAddress &rForeignIP, u16 nForeignPort, u16 nOwnPort,
+			 u32 nIRS, u32 nCounter)
+{
+	if (!s_bSecretValid)
+	{
+		CBcmRandomNumberGenerator Random;
+		Random.GetBytes (s_Secret, sizeof s_Secret);
+
+		s_bSecretValid = TRUE;
+	}
+
+	const u32 Message[] =
+	{
+		(u32) rForeignIP,
+		(u32) nForeignPort << 16 | nOwnPort,
+		nIRS,
+		nCounter
+	};
+
+	u32 v0 = s_Secret[0];
+	u32 v1 = s_Secret[1];
+	u32 v2 = 0x6C796765U ^ s_Secret[0];
+	u32 v3 = 0x74656462U ^ s_Secret[1];
+
+	for (unsigned i = 0; i < sizeof Message / sizeof Message[0]; i++)
+	{
+		v3 ^= Message[i];
+		SIPROUND ();
+		SIPROUND ();
+		v0 ^= Message[i];
+	}
+
+	u32 b = (u32) sizeof Message << 24;
+	v3 ^= b;
+	SIPROUND ();
+	SIPROUND ();
+	v0 ^= b;
+
+	v2 ^= 0xFF;
+	SIPROUND ();
+	SIPROUND ();
+	SIPROUND ();
+	SIPROUND ();
+
+	return v1 ^ v3;
+}
+
+u32 CTCPSYNCookie::GetCounter (void)
+{
+	assert (CTimer::Get () != 0);
+	return CTimer::Get ()->GetUptime () / TCP_SYN_COOKIE_PERIOD_SECS;
+}
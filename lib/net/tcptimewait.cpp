@@ -0,0 +1,293 @@
+//
+// tcptimewait.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcptimewait.h>
+#include <circle/macros.h>
+#include <circle/util.h>
+#include <circle/net/in.h>
+#include <assert.h>
+
+struct TTCPHeader
+{
+	u16 	nSourcePort;
+	u16 	nDestPort;
+	u32	nSequenceNumber;
+	u32	nAcknowledgmentNumber;
+	u16	nDataOffsetFlags;		// following #define(s) are valid without BE()
+#define TCP_DATA_OFFSET(field)	(((field) >> 4) & 0x0F)
+#define TCP_DATA_OFFSET_SHIFT	4
+#define TCP_FLAG_ACK		(1 << 12)
+#define TCP_FLAG_RESET		(1 << 10)
+#define TCP_FLAG_SYN		(1 << 9)
+#define TCP_FLAG_FIN		(1 << 8)
+	u16	nWindow;
+	u16	nChecksum;
+	u16	nUrgentPointer;
+}
+PACKED;
+
+// Modulo 32 sequence number arithmetic
+#define gt(x, y)		((int) ((u32) (x) - (u32) (y)) > 0)
+
+CTCPTimeWaitTable::CTCPTimeWaitTable (CNetConfig *pNetConfig, CNetworkLayer *pNetworkLayer)
+:	CNetConnection (pNetConfig, pNetworkLayer, 0, IPPROTO_TCP),
+	m_nIn (0),
+	m_nOut (0),
+	m_nCount (0),
+	m_pTimer (CTimer::Get ())
+{
+	assert (m_pTimer != 0);
+
+	for (unsigned i = 0; i < TCP_TIMEWAIT_HASH_SIZE; i++)
+	{
+		m_HashBucket[i] = -1;
+	}
+}
+
+CTCPTimeWaitTable::~CTCPTimeWaitTable (void)
+{
+	m_pTimer = 0;
+}
+
+void CTCPTimeWaitTable::Add (const u8 *pForeignIP, u16 nForeignPort, u16 nOwnPort,
+			     u32 nSND_NXT, u32 nRCV_NXT)
+{
+	assert (pForeignIP != 0);
+
+	int nEntry = Lookup (pForeignIP, nForeignPort, nOwnPort);
+	if (nEntry >= 0)
+	{
+		Remove (nEntry);
+	}
+
+	if (m_nCount == TCP_TIMEWAIT_ENTRIES)
+	{
+		if (m_Entry[m_nOut].bValid)
+		{
+			Remove (m_nOut);
+		}
+
+		m_nOut = (m_nOut+1) % TCP_TIMEWAIT_ENTRIES;
+		m_nCount--;
+	}
+
+	TEntry *pEntry = &m_Entry[m_nIn];
+
+	pEntry->bValid = TRUE;
+	memcpy (pEntry->ForeignIP, pForeignIP, IP_ADDRESS_SIZE);
+	pEntry->nForeignPort = nForeignPort;
+	pEntry->nOwnPort = nOwnPort;
+	pEntry->nSND_NXT = nSND_NXT;
+	pEntry->nRCV_NXT = nRCV_NXT;
+	assert (m_pTimer != 0);
+	pEntry->nExpireTicks = m_pTimer->GetTicks () + TCP_TIMEWAIT_HZ;
+
+	unsigned nBucket = GetBucket (pForeignIP, nForeignPort, nOwnPort);
+	pEntry->nHashNext = m_HashBucket[nBucket];
+	m_HashBucket[nBucket] = m_nIn;
+
+	m_nIn = (m_nIn+1) % TCP_TIMEWAIT_ENTRIES;
+	m_nCount++;
+}
+
+int CTCPTimeWaitTable::PacketReceived (const void *pPacket, unsigned nLength,
+				       CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+				       boolean bChecksumOK)
+{
+	if (   nProtocol != IPPROTO_TCP
+	    || m_nCount == 0)
+	{
+		return 0;
+	}
+
+	if (nLength < sizeof (TTCPHeader))
+	{
+		return -1;
+	}
+
+	assert (pPacket != 0);
+	TTCPHeader *pHeader = (TTCPHeader *) pPacket;
+
+	u16 nForeignPort = be2le16 (pHeader->nSourcePort);
+	u16 nOwnPort = be2le16 (pHeader->nDestPort);
+
+	int nEntry = Lookup (rSenderIP.Get (), nForeignPort, nOwnPort);
+	if (nEntry < 0)
+	{
+		return 0;
+	}
+
+	TEntry *pEntry = &m_Entry[nEntry];
+
+	assert (m_pNetConfig != 0);
+	if (m_pNetConfig->GetIPAddress ()->IsNull ())
+	{
+		return 0;
+	}
+
+	m_Checksum.SetSourceAddress (*m_pNetConfig->GetIPAddress ());
+	m_Checksum.SetDestinationAddress (rSenderIP);
+
+	if (   !bChecksumOK
+	    && m_Checksum.Calculate (pPacket, nLength) != CHECKSUM_OK)
+	{
+		return -1;
+	}
+
+	u16 nFlags = pHeader->nDataOffsetFlags;
+	u32 nDataOffset = TCP_DATA_OFFSET (pHeader->nDataOffsetFlags)*4;
+	if (   nDataOffset < sizeof (TTCPHeader)
+	    || nDataOffset > nLength)
+	{
+		return -1;
+	}
+
+	u32 nSEG_SEQ = be2le32 (pHeader->nSequenceNumber);
+
+	if (nFlags & TCP_FLAG_RESET)
+	{
+		// ignore, prevents TIME-WAIT assassination (RFC 1337)
+		return 1;
+	}
+
+	if (   (nFlags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN
+	    && gt (nSEG_SEQ, pEntry->nRCV_NXT))
+	{
+		// new incarnation of the connection (RFC 1122 section 4.2.2.13),
+		// let a listening connection handle it
+		Remove (nEntry);
+
+		return 0;
+	}
+
+	if (   nLength > nDataOffset
+	    || (nFlags & (TCP_FLAG_SYN | TCP_FLAG_FIN)))
+	{
+		// retransmitted FIN or old duplicate, acknowledge it
+		m_ForeignIP.Set (rSenderIP);
+		m_nForeignPort = nForeignPort;
+		m_nOwnPort = nOwnPort;
+
+		SendSegment (TCP_FLAG_ACK, pEntry->nSND_NXT, pEntry->nRCV_NXT);
+	}
+
+	return 1;
+}
+
+void CTCPTimeWaitTable::Process (void)
+{
+	assert (m_pTimer != 0);
+	unsigned nTicks = m_pTimer->GetTicks ();
+
+	while (   m_nCount > 0
+	       && (   !m_Entry[m_nOut].bValid
+		   || (int) (nTicks - m_Entry[m_nOut].nExpireTicks) >= 0))
+	{
+		if (m_Entry[m_nOut].bValid)
+		{
+			Remove (m_nOut);
+		}
+
+		m_nOut = (m_nOut+1) % TCP_TIMEWAIT_ENTRIES;
+		m_nCount--;
+	}
+}
+
+int CTCPTimeWaitTable::Lookup (const u8 *pForeignIP, u16 nForeignPort, u16 nOwnPort) const
+{
+	for (int nEntry = m_HashBucket[GetBucket (pForeignIP, nForeignPort, nOwnPort)];
+	     nEntry >= 0;
+	     nEntry = m_Entry[nEntry].nHashNext)
+	{
+		const TEntry *pEntry = &m_Entry[nEntry];
+		assert (pEntry->bValid);
+
+		if (   pEntry->nForeignPort == nForeignPort
+		    && pEntry->nOwnPort == nOwnPort
+		    && memcmp (pEntry->ForeignIP, pForeignIP, IP_ADDRESS_SIZE) == 0)
+		{
+			return nEntry;
+		}
+	}
+
+	return -1;
+}
+
+// the ring buffer slot is freed later in Add() or Process()
+void CTCPTimeWaitTable::Remove (unsigned nEntry)
+{
+	assert (nEntry < TCP_TIMEWAIT_ENTRIES);
+	TEntry *pEntry = &m_Entry[nEntry];
+	assert (pEntry->bValid);
+
+	int *pLink = &m_HashBucket[GetBucket (pEntry->ForeignIP, pEntry->nForeignPort,
+					      pEntry->nOwnPort)];
+	while (*pLink != (int) nEntry)
+	{
+		assert (*pLink >= 0);
+		pLink = &m_Entry[*pLink].nHashNext;
+	}
+
+	*pLink = pEntry->nHashNext;
+
+	pEntry->bValid = FALSE;
+}
+
+unsigned CTCPTimeWaitTable::GetBucket (const u8 *pForeignIP, u16 nForeignPort, u16 nOwnPort)
+{
+	assert (pForeignIP != 0);
+	u32 nHash =   ((u32) pForeignIP[0] << 24 | (u32) pForeignIP[1] << 16
+		     | (u32) pForeignIP[2] << 8  | pForeignIP[3])
+		    ^ ((u32) nForeignPort << 16 | nOwnPort);
+
+	nHash *= 0x9E3779B1U;			// multiplicative hashing (golden ratio)
+
+	return nHash % TCP_TIMEWAIT_HASH_SIZE;
+}
+
+boolean CTCPTimeWaitTable::SendSegment (unsigned nFlags, u32 nSequenceNumber,
+					u32 nAcknowledgmentNumber)
+{
+	unsigned nDataOffset = 5;
+	assert (nDataOffset * 4 == sizeof (TTCPHeader));
+
+	unsigned nPacketLength = nDataOffset * 4;
+
+	CNetBuffer *pBuffer = new CNetBuffer (IP_PACKET_HEADROOM);
+	assert (pBuffer != 0);
+	assert (nPacketLength <= pBuffer->GetMaxLength ());
+	pBuffer->SetLength (nPacketLength);
+
+	u8 *TxBuffer = (u8 *) pBuffer->GetData ();
+	TTCPHeader *pHeader = (TTCPHeader *) TxBuffer;
+
+	pHeader->nSourcePort	 	= le2be16 (m_nOwnPort);
+	pHeader->nDestPort	 	= le2be16 (m_nForeignPort);
+	pHeader->nSequenceNumber 	= le2be32 (nSequenceNumber);
+	pHeader->nAcknowledgmentNumber	= le2be32 (nAcknowledgmentNumber);
+	pHeader->nDataOffsetFlags	= (nDataOffset << TCP_DATA_OFFSET_SHIFT) | nFlags;
+	pHeader->nWindow		= 0;
+	pHeader->nUrgentPointer		= 0;
+
+	pHeader->nChecksum = 0;		// must be 0 for calculation
+	pHeader->nChecksum = m_Checksum.Calculate (TxBuffer, nPacketLength);
+
+	assert (m_pNetworkLayer != 0);
+	return m_pNetworkLayer->Send (m_ForeignIP, pBuffer, IPPROTO_TCP);
+}
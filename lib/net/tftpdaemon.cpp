@@ -2,7 +2,7 @@
 // tftpdaemon.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,6 +22,7 @@
 #include <circle/net/in.h>
 #include <circle/sched/scheduler.h>
 #include <circle/logger.h>
+#include <circle/string.h>
 #include <circle/timer.h>
 #include <circle/util.h>
 #include <circle/macros.h>
@@ -31,6 +32,17 @@
 
 #define RECEIVE_TIMEOUT_HZ	(5 * HZ)
 #define MAX_TIMEOUT_HZ		(25 * HZ)
+#define OACK_RETRANS_HZ		HZ
+
+#define DEFAULT_BLOCK_SIZE	512
+#define MIN_BLOCK_SIZE		8		// RFC 2348
+#define MAX_BLOCK_SIZE		1468		// no IP fragmentation, must fit into Ethernet frame
+#define MAX_WINDOW_SIZE		16		// RFC 7440
+
+#define WRITE_CHUNK_SIZE	0x8000		// multiple of the usual FAT cluster sizes
+#define TRANSFER_BUFFER_SIZE	WRITE_CHUNK_SIZE
+
+#define MAX_OPTION_ACK_LEN	64
 
 struct TTFTPReqPacket
 {
@@ -41,8 +53,8 @@ struct TTFTPReqPacket
 #define MAX_FILENAME_LEN	128
 #define MAX_MODE_LEN		16
 #define MIN_FILENAME_MODE_LEN	(1+1+1+1)
-#define MAX_FILENAME_MODE_LEN	(MAX_FILENAME_LEN+1+MAX_MODE_LEN+1)
-	char	FileNameMode[MAX_FILENAME_MODE_LEN];
+#define MAX_REQUEST_LEN		512		// file name, mode and options
+	char	FileNameMode[MAX_REQUEST_LEN];
 }
 PACKED;
 
@@ -52,11 +64,13 @@ struct TTFTPDataPacket
 #define OP_CODE_DATA		3
 
 	u16	BlockNumber;
-#define MAX_DATA_LEN		512
+#define MAX_DATA_LEN		MAX_BLOCK_SIZE
 	u8	Data[MAX_DATA_LEN];
 }
 PACKED;
 
+#define DATA_HEADER_LEN		(sizeof (u16) + sizeof (u16))
+
 struct TTFTPAckPacket
 {
 	u16	OpCode;
@@ -86,6 +100,15 @@ struct TTFTPErrorPacket
 }
 PACKED;
 
+struct TTFTPOptionAckPacket
+{
+	u16	OpCode;
+#define OP_CODE_OACK		6
+
+	char	Options[MAX_OPTION_ACK_LEN-sizeof (u16)];	// pairs of option name and value
+}
+PACKED;
+
 typedef unsigned TIMER;
 #define START_TIMER(timer)		((timer) = CTimer::Get ()->GetTicks ())
 #define TIMER_EXPIRED(timer, timeout)	(CTimer::Get ()->GetTicks () - (timer) >= (timeout))
@@ -95,8 +118,17 @@ static const char FromTFPTDaemon[] = "tftpd";
 CTFTPDaemon::CTFTPDaemon (CNetSubSystem *pNetSubSystem)
 :	m_pNetSubSystem (pNetSubSystem),
 	m_pRequestSocket (0),
-	m_pTransferSocket (0)
+	m_pTransferSocket (0),
+	m_nBlockSize (DEFAULT_BLOCK_SIZE),
+	m_nWindowSize (1),
+	m_pOptionAck (new u8[MAX_OPTION_ACK_LEN]),
+	m_nOptionAckLength (0),
+	m_pBuffer (new u8[TRANSFER_BUFFER_SIZE]),
+	m_nBufferFill (0)
 {
+	assert (m_pOptionAck != 0);
+	assert (m_pBuffer != 0);
+
 	SetName (FromTFPTDaemon);
 }
 
@@ -108,6 +140,12 @@ CTFTPDaemon::~CTFTPDaemon (void)
 	delete m_pRequestSocket;
 	m_pRequestSocket = 0;
 
+	delete [] m_pBuffer;
+	m_pBuffer = 0;
+
+	delete [] m_pOptionAck;
+	m_pOptionAck = 0;
+
 	m_pNetSubSystem = 0;
 }
 
@@ -168,9 +206,9 @@ void CTFTPDaemon::Run (void)
 		}
 
 		const char *pMode = pFileName+nNameLen+1;
-		if (   strcmp (pMode, "octet") != 0
-		    && strcmp (pMode, "Octet") != 0
-		    && strcmp (pMode, "OCTET") != 0)
+		size_t nModeLen = strlen (pMode);
+		if (   nModeLen > MAX_MODE_LEN
+		    || strcasecmp (pMode, "octet") != 0)
 		{
 			SendError (ERROR_CODE_OTHER, "Binary mode supported only",
 				   &ForeignIP, usForeignPort);
@@ -178,11 +216,17 @@ void CTFTPDaemon::Run (void)
 			continue;
 		}
 
+		// options follow the mode (RFC 2347)
+		int nOptionsLength = nLength - (int) (nNameLen+1 + nModeLen+1);
+		m_nOptionAckLength = ParseOptions (pMode+nModeLen+1,
+						   nOptionsLength > 0 ? (unsigned) nOptionsLength : 0);
+
 		CString IPString;
 		ForeignIP.Format (&IPString);
-		CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Incoming %s request from %s",
+		CLogger::Get ()->Write (FromTFPTDaemon, LogDebug,
+					"Incoming %s request from %s (blksize %u, windowsize %u)",
 					usOpCode == OP_CODE_RRQ ? "read" : "write",
-					(const char *) IPString);
+					(const char *) IPString, m_nBlockSize, m_nWindowSize);
 
 		assert (m_pTransferSocket == 0);
 		m_pTransferSocket = new CSocket (m_pNetSubSystem, IPPROTO_UDP);
@@ -240,37 +284,67 @@ boolean CTFTPDaemon::DoRead (const char *pFileName)
 		return FALSE;
 	}
 
+	if (   m_nOptionAckLength > 0
+	    && !SendOptionAck ())
+	{
+		FileClose ();
+
+		return FALSE;
+	}
+
 	CRetransmissionTimeoutCalculator RTCalc;
 	RTCalc.Initialize (0);
 
-	int nDataLength = MAX_DATA_LEN;
-	for (u16 usBlockNumber = 1; nDataLength == MAX_DATA_LEN; usBlockNumber++)
-	{
-		TTFTPDataPacket DataPacket;
-		DataPacket.OpCode = BE (OP_CODE_DATA);
-		DataPacket.BlockNumber = le2be16 (usBlockNumber);
+	// The window holds the data packets, which have not been acknowledged yet. Blocks are
+	// counted with 32-bit sequence numbers, the block number on the wire wraps around.
+	unsigned nSlotSize = DATA_HEADER_LEN + m_nBlockSize;
+	assert (m_nWindowSize * nSlotSize <= TRANSFER_BUFFER_SIZE);
+	unsigned PacketLength[MAX_WINDOW_SIZE];
+
+	u32 nBase = 1;			// first block not acknowledged
+	u32 nNext = 1;			// next block to be sent
+	u32 nRead = 1;			// next block to be read from file
+	u32 nLast = 0;			// last block of the file (0 if not known yet)
 
-		nDataLength = FileRead (DataPacket.Data, MAX_DATA_LEN);
-		if (nDataLength < 0)
+	TIMER TransferTimer;
+	START_TIMER (TransferTimer);
+	while (nLast == 0 || nBase <= nLast)
+	{
+		// send the window
+		while (   nNext < nBase + m_nWindowSize
+		       && (nLast == 0 || nNext <= nLast))
 		{
-			CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot read");
+			unsigned nSlot = nNext % m_nWindowSize;
+			TTFTPDataPacket *pPacket = (TTFTPDataPacket *) (m_pBuffer + nSlot * nSlotSize);
 
-			SendError (ERROR_CODE_OTHER, "Error reading file");
+			if (nNext == nRead)
+			{
+				pPacket->OpCode = BE (OP_CODE_DATA);
+				pPacket->BlockNumber = le2be16 ((u16) nNext);
 
-			FileClose ();
+				int nDataLength = FileRead (pPacket->Data, m_nBlockSize);
+				if (nDataLength < 0)
+				{
+					CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot read");
 
-			return FALSE;
-		}
+					SendError (ERROR_CODE_OTHER, "Error reading file");
 
-		unsigned nPacketLength =   sizeof DataPacket.OpCode
-					 + sizeof DataPacket.BlockNumber
-					 + nDataLength;
+					FileClose ();
 
-		TIMER TransferTimer;
-		START_TIMER (TransferTimer);
-		while (!TIMER_EXPIRED (TransferTimer, MAX_TIMEOUT_HZ))
-		{
-			if (m_pTransferSocket->Send (&DataPacket, nPacketLength, MSG_DONTWAIT) < 0)
+					return FALSE;
+				}
+
+				PacketLength[nSlot] = DATA_HEADER_LEN + nDataLength;
+
+				if ((unsigned) nDataLength < m_nBlockSize)
+				{
+					nLast = nNext;
+				}
+
+				nRead++;
+			}
+
+			if (m_pTransferSocket->Send (pPacket, PacketLength[nSlot], MSG_DONTWAIT) < 0)
 			{
 				CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send data");
 
@@ -279,54 +353,83 @@ boolean CTFTPDaemon::DoRead (const char *pFileName)
 				return FALSE;
 			}
 
-			RTCalc.SegmentSent ((u32) (usBlockNumber-1) * MAX_DATA_LEN, nDataLength);
+			RTCalc.SegmentSent ((nNext-1) * m_nBlockSize,
+					    PacketLength[nSlot] - DATA_HEADER_LEN);
 
-			TIMER ReceiveTimer;
-			START_TIMER (ReceiveTimer);
-			while (!TIMER_EXPIRED (ReceiveTimer, RTCalc.GetRTO ()))
-			{
-				CScheduler::Get ()->Yield ();
+			nNext++;
+		}
 
-				TTFTPAckPacket AckPacket;
-				int nResult = m_pTransferSocket->Receive (&AckPacket, sizeof AckPacket,
-									  MSG_DONTWAIT);
-				if (nResult < 0)
-				{
-					CLogger::Get ()->Write (FromTFPTDaemon, LogError,
-								"Cannot receive ACK");
+		// wait for the ACK of the window
+		boolean bAcknowledged = FALSE;
 
-					FileClose ();
+		TIMER ReceiveTimer;
+		START_TIMER (ReceiveTimer);
+		while (!TIMER_EXPIRED (ReceiveTimer, RTCalc.GetRTO ()))
+		{
+			CScheduler::Get ()->Yield ();
 
-					return FALSE;
-				}
+			TTFTPAckPacket AckPacket;
+			int nResult = m_pTransferSocket->Receive (&AckPacket, sizeof AckPacket,
+								  MSG_DONTWAIT);
+			if (nResult < 0)
+			{
+				CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot receive ACK");
 
-				if (   nResult == sizeof AckPacket
-				    || AckPacket.OpCode == BE (OP_CODE_ACK)
-				    || AckPacket.BlockNumber == le2be16 (usBlockNumber))
-				{
-					break;
-				}
+				FileClose ();
+
+				return FALSE;
 			}
 
-			if (!TIMER_EXPIRED (ReceiveTimer, RTCalc.GetRTO ()))
+			if (   nResult >= (int) sizeof AckPacket.OpCode
+			    && AckPacket.OpCode == BE (OP_CODE_ERROR))
 			{
-				RTCalc.SegmentAcknowledged ((u32) (usBlockNumber-1) * MAX_DATA_LEN);
+				CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Transfer aborted");
 
-				break;
+				FileClose ();
+
+				return FALSE;
 			}
-			else
+
+			if (   nResult == sizeof AckPacket
+			    && AckPacket.OpCode == BE (OP_CODE_ACK))
 			{
-				RTCalc.RetransmissionTimerExpired ();
+				u16 usBlockNumber = be2le16 (AckPacket.BlockNumber);
+				u32 nAcked = nBase-1 + (u16) (usBlockNumber - (u16) (nBase-1));
+				if (   nAcked >= nBase
+				    && nAcked < nNext)
+				{
+					nBase = nAcked+1;
+
+					RTCalc.SegmentAcknowledged (nAcked * m_nBlockSize);
+
+					bAcknowledged = TRUE;
+
+					break;
+				}
 			}
 		}
 
-		if (TIMER_EXPIRED (TransferTimer, MAX_TIMEOUT_HZ))
+		if (bAcknowledged)
 		{
-			CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Transfer timed out");
+			// an ACK inside the window means, that the following blocks have been lost
+			nNext = nBase;
 
-			FileClose ();
+			START_TIMER (TransferTimer);
+		}
+		else
+		{
+			RTCalc.RetransmissionTimerExpired ();
 
-			return FALSE;
+			nNext = nBase;
+
+			if (TIMER_EXPIRED (TransferTimer, MAX_TIMEOUT_HZ))
+			{
+				CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Transfer timed out");
+
+				FileClose ();
+
+				return FALSE;
+			}
 		}
 	}
 
@@ -342,10 +445,25 @@ boolean CTFTPDaemon::DoWrite (const char *pFileName)
 	assert (pFileName != 0);
 	if (FileCreate (pFileName))
 	{
-		TTFTPAckPacket AckPacket;
-		AckPacket.OpCode = BE (OP_CODE_ACK);
-		AckPacket.BlockNumber = 0;
-		if (m_pTransferSocket->Send (&AckPacket, sizeof AckPacket, MSG_DONTWAIT) < 0)
+		m_nBufferFill = 0;
+
+		// the OACK replaces the ACK of block 0
+		int nResult;
+		if (m_nOptionAckLength > 0)
+		{
+			nResult = m_pTransferSocket->Send (m_pOptionAck, m_nOptionAckLength,
+							   MSG_DONTWAIT);
+		}
+		else
+		{
+			TTFTPAckPacket AckPacket;
+			AckPacket.OpCode = BE (OP_CODE_ACK);
+			AckPacket.BlockNumber = 0;
+			nResult = m_pTransferSocket->Send (&AckPacket, sizeof AckPacket,
+							   MSG_DONTWAIT);
+		}
+
+		if (nResult < 0)
 		{
 			CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send ACK");
 
@@ -365,58 +483,66 @@ boolean CTFTPDaemon::DoWrite (const char *pFileName)
 	// After the first data packet has been received, use a longer time-out.
 	unsigned nTimeout = RECEIVE_TIMEOUT_HZ;
 
-	int nLength = MAX_DATA_LEN;
-	for (u16 usBlockNumber = 1; nLength == MAX_DATA_LEN; usBlockNumber++)
+	// Blocks are acknowledged at the end of each window. If a block is missing, the last
+	// block received in order is acknowledged once, so that the sender continues from there.
+	u32 nExpected = 1;
+	unsigned nInWindow = 0;
+	boolean bGapAcknowledged = FALSE;
+
+	int nLength = m_nBlockSize;
+	while (nLength == (int) m_nBlockSize)
 	{
 		TTFTPDataPacket DataPacket;
+		int nDataLength;
 		do
 		{
+			TIMER ReceiveTimer;
+			START_TIMER (ReceiveTimer);
+
+			int nResult;
 			do
 			{
-				TIMER ReceiveTimer;
-				START_TIMER (ReceiveTimer);
-
-				int nResult;
-				do
+				if (TIMER_EXPIRED (ReceiveTimer, nTimeout))
 				{
-					if (TIMER_EXPIRED (ReceiveTimer, nTimeout))
-					{
-						CLogger::Get ()->Write (FromTFPTDaemon, LogDebug,
-									"Transfer timed out");
+					CLogger::Get ()->Write (FromTFPTDaemon, LogDebug,
+								"Transfer timed out");
 
-						FileClose ();
+					FileClose ();
 
-						return FALSE;
-					}
+					return FALSE;
+				}
 
-					CScheduler::Get ()->Yield ();
+				CScheduler::Get ()->Yield ();
 
-					nResult = m_pTransferSocket->Receive (&DataPacket,
-									      sizeof DataPacket,
-									      MSG_DONTWAIT);
-					if (nResult < 0)
-					{
-						CLogger::Get ()->Write (FromTFPTDaemon, LogError,
-									"Cannot receive data");
+				nResult = m_pTransferSocket->Receive (&DataPacket, sizeof DataPacket,
+								      MSG_DONTWAIT);
+				if (nResult < 0)
+				{
+					CLogger::Get ()->Write (FromTFPTDaemon, LogError,
+								"Cannot receive data");
 
-						FileClose ();
+					FileClose ();
 
-						return FALSE;
-					}
+					return FALSE;
 				}
-				while (nResult == 0);
-
-				nLength = nResult - (  sizeof DataPacket.OpCode
-						     + sizeof DataPacket.BlockNumber);
 			}
-			while (   nLength < 0
-			       || DataPacket.OpCode != BE (OP_CODE_DATA));
+			while (nResult == 0);
+
+			nDataLength = nResult - DATA_HEADER_LEN;
+		}
+		while (   nDataLength < 0
+		       || nDataLength > (int) m_nBlockSize
+		       || DataPacket.OpCode != BE (OP_CODE_DATA));
 
-			if ((int) (usBlockNumber - be2le16 (DataPacket.BlockNumber)) >= 0)
+		u16 usBlockNumber = be2le16 (DataPacket.BlockNumber);
+		if (usBlockNumber != (u16) nExpected)
+		{
+			// duplicate or out of order
+			if (!bGapAcknowledged)
 			{
 				TTFTPAckPacket AckPacket;
 				AckPacket.OpCode = BE (OP_CODE_ACK);
-				AckPacket.BlockNumber = DataPacket.BlockNumber;
+				AckPacket.BlockNumber = le2be16 ((u16) (nExpected-1));
 				if (m_pTransferSocket->Send (&AckPacket, sizeof AckPacket,
 							     MSG_DONTWAIT) < 0)
 				{
@@ -427,22 +553,49 @@ boolean CTFTPDaemon::DoWrite (const char *pFileName)
 
 					return FALSE;
 				}
+
+				bGapAcknowledged = m_nWindowSize > 1;
 			}
+
+			nInWindow = 0;
+
+			continue;
 		}
-		while (DataPacket.BlockNumber != le2be16 (usBlockNumber));
 
-		if (nLength > 0)
+		nLength = nDataLength;
+		nExpected++;
+		bGapAcknowledged = FALSE;
+
+		if (   (   nLength > 0
+			&& !WriteData (DataPacket.Data, (unsigned) nLength))
+		    || (   nLength < (int) m_nBlockSize
+			&& !FlushData ()))
 		{
-			if (FileWrite (DataPacket.Data, (unsigned) nLength) != nLength)
-			{
-				CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot write");
+			CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot write");
+
+			SendError (ERROR_CODE_DISK_FULL, "Disk full");
+
+			FileClose ();
+
+			return FALSE;
+		}
 
-				SendError (ERROR_CODE_DISK_FULL, "Disk full");
+		if (   ++nInWindow == m_nWindowSize
+		    || nLength < (int) m_nBlockSize)
+		{
+			TTFTPAckPacket AckPacket;
+			AckPacket.OpCode = BE (OP_CODE_ACK);
+			AckPacket.BlockNumber = DataPacket.BlockNumber;
+			if (m_pTransferSocket->Send (&AckPacket, sizeof AckPacket, MSG_DONTWAIT) < 0)
+			{
+				CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send ACK");
 
 				FileClose ();
 
 				return FALSE;
 			}
+
+			nInWindow = 0;
 		}
 
 		nTimeout = MAX_TIMEOUT_HZ;
@@ -453,6 +606,177 @@ boolean CTFTPDaemon::DoWrite (const char *pFileName)
 	return TRUE;
 }
 
+unsigned CTFTPDaemon::ParseOptions (const char *pOptions, unsigned nLength)
+{
+	m_nBlockSize = DEFAULT_BLOCK_SIZE;
+	m_nWindowSize = 1;
+
+	TTFTPOptionAckPacket *pOptionAck = (TTFTPOptionAckPacket *) m_pOptionAck;
+	pOptionAck->OpCode = BE (OP_CODE_OACK);
+	unsigned nAckLength = 0;
+
+	assert (pOptions != 0);
+	while (nLength > 0)
+	{
+		const char *pName = pOptions;
+		size_t nNameLen = strlen (pName);
+		if (nNameLen == 0 || nNameLen+1 >= nLength)
+		{
+			break;
+		}
+
+		const char *pValue = pName + nNameLen+1;
+		size_t nValueLen = strlen (pValue);
+		if (nNameLen+1 + nValueLen+1 > nLength)
+		{
+			break;
+		}
+
+		pOptions += nNameLen+1 + nValueLen+1;
+		nLength -= nNameLen+1 + nValueLen+1;
+
+		char *pEnd = 0;
+		unsigned long ulValue = strtoul (pValue, &pEnd, 10);
+		if (   pEnd == 0
+		    || *pEnd != '\0')
+		{
+			continue;
+		}
+
+		// unknown options are ignored (RFC 2347)
+		unsigned nValue;
+		if (   strcasecmp (pName, "blksize") == 0
+		    && ulValue >= MIN_BLOCK_SIZE)
+		{
+			nValue = ulValue < MAX_BLOCK_SIZE ? (unsigned) ulValue : MAX_BLOCK_SIZE;
+			m_nBlockSize = nValue;
+		}
+		else if (   strcasecmp (pName, "windowsize") == 0
+			 && ulValue >= 1)
+		{
+			nValue = ulValue < MAX_WINDOW_SIZE ? (unsigned) ulValue : MAX_WINDOW_SIZE;
+			m_nWindowSize = nValue;
+		}
+		else
+		{
+			continue;
+		}
+
+		CString Value;
+		Value.Format ("%u", nValue);
+		if (  nAckLength + nNameLen+1 + Value.GetLength ()+1
+		    > sizeof pOptionAck->Options)
+		{
+			break;
+		}
+
+		strcpy (pOptionAck->Options + nAckLength, pName);
+		nAckLength += nNameLen+1;
+		strcpy (pOptionAck->Options + nAckLength, Value);
+		nAckLength += Value.GetLength ()+1;
+	}
+
+	return nAckLength > 0 ? sizeof pOptionAck->OpCode + nAckLength : 0;
+}
+
+boolean CTFTPDaemon::SendOptionAck (void)
+{
+	assert (m_pTransferSocket != 0);
+	assert (m_nOptionAckLength > 0);
+
+	TIMER TransferTimer;
+	START_TIMER (TransferTimer);
+	while (!TIMER_EXPIRED (TransferTimer, MAX_TIMEOUT_HZ))
+	{
+		if (m_pTransferSocket->Send (m_pOptionAck, m_nOptionAckLength, MSG_DONTWAIT) < 0)
+		{
+			CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send OACK");
+
+			return FALSE;
+		}
+
+		TIMER ReceiveTimer;
+		START_TIMER (ReceiveTimer);
+		while (!TIMER_EXPIRED (ReceiveTimer, OACK_RETRANS_HZ))
+		{
+			CScheduler::Get ()->Yield ();
+
+			TTFTPAckPacket AckPacket;
+			int nResult = m_pTransferSocket->Receive (&AckPacket, sizeof AckPacket,
+								  MSG_DONTWAIT);
+			if (nResult < 0)
+			{
+				CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot receive ACK");
+
+				return FALSE;
+			}
+
+			// the client rejects the options with an error packet
+			if (   nResult >= (int) sizeof AckPacket.OpCode
+			    && AckPacket.OpCode == BE (OP_CODE_ERROR))
+			{
+				return FALSE;
+			}
+
+			if (   nResult == sizeof AckPacket
+			    && AckPacket.OpCode == BE (OP_CODE_ACK)
+			    && AckPacket.BlockNumber == 0)
+			{
+				return TRUE;
+			}
+		}
+	}
+
+	CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Transfer timed out");
+
+	return FALSE;
+}
+
+boolean CTFTPDaemon::WriteData (const void *pBuffer, unsigned nCount)
+{
+	const u8 *pData = (const u8 *) pBuffer;
+	while (nCount > 0)
+	{
+		unsigned nBytes = WRITE_CHUNK_SIZE - m_nBufferFill;
+		if (nBytes > nCount)
+		{
+			nBytes = nCount;
+		}
+
+		assert (m_pBuffer != 0);
+		memcpy (m_pBuffer + m_nBufferFill, pData, nBytes);
+		m_nBufferFill += nBytes;
+		pData += nBytes;
+		nCount -= nBytes;
+
+		if (   m_nBufferFill == WRITE_CHUNK_SIZE
+		    && !FlushData ())
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+boolean CTFTPDaemon::FlushData (void)
+{
+	if (m_nBufferFill == 0)
+	{
+		return TRUE;
+	}
+
+	assert (m_pBuffer != 0);
+	if (FileWrite (m_pBuffer, m_nBufferFill) != (int) m_nBufferFill)
+	{
+		return FALSE;
+	}
+
+	m_nBufferFill = 0;
+
+	return TRUE;
+}
+
 void CTFTPDaemon::SendError (u16 usErrorCode, const char *pErrorMessage, CIPAddress *pSendTo, u16 usPort)
 {
 	TTFTPErrorPacket ErrorPacket;
@@ -2,7 +2,7 @@
 // transportlayer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,6 +20,7 @@
 #include <circle/net/transportlayer.h>
 #include <circle/net/tcpconnection.h>
 #include <circle/net/udpconnection.h>
+#include <circle/net/netstatistics.h>
 #include <circle/net/in.h>
 #include <circle/macros.h>
 #include <assert.h>
@@ -32,54 +33,70 @@ CTransportLayer::CTransportLayer (CNetConfig *pNetConfig, CNetworkLayer *pNetwor
 	m_pNetworkLayer (pNetworkLayer),
 	m_nOwnPort (OWN_PORT_MIN),
 	m_SpinLock (TASK_LEVEL),
-	m_TCPRejector (pNetConfig, pNetworkLayer)
+	m_ppHashBucket (0),
+	m_pActiveHead (0),
+	m_pActiveTail (0),
+	m_nActiveCount (0),
+	m_TCPRejector (pNetConfig, pNetworkLayer),
+	m_TCPTimeWait (pNetConfig, pNetworkLayer)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
+
+	for (unsigned i = 0; i < TRANSPORT_MAX_LISTEN_PORTS; i++)
+	{
+		m_ListenPort[i].nPort = 0;
+		m_ListenPort[i].nCount = 0;
+	}
 }
 
 CTransportLayer::~CTransportLayer (void)
 {
+	delete [] m_ppHashBucket;
+	m_ppHashBucket = 0;
+
 	m_pNetworkLayer = 0;
 	m_pNetConfig = 0;
 }
 
 boolean CTransportLayer::Initialize (void)
 {
+	m_ppHashBucket = new CNetConnection *[2*TRANSPORT_HASH_SIZE];
+	assert (m_ppHashBucket != 0);
+
+	for (unsigned i = 0; i < 2*TRANSPORT_HASH_SIZE; i++)
+	{
+		m_ppHashBucket[i] = 0;
+	}
+
 	return TRUE;
 }
 
 void CTransportLayer::Process (void)
 {
-	unsigned nResultLength;
 	CIPAddress Sender;
 	CIPAddress Receiver;
 	int nProtocol;
 	assert (m_pNetworkLayer != 0);
-	u8 Buffer[FRAME_BUFFER_SIZE];
-	while (m_pNetworkLayer->Receive (Buffer, &nResultLength, &Sender, &Receiver, &nProtocol))
+	CNetBuffer *pBuffer;
+	while ((pBuffer = m_pNetworkLayer->Receive (&Sender, &Receiver, &nProtocol)) != 0)
 	{
-		unsigned i;
-		for (i = 0; i < m_pConnection.GetCount (); i++)
-		{
-			if (m_pConnection[i] == 0)
-			{
-				continue;
-			}
-
-			if (((CNetConnection *) m_pConnection[i])->PacketReceived (
-				Buffer, nResultLength, Sender, Receiver, nProtocol) != 0)
-			{
-				break;
-			}
-		}
+		boolean bChecksumOK = !!(pBuffer->GetOffloadFlags () & NET_OFFLOAD_RX_CHECKSUM);
 
-		if (i >= m_pConnection.GetCount ())
+		if (!PacketReceived (pBuffer->GetData (), pBuffer->GetLength (),
+				     Sender, Receiver, nProtocol, bChecksumOK))
 		{
-			// send RESET on not consumed TCP segment
-			m_TCPRejector.PacketReceived (Buffer, nResultLength,
-						      Sender, Receiver, nProtocol);
+			NET_STAT_INC (NetCounterTransportRxUnhandled);
+
+			// send RESET on not consumed TCP segment (or a SYN cookie, if the
+			// backlog of a listening socket is exhausted)
+			m_TCPRejector.PacketReceived (pBuffer->GetData (), pBuffer->GetLength (),
+						      Sender, Receiver, nProtocol, bChecksumOK,
+						      IsListenPort (pBuffer->GetData (),
+								    pBuffer->GetLength ()));
 		}
+
+		pBuffer->Release ();
 	}
 
 	TICMPNotificationType Type;
@@ -88,38 +105,53 @@ void CTransportLayer::Process (void)
 	while (m_pNetworkLayer->ReceiveNotification (&Type, &Sender, &Receiver,
 						     &nSendPort, &nReceivePort, &nProtocol))
 	{
-		unsigned i;
-		for (i = 0; i < m_pConnection.GetCount (); i++)
+		NotificationReceived (Type, Sender, Receiver, nSendPort, nReceivePort, nProtocol);
+	}
+
+	// connections, which are activated again, are processed on the next call
+	for (unsigned nCount = m_nActiveCount; nCount > 0; nCount--)
+	{
+		CNetConnection *pConnection = GetActive ();
+		if (pConnection == 0)
+		{
+			break;
+		}
+
+		if (!pConnection->IsTerminated ())
 		{
-			if (m_pConnection[i] == 0)
+			pConnection->Process ();
+
+			// only the sequence numbers are needed in TIME-WAIT state
+			u32 nSND_NXT, nRCV_NXT;
+			if (   pConnection->GetProtocol () == IPPROTO_TCP
+			    && ((CTCPConnection *) pConnection)->ReleaseTimeWait (&nSND_NXT, &nRCV_NXT))
 			{
+				m_TCPTimeWait.Add (pConnection->GetForeignIP (),
+						   pConnection->GetForeignPort (),
+						   pConnection->GetOwnPort (), nSND_NXT, nRCV_NXT);
+
+				RemoveConnection (pConnection);
+
 				continue;
 			}
 
-			if (((CNetConnection *) m_pConnection[i])->NotificationReceived (
-				Type, Sender, Receiver, nSendPort, nReceivePort, nProtocol) != 0)
+			UpdateHash (pConnection);
+
+			pConnection->NotifyPoll ();
+
+			if (pConnection->IsProcessPending ())
 			{
-				break;
+				Activate (pConnection);
 			}
 		}
-	}
-
-	for (unsigned i = 0; i < m_pConnection.GetCount (); i++)
-	{
-		if (m_pConnection[i] != 0)
+		else
 		{
-			if (!((CNetConnection *) m_pConnection[i])->IsTerminated ())
-			{			
-				((CNetConnection *) m_pConnection[i])->Process ();
-			}
-			else
-			{
-				delete (CNetConnection *) m_pConnection[i];
-				m_pConnection[i] = 0;
-			}
+			RemoveConnection (pConnection);
 		}
 	}
 
+	m_TCPTimeWait.Process ();
+
 	m_SpinLock.Acquire ();
 
 	// shrink m_pConnection
@@ -172,8 +204,9 @@ int CTransportLayer::Bind (u16 nOwnPort, int nProtocol)
 
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
-	m_pConnection[i] = new CUDPConnection (m_pNetConfig, m_pNetworkLayer, nOwnPort);
-	assert (m_pConnection[i] != 0);
+	CNetConnection *pConnection = new CUDPConnection (m_pNetConfig, m_pNetworkLayer, nOwnPort);
+	assert (pConnection != 0);
+	AddConnection (pConnection, i);
 
 	m_SpinLock.Release ();
 
@@ -212,8 +245,8 @@ int CTransportLayer::Connect (CIPAddress &rIPAddress, u16 nPort, u16 nOwnPort, i
 			for (j = 0; j < m_pConnection.GetCount (); j++)
 			{
 				if (   m_pConnection[j] != 0
-				    && ((CNetConnection *) m_pConnection[j])->GetOwnPort () == nOwnPort
-				    && ((CNetConnection *) m_pConnection[j])->GetProtocol () == nProtocol)
+				    && m_pConnection[j]->GetOwnPort () == nOwnPort
+				    && m_pConnection[j]->GetProtocol () == nProtocol)
 				{
 					break;
 				}
@@ -224,14 +257,15 @@ int CTransportLayer::Connect (CIPAddress &rIPAddress, u16 nPort, u16 nOwnPort, i
 
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
+	CNetConnection *pConnection;
 	switch (nProtocol)
 	{
 	case IPPROTO_TCP:
-		m_pConnection[i] = new CTCPConnection (m_pNetConfig, m_pNetworkLayer, rIPAddress, nPort, nOwnPort);
+		pConnection = new CTCPConnection (m_pNetConfig, m_pNetworkLayer, rIPAddress, nPort, nOwnPort);
 		break;
 
 	case IPPROTO_UDP:
-		m_pConnection[i] = new CUDPConnection (m_pNetConfig, m_pNetworkLayer, rIPAddress, nPort, nOwnPort);
+		pConnection = new CUDPConnection (m_pNetConfig, m_pNetworkLayer, rIPAddress, nPort, nOwnPort);
 		break;
 
 	default:
@@ -239,10 +273,12 @@ int CTransportLayer::Connect (CIPAddress &rIPAddress, u16 nPort, u16 nOwnPort, i
 		return -1;
 	}
 
+	assert (pConnection != 0);
+	AddConnection (pConnection, i);
+
 	m_SpinLock.Release ();
 
-	assert (m_pConnection[i] != 0);
-	int nResult = ((CNetConnection *) m_pConnection[i])->Connect ();
+	int nResult = pConnection->Connect ();
 	if (nResult < 0)
 	{
 		return -1;
@@ -285,8 +321,9 @@ int CTransportLayer::Listen (u16 nOwnPort, int nProtocol)
 
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
-	m_pConnection[i] = new CTCPConnection (m_pNetConfig, m_pNetworkLayer, nOwnPort);
-	assert (m_pConnection[i] != 0);
+	CNetConnection *pConnection = new CTCPConnection (m_pNetConfig, m_pNetworkLayer, nOwnPort);
+	assert (pConnection != 0);
+	AddConnection (pConnection, i);
 
 	m_SpinLock.Release ();
 
@@ -304,7 +341,68 @@ int CTransportLayer::Accept (CIPAddress *pForeignIP, u16 *pForeignPort, int hCon
 
 	assert (pForeignIP != 0);
 	assert (pForeignPort != 0);
-	return ((CNetConnection *) m_pConnection[hConnection])->Accept (pForeignIP, pForeignPort);
+	return m_pConnection[hConnection]->Accept (pForeignIP, pForeignPort);
+}
+
+boolean CTransportLayer::RegisterListenPort (u16 nOwnPort)
+{
+	assert (nOwnPort != 0);
+
+	m_SpinLock.Acquire ();
+
+	unsigned nFree = TRANSPORT_MAX_LISTEN_PORTS;
+	for (unsigned i = 0; i < TRANSPORT_MAX_LISTEN_PORTS; i++)
+	{
+		if (m_ListenPort[i].nPort == nOwnPort)
+		{
+			m_ListenPort[i].nCount++;
+
+			m_SpinLock.Release ();
+
+			return TRUE;
+		}
+
+		if (   m_ListenPort[i].nPort == 0
+		    && nFree == TRANSPORT_MAX_LISTEN_PORTS)
+		{
+			nFree = i;
+		}
+	}
+
+	if (nFree == TRANSPORT_MAX_LISTEN_PORTS)
+	{
+		m_SpinLock.Release ();
+
+		return FALSE;
+	}
+
+	m_ListenPort[nFree].nPort = nOwnPort;
+	m_ListenPort[nFree].nCount = 1;
+
+	m_SpinLock.Release ();
+
+	return TRUE;
+}
+
+void CTransportLayer::UnregisterListenPort (u16 nOwnPort)
+{
+	m_SpinLock.Acquire ();
+
+	for (unsigned i = 0; i < TRANSPORT_MAX_LISTEN_PORTS; i++)
+	{
+		if (m_ListenPort[i].nPort == nOwnPort)
+		{
+			assert (m_ListenPort[i].nCount > 0);
+			if (--m_ListenPort[i].nCount == 0)
+			{
+				m_ListenPort[i].nPort = 0;
+			}
+
+			break;
+		}
+	}
+
+	m_SpinLock.Release ();
 }
 
 int CTransportLayer::Disconnect (int hConnection)
@@ -316,7 +414,7 @@ int CTransportLayer::Disconnect (int hConnection)
 		return -1;
 	}
 
-	return ((CNetConnection *) m_pConnection[hConnection])->Close ();
+	return m_pConnection[hConnection]->Close ();
 }
 
 int CTransportLayer::Send (const void *pData, unsigned nLength, int nFlags, int hConnection)
@@ -330,7 +428,38 @@ int CTransportLayer::Send (const void *pData, unsigned nLength, int nFlags, int
 
 	assert (pData != 0);
 	assert (nLength > 0);
-	return ((CNetConnection *) m_pConnection[hConnection])->Send (pData, nLength, nFlags);
+	return m_pConnection[hConnection]->Send (pData, nLength, nFlags);
+}
+
+int CTransportLayer::SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	assert (pIOVector != 0);
+	assert (nCount > 0);
+	return m_pConnection[hConnection]->SendV (pIOVector, nCount, nFlags);
+}
+
+int CTransportLayer::SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+				   TNetSendCompletionHandler *pHandler, void *pParam, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	assert (pData != 0);
+	assert (nLength > 0);
+	assert (pHandler != 0);
+	return m_pConnection[hConnection]->SendZeroCopy (pData, nLength, nFlags,
+									      pHandler, pParam);
 }
 
 int CTransportLayer::Receive (void *pBuffer, int nFlags, int hConnection)
@@ -343,7 +472,7 @@ int CTransportLayer::Receive (void *pBuffer, int nFlags, int hConnection)
 	}
 
 	assert (pBuffer != 0);
-	return ((CNetConnection *) m_pConnection[hConnection])->Receive (pBuffer, nFlags);
+	return m_pConnection[hConnection]->Receive (pBuffer, nFlags);
 }
 
 int CTransportLayer::SendTo (const void *pData, unsigned nLength, int nFlags,
@@ -358,7 +487,7 @@ int CTransportLayer::SendTo (const void *pData, unsigned nLength, int nFlags,
 
 	assert (pData != 0);
 	assert (nLength > 0);
-	return ((CNetConnection *) m_pConnection[hConnection])->SendTo (pData, nLength, nFlags,
+	return m_pConnection[hConnection]->SendTo (pData, nLength, nFlags,
 									rForeignIP, nForeignPort);
 }
 
@@ -373,7 +502,7 @@ int CTransportLayer::ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeig
 	}
 
 	assert (pBuffer != 0);
-	return ((CNetConnection *) m_pConnection[hConnection])->ReceiveFrom (pBuffer, nFlags,
+	return m_pConnection[hConnection]->ReceiveFrom (pBuffer, nFlags,
 									     pForeignIP, pForeignPort);
 }
 
@@ -386,7 +515,45 @@ int CTransportLayer::SetOptionBroadcast (boolean bAllowed, int hConnection)
 		return -1;
 	}
 
-	return ((CNetConnection *) m_pConnection[hConnection])->SetOptionBroadcast (bAllowed);
+	return m_pConnection[hConnection]->SetOptionBroadcast (bAllowed);
+}
+
+int CTransportLayer::SetOptionCork (boolean bCork, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return m_pConnection[hConnection]->SetOptionCork (bCork);
+}
+
+int CTransportLayer::SetOptionRxQueueDepth (unsigned nDepth, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return m_pConnection[hConnection]->SetOptionRxQueueDepth (nDepth);
+}
+
+int CTransportLayer::SetOptionMembership (const CIPAddress &rGroupIP, boolean bJoin,
+					  int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return m_pConnection[hConnection]->SetOptionMembership (rGroupIP,
+										    bJoin);
 }
 
 boolean CTransportLayer::IsConnected (int hConnection) const
@@ -398,7 +565,7 @@ boolean CTransportLayer::IsConnected (int hConnection) const
 		return 0;
 	}
 
-	return ((CNetConnection *) m_pConnection[hConnection])->IsConnected ();
+	return m_pConnection[hConnection]->IsConnected ();
 }
 
 const u8 *CTransportLayer::GetForeignIP (int hConnection) const
@@ -410,5 +577,397 @@ const u8 *CTransportLayer::GetForeignIP (int hConnection) const
 		return 0;
 	}
 
-	return ((CNetConnection *) m_pConnection[hConnection])->GetForeignIP ();
+	return m_pConnection[hConnection]->GetForeignIP ();
+}
+
+unsigned CTransportLayer::GetPollStatus (int hConnection) const
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return NET_POLL_ERROR;
+	}
+
+	return m_pConnection[hConnection]->GetPollStatus ();
+}
+
+unsigned CTransportLayer::GetRetransmissions (int hConnection) const
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return 0;
+	}
+
+	return m_pConnection[hConnection]->GetRetransmissions ();
+}
+
+void CTransportLayer::SetPollEvent (CSynchronizationEvent *pEvent, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return;
+	}
+
+	m_pConnection[hConnection]->SetPollEvent (pEvent);
+}
+
+// must be called with m_SpinLock acquired
+void CTransportLayer::AddConnection (CNetConnection *pConnection, unsigned hConnection)
+{
+	assert (pConnection != 0);
+	assert (pConnection->m_pTransportLayer == 0);
+	pConnection->m_pTransportLayer = this;
+	pConnection->m_hConnection = hConnection;
+
+	assert (m_pConnection[hConnection] == 0);
+	m_pConnection[hConnection] = pConnection;
+
+	InsertHash (pConnection);
+
+	Activate (pConnection);
+}
+
+// the connection is deleted
+void CTransportLayer::RemoveConnection (CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+	assert (pConnection->m_pTransportLayer == this);
+
+	m_SpinLock.Acquire ();
+
+	RemoveHash (pConnection);
+
+	int hConnection = pConnection->m_hConnection;
+	assert (hConnection >= 0);
+	assert (m_pConnection[hConnection] == pConnection);
+	m_pConnection[hConnection] = 0;
+
+	m_SpinLock.Release ();
+
+	pConnection->NotifyPoll ();	// the poller sees NET_POLL_ERROR now
+
+	delete pConnection;		// removes it from the active list too
+}
+
+boolean CTransportLayer::PacketReceived (const void *pPacket, unsigned nLength,
+					 CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+					 boolean bChecksumOK)
+{
+	if (   (   nProtocol != IPPROTO_TCP
+		&& nProtocol != IPPROTO_UDP)
+	    || nLength < 2*sizeof (u16))
+	{
+		return FALSE;
+	}
+
+	// TCP and UDP header start with the source and destination port
+	assert (pPacket != 0);
+	const u8 *pPorts = (const u8 *) pPacket;
+	u16 nForeignPort = (u16) pPorts[0] << 8 | pPorts[1];
+	u16 nOwnPort = (u16) pPorts[2] << 8 | pPorts[3];
+
+	// try the connection with exact address match first
+	unsigned nBucket = GetBucket (nProtocol, nOwnPort, rSenderIP.Get (), nForeignPort);
+	for (unsigned nPass = 0; nPass < 2; nPass++)
+	{
+		assert (m_ppHashBucket != 0);
+		for (CNetConnection *pConnection = m_ppHashBucket[nBucket];
+		     pConnection != 0;
+		     pConnection = pConnection->m_pHashNext)
+		{
+			if (   pConnection->GetProtocol () != nProtocol
+			    || pConnection->GetOwnPort () != nOwnPort)
+			{
+				continue;
+			}
+
+			if (   nPass == 0
+			    && (   pConnection->GetForeignPort () != nForeignPort
+				|| rSenderIP != pConnection->GetForeignIP ()))
+			{
+				continue;
+			}
+
+			int nResult = pConnection->PacketReceived (pPacket, nLength,
+								   rSenderIP, rReceiverIP, nProtocol,
+								   bChecksumOK);
+			if (nResult != 0)
+			{
+				if (nResult > 0)
+				{
+					UpdateHash (pConnection);
+
+					Activate (pConnection);
+				}
+
+				return TRUE;
+			}
+		}
+
+		if (   nPass == 0
+		    && nProtocol == IPPROTO_TCP)
+		{
+			// closed connections in TIME-WAIT state are checked before listening ones
+			if (m_TCPTimeWait.PacketReceived (pPacket, nLength, rSenderIP, rReceiverIP,
+							  nProtocol, bChecksumOK) != 0)
+			{
+				return TRUE;
+			}
+		}
+
+		nBucket = GetWildcardBucket (nProtocol, nOwnPort);
+	}
+
+	return FALSE;
+}
+
+void CTransportLayer::NotificationReceived (TICMPNotificationType Type,
+					    CIPAddress &rSenderIP, CIPAddress &rReceiverIP,
+					    u16 nSendPort, u16 nReceivePort, int nProtocol)
+{
+	if (   nProtocol != IPPROTO_TCP
+	    && nProtocol != IPPROTO_UDP)
+	{
+		return;
+	}
+
+	// nSendPort is the foreign port and nReceivePort the own port here
+	unsigned nBucket = GetBucket (nProtocol, nReceivePort, rSenderIP.Get (), nSendPort);
+	for (unsigned nPass = 0; nPass < 2; nPass++)
+	{
+		assert (m_ppHashBucket != 0);
+		for (CNetConnection *pConnection = m_ppHashBucket[nBucket];
+		     pConnection != 0;
+		     pConnection = pConnection->m_pHashNext)
+		{
+			if (pConnection->NotificationReceived (Type, rSenderIP, rReceiverIP,
+							       nSendPort, nReceivePort, nProtocol) != 0)
+			{
+				Activate (pConnection);
+
+				return;
+			}
+		}
+
+		nBucket = GetWildcardBucket (nProtocol, nReceivePort);
+	}
+}
+
+boolean CTransportLayer::IsListenPort (const void *pPacket, unsigned nLength)
+{
+	if (nLength < 2*sizeof (u16))
+	{
+		return FALSE;
+	}
+
+	assert (pPacket != 0);
+	const u8 *pPorts = (const u8 *) pPacket;
+	u16 nOwnPort = (u16) pPorts[2] << 8 | pPorts[3];
+
+	boolean bResult = FALSE;
+
+	m_SpinLock.Acquire ();
+
+	for (unsigned i = 0; i < TRANSPORT_MAX_LISTEN_PORTS; i++)
+	{
+		if (m_ListenPort[i].nPort == nOwnPort)
+		{
+			bResult = TRUE;
+
+			break;
+		}
+	}
+
+	m_SpinLock.Release ();
+
+	return bResult;
+}
+
+unsigned CTransportLayer::GetBucket (int nProtocol, u16 nOwnPort, const u8 *pForeignIP,
+				     u16 nForeignPort)
+{
+	assert (pForeignIP != 0);
+	u32 nHash =   ((u32) pForeignIP[0] << 24 | (u32) pForeignIP[1] << 16
+		     | (u32) pForeignIP[2] << 8  | pForeignIP[3])
+		    ^ ((u32) nForeignPort << 16 | nOwnPort)
+		    ^ (u32) nProtocol;
+
+	nHash *= 0x9E3779B1U;			// multiplicative hashing (golden ratio)
+
+	return nHash >> (32 - TRANSPORT_HASH_BITS);
+}
+
+unsigned CTransportLayer::GetWildcardBucket (int nProtocol, u16 nOwnPort)
+{
+	u32 nHash = ((u32) nOwnPort ^ (u32) nProtocol << 16) * 0x9E3779B1U;
+
+	return TRANSPORT_HASH_SIZE + (nHash >> (32 - TRANSPORT_HASH_BITS));
+}
+
+unsigned CTransportLayer::GetBucket (const CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+	if (pConnection->HasWildcardForeign ())
+	{
+		return GetWildcardBucket (pConnection->GetProtocol (), pConnection->GetOwnPort ());
+	}
+
+	return GetBucket (pConnection->GetProtocol (), pConnection->GetOwnPort (),
+			  pConnection->GetForeignIP (), pConnection->GetForeignPort ());
+}
+
+void CTransportLayer::UpdateHash (CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+	if (GetBucket (pConnection) == pConnection->m_nHashBucket)
+	{
+		return;
+	}
+
+	m_SpinLock.Acquire ();
+
+	RemoveHash (pConnection);
+	InsertHash (pConnection);
+
+	m_SpinLock.Release ();
+}
+
+// must be called with m_SpinLock acquired
+void CTransportLayer::InsertHash (CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+	unsigned nBucket = GetBucket (pConnection);
+	pConnection->m_nHashBucket = nBucket;
+
+	assert (m_ppHashBucket != 0);
+	pConnection->m_pHashPrev = 0;
+	pConnection->m_pHashNext = m_ppHashBucket[nBucket];
+	if (m_ppHashBucket[nBucket] != 0)
+	{
+		m_ppHashBucket[nBucket]->m_pHashPrev = pConnection;
+	}
+	m_ppHashBucket[nBucket] = pConnection;
+}
+
+// must be called with m_SpinLock acquired
+void CTransportLayer::RemoveHash (CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+	if (pConnection->m_pHashPrev != 0)
+	{
+		pConnection->m_pHashPrev->m_pHashNext = pConnection->m_pHashNext;
+	}
+	else
+	{
+		assert (m_ppHashBucket != 0);
+		assert (m_ppHashBucket[pConnection->m_nHashBucket] == pConnection);
+		m_ppHashBucket[pConnection->m_nHashBucket] = pConnection->m_pHashNext;
+	}
+
+	if (pConnection->m_pHashNext != 0)
+	{
+		pConnection->m_pHashNext->m_pHashPrev = pConnection->m_pHashPrev;
+	}
+
+	pConnection->m_pHashNext = 0;
+	pConnection->m_pHashPrev = 0;
+}
+
+void CTransportLayer::Activate (CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+
+	m_ActiveSpinLock.Acquire ();
+
+	if (!pConnection->m_bActive)
+	{
+		pConnection->m_bActive = TRUE;
+
+		pConnection->m_pActiveNext = 0;
+		pConnection->m_pActivePrev = m_pActiveTail;
+		if (m_pActiveTail != 0)
+		{
+			m_pActiveTail->m_pActiveNext = pConnection;
+		}
+		else
+		{
+			m_pActiveHead = pConnection;
+		}
+		m_pActiveTail = pConnection;
+
+		m_nActiveCount++;
+	}
+
+	m_ActiveSpinLock.Release ();
+}
+
+void CTransportLayer::Deactivate (CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+
+	m_ActiveSpinLock.Acquire ();
+
+	if (pConnection->m_bActive)
+	{
+		pConnection->m_bActive = FALSE;
+
+		if (pConnection->m_pActivePrev != 0)
+		{
+			pConnection->m_pActivePrev->m_pActiveNext = pConnection->m_pActiveNext;
+		}
+		else
+		{
+			assert (m_pActiveHead == pConnection);
+			m_pActiveHead = pConnection->m_pActiveNext;
+		}
+
+		if (pConnection->m_pActiveNext != 0)
+		{
+			pConnection->m_pActiveNext->m_pActivePrev = pConnection->m_pActivePrev;
+		}
+		else
+		{
+			assert (m_pActiveTail == pConnection);
+			m_pActiveTail = pConnection->m_pActivePrev;
+		}
+
+		assert (m_nActiveCount > 0);
+		m_nActiveCount--;
+	}
+
+	m_ActiveSpinLock.Release ();
+}
+
+CNetConnection *CTransportLayer::GetActive (void)
+{
+	m_ActiveSpinLock.Acquire ();
+
+	CNetConnection *pConnection = m_pActiveHead;
+	if (pConnection != 0)
+	{
+		assert (pConnection->m_bActive);
+		pConnection->m_bActive = FALSE;
+
+		m_pActiveHead = pConnection->m_pActiveNext;
+		if (m_pActiveHead != 0)
+		{
+			m_pActiveHead->m_pActivePrev = 0;
+		}
+		else
+		{
+			m_pActiveTail = 0;
+		}
+
+		assert (m_nActiveCount > 0);
+		m_nActiveCount--;
+	}
+
+	m_ActiveSpinLock.Release ();
+
+	return pConnection;
 }
@@ -2,7 +2,7 @@
 // udpconnection.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,6 +19,7 @@
 //
 #include <circle/net/udpconnection.h>
 #include <circle/net/in.h>
+#include <circle/net/netstatistics.h>
 #include <circle/macros.h>
 #include <circle/util.h>
 #include <assert.h>
@@ -47,7 +48,9 @@ CUDPConnection::CUDPConnection (CNetConfig	*pNetConfig,
 :	CNetConnection (pNetConfig, pNetworkLayer, rForeignIP, nForeignPort, nOwnPort, IPPROTO_UDP),
 	m_bOpen (TRUE),
 	m_bActiveOpen (TRUE),
+	m_nRxQueueDepth (UDP_RX_QUEUE_DEPTH),
 	m_bBroadcastsAllowed (FALSE),
+	m_nMulticastGroups (0),
 	m_nErrno (0)
 {
 }
@@ -58,7 +61,9 @@ CUDPConnection::CUDPConnection (CNetConfig	*pNetConfig,
 :	CNetConnection (pNetConfig, pNetworkLayer, nOwnPort, IPPROTO_UDP),
 	m_bOpen (TRUE),
 	m_bActiveOpen (FALSE),
+	m_nRxQueueDepth (UDP_RX_QUEUE_DEPTH),
 	m_bBroadcastsAllowed (FALSE),
+	m_nMulticastGroups (0),
 	m_nErrno (0)
 {
 }
@@ -66,6 +71,12 @@ CUDPConnection::CUDPConnection (CNetConfig	*pNetConfig,
 CUDPConnection::~CUDPConnection (void)
 {
 	assert (!m_bOpen);
+
+	assert (m_pNetworkLayer != 0);
+	while (m_nMulticastGroups > 0)
+	{
+		m_pNetworkLayer->LeaveGroup (m_MulticastGroup[--m_nMulticastGroups]);
+	}
 }
 
 int CUDPConnection::Connect (void)
@@ -89,6 +100,8 @@ int CUDPConnection::Close (void)
 	
 	m_bOpen = FALSE;
 
+	Activate ();
+
 	return 0;
 }
 	
@@ -115,7 +128,7 @@ int CUDPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 
 	unsigned nPacketLength = sizeof (TUDPHeader) + nLength;		// may wrap
 	if (   nPacketLength <= sizeof (TUDPHeader)
-	    || nPacketLength > FRAME_BUFFER_SIZE)
+	    || nPacketLength > IP_PAYLOAD_MAX_LENGTH)
 	{
 		return -1;
 	}
@@ -128,7 +141,11 @@ int CUDPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 		return -1;
 	}
 
-	u8 PacketBuffer[nPacketLength];
+	CNetBuffer *pBuffer = new CNetBuffer (IP_PACKET_HEADROOM);
+	assert (pBuffer != 0);
+	pBuffer->SetLength (nPacketLength);
+
+	u8 *PacketBuffer = (u8 *) pBuffer->GetData ();
 	TUDPHeader *pHeader = (TUDPHeader *) PacketBuffer;
 
 	pHeader->nSourcePort = le2be16 (m_nOwnPort);
@@ -136,20 +153,66 @@ int CUDPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 	pHeader->nLength     = le2be16 (nPacketLength);
 	pHeader->nChecksum   = 0;
 	
-	assert (pData != 0);
-	assert (nLength > 0);
-	memcpy (PacketBuffer+sizeof (TUDPHeader), pData, nLength);
-
 	m_Checksum.SetSourceAddress (*m_pNetConfig->GetIPAddress ());
 	m_Checksum.SetDestinationAddress (m_ForeignIP);
-	pHeader->nChecksum = m_Checksum.Calculate (PacketBuffer, nPacketLength);
+
+	assert (pData != 0);
+	assert (nLength > 0);
+	CopyData (pBuffer, pData, nLength);
 
 	assert (m_pNetworkLayer != 0);
-	boolean bOK = m_pNetworkLayer->Send (m_ForeignIP, PacketBuffer, nPacketLength, IPPROTO_UDP);
+	boolean bOK = m_pNetworkLayer->Send (m_ForeignIP, pBuffer, IPPROTO_UDP);
+	if (bOK)
+	{
+		NET_STAT_INC (NetCounterUDPTxDatagrams);
+	}
 	
 	return bOK ? nLength : -1;
 }
 
+int CUDPConnection::SendV (const TNetIOVector *pIOVector, unsigned nCount, int nFlags)
+{
+	// gather the datagram
+	u8 Buffer[IP_PAYLOAD_MAX_LENGTH];
+	unsigned nLength = 0;
+
+	assert (pIOVector != 0);
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		if (pIOVector[i].nLength > sizeof Buffer - nLength)
+		{
+			return -1;
+		}
+
+		assert (pIOVector[i].pData != 0);
+		memcpy (Buffer+nLength, pIOVector[i].pData, pIOVector[i].nLength);
+		nLength += pIOVector[i].nLength;
+	}
+
+	if (nLength == 0)
+	{
+		return -1;
+	}
+
+	return Send (Buffer, nLength, nFlags);
+}
+
+int CUDPConnection::SendZeroCopy (const void *pData, unsigned nLength, int nFlags,
+				  TNetSendCompletionHandler *pHandler, void *pParam)
+{
+	// the datagram is built immediately, so the buffer can be returned at once
+	int nResult = Send (pData, nLength, nFlags);
+	if (nResult < 0)
+	{
+		return nResult;
+	}
+
+	assert (pHandler != 0);
+	(*pHandler) (pData, pParam);
+
+	return nResult;
+}
+
 int CUDPConnection::Receive (void *pBuffer, int nFlags)
 {
 	void *pParam;
@@ -220,7 +283,7 @@ int CUDPConnection::SendTo (const void *pData, unsigned nLength, int nFlags,
 
 	unsigned nPacketLength = sizeof (TUDPHeader) + nLength;		// may wrap
 	if (   nPacketLength <= sizeof (TUDPHeader)
-	    || nPacketLength > FRAME_BUFFER_SIZE)
+	    || nPacketLength > IP_PAYLOAD_MAX_LENGTH)
 	{
 		return -1;
 	}
@@ -233,7 +296,11 @@ int CUDPConnection::SendTo (const void *pData, unsigned nLength, int nFlags,
 		return -1;
 	}
 
-	u8 PacketBuffer[nPacketLength];
+	CNetBuffer *pBuffer = new CNetBuffer (IP_PACKET_HEADROOM);
+	assert (pBuffer != 0);
+	pBuffer->SetLength (nPacketLength);
+
+	u8 *PacketBuffer = (u8 *) pBuffer->GetData ();
 	TUDPHeader *pHeader = (TUDPHeader *) PacketBuffer;
 
 	pHeader->nSourcePort = le2be16 (m_nOwnPort);
@@ -241,16 +308,19 @@ int CUDPConnection::SendTo (const void *pData, unsigned nLength, int nFlags,
 	pHeader->nLength     = le2be16 (nPacketLength);
 	pHeader->nChecksum   = 0;
 	
-	assert (pData != 0);
-	assert (nLength > 0);
-	memcpy (PacketBuffer+sizeof (TUDPHeader), pData, nLength);
-
 	m_Checksum.SetSourceAddress (*m_pNetConfig->GetIPAddress ());
 	m_Checksum.SetDestinationAddress (rForeignIP);
-	pHeader->nChecksum = m_Checksum.Calculate (PacketBuffer, nPacketLength);
+
+	assert (pData != 0);
+	assert (nLength > 0);
+	CopyData (pBuffer, pData, nLength);
 
 	assert (m_pNetworkLayer != 0);
-	boolean bOK = m_pNetworkLayer->Send (rForeignIP, PacketBuffer, nPacketLength, IPPROTO_UDP);
+	boolean bOK = m_pNetworkLayer->Send (rForeignIP, pBuffer, IPPROTO_UDP);
+	if (bOK)
+	{
+		NET_STAT_INC (NetCounterUDPTxDatagrams);
+	}
 	
 	return bOK ? nLength : -1;
 }
@@ -314,6 +384,66 @@ int CUDPConnection::SetOptionBroadcast (boolean bAllowed)
 	return 0;
 }
 
+int CUDPConnection::SetOptionMembership (const CIPAddress &rGroupIP, boolean bJoin)
+{
+	if (!rGroupIP.IsMulticast ())
+	{
+		return -1;
+	}
+
+	unsigned i;
+	for (i = 0; i < m_nMulticastGroups; i++)
+	{
+		if (m_MulticastGroup[i] == rGroupIP)
+		{
+			break;
+		}
+	}
+
+	assert (m_pNetworkLayer != 0);
+
+	if (bJoin)
+	{
+		if (i < m_nMulticastGroups)
+		{
+			return 0;
+		}
+
+		if (   m_nMulticastGroups >= UDP_MAX_MULTICAST_GROUPS
+		    || !m_pNetworkLayer->JoinGroup (rGroupIP))
+		{
+			return -1;
+		}
+
+		m_MulticastGroup[m_nMulticastGroups++].Set (rGroupIP);
+	}
+	else
+	{
+		if (i >= m_nMulticastGroups)
+		{
+			return -1;
+		}
+
+		m_pNetworkLayer->LeaveGroup (rGroupIP);
+
+		m_MulticastGroup[i].Set (m_MulticastGroup[--m_nMulticastGroups]);
+	}
+
+	return 0;
+}
+
+int CUDPConnection::SetOptionCork (boolean bCork)
+{
+	return 0;
+}
+
+int CUDPConnection::SetOptionRxQueueDepth (unsigned nDepth)
+{
+	m_nRxQueueDepth = nDepth;
+
+	return 0;
+}
+
 boolean CUDPConnection::IsConnected (void) const
 {
 	return FALSE;
@@ -323,13 +453,75 @@ boolean CUDPConnection::IsTerminated (void) const
 {
 	return !m_bOpen;
 }
+
+unsigned CUDPConnection::GetPollStatus (void) const
+{
+	if (!m_bOpen)
+	{
+		return NET_POLL_ERROR;
+	}
+
+	unsigned nStatus = NET_POLL_WRITE;		// Send() never waits
+
+	if (m_nErrno < 0)
+	{
+		nStatus |= NET_POLL_READ | NET_POLL_ERROR;
+	}
+
+	if (!m_RxQueue.IsEmpty ())
+	{
+		nStatus |= NET_POLL_READ;
+	}
+
+	return nStatus;
+}
+	
+boolean CUDPConnection::HasWildcardForeign (void) const
+{
+	assert (m_pNetConfig != 0);
+	return    !m_bActiveOpen
+	       || m_ForeignIP.IsBroadcast ()
+	       || m_ForeignIP == *m_pNetConfig->GetBroadcastAddress ();
+}
 	
 void CUDPConnection::Process (void)
 {
 }
 
+boolean CUDPConnection::IsProcessPending (void) const
+{
+	return FALSE;
+}
+
+void CUDPConnection::CopyData (CNetBuffer *pBuffer, const void *pData, unsigned nLength)
+{
+	assert (pBuffer != 0);
+	u8 *PacketBuffer = (u8 *) pBuffer->GetData ();
+	TUDPHeader *pHeader = (TUDPHeader *) PacketBuffer;
+
+	assert (m_pNetworkLayer != 0);
+	if (m_pNetworkLayer->GetOffloadCapabilities () & NET_OFFLOAD_TX_CHECKSUM)
+	{
+		memcpy (PacketBuffer+sizeof (TUDPHeader), pData, nLength);
+
+		pHeader->nChecksum =
+			m_Checksum.CalculatePseudoHeader (sizeof (TUDPHeader) + nLength);
+
+		pBuffer->SetOffload (NET_OFFLOAD_TX_CHECKSUM, 0,
+				     (u8 *) &pHeader->nChecksum - PacketBuffer);
+	}
+	else
+	{
+		// the data is copied during checksum calculation
+		pHeader->nChecksum = m_Checksum.CalculateCopy (PacketBuffer, sizeof (TUDPHeader),
+							       PacketBuffer+sizeof (TUDPHeader),
+							       pData, nLength);
+	}
+}
+
 int CUDPConnection::PacketReceived (const void *pPacket, unsigned nLength,
-				    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol)
+				    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol,
+				    boolean bChecksumOK)
 {
 	if (nProtocol != IPPROTO_UDP)
 	{
@@ -365,18 +557,39 @@ int CUDPConnection::PacketReceived (const void *pPacket, unsigned nLength,
 		}
 	}
 
+	// multicast datagrams are delivered to the members of the group only
+	if (rReceiverIP.IsMulticast ())
+	{
+		unsigned i;
+		for (i = 0; i < m_nMulticastGroups; i++)
+		{
+			if (m_MulticastGroup[i] == rReceiverIP)
+			{
+				break;
+			}
+		}
+
+		if (i >= m_nMulticastGroups)
+		{
+			return 0;
+		}
+	}
+
 	if (nLength < be2le16 (pHeader->nLength))
 	{
 		return -1;
 	}
 	
-	if (pHeader->nChecksum != UDP_CHECKSUM_NONE)
+	if (   pHeader->nChecksum != UDP_CHECKSUM_NONE
+	    && !bChecksumOK)
 	{
 		m_Checksum.SetSourceAddress (rSenderIP);
 		m_Checksum.SetDestinationAddress (rReceiverIP);
 
 		if (m_Checksum.Calculate (pPacket, nLength) != CHECKSUM_OK)
 		{
+			NET_STAT_INC (NetCounterUDPRxChecksumErrors);
+
 			return -1;
 		}
 	}
@@ -388,6 +601,14 @@ int CUDPConnection::PacketReceived (const void *pPacket, unsigned nLength,
 		return 1;
 	}
 
+	if (   m_nRxQueueDepth != 0
+	    && m_RxQueue.GetCount () >= m_nRxQueueDepth)
+	{
+		NET_STAT_INC (NetCounterUDPRxQueueFull);
+
+		return 1;
+	}
+
 	nLength -= sizeof (TUDPHeader);
 	assert (nLength > 0);
 
@@ -398,6 +619,8 @@ int CUDPConnection::PacketReceived (const void *pPacket, unsigned nLength,
 
 	m_RxQueue.Enqueue ((u8 *) pPacket + sizeof (TUDPHeader), nLength, pData);
 
+	NET_STAT_INC (NetCounterUDPRxDatagrams);
+
 	m_Event.Set ();
 
 	return 1;
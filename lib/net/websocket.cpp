@@ -0,0 +1,823 @@
+//
+// websocket.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/websocket.h>
+#include <circle/net/in.h>
+#include <circle/string.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define FRAME_FLAG_FIN		0x80
+#define FRAME_FLAG_RSV		0x70
+#define FRAME_OPCODE_MASK	0x0F
+#define FRAME_FLAG_MASK		0x80
+#define FRAME_LENGTH_MASK	0x7F
+	#define FRAME_LENGTH_16		126
+	#define FRAME_LENGTH_64		127
+
+#define MAX_HEADER_LINE		256
+
+static const char Magic[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";	// from RFC 6455
+
+CWebSocket::CWebSocket (CSocket *pSocket, boolean bClient, const void *pRxData, unsigned nRxLength)
+:	m_pSocket (pSocket),
+	m_bClient (bClient),
+	m_bClosed (FALSE),
+	m_bCloseSent (FALSE),
+	m_bSendFragmented (FALSE),
+	m_nRxOffset (0),
+	m_nRxLength (0)
+{
+	assert (m_pSocket != 0);
+
+	if (nRxLength > 0)
+	{
+		assert (pRxData != 0);
+		assert (nRxLength <= sizeof m_RxBuffer);
+		memcpy (m_RxBuffer, pRxData, nRxLength);
+		m_nRxLength = nRxLength;
+	}
+}
+
+CWebSocket::~CWebSocket (void)
+{
+	if (   !m_bClosed
+	    && !m_bCloseSent)
+	{
+		Close (WEBSOCKET_STATUS_GOING_AWAY);
+	}
+
+	delete m_pSocket;
+	m_pSocket = 0;
+}
+
+CWebSocket *CWebSocket::Connect (CNetSubSystem *pNetSubSystem,
+				 CIPAddress &rServerIP, u16 nServerPort,
+				 const char *pServerName, const char *pPath)
+{
+	assert (pNetSubSystem != 0);
+	CSocket *pSocket = new CSocket (pNetSubSystem, IPPROTO_TCP);
+	assert (pSocket != 0);
+
+	if (pSocket->Connect (rServerIP, nServerPort) < 0)
+	{
+		delete pSocket;
+
+		return 0;
+	}
+
+	// send opening handshake
+	CBcmRandomNumberGenerator Random;
+	u32 Nonce[4];
+	for (unsigned i = 0; i < 4; i++)
+	{
+		Nonce[i] = Random.GetNumber ();
+	}
+
+	char Key[WEBSOCKET_KEY_SIZE+1];
+	Base64Encode ((const u8 *) Nonce, sizeof Nonce, Key);
+
+	char Accept[WEBSOCKET_ACCEPT_SIZE+1];
+	GetAcceptKey (Key, Accept);
+
+	assert (pServerName != 0);
+	assert (pPath != 0);
+	CString Request;
+	Request.Format ("GET %s HTTP/1.1\r\n"
+			"Host: %s\r\n"
+			"Upgrade: websocket\r\n"
+			"Connection: Upgrade\r\n"
+			"Sec-WebSocket-Key: %s\r\n"
+			"Sec-WebSocket-Version: %u\r\n"
+			"\r\n", pPath, pServerName, Key, WEBSOCKET_VERSION);
+
+	if (pSocket->Send ((const char *) Request, Request.GetLength (), 0) < 0)
+	{
+		delete pSocket;
+
+		return 0;
+	}
+
+	// receive and check the response header
+	char Buffer[FRAME_BUFFER_SIZE];
+	char Line[MAX_HEADER_LINE];
+	unsigned nLine = 0;
+	unsigned nChar = 0;
+	boolean bAccepted = FALSE;
+	int nResult;
+	while ((nResult = pSocket->Receive (Buffer, sizeof Buffer, 0)) > 0)
+	{
+		for (int i = 0; i < nResult; i++)
+		{
+			char chChar = Buffer[i];
+			if (chChar == '\r')
+			{
+				continue;
+			}
+
+			if (chChar != '\n')
+			{
+				// accumulate header line
+				if (nChar < sizeof Line-1)
+				{
+					Line[nChar++] = chChar;
+					Line[nChar] = '\0';
+				}
+
+				continue;
+			}
+
+			if (nChar == 0)			// empty line is end of header
+			{
+				if (!bAccepted)
+				{
+					delete pSocket;
+
+					return 0;
+				}
+
+				// frames may follow the header immediately
+				CWebSocket *pWebSocket = new CWebSocket (pSocket, TRUE,
+									 Buffer+i+1, nResult-i-1);
+				assert (pWebSocket != 0);
+
+				return pWebSocket;
+			}
+
+			char *pSavePtr;
+			if (nLine++ == 0)
+			{
+				// "HTTP/1.1 101 Switching Protocols" expected
+				char *pToken;
+				if (   (pToken = strtok_r (Line, " ", &pSavePtr)) == 0
+				    || strcmp (pToken, "HTTP/1.1") != 0
+				    || (pToken = strtok_r (0, " ", &pSavePtr)) == 0
+				    || strcmp (pToken, "101") != 0)
+				{
+					delete pSocket;
+
+					return 0;
+				}
+			}
+			else
+			{
+				char *pToken = strtok_r (Line, ": ", &pSavePtr);
+				if (   pToken != 0
+				    && strcasecmp (pToken, "Sec-WebSocket-Accept") == 0)
+				{
+					pToken = strtok_r (0, " ", &pSavePtr);
+					bAccepted =    pToken != 0
+						    && strcmp (pToken, Accept) == 0;
+				}
+			}
+
+			nChar = 0;
+		}
+	}
+
+	delete pSocket;
+
+	return 0;
+}
+
+int CWebSocket::Send (const void *pData, unsigned nLength, TWebSocketOpcode Opcode)
+{
+	assert (!m_bSendFragmented);
+	assert (Opcode == WebSocketText || Opcode == WebSocketBinary);
+
+	return SendFrame (Opcode, TRUE, pData, nLength);
+}
+
+int CWebSocket::SendFragment (const void *pData, unsigned nLength, boolean bFinal,
+			      TWebSocketOpcode Opcode)
+{
+	unsigned nOpcode = WebSocketContinuation;
+	if (!m_bSendFragmented)
+	{
+		assert (Opcode == WebSocketText || Opcode == WebSocketBinary);
+		nOpcode = Opcode;
+	}
+
+	int nResult = SendFrame (nOpcode, bFinal, pData, nLength);
+	if (nResult >= 0)
+	{
+		m_bSendFragmented = !bFinal;
+	}
+
+	return nResult;
+}
+
+unsigned CWebSocket::Broadcast (CWebSocket * const *ppWebSockets, unsigned nCount,
+				const void *pData, unsigned nLength, TWebSocketOpcode Opcode)
+{
+	assert (Opcode == WebSocketText || Opcode == WebSocketBinary);
+
+	// frames from the server are not masked, so the frame is the same for all clients
+	u8 Header[WEBSOCKET_MAX_HEADER_SIZE];
+	unsigned nHeaderLength = EncodeHeader (Header, Opcode, TRUE, nLength, 0);
+
+	TNetIOVector IOVector[2] = {{Header, nHeaderLength}, {pData, nLength}};
+
+	unsigned nSent = 0;
+	assert (ppWebSockets != 0);
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		CWebSocket *pWebSocket = ppWebSockets[i];
+		if (   pWebSocket == 0
+		    || pWebSocket->m_bClosed
+		    || pWebSocket->m_bCloseSent
+		    || pWebSocket->m_bSendFragmented)	// frames of messages must not interleave
+		{
+			continue;
+		}
+
+		assert (!pWebSocket->m_bClient);
+		assert (pWebSocket->m_pSocket != 0);
+
+		// do not wait for slow clients
+		if (pWebSocket->m_pSocket->SendV (IOVector, nLength > 0 ? 2 : 1, MSG_DONTWAIT) < 0)
+		{
+			pWebSocket->m_bClosed = TRUE;
+
+			continue;
+		}
+
+		nSent++;
+	}
+
+	return nSent;
+}
+
+int CWebSocket::Receive (void *pBuffer, unsigned nSize, TWebSocketOpcode *pOpcode, int nFlags)
+{
+	if (m_bClosed)
+	{
+		return -1;
+	}
+
+	u8 *pMessage = (u8 *) pBuffer;
+	unsigned nMessageLength = 0;
+	unsigned nMessageOpcode = WebSocketContinuation;	// no message started
+
+	while (1)
+	{
+		if (   nMessageOpcode == WebSocketContinuation
+		    && (nFlags & MSG_DONTWAIT)
+		    && m_nRxOffset >= m_nRxLength)
+		{
+			assert (m_pSocket != 0);
+			int nResult = m_pSocket->Receive (m_RxBuffer, sizeof m_RxBuffer, MSG_DONTWAIT);
+			if (nResult < 0)
+			{
+				m_bClosed = TRUE;
+
+				return -1;
+			}
+
+			if (nResult == 0)
+			{
+				return 0;
+			}
+
+			m_nRxOffset = 0;
+			m_nRxLength = nResult;
+		}
+
+		// parse frame header
+		u8 Header[2];
+		if (!Read (Header, sizeof Header))
+		{
+			return -1;
+		}
+
+		if (Header[0] & FRAME_FLAG_RSV)			// no extensions negotiated
+		{
+			return Fail (WEBSOCKET_STATUS_PROTOCOL_ERROR);
+		}
+
+		boolean bFinal = Header[0] & FRAME_FLAG_FIN ? TRUE : FALSE;
+		unsigned nOpcode = Header[0] & FRAME_OPCODE_MASK;
+
+		// frames from the client must be masked, frames from the server must not
+		boolean bMasked = Header[1] & FRAME_FLAG_MASK ? TRUE : FALSE;
+		if (bMasked == m_bClient)
+		{
+			return Fail (WEBSOCKET_STATUS_PROTOCOL_ERROR);
+		}
+
+		u64 nLength = Header[1] & FRAME_LENGTH_MASK;
+		if (nLength >= FRAME_LENGTH_16)
+		{
+			u8 Extended[8];
+			unsigned nBytes = nLength == FRAME_LENGTH_16 ? 2 : 8;
+			if (!Read (Extended, nBytes))
+			{
+				return -1;
+			}
+
+			nLength = 0;
+			for (unsigned i = 0; i < nBytes; i++)
+			{
+				nLength = nLength << 8 | Extended[i];
+			}
+		}
+
+		u8 MaskKey[4];
+		if (   bMasked
+		    && !Read (MaskKey, sizeof MaskKey))
+		{
+			return -1;
+		}
+
+		// control frames may be injected into fragmented messages
+		if (nOpcode >= WebSocketClose)
+		{
+			if (   !bFinal
+			    || nLength > WEBSOCKET_MAX_CONTROL_PAYLOAD)
+			{
+				return Fail (WEBSOCKET_STATUS_PROTOCOL_ERROR);
+			}
+
+			u8 Payload[WEBSOCKET_MAX_CONTROL_PAYLOAD];
+			if (!Read (Payload, (unsigned) nLength))
+			{
+				return -1;
+			}
+
+			if (bMasked)
+			{
+				ApplyMask (Payload, (unsigned) nLength, MaskKey);
+			}
+
+			switch (nOpcode)
+			{
+			case WebSocketPing:
+				if (SendFrame (WebSocketPong, TRUE, Payload, (unsigned) nLength) < 0)
+				{
+					return -1;
+				}
+				break;
+
+			case WebSocketPong:
+				break;
+
+			case WebSocketClose:
+				if (!m_bCloseSent)
+				{
+					// echo the status code
+					SendFrame (WebSocketClose, TRUE, Payload, nLength >= 2 ? 2 : 0);
+					m_bCloseSent = TRUE;
+				}
+				m_bClosed = TRUE;
+				return -1;
+
+			default:
+				return Fail (WEBSOCKET_STATUS_PROTOCOL_ERROR);
+			}
+
+			continue;
+		}
+
+		if (nOpcode == WebSocketContinuation)
+		{
+			if (nMessageOpcode == WebSocketContinuation)
+			{
+				return Fail (WEBSOCKET_STATUS_PROTOCOL_ERROR);
+			}
+		}
+		else if (   nOpcode == WebSocketText
+			 || nOpcode == WebSocketBinary)
+		{
+			if (nMessageOpcode != WebSocketContinuation)
+			{
+				return Fail (WEBSOCKET_STATUS_PROTOCOL_ERROR);
+			}
+
+			nMessageOpcode = nOpcode;
+		}
+		else
+		{
+			return Fail (WEBSOCKET_STATUS_PROTOCOL_ERROR);
+		}
+
+		if (nLength > nSize - nMessageLength)
+		{
+			return Fail (WEBSOCKET_STATUS_TOO_BIG);
+		}
+
+		assert (pMessage != 0);
+		if (!Read (pMessage + nMessageLength, (unsigned) nLength))
+		{
+			return -1;
+		}
+
+		if (bMasked)
+		{
+			ApplyMask (pMessage + nMessageLength, (unsigned) nLength, MaskKey);
+		}
+
+		nMessageLength += (unsigned) nLength;
+
+		if (bFinal)
+		{
+			if (pOpcode != 0)
+			{
+				*pOpcode = (TWebSocketOpcode) nMessageOpcode;
+			}
+
+			return (int) nMessageLength;
+		}
+	}
+}
+
+boolean CWebSocket::Close (u16 usStatusCode)
+{
+	if (m_bCloseSent)
+	{
+		return TRUE;
+	}
+
+	u8 Payload[2] = {(u8) (usStatusCode >> 8), (u8) (usStatusCode & 0xFF)};
+	boolean bOK = SendFrame (WebSocketClose, TRUE, Payload, sizeof Payload) >= 0;
+
+	m_bCloseSent = TRUE;
+
+	return bOK;
+}
+
+boolean CWebSocket::IsClosed (void) const
+{
+	return m_bClosed;
+}
+
+void CWebSocket::GetAcceptKey (const char *pKey, char *pAccept)
+{
+	assert (pKey != 0);
+	size_t nKeyLength = strlen (pKey);
+
+	char Buffer[WEBSOCKET_KEY_SIZE + sizeof Magic];
+	if (nKeyLength > WEBSOCKET_KEY_SIZE)
+	{
+		nKeyLength = WEBSOCKET_KEY_SIZE;
+	}
+
+	memcpy (Buffer, pKey, nKeyLength);
+	memcpy (Buffer + nKeyLength, Magic, sizeof Magic-1);
+
+	u8 Digest[20];
+	SHA1 (Buffer, nKeyLength + sizeof Magic-1, Digest);
+
+	assert (pAccept != 0);
+	Base64Encode (Digest, sizeof Digest, pAccept);
+}
+
+void CWebSocket::ApplyMask (u8 *pData, unsigned nLength, const u8 *pMaskKey, unsigned nOffset)
+{
+	assert (pData != 0 || nLength == 0);
+	assert (pMaskKey != 0);
+
+	// single bytes until pData is aligned
+	while (   nLength > 0
+	       && ((uintptr) pData & 7) != 0)
+	{
+		*pData++ ^= pMaskKey[nOffset++ & 3];
+		nLength--;
+	}
+
+	if (nLength >= 8)
+	{
+		// the key repeats every 4 bytes, so the rotated key fits all words
+		u8 Mask[8];
+		for (unsigned i = 0; i < 8; i++)
+		{
+			Mask[i] = pMaskKey[(nOffset + i) & 3];
+		}
+
+		u64 nMask;
+		memcpy (&nMask, Mask, sizeof nMask);
+
+		u64 *pWord = (u64 *) pData;
+		for (; nLength >= 32; nLength -= 32)
+		{
+			pWord[0] ^= nMask;
+			pWord[1] ^= nMask;
+			pWord[2] ^= nMask;
+			pWord[3] ^= nMask;
+			pWord += 4;
+		}
+
+		for (; nLength >= 8; nLength -= 8)
+		{
+			*pWord++ ^= nMask;
+		}
+
+		pData = (u8 *) pWord;
+	}
+
+	while (nLength-- > 0)
+	{
+		*pData++ ^= pMaskKey[nOffset++ & 3];
+	}
+}
+
+int CWebSocket::SendFrame (unsigned nOpcode, boolean bFinal, const void *pData, unsigned nLength)
+{
+	if (   m_bClosed
+	    || m_bCloseSent)
+	{
+		return -1;
+	}
+
+	assert (pData != 0 || nLength == 0);
+	assert (m_pSocket != 0);
+
+	u8 Header[WEBSOCKET_MAX_HEADER_SIZE];
+
+	if (!m_bClient)
+	{
+		unsigned nHeaderLength = EncodeHeader (Header, nOpcode, bFinal, nLength, 0);
+
+		TNetIOVector IOVector[2] = {{Header, nHeaderLength}, {pData, nLength}};
+		if (m_pSocket->SendV (IOVector, nLength > 0 ? 2 : 1, 0) < 0)
+		{
+			m_bClosed = TRUE;
+
+			return -1;
+		}
+
+		return nLength;
+	}
+
+	// the caller's data must not be modified, so mask a copy of it piece by piece
+	u8 MaskKey[4];
+	NewMaskKey (MaskKey);
+
+	unsigned nHeaderLength = EncodeHeader (Header, nOpcode, bFinal, nLength, MaskKey);
+	if (m_pSocket->Send (Header, nHeaderLength, nLength > 0 ? MSG_MORE : 0) < 0)
+	{
+		m_bClosed = TRUE;
+
+		return -1;
+	}
+
+	const u8 *pSource = (const u8 *) pData;
+	u8 Buffer[FRAME_BUFFER_SIZE];
+	for (unsigned nOffset = 0; nOffset < nLength;)
+	{
+		unsigned nChunk = nLength - nOffset;
+		if (nChunk > sizeof Buffer)
+		{
+			nChunk = sizeof Buffer;
+		}
+
+		memcpy (Buffer, pSource + nOffset, nChunk);
+		ApplyMask (Buffer, nChunk, MaskKey, nOffset);
+
+		nOffset += nChunk;
+
+		if (m_pSocket->Send (Buffer, nChunk, nOffset < nLength ? MSG_MORE : 0) < 0)
+		{
+			m_bClosed = TRUE;
+
+			return -1;
+		}
+	}
+
+	return nLength;
+}
+
+unsigned CWebSocket::EncodeHeader (u8 *pHeader, unsigned nOpcode, boolean bFinal,
+				   u64 nLength, const u8 *pMaskKey)
+{
+	assert (pHeader != 0);
+	assert (nOpcode <= FRAME_OPCODE_MASK);
+
+	unsigned nHeaderLength = 0;
+	pHeader[nHeaderLength++] = (bFinal ? FRAME_FLAG_FIN : 0) | nOpcode;
+
+	u8 uchMask = pMaskKey != 0 ? FRAME_FLAG_MASK : 0;
+	if (nLength < FRAME_LENGTH_16)
+	{
+		pHeader[nHeaderLength++] = uchMask | (u8) nLength;
+	}
+	else if (nLength <= 0xFFFF)
+	{
+		pHeader[nHeaderLength++] = uchMask | FRAME_LENGTH_16;
+		pHeader[nHeaderLength++] = (u8) (nLength >> 8);
+		pHeader[nHeaderLength++] = (u8) nLength;
+	}
+	else
+	{
+		pHeader[nHeaderLength++] = uchMask | FRAME_LENGTH_64;
+		for (int nShift = 56; nShift >= 0; nShift -= 8)
+		{
+			pHeader[nHeaderLength++] = (u8) (nLength >> nShift);
+		}
+	}
+
+	if (pMaskKey != 0)
+	{
+		memcpy (pHeader + nHeaderLength, pMaskKey, 4);
+		nHeaderLength += 4;
+	}
+
+	assert (nHeaderLength <= WEBSOCKET_MAX_HEADER_SIZE);
+
+	return nHeaderLength;
+}
+
+boolean CWebSocket::Read (void *pBuffer, unsigned nLength)
+{
+	u8 *pTarget = (u8 *) pBuffer;
+	while (nLength > 0)
+	{
+		if (m_nRxOffset >= m_nRxLength)
+		{
+			assert (m_pSocket != 0);
+			int nResult = m_pSocket->Receive (m_RxBuffer, sizeof m_RxBuffer, 0);
+			if (nResult <= 0)
+			{
+				m_bClosed = TRUE;
+
+				return FALSE;
+			}
+
+			m_nRxOffset = 0;
+			m_nRxLength = nResult;
+		}
+
+		unsigned nChunk = m_nRxLength - m_nRxOffset;
+		if (nChunk > nLength)
+		{
+			nChunk = nLength;
+		}
+
+		assert (pTarget != 0);
+		memcpy (pTarget, m_RxBuffer + m_nRxOffset, nChunk);
+
+		pTarget += nChunk;
+		m_nRxOffset += nChunk;
+		nLength -= nChunk;
+	}
+
+	return TRUE;
+}
+
+int CWebSocket::Fail (u16 usStatusCode)
+{
+	Close (usStatusCode);
+
+	m_bClosed = TRUE;
+
+	return -1;
+}
+
+void CWebSocket::NewMaskKey (u8 *pMaskKey)
+{
+	u32 nKey = m_Random.GetNumber ();
+
+	assert (pMaskKey != 0);
+	memcpy (pMaskKey, &nKey, 4);
+}
+
+void CWebSocket::SHA1 (const void *pData, unsigned nLength, u8 *pDigest)
+{
+	u32 H[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+	const u8 *pSource = (const u8 *) pData;
+	u64 nBits = (u64) nLength * 8;
+
+	// the last one or two blocks are padded with 0x80, zeros and the length in bits
+	unsigned nBlocks = (nLength + 8) / 64 + 1;
+	for (unsigned nBlock = 0; nBlock < nBlocks; nBlock++)
+	{
+		u8 Block[64];
+		for (unsigned i = 0; i < 64; i++)
+		{
+			unsigned nPos = nBlock*64 + i;
+			if (nPos < nLength)
+			{
+				Block[i] = pSource[nPos];
+			}
+			else if (nPos == nLength)
+			{
+				Block[i] = 0x80;
+			}
+			else
+			{
+				Block[i] = 0;
+			}
+		}
+
+		if (nBlock == nBlocks-1)
+		{
+			for (unsigned i = 0; i < 8; i++)
+			{
+				Block[56+i] = (u8) (nBits >> (56 - i*8));
+			}
+		}
+
+		u32 W[80];
+		for (unsigned t = 0; t < 16; t++)
+		{
+			W[t] =   (u32) Block[t*4] << 24 | (u32) Block[t*4+1] << 16
+			       | (u32) Block[t*4+2] << 8 | Block[t*4+3];
+		}
+
+		for (unsigned t = 16; t < 80; t++)
+		{
+			u32 nTemp = W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16];
+			W[t] = nTemp << 1 | nTemp >> 31;
+		}
+
+		u32 A = H[0], B = H[1], C = H[2], D = H[3], E = H[4];
+		for (unsigned t = 0; t < 80; t++)
+		{
+			u32 F, K;
+			if (t < 20)
+			{
+				F = (B & C) | (~B & D);
+				K = 0x5A827999;
+			}
+			else if (t < 40)
+			{
+				F = B ^ C ^ D;
+				K = 0x6ED9EBA1;
+			}
+			else if (t < 60)
+			{
+				F = (B & C) | (B & D) | (C & D);
+				K = 0x8F1BBCDC;
+			}
+			else
+			{
+				F = B ^ C ^ D;
+				K = 0xCA62C1D6;
+			}
+
+			u32 nTemp = (A << 5 | A >> 27) + F + E + K + W[t];
+			E = D;
+			D = C;
+			C = B << 30 | B >> 2;
+			B = A;
+			A = nTemp;
+		}
+
+		H[0] += A;
+		H[1] += B;
+		H[2] += C;
+		H[3] += D;
+		H[4] += E;
+	}
+
+	assert (pDigest != 0);
+	for (unsigned i = 0; i < 20; i++)
+	{
+		pDigest[i] = (u8) (H[i / 4] >> (24 - (i % 4) * 8));
+	}
+}
+
+void CWebSocket::Base64Encode (const u8 *pData, unsigned nLength, char *pResult)
+{
+	static const char Alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	assert (pData != 0);
+	assert (pResult != 0);
+
+	for (unsigned i = 0; i < nLength; i += 3)
+	{
+		u32 nGroup = (u32) pData[i] << 16;
+		if (i+1 < nLength)
+		{
+			nGroup |= (u32) pData[i+1] << 8;
+		}
+		if (i+2 < nLength)
+		{
+			nGroup |= pData[i+2];
+		}
+
+		*pResult++ = Alphabet[(nGroup >> 18) & 0x3F];
+		*pResult++ = Alphabet[(nGroup >> 12) & 0x3F];
+		*pResult++ = i+1 < nLength ? Alphabet[(nGroup >> 6) & 0x3F] : '=';
+		*pResult++ = i+2 < nLength ? Alphabet[nGroup & 0x3F] : '=';
+	}
+
+	*pResult = '\0';
+}
@@ -0,0 +1,99 @@
+//
+// netbuffer.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/netbuffer.h>
+#include <circle/atomic.h>
+#include <circle/alloc.h>
+
+void *CNetBuffer::s_pFreeList = 0;
+CSpinLock CNetBuffer::s_SpinLock (TASK_LEVEL);
+
+CNetBuffer::CNetBuffer (unsigned nHeadroom)
+:	m_nRefCount (1),
+	m_pData (m_Buffer + nHeadroom),
+	m_nLength (0),
+	m_nOffloadFlags (0),
+	m_nChecksumStart (0),
+	m_nChecksumOffset (0),
+	m_nSegmentSize (0)
+{
+	assert (nHeadroom < NET_BUFFER_SIZE);
+}
+
+CNetBuffer::~CNetBuffer (void)
+{
+	assert (m_nRefCount == 0);
+	m_pData = 0;
+}
+
+void CNetBuffer::AddRef (void)
+{
+	assert (m_nRefCount > 0);
+	AtomicIncrement (&m_nRefCount);
+}
+
+void CNetBuffer::Release (void)
+{
+	assert (m_nRefCount > 0);
+	if (AtomicDecrement (&m_nRefCount) == 0)
+	{
+		delete this;
+	}
+}
+
+void *CNetBuffer::operator new (size_t nSize)
+{
+	assert (nSize == sizeof (CNetBuffer));
+
+	s_SpinLock.Acquire ();
+
+	void *pBlock = s_pFreeList;
+	if (pBlock != 0)
+	{
+		s_pFreeList = *(void **) pBlock;
+
+		s_SpinLock.Release ();
+
+		return pBlock;
+	}
+
+	s_SpinLock.Release ();
+
+	// the heap returns cache-aligned blocks
+	pBlock = malloc (nSize);
+	assert (pBlock != 0);
+	assert (((uintptr) pBlock & (DATA_CACHE_LINE_LENGTH_MAX-1)) == 0);
+
+	return pBlock;
+}
+
+// freed buffers are kept for reuse, the release of memory to the heap is not required
+
+void CNetBuffer::operator delete (void *pBlock, size_t nSize)
+{
+	assert (pBlock != 0);
+	assert (nSize == sizeof (CNetBuffer));
+
+	s_SpinLock.Acquire ();
+
+	*(void **) pBlock = s_pFreeList;
+	s_pFreeList = pBlock;
+
+	s_SpinLock.Release ();
+}
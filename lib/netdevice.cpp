@@ -2,7 +2,7 @@
 // netdevice.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,6 +18,8 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/netdevice.h>
+#include <circle/netbuffer.h>
+#include <assert.h>
 
 const char *CNetDevice::s_SpeedString[NetDeviceSpeedUnknown] =
 {
@@ -41,6 +43,91 @@ void CNetDevice::AddNetDevice (void)
 	}
 }
 
+void CNetDevice::RegisterLinkChangeHandler (TNetLinkChangeHandler *pHandler, void *pParam)
+{
+	m_pLinkChangeParam = pParam;
+	m_pLinkChangeHandler = pHandler;
+}
+
+void CNetDevice::NotifyLinkChange (void)
+{
+	TNetLinkChangeHandler *pHandler = m_pLinkChangeHandler;
+	if (pHandler != 0)
+	{
+		(*pHandler) (m_pLinkChangeParam);
+	}
+}
+
+boolean CNetDevice::SendBuffer (CNetBuffer *pBuffer)
+{
+	assert (pBuffer != 0);
+
+	return SendFrame (pBuffer->GetData (), pBuffer->GetLength ());
+}
+
+boolean CNetDevice::ReceiveBuffer (CNetBuffer *pBuffer)
+{
+	assert (pBuffer != 0);
+	assert (pBuffer->GetMaxLength () >= FRAME_BUFFER_SIZE);
+
+	unsigned nLength;
+	if (!ReceiveFrame (pBuffer->GetData (), &nLength))
+	{
+		return FALSE;
+	}
+
+	pBuffer->SetLength (nLength);
+
+	return TRUE;
+}
+
+CNetBuffer *CNetDevice::ReceiveNetBuffer (void)
+{
+	CNetBuffer *pBuffer = new CNetBuffer;
+	assert (pBuffer != 0);
+
+	if (!ReceiveBuffer (pBuffer))
+	{
+		pBuffer->Release ();
+
+		return 0;
+	}
+
+	return pBuffer;
+}
+
+unsigned CNetDevice::SendFrames (CNetBuffer *ppBuffer[], unsigned nCount)
+{
+	assert (ppBuffer != 0);
+
+	unsigned i;
+	for (i = 0; i < nCount; i++)
+	{
+		if (!SendBuffer (ppBuffer[i]))
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
+unsigned CNetDevice::ReceiveFrames (CNetBuffer *ppBuffer[], unsigned nMaxCount)
+{
+	assert (ppBuffer != 0);
+
+	unsigned i;
+	for (i = 0; i < nMaxCount; i++)
+	{
+		if ((ppBuffer[i] = ReceiveNetBuffer ()) == 0)
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
 const char *CNetDevice::GetSpeedString (TNetDeviceSpeed Speed)
 {
 	if (Speed >= NetDeviceSpeedUnknown)
@@ -71,7 +158,8 @@ CNetDevice *CNetDevice::GetNetDevice (TNetDeviceType Type)
 			break;
 		}
 
-		if (   Type == NetDeviceTypeAny
+		if (   (   Type == NetDeviceTypeAny
+			&& pDevice->GetType () != NetDeviceTypeLoopback)
 		    || pDevice->GetType () == Type)
 		{
 			return pDevice;
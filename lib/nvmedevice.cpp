@@ -0,0 +1,942 @@
+//
+// nvmedevice.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/nvmedevice.h>
+#include <circle/devicenameservice.h>
+#include <circle/memorymap.h>
+#include <circle/memory.h>
+#include <circle/memio.h>
+#include <circle/multicore.h>
+#include <circle/synchronize.h>
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#ifdef NO_BUSY_WAIT
+	#include <circle/sched/scheduler.h>
+#endif
+#include <assert.h>
+
+// Controller registers
+#define NVME_REG_CAP		0x00
+	#define NVME_CAP_MQES__MASK		0xFFFF		// low word
+	#define NVME_CAP_TO__SHIFT		24
+	#define NVME_CAP_TO__MASK		(0xFF << 24)
+	#define NVME_CAP_DSTRD__MASK		0x0F		// high word
+	#define NVME_CAP_CSS_NVM		(1 << 5)
+	#define NVME_CAP_MPSMIN__SHIFT		16
+	#define NVME_CAP_MPSMIN__MASK		(0x0F << 16)
+#define NVME_REG_VS		0x08
+#define NVME_REG_CC		0x14
+	#define NVME_CC_EN			(1 << 0)
+	#define NVME_CC_SHN__MASK		(3 << 14)
+	#define NVME_CC_SHN_NORMAL		(1 << 14)
+	#define NVME_CC_IOSQES(n)		((n) << 16)	// log2 of entry size
+	#define NVME_CC_IOCQES(n)		((n) << 20)
+#define NVME_REG_CSTS		0x1C
+	#define NVME_CSTS_RDY			(1 << 0)
+	#define NVME_CSTS_CFS			(1 << 1)
+	#define NVME_CSTS_SHST__MASK		(3 << 2)
+	#define NVME_CSTS_SHST_COMPLETE		(2 << 2)
+#define NVME_REG_AQA		0x24
+#define NVME_REG_ASQ		0x28
+#define NVME_REG_ACQ		0x30
+#define NVME_REG_DOORBELL	0x1000
+
+// Admin commands
+#define NVME_ADMIN_CREATE_SQ	0x01
+#define NVME_ADMIN_CREATE_CQ	0x05
+#define NVME_ADMIN_IDENTIFY	0x06
+	#define NVME_IDENTIFY_NAMESPACE		0
+	#define NVME_IDENTIFY_CONTROLLER	1
+#define NVME_ADMIN_SET_FEATURES	0x09
+	#define NVME_FEATURE_NUM_QUEUES		0x07
+
+// NVM commands
+#define NVME_CMD_FLUSH		0x00
+#define NVME_CMD_WRITE		0x01
+#define NVME_CMD_READ		0x02
+
+#define NVME_OPCODE_TO_DEVICE(op)	(((op) & 3) == 1)
+
+#define NVME_NSID		1
+
+#define NVME_PAGE_SIZE		0x1000
+#define NVME_PAGE_MASK		(NVME_PAGE_SIZE-1)
+
+#define NVME_STATUS(status)	((status) >> 1)		// without phase tag
+
+#define NVME_TO_DMA(ptr)	((u64) (uintptr) (ptr) | CBcmPCIeHostBridge::GetDMAAddress ())
+
+static const char From[] = "nvme";
+
+CNVMeDevice::CNVMeDevice (CInterruptSystem *pInterruptSystem)
+:	m_pInterruptSystem (pInterruptSystem),
+	m_PCIeHostBridge (pInterruptSystem),
+	m_nBase (0),
+	m_nDoorbellStride (4),
+	m_nTimeoutMs (500),
+	m_nNextPage (CMemorySystem::GetCoherentPage (COHERENT_SLOT_NVME_START)),
+	m_nEndPage (CMemorySystem::GetCoherentPage (COHERENT_SLOT_NVME_END) + PAGE_SIZE),
+	m_bMSI (FALSE),
+	m_nIOQueues (0),
+	m_nMaxBlocks (NVME_MAX_TRANSFER / NVME_BLOCK_SIZE),
+	m_ullBlockCount (0),
+	m_ullOffset (0),
+	m_bVolatileWriteCache (FALSE),
+	m_pPartitionManager (0)
+{
+}
+
+CNVMeDevice::~CNVMeDevice (void)
+{
+	if (m_nIOQueues > 0)
+	{
+		FlushCache ();
+	}
+
+	if (m_nBase != 0)
+	{
+		WriteReg (NVME_REG_CC, (ReadReg (NVME_REG_CC) & ~NVME_CC_SHN__MASK) | NVME_CC_SHN_NORMAL);
+
+		for (unsigned i = 0; i < m_nTimeoutMs; i++)
+		{
+			if ((ReadReg (NVME_REG_CSTS) & NVME_CSTS_SHST__MASK) == NVME_CSTS_SHST_COMPLETE)
+			{
+				break;
+			}
+
+			CTimer::Get ()->MsDelay (1);
+		}
+
+		m_nBase = 0;
+	}
+
+	delete m_pPartitionManager;
+	m_pPartitionManager = 0;
+
+	m_pInterruptSystem = 0;
+}
+
+boolean CNVMeDevice::Initialize (void)
+{
+	if (!m_PCIeHostBridge.Initialize ())
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot initialize PCIe host bridge");
+
+		return FALSE;
+	}
+
+	if (!m_PCIeHostBridge.EnableDevice (NVME_PCI_CLASS_CODE, NVME_PCIE_SLOT, NVME_PCIE_FUNC))
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot enable NVMe device");
+
+		return FALSE;
+	}
+
+	m_nBase = MEM_PCIE_RANGE_START_VIRTUAL;
+
+	// check capabilities
+	u32 nCapLow = ReadReg (NVME_REG_CAP);
+	u32 nCapHigh = ReadReg (NVME_REG_CAP + 4);
+
+	if ((nCapLow & NVME_CAP_MQES__MASK) + 1 < NVME_QUEUE_ENTRIES)
+	{
+		CLogger::Get ()->Write (From, LogError, "Queue size not supported");
+
+		return FALSE;
+	}
+
+	if (   !(nCapHigh & NVME_CAP_CSS_NVM)
+	    || (nCapHigh & NVME_CAP_MPSMIN__MASK) >> NVME_CAP_MPSMIN__SHIFT != 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Controller not supported");
+
+		return FALSE;
+	}
+
+	m_nTimeoutMs = (nCapLow & NVME_CAP_TO__MASK) >> NVME_CAP_TO__SHIFT;
+	m_nTimeoutMs = m_nTimeoutMs != 0 ? m_nTimeoutMs * 500 : 500;
+
+	m_nDoorbellStride = 4 << (nCapHigh & NVME_CAP_DSTRD__MASK);
+
+	u32 nVersion = ReadReg (NVME_REG_VS);
+	CLogger::Get ()->Write (From, LogDebug, "NVMe version %u.%u", nVersion >> 16,
+				(nVersion >> 8) & 0xFF);
+
+	// reset controller
+	if (ReadReg (NVME_REG_CC) & NVME_CC_EN)
+	{
+		WriteReg (NVME_REG_CC, ReadReg (NVME_REG_CC) & ~NVME_CC_EN);
+	}
+
+	if (!WaitReady (FALSE))
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot reset controller");
+
+		return FALSE;
+	}
+
+	// set admin queue
+	if (!InitQueue (&m_AdminQueue, 0))
+	{
+		return FALSE;
+	}
+
+	WriteReg (NVME_REG_AQA, (NVME_QUEUE_ENTRIES-1) << 16 | (NVME_QUEUE_ENTRIES-1));
+	u64 nASQ = NVME_TO_DMA (m_AdminQueue.pSQ);
+	WriteReg (NVME_REG_ASQ, (u32) nASQ);
+	WriteReg (NVME_REG_ASQ + 4, (u32) (nASQ >> 32));
+	u64 nACQ = NVME_TO_DMA (m_AdminQueue.pCQ);
+	WriteReg (NVME_REG_ACQ, (u32) nACQ);
+	WriteReg (NVME_REG_ACQ + 4, (u32) (nACQ >> 32));
+
+	// enable controller (4K pages, 64 byte SQ entries, 16 byte CQ entries)
+	WriteReg (NVME_REG_CC, NVME_CC_IOCQES (4) | NVME_CC_IOSQES (6) | NVME_CC_EN);
+
+	if (!WaitReady (TRUE))
+	{
+		CLogger::Get ()->Write (From, LogError, "Controller is not ready");
+
+		return FALSE;
+	}
+
+	// enable MSI, one vector for the admin queue and for each I/O queue if possible
+	unsigned nVectors = m_PCIeHostBridge.EnableMSI (NVME_PCIE_SLOT, NVME_PCIE_FUNC,
+							1 + NVME_IO_QUEUES);
+	if (   nVectors > 0
+	    && m_PCIeHostBridge.ConnectMSI (MSIHandler, this))
+	{
+		m_bMSI = TRUE;
+	}
+	else
+	{
+		CLogger::Get ()->Write (From, LogWarning, "MSI not available, polling completions");
+
+		nVectors = 1;
+	}
+
+	// identify controller
+	u8 *pIdentify = (u8 *) AllocatePage ();
+	if (pIdentify == 0)
+	{
+		return FALSE;
+	}
+
+	TNVMeCommand Command;
+	memset (&Command, 0, sizeof Command);
+	Command.CDW0 = NVME_ADMIN_IDENTIFY;
+	Command.CDW10 = NVME_IDENTIFY_CONTROLLER;
+	if (Execute (&m_AdminQueue, &Command, pIdentify, NVME_PAGE_SIZE) != 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot identify controller");
+
+		return FALSE;
+	}
+
+	char Model[41];
+	memcpy (Model, pIdentify + 24, 40);
+	Model[40] = '\0';
+	for (int i = 39; i > 0 && Model[i] == ' '; i--)
+	{
+		Model[i] = '\0';
+	}
+	CLogger::Get ()->Write (From, LogNotice, "%s", Model);
+
+	u8 uchMDTS = pIdentify[77];			// in units of the min. page size
+	if (   uchMDTS != 0
+	    && uchMDTS < 16
+	    && (NVME_PAGE_SIZE << uchMDTS) / NVME_BLOCK_SIZE < (int) m_nMaxBlocks)
+	{
+		m_nMaxBlocks = (NVME_PAGE_SIZE << uchMDTS) / NVME_BLOCK_SIZE;
+	}
+
+	m_bVolatileWriteCache = pIdentify[525] & 1;
+
+	u32 nNamespaces;
+	memcpy (&nNamespaces, pIdentify + 516, sizeof nNamespaces);
+	if (nNamespaces < NVME_NSID)
+	{
+		CLogger::Get ()->Write (From, LogError, "No namespace");
+
+		return FALSE;
+	}
+
+	// identify namespace
+	memset (&Command, 0, sizeof Command);
+	Command.CDW0 = NVME_ADMIN_IDENTIFY;
+	Command.NSID = NVME_NSID;
+	Command.CDW10 = NVME_IDENTIFY_NAMESPACE;
+	if (Execute (&m_AdminQueue, &Command, pIdentify, NVME_PAGE_SIZE) != 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot identify namespace");
+
+		return FALSE;
+	}
+
+	memcpy (&m_ullBlockCount, pIdentify, sizeof m_ullBlockCount);
+	if (m_ullBlockCount == 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Namespace is not active");
+
+		return FALSE;
+	}
+
+	unsigned nFormat = pIdentify[26] & 0x0F;
+	unsigned nBlockSize = 1 << pIdentify[128 + nFormat*4 + 2];
+	if (nBlockSize != NVME_BLOCK_SIZE)
+	{
+		CLogger::Get ()->Write (From, LogError, "Unsupported block size: %u", nBlockSize);
+
+		return FALSE;
+	}
+
+	// create I/O queues
+	memset (&Command, 0, sizeof Command);
+	Command.CDW0 = NVME_ADMIN_SET_FEATURES;
+	Command.CDW10 = NVME_FEATURE_NUM_QUEUES;
+	Command.CDW11 = (NVME_IO_QUEUES-1) << 16 | (NVME_IO_QUEUES-1);
+	u32 nResult;
+	if (Execute (&m_AdminQueue, &Command, 0, 0, &nResult) != 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot set number of queues");
+
+		return FALSE;
+	}
+
+	unsigned nQueues = NVME_IO_QUEUES;
+	if ((nResult & 0xFFFF) + 1 < nQueues)
+	{
+		nQueues = (nResult & 0xFFFF) + 1;
+	}
+	if ((nResult >> 16) + 1 < nQueues)
+	{
+		nQueues = (nResult >> 16) + 1;
+	}
+
+	for (unsigned i = 0; i < nQueues; i++)
+	{
+		TQueue *pQueue = &m_IOQueue[i];
+
+		if (!InitQueue (pQueue, i+1))
+		{
+			return FALSE;
+		}
+
+		pQueue->nVector = (i+1) % nVectors;
+
+		if (!CreateIOQueue (pQueue))
+		{
+			CLogger::Get ()->Write (From, LogError, "Cannot create I/O queue %u", i+1);
+
+			return FALSE;
+		}
+
+		m_nIOQueues++;
+	}
+
+	CLogger::Get ()->Write (From, LogDebug, "%u I/O queue(s), %u MSI vector(s)",
+				m_nIOQueues, m_bMSI ? nVectors : 0);
+
+	CLogger::Get ()->Write (From, LogDebug, "Capacity is %u MByte",
+				(unsigned) (m_ullBlockCount / (MEGABYTE / NVME_BLOCK_SIZE)));
+
+	assert (m_pPartitionManager == 0);
+	m_pPartitionManager = new CPartitionManager (this, "nvme1");
+	assert (m_pPartitionManager != 0);
+	if (!m_pPartitionManager->Initialize ())
+	{
+		return FALSE;
+	}
+
+	CDeviceNameService::Get ()->AddDevice ("nvme1", this, TRUE);
+
+	return TRUE;
+}
+
+int CNVMeDevice::Read (void *pBuffer, size_t nCount)
+{
+	if (   m_ullOffset % NVME_BLOCK_SIZE != 0
+	    || nCount % NVME_BLOCK_SIZE != 0)
+	{
+		return -1;
+	}
+
+	int nResult = ReadBlocks (m_ullOffset / NVME_BLOCK_SIZE, pBuffer, nCount / NVME_BLOCK_SIZE);
+	if (nResult > 0)
+	{
+		m_ullOffset += nResult;
+	}
+
+	return nResult;
+}
+
+int CNVMeDevice::Write (const void *pBuffer, size_t nCount)
+{
+	if (   m_ullOffset % NVME_BLOCK_SIZE != 0
+	    || nCount % NVME_BLOCK_SIZE != 0)
+	{
+		return -1;
+	}
+
+	int nResult = WriteBlocks (m_ullOffset / NVME_BLOCK_SIZE, pBuffer, nCount / NVME_BLOCK_SIZE);
+	if (nResult > 0)
+	{
+		m_ullOffset += nResult;
+	}
+
+	return nResult;
+}
+
+u64 CNVMeDevice::Seek (u64 ullOffset)
+{
+	m_ullOffset = ullOffset;
+
+	return m_ullOffset;
+}
+
+u64 CNVMeDevice::GetSize (void) const
+{
+	return m_ullBlockCount * NVME_BLOCK_SIZE;
+}
+
+int CNVMeDevice::ReadBlocks (u64 ullBlock, void *pBuffer, unsigned nBlocks)
+{
+	return Transfer (FALSE, ullBlock, pBuffer, nBlocks);
+}
+
+int CNVMeDevice::WriteBlocks (u64 ullBlock, const void *pBuffer, unsigned nBlocks)
+{
+	return Transfer (TRUE, ullBlock, (void *) pBuffer, nBlocks);
+}
+
+boolean CNVMeDevice::FlushCache (void)
+{
+	if (!m_bVolatileWriteCache)
+	{
+		return TRUE;
+	}
+
+	TNVMeCommand Command;
+	memset (&Command, 0, sizeof Command);
+	Command.CDW0 = NVME_CMD_FLUSH;
+	Command.NSID = NVME_NSID;
+
+	return Execute (GetIOQueue (), &Command) == 0;
+}
+
+boolean CNVMeDevice::SubmitRequest (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+
+	u64 ullOffset = pRequest->GetOffset ();
+	size_t nCount = pRequest->GetCount ();
+
+	// requests, which do not fit into one command, are processed synchronously
+	if (   !m_bMSI
+	    || ullOffset % NVME_BLOCK_SIZE != 0
+	    || nCount % NVME_BLOCK_SIZE != 0
+	    || nCount / NVME_BLOCK_SIZE > m_nMaxBlocks
+	    || ullOffset / NVME_BLOCK_SIZE + nCount / NVME_BLOCK_SIZE > m_ullBlockCount
+	    || ((uintptr) pRequest->GetBuffer () & 3))
+	{
+		return CDevice::SubmitRequest (pRequest);
+	}
+
+	TNVMeCommand Command;
+	SetupRW (&Command, pRequest->IsWrite (), ullOffset / NVME_BLOCK_SIZE,
+		 nCount / NVME_BLOCK_SIZE);
+
+	if (Submit (GetIOQueue (), &Command, pRequest->GetBuffer (), nCount, pRequest) < 0)
+	{
+		return CDevice::SubmitRequest (pRequest);
+	}
+
+	return TRUE;
+}
+
+boolean CNVMeDevice::InitQueue (TQueue *pQueue, unsigned nID)
+{
+	assert (pQueue != 0);
+
+	pQueue->nID = nID;
+	pQueue->nVector = 0;
+	pQueue->pSQ = (TNVMeCommand *) AllocatePage ();
+	pQueue->pCQ = (TNVMeCompletion *) AllocatePage ();
+	pQueue->nSQTail = 0;
+	pQueue->nCQHead = 0;
+	pQueue->usPhase = 1;
+	pQueue->nSQDoorbell = m_nBase + NVME_REG_DOORBELL + (2*nID) * m_nDoorbellStride;
+	pQueue->nCQDoorbell = m_nBase + NVME_REG_DOORBELL + (2*nID + 1) * m_nDoorbellStride;
+
+	for (unsigned i = 0; i < NVME_MAX_REQUESTS; i++)
+	{
+		TRequest *pRequest = &pQueue->Request[i];
+
+		pRequest->bInUse = FALSE;
+		pRequest->bDone = FALSE;
+		pRequest->bAbandoned = FALSE;
+		pRequest->pBlockRequest = 0;
+		pRequest->pPage = (u64 *) AllocatePage ();
+		pRequest->pCopyBack = 0;
+
+		if (pRequest->pPage == 0)
+		{
+			return FALSE;
+		}
+	}
+
+	return pQueue->pSQ != 0 && pQueue->pCQ != 0;
+}
+
+boolean CNVMeDevice::CreateIOQueue (TQueue *pQueue)
+{
+	assert (pQueue != 0);
+
+	TNVMeCommand Command;
+	memset (&Command, 0, sizeof Command);
+	Command.CDW0 = NVME_ADMIN_CREATE_CQ;
+	Command.PRP1 = NVME_TO_DMA (pQueue->pCQ);
+	Command.CDW10 = (NVME_QUEUE_ENTRIES-1) << 16 | pQueue->nID;
+	Command.CDW11 =   pQueue->nVector << 16
+			| (m_bMSI ? 1 << 1 : 0)			// interrupts enabled
+			| 1 << 0;				// physically contiguous
+	if (Execute (&m_AdminQueue, &Command) != 0)
+	{
+		return FALSE;
+	}
+
+	memset (&Command, 0, sizeof Command);
+	Command.CDW0 = NVME_ADMIN_CREATE_SQ;
+	Command.PRP1 = NVME_TO_DMA (pQueue->pSQ);
+	Command.CDW10 = (NVME_QUEUE_ENTRIES-1) << 16 | pQueue->nID;
+	Command.CDW11 = pQueue->nID << 16 | 1 << 0;		// CQ ID, physically contiguous
+
+	return Execute (&m_AdminQueue, &Command) == 0;
+}
+
+int CNVMeDevice::Submit (TQueue *pQueue, TNVMeCommand *pCommand,
+			 const void *pBuffer, size_t nLength, CBlockRequest *pBlockRequest)
+{
+	assert (pQueue != 0);
+	assert (pCommand != 0);
+
+	boolean bToDevice = NVME_OPCODE_TO_DEVICE (pCommand->CDW0);
+	boolean bBounce = nLength > 0 && ((uintptr) pBuffer & 3);
+
+	if (   nLength > 0
+	    && !bBounce)
+	{
+		CleanAndInvalidateDataCacheRange ((uintptr) pBuffer, nLength);
+	}
+
+	pQueue->SpinLock.Acquire ();
+
+	int nSlot;
+	for (nSlot = 0; nSlot < NVME_MAX_REQUESTS; nSlot++)
+	{
+		if (!pQueue->Request[nSlot].bInUse)
+		{
+			break;
+		}
+	}
+
+	if (nSlot >= NVME_MAX_REQUESTS)
+	{
+		pQueue->SpinLock.Release ();
+
+		return -1;
+	}
+
+	TRequest *pRequest = &pQueue->Request[nSlot];
+	pRequest->bInUse = TRUE;
+	pRequest->bDone = FALSE;
+	pRequest->bAbandoned = FALSE;
+	pRequest->pBlockRequest = pBlockRequest;
+	pRequest->pCopyBack = 0;
+
+	pCommand->CDW0 = (pCommand->CDW0 & 0xFFFF) | (u32) nSlot << 16;
+
+	if (bBounce)
+	{
+		// the page of the slot is used as data buffer
+		assert (nLength <= NVME_PAGE_SIZE);
+		assert (pBlockRequest == 0);
+
+		if (bToDevice)
+		{
+			memcpy (pRequest->pPage, pBuffer, nLength);
+		}
+		else
+		{
+			pRequest->pCopyBack = (void *) pBuffer;
+			pRequest->nCopyLength = nLength;
+		}
+
+		pCommand->PRP1 = NVME_TO_DMA (pRequest->pPage);
+		pCommand->PRP2 = 0;
+	}
+	else if (nLength > 0)
+	{
+		u64 nAddress = NVME_TO_DMA (pBuffer);
+		pCommand->PRP1 = nAddress;
+		pCommand->PRP2 = 0;
+
+		size_t nFirst = NVME_PAGE_SIZE - (nAddress & NVME_PAGE_MASK);
+		if (nLength > nFirst)
+		{
+			u64 nNextPage = nAddress + nFirst;
+			size_t nRest = nLength - nFirst;
+
+			if (nRest <= NVME_PAGE_SIZE)
+			{
+				pCommand->PRP2 = nNextPage;
+			}
+			else
+			{
+				// more than two pages, PRP2 points to the PRP list
+				u64 *pList = pRequest->pPage;
+				unsigned nEntries = 0;
+				while (nRest > 0)
+				{
+					assert (nEntries < NVME_PAGE_SIZE / sizeof (u64));
+					pList[nEntries++] = nNextPage;
+
+					nNextPage += NVME_PAGE_SIZE;
+					nRest -= nRest > NVME_PAGE_SIZE ? NVME_PAGE_SIZE : nRest;
+				}
+
+				pCommand->PRP2 = NVME_TO_DMA (pList);
+			}
+		}
+	}
+
+	memcpy (&pQueue->pSQ[pQueue->nSQTail], pCommand, sizeof *pCommand);
+	if (++pQueue->nSQTail == NVME_QUEUE_ENTRIES)
+	{
+		pQueue->nSQTail = 0;
+	}
+
+	DataSyncBarrier ();
+
+	write32 (pQueue->nSQDoorbell, pQueue->nSQTail);
+
+	pQueue->SpinLock.Release ();
+
+	return nSlot;
+}
+
+int CNVMeDevice::Wait (TQueue *pQueue, int nSlot, u32 *pResult)
+{
+	assert (pQueue != 0);
+	assert (0 <= nSlot && nSlot < NVME_MAX_REQUESTS);
+	TRequest *pRequest = &pQueue->Request[nSlot];
+
+	unsigned nStartTicks = CTimer::Get ()->GetTicks ();
+	while (!pRequest->bDone)
+	{
+		if (!m_bMSI)
+		{
+			ProcessCompletions (pQueue);
+		}
+
+		if (CTimer::Get ()->GetTicks () - nStartTicks >= MSEC2HZ (m_nTimeoutMs) + 1)
+		{
+			pQueue->SpinLock.Acquire ();
+
+			if (!pRequest->bDone)
+			{
+				// the command remains active, ignore its completion
+				pRequest->bAbandoned = TRUE;
+
+				pQueue->SpinLock.Release ();
+
+				CLogger::Get ()->Write (From, LogWarning, "Command timed out");
+
+				return -1;
+			}
+
+			pQueue->SpinLock.Release ();
+
+			break;
+		}
+
+#ifdef NO_BUSY_WAIT
+		CScheduler::Get ()->Yield ();
+#endif
+	}
+
+	DataMemBarrier ();
+
+	int nStatus = pRequest->usStatus;
+	if (pResult != 0)
+	{
+		*pResult = pRequest->nResult;
+	}
+
+	if (   nStatus == 0
+	    && pRequest->pCopyBack != 0)
+	{
+		memcpy (pRequest->pCopyBack, pRequest->pPage, pRequest->nCopyLength);
+	}
+
+	pRequest->bInUse = FALSE;
+
+	return nStatus;
+}
+
+int CNVMeDevice::Execute (TQueue *pQueue, TNVMeCommand *pCommand,
+			  const void *pBuffer, size_t nLength, u32 *pResult)
+{
+	int nSlot;
+	while ((nSlot = Submit (pQueue, pCommand, pBuffer, nLength)) < 0)
+	{
+		// all slots are used by other tasks
+		if (!m_bMSI)
+		{
+			ProcessCompletions (pQueue);
+		}
+
+#ifdef NO_BUSY_WAIT
+		CScheduler::Get ()->Yield ();
+#endif
+	}
+
+	return Wait (pQueue, nSlot, pResult);
+}
+
+int CNVMeDevice::Transfer (boolean bWrite, u64 ullBlock, void *pBuffer, unsigned nBlocks)
+{
+	assert (pBuffer != 0);
+
+	if (   m_nIOQueues == 0
+	    || ullBlock + nBlocks > m_ullBlockCount)
+	{
+		return -1;
+	}
+
+	TQueue *pQueue = GetIOQueue ();
+
+	// unaligned buffers are transferred page by page via the bounce buffer
+	unsigned nMaxBlocks =   (uintptr) pBuffer & 3
+			      ? NVME_PAGE_SIZE / NVME_BLOCK_SIZE : m_nMaxBlocks;
+
+	u8 *pData = (u8 *) pBuffer;
+	unsigned nRemaining = nBlocks;
+	while (nRemaining > 0)
+	{
+		unsigned nChunk = nRemaining < nMaxBlocks ? nRemaining : nMaxBlocks;
+
+		if (TransferChunk (pQueue, bWrite, ullBlock, pData, nChunk) < 0)
+		{
+			return -1;
+		}
+
+		ullBlock += nChunk;
+		pData += nChunk * NVME_BLOCK_SIZE;
+		nRemaining -= nChunk;
+	}
+
+	return nBlocks * NVME_BLOCK_SIZE;
+}
+
+int CNVMeDevice::TransferChunk (TQueue *pQueue, boolean bWrite, u64 ullBlock,
+				void *pBuffer, unsigned nBlocks)
+{
+	TNVMeCommand Command;
+	SetupRW (&Command, bWrite, ullBlock, nBlocks);
+
+	int nStatus = Execute (pQueue, &Command, pBuffer, nBlocks * NVME_BLOCK_SIZE);
+	if (nStatus != 0)
+	{
+		if (nStatus > 0)
+		{
+			CLogger::Get ()->Write (From, LogError, "%s error (status 0x%X)",
+						bWrite ? "Write" : "Read", (unsigned) nStatus);
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void CNVMeDevice::SetupRW (TNVMeCommand *pCommand, boolean bWrite, u64 ullBlock,
+			   unsigned nBlocks)
+{
+	assert (pCommand != 0);
+	assert (nBlocks > 0);
+
+	memset (pCommand, 0, sizeof *pCommand);
+	pCommand->CDW0 = bWrite ? NVME_CMD_WRITE : NVME_CMD_READ;
+	pCommand->NSID = NVME_NSID;
+	pCommand->CDW10 = (u32) ullBlock;
+	pCommand->CDW11 = (u32) (ullBlock >> 32);
+	pCommand->CDW12 = nBlocks - 1;
+}
+
+void CNVMeDevice::ProcessCompletions (TQueue *pQueue)
+{
+	assert (pQueue != 0);
+
+	CBlockRequest *Completed[NVME_MAX_REQUESTS];
+	int Result[NVME_MAX_REQUESTS];
+	unsigned nCompleted = 0;
+
+	pQueue->SpinLock.Acquire ();
+
+	boolean bUpdate = FALSE;
+	volatile TNVMeCompletion *pEntry;
+	while (((pEntry = &pQueue->pCQ[pQueue->nCQHead])->Status & 1) == pQueue->usPhase)
+	{
+		unsigned nSlot = pEntry->CID;
+		if (nSlot < NVME_MAX_REQUESTS)
+		{
+			TRequest *pRequest = &pQueue->Request[nSlot];
+			assert (pRequest->bInUse);
+
+			pRequest->usStatus = NVME_STATUS (pEntry->Status);
+			pRequest->nResult = pEntry->DW0;
+
+			if (pRequest->bAbandoned)
+			{
+				pRequest->bInUse = FALSE;
+			}
+			else if (pRequest->pBlockRequest != 0)
+			{
+				assert (nCompleted < NVME_MAX_REQUESTS);
+				Completed[nCompleted] = pRequest->pBlockRequest;
+				Result[nCompleted] =   pRequest->usStatus == 0
+						     ? (int) pRequest->pBlockRequest->GetCount () : -1;
+				nCompleted++;
+
+				pRequest->bInUse = FALSE;
+			}
+			else
+			{
+				DataMemBarrier ();
+
+				pRequest->bDone = TRUE;
+			}
+		}
+
+		if (++pQueue->nCQHead == NVME_QUEUE_ENTRIES)
+		{
+			pQueue->nCQHead = 0;
+			pQueue->usPhase ^= 1;
+		}
+
+		bUpdate = TRUE;
+	}
+
+	if (bUpdate)
+	{
+		write32 (pQueue->nCQDoorbell, pQueue->nCQHead);
+	}
+
+	pQueue->SpinLock.Release ();
+
+	for (unsigned i = 0; i < nCompleted; i++)
+	{
+		Completed[i]->Complete (Result[i]);
+	}
+}
+
+CNVMeDevice::TQueue *CNVMeDevice::GetIOQueue (void)
+{
+	assert (m_nIOQueues > 0);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	return &m_IOQueue[CMultiCoreSupport::ThisCore () % m_nIOQueues];
+#else
+	return &m_IOQueue[0];
+#endif
+}
+
+uintptr CNVMeDevice::AllocatePage (void)
+{
+	if (m_nNextPage + NVME_PAGE_SIZE > m_nEndPage)
+	{
+		CLogger::Get ()->Write (From, LogError, "Coherent memory exhausted");
+
+		return 0;
+	}
+
+	uintptr nPage = m_nNextPage;
+	m_nNextPage += NVME_PAGE_SIZE;
+
+	memset ((void *) nPage, 0, NVME_PAGE_SIZE);
+
+	return nPage;
+}
+
+boolean CNVMeDevice::WaitReady (boolean bReady)
+{
+	for (unsigned i = 0; i < m_nTimeoutMs; i++)
+	{
+		u32 nStatus = ReadReg (NVME_REG_CSTS);
+		if (nStatus & NVME_CSTS_CFS)
+		{
+			CLogger::Get ()->Write (From, LogError, "Controller fatal status");
+
+			return FALSE;
+		}
+
+		if (!!(nStatus & NVME_CSTS_RDY) == !!bReady)
+		{
+			return TRUE;
+		}
+
+		CTimer::Get ()->MsDelay (1);
+	}
+
+	return FALSE;
+}
+
+u32 CNVMeDevice::ReadReg (unsigned nOffset) const
+{
+	assert (m_nBase != 0);
+
+	return read32 (m_nBase + nOffset);
+}
+
+void CNVMeDevice::WriteReg (unsigned nOffset, u32 nValue)
+{
+	assert (m_nBase != 0);
+
+	write32 (m_nBase + nOffset, nValue);
+}
+
+void CNVMeDevice::MSIHandler (unsigned nVector, void *pParam)
+{
+	CNVMeDevice *pThis = (CNVMeDevice *) pParam;
+	assert (pThis != 0);
+
+	if (pThis->m_AdminQueue.nVector == nVector)
+	{
+		pThis->ProcessCompletions (&pThis->m_AdminQueue);
+	}
+
+	for (unsigned i = 0; i < pThis->m_nIOQueues; i++)
+	{
+		if (pThis->m_IOQueue[i].nVector == nVector)
+		{
+			pThis->ProcessCompletions (&pThis->m_IOQueue[i]);
+		}
+	}
+}
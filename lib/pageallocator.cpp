@@ -2,7 +2,7 @@
 // pageallocator.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,19 +19,33 @@
 //
 #include <circle/pageallocator.h>
 #include <circle/logger.h>
+#ifdef ARM_ALLOW_MULTI_CORE
+	#include <circle/multicore.h>
+#endif
 #include <assert.h>
 
 #define PAGE_MASK	(PAGE_SIZE-1)
 
 CPageAllocator::CPageAllocator (void)
-:	m_pNext (0),
+:	m_pBase (0),
 	m_pLimit (0),
+	m_nFreePages (0)
 #ifdef PAGE_DEBUG
-	m_nCount (0),
-	m_nMaxCount (0),
+	, m_nCount (0),
+	m_nMaxCount (0)
 #endif
-	m_pFreeList (0)
 {
+	for (unsigned i = 0; i <= PAGE_MAX_ORDER; i++)
+	{
+		m_pFreeList[i] = 0;
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	for (unsigned i = 0; i < CORES; i++)
+	{
+		m_CoreCache[i].nCount = 0;
+	}
+#endif
 }
 
 CPageAllocator::~CPageAllocator (void)
@@ -40,52 +54,128 @@ CPageAllocator::~CPageAllocator (void)
 
 void CPageAllocator::Setup (uintptr nBase, size_t nSize)
 {
-	m_pNext = (u8 *) ((nBase + PAGE_SIZE-1) & ~PAGE_MASK);
+	m_pBase = (u8 *) ((nBase + PAGE_SIZE-1) & ~PAGE_MASK);
 	m_pLimit = (u8 *) ((nBase + nSize) & ~PAGE_MASK);
+
+	if (m_pLimit > m_pBase + PAGE_MAX_PAGES * PAGE_SIZE)
+	{
+		m_pLimit = m_pBase + PAGE_MAX_PAGES * PAGE_SIZE;
+	}
+
+	for (unsigned i = 0; i < PAGE_MAX_PAGES; i++)
+	{
+		m_PageInfo[i] = PAGE_INFO_NONE;
+	}
+
+	// split the region into the largest blocks, which are aligned to their size
+	u8 *pBlock = m_pBase;
+	while (pBlock < m_pLimit)
+	{
+		unsigned nOrder = PAGE_MAX_ORDER;
+		while (   nOrder > 0
+		       && (   ((uintptr) pBlock & ((PAGE_SIZE << nOrder)-1)) != 0
+			   || pBlock + (PAGE_SIZE << nOrder) > m_pLimit))
+		{
+			nOrder--;
+		}
+
+		InsertFree (pBlock, nOrder);
+		m_nFreePages += 1 << nOrder;
+
+		pBlock += PAGE_SIZE << nOrder;
+	}
 }
 
 size_t CPageAllocator::GetFreeSpace (void) const
 {
-	return m_pLimit - m_pNext;
+	return (size_t) m_nFreePages * PAGE_SIZE;
 }
 
 void *CPageAllocator::Allocate (void)
 {
-	assert (m_pNext != 0);
+	assert (m_pBase != 0);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	EnterCritical (IRQ_LEVEL);
+
+	TCoreCache *pCache = &m_CoreCache[CMultiCoreSupport::ThisCore ()];
+	if (pCache->nCount > 0)
+	{
+		void *pPage = pCache->pPage[--pCache->nCount];
+
+		LeaveCritical ();
+
+		return pPage;
+	}
+
+	LeaveCritical ();
+#endif
 
 	m_SpinLock.Acquire ();
 
-#ifdef PAGE_DEBUG
-	if (++m_nCount > m_nMaxCount)
+	void *pPage = AllocateBlock (0);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	// refill the cache of this core with a half of its size
+	pCache = &m_CoreCache[CMultiCoreSupport::ThisCore ()];
+	while (   pPage != 0
+	       && pCache->nCount < PAGE_CORE_CACHE_SIZE/2)
 	{
-		m_nMaxCount = m_nCount;
+		void *pCachePage = AllocateBlock (0);
+		if (pCachePage == 0)
+		{
+			break;
+		}
+
+		pCache->pPage[pCache->nCount++] = pCachePage;
 	}
 #endif
 
-	TFreePage *pFreePage;
-	if ((pFreePage = m_pFreeList) != 0)
+	m_SpinLock.Release ();
+
+	return pPage;				// TODO: system should panic on 0
+}
+
+void *CPageAllocator::AllocateContiguous (size_t nSize, size_t nAlign, size_t nBoundary)
+{
+	assert (m_pBase != 0);
+	assert (nSize > 0);
+	assert ((nAlign & (nAlign-1)) == 0);
+	assert ((nBoundary & (nBoundary-1)) == 0);
+
+	size_t nPages = (nSize + PAGE_SIZE-1) / PAGE_SIZE;
+
+	unsigned nOrder = 0;
+	while (   ((size_t) 1 << nOrder) < nPages
+	       || ((size_t) PAGE_SIZE << nOrder) < nAlign)
 	{
-		assert (pFreePage->nMagic == FREEPAGE_MAGIC);
-		m_pFreeList = pFreePage->pNext;
-		pFreePage->nMagic = 0;
+		nOrder++;
 	}
-	else
+
+	if (   nOrder > PAGE_MAX_ORDER
+	    || (   nBoundary != 0
+		&& ((size_t) PAGE_SIZE << nOrder) > nBoundary))
 	{
-		pFreePage = (TFreePage *) m_pNext;
+		return 0;
+	}
 
-		m_pNext += PAGE_SIZE;
+	m_SpinLock.Acquire ();
 
-		if (m_pNext > m_pLimit)
-		{
-			m_SpinLock.Release ();
+	void *pBlock = AllocateBlock (nOrder);
 
-			return 0;		// TODO: system should panic here
-		}
+#ifdef ARM_ALLOW_MULTI_CORE
+	if (pBlock == 0)
+	{
+		// the cached pages may prevent merging
+		FlushCoreCache ();
+
+		pBlock = AllocateBlock (nOrder);
 	}
+#endif
 
 	m_SpinLock.Release ();
 
-	return pFreePage;
+	return pBlock;
 }
 
 void CPageAllocator::Free (void *pPage)
@@ -95,19 +185,38 @@ void CPageAllocator::Free (void *pPage)
 		return;
 	}
 
-	TFreePage *pFreePage = (TFreePage *) pPage;
+	assert ((u8 *) pPage >= m_pBase);
+	assert ((u8 *) pPage < m_pLimit);
+	assert (((uintptr) pPage & PAGE_MASK) == 0);
 
-	m_SpinLock.Acquire ();
+	unsigned nInfo = m_PageInfo[GetIndex (pPage)];
+	assert (!(nInfo & PAGE_INFO_FREE));
+	assert (nInfo != PAGE_INFO_NONE);
+	unsigned nOrder = nInfo & PAGE_INFO_ORDER_MASK;
 
-	pFreePage->nMagic = FREEPAGE_MAGIC;
+#ifdef ARM_ALLOW_MULTI_CORE
+	if (nOrder == 0)
+	{
+		EnterCritical (IRQ_LEVEL);
 
-	pFreePage->pNext = m_pFreeList;
-	m_pFreeList = pFreePage;
+		TCoreCache *pCache = &m_CoreCache[CMultiCoreSupport::ThisCore ()];
+		if (pCache->nCount < PAGE_CORE_CACHE_SIZE)
+		{
+			pCache->pPage[pCache->nCount++] = pPage;
 
-#ifdef PAGE_DEBUG
-	m_nCount--;
+			LeaveCritical ();
+
+			return;
+		}
+
+		LeaveCritical ();
+	}
 #endif
 
+	m_SpinLock.Acquire ();
+
+	FreeBlock ((u8 *) pPage, nOrder);
+
 	m_SpinLock.Release ();
 }
 
@@ -115,7 +224,138 @@ void CPageAllocator::Free (void *pPage)
 
 void CPageAllocator::DumpStatus (void)
 {
-	CLogger::Get ()->Write ("pager", LogDebug, "%u pages (max %u)", m_nCount, m_nMaxCount);
+	CLogger::Get ()->Write ("pager", LogDebug, "%u blocks (max %u), %u pages free",
+				m_nCount, m_nMaxCount, m_nFreePages);
+}
+
+#endif
+
+// the following functions must be called with m_SpinLock acquired
+
+void *CPageAllocator::AllocateBlock (unsigned nOrder)
+{
+	assert (nOrder <= PAGE_MAX_ORDER);
+
+	unsigned nFreeOrder = nOrder;
+	while (m_pFreeList[nFreeOrder] == 0)
+	{
+		if (++nFreeOrder > PAGE_MAX_ORDER)
+		{
+			return 0;
+		}
+	}
+
+	u8 *pBlock = (u8 *) m_pFreeList[nFreeOrder];
+	RemoveFree (pBlock, nFreeOrder);
+
+	// split the block and free the upper halves
+	while (nFreeOrder > nOrder)
+	{
+		nFreeOrder--;
+
+		InsertFree (pBlock + (PAGE_SIZE << nFreeOrder), nFreeOrder);
+	}
+
+	m_PageInfo[GetIndex (pBlock)] = nOrder;
+
+	assert (m_nFreePages >= 1U << nOrder);
+	m_nFreePages -= 1 << nOrder;
+
+#ifdef PAGE_DEBUG
+	if (++m_nCount > m_nMaxCount)
+	{
+		m_nMaxCount = m_nCount;
+	}
+#endif
+
+	return pBlock;
+}
+
+void CPageAllocator::FreeBlock (u8 *pBlock, unsigned nOrder)
+{
+	m_PageInfo[GetIndex (pBlock)] = PAGE_INFO_NONE;
+	m_nFreePages += 1 << nOrder;
+
+#ifdef PAGE_DEBUG
+	m_nCount--;
+#endif
+
+	// merge with the free buddy blocks
+	while (nOrder < PAGE_MAX_ORDER)
+	{
+		u8 *pBuddy = (u8 *) ((uintptr) pBlock ^ (PAGE_SIZE << nOrder));
+		if (   pBuddy < m_pBase
+		    || pBuddy >= m_pLimit
+		    || m_PageInfo[GetIndex (pBuddy)] != (PAGE_INFO_FREE | nOrder))
+		{
+			break;
+		}
+
+		RemoveFree (pBuddy, nOrder);
+
+		if (pBuddy < pBlock)
+		{
+			pBlock = pBuddy;
+		}
+
+		nOrder++;
+	}
+
+	InsertFree (pBlock, nOrder);
+}
+
+void CPageAllocator::InsertFree (u8 *pBlock, unsigned nOrder)
+{
+	assert (nOrder <= PAGE_MAX_ORDER);
+
+	TFreePage *pFreePage = (TFreePage *) pBlock;
+
+	pFreePage->nMagic = FREEPAGE_MAGIC;
+	pFreePage->pPrev = 0;
+	pFreePage->pNext = m_pFreeList[nOrder];
+	if (pFreePage->pNext != 0)
+	{
+		pFreePage->pNext->pPrev = pFreePage;
+	}
+	m_pFreeList[nOrder] = pFreePage;
+
+	m_PageInfo[GetIndex (pBlock)] = PAGE_INFO_FREE | nOrder;
+}
+
+void CPageAllocator::RemoveFree (u8 *pBlock, unsigned nOrder)
+{
+	TFreePage *pFreePage = (TFreePage *) pBlock;
+	assert (pFreePage->nMagic == FREEPAGE_MAGIC);
+
+	if (pFreePage->pPrev != 0)
+	{
+		pFreePage->pPrev->pNext = pFreePage->pNext;
+	}
+	else
+	{
+		assert (m_pFreeList[nOrder] == pFreePage);
+		m_pFreeList[nOrder] = pFreePage->pNext;
+	}
+
+	if (pFreePage->pNext != 0)
+	{
+		pFreePage->pNext->pPrev = pFreePage->pPrev;
+	}
+
+	pFreePage->nMagic = 0;
+
+	m_PageInfo[GetIndex (pBlock)] = PAGE_INFO_NONE;
+}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+
+void CPageAllocator::FlushCoreCache (void)
+{
+	TCoreCache *pCache = &m_CoreCache[CMultiCoreSupport::ThisCore ()];
+	while (pCache->nCount > 0)
+	{
+		FreeBlock ((u8 *) pCache->pPage[--pCache->nCount], 0);
+	}
 }
 
 #endif
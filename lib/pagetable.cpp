@@ -68,6 +68,11 @@ CPageTable::CPageTable (u32 nMemSize)
 		{
 			nAttributes = ARMV6MMUL1SECTION_COHERENT;
 		}
+		else if (   nBaseAddress >= MEM_UNCACHED_REGION
+			 && nBaseAddress <  MEM_HEAP_START)
+		{
+			nAttributes = ARMV6MMUL1SECTION_UNCACHED;
+		}
 		else if (nBaseAddress < nMemSize)
 		{
 			nAttributes = ARMV6MMUL1SECTION_NORMAL_XN;
@@ -174,11 +179,17 @@ u64 *CPageTable::CreateLevel2Table (u64 nBaseAddress)
 				pDesc->SH	= ATTRIB_SH_OUTER_SHAREABLE;
 			}
 			else if (   nBaseAddress >= MEM_COHERENT_REGION
-				 && nBaseAddress <  MEM_HEAP_START)
+				 && nBaseAddress <  MEM_UNCACHED_REGION)
 			{
 				pDesc->AttrIndx = ATTRINDX_COHERENT;
 				pDesc->SH	= ATTRIB_SH_OUTER_SHAREABLE;
 			}
+			else if (   nBaseAddress >= MEM_UNCACHED_REGION
+				 && nBaseAddress <  MEM_HEAP_START)
+			{
+				pDesc->AttrIndx = ATTRINDX_UNCACHED;
+				pDesc->SH	= ATTRIB_SH_OUTER_SHAREABLE;
+			}
 
 			if (nBaseAddress == MEM_PCIE_RANGE_START_VIRTUAL)
 			{
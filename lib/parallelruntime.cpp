@@ -0,0 +1,285 @@
+//
+// parallelruntime.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/parallelruntime.h>
+
+#ifdef ARM_ALLOW_MULTI_CORE
+
+#include <assert.h>
+
+#define DEQUE_MASK	(PARALLEL_DEQUE_SIZE-1)
+
+#if (PARALLEL_DEQUE_SIZE & DEQUE_MASK) != 0
+	#error PARALLEL_DEQUE_SIZE must be a power of 2
+#endif
+
+CParallelRuntime *CParallelRuntime::s_pThis = 0;
+
+CParallelRuntime::CParallelRuntime (CMemorySystem *pMemorySystem)
+:	CMultiCoreSupport (pMemorySystem)
+{
+	assert (s_pThis == 0);
+	s_pThis = this;
+}
+
+CParallelRuntime::~CParallelRuntime (void)
+{
+	s_pThis = 0;
+}
+
+void CParallelRuntime::Run (unsigned nCore)
+{
+	assert (nCore < CORES);
+	if (nCore == 0)
+	{
+		return;
+	}
+
+	while (1)
+	{
+		if (!ExecuteOne (nCore))
+		{
+			// the event register is set, if a job was submitted after the check
+			WaitForEvent ();
+		}
+	}
+}
+
+void CParallelRuntime::Submit (TJobFunction *pFunction, void *pParam, CJobGroup *pGroup)
+{
+	assert (pFunction != 0);
+
+	TJob Job;
+	Job.pFunction = pFunction;
+	Job.pForFunction = 0;
+	Job.pParam = pParam;
+	Job.pGroup = pGroup;
+
+	Enqueue (Job);
+}
+
+void CParallelRuntime::ParallelFor (unsigned nBegin, unsigned nEnd, unsigned nGrain,
+				    TParallelForFunction *pFunction, void *pParam)
+{
+	assert (pFunction != 0);
+	assert (nGrain > 0);
+
+	if (nBegin >= nEnd)
+	{
+		return;
+	}
+
+	CJobGroup Group;
+
+	TJob Job;
+	Job.pFunction = 0;
+	Job.pForFunction = pFunction;
+	Job.pParam = pParam;
+	Job.pGroup = &Group;
+	Job.nBegin = nBegin;
+	Job.nEnd = nEnd;
+	Job.nGrain = nGrain;
+
+	__atomic_add_fetch (&Group.m_nPending, 1, __ATOMIC_RELAXED);
+	Execute (&Job, ThisCore ());
+
+	Wait (&Group);
+}
+
+void CParallelRuntime::Wait (CJobGroup *pGroup)
+{
+	assert (pGroup != 0);
+
+	unsigned nCore = ThisCore ();
+	while (!pGroup->IsComplete ())
+	{
+		if (!ExecuteOne (nCore))
+		{
+			WaitForEvent ();
+		}
+	}
+}
+
+CParallelRuntime *CParallelRuntime::Get (void)
+{
+	assert (s_pThis != 0);
+	return s_pThis;
+}
+
+void CParallelRuntime::Enqueue (const TJob &rJob)
+{
+	if (rJob.pGroup != 0)
+	{
+		__atomic_add_fetch (&rJob.pGroup->m_nPending, 1, __ATOMIC_RELAXED);
+	}
+
+	unsigned nCore = ThisCore ();
+	if (!m_Deque[nCore].Push (rJob))
+	{
+		TJob Job = rJob;
+		Execute (&Job, nCore);
+
+		return;
+	}
+
+	DataSyncBarrier ();
+	SendEvent ();
+}
+
+boolean CParallelRuntime::ExecuteOne (unsigned nCore)
+{
+	TJob Job;
+	if (!m_Deque[nCore].Pop (&Job))
+	{
+		unsigned i;
+		for (i = 1; i < CORES; i++)
+		{
+			if (m_Deque[(nCore + i) % CORES].Steal (&Job))
+			{
+				break;
+			}
+		}
+
+		if (i == CORES)
+		{
+			return FALSE;
+		}
+	}
+
+	Execute (&Job, nCore);
+
+	return TRUE;
+}
+
+void CParallelRuntime::Execute (TJob *pJob, unsigned nCore)
+{
+	assert (pJob != 0);
+
+	if (pJob->pForFunction != 0)
+	{
+		// split off the upper half as long as the range is larger than the grain
+		while (pJob->nEnd - pJob->nBegin > pJob->nGrain)
+		{
+			TJob Upper = *pJob;
+			Upper.nBegin = pJob->nBegin + (pJob->nEnd - pJob->nBegin) / 2;
+
+			assert (Upper.pGroup != 0);
+			__atomic_add_fetch (&Upper.pGroup->m_nPending, 1, __ATOMIC_RELAXED);
+
+			if (!m_Deque[nCore].Push (Upper))
+			{
+				__atomic_sub_fetch (&Upper.pGroup->m_nPending, 1, __ATOMIC_RELAXED);
+
+				break;
+			}
+
+			DataSyncBarrier ();
+			SendEvent ();
+
+			pJob->nEnd = Upper.nBegin;
+		}
+
+		(*pJob->pForFunction) (pJob->nBegin, pJob->nEnd, pJob->pParam);
+	}
+	else
+	{
+		assert (pJob->pFunction != 0);
+		(*pJob->pFunction) (pJob->pParam);
+	}
+
+	if (pJob->pGroup != 0)
+	{
+		if (__atomic_sub_fetch (&pJob->pGroup->m_nPending, 1, __ATOMIC_RELEASE) == 0)
+		{
+			DataSyncBarrier ();
+			SendEvent ();		// wake up waiting cores
+		}
+	}
+}
+
+void CJobGroup::Wait (void)
+{
+	CParallelRuntime::Get ()->Wait (this);
+}
+
+boolean CParallelRuntime::CJobDeque::Push (const TJob &rJob)
+{
+	int nBottom = __atomic_load_n (&m_nBottom, __ATOMIC_RELAXED);
+	int nTop = __atomic_load_n (&m_nTop, __ATOMIC_ACQUIRE);
+	if (nBottom - nTop > DEQUE_MASK)
+	{
+		return FALSE;
+	}
+
+	m_Job[nBottom & DEQUE_MASK] = rJob;
+
+	__atomic_store_n (&m_nBottom, nBottom+1, __ATOMIC_RELEASE);
+
+	return TRUE;
+}
+
+boolean CParallelRuntime::CJobDeque::Pop (TJob *pJob)
+{
+	int nBottom = __atomic_load_n (&m_nBottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n (&m_nBottom, nBottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+	int nTop = __atomic_load_n (&m_nTop, __ATOMIC_RELAXED);
+	if (nTop > nBottom)
+	{
+		__atomic_store_n (&m_nBottom, nBottom+1, __ATOMIC_RELAXED);	// was empty
+
+		return FALSE;
+	}
+
+	assert (pJob != 0);
+	*pJob = m_Job[nBottom & DEQUE_MASK];
+
+	if (nTop == nBottom)
+	{
+		// last job, race against thieves
+		boolean bWon = __atomic_compare_exchange_n (&m_nTop, &nTop, nTop+1, false,
+							    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+
+		__atomic_store_n (&m_nBottom, nBottom+1, __ATOMIC_RELAXED);
+
+		return bWon;
+	}
+
+	return TRUE;
+}
+
+boolean CParallelRuntime::CJobDeque::Steal (TJob *pJob)
+{
+	int nTop = __atomic_load_n (&m_nTop, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	int nBottom = __atomic_load_n (&m_nBottom, __ATOMIC_ACQUIRE);
+	if (nTop >= nBottom)
+	{
+		return FALSE;
+	}
+
+	assert (pJob != 0);
+	*pJob = m_Job[nTop & DEQUE_MASK];
+
+	return __atomic_compare_exchange_n (&m_nTop, &nTop, nTop+1, false,
+					    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,364 @@
+//
+// perfcounters.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/perfcounters.h>
+#include <circle/interrupt.h>
+#include <circle/multicore.h>
+#include <circle/bcm2836.h>
+#include <circle/memio.h>
+#include <circle/synchronize.h>
+#include <circle/sysconfig.h>
+#include <assert.h>
+
+#if RASPPI >= 2
+
+#if AARCH == 32
+	#define PMCR		"c9, c12, 0"
+	#define PMCNTENSET	"c9, c12, 1"
+	#define PMCNTENCLR	"c9, c12, 2"
+	#define PMOVSCLR	"c9, c12, 3"
+	#define PMSELR		"c9, c12, 5"
+	#define PMCEID0		"c9, c12, 6"
+	#define PMCEID1		"c9, c12, 7"
+	#define PMCCNTR		"c9, c13, 0"
+	#define PMXEVTYPER	"c9, c13, 1"
+	#define PMXEVCNTR	"c9, c13, 2"
+	#define PMINTENSET	"c9, c14, 1"
+	#define PMINTENCLR	"c9, c14, 2"
+
+	#define READ_PMU(reg, value)	asm volatile ("mrc p15, 0, %0, " reg : "=r" (value))
+	#define WRITE_PMU(reg, value)	asm volatile ("mcr p15, 0, %0, " reg : : "r" (value))
+#else
+	#define PMCR		"pmcr_el0"
+	#define PMCNTENSET	"pmcntenset_el0"
+	#define PMCNTENCLR	"pmcntenclr_el0"
+	#define PMOVSCLR	"pmovsclr_el0"
+	#define PMSELR		"pmselr_el0"
+	#define PMCEID0		"pmceid0_el0"
+	#define PMCEID1		"pmceid1_el0"
+	#define PMCCNTR		"pmccntr_el0"
+	#define PMXEVTYPER	"pmxevtyper_el0"
+	#define PMXEVCNTR	"pmxevcntr_el0"
+	#define PMINTENSET	"pmintenset_el1"
+	#define PMINTENCLR	"pmintenclr_el1"
+
+	#define READ_PMU(reg, value)	asm volatile ("mrs %0, " reg : "=r" (value))
+	#define WRITE_PMU(reg, value)	asm volatile ("msr " reg ", %0" : : "r" (value))
+#endif
+
+#define PMCR_E			(1 << 0)	// enable all counters
+#define PMCR_P			(1 << 1)	// reset event counters
+#define PMCR_C			(1 << 2)	// reset cycle counter
+#define PMCR_LC			(1 << 6)	// 64-bit cycle counter overflow (AArch64 only)
+#define PMCR_N_SHIFT		11
+#define PMCR_N_MASK		(0x1F << 11)
+
+#define PMCNTEN_CYCLES		(1U << 31)
+
+#define PMSELR_CYCLES		31		// selects PMCCFILTR via PMXEVTYPER
+
+#endif
+
+CPerfCounters::CPerfCounters (void)
+:	m_nEventCounters (GetEventCounters ()),
+	m_pOverflowHandler (0),
+	m_pOverflowParam (0),
+	m_nOverflowPeriod (0),
+	m_nOverflowCounter (0),
+	m_nIRQ (0)
+{
+#if RASPPI >= 2
+	uintptr nValue = 0;
+	WRITE_PMU (PMCR, nValue);			// stop counting
+
+	nValue = ~0U;
+	WRITE_PMU (PMCNTENCLR, nValue);
+	WRITE_PMU (PMINTENCLR, nValue);
+	WRITE_PMU (PMOVSCLR, nValue);
+
+	nValue = PMSELR_CYCLES;				// count cycles in all modes
+	WRITE_PMU (PMSELR, nValue);
+	nValue = 0;
+	WRITE_PMU (PMXEVTYPER, nValue);
+
+	nValue = PMCNTEN_CYCLES;
+	WRITE_PMU (PMCNTENSET, nValue);
+
+	InstructionSyncBarrier ();
+#endif
+}
+
+CPerfCounters::~CPerfCounters (void)
+{
+	DisconnectOverflowHandler ();
+
+	Stop ();
+}
+
+unsigned CPerfCounters::GetEventCounters (void)
+{
+#if RASPPI >= 2
+	uintptr nPMCR;
+	READ_PMU (PMCR, nPMCR);
+
+	return (nPMCR & PMCR_N_MASK) >> PMCR_N_SHIFT;
+#else
+	return 0;
+#endif
+}
+
+boolean CPerfCounters::IsEventSupported (TPerfEvent Event)
+{
+#if RASPPI >= 2
+	unsigned nEvent = Event;
+
+	uintptr nPMCEID;
+	if (nEvent < 32)
+	{
+		READ_PMU (PMCEID0, nPMCEID);
+	}
+	else if (nEvent < 64)
+	{
+		READ_PMU (PMCEID1, nPMCEID);
+	}
+	else
+	{
+		return FALSE;
+	}
+
+	return nPMCEID & (1U << (nEvent & 31)) ? TRUE : FALSE;
+#else
+	return FALSE;
+#endif
+}
+
+boolean CPerfCounters::SetEvent (unsigned nCounter, TPerfEvent Event)
+{
+#if RASPPI >= 2
+	if (   nCounter >= m_nEventCounters
+	    || (   m_pOverflowHandler != 0
+		&& nCounter == m_nOverflowCounter)
+	    || !IsEventSupported (Event))
+	{
+		return FALSE;
+	}
+
+	uintptr nValue = nCounter;
+	WRITE_PMU (PMSELR, nValue);
+	InstructionSyncBarrier ();
+	nValue = Event;
+	WRITE_PMU (PMXEVTYPER, nValue);
+
+	nValue = 1 << nCounter;
+	WRITE_PMU (PMCNTENSET, nValue);
+
+	InstructionSyncBarrier ();
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+void CPerfCounters::Start (void)
+{
+#if RASPPI >= 2
+	uintptr nValue = PMCR_P | PMCR_C;
+	WRITE_PMU (PMCR, nValue);
+	InstructionSyncBarrier ();
+
+	if (m_pOverflowHandler != 0)
+	{
+		// re-arm the overflow counter, which has been reset with the others
+		nValue = m_nOverflowCounter;
+		WRITE_PMU (PMSELR, nValue);
+		InstructionSyncBarrier ();
+		nValue = (u32) -m_nOverflowPeriod;
+		WRITE_PMU (PMXEVCNTR, nValue);
+	}
+
+#if AARCH == 32
+	nValue = PMCR_E;
+#else
+	nValue = PMCR_E | PMCR_LC;
+#endif
+	WRITE_PMU (PMCR, nValue);
+
+	InstructionSyncBarrier ();
+#endif
+}
+
+void CPerfCounters::Stop (void)
+{
+#if RASPPI >= 2
+	uintptr nValue;
+	READ_PMU (PMCR, nValue);
+	nValue &= ~PMCR_E;
+	WRITE_PMU (PMCR, nValue);
+
+	InstructionSyncBarrier ();
+#endif
+}
+
+u64 CPerfCounters::GetCycles (void) const
+{
+#if RASPPI >= 2
+	uintptr nValue;
+	READ_PMU (PMCCNTR, nValue);
+
+	return nValue;
+#else
+	return 0;
+#endif
+}
+
+u32 CPerfCounters::GetCount (unsigned nCounter) const
+{
+#if RASPPI >= 2
+	assert (nCounter < m_nEventCounters);
+
+	uintptr nValue = nCounter;
+	WRITE_PMU (PMSELR, nValue);
+	InstructionSyncBarrier ();
+	READ_PMU (PMXEVCNTR, nValue);
+
+	return nValue;
+#else
+	return 0;
+#endif
+}
+
+boolean CPerfCounters::ConnectOverflowHandler (u32 nPeriod, TPerfOverflowHandler *pHandler,
+					       void *pParam)
+{
+#if RASPPI >= 2
+	assert (nPeriod > 0);
+	assert (pHandler != 0);
+	assert (m_pOverflowHandler == 0);
+
+	if (   m_nEventCounters == 0
+	    || !IsEventSupported (PerfEventCPUCycles))
+	{
+		return FALSE;
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	unsigned nCore = CMultiCoreSupport::ThisCore ();
+#else
+	unsigned nCore = 0;
+#endif
+
+#if RASPPI >= 4
+	m_nIRQ = ARM_IRQLOCAL0_PMU + nCore;
+#else
+	if (nCore != 0)			// local IRQs are handled on core 0 only
+	{
+		return FALSE;
+	}
+
+	m_nIRQ = ARM_IRQLOCAL0_PMU;
+#endif
+
+	m_nOverflowCounter = m_nEventCounters-1;
+	m_nOverflowPeriod = nPeriod;
+	m_pOverflowParam = pParam;
+	m_pOverflowHandler = pHandler;
+
+	uintptr nValue = m_nOverflowCounter;
+	WRITE_PMU (PMSELR, nValue);
+	InstructionSyncBarrier ();
+	nValue = PerfEventCPUCycles;
+	WRITE_PMU (PMXEVTYPER, nValue);
+	nValue = (u32) -m_nOverflowPeriod;
+	WRITE_PMU (PMXEVCNTR, nValue);
+
+	nValue = 1 << m_nOverflowCounter;
+	WRITE_PMU (PMOVSCLR, nValue);
+	WRITE_PMU (PMINTENSET, nValue);
+	WRITE_PMU (PMCNTENSET, nValue);
+
+	InstructionSyncBarrier ();
+
+#if RASPPI >= 4
+#ifdef ARM_ALLOW_MULTI_CORE
+	CInterruptSystem::SetIRQTarget (m_nIRQ, nCore);
+#endif
+	write32 (ARM_LOCAL_PM_ROUTING_SET, 1 << nCore);	// PMU IRQ of this core to the GIC
+#endif
+
+	CInterruptSystem::Get ()->ConnectIRQ (m_nIRQ, InterruptHandler, this);
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+void CPerfCounters::DisconnectOverflowHandler (void)
+{
+#if RASPPI >= 2
+	if (m_pOverflowHandler == 0)
+	{
+		return;
+	}
+
+	uintptr nValue = 1 << m_nOverflowCounter;
+	WRITE_PMU (PMINTENCLR, nValue);
+	WRITE_PMU (PMCNTENCLR, nValue);
+	WRITE_PMU (PMOVSCLR, nValue);
+
+	InstructionSyncBarrier ();
+
+	CInterruptSystem::Get ()->DisconnectIRQ (m_nIRQ);
+
+	m_pOverflowHandler = 0;
+#endif
+}
+
+void CPerfCounters::InterruptHandler (void *pParam)
+{
+#if RASPPI >= 2
+	CPerfCounters *pThis = (CPerfCounters *) pParam;
+	assert (pThis != 0);
+
+	uintptr nOverflow;
+	READ_PMU (PMOVSCLR, nOverflow);
+	WRITE_PMU (PMOVSCLR, nOverflow);
+
+	if (!(nOverflow & (1 << pThis->m_nOverflowCounter)))
+	{
+		return;
+	}
+
+	uintptr nPMSELR;				// may be in use by the interrupted code
+	READ_PMU (PMSELR, nPMSELR);
+
+	uintptr nValue = pThis->m_nOverflowCounter;
+	WRITE_PMU (PMSELR, nValue);
+	InstructionSyncBarrier ();
+	nValue = (u32) -pThis->m_nOverflowPeriod;
+	WRITE_PMU (PMXEVCNTR, nValue);
+
+	WRITE_PMU (PMSELR, nPMSELR);
+	InstructionSyncBarrier ();
+
+	assert (pThis->m_pOverflowHandler != 0);
+	(*pThis->m_pOverflowHandler) (pThis->m_pOverflowParam);
+#endif
+}
@@ -2,7 +2,7 @@
 // pwmoutput.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,6 +22,7 @@
 #include <circle/timer.h>
 #include <circle/memio.h>
 #include <circle/synchronize.h>
+#include <circle/new.h>
 #include <assert.h>
 
 //
@@ -60,12 +61,22 @@
 #define ARM_PWM_STA_STA3	(1 << 11)
 #define ARM_PWM_STA_STA4	(1 << 12)
 
+//
+// PWM DMA configuration register
+//
+#define ARM_PWM_DMAC_DREQ__SHIFT	0
+#define ARM_PWM_DMAC_PANIC__SHIFT	8
+#define ARM_PWM_DMAC_ENAB		(1 << 31)
+
 CPWMOutput::CPWMOutput (TGPIOClockSource Source, unsigned nDivider, unsigned nRange, boolean bMSMode)
 :	m_Clock (GPIOClockPWM, Source),
 	m_nDivider (nDivider),
 	m_nRange (nRange),
 	m_bMSMode (bMSMode),
-	m_bActive (FALSE)
+	m_bActive (FALSE),
+	m_pFIFOBuffers (0),
+	m_pFIFOHandler (0),
+	m_pFIFOParam (0)
 {
 }
 
@@ -109,6 +120,22 @@ void CPWMOutput::Stop (void)
 	assert (m_bActive);
 	m_bActive = FALSE;
 
+	if (m_pFIFOBuffers != 0)
+	{
+		m_pFIFOBuffers->Cancel ();
+		while (m_pFIFOBuffers->IsActive ())
+		{
+			// wait for the last chunk
+		}
+
+		PeripheralEntry ();
+		write32 (ARM_PWM_DMAC, 0);
+		PeripheralExit ();
+
+		delete m_pFIFOBuffers;
+		m_pFIFOBuffers = 0;
+	}
+
 	m_Clock.Stop ();
 	CTimer::SimpleusDelay (2000);
 
@@ -123,6 +150,7 @@ void CPWMOutput::Stop (void)
 void CPWMOutput::Write (unsigned nChannel, unsigned nValue)
 {
 	assert (m_bActive);
+	assert (m_pFIFOBuffers == 0);
 	assert (   nChannel == PWM_CHANNEL1
 		|| nChannel == PWM_CHANNEL2);
 	assert (nValue <= m_nRange);
@@ -142,3 +170,83 @@ void CPWMOutput::Write (unsigned nChannel, unsigned nValue)
 
 	m_SpinLock.Release ();
 }
+
+boolean CPWMOutput::StartFIFO (CInterruptSystem *pInterruptSystem, TPWMFIFOHandler *pHandler,
+			       void *pParam, unsigned nChunkSize, boolean bBothChannels)
+{
+	assert (!m_bActive);
+	assert (m_pFIFOBuffers == 0);
+	assert (pInterruptSystem != 0);
+	assert (pHandler != 0);
+	assert (nChunkSize > 0);
+
+	m_pFIFOHandler = pHandler;
+	m_pFIFOParam = pParam;
+
+	m_pFIFOBuffers = new CDMASoundBuffers (TRUE, ARM_PWM_FIF1, DREQSourcePWM, nChunkSize,
+					       pInterruptSystem);
+	if (m_pFIFOBuffers == 0)
+	{
+		return FALSE;
+	}
+
+	assert (1 <= m_nDivider && m_nDivider <= 4095);
+	m_Clock.Start (m_nDivider);
+	CTimer::SimpleusDelay (2000);
+
+	PeripheralEntry ();
+
+	write32 (ARM_PWM_RNG1, m_nRange);
+	write32 (ARM_PWM_RNG2, m_nRange);
+
+	u32 nControl = ARM_PWM_CTL_PWEN1 | ARM_PWM_CTL_USEF1 | ARM_PWM_CTL_CLRF1;
+	if (bBothChannels)
+	{
+		nControl |= ARM_PWM_CTL_PWEN2 | ARM_PWM_CTL_USEF2;
+	}
+
+	if (m_bMSMode)
+	{
+		nControl |= ARM_PWM_CTL_MSEN1 | ARM_PWM_CTL_MSEN2;
+	}
+
+	write32 (ARM_PWM_CTL, nControl);
+	CTimer::SimpleusDelay (2000);
+
+	write32 (ARM_PWM_DMAC,   ARM_PWM_DMAC_ENAB
+			       | (7 << ARM_PWM_DMAC_PANIC__SHIFT)
+			       | (7 << ARM_PWM_DMAC_DREQ__SHIFT));
+
+	PeripheralExit ();
+
+	m_bActive = TRUE;
+
+	if (!m_pFIFOBuffers->Start (FIFOHandlerStub, this))
+	{
+		Stop ();
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean CPWMOutput::IsFIFOActive (void) const
+{
+	return m_pFIFOBuffers != 0 && m_pFIFOBuffers->IsActive ();
+}
+
+unsigned CPWMOutput::FIFOHandlerStub (boolean bStatus, u32 *pBuffer, unsigned nChunkSize,
+				      void *pParam)
+{
+	CPWMOutput *pThis = (CPWMOutput *) pParam;
+	assert (pThis != 0);
+
+	if (!bStatus)
+	{
+		return 0;
+	}
+
+	assert (pThis->m_pFIFOHandler != 0);
+	return (*pThis->m_pFIFOHandler) (pBuffer, nChunkSize, pThis->m_pFIFOParam);
+}
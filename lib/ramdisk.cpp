@@ -0,0 +1,221 @@
+//
+// ramdisk.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/ramdisk.h>
+#include <circle/devicenameservice.h>
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <assert.h>
+
+LOGMODULE ("ramdisk");
+
+CRAMDiskDevice::CRAMDiskDevice (u64 ullSize, unsigned nIndex, int nHeapType)
+:	m_ullSize ((ullSize + RAMDISK_CHUNK_SIZE-1) & ~((u64) RAMDISK_CHUNK_SIZE-1)),
+	m_nIndex (nIndex),
+	m_nHeapType (nHeapType),
+	m_nChunks ((unsigned) (m_ullSize / RAMDISK_CHUNK_SIZE)),
+	m_ppChunk (0),
+	m_nAllocatedChunks (0),
+	m_ullOffset (0)
+{
+	assert (m_nChunks > 0);
+}
+
+CRAMDiskDevice::~CRAMDiskDevice (void)
+{
+	if (m_ppChunk != 0)
+	{
+		CDeviceNameService::Get ()->RemoveDevice ("ram", m_nIndex, TRUE);
+
+		for (unsigned i = 0; i < m_nChunks; i++)
+		{
+			if (m_ppChunk[i] != 0)
+			{
+				CMemorySystem::HeapFree (m_ppChunk[i]);
+			}
+		}
+
+		delete [] m_ppChunk;
+		m_ppChunk = 0;
+	}
+}
+
+boolean CRAMDiskDevice::Initialize (void)
+{
+	assert (m_ppChunk == 0);
+	m_ppChunk = new u8 *[m_nChunks];
+	if (m_ppChunk == 0)
+	{
+		return FALSE;
+	}
+
+	for (unsigned i = 0; i < m_nChunks; i++)
+	{
+		m_ppChunk[i] = 0;
+	}
+
+	CDeviceNameService::Get ()->AddDevice ("ram", m_nIndex, this, TRUE);
+
+	LOGNOTE ("ram%u: %llu KB", m_nIndex, m_ullSize / 1024);
+
+	return TRUE;
+}
+
+int CRAMDiskDevice::Read (void *pBuffer, size_t nCount)
+{
+	assert (m_ppChunk != 0);
+
+	if (   m_ullOffset + nCount > m_ullSize
+	    || nCount > 0x7FFFFFFF)
+	{
+		return -1;
+	}
+
+	u8 *pDest = (u8 *) pBuffer;
+	size_t nRemaining = nCount;
+	while (nRemaining > 0)
+	{
+		unsigned nChunk = (unsigned) (m_ullOffset / RAMDISK_CHUNK_SIZE);
+		unsigned nChunkOffset = (unsigned) (m_ullOffset % RAMDISK_CHUNK_SIZE);
+		size_t nBytes = RAMDISK_CHUNK_SIZE - nChunkOffset;
+		if (nBytes > nRemaining)
+		{
+			nBytes = nRemaining;
+		}
+
+		const u8 *pChunk = m_ppChunk[nChunk];
+		if (pChunk != 0)
+		{
+			memcpy (pDest, pChunk + nChunkOffset, nBytes);
+		}
+		else
+		{
+			memset (pDest, 0, nBytes);
+		}
+
+		pDest += nBytes;
+		nRemaining -= nBytes;
+		m_ullOffset += nBytes;
+	}
+
+	return (int) nCount;
+}
+
+int CRAMDiskDevice::Write (const void *pBuffer, size_t nCount)
+{
+	assert (m_ppChunk != 0);
+
+	if (   m_ullOffset + nCount > m_ullSize
+	    || nCount > 0x7FFFFFFF)
+	{
+		return -1;
+	}
+
+	const u8 *pSrc = (const u8 *) pBuffer;
+	size_t nRemaining = nCount;
+	while (nRemaining > 0)
+	{
+		unsigned nChunk = (unsigned) (m_ullOffset / RAMDISK_CHUNK_SIZE);
+		unsigned nChunkOffset = (unsigned) (m_ullOffset % RAMDISK_CHUNK_SIZE);
+		size_t nBytes = RAMDISK_CHUNK_SIZE - nChunkOffset;
+		if (nBytes > nRemaining)
+		{
+			nBytes = nRemaining;
+		}
+
+		// zeros written to an unallocated chunk need no memory (e.g. from formatting)
+		u8 *pChunk = m_ppChunk[nChunk];
+		if (   pChunk == 0
+		    && !IsZero (pSrc, nBytes))
+		{
+			pChunk = AllocateChunk (nChunk);
+			if (pChunk == 0)
+			{
+				LOGWARN ("Out of memory");
+
+				return -1;
+			}
+		}
+
+		if (pChunk != 0)
+		{
+			memcpy (pChunk + nChunkOffset, pSrc, nBytes);
+		}
+
+		pSrc += nBytes;
+		nRemaining -= nBytes;
+		m_ullOffset += nBytes;
+	}
+
+	return (int) nCount;
+}
+
+u64 CRAMDiskDevice::Seek (u64 ullOffset)
+{
+	if (ullOffset >= m_ullSize)
+	{
+		return (u64) -1;
+	}
+
+	m_ullOffset = ullOffset;
+
+	return m_ullOffset;
+}
+
+u64 CRAMDiskDevice::GetSize (void) const
+{
+	return m_ullSize;
+}
+
+u64 CRAMDiskDevice::GetAllocatedSize (void) const
+{
+	return (u64) m_nAllocatedChunks * RAMDISK_CHUNK_SIZE;
+}
+
+u8 *CRAMDiskDevice::AllocateChunk (unsigned nChunk)
+{
+	assert (m_ppChunk != 0);
+	assert (nChunk < m_nChunks);
+	assert (m_ppChunk[nChunk] == 0);
+
+	u8 *pChunk = (u8 *) CMemorySystem::HeapAllocate (RAMDISK_CHUNK_SIZE, m_nHeapType);
+	if (pChunk != 0)
+	{
+		memset (pChunk, 0, RAMDISK_CHUNK_SIZE);
+
+		m_ppChunk[nChunk] = pChunk;
+		m_nAllocatedChunks++;
+	}
+
+	return pChunk;
+}
+
+boolean CRAMDiskDevice::IsZero (const void *pBuffer, size_t nCount)
+{
+	const u8 *p = (const u8 *) pBuffer;
+	while (nCount--)
+	{
+		if (*p++ != 0)
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,126 @@
+//
+// rcu.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/rcu.h>
+#include <circle/multicore.h>
+#include <circle/spinlock.h>
+#include <assert.h>
+
+#ifdef ARM_ALLOW_MULTI_CORE
+
+CRCU::TReader CRCU::s_Reader[CORES];
+
+volatile u32 CRCU::s_nEpoch = 1;
+
+static CSpinLock s_SpinLock (TASK_LEVEL);	// serializes Synchronize()
+
+void CRCU::ReadLock (void)
+{
+	// a nested read section from IRQ context must not see a half updated slot
+	EnterCritical (IRQ_LEVEL);
+
+	TReader *pReader = &s_Reader[CMultiCoreSupport::ThisCore ()];
+	if (pReader->nNesting++ == 0)
+	{
+		pReader->nEpoch = __atomic_load_n (&s_nEpoch, __ATOMIC_RELAXED);
+
+		// the slot must be visible before the shared pointer is read
+		DataSyncBarrier ();
+	}
+
+	LeaveCritical ();
+}
+
+void CRCU::ReadUnlock (void)
+{
+	EnterCritical (IRQ_LEVEL);
+
+	TReader *pReader = &s_Reader[CMultiCoreSupport::ThisCore ()];
+	assert (pReader->nNesting > 0);
+	if (--pReader->nNesting == 0)
+	{
+		DataMemBarrier ();
+
+		pReader->nEpoch = 0;
+	}
+
+	LeaveCritical ();
+}
+
+void CRCU::Synchronize (void)
+{
+	assert (CurrentExecutionLevel () == TASK_LEVEL);
+
+	unsigned nThisCore = CMultiCoreSupport::ThisCore ();
+	assert (s_Reader[nThisCore].nNesting == 0);
+
+	s_SpinLock.Acquire ();
+
+	// the new pointer must be visible, before the slots are checked
+	DataSyncBarrier ();
+
+	u32 nEpoch = s_nEpoch + 1;
+	if (nEpoch == 0)
+	{
+		nEpoch = 1;
+	}
+
+	__atomic_store_n (&s_nEpoch, nEpoch, __ATOMIC_RELEASE);
+	DataSyncBarrier ();
+
+	// a reader, which has entered its section with an older epoch, may still see the old
+	// version, a reader with the new epoch has read the new pointer
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		if (nCore == nThisCore)
+		{
+			continue;
+		}
+
+		u32 nReaderEpoch;
+		while (   (nReaderEpoch = s_Reader[nCore].nEpoch) != 0
+		       && nReaderEpoch != nEpoch)
+		{
+			asm volatile ("yield");
+		}
+	}
+
+	DataMemBarrier ();
+
+	s_SpinLock.Release ();
+}
+
+#else
+
+void CRCU::ReadLock (void)
+{
+}
+
+void CRCU::ReadUnlock (void)
+{
+}
+
+void CRCU::Synchronize (void)
+{
+	assert (CurrentExecutionLevel () == TASK_LEVEL);
+
+	DataMemBarrier ();
+}
+
+#endif
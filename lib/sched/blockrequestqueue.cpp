@@ -0,0 +1,207 @@
+//
+// blockrequestqueue.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/sched/blockrequestqueue.h>
+#include <assert.h>
+
+CBlockRequestQueue::CBlockRequestQueue (CDevice *pDevice, const char *pName)
+:	m_pDevice (pDevice),
+	m_pList (0),
+	m_ullPosition (0),
+	m_bStop (FALSE),
+	m_SpinLock (TASK_LEVEL)
+{
+	assert (m_pDevice != 0);
+
+	SetName (pName);
+}
+
+CBlockRequestQueue::~CBlockRequestQueue (void)
+{
+	assert (m_pList == 0);
+
+	m_pDevice = 0;
+}
+
+boolean CBlockRequestQueue::Submit (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	pRequest->m_pNext = 0;
+
+	m_SpinLock.Acquire ();
+
+	if (m_bStop)
+	{
+		m_SpinLock.Release ();
+
+		return FALSE;
+	}
+
+	// insert behind requests with the same or lower offset
+	CBlockRequest **ppRequest = &m_pList;
+	while (   *ppRequest != 0
+	       && (*ppRequest)->m_ullOffset <= pRequest->m_ullOffset)
+	{
+		ppRequest = &(*ppRequest)->m_pNext;
+	}
+
+	pRequest->m_pNext = *ppRequest;
+	*ppRequest = pRequest;
+
+	m_SpinLock.Release ();
+
+	m_Event.Set ();
+
+	return TRUE;
+}
+
+void CBlockRequestQueue::Stop (void)
+{
+	m_SpinLock.Acquire ();
+	m_bStop = TRUE;
+	m_SpinLock.Release ();
+
+	m_Event.Set ();
+
+	WaitForTermination ();
+}
+
+void CBlockRequestQueue::Run (void)
+{
+	while (1)
+	{
+		m_SpinLock.Acquire ();
+
+		CBlockRequest *pRequests = TakeNext ();
+		if (pRequests == 0)
+		{
+			if (m_bStop)
+			{
+				m_SpinLock.Release ();
+
+				break;
+			}
+
+			m_Event.Clear ();
+
+			m_SpinLock.Release ();
+
+			m_Event.Wait ();
+
+			continue;
+		}
+
+		boolean bStop = m_bStop;
+
+		m_SpinLock.Release ();
+
+		if (bStop)
+		{
+			while (pRequests != 0)
+			{
+				CBlockRequest *pNext = pRequests->m_pNext;
+				pRequests->Complete (-1);
+				pRequests = pNext;
+			}
+
+			continue;
+		}
+
+		Process (pRequests);
+	}
+}
+
+CBlockRequest *CBlockRequestQueue::TakeNext (void)
+{
+	if (m_pList == 0)
+	{
+		return 0;
+	}
+
+	// continue upwards from the current position, restart at the lowest offset
+	CBlockRequest **ppFirst = &m_pList;
+	while (   *ppFirst != 0
+	       && (*ppFirst)->m_ullOffset < m_ullPosition)
+	{
+		ppFirst = &(*ppFirst)->m_pNext;
+	}
+
+	if (*ppFirst == 0)
+	{
+		ppFirst = &m_pList;
+	}
+
+	// extend the run by the following requests, which can be merged
+	CBlockRequest *pFirst = *ppFirst;
+	CBlockRequest *pLast = pFirst;
+	size_t nCount = pFirst->m_nCount;
+	while (pLast->m_pNext != 0)
+	{
+		CBlockRequest *pNext = pLast->m_pNext;
+		if (   pNext->m_bWrite != pFirst->m_bWrite
+		    || pNext->m_ullOffset != pFirst->m_ullOffset + nCount
+		    || pNext->m_pBuffer != (u8 *) pFirst->m_pBuffer + nCount
+		    || nCount + pNext->m_nCount > BLOCK_QUEUE_MAX_MERGE)
+		{
+			break;
+		}
+
+		nCount += pNext->m_nCount;
+		pLast = pNext;
+	}
+
+	*ppFirst = pLast->m_pNext;
+	pLast->m_pNext = 0;
+
+	return pFirst;
+}
+
+void CBlockRequestQueue::Process (CBlockRequest *pRequests)
+{
+	assert (pRequests != 0);
+
+	size_t nCount = 0;
+	for (CBlockRequest *pRequest = pRequests; pRequest != 0; pRequest = pRequest->m_pNext)
+	{
+		nCount += pRequest->m_nCount;
+	}
+
+	u64 ullOffset = pRequests->m_ullOffset;
+
+	int nResult = -1;
+	assert (m_pDevice != 0);
+	if (m_pDevice->Seek (ullOffset) == ullOffset)
+	{
+		nResult =   pRequests->m_bWrite
+			  ? m_pDevice->Write (pRequests->m_pBuffer, nCount)
+			  : m_pDevice->Read (pRequests->m_pBuffer, nCount);
+	}
+
+	m_ullPosition = ullOffset + nCount;
+
+	boolean bOK = nResult == (int) nCount;
+
+	while (pRequests != 0)
+	{
+		// the completion routine may delete the request
+		CBlockRequest *pNext = pRequests->m_pNext;
+		pRequests->Complete (bOK ? (int) pRequests->m_nCount : -1);
+		pRequests = pNext;
+	}
+}
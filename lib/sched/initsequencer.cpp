@@ -0,0 +1,207 @@
+//
+// initsequencer.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/sched/initsequencer.h>
+#include <circle/sched/task.h>
+#include <circle/boottrace.h>
+#include <circle/logger.h>
+#include <assert.h>
+
+static const char FromInit[] = "init";
+
+class CInitStepTask : public CTask	/// Runs one step of CInitSequencer
+{
+public:
+	CInitStepTask (CInitSequencer *pSequencer, unsigned nIndex, const char *pName,
+		       unsigned nAffinity)
+	:	CTask (TASK_STACK_SIZE, TRUE),
+		m_pSequencer (pSequencer),
+		m_nIndex (nIndex)
+	{
+		SetName (pName);
+
+		if (nAffinity != 0)
+		{
+			SetAffinity (nAffinity);
+		}
+
+		Start ();
+	}
+
+	void Run (void)
+	{
+		m_pSequencer->RunStep (m_nIndex);
+	}
+
+private:
+	CInitSequencer *m_pSequencer;
+	unsigned m_nIndex;
+};
+
+CInitSequencer::CInitSequencer (void)
+:	m_nSteps (0),
+	m_nAllSteps (0),
+	m_nStarted (0),
+	m_nCompleted (0),
+	m_nFailed (0)
+{
+}
+
+CInitSequencer::~CInitSequencer (void)
+{
+	assert ((m_nCompleted & m_nStarted) == m_nStarted);
+}
+
+u32 CInitSequencer::AddStep (const char *pName, TInitStepHandler *pHandler, void *pParam,
+			     u32 nDependsOn)
+{
+	assert (m_nSteps < INIT_MAX_STEPS);
+	assert (pName != 0);
+	assert (pHandler != 0);
+	assert ((nDependsOn & ~m_nAllSteps) == 0);	// steps have to be added in order
+
+	TStep *pStep = &m_Step[m_nSteps];
+	pStep->pName = pName;
+	pStep->pHandler = pHandler;
+	pStep->pParam = pParam;
+	pStep->nDependsOn = nDependsOn;
+	pStep->nAffinity = 0;
+
+	u32 nStep = 1U << m_nSteps++;
+	m_nAllSteps |= nStep;
+
+	return nStep;
+}
+
+void CInitSequencer::SetAffinity (u32 nStep, unsigned nCoreMask)
+{
+	assert (nStep != 0);
+	unsigned nIndex = __builtin_ctz (nStep);
+	assert (nIndex < m_nSteps);
+	assert (!(m_nStarted & nStep));
+
+	m_Step[nIndex].nAffinity = nCoreMask;
+}
+
+void CInitSequencer::Start (u32 nSteps)
+{
+	nSteps &= m_nAllSteps;
+
+	// add the dependencies, a step depends on steps with a lower index only
+	for (int i = m_nSteps-1; i >= 0; i--)
+	{
+		if (nSteps & (1U << i))
+		{
+			nSteps |= m_Step[i].nDependsOn;
+		}
+	}
+
+	nSteps &= ~m_nStarted;
+	m_nStarted |= nSteps;
+
+	for (unsigned i = 0; i < m_nSteps; i++)
+	{
+		if (nSteps & (1U << i))
+		{
+			new CInitStepTask (this, i, m_Step[i].pName, m_Step[i].nAffinity);
+		}
+	}
+}
+
+boolean CInitSequencer::Wait (u32 nSteps)
+{
+	nSteps &= m_nAllSteps;
+	assert ((nSteps & m_nStarted) == nSteps);
+
+	while (!IsComplete (nSteps))
+	{
+		m_Event.Clear ();
+
+		if (IsComplete (nSteps))	// a step may have completed meanwhile
+		{
+			break;
+		}
+
+		m_Event.Wait ();
+	}
+
+	return !(m_nFailed & nSteps);
+}
+
+boolean CInitSequencer::IsComplete (u32 nSteps) const
+{
+	nSteps &= m_nAllSteps;
+
+	return (m_nCompleted & nSteps) == nSteps;
+}
+
+void CInitSequencer::RunStep (unsigned nIndex)
+{
+	assert (nIndex < m_nSteps);
+	TStep *pStep = &m_Step[nIndex];
+
+	u32 nDependsOn = pStep->nDependsOn;
+	while (!IsComplete (nDependsOn))
+	{
+		m_Event.Clear ();
+
+		if (IsComplete (nDependsOn))
+		{
+			break;
+		}
+
+		m_Event.Wait ();
+	}
+
+	if (m_nFailed & nDependsOn)
+	{
+		CompleteStep (nIndex, FALSE);
+
+		return;
+	}
+
+	assert (pStep->pHandler != 0);
+	boolean bOK = (*pStep->pHandler) (pStep->pParam);
+	if (!bOK)
+	{
+		CLogger::Get ()->Write (FromInit, LogError, "Step %s failed", pStep->pName);
+	}
+
+	CompleteStep (nIndex, bOK);
+}
+
+void CInitSequencer::CompleteStep (unsigned nIndex, boolean bOK)
+{
+	assert (nIndex < m_nSteps);
+
+	CBootTrace::Mark (m_Step[nIndex].pName);
+
+	m_SpinLock.Acquire ();
+
+	if (!bOK)
+	{
+		m_nFailed |= 1U << nIndex;
+	}
+
+	m_nCompleted |= 1U << nIndex;
+
+	m_SpinLock.Release ();
+
+	m_Event.Set ();
+}
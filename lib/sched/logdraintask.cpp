@@ -0,0 +1,60 @@
+//
+// logdraintask.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/sched/logdraintask.h>
+#include <circle/sched/scheduler.h>
+#include <circle/logger.h>
+#include <assert.h>
+
+CLogDrainTask::CLogDrainTask (unsigned nIntervalMs)
+:	m_nIntervalMs (nIntervalMs),
+	m_bStop (FALSE)
+{
+	SetName ("logdrain");
+	SetPriority (TASK_PRIORITY_LOW);
+
+	CLogger::Get ()->EnableDeferredMode ();
+}
+
+CLogDrainTask::~CLogDrainTask (void)
+{
+}
+
+void CLogDrainTask::Stop (void)
+{
+	m_bStop = TRUE;
+
+	WaitForTermination ();
+}
+
+void CLogDrainTask::Run (void)
+{
+	CLogger *pLogger = CLogger::Get ();
+	assert (pLogger != 0);
+
+	while (!m_bStop)
+	{
+		if (pLogger->FlushDeferred () == 0)
+		{
+			CScheduler::Get ()->MsSleep (m_nIntervalMs);
+		}
+	}
+
+	pLogger->FlushDeferred ();
+}
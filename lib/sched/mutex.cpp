@@ -55,6 +55,13 @@ void CMutex::Acquire (void)
             m_iReentrancyCount++;
             return;
         }
+
+        // priority inheritance: the owner must not be delayed by medium priority tasks
+        if (m_pOwningTask->GetEffectivePriority () < pTask->GetEffectivePriority ())
+        {
+            m_pOwningTask->SetEffectivePriority (pTask->GetEffectivePriority ());
+        }
+
         m_event.Wait();
     }
 }
@@ -65,6 +72,9 @@ void CMutex::Release (void)
     m_iReentrancyCount--;
     if (m_iReentrancyCount == 0)
     {
+        // drop an inherited priority
+        m_pOwningTask->SetEffectivePriority (m_pOwningTask->GetPriority ());
+
         m_pOwningTask = 0;
         m_event.Pulse();
         CScheduler::Get()->Yield();
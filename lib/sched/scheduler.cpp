@@ -2,7 +2,7 @@
 // scheduler.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,6 +19,8 @@
 //
 #include <circle/sched/scheduler.h>
 #include <circle/timer.h>
+#include <circle/tracer.h>
+#include <circle/synchronize.h>
 #include <circle/logger.h>
 #include <circle/string.h>
 #include <circle/util.h>
@@ -29,19 +31,48 @@ static const char FromScheduler[] = "sched";
 CScheduler *CScheduler::s_pThis = 0;
 
 CScheduler::CScheduler (void)
-:	m_nTasks (0),
-	m_pCurrent (0),
-	m_nCurrent (0),
+:	m_pTaskListHead (0),
+	m_pTaskListTail (0),
 	m_pTaskSwitchHandler (0),
 	m_pTaskTerminationHandler (0),
-	m_iSuspendNewTasks (0)
+	m_iSuspendNewTasks (0),
+	m_bPreemptionEnabled (FALSE)
 {
 	assert (s_pThis == 0);
 	s_pThis = this;
 
-	m_pCurrent = new CTask (0);		// main task currently running
-	assert (m_pCurrent != 0);
-	m_pCurrent->SetName ("main");
+#if RASPPI >= 2
+#if AARCH == 32
+	u32 nCNTFRQ;
+	asm volatile ("mrc p15, 0, %0, c14, c0, 0" : "=r" (nCNTFRQ));
+#else
+	u64 nCNTFRQ;
+	asm volatile ("mrs %0, CNTFRQ_EL0" : "=r" (nCNTFRQ));
+#endif
+	m_nTimestampFrequency = nCNTFRQ;
+#else
+	m_nTimestampFrequency = CLOCKHZ;
+#endif
+
+	unsigned nTicks = CTimer::GetClockTicks ();
+
+	for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+	{
+		m_pCurrent[nCore] = 0;
+		m_pPrevious[nCore] = 0;
+		m_bPreemptionPending[nCore] = FALSE;
+		m_nIdleTime[nCore] = 0;
+		m_nRunStart[nCore] = GetTimestamp ();
+
+		memset (&m_ReadyQueue[nCore], 0, sizeof m_ReadyQueue[nCore]);
+		m_TimerWheel[nCore].Reset (nTicks);
+	}
+
+	CTask *pMainTask = new CTask (0);	// main task currently running
+	assert (pMainTask != 0);
+	pMainTask->SetName ("main");
+
+	m_pCurrent[ThisCore ()] = pMainTask;
 }
 
 CScheduler::~CScheduler (void)
@@ -52,33 +83,229 @@ CScheduler::~CScheduler (void)
 	s_pThis = 0;
 }
 
+#ifdef ARM_ALLOW_MULTI_CORE
+
+void CScheduler::InitializeSecondary (void)
+{
+	unsigned nCore = ThisCore ();
+	assert (nCore > 0);
+	assert (m_pCurrent[nCore] == 0);
+
+	CTask *pMainTask = new CTask (0);	// code currently running on this core
+	assert (pMainTask != 0);
+
+	CString Name;
+	Name.Format ("main%u", nCore);
+	pMainTask->SetName (Name);
+
+	m_nRunStart[nCore] = GetTimestamp ();
+	m_pCurrent[nCore] = pMainTask;
+}
+
+#endif
+
 void CScheduler::Yield (void)
 {
-	while ((m_nCurrent = GetNextTask ()) == MAX_TASKS)	// no task is ready
+	unsigned nCore = ThisCore ();
+	CTask *pCurrent = m_pCurrent[nCore];
+	assert (pCurrent != 0);
+
+	m_bPreemptionPending[nCore] = FALSE;
+
+	pCurrent->m_nYields++;
+
+	boolean bIdle = FALSE;
+	unsigned nIdleStart = 0;
+
+	CTask *pNext;
+	while (1)
 	{
-		assert (m_nTasks > 0);
+		m_SpinLock.Acquire ();
+
+		m_TimerWheel[nCore].Expire (CTimer::GetClockTicks (), TimerWheelHandler, this);
+
+		// the current task continues, if no other task with at least its priority is ready
+		if (   pCurrent->GetState () == TaskStateReady
+		    && !pCurrent->IsSuspended ())
+		{
+			pNext = GetNextTask (pCurrent->GetEffectivePriority ());
+
+			break;
+		}
+
+		pNext = GetNextTask (-1);
+		if (pNext != 0)
+		{
+			break;
+		}
+
+		// no task is ready
+		if (!bIdle)
+		{
+			bIdle = TRUE;
+			nIdleStart = CTimer::GetClockTicks ();
+
+			AccountRunTime (pCurrent, nCore);
+		}
+
+#ifdef TICKLESS_IDLE
+		// core 0 halts until an interrupt occurs or the next sleeping task is due
+		if (nCore == 0)
+		{
+			unsigned nWakeTicks = 0;
+			boolean bWakeTicksValid = m_TimerWheel[nCore].GetNextExpiry (&nWakeTicks);
+
+			// IRQs remain disabled until WFI, so that no wake-up can be lost
+			EnterCritical (IRQ_LEVEL);
+
+			m_SpinLock.Release ();
+
+			CTimer::Get ()->IdleWait (nWakeTicks, bWakeTicksValid);
+
+			LeaveCritical ();
+
+			continue;
+		}
+#endif
+
+#ifdef ARM_ALLOW_MULTI_CORE
+		boolean bNoTimers = m_TimerWheel[nCore].IsEmpty ();
+#endif
+
+		m_SpinLock.Release ();
+
+#ifdef ARM_ALLOW_MULTI_CORE
+		// secondary cores get no timer IRQ, but an event, if a task becomes ready
+		if (   nCore > 0
+		    && bNoTimers)
+		{
+			WaitForEvent ();
+		}
+#endif
+	}
+
+	if (bIdle)
+	{
+		m_nIdleTime[nCore] += CTimer::GetClockTicks () - nIdleStart;
+
+		m_nRunStart[nCore] = GetTimestamp ();	// idle time is not accounted to a task
 	}
 
-	assert (m_nCurrent < MAX_TASKS);
-	CTask *pNext = m_pTask[m_nCurrent];
-	assert (pNext != 0);
-	if (m_pCurrent == pNext)
+#ifdef LATENCY_PROBES
+	RecordWakeLatency (pNext != 0 ? pNext : pCurrent);
+#endif
+
+	if (pNext == 0)
 	{
+		m_SpinLock.Release ();
+
 		return;
 	}
-	
-	TTaskRegisters *pOldRegs = m_pCurrent->GetRegs ();
-	m_pCurrent = pNext;
-	TTaskRegisters *pNewRegs = m_pCurrent->GetRegs ();
+
+	TTaskRegisters *pOldRegs = pCurrent->GetRegs ();
+	m_pCurrent[nCore] = pNext;
+	TTaskRegisters *pNewRegs = pNext->GetRegs ();
+
+	// pCurrent remains marked running, until the switch has completed
+	pNext->m_bRunning = TRUE;
+	pNext->m_nSwitches++;
+	m_pPrevious[nCore] = pCurrent;
+
+	AccountRunTime (pCurrent, nCore);
+
+	m_SpinLock.Release ();
+
+	TRACEPOINT (TRACER_EVENT_TASK_SWITCH, (uintptr) pNext, (uintptr) pCurrent);
 
 	if (m_pTaskSwitchHandler != 0)
 	{
-		(*m_pTaskSwitchHandler) (m_pCurrent);
+		(*m_pTaskSwitchHandler) (pNext);
 	}
 
 	assert (pOldRegs != 0);
 	assert (pNewRegs != 0);
 	TaskSwitch (pOldRegs, pNewRegs);
+
+	FinishSwitch ();
+}
+
+void CScheduler::FinishSwitch (void)
+{
+	unsigned nCore = ThisCore ();
+
+	CTask *pPrevious = m_pPrevious[nCore];
+	if (pPrevious == 0)
+	{
+		return;
+	}
+
+	m_pPrevious[nCore] = 0;
+
+	m_SpinLock.Acquire ();
+
+	// the registers of pPrevious have been saved, it can be picked up again now
+	pPrevious->m_bRunning = FALSE;
+
+	boolean bTerminated = pPrevious->GetState () == TaskStateTerminated;
+	if (!bTerminated)
+	{
+		Enqueue (pPrevious);
+	}
+
+	m_SpinLock.Release ();
+
+	// a task cannot be deleted, while it is running on its own stack
+	if (bTerminated)
+	{
+		if (m_pTaskTerminationHandler != 0)
+		{
+			(*m_pTaskTerminationHandler) (pPrevious);
+		}
+
+		RemoveTask (pPrevious);
+
+		delete pPrevious;
+	}
+}
+
+// accounts the time since the last call for this core to pTask
+void CScheduler::AccountRunTime (CTask *pTask, unsigned nCore)
+{
+	assert (pTask != 0);
+	assert (nCore < SCHED_CORES);
+
+	u64 nTimestamp = GetTimestamp ();
+	pTask->m_nRunTime += nTimestamp - m_nRunStart[nCore];
+	m_nRunStart[nCore] = nTimestamp;
+}
+
+u64 CScheduler::GetMicroseconds (u64 nTimestamp) const
+{
+	assert (m_nTimestampFrequency != 0);
+
+	return   nTimestamp / m_nTimestampFrequency * 1000000
+	       + nTimestamp % m_nTimestampFrequency * 1000000 / m_nTimestampFrequency;
+}
+
+u64 CScheduler::GetTimestamp (void)
+{
+#if RASPPI >= 2
+	InstructionSyncBarrier ();
+
+#if AARCH == 32
+	u32 nCNTPCTLow, nCNTPCTHigh;
+	asm volatile ("mrrc p15, 0, %0, %1, c14" : "=r" (nCNTPCTLow), "=r" (nCNTPCTHigh));
+
+	return (u64) nCNTPCTHigh << 32 | nCNTPCTLow;
+#else
+	u64 nCNTPCT;
+	asm volatile ("mrs %0, CNTPCT_EL0" : "=r" (nCNTPCT));
+
+	return nCNTPCT;
+#endif
+#else
+	return CTimer::GetClockTicks ();
+#endif
 }
 
 void CScheduler::Sleep (unsigned nSeconds)
@@ -111,10 +338,17 @@ void CScheduler::usSleep (unsigned nMicroSeconds)
 
 		unsigned nStartTicks = CTimer::Get ()->GetClockTicks ();
 
-		assert (m_pCurrent != 0);
-		assert (m_pCurrent->GetState () == TaskStateReady);
-		m_pCurrent->SetWakeTicks (nStartTicks + nTicks);
-		m_pCurrent->SetState (TaskStateSleeping);
+		CTask *pCurrent = m_pCurrent[ThisCore ()];
+		assert (pCurrent != 0);
+		assert (pCurrent->GetState () == TaskStateReady);
+
+		m_SpinLock.Acquire ();
+
+		pCurrent->SetWakeTicks (nStartTicks + nTicks);
+		pCurrent->SetState (TaskStateSleeping);
+		AddToTimerWheel (pCurrent, nStartTicks + nTicks);
+
+		m_SpinLock.Release ();
 
 		Yield ();
 	}
@@ -122,37 +356,45 @@ void CScheduler::usSleep (unsigned nMicroSeconds)
 
 CTask *CScheduler::GetCurrentTask (void)
 {
-	return m_pCurrent;
+	return m_pCurrent[ThisCore ()];
 }
 
 CTask *CScheduler::GetTask (const char *pTaskName)
 {
 	assert (pTaskName != 0);
 
-	for (unsigned i = 0; i < m_nTasks; i++)
-	{
-		CTask *pTask = m_pTask[i];
+	m_SpinLock.Acquire ();
 
-		if (   pTask != 0
-		    && strcmp (pTask->GetName (), pTaskName) == 0)
+	CTask *pTask;
+	for (pTask = m_pTaskListHead; pTask != 0; pTask = pTask->m_pTaskListNext)
+	{
+		if (strcmp (pTask->GetName (), pTaskName) == 0)
 		{
-			return pTask;
+			break;
 		}
 	}
 
-	return 0;
+	m_SpinLock.Release ();
+
+	return pTask;
 }
 
 boolean CScheduler::IsValidTask (CTask *pTask)
 {
-	unsigned i;
-	for (i = 0; i < m_nTasks; i++)
+	m_SpinLock.Acquire ();
+
+	CTask *p;
+	for (p = m_pTaskListHead; p != 0; p = p->m_pTaskListNext)
 	{
-		if (m_pTask[i] != 0 && m_pTask[i] == pTask)
-			return TRUE;
+		if (p == pTask)
+		{
+			break;
+		}
 	}
 
-	return FALSE;
+	m_SpinLock.Release ();
+
+	return p != 0 ? TRUE : FALSE;
 }
 
 void CScheduler::RegisterTaskSwitchHandler (TSchedulerTaskHandler *pHandler)
@@ -169,6 +411,17 @@ void CScheduler::RegisterTaskTerminationHandler (TSchedulerTaskHandler *pHandler
 	assert (m_pTaskTerminationHandler != 0);
 }
 
+void CScheduler::EnablePreemption (void)
+{
+	if (!m_bPreemptionEnabled)
+	{
+		m_bPreemptionEnabled = TRUE;
+
+		// sleeping tasks on core 0 are considered in CTimer::IdleWait()
+		CTimer::Get ()->RegisterPeriodicHandler (PeriodicHandler, FALSE);
+	}
+}
+
 void CScheduler::SuspendNewTasks (void)
 {
 	m_iSuspendNewTasks++;
@@ -181,33 +434,61 @@ void CScheduler::ResumeNewTasks (void)
 	if (m_iSuspendNewTasks == 0)
 	{
 		// Resume all new tasks
-		unsigned i;
-		for (i = 0; i < m_nTasks; i++)
+		for (CTask *pTask = m_pTaskListHead; pTask != 0; pTask = pTask->m_pTaskListNext)
 		{
-			if (m_pTask[i] != 0 && m_pTask[i]->GetState() == TaskStateNew)
+			if (pTask->GetState() == TaskStateNew)
 			{
-				m_pTask[i]->Start();
+				pTask->Start();
 			}
 		}
 
 	}
 }
 
-void CScheduler::ListTasks (CDevice *pTarget)
+u64 CScheduler::GetIdleTime (unsigned nCore) const
 {
-	assert (pTarget != 0);
+	assert (nCore < SCHED_CORES);
+	return m_nIdleTime[nCore];
+}
 
-	static const char Header[] = "#  ADDR     STAT  FL NAME\n";
-	pTarget->Write (Header, sizeof Header-1);
+u64 CScheduler::IdleTimeHandler (unsigned nCore, void *pParam)
+{
+	CScheduler *pThis = (CScheduler *) pParam;
+	assert (pThis != 0);
+
+	return pThis->GetIdleTime (nCore);
+}
+
+unsigned CScheduler::GetTaskCount (TTaskState State)
+{
+	unsigned nCount = 0;
+
+	m_SpinLock.Acquire ();
 
-	for (unsigned i = 0; i < m_nTasks; i++)
+	for (CTask *pTask = m_pTaskListHead; pTask != 0; pTask = pTask->m_pTaskListNext)
 	{
-		CTask *pTask = m_pTask[i];
-		if (pTask == 0)
+		if (   State == TaskStateUnknown
+		    || pTask->GetState () == State)
 		{
-			continue;
+			nCount++;
 		}
+	}
 
+	m_SpinLock.Release ();
+
+	return nCount;
+}
+
+void CScheduler::ListTasks (CDevice *pTarget)
+{
+	assert (pTarget != 0);
+
+	static const char Header[] = "#  ADDR     STAT  FL PR CO  RUN(ms)   YIELDS SWITCHES  STACK/SIZE NAME\n";
+	pTarget->Write (Header, sizeof Header-1);
+
+	unsigned i = 0;
+	for (CTask *pTask = m_pTaskListHead; pTask != 0; pTask = pTask->m_pTaskListNext, i++)
+	{
 		TTaskState State = pTask->GetState ();
 		assert (State < TaskStateUnknown);
 
@@ -216,11 +497,18 @@ void CScheduler::ListTasks (CDevice *pTarget)
 			{"new", "ready", "block", "block", "sleep", "term"};
 
 		CString Line;
-		Line.Format ("%02u %08lX %-5s %c%c %s\n",
+		Line.Format ("%02u %08lX %-5s %c%c %2u %02X %8llu %8u %8u %5u/%-5u %s\n",
 			     i, (uintptr) pTask,
-			     pTask == m_pCurrent ? "run" : StateNames[State],
+			     pTask->m_bRunning ? "run" : StateNames[State],
 			     pTask->IsSuspended () ? 'S' : ' ',
 			     State == TaskStateBlockedWithTimeout ? 'T' : ' ',
+			     pTask->GetEffectivePriority (),
+			     pTask->GetAffinity (),
+			     pTask->GetRunTime () / 1000,
+			     pTask->GetYieldCount (),
+			     pTask->GetSwitchCount (),
+			     pTask->GetStackHighWater (),
+			     pTask->GetStackSize (),
 			     pTask->GetName ());
 
 		pTarget->Write (Line, Line.GetLength ());
@@ -236,69 +524,101 @@ void CScheduler::AddTask (CTask *pTask)
 		pTask->SetState(TaskStateNew);
 	}
 
-	unsigned i;
-	for (i = 0; i < m_nTasks; i++)
-	{
-		if (m_pTask[i] == 0)
-		{
-			m_pTask[i] = pTask;
+	m_SpinLock.Acquire ();
 
-			return;
-		}
-	}
+	pTask->m_pTaskListNext = 0;
+	pTask->m_pTaskListPrev = m_pTaskListTail;
 
-	if (m_nTasks >= MAX_TASKS)
+	if (m_pTaskListTail != 0)
 	{
-		CLogger::Get ()->Write (FromScheduler, LogPanic, "System limit of tasks exceeded");
+		m_pTaskListTail->m_pTaskListNext = pTask;
 	}
+	else
+	{
+		m_pTaskListHead = pTask;
+	}
+
+	m_pTaskListTail = pTask;
 
-	m_pTask[m_nTasks++] = pTask;
+	Enqueue (pTask);
+
+	m_SpinLock.Release ();
+}
+
+void CScheduler::UpdateTask (CTask *pTask)
+{
+	assert (pTask != 0);
+
+	m_SpinLock.Acquire ();
+
+	Dequeue (pTask);
+	Enqueue (pTask);
+
+	m_SpinLock.Release ();
 }
 
 void CScheduler::RemoveTask (CTask *pTask)
 {
-	for (unsigned i = 0; i < m_nTasks; i++)
-	{
-		if (m_pTask[i] == pTask)
-		{
-			m_pTask[i] = 0;
+	assert (pTask != 0);
 
-			if (i == m_nTasks-1)
-			{
-				m_nTasks--;
-			}
+	m_SpinLock.Acquire ();
 
-			return;
-		}
+	Dequeue (pTask);
+	RemoveFromTimerWheel (pTask);
+
+	if (pTask->m_pTaskListPrev != 0)
+	{
+		pTask->m_pTaskListPrev->m_pTaskListNext = pTask->m_pTaskListNext;
+	}
+	else
+	{
+		assert (m_pTaskListHead == pTask);
+		m_pTaskListHead = pTask->m_pTaskListNext;
 	}
 
-	assert (0);
+	if (pTask->m_pTaskListNext != 0)
+	{
+		pTask->m_pTaskListNext->m_pTaskListPrev = pTask->m_pTaskListPrev;
+	}
+	else
+	{
+		assert (m_pTaskListTail == pTask);
+		m_pTaskListTail = pTask->m_pTaskListPrev;
+	}
+
+	pTask->m_pTaskListNext = 0;
+	pTask->m_pTaskListPrev = 0;
+
+	m_SpinLock.Release ();
 }
 
 boolean CScheduler::BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds)
 {
+	CTask *pCurrent = m_pCurrent[ThisCore ()];
+
 	assert (ppWaitListHead != 0);
-	assert (m_pCurrent->m_pWaitListNext == 0);
-	assert (m_pCurrent != 0);
-	assert (m_pCurrent->GetState () == TaskStateReady);
+	assert (pCurrent != 0);
+	assert (pCurrent->m_pWaitListNext == 0);
+	assert (pCurrent->GetState () == TaskStateReady);
 
 	m_SpinLock.Acquire ();
 
 	// Add current task to waiting task list
-	m_pCurrent->m_pWaitListNext = *ppWaitListHead;
-	*ppWaitListHead = m_pCurrent;
+	pCurrent->m_pWaitListNext = *ppWaitListHead;
+	*ppWaitListHead = pCurrent;
 
 	if (nMicroSeconds == 0)
 	{
-		m_pCurrent->SetState (TaskStateBlocked);
+		pCurrent->SetState (TaskStateBlocked);
 	}
 	else
 	{
 		unsigned nTicks = nMicroSeconds * (CLOCKHZ / 1000000);
 		unsigned nStartTicks = CTimer::Get ()->GetClockTicks ();
 
-		m_pCurrent->SetWakeTicks (nStartTicks + nTicks);
-		m_pCurrent->SetState (TaskStateBlockedWithTimeout);
+		pCurrent->SetWakeTicks (nStartTicks + nTicks);
+		pCurrent->SetState (TaskStateBlockedWithTimeout);
+		AddToTimerWheel (pCurrent, nStartTicks + nTicks);
 	}
 	
 	m_SpinLock.Release ();
@@ -314,7 +634,7 @@ boolean CScheduler::BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds)
 	CTask* p = *ppWaitListHead;
 	while (p)
 	{
-		if (p == m_pCurrent)
+		if (p == pCurrent)
 		{
 			if (pPrev)
 				pPrev->m_pWaitListNext = p->m_pWaitListNext;
@@ -324,12 +644,12 @@ boolean CScheduler::BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds)
 		pPrev = p;
 		p = p->m_pWaitListNext;
 	}
-	m_pCurrent->m_pWaitListNext = nullptr;
+	pCurrent->m_pWaitListNext = nullptr;
 
 	m_SpinLock.Release ();
 
 	// GetWakeTicks Will be zero if timeout expired, non-zero if event signalled
-	return m_pCurrent->GetWakeTicks() == 0;		
+	return pCurrent->GetWakeTicks() == 0;
 }
 
 void CScheduler::WakeTasks (CTask **ppWaitListHead)
@@ -356,7 +676,14 @@ void CScheduler::WakeTasks (CTask **ppWaitListHead)
 		        || pTask->GetState () == TaskStateBlockedWithTimeout);
 #endif
 
+		RemoveFromTimerWheel (pTask);
+
 		pTask->SetState (TaskStateReady);
+#ifdef LATENCY_PROBES
+		pTask->m_nReadyTicks = CTimer::GetClockTicks ();
+#endif
+
+		Enqueue (pTask);
 
 		CTask* pNext = pTask->m_pWaitListNext;
 		pTask->m_pWaitListNext = 0;
@@ -366,73 +693,269 @@ void CScheduler::WakeTasks (CTask **ppWaitListHead)
 	m_SpinLock.Release ();
 }
 
-unsigned CScheduler::GetNextTask (void)
+// Queues pTask at the tail of the list for its priority, if it is ready to run and is not
+// queued or running already. A task, which is switched away, is queued in FinishSwitch().
+
+void CScheduler::Enqueue (CTask *pTask)
 {
-	unsigned nTask = m_nCurrent < MAX_TASKS ? m_nCurrent : 0;
+	assert (pTask != 0);
 
-	unsigned nTicks = CTimer::Get ()->GetClockTicks ();
+	if (   pTask->m_nReadyCore < SCHED_CORES
+	    || pTask->m_bRunning
+	    || pTask->IsSuspended ()
+	    || pTask->GetState () != TaskStateReady)
+	{
+		return;
+	}
 
-	for (unsigned i = 1; i <= m_nTasks; i++)
+	unsigned nCore = ThisCore ();
+#ifdef ARM_ALLOW_MULTI_CORE
+	// other cores with this core in the affinity mask may take the task from here
+	unsigned nAffinity = pTask->GetAffinity ();
+	if (!(nAffinity & TASK_AFFINITY_CORE (nCore)))
 	{
-		if (++nTask >= m_nTasks)
-		{
-			nTask = 0;
-		}
+		nCore = __builtin_ctz (nAffinity);
+	}
+#endif
+	assert (nCore < SCHED_CORES);
+
+	TSchedulerReadyQueue *pQueue = &m_ReadyQueue[nCore];
+	unsigned nPriority = pTask->GetEffectivePriority ();
+	assert (nPriority <= TASK_PRIORITY_MAX);
+
+	pTask->m_pReadyNext = 0;
+	pTask->m_pReadyPrev = pQueue->pTail[nPriority];
+
+	if (pQueue->pTail[nPriority] != 0)
+	{
+		pQueue->pTail[nPriority]->m_pReadyNext = pTask;
+	}
+	else
+	{
+		pQueue->pHead[nPriority] = pTask;
+	}
+
+	pQueue->pTail[nPriority] = pTask;
+	pQueue->nBitmap |= 1U << nPriority;
+
+	pTask->m_nReadyCore = nCore;
+	pTask->m_nReadyPriority = nPriority;
+
+	RequestPreemption (pTask);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	// wake up idle cores, the task may run on another core
+	DataSyncBarrier ();
+	SendEvent ();
+#endif
+}
+
+void CScheduler::Dequeue (CTask *pTask)
+{
+	assert (pTask != 0);
+
+	unsigned nCore = pTask->m_nReadyCore;
+	if (nCore >= SCHED_CORES)
+	{
+		return;
+	}
+
+	TSchedulerReadyQueue *pQueue = &m_ReadyQueue[nCore];
+	unsigned nPriority = pTask->m_nReadyPriority;
+
+	if (pTask->m_pReadyPrev != 0)
+	{
+		pTask->m_pReadyPrev->m_pReadyNext = pTask->m_pReadyNext;
+	}
+	else
+	{
+		assert (pQueue->pHead[nPriority] == pTask);
+		pQueue->pHead[nPriority] = pTask->m_pReadyNext;
+	}
+
+	if (pTask->m_pReadyNext != 0)
+	{
+		pTask->m_pReadyNext->m_pReadyPrev = pTask->m_pReadyPrev;
+	}
+	else
+	{
+		assert (pQueue->pTail[nPriority] == pTask);
+		pQueue->pTail[nPriority] = pTask->m_pReadyPrev;
+	}
+
+	if (pQueue->pHead[nPriority] == 0)
+	{
+		pQueue->nBitmap &= ~(1U << nPriority);
+	}
+
+	pTask->m_pReadyNext = 0;
+	pTask->m_pReadyPrev = 0;
+	pTask->m_nReadyCore = SCHED_CORES;
+}
 
-		CTask *pTask = m_pTask[nTask];
-		if (pTask == 0)
+// Removes the first task with the highest priority, which is at least nMinPriority, from the
+// ready queues and returns it. Another core's queue is only used, if it has a task with a
+// higher priority, which is allowed to run on this core.
+
+CTask *CScheduler::GetNextTask (int nMinPriority)
+{
+	unsigned nCore = ThisCore ();
+	TSchedulerReadyQueue *pQueue = &m_ReadyQueue[nCore];
+
+	CTask *pTask = 0;
+	int nPriority = pQueue->nBitmap != 0 ? 31 - __builtin_clz (pQueue->nBitmap) : -1;
+	if (nPriority >= nMinPriority)
+	{
+		pTask = pQueue->pHead[nPriority];
+	}
+	else
+	{
+		nPriority = nMinPriority-1;
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	for (unsigned i = 0; i < SCHED_CORES; i++)
+	{
+		TSchedulerReadyQueue *pOtherQueue = &m_ReadyQueue[i];
+		if (   i == nCore
+		    || pOtherQueue->nBitmap == 0)
 		{
 			continue;
 		}
 
-		if (pTask->IsSuspended ())
+		int nTop = 31 - __builtin_clz (pOtherQueue->nBitmap);
+		if (nTop <= nPriority)
 		{
 			continue;
 		}
 
-		switch (pTask->GetState ())
+		for (CTask *p = pOtherQueue->pHead[nTop]; p != 0; p = p->m_pReadyNext)
 		{
-		case TaskStateReady:
-			return nTask;
-
-		case TaskStateBlocked:
-		case TaskStateNew:
-			continue;
-
-		case TaskStateBlockedWithTimeout:
-			if ((int) (pTask->GetWakeTicks () - nTicks) > 0)
+			if (p->GetAffinity () & TASK_AFFINITY_CORE (nCore))
 			{
-				continue;
+				pTask = p;
+				nPriority = nTop;
+
+				break;
 			}
-			pTask->SetState (TaskStateReady);
-			pTask->SetWakeTicks(0);		// Use as flag that timeout expired
-			return nTask;
+		}
+	}
+#endif
 
+	if (pTask != 0)
+	{
+		Dequeue (pTask);
+	}
 
-		case TaskStateSleeping:
-			if ((int) (pTask->GetWakeTicks () - nTicks) > 0)
-			{
-				continue;
-			}
-			pTask->SetState (TaskStateReady);
-			return nTask;
+	return pTask;
+}
 
-		case TaskStateTerminated:
-			if (m_pTaskTerminationHandler != 0)
-			{
-				(*m_pTaskTerminationHandler) (pTask);
-			}
-			RemoveTask (pTask);
-			delete pTask;
-			return MAX_TASKS;
+void CScheduler::AddToTimerWheel (CTask *pTask, unsigned nWakeTicks)
+{
+	assert (pTask != 0);
+	assert (pTask->m_nWheelCore >= SCHED_CORES);
 
-		default:
-			assert (0);
-			break;
+	unsigned nCore = ThisCore ();
+	m_TimerWheel[nCore].Add (&pTask->m_WheelEntry, nWakeTicks);
+	pTask->m_nWheelCore = nCore;
+}
+
+void CScheduler::RemoveFromTimerWheel (CTask *pTask)
+{
+	assert (pTask != 0);
+
+	unsigned nCore = pTask->m_nWheelCore;
+	if (nCore < SCHED_CORES)
+	{
+		m_TimerWheel[nCore].Remove (&pTask->m_WheelEntry);
+		pTask->m_nWheelCore = SCHED_CORES;
+	}
+}
+
+void CScheduler::TimerWheelHandler (TTimerWheelEntry *pEntry, void *pParam)
+{
+	CScheduler *pThis = (CScheduler *) pParam;
+	assert (pThis != 0);
+
+	assert (pEntry != 0);
+	CTask *pTask = (CTask *) pEntry->pParam;
+	assert (pTask != 0);
+
+	pTask->m_nWheelCore = SCHED_CORES;
+
+	if (pTask->GetState () == TaskStateBlockedWithTimeout)
+	{
+		pTask->SetWakeTicks(0);		// Use as flag that timeout expired
+	}
+	else
+	{
+		assert (pTask->GetState () == TaskStateSleeping);
+	}
+
+	pTask->SetState (TaskStateReady);
+#ifdef LATENCY_PROBES
+	pTask->m_nReadyTicks = CTimer::GetClockTicks ();
+#endif
+
+	pThis->Enqueue (pTask);
+}
+
+#ifdef LATENCY_PROBES
+
+void CScheduler::RecordWakeLatency (CTask *pTask)
+{
+	assert (pTask != 0);
+	if (pTask->m_nReadyTicks != 0)
+	{
+		m_WakeLatency.Add (CTimer::GetClockTicks () - pTask->m_nReadyTicks);
+
+		pTask->m_nReadyTicks = 0;
+	}
+}
+
+#endif
+
+void CScheduler::RequestPreemption (CTask *pTask)
+{
+	assert (pTask != 0);
+
+	if (!m_bPreemptionEnabled)
+	{
+		return;
+	}
+
+	for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+	{
+		CTask *pCurrent = m_pCurrent[nCore];
+
+		if (   pCurrent != 0
+		    && (pTask->GetAffinity () & TASK_AFFINITY_CORE (nCore))
+		    && pTask->GetEffectivePriority () > pCurrent->GetEffectivePriority ())
+		{
+			m_bPreemptionPending[nCore] = TRUE;
 		}
 	}
+}
+
+void CScheduler::PeriodicHandler (void)
+{
+	CScheduler *pThis = s_pThis;
+	if (pThis == 0)
+	{
+		return;
+	}
+
+	unsigned nTicks = CTimer::GetClockTicks ();
+
+	pThis->m_SpinLock.Acquire ();
+
+	// wake the tasks, which are due now, a preemption is requested on enqueue, if required
+	for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+	{
+		pThis->m_TimerWheel[nCore].Expire (nTicks, TimerWheelHandler, pThis);
+	}
 
-	return MAX_TASKS;
+	pThis->m_SpinLock.Release ();
 }
 
 CScheduler *CScheduler::Get (void)
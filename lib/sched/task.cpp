@@ -19,16 +19,41 @@
 //
 #include <circle/sched/task.h>
 #include <circle/sched/scheduler.h>
+#include <circle/multicore.h>
 #include <circle/util.h>
 #include <assert.h>
 
+#define TASK_STACK_CANARY	0x5354414BU		// "STAK"
+
 CTask::CTask (unsigned nStackSize, boolean bCreateSuspended)
 :	m_State (bCreateSuspended ? TaskStateNew : TaskStateReady),
 	m_bSuspended (FALSE),
+	m_nPriority (TASK_PRIORITY_NORMAL),
+	m_nEffectivePriority (TASK_PRIORITY_NORMAL),
+#ifdef ARM_ALLOW_MULTI_CORE
+	m_nAffinity (TASK_AFFINITY_CORE (CMultiCoreSupport::ThisCore ())),
+#else
+	m_nAffinity (TASK_AFFINITY_CORE (0)),
+#endif
+	m_bRunning (nStackSize == 0),		// the main task is running already
 	m_nStackSize (nStackSize),
 	m_pStack (0),
-	m_pWaitListNext (0)
+	m_pWaitListNext (0),
+	m_pTaskListNext (0),
+	m_pTaskListPrev (0),
+	m_pReadyNext (0),
+	m_pReadyPrev (0),
+	m_nReadyCore (SCHED_CORES),
+	m_nReadyPriority (0),
+	m_nWheelCore (SCHED_CORES),
+	m_nReadyTicks (0),
+	m_nRunTime (0),
+	m_nYields (0),
+	m_nSwitches (0)
 {
+	memset (&m_WheelEntry, 0, sizeof m_WheelEntry);
+	m_WheelEntry.pParam = this;
+
 	for (unsigned i = 0; i < TASK_USER_DATA_SLOTS; i++)
 	{
 		m_pUserData[i] = 0;
@@ -45,6 +70,13 @@ CTask::CTask (unsigned nStackSize, boolean bCreateSuspended)
 		m_pStack = new u8[m_nStackSize];
 		assert (m_pStack != 0);
 
+		// for GetStackHighWater()
+		u32 *pStack = (u32 *) m_pStack;
+		for (unsigned i = 0; i < m_nStackSize / sizeof (u32); i++)
+		{
+			pStack[i] = TASK_STACK_CANARY;
+		}
+
 		InitializeRegs ();
 	}
 
@@ -73,6 +105,8 @@ void CTask::Start (void)
 		assert (m_bSuspended);
 		m_bSuspended = FALSE;
 	}
+
+	CScheduler::Get ()->UpdateTask (this);
 }
 
 void CTask::Suspend (void)
@@ -80,6 +114,8 @@ void CTask::Suspend (void)
 	assert (m_State != TaskStateNew);
 	assert (!m_bSuspended);
 	m_bSuspended = TRUE;
+
+	CScheduler::Get ()->UpdateTask (this);
 }
 
 void CTask::Run (void)		// dummy method which is never called
@@ -119,6 +155,43 @@ const char *CTask::GetName (void) const
 	return m_Name;
 }
 
+void CTask::SetPriority (unsigned nPriority)
+{
+	assert (nPriority <= TASK_PRIORITY_MAX);
+
+	// do not lower an inherited priority here, CMutex restores it on release
+	boolean bUpdate =    m_nEffectivePriority == m_nPriority
+			  || nPriority > m_nEffectivePriority;
+
+	m_nPriority = nPriority;
+
+	if (bUpdate)
+	{
+		SetEffectivePriority (nPriority);
+	}
+}
+
+void CTask::SetEffectivePriority (unsigned nPriority)
+{
+	assert (nPriority <= TASK_PRIORITY_MAX);
+	m_nEffectivePriority = nPriority;
+
+	CScheduler::Get ()->UpdateTask (this);	// requeue with the new priority
+}
+
+void CTask::SetAffinity (unsigned nCoreMask)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	assert (nCoreMask != 0);
+	assert ((nCoreMask & ~TASK_AFFINITY_ANY) == 0);
+	m_nAffinity = nCoreMask;
+
+	CScheduler::Get ()->UpdateTask (this);	// move to the ready queue of an allowed core
+#else
+	assert (nCoreMask == TASK_AFFINITY_CORE (0));
+#endif
+}
+
 void CTask::SetUserData (void *pData, unsigned nSlot)
 {
 	m_pUserData[nSlot] = pData;
@@ -129,6 +202,31 @@ void *CTask::GetUserData (unsigned nSlot)
 	return m_pUserData[nSlot];
 }
 
+u64 CTask::GetRunTime (void) const
+{
+	return CScheduler::Get ()->GetMicroseconds (m_nRunTime);
+}
+
+unsigned CTask::GetStackHighWater (void) const
+{
+	if (m_pStack == 0)
+	{
+		return 0;
+	}
+
+	// the stack grows downwards, search for the lowest overwritten word
+	const u32 *pStack = (const u32 *) m_pStack;
+	unsigned nWords = m_nStackSize / sizeof (u32);
+
+	unsigned i;
+	for (i = 0; i < nWords && pStack[i] == TASK_STACK_CANARY; i++)
+	{
+		// just search
+	}
+
+	return (nWords - i) * sizeof (u32);
+}
+
 #if AARCH == 32
 
 void CTask::InitializeRegs (void)
@@ -173,6 +271,8 @@ void CTask::TaskEntry (void *pParam)
 	CTask *pThis = (CTask *) pParam;
 	assert (pThis != 0);
 
+	CScheduler::Get ()->FinishSwitch ();
+
 	pThis->Run ();
 
 	pThis->m_State = TaskStateTerminated;
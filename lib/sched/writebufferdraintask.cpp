@@ -0,0 +1,69 @@
+//
+// writebufferdraintask.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/sched/writebufferdraintask.h>
+#include <circle/sched/scheduler.h>
+#include <assert.h>
+
+CWriteBufferDrainTask::CWriteBufferDrainTask (CWriteBufferDevice *pWriteBuffer,
+					      size_t nBatchSize, unsigned nIntervalMs)
+:	m_pWriteBuffer (pWriteBuffer),
+	m_nBatchSize (nBatchSize),
+	m_nIntervalMs (nIntervalMs),
+	m_bStop (FALSE)
+{
+	assert (m_pWriteBuffer != 0);
+	assert (m_nBatchSize > 0);
+
+	SetName ("wbufdrain");
+	SetPriority (TASK_PRIORITY_LOW);
+}
+
+CWriteBufferDrainTask::~CWriteBufferDrainTask (void)
+{
+	m_pWriteBuffer = 0;
+}
+
+void CWriteBufferDrainTask::Stop (void)
+{
+	m_bStop = TRUE;
+
+	WaitForTermination ();
+}
+
+void CWriteBufferDrainTask::Run (void)
+{
+	assert (m_pWriteBuffer != 0);
+
+	while (!m_bStop)
+	{
+		if (m_pWriteBuffer->IsFlushDue ())
+		{
+			m_pWriteBuffer->Update (m_nBatchSize);
+
+			CScheduler::Get ()->Yield ();
+		}
+		else
+		{
+			CScheduler::Get ()->MsSleep (m_nIntervalMs);
+		}
+	}
+
+	m_pWriteBuffer->Flush (m_nBatchSize);
+}
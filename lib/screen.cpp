@@ -2,7 +2,7 @@
 // screen.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,12 +18,17 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/screen.h>
+#include <circle/boottrace.h>
 #include <circle/devicenameservice.h>
 #include <circle/synchronize.h>
 #include <circle/util.h>
+#include <assert.h>
 
 #define ROTORS		4
 
+#define GLYPH_WIDTH	8		// glyph pixel cache works with this char width only
+#define GLYPH_COLORS	4		// number of cached color pairs
+
 #ifndef SCREEN_HEADLESS
 
 enum TScreenState
@@ -56,12 +61,20 @@ CScreenDevice::CScreenDevice (unsigned nWidth, unsigned nHeight, boolean bVirtua
 	m_BackgroundColor (BLACK_COLOR),
 	m_ReverseAttribute (FALSE),
 	m_bInsertOn (FALSE),
-	m_bUpdated (FALSE)
+	m_bUpdated (FALSE),
 #ifdef SCREEN_DMA_BURST_LENGTH
-	, m_DMAChannel (DMA_CHANNEL_NORMAL)
+	m_DMAChannel (DMA_CHANNEL_NORMAL),
 #endif
 #ifdef REALTIME
-	, m_SpinLock (TASK_LEVEL)
+	m_SpinLock (TASK_LEVEL),
+#endif
+	m_pGlyphPixels (0),
+	m_nGlyphPixelsUsed (0),
+	m_nGlyphPixelsNext (0)
+#ifdef SCREEN_HW_SCROLL
+	, m_pFrameBase (0),
+	m_nWindowY (0),
+	m_nVirtHeight (0)
 #endif
 {
 }
@@ -79,14 +92,22 @@ CScreenDevice::~CScreenDevice (void)
 
 	delete [] m_pCursorPixels;
 	m_pCursorPixels = 0;
+
+	delete [] m_pGlyphPixels;
+	m_pGlyphPixels = 0;
 }
 
 boolean CScreenDevice::Initialize (void)
 {
 	if (!m_bVirtual)
 	{
+#ifndef SCREEN_HW_SCROLL
 		m_pFrameBuffer = new CBcmFrameBuffer (m_nInitWidth, m_nInitHeight, DEPTH,
 						      0, 0, m_nDisplay);
+#else
+		m_pFrameBuffer = new CBcmFrameBuffer (m_nInitWidth, m_nInitHeight, DEPTH,
+						      0, 0, m_nDisplay, TRUE);
+#endif
 #if DEPTH == 8
 		m_pFrameBuffer->SetPalette (RED_COLOR, RED_COLOR16);
 		m_pFrameBuffer->SetPalette (GREEN_COLOR, GREEN_COLOR16);
@@ -120,6 +141,14 @@ boolean CScreenDevice::Initialize (void)
 		m_nWidth  = m_pFrameBuffer->GetWidth ();
 		m_nHeight = m_pFrameBuffer->GetHeight ();
 
+#ifdef SCREEN_HW_SCROLL
+		// the visible window is m_nHeight lines at m_nWindowY
+		m_pFrameBase  = m_pBuffer;
+		m_nVirtHeight = m_pFrameBuffer->GetVirtHeight ();
+		m_nSize       = m_nPitch * m_nHeight;
+		assert (m_nVirtHeight >= 2*m_nHeight);
+#endif
+
 		m_pCursorPixels = new TScreenColor[
 					m_CharGen.GetCharWidth () * 
 				       (m_CharGen.GetCharHeight () - m_CharGen.GetUnderline ())];
@@ -147,6 +176,11 @@ boolean CScreenDevice::Initialize (void)
 		m_pBuffer = new TScreenColor[m_nWidth * m_nHeight];
 	}
 
+	if (m_CharGen.GetCharWidth () == GLYPH_WIDTH)
+	{
+		m_pGlyphPixels = new TGlyphPixels[GLYPH_COLORS];
+	}
+
 	m_nUsedHeight = m_nHeight / m_CharGen.GetCharHeight () * m_CharGen.GetCharHeight ();
 	m_nScrollEnd = m_nUsedHeight;
 
@@ -156,6 +190,8 @@ boolean CScreenDevice::Initialize (void)
 
 	CDeviceNameService::Get ()->AddDevice ("tty", m_nDisplay+1, this, FALSE);
 
+	CBootTrace::Mark ("screen");
+
 	return TRUE;
 }
 
@@ -582,9 +618,10 @@ void CScreenDevice::ClearDisplayEnd (void)
 
 void CScreenDevice::ClearLineEnd (void)
 {
-	for (unsigned nPosX = m_nCursorX; nPosX < m_nWidth; nPosX += m_CharGen.GetCharWidth ())
+	if (m_nCursorX < m_nWidth)
 	{
-		EraseChar (nPosX, m_nCursorY);
+		FillRect (m_nCursorX, m_nCursorY, m_nWidth - m_nCursorX,
+			  m_CharGen.GetCharHeight (), m_BackgroundColor);
 	}
 }
 
@@ -685,9 +722,10 @@ void CScreenDevice::EraseChars (unsigned nCount)
 		nEndX = m_nWidth;
 	}
 
-	for (unsigned nPosX = m_nCursorX; nPosX < nEndX; nPosX += m_CharGen.GetCharWidth ())
+	if (m_nCursorX < nEndX)
 	{
-		EraseChar (nPosX, m_nCursorY);
+		FillRect (m_nCursorX, m_nCursorY, nEndX - m_nCursorX,
+			  m_CharGen.GetCharHeight (), m_BackgroundColor);
 	}
 }
 
@@ -890,37 +928,120 @@ void CScreenDevice::Scroll (void)
 {
 	unsigned nLines = m_CharGen.GetCharHeight ();
 
-	u32 *pTo = (u32 *) (m_pBuffer + m_nScrollStart * m_nPitch);
-	u32 *pFrom = (u32 *) (m_pBuffer + (m_nScrollStart + nLines) * m_nPitch);
+#ifdef SCREEN_HW_SCROLL
+	if (   m_pFrameBase != 0
+	    && m_nScrollStart == 0
+	    && m_nScrollEnd == m_nUsedHeight)
+	{
+		if (m_nWindowY + nLines + m_nHeight <= m_nVirtHeight)
+		{
+			// move the window down, the new lines are outside of the visible area
+			m_nWindowY += nLines;
+			m_pBuffer += m_nPitch * nLines;
+		}
+		else
+		{
+			// wrap around, the copy target is outside of the visible area
+			assert (m_nWindowY + nLines >= m_nHeight);
+			CopyBlock (m_pFrameBase, m_pBuffer + m_nPitch * nLines,
+				   m_nPitch * (m_nUsedHeight - nLines) * sizeof (TScreenColor));
+
+			m_nWindowY = 0;
+			m_pBuffer = m_pFrameBase;
+		}
+
+		FillRect (0, m_nUsedHeight - nLines, m_nWidth, m_nHeight - (m_nUsedHeight - nLines),
+			  m_BackgroundColor);
+
+		m_pFrameBuffer->SetVirtualOffset (0, m_nWindowY);
+
+		return;
+	}
+#endif
+
+	TScreenColor *pTo = m_pBuffer + m_nScrollStart * m_nPitch;
+	TScreenColor *pFrom = m_pBuffer + (m_nScrollStart + nLines) * m_nPitch;
 
 	unsigned nSize = m_nPitch * (m_nScrollEnd - m_nScrollStart - nLines) * sizeof (TScreenColor);
 	if (nSize > 0)
 	{
+		CopyBlock (pTo, pFrom, nSize);
+	}
+
+	FillRect (0, m_nScrollEnd - nLines, m_nWidth, nLines, m_BackgroundColor);
+}
+
+void CScreenDevice::CopyBlock (void *pTo, const void *pFrom, unsigned nSize)
+{
 #ifdef SCREEN_DMA_BURST_LENGTH
-		m_DMAChannel.SetupMemCopy (pTo, pFrom, nSize, SCREEN_DMA_BURST_LENGTH, FALSE);
+	m_DMAChannel.SetupMemCopy (pTo, pFrom, nSize, SCREEN_DMA_BURST_LENGTH, FALSE);
 
-		m_DMAChannel.Start ();
-		m_DMAChannel.Wait ();
+	m_DMAChannel.Start ();
+	m_DMAChannel.Wait ();
 #else
-		unsigned nSizeBlk = nSize & ~0xF;
-		memcpyblk (pTo, pFrom, nSizeBlk);
+	unsigned nSizeBlk = nSize & ~0xF;
+	memcpyblk (pTo, pFrom, nSizeBlk);
 
-		// Handle framebuffers with row lengths not aligned to 16 bytes
-		memcpy ((u8 *) pTo + nSizeBlk, (u8 *) pFrom + nSizeBlk, nSize & 0xF);
+	// Handle framebuffers with row lengths not aligned to 16 bytes
+	memcpy ((u8 *) pTo + nSizeBlk, (const u8 *) pFrom + nSizeBlk, nSize & 0xF);
 #endif
+}
 
-		pTo += nSize / sizeof (u32);
+void CScreenDevice::FillRect (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight,
+			      TScreenColor Color)
+{
+	if (   nPosX >= m_nWidth
+	    || nPosY >= m_nHeight)
+	{
+		return;
 	}
 
-	nSize = m_nPitch * nLines * sizeof (TScreenColor) / sizeof (u32);
-	while (nSize--)
+	if (nWidth > m_nWidth - nPosX)
 	{
-		*pTo++ = m_BackgroundColor;
+		nWidth = m_nWidth - nPosX;
+	}
+
+	if (nHeight > m_nHeight - nPosY)
+	{
+		nHeight = m_nHeight - nPosY;
+	}
+
+	TScreenColor *pLine = m_pBuffer + m_nPitch * nPosY + nPosX;
+	for (unsigned y = 0; y < nHeight; y++, pLine += m_nPitch)
+	{
+		for (unsigned x = 0; x < nWidth; x++)
+		{
+			pLine[x] = Color;
+		}
 	}
 }
 
 void CScreenDevice::DisplayChar (char chChar, unsigned nPosX, unsigned nPosY, TScreenColor Color)
 {
+	// fast path: write pre-rendered lines, if the char is completely on screen
+	if (   m_pGlyphPixels != 0
+	    && nPosX + GLYPH_WIDTH <= m_nWidth
+	    && nPosY + m_CharGen.GetCharHeight () <= m_nHeight)
+	{
+		const TGlyphPixels *pGlyphPixels = GetGlyphPixels (Color, GetTextBackgroundColor ());
+		assert (pGlyphPixels != 0);
+
+		TScreenColor *pLine = m_pBuffer + m_nPitch * nPosY + nPosX;
+		for (unsigned y = 0; y < m_CharGen.GetCharHeight (); y++, pLine += m_nPitch)
+		{
+			u32 nBitmap = m_CharGen.GetPixelLine (chChar, y);
+			assert (nBitmap < 256);
+			const TScreenColor *pPixels = pGlyphPixels->Pixels[nBitmap];
+
+			for (unsigned x = 0; x < GLYPH_WIDTH; x++)
+			{
+				pLine[x] = pPixels[x];
+			}
+		}
+
+		return;
+	}
+
 	for (unsigned y = 0; y < m_CharGen.GetCharHeight (); y++)
 	{
 		for (unsigned x = 0; x < m_CharGen.GetCharWidth (); x++)
@@ -933,13 +1054,49 @@ void CScreenDevice::DisplayChar (char chChar, unsigned nPosX, unsigned nPosY, TS
 
 void CScreenDevice::EraseChar (unsigned nPosX, unsigned nPosY)
 {
-	for (unsigned y = 0; y < m_CharGen.GetCharHeight (); y++)
+	FillRect (nPosX, nPosY, m_CharGen.GetCharWidth (), m_CharGen.GetCharHeight (),
+		  m_BackgroundColor);
+}
+
+const CScreenDevice::TGlyphPixels *CScreenDevice::GetGlyphPixels (TScreenColor Color,
+								  TScreenColor BackgroundColor)
+{
+	assert (m_pGlyphPixels != 0);
+
+	for (unsigned i = 0; i < m_nGlyphPixelsUsed; i++)
 	{
-		for (unsigned x = 0; x < m_CharGen.GetCharWidth (); x++)
+		if (   m_pGlyphPixels[i].Color == Color
+		    && m_pGlyphPixels[i].BackgroundColor == BackgroundColor)
+		{
+			return &m_pGlyphPixels[i];
+		}
+	}
+
+	// render all line bitmaps for this color pair into the next entry (round robin)
+	TGlyphPixels *pGlyphPixels = &m_pGlyphPixels[m_nGlyphPixelsNext];
+	if (++m_nGlyphPixelsNext == GLYPH_COLORS)
+	{
+		m_nGlyphPixelsNext = 0;
+	}
+
+	if (m_nGlyphPixelsUsed < GLYPH_COLORS)
+	{
+		m_nGlyphPixelsUsed++;
+	}
+
+	pGlyphPixels->Color = Color;
+	pGlyphPixels->BackgroundColor = BackgroundColor;
+
+	for (unsigned nBitmap = 0; nBitmap < 256; nBitmap++)
+	{
+		for (unsigned x = 0; x < GLYPH_WIDTH; x++)
 		{
-			SetPixel (nPosX + x, nPosY + y, m_BackgroundColor);
+			pGlyphPixels->Pixels[nBitmap][x] =
+				nBitmap & (0x80 >> x) ? Color : BackgroundColor;
 		}
 	}
+
+	return pGlyphPixels;
 }
 
 void CScreenDevice::InvertCursor (void)
@@ -983,6 +1140,28 @@ void CScreenDevice::SetPixel (unsigned nPosX, unsigned nPosY, TScreenColor Color
 	}
 }
 
+void CScreenDevice::SetPixels (unsigned nPosX, unsigned nPosY, const TScreenColor *pPixels,
+			       unsigned nCount)
+{
+	if (   nPosX >= m_nWidth
+	    || nPosY >= m_nHeight)
+	{
+		return;
+	}
+
+	if (nCount > m_nWidth - nPosX)
+	{
+		nCount = m_nWidth - nPosX;
+	}
+
+	assert (pPixels != 0);
+	TScreenColor *pLine = m_pBuffer + m_nPitch * nPosY + nPosX;
+	for (unsigned x = 0; x < nCount; x++)
+	{
+		pLine[x] = pPixels[x];
+	}
+}
+
 TScreenColor CScreenDevice::GetPixel (unsigned nPosX, unsigned nPosY)
 {
 	if (   nPosX < m_nWidth
@@ -1036,6 +1215,8 @@ boolean CScreenDevice::Initialize (void)
 
 	CDeviceNameService::Get ()->AddDevice ("tty1", this, FALSE);
 
+	CBootTrace::Mark ("screen");
+
 	return TRUE;
 }
 
@@ -1073,6 +1254,16 @@ TScreenColor CScreenDevice::GetPixel (unsigned nPosX, unsigned nPosY)
 	return BLACK_COLOR;
 }
 
+void CScreenDevice::SetPixels (unsigned nPosX, unsigned nPosY, const TScreenColor *pPixels,
+			       unsigned nCount)
+{
+}
+
+void CScreenDevice::FillRect (unsigned nPosX, unsigned nPosY, unsigned nWidth, unsigned nHeight,
+			      TScreenColor Color)
+{
+}
+
 void CScreenDevice::Rotor (unsigned nIndex, unsigned nCount)
 {
 }
@@ -2,7 +2,7 @@
 // serial.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,6 +23,8 @@
 #include <circle/memio.h>
 #include <circle/machineinfo.h>
 #include <circle/synchronize.h>
+#include <circle/dmachannel.h>
+#include <circle/new.h>
 #include <assert.h>
 
 #ifndef USE_RPI_STUB_AT
@@ -47,6 +49,7 @@
 #define ARM_UART_RIS    	(m_nBaseAddress + 0x3C)
 #define ARM_UART_MIS    	(m_nBaseAddress + 0x40)
 #define ARM_UART_ICR    	(m_nBaseAddress + 0x44)
+#define ARM_UART_DMACR    	(m_nBaseAddress + 0x48)
 
 // Definitions from Raspberry PI Remote Serial Protocol.
 //     Copyright 2012 Jamie Iles, jamie@jamieiles.com.
@@ -105,6 +108,13 @@
 #define INT_DCDM		(1 << 2)
 #define INT_CTSM		(1 << 1)
 
+#define DMACR_TXDMAE		(1 << 1)
+#define DMACR_RXDMAE		(1 << 0)
+
+#define DR_ERROR_MASK		(DR_OE_MASK | DR_BE_MASK | DR_PE_MASK | DR_FE_MASK)
+
+#define TX_DMA_MAX_ENTRIES	(TXFR_LEN_MAX_LITE / sizeof (u32))
+
 static uintptr s_BaseAddress[SERIAL_DEVICES] =
 {
 	ARM_IO_BASE + 0x201000,
@@ -162,10 +172,26 @@ CSerialDevice::CSerialDevice (CInterruptSystem *pInterruptSystem, boolean bUseFI
 	m_nTxOutPtr (0),
 	m_nOptions (SERIAL_OPTION_ONLCR),
 	m_pMagic (0),
-	m_SpinLock (bUseFIQ ? FIQ_LEVEL : IRQ_LEVEL)
+	m_SpinLock (bUseFIQ ? FIQ_LEVEL : IRQ_LEVEL),
 #ifdef REALTIME
-	, m_LineSpinLock (TASK_LEVEL)
+	m_LineSpinLock (TASK_LEVEL),
 #endif
+	m_bUseDMA (FALSE),
+	m_pRxDMA (0),
+	m_pTxDMA (0),
+	m_pRxControlBlockBuffer (0),
+	m_pRxControlBlock (0),
+	m_pRxRing (0),
+	m_nRxRingMask (0),
+	m_nRxRingOutPtr (0),
+	m_pTxRing (0),
+	m_nTxRingMask (0),
+	m_nTxRingInPtr (0),
+	m_nTxRingOutPtr (0),
+	m_nTxDMALength (0),
+	m_bTxDMAActive (FALSE),
+	m_pIdleHandler (0),
+	m_pIdleParam (0)
 {
 	if (   m_nDevice >= SERIAL_DEVICES
 	    || s_GPIOConfig[nDevice][0][VALUE_PIN] >= GPIO_PINS)
@@ -216,9 +242,32 @@ CSerialDevice::~CSerialDevice (void)
 
 	PeripheralEntry ();
 	write32 (ARM_UART_IMSC, 0);
+	write32 (ARM_UART_DMACR, 0);
 	write32 (ARM_UART_CR, 0);
 	PeripheralExit ();
 
+	if (m_bUseDMA)
+	{
+		m_pRxDMA->Cancel ();
+		m_pTxDMA->Cancel ();
+
+		delete m_pRxDMA;
+		m_pRxDMA = 0;
+		delete m_pTxDMA;
+		m_pTxDMA = 0;
+
+		m_pRxControlBlock = 0;
+		delete [] m_pRxControlBlockBuffer;
+		m_pRxControlBlockBuffer = 0;
+
+		delete [] m_pRxRing;
+		m_pRxRing = 0;
+		delete [] m_pTxRing;
+		m_pTxRing = 0;
+
+		m_bUseDMA = FALSE;
+	}
+
 	// disconnect interrupt, if this is the last device, which uses interrupts
 	if (   m_pInterruptSystem != 0
 	    && --s_nInterruptUseCount == 0)
@@ -230,7 +279,7 @@ CSerialDevice::~CSerialDevice (void)
 		}
 		else
 		{
-			s_pInterruptSystem->DisconnectFIQ ();
+			s_pInterruptSystem->DisconnectFIQ (ARM_FIQ_UART);
 		}
 
 		s_pInterruptSystem = 0;
@@ -344,7 +393,48 @@ boolean CSerialDevice::Initialize (unsigned nBaudrate,
 		break;
 	}
 
-	if (m_pInterruptSystem != 0)
+	if (m_bUseDMA)
+	{
+		// the DMA requests are paced by the FIFO levels
+		write32 (ARM_UART_IFLS,   IFLS_IFSEL_1_2 << IFLS_TXIFSEL_SHIFT
+					| IFLS_IFSEL_1_8 << IFLS_RXIFSEL_SHIFT);
+		write32 (ARM_UART_LCRH, nLCRH);
+		write32 (ARM_UART_DMACR, DMACR_TXDMAE | DMACR_RXDMAE);
+		write32 (ARM_UART_IMSC, INT_RT | INT_OE);
+
+		// the receive DMA runs continuously through the ring, which is split into
+		// two halves, because of the limited transfer length of the DMA lite channels
+		assert (m_pRxControlBlock != 0);
+		assert (m_pRxRing != 0);
+		unsigned nHalfLength = (m_nRxRingMask+1) * sizeof (u32) / 2;
+		for (unsigned i = 0; i < 2; i++)
+		{
+			TDMAControlBlock *pCB = &m_pRxControlBlock[i];
+
+			pCB->nTransferInformation     =   (DREQSourceUARTRX << TI_PERMAP_SHIFT)
+							| TI_SRC_DREQ
+							| TI_DEST_INC
+							| TI_WAIT_RESP;
+			pCB->nSourceAddress           = (ARM_UART_DR & 0xFFFFFF) + GPU_IO_BASE;
+			pCB->nDestinationAddress      = BUS_ADDRESS ((uintptr) m_pRxRing + i*nHalfLength);
+			pCB->nTransferLength          = nHalfLength;
+			pCB->n2DModeStride            = 0;
+			pCB->nNextControlBlockAddress = BUS_ADDRESS ((uintptr) &m_pRxControlBlock[!i]);
+			pCB->nReserved[0]             = 0;
+			pCB->nReserved[1]             = 0;
+		}
+
+		CleanAndInvalidateDataCacheRange ((uintptr) m_pRxRing,
+						  (m_nRxRingMask+1) * sizeof (u32));
+
+		m_pRxDMA->SetupControlBlocks (m_pRxControlBlock, 2);
+		m_pRxDMA->Start ();
+
+		// add device to interrupt handling
+		s_nInterruptDeviceMask |= 1 << m_nDevice;
+		DataSyncBarrier ();
+	}
+	else if (m_pInterruptSystem != 0)
 	{
 		write32 (ARM_UART_IFLS,   IFLS_IFSEL_1_4 << IFLS_TXIFSEL_SHIFT
 					| IFLS_IFSEL_1_4 << IFLS_RXIFSEL_SHIFT);
@@ -386,6 +476,15 @@ int CSerialDevice::Write (const void *pBuffer, size_t nCount)
 	u8 *pChar = (u8 *) pBuffer;
 	assert (pChar != 0);
 
+	if (m_bUseDMA)
+	{
+		int nResult = WriteDMA (pChar, nCount);
+
+		m_LineSpinLock.Release ();
+
+		return nResult;
+	}
+
 	int nResult = 0;
 
 	while (nCount--)
@@ -452,7 +551,11 @@ int CSerialDevice::Read (void *pBuffer, size_t nCount)
 
 	int nResult = 0;
 
-	if (m_pInterruptSystem != 0)
+	if (m_bUseDMA)
+	{
+		nResult = ReadDMA (pChar, nCount);
+	}
+	else if (m_pInterruptSystem != 0)
 	{
 		m_SpinLock.Acquire ();
 
@@ -547,6 +650,7 @@ void CSerialDevice::RegisterMagicReceivedHandler (const char *pMagic, TMagicRece
 	assert (pMagic != 0);
 	assert (*pMagic != '\0');
 	assert (pHandler != 0);
+	assert (!m_bUseDMA);
 
 	m_pMagicReceivedHandler = pHandler;
 
@@ -559,6 +663,11 @@ unsigned CSerialDevice::AvailableForWrite (void)
 	assert (m_bValid);
 	assert (m_pInterruptSystem != 0);
 
+	if (m_bUseDMA)
+	{
+		return m_nTxRingMask - ((m_nTxRingInPtr - m_nTxRingOutPtr) & m_nTxRingMask);
+	}
+
 	m_SpinLock.Acquire ();
 
 	unsigned nResult;
@@ -581,6 +690,11 @@ unsigned CSerialDevice::AvailableForRead (void)
 	assert (m_bValid);
 	assert (m_pInterruptSystem != 0);
 
+	if (m_bUseDMA)
+	{
+		return (GetRxDMAInPtr () - m_nRxRingOutPtr) & m_nRxRingMask;
+	}
+
 	m_SpinLock.Acquire ();
 
 	unsigned nResult;
@@ -603,6 +717,19 @@ int CSerialDevice::Peek (void)
 	assert (m_bValid);
 	assert (m_pInterruptSystem != 0);
 
+	if (m_bUseDMA)
+	{
+		if (GetRxDMAInPtr () == m_nRxRingOutPtr)
+		{
+			return -1;
+		}
+
+		u32 *pEntry = &m_pRxRing[m_nRxRingOutPtr];
+		CleanAndInvalidateDataCacheRange ((uintptr) pEntry, sizeof (u32));
+
+		return *pEntry & 0xFF;
+	}
+
 	m_SpinLock.Acquire ();
 
 	int nResult = -1;
@@ -616,8 +743,45 @@ int CSerialDevice::Peek (void)
 	return nResult;
 }
 
+boolean CSerialDevice::SetBaudrate (unsigned nBaudrate)
+{
+	if (!m_bValid)
+	{
+		return FALSE;
+	}
+
+	unsigned nClockRate = CMachineInfo::Get ()->GetClockRate (CLOCK_ID_UART);
+	assert (nClockRate > 0);
+
+	assert (300 <= nBaudrate && nBaudrate <= 4000000);
+	unsigned nBaud16 = nBaudrate * 16;
+	unsigned nIntDiv = nClockRate / nBaud16;
+	assert (1 <= nIntDiv && nIntDiv <= 0xFFFF);
+	unsigned nFractDiv2 = (nClockRate % nBaud16) * 8 / nBaudrate;
+	unsigned nFractDiv = nFractDiv2 / 2 + nFractDiv2 % 2;
+	assert (nFractDiv <= 0x3F);
+
+	Flush ();
+
+	PeripheralEntry ();
+
+	write32 (ARM_UART_IBRD, nIntDiv);
+	write32 (ARM_UART_FBRD, nFractDiv);
+	write32 (ARM_UART_LCRH, read32 (ARM_UART_LCRH));	// the divisors are latched on LCRH write
+
+	PeripheralExit ();
+
+	return TRUE;
+}
+
 void CSerialDevice::Flush (void)
 {
+	while (   m_bUseDMA
+	       && m_bTxDMAActive)
+	{
+		// just wait
+	}
+
 	PeripheralEntry ();
 
 	while (read32 (ARM_UART_FR) & FR_BUSY_MASK)
@@ -673,6 +837,31 @@ void CSerialDevice::InterruptHandler (void)
 
 	PeripheralEntry ();
 
+	if (m_bUseDMA)
+	{
+		// the data is handled by DMA, only idle line and errors are reported here
+		u32 nMIS = read32 (ARM_UART_MIS);
+		write32 (ARM_UART_ICR, nMIS);
+
+		if (   (nMIS & INT_OE)
+		    && m_nRxStatus == 0)
+		{
+			m_nRxStatus = -SERIAL_ERROR_OVERRUN;
+		}
+
+		PeripheralExit ();
+
+		m_SpinLock.Release ();
+
+		if (   (nMIS & INT_RT)
+		    && m_pIdleHandler != 0)
+		{
+			(*m_pIdleHandler) (m_pIdleParam);
+		}
+
+		return;
+	}
+
 	// acknowledge pending interrupts
 	write32 (ARM_UART_ICR, read32 (ARM_UART_MIS));
 
@@ -762,6 +951,245 @@ void CSerialDevice::InterruptHandler (void)
 	}
 }
 
+boolean CSerialDevice::EnableDMA (unsigned nRxBufferSize, unsigned nTxBufferSize)
+{
+	// the DREQ lines are available for the first PL011 only
+	if (   !m_bValid
+	    || m_nDevice != 0
+	    || m_pInterruptSystem == 0
+	    || m_bUseDMA)
+	{
+		return FALSE;
+	}
+
+	assert (nRxBufferSize >= 2 && (nRxBufferSize & (nRxBufferSize-1)) == 0);
+	assert (nTxBufferSize >= 2 && (nTxBufferSize & (nTxBufferSize-1)) == 0);
+	assert (nRxBufferSize * sizeof (u32) / 2 <= TXFR_LEN_MAX_LITE);
+
+	m_pRxDMA = new CDMAChannel (DMA_CHANNEL_LITE, m_pInterruptSystem);
+	m_pTxDMA = new CDMAChannel (DMA_CHANNEL_LITE, m_pInterruptSystem);
+	assert (m_pRxDMA != 0);
+	assert (m_pTxDMA != 0);
+
+	m_pRxControlBlockBuffer = new (HEAP_DMA30) u8[2*sizeof (TDMAControlBlock) + 31];
+	m_pRxRing = new (HEAP_DMA30) u32[nRxBufferSize];
+	m_pTxRing = new (HEAP_DMA30) u32[nTxBufferSize];
+	assert (m_pRxControlBlockBuffer != 0);
+	assert (m_pRxRing != 0);
+	assert (m_pTxRing != 0);
+
+	m_pRxControlBlock = (TDMAControlBlock *) (((uintptr) m_pRxControlBlockBuffer + 31) & ~31);
+
+	m_nRxRingMask = nRxBufferSize-1;
+	m_nRxRingOutPtr = 0;
+
+	m_nTxRingMask = nTxBufferSize-1;
+	m_nTxRingInPtr = 0;
+	m_nTxRingOutPtr = 0;
+
+	m_pTxDMA->SetCompletionRoutine (TxDMACompletionStub, this);
+
+	m_bUseDMA = TRUE;
+
+	return TRUE;
+}
+
+void CSerialDevice::RegisterIdleHandler (TIdleHandler *pHandler, void *pParam)
+{
+	assert (m_bUseDMA);
+
+	m_pIdleParam = pParam;
+	m_pIdleHandler = pHandler;
+}
+
+int CSerialDevice::ReadDMA (u8 *pBuffer, size_t nCount)
+{
+	m_SpinLock.Acquire ();
+
+	int nResult = m_nRxStatus;
+	m_nRxStatus = 0;
+
+	m_SpinLock.Release ();
+
+	if (nResult < 0)
+	{
+		return nResult;
+	}
+
+	unsigned nInPtr = GetRxDMAInPtr ();
+	unsigned nOutPtr = m_nRxRingOutPtr;
+
+	while (   nCount > 0
+	       && nOutPtr != nInPtr)
+	{
+		// copy one contiguous part of the ring at a time
+		unsigned nEntries = nInPtr > nOutPtr ? nInPtr - nOutPtr : m_nRxRingMask+1 - nOutPtr;
+		if (nEntries > nCount)
+		{
+			nEntries = nCount;
+		}
+
+		const u32 *pEntry = &m_pRxRing[nOutPtr];
+		CleanAndInvalidateDataCacheRange ((uintptr) pEntry, nEntries * sizeof (u32));
+
+		unsigned i;
+		for (i = 0; i < nEntries; i++)
+		{
+			u32 nDR = pEntry[i];
+			if (nDR & DR_ERROR_MASK)
+			{
+				break;
+			}
+
+			*pBuffer++ = nDR & 0xFF;
+		}
+
+		nOutPtr = (nOutPtr + i) & m_nRxRingMask;
+		nCount -= i;
+		nResult += i;
+
+		if (i < nEntries)
+		{
+			// report an error, after the data received before it has been returned
+			if (nResult == 0)
+			{
+				u32 nDR = pEntry[i];
+				if (nDR & DR_BE_MASK)
+				{
+					nResult = -SERIAL_ERROR_BREAK;
+				}
+				else if (nDR & DR_OE_MASK)
+				{
+					nResult = -SERIAL_ERROR_OVERRUN;
+				}
+				else if (nDR & DR_FE_MASK)
+				{
+					nResult = -SERIAL_ERROR_FRAMING;
+				}
+				else
+				{
+					nResult = -SERIAL_ERROR_PARITY;
+				}
+
+				nOutPtr = (nOutPtr + 1) & m_nRxRingMask;
+			}
+
+			break;
+		}
+	}
+
+	m_nRxRingOutPtr = nOutPtr;
+
+	return nResult;
+}
+
+int CSerialDevice::WriteDMA (const u8 *pBuffer, size_t nCount)
+{
+	int nResult = 0;
+
+	m_SpinLock.Acquire ();
+
+	unsigned nInPtr = m_nTxRingInPtr;
+	unsigned nFree = m_nTxRingMask - ((nInPtr - m_nTxRingOutPtr) & m_nTxRingMask);
+
+	while (nCount > 0)
+	{
+		u8 uchChar = *pBuffer;
+
+		boolean bAddCR = uchChar == '\n' && (m_nOptions & SERIAL_OPTION_ONLCR);
+		if (nFree < (bAddCR ? 2U : 1U))
+		{
+			break;
+		}
+
+		m_pTxRing[nInPtr] = uchChar;
+		nInPtr = (nInPtr + 1) & m_nTxRingMask;
+		nFree--;
+
+		if (bAddCR)
+		{
+			m_pTxRing[nInPtr] = '\r';
+			nInPtr = (nInPtr + 1) & m_nTxRingMask;
+			nFree--;
+		}
+
+		pBuffer++;
+		nCount--;
+		nResult++;
+	}
+
+	m_nTxRingInPtr = nInPtr;
+
+	if (!m_bTxDMAActive)
+	{
+		StartTxDMA ();
+	}
+
+	m_SpinLock.Release ();
+
+	return nResult;
+}
+
+unsigned CSerialDevice::GetRxDMAInPtr (void)
+{
+	assert (m_pRxDMA != 0);
+
+	PeripheralEntry ();
+	u32 nDestinationAddress = read32 (ARM_DMACHAN_DEST_AD (m_pRxDMA->GetChannelNumber ()));
+	PeripheralExit ();
+
+	return   (nDestinationAddress - BUS_ADDRESS ((uintptr) m_pRxRing)) / sizeof (u32)
+	       & m_nRxRingMask;
+}
+
+// called with m_SpinLock acquired
+void CSerialDevice::StartTxDMA (void)
+{
+	unsigned nInPtr = m_nTxRingInPtr;
+	unsigned nOutPtr = m_nTxRingOutPtr;
+	if (nInPtr == nOutPtr)
+	{
+		m_bTxDMAActive = FALSE;
+
+		return;
+	}
+
+	// send one contiguous part of the ring at a time
+	unsigned nEntries = nInPtr > nOutPtr ? nInPtr - nOutPtr : m_nTxRingMask+1 - nOutPtr;
+	if (nEntries > TX_DMA_MAX_ENTRIES)
+	{
+		nEntries = TX_DMA_MAX_ENTRIES;
+	}
+
+	m_nTxDMALength = nEntries;
+	m_bTxDMAActive = TRUE;
+
+	assert (m_pTxDMA != 0);
+	m_pTxDMA->SetupIOWrite (ARM_UART_DR, &m_pTxRing[nOutPtr], nEntries * sizeof (u32),
+				DREQSourceUARTTX);
+	m_pTxDMA->Start ();
+}
+
+void CSerialDevice::TxDMACompletionRoutine (boolean bStatus)
+{
+	m_SpinLock.Acquire ();
+
+	m_nTxRingOutPtr = (m_nTxRingOutPtr + m_nTxDMALength) & m_nTxRingMask;
+	m_nTxDMALength = 0;
+
+	StartTxDMA ();
+
+	m_SpinLock.Release ();
+}
+
+void CSerialDevice::TxDMACompletionStub (unsigned nChannel, boolean bStatus, void *pParam)
+{
+	CSerialDevice *pThis = (CSerialDevice *) pParam;
+	assert (pThis != 0);
+
+	pThis->TxDMACompletionRoutine (bStatus);
+}
+
 void CSerialDevice::InterruptStub (void *pParam)
 {
 	DataMemBarrier ();
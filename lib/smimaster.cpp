@@ -21,9 +21,13 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/smimaster.h>
+#include <circle/machineinfo.h>
+#include <circle/synchronize.h>
+#include <circle/bcm2835int.h>
 #include <circle/bcm2835.h>
 #include <circle/memio.h>
 #include <circle/timer.h>
+#include <circle/new.h>
 #include <assert.h>
 
 // Registers - ref the linux driver (bcm2835_smi.h) for documentation
@@ -129,6 +133,10 @@
 #define DMA_REQUEST_THRESH  2
 #define DMA_PANIC_LEVEL		8
 
+// Streaming
+#define STREAM_TRANSFER_COUNT	0xFFFFFFFF	// SMI length, re-armed from the interrupt handler, when expired
+#define STREAM_BURST_MAX		15
+
 // Clock
 #define CM_SMICTL_FLIP (1 << 8)
 #define CM_SMICTL_BUSY (1 << 7)
@@ -145,11 +153,24 @@
 
 
 
-CSMIMaster::CSMIMaster(unsigned nSDLinesMask, boolean bUseAddressPins) :
+CSMIMaster::CSMIMaster(unsigned nSDLinesMask, boolean bUseAddressPins, CInterruptSystem *pInterruptSystem) :
 	m_nSDLinesMask (nSDLinesMask),
 	m_bUseAddressPins (bUseAddressPins),
-	m_txDMA (DMA_CHANNEL_LITE /*DMA_CHANNEL_NORMAL*/),
-	m_pDMABuffer (0)
+	m_txDMA (DMA_CHANNEL_LITE /*DMA_CHANNEL_NORMAL*/, pInterruptSystem),
+	m_pDMABuffer (0),
+	m_bHasInterruptSystem (pInterruptSystem != 0),
+	m_bDMAActive (FALSE),
+	m_pCompletionRoutine (0),
+	m_pCompletionParam (0),
+	m_pInterruptSystem (pInterruptSystem),
+	m_nStreamChannel (DMA_CHANNEL_MAX+1),
+	m_bStreamIRQConnected (FALSE),
+	m_pStreamCBBuffer (0),
+	m_pStreamCB (0),
+	m_pStreamBuffer (0),
+	m_bStreamActive (FALSE),
+	m_pStreamRoutine (0),
+	m_pStreamParam (0)
 {
 	if (m_bUseAddressPins) {
 		for (unsigned i = 0 ; i < SMI_NUM_ADDRESS_LINES ; i++) {
@@ -167,6 +188,29 @@ CSMIMaster::CSMIMaster(unsigned nSDLinesMask, boolean bUseAddressPins) :
 
 CSMIMaster::~CSMIMaster (void)
 {
+	WaitForDMA ();
+
+	StopStream ();
+
+	if (m_bStreamIRQConnected) {
+		assert (m_pInterruptSystem != 0);
+		m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_DMA0+m_nStreamChannel);
+		m_bStreamIRQConnected = FALSE;
+	}
+
+	if (m_nStreamChannel <= DMA_CHANNEL_MAX) {
+		PeripheralEntry ();
+		write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) & ~(1 << m_nStreamChannel));
+		PeripheralExit ();
+
+		CMachineInfo::Get ()->FreeDMAChannel (m_nStreamChannel);
+		m_nStreamChannel = DMA_CHANNEL_MAX+1;
+	}
+
+	m_pStreamCB = 0;
+	delete [] m_pStreamCBBuffer;
+	m_pStreamCBBuffer = 0;
+
 	if (m_bUseAddressPins) {
 		for (unsigned i = 0 ; i < SMI_NUM_ADDRESS_LINES ; i++) {
 			m_addressGpios[i].SetMode(GPIOModeInput);
@@ -213,12 +257,228 @@ void CSMIMaster::Write (unsigned nValue) {
 void CSMIMaster::WriteDMA(boolean bWaitForCompletion)
 {
 	assert (m_pDMABuffer != 0);
+	assert (!m_bDMAActive);
 	m_txDMA.SetupIOWrite (ARM_SMI_D, m_pDMABuffer, m_nLength, DREQSourceSMI);
+	if (m_bHasInterruptSystem) {
+		m_txDMA.SetCompletionRoutine (DMACompletionStub, this);
+	}
+	m_bDMAActive = TRUE;
 	m_txDMA.Start();
 	PeripheralEntry();
 	write32(ARM_SMI_CS, read32(ARM_SMI_CS) | CS_START);
 	PeripheralExit();
-	if (bWaitForCompletion) m_txDMA.Wait();
+	if (bWaitForCompletion) WaitForDMA();
+}
+
+void CSMIMaster::SetCompletionRoutine (TSMICompletionRoutine *pRoutine, void *pParam)
+{
+	assert (m_bHasInterruptSystem);
+	WaitForDMA();
+	m_pCompletionParam = pParam;
+	m_pCompletionRoutine = pRoutine;
+}
+
+boolean CSMIMaster::IsDMAActive (void) const
+{
+	return m_bDMAActive;
+}
+
+void CSMIMaster::WaitForDMA (void)
+{
+	if (!m_bDMAActive) return;
+	if (m_bHasInterruptSystem) {
+		while (m_bDMAActive) {} // cleared in the completion stub
+	}
+	else {
+		m_txDMA.Wait();
+		m_bDMAActive = FALSE;
+	}
+}
+
+void CSMIMaster::DMACompletionStub (unsigned nChannel, boolean bStatus, void *pParam)
+{
+	CSMIMaster *pThis = (CSMIMaster *) pParam;
+	assert (pThis != 0);
+	pThis->m_bDMAActive = FALSE;
+	TSMICompletionRoutine *pRoutine = pThis->m_pCompletionRoutine;
+	if (pRoutine != 0) {
+		(*pRoutine) (bStatus, pThis->m_pCompletionParam);
+	}
+}
+
+boolean CSMIMaster::StartStream (boolean bWrite, void *pBuffer, unsigned nHalfLength,
+				  TSMIStreamRoutine *pRoutine, void *pParam, unsigned nBurstLength)
+{
+	assert (m_pInterruptSystem != 0);
+	assert (!m_bDMAActive);
+	assert (!m_bStreamActive);
+	assert (pBuffer != 0);
+	assert (nHalfLength > 0 && nHalfLength <= TXFR_LEN_MAX_LITE);
+	assert ((nHalfLength & 3) == 0);
+	assert (pRoutine != 0);
+	assert (nBurstLength <= STREAM_BURST_MAX);
+
+	if (m_nStreamChannel > DMA_CHANNEL_MAX) {
+		m_nStreamChannel = CMachineInfo::Get ()->AllocateDMAChannel (DMA_CHANNEL_LITE);
+		if (m_nStreamChannel > DMA_CHANNEL_MAX) {
+			return FALSE;
+		}
+
+		PeripheralEntry ();
+		write32 (ARM_DMA_ENABLE, read32 (ARM_DMA_ENABLE) | (1 << m_nStreamChannel));
+		CTimer::SimpleusDelay (1000);
+		write32 (ARM_DMACHAN_CS (m_nStreamChannel), CS_RESET);
+		while (read32 (ARM_DMACHAN_CS (m_nStreamChannel)) & CS_RESET) {}
+		PeripheralExit ();
+
+		m_pInterruptSystem->ConnectIRQ (ARM_IRQ_DMA0+m_nStreamChannel, StreamInterruptStub, this);
+		m_bStreamIRQConnected = TRUE;
+	}
+
+	if (m_pStreamCB == 0) {
+		m_pStreamCBBuffer = new (HEAP_DMA30) u8[2*sizeof (TDMAControlBlock) + 31];
+		if (m_pStreamCBBuffer == 0) {
+			return FALSE;
+		}
+		m_pStreamCB = (TDMAControlBlock *) (((uintptr) m_pStreamCBBuffer + 31) & ~31);
+	}
+
+	m_bStreamWrite = bWrite;
+	m_pStreamBuffer = (u8 *) pBuffer;
+	m_nStreamHalfLength = nHalfLength;
+	m_nStreamHalf = 0;
+	m_pStreamRoutine = pRoutine;
+	m_pStreamParam = pParam;
+
+	// two control blocks, which are chained to a ring, each raising an interrupt on completion
+	u32 nSMIData = (ARM_SMI_D & 0xFFFFFF) + GPU_IO_BASE;
+	for (unsigned i = 0; i < 2; i++) {
+		TDMAControlBlock *pCB = &m_pStreamCB[i];
+		u32 nHalf = BUS_ADDRESS ((uintptr) m_pStreamBuffer + i*nHalfLength);
+
+		pCB->nTransferInformation = (DREQSourceSMI << TI_PERMAP_SHIFT) | (nBurstLength << TI_BURST_LENGTH_SHIFT) | TI_WAIT_RESP | TI_INTEN;
+		if (bWrite) {
+			pCB->nTransferInformation |= TI_SRC_WIDTH | TI_SRC_INC | TI_DEST_DREQ;
+			pCB->nSourceAddress = nHalf;
+			pCB->nDestinationAddress = nSMIData;
+		}
+		else {
+			pCB->nTransferInformation |= TI_SRC_DREQ | TI_DEST_WIDTH | TI_DEST_INC;
+			pCB->nSourceAddress = nSMIData;
+			pCB->nDestinationAddress = nHalf;
+		}
+		pCB->nTransferLength = nHalfLength;
+		pCB->n2DModeStride = 0;
+		pCB->nNextControlBlockAddress = BUS_ADDRESS ((uintptr) &m_pStreamCB[!i]);
+		pCB->nReserved[0] = 0;
+		pCB->nReserved[1] = 0;
+	}
+
+	CleanAndInvalidateDataCacheRange ((uintptr) m_pStreamCB, 2*sizeof (TDMAControlBlock));
+	CleanAndInvalidateDataCacheRange ((uintptr) m_pStreamBuffer, 2*nHalfLength);
+
+	m_bStreamActive = TRUE;
+
+	PeripheralEntry ();
+
+	// the DREQ is raised, when a full burst can be transferred
+	u32 nThresh = nBurstLength + 1;
+	write32(ARM_SMI_DMC, (nThresh << DMC_REQW__SHIFT) | (nThresh << DMC_REQR__SHIFT) | (DMA_PANIC_LEVEL << DMC_PANICW__SHIFT) | (DMA_PANIC_LEVEL << DMC_PANICR__SHIFT) | DMC_DMAEN);
+	write32(ARM_SMI_CS, (read32(ARM_SMI_CS) & ~CS_WRITE) | CS_ENABLE | CS_CLEAR | CS_PXLDAT);
+	write32(ARM_SMI_L, STREAM_TRANSFER_COUNT);
+	if (bWrite) {
+		write32(ARM_SMI_CS, read32(ARM_SMI_CS) | CS_WRITE);
+	}
+
+	write32 (ARM_DMACHAN_CONBLK_AD (m_nStreamChannel), BUS_ADDRESS ((uintptr) &m_pStreamCB[0]));
+	write32 (ARM_DMACHAN_CS (m_nStreamChannel),   CS_WAIT_FOR_OUTSTANDING_WRITES
+						    | (DEFAULT_PANIC_PRIORITY << CS_PANIC_PRIORITY_SHIFT)
+						    | (DEFAULT_PRIORITY << CS_PRIORITY_SHIFT)
+						    | CS_ACTIVE);
+
+	write32(ARM_SMI_CS, read32(ARM_SMI_CS) | CS_START);
+
+	PeripheralExit ();
+
+	return TRUE;
+}
+
+void CSMIMaster::StopStream (void)
+{
+	if (!m_bStreamActive) return;
+	m_bStreamActive = FALSE;
+
+	assert (m_nStreamChannel <= DMA_CHANNEL_MAX);
+
+	PeripheralEntry ();
+
+	// pause the channel first, so that no transfer is interrupted in between
+	write32 (ARM_DMACHAN_CS (m_nStreamChannel), 0);
+	CTimer::SimpleusDelay (10);
+	write32 (ARM_DMACHAN_CS (m_nStreamChannel), CS_RESET);
+	while (read32 (ARM_DMACHAN_CS (m_nStreamChannel)) & CS_RESET) {}
+	write32 (ARM_DMA_INT_STATUS, 1 << m_nStreamChannel);
+
+	// abort the pending SMI transfer and restore the settings of SetupDMA()
+	write32(ARM_SMI_CS, read32(ARM_SMI_CS) & ~(CS_ENABLE | CS_WRITE));
+	write32(ARM_SMI_DMC, (DMA_REQUEST_THRESH << DMC_REQW__SHIFT) | (DMA_REQUEST_THRESH << DMC_REQR__SHIFT) | (DMA_PANIC_LEVEL << DMC_PANICW__SHIFT) | (DMA_PANIC_LEVEL << DMC_PANICR__SHIFT) | DMC_DMAEN);
+	write32(ARM_SMI_CS, read32(ARM_SMI_CS) | CS_ENABLE | CS_CLEAR);
+
+	PeripheralExit ();
+}
+
+boolean CSMIMaster::IsStreamActive (void) const
+{
+	return m_bStreamActive;
+}
+
+void CSMIMaster::StreamInterruptHandler (void)
+{
+	assert (m_nStreamChannel <= DMA_CHANNEL_MAX);
+
+	PeripheralEntry ();
+
+	write32 (ARM_DMA_INT_STATUS, 1 << m_nStreamChannel);
+
+	u32 nCS = read32 (ARM_DMACHAN_CS (m_nStreamChannel));
+	write32 (ARM_DMACHAN_CS (m_nStreamChannel), nCS);	// reset CS_INT
+
+	// the SMI transfer counter has expired, re-arm it
+	if (m_bStreamActive && (read32(ARM_SMI_CS) & CS_DONE)) {
+		write32(ARM_SMI_L, STREAM_TRANSFER_COUNT);
+		write32(ARM_SMI_CS, read32(ARM_SMI_CS) | CS_DONE | CS_START);
+	}
+
+	PeripheralExit ();
+
+	if (!m_bStreamActive) return;	// stopped in between
+
+	boolean bStatus = nCS & CS_ERROR ? FALSE : TRUE;
+
+	u8 *pHalf = m_pStreamBuffer + m_nStreamHalf*m_nStreamHalfLength;
+	m_nStreamHalf ^= 1;
+
+	if (!m_bStreamWrite) {
+		InvalidateDataCacheRange ((uintptr) pHalf, m_nStreamHalfLength);
+	}
+
+	if (!bStatus) {
+		StopStream ();
+	}
+
+	assert (m_pStreamRoutine != 0);
+	(*m_pStreamRoutine) (pHalf, m_nStreamHalfLength, bStatus, m_pStreamParam);
+
+	if (bStatus && m_bStreamWrite) {
+		CleanAndInvalidateDataCacheRange ((uintptr) pHalf, m_nStreamHalfLength);
+	}
+}
+
+void CSMIMaster::StreamInterruptStub (void *pParam)
+{
+	CSMIMaster *pThis = (CSMIMaster *) pParam;
+	assert (pThis != 0);
+	pThis->StreamInterruptHandler ();
 }
 
 void CSMIMaster::SetupTiming(TSMIDataWidth nWidth, unsigned nCycle_ns, unsigned nSetup, unsigned nStrobe, unsigned nHold, unsigned nPace, unsigned nDevice)
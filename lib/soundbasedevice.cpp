@@ -31,10 +31,15 @@ CSoundBaseDevice::CSoundBaseDevice (TSoundFormat HWFormat, u32 nRange32, unsigne
 	m_nNeedDataThreshold (0),
 	m_WriteFormat (SoundFormatUnknown),
 	m_nWriteChannels (0),
+	m_pConvertRoutine (0),
 	m_pQueue (0),
 	m_nInPtr (0),
 	m_nOutPtr (0),
 	m_pCallback (0),
+	m_pRenderCallback (0),
+	m_pRenderFloatCallback (0),
+	m_pRenderParam (0),
+	m_pRenderConvertRoutine (0),
 	m_nReadQueueSize (0),
 	m_nHaveDataThreshold (0),
 	m_ReadFormat (SoundFormatUnknown),
@@ -104,6 +109,8 @@ CSoundBaseDevice::CSoundBaseDevice (TSoundFormat HWFormat, u32 nRange32, unsigne
 		m_uchIEC958Status[2] = 0;	// source number, take no account of channel number
 		m_uchIEC958Status[3] = uchFS;	// sampling frequency
 		m_uchIEC958Status[4] = 0b1011 | (uchOrigFS << 4); // 24 bit samples, original freq.
+
+		UpdateIEC958FrameBits ();
 	}
 }
 
@@ -194,12 +201,21 @@ void CSoundBaseDevice::SetWriteFormat (TSoundFormat Format, unsigned nChannels)
 		m_nWriteSampleSize = sizeof (s32);
 		break;
 
+	case SoundFormatFloat32:
+		m_nWriteSampleSize = sizeof (float);
+		break;
+
 	default:
 		assert (0);
 		break;
 	}
 
 	m_nWriteFrameSize = m_nWriteChannels * m_nWriteSampleSize;
+
+	// select the conversion once here, instead of deciding it for each sample in Write()
+	m_pConvertRoutine = GetConvertRoutine (m_WriteFormat, m_HWFormat,
+					       m_nWriteChannels, m_bSwapChannels);
+	assert (m_pConvertRoutine != 0);
 }
 
 int CSoundBaseDevice::Write (const void *pBuffer, size_t nCount)
@@ -235,46 +251,33 @@ int CSoundBaseDevice::Write (const void *pBuffer, size_t nCount)
 	}
 	else
 	{
-		while (   nCount >= m_nWriteFrameSize
-		       && GetQueueBytesFree () >= m_nHWFrameSize)
+		assert (m_pConvertRoutine != 0);
+
+		unsigned nFrames = nCount / m_nWriteFrameSize;
+		unsigned nFramesFree = GetQueueBytesFree () / m_nHWFrameSize;
+		if (nFrames > nFramesFree)
 		{
-			u8 Frame[SOUND_MAX_FRAME_SIZE];
+			nFrames = nFramesFree;
+		}
 
-			if (!m_bSwapChannels)
-			{
-				ConvertSoundFormat (Frame, pBuffer8);
-				pBuffer8 += m_nWriteSampleSize;
+		while (nFrames > 0)
+		{
+			u32 Buffer[SOUND_CONVERT_FRAMES * SOUND_HW_CHANNELS];
 
-				if (m_nWriteChannels == 2)
-				{
-					ConvertSoundFormat (Frame+m_nHWSampleSize, pBuffer8);
-					pBuffer8 += m_nWriteSampleSize;
-				}
-				else
-				{
-					memcpy (Frame+m_nHWSampleSize, Frame, m_nHWSampleSize);
-				}
-			}
-			else
+			unsigned nBlockFrames = nFrames;
+			if (nBlockFrames > SOUND_CONVERT_FRAMES)
 			{
-				ConvertSoundFormat (Frame+m_nHWSampleSize, pBuffer8);
-				pBuffer8 += m_nWriteSampleSize;
-
-				if (m_nWriteChannels == 2)
-				{
-					ConvertSoundFormat (Frame, pBuffer8);
-					pBuffer8 += m_nWriteSampleSize;
-				}
-				else
-				{
-					memcpy (Frame, Frame+m_nHWSampleSize, m_nHWSampleSize);
-				}
+				nBlockFrames = SOUND_CONVERT_FRAMES;
 			}
 
-			Enqueue (Frame, m_nHWFrameSize);
+			(*m_pConvertRoutine) (Buffer, pBuffer8, nBlockFrames, m_nRangeMax);
 
-			nCount -= m_nWriteFrameSize;
-			nResult += m_nWriteFrameSize;
+			Enqueue (Buffer, nBlockFrames * m_nHWFrameSize);
+
+			unsigned nBytes = nBlockFrames * m_nWriteFrameSize;
+			pBuffer8 += nBytes;
+			nResult += nBytes;
+			nFrames -= nBlockFrames;
 		}
 	}
 
@@ -311,6 +314,34 @@ void CSoundBaseDevice::RegisterNeedDataCallback (TSoundDataCallback *pCallback,
 	m_pCallbackParam = pParam;
 }
 
+void CSoundBaseDevice::RegisterRenderCallback (TSoundRenderCallback *pCallback, void *pParam)
+{
+	m_SpinLock.Acquire ();
+
+	m_pRenderFloatCallback = 0;
+	m_pRenderParam = pParam;
+	m_pRenderCallback = pCallback;
+
+	m_SpinLock.Release ();
+}
+
+void CSoundBaseDevice::RegisterRenderFloatCallback (TSoundRenderFloatCallback *pCallback,
+						    void *pParam)
+{
+	TConvertRoutine *pConvertRoutine = GetConvertRoutine (SoundFormatFloat32, m_HWFormat,
+							      SOUND_HW_CHANNELS, m_bSwapChannels);
+	assert (pConvertRoutine != 0);
+
+	m_SpinLock.Acquire ();
+
+	m_pRenderCallback = 0;
+	m_pRenderConvertRoutine = pConvertRoutine;
+	m_pRenderParam = pParam;
+	m_pRenderFloatCallback = pCallback;
+
+	m_SpinLock.Release ();
+}
+
 boolean CSoundBaseDevice::AreChannelsSwapped (void) const
 {
 	return m_bSwapChannels;
@@ -517,84 +548,147 @@ u32 CSoundBaseDevice::ConvertIEC958Sample (u32 nSample, unsigned nFrame)
 	nSample &= 0xFFFFFF;
 	nSample <<= 4;
 
-	if (   nFrame < IEC958_STATUS_BYTES * 8
-	    && (m_uchIEC958Status[nFrame / 8] & BIT(nFrame % 8)))
+	if (nFrame < IEC958_STATUS_BYTES * 8)
 	{
-		nSample |= 0x40000000;
-
+		nSample |= m_IEC958FrameBits[nFrame];
 	}
 
+	// the preamble has an even number of ones and does not change the parity
 	if (parity32 (nSample))
 	{
 		nSample |= 0x80000000;
 	}
 
-	if (nFrame == 0)
+	return nSample;
+}
+
+void CSoundBaseDevice::ConvertIEC958Samples (u32 *pBuffer, unsigned nChunkSize,
+					     unsigned nChannels)
+{
+	assert (m_HWFormat == SoundFormatIEC958);
+	assert (pBuffer != 0);
+	assert (nChannels > 0);
+	assert (nChunkSize % nChannels == 0);
+
+	// this loop has no dependencies between the samples and can be vectorized
+	for (unsigned i = 0; i < nChunkSize; i++)
 	{
-		nSample |= IEC958_B_FRAME_PREAMBLE;
+		u32 nValue = (pBuffer[i] & 0xFFFFFF) << 4;
+
+		pBuffer[i] = nValue | (u32) parity32 (nValue) << 31;
 	}
 
-	return nSample;
+	ApplyIEC958Framing (pBuffer, nChunkSize, nChannels);
 }
 
-void CSoundBaseDevice::ConvertSoundFormat (void *pTo, const void *pFrom)
+void CSoundBaseDevice::SetIEC958NonPCM (boolean bNonPCM)
 {
-	s32 nValue = 0;
+	assert (m_HWFormat == SoundFormatIEC958);
 
-	switch (m_WriteFormat)
+	if (bNonPCM)
 	{
-	case SoundFormatUnsigned8: {
-		const u8 *pValue = reinterpret_cast<const u8 *> (pFrom);
-		nValue = *pValue;
-		nValue -= 128;
-		nValue <<= 24;
-		} break;
+		m_uchIEC958Status[0] |= 0b10;
+	}
+	else
+	{
+		m_uchIEC958Status[0] &= ~0b10;
+	}
 
-	case SoundFormatSigned16: {
-		const s16 *pValue = reinterpret_cast<const s16 *> (pFrom);
-		nValue = *pValue;
-		nValue <<= 16;
-		} break;
+	UpdateIEC958FrameBits ();
+}
+
+// precompute control channel bit and preamble for the frames, which carry the channel status
+void CSoundBaseDevice::UpdateIEC958FrameBits (void)
+{
+	for (unsigned nFrame = 0; nFrame < IEC958_STATUS_BYTES * 8; nFrame++)
+	{
+		m_IEC958FrameBits[nFrame] =   (m_uchIEC958Status[nFrame / 8] & BIT(nFrame % 8))
+					    ? 0x40000000 : 0;
+	}
+
+	m_IEC958FrameBits[0] |= IEC958_B_FRAME_PREAMBLE;
+}
+
+// Sample conversion //////////////////////////////////////////////////
+
+// The following helpers are only called with constant format parameters from
+// ConvertFrames(), so that the switch statements are resolved at compile time.
+
+static inline unsigned GetSampleSize (TSoundFormat Format)
+{
+	switch (Format)
+	{
+	case SoundFormatUnsigned8:	return sizeof (u8);
+	case SoundFormatSigned16:	return sizeof (s16);
+	case SoundFormatSigned24:	return sizeof (u8)*3;
+	case SoundFormatFloat32:	return sizeof (float);
+	default:			return sizeof (u32);
+	}
+}
+
+// returns the sample as 32-bit signed value
+static inline s32 ReadSample (TSoundFormat Format, const u8 *pFrom)
+{
+	switch (Format)
+	{
+	case SoundFormatUnsigned8:
+		return ((s32) *pFrom - 128) << 24;
+
+	case SoundFormatSigned16:
+		return (s32) *reinterpret_cast<const s16 *> (pFrom) << 16;
 
 	case SoundFormatSigned24:
-	case SoundFormatSigned24_32: {
-		const u32 *pValue = reinterpret_cast<const u32 *> (pFrom);
-		nValue = *pValue & 0xFFFFFF;
-		nValue <<= 8;
-		} break;
+		return (s32) (  (u32) pFrom[0] << 8
+			      | (u32) pFrom[1] << 16
+			      | (u32) pFrom[2] << 24);
+
+	case SoundFormatSigned24_32:
+		return (s32) (*reinterpret_cast<const u32 *> (pFrom) << 8);
+
+	case SoundFormatFloat32: {
+		float fValue = *reinterpret_cast<const float *> (pFrom);
+		if (fValue >= 1.0f)
+		{
+			return 0x7FFFFFFF;
+		}
 
-	case SoundFormatUnknown:
-		memcpy (pTo, pFrom, m_nWriteSampleSize);
-		return;
+		if (!(fValue > -1.0f))		// also catches NaN
+		{
+			return -0x7FFFFFFF-1;
+		}
+
+		return (s32) (fValue * 2147483648.0f);
+		}
 
 	default:
 		assert (0);
-		break;
+		return 0;
 	}
+}
 
-	switch (m_HWFormat)
+static inline void WriteSample (TSoundFormat Format, u8 *pTo, s32 nValue, int nRangeMax)
+{
+	switch (Format)
 	{
-	case SoundFormatSigned16: {
-		s16 *pValue = reinterpret_cast<s16 *> (pTo);
-		*pValue = nValue >> 16;
-		} break;
+	case SoundFormatSigned16:
+		*reinterpret_cast<s16 *> (pTo) = nValue >> 16;
+		break;
 
-	case SoundFormatSigned24_32: {
-		s32 *pValue = reinterpret_cast<s32 *> (pTo);
-		*pValue = nValue >> 8;
-		} break;
+	case SoundFormatSigned24_32:
+		*reinterpret_cast<s32 *> (pTo) = nValue >> 8;
+		break;
 
 	case SoundFormatUnsigned32: {
 		s64 llValue = (s64) nValue;
 		llValue += 1U << 31;
-		llValue *= m_nRangeMax;
+		llValue *= nRangeMax;
 		llValue >>= 32;
 
-		u32 *pValue = reinterpret_cast<u32 *> (pTo);
-		*pValue = (u32) llValue;
+		*reinterpret_cast<u32 *> (pTo) = (u32) llValue;
 		} break;
 
-	case SoundFormatIEC958: {
+	case SoundFormatIEC958:
+		// control channel bit and preamble are inserted in GetChunkInternal()
 		nValue >>= 4;
 		nValue &= 0xFFFFFF0;
 		if (parity32 (nValue))
@@ -602,9 +696,8 @@ void CSoundBaseDevice::ConvertSoundFormat (void *pTo, const void *pFrom)
 			nValue |= 0x80000000;
 		}
 
-		s32 *pValue = reinterpret_cast<s32 *> (pTo);
-		*pValue = nValue;
-		} break;
+		*reinterpret_cast<s32 *> (pTo) = nValue;
+		break;
 
 	default:
 		assert (0);
@@ -612,6 +705,66 @@ void CSoundBaseDevice::ConvertSoundFormat (void *pTo, const void *pFrom)
 	}
 }
 
+template <TSoundFormat WriteFormat, TSoundFormat HWFormat, unsigned nChannels,
+	  boolean bSwapChannels>
+void CSoundBaseDevice::ConvertFrames (void *pTo, const void *pFrom, unsigned nFrames,
+				      int nRangeMax)
+{
+	const unsigned nInSize = GetSampleSize (WriteFormat);
+	const unsigned nOutSize = GetSampleSize (HWFormat);
+
+	const u8 *pIn = static_cast<const u8 *> (pFrom);
+	u8 *pOut = static_cast<u8 *> (pTo);
+	assert (pIn != 0);
+	assert (pOut != 0);
+
+	while (nFrames-- > 0)
+	{
+		s32 nLeft = ReadSample (WriteFormat, pIn);
+		s32 nRight = nChannels == 2 ? ReadSample (WriteFormat, pIn + nInSize) : nLeft;
+		pIn += nChannels * nInSize;
+
+		WriteSample (HWFormat, pOut,		bSwapChannels ? nRight : nLeft,  nRangeMax);
+		WriteSample (HWFormat, pOut + nOutSize,	bSwapChannels ? nLeft  : nRight, nRangeMax);
+		pOut += SOUND_HW_CHANNELS * nOutSize;
+	}
+}
+
+#define CONVERT_CHANNELS(write, hw)							\
+	if (nChannels == 2)								\
+	{										\
+		return bSwapChannels ? ConvertFrames<write, hw, 2, TRUE>		\
+				     : ConvertFrames<write, hw, 2, FALSE>;		\
+	}										\
+	return bSwapChannels ? ConvertFrames<write, hw, 1, TRUE>			\
+			     : ConvertFrames<write, hw, 1, FALSE>;
+
+#define CONVERT_HW_FORMAT(write)							\
+	switch (HWFormat)								\
+	{										\
+	case SoundFormatSigned16:	CONVERT_CHANNELS (write, SoundFormatSigned16)	\
+	case SoundFormatSigned24_32:	CONVERT_CHANNELS (write, SoundFormatSigned24_32) \
+	case SoundFormatUnsigned32:	CONVERT_CHANNELS (write, SoundFormatUnsigned32)	\
+	case SoundFormatIEC958:		CONVERT_CHANNELS (write, SoundFormatIEC958)	\
+	default:			assert (0); return 0;				\
+	}
+
+CSoundBaseDevice::TConvertRoutine *CSoundBaseDevice::GetConvertRoutine (TSoundFormat WriteFormat,
+									 TSoundFormat HWFormat,
+									 unsigned nChannels,
+									 boolean bSwapChannels)
+{
+	switch (WriteFormat)
+	{
+	case SoundFormatUnsigned8:	CONVERT_HW_FORMAT (SoundFormatUnsigned8)
+	case SoundFormatSigned16:	CONVERT_HW_FORMAT (SoundFormatSigned16)
+	case SoundFormatSigned24:	CONVERT_HW_FORMAT (SoundFormatSigned24)
+	case SoundFormatSigned24_32:	CONVERT_HW_FORMAT (SoundFormatSigned24_32)
+	case SoundFormatFloat32:	CONVERT_HW_FORMAT (SoundFormatFloat32)
+	default:			assert (0); return 0;
+	}
+}
+
 unsigned CSoundBaseDevice::GetChunkInternal (void *pBuffer, unsigned nChunkSize)
 {
 	u8 *pBuffer8 = static_cast<u8 *> (pBuffer);
@@ -621,6 +774,12 @@ unsigned CSoundBaseDevice::GetChunkInternal (void *pBuffer, unsigned nChunkSize)
 	assert (nChunkSize % SOUND_HW_CHANNELS == 0);
 	unsigned nChunkSizeBytes = nChunkSize * m_nHWSampleSize;
 
+	if (   m_pRenderCallback != 0
+	    || m_pRenderFloatCallback != 0)
+	{
+		return RenderChunk (pBuffer, nChunkSize);
+	}
+
 	m_SpinLock.Acquire ();
 
 	unsigned nQueueBytesAvail = GetQueueBytesAvail ();
@@ -640,62 +799,144 @@ unsigned CSoundBaseDevice::GetChunkInternal (void *pBuffer, unsigned nChunkSize)
 
 	m_SpinLock.Release ();
 
-	while (nBytes < nChunkSizeBytes)
+	if (m_HWFormat != SoundFormatUnsigned32)
+	{
+		if (nBytes < nChunkSizeBytes)
+		{
+			memset (pBuffer8, 0, nChunkSizeBytes - nBytes);
+		}
+	}
+	else
 	{
-		memcpy (pBuffer8, m_NullFrame, m_nHWFrameSize);
+		while (nBytes < nChunkSizeBytes)
+		{
+			memcpy (pBuffer8, m_NullFrame, m_nHWFrameSize);
 
-		pBuffer8 += m_nHWFrameSize;
-		nBytes += m_nHWFrameSize;
+			pBuffer8 += m_nHWFrameSize;
+			nBytes += m_nHWFrameSize;
+		}
 	}
 
-	// insert control channel and parity bits, and preamble into IEC958 block
 	if (m_HWFormat == SoundFormatIEC958)
 	{
-		u32 *pBuffer32 = static_cast<u32 *> (pBuffer);
+		ApplyIEC958Framing (static_cast<u32 *> (pBuffer), nChunkSize);
+	}
+
+	if (   m_pCallback != 0
+	    && nQueueBytesAvail < m_nNeedDataThreshold)
+	{
+		(*m_pCallback) (m_pCallbackParam);
+	}
+
+	return nChunkSize;
+}
+
+unsigned CSoundBaseDevice::RenderChunk (void *pBuffer, unsigned nChunkSize)
+{
+	assert (pBuffer != 0);
+	assert (nChunkSize > 0);
+
+	m_SpinLock.Acquire ();
+
+	TSoundRenderCallback *pCallback = m_pRenderCallback;
+	TSoundRenderFloatCallback *pFloatCallback = m_pRenderFloatCallback;
+	TConvertRoutine *pConvertRoutine = m_pRenderConvertRoutine;
+	void *pParam = m_pRenderParam;
+
+	m_SpinLock.Release ();
+
+	if (pCallback != 0)
+	{
+		// the samples are rendered in place, only IEC958 needs a second pass
+		unsigned nResult = (*pCallback) (pBuffer, nChunkSize, pParam);
+		assert (nResult <= nChunkSize);
 
-		unsigned i;
-		for (i = 0; i < nChunkSize; i += IEC958_SUBFRAMES_PER_BLOCK)
+		if (m_HWFormat == SoundFormatIEC958)
 		{
-			unsigned j;
-			for (j = 0; j < IEC958_STATUS_BYTES * 8 * SOUND_HW_CHANNELS; j++)
-			{
-				u32 *pSubFrame = &pBuffer32[i + j];
+			ConvertIEC958Samples (static_cast<u32 *> (pBuffer), nResult);
+		}
 
-				unsigned nFrame = j / SOUND_HW_CHANNELS;
-				if (m_uchIEC958Status[nFrame / 8] & BIT(nFrame % 8))
-				{
-					u32 nValue = *pSubFrame;
+		return nResult;
+	}
 
-					nValue |= 0x40000000;
+	if (pFloatCallback == 0)	// unregistered in the meantime, send silence
+	{
+		u8 *pBuffer8 = static_cast<u8 *> (pBuffer);
+		for (unsigned i = 0; i < nChunkSize; i += SOUND_HW_CHANNELS)
+		{
+			memcpy (pBuffer8, m_NullFrame, m_nHWFrameSize);
+			pBuffer8 += m_nHWFrameSize;
+		}
 
-					nValue &= 0x7FFFFFFF;
-					if (parity32 (nValue))
-					{
-						nValue |= 0x80000000;
-					}
+		return nChunkSize;
+	}
 
-					*pSubFrame = nValue;
-				}
+	assert (pConvertRoutine != 0);
 
-				if (nFrame == 0)
-				{
-					*pSubFrame |= IEC958_B_FRAME_PREAMBLE;
-				}
-			}
+	u8 *pBuffer8 = static_cast<u8 *> (pBuffer);
+	unsigned nFrames = nChunkSize / SOUND_HW_CHANNELS;
+	while (nFrames > 0)
+	{
+		float Buffer[SOUND_CONVERT_FRAMES * SOUND_HW_CHANNELS];
+
+		unsigned nBlockFrames = nFrames;
+		if (nBlockFrames > SOUND_CONVERT_FRAMES)
+		{
+			nBlockFrames = SOUND_CONVERT_FRAMES;
 		}
 
-		assert (i == nChunkSize);	// nChunkSize must be a multiple of 384
+		if (!(*pFloatCallback) (Buffer, nBlockFrames, pParam))
+		{
+			return 0;
+		}
+
+		(*pConvertRoutine) (pBuffer8, Buffer, nBlockFrames, m_nRangeMax);
+
+		pBuffer8 += nBlockFrames * m_nHWFrameSize;
+		nFrames -= nBlockFrames;
 	}
 
-	if (   m_pCallback != 0
-	    && nQueueBytesAvail < m_nNeedDataThreshold)
+	if (m_HWFormat == SoundFormatIEC958)
 	{
-		(*m_pCallback) (m_pCallbackParam);
+		ApplyIEC958Framing (static_cast<u32 *> (pBuffer), nChunkSize);
 	}
 
 	return nChunkSize;
 }
 
+// insert control channel bits and preamble into IEC958 blocks, the samples have already been
+// shifted and the parity bit has been calculated without the control channel bit
+void CSoundBaseDevice::ApplyIEC958Framing (u32 *pBuffer, unsigned nChunkSize, unsigned nChannels)
+{
+	assert (m_HWFormat == SoundFormatIEC958);
+	assert (pBuffer != 0);
+	assert (nChannels > 0);
+
+	const unsigned nBlockSize = IEC958_FRAMES_PER_BLOCK * nChannels;
+	for (unsigned i = 0; i < nChunkSize; i += nBlockSize)
+	{
+		unsigned nFrames = IEC958_STATUS_BYTES * 8;
+		if (nFrames * nChannels > nChunkSize - i)
+		{
+			nFrames = (nChunkSize - i) / nChannels;
+		}
+
+		u32 *pSubFrame = &pBuffer[i];
+		for (unsigned nFrame = 0; nFrame < nFrames; nFrame++)
+		{
+			// a set control channel bit toggles the parity
+			u32 nBits = m_IEC958FrameBits[nFrame];
+			u32 nParity = (nBits & 0x40000000) << 1;
+
+			for (unsigned j = 0; j < nChannels; j++)
+			{
+				*pSubFrame = (*pSubFrame | nBits) ^ nParity;
+				pSubFrame++;
+			}
+		}
+	}
+}
+
 unsigned CSoundBaseDevice::GetQueueBytesFree (void)
 {
 	assert (m_nQueueSize > 1);
@@ -731,14 +972,26 @@ void CSoundBaseDevice::Enqueue (const void *pBuffer, unsigned nCount)
 	assert (m_pQueue != 0);
 
 	assert (nCount > 0);
-	while (nCount-- > 0)
+	assert (nCount < m_nQueueSize);
+
+	// copy in up to two parts, if the ring buffer wraps around
+	unsigned nPart = m_nQueueSize - m_nInPtr;
+	if (nPart > nCount)
 	{
-		m_pQueue[m_nInPtr] = *p++;
+		nPart = nCount;
+	}
 
-		if (++m_nInPtr == m_nQueueSize)
-		{
-			m_nInPtr = 0;
-		}
+	memcpy (m_pQueue + m_nInPtr, p, nPart);
+	m_nInPtr += nPart;
+	if (m_nInPtr == m_nQueueSize)
+	{
+		m_nInPtr = 0;
+	}
+
+	if (nCount > nPart)
+	{
+		memcpy (m_pQueue, p + nPart, nCount - nPart);
+		m_nInPtr = nCount - nPart;
 	}
 }
 
@@ -749,14 +1002,25 @@ void CSoundBaseDevice::Dequeue (void *pBuffer, unsigned nCount)
 	assert (m_pQueue != 0);
 
 	assert (nCount > 0);
-	while (nCount-- > 0)
+	assert (nCount < m_nQueueSize);
+
+	unsigned nPart = m_nQueueSize - m_nOutPtr;
+	if (nPart > nCount)
 	{
-		*p++ = m_pQueue[m_nOutPtr];
+		nPart = nCount;
+	}
 
-		if (++m_nOutPtr == m_nQueueSize)
-		{
-			m_nOutPtr = 0;
-		}
+	memcpy (p, m_pQueue + m_nOutPtr, nPart);
+	m_nOutPtr += nPart;
+	if (m_nOutPtr == m_nQueueSize)
+	{
+		m_nOutPtr = 0;
+	}
+
+	if (nCount > nPart)
+	{
+		memcpy (p + nPart, m_pQueue, nCount - nPart);
+		m_nOutPtr = nCount - nPart;
 	}
 }
 
@@ -864,14 +1128,26 @@ void CSoundBaseDevice::ReadEnqueue (const void *pBuffer, unsigned nCount)
 	assert (m_pReadQueue != 0);
 
 	assert (nCount > 0);
-	while (nCount-- > 0)
+	assert (nCount < m_nReadQueueSize);
+
+	// copy in up to two parts, if the ring buffer wraps around
+	unsigned nPart = m_nReadQueueSize - m_nReadInPtr;
+	if (nPart > nCount)
+	{
+		nPart = nCount;
+	}
+
+	memcpy (m_pReadQueue + m_nReadInPtr, p, nPart);
+	m_nReadInPtr += nPart;
+	if (m_nReadInPtr == m_nReadQueueSize)
 	{
-		m_pReadQueue[m_nReadInPtr] = *p++;
+		m_nReadInPtr = 0;
+	}
 
-		if (++m_nReadInPtr == m_nReadQueueSize)
-		{
-			m_nReadInPtr = 0;
-		}
+	if (nCount > nPart)
+	{
+		memcpy (m_pReadQueue, p + nPart, nCount - nPart);
+		m_nReadInPtr = nCount - nPart;
 	}
 }
 
@@ -882,13 +1158,24 @@ void CSoundBaseDevice::ReadDequeue (void *pBuffer, unsigned nCount)
 	assert (m_pReadQueue != 0);
 
 	assert (nCount > 0);
-	while (nCount-- > 0)
+	assert (nCount < m_nReadQueueSize);
+
+	unsigned nPart = m_nReadQueueSize - m_nReadOutPtr;
+	if (nPart > nCount)
 	{
-		*p++ = m_pReadQueue[m_nReadOutPtr];
+		nPart = nCount;
+	}
 
-		if (++m_nReadOutPtr == m_nReadQueueSize)
-		{
-			m_nReadOutPtr = 0;
-		}
+	memcpy (p, m_pReadQueue + m_nReadOutPtr, nPart);
+	m_nReadOutPtr += nPart;
+	if (m_nReadOutPtr == m_nReadQueueSize)
+	{
+		m_nReadOutPtr = 0;
+	}
+
+	if (nCount > nPart)
+	{
+		memcpy (p + nPart, m_pReadQueue, nCount - nPart);
+		m_nReadOutPtr = nCount - nPart;
 	}
 }
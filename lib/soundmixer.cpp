@@ -0,0 +1,556 @@
+//
+// soundmixer.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/soundmixer.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define PI			3.14159265358979f
+
+#define CUTOFF			0.9f		// of the lower Nyquist frequency
+
+#define CONVERT_FRAMES		64		// frames converted at once in Write()
+
+CSoundMixer::CSoundMixer (CSoundBaseDevice *pDevice, unsigned nSampleRate)
+:	m_pDevice (pDevice),
+	m_nSampleRate (nSampleRate),
+	m_fMasterGain (1.0f)
+{
+	assert (m_pDevice != 0);
+	assert (m_nSampleRate > 0);
+
+	for (unsigned i = 0; i < SOUND_MIXER_MAX_STREAMS; i++)
+	{
+		m_pStream[i] = 0;
+	}
+}
+
+CSoundMixer::~CSoundMixer (void)
+{
+	assert (m_pDevice != 0);
+	m_pDevice->RegisterRenderFloatCallback (0, 0);
+
+	for (unsigned i = 0; i < SOUND_MIXER_MAX_STREAMS; i++)
+	{
+		if (m_pStream[i] != 0)
+		{
+			RemoveStream (i);
+		}
+	}
+
+	m_pDevice = 0;
+}
+
+boolean CSoundMixer::Start (void)
+{
+	assert (m_pDevice != 0);
+	m_pDevice->RegisterRenderFloatCallback (RenderStub, this);
+
+	return m_pDevice->Start ();
+}
+
+void CSoundMixer::Cancel (void)
+{
+	assert (m_pDevice != 0);
+	m_pDevice->Cancel ();
+}
+
+boolean CSoundMixer::IsActive (void) const
+{
+	assert (m_pDevice != 0);
+	return m_pDevice->IsActive ();
+}
+
+int CSoundMixer::AddStream (TSoundFormat Format, unsigned nChannels, unsigned nSampleRate,
+			    unsigned nQueueMsecs)
+{
+	assert (1 <= nChannels && nChannels <= 2);
+	assert (nSampleRate > 0);
+	assert (1 <= nQueueMsecs && nQueueMsecs <= 1000);
+
+	unsigned nSampleSize;
+	switch (Format)
+	{
+	case SoundFormatUnsigned8:	nSampleSize = sizeof (u8);	break;
+	case SoundFormatSigned16:	nSampleSize = sizeof (s16);	break;
+	case SoundFormatSigned24:	nSampleSize = sizeof (u8)*3;	break;
+	case SoundFormatSigned24_32:	nSampleSize = sizeof (s32);	break;
+	case SoundFormatFloat32:	nSampleSize = sizeof (float);	break;
+
+	default:
+		assert (0);
+		return -1;
+	}
+
+	TStream *pStream = new TStream;
+	if (pStream == 0)
+	{
+		return -1;
+	}
+
+	pStream->Format = Format;
+	pStream->nChannels = nChannels;
+	pStream->nFrameSize = nChannels * nSampleSize;
+	pStream->fGain = 1.0f;
+	pStream->nUnderruns = 0;
+
+	// the ring capacity must be a power of 2
+	unsigned nQueueFrames = (nSampleRate * nQueueMsecs + 999) / 1000;
+	unsigned nQueueSize = 2;
+	while (nQueueSize < nQueueFrames)
+	{
+		nQueueSize <<= 1;
+	}
+
+	pStream->nQueueSize = nQueueSize;
+	pStream->pQueue = new CSPSCRing<TFrame> (nQueueSize);
+
+	pStream->bResample = nSampleRate != m_nSampleRate;
+	pStream->nStep = ((u64) nSampleRate << 32) / m_nSampleRate;
+	pStream->nFraction = 0;
+	pStream->nPending = 0;
+	pStream->pCoeff = 0;
+	pStream->nHistoryPos = 0;
+	memset (pStream->History, 0, sizeof pStream->History);
+
+	if (pStream->bResample)
+	{
+		pStream->pCoeff = CreateFilter (nSampleRate, m_nSampleRate);
+	}
+
+	if (   pStream->pQueue == 0
+	    || (   pStream->bResample
+		&& pStream->pCoeff == 0))
+	{
+		delete [] pStream->pCoeff;
+		delete pStream->pQueue;
+		delete pStream;
+
+		return -1;
+	}
+
+	m_SpinLock.Acquire ();
+
+	for (unsigned i = 0; i < SOUND_MIXER_MAX_STREAMS; i++)
+	{
+		if (m_pStream[i] == 0)
+		{
+			m_pStream[i] = pStream;
+
+			m_SpinLock.Release ();
+
+			return i;
+		}
+	}
+
+	m_SpinLock.Release ();
+
+	delete [] pStream->pCoeff;
+	delete pStream->pQueue;
+	delete pStream;
+
+	return -1;
+}
+
+void CSoundMixer::RemoveStream (int nStream)
+{
+	assert (0 <= nStream && nStream < SOUND_MIXER_MAX_STREAMS);
+
+	m_SpinLock.Acquire ();
+
+	TStream *pStream = m_pStream[nStream];
+	m_pStream[nStream] = 0;
+
+	m_SpinLock.Release ();
+
+	// Render() does not use the stream any more
+	assert (pStream != 0);
+	delete [] pStream->pCoeff;
+	delete pStream->pQueue;
+	delete pStream;
+}
+
+int CSoundMixer::Write (int nStream, const void *pBuffer, size_t nCount)
+{
+	assert (0 <= nStream && nStream < SOUND_MIXER_MAX_STREAMS);
+	TStream *pStream = m_pStream[nStream];
+	assert (pStream != 0);
+	assert (pStream->pQueue != 0);
+
+	const u8 *pBuffer8 = static_cast<const u8 *> (pBuffer);
+	assert (pBuffer8 != 0);
+
+	int nResult = 0;
+
+	unsigned nFrames = nCount / pStream->nFrameSize;
+	unsigned nFramesFree = GetQueueFramesFree (nStream);
+	if (nFrames > nFramesFree)
+	{
+		nFrames = nFramesFree;
+	}
+
+	while (nFrames > 0)
+	{
+		TFrame Frames[CONVERT_FRAMES];
+
+		unsigned nBlockFrames = nFrames;
+		if (nBlockFrames > CONVERT_FRAMES)
+		{
+			nBlockFrames = CONVERT_FRAMES;
+		}
+
+		ConvertToFrames (pStream->Format, pStream->nChannels, pBuffer8, Frames, nBlockFrames);
+
+		unsigned nWritten = pStream->pQueue->WriteMultiple (Frames, nBlockFrames);
+
+		unsigned nBytes = nWritten * pStream->nFrameSize;
+		pBuffer8 += nBytes;
+		nResult += nBytes;
+
+		if (nWritten < nBlockFrames)
+		{
+			break;
+		}
+
+		nFrames -= nWritten;
+	}
+
+	return nResult;
+}
+
+unsigned CSoundMixer::GetQueueFramesFree (int nStream) const
+{
+	assert (0 <= nStream && nStream < SOUND_MIXER_MAX_STREAMS);
+	const TStream *pStream = m_pStream[nStream];
+	assert (pStream != 0);
+	assert (pStream->pQueue != 0);
+
+	// GetCount() is a lower bound for the consumer side, so this is safe
+	return pStream->nQueueSize - pStream->pQueue->GetCount ();
+}
+
+void CSoundMixer::SetGain (int nStream, float fGain)
+{
+	assert (0 <= nStream && nStream < SOUND_MIXER_MAX_STREAMS);
+	assert (m_pStream[nStream] != 0);
+
+	m_pStream[nStream]->fGain = fGain;
+}
+
+void CSoundMixer::SetMasterGain (float fGain)
+{
+	m_fMasterGain = fGain;
+}
+
+unsigned CSoundMixer::GetUnderruns (int nStream) const
+{
+	assert (0 <= nStream && nStream < SOUND_MIXER_MAX_STREAMS);
+	assert (m_pStream[nStream] != 0);
+
+	return m_pStream[nStream]->nUnderruns;
+}
+
+void CSoundMixer::Render (float *pBuffer, unsigned nFrames)
+{
+	assert (pBuffer != 0);
+	memset (pBuffer, 0, nFrames * sizeof (TFrame));
+
+	m_SpinLock.Acquire ();
+
+	for (unsigned i = 0; i < SOUND_MIXER_MAX_STREAMS; i++)
+	{
+		if (m_pStream[i] != 0)
+		{
+			RenderStream (m_pStream[i], pBuffer, nFrames);
+		}
+	}
+
+	m_SpinLock.Release ();
+
+	float fMasterGain = m_fMasterGain;
+	if (fMasterGain != 1.0f)
+	{
+		for (unsigned i = 0; i < nFrames * 2; i++)
+		{
+			pBuffer[i] *= fMasterGain;
+		}
+	}
+}
+
+boolean CSoundMixer::RenderStub (float *pBuffer, unsigned nFrames, void *pParam)
+{
+	CSoundMixer *pThis = static_cast<CSoundMixer *> (pParam);
+	assert (pThis != 0);
+
+	pThis->Render (pBuffer, nFrames);
+
+	return TRUE;
+}
+
+void CSoundMixer::RenderStream (TStream *pStream, float *pBuffer, unsigned nFrames)
+{
+	assert (pStream != 0);
+	CSPSCRing<TFrame> *pQueue = pStream->pQueue;
+	assert (pQueue != 0);
+
+	float fGain = pStream->fGain;
+
+	if (!pStream->bResample)
+	{
+		while (nFrames-- > 0)
+		{
+			TFrame *pFrame = pQueue->BeginRead ();
+			if (pFrame == 0)
+			{
+				pStream->nUnderruns++;
+
+				return;
+			}
+
+			*pBuffer++ += pFrame->fLeft * fGain;
+			*pBuffer++ += pFrame->fRight * fGain;
+
+			pQueue->EndRead ();
+		}
+
+		return;
+	}
+
+	assert (pStream->pCoeff != 0);
+
+	while (nFrames-- > 0)
+	{
+		// consume the input frames, which have been passed since the last output frame
+		while (pStream->nPending > 0)
+		{
+			TFrame *pFrame = pQueue->BeginRead ();
+			if (pFrame == 0)
+			{
+				pStream->nUnderruns++;
+
+				return;
+			}
+
+			PushHistory (pStream, *pFrame);
+
+			pQueue->EndRead ();
+
+			pStream->nPending--;
+		}
+
+		// The window contains the last SOUND_MIXER_TAPS input frames in channel order
+		// and the coefficients are duplicated for both channels, so that the loop uses
+		// four independent accumulators, which the compiler can map to one SIMD register.
+		const float *pHistory = &pStream->History[pStream->nHistoryPos * 2];
+		const float *pCoeff =   pStream->pCoeff
+				      + (pStream->nFraction >> (32-SOUND_MIXER_PHASE_BITS))
+					* SOUND_MIXER_TAPS*2;
+
+		float fSum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+		for (unsigned i = 0; i < SOUND_MIXER_TAPS*2; i += 4)
+		{
+			fSum[0] += pCoeff[i]   * pHistory[i];
+			fSum[1] += pCoeff[i+1] * pHistory[i+1];
+			fSum[2] += pCoeff[i+2] * pHistory[i+2];
+			fSum[3] += pCoeff[i+3] * pHistory[i+3];
+		}
+
+		*pBuffer++ += (fSum[0] + fSum[2]) * fGain;
+		*pBuffer++ += (fSum[1] + fSum[3]) * fGain;
+
+		u64 nPosition = (u64) pStream->nFraction + pStream->nStep;
+		pStream->nFraction = (u32) nPosition;
+		pStream->nPending = (unsigned) (nPosition >> 32);
+	}
+}
+
+void CSoundMixer::PushHistory (TStream *pStream, const TFrame &Frame)
+{
+	assert (pStream != 0);
+	unsigned nPos = pStream->nHistoryPos;
+	assert (nPos < SOUND_MIXER_TAPS);
+
+	// write each frame twice, the window is always continuous then
+	float *pHistory = pStream->History;
+	pHistory[nPos*2]   = pHistory[(nPos+SOUND_MIXER_TAPS)*2]   = Frame.fLeft;
+	pHistory[nPos*2+1] = pHistory[(nPos+SOUND_MIXER_TAPS)*2+1] = Frame.fRight;
+
+	if (++nPos == SOUND_MIXER_TAPS)
+	{
+		nPos = 0;
+	}
+
+	pStream->nHistoryPos = nPos;
+}
+
+// Filter design //////////////////////////////////////////////////////
+
+static float Sine (float x)
+{
+	// reduce to -PI..PI
+	while (x > PI)
+	{
+		x -= 2.0f*PI;
+	}
+	while (x < -PI)
+	{
+		x += 2.0f*PI;
+	}
+
+	// reduce to -PI/2..PI/2
+	if (x > PI/2.0f)
+	{
+		x = PI - x;
+	}
+	else if (x < -PI/2.0f)
+	{
+		x = -PI - x;
+	}
+
+	// Taylor series, error < 1e-7
+	float x2 = x*x;
+	return x * (1.0f - x2/6.0f * (1.0f - x2/20.0f * (1.0f - x2/42.0f
+			* (1.0f - x2/72.0f * (1.0f - x2/110.0f * (1.0f - x2/156.0f))))));
+}
+
+static float Cosine (float x)
+{
+	return Sine (x + PI/2.0f);
+}
+
+float *CSoundMixer::CreateFilter (unsigned nInRate, unsigned nOutRate)
+{
+	float *pCoeff = new float[SOUND_MIXER_PHASES * SOUND_MIXER_TAPS*2];
+	if (pCoeff == 0)
+	{
+		return 0;
+	}
+
+	// cutoff in cycles per input sample, below the lower Nyquist frequency
+	float fCutoff = 0.5f * CUTOFF;
+	if (nOutRate < nInRate)
+	{
+		fCutoff = fCutoff * nOutRate / nInRate;
+	}
+
+	const float fHalfWidth = SOUND_MIXER_TAPS / 2;
+
+	for (unsigned nPhase = 0; nPhase < SOUND_MIXER_PHASES; nPhase++)
+	{
+		float *pPhase = &pCoeff[nPhase * SOUND_MIXER_TAPS*2];
+		float fPhase = (float) nPhase / SOUND_MIXER_PHASES;
+
+		// Tap t is applied to the input frame, which is (SOUND_MIXER_TAPS-1-t) frames
+		// older than the newest one. The output is delayed by SOUND_MIXER_TAPS/2
+		// frames, so that all distances are within the window.
+		float fSum = 0.0f;
+		for (unsigned t = 0; t < SOUND_MIXER_TAPS; t++)
+		{
+			float x = fHalfWidth - 1.0f + fPhase - t;	// distance in input frames
+
+			float fSinc = x != 0.0f ? Sine (2.0f*PI*fCutoff*x) / (PI*x) : 2.0f*fCutoff;
+
+			// Blackman window over -fHalfWidth..fHalfWidth
+			float fWindow =   0.42f
+					+ 0.5f  * Cosine (PI*x / fHalfWidth)
+					+ 0.08f * Cosine (2.0f*PI*x / fHalfWidth);
+
+			float fValue = fSinc * fWindow;
+			pPhase[t*2] = pPhase[t*2+1] = fValue;
+			fSum += fValue;
+		}
+
+		// normalize to unity gain at DC
+		assert (fSum > 0.0f);
+		for (unsigned t = 0; t < SOUND_MIXER_TAPS*2; t++)
+		{
+			pPhase[t] /= fSum;
+		}
+	}
+
+	return pCoeff;
+}
+
+// Format conversion //////////////////////////////////////////////////
+
+unsigned CSoundMixer::ConvertToFrames (TSoundFormat Format, unsigned nChannels,
+				       const u8 *pFrom, TFrame *pTo, unsigned nFrames)
+{
+	assert (pFrom != 0);
+	assert (pTo != 0);
+
+	float *pOut = &pTo->fLeft;
+	unsigned nSamples = nFrames * nChannels;
+
+	// decode all samples one after the other, the loop is selected once per block
+	switch (Format)
+	{
+	case SoundFormatUnsigned8:
+		for (unsigned i = 0; i < nSamples; i++)
+		{
+			pOut[i] = ((int) pFrom[i] - 128) * (1.0f / 128.0f);
+		}
+		break;
+
+	case SoundFormatSigned16: {
+		const s16 *pIn = reinterpret_cast<const s16 *> (pFrom);
+		for (unsigned i = 0; i < nSamples; i++)
+		{
+			pOut[i] = pIn[i] * (1.0f / 32768.0f);
+		}
+		} break;
+
+	case SoundFormatSigned24:
+		for (unsigned i = 0; i < nSamples; i++, pFrom += 3)
+		{
+			s32 nValue = (s32) (  (u32) pFrom[0] << 8
+					    | (u32) pFrom[1] << 16
+					    | (u32) pFrom[2] << 24);
+			pOut[i] = nValue * (1.0f / 2147483648.0f);
+		}
+		break;
+
+	case SoundFormatSigned24_32: {
+		const u32 *pIn = reinterpret_cast<const u32 *> (pFrom);
+		for (unsigned i = 0; i < nSamples; i++)
+		{
+			pOut[i] = (s32) (pIn[i] << 8) * (1.0f / 2147483648.0f);
+		}
+		} break;
+
+	case SoundFormatFloat32:
+		memcpy (pOut, pFrom, nSamples * sizeof (float));
+		break;
+
+	default:
+		assert (0);
+		return 0;
+	}
+
+	// expand mono to stereo in place, from the end
+	if (nChannels == 1)
+	{
+		for (unsigned i = nFrames; i-- > 0;)
+		{
+			pTo[i].fLeft = pTo[i].fRight = pOut[i];
+		}
+	}
+
+	return nFrames;
+}
@@ -22,6 +22,7 @@
 #include <circle/memio.h>
 #include <circle/machineinfo.h>
 #include <circle/synchronize.h>
+#include <circle/new.h>
 #include <assert.h>
 
 // CS Register
@@ -50,6 +51,10 @@
 #define CS_CS		(3 << 0)
 #define CS_CS__SHIFT	0
 
+#define DLEN_MAX	0xFFFF
+
+#define BUS_IO_ADDRESS(addr)	(((addr) & 0xFFFFFF) + GPU_IO_BASE)
+
 CSPIMasterDMA::CSPIMasterDMA (CInterruptSystem *pInterruptSystem,
 			      unsigned nClockSpeed, unsigned CPOL, unsigned CPHA,
 			      boolean bDMAChannelLite)
@@ -64,13 +69,27 @@ CSPIMasterDMA::CSPIMasterDMA (CInterruptSystem *pInterruptSystem,
 	m_CE0  ( 8, GPIOModeAlternateFunction0),
 	m_CE1  ( 7, GPIOModeAlternateFunction0),
 	m_nCoreClockRate (CMachineInfo::Get ()->GetClockRate (CLOCK_ID_CORE)),
-	m_pCompletionRoutine (0)
+	m_pCompletionRoutine (0),
+	m_pQueueBuffer (0),
+	m_pQueueEntry (0),
+	m_pQueueTail (0),
+	m_nQueueLength (0)
 {
 	assert (m_nCoreClockRate > 0);
 }
 
 CSPIMasterDMA::~CSPIMasterDMA (void)
 {
+	if (m_nQueueLength > 0)
+	{
+		StopQueue ();
+	}
+
+	m_pQueueEntry = 0;
+	m_pQueueTail = 0;
+
+	delete [] m_pQueueBuffer;
+	m_pQueueBuffer = 0;
 }
 
 boolean CSPIMasterDMA::Initialize (void)
@@ -163,6 +182,13 @@ void CSPIMasterDMA::DMACompletionRoutine (boolean bRxStatus)
 	write32 (ARM_SPI0_CS, read32 (ARM_SPI0_CS) & ~(CS_TA | CS_DMAEN | CS_ADCS));
 	PeripheralExit ();
 
+	if (m_nQueueLength > 0)
+	{
+		InvalidateReadBuffers ();
+
+		m_nQueueLength = 0;
+	}
+
 	TSPICompletionRoutine *pCompletionRoutine = m_pCompletionRoutine;
 	m_pCompletionRoutine = 0;
 
@@ -249,3 +275,263 @@ int CSPIMasterDMA::WriteReadSync (unsigned    nChipSelect,
 
 	return (int) nCount;
 }
+
+boolean CSPIMasterDMA::StartQueue (const TSPITransfer *pTransfers, unsigned nTransfers,
+				   unsigned nPeriodUs)
+{
+	assert (m_nQueueLength == 0);
+
+	if (   nTransfers == 0
+	    || nTransfers > SPI_DMA_MAX_TRANSFERS)
+	{
+		return FALSE;
+	}
+
+	assert (pTransfers != 0);
+	for (unsigned i = 0; i < nTransfers; i++)
+	{
+		if (   pTransfers[i].nCount == 0
+		    || pTransfers[i].nCount > DLEN_MAX)
+		{
+			return FALSE;
+		}
+	}
+
+	// with a period, a transfer without chip select fills the gap until the next cycle
+	unsigned nGapBytes = 0;
+	if (nPeriodUs > 0)
+	{
+		unsigned nDivider = (m_nCoreClockRate / m_nClockSpeed) & ~1U;
+		assert (nDivider > 0);
+
+		u64 nCycleBytes = (u64) nPeriodUs * (m_nCoreClockRate / nDivider) / (8 * 1000000U);
+
+		u64 nQueueBytes = 0;
+		for (unsigned i = 0; i < nTransfers; i++)
+		{
+			nQueueBytes += pTransfers[i].nCount;
+		}
+
+		if (   nCycleBytes <= nQueueBytes
+		    || nCycleBytes - nQueueBytes > DLEN_MAX)
+		{
+			return FALSE;
+		}
+
+		nGapBytes = (unsigned) (nCycleBytes - nQueueBytes);
+	}
+
+	if (m_pQueueBuffer == 0)
+	{
+		m_pQueueBuffer = new (HEAP_DMA30) u8[  (SPI_DMA_MAX_TRANSFERS+1) * sizeof (TQueueEntry)
+						     + sizeof (TQueueTail) + 31];
+		if (m_pQueueBuffer == 0)
+		{
+			return FALSE;
+		}
+
+		m_pQueueEntry = (TQueueEntry *) (((uintptr) m_pQueueBuffer + 31) & ~31);
+		m_pQueueTail = (TQueueTail *) &m_pQueueEntry[SPI_DMA_MAX_TRANSFERS+1];
+	}
+
+	assert (m_pQueueEntry != 0);
+	assert (m_pQueueTail != 0);
+	m_pQueueTail->nDummyWrite = 0;
+	m_pQueueTail->nStopValue = (m_CPOL << CS_CPOL__SHIFT) | (m_CPHA << CS_CPHA__SHIFT);
+
+	TDMAControlBlock *pStop = &m_pQueueTail->Stop;
+	pStop->nTransferInformation     = TI_WAIT_RESP;
+	pStop->nSourceAddress           = BUS_ADDRESS ((uintptr) &m_pQueueTail->nStopValue);
+	pStop->nDestinationAddress      = BUS_IO_ADDRESS (ARM_SPI0_CS);
+	pStop->nTransferLength          = sizeof (u32);
+	pStop->n2DModeStride            = 0;
+	pStop->nNextControlBlockAddress = 0;
+	pStop->nReserved[0]             = 0;
+	pStop->nReserved[1]             = 0;
+
+	// the RX chain runs through all entries and either stops or restarts at entry 0
+	unsigned nEntries = nTransfers + (nGapBytes > 0 ? 1 : 0);
+	for (unsigned i = 0; i < nTransfers; i++)
+	{
+		u32 nNext = BUS_ADDRESS ((uintptr) pStop);
+		if (i+1 < nEntries)
+		{
+			nNext = BUS_ADDRESS ((uintptr) m_pQueueEntry[i+1].Setup);
+		}
+		else if (nPeriodUs > 0)
+		{
+			nNext = BUS_ADDRESS ((uintptr) m_pQueueEntry[0].Setup);
+		}
+
+		SetupQueueEntry (i, pTransfers[i], nNext);
+
+		m_QueueTransfer[i] = pTransfers[i];
+
+		if (pTransfers[i].pWriteBuffer != 0)
+		{
+			CleanAndInvalidateDataCacheRange ((uintptr) pTransfers[i].pWriteBuffer,
+							  pTransfers[i].nCount);
+		}
+
+		if (pTransfers[i].pReadBuffer != 0)
+		{
+			CleanAndInvalidateDataCacheRange ((uintptr) pTransfers[i].pReadBuffer,
+							  pTransfers[i].nCount);
+		}
+	}
+
+	if (nGapBytes > 0)
+	{
+		TSPITransfer Gap = {ChipSelectNone, 0, 0, nGapBytes};
+		SetupQueueEntry (nTransfers, Gap, BUS_ADDRESS ((uintptr) m_pQueueEntry[0].Setup));
+	}
+
+	m_nQueueLength = nTransfers;
+
+	// the TX channel is started from the RX chain for each transfer
+	unsigned nControlBlocks = ((uintptr) pStop - (uintptr) m_pQueueEntry) / sizeof (TDMAControlBlock) + 1;
+	CleanAndInvalidateDataCacheRange ((uintptr) m_pQueueEntry,
+					  nControlBlocks * sizeof (TDMAControlBlock));
+
+	m_RxDMA.SetupControlBlocks (m_pQueueEntry[0].Setup, nControlBlocks);
+
+	if (nPeriodUs == 0)
+	{
+		m_RxDMA.SetCompletionRoutine (DMACompletionStub, this);
+	}
+
+	m_RxDMA.Start ();
+
+	return TRUE;
+}
+
+void CSPIMasterDMA::StopQueue (void)
+{
+	if (m_nQueueLength == 0)
+	{
+		return;
+	}
+
+	m_RxDMA.Cancel ();
+	m_TxDMA.Cancel ();
+
+	PeripheralEntry ();
+	write32 (ARM_SPI0_CS,   (read32 (ARM_SPI0_CS) & ~(CS_TA | CS_DMAEN | CS_ADCS))
+			      | CS_CLEAR_RX | CS_CLEAR_TX);
+	PeripheralExit ();
+
+	InvalidateReadBuffers ();
+
+	m_nQueueLength = 0;
+}
+
+void CSPIMasterDMA::SetupQueueEntry (unsigned nEntry, const TSPITransfer &rTransfer,
+				     u32 nNextControlBlock)
+{
+	assert (nEntry <= SPI_DMA_MAX_TRANSFERS);
+	TQueueEntry *pEntry = &m_pQueueEntry[nEntry];
+
+	assert (rTransfer.nChipSelect <= 1 || rTransfer.nChipSelect == ChipSelectNone);
+	u32 nMode = (m_CPOL << CS_CPOL__SHIFT) | (m_CPHA << CS_CPHA__SHIFT);
+
+	unsigned nTxChannel = m_TxDMA.GetChannelNumber ();
+
+	static const u32 SetupRegister[5] =
+	{
+		ARM_SPI0_CS,		// end previous transfer, clear FIFOs
+		ARM_SPI0_DLEN,
+		ARM_SPI0_CS,		// start this transfer
+		0,			// TX channel CONBLK_AD
+		0			// TX channel CS
+	};
+
+	pEntry->SetupValue[0] = nMode | CS_CLEAR_RX | CS_CLEAR_TX;
+	pEntry->SetupValue[1] = rTransfer.nCount;
+	pEntry->SetupValue[2] =   nMode
+				| (rTransfer.nChipSelect << CS_CS__SHIFT)
+				| CS_DMAEN | CS_ADCS | CS_TA;
+	pEntry->SetupValue[3] = BUS_ADDRESS ((uintptr) &pEntry->TxBlock);
+	pEntry->SetupValue[4] =   CS_WAIT_FOR_OUTSTANDING_WRITES
+				| (DEFAULT_PANIC_PRIORITY << CS_PANIC_PRIORITY_SHIFT)
+				| (DEFAULT_PRIORITY << CS_PRIORITY_SHIFT)
+				| CS_ACTIVE;
+
+	for (unsigned i = 0; i < 5; i++)
+	{
+		u32 nRegister = SetupRegister[i];
+		if (i == 3)
+		{
+			nRegister = ARM_DMACHAN_CONBLK_AD (nTxChannel);
+		}
+		else if (i == 4)
+		{
+			nRegister = ARM_DMACHAN_CS (nTxChannel);
+		}
+
+		TDMAControlBlock *pBlock = &pEntry->Setup[i];
+		pBlock->nTransferInformation     = TI_WAIT_RESP;
+		pBlock->nSourceAddress           = BUS_ADDRESS ((uintptr) &pEntry->SetupValue[i]);
+		pBlock->nDestinationAddress      = BUS_IO_ADDRESS (nRegister);
+		pBlock->nTransferLength          = sizeof (u32);
+		pBlock->n2DModeStride            = 0;
+		pBlock->nNextControlBlockAddress =   i < 4
+						   ? BUS_ADDRESS ((uintptr) &pEntry->Setup[i+1])
+						   : BUS_ADDRESS ((uintptr) &pEntry->RxBlock);
+		pBlock->nReserved[0]             = 0;
+		pBlock->nReserved[1]             = 0;
+	}
+
+	TDMAControlBlock *pTx = &pEntry->TxBlock;
+	pTx->nTransferInformation     =   (DREQSourceSPITX << TI_PERMAP_SHIFT)
+					| (DEFAULT_BURST_LENGTH << TI_BURST_LENGTH_SHIFT)
+					| TI_DEST_DREQ
+					| TI_WAIT_RESP;
+	if (rTransfer.pWriteBuffer != 0)
+	{
+		pTx->nTransferInformation |= TI_SRC_WIDTH | TI_SRC_INC;
+		pTx->nSourceAddress = BUS_ADDRESS ((uintptr) rTransfer.pWriteBuffer);
+	}
+	else
+	{
+		pTx->nSourceAddress = BUS_ADDRESS ((uintptr) &m_pQueueTail->nDummyWrite);
+	}
+	pTx->nDestinationAddress      = BUS_IO_ADDRESS (ARM_SPI0_FIFO);
+	pTx->nTransferLength          = rTransfer.nCount;
+	pTx->n2DModeStride            = 0;
+	pTx->nNextControlBlockAddress = 0;
+	pTx->nReserved[0]             = 0;
+	pTx->nReserved[1]             = 0;
+
+	TDMAControlBlock *pRx = &pEntry->RxBlock;
+	pRx->nTransferInformation     =   (DREQSourceSPIRX << TI_PERMAP_SHIFT)
+					| (DEFAULT_BURST_LENGTH << TI_BURST_LENGTH_SHIFT)
+					| TI_SRC_DREQ
+					| TI_WAIT_RESP;
+	pRx->nSourceAddress           = BUS_IO_ADDRESS (ARM_SPI0_FIFO);
+	if (rTransfer.pReadBuffer != 0)
+	{
+		pRx->nTransferInformation |= TI_DEST_WIDTH | TI_DEST_INC;
+		pRx->nDestinationAddress = BUS_ADDRESS ((uintptr) rTransfer.pReadBuffer);
+	}
+	else
+	{
+		pRx->nDestinationAddress = BUS_ADDRESS ((uintptr) &m_pQueueTail->nDummyRead);
+	}
+	pRx->nTransferLength          = rTransfer.nCount;
+	pRx->n2DModeStride            = 0;
+	pRx->nNextControlBlockAddress = nNextControlBlock;
+	pRx->nReserved[0]             = 0;
+	pRx->nReserved[1]             = 0;
+}
+
+void CSPIMasterDMA::InvalidateReadBuffers (void)
+{
+	for (unsigned i = 0; i < m_nQueueLength; i++)
+	{
+		if (m_QueueTransfer[i].pReadBuffer != 0)
+		{
+			CleanAndInvalidateDataCacheRange ((uintptr) m_QueueTransfer[i].pReadBuffer,
+							  m_QueueTransfer[i].nCount);
+		}
+	}
+}
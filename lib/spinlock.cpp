@@ -2,7 +2,7 @@
 // spinlock.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,10 +22,15 @@
 #ifdef ARM_ALLOW_MULTI_CORE
 
 #include <circle/multicore.h>
+#include <circle/timer.h>
+#include <circle/util.h>
 #include <assert.h>
 
 #define SPINLOCK_SAVE_POWER
 
+#define BACKOFF_MIN		16		// delay loops
+#define BACKOFF_MAX		1024
+
 boolean CSpinLock::s_bEnabled = FALSE;
 
 CSpinLock::CSpinLock (unsigned nTargetLevel)
@@ -134,4 +139,120 @@ void CSpinLock::Enable (void)
 	s_bEnabled = TRUE;
 }
 
+CTicketSpinLock::CTicketSpinLock (unsigned nTargetLevel)
+:	m_nTargetLevel (nTargetLevel),
+	m_nNextTicket (0),
+	m_nOwner (0),
+	m_bTicketTaken (FALSE)
+{
+	assert (nTargetLevel <= FIQ_LEVEL);
+
+#ifdef SPINLOCK_STATISTICS
+	ResetStatistics ();
+#endif
+}
+
+CTicketSpinLock::~CTicketSpinLock (void)
+{
+	assert (m_nNextTicket == m_nOwner);
+}
+
+void CTicketSpinLock::Acquire (void)
+{
+	if (m_nTargetLevel >= IRQ_LEVEL)
+	{
+		EnterCritical (m_nTargetLevel);
+	}
+
+	if (!CSpinLock::IsEnabled ())
+	{
+		return;
+	}
+
+	u32 nTicket = __atomic_fetch_add (&m_nNextTicket, 1, __ATOMIC_RELAXED);
+
+	u32 nOwner = __atomic_load_n (&m_nOwner, __ATOMIC_ACQUIRE);
+	if (nOwner != nTicket)
+	{
+#ifdef SPINLOCK_STATISTICS
+		unsigned nWaiters = nTicket - nOwner + 1;
+		unsigned nStartTicks = CTimer::GetClockTicks ();
+#endif
+
+		unsigned nBackoff = BACKOFF_MIN;
+		do
+		{
+			if (nTicket - nOwner > 1)
+			{
+				for (unsigned i = 0; i < nBackoff; i++)
+				{
+					asm volatile ("yield");
+				}
+
+				if (nBackoff < BACKOFF_MAX)
+				{
+					nBackoff <<= 1;
+				}
+			}
+			else
+			{
+				// the owner sends an event on release, which is not lost, if it
+				// occurs before WFE
+				WaitForEvent ();
+			}
+
+			nOwner = __atomic_load_n (&m_nOwner, __ATOMIC_ACQUIRE);
+		}
+		while (nOwner != nTicket);
+
+#ifdef SPINLOCK_STATISTICS
+		m_Statistics.nContended++;
+		m_Statistics.nWaitTicks += CTimer::GetClockTicks () - nStartTicks;
+		if (nWaiters > m_Statistics.nMaxWaiters)
+		{
+			m_Statistics.nMaxWaiters = nWaiters;
+		}
+#endif
+	}
+
+#ifdef SPINLOCK_STATISTICS
+	m_Statistics.nAcquired++;
+#endif
+
+	m_bTicketTaken = TRUE;
+}
+
+void CTicketSpinLock::Release (void)
+{
+	if (m_bTicketTaken)
+	{
+		m_bTicketTaken = FALSE;
+
+		__atomic_store_n (&m_nOwner, m_nOwner+1, __ATOMIC_RELEASE);
+
+		DataSyncBarrier ();
+		SendEvent ();
+	}
+
+	if (m_nTargetLevel >= IRQ_LEVEL)
+	{
+		LeaveCritical ();
+	}
+}
+
+#ifdef SPINLOCK_STATISTICS
+
+void CTicketSpinLock::GetStatistics (TStatistics *pStatistics) const
+{
+	assert (pStatistics != 0);
+	memcpy (pStatistics, &m_Statistics, sizeof *pStatistics);
+}
+
+void CTicketSpinLock::ResetStatistics (void)
+{
+	memset (&m_Statistics, 0, sizeof m_Statistics);
+}
+
+#endif
+
 #endif
@@ -2,7 +2,7 @@
 // string.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // ftoa() inspired by Arjan van Vught <info@raspberrypi-dmx.nl>
 //
@@ -21,8 +21,10 @@
 //
 #include <circle/string.h>
 #include <circle/util.h>
+#include <assert.h>
 
 #define FORMAT_RESERVE		64	// additional bytes to allocate
+#define FORMAT_STACK_SIZE	256	// stack buffer for the first formatting pass
 
 #if AARCH == 32
 	#define MAX_NUMBER_LEN		22	// 64 bit octal number
@@ -35,127 +37,157 @@
 #define MAX_FLOAT_LEN		(1+MAX_NUMBER_LEN+1+MAX_PRECISION)
 
 CString::CString (void)
-:	m_pBuffer (0),
-	m_nSize (0)
+:	m_pBuffer (m_InlineBuffer),
+	m_nSize (STRING_INLINE_SIZE),
+	m_pInPtr (m_InlineBuffer),
+	m_bExternal (FALSE),
+	m_nTruncated (0)
 {
+	m_InlineBuffer[0] = '\0';
 }
 
 CString::CString (const char *pString)
+:	m_pBuffer (m_InlineBuffer),
+	m_nSize (STRING_INLINE_SIZE),
+	m_pInPtr (m_InlineBuffer),
+	m_bExternal (FALSE),
+	m_nTruncated (0)
 {
-	m_nSize = strlen (pString)+1;
-
-	m_pBuffer = new char[m_nSize];
-
-	strcpy (m_pBuffer, pString);
+	operator = (pString);
 }
 
 CString::CString (const CString &rString)
+:	m_pBuffer (m_InlineBuffer),
+	m_nSize (STRING_INLINE_SIZE),
+	m_pInPtr (m_InlineBuffer),
+	m_bExternal (FALSE),
+	m_nTruncated (0)
 {
-	m_nSize = strlen (rString)+1;
-
-	m_pBuffer = new char[m_nSize];
-
-	strcpy (m_pBuffer, rString);
+	operator = ((const char *) rString);
 }
 
 CString::CString (CString &&rrString)
+:	m_pBuffer (m_InlineBuffer),
+	m_nSize (STRING_INLINE_SIZE),
+	m_pInPtr (m_InlineBuffer),
+	m_bExternal (FALSE),
+	m_nTruncated (0)
 {
-	m_nSize = rrString.m_nSize;
-	m_pBuffer = rrString.m_pBuffer;
+	operator = (static_cast<CString &&> (rrString));
+}
 
-	rrString.m_nSize = 0;
-	rrString.m_pBuffer = nullptr;
+CString::CString (char *pBuffer, size_t nSize)
+:	m_pBuffer (pBuffer),
+	m_nSize (nSize),
+	m_pInPtr (pBuffer),
+	m_bExternal (TRUE),
+	m_nTruncated (0)
+{
+	assert (pBuffer != 0 || nSize == 0);
 }
 
 CString::~CString (void)
 {
-	delete [] m_pBuffer;
+	if (   !m_bExternal
+	    && m_pBuffer != m_InlineBuffer)
+	{
+		delete [] m_pBuffer;
+	}
+
 	m_pBuffer = 0;
 }
 
 CString::operator const char *(void) const
 {
-	if (m_pBuffer != 0)
-	{
-		return m_pBuffer;
-	}
-
-	return "";
+	return m_pBuffer;
 }
 
 const char *CString::operator = (const char *pString)
 {
-	delete [] m_pBuffer;
+	assert (!m_bExternal);
 
-	m_nSize = strlen (pString)+1;
-
-	m_pBuffer = new char[m_nSize];
+	size_t nLength = strlen (pString);
+	if (nLength >= m_nSize)
+	{
+		Resize (nLength+1, 0);
+	}
 
-	strcpy (m_pBuffer, pString);
+	memmove (m_pBuffer, pString, nLength+1);	// pString may be a part of this string
 
 	return m_pBuffer;
 }
 
 CString &CString::operator = (const CString &rString)
 {
-	delete [] m_pBuffer;
-
-	m_nSize = strlen (rString)+1;
-
-	m_pBuffer = new char[m_nSize];
-
-	strcpy (m_pBuffer, rString);
+	if (this != &rString)
+	{
+		operator = ((const char *) rString);
+	}
 
 	return *this;
 }
 
 CString &CString::operator = (CString &&rrString)
 {
-	delete [] m_pBuffer;
+	if (this == &rrString)
+	{
+		return *this;
+	}
+
+	// an inline string cannot be taken over
+	if (rrString.m_pBuffer == rrString.m_InlineBuffer)
+	{
+		operator = ((const char *) rrString);
+
+		return *this;
+	}
+
+	if (m_pBuffer != m_InlineBuffer)
+	{
+		delete [] m_pBuffer;
+	}
 
 	m_nSize = rrString.m_nSize;
 	m_pBuffer = rrString.m_pBuffer;
 
-	rrString.m_nSize = 0;
-	rrString.m_pBuffer = nullptr;
+	rrString.m_nSize = STRING_INLINE_SIZE;
+	rrString.m_pBuffer = rrString.m_InlineBuffer;
+	rrString.m_InlineBuffer[0] = '\0';
 
 	return *this;
 }
 
 size_t CString::GetLength (void) const
 {
-	if (m_pBuffer == 0)
-	{
-		return 0;
-	}
-	
 	return strlen (m_pBuffer);
 }
 
-void CString::Append (const char *pString)
+void CString::Reserve (size_t nLength)
 {
-	m_nSize = 1;		// for terminating '\0'
-	if (m_pBuffer != 0)
+	if (nLength >= m_nSize)
 	{
-		m_nSize += strlen (m_pBuffer);
+		Resize (nLength+1, GetLength ()+1);
 	}
-	m_nSize += strlen (pString);
+}
 
-	char *pBuffer = new char[m_nSize];
+void CString::Append (const char *pString)
+{
+	size_t nOldLength = GetLength ();
+	size_t nLength = strlen (pString);
 
-	if (m_pBuffer != 0)
+	if (nOldLength + nLength >= m_nSize)
 	{
-		strcpy (pBuffer, m_pBuffer);
-		delete [] m_pBuffer;
-	}
-	else
-	{
-		*pBuffer = '\0';
-	}
+		// grow geometrically, so that repeated appends do not copy the string each time
+		size_t nNewSize = m_nSize * 2;
+		if (nNewSize <= nOldLength + nLength)
+		{
+			nNewSize = nOldLength + nLength + 1;
+		}
 
-	strcat (pBuffer, pString);
+		Resize (nNewSize, nOldLength+1);
+	}
 
-	m_pBuffer = pBuffer;
+	memcpy (m_pBuffer + nOldLength, pString, nLength+1);
 }
 
 int CString::Compare (const char *pString) const
@@ -191,9 +223,6 @@ int CString::Replace (const char *pOld, const char *pNew)
 
 	CString OldString (m_pBuffer);
 
-	delete [] m_pBuffer;
-	m_nSize = FORMAT_RESERVE;
-	m_pBuffer = new char[m_nSize];
 	m_pInPtr = m_pBuffer;
 
 	const char *pReader = OldString.m_pBuffer;
@@ -245,12 +274,54 @@ void CString::Format (const char *pFormat, ...)
 
 void CString::FormatV (const char *pFormat, va_list Args)
 {
-	delete [] m_pBuffer;
+	assert (!m_bExternal);
 
-	m_nSize = FORMAT_RESERVE;
-	m_pBuffer = new char[m_nSize];
-	m_pInPtr = m_pBuffer;
+	// format into a stack buffer first, so that the string is allocated only once
+	char Buffer[FORMAT_STACK_SIZE];
+	va_list ArgsCopy;
+	va_copy (ArgsCopy, Args);
+	size_t nLength = FormatBufferV (Buffer, sizeof Buffer, pFormat, ArgsCopy);
+	va_end (ArgsCopy);
 
+	if (nLength >= m_nSize)
+	{
+		Resize (nLength+1, 0);
+	}
+
+	if (nLength < sizeof Buffer)
+	{
+		memcpy (m_pBuffer, Buffer, nLength+1);
+	}
+	else
+	{
+		// the string did not fit, but its length is known now
+		FormatBufferV (m_pBuffer, nLength+1, pFormat, Args);
+	}
+}
+
+size_t CString::FormatBuffer (char *pBuffer, size_t nSize, const char *pFormat, ...)
+{
+	va_list var;
+	va_start (var, pFormat);
+
+	size_t nResult = FormatBufferV (pBuffer, nSize, pFormat, var);
+
+	va_end (var);
+
+	return nResult;
+}
+
+size_t CString::FormatBufferV (char *pBuffer, size_t nSize, const char *pFormat, va_list Args)
+{
+	CString Target (pBuffer, nSize);
+
+	Target.FormatInternal (pFormat, Args);
+
+	return Target.m_pInPtr - Target.m_pBuffer + Target.m_nTruncated;
+}
+
+void CString::FormatInternal (const char *pFormat, va_list Args)
+{
 	while (*pFormat != '\0')
 	{
 		if (*pFormat == '%')
@@ -572,12 +643,15 @@ void CString::FormatV (const char *pFormat, va_list Args)
 		pFormat++;
 	}
 
-	*m_pInPtr = '\0';
+	if (m_nSize > 0)
+	{
+		*m_pInPtr = '\0';
+	}
 }
 
 void CString::PutChar (char chChar, size_t nCount)
 {
-	ReserveSpace (nCount);
+	nCount = ReserveSpace (nCount);
 
 	while (nCount--)
 	{
@@ -587,41 +661,66 @@ void CString::PutChar (char chChar, size_t nCount)
 
 void CString::PutString (const char *pString)
 {
-	size_t nLen = strlen (pString);
-	
-	ReserveSpace (nLen);
-	
-	strcpy (m_pInPtr, pString);
-	
+	size_t nLen = ReserveSpace (strlen (pString));
+
+	memcpy (m_pInPtr, pString, nLen);
+
 	m_pInPtr += nLen;
 }
 
-void CString::ReserveSpace (size_t nSpace)
+size_t CString::ReserveSpace (size_t nSpace)
 {
 	if (nSpace == 0)
 	{
-		return;
+		return 0;
 	}
-	
+
 	size_t nOffset = m_pInPtr - m_pBuffer;
 	size_t nNewSize = nOffset + nSpace + 1;
 	if (m_nSize >= nNewSize)
 	{
-		return;
+		return nSpace;
 	}
-	
+
+	if (m_bExternal)
+	{
+		size_t nAvailable = m_nSize > nOffset+1 ? m_nSize - (nOffset+1) : 0;
+		m_nTruncated += nSpace - nAvailable;
+
+		return nAvailable;
+	}
+
 	nNewSize += FORMAT_RESERVE;
-	char *pNewBuffer = new char[nNewSize];
-		
-	*m_pInPtr = '\0';
-	strcpy (pNewBuffer, m_pBuffer);
-	
-	delete [] m_pBuffer;
+	if (nNewSize < m_nSize * 2)
+	{
+		nNewSize = m_nSize * 2;
+	}
 
-	m_pBuffer = pNewBuffer;
-	m_nSize = nNewSize;
+	Resize (nNewSize, nOffset);
 
 	m_pInPtr = m_pBuffer + nOffset;
+
+	return nSpace;
+}
+
+void CString::Resize (size_t nSize, size_t nKeep)
+{
+	assert (!m_bExternal);
+	assert (nSize > m_nSize);
+	assert (nKeep <= m_nSize);
+
+	char *pNewBuffer = new char[nSize];
+	assert (pNewBuffer != 0);
+
+	memcpy (pNewBuffer, m_pBuffer, nKeep);
+
+	if (m_pBuffer != m_InlineBuffer)
+	{
+		delete [] m_pBuffer;
+	}
+
+	m_pBuffer = pNewBuffer;
+	m_nSize = nSize;
 }
 
 char *CString::ntoa (char *pDest, unsigned long ulNumber, unsigned nBase, boolean bUpcase)
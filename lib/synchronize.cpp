@@ -19,6 +19,7 @@
 //
 #include <circle/synchronize.h>
 #include <circle/sysconfig.h>
+#include <circle/memorymap.h>
 #include <circle/types.h>
 #include <assert.h>
 
@@ -132,35 +133,127 @@ void LeaveCritical (void)
 
 #endif
 
-#if RASPPI == 1
-
 //
-// Cache maintenance operations for ARMv6
+// Cache maintenance operations by MVA (same encoding on ARMv6 and ARMv7)
 //
 // NOTE: The following functions should hold all variables in CPU registers. Currently this will be
 //	 ensured using maximum optimation (see circle/synchronize.h).
 //
+// The range operations start at the cache line, which contains nAddress, and end with the
+// line, which contains the last byte of the range. Operations by set/way are not broadcast
+// to the other cores, so the whole cache is used for large ranges on single core only.
+// Memory in the uncached region does not need maintenance, but the barrier is still required.
+//
 
-void CleanAndInvalidateDataCacheRange (u32 nAddress, u32 nLength)
+#define CACHE_LINE_MASK		(DATA_CACHE_LINE_LENGTH_MIN-1)
+
+#define IS_UNCACHED(addr)	((addr) - MEM_UNCACHED_REGION < UNCACHED_REGION_SIZE)
+
+#define CleanLine(addr)		asm volatile ("mcr p15, 0, %0, c7, c10, 1" : : "r" (addr) : "memory")
+#define InvalidateLine(addr)	asm volatile ("mcr p15, 0, %0, c7, c6,  1" : : "r" (addr) : "memory")
+#define CleanAndInvalidateLine(addr) \
+				asm volatile ("mcr p15, 0, %0, c7, c14, 1" : : "r" (addr) : "memory")
+
+void InvalidateDataCacheRange (u32 nAddress, u32 nLength)
 {
-	while (1)
+	if (IS_UNCACHED (nAddress))
 	{
-		asm volatile ("mcr p15, 0, %0, c7, c14,  1" : : "r" (nAddress) : "memory");
+		DataSyncBarrier ();
+
+		return;
+	}
 
-		if (nLength <= DATA_CACHE_LINE_LENGTH_MIN)
-		{
-			break;
-		}
+#ifndef ARM_ALLOW_MULTI_CORE
+	if (nLength > DATA_CACHE_RANGE_MAX)
+	{
+		CleanAndInvalidateDataCache ();
 
-		nAddress += DATA_CACHE_LINE_LENGTH_MIN;
-		nLength  -= DATA_CACHE_LINE_LENGTH_MIN;
+		return;
+	}
+#endif
+
+	u32 nEndAddress = nAddress + nLength;
+
+	// partial lines at the edges may hold other data, which must not be discarded
+	if (nAddress & CACHE_LINE_MASK)
+	{
+		CleanAndInvalidateLine (nAddress);
+
+		nAddress = (nAddress | CACHE_LINE_MASK) + 1;
+	}
+
+	if (   (nEndAddress & CACHE_LINE_MASK)
+	    && nAddress < nEndAddress)
+	{
+		CleanAndInvalidateLine (nEndAddress);
+
+		nEndAddress &= ~CACHE_LINE_MASK;
+	}
+
+	for (; nAddress < nEndAddress; nAddress += DATA_CACHE_LINE_LENGTH_MIN)
+	{
+		InvalidateLine (nAddress);
 	}
 
 	DataSyncBarrier ();
 }
 
+void CleanDataCacheRange (u32 nAddress, u32 nLength)
+{
+	if (IS_UNCACHED (nAddress))
+	{
+		DataSyncBarrier ();
+
+		return;
+	}
+
+#ifndef ARM_ALLOW_MULTI_CORE
+	if (nLength > DATA_CACHE_RANGE_MAX)
+	{
+		CleanDataCache ();
+
+		return;
+	}
+#endif
+
+	u32 nEndAddress = nAddress + nLength;
+	for (nAddress &= ~CACHE_LINE_MASK; nAddress < nEndAddress;
+	     nAddress += DATA_CACHE_LINE_LENGTH_MIN)
+	{
+		CleanLine (nAddress);
+	}
+
+	DataSyncBarrier ();
+}
+
+void CleanAndInvalidateDataCacheRange (u32 nAddress, u32 nLength)
+{
+	if (IS_UNCACHED (nAddress))
+	{
+		DataSyncBarrier ();
+
+		return;
+	}
+
+#ifndef ARM_ALLOW_MULTI_CORE
+	if (nLength > DATA_CACHE_RANGE_MAX)
+	{
+		CleanAndInvalidateDataCache ();
+
+		return;
+	}
 #endif
 
+	u32 nEndAddress = nAddress + nLength;
+	for (nAddress &= ~CACHE_LINE_MASK; nAddress < nEndAddress;
+	     nAddress += DATA_CACHE_LINE_LENGTH_MIN)
+	{
+		CleanAndInvalidateLine (nAddress);
+	}
+
+	DataSyncBarrier ();
+}
+
 // ARMv7 ARM A3.5.4
 void SyncDataAndInstructionCache (void)
 {
@@ -19,6 +19,7 @@
 //
 #include <circle/synchronize.h>
 #include <circle/sysconfig.h>
+#include <circle/memorymap.h>
 #include <assert.h>
 
 #define MAX_CRITICAL_LEVEL	20		// maximum nested level of EnterCritical()
@@ -256,19 +257,87 @@ void CleanDataCache (void)
 	DataSyncBarrier ();
 }
 
-void InvalidateDataCacheRange (u64 nAddress, u64 nLength)
+void CleanAndInvalidateDataCache (void)
 {
-	while (1)
+	// clean and invalidate L1 data cache
+	for (unsigned nSet = 0; nSet < L1_DATA_CACHE_SETS; nSet++)
 	{
-		asm volatile ("dc ivac, %0" : : "r" (nAddress) : "memory");
+		for (unsigned nWay = 0; nWay < L1_DATA_CACHE_WAYS; nWay++)
+		{
+			u64 nSetWayLevel =   nWay << L1_SETWAY_WAY_SHIFT
+					   | nSet << L1_SETWAY_SET_SHIFT
+					   | 0 << SETWAY_LEVEL_SHIFT;
+
+			asm volatile ("dc cisw, %0" : : "r" (nSetWayLevel) : "memory");
+		}
+	}
 
-		if (nLength <= DATA_CACHE_LINE_LENGTH_MIN)
+	// clean and invalidate L2 unified cache
+	for (unsigned nSet = 0; nSet < L2_CACHE_SETS; nSet++)
+	{
+		for (unsigned nWay = 0; nWay < L2_CACHE_WAYS; nWay++)
 		{
-			break;
+			u64 nSetWayLevel =   nWay << L2_SETWAY_WAY_SHIFT
+					   | nSet << L2_SETWAY_SET_SHIFT
+					   | 1 << SETWAY_LEVEL_SHIFT;
+
+			asm volatile ("dc cisw, %0" : : "r" (nSetWayLevel) : "memory");
 		}
+	}
+
+	DataSyncBarrier ();
+}
+
+//
+// The range operations start at the cache line, which contains nAddress, and end with the
+// line, which contains the last byte of the range. Operations by set/way are not broadcast
+// to the other cores, so the whole cache is used for large ranges on single core only.
+// Memory in the uncached region does not need maintenance, but the barrier is still required.
+//
+
+#define CACHE_LINE_MASK		(DATA_CACHE_LINE_LENGTH_MIN-1)
+
+#define IS_UNCACHED(addr)	((addr) - MEM_UNCACHED_REGION < UNCACHED_REGION_SIZE)
+
+void InvalidateDataCacheRange (u64 nAddress, u64 nLength)
+{
+	if (IS_UNCACHED (nAddress))
+	{
+		DataSyncBarrier ();
+
+		return;
+	}
+
+#ifndef ARM_ALLOW_MULTI_CORE
+	if (nLength > DATA_CACHE_RANGE_MAX)
+	{
+		CleanAndInvalidateDataCache ();
+
+		return;
+	}
+#endif
+
+	u64 nEndAddress = nAddress + nLength;
+
+	// partial lines at the edges may hold other data, which must not be discarded
+	if (nAddress & CACHE_LINE_MASK)
+	{
+		asm volatile ("dc civac, %0" : : "r" (nAddress) : "memory");
+
+		nAddress = (nAddress | CACHE_LINE_MASK) + 1;
+	}
+
+	if (   (nEndAddress & CACHE_LINE_MASK)
+	    && nAddress < nEndAddress)
+	{
+		asm volatile ("dc civac, %0" : : "r" (nEndAddress) : "memory");
+
+		nEndAddress &= ~CACHE_LINE_MASK;
+	}
 
-		nAddress += DATA_CACHE_LINE_LENGTH_MIN;
-		nLength  -= DATA_CACHE_LINE_LENGTH_MIN;
+	for (; nAddress < nEndAddress; nAddress += DATA_CACHE_LINE_LENGTH_MIN)
+	{
+		asm volatile ("dc ivac, %0" : : "r" (nAddress) : "memory");
 	}
 
 	DataSyncBarrier ();
@@ -276,17 +345,27 @@ void InvalidateDataCacheRange (u64 nAddress, u64 nLength)
 
 void CleanDataCacheRange (u64 nAddress, u64 nLength)
 {
-	while (1)
+	if (IS_UNCACHED (nAddress))
 	{
-		asm volatile ("dc cvac, %0" : : "r" (nAddress) : "memory");
+		DataSyncBarrier ();
 
-		if (nLength <= DATA_CACHE_LINE_LENGTH_MIN)
-		{
-			break;
-		}
+		return;
+	}
 
-		nAddress += DATA_CACHE_LINE_LENGTH_MIN;
-		nLength  -= DATA_CACHE_LINE_LENGTH_MIN;
+#ifndef ARM_ALLOW_MULTI_CORE
+	if (nLength > DATA_CACHE_RANGE_MAX)
+	{
+		CleanDataCache ();
+
+		return;
+	}
+#endif
+
+	u64 nEndAddress = nAddress + nLength;
+	for (nAddress &= ~CACHE_LINE_MASK; nAddress < nEndAddress;
+	     nAddress += DATA_CACHE_LINE_LENGTH_MIN)
+	{
+		asm volatile ("dc cvac, %0" : : "r" (nAddress) : "memory");
 	}
 
 	DataSyncBarrier ();
@@ -294,17 +373,27 @@ void CleanDataCacheRange (u64 nAddress, u64 nLength)
 
 void CleanAndInvalidateDataCacheRange (u64 nAddress, u64 nLength)
 {
-	while (1)
+	if (IS_UNCACHED (nAddress))
 	{
-		asm volatile ("dc civac, %0" : : "r" (nAddress) : "memory");
+		DataSyncBarrier ();
 
-		if (nLength <= DATA_CACHE_LINE_LENGTH_MIN)
-		{
-			break;
-		}
+		return;
+	}
 
-		nAddress += DATA_CACHE_LINE_LENGTH_MIN;
-		nLength  -= DATA_CACHE_LINE_LENGTH_MIN;
+#ifndef ARM_ALLOW_MULTI_CORE
+	if (nLength > DATA_CACHE_RANGE_MAX)
+	{
+		CleanAndInvalidateDataCache ();
+
+		return;
+	}
+#endif
+
+	u64 nEndAddress = nAddress + nLength;
+	for (nAddress &= ~CACHE_LINE_MASK; nAddress < nEndAddress;
+	     nAddress += DATA_CACHE_LINE_LENGTH_MIN)
+	{
+		asm volatile ("dc civac, %0" : : "r" (nAddress) : "memory");
 	}
 
 	DataSyncBarrier ();
@@ -24,6 +24,8 @@
 #include <circle/machineinfo.h>
 #include <circle/memory.h>
 #include <circle/chainboot.h>
+#include <circle/boottrace.h>
+#include <circle/timer.h>
 #include <circle/qemu.h>
 #include <circle/synchronize.h>
 #include <circle/sysconfig.h>
@@ -185,6 +187,8 @@ char circle_version_string[10];
 
 void sysinit (void)
 {
+	unsigned nStartTicks = CTimer::GetClockTicks ();	// time spent in the firmware
+
 	EnableFIQs ();		// go to IRQ_LEVEL, EnterCritical() will not work otherwise
 	EnableIRQs ();		// go to TASK_LEVEL
 
@@ -213,6 +217,10 @@ void sysinit (void)
 
 	CMemorySystem Memory;
 
+	// record after enabling the MMU, because atomic operations are used
+	CBootTrace::Mark ("sysinit", nStartTicks);
+	CBootTrace::Mark ("memory");
+
 #if RASPPI >= 4
 	MachineInfo.FetchDTB ();
 #endif
@@ -243,6 +251,8 @@ void sysinit (void)
 		(**pFunc) ();
 	}
 
+	CBootTrace::Mark ("main");
+
 	extern int main (void);
 	if (main () == EXIT_REBOOT)
 	{
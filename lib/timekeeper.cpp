@@ -0,0 +1,292 @@
+//
+// timekeeper.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/timekeeper.h>
+#include <circle/synchronize.h>
+#include <circle/sysconfig.h>
+#include <assert.h>
+
+// The product (counter delta * mult) must not overflow 64 bits. With this shift that takes
+// more than 1000 seconds at 1 MHz and at 54 MHz, the conversion is re-based every second.
+#define SHIFT			24
+#define REBASE_INTERVAL		HZ
+
+#define NS_PER_SECOND		1000000000ULL
+
+#define FLL_GAIN_SHIFT		2		// 1/4 of the measured frequency error is applied
+
+CTimeKeeper *CTimeKeeper::s_pThis = 0;
+
+CTimeKeeper::CTimeKeeper (void)
+:	m_nSequence (0),
+	m_nCounterFrequency (CLOCKHZ),
+	m_nFrequencyPPB (0),
+	m_nSlewPPB (0),
+	m_nSlewEndNs (0),
+	m_bTimeSet (FALSE),
+	m_nLastAdjustNs (0),
+	m_RebaseTimer (RebaseHandler, this)
+{
+	assert (s_pThis == 0);
+	s_pThis = this;
+
+#ifdef USE_PHYSICAL_COUNTER
+#if AARCH == 32
+	u32 nCNTFRQ;
+	asm volatile ("mrc p15, 0, %0, c14, c0, 0" : "=r" (nCNTFRQ));
+#else
+	u64 nCNTFRQ;
+	asm volatile ("mrs %0, CNTFRQ_EL0" : "=r" (nCNTFRQ));
+#endif
+	m_nCounterFrequency = nCNTFRQ;
+#endif
+	assert (m_nCounterFrequency > 0);
+
+	m_nNominalMult = (NS_PER_SECOND << SHIFT) / m_nCounterFrequency;
+
+	TParams Params;
+	Params.nBaseCounter = ReadCounter ();
+	Params.nBaseNs = 0;
+	Params.nMult = m_nNominalMult;
+	Params.nRealtimeOffsetNs = 0;
+
+	m_Params[0] = Params;
+	m_Params[1] = Params;
+}
+
+CTimeKeeper::~CTimeKeeper (void)
+{
+	m_RebaseTimer.Cancel ();
+
+	s_pThis = 0;
+}
+
+boolean CTimeKeeper::Initialize (void)
+{
+	m_RebaseTimer.Start (REBASE_INTERVAL);
+
+	return TRUE;
+}
+
+u64 CTimeKeeper::GetMonotonicNs (void) const
+{
+	TParams Params;
+	GetParams (&Params);
+
+	return Convert (Params, ReadCounter ());
+}
+
+u64 CTimeKeeper::GetTimeNs (void) const
+{
+	TParams Params;
+	GetParams (&Params);
+
+	return Convert (Params, ReadCounter ()) + Params.nRealtimeOffsetNs;
+}
+
+boolean CTimeKeeper::IsTimeSet (void) const
+{
+	return m_bTimeSet;
+}
+
+void CTimeKeeper::SetTime (u64 nTimeNs)
+{
+	m_SpinLock.Acquire ();
+
+	Rebase ();
+
+	TParams Params = m_Params[m_nSequence & 1];
+	Params.nRealtimeOffsetNs = (s64) (nTimeNs - Params.nBaseNs);
+
+	m_nSlewPPB = 0;
+	Params.nMult = GetMult ();
+
+	SetParams (Params);
+
+	m_bTimeSet = TRUE;
+
+	m_SpinLock.Release ();
+}
+
+void CTimeKeeper::Adjust (s64 nOffsetNs)
+{
+	m_SpinLock.Acquire ();
+
+	Rebase ();
+
+	TParams Params = m_Params[m_nSequence & 1];
+	u64 nNowNs = Params.nBaseNs;
+
+	if (   !m_bTimeSet
+	    || nOffsetNs > TIMEKEEPER_STEP_THRESHOLD_NS
+	    || nOffsetNs < -TIMEKEEPER_STEP_THRESHOLD_NS)
+	{
+		Params.nRealtimeOffsetNs += nOffsetNs;
+		m_nSlewPPB = 0;
+
+		// the next offset is not useful for the frequency estimate
+		m_nLastAdjustNs = 0;
+		m_bTimeSet = TRUE;
+	}
+	else
+	{
+		// the offset has been accumulated since the last adjustment (FLL)
+		if (   m_nLastAdjustNs != 0
+		    && nNowNs - m_nLastAdjustNs >= NS_PER_SECOND)
+		{
+			s64 nError = nOffsetNs * (s64) NS_PER_SECOND / (s64) (nNowNs - m_nLastAdjustNs);
+			s64 nFrequency = m_nFrequencyPPB + (nError >> FLL_GAIN_SHIFT);
+			if (nFrequency > TIMEKEEPER_MAX_SLEW_PPB)
+			{
+				nFrequency = TIMEKEEPER_MAX_SLEW_PPB;
+			}
+			else if (nFrequency < -TIMEKEEPER_MAX_SLEW_PPB)
+			{
+				nFrequency = -TIMEKEEPER_MAX_SLEW_PPB;
+			}
+
+			m_nFrequencyPPB = (int) nFrequency;
+		}
+
+		m_nLastAdjustNs = nNowNs;
+
+		// slew the offset with the max. rate for whole re-base intervals, which are
+		// restarted here, so that the slewing ends with a Rebase()
+		u64 nAbsOffsetNs = nOffsetNs < 0 ? -nOffsetNs : nOffsetNs;
+		u64 nDurationNs = nAbsOffsetNs * NS_PER_SECOND / TIMEKEEPER_MAX_SLEW_PPB;
+		nDurationNs = (nDurationNs / NS_PER_SECOND + 1) * NS_PER_SECOND;
+
+		m_nSlewPPB = (int) (nOffsetNs * (s64) NS_PER_SECOND / (s64) nDurationNs);
+		m_nSlewEndNs = nNowNs + nDurationNs - NS_PER_SECOND / 2;
+
+		m_RebaseTimer.Start (REBASE_INTERVAL);
+	}
+
+	Params.nMult = GetMult ();
+
+	SetParams (Params);
+
+	m_SpinLock.Release ();
+}
+
+int CTimeKeeper::GetFrequencyPPB (void) const
+{
+	return m_nFrequencyPPB;
+}
+
+CTimeKeeper *CTimeKeeper::Get (void)
+{
+	return s_pThis;
+}
+
+void CTimeKeeper::GetParams (TParams *pParams) const
+{
+	assert (pParams != 0);
+
+	u32 nSequence;
+	do
+	{
+		nSequence = __atomic_load_n (&m_nSequence, __ATOMIC_ACQUIRE);
+
+		*pParams = m_Params[nSequence & 1];
+
+		DataMemBarrier ();
+	}
+	while (nSequence != __atomic_load_n (&m_nSequence, __ATOMIC_RELAXED));
+}
+
+// The readers use m_Params[m_nSequence & 1], which is not written at this time.
+void CTimeKeeper::SetParams (const TParams &rParams)
+{
+	__atomic_add_fetch (&m_nSequence, 1, __ATOMIC_RELEASE);	// readers switch to [1]
+	DataMemBarrier ();
+
+	m_Params[0] = rParams;
+
+	__atomic_add_fetch (&m_nSequence, 1, __ATOMIC_RELEASE);	// readers switch to [0]
+	DataMemBarrier ();
+
+	m_Params[1] = rParams;
+}
+
+u64 CTimeKeeper::Convert (const TParams &rParams, u64 nCounter)
+{
+	return rParams.nBaseNs + (((nCounter - rParams.nBaseCounter) * rParams.nMult) >> SHIFT);
+}
+
+void CTimeKeeper::Rebase (void)
+{
+	TParams Params = m_Params[m_nSequence & 1];
+
+	u64 nCounter = ReadCounter ();
+	Params.nBaseNs = Convert (Params, nCounter);
+	Params.nBaseCounter = nCounter;
+
+	if (   m_nSlewPPB != 0
+	    && Params.nBaseNs >= m_nSlewEndNs)
+	{
+		m_nSlewPPB = 0;
+	}
+
+	Params.nMult = GetMult ();
+
+	SetParams (Params);
+}
+
+u64 CTimeKeeper::GetMult (void) const
+{
+	s64 nPPB = (s64) m_nFrequencyPPB + m_nSlewPPB;
+
+	return m_nNominalMult + (s64) m_nNominalMult * nPPB / (s64) NS_PER_SECOND;
+}
+
+u64 CTimeKeeper::ReadCounter (void)
+{
+#ifdef USE_PHYSICAL_COUNTER
+	InstructionSyncBarrier ();
+
+#if AARCH == 32
+	u32 nCNTPCTLow, nCNTPCTHigh;
+	asm volatile ("mrrc p15, 0, %0, %1, c14" : "=r" (nCNTPCTLow), "=r" (nCNTPCTHigh));
+
+	return (u64) nCNTPCTHigh << 32 | nCNTPCTLow;
+#else
+	u64 nCNTPCT;
+	asm volatile ("mrs %0, CNTPCT_EL0" : "=r" (nCNTPCT));
+
+	return nCNTPCT;
+#endif
+#else
+	return CTimer::GetClockTicks64 ();
+#endif
+}
+
+void CTimeKeeper::RebaseHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext)
+{
+	CTimeKeeper *pThis = (CTimeKeeper *) pParam;
+	assert (pThis != 0);
+
+	pThis->m_SpinLock.Acquire ();
+
+	pThis->Rebase ();
+
+	pThis->m_SpinLock.Release ();
+
+	pThis->m_RebaseTimer.Start (REBASE_INTERVAL);
+}
@@ -2,7 +2,7 @@
 // timer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,6 +23,7 @@
 #include <circle/memio.h>
 #include <circle/synchronize.h>
 #include <circle/logger.h>
+#include <circle/boottrace.h>
 #include <circle/debug.h>
 #include <assert.h>
 
@@ -30,16 +31,24 @@
 	#error USE_PHYSICAL_COUNTER is required on Raspberry Pi 4!
 #endif
 
-struct TKernelTimer
+struct THighResTimer
 {
+	TTimerWheelEntry     m_Entry;
 #ifndef NDEBUG
 	unsigned	     m_nMagic;
-#define KERNEL_TIMER_MAGIC	0x4B544D43
+#define HIGHRES_TIMER_MAGIC	0x48544D43
 #endif
 	TKernelTimerHandler *m_pHandler;
-	unsigned	     m_nElapsesAt;
 	void 		    *m_pParam;
 	void 		    *m_pContext;
+	boolean		     m_bPending;	// still on the timer wheel
+	THighResTimer	    *m_pNextDue;
+};
+
+struct TDueHighResTimers
+{
+	THighResTimer	    *m_pHead;
+	THighResTimer	    *m_pTail;
 };
 
 static const char FromTimer[] = "timer";
@@ -59,7 +68,8 @@ CTimer::CTimer (CInterruptSystem *pInterruptSystem)
 	m_nMsDelay (200000),
 	m_nusDelay (m_nMsDelay / 1000),
 	m_pUpdateTimeHandler (0),
-	m_nPeriodicHandlers (0)
+	m_nPeriodicHandlers (0),
+	m_nIdlePeriodicHandlers (0)
 {
 	assert (s_pThis == 0);
 	s_pThis = this;
@@ -78,16 +88,38 @@ CTimer::~CTimer (void)
 #endif
 
 	m_pInterruptSystem->DisconnectIRQ (ARM_IRQLOCAL0_CNTPNS);
+	m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_TIMER3);
 #endif
 
-	TPtrListElement *pElement;
-	while ((pElement = m_KernelTimerList.GetFirst ()) != 0)
+	TKernelTimer *pTimer;
+	while ((pTimer = m_KernelTimerList.GetFirst ()) != 0)
 	{
-		TKernelTimer *pTimer = (TKernelTimer *) m_KernelTimerList.GetPtr (pElement);
-		assert (pTimer != 0);
 		assert (pTimer->m_nMagic == KERNEL_TIMER_MAGIC);
 
-		m_KernelTimerList.Remove (pElement);
+		m_KernelTimerList.Remove (pTimer);
+		pTimer->m_bPending = FALSE;
+
+		if (!pTimer->m_bOwned)
+		{
+			delete pTimer;
+		}
+	}
+
+	while ((pTimer = m_KernelTimerPool.GetFirst ()) != 0)
+	{
+		m_KernelTimerPool.Remove (pTimer);
+
+		delete pTimer;
+	}
+
+	// remove all high-resolution timers from the wheel (maximum delay is 2^31 ticks)
+	TDueHighResTimers Due = {0, 0};
+	m_HighResTimerWheel.Expire (read32 (ARM_SYSTIMER_CLO) + 0x7FFFFFFF,
+				    HighResTimerWheelHandler, &Due);
+	while (Due.m_pHead != 0)
+	{
+		THighResTimer *pTimer = Due.m_pHead;
+		Due.m_pHead = pTimer->m_pNextDue;
 
 		delete pTimer;
 	}
@@ -103,31 +135,41 @@ boolean CTimer::Initialize (void)
 
 	PeripheralEntry ();
 
+	u32 nClockTicks = read32 (ARM_SYSTIMER_CLO);
 	write32 (ARM_SYSTIMER_CLO, -(30 * CLOCKHZ));	// timer wraps soon, to check for problems
+	CBootTrace::ClockChanged (read32 (ARM_SYSTIMER_CLO) - nClockTicks);
+
+	m_nClockTicksPerHZTick = CLOCKHZ / HZ;
+
+	m_nNextTick = ReadCounter () + m_nClockTicksPerHZTick;
+	WriteCompare (m_nNextTick);
 
-	write32 (ARM_SYSTIMER_C3, read32 (ARM_SYSTIMER_CLO) + CLOCKHZ / HZ);
+	m_HighResTimerWheel.Reset (read32 (ARM_SYSTIMER_CLO));
 #else
 	m_pInterruptSystem->ConnectIRQ (ARM_IRQLOCAL0_CNTPNS, InterruptHandler, this);
 
-#if AARCH == 32
-	u32 nCNTPCTLow, nCNTPCTHigh;
-	asm volatile ("mrrc p15, 0, %0, %1, c14" : "=r" (nCNTPCTLow), "=r" (nCNTPCTHigh));
+	// the system timer is free here, it drives the high-resolution timers
+	m_pInterruptSystem->ConnectIRQ (ARM_IRQ_TIMER3, HighResInterruptHandler, this);
 
-	u64 nCNTP_CVAL = ((u64) nCNTPCTHigh << 32 | nCNTPCTLow) + CLOCKHZ / HZ;
-	asm volatile ("mcrr p15, 2, %0, %1, c14" :: "r" (nCNTP_CVAL & 0xFFFFFFFFU),
-						    "r" (nCNTP_CVAL >> 32));
+	PeripheralEntry ();
 
-	asm volatile ("mcr p15, 0, %0, c14, c2, 1" :: "r" (1));
+	m_HighResTimerWheel.Reset (read32 (ARM_SYSTIMER_CLO));
+
+#if AARCH == 32
+	m_nClockTicksPerHZTick = CLOCKHZ / HZ;
 #else
 	u64 nCNTFRQ;
 	asm volatile ("mrs %0, CNTFRQ_EL0" : "=r" (nCNTFRQ));
 	assert (nCNTFRQ % HZ == 0);
 	m_nClockTicksPerHZTick = nCNTFRQ / HZ;
+#endif
 
-	u64 nCNTPCT;
-	asm volatile ("mrs %0, CNTPCT_EL0" : "=r" (nCNTPCT));
-	asm volatile ("msr CNTP_CVAL_EL0, %0" :: "r" (nCNTPCT + m_nClockTicksPerHZTick));
+	m_nNextTick = ReadCounter () + m_nClockTicksPerHZTick;
+	WriteCompare (m_nNextTick);
 
+#if AARCH == 32
+	asm volatile ("mcr p15, 0, %0, c14, c2, 1" :: "r" (1));
+#else
 	asm volatile ("msr CNTP_CTL_EL0, %0" :: "r" (1));
 #endif
 #endif
@@ -158,6 +200,8 @@ boolean CTimer::Initialize (void)
 
 	PeripheralExit ();
 
+	CBootTrace::Mark ("timer");
+
 	return TRUE;
 }
 
@@ -239,6 +283,46 @@ unsigned CTimer::GetClockTicks (void)
 #endif
 }
 
+u64 CTimer::GetClockTicks64 (void)
+{
+#ifndef USE_PHYSICAL_COUNTER
+	PeripheralEntry ();
+
+	// the high word may increment between the two reads
+	u32 nHigh, nLow;
+	do
+	{
+		nHigh = read32 (ARM_SYSTIMER_CHI);
+		nLow = read32 (ARM_SYSTIMER_CLO);
+	}
+	while (nHigh != read32 (ARM_SYSTIMER_CHI));
+
+	PeripheralExit ();
+
+	return (u64) nHigh << 32 | nLow;
+#else
+#if AARCH == 32
+	InstructionSyncBarrier ();
+
+	u32 nCNTPCTLow, nCNTPCTHigh;
+	asm volatile ("mrrc p15, 0, %0, %1, c14" : "=r" (nCNTPCTLow), "=r" (nCNTPCTHigh));
+
+	return (u64) nCNTPCTHigh << 32 | nCNTPCTLow;
+#else
+	InstructionSyncBarrier ();
+
+	u64 nCNTPCT;
+	asm volatile ("mrs %0, CNTPCT_EL0" : "=r" (nCNTPCT));
+	u64 nCNTFRQ;
+	asm volatile ("mrs %0, CNTFRQ_EL0" : "=r" (nCNTFRQ));
+
+	// split the conversion, so that the product cannot overflow
+	return   nCNTPCT / nCNTFRQ * CLOCKHZ
+	       + nCNTPCT % nCNTFRQ * CLOCKHZ / nCNTFRQ;
+#endif
+#endif
+}
+
 unsigned CTimer::GetTicks (void) const
 {
 	return m_nTicks;
@@ -385,85 +469,359 @@ TKernelTimerHandle CTimer::StartKernelTimer (unsigned nDelay,
 					     void *pParam,
 					     void *pContext)
 {
-	TKernelTimer *pTimer = new TKernelTimer;
-	assert (pTimer != 0);
+	m_KernelTimerSpinLock.Acquire ();
 
-	unsigned nElapsesAt = m_nTicks + nDelay;
+	TKernelTimer *pTimer = m_KernelTimerPool.GetFirst ();
+	if (pTimer != 0)
+	{
+		m_KernelTimerPool.Remove (pTimer);
+	}
+
+	m_KernelTimerSpinLock.Release ();
+
+	if (pTimer == 0)
+	{
+		// pooled timers are never freed, so that a stale handle can be checked
+		pTimer = new TKernelTimer;
+		assert (pTimer != 0);
+	}
 
 	assert (pHandler != 0);
 #ifndef NDEBUG
 	pTimer->m_nMagic     = KERNEL_TIMER_MAGIC;
 #endif
 	pTimer->m_pHandler   = pHandler;
-	pTimer->m_nElapsesAt = nElapsesAt;
 	pTimer->m_pParam     = pParam;
 	pTimer->m_pContext   = pContext;
+	pTimer->m_bPending   = FALSE;
+	pTimer->m_bOwned     = FALSE;
+
+	AddKernelTimer (pTimer, nDelay);
+
+	return (TKernelTimerHandle) pTimer;
+}
+
+void CTimer::CancelKernelTimer (TKernelTimerHandle hTimer)
+{
+	TKernelTimer *pTimer = (TKernelTimer *) hTimer;
+	assert (pTimer != 0);
 
 	m_KernelTimerSpinLock.Acquire ();
 
-	TPtrListElement *pPrevElement = 0;
-	TPtrListElement *pElement = m_KernelTimerList.GetFirst ();
-	while (pElement != 0)
+	// the handle may be stale, but the timer object is still valid (pooled)
+	if (pTimer->m_bPending)
+	{
+		assert (pTimer->m_nMagic == KERNEL_TIMER_MAGIC);
+
+		m_KernelTimerList.Remove (pTimer);
+		pTimer->m_bPending = FALSE;
+
+		if (!pTimer->m_bOwned)
+		{
+			m_KernelTimerPool.InsertFirst (pTimer);
+		}
+	}
+
+	m_KernelTimerSpinLock.Release ();
+}
+
+void CTimer::AddKernelTimer (TKernelTimer *pTimer, unsigned nDelay)
+{
+	assert (pTimer != 0);
+
+	m_KernelTimerSpinLock.Acquire ();
+
+	if (pTimer->m_bPending)			// restart
+	{
+		m_KernelTimerList.Remove (pTimer);
+	}
+
+	unsigned nElapsesAt = m_nTicks + nDelay;
+	pTimer->m_nElapsesAt = nElapsesAt;
+	pTimer->m_bPending = TRUE;
+
+	// search from the end, because new timers elapse late in most cases
+	TKernelTimer *pTimer2 = m_KernelTimerList.GetLast ();
+	while (pTimer2 != 0)
 	{
-		TKernelTimer *pTimer2 = (TKernelTimer *) m_KernelTimerList.GetPtr (pElement);
-		assert (pTimer2 != 0);
 		assert (pTimer2->m_nMagic == KERNEL_TIMER_MAGIC);
 
-		if ((int) (pTimer2->m_nElapsesAt-nElapsesAt) > 0)
+		if ((int) (pTimer2->m_nElapsesAt-nElapsesAt) <= 0)
 		{
 			break;
 		}
 
-		pPrevElement = pElement;
-		pElement = m_KernelTimerList.GetNext (pElement);
+		pTimer2 = m_KernelTimerList.GetPrev (pTimer2);
 	}
 
-	if (pElement != 0)
+	if (pTimer2 != 0)
 	{
-		m_KernelTimerList.InsertBefore (pElement, pTimer);
+		m_KernelTimerList.InsertAfter (pTimer2, pTimer);
 	}
 	else
 	{
-		m_KernelTimerList.InsertAfter (pPrevElement, pTimer);
+		m_KernelTimerList.InsertFirst (pTimer);
 	}
 
 	m_KernelTimerSpinLock.Release ();
+}
+
+void CTimer::RemoveKernelTimer (TKernelTimer *pTimer)
+{
+	assert (pTimer != 0);
+
+	m_KernelTimerSpinLock.Acquire ();
+
+	if (pTimer->m_bPending)
+	{
+		m_KernelTimerList.Remove (pTimer);
+		pTimer->m_bPending = FALSE;
+	}
+
+	m_KernelTimerSpinLock.Release ();
+}
+
+void CTimer::IdleWait (unsigned nWakeTicks, boolean bWakeTicksValid)
+{
+#ifdef TICKLESS_IDLE
+	unsigned nIdleTicks = 0;		// number of ticks to be skipped
+
+#ifndef ARM_ALLOW_MULTI_CORE
+	if (m_nIdlePeriodicHandlers == 0)
+	{
+		nIdleTicks = TICKLESS_MAX_IDLE_TICKS;
+
+		m_KernelTimerSpinLock.Acquire ();
+
+		TKernelTimer *pTimer = m_KernelTimerList.GetFirst ();
+		if (pTimer != 0)
+		{
+			assert (pTimer->m_nMagic == KERNEL_TIMER_MAGIC);
+
+			// the next tick increments m_nTicks already
+			int nTicks = (int) (pTimer->m_nElapsesAt - m_nTicks) - 1;
+			if (nTicks < (int) nIdleTicks)
+			{
+				nIdleTicks = nTicks > 0 ? nTicks : 0;
+			}
+		}
+
+		m_KernelTimerSpinLock.Release ();
+	}
+#endif
+
+	TCounter nDeadline = m_nNextTick + (TCounter) nIdleTicks * m_nClockTicksPerHZTick;
+
+	if (bWakeTicksValid)
+	{
+		int nDelay = (int) (nWakeTicks - GetClockTicks ());
+		if (nDelay <= 0)
+		{
+			return;
+		}
+
+		PeripheralEntry ();
+
+#if defined (USE_PHYSICAL_COUNTER) && AARCH == 64
+		TCounter nWakeCounter =   ReadCounter ()
+					+ (u64) nDelay * m_nClockTicksPerHZTick / (CLOCKHZ / HZ);
+#else
+		TCounter nWakeCounter = ReadCounter () + nDelay;
+#endif
+
+		PeripheralExit ();
+
+		if ((TSignedCounter) (nWakeCounter - nDeadline) < 0)
+		{
+			nDeadline = nWakeCounter;
+		}
+	}
+
+#ifndef USE_PHYSICAL_COUNTER
+	m_HighResTimerSpinLock.Acquire ();
+
+	unsigned nExpires;
+	if (   m_HighResTimerWheel.GetNextExpiry (&nExpires)
+	    && (TSignedCounter) (nExpires - nDeadline) < 0)
+	{
+		nDeadline = nExpires;
+	}
+
+	m_HighResTimerSpinLock.Release ();
+#endif
+
+	PeripheralEntry ();
+
+	WriteCompare (nDeadline);
+
+	DataSyncBarrier ();
+	WaitForInterrupt ();
+
+	// woken by another interrupt, restore the regular tick (the timer IRQ is pending otherwise)
+	if ((TSignedCounter) (ReadCounter () - nDeadline) < 0)
+	{
+		UpdateTicks ();
+	}
+
+	PeripheralExit ();
+#else
+	DataSyncBarrier ();
+	WaitForInterrupt ();
+#endif
+}
+
+TKernelTimerHandle CTimer::StartHighResTimer (unsigned nDelayMicros,
+					      TKernelTimerHandler *pHandler,
+					      void *pParam,
+					      void *pContext)
+{
+	assert (nDelayMicros < 0x80000000U);
+
+	THighResTimer *pTimer = new THighResTimer;
+	assert (pTimer != 0);
+
+	assert (pHandler != 0);
+#ifndef NDEBUG
+	pTimer->m_nMagic   = HIGHRES_TIMER_MAGIC;
+#endif
+	pTimer->m_pHandler = pHandler;
+	pTimer->m_pParam   = pParam;
+	pTimer->m_pContext = pContext;
+	pTimer->m_bPending = TRUE;
+	pTimer->m_Entry.pParam = pTimer;
+
+	m_HighResTimerSpinLock.Acquire ();
+
+	PeripheralEntry ();
+
+	m_HighResTimerWheel.Add (&pTimer->m_Entry, read32 (ARM_SYSTIMER_CLO) + nDelayMicros);
+
+	ProgramHighResTimer ();
+
+	PeripheralExit ();
+
+	m_HighResTimerSpinLock.Release ();
 
 	return (TKernelTimerHandle) pTimer;
 }
 
-void CTimer::CancelKernelTimer (TKernelTimerHandle hTimer)
+void CTimer::CancelHighResTimer (TKernelTimerHandle hTimer)
 {
-	TKernelTimer *pTimer = (TKernelTimer *) hTimer;
+	THighResTimer *pTimer = (THighResTimer *) hTimer;
 	assert (pTimer != 0);
+	assert (pTimer->m_nMagic == HIGHRES_TIMER_MAGIC);
 
-	m_KernelTimerSpinLock.Acquire ();
+	m_HighResTimerSpinLock.Acquire ();
 
-	TPtrListElement *pElement = m_KernelTimerList.Find (pTimer);
-	if (pElement != 0)
+	// if the timer has just expired, its handler is called and it is deleted after that
+	if (!pTimer->m_bPending)
 	{
-		assert (pTimer->m_nMagic == KERNEL_TIMER_MAGIC);
+		m_HighResTimerSpinLock.Release ();
+
+		return;
+	}
+
+	m_HighResTimerWheel.Remove (&pTimer->m_Entry);
+
+	m_HighResTimerSpinLock.Release ();
+
+#ifndef NDEBUG
+	pTimer->m_nMagic = 0;
+#endif
+	delete pTimer;
+}
+
+// Programs the system timer compare register for the next high-resolution timer, which
+// is due. Without USE_PHYSICAL_COUNTER the next tick is considered too. The timer wheel
+// is based on the system timer counter (1 MHz), which may differ from GetClockTicks().
+
+void CTimer::ProgramHighResTimer (void)
+{
+	unsigned nExpires;
+	boolean bValid = m_HighResTimerWheel.GetNextExpiry (&nExpires);
+
+#ifndef USE_PHYSICAL_COUNTER
+	if (   !bValid
+	    || (int) (nExpires - m_nNextTick) > 0)
+	{
+		nExpires = m_nNextTick;
+	}
+#else
+	if (!bValid)
+	{
+		return;
+	}
+#endif
+
+	WriteSystemTimerCompare (nExpires);
+}
+
+void CTimer::PollHighResTimers (void)
+{
+	TDueHighResTimers Due = {0, 0};
+
+	m_HighResTimerSpinLock.Acquire ();
+
+	PeripheralEntry ();
+
+	m_HighResTimerWheel.Expire (read32 (ARM_SYSTIMER_CLO), HighResTimerWheelHandler, &Due);
+
+	ProgramHighResTimer ();
+
+	PeripheralExit ();
 
-		m_KernelTimerList.Remove (pElement);
+	m_HighResTimerSpinLock.Release ();
+
+	// call the handlers without lock, so that they can start timers again
+	while (Due.m_pHead != 0)
+	{
+		THighResTimer *pTimer = Due.m_pHead;
+		Due.m_pHead = pTimer->m_pNextDue;
+
+		assert (pTimer->m_nMagic == HIGHRES_TIMER_MAGIC);
+		TKernelTimerHandler *pHandler = pTimer->m_pHandler;
+		assert (pHandler != 0);
+		(*pHandler) ((TKernelTimerHandle) pTimer, pTimer->m_pParam, pTimer->m_pContext);
 
 #ifndef NDEBUG
 		pTimer->m_nMagic = 0;
 #endif
 		delete pTimer;
 	}
+}
 
-	m_KernelTimerSpinLock.Release ();
+void CTimer::HighResTimerWheelHandler (TTimerWheelEntry *pEntry, void *pContext)
+{
+	TDueHighResTimers *pDue = (TDueHighResTimers *) pContext;
+	assert (pDue != 0);
+
+	assert (pEntry != 0);
+	THighResTimer *pTimer = (THighResTimer *) pEntry->pParam;
+	assert (pTimer != 0);
+
+	pTimer->m_bPending = FALSE;
+	pTimer->m_pNextDue = 0;
+
+	if (pDue->m_pTail != 0)
+	{
+		pDue->m_pTail->m_pNextDue = pTimer;
+	}
+	else
+	{
+		pDue->m_pHead = pTimer;
+	}
+
+	pDue->m_pTail = pTimer;
 }
 
 void CTimer::PollKernelTimers (void)
 {
 	m_KernelTimerSpinLock.Acquire ();
 
-	TPtrListElement *pElement = m_KernelTimerList.GetFirst ();
-	while (pElement != 0)
+	// the list is re-read after each handler, which may have cancelled other timers
+	TKernelTimer *pTimer;
+	while ((pTimer = m_KernelTimerList.GetFirst ()) != 0)
 	{
-		TKernelTimer *pTimer = (TKernelTimer *) m_KernelTimerList.GetPtr (pElement);
-		assert (pTimer != 0);
 		assert (pTimer->m_nMagic == KERNEL_TIMER_MAGIC);
 
 		if ((int) (pTimer->m_nElapsesAt-m_nTicks) > 0)
@@ -471,22 +829,24 @@ void CTimer::PollKernelTimers (void)
 			break;
 		}
 
-		TPtrListElement *pNextElement = m_KernelTimerList.GetNext (pElement);
-		m_KernelTimerList.Remove (pElement);
-		pElement = pNextElement;
+		m_KernelTimerList.Remove (pTimer);
+		pTimer->m_bPending = FALSE;
 
 		m_KernelTimerSpinLock.Release ();
 
+		// an owned timer may be restarted or destroyed by its handler
+		boolean bOwned = pTimer->m_bOwned;
+
 		TKernelTimerHandler *pHandler = pTimer->m_pHandler;
 		assert (pHandler != 0);
 		(*pHandler) ((TKernelTimerHandle) pTimer, pTimer->m_pParam, pTimer->m_pContext);
 
-#ifndef NDEBUG
-		pTimer->m_nMagic = 0;
-#endif
-		delete pTimer;
-
 		m_KernelTimerSpinLock.Acquire ();
+
+		if (!bOwned)
+		{
+			m_KernelTimerPool.InsertFirst (pTimer);
+		}
 	}
 
 	m_KernelTimerSpinLock.Release ();
@@ -497,61 +857,146 @@ void CTimer::InterruptHandler (void)
 #ifndef USE_PHYSICAL_COUNTER
 	PeripheralEntry ();
 
-	u32 nCompare = read32 (ARM_SYSTIMER_C3);
-	do
+	write32 (ARM_SYSTIMER_CS, 1 << 3);
+#endif
+
+	unsigned nElapsed = UpdateTicks ();
+
+#ifndef USE_PHYSICAL_COUNTER
+	PeripheralExit ();
+
+	// the system timer compare register is shared with the high-resolution timers
+	PollHighResTimers ();
+#endif
+
+	if (nElapsed == 0)
 	{
-		nCompare += CLOCKHZ / HZ;
+		return;
+	}
+
+#ifndef NDEBUG
+	//debug_click ();
+#endif
+
+	PollKernelTimers ();
 
-		write32 (ARM_SYSTIMER_C3, nCompare);
+	for (unsigned i = 0; i < m_nPeriodicHandlers; i++)
+	{
+		(*m_pPeriodicHandler[i]) ();
 	}
-	while ((int) (nCompare - read32 (ARM_SYSTIMER_CLO)) < 2);	// time may drift
+}
+
+void CTimer::InterruptHandler (void *pParam)
+{
+	CTimer *pThis = (CTimer *) pParam;
+	assert (pThis != 0);
+
+	pThis->InterruptHandler ();
+}
+
+#ifdef USE_PHYSICAL_COUNTER
+
+void CTimer::HighResInterruptHandler (void *pParam)
+{
+	CTimer *pThis = (CTimer *) pParam;
+	assert (pThis != 0);
+
+	PeripheralEntry ();
 
 	write32 (ARM_SYSTIMER_CS, 1 << 3);
 
 	PeripheralExit ();
+
+	pThis->PollHighResTimers ();
+}
+
+#endif
+
+CTimer::TCounter CTimer::ReadCounter (void)
+{
+#ifndef USE_PHYSICAL_COUNTER
+	return read32 (ARM_SYSTIMER_CLO);
 #else
+	InstructionSyncBarrier ();
+
 #if AARCH == 32
-	u32 nCNTP_CVALLow, nCNTP_CVALHigh;
-	asm volatile ("mrrc p15, 2, %0, %1, c14" : "=r" (nCNTP_CVALLow), "=r" (nCNTP_CVALHigh));
+	u32 nCNTPCTLow, nCNTPCTHigh;
+	asm volatile ("mrrc p15, 0, %0, %1, c14" : "=r" (nCNTPCTLow), "=r" (nCNTPCTHigh));
 
-	u64 nCNTP_CVAL = ((u64) nCNTP_CVALHigh << 32 | nCNTP_CVALLow) + CLOCKHZ / HZ;
-	asm volatile ("mcrr p15, 2, %0, %1, c14" :: "r" (nCNTP_CVAL & 0xFFFFFFFFU),
-						    "r" (nCNTP_CVAL >> 32));
+	return (u64) nCNTPCTHigh << 32 | nCNTPCTLow;
 #else
-	u64 nCNTP_CVAL;
-	asm volatile ("mrs %0, CNTP_CVAL_EL0" : "=r" (nCNTP_CVAL));
-	asm volatile ("msr CNTP_CVAL_EL0, %0" :: "r" (nCNTP_CVAL + m_nClockTicksPerHZTick));
+	u64 nCNTPCT;
+	asm volatile ("mrs %0, CNTPCT_EL0" : "=r" (nCNTPCT));
+
+	return nCNTPCT;
 #endif
 #endif
+}
 
-#ifndef NDEBUG
-	//debug_click ();
+void CTimer::WriteCompare (TCounter nCompare)
+{
+#ifndef USE_PHYSICAL_COUNTER
+	WriteSystemTimerCompare (nCompare);
+#else
+#if AARCH == 32
+	asm volatile ("mcrr p15, 2, %0, %1, c14" :: "r" ((u32) (nCompare & 0xFFFFFFFFU)),
+						    "r" ((u32) (nCompare >> 32)));
+#else
+	asm volatile ("msr CNTP_CVAL_EL0, %0" :: "r" (nCompare));
+#endif
 #endif
+}
 
-	m_TimeSpinLock.Acquire ();
+void CTimer::WriteSystemTimerCompare (u32 nCompare)
+{
+	// the system timer matches on equality only, so the compare value must be ahead
+	if ((int) (nCompare - read32 (ARM_SYSTIMER_CLO)) < 2)
+	{
+		nCompare = read32 (ARM_SYSTIMER_CLO) + 2;
+	}
+
+	write32 (ARM_SYSTIMER_C3, nCompare);
+}
+
+// Advances the time by the number of ticks, which have passed since the last call, and
+// programs the timer for the next tick. This catches up ticks, which have been skipped
+// in IdleWait() or lost because of a long IRQ latency.
 
-	if (++m_nTicks % HZ == 0)
+unsigned CTimer::UpdateTicks (void)
+{
+	TCounter nNow = ReadCounter ();
+
+	unsigned nElapsed = 0;
+	while ((TSignedCounter) (nNow - m_nNextTick) >= 0)
 	{
-		m_nUptime++;
-		m_nTime++;
+		m_nNextTick += m_nClockTicksPerHZTick;
+		nElapsed++;
 	}
 
-	m_TimeSpinLock.Release ();
+#ifndef USE_PHYSICAL_COUNTER
+	m_HighResTimerSpinLock.Acquire ();
 
-	PollKernelTimers ();
+	ProgramHighResTimer ();
 
-	for (unsigned i = 0; i < m_nPeriodicHandlers; i++)
+	m_HighResTimerSpinLock.Release ();
+#else
+	WriteCompare (m_nNextTick);
+#endif
+
+	m_TimeSpinLock.Acquire ();
+
+	for (unsigned i = 0; i < nElapsed; i++)
 	{
-		(*m_pPeriodicHandler[i]) ();
+		if (++m_nTicks % HZ == 0)
+		{
+			m_nUptime++;
+			m_nTime++;
+		}
 	}
-}
 
-void CTimer::InterruptHandler (void *pParam)
-{
-	CTimer *pThis = (CTimer *) pParam;
-	assert (pThis != 0);
+	m_TimeSpinLock.Release ();
 
-	pThis->InterruptHandler ();
+	return nElapsed;
 }
 
 void CTimer::TuneMsDelay (void)
@@ -576,10 +1021,15 @@ void CTimer::RegisterUpdateTimeHandler (TUpdateTimeHandler *pHandler)
 	assert (m_pUpdateTimeHandler != 0);
 }
 
-void CTimer::RegisterPeriodicHandler (TPeriodicTimerHandler *pHandler)
+void CTimer::RegisterPeriodicHandler (TPeriodicTimerHandler *pHandler, boolean bNeedsIdleTicks)
 {
 	assert (pHandler != 0);
 
+	if (bNeedsIdleTicks)
+	{
+		m_nIdlePeriodicHandlers++;
+	}
+
 	assert (m_nPeriodicHandlers < TIMER_MAX_PERIODIC_HANDLERS);
 	m_pPeriodicHandler[m_nPeriodicHandlers] = pHandler;
 
@@ -648,3 +1098,57 @@ CTimer *CTimer::Get (void)
 	assert (s_pThis != 0);
 	return s_pThis;
 }
+
+CKernelTimer::CKernelTimer (TKernelTimerHandler *pHandler, void *pParam, void *pContext)
+{
+#ifndef NDEBUG
+	m_Timer.m_nMagic = KERNEL_TIMER_MAGIC;
+#endif
+	m_Timer.pPrev = 0;
+	m_Timer.pNext = 0;
+	m_Timer.m_pHandler = pHandler;
+	m_Timer.m_nElapsesAt = 0;
+	m_Timer.m_pParam = pParam;
+	m_Timer.m_pContext = pContext;
+	m_Timer.m_bPending = FALSE;
+	m_Timer.m_bOwned = TRUE;
+}
+
+CKernelTimer::~CKernelTimer (void)
+{
+	Cancel ();
+
+#ifndef NDEBUG
+	m_Timer.m_nMagic = 0;
+#endif
+	m_Timer.m_pHandler = 0;
+}
+
+void CKernelTimer::SetHandler (TKernelTimerHandler *pHandler, void *pParam, void *pContext)
+{
+	assert (!m_Timer.m_bPending);
+
+	m_Timer.m_pHandler = pHandler;
+	m_Timer.m_pParam = pParam;
+	m_Timer.m_pContext = pContext;
+}
+
+void CKernelTimer::Start (unsigned nDelay)
+{
+	assert (m_Timer.m_pHandler != 0);
+	assert (CTimer::s_pThis != 0);
+	CTimer::s_pThis->AddKernelTimer (&m_Timer, nDelay);
+}
+
+void CKernelTimer::Cancel (void)
+{
+	if (CTimer::s_pThis != 0)
+	{
+		CTimer::s_pThis->RemoveKernelTimer (&m_Timer);
+	}
+}
+
+boolean CKernelTimer::IsRunning (void) const
+{
+	return m_Timer.m_bPending;
+}
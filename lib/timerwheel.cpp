@@ -0,0 +1,338 @@
+//
+// timerwheel.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/timerwheel.h>
+#include <circle/util.h>
+#include <assert.h>
+
+CTimerWheel::CTimerWheel (unsigned nNow)
+:	m_nEntries (0)
+{
+	memset (m_pSlot, 0, sizeof m_pSlot);
+	memset (m_Bitmap, 0, sizeof m_Bitmap);
+
+	Reset (nNow);
+}
+
+CTimerWheel::~CTimerWheel (void)
+{
+	assert (m_nEntries == 0);
+}
+
+void CTimerWheel::Reset (unsigned nNow)
+{
+	assert (m_nEntries == 0);
+
+	m_nBase = nNow >> Shift;
+}
+
+void CTimerWheel::Add (TTimerWheelEntry *pEntry, unsigned nExpires)
+{
+	assert (pEntry != 0);
+	pEntry->nExpires = nExpires;
+
+	Insert (pEntry);
+
+	m_nEntries++;
+}
+
+void CTimerWheel::Remove (TTimerWheelEntry *pEntry)
+{
+	assert (pEntry != 0);
+	unsigned nSlot = pEntry->nSlot;
+	assert (nSlot < Slots);
+
+	if (pEntry->pPrev != 0)
+	{
+		pEntry->pPrev->pNext = pEntry->pNext;
+	}
+	else
+	{
+		assert (m_pSlot[nSlot] == pEntry);
+		m_pSlot[nSlot] = pEntry->pNext;
+
+		if (   m_pSlot[nSlot] == 0
+		    && nSlot < Level0Size)
+		{
+			m_Bitmap[nSlot / 32] &= ~(1U << (nSlot % 32));
+		}
+	}
+
+	if (pEntry->pNext != 0)
+	{
+		pEntry->pNext->pPrev = pEntry->pPrev;
+	}
+
+	pEntry->pNext = 0;
+	pEntry->pPrev = 0;
+	pEntry->nSlot = Slots;
+
+	assert (m_nEntries > 0);
+	m_nEntries--;
+}
+
+void CTimerWheel::Expire (unsigned nNow, TTimerWheelHandler *pHandler, void *pContext)
+{
+	assert (pHandler != 0);
+
+	unsigned nNowJiffy = nNow >> Shift;
+
+	// process all passed jiffies, every entry found there is due
+	while (   m_nBase != nNowJiffy
+	       && (int) ((nNowJiffy - m_nBase) << Shift) > 0)	// handles wrap
+	{
+		if (m_nEntries == 0)
+		{
+			m_nBase = nNowJiffy;
+
+			break;
+		}
+
+		unsigned nIndex = m_nBase & (Level0Size-1);
+		if (m_pSlot[nIndex] != 0)
+		{
+			while (m_pSlot[nIndex] != 0)	// handler may add due entries again
+			{
+				TTimerWheelEntry *pEntry = m_pSlot[nIndex];
+				Remove (pEntry);
+
+				(*pHandler) (pEntry, pContext);
+			}
+
+			m_nBase = (m_nBase + 1) & JiffyMask;
+		}
+		else
+		{
+			// skip empty slots up to the next wrap of level 0
+			unsigned nSteps = FindNextSlot (nIndex) - nIndex;
+			unsigned nRemaining = (nNowJiffy - m_nBase) & JiffyMask;
+			if (nSteps > nRemaining)
+			{
+				nSteps = nRemaining;
+			}
+
+			m_nBase = (m_nBase + nSteps) & JiffyMask;
+		}
+
+		if ((m_nBase & (Level0Size-1)) == 0)
+		{
+			Cascade ();
+		}
+	}
+
+	// check the entries of the current jiffy exactly
+	unsigned nIndex = m_nBase & (Level0Size-1);
+	TTimerWheelEntry *pEntry = m_pSlot[nIndex];
+	while (pEntry != 0)
+	{
+		TTimerWheelEntry *pNext = pEntry->pNext;
+
+		if ((int) (pEntry->nExpires - nNow) <= 0)
+		{
+			Remove (pEntry);
+
+			(*pHandler) (pEntry, pContext);
+		}
+
+		pEntry = pNext;
+	}
+}
+
+boolean CTimerWheel::GetNextExpiry (unsigned *pExpires) const
+{
+	assert (pExpires != 0);
+
+	if (m_nEntries == 0)
+	{
+		return FALSE;
+	}
+
+	// the first non-empty slot of level 0 holds the next entries, which are due
+	unsigned nBaseIndex = m_nBase & (Level0Size-1);
+	for (unsigned nDistance = 0; nDistance < Level0Size; )
+	{
+		unsigned nIndex = (nBaseIndex + nDistance) & (Level0Size-1);
+		u32 nBits = m_Bitmap[nIndex / 32] >> (nIndex % 32);
+		if (nBits == 0)
+		{
+			nDistance += 32 - nIndex % 32;
+
+			continue;
+		}
+
+		nDistance += __builtin_ctz (nBits);
+		if (nDistance >= Level0Size)
+		{
+			break;
+		}
+
+		nIndex = (nBaseIndex + nDistance) & (Level0Size-1);
+		const TTimerWheelEntry *pEntry = m_pSlot[nIndex];
+		assert (pEntry != 0);
+
+		unsigned nExpires = pEntry->nExpires;
+		for (pEntry = pEntry->pNext; pEntry != 0; pEntry = pEntry->pNext)
+		{
+			if ((int) (pEntry->nExpires - nExpires) < 0)
+			{
+				nExpires = pEntry->nExpires;
+			}
+		}
+
+		*pExpires = nExpires;
+
+		return TRUE;
+	}
+
+	// otherwise wake up, when the next non-empty slot of an upper level is cascaded
+	boolean bFound = FALSE;
+	unsigned nShift = Level0Bits;
+	for (unsigned nLevel = 1; nLevel < Levels; nLevel++)
+	{
+		unsigned nIndex = (m_nBase >> nShift) & (LevelNSize-1);
+		for (unsigned nDistance = 1; nDistance <= LevelNSize; nDistance++)
+		{
+			if (m_pSlot[Level0Size + (nLevel-1) * LevelNSize
+				    + ((nIndex + nDistance) & (LevelNSize-1))] != 0)
+			{
+				unsigned nExpires = (((m_nBase >> nShift) + nDistance) << nShift) << Shift;
+				if (   !bFound
+				    || (int) (nExpires - *pExpires) < 0)
+				{
+					*pExpires = nExpires;
+					bFound = TRUE;
+				}
+
+				break;
+			}
+		}
+
+		nShift += LevelNBits;
+	}
+
+	assert (bFound);
+
+	return bFound;
+}
+
+void CTimerWheel::Insert (TTimerWheelEntry *pEntry)
+{
+	assert (pEntry != 0);
+
+	unsigned nJiffy = pEntry->nExpires >> Shift;
+
+	int nDelta = (int) ((nJiffy - m_nBase) << Shift) >> Shift;	// sign extend
+	if (nDelta < 0)
+	{
+		nJiffy = m_nBase;		// already due
+		nDelta = 0;
+	}
+
+	unsigned nSlot;
+	if (nDelta < (int) Level0Size)
+	{
+		nSlot = nJiffy & (Level0Size-1);
+	}
+	else
+	{
+		unsigned nLevel = 1;
+		unsigned nShift = Level0Bits;
+		while (   nLevel < Levels-1
+		       && nDelta >= 1 << (nShift + LevelNBits))
+		{
+			nLevel++;
+			nShift += LevelNBits;
+		}
+
+		nSlot =   Level0Size + (nLevel-1) * LevelNSize
+			+ ((nJiffy >> nShift) & (LevelNSize-1));
+	}
+
+	assert (nSlot < Slots);
+	pEntry->nSlot = nSlot;
+
+	pEntry->pPrev = 0;
+	pEntry->pNext = m_pSlot[nSlot];
+	if (pEntry->pNext != 0)
+	{
+		pEntry->pNext->pPrev = pEntry;
+	}
+	m_pSlot[nSlot] = pEntry;
+
+	if (nSlot < Level0Size)
+	{
+		m_Bitmap[nSlot / 32] |= 1U << (nSlot % 32);
+	}
+}
+
+// Called, when level 0 wraps. Moves the entries of the next slot of the upper
+// level(s) down, based on the new m_nBase.
+
+void CTimerWheel::Cascade (void)
+{
+	unsigned nShift = Level0Bits;
+	for (unsigned nLevel = 1; nLevel < Levels; nLevel++)
+	{
+		unsigned nIndex = (m_nBase >> nShift) & (LevelNSize-1);
+
+		CascadeSlot (Level0Size + (nLevel-1) * LevelNSize + nIndex);
+
+		if (nIndex != 0)
+		{
+			break;
+		}
+
+		nShift += LevelNBits;
+	}
+}
+
+void CTimerWheel::CascadeSlot (unsigned nSlot)
+{
+	assert (Level0Size <= nSlot && nSlot < Slots);
+
+	TTimerWheelEntry *pEntry = m_pSlot[nSlot];
+	m_pSlot[nSlot] = 0;
+
+	while (pEntry != 0)
+	{
+		TTimerWheelEntry *pNext = pEntry->pNext;
+
+		Insert (pEntry);
+
+		pEntry = pNext;
+	}
+}
+
+unsigned CTimerWheel::FindNextSlot (unsigned nIndex) const
+{
+	assert (nIndex < Level0Size);
+
+	for (unsigned i = nIndex+1; i < Level0Size; )
+	{
+		u32 nBits = m_Bitmap[i / 32] >> (i % 32);
+		if (nBits != 0)
+		{
+			return i + __builtin_ctz (nBits);
+		}
+
+		i = (i | 31) + 1;
+	}
+
+	return Level0Size;
+}
@@ -2,8 +2,8 @@
 // tracer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014  R. Stange <rsta2@o2online.de>
-// 
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
+//
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
 // the Free Software Foundation, either version 3 of the License, or
@@ -19,7 +19,11 @@
 //
 #include <circle/tracer.h>
 #include <circle/timer.h>
+#include <circle/multicore.h>
+#include <circle/synchronize.h>
 #include <circle/logger.h>
+#include <circle/string.h>
+#include <assert.h>
 
 static const char FromTracer[] = "trace";
 
@@ -29,25 +33,67 @@ CTracer::CTracer (unsigned nDepth, boolean bStopIfFull)
 : 	m_nDepth (nDepth),
 	m_bStopIfFull (bStopIfFull),
 	m_bActive (FALSE),
-	m_nStartTicks (0),
-	m_nEntries (0),
-	m_nCurrent (0)
+	m_nStartTimestamp (0),
+	m_nEventNames (0)
 {
-	s_pThis = this;
+	assert (m_nDepth > 0);
+
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		m_Buffer[nCore].pEntry = new TTraceEntry[nDepth];
+		assert (m_Buffer[nCore].pEntry != 0);
+		m_Buffer[nCore].nWritten = 0;
+	}
+
+#if RASPPI >= 2
+#if AARCH == 32
+	u32 nCNTFRQ;
+	asm volatile ("mrc p15, 0, %0, c14, c0, 0" : "=r" (nCNTFRQ));
+#else
+	u64 nCNTFRQ;
+	asm volatile ("mrs %0, CNTFRQ_EL0" : "=r" (nCNTFRQ));
+#endif
+	m_nFrequency = nCNTFRQ;
+#else
+	m_nFrequency = CLOCKHZ;
+#endif
+
+	SetEventName (TRACER_EVENT_STOP, "stop");
+	SetEventName (TRACER_EVENT_TASK_SWITCH, "task switch");
+	SetEventName (TRACER_EVENT_IRQ_ENTRY, "irq", TracerPhaseBegin);
+	SetEventName (TRACER_EVENT_IRQ_EXIT, "irq", TracerPhaseEnd);
+	SetEventName (TRACER_EVENT_NET_DEV_RX, "net dev rx");
+	SetEventName (TRACER_EVENT_NET_DEV_TX, "net dev tx");
+	SetEventName (TRACER_EVENT_NET_IP_RX, "net ip rx");
+	SetEventName (TRACER_EVENT_NET_IP_TX, "net ip tx");
+	SetEventName (TRACER_EVENT_USB_COMPLETE, "usb complete");
 
-	m_pEntry = new TTraceEntry[nDepth];
+	s_pThis = this;
 }
 
 CTracer::~CTracer (void)
 {
-	delete [] m_pEntry;
-
 	s_pThis = 0;
+
+	m_bActive = FALSE;
+
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		delete [] m_Buffer[nCore].pEntry;
+		m_Buffer[nCore].pEntry = 0;
+	}
 }
 
 void CTracer::Start (void)
 {
-	m_nStartTicks = CTimer::Get ()->GetClockTicks ();
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		m_Buffer[nCore].nWritten = 0;
+	}
+
+	m_nStartTimestamp = GetTimestamp ();
+
+	DataMemBarrier ();
 
 	m_bActive = TRUE;
 }
@@ -57,37 +103,73 @@ void CTracer::Stop (void)
 	Event (TRACER_EVENT_STOP);
 
 	m_bActive = FALSE;
+
+	DataMemBarrier ();
 }
 
 void CTracer::Event (unsigned nID, unsigned nParam1, unsigned nParam2, unsigned nParam3, unsigned nParam4)
 {
-	if (m_bActive)
+	if (!m_bActive)
 	{
-		if (m_nEntries < m_nDepth)
-		{
-			m_nEntries++;
-		}
-		else if (m_bStopIfFull)
+		return;
+	}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	TCoreBuffer *pBuffer = &m_Buffer[CMultiCoreSupport::ThisCore ()];
+#else
+	TCoreBuffer *pBuffer = &m_Buffer[0];
+#endif
+
+	// reserve an entry, an IRQ or FIQ handler on this core may do the same meanwhile
+	unsigned nIndex = __atomic_fetch_add (&pBuffer->nWritten, 1, __ATOMIC_RELAXED);
+	if (nIndex >= m_nDepth)
+	{
+		if (m_bStopIfFull)
 		{
 			m_bActive = FALSE;
 
 			return;
 		}
 
-		TTraceEntry *pEntry = m_pEntry + m_nCurrent;
+		nIndex %= m_nDepth;
+	}
+
+	TTraceEntry *pEntry = pBuffer->pEntry + nIndex;
 
-		pEntry->nClockTicks = CTimer::Get ()->GetClockTicks () - m_nStartTicks;
-		pEntry->nEventID    = nID;
-		pEntry->nParam[0]   = nParam1;
-		pEntry->nParam[1]   = nParam2;
-		pEntry->nParam[2]   = nParam3;
-		pEntry->nParam[3]   = nParam4;
+	pEntry->nTimestamp = GetTimestamp () - m_nStartTimestamp;
+	pEntry->nEventID   = nID;
+	pEntry->nParam[0]  = nParam1;
+	pEntry->nParam[1]  = nParam2;
+	pEntry->nParam[2]  = nParam3;
+	pEntry->nParam[3]  = nParam4;
+}
+
+void CTracer::SetEventName (unsigned nID, const char *pName, TTracerPhase Phase)
+{
+	assert (pName != 0);
+
+	unsigned i;
+	for (i = 0; i < m_nEventNames; i++)
+	{
+		if (m_EventName[i].nID == nID)
+		{
+			break;
+		}
+	}
 
-		if (++m_nCurrent == m_nDepth)
+	if (i == m_nEventNames)
+	{
+		if (m_nEventNames == TRACER_MAX_EVENT_NAMES)
 		{
-			m_nCurrent = 0;
+			return;
 		}
+
+		m_nEventNames++;
 	}
+
+	m_EventName[i].nID = nID;
+	m_EventName[i].pName = pName;
+	m_EventName[i].Phase = Phase;
 }
 
 void CTracer::Dump (void)
@@ -96,28 +178,186 @@ void CTracer::Dump (void)
 	{
 		Stop ();
 	}
-	
+
 	CLogger *pLogger = CLogger::Get ();
 
-	unsigned nEvent = 0;
-	if (m_nEntries == m_nDepth)
+	unsigned Index[CORES] = {0};
+	const TTraceEntry *pEntry;
+	unsigned nCore;
+	for (unsigned i = 1; (pEntry = GetNextEntry (Index, &nCore)) != 0; i++)
 	{
-		nEvent = m_nCurrent;
-	}
-	
-	for (unsigned i = 1; i <= m_nEntries; i++)
-	{	
-		TTraceEntry *pEntry = m_pEntry + nEvent;
+		u64 nNanos = GetNanoseconds (pEntry->nTimestamp);
 
-		pLogger->Write (FromTracer, LogNotice, "%2u: %2u.%06u %2u %08X %08X %08X %08X",
-				i, pEntry->nClockTicks / CLOCKHZ, pEntry->nClockTicks % CLOCKHZ,
+		pLogger->Write (FromTracer, LogNotice, "%2u: %u %2llu.%06u %2u %08X %08X %08X %08X",
+				i, nCore, nNanos / 1000000000, (unsigned) (nNanos % 1000000000 / 1000),
 				pEntry->nEventID, pEntry->nParam[0], pEntry->nParam[1], pEntry->nParam[2], pEntry->nParam[3]);
+	}
+}
+
+void CTracer::WriteChromeTrace (TTracerWriteHandler *pHandler, void *pParam)
+{
+	assert (pHandler != 0);
 
-		nEvent = (nEvent+1) % m_nDepth;
+	if (m_bActive)
+	{
+		Stop ();
 	}
+
+	static const char Header[] = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	(*pHandler) (Header, sizeof Header-1, pParam);
+
+	unsigned Index[CORES] = {0};
+	const TTraceEntry *pEntry;
+	unsigned nCore;
+	boolean bFirst = TRUE;
+	while ((pEntry = GetNextEntry (Index, &nCore)) != 0)
+	{
+		const char *pName = 0;
+		char chPhase = 'i';
+		for (unsigned i = 0; i < m_nEventNames; i++)
+		{
+			if (m_EventName[i].nID == pEntry->nEventID)
+			{
+				pName = m_EventName[i].pName;
+				chPhase =   m_EventName[i].Phase == TracerPhaseBegin ? 'B'
+					  : (m_EventName[i].Phase == TracerPhaseEnd ? 'E' : 'i');
+
+				break;
+			}
+		}
+
+		CString Name;
+		if (pName != 0)
+		{
+			Name = pName;
+		}
+		else
+		{
+			Name.Format ("event %u", pEntry->nEventID);
+		}
+
+		u64 nNanos = GetNanoseconds (pEntry->nTimestamp);
+
+		CString Line;
+		Line.Format ("%s{\"name\":\"%s\",\"ph\":\"%c\",\"s\":\"t\",\"pid\":0,\"tid\":%u,"
+			     "\"ts\":%llu.%03u,\"args\":{\"p1\":\"0x%X\",\"p2\":\"0x%X\","
+			     "\"p3\":\"0x%X\",\"p4\":\"0x%X\"}}",
+			     bFirst ? "" : ",\n", (const char *) Name, chPhase, nCore,
+			     nNanos / 1000, (unsigned) (nNanos % 1000),
+			     pEntry->nParam[0], pEntry->nParam[1], pEntry->nParam[2], pEntry->nParam[3]);
+
+		(*pHandler) ((const char *) Line, Line.GetLength (), pParam);
+
+		bFirst = FALSE;
+	}
+
+	static const char Trailer[] = "\n]}\n";
+	(*pHandler) (Trailer, sizeof Trailer-1, pParam);
+}
+
+void CTracer::WriteChromeTrace (CDevice *pDevice)
+{
+	assert (pDevice != 0);
+
+	WriteChromeTrace (DeviceWriteHandler, pDevice);
 }
 
 CTracer *CTracer::Get (void)
 {
 	return s_pThis;
 }
+
+// Returns the oldest not yet visited entry of all cores (k-way merge by time stamp).
+// pIndex[] holds the number of visited entries per core.
+const TTraceEntry *CTracer::GetNextEntry (unsigned *pIndex, unsigned *pCore) const
+{
+	assert (pIndex != 0);
+	assert (pCore != 0);
+
+	const TTraceEntry *pResult = 0;
+	for (unsigned nCore = 0; nCore < CORES; nCore++)
+	{
+		if (pIndex[nCore] >= GetEntryCount (nCore))
+		{
+			continue;
+		}
+
+		const TTraceEntry *pEntry = GetEntry (nCore, pIndex[nCore]);
+		if (   pResult == 0
+		    || pEntry->nTimestamp < pResult->nTimestamp)
+		{
+			pResult = pEntry;
+			*pCore = nCore;
+		}
+	}
+
+	if (pResult != 0)
+	{
+		pIndex[*pCore]++;
+	}
+
+	return pResult;
+}
+
+// nIndex is counted from the oldest entry in the ring buffer
+const TTraceEntry *CTracer::GetEntry (unsigned nCore, unsigned nIndex) const
+{
+	assert (nCore < CORES);
+	const TCoreBuffer *pBuffer = &m_Buffer[nCore];
+
+	unsigned nFirst = 0;
+	if (   !m_bStopIfFull
+	    && pBuffer->nWritten > m_nDepth)
+	{
+		nFirst = pBuffer->nWritten % m_nDepth;
+	}
+
+	return pBuffer->pEntry + (nFirst + nIndex) % m_nDepth;
+}
+
+unsigned CTracer::GetEntryCount (unsigned nCore) const
+{
+	assert (nCore < CORES);
+	unsigned nWritten = m_Buffer[nCore].nWritten;
+
+	return nWritten < m_nDepth ? nWritten : m_nDepth;
+}
+
+u64 CTracer::GetNanoseconds (u64 nTimestamp) const
+{
+	assert (m_nFrequency != 0);
+
+	return   nTimestamp / m_nFrequency * 1000000000
+	       + nTimestamp % m_nFrequency * 1000000000 / m_nFrequency;
+}
+
+u64 CTracer::GetTimestamp (void)
+{
+#if RASPPI >= 2
+#if AARCH == 32
+	InstructionSyncBarrier ();
+
+	u32 nCNTPCTLow, nCNTPCTHigh;
+	asm volatile ("mrrc p15, 0, %0, %1, c14" : "=r" (nCNTPCTLow), "=r" (nCNTPCTHigh));
+
+	return (u64) nCNTPCTHigh << 32 | nCNTPCTLow;
+#else
+	InstructionSyncBarrier ();
+
+	u64 nCNTPCT;
+	asm volatile ("mrs %0, CNTPCT_EL0" : "=r" (nCNTPCT));
+
+	return nCNTPCT;
+#endif
+#else
+	return CTimer::GetClockTicks ();
+#endif
+}
+
+void CTracer::DeviceWriteHandler (const void *pBuffer, size_t nLength, void *pParam)
+{
+	CDevice *pDevice = (CDevice *) pParam;
+	assert (pDevice != 0);
+
+	pDevice->Write (pBuffer, nLength);
+}
@@ -26,6 +26,12 @@
 
 // Granule size is 64KB. Only EL1 stage 1 translation is enabled with 32 bits IPA
 // (= PA) size (4GB).
+//
+// Level 2 entries, which cover a 512MB range with uniform attributes (e.g. peripherals,
+// RAM above the kernel and the coherent/uncached regions), are mapped as block entries.
+// This saves a 64KB level 3 table per entry and a level of the table walk on a TLB miss.
+// Other entries point to a level 3 table with page granularity. The 4KB granule is not
+// supported, because the page allocator and the memory map rely on a 64KB page size.
 
 #if RASPPI == 3
 // We create one level 2 (first lookup level) translation table with 3 table
@@ -61,6 +67,31 @@ CTranslationTable::CTranslationTable (size_t nMemSize)
 		}
 #endif
 
+		if (IsUniformBlock (nBaseAddress))
+		{
+			TARMV8MMU_LEVEL2_BLOCK_DESCRIPTOR *pDesc = &m_pTable[nEntry].Block;
+
+			unsigned nAttrIndx, nSH, nPXN;
+			GetAttributes (nBaseAddress, &nAttrIndx, &nSH, &nPXN);
+
+			pDesc->Value01	     = 1;
+			pDesc->AttrIndx	     = nAttrIndx;
+			pDesc->NS	     = 0;
+			pDesc->AP	     = ATTRIB_AP_RW_EL1;
+			pDesc->SH	     = nSH;
+			pDesc->AF	     = 1;
+			pDesc->nG	     = 0;
+			pDesc->Reserved0_1   = 0;
+			pDesc->OutputAddress = ARMV8MMUL2BLOCKADDR (nBaseAddress);
+			pDesc->Reserved0_2   = 0;
+			pDesc->Continous     = 0;
+			pDesc->PXN	     = nPXN;
+			pDesc->UXN	     = 1;
+			pDesc->Ignored	     = 0;
+
+			continue;
+		}
+
 		TARMV8MMU_LEVEL3_DESCRIPTOR *pTable = CreateLevel3Table (nBaseAddress);
 		assert (pTable != 0);
 
@@ -112,36 +143,220 @@ TARMV8MMU_LEVEL3_DESCRIPTOR *CTranslationTable::CreateLevel3Table (uintptr nBase
 		pDesc->OutputAddress = ARMV8MMUL3PAGEADDR (nBaseAddress);
 		pDesc->Reserved0_2   = 0;
 		pDesc->Continous     = 0;
-		pDesc->PXN	     = 0;
 		pDesc->UXN	     = 1;
 		pDesc->Ignored	     = 0;
 
-		extern u8 _etext;
-		if (nBaseAddress >= (u64) &_etext)
-		{
-			pDesc->PXN = 1;
+		unsigned nAttrIndx, nSH, nPXN;
+		GetAttributes (nBaseAddress, &nAttrIndx, &nSH, &nPXN);
+
+		pDesc->AttrIndx	     = nAttrIndx;
+		pDesc->SH	     = nSH;
+		pDesc->PXN	     = nPXN;
+
+		nBaseAddress += ARMV8MMU_LEVEL3_PAGE_SIZE;
+	}
+
+	return pTable;
+}
+
+void CTranslationTable::GetAttributes (u64 nAddress, unsigned *pAttrIndx, unsigned *pSH,
+				       unsigned *pPXN)
+{
+	*pAttrIndx = ATTRINDX_NORMAL;
+	*pSH	   = ATTRIB_SH_INNER_SHAREABLE;
+	*pPXN	   = 0;
+
+	extern u8 _etext;
+	if (nAddress >= (u64) &_etext)
+	{
+		*pPXN = 1;
 
 #if RASPPI >= 4
-			if (   (   nBaseAddress >= m_nMemSize
-			        && nBaseAddress < MEM_HIGHMEM_START)
-			    || nBaseAddress > MEM_HIGHMEM_END)
+		if (   (   nAddress >= m_nMemSize
+			&& nAddress < MEM_HIGHMEM_START)
+		    || nAddress > MEM_HIGHMEM_END)
 #else
-			if (nBaseAddress >= m_nMemSize)
+		if (nAddress >= m_nMemSize)
 #endif
+		{
+			*pAttrIndx = ATTRINDX_DEVICE;
+			*pSH	   = ATTRIB_SH_OUTER_SHAREABLE;
+		}
+		else if (   nAddress >= MEM_COHERENT_REGION
+			 && nAddress <  MEM_UNCACHED_REGION)
+		{
+			*pAttrIndx = ATTRINDX_COHERENT;
+			*pSH	   = ATTRIB_SH_OUTER_SHAREABLE;
+		}
+		else if (   nAddress >= MEM_UNCACHED_REGION
+			 && nAddress <  MEM_HEAP_START)
+		{
+			*pAttrIndx = ATTRINDX_UNCACHED;
+			*pSH	   = ATTRIB_SH_OUTER_SHAREABLE;
+		}
+	}
+}
+
+boolean CTranslationTable::IsUniformBlock (u64 nBaseAddress)
+{
+	extern u8 _etext;
+
+	// addresses, where the attributes returned from GetAttributes() may change
+	const u64 Boundary[] =
+	{
+		(u64) &_etext,
+		m_nMemSize,
+		MEM_COHERENT_REGION,
+		MEM_UNCACHED_REGION,
+		MEM_HEAP_START,
+#if RASPPI >= 4
+		MEM_HIGHMEM_START,
+		MEM_HIGHMEM_END + 1UL,
+#endif
+	};
+
+	for (unsigned i = 0; i < sizeof Boundary / sizeof Boundary[0]; i++)
+	{
+		if (   nBaseAddress < Boundary[i]
+		    && Boundary[i] < nBaseAddress + ARMV8MMU_LEVEL2_BLOCK_SIZE)
+		{
+			return FALSE;
+		}
+	}
+
+	return nBaseAddress >= (u64) &_etext;
+}
+
+boolean CTranslationTable::SetAttributes (uintptr nAddress, size_t nSize, unsigned nAttributes)
+{
+	if (   (nAddress & (ARMV8MMU_LEVEL3_PAGE_SIZE-1))
+	    || (nSize & (ARMV8MMU_LEVEL3_PAGE_SIZE-1))
+	    || nSize == 0)
+	{
+		return FALSE;
+	}
+
+	extern u8 _etext;
+	if (   nAddress < (uintptr) &_etext
+	    || (   nAddress < MEM_HEAP_START
+		&& nAddress + nSize > MEM_COHERENT_REGION))
+	{
+		return FALSE;
+	}
+
+	// only normal memory can be modified
+	for (uintptr nPage = nAddress; nPage < nAddress + nSize; nPage += ARMV8MMU_LEVEL3_PAGE_SIZE)
+	{
+		unsigned nAttrIndx, nSH, nPXN;
+		GetAttributes (nPage, &nAttrIndx, &nSH, &nPXN);
+		if (nAttrIndx != ATTRINDX_NORMAL)
+		{
+			return FALSE;
+		}
+	}
+
+	// check the range and split block entries, the attributes do not change here
+	for (uintptr nEntryAddress = nAddress & ~((uintptr) ARMV8MMU_LEVEL2_BLOCK_SIZE-1);
+	     nEntryAddress < nAddress + nSize;
+	     nEntryAddress += ARMV8MMU_LEVEL2_BLOCK_SIZE)
+	{
+		unsigned nEntry = nEntryAddress / ARMV8MMU_LEVEL2_BLOCK_SIZE;
+		if (nEntry >= LEVEL2_TABLE_ENTRIES)
+		{
+			return FALSE;
+		}
+
+		TARMV8MMU_LEVEL2_DESCRIPTOR *pEntry = &m_pTable[nEntry];
+		if (pEntry->Table.Value11 == 3)
+		{
+			continue;
+		}
+
+		if (pEntry->Block.Value01 != 1)
+		{
+			return FALSE;		// not mapped
+		}
+
+		TARMV8MMU_LEVEL3_DESCRIPTOR *pTable = CreateLevel3Table (nEntryAddress);
+		assert (pTable != 0);
+		DataSyncBarrier ();
+
+		// break-before-make, required when changing the block size
+		*(volatile u64 *) pEntry = 0;
+		InvalidateTLB ();
+
+		TARMV8MMU_LEVEL2_TABLE_DESCRIPTOR Desc;
+		Desc.Value11	  = 3;
+		Desc.Ignored1	  = 0;
+		Desc.TableAddress = ARMV8MMUL2TABLEADDR ((u64) pTable);
+		Desc.Reserved0	  = 0;
+		Desc.Ignored2	  = 0;
+		Desc.PXNTable	  = 0;
+		Desc.UXNTable	  = 0;
+		Desc.APTable	  = AP_TABLE_ALL_ACCESS;
+		Desc.NSTable	  = 0;
+
+		*(volatile u64 *) pEntry = *(u64 *) &Desc;
+		DataSyncBarrier ();
+		InstructionSyncBarrier ();
+	}
+
+	if (nAttributes & TT_ATTR_UNCACHED)
+	{
+		CleanAndInvalidateDataCacheRange (nAddress, nSize);
+	}
+
+	u64 nDescriptor;
+	TARMV8MMU_LEVEL3_PAGE_DESCRIPTOR *pNew = (TARMV8MMU_LEVEL3_PAGE_DESCRIPTOR *) &nDescriptor;
+
+	// break-before-make, required when changing the memory type
+	for (unsigned nPass = 0; nPass < 2; nPass++)
+	{
+		for (uintptr nPage = nAddress; nPage < nAddress + nSize;
+		     nPage += ARMV8MMU_LEVEL3_PAGE_SIZE)
+		{
+			TARMV8MMU_LEVEL2_TABLE_DESCRIPTOR *pEntry =
+				&m_pTable[nPage / ARMV8MMU_LEVEL2_BLOCK_SIZE].Table;
+			assert (pEntry->Value11 == 3);
+
+			TARMV8MMU_LEVEL3_DESCRIPTOR *pTable =
+				(TARMV8MMU_LEVEL3_DESCRIPTOR *) ARMV8MMUL2TABLEPTR ((u64) pEntry->TableAddress);
+			volatile u64 *pPage = (volatile u64 *)
+				&pTable[(nPage % ARMV8MMU_LEVEL2_BLOCK_SIZE) / ARMV8MMU_LEVEL3_PAGE_SIZE];
+
+			if (nPass == 0)
 			{
-				pDesc->AttrIndx = ATTRINDX_DEVICE;
-				pDesc->SH	= ATTRIB_SH_OUTER_SHAREABLE;
-			}
-			else if (   nBaseAddress >= MEM_COHERENT_REGION
-				 && nBaseAddress <  MEM_HEAP_START)
-			{
-				pDesc->AttrIndx = ATTRINDX_COHERENT;
-				pDesc->SH	= ATTRIB_SH_OUTER_SHAREABLE;
+				*pPage = 0;
+
+				continue;
 			}
+
+			nDescriptor = 0;
+			pNew->Value11	    = 3;
+			pNew->AttrIndx	    =   nAttributes & TT_ATTR_UNCACHED
+					      ? ATTRINDX_UNCACHED : ATTRINDX_NORMAL;
+			pNew->AP	    =   nAttributes & TT_ATTR_READ_ONLY
+					      ? ATTRIB_AP_RO_EL1 : ATTRIB_AP_RW_EL1;
+			pNew->SH	    =   nAttributes & TT_ATTR_UNCACHED
+					      ? ATTRIB_SH_OUTER_SHAREABLE : ATTRIB_SH_INNER_SHAREABLE;
+			pNew->AF	    = 1;
+			pNew->OutputAddress = ARMV8MMUL3PAGEADDR (nPage);
+			pNew->PXN	    = nAttributes & TT_ATTR_NO_EXEC ? 1 : 0;
+			pNew->UXN	    = 1;
+
+			*pPage = nDescriptor;
 		}
 
-		nBaseAddress += ARMV8MMU_LEVEL3_PAGE_SIZE;
+		InvalidateTLB ();
 	}
 
-	return pTable;
+	return TRUE;
+}
+
+void CTranslationTable::InvalidateTLB (void)
+{
+	DataSyncBarrier ();
+	asm volatile ("tlbi vmalle1is" : : : "memory");
+	DataSyncBarrier ();
+	InstructionSyncBarrier ();
 }
@@ -26,6 +26,7 @@
 #include <circle/usb/dwhciframeschednsplit.h>
 #include <circle/usb/dwhciframeschedper.h>
 #include <circle/sched/scheduler.h>
+#include <circle/boottrace.h>
 #include <circle/bcmpropertytags.h>
 #include <circle/bcm2835.h>
 #include <circle/synchronize.h>
@@ -76,7 +77,9 @@ CDWHCIDevice::CDWHCIDevice (CInterruptSystem *pInterruptSystem, CTimer *pTimer,
 	m_nChannelAllocated (0),
 	m_ChannelSpinLock (MAX_TARGET_LEVEL),
 #ifdef USE_USB_SOF_INTR
-	m_TransactionQueue (DWHCI_MAX_CHANNELS, MAX_TARGET_LEVEL),
+	m_TransactionQueue (DWHCI_MAX_PENDING_STAGES, MAX_TARGET_LEVEL),
+#else
+	m_WaitingTransactions (DWHCI_MAX_PENDING_STAGES),
 #endif
 	m_IntMaskSpinLock (MAX_TARGET_LEVEL),
 	m_nWaitBlockAllocated (0),
@@ -111,11 +114,15 @@ CDWHCIDevice::~CDWHCIDevice (void)
 	assert (m_pTimer != 0);
 	m_pTimer->MsDelay (200);	// wait for completion of all transactions
 
+#ifndef USE_USB_SOF_INTR
+	FlushWaitingTransactions ();
+#endif
+
 	assert (m_pInterruptSystem != 0);
 #ifndef USE_USB_FIQ
 	m_pInterruptSystem->DisconnectIRQ (ARM_IRQ_USB);
 #else
-	m_pInterruptSystem->DisconnectFIQ ();
+	m_pInterruptSystem->DisconnectFIQ (ARM_FIQ_USB);
 	m_MPHI.DisconnectHandler ();
 #endif
 
@@ -201,6 +208,8 @@ boolean CDWHCIDevice::Initialize (boolean bScanDevices)
 		ReScanDevices ();
 	}
 
+	CBootTrace::Mark ("usb");
+
 	return TRUE;
 }
 
@@ -311,6 +320,13 @@ boolean CDWHCIDevice::SubmitAsyncRequest (CUSBRequest *pURB, unsigned nTimeoutMs
 	PeripheralEntry ();
 
 	assert (pURB != 0);
+	if (pURB->GetEndpoint ()->GetType () == EndpointTypeIsochronous)
+	{
+		PeripheralExit ();
+
+		return FALSE;		// not supported
+	}
+
 	assert (   pURB->GetEndpoint ()->GetType () == EndpointTypeBulk
 		|| pURB->GetEndpoint ()->GetType () == EndpointTypeInterrupt);
 	assert (pURB->GetBufLen () > 0);
@@ -329,6 +345,8 @@ void CDWHCIDevice::CancelDeviceTransactions (CUSBDevice *pUSBDevice)
 {
 #ifdef USE_USB_SOF_INTR
 	m_TransactionQueue.FlushDevice (pUSBDevice);
+#else
+	FlushWaitingTransactions (pUSBDevice);
 #endif
 }
 
@@ -396,6 +414,8 @@ void CDWHCIDevice::DisableRootPort (boolean bPowerOff)
 
 #ifdef USE_USB_SOF_INTR
 	m_TransactionQueue.Flush ();
+#else
+	FlushWaitingTransactions ();
 #endif
 }
 
@@ -556,7 +576,7 @@ boolean CDWHCIDevice::EnableRootPort (void)
 	HostPort.Write ();
 
 	// normally 10ms, seems to be too short for some devices
-	m_pTimer->MsDelay (20);		// see USB 2.0 spec (tRSTRCY)
+	m_pTimer->MsDelay (USB_PORT_RESET_RECOVERY_MS);	// see USB 2.0 spec (tRSTRCY)
 
 	return TRUE;
 }
@@ -753,27 +773,11 @@ boolean CDWHCIDevice::TransferStageAsync (CUSBRequest *pURB, boolean bIn, boolea
 {
 	assert (pURB != 0);
 	
-#ifndef USE_USB_SOF_INTR
-	unsigned nChannel = AllocateChannel ();
-	if (nChannel >= m_nChannels)
-	{
-		return FALSE;
-	}
-#else
-	unsigned nChannel = DWHCI_MAX_CHANNELS;		// unused
-#endif
-
+	// the channel is assigned, when the transaction is started
 	CDWHCITransferStageData *pStageData =
-		new CDWHCITransferStageData (nChannel, pURB, bIn, bStatusStage, nTimeoutMs);
+		new CDWHCITransferStageData (DWHCI_MAX_CHANNELS, pURB, bIn, bStatusStage, nTimeoutMs);
 	assert (pStageData != 0);
 
-#ifndef USE_USB_SOF_INTR
-	assert (m_pStageData[nChannel] == 0);
-	m_pStageData[nChannel] = pStageData;
-
-	EnableChannelInterrupt (nChannel);
-#endif
-
 	if (!pStageData->IsSplit ())
 	{
 		pStageData->SetState (StageStateNoSplitTransfer);
@@ -782,16 +786,7 @@ boolean CDWHCIDevice::TransferStageAsync (CUSBRequest *pURB, boolean bIn, boolea
 	{
 		if (!pStageData->BeginSplitCycle ())
 		{
-#ifndef USE_USB_SOF_INTR
-			DisableChannelInterrupt (nChannel);
-#endif
-
 			delete pStageData;
-#ifndef USE_USB_SOF_INTR
-			m_pStageData[nChannel] = 0;
-			
-			FreeChannel (nChannel);
-#endif
 
 			return FALSE;
 		}
@@ -802,7 +797,7 @@ boolean CDWHCIDevice::TransferStageAsync (CUSBRequest *pURB, boolean bIn, boolea
 	}
 
 #ifndef USE_USB_SOF_INTR
-	StartTransaction (pStageData);
+	ScheduleTransaction (pStageData);
 #else
 	QueueTransaction (pStageData);
 #endif
@@ -872,8 +867,148 @@ void CDWHCIDevice::QueueDelayedTransaction (CDWHCITransferStageData *pStageData)
 	m_TransactionQueue.Enqueue (pStageData, usFrameNumber);
 }
 
+#else
+
+void CDWHCIDevice::ScheduleTransaction (CDWHCITransferStageData *pStageData)
+{
+	assert (pStageData != 0);
+	CUSBRequest *pURB = pStageData->GetURB ();
+	assert (pURB != 0);
+
+	m_ChannelSpinLock.Acquire ();
+
+	// transactions to the same endpoint share the data toggle and must not overlap
+	unsigned nChannel = DWHCI_MAX_CHANNELS;
+	if (!IsEndpointActive (pURB->GetEndpoint ()))
+	{
+		unsigned nChannelMask = 1;
+		for (unsigned i = 0; i < m_nChannels; i++)
+		{
+			if (!(m_nChannelAllocated & nChannelMask))
+			{
+				m_nChannelAllocated |= nChannelMask;
+				nChannel = i;
+
+				break;
+			}
+
+			nChannelMask <<= 1;
+		}
+	}
+
+	if (nChannel >= m_nChannels)
+	{
+		// started from FreeChannel() later, in the order of submission
+		TPtrListElement *pPrevElement = 0;
+		TPtrListElement *pElement = m_WaitingTransactions.GetFirst ();
+		while (pElement != 0)
+		{
+			pPrevElement = pElement;
+			pElement = m_WaitingTransactions.GetNext (pElement);
+		}
+
+		m_WaitingTransactions.InsertAfter (pPrevElement, pStageData);
+
+		m_ChannelSpinLock.Release ();
+
+		return;
+	}
+
+	assert (m_pStageData[nChannel] == 0);
+	m_pStageData[nChannel] = pStageData;
+
+	m_ChannelSpinLock.Release ();
+
+	AssignChannel (nChannel, pStageData);
+
+	StartTransaction (pStageData);
+}
+
+CDWHCITransferStageData *CDWHCIDevice::DequeueWaitingTransaction (void)
+{
+	TPtrListElement *pElement = m_WaitingTransactions.GetFirst ();
+	while (pElement != 0)
+	{
+		CDWHCITransferStageData *pStageData =
+			(CDWHCITransferStageData *) m_WaitingTransactions.GetPtr (pElement);
+		assert (pStageData != 0);
+		CUSBRequest *pURB = pStageData->GetURB ();
+		assert (pURB != 0);
+
+		if (!IsEndpointActive (pURB->GetEndpoint ()))
+		{
+			m_WaitingTransactions.Remove (pElement);
+
+			return pStageData;
+		}
+
+		pElement = m_WaitingTransactions.GetNext (pElement);
+	}
+
+	return 0;
+}
+
+boolean CDWHCIDevice::IsEndpointActive (CUSBEndpoint *pEndpoint) const
+{
+	assert (pEndpoint != 0);
+
+	for (unsigned nChannel = 0; nChannel < m_nChannels; nChannel++)
+	{
+		CDWHCITransferStageData *pStageData = m_pStageData[nChannel];
+		if (   pStageData != 0
+		    && pStageData->GetURB ()->GetEndpoint () == pEndpoint)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+void CDWHCIDevice::FlushWaitingTransactions (CUSBDevice *pUSBDevice)
+{
+	m_ChannelSpinLock.Acquire ();
+
+	TPtrListElement *pElement = m_WaitingTransactions.GetFirst ();
+	while (pElement != 0)
+	{
+		TPtrListElement *pNextElement = m_WaitingTransactions.GetNext (pElement);
+
+		CDWHCITransferStageData *pStageData =
+			(CDWHCITransferStageData *) m_WaitingTransactions.GetPtr (pElement);
+		assert (pStageData != 0);
+
+		if (   pUSBDevice == 0
+		    || pStageData->GetDevice () == pUSBDevice)
+		{
+			m_WaitingTransactions.Remove (pElement);
+
+			CUSBRequest *pURB = pStageData->GetURB ();
+			delete pURB;
+
+			delete pStageData;
+		}
+
+		pElement = pNextElement;
+	}
+
+	m_ChannelSpinLock.Release ();
+}
+
 #endif
 
+void CDWHCIDevice::AssignChannel (unsigned nChannel, CDWHCITransferStageData *pStageData)
+{
+	assert (nChannel < m_nChannels);
+	assert (pStageData != 0);
+
+	pStageData->SetChannelNumber (nChannel);
+
+	m_pStageData[nChannel] = pStageData;
+
+	EnableChannelInterrupt (nChannel);
+}
+
 void CDWHCIDevice::StartTransaction (CDWHCITransferStageData *pStageData)
 {
 	assert (pStageData != 0);
@@ -1131,6 +1266,11 @@ void CDWHCIDevice::ChannelInterruptHandler (unsigned nChannel)
 #else
 				pStageData->SetState (StageStatePeriodicDelay);
 
+				// the channel is not needed, until the timer elapses
+				DisableChannelInterrupt (nChannel);
+				m_pStageData[nChannel] = 0;
+				FreeChannel (nChannel);
+
 				unsigned nInterval = pURB->GetEndpoint ()->GetInterval ();
 
 				m_pTimer->StartKernelTimer (MSEC2HZ (nInterval), TimerStub,
@@ -1317,6 +1457,10 @@ void CDWHCIDevice::ChannelInterruptHandler (unsigned nChannel)
 #else
 					pStageData->SetState (StageStatePeriodicDelay);
 
+					DisableChannelInterrupt (nChannel);
+					m_pStageData[nChannel] = 0;
+					FreeChannel (nChannel);
+
 					unsigned nInterval = pURB->GetEndpoint ()->GetInterval ();
 
 					m_pTimer->StartKernelTimer (MSEC2HZ (nInterval),
@@ -1365,18 +1509,20 @@ void CDWHCIDevice::SOFInterruptHandler (void)
 	CDWHCIRegister FrameNumber (DWHCI_HOST_FRM_NUM);
 	u16 usFrameNumber = DWHCI_HOST_FRM_NUM_NUMBER (FrameNumber.Read ());
 
-	CDWHCITransferStageData *pStageData;
-	while ((pStageData = m_TransactionQueue.Dequeue (usFrameNumber)) != 0)
+	// due transactions remain queued for the next frame, while all channels are busy
+	unsigned nChannel;
+	while ((nChannel = AllocateChannel ()) < m_nChannels)
 	{
-		unsigned nChannel = AllocateChannel ();
-		assert (nChannel < m_nChannels);	// too many parallel transactions otherwise
+		CDWHCITransferStageData *pStageData = m_TransactionQueue.Dequeue (usFrameNumber);
+		if (pStageData == 0)
+		{
+			FreeChannel (nChannel);
 
-		pStageData->SetChannelNumber (nChannel);
+			break;
+		}
 
 		assert (m_pStageData[nChannel] == 0);
-		m_pStageData[nChannel] = pStageData;
-
-		EnableChannelInterrupt (nChannel);
+		AssignChannel (nChannel, pStageData);
 
 		StartTransaction (pStageData);
 	}
@@ -1491,20 +1637,13 @@ void CDWHCIDevice::TimerHandler (CDWHCITransferStageData *pStageData)
 
 	if (!m_bRootPortEnabled)
 	{
-		unsigned nChannel = pStageData->GetChannelNumber ();
-		assert (nChannel < m_nChannels);
 		CUSBRequest *pURB = pStageData->GetURB ();
 		assert (pURB != 0);
 
-		DisableChannelInterrupt (nChannel);
-
 		pURB->SetStatus (0);
 		pURB->SetUSBError (USBErrorAborted);
 
 		delete pStageData;
-		m_pStageData[nChannel] = 0;
-
-		FreeChannel (nChannel);
 
 		PeripheralExit ();
 
@@ -1527,7 +1666,7 @@ void CDWHCIDevice::TimerHandler (CDWHCITransferStageData *pStageData)
 		pStageData->SetState (StageStateNoSplitTransfer);
 	}
 
-	StartTransaction (pStageData);
+	ScheduleTransaction (pStageData);
 
 	PeripheralExit ();
 }
@@ -1607,6 +1746,25 @@ void CDWHCIDevice::FreeChannel (unsigned nChannel)
 	m_ChannelSpinLock.Acquire ();
 	
 	assert (m_nChannelAllocated & nChannelMask);
+
+#ifndef USE_USB_SOF_INTR
+	// hand the channel over to the next waiting transaction
+	CDWHCITransferStageData *pStageData = DequeueWaitingTransaction ();
+	if (pStageData != 0)
+	{
+		assert (m_pStageData[nChannel] == 0);
+		m_pStageData[nChannel] = pStageData;
+
+		m_ChannelSpinLock.Release ();
+
+		AssignChannel (nChannel, pStageData);
+
+		StartTransaction (pStageData);
+
+		return;
+	}
+#endif
+
 	m_nChannelAllocated &= ~nChannelMask;
 	
 	m_ChannelSpinLock.Release ();
@@ -7,7 +7,7 @@
 //	Licensed under GPLv2
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -24,6 +24,7 @@
 //
 #include <circle/usb/lan7800.h>
 #include <circle/usb/usbhostcontroller.h>
+#include <circle/netbuffer.h>
 #include <circle/bcmpropertytags.h>
 #include <circle/synchronize.h>
 #include <circle/logger.h>
@@ -43,6 +44,18 @@
 
 #define MAX_RX_FRAME_SIZE		(2*6 + 2 + 1500 + 4)
 
+#define RX_BUFFER_SIZE			DEFAULT_BURST_CAP_SIZE	// multiple frames (MEF mode)
+#define TX_BUFFER_SIZE			(8 * 1024)		// multiple frames per transfer
+#define RX_TX_ALIGNMENT			4	// frames are aligned in a transfer buffer
+
+#define INT_BUFFER_SIZE			4	// INT_STS is reported on the interrupt EP
+
+// PHY registers (LAN88xx, main page)
+#define PHY_INT_MASK			0x19
+	#define PHY_INT_MASK_MDINTPIN_EN	0x8000
+	#define PHY_INT_MASK_LINK_CHANGE	0x4000
+#define PHY_INT_STS			0x1A		// cleared on read
+
 // USB vendor requests
 #define WRITE_REGISTER			0xA0
 #define READ_REGISTER			0xA1
@@ -53,6 +66,7 @@
 		#define ID_REV_CHIP_ID_7800		0x7800
 #define INT_STS				0x00C
 	#define INT_STS_CLEAR_ALL		0xFFFFFFFF
+	#define INT_STS_PHY_INT			0x00020000
 #define HW_CFG				0x010
 	#define HW_CFG_CLK125_EN		0x02000000
 	#define HW_CFG_REFCLK25_EN		0x01000000
@@ -220,11 +234,25 @@
 	#define MAF_LO_ADDR_MASK		0xFFFFFFFF
 
 // TX command A
+#define TX_CMD_A_LSO			0x08000000
+#define TX_CMD_A_IPE			0x04000000
+#define TX_CMD_A_TPE			0x02000000
 #define TX_CMD_A_FCS			0x00400000
 #define TX_CMD_A_LEN_MASK		0x000FFFFF
 
+// TX command B
+#define TX_CMD_B_MSS_SHIFT		16
+#define TX_CMD_B_MSS_MASK		0x3FFF0000
+#define TX_CMD_B_MSS_MIN		8
+
 // RX command A
+#define RX_CMD_A_ICE			0x80000000
+#define RX_CMD_A_TCE			0x40000000
+#define RX_CMD_A_PID_MASK		0x18000000
+	#define RX_CMD_A_PID_TCP_IP		0x08000000
+	#define RX_CMD_A_PID_UDP_IP		0x10000000
 #define RX_CMD_A_RED			0x00400000
+#define RX_CMD_A_ICSM			0x00004000
 #define RX_CMD_A_LEN_MASK		0x00003FFF
 
 static const char FromLAN7800[] = "lan7800";
@@ -232,12 +260,45 @@ static const char FromLAN7800[] = "lan7800";
 CLAN7800Device::CLAN7800Device (CUSBFunction *pFunction)
 :	CUSBFunction (pFunction),
 	m_pEndpointBulkIn (0),
-	m_pEndpointBulkOut (0)
+	m_pEndpointBulkOut (0),
+	m_pEndpointInterrupt (0),
+	m_nMulticastCount (0),
+	m_pRxQueue (0),
+	m_pRxBuffer (0),
+	m_nRxOffset (0),
+	m_nRxLength (0),
+	m_pTxBuffer (new u8[TX_BUFFER_SIZE]),
+	m_pIntBuffer (0),
+	m_pIntURB (0),
+	m_bIntPending (FALSE),
+	m_bLinkInterrupt (FALSE)
 {
+	assert (m_pTxBuffer != 0);
 }
 
 CLAN7800Device::~CLAN7800Device (void)
 {
+	// a pending URB has been deleted by the host controller on device removal
+	if (!m_bIntPending)
+	{
+		delete m_pIntURB;
+	}
+	m_pIntURB = 0;
+
+	delete [] m_pIntBuffer;
+	m_pIntBuffer = 0;
+
+	delete [] m_pTxBuffer;
+	m_pTxBuffer = 0;
+
+	m_pRxBuffer = 0;
+
+	delete m_pRxQueue;
+	m_pRxQueue = 0;
+
+	delete m_pEndpointInterrupt;
+	m_pEndpointInterrupt = 0;
+
 	delete m_pEndpointBulkOut;
 	m_pEndpointBulkOut = 0;
 
@@ -284,6 +345,18 @@ boolean CLAN7800Device::Configure (void)
 				m_pEndpointBulkOut = new CUSBEndpoint (GetDevice (), pEndpointDesc);
 			}
 		}
+		else if (   (pEndpointDesc->bmAttributes & 0x3F) == 0x03		// Interrupt
+			 && (pEndpointDesc->bEndpointAddress & 0x80) == 0x80)	// Input
+		{
+			if (m_pEndpointInterrupt != 0)
+			{
+				ConfigurationError (FromLAN7800);
+
+				return FALSE;
+			}
+
+			m_pEndpointInterrupt = new CUSBEndpoint (GetDevice (), pEndpointDesc);
+		}
 	}
 
 	if (   m_pEndpointBulkIn  == 0
@@ -337,8 +410,8 @@ boolean CLAN7800Device::Configure (void)
 		return FALSE;
 	}
 
-	// enable the LEDs and SEF mode
-	if (!ReadWriteReg (HW_CFG, HW_CFG_LED0_EN | HW_CFG_LED1_EN, ~HW_CFG_MEF))
+	// enable the LEDs and MEF mode (multiple frames per bulk in transfer)
+	if (!ReadWriteReg (HW_CFG, HW_CFG_LED0_EN | HW_CFG_LED1_EN | HW_CFG_MEF))
 	{
 		return FALSE;
 	}
@@ -356,8 +429,8 @@ boolean CLAN7800Device::Configure (void)
 		return FALSE;
 	}
 
-	// interrupt EP is not used
-	if (   !WriteReg (INT_EP_CTL, 0)
+	// the interrupt EP is used for PHY interrupts (link changes) only
+	if (   !WriteReg (INT_EP_CTL, m_pEndpointInterrupt != 0 ? INT_EP_PHY_INT_EN : 0)
 	    || !WriteReg (INT_STS, INT_STS_CLEAR_ALL))
 	{
 		return FALSE;
@@ -370,8 +443,9 @@ boolean CLAN7800Device::Configure (void)
 		return FALSE;
 	}
 
-	// init receive filtering engine
-	if (!ReadWriteReg (RFE_CTL, RFE_CTL_BCAST_EN | RFE_CTL_DA_PERFECT))
+	// init receive filtering engine, enable RX checksum offload
+	if (!ReadWriteReg (RFE_CTL,   RFE_CTL_BCAST_EN | RFE_CTL_DA_PERFECT
+				    | RFE_CTL_TCPUDP_COE | RFE_CTL_IP_COE))
 	{
 		return FALSE;
 	}
@@ -414,6 +488,22 @@ boolean CLAN7800Device::Configure (void)
 		return FALSE;
 	}
 
+	// several bulk in transfers are queued
+	assert (m_pRxQueue == 0);
+	m_pRxQueue = new CUSBBulkInQueue (GetHost (), m_pEndpointBulkIn, RX_BUFFER_SIZE);
+	assert (m_pRxQueue != 0);
+
+	// without link change interrupts the PHY is polled
+	if (m_pEndpointInterrupt != 0)
+	{
+		m_bLinkInterrupt = StartIntRequest ();
+		if (!m_bLinkInterrupt)
+		{
+			CLogger::Get ()->Write (FromLAN7800, LogWarning,
+						"Cannot start interrupt request");
+		}
+	}
+
 	AddNetDevice ();
 
 	return TRUE;
@@ -443,48 +533,203 @@ boolean CLAN7800Device::SendFrame (const void *pBuffer, unsigned nLength)
 	return GetHost ()->Transfer (m_pEndpointBulkOut, TxBuffer, nLength+TX_HEADER_SIZE) >= 0;
 }
 
-boolean CLAN7800Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
+unsigned CLAN7800Device::SendFrames (CNetBuffer *ppBuffer[], unsigned nCount)
 {
-	assert (m_pEndpointBulkIn != 0);
-	assert (pBuffer != 0);
-	CUSBRequest URB (m_pEndpointBulkIn, pBuffer, FRAME_BUFFER_SIZE);
+	assert (ppBuffer != 0);
+	assert (m_pTxBuffer != 0);
+	assert (m_pEndpointBulkOut != 0);
 
-	if (!GetHost ()->SubmitBlockingRequest (&URB))
+	unsigned nSent = 0;
+	while (nSent < nCount)
 	{
-		return FALSE;
+		// fill in as many frames as possible into one bulk transfer
+		unsigned nOffset = 0;
+		unsigned i;
+		for (i = nSent; i < nCount; i++)
+		{
+			assert (ppBuffer[i] != 0);
+			unsigned nLength = ppBuffer[i]->GetLength ();
+			if (nLength > FRAME_BUFFER_SIZE)
+			{
+				break;
+			}
+
+			unsigned nFrameOffset = (nOffset + RX_TX_ALIGNMENT-1) & ~(RX_TX_ALIGNMENT-1);
+			if (nFrameOffset + TX_HEADER_SIZE + nLength > TX_BUFFER_SIZE)
+			{
+				break;
+			}
+
+			u32 nTxCmdA = (nLength & TX_CMD_A_LEN_MASK) | TX_CMD_A_FCS;
+			u32 nTxCmdB = 0;
+
+			unsigned nOffloads = ppBuffer[i]->GetOffloadFlags ();
+			if (nOffloads & NET_OFFLOAD_TX_CHECKSUM)
+			{
+				nTxCmdA |= TX_CMD_A_IPE | TX_CMD_A_TPE;
+			}
+
+			if (nOffloads & NET_OFFLOAD_TX_SEGMENTATION)
+			{
+				unsigned nMSS = ppBuffer[i]->GetSegmentSize ();
+				if (nMSS < TX_CMD_B_MSS_MIN)
+				{
+					nMSS = TX_CMD_B_MSS_MIN;
+				}
+
+				nTxCmdA |= TX_CMD_A_LSO;
+				nTxCmdB = (nMSS << TX_CMD_B_MSS_SHIFT) & TX_CMD_B_MSS_MASK;
+			}
+
+			u32 *pTxHeader = (u32 *) (m_pTxBuffer + nFrameOffset);
+			pTxHeader[0] = nTxCmdA;
+			pTxHeader[1] = nTxCmdB;
+
+			memcpy (m_pTxBuffer + nFrameOffset + TX_HEADER_SIZE, ppBuffer[i]->GetData (),
+				nLength);
+
+			nOffset = nFrameOffset + TX_HEADER_SIZE + nLength;
+		}
+
+		if (   i == nSent
+		    || GetHost ()->Transfer (m_pEndpointBulkOut, m_pTxBuffer, nOffset) < 0)
+		{
+			break;
+		}
+
+		nSent = i;
 	}
 
-	u32 nResultLength = URB.GetResultLength ();
-	if (nResultLength < RX_HEADER_SIZE)
+	return nSent;
+}
+
+boolean CLAN7800Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
+{
+	const u8 *pFrame;
+	unsigned nFrameLength;
+	if (!GetRxFrame (&pFrame, &nFrameLength))
 	{
 		return FALSE;
 	}
 
-	u32 nRxStatus = *(u32 *) pBuffer;	// RX command A
-	if (nRxStatus & RX_CMD_A_RED)
+	assert (pBuffer != 0);
+	memcpy (pBuffer, pFrame, nFrameLength);
+
+	assert (pResultLength != 0);
+	*pResultLength = nFrameLength;
+
+	return TRUE;
+}
+
+unsigned CLAN7800Device::ReceiveFrames (CNetBuffer *ppBuffer[], unsigned nMaxCount)
+{
+	assert (ppBuffer != 0);
+
+	unsigned nCount = 0;
+	const u8 *pFrame;
+	unsigned nFrameLength;
+	boolean bChecksumOK;
+	while (   nCount < nMaxCount
+	       && GetRxFrame (&pFrame, &nFrameLength, &bChecksumOK))
 	{
-		CLogger::Get ()->Write (FromLAN7800, LogWarning, "RX error (status 0x%X)", nRxStatus);
+		CNetBuffer *pBuffer = new CNetBuffer;
+		assert (pBuffer != 0);
 
-		return FALSE;
+		memcpy (pBuffer->GetData (), pFrame, nFrameLength);
+		pBuffer->SetLength (nFrameLength);
+
+		if (bChecksumOK)
+		{
+			pBuffer->SetOffload (NET_OFFLOAD_RX_CHECKSUM);
+		}
+
+		ppBuffer[nCount++] = pBuffer;
 	}
-	
-	u32 nFrameLength = nRxStatus & RX_CMD_A_LEN_MASK;
-	assert (nFrameLength == nResultLength-RX_HEADER_SIZE);
-	assert (nFrameLength > 4);
-	if (nFrameLength <= 4)
+
+	return nCount;
+}
+
+boolean CLAN7800Device::GetRxFrame (const u8 **ppFrame, unsigned *pFrameLength,
+				    boolean *pChecksumOK)
+{
+	while (1)
 	{
-		return FALSE;
-	}
-	nFrameLength -= 4;	// ignore FCS
+		if (m_nRxOffset >= m_nRxLength)
+		{
+			m_nRxOffset = 0;
+			m_nRxLength = 0;
 
-	//CLogger::Get ()->Write (FromLAN7800, LogDebug, "Frame received (status 0x%X)", nRxStatus);
+			assert (m_pRxQueue != 0);
+			m_pRxBuffer = m_pRxQueue->GetData (&m_nRxLength);
+			if (m_pRxBuffer == 0)
+			{
+				return FALSE;
+			}
 
-	memcpy (pBuffer, (u8 *) pBuffer + RX_HEADER_SIZE, nFrameLength); // overwrite RX command A..C
+			continue;
+		}
 
-	assert (pResultLength != 0);
-	*pResultLength = nFrameLength;
-	
-	return TRUE;
+		const u8 *pHeader = m_pRxBuffer + m_nRxOffset;
+		unsigned nRemaining = m_nRxLength - m_nRxOffset;
+		if (nRemaining < RX_HEADER_SIZE)
+		{
+			m_nRxOffset = m_nRxLength;
+
+			continue;
+		}
+
+		u32 nRxStatus = *(const u32 *) pHeader;	// RX command A
+		u32 nFrameLength = nRxStatus & RX_CMD_A_LEN_MASK;
+		if (nFrameLength > nRemaining - RX_HEADER_SIZE)
+		{
+			CLogger::Get ()->Write (FromLAN7800, LogWarning, "Invalid RX frame length");
+
+			m_nRxOffset = m_nRxLength;
+
+			continue;
+		}
+
+		// the next frame starts aligned
+		m_nRxOffset += (RX_HEADER_SIZE + nFrameLength + RX_TX_ALIGNMENT-1)
+			       & ~(RX_TX_ALIGNMENT-1);
+
+		if (nRxStatus & RX_CMD_A_RED)
+		{
+			CLogger::Get ()->Write (FromLAN7800, LogWarning, "RX error (status 0x%X)",
+						nRxStatus);
+
+			continue;
+		}
+
+		if (   nFrameLength <= 4
+		    || nFrameLength-4 > FRAME_BUFFER_SIZE)
+		{
+			continue;
+		}
+
+		//CLogger::Get ()->Write (FromLAN7800, LogDebug, "Frame received (status 0x%X)", nRxStatus);
+
+		assert (ppFrame != 0);
+		*ppFrame = pHeader + RX_HEADER_SIZE;	// skip RX command A..C
+
+		assert (pFrameLength != 0);
+		*pFrameLength = nFrameLength - 4;	// ignore FCS
+
+		if (pChecksumOK != 0)
+		{
+			u32 nProtocol = nRxStatus & RX_CMD_A_PID_MASK;
+			*pChecksumOK =    (   nProtocol == RX_CMD_A_PID_TCP_IP
+					   || nProtocol == RX_CMD_A_PID_UDP_IP)
+				       && !(nRxStatus & (RX_CMD_A_ICE | RX_CMD_A_TCE | RX_CMD_A_ICSM));
+		}
+
+		return TRUE;
+	}
+}
+
+unsigned CLAN7800Device::GetOffloadCapabilities (void)
+{
+	return NET_OFFLOAD_TX_CHECKSUM | NET_OFFLOAD_TX_SEGMENTATION | NET_OFFLOAD_RX_CHECKSUM;
 }
 
 boolean CLAN7800Device::IsLinkUp (void)
@@ -535,7 +780,7 @@ boolean CLAN7800Device::InitMACAddress (void)
 {
 	CBcmPropertyTags Tags;
 	TPropertyTagMACAddress MACAddress;
-	if (!Tags.GetTag (PROPTAG_GET_MAC_ADDRESS, &MACAddress, sizeof MACAddress))
+	if (!Tags.GetTagCached (PROPTAG_GET_MAC_ADDRESS, &MACAddress, sizeof MACAddress))
 	{
 		return FALSE;
 	}
@@ -569,6 +814,48 @@ boolean CLAN7800Device::InitMACAddress (void)
 	return TRUE;
 }
 
+boolean CLAN7800Device::SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount)
+{
+	assert (nCount <= MAX_MULTICAST_ADDRESSES);
+	assert (MAX_MULTICAST_ADDRESSES < NUM_OF_MAF);
+
+	// entry 0 holds the own MAC address
+	unsigned i;
+	for (i = 0; i < nCount; i++)
+	{
+		assert (pAddresses != 0);
+		const u8 *pAddress = pAddresses[i].Get ();
+
+		u32 nAddressLow =    (u32) pAddress[0]
+				  | ((u32) pAddress[1] << 8)
+				  | ((u32) pAddress[2] << 16)
+				  | ((u32) pAddress[3] << 24);
+		u32 nAddressHigh =    (u32) pAddress[4]
+				   | ((u32) pAddress[5] << 8);
+
+		// invalidate the entry, while it is updated
+		if (   !WriteReg (MAF_HI (i+1), 0)
+		    || !WriteReg (MAF_LO (i+1), nAddressLow)
+		    || !WriteReg (MAF_HI (i+1), nAddressHigh | MAF_HI_VALID))
+		{
+			return FALSE;
+		}
+	}
+
+	// invalidate the remaining entries from the previous call
+	for (; i < m_nMulticastCount; i++)
+	{
+		if (!WriteReg (MAF_HI (i+1), 0))
+		{
+			return FALSE;
+		}
+	}
+
+	m_nMulticastCount = nCount;
+
+	return TRUE;
+}
+
 boolean CLAN7800Device::InitPHY (void)
 {
 	// select main page registers (0-30)
@@ -594,7 +881,114 @@ boolean CLAN7800Device::InitPHY (void)
 	usLEDModeSel |= 1 << 0;
 	usLEDModeSel |= 6 << 4;
 
-	return PHYWrite (0x1D, usLEDModeSel);
+	if (!PHYWrite (0x1D, usLEDModeSel))
+	{
+		return FALSE;
+	}
+
+	if (m_pEndpointInterrupt == 0)
+	{
+		return TRUE;
+	}
+
+	// enable link change interrupt
+	u16 usIntStatus;
+	return    PHYRead (PHY_INT_STS, &usIntStatus)
+	       && PHYWrite (PHY_INT_MASK, PHY_INT_MASK_MDINTPIN_EN | PHY_INT_MASK_LINK_CHANGE);
+}
+
+boolean CLAN7800Device::UpdatePHY (void)
+{
+	if (!m_bLinkInterrupt)
+	{
+		return FALSE;
+	}
+
+	if (m_bIntPending)
+	{
+		return TRUE;
+	}
+
+	// acknowledge the interrupt in the PHY and in the device, before the next request
+	u16 usIntStatus;
+	if (   !PHYWrite (0x1F, 0)
+	    || !PHYRead (PHY_INT_STS, &usIntStatus)
+	    || !WriteReg (INT_STS, INT_STS_PHY_INT))
+	{
+		return TRUE;		// try again on next call
+	}
+
+	if (!StartIntRequest ())
+	{
+		CLogger::Get ()->Write (FromLAN7800, LogError, "Cannot restart interrupt request");
+	}
+
+	return TRUE;
+}
+
+boolean CLAN7800Device::HasLinkInterrupt (void)
+{
+	return m_bLinkInterrupt;
+}
+
+boolean CLAN7800Device::StartIntRequest (void)
+{
+	assert (m_pEndpointInterrupt != 0);
+	assert (!m_bIntPending);
+
+	if (m_pIntURB == 0)
+	{
+		m_pIntBuffer = new u8[INT_BUFFER_SIZE];
+		assert (m_pIntBuffer != 0);
+
+		m_pIntURB = new CUSBRequest (m_pEndpointInterrupt, m_pIntBuffer, INT_BUFFER_SIZE);
+		assert (m_pIntURB != 0);
+		m_pIntURB->SetCompletionRoutine (IntCompletionStub, 0, this);
+	}
+	else
+	{
+		m_pIntURB->Reset ();
+	}
+
+	m_bIntPending = TRUE;
+
+	if (!GetHost ()->SubmitAsyncRequest (m_pIntURB))
+	{
+		m_bIntPending = FALSE;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CLAN7800Device::IntCompletionRoutine (CUSBRequest *pURB)
+{
+	assert (pURB != 0);
+	assert (pURB == m_pIntURB);
+	assert (m_bIntPending);
+
+	// the request is restarted from UpdatePHY(), after the PHY interrupt has been cleared
+	m_bIntPending = FALSE;
+
+	if (   pURB->GetStatus () != 0
+	    && pURB->GetResultLength () >= INT_BUFFER_SIZE)
+	{
+		u32 nIntStatus =   (u32) m_pIntBuffer[0]       | (u32) m_pIntBuffer[1] << 8
+				 | (u32) m_pIntBuffer[2] << 16 | (u32) m_pIntBuffer[3] << 24;
+		if (nIntStatus & INT_STS_PHY_INT)
+		{
+			NotifyLinkChange ();
+		}
+	}
+}
+
+void CLAN7800Device::IntCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext)
+{
+	CLAN7800Device *pThis = (CLAN7800Device *) pContext;
+	assert (pThis != 0);
+
+	pThis->IntCompletionRoutine (pURB);
 }
 
 boolean CLAN7800Device::PHYWrite (u8 uchIndex, u16 usValue)
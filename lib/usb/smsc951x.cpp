@@ -9,7 +9,7 @@
 // See the file lib/usb/README for details!
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -26,6 +26,7 @@
 //
 #include <circle/usb/smsc951x.h>
 #include <circle/usb/usbhostcontroller.h>
+#include <circle/netbuffer.h>
 #include <circle/bcmpropertytags.h>
 #include <circle/synchronize.h>
 #include <circle/logger.h>
@@ -35,6 +36,19 @@
 #include <circle/debug.h>
 #include <assert.h>
 
+// Sizes
+#define HS_USB_PKT_SIZE			512
+
+#define DEFAULT_HS_BURST_CAP_SIZE	(16 * 1024 + 5 * HS_USB_PKT_SIZE)
+#define DEFAULT_BULK_IN_DELAY		0x2000
+
+#define RX_HEADER_SIZE			4
+#define TX_HEADER_SIZE			(4 + 4)
+
+#define RX_BUFFER_SIZE			DEFAULT_HS_BURST_CAP_SIZE	// multiple frames (MEF mode)
+#define TX_BUFFER_SIZE			(8 * 1024)		// multiple frames per transfer
+#define RX_TX_ALIGNMENT			4	// frames are aligned in a transfer buffer
+
 // USB vendor requests
 #define WRITE_REGISTER			0xA0
 #define READ_REGISTER			0xA1
@@ -47,6 +61,7 @@
 	#define TX_CFG_ON			0x00000004
 #define HW_CFG				0x14
 	#define HW_CFG_BIR			0x00001000
+	#define HW_CFG_MEF			0x00000020
 #define RX_FIFO_INF			0x18
 #define PM_CTRL				0x20
 #define LED_GPIO_CFG			0x24
@@ -65,6 +80,7 @@
 	#define MAC_CR_RCVOWN			0x00800000
 	#define MAC_CR_MCPAS			0x00080000
 	#define MAC_CR_PRMS			0x00040000
+	#define MAC_CR_HPFILT			0x00002000
 	#define MAC_CR_BCAST			0x00000800
 	#define MAC_CR_TXEN			0x00000008
 	#define MAC_CR_RXEN			0x00000004
@@ -129,12 +145,26 @@ static const char FromSMSC951x[] = "smsc951x";
 CSMSC951xDevice::CSMSC951xDevice (CUSBFunction *pFunction)
 :	CUSBFunction (pFunction),
 	m_pEndpointBulkIn (0),
-	m_pEndpointBulkOut (0)
+	m_pEndpointBulkOut (0),
+	m_pRxQueue (0),
+	m_pRxBuffer (0),
+	m_nRxOffset (0),
+	m_nRxLength (0),
+	m_pTxBuffer (new u8[TX_BUFFER_SIZE])
 {
+	assert (m_pTxBuffer != 0);
 }
 
 CSMSC951xDevice::~CSMSC951xDevice (void)
 {
+	delete [] m_pTxBuffer;
+	m_pTxBuffer = 0;
+
+	m_pRxBuffer = 0;
+
+	delete m_pRxQueue;
+	m_pRxQueue = 0;
+
 	delete m_pEndpointBulkOut;
 	m_pEndpointBulkOut = 0;
 
@@ -146,7 +176,7 @@ boolean CSMSC951xDevice::Configure (void)
 {
 	CBcmPropertyTags Tags;
 	TPropertyTagMACAddress MACAddress;
-	if (Tags.GetTag (PROPTAG_GET_MAC_ADDRESS, &MACAddress, sizeof MACAddress))
+	if (Tags.GetTagCached (PROPTAG_GET_MAC_ADDRESS, &MACAddress, sizeof MACAddress))
 	{
 		m_MACAddress.Set (MACAddress.Address);
 	}
@@ -228,6 +258,18 @@ boolean CSMSC951xDevice::Configure (void)
 		return FALSE;
 	}
 
+	// receive multiple frames per bulk in transfer (MEF mode), no NAK on empty Rx FIFO
+	u32 nHWConfig;
+	if (   !WriteReg (BURST_CAP, DEFAULT_HS_BURST_CAP_SIZE / HS_USB_PKT_SIZE)
+	    || !WriteReg (BULK_IN_DLY, DEFAULT_BULK_IN_DELAY)
+	    || !ReadReg (HW_CFG, &nHWConfig)
+	    || !WriteReg (HW_CFG, nHWConfig | HW_CFG_MEF | HW_CFG_BIR))
+	{
+		CLogger::Get ()->Write (FromSMSC951x, LogError, "Cannot configure bulk in transfers");
+
+		return FALSE;
+	}
+
 	if (   !WriteReg (LED_GPIO_CFG,   LED_GPIO_CFG_SPD_LED
 					| LED_GPIO_CFG_LNK_LED
 					| LED_GPIO_CFG_FDX_LED)
@@ -242,6 +284,11 @@ boolean CSMSC951xDevice::Configure (void)
 		return FALSE;
 	}
 
+	// several bulk in transfers are queued
+	assert (m_pRxQueue == 0);
+	m_pRxQueue = new CUSBBulkInQueue (GetHost (), m_pEndpointBulkIn, RX_BUFFER_SIZE);
+	assert (m_pRxQueue != 0);
+
 	AddNetDevice ();
 
 	return TRUE;
@@ -271,48 +318,162 @@ boolean CSMSC951xDevice::SendFrame (const void *pBuffer, unsigned nLength)
 	return GetHost ()->Transfer (m_pEndpointBulkOut, TxBuffer, nLength+8) >= 0;
 }
 
-boolean CSMSC951xDevice::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
+unsigned CSMSC951xDevice::SendFrames (CNetBuffer *ppBuffer[], unsigned nCount)
 {
-	assert (m_pEndpointBulkIn != 0);
-	assert (pBuffer != 0);
-	CUSBRequest URB (m_pEndpointBulkIn, pBuffer, FRAME_BUFFER_SIZE);
+	assert (ppBuffer != 0);
+	assert (m_pTxBuffer != 0);
+	assert (m_pEndpointBulkOut != 0);
 
-	if (!GetHost ()->SubmitBlockingRequest (&URB))
+	unsigned nSent = 0;
+	while (nSent < nCount)
 	{
-		return FALSE;
+		// fill in as many frames as possible into one bulk transfer
+		unsigned nOffset = 0;
+		unsigned i;
+		for (i = nSent; i < nCount; i++)
+		{
+			assert (ppBuffer[i] != 0);
+			unsigned nLength = ppBuffer[i]->GetLength ();
+			if (nLength > FRAME_BUFFER_SIZE)
+			{
+				break;
+			}
+
+			unsigned nFrameOffset = (nOffset + RX_TX_ALIGNMENT-1) & ~(RX_TX_ALIGNMENT-1);
+			if (nFrameOffset + TX_HEADER_SIZE + nLength > TX_BUFFER_SIZE)
+			{
+				break;
+			}
+
+			u32 *pTxHeader = (u32 *) (m_pTxBuffer + nFrameOffset);
+			pTxHeader[0] = TX_CMD_A_FIRST_SEG | TX_CMD_A_LAST_SEG | nLength;
+			pTxHeader[1] = nLength;
+
+			memcpy (m_pTxBuffer + nFrameOffset + TX_HEADER_SIZE, ppBuffer[i]->GetData (),
+				nLength);
+
+			nOffset = nFrameOffset + TX_HEADER_SIZE + nLength;
+		}
+
+		if (   i == nSent
+		    || GetHost ()->Transfer (m_pEndpointBulkOut, m_pTxBuffer, nOffset) < 0)
+		{
+			break;
+		}
+
+		nSent = i;
 	}
 
-	u32 nResultLength = URB.GetResultLength ();
-	if (nResultLength < 4)				// should not happen with HW_CFG_BIR set
+	return nSent;
+}
+
+boolean CSMSC951xDevice::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
+{
+	const u8 *pFrame;
+	unsigned nFrameLength;
+	if (!GetRxFrame (&pFrame, &nFrameLength))
 	{
 		return FALSE;
 	}
 
-	u32 nRxStatus = *(u32 *) pBuffer;
-	if (nRxStatus & RX_STS_ERROR)
+	assert (pBuffer != 0);
+	memcpy (pBuffer, pFrame, nFrameLength);
+
+	assert (pResultLength != 0);
+	*pResultLength = nFrameLength;
+
+	return TRUE;
+}
+
+unsigned CSMSC951xDevice::ReceiveFrames (CNetBuffer *ppBuffer[], unsigned nMaxCount)
+{
+	assert (ppBuffer != 0);
+
+	unsigned nCount = 0;
+	const u8 *pFrame;
+	unsigned nFrameLength;
+	while (   nCount < nMaxCount
+	       && GetRxFrame (&pFrame, &nFrameLength))
 	{
-		CLogger::Get ()->Write (FromSMSC951x, LogWarning, "RX error (status 0x%X)", nRxStatus);
+		CNetBuffer *pBuffer = new CNetBuffer;
+		assert (pBuffer != 0);
 
-		return FALSE;
+		memcpy (pBuffer->GetData (), pFrame, nFrameLength);
+		pBuffer->SetLength (nFrameLength);
+
+		ppBuffer[nCount++] = pBuffer;
 	}
-	
-	u32 nFrameLength = RX_STS_FRAMELEN (nRxStatus);
-	assert (nFrameLength == nResultLength-4);
-	assert (nFrameLength > 4);
-	if (nFrameLength <= 4)
+
+	return nCount;
+}
+
+boolean CSMSC951xDevice::GetRxFrame (const u8 **ppFrame, unsigned *pFrameLength)
+{
+	while (1)
 	{
-		return FALSE;
-	}
-	nFrameLength -= 4;	// ignore CRC
+		if (m_nRxOffset >= m_nRxLength)
+		{
+			m_nRxOffset = 0;
+			m_nRxLength = 0;
 
-	//CLogger::Get ()->Write (FromSMSC951x, LogDebug, "Frame received (status 0x%X)", nRxStatus);
+			assert (m_pRxQueue != 0);
+			m_pRxBuffer = m_pRxQueue->GetData (&m_nRxLength);
+			if (m_pRxBuffer == 0)
+			{
+				return FALSE;
+			}
 
-	memcpy (pBuffer, (u8 *) pBuffer + 4, nFrameLength);	// overwrite RX status
+			continue;
+		}
 
-	assert (pResultLength != 0);
-	*pResultLength = nFrameLength;
-	
-	return TRUE;
+		const u8 *pHeader = m_pRxBuffer + m_nRxOffset;
+		unsigned nRemaining = m_nRxLength - m_nRxOffset;
+		if (nRemaining < RX_HEADER_SIZE)	// should not happen with HW_CFG_BIR set
+		{
+			m_nRxOffset = m_nRxLength;
+
+			continue;
+		}
+
+		u32 nRxStatus = *(const u32 *) pHeader;
+		u32 nFrameLength = RX_STS_FRAMELEN (nRxStatus);
+		if (nFrameLength > nRemaining - RX_HEADER_SIZE)
+		{
+			CLogger::Get ()->Write (FromSMSC951x, LogWarning, "Invalid RX frame length");
+
+			m_nRxOffset = m_nRxLength;
+
+			continue;
+		}
+
+		// the next frame starts aligned
+		m_nRxOffset += (RX_HEADER_SIZE + nFrameLength + RX_TX_ALIGNMENT-1)
+			       & ~(RX_TX_ALIGNMENT-1);
+
+		if (nRxStatus & RX_STS_ERROR)
+		{
+			CLogger::Get ()->Write (FromSMSC951x, LogWarning, "RX error (status 0x%X)",
+						nRxStatus);
+
+			continue;
+		}
+
+		if (   nFrameLength <= 4
+		    || nFrameLength-4 > FRAME_BUFFER_SIZE)
+		{
+			continue;
+		}
+
+		//CLogger::Get ()->Write (FromSMSC951x, LogDebug, "Frame received (status 0x%X)", nRxStatus);
+
+		assert (ppFrame != 0);
+		*ppFrame = pHeader + RX_HEADER_SIZE;	// skip RX status
+
+		assert (pFrameLength != 0);
+		*pFrameLength = nFrameLength - 4;	// ignore CRC
+
+		return TRUE;
+	}
 }
 
 boolean CSMSC951xDevice::IsLinkUp (void)
@@ -350,6 +511,54 @@ TNetDeviceSpeed CSMSC951xDevice::GetLinkSpeed (void)
 	}
 }
 
+boolean CSMSC951xDevice::SetMulticastFilter (const CMACAddress *pAddresses, unsigned nCount)
+{
+	// the upper 6 bits of the big endian Ethernet CRC select the hash bit
+	u32 Hash[2] = {0, 0};
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		assert (pAddresses != 0);
+		const u8 *pAddress = pAddresses[i].Get ();
+
+		u32 nCRC = 0xFFFFFFFF;
+		for (unsigned j = 0; j < MAC_ADDRESS_SIZE; j++)
+		{
+			u8 uchByte = pAddress[j];
+			for (unsigned k = 0; k < 8; k++, uchByte >>= 1)
+			{
+				u32 nMSB = nCRC >> 31;
+				nCRC <<= 1;
+				if (nMSB ^ (uchByte & 1))
+				{
+					nCRC ^= 0x04C11DB7;
+				}
+			}
+		}
+
+		unsigned nBit = nCRC >> 26;
+		Hash[nBit >> 5] |= 1 << (nBit & 31);
+	}
+
+	u32 nMACControl;
+	if (   !WriteReg (HASHH, Hash[1])
+	    || !WriteReg (HASHL, Hash[0])
+	    || !ReadReg (MAC_CR, &nMACControl))
+	{
+		return FALSE;
+	}
+
+	if (nCount > 0)
+	{
+		nMACControl |= MAC_CR_HPFILT;
+	}
+	else
+	{
+		nMACControl &= ~MAC_CR_HPFILT;
+	}
+
+	return WriteReg (MAC_CR, nMACControl);
+}
+
 boolean CSMSC951xDevice::PHYWrite (u8 uchIndex, u16 usValue)
 {
 	assert (uchIndex <= 31);
@@ -0,0 +1,427 @@
+//
+// usbaudiostreaming.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Refer to "Universal Serial Bus Device Class Definition for Audio Devices", Release 1.0
+
+#include <circle/usb/usbaudiostreaming.h>
+#include <circle/usb/usbaudio.h>
+#include <circle/usb/usbhostcontroller.h>
+#include <circle/devicenameservice.h>
+#include <circle/synchronize.h>
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define FRAME_SIZE	(2 * sizeof (s16))		// 16-bit stereo
+
+static const char From[] = "uaudio";
+static const char DevicePrefix[] = "uaudio";
+
+CNumberPool CUSBAudioStreamingDevice::s_DeviceNumberPool (1);
+
+CUSBAudioStreamingDevice::CUSBAudioStreamingDevice (CUSBFunction *pFunction)
+:	CUSBFunction (pFunction),
+	m_pEndpointOut (0),
+	m_uchAlternateSetting (0),
+	m_bContinuousRate (FALSE),
+	m_nNumRates (0),
+	m_nSampleRate (0),
+	m_nFrameAccu (0),
+	m_pCallback (0),
+	m_pCallbackParam (0),
+	m_nBufferSize (0),
+	m_bStopping (TRUE),
+	m_nActiveURBs (0),
+	m_nDeviceNumber (0)
+{
+	for (unsigned i = 0; i < USB_AUDIO_NUM_URBS; i++)
+	{
+		m_pBufferMemory[i] = 0;
+		m_pBuffer[i] = 0;
+	}
+}
+
+CUSBAudioStreamingDevice::~CUSBAudioStreamingDevice (void)
+{
+	m_bStopping = TRUE;
+
+	// wait for the queued URBs, they do not complete, if the device has been unplugged
+	for (unsigned i = 0; m_nActiveURBs > 0 && i < 100; i++)
+	{
+		CTimer::Get ()->MsDelay (1);
+	}
+
+	if (m_nDeviceNumber != 0)
+	{
+		CDeviceNameService::Get ()->RemoveDevice (DevicePrefix, m_nDeviceNumber, FALSE);
+
+		s_DeviceNumberPool.FreeNumber (m_nDeviceNumber);
+	}
+
+	delete m_pEndpointOut;
+	m_pEndpointOut = 0;
+
+	for (unsigned i = 0; i < USB_AUDIO_NUM_URBS; i++)
+	{
+		delete [] m_pBufferMemory[i];
+		m_pBufferMemory[i] = 0;
+		m_pBuffer[i] = 0;
+	}
+
+	m_pCallback = 0;
+}
+
+boolean CUSBAudioStreamingDevice::Configure (void)
+{
+	// The alternate setting 0 has no endpoints. We take the first alternate setting
+	// with a PCM Type I format (16-bit stereo) and an isochronous output endpoint.
+	const TUSBEndpointDescriptor *pEndpointDesc = 0;
+	const TUSBInterfaceDescriptor *pInterfaceDesc;
+	while ((pInterfaceDesc = (TUSBInterfaceDescriptor *) GetDescriptor (DESCRIPTOR_INTERFACE)) != 0)
+	{
+		if (pInterfaceDesc->bInterfaceNumber != GetInterfaceNumber ())
+		{
+			break;
+		}
+
+		if (   pInterfaceDesc->bNumEndpoints < 1
+		    || pInterfaceDesc->bInterfaceClass != 0x01		// Audio class
+		    || pInterfaceDesc->bInterfaceSubClass != AUDIO_SUBCLASS_AUDIOSTREAMING)
+		{
+			continue;
+		}
+
+		const TUSBAudioStreamingInterfaceDescriptor *pGeneralDesc =
+			(TUSBAudioStreamingInterfaceDescriptor *) GetDescriptor (DESCRIPTOR_CS_INTERFACE);
+		if (   pGeneralDesc == 0
+		    || pGeneralDesc->bLength < sizeof *pGeneralDesc
+		    || pGeneralDesc->bDescriptorSubtype != AS_GENERAL
+		    || pGeneralDesc->wFormatTag != AUDIO_FORMAT_TAG_PCM)
+		{
+			continue;
+		}
+
+		const TUSBAudioTypeIFormatTypeDescriptor *pFormatDesc =
+			(TUSBAudioTypeIFormatTypeDescriptor *) GetDescriptor (DESCRIPTOR_CS_INTERFACE);
+		if (   pFormatDesc == 0
+		    || pFormatDesc->bLength < sizeof *pFormatDesc
+		    || pFormatDesc->bDescriptorSubtype != FORMAT_TYPE
+		    || pFormatDesc->bFormatType != AUDIO_FORMAT_TYPE_I
+		    || pFormatDesc->bNrChannels != 2
+		    || pFormatDesc->bSubframeSize != sizeof (s16)
+		    || pFormatDesc->bBitResolution != 16)
+		{
+			continue;
+		}
+
+		unsigned nRates = pFormatDesc->bSamFreqType == 0 ? 2 : pFormatDesc->bSamFreqType;
+		if (pFormatDesc->bLength < sizeof *pFormatDesc + nRates * 3)
+		{
+			continue;
+		}
+
+		pEndpointDesc = (TUSBEndpointDescriptor *) GetDescriptor (DESCRIPTOR_ENDPOINT);
+		if (   pEndpointDesc == 0
+		    || (pEndpointDesc->bmAttributes & 0x03) != 0x01		// Isochronous EP
+		    || (pEndpointDesc->bEndpointAddress & 0x80) == 0x80	// Input EP
+		    || (pEndpointDesc->wMaxPacketSize & 0x7FF) == 0)
+		{
+			pEndpointDesc = 0;
+
+			continue;
+		}
+
+		m_bContinuousRate = pFormatDesc->bSamFreqType == 0;
+		for (m_nNumRates = 0; m_nNumRates < nRates && m_nNumRates < USB_AUDIO_MAX_RATES;
+		     m_nNumRates++)
+		{
+			const unsigned char *pRate = pFormatDesc->tSamFreq[m_nNumRates];
+			m_Rate[m_nNumRates] = pRate[0] | (unsigned) pRate[1] << 8 | (unsigned) pRate[2] << 16;
+		}
+
+		m_uchAlternateSetting = pInterfaceDesc->bAlternateSetting;
+
+		break;
+	}
+
+	if (pEndpointDesc == 0)
+	{
+		CLogger::Get ()->Write (From, LogWarning, "No supported streaming format found");
+
+		return FALSE;
+	}
+
+	m_uchEndpointAddress = pEndpointDesc->bEndpointAddress;
+	m_usMaxPacketSize = pEndpointDesc->wMaxPacketSize & 0x7FF;
+
+	// one packet per (micro)frame interval
+	unsigned nInterval = pEndpointDesc->bInterval;
+	if (nInterval < 1)
+	{
+		nInterval = 1;
+	}
+
+	if (nInterval > 4)
+	{
+		nInterval = 4;
+	}
+
+	m_nPacketsPerSecond = GetDevice ()->GetSpeed () >= USBSpeedHigh ? 8000 : 1000;
+	m_nPacketsPerSecond >>= nInterval-1;
+
+	m_pEndpointOut = new CUSBEndpoint (GetDevice (), pEndpointDesc);
+	assert (m_pEndpointOut != 0);
+
+	// each buffer is aligned to its size (power of 2, max. 64K), so it cannot cross 64K
+	for (m_nBufferSize = DATA_CACHE_LINE_LENGTH_MAX;
+	     m_nBufferSize < USB_MAX_ISO_PACKETS * m_usMaxPacketSize;
+	     m_nBufferSize <<= 1)
+	{
+		// just calculating
+	}
+
+	assert (m_nBufferSize <= 0x10000);
+	for (unsigned i = 0; i < USB_AUDIO_NUM_URBS; i++)
+	{
+		m_pBufferMemory[i] = new u8[2*m_nBufferSize];
+		assert (m_pBufferMemory[i] != 0);
+
+		m_pBuffer[i] = (u8 *) (((uintptr) m_pBufferMemory[i] + m_nBufferSize-1)
+				       & ~((uintptr) m_nBufferSize-1));
+	}
+
+	if (!CUSBFunction::Configure ())
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot set interface");
+
+		return FALSE;
+	}
+
+	assert (m_nDeviceNumber == 0);
+	m_nDeviceNumber = s_DeviceNumberPool.AllocateNumber (TRUE, From);
+
+	CDeviceNameService::Get ()->AddDevice (DevicePrefix, m_nDeviceNumber, this, FALSE);
+
+	return TRUE;
+}
+
+boolean CUSBAudioStreamingDevice::IsSampleRateSupported (unsigned nSampleRate) const
+{
+	if (m_bContinuousRate)
+	{
+		assert (m_nNumRates == 2);
+		return m_Rate[0] <= nSampleRate && nSampleRate <= m_Rate[1];
+	}
+
+	for (unsigned i = 0; i < m_nNumRates; i++)
+	{
+		if (m_Rate[i] == nSampleRate)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+boolean CUSBAudioStreamingDevice::Setup (unsigned nSampleRate)
+{
+	assert (!IsActive ());
+
+	if (!IsSampleRateSupported (nSampleRate))
+	{
+		CLogger::Get ()->Write (From, LogError, "Sample rate not supported (%u)", nSampleRate);
+
+		return FALSE;
+	}
+
+	assert (m_nPacketsPerSecond > 0);
+	if ((nSampleRate + m_nPacketsPerSecond-1) / m_nPacketsPerSecond * FRAME_SIZE > m_usMaxPacketSize)
+	{
+		CLogger::Get ()->Write (From, LogError, "Packet size too small");
+
+		return FALSE;
+	}
+
+	if (GetHost ()->ControlMessage (GetEndpoint0 (),
+					REQUEST_OUT | REQUEST_TO_INTERFACE, SET_INTERFACE,
+					m_uchAlternateSetting, GetInterfaceNumber (), 0, 0) < 0)
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot set interface");
+
+		return FALSE;
+	}
+
+	// devices with a single fixed rate often do not have a sampling frequency control
+	if (   m_bContinuousRate
+	    || m_nNumRates > 1)
+	{
+		DMA_BUFFER (u8, Rate, 3);
+		Rate[0] = nSampleRate & 0xFF;
+		Rate[1] = (nSampleRate >> 8) & 0xFF;
+		Rate[2] = (nSampleRate >> 16) & 0xFF;
+
+		if (GetHost ()->ControlMessage (GetEndpoint0 (),
+						REQUEST_OUT | REQUEST_CLASS | REQUEST_TO_ENDPOINT,
+						AUDIO_REQUEST_SET_CUR,
+						AUDIO_EP_CONTROL_SAMPLING_FREQ << 8,
+						m_uchEndpointAddress, Rate, 3) < 0)
+		{
+			CLogger::Get ()->Write (From, LogWarning, "Cannot set sample rate");
+		}
+	}
+
+	m_nSampleRate = nSampleRate;
+	m_nFrameAccu = 0;
+
+	return TRUE;
+}
+
+void CUSBAudioStreamingDevice::RegisterChunkCallback (TUSBAudioChunkCallback *pCallback,
+						      void *pParam)
+{
+	m_pCallback = pCallback;
+	m_pCallbackParam = pParam;
+}
+
+boolean CUSBAudioStreamingDevice::Start (void)
+{
+	if (   m_nSampleRate == 0
+	    || m_pCallback == 0
+	    || IsActive ())
+	{
+		return FALSE;
+	}
+
+	m_bStopping = FALSE;
+
+	// queue all URBs at once, the completion of the first one must not overtake
+	EnterCritical ();
+
+	for (unsigned i = 0; i < USB_AUDIO_NUM_URBS; i++)
+	{
+		if (!SubmitURB (i))
+		{
+			m_bStopping = TRUE;
+
+			break;
+		}
+	}
+
+	LeaveCritical ();
+
+	if (!IsActive ())
+	{
+		CLogger::Get ()->Write (From, LogError, "Cannot start streaming");
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CUSBAudioStreamingDevice::Stop (void)
+{
+	m_bStopping = TRUE;
+}
+
+boolean CUSBAudioStreamingDevice::IsActive (void) const
+{
+	return m_nActiveURBs > 0;
+}
+
+boolean CUSBAudioStreamingDevice::SubmitURB (unsigned nURB)
+{
+	assert (nURB < USB_AUDIO_NUM_URBS);
+	u8 *pBuffer = m_pBuffer[nURB];
+	assert (pBuffer != 0);
+
+	assert (m_pEndpointOut != 0);
+	CUSBRequest *pURB = new CUSBRequest (m_pEndpointOut, pBuffer, m_nBufferSize);
+	assert (pURB != 0);
+
+	// distribute the frames evenly over the packets (e.g. 44 or 45 frames at 44.1 kHz)
+	unsigned nWords = 0;
+	for (unsigned i = 0; i < USB_MAX_ISO_PACKETS; i++)
+	{
+		m_nFrameAccu += m_nSampleRate;
+		unsigned nFrames = m_nFrameAccu / m_nPacketsPerSecond;
+		m_nFrameAccu %= m_nPacketsPerSecond;
+
+		boolean bOK = pURB->AddIsoPacket (nFrames * FRAME_SIZE);
+		assert (bOK);
+		(void) bOK;
+
+		nWords += nFrames * 2;
+	}
+
+	assert (m_pCallback != 0);
+	unsigned nResult = (*m_pCallback) ((s16 *) pBuffer, nWords, m_pCallbackParam);
+	if (nResult == 0)
+	{
+		delete pURB;
+
+		return FALSE;
+	}
+
+	assert (nResult <= nWords);
+	memset (pBuffer + nResult * sizeof (s16), 0, (nWords - nResult) * sizeof (s16));
+
+	pURB->SetCompletionRoutine (CompletionStub, (void *) (uintptr) nURB, this);
+
+	if (!GetHost ()->SubmitAsyncRequest (pURB))
+	{
+		delete pURB;
+
+		return FALSE;
+	}
+
+	m_nActiveURBs++;
+
+	return TRUE;
+}
+
+void CUSBAudioStreamingDevice::CompletionRoutine (CUSBRequest *pURB, unsigned nURB)
+{
+	assert (pURB != 0);
+	boolean bOK = pURB->GetStatus () ? TRUE : FALSE;
+
+	delete pURB;
+
+	assert (m_nActiveURBs > 0);
+	m_nActiveURBs--;
+
+	if (   !bOK
+	    || m_bStopping
+	    || !SubmitURB (nURB))
+	{
+		// the whole stream ends, if one URB cannot be continued
+		m_bStopping = TRUE;
+	}
+}
+
+void CUSBAudioStreamingDevice::CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext)
+{
+	CUSBAudioStreamingDevice *pThis = (CUSBAudioStreamingDevice *) pContext;
+	assert (pThis != 0);
+
+	pThis->CompletionRoutine (pURB, (unsigned) (uintptr) pParam);
+}
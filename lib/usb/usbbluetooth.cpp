@@ -2,7 +2,7 @@
 // usbbluetooth.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,8 +22,13 @@
 #include <circle/devicenameservice.h>
 #include <circle/logger.h>
 #include <circle/string.h>
+#include <circle/util.h>
 #include <assert.h>
 
+#define EVENT_HEADER_SIZE	2
+#define ACL_HEADER_SIZE		4
+#define COMMAND_HEADER_SIZE	3
+
 static const char FromBluetooth[] = "btusb";
 static const char DevicePrefix[] = "ubt";
 
@@ -34,10 +39,31 @@ CUSBBluetoothDevice::CUSBBluetoothDevice (CUSBFunction *pFunction)
 	m_pEndpointInterrupt (0),
 	m_pEndpointBulkIn (0),
 	m_pEndpointBulkOut (0),
-	m_pEventBuffer (0),
+	m_bRxStarted (FALSE),
+	m_pEventRing (0),
+	m_pACLRing (0),
+	m_nEventOverruns (0),
+	m_nACLOverruns (0),
+	m_pTxURB (0),
+	m_pTxBuffer (0),
+	m_bTxActive (FALSE),
+	m_bTxError (FALSE),
+	m_pTxRing (0),
+	m_TxSpinLock (IRQ_LEVEL),
 	m_pEventHandler (0),
 	m_nDeviceNumber (0)
 {
+	for (unsigned i = 0; i < RxURBs; i++)
+	{
+		m_pRxURB[i] = 0;
+		m_pRxBuffer[i] = 0;
+		m_bRxPending[i] = FALSE;
+	}
+
+	m_EventAssembly.nValid = 0;
+	m_EventAssembly.nTotal = 0;
+	m_ACLAssembly.nValid = 0;
+	m_ACLAssembly.nTotal = 0;
 }
 
 CUSBBluetoothDevice::~CUSBBluetoothDevice (void)
@@ -51,9 +77,37 @@ CUSBBluetoothDevice::~CUSBBluetoothDevice (void)
 		s_DeviceNumberPool.FreeNumber (m_nDeviceNumber);
 	}
 
-	delete [] m_pEventBuffer;
-	m_pEventBuffer = 0;
-	
+	// a pending URB has been deleted by the host controller on device removal
+	for (unsigned i = 0; i < RxURBs; i++)
+	{
+		if (!m_bRxPending[i])
+		{
+			delete m_pRxURB[i];
+		}
+		m_pRxURB[i] = 0;
+
+		delete [] m_pRxBuffer[i];
+		m_pRxBuffer[i] = 0;
+	}
+
+	if (!m_bTxActive)
+	{
+		delete m_pTxURB;
+	}
+	m_pTxURB = 0;
+
+	delete [] m_pTxBuffer;
+	m_pTxBuffer = 0;
+
+	delete m_pTxRing;
+	m_pTxRing = 0;
+
+	delete m_pACLRing;
+	m_pACLRing = 0;
+
+	delete m_pEventRing;
+	m_pEventRing = 0;
+
 	delete m_pEndpointBulkOut;
 	m_pEndpointBulkOut = 0;
 
@@ -137,8 +191,34 @@ boolean CUSBBluetoothDevice::Configure (void)
 		return FALSE;
 	}
 
-	m_pEventBuffer = new u8[m_pEndpointInterrupt->GetMaxPacketSize ()];
-	assert (m_pEventBuffer != 0);
+	for (unsigned i = 0; i < RxURBs; i++)
+	{
+		CUSBEndpoint *pEndpoint = i < BT_USB_EVENT_URBS ? m_pEndpointInterrupt : m_pEndpointBulkIn;
+		unsigned nSize = pEndpoint->GetMaxPacketSize ();
+		if (i >= BT_USB_EVENT_URBS)
+		{
+			nSize *= BT_USB_ACL_RX_PACKETS;
+		}
+
+		m_pRxBuffer[i] = new u8[nSize];
+		assert (m_pRxBuffer[i] != 0);
+
+		m_pRxURB[i] = new CUSBRequest (pEndpoint, m_pRxBuffer[i], nSize);
+		assert (m_pRxURB[i] != 0);
+		m_pRxURB[i]->SetCompletionRoutine (CompletionStub, (void *) (uintptr) i, this);
+	}
+
+	m_pEventRing = new CSPSCRing<TEventPacket> (BT_USB_EVENT_SLOTS);
+	assert (m_pEventRing != 0);
+
+	m_pACLRing = new CSPSCRing<TACLPacket> (BT_USB_ACL_SLOTS);
+	assert (m_pACLRing != 0);
+
+	m_pTxBuffer = new u8[BT_USB_ACL_TX_MAX_SIZE];
+	assert (m_pTxBuffer != 0);
+
+	m_pTxRing = new CSPSCRing<u8> (BT_USB_ACL_TX_RING_SIZE);
+	assert (m_pTxRing != 0);
 
 	assert (m_nDeviceNumber == 0);
 	m_nDeviceNumber = s_DeviceNumberPool.AllocateNumber (TRUE, FromBluetooth);
@@ -159,51 +239,284 @@ boolean CUSBBluetoothDevice::SendHCICommand (const void *pBuffer, unsigned nLeng
 	return TRUE;
 }
 
+boolean CUSBBluetoothDevice::SendHCICommands (const void *pBuffer, unsigned nLength)
+{
+	const u8 *pCommand = (const u8 *) pBuffer;
+	assert (pCommand != 0);
+
+	while (nLength > 0)
+	{
+		if (nLength < COMMAND_HEADER_SIZE)
+		{
+			return FALSE;
+		}
+
+		unsigned nCommandLength = COMMAND_HEADER_SIZE + pCommand[2];
+		if (   nCommandLength > nLength
+		    || !SendHCICommand (pCommand, nCommandLength))
+		{
+			return FALSE;
+		}
+
+		pCommand += nCommandLength;
+		nLength -= nCommandLength;
+	}
+
+	return TRUE;
+}
+
 void CUSBBluetoothDevice::RegisterHCIEventHandler (TBTHCIEventHandler *pHandler)
 {
 	m_pEventHandler = pHandler;
 	assert (m_pEventHandler != 0);
 
-	StartRequest ();
+	StartReception ();
 }
 
-boolean CUSBBluetoothDevice::StartRequest (void)
+boolean CUSBBluetoothDevice::StartReception (void)
 {
-	assert (m_pEndpointInterrupt != 0);
-	assert (m_pEventBuffer != 0);
+	if (m_bRxStarted)
+	{
+		return TRUE;
+	}
 
-	CUSBRequest *pURB = new CUSBRequest (m_pEndpointInterrupt, m_pEventBuffer,
-					     m_pEndpointInterrupt->GetMaxPacketSize ());
-	assert (pURB != 0);
+	m_bRxStarted = TRUE;
 
-	pURB->SetCompletionRoutine (CompletionStub, 0, this);
-	
-	return GetHost ()->SubmitAsyncRequest (pURB);
+	for (unsigned i = 0; i < RxURBs; i++)
+	{
+		if (!StartRequest (i))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+unsigned CUSBBluetoothDevice::ReceiveHCIEvent (void *pBuffer)
+{
+	assert (m_pEventRing != 0);
+	TEventPacket *pPacket = m_pEventRing->BeginRead ();
+	if (pPacket == 0)
+	{
+		return 0;
+	}
+
+	unsigned nLength = pPacket->nLength;
+	assert (pBuffer != 0);
+	memcpy (pBuffer, pPacket->Data, nLength);
+
+	m_pEventRing->EndRead ();
+
+	return nLength;
+}
+
+unsigned CUSBBluetoothDevice::ReceiveACLData (void *pBuffer)
+{
+	assert (m_pACLRing != 0);
+	TACLPacket *pPacket = m_pACLRing->BeginRead ();
+	if (pPacket == 0)
+	{
+		return 0;
+	}
+
+	unsigned nLength = pPacket->nLength;
+	assert (pBuffer != 0);
+	memcpy (pBuffer, pPacket->Data, nLength);
+
+	m_pACLRing->EndRead ();
+
+	return nLength;
+}
+
+boolean CUSBBluetoothDevice::SendACLData (const void *pBuffer, unsigned nLength)
+{
+	assert (pBuffer != 0);
+	assert (nLength >= ACL_HEADER_SIZE);
+
+	assert (m_pTxRing != 0);
+	if (   m_bTxError
+	    || BT_USB_ACL_TX_RING_SIZE - m_pTxRing->GetCount () < nLength)
+	{
+		return FALSE;
+	}
+
+	// the packets are queued completely or not at all
+#ifndef NDEBUG
+	unsigned nWritten =
+#endif
+		m_pTxRing->WriteMultiple ((const u8 *) pBuffer, nLength);
+	assert (nWritten == nLength);
+
+	m_TxSpinLock.Acquire ();
+
+	if (!m_bTxActive)
+	{
+		StartTransmit ();
+	}
+
+	m_TxSpinLock.Release ();
+
+	return TRUE;
 }
 
-void CUSBBluetoothDevice::CompletionRoutine (CUSBRequest *pURB)
+boolean CUSBBluetoothDevice::StartRequest (unsigned nURB)
 {
+	assert (nURB < RxURBs);
+	CUSBRequest *pURB = m_pRxURB[nURB];
 	assert (pURB != 0);
 
-	boolean bRestart = TRUE;
+	pURB->Reset ();
+
+	assert (!m_bRxPending[nURB]);
+	m_bRxPending[nURB] = TRUE;
+
+	if (!GetHost ()->SubmitAsyncRequest (pURB))
+	{
+		m_bRxPending[nURB] = FALSE;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CUSBBluetoothDevice::Assemble (TAssembly *pAssembly, boolean bACL,
+				    const u8 *pData, unsigned nLength)
+{
+	assert (pAssembly != 0);
+	assert (pData != 0);
+
+	unsigned nHeaderSize = bACL ? ACL_HEADER_SIZE : EVENT_HEADER_SIZE;
+	unsigned nMaxSize = bACL ? BT_USB_ACL_MAX_SIZE : BT_USB_EVENT_MAX_SIZE;
 
-	if (pURB->GetStatus () != 0)
+	while (nLength > 0)
 	{
-		assert (m_pEventHandler != 0);
-		assert (m_pEventBuffer != 0);
-		(*m_pEventHandler) (m_pEventBuffer, pURB->GetResultLength ());
+		unsigned nNeeded = (pAssembly->nTotal == 0 ? nHeaderSize : pAssembly->nTotal)
+				 - pAssembly->nValid;
+		unsigned nBytes = nLength < nNeeded ? nLength : nNeeded;
+
+		// bytes of a too large packet are counted, but not stored
+		if (pAssembly->nValid < nMaxSize)
+		{
+			unsigned nCopy = nMaxSize - pAssembly->nValid;
+			memcpy (pAssembly->Buffer + pAssembly->nValid, pData,
+				nBytes < nCopy ? nBytes : nCopy);
+		}
+
+		pAssembly->nValid += nBytes;
+		pData += nBytes;
+		nLength -= nBytes;
+
+		if (pAssembly->nTotal == 0)
+		{
+			if (pAssembly->nValid == nHeaderSize)
+			{
+				pAssembly->nTotal = nHeaderSize + (  bACL
+								   ? (  pAssembly->Buffer[2]
+								      | pAssembly->Buffer[3] << 8)
+								   : pAssembly->Buffer[1]);
+			}
+			else
+			{
+				continue;
+			}
+		}
+
+		if (pAssembly->nValid == pAssembly->nTotal)
+		{
+			if (pAssembly->nTotal <= nMaxSize)
+			{
+				Deliver (bACL, pAssembly->Buffer, pAssembly->nTotal);
+			}
+			else
+			{
+				if (bACL)
+				{
+					m_nACLOverruns++;
+				}
+				else
+				{
+					m_nEventOverruns++;
+				}
+			}
+
+			pAssembly->nValid = 0;
+			pAssembly->nTotal = 0;
+		}
+	}
+}
+
+void CUSBBluetoothDevice::Deliver (boolean bACL, const u8 *pPacket, unsigned nLength)
+{
+	if (!bACL)
+	{
+		if (m_pEventHandler != 0)
+		{
+			(*m_pEventHandler) (pPacket, nLength);
+
+			return;
+		}
+
+		assert (m_pEventRing != 0);
+		TEventPacket *pSlot = m_pEventRing->BeginWrite ();
+		if (pSlot == 0)
+		{
+			m_nEventOverruns++;
+
+			return;
+		}
+
+		assert (nLength <= sizeof pSlot->Data);
+		memcpy (pSlot->Data, pPacket, nLength);
+		pSlot->nLength = nLength;
+
+		m_pEventRing->EndWrite (pSlot);
 	}
 	else
+	{
+		assert (m_pACLRing != 0);
+		TACLPacket *pSlot = m_pACLRing->BeginWrite ();
+		if (pSlot == 0)
+		{
+			m_nACLOverruns++;
+
+			return;
+		}
+
+		assert (nLength <= sizeof pSlot->Data);
+		memcpy (pSlot->Data, pPacket, nLength);
+		pSlot->nLength = nLength;
+
+		m_pACLRing->EndWrite (pSlot);
+	}
+}
+
+void CUSBBluetoothDevice::CompletionRoutine (CUSBRequest *pURB, unsigned nURB)
+{
+	assert (pURB != 0);
+	assert (nURB < RxURBs);
+	assert (pURB == m_pRxURB[nURB]);
+	assert (m_bRxPending[nURB]);
+	m_bRxPending[nURB] = FALSE;
+
+	if (pURB->GetStatus () == 0)
 	{
 		CLogger::Get ()->Write (FromBluetooth, LogWarning, "Request failed");
 
-		bRestart = FALSE;
+		return;			// URB is deleted in destructor
 	}
 
-	delete pURB;
+	if (nURB < BT_USB_EVENT_URBS)
+	{
+		Assemble (&m_EventAssembly, FALSE, m_pRxBuffer[nURB], pURB->GetResultLength ());
+	}
+	else
+	{
+		Assemble (&m_ACLAssembly, TRUE, m_pRxBuffer[nURB], pURB->GetResultLength ());
+	}
 
-	if (   bRestart
-	    && !StartRequest ())
+	if (!StartRequest (nURB))
 	{
 		CLogger::Get ()->Write (FromBluetooth, LogError, "Cannot restart request");
 	}
@@ -213,6 +526,67 @@ void CUSBBluetoothDevice::CompletionStub (CUSBRequest *pURB, void *pParam, void
 {
 	CUSBBluetoothDevice *pThis = (CUSBBluetoothDevice *) pContext;
 	assert (pThis != 0);
-	
-	pThis->CompletionRoutine (pURB);
+
+	pThis->CompletionRoutine (pURB, (unsigned) (uintptr) pParam);
+}
+
+void CUSBBluetoothDevice::StartTransmit (void)
+{
+	assert (!m_bTxActive);
+
+	assert (m_pTxRing != 0);
+	assert (m_pTxBuffer != 0);
+	unsigned nLength = m_pTxRing->ReadMultiple (m_pTxBuffer, BT_USB_ACL_TX_MAX_SIZE);
+	if (nLength == 0)
+	{
+		return;
+	}
+
+	assert (m_pTxURB == 0);
+	assert (m_pEndpointBulkOut != 0);
+	m_pTxURB = new CUSBRequest (m_pEndpointBulkOut, m_pTxBuffer, nLength);
+	assert (m_pTxURB != 0);
+	m_pTxURB->SetCompletionRoutine (TransmitCompletionStub, 0, this);
+
+	m_bTxActive = TRUE;
+
+	if (!GetHost ()->SubmitAsyncRequest (m_pTxURB))
+	{
+		delete m_pTxURB;
+		m_pTxURB = 0;
+
+		m_bTxActive = FALSE;
+		m_bTxError = TRUE;
+	}
+}
+
+void CUSBBluetoothDevice::TransmitCompletionRoutine (CUSBRequest *pURB)
+{
+	assert (pURB != 0);
+
+	m_TxSpinLock.Acquire ();
+
+	assert (pURB == m_pTxURB);
+	if (pURB->GetStatus () == 0)
+	{
+		m_bTxError = TRUE;
+	}
+
+	delete m_pTxURB;
+	m_pTxURB = 0;
+
+	assert (m_bTxActive);
+	m_bTxActive = FALSE;
+
+	StartTransmit ();
+
+	m_TxSpinLock.Release ();
+}
+
+void CUSBBluetoothDevice::TransmitCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext)
+{
+	CUSBBluetoothDevice *pThis = (CUSBBluetoothDevice *) pContext;
+	assert (pThis != 0);
+
+	pThis->TransmitCompletionRoutine (pURB);
 }
@@ -0,0 +1,167 @@
+//
+// usbbulkinqueue.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/usb/usbbulkinqueue.h>
+#include <assert.h>
+
+CUSBBulkInQueue::CUSBBulkInQueue (CUSBHostController *pHost, CUSBEndpoint *pEndpoint,
+				  unsigned nBufferSize, unsigned nBufferCount)
+:	m_pHost (pHost),
+	m_pEndpoint (pEndpoint),
+	m_nBufferSize (nBufferSize),
+	m_nBufferCount (nBufferCount),
+	m_ppBuffer (new u8 *[nBufferCount]),
+	m_pResultLength (new unsigned[nBufferCount]),
+	m_FreeRing (nBufferCount),
+	m_DoneRing (nBufferCount),
+	m_nCurrent (nBufferCount),
+	m_bRequestActive (FALSE)
+{
+	assert (m_pHost != 0);
+	assert (m_pEndpoint != 0);
+	assert (m_nBufferSize > 0);
+	assert (m_ppBuffer != 0);
+	assert (m_pResultLength != 0);
+
+	for (unsigned i = 0; i < m_nBufferCount; i++)
+	{
+		m_ppBuffer[i] = new u8[m_nBufferSize];
+		assert (m_ppBuffer[i] != 0);
+
+		m_FreeRing.Write (i);
+	}
+}
+
+CUSBBulkInQueue::~CUSBBulkInQueue (void)
+{
+	// a pending request has been cancelled by the host controller before (device removed)
+	for (unsigned i = 0; i < m_nBufferCount; i++)
+	{
+		delete [] m_ppBuffer[i];
+	}
+
+	delete [] m_pResultLength;
+	m_pResultLength = 0;
+
+	delete [] m_ppBuffer;
+	m_ppBuffer = 0;
+
+	m_pEndpoint = 0;
+	m_pHost = 0;
+}
+
+const u8 *CUSBBulkInQueue::GetData (unsigned *pLength)
+{
+	const u8 *pResult = 0;
+
+	m_SpinLock.Acquire ();
+
+	if (m_nCurrent < m_nBufferCount)		// give back the previous buffer
+	{
+		m_FreeRing.Write (m_nCurrent);
+		m_nCurrent = m_nBufferCount;
+	}
+
+	unsigned nBuffer;
+	if (m_DoneRing.Read (&nBuffer))
+	{
+		m_nCurrent = nBuffer;
+
+		assert (pLength != 0);
+		*pLength = m_pResultLength[nBuffer];
+
+		pResult = m_ppBuffer[nBuffer];
+	}
+
+	StartRequest ();
+
+	m_SpinLock.Release ();
+
+	return pResult;
+}
+
+void CUSBBulkInQueue::StartRequest (void)
+{
+	if (m_bRequestActive)
+	{
+		return;
+	}
+
+	unsigned nBuffer;
+	if (!m_FreeRing.Read (&nBuffer))
+	{
+		return;					// all buffers are filled
+	}
+
+	CUSBRequest *pURB = new CUSBRequest (m_pEndpoint, m_ppBuffer[nBuffer], m_nBufferSize);
+	assert (pURB != 0);
+	pURB->SetCompletionRoutine (CompletionStub, (void *) (uintptr) nBuffer, this);
+
+	m_bRequestActive = TRUE;
+
+	assert (m_pHost != 0);
+	if (!m_pHost->SubmitAsyncRequest (pURB))
+	{
+		delete pURB;
+
+		m_bRequestActive = FALSE;
+
+		m_FreeRing.Write (nBuffer);
+	}
+}
+
+void CUSBBulkInQueue::CompletionRoutine (CUSBRequest *pURB, unsigned nBuffer)
+{
+	assert (pURB != 0);
+	unsigned nLength = pURB->GetStatus () ? pURB->GetResultLength () : 0;
+
+	delete pURB;
+
+	m_SpinLock.Acquire ();
+
+	assert (m_bRequestActive);
+	m_bRequestActive = FALSE;
+
+	assert (nBuffer < m_nBufferCount);
+	if (nLength > 0)
+	{
+		m_pResultLength[nBuffer] = nLength;
+
+		if (!m_DoneRing.Write (nBuffer))	// cannot fail, has an entry for each buffer
+		{
+			assert (0);
+		}
+
+		StartRequest ();			// continue with the next free buffer
+	}
+	else
+	{
+		m_FreeRing.Write (nBuffer);
+	}
+
+	m_SpinLock.Release ();
+}
+
+void CUSBBulkInQueue::CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext)
+{
+	CUSBBulkInQueue *pThis = (CUSBBulkInQueue *) pContext;
+	assert (pThis != 0);
+
+	pThis->CompletionRoutine (pURB, (unsigned) (uintptr) pParam);
+}
@@ -2,7 +2,7 @@
 // usbdevice.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -28,9 +28,11 @@
 #include <circle/util.h>
 #include <circle/sysconfig.h>
 #include <circle/debug.h>
+#include <circle/synchronize.h>
 #include <assert.h>
 
 #define MAX_CONFIG_DESC_SIZE		512		// best guess
+#define CONFIG_ARENA_SIZE		(MAX_CONFIG_DESC_SIZE + 256)
 
 static const char FromDevice[] = "usbdev";
 
@@ -51,7 +53,8 @@ CUSBDevice::CUSBDevice (CUSBHostController *pHost, TUSBSpeed Speed, CUSBHCIRootP
 	m_pTTHubDevice (0),
 	m_pDeviceDesc (0),
 	m_pConfigDesc (0),
-	m_pConfigParser (0)
+	m_pConfigParser (0),
+	m_ConfigArena (CONFIG_ARENA_SIZE)
 {
 	assert (m_pHost != 0);
 	assert (m_pRootPort != 0);
@@ -82,7 +85,8 @@ CUSBDevice::CUSBDevice (CUSBHostController *pHost, TUSBSpeed Speed,
 	m_pEndpoint0 (0),
 	m_pDeviceDesc (0),
 	m_pConfigDesc (0),
-	m_pConfigParser (0)
+	m_pConfigParser (0),
+	m_ConfigArena (CONFIG_ARENA_SIZE)
 {
 	assert (m_pHost != 0);
 	assert (m_pHub != 0);
@@ -150,11 +154,14 @@ CUSBDevice::~CUSBDevice (void)
 	}
 #endif
 
-	delete m_pConfigParser;
-	m_pConfigParser = 0;
+	if (m_pConfigParser != 0)
+	{
+		m_pConfigParser->~CUSBConfigurationParser ();
+		m_pConfigParser = 0;
+	}
 
-	delete m_pConfigDesc;
 	m_pConfigDesc = 0;
+	m_ConfigArena.Reset ();
 	
 	delete m_pDeviceDesc;
 	m_pDeviceDesc = 0;
@@ -257,8 +264,10 @@ boolean CUSBDevice::Initialize (void)
 	SetAddress ((u8) nAddress);
 #endif
 
+	// the descriptors are received via DMA, so they have to be cache-line aligned
 	assert (m_pConfigDesc == 0);
-	m_pConfigDesc = new TUSBConfigurationDescriptor;
+	m_pConfigDesc = (TUSBConfigurationDescriptor *)
+		m_ConfigArena.Allocate (sizeof *m_pConfigDesc, DATA_CACHE_LINE_LENGTH_MAX);
 	assert (m_pConfigDesc != 0);
 
 	u8 ucConfigIndex = DESCRIPTOR_INDEX_DEFAULT;
@@ -277,7 +286,7 @@ boolean CUSBDevice::Initialize (void)
 	{
 		LogWrite (LogError, "Cannot get configuration descriptor (short)");
 
-		delete m_pConfigDesc;
+		m_ConfigArena.Reset ();
 		m_pConfigDesc = 0;
 
 		return FALSE;
@@ -289,7 +298,7 @@ boolean CUSBDevice::Initialize (void)
 	{
 		LogWrite (LogError, "Invalid configuration descriptor");
 		
-		delete m_pConfigDesc;
+		m_ConfigArena.Reset ();
 		m_pConfigDesc = 0;
 
 		return FALSE;
@@ -297,9 +306,10 @@ boolean CUSBDevice::Initialize (void)
 
 	unsigned nTotalLength = m_pConfigDesc->wTotalLength;
 
-	delete m_pConfigDesc;
+	m_ConfigArena.Reset ();
 
-	m_pConfigDesc = (TUSBConfigurationDescriptor *) new u8[nTotalLength];
+	m_pConfigDesc = (TUSBConfigurationDescriptor *)
+		m_ConfigArena.Allocate (nTotalLength, DATA_CACHE_LINE_LENGTH_MAX);
 	assert (m_pConfigDesc != 0);
 
 	if (m_pHost->GetDescriptor (m_pEndpoint0,
@@ -309,7 +319,7 @@ boolean CUSBDevice::Initialize (void)
 	{
 		LogWrite (LogError, "Cannot get configuration descriptor");
 
-		delete m_pConfigDesc;
+		m_ConfigArena.Reset ();
 		m_pConfigDesc = 0;
 
 		return FALSE;
@@ -320,7 +330,7 @@ boolean CUSBDevice::Initialize (void)
 #endif
 
 	assert (m_pConfigParser == 0);
-	m_pConfigParser = new CUSBConfigurationParser (m_pConfigDesc, nTotalLength);
+	m_pConfigParser = new (m_ConfigArena) CUSBConfigurationParser (m_pConfigDesc, nTotalLength);
 	assert (m_pConfigParser != 0);
 
 	if (!m_pConfigParser->IsValid ())
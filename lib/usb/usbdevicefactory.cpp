@@ -22,6 +22,7 @@
 #include <circle/synchronize.h>
 #include <circle/koptions.h>
 #include <circle/logger.h>
+#include <circle/util.h>
 #include <assert.h>
 
 // for factory
@@ -40,6 +41,7 @@
 #include <circle/usb/lan7800.h>
 #include <circle/usb/usbbluetooth.h>
 #include <circle/usb/usbmidi.h>
+#include <circle/usb/usbaudiostreaming.h>
 #include <circle/usb/usbcdcethernet.h>
 #include <circle/usb/usbserialcdc.h>
 #include <circle/usb/usbserialch341.h>
@@ -53,12 +55,12 @@ CUSBFunction *CUSBDeviceFactory::GetDevice (CUSBFunction *pParent, CString *pNam
 	assert (pParent != 0);
 	assert (pName != 0);
 
-	const char *pUSBIgnore = CKernelOptions::Get ()->GetUSBIgnore ();
-	assert (pUSBIgnore != 0);
-	if (pName->Compare (pUSBIgnore) == 0)
+	if (IsIgnored (*pName))
 	{
 		CLogger::Get ()->Write ("ufactory", LogWarning,
-					"Ignoring device/interface %s", pUSBIgnore);
+					"Ignoring device/interface %s", (const char *) *pName);
+
+		delete pName;
 
 		return 0;
 	}
@@ -150,6 +152,12 @@ CUSBFunction *CUSBDeviceFactory::GetDevice (CUSBFunction *pParent, CString *pNam
 	{
 		pResult = new CUSBMIDIDevice (pParent);
 	}
+#if RASPPI >= 4
+	else if (pName->Compare ("int1-2-0") == 0)
+	{
+		pResult = new CUSBAudioStreamingDevice (pParent);
+	}
+#endif
 	else if (pName->Compare ("int2-6-0") == 0)
 	{
 		pResult = new CUSBCDCEthernetDevice (pParent);
@@ -285,3 +293,36 @@ boolean CUSBDeviceFactory::FindDeviceID (CString *pName, const TUSBDeviceID *pID
 
 	return FALSE;
 }
+
+boolean CUSBDeviceFactory::IsIgnored (const char *pName)
+{
+	assert (pName != 0);
+
+	const char *pEntry = CKernelOptions::Get ()->GetUSBIgnore ();
+	assert (pEntry != 0);
+
+	// comma separated list, an entry matches all names, which start with it,
+	// followed by '-' (e.g. "int8" ignores all mass storage interfaces)
+	while (*pEntry != '\0')
+	{
+		const char *pEnd = strchr (pEntry, ',');
+		size_t nLength = pEnd != 0 ? (size_t) (pEnd - pEntry) : strlen (pEntry);
+
+		if (   nLength > 0
+		    && strncmp (pName, pEntry, nLength) == 0
+		    && (   pName[nLength] == '\0'
+			|| pName[nLength] == '-'))
+		{
+			return TRUE;
+		}
+
+		if (pEnd == 0)
+		{
+			break;
+		}
+
+		pEntry = pEnd + 1;
+	}
+
+	return FALSE;
+}
@@ -56,6 +56,10 @@ CUSBEndpoint::CUSBEndpoint (CUSBDevice *pDevice, const TUSBEndpointDescriptor *p
 
 	switch (pDesc->bmAttributes & 0x03)
 	{
+	case 1:
+		m_Type = EndpointTypeIsochronous;
+		break;
+
 	case 2:
 		m_Type = EndpointTypeBulk;
 		break;
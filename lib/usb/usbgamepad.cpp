@@ -2,7 +2,7 @@
 // usbgamepad.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // Ported from the USPi driver which is:
 // 	Copyright (C) 2014  M. Maccaferri <macca@maccasoft.com>
@@ -23,6 +23,7 @@
 #include <circle/usb/usbgamepad.h>
 #include <circle/devicenameservice.h>
 #include <circle/logger.h>
+#include <circle/timer.h>
 #include <circle/util.h>
 #include <circle/debug.h>
 #include <assert.h>
@@ -36,9 +37,15 @@ CUSBGamePadDevice::CUSBGamePadDevice (CUSBFunction *pFunction)
 :	CUSBHIDDevice (pFunction),
 	m_pStatusHandler (0),
 	m_usReportSize (0),
-	m_nDeviceNumber (0)	// not assigned
+	m_nDeviceNumber (0),	// not assigned
+	m_nLastReportSize (0),
+	m_nMinIntervalTicks (0),
+	m_nLastNotifyTicks (0),
+	m_bNotifyPending (FALSE),
+	m_nDiscardedReports (0)
 {
 	memset (&m_State, 0, sizeof m_State);
+	memset (&m_Snapshot, 0, sizeof m_Snapshot);
 }
 
 CUSBGamePadDevice::~CUSBGamePadDevice (void)
@@ -68,6 +75,8 @@ boolean CUSBGamePadDevice::Configure (void)
 
 	CDeviceNameService::Get ()->AddDevice (DevicePrefix, m_nDeviceNumber, this, FALSE);
 
+	PublishState ();		// the initial state
+
 	return TRUE;
 }
 
@@ -83,16 +92,105 @@ void CUSBGamePadDevice::RegisterStatusHandler (TGamePadStatusHandler *pStatusHan
 	assert (m_pStatusHandler != 0);
 }
 
+void CUSBGamePadDevice::SetStatusInterval (unsigned nMinIntervalMs)
+{
+	m_nMinIntervalTicks = nMinIntervalMs * (CLOCKHZ / 1000);
+}
+
+void CUSBGamePadDevice::GetState (TGamePadState *pState) const
+{
+	assert (pState != 0);
+
+	unsigned nSequence;
+	do
+	{
+		nSequence = m_SnapshotLock.ReadBegin ();
+
+		memcpy (pState, &m_Snapshot, sizeof *pState);
+	}
+	while (m_SnapshotLock.ReadRetry (nSequence));
+}
+
 void CUSBGamePadDevice::ReportHandler (const u8 *pReport, unsigned nReportSize)
 {
 	if (   pReport != 0
-	    && nReportSize == m_usReportSize
-	    && m_pStatusHandler != 0)
+	    && nReportSize == m_usReportSize)
 	{
 		//debug_hexdump (pReport, m_usReportSize, FromUSBPad);
 
-		DecodeReport (pReport);
+		HandleReport (pReport, nReportSize);
+	}
+}
+
+void CUSBGamePadDevice::HandleReport (const u8 *pReport, unsigned nReportSize)
+{
+	assert (pReport != 0);
+
+	// an identical report would decode to the same state
+	if (   nReportSize == m_nLastReportSize
+	    && memcmp (pReport, m_LastReport, nReportSize) == 0)
+	{
+		m_nDiscardedReports++;
+
+		NotifyStatus ();	// may be pending from a previous change
+
+		return;
+	}
+
+	if (nReportSize <= sizeof m_LastReport)
+	{
+		memcpy (m_LastReport, pReport, nReportSize);
+		m_nLastReportSize = nReportSize;
+	}
+	else
+	{
+		m_nLastReportSize = 0;
+	}
+
+	DecodeReport (pReport);
 
-		(*m_pStatusHandler) (m_nDeviceNumber-1, &m_State);
+	// the report may differ in fields, which are not decoded (e.g. a counter)
+	if (memcmp (&m_State, &m_Snapshot, sizeof m_State) != 0)
+	{
+		PublishState ();
+
+		m_bNotifyPending = TRUE;
+	}
+	else
+	{
+		m_nDiscardedReports++;
 	}
+
+	NotifyStatus ();
+}
+
+void CUSBGamePadDevice::PublishState (void)
+{
+	// the writer runs in the completion routine of the report request only
+	m_SnapshotLock.WriteBegin ();
+
+	memcpy (&m_Snapshot, &m_State, sizeof m_Snapshot);
+
+	m_SnapshotLock.WriteEnd ();
+}
+
+void CUSBGamePadDevice::NotifyStatus (void)
+{
+	if (   !m_bNotifyPending
+	    || m_pStatusHandler == 0)
+	{
+		return;
+	}
+
+	unsigned nTicks = CTimer::GetClockTicks ();
+	if (   m_nMinIntervalTicks != 0
+	    && nTicks - m_nLastNotifyTicks < m_nMinIntervalTicks)
+	{
+		return;
+	}
+
+	m_nLastNotifyTicks = nTicks;
+	m_bNotifyPending = FALSE;
+
+	(*m_pStatusHandler) (m_nDeviceNumber-1, &m_State);
 }
@@ -2,7 +2,7 @@
 // usbgamepadps4.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 //
 // This driver was developed by:
 //	Jose Luis Sanchez, http://jspeccy.speccy.org/
@@ -202,12 +202,7 @@ void CUSBGamePadPS4Device::ReportHandler (const u8 *pReport, unsigned nReportSiz
 	{
 		//debug_hexdump (pReport, m_usReportSize, FromUSBPadPS4);
 
-		DecodeReport (pReport);
-
-		if (m_pStatusHandler != 0)
-		{
-			(*m_pStatusHandler) (m_nDeviceNumber-1, &m_State);
-		}
+		HandleReport (pReport, nReportSize);
 
 		if (m_pMouseDevice != 0)
 		{
@@ -2,7 +2,7 @@
 // usbgamepadxbox360.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // Information to implement this was taken from:
 //	https://github.com/felis/USB_Host_Shield_2.0/blob/master/XBOXUSB.cpp
@@ -103,14 +103,11 @@ void CUSBGamePadXbox360Device::ReportHandler (const u8 *pReport, unsigned nRepor
 	if (   pReport != 0
 	    && nReportSize == REPORT_SIZE
 	    && pReport[0] == (REPORT_HEADER & 0xFF)
-	    && pReport[1] == (REPORT_HEADER >> 8)
-	    && m_pStatusHandler != 0)
+	    && pReport[1] == (REPORT_HEADER >> 8))
 	{
 		//debug_hexdump (pReport, m_usReportSize, FromUSBPadXbox360);
 
-		DecodeReport (pReport);
-
-		(*m_pStatusHandler) (m_nDeviceNumber-1, &m_State);
+		HandleReport (pReport, nReportSize);
 	}
 }
 
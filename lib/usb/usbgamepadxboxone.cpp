@@ -2,7 +2,7 @@
 // usbgamepadxboxone.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2018-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2018-2022  R. Stange <rsta2@o2online.de>
 //
 // This driver was developed by:
 //	Jose Luis Sanchez, jspeccy@gmail.com, jsanchezv@github.com
@@ -152,11 +152,9 @@ void CUSBGamePadXboxOneDevice::ReportHandler (const u8 *pReport, unsigned report
 
 	// Controller sends "heartbeat" packets periodically starting with
 	// 0x03, 0x20. We aren't interested in them.
-	if (m_pStatusHandler != nullptr && reportSize == 18 && pReport[0] == 0x20)
+	if (reportSize == 18 && pReport[0] == 0x20)
 	{
-		DecodeReport (pReport);
-
-		(*m_pStatusHandler) (m_nDeviceNumber-1, &m_State);
+		HandleReport (pReport, reportSize);
 	}
 }
 
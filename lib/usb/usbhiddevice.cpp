@@ -30,7 +30,11 @@ CUSBHIDDevice::CUSBHIDDevice (CUSBFunction *pFunction, unsigned nMaxReportSize)
 	m_nMaxReportSize (nMaxReportSize),
 	m_pReportEndpoint (0),
 	m_pEndpointOut (0),
-	m_pReportBuffer (0)
+	m_pReportBuffer (0),
+	m_pURB (0),
+	m_bRequestPending (FALSE),
+	m_pReportQueue (0),
+	m_nDroppedReports (0)
 {
 	if (m_nMaxReportSize > 0)
 	{
@@ -41,6 +45,16 @@ CUSBHIDDevice::CUSBHIDDevice (CUSBFunction *pFunction, unsigned nMaxReportSize)
 
 CUSBHIDDevice::~CUSBHIDDevice (void)
 {
+	// a pending URB has been deleted by the host controller on device removal
+	if (!m_bRequestPending)
+	{
+		delete m_pURB;
+	}
+	m_pURB = 0;
+
+	delete m_pReportQueue;
+	m_pReportQueue = 0;
+
 	delete [] m_pReportBuffer;
 	m_pReportBuffer = 0;
 
@@ -193,28 +207,109 @@ int CUSBHIDDevice::ReceiveFromEndpointIn (void *pBuffer, unsigned nBufSize, unsi
 	return GetHost ()->Transfer (m_pReportEndpoint, pBuffer, nBufSize, nTimeoutMs);
 }
 
+boolean CUSBHIDDevice::EnableReportQueue (unsigned nSize)
+{
+	assert (m_pURB == 0);
+
+	if (   m_nMaxReportSize == 0
+	    || m_nMaxReportSize > USBHID_QUEUED_REPORT_SIZE)
+	{
+		return FALSE;
+	}
+
+	if (m_pReportQueue == 0)
+	{
+		m_pReportQueue = new CSPSCRing<TQueuedReport> (nSize);
+		assert (m_pReportQueue != 0);
+	}
+
+	return TRUE;
+}
+
+unsigned CUSBHIDDevice::DequeueReport (void *pBuffer, unsigned nBufSize)
+{
+	assert (m_pReportQueue != 0);
+	TQueuedReport *pReport = m_pReportQueue->BeginRead ();
+	if (pReport == 0)
+	{
+		return 0;
+	}
+
+	unsigned nLength = pReport->nLength;
+	if (nLength > nBufSize)
+	{
+		nLength = nBufSize;
+	}
+
+	assert (pBuffer != 0);
+	memcpy (pBuffer, pReport->Report, nLength);
+
+	m_pReportQueue->EndRead ();
+
+	return nLength;
+}
+
 boolean CUSBHIDDevice::StartRequest (void)
 {
 	assert (m_pReportEndpoint != 0);
 	assert (m_pReportBuffer != 0);
-	
-	assert (m_nMaxReportSize > 0);
-	CUSBRequest *pURB = new CUSBRequest (m_pReportEndpoint, m_pReportBuffer, m_nMaxReportSize);
-	assert (pURB != 0);
-	pURB->SetCompletionRoutine (CompletionStub, 0, this);
-	
-	return GetHost ()->SubmitAsyncRequest (pURB);
+	assert (!m_bRequestPending);
+
+	if (m_pURB == 0)
+	{
+		assert (m_nMaxReportSize > 0);
+		m_pURB = new CUSBRequest (m_pReportEndpoint, m_pReportBuffer, m_nMaxReportSize);
+		assert (m_pURB != 0);
+		m_pURB->SetCompletionRoutine (CompletionStub, 0, this);
+	}
+	else
+	{
+		m_pURB->Reset ();
+	}
+
+	m_bRequestPending = TRUE;
+
+	if (!GetHost ()->SubmitAsyncRequest (m_pURB))
+	{
+		m_bRequestPending = FALSE;
+
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 void CUSBHIDDevice::CompletionRoutine (CUSBRequest *pURB)
 {
 	assert (pURB != 0);
+	assert (pURB == m_pURB);
+	assert (m_bRequestPending);
+	m_bRequestPending = FALSE;
 
 	boolean bRestart = TRUE;
 
 	if (pURB->GetStatus () != 0)
 	{
-		ReportHandler (m_pReportBuffer, pURB->GetResultLength ());
+		if (m_pReportQueue == 0)
+		{
+			ReportHandler (m_pReportBuffer, pURB->GetResultLength ());
+		}
+		else
+		{
+			TQueuedReport *pReport = m_pReportQueue->BeginWrite ();
+			if (pReport != 0)
+			{
+				pReport->nLength = pURB->GetResultLength ();
+				assert (pReport->nLength <= USBHID_QUEUED_REPORT_SIZE);
+				memcpy (pReport->Report, m_pReportBuffer, pReport->nLength);
+
+				m_pReportQueue->EndWrite (pReport);
+			}
+			else
+			{
+				m_nDroppedReports++;
+			}
+		}
 	}
 	else
 	{
@@ -231,8 +326,6 @@ void CUSBHIDDevice::CompletionRoutine (CUSBRequest *pURB)
 		}
 	}
 
-	delete pURB;
-
 	if (   bRestart
 	    && !StartRequest ())
 	{
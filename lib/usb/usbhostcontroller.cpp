@@ -2,7 +2,7 @@
 // usbhostcontroller.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,10 +20,11 @@
 #include <circle/usb/usbhostcontroller.h>
 #include <circle/usb/usbhcirootport.h>
 #include <circle/usb/usbstandardhub.h>
+#include <circle/sysconfig.h>
 #include <circle/timer.h>
 #include <assert.h>
 
-struct TPortStatusEvent
+struct TPortStatusEvent : TIntrusiveListNode
 {
 	boolean	bFromRootPort;			// from hub otherwise
 
@@ -39,7 +40,10 @@ boolean CUSBHostController::s_bPlugAndPlay;
 CUSBHostController *CUSBHostController::s_pThis = 0;
 
 CUSBHostController::CUSBHostController (boolean bPlugAndPlay)
-:	m_bFirstUpdateCall (TRUE)
+:	m_bFirstUpdateCall (TRUE),
+	m_bDeviceTreeUpdated (FALSE),
+	m_pPortStatusHandler (0),
+	m_pPortStatusParam (0)
 {
 	s_pThis = this;
 
@@ -72,7 +76,7 @@ boolean CUSBHostController::SetAddress (CUSBEndpoint *pEndpoint, u8 ucDeviceAddr
 		return FALSE;
 	}
 	
-	CTimer::Get ()->MsDelay (50);		// see USB 2.0 spec (tDSETADDR)
+	CTimer::Get ()->MsDelay (USB_SET_ADDRESS_DELAY_MS);	// see USB 2.0 spec (tDSETADDR)
 	
 	return TRUE;
 }
@@ -84,7 +88,7 @@ boolean CUSBHostController::SetConfiguration (CUSBEndpoint *pEndpoint, u8 ucConf
 		return FALSE;
 	}
 	
-	CTimer::Get ()->MsDelay (50);
+	CTimer::Get ()->MsDelay (USB_SET_CONFIG_DELAY_MS);
 	
 	return TRUE;
 }
@@ -147,14 +151,47 @@ boolean CUSBHostController::UpdatePlugAndPlay (void)
 	boolean bResult = m_bFirstUpdateCall;
 	m_bFirstUpdateCall = FALSE;
 
-	m_SpinLock.Acquire ();
+	if (m_pPortStatusHandler == 0)
+	{
+		if (ProcessPortStatusEvents ())
+		{
+			bResult = TRUE;
+		}
+	}
 
-	TPtrListElement *pElement;
-	while ((pElement  = m_HubList.GetFirst ()) != 0)
+	// the events may have been processed by a worker task in the meantime
+	if (__atomic_exchange_n (&m_bDeviceTreeUpdated, FALSE, __ATOMIC_ACQ_REL))
 	{
-		TPortStatusEvent *pEvent = (TPortStatusEvent *) m_HubList.GetPtr (pElement);
+		bResult = TRUE;
+	}
+
+	return bResult;
+}
 
-		m_HubList.Remove (pElement);
+void CUSBHostController::RegisterPortStatusHandler (TPortStatusHandler *pHandler, void *pParam)
+{
+	assert (s_bPlugAndPlay);
+
+	m_SpinLock.Acquire ();
+
+	m_pPortStatusHandler = pHandler;
+	m_pPortStatusParam = pParam;
+
+	m_SpinLock.Release ();
+}
+
+boolean CUSBHostController::ProcessPortStatusEvents (void)
+{
+	assert (s_bPlugAndPlay);
+
+	boolean bResult = FALSE;
+
+	m_SpinLock.Acquire ();
+
+	TPortStatusEvent *pEvent;
+	while ((pEvent = m_HubList.GetFirst ()) != 0)
+	{
+		m_HubList.Remove (pEvent);
 
 		m_SpinLock.Release ();
 
@@ -179,6 +216,11 @@ boolean CUSBHostController::UpdatePlugAndPlay (void)
 
 	m_SpinLock.Release ();
 
+	if (bResult)
+	{
+		__atomic_store_n (&m_bDeviceTreeUpdated, TRUE, __ATOMIC_RELEASE);
+	}
+
 	return bResult;
 }
 
@@ -194,17 +236,17 @@ void CUSBHostController::PortStatusChanged (CUSBHCIRootPort *pRootPort)
 
 	m_SpinLock.Acquire ();
 
-	TPtrListElement *pPrevElement = 0;
-	TPtrListElement *pElement = m_HubList.GetFirst ();
-	while (pElement != 0)					// find last element
-	{
-		pPrevElement = pElement;
-		pElement = m_HubList.GetNext (pElement);
-	}
+	m_HubList.InsertLast (pEvent);
 
-	m_HubList.InsertAfter (pPrevElement, pEvent);		// append to list
+	TPortStatusHandler *pHandler = m_pPortStatusHandler;
+	void *pParam = m_pPortStatusParam;
 
 	m_SpinLock.Release ();
+
+	if (pHandler != 0)
+	{
+		(*pHandler) (pParam);
+	}
 }
 
 void CUSBHostController::PortStatusChanged (CUSBStandardHub *pHub)
@@ -219,17 +261,17 @@ void CUSBHostController::PortStatusChanged (CUSBStandardHub *pHub)
 
 	m_SpinLock.Acquire ();
 
-	TPtrListElement *pPrevElement = 0;
-	TPtrListElement *pElement = m_HubList.GetFirst ();
-	while (pElement != 0)					// find last element
-	{
-		pPrevElement = pElement;
-		pElement = m_HubList.GetNext (pElement);
-	}
+	m_HubList.InsertLast (pEvent);
 
-	m_HubList.InsertAfter (pPrevElement, pEvent);		// append to list
+	TPortStatusHandler *pHandler = m_pPortStatusHandler;
+	void *pParam = m_pPortStatusParam;
 
 	m_SpinLock.Release ();
+
+	if (pHandler != 0)
+	{
+		(*pHandler) (pParam);
+	}
 }
 
 CUSBHostController *CUSBHostController::Get (void)
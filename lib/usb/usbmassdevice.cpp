@@ -28,8 +28,14 @@
 #include <circle/new.h>
 #include <assert.h>
 
+#ifdef NO_BUSY_WAIT
+	#include <circle/sched/scheduler.h>
+#endif
+
 #define MAX_TRIES	8				// max. read / write attempts
 
+#define ASYNC_MASK	(UMSD_MAX_ASYNC_REQUESTS-1)
+
 // USB Mass Storage Bulk-Only Transport
 
 // Class-specific requests
@@ -195,6 +201,23 @@ struct TSCSIWrite10
 }
 PACKED;
 
+static void SetupCBW (TCBW *pCBW, unsigned nTag, const void *pCmdBlk, size_t nCmdBlkLen,
+		      size_t nBufLen, boolean bIn)
+{
+	assert (pCBW != 0);
+	memset (pCBW, 0, sizeof *pCBW);
+
+	pCBW->dCWBSignature	     = CBWSIGNATURE;
+	pCBW->dCWBTag		     = nTag;
+	pCBW->dCBWDataTransferLength = nBufLen;
+	pCBW->bmCBWFlags	     = bIn ? CBWFLAGS_DATA_IN : 0;
+	pCBW->bCBWLUN		     = CBWLUN;
+	pCBW->bCBWCBLength	     = (u8) nCmdBlkLen;
+
+	assert (pCmdBlk != 0);
+	memcpy (pCBW->CBWCB, pCmdBlk, nCmdBlkLen);
+}
+
 CNumberPool CUSBBulkOnlyMassStorageDevice::s_DeviceNumberPool (1);
 
 static const char FromUmsd[] = "umsd";
@@ -207,8 +230,19 @@ CUSBBulkOnlyMassStorageDevice::CUSBBulkOnlyMassStorageDevice (CUSBFunction *pFun
 	m_nBlockCount (0),
 	m_ullOffset (0),
 	m_pPartitionManager (0),
+	m_nAsyncHead (0),
+	m_nAsyncTail (0),
+	m_nAsyncActive (0),
+	m_nAsyncLength (0),
+	m_AsyncState (AsyncStateIdle),
+	m_bSyncActive (FALSE),
+	m_bResetRequired (FALSE),
+	m_pAsyncCBW (new (HEAP_DMA30) u8[sizeof (TCBW)]),
+	m_pAsyncCSW (new (HEAP_DMA30) u8[sizeof (TCSW)]),
 	m_nDeviceNumber (0)
 {
+	assert (m_pAsyncCBW != 0);
+	assert (m_pAsyncCSW != 0);
 }
 
 CUSBBulkOnlyMassStorageDevice::~CUSBBulkOnlyMassStorageDevice (void)
@@ -225,6 +259,12 @@ CUSBBulkOnlyMassStorageDevice::~CUSBBulkOnlyMassStorageDevice (void)
 	delete m_pPartitionManager;
 	m_pPartitionManager = 0;
 
+	delete [] m_pAsyncCSW;
+	m_pAsyncCSW = 0;
+
+	delete [] m_pAsyncCBW;
+	m_pAsyncCBW = 0;
+
 	delete m_pEndpointOut;
 	m_pEndpointOut =  0;
 	
@@ -424,76 +464,100 @@ boolean CUSBBulkOnlyMassStorageDevice::Configure (void)
 
 int CUSBBulkOnlyMassStorageDevice::Read (void *pBuffer, size_t nCount)
 {
-	unsigned nTries = MAX_TRIES;
+	return ReadWrite (TRUE, pBuffer, nCount);
+}
 
-	int nResult;
+int CUSBBulkOnlyMassStorageDevice::Write (const void *pBuffer, size_t nCount)
+{
+	return ReadWrite (FALSE, (void *) pBuffer, nCount);
+}
 
-	do
-	{
-		nResult = TryRead (pBuffer, nCount);
+u64 CUSBBulkOnlyMassStorageDevice::Seek (u64 ullOffset)
+{
+	m_ullOffset = ullOffset;
 
-		if (nResult != (int) nCount)
-		{
-			int nStatus = Reset ();
-			if (nStatus != 0)
-			{
-				return nStatus;
-			}
-		}
-	}
-	while (   nResult != (int) nCount
-	       && --nTries > 0);
+	return m_ullOffset;
+}
 
-	return nResult;
+unsigned CUSBBulkOnlyMassStorageDevice::GetCapacity (void) const
+{
+	return m_nBlockCount;
 }
 
-int CUSBBulkOnlyMassStorageDevice::Write (const void *pBuffer, size_t nCount)
+int CUSBBulkOnlyMassStorageDevice::ReadWrite (boolean bIn, void *pBuffer, size_t nCount)
 {
-	unsigned nTries = MAX_TRIES;
+	BeginSyncAccess ();
 
-	int nResult;
+	if (m_bResetRequired)
+	{
+		m_bResetRequired = FALSE;
 
-	do
+		Reset ();
+	}
+
+	// large requests are split into commands with the maximum transfer length
+	u8 *pBuffer8 = (u8 *) pBuffer;
+	u64 ullOffset = m_ullOffset;
+	size_t nRemaining = nCount;
+	while (nRemaining > 0)
 	{
-		nResult = TryWrite (pBuffer, nCount);
+		size_t nChunk = nRemaining;
+		if (nChunk > UMSD_MAX_TRANSFER_BLOCKS * UMSD_BLOCK_SIZE)
+		{
+			nChunk = UMSD_MAX_TRANSFER_BLOCKS * UMSD_BLOCK_SIZE;
+		}
 
-		if (nResult != (int) nCount)
+		unsigned nTries = MAX_TRIES;
+
+		int nResult;
+
+		do
 		{
-			int nStatus = Reset ();
-			if (nStatus != 0)
+			nResult =   bIn
+				  ? TryRead (ullOffset, pBuffer8, nChunk)
+				  : TryWrite (ullOffset, pBuffer8, nChunk);
+
+			if (nResult != (int) nChunk)
 			{
-				return nStatus;
+				int nStatus = Reset ();
+				if (nStatus != 0)
+				{
+					EndSyncAccess ();
+
+					return nStatus;
+				}
 			}
 		}
-	}
-	while (   nResult != (int) nCount
-	       && --nTries > 0);
+		while (   nResult != (int) nChunk
+		       && --nTries > 0);
 
-	return nResult;
-}
+		if (nResult != (int) nChunk)
+		{
+			EndSyncAccess ();
 
-u64 CUSBBulkOnlyMassStorageDevice::Seek (u64 ullOffset)
-{
-	m_ullOffset = ullOffset;
+			return nResult;
+		}
 
-	return m_ullOffset;
-}
+		pBuffer8 += nChunk;
+		ullOffset += nChunk;
+		nRemaining -= nChunk;
+	}
 
-unsigned CUSBBulkOnlyMassStorageDevice::GetCapacity (void) const
-{
-	return m_nBlockCount;
+	EndSyncAccess ();
+
+	return nCount;
 }
 
-int CUSBBulkOnlyMassStorageDevice::TryRead (void *pBuffer, size_t nCount)
+int CUSBBulkOnlyMassStorageDevice::TryRead (u64 ullOffset, void *pBuffer, size_t nCount)
 {
 	assert (pBuffer != 0);
 
-	if (   (m_ullOffset & UMSD_BLOCK_MASK) != 0
-	    || m_ullOffset > UMSD_MAX_OFFSET)
+	if (   (ullOffset & UMSD_BLOCK_MASK) != 0
+	    || ullOffset > UMSD_MAX_OFFSET)
 	{
 		return -1;
 	}
-	u32 nBlockAddress = (u32) (m_ullOffset >> UMSD_BLOCK_SHIFT);
+	u32 nBlockAddress = (u32) (ullOffset >> UMSD_BLOCK_SHIFT);
 
 	if ((nCount & UMSD_BLOCK_MASK) != 0)
 	{
@@ -521,16 +585,16 @@ int CUSBBulkOnlyMassStorageDevice::TryRead (void *pBuffer, size_t nCount)
 	return nCount;
 }
 
-int CUSBBulkOnlyMassStorageDevice::TryWrite (const void *pBuffer, size_t nCount)
+int CUSBBulkOnlyMassStorageDevice::TryWrite (u64 ullOffset, const void *pBuffer, size_t nCount)
 {
 	assert (pBuffer != 0);
 
-	if (   (m_ullOffset & UMSD_BLOCK_MASK) != 0
-	    || m_ullOffset > UMSD_MAX_OFFSET)
+	if (   (ullOffset & UMSD_BLOCK_MASK) != 0
+	    || ullOffset > UMSD_MAX_OFFSET)
 	{
 		return -1;
 	}
-	u32 nBlockAddress = (u32) (m_ullOffset >> UMSD_BLOCK_SHIFT);
+	u32 nBlockAddress = (u32) (ullOffset >> UMSD_BLOCK_SHIFT);
 
 	if ((nCount & UMSD_BLOCK_MASK) != 0)
 	{
@@ -567,16 +631,7 @@ int CUSBBulkOnlyMassStorageDevice::Command (void *pCmdBlk, size_t nCmdBlkLen,
 
 	DMA_BUFFER (u8, CBWBuffer, sizeof (TCBW));
 	TCBW *pCBW = (TCBW *) CBWBuffer;
-	memset (pCBW, 0, sizeof *pCBW);
-
-	pCBW->dCWBSignature	     = CBWSIGNATURE;
-	pCBW->dCWBTag		     = ++m_nCWBTag;
-	pCBW->dCBWDataTransferLength = nBufLen;
-	pCBW->bmCBWFlags	     = bIn ? CBWFLAGS_DATA_IN : 0;
-	pCBW->bCBWLUN		     = CBWLUN;
-	pCBW->bCBWCBLength	     = (u8) nCmdBlkLen;
-
-	memcpy (pCBW->CBWCB, pCmdBlk, nCmdBlkLen);
+	SetupCBW (pCBW, ++m_nCWBTag, pCmdBlk, nCmdBlkLen, nBufLen, bIn);
 
 	CUSBHostController *pHost = GetHost ();
 	assert (pHost != 0);
@@ -724,3 +779,339 @@ int CUSBBulkOnlyMassStorageDevice::Reset (void)
 
 	return 0;
 }
+
+boolean CUSBBulkOnlyMassStorageDevice::ReadAsync (u64 ullOffset, void *pBuffer, size_t nCount,
+						  TUMSDCompletionRoutine *pRoutine, void *pParam)
+{
+	return QueueAsync (TRUE, ullOffset, pBuffer, nCount, pRoutine, pParam);
+}
+
+boolean CUSBBulkOnlyMassStorageDevice::WriteAsync (u64 ullOffset, const void *pBuffer, size_t nCount,
+						   TUMSDCompletionRoutine *pRoutine, void *pParam)
+{
+	return QueueAsync (FALSE, ullOffset, (void *) pBuffer, nCount, pRoutine, pParam);
+}
+
+boolean CUSBBulkOnlyMassStorageDevice::SubmitRequest (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+
+	return QueueAsync (!pRequest->IsWrite (), pRequest->GetOffset (),
+			   pRequest->GetBuffer (), pRequest->GetCount (),
+			   BlockRequestCompletion, pRequest);
+}
+
+void CUSBBulkOnlyMassStorageDevice::BlockRequestCompletion (int nResult, void *pParam)
+{
+	CBlockRequest *pRequest = (CBlockRequest *) pParam;
+	assert (pRequest != 0);
+
+	pRequest->Complete (nResult);
+}
+
+boolean CUSBBulkOnlyMassStorageDevice::QueueAsync (boolean bIn, u64 ullOffset,
+						   void *pBuffer, size_t nCount,
+						   TUMSDCompletionRoutine *pRoutine, void *pParam)
+{
+	assert (pRoutine != 0);
+
+	if (   pBuffer == 0
+	    || nCount == 0
+	    || !IS_CACHE_ALIGNED (pBuffer, nCount)
+	    || (nCount & UMSD_BLOCK_MASK) != 0
+	    || (ullOffset & UMSD_BLOCK_MASK) != 0
+	    || ullOffset + nCount > UMSD_MAX_OFFSET)
+	{
+		return FALSE;
+	}
+
+	// requests above the maximum transfer length are queued in parts
+	const size_t nMaxTransfer = UMSD_MAX_TRANSFER_BLOCKS * UMSD_BLOCK_SIZE;
+	unsigned nParts = (nCount + nMaxTransfer-1) / nMaxTransfer;
+
+	m_AsyncSpinLock.Acquire ();
+
+	if (m_nAsyncTail - m_nAsyncHead + nParts > UMSD_MAX_ASYNC_REQUESTS)
+	{
+		m_AsyncSpinLock.Release ();
+
+		return FALSE;
+	}
+
+	u8 *pBuffer8 = (u8 *) pBuffer;
+	u32 nBlockAddress = (u32) (ullOffset >> UMSD_BLOCK_SHIFT);
+	size_t nRemaining = nCount;
+	while (nRemaining > 0)
+	{
+		size_t nPart = nRemaining < nMaxTransfer ? nRemaining : nMaxTransfer;
+		nRemaining -= nPart;
+
+		TAsyncRequest *pRequest = &m_AsyncRequest[m_nAsyncTail++ & ASYNC_MASK];
+		pRequest->bIn		= bIn;
+		pRequest->nBlockAddress	= nBlockAddress;
+		pRequest->pBuffer	= pBuffer8;
+		pRequest->nCount	= nPart;
+		pRequest->nReport	= nRemaining == 0 ? nCount : 0;
+		pRequest->pRoutine	= nRemaining == 0 ? pRoutine : 0;
+		pRequest->pParam	= pParam;
+
+		pBuffer8 += nPart;
+		nBlockAddress += nPart >> UMSD_BLOCK_SHIFT;
+	}
+
+	boolean bStarted = m_AsyncState != AsyncStateIdle || StartAsync ();
+
+	m_AsyncSpinLock.Release ();
+
+	if (!bStarted)
+	{
+		CompleteAsync (-1);
+	}
+
+	return TRUE;
+}
+
+// returns FALSE, if the command could not be submitted (call CompleteAsync (-1) without lock)
+boolean CUSBBulkOnlyMassStorageDevice::StartAsync (void)
+{
+	assert (m_AsyncState == AsyncStateIdle || m_AsyncState == AsyncStateComplete);
+	m_AsyncState = AsyncStateIdle;
+
+	if (   m_bSyncActive
+	    || m_nAsyncHead == m_nAsyncTail)
+	{
+		return TRUE;
+	}
+
+	// combine the following requests, which continue the first one
+	const TAsyncRequest *pFirst = &m_AsyncRequest[m_nAsyncHead & ASYNC_MASK];
+	unsigned nBlocks = pFirst->nCount >> UMSD_BLOCK_SHIFT;
+	m_nAsyncActive = 1;
+
+	while (m_nAsyncHead + m_nAsyncActive != m_nAsyncTail)
+	{
+		const TAsyncRequest *pNext =
+			&m_AsyncRequest[(m_nAsyncHead + m_nAsyncActive) & ASYNC_MASK];
+		unsigned nNextBlocks = pNext->nCount >> UMSD_BLOCK_SHIFT;
+
+		if (   pNext->bIn != pFirst->bIn
+		    || pNext->nBlockAddress != pFirst->nBlockAddress + nBlocks
+		    || pNext->pBuffer != pFirst->pBuffer + (nBlocks << UMSD_BLOCK_SHIFT)
+		    || nBlocks + nNextBlocks > UMSD_MAX_TRANSFER_BLOCKS)
+		{
+			break;
+		}
+
+		nBlocks += nNextBlocks;
+		m_nAsyncActive++;
+	}
+
+	m_nAsyncLength = nBlocks << UMSD_BLOCK_SHIFT;
+
+	// READ(10) and WRITE(10) have the same layout
+	TSCSIRead10 SCSICmd;
+	SCSICmd.OperationCode		= pFirst->bIn ? SCSI_OP_READ : SCSI_OP_WRITE;
+	SCSICmd.Reserved1		= pFirst->bIn ? 0 : SCSI_WRITE_FUA;
+	SCSICmd.LogicalBlockAddress	= le2be32 (pFirst->nBlockAddress);
+	SCSICmd.Reserved2		= 0;
+	SCSICmd.TransferLength		= le2be16 ((u16) nBlocks);
+	SCSICmd.Control			= SCSI_CONTROL;
+
+	SetupCBW ((TCBW *) m_pAsyncCBW, ++m_nCWBTag, &SCSICmd, sizeof SCSICmd,
+		  m_nAsyncLength, pFirst->bIn);
+
+	m_AsyncState = AsyncStateCBW;
+
+	if (!SubmitAsync (m_pEndpointOut, m_pAsyncCBW, sizeof (TCBW)))
+	{
+		m_AsyncState = AsyncStateComplete;
+		m_bResetRequired = TRUE;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean CUSBBulkOnlyMassStorageDevice::SubmitAsync (CUSBEndpoint *pEndpoint,
+						    void *pBuffer, size_t nLength)
+{
+	CUSBRequest *pURB = new CUSBRequest (pEndpoint, pBuffer, nLength);
+	assert (pURB != 0);
+	pURB->SetCompletionRoutine (AsyncCompletionStub, 0, this);
+
+	CUSBHostController *pHost = GetHost ();
+	assert (pHost != 0);
+	if (!pHost->SubmitAsyncRequest (pURB))
+	{
+		delete pURB;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CUSBBulkOnlyMassStorageDevice::AsyncCompletion (CUSBRequest *pURB)
+{
+	assert (pURB != 0);
+	boolean bOK = pURB->GetStatus () != 0;
+	u32 nLength = pURB->GetResultLength ();
+
+	delete pURB;
+
+	m_AsyncSpinLock.Acquire ();
+
+	const TAsyncRequest *pFirst = &m_AsyncRequest[m_nAsyncHead & ASYNC_MASK];
+
+	switch (m_AsyncState)
+	{
+	case AsyncStateCBW:
+		if (!bOK)
+		{
+			break;
+		}
+
+		m_AsyncState = AsyncStateData;
+		if (SubmitAsync (pFirst->bIn ? m_pEndpointIn : m_pEndpointOut,
+				 pFirst->pBuffer, m_nAsyncLength))
+		{
+			m_AsyncSpinLock.Release ();
+
+			return;
+		}
+		break;
+
+	case AsyncStateData:
+		if (   !bOK
+		    || nLength != m_nAsyncLength)
+		{
+			break;
+		}
+
+		m_AsyncState = AsyncStateCSW;
+		if (SubmitAsync (m_pEndpointIn, m_pAsyncCSW, sizeof (TCSW)))
+		{
+			m_AsyncSpinLock.Release ();
+
+			return;
+		}
+		break;
+
+	case AsyncStateCSW: {
+		const TCSW *pCSW = (const TCSW *) m_pAsyncCSW;
+		if (   bOK
+		    && nLength == sizeof (TCSW)
+		    && pCSW->dCSWSignature == CSWSIGNATURE
+		    && pCSW->dCSWTag == m_nCWBTag
+		    && pCSW->bCSWStatus == CSWSTATUS_PASSED
+		    && pCSW->dCSWDataResidue == 0)
+		{
+			m_AsyncState = AsyncStateComplete;
+
+			m_AsyncSpinLock.Release ();
+
+			CompleteAsync (m_nAsyncLength);
+
+			return;
+		}
+		} break;
+
+	default:
+		assert (0);
+		break;
+	}
+
+	// the device will be reset by the next synchronous access
+	m_AsyncState = AsyncStateComplete;
+	m_bResetRequired = TRUE;
+
+	m_AsyncSpinLock.Release ();
+
+	CLogger::Get ()->Write (FromUmsd, LogError, "Async transfer failed");
+
+	CompleteAsync (-1);
+}
+
+void CUSBBulkOnlyMassStorageDevice::CompleteAsync (int nResult)
+{
+	assert (m_AsyncState == AsyncStateComplete);
+
+	// the completed requests are not touched by the producers, no lock needed here
+	unsigned nCompleted = nResult < 0 ? m_nAsyncTail - m_nAsyncHead : m_nAsyncActive;
+	for (unsigned i = 0; i < nCompleted; i++)
+	{
+		const TAsyncRequest *pRequest = &m_AsyncRequest[(m_nAsyncHead + i) & ASYNC_MASK];
+		if (pRequest->pRoutine != 0)
+		{
+			(*pRequest->pRoutine) (nResult < 0 ? nResult : (int) pRequest->nReport,
+					       pRequest->pParam);
+		}
+	}
+
+	m_AsyncSpinLock.Acquire ();
+
+	m_nAsyncHead += nCompleted;
+	m_nAsyncActive = 0;
+
+	boolean bStarted = StartAsync ();
+
+	m_AsyncSpinLock.Release ();
+
+	if (!bStarted)
+	{
+		CompleteAsync (-1);
+	}
+}
+
+void CUSBBulkOnlyMassStorageDevice::AsyncCompletionStub (CUSBRequest *pURB, void *pParam,
+							 void *pContext)
+{
+	CUSBBulkOnlyMassStorageDevice *pThis = (CUSBBulkOnlyMassStorageDevice *) pContext;
+	assert (pThis != 0);
+
+	pThis->AsyncCompletion (pURB);
+}
+
+void CUSBBulkOnlyMassStorageDevice::BeginSyncAccess (void)
+{
+	while (1)
+	{
+		m_AsyncSpinLock.Acquire ();
+
+		if (   m_AsyncState == AsyncStateIdle
+		    && m_nAsyncHead == m_nAsyncTail)
+		{
+			assert (!m_bSyncActive);
+			m_bSyncActive = TRUE;
+
+			m_AsyncSpinLock.Release ();
+
+			return;
+		}
+
+		m_AsyncSpinLock.Release ();
+
+#ifdef NO_BUSY_WAIT
+		CScheduler::Get ()->Yield ();
+#endif
+	}
+}
+
+void CUSBBulkOnlyMassStorageDevice::EndSyncAccess (void)
+{
+	m_AsyncSpinLock.Acquire ();
+
+	assert (m_bSyncActive);
+	m_bSyncActive = FALSE;
+
+	// continue with requests, which have been queued in the meantime
+	boolean bStarted = StartAsync ();
+
+	m_AsyncSpinLock.Release ();
+
+	if (!bStarted)
+	{
+		CompleteAsync (-1);
+	}
+}
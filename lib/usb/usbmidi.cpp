@@ -55,6 +55,10 @@ CUSBMIDIDevice::CUSBMIDIDevice (CUSBFunction *pFunction)
 	m_pPacketBuffer (0),
 	m_hTimer (0),
 	m_bAllSoundOff (FALSE),
+	m_pEventQueue (0),
+	m_nDroppedEvents (0),
+	m_pSendBatch (0),
+	m_nSendBatchValid (0),
 	m_nDeviceNumber (0)
 {
 }
@@ -77,6 +81,12 @@ CUSBMIDIDevice::~CUSBMIDIDevice (void)
 	delete [] m_pPacketBuffer;
 	m_pPacketBuffer = 0;
 
+	delete [] m_pSendBatch;
+	m_pSendBatch = 0;
+
+	delete m_pEventQueue;
+	m_pEventQueue = 0;
+
 	delete m_pEndpointIn;
 	m_pEndpointIn = 0;
 
@@ -347,6 +357,61 @@ boolean CUSBMIDIDevice::SendPlainMIDI (unsigned nCable, const u8 *pData, unsigne
 	return GetHost ()->Transfer (m_pEndpointOut, Buffer, nBufferValid) == (int) nBufferValid;
 }
 
+void CUSBMIDIDevice::EnableEventQueue (unsigned nSize)
+{
+	assert (m_pEventQueue == 0);
+	m_pEventQueue = new CSPSCRing<TUSBMIDIEvent> (nSize);
+	assert (m_pEventQueue != 0);
+}
+
+boolean CUSBMIDIDevice::GetEvent (TUSBMIDIEvent *pEvent)
+{
+	assert (m_pEventQueue != 0);
+	return m_pEventQueue->Read (pEvent);
+}
+
+boolean CUSBMIDIDevice::AddEventPacket (const u8 *pPacket)
+{
+	assert (pPacket != 0);
+
+	if (m_pEndpointOut == 0)
+	{
+		return FALSE;
+	}
+
+	if (m_pSendBatch == 0)
+	{
+		m_pSendBatch = new u8[USB_MIDI_SEND_BATCH_SIZE * EVENT_PACKET_SIZE];
+		assert (m_pSendBatch != 0);
+	}
+
+	assert (m_nSendBatchValid < USB_MIDI_SEND_BATCH_SIZE * EVENT_PACKET_SIZE);
+	memcpy (m_pSendBatch + m_nSendBatchValid, pPacket, EVENT_PACKET_SIZE);
+	m_nSendBatchValid += EVENT_PACKET_SIZE;
+
+	if (m_nSendBatchValid == USB_MIDI_SEND_BATCH_SIZE * EVENT_PACKET_SIZE)
+	{
+		return FlushEventPackets ();
+	}
+
+	return TRUE;
+}
+
+boolean CUSBMIDIDevice::FlushEventPackets (void)
+{
+	if (m_nSendBatchValid == 0)
+	{
+		return TRUE;
+	}
+
+	assert (m_pSendBatch != 0);
+	boolean bOK = SendEventPackets (m_pSendBatch, m_nSendBatchValid);
+
+	m_nSendBatchValid = 0;
+
+	return bOK;
+}
+
 void CUSBMIDIDevice::SetAllSoundOffOnUSBError (boolean bEnable)
 {
 	m_bAllSoundOff = bEnable;
@@ -386,12 +451,7 @@ void CUSBMIDIDevice::CompletionRoutine (CUSBRequest *pURB)
 			// generate as padding in spite of their status as reserved.
 			if (pPacket[0] != 0)
 			{
-				if (m_pPacketHandler != 0)
-				{
-					unsigned nCable = pPacket[0] >> 4;
-					unsigned nLength = cin_to_length[pPacket[0] & 0x0F];
-					(*m_pPacketHandler) (nCable, pPacket+1, nLength);
-				}
+				HandlePacket (pPacket);
 
 				bRestart = TRUE;
 			}
@@ -400,12 +460,12 @@ void CUSBMIDIDevice::CompletionRoutine (CUSBRequest *pURB)
 	else if (   m_bAllSoundOff
 		 && !pURB->GetStatus ()
 		 && pURB->GetUSBError () != USBErrorUnknown
-		 && m_pPacketHandler)
+		 && (m_pPacketHandler || m_pEventQueue))
 	{
 		for (u8 nChannel = 0; nChannel < 16; nChannel++)
 		{
-			u8 AllSoundOff[] = {(u8) (0xB0 | nChannel), 120, 0};
-			(*m_pPacketHandler) (0, AllSoundOff, sizeof AllSoundOff);
+			u8 AllSoundOff[] = {0x0B, (u8) (0xB0 | nChannel), 120, 0};	// cable 0
+			HandlePacket (AllSoundOff);
 		}
 	}
 
@@ -424,6 +484,33 @@ void CUSBMIDIDevice::CompletionRoutine (CUSBRequest *pURB)
 	}
 }
 
+void CUSBMIDIDevice::HandlePacket (const u8 *pPacket)
+{
+	assert (pPacket != 0);
+
+	if (m_pEventQueue != 0)
+	{
+		TUSBMIDIEvent *pEvent = m_pEventQueue->BeginWrite ();
+		if (pEvent == 0)
+		{
+			m_nDroppedEvents++;
+
+			return;
+		}
+
+		pEvent->nTimestamp = CTimer::GetClockTicks ();
+		memcpy (pEvent->Packet, pPacket, EVENT_PACKET_SIZE);
+
+		m_pEventQueue->EndWrite (pEvent);
+	}
+	else if (m_pPacketHandler != 0)
+	{
+		unsigned nCable = pPacket[0] >> 4;
+		unsigned nLength = cin_to_length[pPacket[0] & 0x0F];
+		(*m_pPacketHandler) (nCable, (u8 *) pPacket+1, nLength);
+	}
+}
+
 void CUSBMIDIDevice::CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext)
 {
 	CUSBMIDIDevice *pThis = (CUSBMIDIDevice *) pContext;
@@ -0,0 +1,74 @@
+//
+// usbplugandplaytask.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/usb/usbplugandplaytask.h>
+#include <assert.h>
+
+CUSBPlugAndPlayTask::CUSBPlugAndPlayTask (CUSBHostController *pHost, unsigned nPriority)
+:	m_pHost (pHost),
+	m_bStop (FALSE)
+{
+	SetName ("usbpnp");
+	SetPriority (nPriority);
+
+	assert (m_pHost != 0);
+	assert (CUSBHostController::IsPlugAndPlay ());
+	m_pHost->RegisterPortStatusHandler (PortStatusHandler, this);
+}
+
+CUSBPlugAndPlayTask::~CUSBPlugAndPlayTask (void)
+{
+	assert (m_pHost != 0);
+	m_pHost->RegisterPortStatusHandler (0);
+
+	m_pHost = 0;
+}
+
+void CUSBPlugAndPlayTask::Stop (void)
+{
+	m_bStop = TRUE;
+	m_Event.Set ();
+
+	WaitForTermination ();
+}
+
+void CUSBPlugAndPlayTask::Run (void)
+{
+	assert (m_pHost != 0);
+
+	while (!m_bStop)
+	{
+		// events, which are queued while processing, set the event again
+		m_Event.Clear ();
+
+		m_pHost->ProcessPortStatusEvents ();
+
+		m_Event.Wait ();
+	}
+
+	m_pHost->RegisterPortStatusHandler (0);
+}
+
+void CUSBPlugAndPlayTask::PortStatusHandler (void *pParam)
+{
+	CUSBPlugAndPlayTask *pThis = (CUSBPlugAndPlayTask *) pParam;
+	assert (pThis != 0);
+
+	pThis->m_Event.Set ();
+}
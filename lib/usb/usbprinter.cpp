@@ -2,7 +2,7 @@
 // usbprinter.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,8 +21,13 @@
 #include <circle/usb/usbhostcontroller.h>
 #include <circle/devicenameservice.h>
 #include <circle/logger.h>
+#include <circle/util.h>
 #include <assert.h>
 
+#ifdef NO_BUSY_WAIT
+	#include <circle/sched/scheduler.h>
+#endif
+
 CNumberPool CUSBPrinterDevice::s_DeviceNumberPool (1);
 
 static const char FromPrinter[] = "uprn";
@@ -33,8 +38,21 @@ CUSBPrinterDevice::CUSBPrinterDevice (CUSBFunction *pFunction)
 	m_Protocol (USBPrinterProtocolUnknown),
 	m_pEndpointIn (0),
 	m_pEndpointOut (0),
-	m_nDeviceNumber (0)
+	m_nDeviceNumber (0),
+	m_nCompleteIndex (0),
+	m_nSubmitIndex (0),
+	m_nFillIndex (0),
+	m_bError (FALSE),
+	m_nBytesPrinted (0),
+	m_pProgressHandler (0),
+	m_pProgressParam (0)
 {
+	for (unsigned i = 0; i < USB_PRINTER_CHUNKS; i++)
+	{
+		m_Chunk[i].pBuffer = 0;
+		m_Chunk[i].nLength = 0;
+		m_Chunk[i].pURB = 0;
+	}
 }
 
 CUSBPrinterDevice::~CUSBPrinterDevice (void)
@@ -46,6 +64,15 @@ CUSBPrinterDevice::~CUSBPrinterDevice (void)
 		s_DeviceNumberPool.FreeNumber (m_nDeviceNumber);
 	}
 
+	for (unsigned i = 0; i < USB_PRINTER_CHUNKS; i++)
+	{
+		delete m_Chunk[i].pURB;
+		m_Chunk[i].pURB = 0;
+
+		delete [] m_Chunk[i].pBuffer;
+		m_Chunk[i].pBuffer = 0;
+	}
+
 	delete m_pEndpointOut;
 	m_pEndpointOut =  0;
 	
@@ -146,3 +173,184 @@ int CUSBPrinterDevice::Write (const void *pBuffer, size_t nCount)
 
 	return nCount;
 }
+
+int CUSBPrinterDevice::WriteAsync (const void *pBuffer, size_t nCount)
+{
+	assert (pBuffer != 0);
+	assert (nCount > 0);
+
+	const u8 *pData = (const u8 *) pBuffer;
+	size_t nRemain = nCount;
+	while (nRemain > 0)
+	{
+		// the chunk at m_nFillIndex must not be in use
+		WaitForChunks (USB_PRINTER_CHUNKS-1);
+		if (m_bError)
+		{
+			return -1;
+		}
+
+		TChunk *pChunk = &m_Chunk[m_nFillIndex % USB_PRINTER_CHUNKS];
+		if (pChunk->pBuffer == 0)
+		{
+			pChunk->pBuffer = new u8[USB_PRINTER_CHUNK_SIZE];
+			assert (pChunk->pBuffer != 0);
+		}
+
+		unsigned nBytes = USB_PRINTER_CHUNK_SIZE - pChunk->nLength;
+		if (nBytes > nRemain)
+		{
+			nBytes = nRemain;
+		}
+
+		memcpy (pChunk->pBuffer + pChunk->nLength, pData, nBytes);
+		pChunk->nLength += nBytes;
+		pData += nBytes;
+		nRemain -= nBytes;
+
+		if (pChunk->nLength == USB_PRINTER_CHUNK_SIZE)
+		{
+			m_SpinLock.Acquire ();
+
+			m_nFillIndex++;
+			SubmitChunks ();
+
+			m_SpinLock.Release ();
+		}
+	}
+
+	return nCount;
+}
+
+boolean CUSBPrinterDevice::Flush (void)
+{
+	if (m_Chunk[m_nFillIndex % USB_PRINTER_CHUNKS].nLength > 0)
+	{
+		WaitForChunks (USB_PRINTER_CHUNKS-1);
+
+		m_SpinLock.Acquire ();
+
+		m_nFillIndex++;
+		SubmitChunks ();
+
+		m_SpinLock.Release ();
+	}
+
+	WaitForChunks (0);
+
+	boolean bResult = !m_bError;
+	m_bError = FALSE;
+
+	return bResult;
+}
+
+void CUSBPrinterDevice::RegisterProgressHandler (TUSBPrinterProgressHandler *pHandler,
+						 void *pParam)
+{
+	m_pProgressParam = pParam;
+	m_pProgressHandler = pHandler;
+}
+
+void CUSBPrinterDevice::SubmitChunks (void)
+{
+	while (   m_nSubmitIndex != m_nFillIndex
+	       && m_nSubmitIndex - m_nCompleteIndex < USB_PRINTER_MAX_ACTIVE)
+	{
+		TChunk *pChunk = &m_Chunk[m_nSubmitIndex % USB_PRINTER_CHUNKS];
+		assert (pChunk->nLength > 0);
+
+		assert (pChunk->pURB == 0);
+		assert (m_pEndpointOut != 0);
+		pChunk->pURB = new CUSBRequest (m_pEndpointOut, pChunk->pBuffer, pChunk->nLength);
+		assert (pChunk->pURB != 0);
+		pChunk->pURB->SetCompletionRoutine (CompletionStub, 0, this);
+
+		m_nSubmitIndex++;
+
+		if (!GetHost ()->SubmitAsyncRequest (pChunk->pURB))
+		{
+			// the chunk is retired in order, the following chunks are sent nevertheless
+			delete pChunk->pURB;
+			pChunk->pURB = 0;
+
+			m_bError = TRUE;
+
+			RetireFailedChunks ();
+		}
+	}
+}
+
+void CUSBPrinterDevice::RetireFailedChunks (void)
+{
+	while (m_nCompleteIndex != m_nSubmitIndex)
+	{
+		TChunk *pChunk = &m_Chunk[m_nCompleteIndex % USB_PRINTER_CHUNKS];
+		if (pChunk->pURB != 0)
+		{
+			break;
+		}
+
+		pChunk->nLength = 0;
+
+		m_nCompleteIndex++;
+	}
+}
+
+void CUSBPrinterDevice::WaitForChunks (unsigned nMaxBusy)
+{
+	while (m_nFillIndex - m_nCompleteIndex > nMaxBusy)
+	{
+#ifdef NO_BUSY_WAIT
+		CScheduler::Get ()->Yield ();
+#endif
+	}
+}
+
+void CUSBPrinterDevice::CompletionRoutine (CUSBRequest *pURB)
+{
+	assert (pURB != 0);
+
+	m_SpinLock.Acquire ();
+
+	// the chunks are completed in order, they are sent to the same endpoint
+	TChunk *pChunk = &m_Chunk[m_nCompleteIndex % USB_PRINTER_CHUNKS];
+	assert (pChunk->pURB == pURB);
+
+	boolean bStatus = pURB->GetStatus () != 0;
+	if (bStatus)
+	{
+		m_nBytesPrinted += pURB->GetResultLength ();
+	}
+	else
+	{
+		m_bError = TRUE;
+	}
+
+	delete pChunk->pURB;
+	pChunk->pURB = 0;
+	pChunk->nLength = 0;
+
+	m_nCompleteIndex++;
+
+	RetireFailedChunks ();
+	SubmitChunks ();
+
+	TUSBPrinterProgressHandler *pHandler = m_pProgressHandler;
+	void *pParam = m_pProgressParam;
+	u64 nBytesPrinted = m_nBytesPrinted;
+
+	m_SpinLock.Release ();
+
+	if (pHandler != 0)
+	{
+		(*pHandler) (nBytesPrinted, bStatus, pParam);
+	}
+}
+
+void CUSBPrinterDevice::CompletionStub (CUSBRequest *pURB, void *pParam, void *pContext)
+{
+	CUSBPrinterDevice *pThis = (CUSBPrinterDevice *) pContext;
+	assert (pThis != 0);
+
+	pThis->CompletionRoutine (pURB);
+}
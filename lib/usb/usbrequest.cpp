@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/usb/usbrequest.h>
+#include <circle/tracer.h>
 #include <assert.h>
 
 CUSBRequest::CUSBRequest (CUSBEndpoint *pEndpoint, void *pBuffer, u32 nBufLen, TSetupData *pSetupData)
@@ -31,7 +32,9 @@ CUSBRequest::CUSBRequest (CUSBEndpoint *pEndpoint, void *pBuffer, u32 nBufLen, T
 	m_pCompletionRoutine (0),
 	m_pCompletionParam (0),
 	m_pCompletionContext (0),
-	m_bCompleteOnNAK (FALSE)
+	m_bCompleteOnNAK (FALSE),
+	m_nNumIsoPackets (0),
+	m_nIsoPacketsLength (0)
 {
 	assert (m_pEndpoint != 0);
 	assert (m_pBuffer != 0 || m_nBufLen == 0);
@@ -118,10 +121,24 @@ void CUSBRequest::SetCompletionRoutine (TURBCompletionRoutine *pRoutine, void *p
 void CUSBRequest::CallCompletionRoutine (void)
 {
 	assert (m_pCompletionRoutine != 0);
-	
+
+	TRACEPOINT (TRACER_EVENT_USB_COMPLETE, (uintptr) this, m_bStatus, m_nResultLen);
+
 	(*m_pCompletionRoutine) (this, m_pCompletionParam, m_pCompletionContext);
 }
 
+void CUSBRequest::Reset (void)
+{
+	m_bStatus = 0;
+	m_nResultLen = 0;
+	m_USBError = USBErrorUnknown;
+
+	for (unsigned i = 0; i < m_nNumIsoPackets; i++)
+	{
+		m_IsoPacket[i].usResultLength = 0;
+	}
+}
+
 void CUSBRequest::SetCompleteOnNAK (void)
 {
 	m_bCompleteOnNAK = TRUE;
@@ -132,4 +149,51 @@ boolean CUSBRequest::IsCompleteOnNAK (void) const
 	return m_bCompleteOnNAK;
 }
 
+boolean CUSBRequest::AddIsoPacket (u16 usLength)
+{
+	assert (m_pEndpoint->GetType () == EndpointTypeIsochronous);
+
+	if (   m_nNumIsoPackets >= USB_MAX_ISO_PACKETS
+	    || m_nIsoPacketsLength + usLength > m_nBufLen)
+	{
+		return FALSE;
+	}
+
+	m_IsoPacket[m_nNumIsoPackets].usLength = usLength;
+	m_IsoPacket[m_nNumIsoPackets].usResultLength = 0;
+	m_nNumIsoPackets++;
+
+	m_nIsoPacketsLength += usLength;
+
+	return TRUE;
+}
+
+unsigned CUSBRequest::GetNumIsoPackets (void) const
+{
+	return m_nNumIsoPackets;
+}
+
+u16 CUSBRequest::GetIsoPacketLength (unsigned nPacket) const
+{
+	assert (nPacket < m_nNumIsoPackets);
+
+	return m_IsoPacket[nPacket].usLength;
+}
+
+void CUSBRequest::SetIsoPacketResultLength (unsigned nPacket, u16 usLength)
+{
+	assert (nPacket < m_nNumIsoPackets);
+	assert (usLength <= m_IsoPacket[nPacket].usLength);
+
+	m_IsoPacket[nPacket].usResultLength = usLength;
+}
+
+u16 CUSBRequest::GetIsoPacketResultLength (unsigned nPacket) const
+{
+	assert (m_bStatus);
+	assert (nPacket < m_nNumIsoPackets);
+
+	return m_IsoPacket[nPacket].usResultLength;
+}
+
 IMPLEMENT_CLASS_ALLOCATOR (CUSBRequest)
@@ -45,8 +45,30 @@ CUSBSerialDevice::CUSBSerialDevice (CUSBFunction *pFunction, size_t nReadHeaderB
 	m_nBufferInValid (0),
 	m_nBufferInPtr (0),
 	m_bInRequestActive (FALSE),
+#if RASPPI >= 4
+	m_nRxBufferSize (0),
+	m_bRxStarted (FALSE),
+	m_pRxRing (0),
+	m_pTxURB (0),
+	m_pTxBuffer (0),
+	m_bTxActive (FALSE),
+	m_bTxError (FALSE),
+	m_pTxRing (0),
+	m_TxSpinLock (IRQ_LEVEL),
+	m_pTransmitHandler (0),
+	m_pTransmitParam (0),
+	m_nTxLowWater (0),
+#endif
+	m_nRxOverruns (0),
 	m_nDeviceNumber (0)
 {
+#if RASPPI >= 4
+	for (unsigned i = 0; i < USB_SERIAL_RX_URBS; i++)
+	{
+		m_pRxURB[i] = 0;
+		m_pRxBuffer[i] = 0;
+	}
+#endif
 }
 
 CUSBSerialDevice::~CUSBSerialDevice (void)
@@ -58,6 +80,30 @@ CUSBSerialDevice::~CUSBSerialDevice (void)
 		s_DeviceNumberPool.FreeNumber (m_nDeviceNumber);
 	}
 
+#if RASPPI >= 4
+	// the xHCI slot has been disabled already, pending URBs do not complete any more
+	for (unsigned i = 0; i < USB_SERIAL_RX_URBS; i++)
+	{
+		delete m_pRxURB[i];
+		m_pRxURB[i] = 0;
+
+		delete [] m_pRxBuffer[i];
+		m_pRxBuffer[i] = 0;
+	}
+
+	delete m_pTxURB;
+	m_pTxURB = 0;
+
+	delete [] m_pTxBuffer;
+	m_pTxBuffer = 0;
+
+	delete m_pRxRing;
+	m_pRxRing = 0;
+
+	delete m_pTxRing;
+	m_pTxRing = 0;
+#endif
+
 	delete m_pEndpointOut;
 	m_pEndpointOut =  0;
 	
@@ -113,6 +159,24 @@ boolean CUSBSerialDevice::Configure (void)
 	m_pBufferIn = new u8[m_nBufferInSize];
 	assert (m_pBufferIn != 0);
 
+#if RASPPI >= 4
+	m_nRxBufferSize = m_nBufferInSize * USB_SERIAL_RX_PACKETS;
+	for (unsigned i = 0; i < USB_SERIAL_RX_URBS; i++)
+	{
+		m_pRxBuffer[i] = new u8[m_nRxBufferSize];
+		assert (m_pRxBuffer[i] != 0);
+	}
+
+	m_pRxRing = new CSPSCRing<u8> (USB_SERIAL_RING_SIZE);
+	assert (m_pRxRing != 0);
+
+	m_pTxBuffer = new u8[USB_SERIAL_TX_MAX_SIZE];
+	assert (m_pTxBuffer != 0);
+
+	m_pTxRing = new CSPSCRing<u8> (USB_SERIAL_RING_SIZE);
+	assert (m_pTxRing != 0);
+#endif
+
 	if (!CUSBFunction::Configure ())
 	{
 		CLogger::Get ()->Write (FromSerial, LogError, "Cannot set interface");
@@ -133,7 +197,39 @@ int CUSBSerialDevice::Write (const void *pBuffer, size_t nCount)
 	assert (pBuffer != 0);
 	assert (nCount > 0);
 
-#if RASPPI <= 3
+#if RASPPI >= 4
+	const u8 *pData = (const u8 *) pBuffer;
+	size_t nRemain = nCount;
+	while (nRemain > 0)
+	{
+		assert (m_pTxRing != 0);
+		unsigned nWritten = m_pTxRing->WriteMultiple (pData, nRemain);
+		pData += nWritten;
+		nRemain -= nWritten;
+
+		m_TxSpinLock.Acquire ();
+
+		if (m_bTxError)
+		{
+			m_bTxError = FALSE;
+
+			m_TxSpinLock.Release ();
+
+			CLogger::Get ()->Write (FromSerial, LogWarning, "USB write failed");
+
+			return -1;
+		}
+
+		if (!m_bTxActive)
+		{
+			StartTransmit ();
+		}
+
+		m_TxSpinLock.Release ();
+	}
+
+	return nCount;
+#else
 	// USB host controller does not allow concurrent split transactions
 	// to same device. Thus wait for completion of pending IN request.
 	do
@@ -141,7 +237,6 @@ int CUSBSerialDevice::Write (const void *pBuffer, size_t nCount)
 		DataMemBarrier ();
 	}
 	while (m_bInRequestActive);
-#endif
 
 	CUSBHostController *pHost = GetHost ();
 	assert (pHost != 0);
@@ -157,6 +252,7 @@ int CUSBSerialDevice::Write (const void *pBuffer, size_t nCount)
 	}
 
 	return nActual;
+#endif
 }
 
 int CUSBSerialDevice::Read (void *pBuffer, size_t nCount)
@@ -164,6 +260,18 @@ int CUSBSerialDevice::Read (void *pBuffer, size_t nCount)
 	assert (pBuffer != 0);
 	assert (nCount > 0);
 
+#if RASPPI >= 4
+	if (   !m_bRxStarted
+	    && !StartReceive ())
+	{
+		CLogger::Get ()->Write (FromSerial, LogWarning, "USB read failed");
+
+		return -1;
+	}
+
+	assert (m_pRxRing != 0);
+	return m_pRxRing->ReadMultiple ((u8 *) pBuffer, nCount);
+#else
 	DataMemBarrier ();
 
 	if (m_bInRequestActive)
@@ -216,6 +324,7 @@ int CUSBSerialDevice::Read (void *pBuffer, size_t nCount)
 	m_nBufferInPtr += nCount;
 
 	return nCount;
+#endif
 }
 
 boolean CUSBSerialDevice::SetBaudRate (unsigned nBaudRate)
@@ -273,3 +382,173 @@ void CUSBSerialDevice::CompletionStub (CUSBRequest *pURB, void *pParam, void *pC
 
 	pThis->CompletionRoutine (pURB);
 }
+
+#if RASPPI >= 4
+
+void CUSBSerialDevice::RegisterTransmitHandler (TUSBSerialTransmitHandler *pHandler, void *pParam,
+						unsigned nLowWater)
+{
+	assert (nLowWater <= USB_SERIAL_RING_SIZE);
+
+	m_TxSpinLock.Acquire ();
+
+	m_pTransmitHandler = pHandler;
+	m_pTransmitParam = pParam;
+	m_nTxLowWater = nLowWater;
+
+	m_TxSpinLock.Release ();
+}
+
+boolean CUSBSerialDevice::StartReceive (void)
+{
+	assert (!m_bRxStarted);
+	m_bRxStarted = TRUE;
+
+	CUSBHostController *pHost = GetHost ();
+	assert (pHost != 0);
+
+	// the requests are not completed on NAK, so they are always pending
+	for (unsigned i = 0; i < USB_SERIAL_RX_URBS; i++)
+	{
+		assert (m_pRxURB[i] == 0);
+		assert (m_pEndpointIn != 0);
+		assert (m_pRxBuffer[i] != 0);
+		m_pRxURB[i] = new CUSBRequest (m_pEndpointIn, m_pRxBuffer[i], m_nRxBufferSize);
+		assert (m_pRxURB[i] != 0);
+
+		m_pRxURB[i]->SetCompletionRoutine (ReceiveCompletionStub, (void *) (uintptr) i, this);
+
+		if (!pHost->SubmitAsyncRequest (m_pRxURB[i]))
+		{
+			delete m_pRxURB[i];
+			m_pRxURB[i] = 0;
+
+			return i > 0;
+		}
+	}
+
+	return TRUE;
+}
+
+void CUSBSerialDevice::ReceiveCompletionRoutine (CUSBRequest *pURB, unsigned nURB)
+{
+	assert (pURB != 0);
+	assert (nURB < USB_SERIAL_RX_URBS);
+	assert (pURB == m_pRxURB[nURB]);
+
+	if (pURB->GetStatus () == 0)
+	{
+		CLogger::Get ()->Write (FromSerial, LogWarning, "USB read failed");
+
+		return;			// URB is deleted in destructor
+	}
+
+	// each packet starts with the read header (if any)
+	const u8 *pData = m_pRxBuffer[nURB];
+	size_t nLength = pURB->GetResultLength ();
+	while (nLength > 0)
+	{
+		size_t nPacket = nLength < m_nBufferInSize ? nLength : m_nBufferInSize;
+		nLength -= nPacket;
+
+		if (nPacket > m_nReadHeaderBytes)
+		{
+			unsigned nBytes = nPacket - m_nReadHeaderBytes;
+
+			assert (m_pRxRing != 0);
+			m_nRxOverruns += nBytes - m_pRxRing->WriteMultiple (pData + m_nReadHeaderBytes,
+									    nBytes);
+		}
+
+		pData += nPacket;
+	}
+
+	pURB->Reset ();
+
+	if (!GetHost ()->SubmitAsyncRequest (pURB))
+	{
+		CLogger::Get ()->Write (FromSerial, LogWarning, "Cannot restart read");
+	}
+}
+
+void CUSBSerialDevice::ReceiveCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext)
+{
+	CUSBSerialDevice *pThis = (CUSBSerialDevice *) pContext;
+	assert (pThis != 0);
+
+	pThis->ReceiveCompletionRoutine (pURB, (unsigned) (uintptr) pParam);
+}
+
+void CUSBSerialDevice::StartTransmit (void)
+{
+	assert (!m_bTxActive);
+
+	assert (m_pTxRing != 0);
+	assert (m_pTxBuffer != 0);
+	unsigned nLength = m_pTxRing->ReadMultiple (m_pTxBuffer, USB_SERIAL_TX_MAX_SIZE);
+	if (nLength == 0)
+	{
+		return;
+	}
+
+	assert (m_pTxURB == 0);
+	assert (m_pEndpointOut != 0);
+	m_pTxURB = new CUSBRequest (m_pEndpointOut, m_pTxBuffer, nLength);
+	assert (m_pTxURB != 0);
+	m_pTxURB->SetCompletionRoutine (TransmitCompletionStub, 0, this);
+
+	m_bTxActive = TRUE;
+
+	if (!GetHost ()->SubmitAsyncRequest (m_pTxURB))
+	{
+		delete m_pTxURB;
+		m_pTxURB = 0;
+
+		m_bTxActive = FALSE;
+		m_bTxError = TRUE;
+	}
+}
+
+void CUSBSerialDevice::TransmitCompletionRoutine (CUSBRequest *pURB)
+{
+	assert (pURB != 0);
+
+	m_TxSpinLock.Acquire ();
+
+	assert (pURB == m_pTxURB);
+	if (pURB->GetStatus () == 0)
+	{
+		m_bTxError = TRUE;
+	}
+
+	delete m_pTxURB;
+	m_pTxURB = 0;
+
+	assert (m_bTxActive);
+	m_bTxActive = FALSE;
+
+	StartTransmit ();
+
+	TUSBSerialTransmitHandler *pHandler = m_pTransmitHandler;
+	void *pParam = m_pTransmitParam;
+	assert (m_pTxRing != 0);
+	boolean bLowWater = m_pTxRing->GetCount () < m_nTxLowWater;
+
+	m_TxSpinLock.Release ();
+
+	if (   pHandler != 0
+	    && bLowWater)
+	{
+		(*pHandler) (pParam);
+	}
+}
+
+void CUSBSerialDevice::TransmitCompletionStub (CUSBRequest *pURB, void *pParam, void *pContext)
+{
+	CUSBSerialDevice *pThis = (CUSBSerialDevice *) pContext;
+	assert (pThis != 0);
+
+	pThis->TransmitCompletionRoutine (pURB);
+}
+
+#endif
@@ -0,0 +1,106 @@
+//
+// usbsoundbasedevice.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/usb/usbsoundbasedevice.h>
+#include <circle/devicenameservice.h>
+#include <circle/logger.h>
+#include <assert.h>
+
+static const char From[] = "usbsound";
+
+CUSBSoundBaseDevice::CUSBSoundBaseDevice (unsigned nSampleRate, unsigned nDevice)
+:	CSoundBaseDevice (SoundFormatSigned16, 0, nSampleRate),
+	m_nSampleRate (nSampleRate),
+	m_nDevice (nDevice),
+	m_pStreamingDevice (0)
+{
+}
+
+CUSBSoundBaseDevice::~CUSBSoundBaseDevice (void)
+{
+	if (m_pStreamingDevice != 0)
+	{
+		m_pStreamingDevice->Stop ();
+		m_pStreamingDevice->RegisterRemovedHandler (0);
+		m_pStreamingDevice = 0;
+	}
+}
+
+boolean CUSBSoundBaseDevice::Start (void)
+{
+	if (m_pStreamingDevice == 0)
+	{
+		m_pStreamingDevice = (CUSBAudioStreamingDevice *)
+			CDeviceNameService::Get ()->GetDevice ("uaudio", m_nDevice, FALSE);
+		if (m_pStreamingDevice == 0)
+		{
+			CLogger::Get ()->Write (From, LogError, "USB audio device not found");
+
+			return FALSE;
+		}
+
+		if (!m_pStreamingDevice->Setup (m_nSampleRate))
+		{
+			m_pStreamingDevice = 0;
+
+			return FALSE;
+		}
+
+		m_pStreamingDevice->RegisterChunkCallback (ChunkCallback, this);
+		m_pStreamingDevice->RegisterRemovedHandler (DeviceRemovedHandler, this);
+	}
+
+	if (m_pStreamingDevice->IsActive ())
+	{
+		return TRUE;
+	}
+
+	return m_pStreamingDevice->Start ();
+}
+
+void CUSBSoundBaseDevice::Cancel (void)
+{
+	if (m_pStreamingDevice != 0)
+	{
+		m_pStreamingDevice->Stop ();
+	}
+}
+
+boolean CUSBSoundBaseDevice::IsActive (void) const
+{
+	return    m_pStreamingDevice != 0
+	       && m_pStreamingDevice->IsActive ();
+}
+
+unsigned CUSBSoundBaseDevice::ChunkCallback (s16 *pBuffer, unsigned nChunkSize, void *pParam)
+{
+	CUSBSoundBaseDevice *pThis = (CUSBSoundBaseDevice *) pParam;
+	assert (pThis != 0);
+
+	return pThis->GetChunk (pBuffer, nChunkSize);
+}
+
+void CUSBSoundBaseDevice::DeviceRemovedHandler (CDevice *pDevice, void *pContext)
+{
+	CUSBSoundBaseDevice *pThis = (CUSBSoundBaseDevice *) pContext;
+	assert (pThis != 0);
+
+	assert (pThis->m_pStreamingDevice == pDevice);
+	pThis->m_pStreamingDevice = 0;
+}
@@ -24,6 +24,7 @@
 #include <circle/logger.h>
 #include <circle/timer.h>
 #include <circle/koptions.h>
+#include <circle/sysconfig.h>
 #include <circle/debug.h>
 #include <circle/macros.h>
 #include <assert.h>
@@ -325,7 +326,25 @@ boolean CUSBStandardHub::EnumeratePorts (void)
 			continue;
 		}
 
-		CTimer::Get ()->MsDelay (100);
+		// wait for the end of the reset signaling (10-20ms), instead of a fixed delay
+		for (unsigned i = 0; i < 20; i++)
+		{
+			CTimer::Get ()->MsDelay (5);
+
+			if (pHost->ControlMessage (pEndpoint0,
+				REQUEST_IN | REQUEST_CLASS | REQUEST_TO_OTHER,
+				GET_STATUS, 0, nPort+1, m_pStatus[nPort], 4) != 4)
+			{
+				return FALSE;
+			}
+
+			if (!(m_pStatus[nPort]->wPortStatus & PORT_RESET__MASK))
+			{
+				break;
+			}
+		}
+
+		CTimer::Get ()->MsDelay (USB_PORT_RESET_RECOVERY_MS);	// see USB 2.0 spec (tRSTRCY)
 		
 		if (pHost->ControlMessage (pEndpoint0,
 			REQUEST_IN | REQUEST_CLASS | REQUEST_TO_OTHER,
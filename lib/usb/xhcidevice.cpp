@@ -2,7 +2,7 @@
 // xhcidevice.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2019-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2019-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -21,6 +21,7 @@
 #include <circle/bcm2711.h>
 #include <circle/memio.h>
 #include <circle/logger.h>
+#include <circle/boottrace.h>
 #include <circle/memory.h>
 #include <circle/util.h>
 #include <circle/bcmpropertytags.h>
@@ -259,6 +260,8 @@ boolean CXHCIDevice::Initialize (boolean bScanDevices)
 	DumpStatus ();
 #endif
 
+	CBootTrace::Mark ("usb");
+
 	return TRUE;
 }
 
@@ -367,12 +370,16 @@ void CXHCIDevice::InterruptHandler (void)
 
 	TXHCITRB *pEventTRB = 0;
 	TXHCITRB *pNextEventTRB;
+	unsigned nEvents = 0;
 	assert (m_pEventManager != 0);
 	while ((pNextEventTRB = m_pEventManager->HandleEvents ()) != 0)
 	{
 		pEventTRB = pNextEventTRB;
+		nEvents++;
 	}
 
+	m_pEventManager->AdaptInterruptModeration (nEvents);
+
 	if (pEventTRB != 0)
 	{
 		m_pMMIO->rt_write64 (0, XHCI_REG_RT_IR_ERDP_LO,   XHCI_TO_DMA (pEventTRB)
@@ -431,8 +438,23 @@ void CXHCIDevice::DumpStatus (void)
 	m_PCIeHostBridge.DumpStatus (XHCI_PCIE_SLOT, XHCI_PCIE_FUNC);
 #endif
 
-	CLogger::Get ()->Write (From, LogDebug, "%u KB shared memory free",
-				(unsigned) (m_SharedMemAllocator.GetFreeSpace () / 1024));
+	TXHCISharedMemStats Stats;
+	m_SharedMemAllocator.GetStats (&Stats);
+
+	CLogger::Get ()->Write (From, LogDebug, "%u KB shared memory free (peak use %u KB, %u slabs free)",
+				(unsigned) (m_SharedMemAllocator.GetFreeSpace () / 1024),
+				(unsigned) (Stats.nPeakUsedBytes / 1024), Stats.nFreeSlabs);
+	CLogger::Get ()->Write (From, LogDebug, "%u allocs, %u frees, %u failed, %u large blocks",
+				Stats.nAllocations, Stats.nFrees, Stats.nFailures,
+				Stats.nLargeBlocksUsed);
+	for (unsigned i = 0; i < XHCI_SIZE_CLASSES; i++)
+	{
+		if (Stats.nBlocksUsed[i] != 0)
+		{
+			CLogger::Get ()->Write (From, LogDebug, "%u blocks of %u bytes",
+						Stats.nBlocksUsed[i], XHCI_MIN_BLOCK_SIZE << i);
+		}
+	}
 }
 
 #endif
@@ -33,6 +33,8 @@
 
 static const char From[] = "xhciep";
 
+#define PENDING_MASK	(XHCI_CONFIG_MAX_PENDING_URBS-1)
+
 CXHCIEndpoint::CXHCIEndpoint (CXHCIUSBDevice *pDevice, CXHCIDevice *pXHCIDevice)
 :	m_pDevice (pDevice),
 	m_pXHCIDevice (pXHCIDevice),
@@ -41,7 +43,8 @@ CXHCIEndpoint::CXHCIEndpoint (CXHCIUSBDevice *pDevice, CXHCIDevice *pXHCIDevice)
 	m_pTransferRing (0),
 	m_uchEndpointID (1),
 	m_uchEndpointType (XHCI_EP_CONTEXT_EP_TYPE_CONTROL),
-	m_pURB (0),
+	m_nPendingHead (0),
+	m_nPendingTail (0),
 	m_bTransferCompleted (TRUE),
 	m_pInputContextBuffer (0)
 {
@@ -67,7 +70,8 @@ CXHCIEndpoint::CXHCIEndpoint (CXHCIUSBDevice *pDevice, const TUSBEndpointDescrip
 	m_pTransferRing (0),
 	m_uchEndpointID (0),
 	m_uchEndpointType (0),
-	m_pURB (0),
+	m_nPendingHead (0),
+	m_nPendingTail (0),
 	m_bTransferCompleted (TRUE),
 	m_pInputContextBuffer (0)
 {
@@ -95,6 +99,26 @@ CXHCIEndpoint::CXHCIEndpoint (CXHCIUSBDevice *pDevice, const TUSBEndpointDescrip
 	{
 		m_uchInterval = ConvertInterval (pDesc->bInterval, m_pDevice->GetSpeed ());
 	}
+	else if ((m_uchAttributes & 3) == 1)	// isochronous endpoint
+	{
+		// period is 2^(bInterval-1) (micro)frames, xHCI counts in microframes
+		u8 uchInterval = pDesc->bInterval;
+		if (uchInterval < 1)
+		{
+			uchInterval = 1;
+		}
+
+		if (uchInterval > 16)
+		{
+			uchInterval = 16;
+		}
+
+		m_uchInterval = uchInterval-1;
+		if (m_pDevice->GetSpeed () < USBSpeedHigh)
+		{
+			m_uchInterval += 3;
+		}
+	}
 	else
 	{
 		m_uchInterval = 0;
@@ -228,7 +252,19 @@ boolean CXHCIEndpoint::Transfer (CUSBRequest *pURB, unsigned nTimeoutMs)
 			m_pDevice->DumpStatus ();
 #endif
 
-			m_pURB = 0;
+			// the TD remains on the ring, ignore its completion
+			m_SpinLock.Acquire ();
+
+			for (unsigned i = m_nPendingHead; i != m_nPendingTail; i++)
+			{
+				if (m_PendingURB[i & PENDING_MASK].pURB == pURB)
+				{
+					m_PendingURB[i & PENDING_MASK].pURB = 0;
+				}
+			}
+
+			m_SpinLock.Release ();
+
 			m_bTransferCompleted = TRUE;
 
 			return FALSE;
@@ -254,9 +290,23 @@ boolean CXHCIEndpoint::TransferAsync (CUSBRequest *pURB, unsigned nTimeoutMs)
 		return FALSE;
 	}
 
-	void *pBuffer = pURB->GetBuffer ();
+	u8 *pBuffer = (u8 *) pURB->GetBuffer ();
 	u32 nBufLen = pURB->GetBufLen ();
 
+	m_SpinLock.Acquire ();
+
+	if (m_nPendingTail - m_nPendingHead >= XHCI_CONFIG_MAX_PENDING_URBS)
+	{
+		m_SpinLock.Release ();
+
+		return FALSE;
+	}
+
+	TPendingURB *pPending = &m_PendingURB[m_nPendingTail & PENDING_MASK];
+	pPending->pURB = pURB;
+
+	assert (m_pTransferRing != 0);
+
 	if (   (m_uchEndpointType & 3) == 2		// bulk EP
 	    || (m_uchEndpointType & 3) == 3)		// interrupt EP
 	{
@@ -266,19 +316,145 @@ boolean CXHCIEndpoint::TransferAsync (CUSBRequest *pURB, unsigned nTimeoutMs)
 		assert ((uintptr) pBuffer > MEM_KERNEL_END);
 		CleanAndInvalidateDataCacheRange ((uintptr) pBuffer, nBufLen);
 
-		if (!EnqueueTRB (  XHCI_TRB_TYPE_NORMAL << XHCI_TRB_CONTROL_TRB_TYPE__SHIFT
-				 | XHCI_TRANSFER_TRB_CONTROL_IOC,
-		     		 nBufLen | 0 << XHCI_TRANSFER_TRB_STATUS_TD_SIZE__SHIFT,
-				 XHCI_TO_DMA_LO (pBuffer),
-				 XHCI_TO_DMA_HI (pBuffer)))
+		// one chained Normal TRB per 64K block, each one generates an event
+		unsigned nTRBs = 0;
+		for (u32 nOffset = 0; nOffset < nBufLen; nTRBs++)
+		{
+			nOffset += GetChunkLength (pBuffer + nOffset, nBufLen - nOffset);
+		}
+
+		if (nTRBs > m_pTransferRing->GetFreeTRBs ())
 		{
+			m_SpinLock.Release ();
+
 			return FALSE;
 		}
+
+		pPending->bControl = FALSE;
+		pPending->bIsoch = FALSE;
+		pPending->nEventsLeft = nTRBs;
+		pPending->pNextChunk = pBuffer;
+		pPending->nBytesLeft = nBufLen;
+		pPending->nTransferred = 0;
+
+		// the first TRB is handed over last, so that the xHC does not see a partial TD
+		TXHCITRB *pFirstTRB = 0;
+		u8 *pChunk = pBuffer;
+		u32 nBytesLeft = nBufLen;
+		while (nBytesLeft > 0)
+		{
+			u32 nChunk = GetChunkLength (pChunk, nBytesLeft);
+			nBytesLeft -= nChunk;
+
+			u32 nTDSize = (nBytesLeft + m_usMaxPacketSize-1) / m_usMaxPacketSize;
+			if (nTDSize > 31)
+			{
+				nTDSize = 31;
+			}
+
+			TXHCITRB *pTRB = EnqueueTRB (  XHCI_TRB_TYPE_NORMAL << XHCI_TRB_CONTROL_TRB_TYPE__SHIFT
+						     | XHCI_TRANSFER_TRB_CONTROL_IOC
+						     | XHCI_TRANSFER_TRB_CONTROL_ISP
+						     | (nBytesLeft > 0 ? XHCI_TRANSFER_TRB_CONTROL_CH : 0),
+						     nChunk | nTDSize << XHCI_TRANSFER_TRB_STATUS_TD_SIZE__SHIFT,
+						     XHCI_TO_DMA_LO (pChunk),
+						     XHCI_TO_DMA_HI (pChunk),
+						     pFirstTRB == 0);
+			assert (pTRB != 0);
+			if (pFirstTRB == 0)
+			{
+				pFirstTRB = pTRB;
+			}
+
+			pChunk += nChunk;
+		}
+
+		DataSyncBarrier ();
+
+		assert (pFirstTRB != 0);
+		pFirstTRB->Control ^= XHCI_TRB_CONTROL_C;
+	}
+	else if ((m_uchEndpointType & 3) == 1)		// isochronous EP
+	{
+		unsigned nPackets = pURB->GetNumIsoPackets ();
+		assert (nPackets > 0);
+		if (nPackets > m_pTransferRing->GetFreeTRBs ())
+		{
+			m_SpinLock.Release ();
+
+			return FALSE;
+		}
+
+		u8 *pPacket = pBuffer;
+		for (unsigned i = 0; i < nPackets; i++)
+		{
+			u32 nLength = pURB->GetIsoPacketLength (i);
+			if (   nLength > m_usMaxPacketSize
+			    || GetChunkLength (pPacket, nLength) != nLength)
+			{
+				m_SpinLock.Release ();
+
+				return FALSE;
+			}
+
+			pPacket += nLength;
+		}
+
+		assert (pBuffer != 0);
+		assert ((uintptr) pBuffer > MEM_KERNEL_END);
+		CleanAndInvalidateDataCacheRange ((uintptr) pBuffer, pPacket - pBuffer);
+
+		pPending->bControl = FALSE;
+		pPending->bIsoch = TRUE;
+		pPending->nEventsLeft = nPackets;
+		pPending->pNextChunk = pBuffer;
+		pPending->nBytesLeft = pPacket - pBuffer;
+		pPending->nTransferred = 0;
+
+		// one TD with a single Isoch TRB per packet, scheduled as soon as possible
+		TXHCITRB *pFirstTRB = 0;
+		pPacket = pBuffer;
+		for (unsigned i = 0; i < nPackets; i++)
+		{
+			u32 nLength = pURB->GetIsoPacketLength (i);
+
+			TXHCITRB *pTRB = EnqueueTRB (  XHCI_TRB_TYPE_ISOCH << XHCI_TRB_CONTROL_TRB_TYPE__SHIFT
+						     | XHCI_TRANSFER_TRB_CONTROL_IOC
+						     | XHCI_TRANSFER_TRB_CONTROL_ISP
+						     | XHCI_TRANSFER_TRB_CONTROL_SIA,
+						     nLength,	// TD size, TBC and TLBPC are 0
+						     XHCI_TO_DMA_LO (pPacket),
+						     XHCI_TO_DMA_HI (pPacket),
+						     pFirstTRB == 0);
+			assert (pTRB != 0);
+			if (pFirstTRB == 0)
+			{
+				pFirstTRB = pTRB;
+			}
+
+			pPacket += nLength;
+		}
+
+		DataSyncBarrier ();
+
+		assert (pFirstTRB != 0);
+		pFirstTRB->Control ^= XHCI_TRB_CONTROL_C;
 	}
 	else
 	{
 		assert (m_uchEndpointType == 4);	// control EP
 
+		if (m_pTransferRing->GetFreeTRBs () < 3)
+		{
+			m_SpinLock.Release ();
+
+			return FALSE;
+		}
+
+		pPending->bControl = TRUE;
+		pPending->bIsoch = FALSE;
+		pPending->nEventsLeft = 1;
+
 		TSetupData *pSetup = pURB->GetSetupData ();
 		assert (pSetup != 0);
 
@@ -315,6 +491,8 @@ boolean CXHCIEndpoint::TransferAsync (CUSBRequest *pURB, unsigned nTimeoutMs)
 				 | (u32) pSetup->wValue << 16,
 				 pSetup->wIndex | (u32) pSetup->wLength << 16))
 		{
+			m_SpinLock.Release ();
+
 			return FALSE;
 		}
 
@@ -332,6 +510,8 @@ boolean CXHCIEndpoint::TransferAsync (CUSBRequest *pURB, unsigned nTimeoutMs)
 					 XHCI_TO_DMA_LO (pBuffer),
 					 XHCI_TO_DMA_HI (pBuffer)))
 			{
+				m_SpinLock.Release ();
+
 				return FALSE;
 			}
 		}
@@ -340,12 +520,14 @@ boolean CXHCIEndpoint::TransferAsync (CUSBRequest *pURB, unsigned nTimeoutMs)
 		if (!EnqueueTRB (  XHCI_TRB_TYPE_STATUS_STAGE << XHCI_TRB_CONTROL_TRB_TYPE__SHIFT
 				 | nDirStatus | XHCI_TRANSFER_TRB_CONTROL_IOC))
 		{
+			m_SpinLock.Release ();
+
 			return FALSE;
 		}
 	}
 
-	assert (m_pURB == 0);
-	m_pURB = pURB;
+	pPending->nEndIndex = m_pTransferRing->GetEnqueueIndex ();
+	m_nPendingTail++;
 
 	DataSyncBarrier ();
 
@@ -353,6 +535,8 @@ boolean CXHCIEndpoint::TransferAsync (CUSBRequest *pURB, unsigned nTimeoutMs)
 	assert (XHCI_IS_ENDPOINTID (m_uchEndpointID));
 	m_pMMIO->db_write32 (m_pDevice->GetSlotID (), XHCI_REG_DB_TARGET_EP0 + m_uchEndpointID-1);
 
+	m_SpinLock.Release ();
+
 	return TRUE;
 }
 
@@ -368,11 +552,89 @@ void CXHCIEndpoint::TransferEvent (u8 uchCompletionCode, u32 nTransferLength)
 
 	DataMemBarrier ();
 
-	assert (m_pURB != 0);
-	CUSBRequest *pURB = m_pURB;
+	// isochronous rings report running empty or full without a TD
+	if (   uchCompletionCode == XHCI_TRB_COMPLETION_CODE_RING_UNDERRUN
+	    || uchCompletionCode == XHCI_TRB_COMPLETION_CODE_RING_OVERRUN)
+	{
+		return;
+	}
+
+	m_SpinLock.Acquire ();
 
-	if (   XHCI_TRB_SUCCESS (uchCompletionCode)
-	    || uchCompletionCode == XHCI_TRB_COMPLETION_CODE_SHORT_PACKET)
+	assert (m_nPendingHead != m_nPendingTail);
+	TPendingURB *pPending = &m_PendingURB[m_nPendingHead & PENDING_MASK];
+	CUSBRequest *pURB = pPending->pURB;
+
+	boolean bSuccess =    XHCI_TRB_SUCCESS (uchCompletionCode)
+			   || uchCompletionCode == XHCI_TRB_COMPLETION_CODE_SHORT_PACKET;
+
+	// the xHC continues with the next TD after a short packet or an error
+	u32 nResultLen;
+	if (pPending->bControl)
+	{
+		nResultLen = pURB != 0 ? pURB->GetBufLen () - nTransferLength : 0;
+	}
+	else if (pPending->bIsoch)
+	{
+		// a failed or missed packet does not fail the whole URB
+		assert (pPending->nEventsLeft > 0);
+		unsigned nPacket = pURB != 0 ? pURB->GetNumIsoPackets () - pPending->nEventsLeft : 0;
+		u32 nLength = pURB != 0 ? pURB->GetIsoPacketLength (nPacket) : 0;
+		assert (nTransferLength <= nLength);
+
+		if (   pURB != 0
+		    && bSuccess)
+		{
+			pURB->SetIsoPacketResultLength (nPacket, nLength - nTransferLength);
+			pPending->nTransferred += nLength - nTransferLength;
+		}
+
+		pPending->pNextChunk += nLength;
+		pPending->nBytesLeft -= nLength;
+
+		bSuccess = TRUE;
+
+		if (--pPending->nEventsLeft > 0)
+		{
+			m_SpinLock.Release ();
+
+			return;
+		}
+
+		nResultLen = pPending->nTransferred;
+	}
+	else
+	{
+		u32 nChunk = GetChunkLength (pPending->pNextChunk, pPending->nBytesLeft);
+		assert (nTransferLength <= nChunk);
+
+		pPending->nTransferred += nChunk - nTransferLength;
+		pPending->pNextChunk += nChunk;
+		pPending->nBytesLeft -= nChunk;
+
+		assert (pPending->nEventsLeft > 0);
+		if (   XHCI_TRB_SUCCESS (uchCompletionCode)
+		    && --pPending->nEventsLeft > 0)
+		{
+			m_SpinLock.Release ();
+
+			return;
+		}
+
+		nResultLen = pPending->nTransferred;
+	}
+
+	m_pTransferRing->SetDequeueIndex (pPending->nEndIndex);
+	m_nPendingHead++;
+
+	m_SpinLock.Release ();
+
+	if (pURB == 0)
+	{
+		return;
+	}
+
+	if (bSuccess)
 	{
 		void *pBuffer = pURB->GetBuffer ();
 		u32 nBufLen = pURB->GetBufLen ();
@@ -382,8 +644,8 @@ void CXHCIEndpoint::TransferEvent (u8 uchCompletionCode, u32 nTransferLength)
 			CleanAndInvalidateDataCacheRange ((uintptr) pBuffer, nBufLen);
 		}
 
-		assert (nTransferLength <= nBufLen);
-		pURB->SetResultLen (nBufLen - nTransferLength);
+		assert (nResultLen <= nBufLen);
+		pURB->SetResultLen (nResultLen);
 
 		pURB->SetStatus (1);
 	}
@@ -393,8 +655,6 @@ void CXHCIEndpoint::TransferEvent (u8 uchCompletionCode, u32 nTransferLength)
 					(unsigned) uchCompletionCode, (unsigned) m_uchEndpointID);
 	}
 
-	m_pURB = 0;
-
 	pURB->CallCompletionRoutine ();
 }
 
@@ -435,7 +695,8 @@ void CXHCIEndpoint::CompletionRoutine (CUSBRequest *pURB, void *pParam, void *pC
 	pThis->m_bTransferCompleted = TRUE;
 }
 
-boolean CXHCIEndpoint::EnqueueTRB (u32 nControl, u32 nStatus, u32 nParameter1, u32 nParameter2)
+TXHCITRB *CXHCIEndpoint::EnqueueTRB (u32 nControl, u32 nStatus, u32 nParameter1, u32 nParameter2,
+				     boolean bHold)
 {
 	assert (m_pTransferRing != 0);
 	TXHCITRB *pTransferTRB = m_pTransferRing->GetEnqueueTRB ();
@@ -455,9 +716,21 @@ boolean CXHCIEndpoint::EnqueueTRB (u32 nControl, u32 nStatus, u32 nParameter1, u
 
 	m_pTransferRing->IncrementEnqueue ();
 
+	if (bHold)
+	{
+		pTransferTRB->Control ^= XHCI_TRB_CONTROL_C;
+	}
+
 	return pTransferTRB;
 }
 
+u32 CXHCIEndpoint::GetChunkLength (const u8 *pBuffer, u32 nLength)
+{
+	u32 nMaxLength = 0x10000 - ((uintptr) pBuffer & 0xFFFF);
+
+	return nLength < nMaxLength ? nLength : nMaxLength;
+}
+
 TXHCIInputContext *CXHCIEndpoint::GetInputContextSetMaxPacketSize (void)
 {
 	assert (m_pInputContextBuffer == 0);
@@ -513,7 +786,7 @@ TXHCIInputContext *CXHCIEndpoint::GetInputContextConfigureEndpoint (void)
 	pEPContext->MaxPacketSize = m_usMaxPacketSize;
 	pEPContext->MaxBurstSize = 0;		// TODO
 	pEPContext->MaxPStreams = 0;
-	pEPContext->CErr = 3;
+	pEPContext->CErr = (m_uchEndpointType & 3) == 1 ? 0 : 3;	// no retries on isoch EPs
 
 	switch (m_uchEndpointType)
 	{
@@ -529,6 +802,13 @@ TXHCIInputContext *CXHCIEndpoint::GetInputContextConfigureEndpoint (void)
 		pEPContext->MaxESITPayload = m_usMaxPacketSize;
 		break;
 
+	case XHCI_EP_CONTEXT_EP_TYPE_ISOCH_OUT:
+	case XHCI_EP_CONTEXT_EP_TYPE_ISOCH_IN:
+		pEPContext->Interval = m_uchInterval;
+		pEPContext->AverageTRBLength = m_usMaxPacketSize;
+		pEPContext->MaxESITPayload = m_usMaxPacketSize;
+		break;
+
 	default:
 		assert (0);
 		break;
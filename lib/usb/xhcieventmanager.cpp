@@ -28,7 +28,8 @@ CXHCIEventManager::CXHCIEventManager (CXHCIDevice *pXHCIDevice)
 :	m_pXHCIDevice (pXHCIDevice),
 	m_pMMIO (pXHCIDevice->GetMMIOSpace ()),
 	m_EventRing (XHCIRingTypeEvent, XHCI_CONFIG_EVENT_RING_SIZE, pXHCIDevice),
-	m_pERST (0)
+	m_pERST (0),
+	m_nIMODI (XHCI_CONFIG_IMODI)
 {
 	if (!m_EventRing.IsValid ())
 	{
@@ -50,7 +51,7 @@ CXHCIEventManager::CXHCIEventManager (CXHCIDevice *pXHCIDevice)
 	m_pMMIO->rt_write32 (0, XHCI_REG_RT_IR_ERSTSZ, 1);
 	m_pMMIO->rt_write64 (0, XHCI_REG_RT_IR_ERSTBA_LO, XHCI_TO_DMA (m_pERST));
 	m_pMMIO->rt_write64 (0, XHCI_REG_RT_IR_ERDP_LO, XHCI_TO_DMA (m_EventRing.GetFirstTRB ()));
-	m_pMMIO->rt_write32 (0, XHCI_REG_RT_IR_IMOD, XHCI_CONFIG_IMODI);
+	m_pMMIO->rt_write32 (0, XHCI_REG_RT_IR_IMOD, m_nIMODI);
 	m_pMMIO->rt_write32 (0, XHCI_REG_RT_IR_IMAN,   m_pMMIO->rt_read32 (0, XHCI_REG_RT_IR_IMAN)
 						     | XHCI_REG_RT_IR_IMAN_IE);
 }
@@ -136,6 +137,36 @@ TXHCITRB *CXHCIEventManager::HandleEvents (void)
 	return pEventTRB;
 }
 
+void CXHCIEventManager::AdaptInterruptModeration (unsigned nEvents)
+{
+	unsigned nIMODI = m_nIMODI;
+
+	if (nEvents >= XHCI_CONFIG_IMOD_EVENTS_HIGH)
+	{
+		nIMODI *= 2;
+		if (nIMODI > XHCI_CONFIG_IMODI)
+		{
+			nIMODI = XHCI_CONFIG_IMODI;
+		}
+	}
+	else if (nEvents <= 1)
+	{
+		nIMODI /= 2;
+		if (nIMODI < XHCI_CONFIG_IMODI_MIN)
+		{
+			nIMODI = XHCI_CONFIG_IMODI_MIN;
+		}
+	}
+
+	if (nIMODI != m_nIMODI)
+	{
+		m_nIMODI = nIMODI;
+
+		assert (m_pMMIO != 0);
+		m_pMMIO->rt_write32 (0, XHCI_REG_RT_IR_IMOD, m_nIMODI);
+	}
+}
+
 #ifndef NDEBUG
 
 void CXHCIEventManager::DumpStatus (void)
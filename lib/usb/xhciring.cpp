@@ -143,7 +143,15 @@ void CXHCIRing::IncrementEnqueue (void)
 	{
 		TXHCITRB *pLinkTRB = &m_pFirstTRB[m_nEnqueueIndex];
 
-		pLinkTRB->Control ^= XHCI_TRB_CONTROL_C;
+		// the Link TRB belongs to a TD, which continues behind it
+		u32 nControl = pLinkTRB->Control & ~XHCI_LINK_TRB_CONTROL_CH;
+		if (   m_Type == XHCIRingTypeTransfer
+		    && (m_pFirstTRB[m_nEnqueueIndex-1].Control & XHCI_TRANSFER_TRB_CONTROL_CH))
+		{
+			nControl |= XHCI_LINK_TRB_CONTROL_CH;
+		}
+
+		pLinkTRB->Control = nControl ^ XHCI_TRB_CONTROL_C;
 
 		if (pLinkTRB->Control & XHCI_LINK_TRB_CONTROL_TC)
 		{
@@ -154,6 +162,32 @@ void CXHCIRing::IncrementEnqueue (void)
 	}
 }
 
+unsigned CXHCIRing::GetEnqueueIndex (void) const
+{
+	assert (m_Type == XHCIRingTypeTransfer);
+
+	return m_nEnqueueIndex;
+}
+
+void CXHCIRing::SetDequeueIndex (unsigned nIndex)
+{
+	assert (m_Type == XHCIRingTypeTransfer);
+	assert (nIndex < m_nTRBCount-1);
+
+	m_nDequeueIndex = nIndex;
+}
+
+unsigned CXHCIRing::GetFreeTRBs (void) const
+{
+	assert (m_Type == XHCIRingTypeTransfer);
+
+	// one TRB is kept free to distinguish a full from an empty ring
+	unsigned nUsable = m_nTRBCount-1;
+	unsigned nUsed = (m_nEnqueueIndex + nUsable - m_nDequeueIndex) % nUsable;
+
+	return nUsable - 1 - nUsed;
+}
+
 u32 CXHCIRing::GetCycleState (void) const
 {
 	assert (m_pFirstTRB != 0);
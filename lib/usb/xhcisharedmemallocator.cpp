@@ -2,7 +2,7 @@
 // xhcisharedmemallocator.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,30 +19,49 @@
 //
 #include <circle/usb/xhcisharedmemallocator.h>
 #include <circle/logger.h>
+#include <circle/util.h>
 #include <assert.h>
 
 static const char From[] = "xhcialloc";
 
 CXHCISharedMemAllocator::CXHCISharedMemAllocator (uintptr nMemStart, uintptr nMemEnd)
-:	m_nMemStart (nMemStart),
-	m_nMemEnd (nMemEnd),
-	m_pFreeList (0)
+:	m_nPoolStart ((nMemStart + XHCI_SLAB_SIZE-1) & ~(uintptr) (XHCI_SLAB_SIZE-1)),
+	m_nSlabs (0)
 {
-	assert (m_nMemStart != 0);
-	assert (m_nMemEnd > m_nMemStart);
+	assert (nMemStart != 0);
+	assert (nMemEnd > nMemStart);
+
+	if (nMemEnd >= m_nPoolStart + XHCI_SLAB_SIZE-1)
+	{
+		m_nSlabs = (nMemEnd - m_nPoolStart + 1) / XHCI_SLAB_SIZE;
+		if (m_nSlabs > XHCI_MAX_SLABS)
+		{
+			m_nSlabs = XHCI_MAX_SLABS;
+		}
+	}
+	assert (m_nSlabs > 0);
+
+	for (unsigned i = 0; i < XHCI_MAX_SLABS; i++)
+	{
+		m_Slab[i].nType = XHCI_SLAB_FREE;
+		m_Slab[i].nCount = 0;
+		m_Slab[i].pFreeList = 0;
+	}
+
+	memset (&m_Stats, 0, sizeof m_Stats);
+	m_Stats.nPoolSize = m_nSlabs * XHCI_SLAB_SIZE;
+	m_Stats.nFreeSlabs = m_nSlabs;
 }
 
 CXHCISharedMemAllocator::~CXHCISharedMemAllocator (void)
 {
-	m_nMemStart = 0;
-	m_nMemEnd = 0;
-
-	m_pFreeList = 0;
+	m_nPoolStart = 0;
+	m_nSlabs = 0;
 }
 
 size_t CXHCISharedMemAllocator::GetFreeSpace (void) const
 {
-	return m_nMemEnd > m_nMemStart ? m_nMemEnd - m_nMemStart : 0;
+	return m_Stats.nPoolSize - m_Stats.nUsedBytes;
 }
 
 void *CXHCISharedMemAllocator::Allocate (size_t nSize, size_t nAlign, size_t nBoundary)
@@ -50,93 +69,229 @@ void *CXHCISharedMemAllocator::Allocate (size_t nSize, size_t nAlign, size_t nBo
 	assert (nSize > 0);
 	assert (nAlign != 0);
 	assert (nAlign <= nBoundary);
-	assert (m_nMemStart != 0);
-	assert (m_nMemEnd != 0);
+	assert (nAlign <= XHCI_SLAB_SIZE);
+	assert (m_nPoolStart != 0);
+
+	void *pResult = 0;
 
-	if (   nSize <= XHCI_BLOCK_SIZE
-	    && nAlign <= XHCI_BLOCK_ALIGN
-	    && nBoundary <= XHCI_BLOCK_BOUNDARY)
+	// the block size of a size class is also its alignment
+	size_t nBlockSize = nSize > nAlign ? nSize : nAlign;
+	if (   nBlockSize <= XHCI_MAX_BLOCK_SIZE
+	    && nSize <= nBoundary)
 	{
-		if (m_pFreeList != 0)
+		unsigned nClass = 0;
+		while (((size_t) XHCI_MIN_BLOCK_SIZE << nClass) < nBlockSize)
 		{
-			TXHCIBlockHeader *pBlockHeader = m_pFreeList;
-			assert (pBlockHeader->nMagic == XHCI_BLOCK_MAGIC);
-			assert (pBlockHeader->nSize == XHCI_BLOCK_SIZE);
-			assert (pBlockHeader->nAlign == XHCI_BLOCK_ALIGN);
-			assert (pBlockHeader->nBoundary == XHCI_BLOCK_BOUNDARY);
-
-			m_pFreeList = pBlockHeader->pNext;
-			pBlockHeader->pNext = 0;
+			nClass++;
+		}
+		assert (nClass < XHCI_SIZE_CLASSES);
 
-			void *pResult = pBlockHeader->Data;
-			assert (((uintptr) pResult & (XHCI_BLOCK_ALIGN-1)) == 0);
+		// boundaries are powers of two too, so nBoundary >= block size here
+		pResult = AllocateBlock (nClass);
+	}
+	else
+	{
+		pResult = AllocateLarge (nSize, nBoundary);
+	}
 
-			return pResult;
-		}
+	if (pResult == 0)
+	{
+		m_Stats.nFailures++;
 
-		nSize = XHCI_BLOCK_SIZE;
-		nAlign = XHCI_BLOCK_ALIGN;
-		nBoundary = XHCI_BLOCK_BOUNDARY;
+		return 0;
 	}
 
-	m_nMemStart += sizeof (TXHCIBlockHeader);
+	assert (((uintptr) pResult & (nAlign-1)) == 0);
 
-	size_t nAlignMask = nAlign - 1;
-	if (m_nMemStart & nAlignMask)
+	m_Stats.nAllocations++;
+	if (m_Stats.nUsedBytes > m_Stats.nPeakUsedBytes)
 	{
-		m_nMemStart += nAlignMask;
-		m_nMemStart &= ~nAlignMask;
+		m_Stats.nPeakUsedBytes = m_Stats.nUsedBytes;
 	}
 
-	size_t nBoundaryMask = nBoundary - 1;
-	if (   (m_nMemStart & ~nBoundaryMask)
-	    != ((m_nMemStart + nSize-1) & ~nBoundaryMask))
+	return pResult;
+}
+
+void CXHCISharedMemAllocator::Free (void *pBlock)
+{
+	assert (pBlock != 0);
+
+	uintptr nAddress = (uintptr) pBlock;
+	unsigned nSlab = (nAddress - m_nPoolStart) / XHCI_SLAB_SIZE;
+	if (   nAddress < m_nPoolStart
+	    || nSlab >= m_nSlabs)
 	{
-		m_nMemStart += nBoundaryMask;
-		m_nMemStart &= ~nBoundaryMask;
+		CLogger::Get ()->Write (From, LogWarning,
+					"Trying to free foreign memory at 0x%lX", nAddress);
+
+		return;
 	}
 
-	TXHCIBlockHeader *pBlockHeader =
-		(TXHCIBlockHeader *) (m_nMemStart - sizeof (TXHCIBlockHeader));
+	TSlab *pSlab = &m_Slab[nSlab];
+	if (pSlab->nType < XHCI_SIZE_CLASSES)
+	{
+		size_t nBlockSize = XHCI_MIN_BLOCK_SIZE << pSlab->nType;
+		assert ((nAddress & (nBlockSize-1)) == 0);
+		assert (pSlab->nCount > 0);
+
+		TFreeBlock *pFreeBlock = (TFreeBlock *) pBlock;
+		pFreeBlock->pNext = pSlab->pFreeList;
+		pSlab->pFreeList = pFreeBlock;
 
-	m_nMemStart += nSize;
+		m_Stats.nBlocksUsed[pSlab->nType]--;
+		m_Stats.nUsedBytes -= nBlockSize;
+
+		if (--pSlab->nCount == 0)
+		{
+			// return the slab to the pool, so that it can be used for other sizes
+			pSlab->nType = XHCI_SLAB_FREE;
+			pSlab->pFreeList = 0;
 
-	if (m_nMemStart > m_nMemEnd)
+			m_Stats.nFreeSlabs++;
+		}
+	}
+	else if (   pSlab->nType == XHCI_SLAB_LARGE
+		 && nAddress == GetSlabAddress (nSlab))
 	{
-		return 0;
+		unsigned nCount = pSlab->nCount;
+		assert (nCount > 0);
+		assert (nSlab + nCount <= m_nSlabs);
+
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			m_Slab[nSlab + i].nType = XHCI_SLAB_FREE;
+			m_Slab[nSlab + i].nCount = 0;
+		}
+
+		m_Stats.nLargeBlocksUsed--;
+		m_Stats.nUsedBytes -= nCount * XHCI_SLAB_SIZE;
+		m_Stats.nFreeSlabs += nCount;
 	}
+	else
+	{
+		CLogger::Get ()->Write (From, LogWarning,
+					"Trying to free unallocated memory at 0x%lX", nAddress);
 
-	pBlockHeader->nMagic = XHCI_BLOCK_MAGIC;
-	pBlockHeader->nSize = (u32) nSize;
-	pBlockHeader->nAlign = (u32) nAlign;
-	pBlockHeader->nBoundary = (u32) nBoundary;
-	pBlockHeader->pNext = 0;
+		return;
+	}
 
-	void *pResult = pBlockHeader->Data;
-	assert (((uintptr) pResult & (nAlign-1)) == 0);
+	m_Stats.nFrees++;
+}
 
-	return pResult;
+void CXHCISharedMemAllocator::GetStats (TXHCISharedMemStats *pStats) const
+{
+	assert (pStats != 0);
+	*pStats = m_Stats;
 }
 
-void CXHCISharedMemAllocator::Free (void *pBlock)
+void *CXHCISharedMemAllocator::AllocateBlock (unsigned nClass)
 {
-	assert (pBlock != 0);
+	assert (nClass < XHCI_SIZE_CLASSES);
+	size_t nBlockSize = XHCI_MIN_BLOCK_SIZE << nClass;
 
-	TXHCIBlockHeader *pBlockHeader =
-		(TXHCIBlockHeader *) ((uintptr) pBlock - sizeof (TXHCIBlockHeader));
-	assert (pBlockHeader->nMagic == XHCI_BLOCK_MAGIC);
+	// prefer a partially used slab of this class, to keep free slabs for other sizes
+	TSlab *pSlab = 0;
+	unsigned nFreeSlab = m_nSlabs;
+	for (unsigned i = 0; i < m_nSlabs; i++)
+	{
+		if (   m_Slab[i].nType == nClass
+		    && m_Slab[i].pFreeList != 0)
+		{
+			pSlab = &m_Slab[i];
+
+			break;
+		}
 
-	if (   pBlockHeader->nSize == XHCI_BLOCK_SIZE
-	    && pBlockHeader->nAlign == XHCI_BLOCK_ALIGN
-	    && pBlockHeader->nBoundary == XHCI_BLOCK_BOUNDARY)
+		if (   m_Slab[i].nType == XHCI_SLAB_FREE
+		    && nFreeSlab == m_nSlabs)
+		{
+			nFreeSlab = i;
+		}
+	}
+
+	if (pSlab == 0)
 	{
-		pBlockHeader->pNext = m_pFreeList;
-		m_pFreeList = pBlockHeader;
+		if (nFreeSlab == m_nSlabs)
+		{
+			return 0;
+		}
+
+		pSlab = &m_Slab[nFreeSlab];
+		assert (pSlab->nCount == 0);
+		pSlab->nType = (u8) nClass;
+
+		// chain all blocks of the slab in ascending order
+		uintptr nSlabAddress = GetSlabAddress (nFreeSlab);
+		TFreeBlock *pNext = 0;
+		for (uintptr nBlock = nSlabAddress + XHCI_SLAB_SIZE - nBlockSize;
+		     nBlock >= nSlabAddress;
+		     nBlock -= nBlockSize)
+		{
+			TFreeBlock *pFreeBlock = (TFreeBlock *) nBlock;
+			pFreeBlock->pNext = pNext;
+			pNext = pFreeBlock;
+		}
+		pSlab->pFreeList = pNext;
+
+		m_Stats.nFreeSlabs--;
 	}
-	else
+
+	TFreeBlock *pFreeBlock = pSlab->pFreeList;
+	assert (pFreeBlock != 0);
+	pSlab->pFreeList = pFreeBlock->pNext;
+	pSlab->nCount++;
+
+	m_Stats.nBlocksUsed[nClass]++;
+	m_Stats.nUsedBytes += nBlockSize;
+
+	return pFreeBlock;
+}
+
+void *CXHCISharedMemAllocator::AllocateLarge (size_t nSize, size_t nBoundary)
+{
+	unsigned nCount = (nSize + XHCI_SLAB_SIZE-1) / XHCI_SLAB_SIZE;
+
+	// first fit over runs of free slabs, which are aligned to XHCI_SLAB_SIZE
+	for (unsigned nFirst = 0; nFirst + nCount <= m_nSlabs; nFirst++)
 	{
-		CLogger::Get ()->Write (From, LogWarning,
-					"Trying to free shared memory at 0x%lX (size %u, align %u)",
-					(uintptr) pBlock, pBlockHeader->nSize, pBlockHeader->nAlign);
+		unsigned i;
+		for (i = 0; i < nCount; i++)
+		{
+			if (m_Slab[nFirst + i].nType != XHCI_SLAB_FREE)
+			{
+				break;
+			}
+		}
+
+		if (i < nCount)
+		{
+			nFirst += i;		// continue behind the used slab
+
+			continue;
+		}
+
+		// a block larger than its boundary (e.g. an array of pages) only has to start
+		// on a boundary, which is always the case here
+		uintptr nAddress = GetSlabAddress (nFirst);
+		if (   nSize <= nBoundary
+		    && (nAddress & ~(nBoundary-1)) != ((nAddress + nSize-1) & ~(nBoundary-1)))
+		{
+			continue;
+		}
+
+		m_Slab[nFirst].nType = XHCI_SLAB_LARGE;
+		m_Slab[nFirst].nCount = nCount;
+		for (i = 1; i < nCount; i++)
+		{
+			m_Slab[nFirst + i].nType = XHCI_SLAB_LARGE_CONT;
+		}
+
+		m_Stats.nLargeBlocksUsed++;
+		m_Stats.nUsedBytes += nCount * XHCI_SLAB_SIZE;
+		m_Stats.nFreeSlabs -= nCount;
+
+		return (void *) nAddress;
 	}
+
+	return 0;
 }
@@ -2,7 +2,7 @@
 // usertimer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2017-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2017-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -75,7 +75,7 @@ void CUserTimer::Stop (void)
 	}
 	else
 	{
-		m_pInterruptSystem->DisconnectFIQ ();
+		m_pInterruptSystem->DisconnectFIQ (ARM_FIQ_TIMER1);
 	}
 
 	m_bInitialized = FALSE;
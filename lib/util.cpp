@@ -19,28 +19,6 @@
 //
 #include <circle/util.h>
 
-void *memmove (void *pDest, const void *pSrc, size_t nLength)
-{
-	char *pchDest = (char *) pDest;
-	const char *pchSrc = (const char *) pSrc;
-
-	if (   pchSrc < pchDest
-	    && pchDest < pchSrc + nLength)
-	{
-		pchSrc += nLength;
-		pchDest += nLength;
-
-		while (nLength--)
-		{
-			*--pchDest = *--pchSrc;
-		}
-
-		return pDest;
-	}
-
-	return memcpy (pDest, pSrc, nLength);
-}
-
 #if STDLIB_SUPPORT <= 1
 
 int memcmp (const void *pBuffer1, const void *pBuffer2, size_t nLength)
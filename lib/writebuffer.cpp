@@ -2,7 +2,7 @@
 // writebuffer.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2020  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2020-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,7 +19,9 @@
 //
 #include <circle/writebuffer.h>
 #include <circle/synchronize.h>
+#include <circle/timer.h>
 #include <circle/macros.h>
+#include <circle/util.h>
 #include <circle/new.h>
 #include <assert.h>
 
@@ -27,13 +29,18 @@ CWriteBufferDevice::CWriteBufferDevice (CDevice *pDevice, size_t nBufferSize)
 :	m_pDevice (pDevice),
 	m_nBufferSize (nBufferSize),
 	m_nInPtr (0),
-	m_nOutPtr (0)
+	m_nOutPtr (0),
+	m_nHighWaterMark (1),
+	m_nMaxDelayTicks (0),
+	m_nFirstPendingTicks (0)
 {
 	assert (m_pDevice != 0);
 	assert (IS_POWEROF_2 (m_nBufferSize));
 
 	m_pBuffer = new (HEAP_ANY) u8[m_nBufferSize];
 	assert (m_pBuffer != 0);
+
+	memset (&m_Stats, 0, sizeof m_Stats);
 }
 
 CWriteBufferDevice::~CWriteBufferDevice (void)
@@ -49,56 +56,142 @@ int CWriteBufferDevice::Write (const void *pBuffer, size_t nCount)
 	assert (pBuffer != 0);
 	assert (m_pBuffer != 0);
 
-	u8 *p = (u8 *) pBuffer;
-
-	int nResult = 0;
+	const u8 *p = (const u8 *) pBuffer;
 
 	m_SpinLock.Acquire ();
 
-	while (nCount-- > 0)
+	size_t nFree = (m_nOutPtr - m_nInPtr - 1) & (m_nBufferSize-1);
+	if (nCount > nFree)
 	{
-		if (((m_nInPtr+1) & (m_nBufferSize-1)) == m_nOutPtr)
+		m_Stats.nBytesDropped += nCount - nFree;
+
+		nCount = nFree;
+	}
+
+	if (nCount > 0)
+	{
+		if (m_nInPtr == m_nOutPtr)
 		{
-			break;
+			m_nFirstPendingTicks = CTimer::GetClockTicks ();
 		}
 
-		m_pBuffer[m_nInPtr++] = *p++;
-		m_nInPtr &= m_nBufferSize-1;
+		// copy in up to two pieces, if the data wraps around the end of the buffer
+		size_t nFirst = m_nBufferSize - m_nInPtr;
+		if (nFirst > nCount)
+		{
+			nFirst = nCount;
+		}
+
+		memcpy (m_pBuffer + m_nInPtr, p, nFirst);
+		memcpy (m_pBuffer, p + nFirst, nCount - nFirst);
+
+		m_nInPtr = (m_nInPtr + nCount) & (m_nBufferSize-1);
 
-		nResult++;
+		unsigned nLevel = (m_nInPtr - m_nOutPtr) & (m_nBufferSize-1);
+		if (nLevel > m_Stats.nMaxLevel)
+		{
+			m_Stats.nMaxLevel = nLevel;
+		}
 	}
 
 	m_SpinLock.Release ();
 
-	return nResult;
+	return (int) nCount;
 }
 
-void CWriteBufferDevice::Update (size_t nMaxBytes)
+size_t CWriteBufferDevice::Update (size_t nMaxBytes)
 {
 	assert (m_pBuffer != 0);
+	assert (nMaxBytes > 0);
 
 	DMA_BUFFER (u8, Buffer, nMaxBytes);
-	u8 *p = Buffer;
 
 	m_SpinLock.Acquire ();
 
-	unsigned nBytes;
-	for (nBytes = 0; nBytes < nMaxBytes; nBytes++)
+	size_t nBytes = (m_nInPtr - m_nOutPtr) & (m_nBufferSize-1);
+	if (nBytes > nMaxBytes)
 	{
-		if (m_nInPtr == m_nOutPtr)
-		{
-			break;
-		}
+		nBytes = nMaxBytes;
+	}
 
-		*p++ = m_pBuffer[m_nOutPtr++];
-		m_nOutPtr &= m_nBufferSize-1;
+	size_t nFirst = m_nBufferSize - m_nOutPtr;
+	if (nFirst > nBytes)
+	{
+		nFirst = nBytes;
 	}
 
+	memcpy (Buffer, m_pBuffer + m_nOutPtr, nFirst);
+	memcpy (Buffer + nFirst, m_pBuffer, nBytes - nFirst);
+
+	m_nOutPtr = (m_nOutPtr + nBytes) & (m_nBufferSize-1);
+
+	// the remaining bytes are waiting since now
+	m_nFirstPendingTicks = CTimer::GetClockTicks ();
+
 	m_SpinLock.Release ();
 
 	if (nBytes > 0)
 	{
 		assert (m_pDevice != 0);
 		m_pDevice->Write (Buffer, nBytes);
+
+		m_SpinLock.Acquire ();
+
+		m_Stats.nBytesWritten += nBytes;
+		m_Stats.nDeviceWrites++;
+
+		m_SpinLock.Release ();
+	}
+
+	return nBytes;
+}
+
+void CWriteBufferDevice::Flush (size_t nMaxBytes)
+{
+	while (Update (nMaxBytes) > 0)
+	{
+		// do nothing
+	}
+}
+
+void CWriteBufferDevice::SetFlushPolicy (size_t nHighWaterMark, unsigned nMaxDelayMs)
+{
+	assert (nHighWaterMark > 0);
+	assert (nHighWaterMark < m_nBufferSize);
+
+	m_nHighWaterMark = nHighWaterMark;
+	m_nMaxDelayTicks = nMaxDelayMs * (CLOCKHZ / 1000);
+}
+
+boolean CWriteBufferDevice::IsFlushDue (void) const
+{
+	size_t nLevel = GetLevel ();
+	if (nLevel == 0)
+	{
+		return FALSE;
 	}
+
+	if (nLevel >= m_nHighWaterMark)
+	{
+		return TRUE;
+	}
+
+	return    m_nMaxDelayTicks != 0
+	       && CTimer::GetClockTicks () - m_nFirstPendingTicks >= m_nMaxDelayTicks;
+}
+
+size_t CWriteBufferDevice::GetLevel (void) const
+{
+	return (m_nInPtr - m_nOutPtr) & (m_nBufferSize-1);
+}
+
+void CWriteBufferDevice::GetStats (TWriteBufferStats *pStats)
+{
+	assert (pStats != 0);
+
+	m_SpinLock.Acquire ();
+
+	*pStats = m_Stats;
+
+	m_SpinLock.Release ();
 }
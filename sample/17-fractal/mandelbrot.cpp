@@ -2,7 +2,7 @@
 // mandelbrot.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,16 +18,41 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include "mandelbrot.h"
+#include <circle/machineinfo.h>
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <circle/synchronize.h>
+#include <assert.h>
 
-#define MAX_ITERATION	5000
+#if defined (__ARM_NEON) && __has_include (<arm_neon.h>)
+	#define MANDELBROT_NEON
+	#include <arm_neon.h>
+#endif
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	#define RENDER_CORES	CORES
+#else
+	#define RENDER_CORES	1
+#endif
+
+#define FRAME_STOP	0xFFFFFFFFU
+
+static const char FromMandelbrot[] = "mandelbrot";
 
 CMandelbrotCalculator::CMandelbrotCalculator (CScreenDevice *pScreen, CMemorySystem *pMemorySystem)
 :	
 #ifdef ARM_ALLOW_MULTI_CORE
 	CMultiCoreSupport (pMemorySystem),
 #endif
-	m_pScreen (pScreen)
+	m_pScreen (pScreen),
+	m_nFrame (0),
+	m_nNextTile (0),
+	m_nTilesDone (0)
 {
+	for (unsigned i = 0; i < CORES; i++)
+	{
+		m_nTilesPerCore[i] = 0;
+	}
 }
 
 CMandelbrotCalculator::~CMandelbrotCalculator (void)
@@ -37,64 +62,217 @@ CMandelbrotCalculator::~CMandelbrotCalculator (void)
 
 void CMandelbrotCalculator::Run (unsigned nCore)
 {
-#ifdef ARM_ALLOW_MULTI_CORE
-	unsigned nQuarterHeight = m_pScreen->GetHeight () / 4;
+	if (nCore != 0)
+	{
+		// secondary cores calculate tiles of each frame, which is started by core 0
+		unsigned nFrame = 0;
+		while (1)
+		{
+			unsigned nNextFrame;
+			while ((nNextFrame = __atomic_load_n (&m_nFrame, __ATOMIC_ACQUIRE)) == nFrame)
+			{
+				// just wait
+			}
+
+			if (nNextFrame == FRAME_STOP)
+			{
+				return;
+			}
+
+			nFrame = nNextFrame;
+			CalculateTiles (nCore, nFrame);
+		}
+	}
+
+	assert (m_pScreen != 0);
+	m_nWidth = m_pScreen->GetWidth ();
+	m_nHeight = m_pScreen->GetHeight ();
+	m_nTilesX = (m_nWidth + TILE_SIZE-1) / TILE_SIZE;
+	m_nTiles = m_nTilesX * ((m_nHeight + TILE_SIZE-1) / TILE_SIZE);
+
+	// the area -2.0..1.0 x -1.0..1.0 is stretched to the screen
+	m_x1 = -2.0;
+	m_y1 = -1.0;
+	m_dx = 3.0 / m_nWidth;
+	m_dy = 2.0 / m_nHeight;
 
-	switch (nCore)
+	u64 nTotalUsec = 0;
+	for (unsigned nFrame = 1; nFrame <= BENCHMARK_FRAMES; nFrame++)
 	{
-	case 0:
-		Calculate (-2.0, 1.0, -1.0, -0.5, MAX_ITERATION, 0, nQuarterHeight);
-		break;
+		u64 nStartUsec = CTimer::GetClockTicks64 ();
 
-	case 1:
-		Calculate (-2.0, 1.0, -0.5, 0.0, MAX_ITERATION, nQuarterHeight, nQuarterHeight);
-		break;
+		__atomic_store_n (&m_nFrame, nFrame, __ATOMIC_RELEASE);
 
-	case 2:
-		Calculate (-2.0, 1.0, 0.0, 0.5, MAX_ITERATION, nQuarterHeight*2, nQuarterHeight);
-		break;
+		CalculateTiles (0, nFrame);
 
-	case 3:
-		Calculate (-2.0, 1.0, 0.5, 1.0, MAX_ITERATION, nQuarterHeight*3, nQuarterHeight);
-		break;
+		// wait for the tiles, which are still calculated by other cores
+		while (__atomic_load_n (&m_nTilesDone, __ATOMIC_ACQUIRE) < nFrame * m_nTiles)
+		{
+			// just wait
+		}
+
+		nTotalUsec += CTimer::GetClockTicks64 () - nStartUsec;
 	}
-#else
-	Calculate (-2.0, 1.0, -1.0, 1.0, MAX_ITERATION, 0, m_pScreen->GetHeight ());
-#endif
+
+	__atomic_store_n (&m_nFrame, FRAME_STOP, __ATOMIC_RELEASE);
+
+	Report (nTotalUsec);
 }
 
-// See: http://en.wikipedia.org/wiki/Mandelbrot_set
-void CMandelbrotCalculator::Calculate (float x1, float x2, float y1, float y2, unsigned nMaxIteration,
-				       unsigned nPosY0, unsigned nHeight)
+void CMandelbrotCalculator::CalculateTiles (unsigned nCore, unsigned nFrame)
 {
-	float dx = (x2-x1) / m_pScreen->GetWidth ();
-	float dy = (y2-y1) / nHeight;
-
-	float y0 = y1;
-	for (unsigned nPosY = nPosY0; nPosY < nPosY0+nHeight; nPosY++, y0 += dy)
+	// the tiles are taken from a shared counter, so that a core, which has calculated
+	// cheap tiles, takes over more of the remaining work
+	unsigned nEndTile = nFrame * m_nTiles;
+	while (1)
 	{
-		float x0 = x1;
-		for (unsigned nPosX = 0; nPosX < m_pScreen->GetWidth (); nPosX++, x0 += dx)
+		unsigned nTile = __atomic_load_n (&m_nNextTile, __ATOMIC_RELAXED);
+		do
 		{
-			float x = 0.0;
-			float y = 0.0;
-			unsigned nIteration = 0;
-			for (; x*x+y*y < 2*2 && nIteration < nMaxIteration; nIteration++)
+			if (nTile >= nEndTile)
 			{
-				float xtmp = x*x - y*y + x0;
-				y = 2*x*y + y0;
-				x = xtmp;
+				return;
 			}
+		}
+		while (!__atomic_compare_exchange_n (&m_nNextTile, &nTile, nTile+1, TRUE,
+						     __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+		CalculateTile (nTile % m_nTiles);
+
+		m_nTilesPerCore[nCore]++;
+
+		__atomic_add_fetch (&m_nTilesDone, 1, __ATOMIC_RELEASE);
+	}
+}
+
+void CMandelbrotCalculator::CalculateTile (unsigned nTile)
+{
+	unsigned nPosX0 = nTile % m_nTilesX * TILE_SIZE;
+	unsigned nPosY0 = nTile / m_nTilesX * TILE_SIZE;
+	unsigned nPosX1 = nPosX0 + TILE_SIZE < m_nWidth ? nPosX0 + TILE_SIZE : m_nWidth;
+	unsigned nPosY1 = nPosY0 + TILE_SIZE < m_nHeight ? nPosY0 + TILE_SIZE : m_nHeight;
+
+	for (unsigned nPosY = nPosY0; nPosY < nPosY1; nPosY++)
+	{
+		float y0 = m_y1 + nPosY * m_dy;
+
+		for (unsigned nPosX = nPosX0; nPosX < nPosX1; nPosX += 4)
+		{
+			float x0 = m_x1 + nPosX * m_dx;
 
+			unsigned Iteration[4];
+			Calculate4 (x0, m_dx, y0, MAX_ITERATION, Iteration);
+
+			for (unsigned i = 0; i < 4 && nPosX+i < nPosX1; i++)
+			{
 #if DEPTH == 8
-			TScreenColor Color = (TScreenColor) (nIteration * 15 / nMaxIteration);
+				TScreenColor Color = (TScreenColor) (Iteration[i] * 15 / MAX_ITERATION);
 #elif DEPTH == 16
-			TScreenColor Color = (TScreenColor) (nIteration * 65535 / nMaxIteration);
-			Color++;
+				TScreenColor Color = (TScreenColor) (Iteration[i] * 65535 / MAX_ITERATION);
+				Color++;
 #else
 	#error DEPTH must be 8 or 16
 #endif
-			m_pScreen->SetPixel (nPosX, nPosY, Color);
+				m_pScreen->SetPixel (nPosX+i, nPosY, Color);
+			}
 		}
 	}
 }
+
+// See: http://en.wikipedia.org/wiki/Mandelbrot_set
+void CMandelbrotCalculator::Calculate4 (float x0, float dx, float y0, unsigned nMaxIteration,
+					unsigned *pIteration)
+{
+	assert (pIteration != 0);
+
+#ifdef MANDELBROT_NEON
+	static const float Lane[4] = {0.0, 1.0, 2.0, 3.0};
+	float32x4_t vx0 = vmlaq_n_f32 (vdupq_n_f32 (x0), vld1q_f32 (Lane), dx);
+	float32x4_t vy0 = vdupq_n_f32 (y0);
+	float32x4_t vLimit = vdupq_n_f32 (2*2);
+
+	float32x4_t x = vdupq_n_f32 (0.0);
+	float32x4_t y = vdupq_n_f32 (0.0);
+	uint32x4_t nIteration = vdupq_n_u32 (0);
+
+	for (unsigned i = 0; i < nMaxIteration; i++)
+	{
+		float32x4_t xx = vmulq_f32 (x, x);
+		float32x4_t yy = vmulq_f32 (y, y);
+
+		// all bits are set in the lanes, which have not escaped yet
+		uint32x4_t Active = vcltq_f32 (vaddq_f32 (xx, yy), vLimit);
+#if AARCH == 64
+		if (vmaxvq_u32 (Active) == 0)
+#else
+		uint32x2_t Max = vpmax_u32 (vget_low_u32 (Active), vget_high_u32 (Active));
+		if (vget_lane_u32 (vpmax_u32 (Max, Max), 0) == 0)
+#endif
+		{
+			break;
+		}
+
+		nIteration = vsubq_u32 (nIteration, Active);
+
+		float32x4_t xy = vmulq_f32 (x, y);
+		x = vaddq_f32 (vsubq_f32 (xx, yy), vx0);
+		y = vaddq_f32 (vaddq_f32 (xy, xy), vy0);
+	}
+
+	vst1q_u32 ((uint32_t *) pIteration, nIteration);
+#else
+	for (unsigned i = 0; i < 4; i++)
+	{
+		pIteration[i] = Calculate (x0 + i*dx, y0, nMaxIteration);
+	}
+#endif
+}
+
+unsigned CMandelbrotCalculator::Calculate (float x0, float y0, unsigned nMaxIteration)
+{
+	float x = 0.0;
+	float y = 0.0;
+	unsigned nIteration = 0;
+	for (; x*x+y*y < 2*2 && nIteration < nMaxIteration; nIteration++)
+	{
+		float xtmp = x*x - y*y + x0;
+		y = 2*x*y + y0;
+		x = xtmp;
+	}
+
+	return nIteration;
+}
+
+void CMandelbrotCalculator::Report (u64 nTotalUsec)
+{
+	assert (nTotalUsec > 0);
+	u64 nPixels = (u64) m_nWidth * m_nHeight * BENCHMARK_FRAMES;
+	u64 nClockRate = CMachineInfo::Get ()->GetClockRate (CLOCK_ID_ARM);
+
+	// frames per second in 1/100
+	unsigned nFPS100 = (unsigned) ((u64) BENCHMARK_FRAMES * 100000000 / nTotalUsec);
+
+	// CPU cycles of all cores spent per pixel
+	u64 nCycles = nTotalUsec * (nClockRate / 1000000) * RENDER_CORES;
+	unsigned nCyclesPerPixel = (unsigned) (nCycles / nPixels);
+
+	CLogger *pLogger = CLogger::Get ();
+	pLogger->Write (FromMandelbrot, LogNotice, "%ux%u, %u iterations max., %u tiles, %s",
+			m_nWidth, m_nHeight, MAX_ITERATION, m_nTiles,
+#ifdef MANDELBROT_NEON
+			"NEON"
+#else
+			"scalar"
+#endif
+			);
+
+	pLogger->Write (FromMandelbrot, LogNotice,
+			"%u frames: %u.%02u fps, %u cycles/pixel (%u core(s) at %u MHz)",
+			BENCHMARK_FRAMES, nFPS100 / 100, nFPS100 % 100, nCyclesPerPixel,
+			RENDER_CORES, (unsigned) (nClockRate / 1000000));
+
+	for (unsigned i = 0; i < RENDER_CORES; i++)
+	{
+		pLogger->Write (FromMandelbrot, LogNotice, "Core %u: %u tiles", i, m_nTilesPerCore[i]);
+	}
+}
@@ -2,7 +2,7 @@
 // mandelbrot.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -23,8 +23,15 @@
 #include <circle/multicore.h>
 #include <circle/screen.h>
 #include <circle/memory.h>
+#include <circle/memorymap.h>
+#include <circle/sysconfig.h>
 #include <circle/types.h>
 
+#define MAX_ITERATION		1000
+#define BENCHMARK_FRAMES	10
+
+#define TILE_SIZE		32		// width and height in pixels, multiple of 4
+
 class CMandelbrotCalculator
 #ifdef ARM_ALLOW_MULTI_CORE
 	: public CMultiCoreSupport
@@ -41,11 +48,34 @@ public:
 	void Run (unsigned nCore);
 
 private:
-	void Calculate (float x1, float x2, float y1, float y2, unsigned nMaxIteration,
-			unsigned nPosY0, unsigned nHeight);
+	// calculates tiles of the current frame, until all tiles have been taken
+	void CalculateTiles (unsigned nCore, unsigned nFrame);
+
+	void CalculateTile (unsigned nTile);
+
+	// calculates four adjacent pixels, returns the number of iterations for each
+	static void Calculate4 (float x0, float dx, float y0, unsigned nMaxIteration,
+				unsigned *pIteration);
+	static unsigned Calculate (float x0, float y0, unsigned nMaxIteration);
+
+	void Report (u64 nTotalUsec);
 
 private:
 	CScreenDevice *m_pScreen;
+
+	unsigned m_nWidth;
+	unsigned m_nHeight;
+	unsigned m_nTilesX;
+	unsigned m_nTiles;			// per frame
+
+	float m_x1, m_y1;
+	float m_dx, m_dy;
+
+	volatile unsigned m_nFrame;		// current frame, set by core 0 to start it
+	volatile unsigned m_nNextTile;		// counts over all frames
+	volatile unsigned m_nTilesDone;		// counts over all frames
+
+	unsigned m_nTilesPerCore[CORES];
 };
 
 #endif
@@ -88,7 +88,8 @@ THTTPStatus CHTTPBootServer::GetContent (const char  *pPath,
 			assert (pPartHeader != 0);
 			if (   strstr (pPartHeader, "name=\"kernelimg\"") != 0
 			    && strstr (pPartHeader, "filename=\"kernel") != 0
-			    && strstr (pPartHeader, ".img\"") != 0
+			    && (   strstr (pPartHeader, ".img\"") != 0
+				|| strstr (pPartHeader, ".img.lz4\"") != 0)
 			    && nPartLength > 0)
 			{
 				u8 *pKernelImage = new u8[nPartLength];
@@ -97,9 +98,16 @@ THTTPStatus CHTTPBootServer::GetContent (const char  *pPath,
 					assert (pPartData != 0);
 					memcpy (pKernelImage, pPartData, nPartLength);
 
-					EnableChainBoot (pKernelImage, nPartLength);
+					if (EnableChainBoot (pKernelImage, nPartLength))
+					{
+						pMsg = "Now booting...";
+					}
+					else
+					{
+						delete [] pKernelImage;
 
-					pMsg = "Now booting...";
+						pMsg = "Invalid kernel image";
+					}
 				}
 				else
 				{
@@ -2,7 +2,7 @@
 // kernel.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2019  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,11 +20,13 @@
 #include "kernel.h"
 #include "httpbootserver.h"
 #include "tftpbootserver.h"
+#include "tcpbootserver.h"
 #include <circle/chainboot.h>
 #include <circle/sysconfig.h>
 #include <assert.h>
 
 #define HTTP_BOOT_PORT		8080
+#define TCP_BOOT_PORT		8888
 
 // Network configuration
 #define USE_DHCP
@@ -112,9 +114,13 @@ TShutdownMode CKernel::Run (void)
 	m_Logger.Write (FromKernel, LogNotice,
 			"Try \"tftp -m binary %s -c put kernel.img\" from another computer!",
 			(const char *) IPString);
+	m_Logger.Write (FromKernel, LogNotice,
+			"Or \"python3 tcpboot.py %s kernel.img\" for fast streaming!",
+			(const char *) IPString);
 
 	new CHTTPBootServer (&m_Net, HTTP_BOOT_PORT, KERNEL_MAX_SIZE + 2000);
 	new CTFTPBootServer (&m_Net, KERNEL_MAX_SIZE);
+	new CTCPBootServer (&m_Net, TCP_BOOT_PORT, KERNEL_MAX_SIZE);
 
 	for (unsigned nCount = 0; !IsChainBootEnabled (); nCount++)
 	{
@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+#
+# tcpboot.py - Streams a kernel image to the TCP boot server of sample/38-bootloader
+#
+# Usage: python3 tcpboot.py IPADDRESS KERNELIMAGE [PORT]
+#
+
+import socket
+import struct
+import sys
+import time
+import zlib
+
+TCP_BOOT_MAGIC = 0x31544243		# "CBT1"
+
+try:
+	host = sys.argv[1]
+	filename = sys.argv[2]
+	port = int(sys.argv[3]) if len(sys.argv) > 3 else 8888
+except Exception:
+	print("Usage: python3 tcpboot.py IPADDRESS KERNELIMAGE [PORT]")
+	sys.exit(1)
+
+with open(filename, "rb") as f:
+	image = f.read()
+
+header = struct.pack("<IIII", TCP_BOOT_MAGIC, len(image), zlib.crc32(image) & 0xFFFFFFFF, 0)
+
+print("Sending " + filename + " (" + str(len(image)) + " bytes) ...")
+sys.stdout.flush()
+
+start = time.time()
+
+try:
+	with socket.create_connection((host, port), timeout=10) as sock:
+		sock.sendall(header + image)
+		reply = sock.makefile().readline().strip()
+except Exception as e:
+	print("ERROR: " + str(e))
+	sys.exit(1)
+
+if reply != "OK":
+	print("ERROR: " + (reply if reply else "No reply"))
+	sys.exit(1)
+
+print("Completed in %.2f seconds!" % (time.time() - start))
@@ -0,0 +1,176 @@
+//
+// tcpbootserver.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "tcpbootserver.h"
+#include <circle/chainboot.h>
+#include <circle/crc32.h>
+#include <circle/netdevice.h>
+#include <circle/net/in.h>
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <circle/string.h>
+#include <circle/util.h>
+#include <assert.h>
+
+static const char FromBootServer[] = "tcpboot";
+
+CTCPBootServer::CTCPBootServer (CNetSubSystem *pNetSubSystem, u16 nPort, size_t nMaxKernelSize)
+:	m_pNetSubSystem (pNetSubSystem),
+	m_nPort (nPort),
+	m_nMaxKernelSize (nMaxKernelSize),
+	m_pBuffer (0)
+{
+	SetName (FromBootServer);
+}
+
+CTCPBootServer::~CTCPBootServer (void)
+{
+	// m_pBuffer is not freed, the kernel image may be referenced by the chain boot
+	m_pNetSubSystem = 0;
+}
+
+void CTCPBootServer::Run (void)
+{
+	// the data is received directly into this buffer, so one frame may exceed the image
+	m_pBuffer = new u8[sizeof (TTCPBootHeader) + m_nMaxKernelSize + FRAME_BUFFER_SIZE];
+	if (m_pBuffer == 0)
+	{
+		CLogger::Get ()->Write (FromBootServer, LogError, "Cannot allocate buffer");
+
+		return;
+	}
+
+	assert (m_pNetSubSystem != 0);
+	CSocket Socket (m_pNetSubSystem, IPPROTO_TCP);
+	if (   Socket.Bind (m_nPort) < 0
+	    || Socket.Listen () < 0)
+	{
+		CLogger::Get ()->Write (FromBootServer, LogError, "Cannot listen on port %u", m_nPort);
+
+		return;
+	}
+
+	while (!IsChainBootEnabled ())
+	{
+		CIPAddress ForeignIP;
+		u16 nForeignPort;
+		CSocket *pConnection = Socket.Accept (&ForeignIP, &nForeignPort);
+		if (pConnection == 0)
+		{
+			continue;
+		}
+
+		const char *pError = ReceiveImage (pConnection);
+
+		CString Reply;
+		if (pError == 0)
+		{
+			Reply = "OK\n";
+		}
+		else
+		{
+			CLogger::Get ()->Write (FromBootServer, LogError, "%s", pError);
+
+			Reply.Format ("ERROR %s\n", pError);
+		}
+
+		pConnection->Send ((const char *) Reply, Reply.GetLength (), 0);
+
+		delete pConnection;
+	}
+}
+
+const char *CTCPBootServer::ReceiveImage (CSocket *pConnection)
+{
+	assert (pConnection != 0);
+	assert (m_pBuffer != 0);
+
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	const TTCPBootHeader *pHeader = (const TTCPBootHeader *) m_pBuffer;
+	u8 *pImage = m_pBuffer + sizeof (TTCPBootHeader);
+
+	size_t nImageSize = 0;
+	size_t nTotalSize = sizeof (TTCPBootHeader);	// until the header has been received
+	size_t nReceived = 0;
+
+	// the checksum is calculated for each received segment, while the next one arrives
+	CCRC32 CRC;
+
+	while (nReceived < nTotalSize)
+	{
+		int nResult = pConnection->Receive (m_pBuffer + nReceived, FRAME_BUFFER_SIZE, 0);
+		if (nResult <= 0)
+		{
+			return "Connection closed";
+		}
+
+		size_t nOldReceived = nReceived;
+		nReceived += nResult;
+
+		if (   nImageSize == 0
+		    && nReceived >= sizeof (TTCPBootHeader))
+		{
+			if (pHeader->nMagic != TCP_BOOT_MAGIC)
+			{
+				return "Invalid header";
+			}
+
+			nImageSize = pHeader->nImageSize;
+			if (   nImageSize == 0
+			    || nImageSize > m_nMaxKernelSize)
+			{
+				return "Invalid image size";
+			}
+
+			nTotalSize += nImageSize;
+
+			CLogger::Get ()->Write (FromBootServer, LogDebug,
+						"Receiving %lu bytes ...", nImageSize);
+
+			nOldReceived = sizeof (TTCPBootHeader);
+		}
+
+		if (nReceived > nTotalSize)
+		{
+			return "Image too long";
+		}
+
+		if (nImageSize != 0)
+		{
+			CRC.Update (m_pBuffer + nOldReceived, nReceived - nOldReceived);
+		}
+	}
+
+	if (CRC.Get () != pHeader->nImageCRC32)
+	{
+		return "CRC error";
+	}
+
+	unsigned nMs = (CTimer::GetClockTicks () - nStartTicks) / (CLOCKHZ / 1000);
+	CLogger::Get ()->Write (FromBootServer, LogNotice, "%lu bytes received in %u ms",
+				nImageSize, nMs);
+
+	if (!EnableChainBoot (pImage, nImageSize))
+	{
+		return "Invalid kernel image";
+	}
+
+	return 0;
+}
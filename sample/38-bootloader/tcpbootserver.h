@@ -0,0 +1,64 @@
+//
+// tcpbootserver.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _tcpbootserver_h
+#define _tcpbootserver_h
+
+#include <circle/sched/task.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/net/socket.h>
+#include <circle/macros.h>
+#include <circle/types.h>
+
+// Receives a kernel image, which is streamed via a TCP connection (see tcpboot.py), and
+// verifies its CRC-32 during reception. The stream starts with a header:
+
+struct TTCPBootHeader
+{
+	u32	nMagic;
+#define TCP_BOOT_MAGIC		0x31544243		// "CBT1"
+	u32	nImageSize;
+	u32	nImageCRC32;		// CRC-32 of the image (see crc32.h)
+	u32	nReserved;		// set to 0
+}
+PACKED;
+
+// The server replies with "OK\n" or with "ERROR <reason>\n" and closes the connection.
+
+class CTCPBootServer : public CTask
+{
+public:
+	CTCPBootServer (CNetSubSystem *pNetSubSystem, u16 nPort, size_t nMaxKernelSize);
+	~CTCPBootServer (void);
+
+	void Run (void);
+
+private:
+	// returns error message or 0 on success
+	const char *ReceiveImage (CSocket *pConnection);
+
+private:
+	CNetSubSystem *m_pNetSubSystem;
+	u16 m_nPort;
+	size_t m_nMaxKernelSize;
+
+	u8 *m_pBuffer;				// header and kernel image
+};
+
+#endif
@@ -62,9 +62,12 @@ boolean CTFTPBootServer::FileCreate (const char *pFileName)
 	}
 
 	static const char FileExt[] = ".img";
+	static const char FileExtLZ4[] = ".img.lz4";		// LZ4 compressed image
 	size_t nLen = strlen (pFileName);
 	assert (nLen > sizeof FileExt);
-	if (strcmp (&pFileName[nLen - (sizeof FileExt-1)], FileExt) != 0)
+	if (   strcmp (&pFileName[nLen - (sizeof FileExt-1)], FileExt) != 0
+	    && (   nLen <= sizeof FileExtLZ4
+		|| strcmp (&pFileName[nLen - (sizeof FileExtLZ4-1)], FileExtLZ4) != 0))
 	{
 		return FALSE;
 	}
@@ -94,9 +97,12 @@ boolean CTFTPBootServer::FileClose (void)
 
 	m_bFileOpen = FALSE;
 
-	if (m_nCurrentOffset > 0)
+	if (   m_nCurrentOffset > 0
+	    && !EnableChainBoot (m_pKernelBuffer, m_nCurrentOffset))
 	{
-		EnableChainBoot (m_pKernelBuffer, m_nCurrentOffset);
+		CLogger::Get ()->Write (FromBootServer, LogError, "Invalid kernel image");
+
+		return FALSE;
 	}
 
 	return TRUE;
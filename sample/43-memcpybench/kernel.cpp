@@ -0,0 +1,276 @@
+//
+// kernel.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "kernel.h"
+#include "oldcopy.h"
+#include <circle/util.h>
+#include <assert.h>
+
+#define BUFFER_SIZE	0x20000			// bytes per buffer
+#define BYTES_PER_TEST	0x800000		// copied on each measurement
+
+#define VERIFY_OFFSETS	16
+#define VERIFY_LENGTH	300
+
+static const char FromKernel[] = "kernel";
+
+static const size_t Lengths[] = {8, 16, 64, 256, 1500, 4096, 0x10000};
+
+CKernel::CKernel (void)
+:	m_Screen (m_Options.GetWidth (), m_Options.GetHeight ()),
+	m_Timer (&m_Interrupt),
+	m_Logger (m_Options.GetLogLevel (), &m_Timer),
+	m_pBuffer1 (0),
+	m_pBuffer2 (0)
+{
+	m_ActLED.Blink (5);	// show we are alive
+}
+
+CKernel::~CKernel (void)
+{
+	delete [] m_pBuffer1;
+	delete [] m_pBuffer2;
+}
+
+boolean CKernel::Initialize (void)
+{
+	boolean bOK = TRUE;
+
+	if (bOK)
+	{
+		bOK = m_Screen.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Serial.Initialize (115200);
+	}
+
+	if (bOK)
+	{
+		CDevice *pTarget = m_DeviceNameService.GetDevice (m_Options.GetLogDevice (), FALSE);
+		if (pTarget == 0)
+		{
+			pTarget = &m_Screen;
+		}
+
+		bOK = m_Logger.Initialize (pTarget);
+	}
+
+	if (bOK)
+	{
+		bOK = m_Interrupt.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Timer.Initialize ();
+	}
+
+	if (bOK)
+	{
+		m_pBuffer1 = new u8[BUFFER_SIZE];
+		m_pBuffer2 = new u8[BUFFER_SIZE];
+
+		bOK = m_pBuffer1 != 0 && m_pBuffer2 != 0;
+	}
+
+	return bOK;
+}
+
+TShutdownMode CKernel::Run (void)
+{
+	m_Logger.Write (FromKernel, LogNotice, "Compile time: " __DATE__ " " __TIME__);
+
+	if (!Verify ())
+	{
+		return ShutdownHalt;
+	}
+
+	m_Logger.Write (FromKernel, LogNotice, "Throughput in MByte/s (new / old)");
+
+	BenchCopy ("memcpy", memcpy, oldmemcpy, 0, 0);
+	BenchCopy ("memcpy", memcpy, oldmemcpy, 1, 0);
+	BenchCopy ("memcpy", memcpy, oldmemcpy, 0, 3);
+	BenchCopy ("memcpy", memcpy, oldmemcpy, 2, 5);
+
+	BenchCopy ("memmove", memmove, oldmemmove, 8, 0, TRUE);
+	BenchCopy ("memmove", memmove, oldmemmove, 9, 0, TRUE);
+
+	BenchSet ();
+
+	m_Logger.Write (FromKernel, LogNotice, "Benchmark completed");
+
+	return ShutdownHalt;
+}
+
+boolean CKernel::Verify (void)
+{
+	// the old routines copy byte by byte in the misaligned case and serve as reference
+	u8 *pResult = m_pBuffer1;
+	u8 *pExpected = m_pBuffer2;
+	const size_t nArea = VERIFY_OFFSETS + VERIFY_LENGTH + VERIFY_OFFSETS;
+
+	for (unsigned nMode = 0; nMode < 3; nMode++)
+	{
+		for (int nDestOffset = 0; nDestOffset < VERIFY_OFFSETS; nDestOffset++)
+		{
+			for (int nSrcOffset = 0; nSrcOffset < VERIFY_OFFSETS; nSrcOffset++)
+			{
+				for (size_t nLength = 0; nLength <= VERIFY_LENGTH; nLength++)
+				{
+					for (size_t i = 0; i < 2*nArea; i++)
+					{
+						pResult[i] = pExpected[i] = (u8) (i * 7 + 1);
+					}
+
+					switch (nMode)
+					{
+					case 0:
+						memcpy (pResult + nDestOffset,
+							pResult + nArea + nSrcOffset, nLength);
+						oldmemcpy (pExpected + nDestOffset,
+							   pExpected + nArea + nSrcOffset, nLength);
+						break;
+
+					case 1:		// overlapping
+						memmove (pResult + nDestOffset,
+							 pResult + nSrcOffset, nLength);
+						oldmemmove (pExpected + nDestOffset,
+							    pExpected + nSrcOffset, nLength);
+						break;
+
+					case 2:
+						memset (pResult + nDestOffset, nSrcOffset + 0xF0, nLength);
+						oldmemset (pExpected + nDestOffset, nSrcOffset + 0xF0, nLength);
+						break;
+					}
+
+					if (memcmp (pResult, pExpected, 2*nArea) != 0)
+					{
+						static const char *Names[] = {"memcpy", "memmove", "memset"};
+
+						m_Logger.Write (FromKernel, LogError,
+								"%s failed (dest +%d, src +%d, length %u)",
+								Names[nMode], nDestOffset, nSrcOffset,
+								(unsigned) nLength);
+
+						return FALSE;
+					}
+				}
+			}
+		}
+	}
+
+	m_Logger.Write (FromKernel, LogNotice, "Verification passed");
+
+	return TRUE;
+}
+
+void CKernel::BenchCopy (const char *pName, TCopyFunction *pNew, TCopyFunction *pOld,
+			 int nDestOffset, int nSrcOffset, boolean bOverlap)
+{
+	CString Line;
+	Line.Format ("%-7s dest +%d src +%d%s:", pName, nDestOffset, nSrcOffset,
+		     bOverlap ? " (overlap)" : "");
+
+	// on overlap the destination is above the source in the same buffer
+	const u8 *pSrc = bOverlap ? m_pBuffer1 : m_pBuffer2;
+
+	for (unsigned i = 0; i < sizeof Lengths / sizeof Lengths[0]; i++)
+	{
+		size_t nLength = Lengths[i];
+		assert (nLength + 16 <= BUFFER_SIZE);
+
+		unsigned nNew = MeasureCopy (pNew, m_pBuffer1 + nDestOffset,
+					     pSrc + nSrcOffset, nLength);
+		unsigned nOld = MeasureCopy (pOld, m_pBuffer1 + nDestOffset,
+					     pSrc + nSrcOffset, nLength);
+
+		CString Result;
+		Result.Format (" %u:%u/%u", (unsigned) nLength, nNew, nOld);
+		Line.Append (Result);
+	}
+
+	m_Logger.Write (FromKernel, LogNotice, "%s", (const char *) Line);
+}
+
+void CKernel::BenchSet (void)
+{
+	for (int nDestOffset = 0; nDestOffset <= 1; nDestOffset++)
+	{
+		CString Line;
+		Line.Format ("%-7s dest +%d:", "memset", nDestOffset);
+
+		for (unsigned i = 0; i < sizeof Lengths / sizeof Lengths[0]; i++)
+		{
+			size_t nLength = Lengths[i];
+
+			unsigned nNew = MeasureSet (memset, m_pBuffer1 + nDestOffset, nLength);
+			unsigned nOld = MeasureSet (oldmemset, m_pBuffer1 + nDestOffset, nLength);
+
+			CString Result;
+			Result.Format (" %u:%u/%u", (unsigned) nLength, nNew, nOld);
+			Line.Append (Result);
+		}
+
+		m_Logger.Write (FromKernel, LogNotice, "%s", (const char *) Line);
+	}
+}
+
+unsigned CKernel::MeasureCopy (TCopyFunction *pFunction, u8 *pDest, const u8 *pSrc, size_t nLength)
+{
+	unsigned nCount = BYTES_PER_TEST / nLength;
+
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		(*pFunction) (pDest, pSrc, nLength);
+	}
+
+	unsigned nTicks = CTimer::GetClockTicks () - nStartTicks;
+	if (nTicks == 0)
+	{
+		nTicks = 1;
+	}
+
+	// CLOCKHZ is 1 MHz, so bytes per tick is MByte/s
+	return (unsigned) ((u64) nCount * nLength / nTicks);
+}
+
+unsigned CKernel::MeasureSet (TSetFunction *pFunction, u8 *pDest, size_t nLength)
+{
+	unsigned nCount = BYTES_PER_TEST / nLength;
+
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		(*pFunction) (pDest, 0x55, nLength);
+	}
+
+	unsigned nTicks = CTimer::GetClockTicks () - nStartTicks;
+	if (nTicks == 0)
+	{
+		nTicks = 1;
+	}
+
+	return (unsigned) ((u64) nCount * nLength / nTicks);
+}
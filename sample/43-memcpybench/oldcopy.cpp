@@ -0,0 +1,123 @@
+//
+// oldcopy.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "oldcopy.h"
+
+// prevent the compiler from replacing the loops with calls to the library functions
+#define NOLIBCALL	__attribute__ ((optimize ("no-tree-loop-distribute-patterns")))
+
+#if AARCH == 32
+	#define WORD_MASK	3
+	typedef u32 TWord;
+#else
+	#define WORD_MASK	7
+	typedef u64 TWord;
+#endif
+
+NOLIBCALL
+void *oldmemcpy (void *pDest, const void *pSrc, size_t nLength)
+{
+	u8 *pDest8 = (u8 *) pDest;
+	const u8 *pSrc8 = (const u8 *) pSrc;
+
+	// block copy only, if both pointers are aligned and the length is above 127
+	if (   nLength > 127
+	    && (((uintptr) pDest8 | (uintptr) pSrc8) & WORD_MASK) == 0)
+	{
+		TWord *pDestW = (TWord *) pDest8;
+		const TWord *pSrcW = (const TWord *) pSrc8;
+
+		while (nLength >= 32)
+		{
+			for (unsigned i = 0; i < 32 / sizeof (TWord); i++)
+			{
+				*pDestW++ = *pSrcW++;
+			}
+
+			nLength -= 32;
+		}
+
+		pDest8 = (u8 *) pDestW;
+		pSrc8 = (const u8 *) pSrcW;
+	}
+
+	while (nLength--)
+	{
+		*pDest8++ = *pSrc8++;
+	}
+
+	return pDest;
+}
+
+NOLIBCALL
+void *oldmemmove (void *pDest, const void *pSrc, size_t nLength)
+{
+	u8 *pDest8 = (u8 *) pDest;
+	const u8 *pSrc8 = (const u8 *) pSrc;
+
+	if (   pSrc8 < pDest8
+	    && pDest8 < pSrc8 + nLength)
+	{
+		pSrc8 += nLength;
+		pDest8 += nLength;
+
+		while (nLength--)
+		{
+			*--pDest8 = *--pSrc8;
+		}
+
+		return pDest;
+	}
+
+	return oldmemcpy (pDest, pSrc, nLength);
+}
+
+NOLIBCALL
+void *oldmemset (void *pDest, int nValue, size_t nLength)
+{
+	u8 *pDest8 = (u8 *) pDest;
+
+	if (   nLength >= 16
+	    && ((uintptr) pDest8 & WORD_MASK) == 0)
+	{
+		u32 nValue32 = (u8) nValue;
+		nValue32 |= nValue32 << 8;
+		nValue32 |= nValue32 << 16;
+
+		u32 *pDest32 = (u32 *) pDest8;
+		while (nLength >= 16)
+		{
+			*pDest32++ = nValue32;
+			*pDest32++ = nValue32;
+			*pDest32++ = nValue32;
+			*pDest32++ = nValue32;
+
+			nLength -= 16;
+		}
+
+		pDest8 = (u8 *) pDest32;
+	}
+
+	while (nLength--)
+	{
+		*pDest8++ = (u8) nValue;
+	}
+
+	return pDest;
+}
@@ -0,0 +1,31 @@
+//
+// oldcopy.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _oldcopy_h
+#define _oldcopy_h
+
+#include <circle/types.h>
+
+// The previous implementations of memcpy(), memmove() and memset() for comparison
+
+void *oldmemcpy (void *pDest, const void *pSrc, size_t nLength);
+void *oldmemmove (void *pDest, const void *pSrc, size_t nLength);
+void *oldmemset (void *pDest, int nValue, size_t nLength);
+
+#endif
@@ -0,0 +1,144 @@
+//
+// kernel.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "kernel.h"
+#include <circle/boottrace.h>
+#include <assert.h>
+
+// define this to let the main loop run, while USB and network are initialized
+//#define DEFER_INIT
+
+static const char FromKernel[] = "kernel";
+
+CKernel::CKernel (void)
+:	m_Screen (m_Options.GetWidth (), m_Options.GetHeight ()),
+	m_Timer (&m_Interrupt),
+	m_Logger (m_Options.GetLogLevel (), &m_Timer),
+	m_USBHCI (&m_Interrupt, &m_Timer)
+{
+	// USB and network are initialized as CInitSequencer steps in Run()
+	m_nInitUSB = m_InitSequencer.AddStep ("init-usb", InitUSB, this);
+	m_nInitNet = m_InitSequencer.AddStep ("init-net", InitNet, this, m_nInitUSB);
+
+	CBootTrace::Mark ("kernel");
+
+	m_ActLED.Blink (5);	// show we are alive
+}
+
+CKernel::~CKernel (void)
+{
+}
+
+boolean CKernel::Initialize (void)
+{
+	boolean bOK = TRUE;
+
+	if (bOK)
+	{
+		bOK = m_Screen.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Serial.Initialize (115200);
+
+		CBootTrace::Mark ("serial");
+	}
+
+	if (bOK)
+	{
+		CDevice *pTarget = m_DeviceNameService.GetDevice (m_Options.GetLogDevice (), FALSE);
+		if (pTarget == 0)
+		{
+			pTarget = &m_Screen;
+		}
+
+		bOK = m_Logger.Initialize (pTarget);
+	}
+
+	if (bOK)
+	{
+		bOK = m_Interrupt.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Timer.Initialize ();
+	}
+
+	return bOK;
+}
+
+TShutdownMode CKernel::Run (void)
+{
+	CBootTrace::Mark ("run");
+
+	m_Logger.Write (FromKernel, LogNotice, "Compile time: " __DATE__ " " __TIME__);
+
+#ifndef DEFER_INIT
+	if (!m_InitSequencer.Run ())
+	{
+		return ShutdownHalt;
+	}
+#else
+	m_InitSequencer.Start ();
+
+	// the main loop of the application would start here
+	for (unsigned nCount = 0; !m_InitSequencer.IsComplete (); nCount++)
+	{
+		m_Screen.Rotor (0, nCount);
+
+		m_Scheduler.Yield ();
+	}
+
+	if (m_InitSequencer.GetFailedSteps ())
+	{
+		return ShutdownHalt;
+	}
+#endif
+
+	m_Logger.Write (FromKernel, LogNotice, "Boot timeline (time since power-on, step duration):");
+
+	CBootTrace::Dump ();
+
+	unsigned nTicks;
+	CBootTrace::GetEvent (CBootTrace::GetCount ()-1, &nTicks);
+	m_Logger.Write (FromKernel, LogNotice, "Ready after %u ms", nTicks / 1000);
+
+	// the table on the serial interface can be parsed by a CI script
+	CBootTrace::Write (&m_Serial);
+
+	return ShutdownHalt;
+}
+
+boolean CKernel::InitUSB (void *pParam)
+{
+	CKernel *pThis = (CKernel *) pParam;
+	assert (pThis != 0);
+
+	return pThis->m_USBHCI.Initialize ();
+}
+
+boolean CKernel::InitNet (void *pParam)
+{
+	CKernel *pThis = (CKernel *) pParam;
+	assert (pThis != 0);
+
+	return pThis->m_Net.Initialize ();	// waits for DHCP
+}
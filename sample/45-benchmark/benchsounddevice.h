@@ -0,0 +1,43 @@
+//
+// benchsounddevice.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _benchsounddevice_h
+#define _benchsounddevice_h
+
+#include <circle/soundbasedevice.h>
+#include <circle/types.h>
+
+class CBenchSoundDevice : public CSoundBaseDevice	// sound device without hardware
+{
+public:
+	CBenchSoundDevice (TSoundFormat HWFormat, unsigned nSampleRate);
+	~CBenchSoundDevice (void);
+
+	boolean Start (void);
+	void Cancel (void);
+	boolean IsActive (void) const;
+
+	/// \brief Fetch the converted samples from the queue, like the DMA interrupt does
+	/// \param pBuffer Buffer for the samples in HW format
+	/// \param nChunkSize Size of the buffer in words
+	/// \return Number of words returned
+	unsigned Drain (u32 *pBuffer, unsigned nChunkSize);
+};
+
+#endif
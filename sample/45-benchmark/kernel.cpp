@@ -0,0 +1,549 @@
+//
+// kernel.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "kernel.h"
+#include "yieldtask.h"
+#include <circle/net/ipaddress.h>
+#include <circle/net/in.h>
+#include <circle/machineinfo.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define WARMUP			3
+#define REPETITIONS		21
+
+#define BUFFER_SIZE		0x100000	// bytes per buffer
+
+#define HEAP_BLOCKS		100		// allocated per repetition
+#define YIELD_COUNT		1000		// task switches to the partner task per repetition
+#define NET_QUEUE_FRAMES	1000		// enqueued and dequeued per repetition
+#define NET_FRAME_SIZE		1500
+#define TCP_SEND_SIZE		0x40000		// bytes per repetition
+#define FILE_SIZE		0x100000	// written and read per repetition
+#define FILE_CHUNK_SIZE		0x10000
+#define BLOCK_READ_SIZE		0x40000		// bytes per repetition, from offset 0
+#define SOUND_SAMPLE_RATE	48000
+#define SOUND_FRAMES		4800		// converted per repetition (100 ms)
+#define SOUND_CHUNK_SIZE	384		// words fetched at once (divides SOUND_FRAMES * 2)
+
+#define PARTITION		"emmc1-1"
+#define TEMP_FILE		"bench.tmp"
+#define RESULT_FILE		"results.csv"
+
+#ifdef USE_NETWORK
+// TCP servers, which receive the TCP benchmark data and the results
+// (e.g. "nc -l -p 5001 > /dev/null" and "nc -l -p 5002 > results.csv")
+static const u8 TCPServer[]	= {192, 168, 0, 100};
+static const u16 usSinkPort	= 5001;
+static const u16 usResultPort	= 5002;
+#endif
+
+static const char FromKernel[] = "kernel";
+
+static void *HeapBlock[HEAP_BLOCKS];
+
+CKernel *CKernel::s_pThis = 0;
+
+CKernel::CKernel (void)
+:	m_Screen (m_Options.GetWidth (), m_Options.GetHeight ()),
+	m_Timer (&m_Interrupt),
+	m_Logger (m_Options.GetLogLevel (), &m_Timer),
+	m_CPUThrottle (CPUSpeedMaximum),
+	m_USBHCI (&m_Interrupt, &m_Timer),
+	m_EMMC (&m_Interrupt, &m_Timer, &m_ActLED),
+#ifdef USE_NETWORK
+	m_pSocket (0),
+#endif
+	m_bFileSystemMounted (FALSE),
+	m_Benchmark (WARMUP, REPETITIONS),
+	m_pBuffer1 (0),
+	m_pBuffer2 (0),
+	m_pUSBStorage (0),
+	m_SoundS16 (SoundFormatSigned24_32, SOUND_SAMPLE_RATE),
+	m_SoundFloat (SoundFormatSigned24_32, SOUND_SAMPLE_RATE),
+	m_SoundIEC958 (SoundFormatIEC958, SOUND_SAMPLE_RATE),
+	m_pSamplesS16 (0),
+	m_pSamplesFloat (0)
+{
+	s_pThis = this;
+
+	m_ActLED.Blink (5);	// show we are alive
+}
+
+CKernel::~CKernel (void)
+{
+	delete [] m_pSamplesFloat;
+	delete [] m_pSamplesS16;
+	delete [] m_pBuffer2;
+	delete [] m_pBuffer1;
+
+	s_pThis = 0;
+}
+
+boolean CKernel::Initialize (void)
+{
+	boolean bOK = TRUE;
+
+	if (bOK)
+	{
+		bOK = m_Screen.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Serial.Initialize (115200);
+	}
+
+	if (bOK)
+	{
+		CDevice *pTarget = m_DeviceNameService.GetDevice (m_Options.GetLogDevice (), FALSE);
+		if (pTarget == 0)
+		{
+			pTarget = &m_Screen;
+		}
+
+		bOK = m_Logger.Initialize (pTarget);
+	}
+
+	if (bOK)
+	{
+		bOK = m_Interrupt.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Timer.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_USBHCI.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_EMMC.Initialize ();
+	}
+
+#ifdef USE_NETWORK
+	if (bOK)
+	{
+		bOK = m_Net.Initialize ();
+	}
+#endif
+
+	if (bOK)
+	{
+		m_pBuffer1 = new u8[BUFFER_SIZE];
+		m_pBuffer2 = new u8[BUFFER_SIZE];
+		m_pSamplesS16 = new s16[SOUND_FRAMES * SOUND_HW_CHANNELS];
+		m_pSamplesFloat = new float[SOUND_FRAMES * SOUND_HW_CHANNELS];
+
+		bOK =    m_pBuffer1 != 0 && m_pBuffer2 != 0
+		      && m_pSamplesS16 != 0 && m_pSamplesFloat != 0;
+	}
+
+	if (bOK)
+	{
+		bOK =    m_SoundS16.AllocateQueueFrames (SOUND_FRAMES)
+		      && m_SoundFloat.AllocateQueueFrames (SOUND_FRAMES)
+		      && m_SoundIEC958.AllocateQueueFrames (SOUND_FRAMES);
+	}
+
+	return bOK;
+}
+
+TShutdownMode CKernel::Run (void)
+{
+	m_Logger.Write (FromKernel, LogNotice, "Compile time: " __DATE__ " " __TIME__);
+
+	m_Logger.Write (FromKernel, LogNotice, "%s at %u MHz",
+			CMachineInfo::Get ()->GetMachineName (), m_CPUThrottle.GetClockRate () / 1000000);
+
+	// test data
+	for (unsigned i = 0; i < BUFFER_SIZE; i++)
+	{
+		m_pBuffer1[i] = (u8) (i * 7 + 1);
+	}
+
+	for (unsigned i = 0; i < SOUND_FRAMES * SOUND_HW_CHANNELS; i++)
+	{
+		int nSample = (int) (i % 200) * 300 - 30000;	// sawtooth
+
+		m_pSamplesS16[i] = (s16) nSample;
+		m_pSamplesFloat[i] = nSample / 32768.0f;
+	}
+
+	m_SoundS16.SetWriteFormat (SoundFormatSigned16);
+	m_SoundFloat.SetWriteFormat (SoundFormatFloat32);
+	m_SoundIEC958.SetWriteFormat (SoundFormatSigned16);
+
+	CDevice *pPartition = m_DeviceNameService.GetDevice (PARTITION, TRUE);
+	if (   pPartition != 0
+	    && m_FileSystem.Mount (pPartition))
+	{
+		m_bFileSystemMounted = TRUE;
+	}
+	else
+	{
+		m_Logger.Write (FromKernel, LogWarning, "Cannot mount partition: %s", PARTITION);
+	}
+
+	m_pUSBStorage = m_DeviceNameService.GetDevice ("umsd1", TRUE);
+
+#ifdef USE_NETWORK
+	while (!m_Net.IsRunning ())
+	{
+		m_Scheduler.MsSleep (100);
+	}
+
+	CIPAddress ServerIP (TCPServer);
+
+	m_pSocket = new CSocket (&m_Net, IPPROTO_TCP);
+	assert (m_pSocket != 0);
+	if (m_pSocket->Connect (ServerIP, usSinkPort) < 0)
+	{
+		m_Logger.Write (FromKernel, LogWarning, "Cannot connect to TCP sink");
+
+		delete m_pSocket;
+		m_pSocket = 0;
+	}
+#endif
+
+	RegisterBenchmarks ();
+
+	unsigned nAborted = m_Benchmark.Run ("mem");
+	nAborted += m_Benchmark.Run ("heap");
+
+	CYieldTask *pYieldTask = new CYieldTask;
+	assert (pYieldTask != 0);
+	nAborted += m_Benchmark.Run ("sched");
+	pYieldTask->Stop ();
+	m_Scheduler.Yield ();		// let the task terminate
+
+	nAborted += m_Benchmark.Run ("net");
+	nAborted += m_Benchmark.Run ("fat");
+	nAborted += m_Benchmark.Run ("block");
+	nAborted += m_Benchmark.Run ("sound");
+
+#ifdef USE_NETWORK
+	delete m_pSocket;
+	m_pSocket = 0;
+#endif
+
+	m_Benchmark.Dump ();
+
+	WriteResults ();
+
+	if (m_bFileSystemMounted)
+	{
+		m_FileSystem.UnMount ();
+	}
+
+	m_Logger.Write (FromKernel, LogNotice, "Benchmark completed (%u aborted)", nAborted);
+
+	return ShutdownHalt;
+}
+
+void CKernel::RegisterBenchmarks (void)
+{
+	m_Benchmark.Register ("mem", "memcpy-4k", Memcpy, (void *) 0x1000, 0x1000);
+	m_Benchmark.Register ("mem", "memcpy-64k", Memcpy, (void *) 0x10000, 0x10000);
+	m_Benchmark.Register ("mem", "memcpy-1m", Memcpy, (void *) 0x100000, 0x100000);
+	m_Benchmark.Register ("mem", "memset-4k", Memset, (void *) 0x1000, 0x1000);
+	m_Benchmark.Register ("mem", "memset-64k", Memset, (void *) 0x10000, 0x10000);
+	m_Benchmark.Register ("mem", "memset-1m", Memset, (void *) 0x100000, 0x100000);
+
+	m_Benchmark.Register ("heap", "alloc-free-64", Heap, (void *) 64);
+	m_Benchmark.Register ("heap", "alloc-free-4k", Heap, (void *) 0x1000);
+	m_Benchmark.Register ("heap", "alloc-free-64k", Heap, (void *) 0x10000);
+
+	m_Benchmark.Register ("sched", "yield", TaskSwitch);
+
+	m_Benchmark.Register ("net", "netqueue", NetQueue, 0,
+			      NET_QUEUE_FRAMES * NET_FRAME_SIZE);
+#ifdef USE_NETWORK
+	if (m_pSocket != 0)
+	{
+		m_Benchmark.Register ("net", "tcp-send", TCPSend, 0, TCP_SEND_SIZE);
+	}
+#endif
+
+	if (m_bFileSystemMounted)
+	{
+		m_Benchmark.Register ("fat", "write", FATWrite, 0, FILE_SIZE);
+		m_Benchmark.Register ("fat", "read", FATRead, 0, FILE_SIZE);
+	}
+
+	m_Benchmark.Register ("block", "sd-read", SDRead, 0, BLOCK_READ_SIZE);
+	if (m_pUSBStorage != 0)
+	{
+		m_Benchmark.Register ("block", "usb-read", USBRead, 0, BLOCK_READ_SIZE);
+	}
+
+	m_Benchmark.Register ("sound", "s16-to-s24", SoundS16, 0,
+			      SOUND_FRAMES * SOUND_HW_CHANNELS * sizeof (s16));
+	m_Benchmark.Register ("sound", "float-to-s24", SoundFloat, 0,
+			      SOUND_FRAMES * SOUND_HW_CHANNELS * sizeof (float));
+	m_Benchmark.Register ("sound", "s16-to-iec958", SoundIEC958, 0,
+			      SOUND_FRAMES * SOUND_HW_CHANNELS * sizeof (s16));
+}
+
+void CKernel::WriteResults (void)
+{
+	// JSON to the serial interface
+	m_Benchmark.WriteJSON (&m_Serial);
+
+	// CSV to the SD card
+	if (m_bFileSystemMounted)
+	{
+		m_FileSystem.FileDelete (TEMP_FILE);
+
+		unsigned hFile = m_FileSystem.FileCreate (RESULT_FILE);
+		if (hFile != 0)
+		{
+			m_Benchmark.WriteCSV (FileWriteHandler, (void *) (uintptr) hFile);
+
+			m_FileSystem.FileClose (hFile);
+		}
+		else
+		{
+			m_Logger.Write (FromKernel, LogWarning, "Cannot create file: %s", RESULT_FILE);
+		}
+	}
+
+#ifdef USE_NETWORK
+	// CSV to a TCP server
+	CIPAddress ServerIP (TCPServer);
+	CSocket Socket (&m_Net, IPPROTO_TCP);
+	if (Socket.Connect (ServerIP, usResultPort) >= 0)
+	{
+		m_Benchmark.WriteCSV (SocketWriteHandler, &Socket);
+	}
+	else
+	{
+		m_Logger.Write (FromKernel, LogWarning, "Cannot connect to result server");
+	}
+#endif
+}
+
+boolean CKernel::Memcpy (void *pParam)
+{
+	memcpy (s_pThis->m_pBuffer2, s_pThis->m_pBuffer1, (size_t) (uintptr) pParam);
+
+	return TRUE;
+}
+
+boolean CKernel::Memset (void *pParam)
+{
+	memset (s_pThis->m_pBuffer2, 0x55, (size_t) (uintptr) pParam);
+
+	return TRUE;
+}
+
+boolean CKernel::Heap (void *pParam)
+{
+	size_t nSize = (size_t) (uintptr) pParam;
+
+	for (unsigned i = 0; i < HEAP_BLOCKS; i++)
+	{
+		HeapBlock[i] = new u8[nSize];
+		if (HeapBlock[i] == 0)
+		{
+			return FALSE;
+		}
+	}
+
+	for (unsigned i = 0; i < HEAP_BLOCKS; i++)
+	{
+		delete [] (u8 *) HeapBlock[i];
+	}
+
+	return TRUE;
+}
+
+boolean CKernel::TaskSwitch (void *pParam)
+{
+	for (unsigned i = 0; i < YIELD_COUNT; i++)
+	{
+		s_pThis->m_Scheduler.Yield ();
+	}
+
+	return TRUE;
+}
+
+boolean CKernel::NetQueue (void *pParam)
+{
+	CNetQueue *pQueue = &s_pThis->m_NetQueue;
+
+	for (unsigned i = 0; i < NET_QUEUE_FRAMES; i++)
+	{
+		pQueue->Enqueue (s_pThis->m_pBuffer1, NET_FRAME_SIZE);
+	}
+
+	for (unsigned i = 0; i < NET_QUEUE_FRAMES; i++)
+	{
+		if (pQueue->Dequeue (s_pThis->m_pBuffer2) != NET_FRAME_SIZE)
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+boolean CKernel::TCPSend (void *pParam)
+{
+#ifdef USE_NETWORK
+	assert (s_pThis->m_pSocket != 0);
+	return s_pThis->m_pSocket->Send (s_pThis->m_pBuffer1, TCP_SEND_SIZE, 0) == TCP_SEND_SIZE;
+#else
+	return FALSE;
+#endif
+}
+
+boolean CKernel::FATWrite (void *pParam)
+{
+	CFATFileSystem *pFileSystem = &s_pThis->m_FileSystem;
+
+	unsigned hFile = pFileSystem->FileCreate (TEMP_FILE);
+	if (hFile == 0)
+	{
+		return FALSE;
+	}
+
+	boolean bOK = TRUE;
+	for (unsigned nOffset = 0; nOffset < FILE_SIZE; nOffset += FILE_CHUNK_SIZE)
+	{
+		if (pFileSystem->FileWrite (hFile, s_pThis->m_pBuffer1 + nOffset,
+					    FILE_CHUNK_SIZE) != FILE_CHUNK_SIZE)
+		{
+			bOK = FALSE;
+
+			break;
+		}
+	}
+
+	return pFileSystem->FileClose (hFile) && bOK;
+}
+
+boolean CKernel::FATRead (void *pParam)
+{
+	CFATFileSystem *pFileSystem = &s_pThis->m_FileSystem;
+
+	unsigned hFile = pFileSystem->FileOpen (TEMP_FILE);
+	if (hFile == 0)
+	{
+		return FALSE;
+	}
+
+	boolean bOK = TRUE;
+	for (unsigned nOffset = 0; nOffset < FILE_SIZE; nOffset += FILE_CHUNK_SIZE)
+	{
+		if (pFileSystem->FileRead (hFile, s_pThis->m_pBuffer2 + nOffset,
+					   FILE_CHUNK_SIZE) != FILE_CHUNK_SIZE)
+		{
+			bOK = FALSE;
+
+			break;
+		}
+	}
+
+	return pFileSystem->FileClose (hFile) && bOK;
+}
+
+boolean CKernel::SDRead (void *pParam)
+{
+	return BlockRead (&s_pThis->m_EMMC);
+}
+
+boolean CKernel::USBRead (void *pParam)
+{
+	return BlockRead (s_pThis->m_pUSBStorage);
+}
+
+boolean CKernel::SoundS16 (void *pParam)
+{
+	return SoundConvert (&s_pThis->m_SoundS16, s_pThis->m_pSamplesS16,
+			     SOUND_HW_CHANNELS * sizeof (s16));
+}
+
+boolean CKernel::SoundFloat (void *pParam)
+{
+	return SoundConvert (&s_pThis->m_SoundFloat, s_pThis->m_pSamplesFloat,
+			     SOUND_HW_CHANNELS * sizeof (float));
+}
+
+boolean CKernel::SoundIEC958 (void *pParam)
+{
+	return SoundConvert (&s_pThis->m_SoundIEC958, s_pThis->m_pSamplesS16,
+			     SOUND_HW_CHANNELS * sizeof (s16));
+}
+
+boolean CKernel::BlockRead (CDevice *pDevice)
+{
+	assert (pDevice != 0);
+
+	if (pDevice->Seek (0) != 0)
+	{
+		return FALSE;
+	}
+
+	return pDevice->Read (s_pThis->m_pBuffer2, BLOCK_READ_SIZE) == BLOCK_READ_SIZE;
+}
+
+boolean CKernel::SoundConvert (CBenchSoundDevice *pDevice, const void *pSamples,
+			       unsigned nFrameSize)
+{
+	assert (pDevice != 0);
+
+	int nBytes = SOUND_FRAMES * nFrameSize;
+	if (pDevice->Write (pSamples, nBytes) != nBytes)
+	{
+		return FALSE;
+	}
+
+	// fetch the converted samples like the DMA interrupt handler would do
+	u32 *pChunk = (u32 *) s_pThis->m_pBuffer2;
+	for (unsigned i = 0; i < SOUND_FRAMES * SOUND_HW_CHANNELS / SOUND_CHUNK_SIZE; i++)
+	{
+		pDevice->Drain (pChunk, SOUND_CHUNK_SIZE);
+	}
+
+	return pDevice->GetQueueFramesAvail () == 0;
+}
+
+void CKernel::FileWriteHandler (const void *pBuffer, size_t nLength, void *pParam)
+{
+	unsigned hFile = (unsigned) (uintptr) pParam;
+
+	s_pThis->m_FileSystem.FileWrite (hFile, pBuffer, nLength);
+}
+
+#ifdef USE_NETWORK
+
+void CKernel::SocketWriteHandler (const void *pBuffer, size_t nLength, void *pParam)
+{
+	CSocket *pSocket = (CSocket *) pParam;
+	assert (pSocket != 0);
+
+	pSocket->Send (pBuffer, nLength, 0);
+}
+
+#endif
@@ -0,0 +1,132 @@
+//
+// kernel.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _kernel_h
+#define _kernel_h
+
+#include <circle/actled.h>
+#include <circle/koptions.h>
+#include <circle/devicenameservice.h>
+#include <circle/screen.h>
+#include <circle/serial.h>
+#include <circle/exceptionhandler.h>
+#include <circle/interrupt.h>
+#include <circle/timer.h>
+#include <circle/logger.h>
+#include <circle/cputhrottle.h>
+#include <circle/usb/usbhcidevice.h>
+#include <SDCard/emmc.h>
+#include <circle/fs/fat/fatfs.h>
+#include <circle/sched/scheduler.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/net/socket.h>
+#include <circle/net/netqueue.h>
+#include <circle/benchmark.h>
+#include <circle/types.h>
+#include "benchsounddevice.h"
+
+// define this to run the TCP benchmark and to send the results to a TCP server
+//#define USE_NETWORK
+
+enum TShutdownMode
+{
+	ShutdownNone,
+	ShutdownHalt,
+	ShutdownReboot
+};
+
+class CKernel
+{
+public:
+	CKernel (void);
+	~CKernel (void);
+
+	boolean Initialize (void);
+
+	TShutdownMode Run (void);
+
+private:
+	void RegisterBenchmarks (void);
+	void WriteResults (void);
+
+	// suites
+	static boolean Memcpy (void *pParam);
+	static boolean Memset (void *pParam);
+	static boolean Heap (void *pParam);
+	static boolean TaskSwitch (void *pParam);
+	static boolean NetQueue (void *pParam);
+	static boolean TCPSend (void *pParam);
+	static boolean FATWrite (void *pParam);
+	static boolean FATRead (void *pParam);
+	static boolean SDRead (void *pParam);
+	static boolean USBRead (void *pParam);
+	static boolean SoundS16 (void *pParam);
+	static boolean SoundFloat (void *pParam);
+	static boolean SoundIEC958 (void *pParam);
+
+	static boolean BlockRead (CDevice *pDevice);
+	static boolean SoundConvert (CBenchSoundDevice *pDevice, const void *pSamples,
+				     unsigned nFrameSize);
+
+	static void FileWriteHandler (const void *pBuffer, size_t nLength, void *pParam);
+#ifdef USE_NETWORK
+	static void SocketWriteHandler (const void *pBuffer, size_t nLength, void *pParam);
+#endif
+
+private:
+	// do not change this order
+	CActLED			m_ActLED;
+	CKernelOptions		m_Options;
+	CDeviceNameService	m_DeviceNameService;
+	CScreenDevice		m_Screen;
+	CSerialDevice		m_Serial;
+	CExceptionHandler	m_ExceptionHandler;
+	CInterruptSystem	m_Interrupt;
+	CTimer			m_Timer;
+	CLogger			m_Logger;
+	CCPUThrottle		m_CPUThrottle;
+	CUSBHCIDevice		m_USBHCI;
+	CEMMCDevice		m_EMMC;
+	CScheduler		m_Scheduler;
+#ifdef USE_NETWORK
+	CNetSubSystem		m_Net;
+	CSocket		       *m_pSocket;
+#endif
+
+	CFATFileSystem		m_FileSystem;
+	boolean			m_bFileSystemMounted;
+
+	CBenchmark		m_Benchmark;
+
+	u8		       *m_pBuffer1;
+	u8		       *m_pBuffer2;
+
+	CNetQueue		m_NetQueue;
+	CDevice		       *m_pUSBStorage;
+
+	CBenchSoundDevice	m_SoundS16;
+	CBenchSoundDevice	m_SoundFloat;
+	CBenchSoundDevice	m_SoundIEC958;
+	s16		       *m_pSamplesS16;
+	float		       *m_pSamplesFloat;
+
+	static CKernel *s_pThis;
+};
+
+#endif
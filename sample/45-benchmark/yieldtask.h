@@ -1,8 +1,8 @@
 //
-// routecache.h
+// yieldtask.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2022  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -17,26 +17,24 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
-#ifndef _circle_net_routecache_h
-#define _circle_net_routecache_h
+#ifndef _yieldtask_h
+#define _yieldtask_h
 
-#include <circle/ptrarray.h>
+#include <circle/sched/task.h>
 #include <circle/types.h>
 
-class CRouteCache
+class CYieldTask : public CTask		// partner task for the task switch benchmark
 {
 public:
-	CRouteCache (void);
-	~CRouteCache (void);
+	CYieldTask (void);
+	~CYieldTask (void);
 
-	void Flush (void);
+	void Run (void);
 
-	void AddRoute (const u8 *pDestIP, const u8 *pGatewayIP);
+	void Stop (void);
 
-	const u8 *GetRoute (const u8 *pDestIP) const;
-
-public:
-	CPtrArray m_Cache;
+private:
+	volatile boolean m_bStop;
 };
 
 #endif
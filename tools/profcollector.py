@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+#
+# profcollector.py
+#
+# Host collector for the sample batches sent by CNetProfiler (addon/profile/)
+#
+# Circle - A C++ bare metal environment for Raspberry Pi
+# Copyright (C) 2022  R. Stange <rsta2@o2online.de>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Usage:
+#
+#	python3 profcollector.py collect [--tcp] [--port 5620] samples.bin
+#		receives batches until Ctrl-C and appends them to samples.bin
+#
+#	python3 profcollector.py fold [--nm aarch64-none-elf-nm] kernel8.elf samples.bin > out.folded
+#		converts the samples to the folded stack format ("core;function count"),
+#		which can be converted to a flame graph with:
+#
+#		flamegraph.pl out.folded > out.svg
+#
+
+import argparse
+import bisect
+import socket
+import struct
+import subprocess
+import sys
+
+HEADER_FORMAT = '<4sHHIIIIQ'		# must match struct TNetProfilerHeader
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+MAGIC = b'CPRF'
+VERSION = 1
+
+CORE_SHIFT = 30
+OFFSET_MASK = (1 << CORE_SHIFT) - 1
+
+def parse_header(data):
+    magic, version, samples, sequence, dropped, period, clock, text_start = \
+        struct.unpack_from(HEADER_FORMAT, data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('invalid batch header')
+    return samples, sequence, dropped, period, clock, text_start
+
+def recv_exact(conn, length):
+    data = b''
+    while len(data) < length:
+        chunk = conn.recv(length - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+def collect(args):
+    out = open(args.output, 'ab')
+    total = 0
+    last_sequence = None
+
+    def store(batch):
+        nonlocal total, last_sequence
+        samples, sequence, dropped, period, clock, text_start = parse_header(batch)
+        if last_sequence is not None and sequence != last_sequence + 1:
+            print('Lost %d batch(es)' % (sequence - last_sequence - 1), file=sys.stderr)
+        last_sequence = sequence
+        out.write(batch[:HEADER_SIZE + samples * 4])
+        out.flush()
+        total += samples
+        print('\r%d samples (%d dropped on target)' % (total, dropped), end='', file=sys.stderr)
+
+    try:
+        if args.tcp:
+            server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            server.bind(('', args.port))
+            server.listen(1)
+            conn, addr = server.accept()
+            print('Connection from %s' % addr[0], file=sys.stderr)
+            while True:
+                header = recv_exact(conn, HEADER_SIZE)
+                if header is None:
+                    break
+                samples = parse_header(header)[0]
+                body = recv_exact(conn, samples * 4)
+                if body is None:
+                    break
+                store(header + body)
+        else:
+            sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            sock.bind(('', args.port))
+            while True:
+                store(sock.recv(65536))
+    except KeyboardInterrupt:
+        pass
+
+    print('', file=sys.stderr)
+    out.close()
+
+def load_symbols(nm, elf):
+    output = subprocess.run([nm, '-n', '-C', '--defined-only', elf],
+                            stdout=subprocess.PIPE, check=True,
+                            universal_newlines=True).stdout
+    addresses = []
+    names = []
+    for line in output.splitlines():
+        fields = line.split(' ', 2)
+        if len(fields) == 3 and fields[1] in 'tTwW':
+            addresses.append(int(fields[0], 16))
+            names.append(fields[2])
+    return addresses, names
+
+def fold(args):
+    addresses, names = load_symbols(args.nm, args.elf)
+
+    data = open(args.samples, 'rb').read()
+    counts = {}
+    pos = 0
+    while pos + HEADER_SIZE <= len(data):
+        samples, sequence, dropped, period, clock, text_start = parse_header(data[pos:])
+        pos += HEADER_SIZE
+        for (word,) in struct.iter_unpack('<I', data[pos:pos + samples * 4]):
+            pc = text_start + ((word & OFFSET_MASK) << 2)
+            i = bisect.bisect_right(addresses, pc) - 1
+            name = names[i] if i >= 0 else '0x%x' % pc
+            key = 'core%u;%s' % (word >> CORE_SHIFT, name)
+            counts[key] = counts.get(key, 0) + 1
+        pos += samples * 4
+
+    for key, count in sorted(counts.items()):
+        print('%s %d' % (key, count))
+
+def main():
+    parser = argparse.ArgumentParser(description='Circle network profiler collector')
+    commands = parser.add_subparsers(dest='command')
+    commands.required = True
+
+    p = commands.add_parser('collect', help='receive sample batches')
+    p.add_argument('--tcp', action='store_true', help='listen for a TCP connection')
+    p.add_argument('--port', type=int, default=5620)
+    p.add_argument('output')
+    p.set_defaults(func=collect)
+
+    p = commands.add_parser('fold', help='convert samples to folded stacks')
+    p.add_argument('--nm', default='aarch64-none-elf-nm', help='nm tool of the toolchain')
+    p.add_argument('elf')
+    p.add_argument('samples')
+    p.set_defaults(func=fold)
+
+    args = parser.parse_args()
+    args.func(args)
+
+if __name__ == '__main__':
+    main()